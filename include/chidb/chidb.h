@@ -21,6 +21,7 @@
  * From the API's perspective's, these are opaque data types. */
 typedef struct chidb_stmt chidb_stmt;
 typedef struct chidb chidb;
+typedef struct chidb_backup chidb_backup;
 
 /* API return codes */
 #define CHIDB_OK (0)
@@ -32,14 +33,121 @@ typedef struct chidb chidb;
 #define CHIDB_EMISMATCH (6)
 #define CHIDB_EIO (7)
 #define CHIDB_EMISUSE (8)
+#define CHIDB_EBUSY (11)
 
 #define CHIDB_ROW (100)
 #define CHIDB_DONE (101)
 
+/* Latency histogram. Bucket i counts operations that took between 2^i
+ * and 2^(i+1)-1 nanoseconds (bucket 0 also counts operations that took
+ * less than a nanosecond, and the last bucket everything above it) */
+#define CHIDB_HIST_NBUCKETS (40)
+
+typedef struct chidb_histogram
+{
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[CHIDB_HIST_NBUCKETS];
+} chidb_histogram;
+
+/* I/O statistics of a database (see chidb_stats_get) */
+typedef struct chidb_stats
+{
+    uint64_t pages_read;      /* Pages read from the file (or the log) */
+    uint64_t pages_written;   /* Pages written to the file (or the log) */
+    uint64_t cache_hits;      /* Page reads served by the buffer pool */
+    uint64_t cache_misses;    /* Page reads that had to access the file */
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t syncs;           /* Calls to fsync/fdatasync */
+    uint64_t stmt_cache_hits;     /* chidb_prepare calls that reused a program */
+    uint64_t stmt_cache_misses;   /* chidb_prepare calls that generated one */
+    uint64_t result_cache_hits;   /* Statements that returned cached rows */
+    uint64_t result_cache_misses; /* Cacheable statements that ran their program */
+
+    chidb_histogram read_latency;
+    chidb_histogram write_latency;
+    chidb_histogram sync_latency;
+} chidb_stats;
+
+/* Executions of an instruction of a profiled statement (see
+ * chidb_profile_start) */
+typedef struct chidb_profile_op
+{
+    const char *opcode;       /* Name of the instruction's opcode */
+    uint64_t count;           /* Times it ran */
+    uint64_t cycles;          /* CPU cycles it took, in all */
+    uint64_t pages;           /* Pages it read, from the buffer pool or not */
+} chidb_profile_op;
+
+/* A column of a chidb_rowbatch. Every row has an entry in each array,
+ * whatever its type: integers are in ints (0 in rows where the value is
+ * not an integer), and text is in data, between offsets[i] and
+ * offsets[i + 1] (no bytes for rows where the value is not text). The
+ * strings are not NUL-terminated. Bit i of nulls (nulls[i / 8] & (1 <<
+ * (i % 8))) is set if the value of row i is NULL, and bit i of texts if
+ * it is text. */
+typedef struct chidb_rowbatch_column
+{
+    int32_t *ints;
+    uint32_t *offsets;        /* nrows + 1 entries */
+    char *data;
+    uint32_t data_size;       /* Bytes allocated for data */
+    uint8_t *nulls;
+    uint8_t *texts;
+} chidb_rowbatch_column;
+
+/* Result rows in columnar form (see chidb_step_batch) */
+typedef struct chidb_rowbatch
+{
+    int nrows;                /* Rows in the batch */
+    int ncols;
+    int capacity;             /* Rows the batch has room for */
+    chidb_rowbatch_column *cols;
+} chidb_rowbatch;
+
+/* Events reported to a trace callback (see chidb_set_trace) */
+#define CHIDB_TRACE_PREPARE    (1 << 0)  /* chidb_prepare, as a whole */
+#define CHIDB_TRACE_PARSE      (1 << 1)  /* Its phases */
+#define CHIDB_TRACE_OPTIMIZE   (1 << 2)
+#define CHIDB_TRACE_CODEGEN    (1 << 3)
+#define CHIDB_TRACE_STEP       (1 << 4)  /* chidb_step */
+#define CHIDB_TRACE_PAGE_READ  (1 << 5)  /* Pages read from the file or the log */
+#define CHIDB_TRACE_PAGE_WRITE (1 << 6)  /* Pages written to them */
+#define CHIDB_TRACE_FSYNC      (1 << 7)
+#define CHIDB_TRACE_SPILL      (1 << 8)  /* Sorted runs written to a temporary file */
+#define CHIDB_TRACE_EVICT      (1 << 9)  /* Pages evicted from the buffer pool */
+#define CHIDB_TRACE_ALL        ((1 << 10) - 1)
+
+#define CHIDB_TRACE_BEGIN (0)
+#define CHIDB_TRACE_END (1)
+
+/* An event reported to a trace callback. Prepares and steps are
+ * reported when they begin and when they end; the other events only
+ * once they are done. */
+typedef struct chidb_trace_event
+{
+    int type;                 /* One of CHIDB_TRACE_* */
+    int phase;                /* CHIDB_TRACE_BEGIN or CHIDB_TRACE_END */
+    uint64_t ns;              /* When it happened (monotonic clock) */
+    uint64_t duration_ns;     /* How long it took (0 when it begins) */
+    const char *sql;          /* SQL being prepared (prepare events) */
+    chidb_stmt *stmt;         /* Statement being stepped, if any */
+    uint32_t npage;           /* Page read, written or evicted (the first of them, for reads of several) */
+    uint64_t bytes;           /* Bytes read, written or spilled */
+    int rc;                   /* Result (when it ends) */
+} chidb_trace_event;
+
+typedef void (*chidb_trace_callback)(chidb *db, const chidb_trace_event *ev);
+
 /* Opens a chidb file.
  *
  * If the file does not exist, it will be created
  *
+ * If file is ":memory:", no file is opened: the database is created in
+ * memory, and goes away when it is closed.
+ *
  * Parameters
  * - file: Filename of the chidb file to open/create
  * - db: Out parameter. Returns a pointer to a chidb struct. The chidb
@@ -59,6 +167,46 @@ typedef struct chidb chidb;
 int chidb_open(const char *file, chidb **db); 
 
 
+/* Flags for chidb_open2 */
+#define CHIDB_OPEN_WAL    (0x01)  /* Use a write-ahead log */
+#define CHIDB_OPEN_DIRECT (0x02)  /* Bypass the OS page cache (O_DIRECT) */
+#define CHIDB_OPEN_MMAP   (0x04)  /* Read pages through a memory mapping */
+#define CHIDB_OPEN_CHECKSUM (0x08)  /* Create the file with page checksums */
+#define CHIDB_OPEN_LINKEDLEAVES (0x10)  /* Create the file with linked table leaves (faster scans) */
+#define CHIDB_OPEN_PACKEDINDEX (0x20)  /* Create the file with packed index cells (more entries per page) */
+#define CHIDB_OPEN_COMPRESS (0x40)  /* Create the file with LZ4-compressed pages (less disk space and I/O) */
+#define CHIDB_OPEN_NORMKEY (0x80)  /* Create the file with 64-bit rowids and normalized index keys (text columns can be indexed) */
+
+/* Opens a chidb file with options.
+ *
+ * Same as chidb_open, but allows choosing the page size of the database
+ * (when it is created), and passing flags that control how the file is
+ * accessed.
+ *
+ * Parameters
+ * - file: Filename of the chidb file to open/create
+ * - db: Out parameter. Returns a pointer to a chidb struct.
+ * - page_size: Page size, in bytes, if the file is created. Must be a
+ *              power of two between 512 and 65536, or 0 for the default
+ *              page size. Ignored if the file already exists.
+ * - flags: Zero or more CHIDB_OPEN_* flags, combined with bitwise OR.
+ *          CHIDB_OPEN_COMPRESS is meant for tables that are written
+ *          once and rarely read, and needs pages of 8192 bytes or more
+ *          to save any space. CHIDB_OPEN_NORMKEY overrides
+ *          CHIDB_OPEN_PACKEDINDEX.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECANTOPEN: Unable to open the database file (or it has
+ *                    compressed pages, and chidb was built without LZ4)
+ * - CHIDB_ECORRUPT: The database file is not well formed
+ * - CHIDB_EMISUSE: Invalid page size
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_open2(const char *file, chidb **db, unsigned int page_size, int flags);
+
+
 /* Prepares a SQL statement for execution
  *
  * Parameters
@@ -90,16 +238,68 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt);
  * results, then CHIDB_DONE is returned (note that this function does
  * not return CHIDB_OK).
  *
+ * Outside a transaction (see chidb_begin), the pages a statement
+ * modified are written to the file (or committed to the write-ahead log)
+ * once it is done.
+ * A query that only reads, outside a transaction, on a database with a
+ * write-ahead log, sees the database as it was when its first
+ * chidb_step was called, whatever other threads commit until it is done.
+ *
+ * The same file can be opened by several processes at once: a statement
+ * that writes waits, on its first chidb_step, until no other process is
+ * writing, and (without a write-ahead log) until no other process is
+ * reading while it writes the file.
+ *
  * Parameters
  * - stmt: Prepared SQL statement
  *
  * Return
  * - CHIDB_ROW: Statement returned a row.
  * - CHIDB_DONE: Statement has finished executing.
+ * - CHIDB_EBUSY: The database is locked by another process
  */
 int chidb_step(chidb_stmt *stmt);
 
 
+/* Resets a prepared SQL statement
+ *
+ * Gets a statement ready to be run again with chidb_step, from the
+ * start, without preparing it again (the SQL is not parsed again, and
+ * its program is not generated again). Values bound to its parameters
+ * are kept, so chidb_bind_* only needs to be called for the ones that
+ * change.
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_reset(chidb_stmt *stmt);
+
+
+/* Binds a value to a parameter of a prepared SQL statement
+ *
+ * Sets the value of a '?' placeholder in the SQL statement (e.g.,
+ * SELECT * FROM t WHERE id = ?), which is NULL until a value is bound
+ * to it. Values must be bound before the statement starts running (or
+ * after chidb_reset). chidb_bind_text copies the string; binding NULL
+ * sets the parameter to NULL.
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - param: Parameter number (the first '?' is 1)
+ * - v: Value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no such parameter
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_bind_int(chidb_stmt *stmt, int param, int v);
+int chidb_bind_text(chidb_stmt *stmt, int param, const char *v);
+
+
 /* Finalizes a SQL statement, freeing all resources associated with it.
  *
  * Parameters
@@ -178,6 +378,478 @@ int chidb_column_int(chidb_stmt *stmt, int col);
 const char *chidb_column_text(chidb_stmt *stmt, int col);
 
 
+/* Allocates a batch for the result rows of a SQL statement
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - batch: Batch to initialize
+ * - capacity: Maximum number of rows in the batch
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: capacity is not positive
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_rowbatch_init(chidb_stmt *stmt, chidb_rowbatch *batch, int capacity);
+
+
+/* Frees the memory of a batch
+ *
+ * Parameters
+ * - batch: Batch initialized with chidb_rowbatch_init
+ */
+void chidb_rowbatch_free(chidb_rowbatch *batch);
+
+
+/* Steps through a prepared SQL statement, several rows at a time
+ *
+ * Like calling chidb_step up to n times, and copying the values of
+ * each result row into the batch (see chidb_rowbatch_column), which
+ * is much cheaper per value than the chidb_column_* functions. The
+ * batch replaces the rows from the previous call; its values stay
+ * valid after the statement moves on. A batch with fewer than n rows
+ * means the statement has finished executing.
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - n: Maximum number of rows (at most the capacity of the batch)
+ * - batch: Batch initialized for this statement with chidb_rowbatch_init
+ *
+ * Return
+ * - CHIDB_ROW: The batch has at least one row
+ * - CHIDB_DONE: Statement has finished executing (the batch is empty)
+ * - CHIDB_EMISUSE: n is larger than the capacity of the batch, or the
+ *                  batch is not for this statement
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Any other error returned by chidb_step
+ */
+int chidb_step_batch(chidb_stmt *stmt, int n, chidb_rowbatch *batch);
+
+
+/* Begins, commits or rolls back a transaction
+ *
+ * Same as running BEGIN, COMMIT or ROLLBACK. Between chidb_begin and
+ * chidb_commit, the pages modified by the statements stay in memory, as
+ * far as the buffer pool has room for them, and are written once, in
+ * file order, at commit. If the database was opened without
+ * CHIDB_OPEN_WAL, the original contents of any page that has to be
+ * written before then are saved in a rollback journal (the file's name
+ * followed by "-journal"), which chidb_rollback, or opening the database
+ * after a crash, copies back into the file. chidb_rollback fails while
+ * a statement is still reading the database (i.e., has returned
+ * CHIDB_ROW and has not been reset or finalized). A transaction that is
+ * still in progress when the database is closed is rolled back.
+ *
+ * Parameters
+ * - db: chidb database
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: chidb_begin was called in a transaction, the others
+ *                  outside of one, or a statement is still reading
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_begin(chidb *db);
+int chidb_commit(chidb *db);
+int chidb_rollback(chidb *db);
+
+
+/* Returns zero while a transaction is in progress (between BEGIN and
+ * COMMIT or ROLLBACK), and non-zero otherwise */
+int chidb_get_autocommit(chidb *db);
+
+
+/* Returns non-zero if a prepared statement doesn't write to the
+ * database. Such statements, on the same database, can be stepped
+ * through by several threads at once (each with its own statements),
+ * as long as none of the statements that write is running.
+ * chidb_prepare and chidb_finalize must still be called by one thread
+ * at a time. */
+int chidb_stmt_readonly(chidb_stmt *stmt);
+
+
+/* Profiles the execution of a statement
+ *
+ * From now on, every time an instruction of the statement runs, its
+ * execution count and the CPU cycles it took (as counted by the
+ * processor's timestamp counter, or in nanoseconds where there isn't
+ * one) are added up, until the statement is finalized. A profiled
+ * statement isn't compiled (see chidb_stmt_exec), so it runs somewhat
+ * slower than it would otherwise.
+ *
+ * Parameters
+ * - stmt: Prepared statement
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_profile_start(chidb_stmt *stmt);
+
+
+/* Returns the profile of a statement
+ *
+ * Parameters
+ * - stmt: Statement profiled with chidb_profile_start
+ * - nops: Out parameter. Number of instructions of the statement.
+ *
+ * Return
+ * - The profile of each instruction, indexed by address (the addr
+ *   column of EXPLAIN), valid until the statement is finalized, or NULL
+ *   if the statement isn't profiled
+ */
+const chidb_profile_op *chidb_profile_get(chidb_stmt *stmt, int *nops);
+
+
+/* Returns the I/O statistics of a database
+ *
+ * Statistics are collected since the database was opened, or since the
+ * last call to chidb_stats_reset.
+ *
+ * Parameters
+ * - db: chidb database
+ * - stats: Out parameter. The statistics are copied here.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_stats_get(chidb *db, chidb_stats *stats);
+
+
+/* Resets the I/O statistics of a database to zero
+ *
+ * Parameters
+ * - db: chidb database
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_stats_reset(chidb *db);
+
+
+/* Sets the temporary memory budget of a database's statements
+ *
+ * The hash tables, sorters and aggregators of a statement, and the
+ * buffer pool of the temporary file of its ephemeral tables, share this
+ * much memory (each gets an even share of it). Past their share, they
+ * spill to temporary files. Statements that are already running keep
+ * the shares they were given.
+ *
+ * Parameters
+ * - db: chidb database
+ * - bytes: Temporary memory of each statement (16 MiB by default)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: bytes is zero
+ */
+int chidb_set_temp_budget(chidb *db, size_t bytes);
+
+
+/* Sets the memory of a database's result cache
+ *
+ * With a result cache, a read-only statement that is run again with
+ * the same parameters (and the same SQL, up to whitespace) returns the
+ * rows it returned the last time, without running, as long as no table
+ * it read has been written to since, by this connection or another one.
+ * The rows of the least recently run statements are evicted to keep
+ * the cache within this much memory, and those of a statement that
+ * returns more rows than fit in it are not cached. Only statements
+ * prepared while the cache is enabled use it.
+ *
+ * Parameters
+ * - db: chidb database
+ * - bytes: Memory of the cached rows, or 0 to disable the cache (the
+ *          default)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_set_result_cache(chidb *db, size_t bytes);
+
+
+/* Sets the number of threads that a database's scans and index builds
+ * run on
+ *
+ * A scan of a whole table that feeds an aggregate splits the table
+ * into ranges of leaves, which that many threads read at once, each
+ * aggregating its own rows, before their partial results are merged.
+ * CREATE INDEX on a table with rows reads and sorts them the same way.
+ * With 1, they run in the thread that steps the statement.
+ *
+ * Parameters
+ * - db: chidb database
+ * - n: Threads, or 0 for one per online processor (the default)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_set_threads(chidb *db, unsigned int n);
+
+
+/* Reports a database's events to a callback
+ *
+ * The callback is called, in the thread where the event happened,
+ * with the events of the types in mask. Page reads of a parallel scan
+ * may be reported from several threads at once. The callback must not
+ * use the database.
+ *
+ * A database that has no callback only pays for a test that the
+ * branch predictor gets right.
+ *
+ * Parameters
+ * - db: chidb database
+ * - callback: Function to call, or NULL to stop tracing
+ * - mask: CHIDB_TRACE_* events to report (CHIDB_TRACE_ALL for all)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_set_trace(chidb *db, chidb_trace_callback callback, unsigned int mask);
+
+
+/* Loads the rows in a text file into an empty table
+ *
+ * Each line of the file is a row, with its values separated by "|". The
+ * first value is the row's integer primary key, and the rows must be
+ * sorted by it. The table's B-Tree is built bottom-up, which is much
+ * faster than inserting the rows one by one.
+ *
+ * Parameters
+ * - db: chidb database
+ * - filename: File with the rows
+ * - root_page: Root page of the table, which must be empty
+ * - nrows: Out parameter. If not NULL, the number of rows read is
+ *          stored here (including the one that caused an error, if any)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECANTOPEN: Could not open the file
+ * - CHIDB_EMISMATCH: A row's first value is not a valid primary key
+ * - CHIDB_EMISUSE: The table is not empty, the rows are not sorted (or
+ *                  two have the same primary key), or a row is too long
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred
+ */
+int chidb_import(chidb *db, const char *filename, unsigned int root_page, unsigned int *nrows);
+
+
+/* Loads the rows in a CSV or TSV file into a table
+ *
+ * Each line of the file is a row, with a value for each column of the
+ * table, in order. Values are separated by commas in ".csv" files (where
+ * a value in double quotes can have commas, newlines, and "" for a
+ * quote), by tabs in ".tsv" files, and by "|" in any other file. Values
+ * of INTEGER columns must be integers, and the first column is the
+ * primary key. Empty values are NULL.
+ *
+ * The rows are loaded in one transaction (or in the current one, if
+ * there is one, where an error leaves the rows loaded before it). If
+ * the table is empty and the rows are sorted by primary key, its B-Tree
+ * is built bottom-up (as with chidb_import), and then its indexes;
+ * otherwise, the rows are inserted one by one. Rows are appended to a
+ * table created WITH (storage = columnar) in new segments, encoded by
+ * column, and such a table can only have INTEGER columns and no
+ * indexes.
+ *
+ * Parameters
+ * - db: chidb database
+ * - filename: File with the rows
+ * - table: Name of the table
+ * - nrows: Out parameter. If not NULL, the number of rows read is
+ *          stored here (including the one that caused an error, if any)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECANTOPEN: Could not open the file
+ * - CHIDB_EINVALIDSQL: There is no such table
+ * - CHIDB_EMISMATCH: A row doesn't have a value for each column, or a
+ *                    value of an INTEGER column is not an integer (or,
+ *                    for the primary key, is NULL or negative), or a
+ *                    columnar table has a column that isn't INTEGER
+ * - CHIDB_ECONSTRAINT: Two rows have the same primary key, or the same
+ *                      value in an indexed column
+ * - CHIDB_EMISUSE: A row is too long, the table has a covering index,
+ *                  or the table is columnar and has an index (or is in
+ *                  a file without overflow pages)
+ * - CHIDB_EBUSY: Another connection is writing to the database
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred
+ */
+int chidb_import_table(chidb *db, const char *filename, const char *table, unsigned int *nrows);
+
+
+/* Builds a zone map of a column of a table
+ *
+ * A zone map keeps the smallest and largest integer value of the column
+ * in each range of primary keys of the table (one per leaf of its
+ * B-Tree when it is built), so that a scan with a condition comparing
+ * the column to a value (WHERE ts > 1000) skips the parts of the table
+ * where no row can pass it (EXPLAIN QUERY PLAN shows USING ZONE MAP).
+ * This pays off on columns that grow with the primary key, such as the
+ * timestamps of rows appended in time order.
+ *
+ * Zone maps are kept in memory, by this connection, until it is closed.
+ * The rows inserted through it widen their ranges, but a change made by
+ * another connection makes the zone maps of the database unusable until
+ * they are built again. Building a zone map again replaces it.
+ *
+ * Parameters
+ * - db: chidb database
+ * - table: Name of the table
+ * - column: Name of the column
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: There is no such table, or no such column in it
+ * - CHIDB_EMISUSE: The table is columnar (its segments have their own
+ *                  zone maps)
+ * - CHIDB_EBUSY: Another connection is writing to the database
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred
+ */
+int chidb_zonemap(chidb *db, const char *table, const char *column);
+
+
+/* Builds a Bloom filter of a table or of an index
+ *
+ * A Bloom filter tells, without reading the B-Tree, that a key is not
+ * in a table (a primary key) or an index (a value of the indexed
+ * column), so that looking up a key that isn't there, as an EXISTS
+ * check or an anti-join mostly does, doesn't have to read the B-Tree
+ * at all. About 1% of the keys that are not there still have to be
+ * looked for.
+ *
+ * The filter is stored in the database file, and is kept up to date by
+ * the rows inserted from then on, by any connection. It is sized for
+ * the rows that the table has when it is built, so it should be built
+ * again once the table has grown a lot (building it again replaces
+ * it). Deleting rows leaves it as it is.
+ *
+ * Parameters
+ * - db: chidb database
+ * - table: Name of the table
+ * - column: Name of an indexed column, for a filter of its index, or
+ *           NULL for a filter of the primary keys of the table
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: There is no such table, or no such column in it
+ * - CHIDB_EMISUSE: The column has no B-Tree index, or the table is
+ *                  columnar
+ * - CHIDB_EBUSY: Another connection is writing to the database
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred
+ */
+int chidb_bloom(chidb *db, const char *table, const char *column);
+
+
+/* Exports the result rows of a SQL statement as an Arrow stream
+ *
+ * Makes out an ArrowArrayStream (the Apache Arrow C stream interface,
+ * see chidb/arrow.h) that steps through the statement with
+ * chidb_step_batch. Each array it returns is a struct array with a
+ * child array per result column, holding up to batch_size rows. Integer
+ * columns are int32 arrays, and text columns utf8 arrays (integers in
+ * them are exported as decimal text); NULL values are null in the
+ * validity bitmaps. The type of a column is known from the first batch
+ * of rows, which is read right away: a column is utf8 if any of the
+ * first rows has text in it (text in later rows of an int32 column makes
+ * get_next fail with EINVAL). The buffers of the arrays are the ones
+ * chidb_step_batch filled in, so values are not copied again.
+ *
+ * The statement must not be stepped through in any other way until the
+ * stream is released, and the stream must be released before the
+ * statement is finalized. Arrays returned by the stream can outlive
+ * both.
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - batch_size: Maximum number of rows in each array
+ * - out: Out parameter. The stream is stored here.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: batch_size is not positive
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Any other error returned by chidb_step
+ */
+struct ArrowArrayStream;
+int chidb_export_arrow(chidb_stmt *stmt, int batch_size, struct ArrowArrayStream *out);
+
+
+/* Starts an online backup of a database
+ *
+ * The pages of the database are copied to file, a few at a time with
+ * chidb_backup_step, while the database keeps being read and written.
+ * With a write-ahead log, the backup is a snapshot of the database as
+ * it was when it started, and never waits for writers, nor makes them
+ * wait. Without one, each step keeps writers out while it copies its
+ * pages, and the backup starts over if the database changes between
+ * two steps. The pages are written to a file named after file (with
+ * "-partial" appended), which is renamed to file by chidb_backup_finish
+ * once every page is copied, so file is never a partial copy.
+ *
+ * Parameters
+ * - db: chidb database
+ * - file: Filename of the copy (replaced if it exists)
+ * - backup: Out parameter. The backup is stored here.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECANTOPEN: Unable to create the copy
+ * - CHIDB_EBUSY: Too many other connections are reading the log
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_backup_init(chidb *db, const char *file, chidb_backup **backup);
+
+/* Copies the next pages of a backup
+ *
+ * Parameters
+ * - backup: Backup started with chidb_backup_init
+ * - npages: Number of pages to copy, or -1 for all of the remaining
+ *           ones. They are read in runs of consecutive pages, each with
+ *           a single read that bypasses the cache of the database.
+ *
+ * Return
+ * - CHIDB_OK: Some pages remain to be copied
+ * - CHIDB_DONE: Every page has been copied
+ * - CHIDB_EBUSY: A transaction is in progress on the database (and the
+ *                database has no write-ahead log)
+ * - CHIDB_ECORRUPT: A page of the database is corrupted
+ * - CHIDB_EIO: An I/O error has occurred when accessing the files
+ */
+int chidb_backup_step(chidb_backup *backup, int npages);
+
+/* Returns the number of pages of a backup that remain to be copied, and
+ * the number of pages in the copy */
+int chidb_backup_remaining(chidb_backup *backup);
+int chidb_backup_pagecount(chidb_backup *backup);
+
+/* Finishes a backup
+ *
+ * If every page has been copied, the copy is synced and renamed to the
+ * filename given to chidb_backup_init. Otherwise, it is deleted.
+ *
+ * Parameters
+ * - backup: Backup started with chidb_backup_init
+ *
+ * Return
+ * - CHIDB_OK: The backup is complete (or was abandoned)
+ * - CHIDB_EIO: An I/O error has occurred when accessing the copy
+ */
+int chidb_backup_finish(chidb_backup *backup);
+
+/* Backs up a database, npages at a time (or all at once, with -1),
+ * sleeping sleep_ms milliseconds between steps, so that the backup
+ * doesn't take all of the I/O bandwidth from the queries. Returns any of
+ * the codes of chidb_backup_init, chidb_backup_step and
+ * chidb_backup_finish (CHIDB_OK once the copy is complete). */
+int chidb_backup_run(chidb *db, const char *file, int npages, unsigned int sleep_ms);
+
+
 /* Closes a chidb database
  *
  * Parameters
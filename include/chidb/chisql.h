@@ -16,4 +16,6 @@ int chisql_parser(const char *sql, chisql_statement_t **stmt);
 
 int chisql_stmt_print(chisql_statement_t *stmt);
 
+void chisql_stmt_free(chisql_statement_t *stmt);
+
 #endif /* CHISQL_H_ */
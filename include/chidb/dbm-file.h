@@ -8,6 +8,8 @@
 #ifndef DBMFILE_H_
 #define DBMFILE_H_
 
+#include <stdio.h>
+#include <stdint.h>
 #include <chidb/chidb.h>
 
 /* Forward declaration */
@@ -20,5 +22,23 @@ int chidb_dbm_file_print_rr(chidb_dbm_file_t *dbmf);
 int chidb_dbm_file_print_program(chidb_dbm_file_t *dbmf);
 int chidb_dbm_file_close(chidb_dbm_file_t *dbmf);
 
+/* Timings of a DBM file (see chidb_dbm_file_bench) */
+typedef struct chidb_dbm_file_bench
+{
+    char *program;          /* Name of the DBM file, without its directory */
+    unsigned int nruns;
+    uint64_t median_ns;     /* Median time of a run (loading the file is not timed) */
+    uint64_t min_ns;        /* Fastest run */
+    uint64_t ninstr;        /* Instructions executed by a run */
+    uint64_t *opcounts;     /* Instructions executed by a run, by opcode */
+    int nopcodes;           /* Entries in opcounts */
+} chidb_dbm_file_bench_t;
+
+int chidb_dbm_file_bench(const char* filename, const char* dbfiledir, const char* genfiledir,
+                         unsigned int nruns, chidb_dbm_file_bench_t *bench);
+int chidb_dbm_file_bench_print(FILE *f, chidb_dbm_file_bench_t *bench);
+int chidb_dbm_file_bench_compare(FILE *f, const char *baseline, chidb_dbm_file_bench_t *bench, double tolerance);
+void chidb_dbm_file_bench_free(chidb_dbm_file_bench_t *bench);
+
 
 #endif /* DBMFILE_H_ */
@@ -27,6 +27,66 @@ typedef enum {
 void chilog_setloglevel(loglevel_t level);
 
 
+/* Compile-time logging level
+ *
+ * Messages above this level are removed by the compiler altogether,
+ * so they cost nothing (not even evaluating their arguments) on hot
+ * paths. Set with ./configure --with-log-level=LEVEL. Defaults to
+ * TRACE, so that every message is available at run time.
+ */
+#ifndef CHILOG_COMPILE_LEVEL
+#define CHILOG_COMPILE_LEVEL TRACE
+#endif
+
+/* Run-time logging level (set with chilog_setloglevel). Checked
+ * inline by the chilog macros so that filtered-out messages don't
+ * pay for a function call and varargs setup. */
+extern loglevel_t __chilog_level;
+
+#define CHILOG_ENABLED(level) ((level) <= CHILOG_COMPILE_LEVEL && (level) <= __chilog_level)
+
+
+/* Log backends */
+typedef enum {
+    CHILOG_BACKEND_STDOUT = 0,  /* Format and print each message immediately (default) */
+    CHILOG_BACKEND_RING   = 1   /* Buffer messages in memory until chilog_flush */
+} chilog_backend_t;
+
+/* Number of messages the ring backend can hold before dropping new ones */
+#define CHILOG_RING_SIZE (4096)
+
+/* Maximum length of a single message in the ring backend (longer
+ * messages are truncated) */
+#define CHILOG_RING_MSGLEN (192)
+
+
+/*
+ * chilog_setbackend - Sets where log messages go
+ *
+ * With CHILOG_BACKEND_RING, logging threads never take a lock or
+ * perform I/O: each message is stored in a lock-free ring buffer,
+ * and printing is deferred until chilog_flush is called (the ring is
+ * also flushed when switching back to stdout, and at exit). If the
+ * ring fills up, new messages are dropped and counted.
+ *
+ * backend: Log backend
+ *
+ * Returns: Nothing.
+ */
+void chilog_setbackend(chilog_backend_t backend);
+
+
+/*
+ * chilog_flush - Print the messages buffered in the ring backend
+ *
+ * Only one thread drains the ring at a time; concurrent callers
+ * return immediately.
+ *
+ * Returns: the number of messages printed.
+ */
+int chilog_flush(void);
+
+
 /*
  * chilog - Print a log message
  *
@@ -38,7 +98,11 @@ void chilog_setloglevel(loglevel_t level);
  *
  * Returns: nothing.
  */
-#define chilog(level, fmt, ...) __chilog(level, __FILE__,  __LINE__, fmt, ##__VA_ARGS__)
+#define chilog(level, fmt, ...) \
+    do { \
+        if (CHILOG_ENABLED(level)) \
+            __chilog(level, __FILE__,  __LINE__, fmt, ##__VA_ARGS__); \
+    } while (0)
 void __chilog(loglevel_t level, char *file, int line, char *fmt, ...);
 
 /*
@@ -52,7 +116,11 @@ void __chilog(loglevel_t level, char *file, int line, char *fmt, ...);
  *
  * Returns: nothing.
  */
-#define chilog_hex(level, data, len) __chilog_hex(level, __FILE__,  __LINE__, data, len)
+#define chilog_hex(level, data, len) \
+    do { \
+        if (CHILOG_ENABLED(level)) \
+            __chilog_hex(level, __FILE__,  __LINE__, data, len); \
+    } while (0)
 void __chilog_hex (loglevel_t level, char *file, int fline, void *data, int len);
 
 
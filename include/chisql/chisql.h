@@ -18,21 +18,35 @@
 #define STMT_SELECT (1)
 #define STMT_INSERT (2)
 #define STMT_DELETE (3)
+#define STMT_ANALYZE (4)
+#define STMT_BEGIN (5)
+#define STMT_COMMIT (6)
+#define STMT_ROLLBACK (7)
+
+/* What EXPLAIN QUERY PLAN and EXPLAIN ANALYZE make of a statement */
+#define PLAN_NONE (0)
+#define PLAN_QUERY (1)      /* The plan the optimizer chose, with its estimates */
+#define PLAN_ANALYZE (2)    /* Same, but running the statement first */
 
 typedef struct chisql_statement
 {
+    chisql_arena_t *arena;  /* Where the statement and its tree are allocated */
     bool explain;
+    uint8_t plan;       /* PLAN_* */
     char *text;
     uint8_t type;
+    uint32_t nparams;   /* Number of '?' placeholders */
     union {
         Create_t *create;
         SRA_t    *select;
         Insert_t *insert;
         Delete_t *delete;
+        char     *analyze;  /* ANALYZE: table to collect statistics on */
     } stmt;
 } chisql_statement_t;
 
 int chisql_parser(const char *sql, chisql_statement_t **stmt);
 int chisql_stmt_print(chisql_statement_t *stmt);
+void chisql_stmt_free(chisql_statement_t *stmt);
 
 #endif /* SQL_TYPES_H_ */
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include "vector.h"
 
 enum query_type {
    SELECT_Q, CREATE_T_Q, CREATE_I_Q, INSERT_Q, DELETE_Q 
@@ -29,16 +30,17 @@ enum data_type {
    TYPE_INT,
    TYPE_DOUBLE,
    TYPE_CHAR,
-   TYPE_TEXT
+   TYPE_TEXT,
+   TYPE_PARAM   /* '?' placeholder, bound when the statement runs */
 };
 
-typedef struct StrList_t {
-   char *str;
-   struct StrList_t *next;
-} StrList_t;
+/* A list of names, in a vector of char*. The list owns the strings. */
+typedef Vector_t StrList_t;
+
+#define StrList_size(list) Vector_size(list)
+#define StrList_get(list, i) ((char *)Vector_get(list, i))
 
 char *typeToString(enum data_type type, char *buf);
-StrList_t *StrList_makeWithNext(const char *str, StrList_t *next);
 StrList_t *StrList_make(char *str);
 StrList_t *StrList_append(StrList_t *list1, StrList_t *list2);
 void StrList_print(StrList_t *list);
@@ -49,4 +51,21 @@ void indent_print(const char *format,...);
 
 void Query_free(Query_t *query);
 
+/* Every node of a statement's tree, and every string in it, is allocated
+ * with chisql_alloc from the statement's arena while chisql_parser runs,
+ * and they are all freed at once by chisql_stmt_free. Code that adds
+ * nodes to a parsed statement can allocate them from its arena too, with
+ * chisql_arena_use. Outside of an arena, chisql_alloc uses calloc. The
+ * *_free functions work on nodes of either kind (chisql_free only frees
+ * nodes that are not in an arena). The arena in use is per thread. */
+typedef struct chisql_arena chisql_arena_t;
+
+chisql_arena_t *chisql_arena_new(void);
+void chisql_arena_destroy(chisql_arena_t *arena);
+chisql_arena_t *chisql_arena_use(chisql_arena_t *arena);
+void *chisql_alloc(size_t size);
+char *chisql_strdup(const char *s);
+char *chisql_strndup(const char *s, size_t n);
+void chisql_free(void *p);
+
 #endif
@@ -25,10 +25,12 @@ typedef struct CondUnary {
    Condition_t *cond;
 } CondUnary;
 
-/* note: we might want to also let CondIn hold SELECT queries. */
+/* expr IN (values_list), or expr IN (select), a query with a single
+   column (values_list is then NULL) */
 typedef struct CondIn {
    Expression_t *expr;
    Literal_t *values_list;
+   struct SRA_s *select;
 } CondIn;
 
 enum CondType {
@@ -63,6 +65,7 @@ Condition_t *And(Condition_t *cond1, Condition_t *cond2);
 Condition_t *Or(Condition_t *cond1, Condition_t *cond2);
 Condition_t *Not(Condition_t *cond);
 Condition_t *In(Expression_t *expr, Literal_t *values_list);
+Condition_t *InSelect(Expression_t *expr, struct SRA_s *select);
 
 void Condition_free(Condition_t *cond);
 void Condition_print(Condition_t *cond);
@@ -4,9 +4,13 @@
 #include "common.h"
 #include "column.h"
 
+/* How the rows of a table are stored: WITH (storage = row | columnar) */
+enum table_storage {STORAGE_ROW, STORAGE_COLUMNAR};
+
 typedef struct Table_s {
    char *name;
    Column_t *columns;
+   enum table_storage storage;
 } Table_t;
 
 enum key_dec_type {KEY_DEC_PRIMARY, KEY_DEC_FOREIGN};
@@ -24,9 +28,14 @@ typedef struct TableReference_s {
    char *table_name, *alias;
 } TableReference_t;
 
+/* How an index is stored: USING btree | hash */
+enum index_method {INDEX_BTREE, INDEX_HASH};
+
 typedef struct Index_s {
    char *name, *table_name, *column_name;
    int unique;
+   StrList_t *include; /* INCLUDE (...): columns stored in a covering index */
+   enum index_method method;
 } Index_t;
 
 enum CreateType { CREATE_TABLE, CREATE_INDEX };
@@ -43,6 +52,7 @@ Table_t *   Table_make(char *name, Column_t *columns, KeyDec_t *decs);
 void        Table_print(Table_t *table);
 void        Table_free(void *table); /* void for generic */
 Table_t *   Table_addKeyDecs(Table_t *table, KeyDec_t *decs);
+Table_t *   Table_setStorage(Table_t *table, const char *storage);
 
 KeyDec_t *  KeyDec_append(KeyDec_t *decs, KeyDec_t *dec);
 KeyDec_t *  ForeignKeyDec(ForeignKeyRef_t fkr);
@@ -53,6 +63,8 @@ void        TableReference_free(TableReference_t *tref);
 
 Index_t *   Index_make(char *name, char *table_name, char *column_name);
 Index_t *   Index_makeUnique(Index_t *idx);
+Index_t *   Index_addInclude(Index_t *idx, StrList_t *columns);
+Index_t *   Index_setMethod(Index_t *idx, const char *method);
 void        Index_print(Index_t *idx);
 void        Index_free(Index_t *idx);
 
@@ -8,10 +8,10 @@
 typedef struct Insert_s {
    char *table_name;
    StrList_t *col_names;
-   Literal_t *values;
+   Vector_t *rows;   /* Literal_t lists, one per row of VALUES (...), (...) */
 } Insert_t;
 
-Insert_t *Insert_make(const char *table_name, StrList_t *opt_col_names, Literal_t *values);
+Insert_t *Insert_make(const char *table_name, StrList_t *opt_col_names, Vector_t *rows);
 void Insert_print(Insert_t *insert);
 void Insert_free(Insert_t *insert);
 
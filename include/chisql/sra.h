@@ -76,6 +76,17 @@ typedef struct SRA_Table_s {
    TableReference_t *ref; /* TableReference_t defined in create.h */
 } SRA_Table_t;
 
+/* How a projection of a single aggregate of a whole table is answered
+ * from the structure of its B-Trees, without reading its rows (chosen by
+ * the optimizer) */
+enum ProjectShortcut {
+   SHORTCUT_NONE,
+   SHORTCUT_COUNT,    /* COUNT(*): add up the cells of the leaves (see Count) */
+   SHORTCUT_MIN,      /* MIN of the primary key or an indexed column: the
+                         first key of the table or index (see MinKey) */
+   SHORTCUT_MAX       /* MAX: its last key (see MaxKey) */
+};
+
 typedef struct SRA_Project_s {
    SRA_t *sra;
    Expression_t *expr_list;
@@ -83,20 +94,82 @@ typedef struct SRA_Project_s {
    int distinct;
    enum OrderBy asc_desc;
    Expression_t *group_by;
+   /* LIMIT and OFFSET: integers or '?' parameters (NULL if absent) */
+   Literal_t *limit, *offset;
+   /* Set by the optimizer when sra can read its table in the order of
+    * order_by, through the index on it (over the seek range of the
+    * selection on the table, or all of it), so rows needn't be sorted */
+   int sorted;
+   /* Set by the optimizer when sra reads its table in the order of
+    * group_by (or of the only column of a DISTINCT), through the index
+    * on it, so that each group can be aggregated as its rows come (a
+    * streaming aggregate) */
+   int grouped;
+   enum ProjectShortcut shortcut;
+   /* Set by the optimizer when sra scans a large table (with no seek
+    * range) to aggregate its rows: the scan runs on several threads,
+    * each aggregating its own rows (see Parallel) */
+   int parallel;
 } SRA_Project_t;
 
 typedef struct SRA_Select_s {
    SRA_t *sra;
    Condition_t *cond;
+   /* Set by the optimizer to read the table through the index on a
+    * column: the conjuncts of cond that bound the range of the index to
+    * read, from seek (NULL for the start of the index) to seek_end (NULL
+    * for its end). Both are the same equality for a lookup, and both are
+    * NULL to scan the table. */
+   Condition_t *seek, *seek_end;
+   /* Set by the optimizer to look up the table in the hash index on a
+    * column (see chidb_catalog_hashIndex) with this equality of cond,
+    * instead of a seek range (seek and seek_end are then NULL) */
+   Condition_t *hash;
+   /* Set by the optimizer to seek the table (or the index on a column),
+    * instead of scanning it, for each value of this IN list of cond on
+    * its primary key (or the indexed column), in order (see SetNext).
+    * seek, seek_end and hash are then NULL. */
+   Condition_t *probe;
+   /* Set by the optimizer when a scan of the table can skip the parts
+    * of it where, according to the zone map of a column (see
+    * chidb_zonemap), no row passes this conjunct of cond, which
+    * compares the column to a value */
+   Condition_t *zone;
 } SRA_Select_t;
 
+/* How a join is run (chosen by the optimizer) */
+enum JoinMethod {
+   JOIN_NESTED_LOOP,  /* Scan sra2 again for each row of sra1 */
+   JOIN_HASH,         /* Build a hash table from sra2, and probe it with
+                         each row of sra1 (see HashOpen) */
+   JOIN_INDEX         /* Seek the index on sra2's column of key for the
+                         rows of sra1, in key order (see SorterOpen) */
+};
+
 typedef struct SRA_Join_s {
    SRA_t *sra1, *sra2;
    JoinCondition_t *opt_cond;
+   enum JoinMethod method;
+   Condition_t *key;  /* Equality of the ON condition between a column of
+                         each input, that a hash or index join is on */
+   /* Set by the optimizer for the hash semi-join of a x IN (SELECT ...)
+    * conjunct (the key, not in opt_cond): the rows of sra1 whose x is
+    * among the rows of sra2, the subquery, each once (see HashOpen) */
+   int semi;
 } SRA_Join_t;
 
+/* How a UNION, INTERSECT or EXCEPT removes duplicates and matches the
+ * rows of its inputs (chosen by the optimizer) */
+enum SetMethod {
+   SET_HASH,          /* Aggregate the rows of both inputs in a hash
+                         table keyed by the whole row (see AggOpen) */
+   SET_MERGE          /* Both inputs come ordered by their only column:
+                         merge them into a streaming aggregator */
+};
+
 typedef struct SRA_Binary_s {
    SRA_t *sra1, *sra2;
+   enum SetMethod method;  /* Not used by NATURAL JOIN */
 } SRA_Binary_t;
 
 struct SRA_s {
@@ -130,6 +203,7 @@ struct JoinCondition_s {
 typedef struct ProjectOption_s {
    Expression_t *order_by, *group_by;
    enum OrderBy asc_desc; /* not used by group by */
+   Literal_t *limit, *offset;
 } ProjectOption_t;
 
 SRA_t *SRATable(TableReference_t *ref);
@@ -150,6 +224,7 @@ SRA_t *SRA_makeDistinct(SRA_t *sra);
 
 ProjectOption_t *OrderBy_make(Expression_t *expr, enum OrderBy o);
 ProjectOption_t *GroupBy_make(Expression_t *expr);
+ProjectOption_t *Limit_make(Literal_t *limit, Literal_t *offset);
 ProjectOption_t *ProjectOption_combine(ProjectOption_t *order_by, 
                                         ProjectOption_t *group_by);
 void ProjectOption_print(ProjectOption_t *sra);
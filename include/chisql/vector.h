@@ -0,0 +1,28 @@
+#ifndef __VECTOR_H_
+#define __VECTOR_H_
+
+/* A growable array of pointers, stored contiguously so that walking it
+ * doesn't chase a pointer per item. The first VECTOR_INLINE items are
+ * kept in the vector itself, so the short lists of a statement (column
+ * names, USING lists...) take a single allocation. Vectors are allocated
+ * with chisql_alloc, so those built while parsing live in the statement's
+ * arena. A NULL vector is an empty one. */
+
+#define VECTOR_INLINE (4)
+
+typedef struct Vector_s {
+   unsigned int size;
+   unsigned int capacity;
+   void **items;
+   void *inline_items[VECTOR_INLINE];
+} Vector_t;
+
+#define Vector_size(v) ((v) ? (v)->size : 0)
+#define Vector_get(v, i) ((v)->items[(i)])
+
+Vector_t *Vector_make(void);
+Vector_t *Vector_push(Vector_t *v, void *item);
+Vector_t *Vector_concat(Vector_t *v1, Vector_t *v2);
+void Vector_free(Vector_t *v);
+
+#endif
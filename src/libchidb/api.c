@@ -42,11 +42,18 @@
 
 
 #include <stdlib.h>
+#include <string.h>
 #include <chidb/chidb.h>
 #include "dbm.h"
 #include "btree.h"
 #include "record.h"
 #include "util.h"
+#include "dbm-cache.h"
+#include "dbm-result.h"
+#include "stats.h"
+#include "catalog.h"
+#include "plan.h"
+#include "probes.h"
 
 /* Implemented in codegen.c */
 int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt);
@@ -60,18 +67,207 @@ int chidb_stmt_optimize(chidb *db,
 
 int chidb_open(const char *file, chidb **db)
 {
+    return chidb_open2(file, db, 0, 0);
+}
+
+int chidb_open2(const char *file, chidb **db, unsigned int page_size, int flags)
+{
+    int rc, pager_flags = 0;
+
+    if (page_size == 0)
+        page_size = DEFAULT_PAGE_SIZE;
+    else if (!PAGE_SIZE_VALID(page_size))
+        return CHIDB_EMISUSE;
+
+    if (flags & CHIDB_OPEN_WAL)
+        pager_flags |= PAGER_WAL;
+    if (flags & CHIDB_OPEN_DIRECT)
+        pager_flags |= PAGER_DIRECT;
+    if (flags & CHIDB_OPEN_MMAP)
+        pager_flags |= PAGER_MMAP;
+    if (flags & CHIDB_OPEN_CHECKSUM)
+        pager_flags |= PAGER_CHECKSUM;
+    if (flags & CHIDB_OPEN_LINKEDLEAVES)
+        pager_flags |= BTREE_LINKEDLEAVES;
+    if (flags & CHIDB_OPEN_PACKEDINDEX)
+        pager_flags |= BTREE_PACKEDINDEX;
+    if (flags & CHIDB_OPEN_COMPRESS)
+        pager_flags |= BTREE_COMPRESSED;
+    if (flags & CHIDB_OPEN_NORMKEY)
+        pager_flags |= BTREE_NORMKEY;
+    if (strcmp(file, ":memory:") == 0)
+        pager_flags |= PAGER_MEMORY;
+
     *db = malloc(sizeof(chidb));
     if (*db == NULL)
         return CHIDB_ENOMEM;
-    chidb_Btree_open(file, *db, &(*db)->bt);
+    rc = chidb_Btree_open2(file, *db, &(*db)->bt, page_size, pager_flags);
+    if (rc != CHIDB_OK)
+    {
+        free(*db);
+        return rc;
+    }
+
+    rc = chidb_dbm_cache_init(&(*db)->stmt_cache);
+    if (rc == CHIDB_OK)
+    {
+        rc = chidb_dbm_result_init(&(*db)->result_cache);
+        if (rc != CHIDB_OK)
+            chidb_dbm_cache_free((*db)->stmt_cache);
+    }
+    if (rc != CHIDB_OK)
+    {
+        chidb_Btree_close((*db)->bt);
+        free(*db);
+        return rc;
+    }
+
+    (*db)->table_stats = NULL;
+    (*db)->temp_budget = DEFAULT_TEMP_BUDGET;
+    (*db)->nthreads = DEFAULT_THREADS;
+
+    /* The schema is parsed once, instead of by every query that needs it */
+    rc = chidb_catalog_init(&(*db)->catalog);
+    if (rc == CHIDB_OK)
+        rc = chidb_catalog_load(*db);
+    if (rc != CHIDB_OK)
+    {
+        chidb_catalog_free((*db)->catalog);
+        chidb_dbm_result_free((*db)->result_cache);
+        chidb_dbm_cache_free((*db)->stmt_cache);
+        chidb_Btree_close((*db)->bt);
+        free(*db);
+        return rc;
+    }
 
     /* Additional initialization code goes here */
     return CHIDB_OK;
 }
 
+int chidb_stats_get(chidb *db, chidb_stats *stats)
+{
+    *stats = db->bt->pager->stats;
+    stats->stmt_cache_hits = db->stmt_cache->hits;
+    stats->stmt_cache_misses = db->stmt_cache->misses;
+    stats->result_cache_hits = db->result_cache->hits;
+    stats->result_cache_misses = db->result_cache->misses;
+
+    return CHIDB_OK;
+}
+
+int chidb_stats_reset(chidb *db)
+{
+    memset(&db->bt->pager->stats, 0, sizeof(chidb_stats));
+    db->stmt_cache->hits = 0;
+    db->stmt_cache->misses = 0;
+    db->result_cache->hits = 0;
+    db->result_cache->misses = 0;
+
+    return CHIDB_OK;
+}
+
+int chidb_set_temp_budget(chidb *db, size_t bytes)
+{
+    if (bytes == 0)
+        return CHIDB_EMISUSE;
+
+    db->temp_budget = bytes;
+    return CHIDB_OK;
+}
+
+int chidb_set_result_cache(chidb *db, size_t bytes)
+{
+    chidb_dbm_result_setmax(db->result_cache, bytes);
+    return CHIDB_OK;
+}
+
+int chidb_set_threads(chidb *db, unsigned int n)
+{
+    db->nthreads = n;
+    return CHIDB_OK;
+}
+
+int chidb_set_trace(chidb *db, chidb_trace_callback callback, unsigned int mask)
+{
+    chidb_tracer *trace = &db->bt->pager->trace;
+
+    /* The mask goes last, so that no event is reported without a callback */
+    trace->db = db;
+    trace->callback = callback;
+    __atomic_store_n(&trace->mask, callback != NULL ? mask & CHIDB_TRACE_ALL : 0, __ATOMIC_RELEASE);
+
+    return CHIDB_OK;
+}
+
+int chidb_begin(chidb *db)
+{
+    return chidb_Btree_begin(db->bt);
+}
+
+int chidb_commit(chidb *db)
+{
+    uint32_t nchanges = chidb_Pager_changes(db->bt->pager);
+    int rc = chidb_Btree_commit(db->bt);
+
+    if (rc == CHIDB_OK)
+        chidb_dbm_result_refresh(db->result_cache, nchanges, chidb_Pager_changes(db->bt->pager));
+
+    return rc;
+}
+
+int chidb_rollback(chidb *db)
+{
+    int rc = chidb_Btree_rollback(db->bt);
+
+    /* Cached programs may refer to tables that no longer exist, and
+     * cached results to rows that no longer exist */
+    if (rc == CHIDB_OK)
+    {
+        chidb_dbm_cache_invalidate(db->stmt_cache);
+        chidb_dbm_result_invalidate(db->result_cache);
+    }
+
+    return rc;
+}
+
+int chidb_get_autocommit(chidb *db)
+{
+    return !chidb_Pager_inTransaction(db->bt->pager);
+}
+
+int chidb_stmt_readonly(chidb_stmt *stmt)
+{
+    return stmt->explain || !chidb_stmt_writes(stmt);
+}
+
+int chidb_profile_start(chidb_stmt *stmt)
+{
+    if (stmt->profile != NULL)
+        return CHIDB_OK;
+
+    stmt->profile = calloc(stmt->endOp > 0 ? stmt->endOp : 1, sizeof(chidb_profile_op));
+    if (stmt->profile == NULL)
+        return CHIDB_ENOMEM;
+
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+        stmt->profile[i].opcode = opcode_to_str(stmt->ops[i].opcode);
+
+    return CHIDB_OK;
+}
+
+const chidb_profile_op *chidb_profile_get(chidb_stmt *stmt, int *nops)
+{
+    *nops = stmt->profile != NULL ? stmt->endOp : 0;
+    return stmt->profile;
+}
+
 int chidb_close(chidb *db)
 {
     chidb_Btree_close(db->bt);
+    chidb_dbm_cache_free(db->stmt_cache);
+    chidb_dbm_result_free(db->result_cache);
+    chidb_catalog_free(db->catalog);
+    chidb_stats_free(db);
     free(db);
 
     /* Additional cleanup code goes here */
@@ -79,10 +275,29 @@ int chidb_close(chidb *db)
     return CHIDB_OK;
 }
 
-int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
+/* Reports the beginning or end of chidb_prepare, or of one of its
+ * phases, and returns when it happened */
+static uint64_t chidb_trace_prepare(chidb *db, int type, int phase, const char *sql,
+                                    uint64_t start, int rc)
+{
+    chidb_trace_event ev = {.type = type, .phase = phase, .sql = sql, .rc = rc};
+
+    chidb_trace_emit(&db->bt->pager->trace, &ev, start);
+    return ev.ns;
+}
+
+#define TRACE_BEGIN(db, type, sql) \
+    (CHIDB_TRACING(&(db)->bt->pager->trace, type) \
+     ? chidb_trace_prepare(db, type, CHIDB_TRACE_BEGIN, sql, 0, CHIDB_OK) : 0)
+#define TRACE_END(db, type, sql, start, rc) \
+    (CHIDB_TRACING(&(db)->bt->pager->trace, type) \
+     ? chidb_trace_prepare(db, type, CHIDB_TRACE_END, sql, start, rc) : 0)
+
+static int chidb_prepare_sql(chidb *db, const char *sql, chidb_stmt **stmt)
 {
     int rc;
     chisql_statement_t *sql_stmt, *sql_stmt_opt;
+    uint64_t start;
 
     *stmt = malloc(sizeof(chidb_stmt));
 
@@ -94,7 +309,21 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
         return rc;
     }
 
+    /* Reuse the program generated for the same SQL, if it's cached */
+    rc = chidb_dbm_cache_get(db->stmt_cache, sql, *stmt);
+    if(rc != CHIDB_ENOTFOUND)
+    {
+        if(rc != CHIDB_OK)
+        {
+            chidb_stmt_free(*stmt);
+            free(*stmt);
+        }
+        return rc;
+    }
+
+    start = TRACE_BEGIN(db, CHIDB_TRACE_PARSE, sql);
     rc = chisql_parser(sql, &sql_stmt);
+    TRACE_END(db, CHIDB_TRACE_PARSE, sql, start, rc);
 
     if(rc != CHIDB_OK)
     {
@@ -102,25 +331,75 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
         return rc;
     }
 
+    start = TRACE_BEGIN(db, CHIDB_TRACE_OPTIMIZE, sql);
     rc = chidb_stmt_optimize((*stmt)->db, sql_stmt, &sql_stmt_opt);
+    TRACE_END(db, CHIDB_TRACE_OPTIMIZE, sql, start, rc);
 
     if(rc != CHIDB_OK)
     {
+        chisql_stmt_free(sql_stmt);
         free(*stmt);
         return rc;
     }
 
-    rc = chidb_stmt_codegen(*stmt, sql_stmt_opt);
+    /* EXPLAIN QUERY PLAN produces the plan instead of running the
+     * statement, and EXPLAIN ANALYZE runs it first (see plan.c) */
+    start = TRACE_BEGIN(db, CHIDB_TRACE_CODEGEN, sql);
+    rc = CHIDB_OK;
+    if(sql_stmt->plan != PLAN_NONE)
+        rc = chidb_plan_build(*stmt, sql_stmt_opt);
+
+    if(rc == CHIDB_OK && sql_stmt->plan == PLAN_QUERY)
+        rc = chidb_plan_codegen(*stmt);
+    else if(rc == CHIDB_OK)
+    {
+        rc = chidb_stmt_codegen(*stmt, sql_stmt_opt);
+        if(rc == CHIDB_OK)
+            rc = chidb_stmt_peephole(*stmt);
+    }
+    if(rc == CHIDB_OK)
+        rc = chidb_stmt_set_nparams(*stmt, sql_stmt->nparams);
+    TRACE_END(db, CHIDB_TRACE_CODEGEN, sql, start, rc);
 
     free(sql_stmt_opt);
 
     (*stmt)->explain = sql_stmt->explain;
 
+    /* The program doesn't refer to the statement's tree */
+    chisql_stmt_free(sql_stmt);
+
+    /* A plan is made of the statistics of the moment */
+    if(rc == CHIDB_OK && (*stmt)->plan == NULL)
+        rc = chidb_dbm_cache_put(db->stmt_cache, sql, *stmt);
+
     return rc;
 }
 
-int chidb_step(chidb_stmt *stmt)
+int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
 {
+    uint64_t start;
+    int rc;
+
+    start = TRACE_BEGIN(db, CHIDB_TRACE_PREPARE, sql);
+    rc = chidb_prepare_sql(db, sql, stmt);
+    if (rc == CHIDB_OK)
+        chidb_dbm_result_prepare(db->result_cache, sql, *stmt);
+    TRACE_END(db, CHIDB_TRACE_PREPARE, sql, start, rc);
+    if (rc == CHIDB_OK)
+        CHIDB_PROBE2(prepare, sql, *stmt);
+
+    return rc;
+}
+
+static int chidb_step_stmt(chidb_stmt *stmt)
+{
+	if(stmt->plan != NULL && stmt->plan->analyze && !stmt->plan->running && !stmt->plan->analyzed)
+	{
+		int rc = chidb_plan_analyze(stmt);
+		if(rc != CHIDB_OK)
+			return rc;
+	}
+
 	if(stmt->explain)
 	{
 		if(stmt->pc == stmt->endOp)
@@ -132,7 +411,99 @@ int chidb_step(chidb_stmt *stmt)
 		}
 	}
 	else
-		return chidb_stmt_exec(stmt);
+	{
+		Pager *pager = stmt->db->bt->pager;
+		uint32_t nchanges = chidb_Pager_changes(pager);
+		bool writes = stmt->pc == 0 && stmt->result_sql == NULL && chidb_stmt_writes(stmt);
+		int rc;
+
+		/* A read-only statement returns the rows it returned the last
+		 * time it ran with the same parameters, if they are cached and
+		 * nothing it read has changed since (see dbm-result.c) */
+		if(stmt->result_sql != NULL && stmt->pc == 0 && stmt->result == NULL)
+			chidb_dbm_result_begin(stmt->db->result_cache, stmt, nchanges);
+		if(stmt->result != NULL && stmt->result->complete)
+			return chidb_dbm_result_next(stmt);
+
+		rc = chidb_stmt_exec(stmt);
+		if(stmt->result != NULL)
+			chidb_dbm_result_record(stmt->db->result_cache, stmt, rc, chidb_Pager_changes(pager));
+
+		/* Outside a transaction, each statement commits its own writes.
+		 * Those that write run in a transaction of their own, which
+		 * chidb_stmt_exec commits, or rolls back if they fail, so that
+		 * nothing is left dirty for the next one to commit */
+		if(rc == CHIDB_DONE && !chidb_Pager_inTransaction(pager))
+		{
+			int flush = chidb_Pager_flush(pager);
+			if(flush != CHIDB_OK)
+				return flush;
+		}
+
+		/* Which only make the cached results of the tables it wrote stale */
+		if(writes && rc != CHIDB_ROW)
+			chidb_dbm_result_refresh(stmt->db->result_cache, nchanges, chidb_Pager_changes(pager));
+
+		return rc;
+	}
+}
+
+int chidb_step(chidb_stmt *stmt)
+{
+	chidb_tracer *trace = &stmt->db->bt->pager->trace;
+	chidb_stmt *outer;
+	uint64_t start = 0;
+	int rc;
+
+	if(!CHIDB_TRACING(trace, CHIDB_TRACE_ALL))
+		return chidb_step_stmt(stmt);
+
+	/* The statement's page reads, writes and spills are reported as its
+	 * own (EXPLAIN ANALYZE steps a statement within another) */
+	outer = trace->stmt;
+	trace->stmt = stmt;
+	if(CHIDB_TRACING(trace, CHIDB_TRACE_STEP))
+	{
+		chidb_trace_event ev = {.type = CHIDB_TRACE_STEP, .phase = CHIDB_TRACE_BEGIN};
+		chidb_trace_emit(trace, &ev, 0);
+		start = ev.ns;
+	}
+
+	rc = chidb_step_stmt(stmt);
+
+	if(CHIDB_TRACING(trace, CHIDB_TRACE_STEP))
+	{
+		chidb_trace_event ev = {.type = CHIDB_TRACE_STEP, .phase = CHIDB_TRACE_END, .rc = rc};
+		chidb_trace_emit(trace, &ev, start);
+	}
+	trace->stmt = outer;
+
+	return rc;
+}
+
+int chidb_reset(chidb_stmt *stmt)
+{
+    return chidb_stmt_reset(stmt);
+}
+
+int chidb_bind_int(chidb_stmt *stmt, int param, int v)
+{
+    chidb_dbm_register_t r = {.type = REG_INT32, .value.i = v};
+
+    if(param < 1)
+        return CHIDB_EMISUSE;
+
+    return chidb_stmt_set_param(stmt, param - 1, &r);
+}
+
+int chidb_bind_text(chidb_stmt *stmt, int param, const char *v)
+{
+    chidb_dbm_register_t r = {.type = REG_STRING, .value.s = (char *) v};
+
+    if(param < 1)
+        return CHIDB_EMISUSE;
+
+    return chidb_stmt_set_param(stmt, param - 1, v == NULL ? NULL : &r);
 }
 
 int chidb_finalize(chidb_stmt *stmt)
@@ -144,6 +515,8 @@ int chidb_column_count(chidb_stmt *stmt)
 {
 	if(stmt->explain)
 		return 6;
+	else if(stmt->plan != NULL && !stmt->plan->running)
+		return chidb_plan_ncols(stmt->plan);
 	else
 		return stmt->nCols;
 }
@@ -194,7 +567,7 @@ int chidb_column_type(chidb_stmt *stmt, int col)
 				return SQL_INTEGER_4BYTE;
 				break;
 			case REG_STRING:
-				return 2 * strlen(r->value.s) + SQL_TEXT;
+				return 2 * chidb_dbm_reg_strlen(r) + SQL_TEXT;
 				break;
 			default:
 				return SQL_NOTVALID;
@@ -225,6 +598,8 @@ const char *chidb_column_name(chidb_stmt* stmt, int col)
 			return NULL;
 		}
 	}
+	else if(stmt->plan != NULL && !stmt->plan->running)
+		return chidb_plan_colname(stmt->plan, col);
 	else
 	{
 		if(col < 0 || col >= stmt->nCols)
@@ -324,8 +699,164 @@ const char *chidb_column_text(chidb_stmt *stmt, int col)
 			}
 			else
 			{
-				return r->value.s;
+				/* Strings in pages are not NUL-terminated, and the page
+				 * may be unpinned before the caller is done with it */
+				if(r->storage == REG_BORROWED_PAGE &&
+				   chidb_dbm_reg_set_string(r, r->value.s, r->len, REG_OWNED) != CHIDB_OK)
+					return NULL;
+
+				return chidb_dbm_reg_str(r);
 			}
 		}
 	}
 }
+
+int chidb_rowbatch_init(chidb_stmt *stmt, chidb_rowbatch *batch, int capacity)
+{
+    batch->nrows = 0;
+    batch->ncols = chidb_column_count(stmt);
+    batch->capacity = capacity;
+    batch->cols = NULL;
+
+    if(capacity <= 0)
+        return CHIDB_EMISUSE;
+
+    batch->cols = calloc(batch->ncols, sizeof(chidb_rowbatch_column));
+    if(batch->cols == NULL && batch->ncols > 0)
+        return CHIDB_ENOMEM;
+
+    for(int i = 0; i < batch->ncols; i++)
+    {
+        chidb_rowbatch_column *col = &batch->cols[i];
+
+        col->ints = malloc(capacity * sizeof(int32_t));
+        col->offsets = malloc((capacity + 1) * sizeof(uint32_t));
+        col->nulls = malloc((capacity + 7) / 8);
+        col->texts = malloc((capacity + 7) / 8);
+        if(col->ints == NULL || col->offsets == NULL || col->nulls == NULL || col->texts == NULL)
+        {
+            chidb_rowbatch_free(batch);
+            return CHIDB_ENOMEM;
+        }
+        col->offsets[0] = 0;
+    }
+
+    return CHIDB_OK;
+}
+
+void chidb_rowbatch_free(chidb_rowbatch *batch)
+{
+    for(int i = 0; batch->cols != NULL && i < batch->ncols; i++)
+    {
+        free(batch->cols[i].ints);
+        free(batch->cols[i].offsets);
+        free(batch->cols[i].data);
+        free(batch->cols[i].nulls);
+        free(batch->cols[i].texts);
+    }
+    free(batch->cols);
+    batch->cols = NULL;
+    batch->nrows = 0;
+}
+
+/* Appends text to row nrow of a batch column (offsets[nrow] is set) */
+static int chidb_rowbatch_text(chidb_rowbatch_column *col, int nrow, const char *s, uint32_t len)
+{
+    uint32_t end = col->offsets[nrow] + len;
+
+    if(end > col->data_size)
+    {
+        uint32_t size = col->data_size == 0 ? 1024 : col->data_size;
+        char *data;
+
+        while(size < end)
+            size *= 2;
+        data = realloc(col->data, size);
+        if(data == NULL)
+            return CHIDB_ENOMEM;
+        col->data = data;
+        col->data_size = size;
+    }
+    memcpy(col->data + col->offsets[nrow], s, len);
+    col->offsets[nrow + 1] = end;
+
+    return CHIDB_OK;
+}
+
+/* Copies the current result row of a statement into row nrow of a batch */
+static int chidb_rowbatch_append(chidb_stmt *stmt, chidb_rowbatch *batch, int nrow)
+{
+    for(int i = 0; i < batch->ncols; i++)
+    {
+        chidb_rowbatch_column *col = &batch->cols[i];
+        uint8_t bit = 1 << (nrow % 8);
+        int type;
+
+        if(nrow % 8 == 0)
+            col->nulls[nrow / 8] = col->texts[nrow / 8] = 0;
+        col->ints[nrow] = 0;
+        col->offsets[nrow + 1] = col->offsets[nrow];
+
+        if(stmt->explain)
+        {
+            /* EXPLAIN rows are not in registers */
+            type = chidb_column_type(stmt, i);
+            if(type == SQL_NULL)
+                col->nulls[nrow / 8] |= bit;
+            else if(type >= SQL_TEXT)
+            {
+                const char *s = chidb_column_text(stmt, i);
+
+                col->texts[nrow / 8] |= bit;
+                if(chidb_rowbatch_text(col, nrow, s, strlen(s)) != CHIDB_OK)
+                    return CHIDB_ENOMEM;
+            }
+            else
+                col->ints[nrow] = chidb_column_int(stmt, i);
+            continue;
+        }
+
+        /* The registers are read directly: the column is known to exist */
+        chidb_dbm_register_t *r = &stmt->reg[stmt->startRR + i];
+
+        switch(r->type)
+        {
+        case REG_NULL:
+            col->nulls[nrow / 8] |= bit;
+            break;
+        case REG_INT32:
+            col->ints[nrow] = r->value.i;
+            break;
+        case REG_STRING:
+            col->texts[nrow / 8] |= bit;
+            if(chidb_rowbatch_text(col, nrow, chidb_dbm_reg_str(r), chidb_dbm_reg_strlen(r)) != CHIDB_OK)
+                return CHIDB_ENOMEM;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return CHIDB_OK;
+}
+
+int chidb_step_batch(chidb_stmt *stmt, int n, chidb_rowbatch *batch)
+{
+    int rc = CHIDB_ROW;
+
+    if(n > batch->capacity || batch->ncols != chidb_column_count(stmt))
+        return CHIDB_EMISUSE;
+
+    batch->nrows = 0;
+    while(batch->nrows < n && (rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        if(chidb_rowbatch_append(stmt, batch, batch->nrows) != CHIDB_OK)
+            return CHIDB_ENOMEM;
+        batch->nrows++;
+    }
+
+    if(rc != CHIDB_ROW && rc != CHIDB_DONE)
+        return rc;
+
+    return batch->nrows > 0 ? CHIDB_ROW : CHIDB_DONE;
+}
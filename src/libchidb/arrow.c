@@ -0,0 +1,407 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module exports the result rows of a statement as an Apache Arrow
+ * stream (see chidb_export_arrow), through the Arrow C data interface,
+ * so that no Arrow library is needed.
+ *
+ * Each array of the stream comes from a batch filled in by
+ * chidb_step_batch: the buffers of the batch (integers, text offsets and
+ * text) are handed over to the arrays, which free them when they are
+ * released. Only the validity bitmaps are built here, since chidb's
+ * batches have NULL bitmaps (a set bit is a NULL) and Arrow's have
+ * validity bitmaps (a set bit is a value).
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chidb/chidb.h>
+#include <chidb/arrow.h>
+
+
+/* State of a stream */
+typedef struct chidb_arrow_stream
+{
+    chidb_stmt *stmt;
+    int batch_size;
+    int ncols;
+    bool *text;                 /* Whether each column is utf8 (or int32) */
+    chidb_rowbatch first;       /* First batch, until get_next returns it */
+    bool pending;               /* first has not been returned yet */
+    char error[128];
+} chidb_arrow_stream;
+
+
+static int chidb_arrow_error(chidb_arrow_stream *st, int err, const char *msg, int rc)
+{
+    snprintf(st->error, sizeof(st->error), "%s (chidb error %d)", msg, rc);
+    return err;
+}
+
+
+/* Schemas */
+
+static void chidb_arrow_release_field(struct ArrowSchema *schema)
+{
+    free((void *) schema->name);
+    schema->release = NULL;
+}
+
+static void chidb_arrow_release_schema(struct ArrowSchema *schema)
+{
+    for(int64_t i = 0; i < schema->n_children; i++)
+        if(schema->children[i]->release != NULL)
+            schema->children[i]->release(schema->children[i]);
+    free(schema->private_data);
+    free(schema->children);
+    schema->release = NULL;
+}
+
+static int chidb_arrow_get_schema(struct ArrowArrayStream *stream, struct ArrowSchema *out)
+{
+    chidb_arrow_stream *st = stream->private_data;
+    struct ArrowSchema *fields;
+
+    memset(out, 0, sizeof(*out));
+    out->format = "+s";
+    out->name = "";
+    out->n_children = st->ncols;
+    out->release = chidb_arrow_release_schema;
+
+    /* The fields are freed along with the schema (private_data) */
+    fields = calloc(st->ncols, sizeof(struct ArrowSchema));
+    out->children = calloc(st->ncols, sizeof(struct ArrowSchema *));
+    out->private_data = fields;
+    if(st->ncols > 0 && (fields == NULL || out->children == NULL))
+    {
+        out->n_children = 0;
+        chidb_arrow_release_schema(out);
+        return chidb_arrow_error(st, ENOMEM, "Could not allocate the schema", CHIDB_ENOMEM);
+    }
+
+    for(int i = 0; i < st->ncols; i++)
+    {
+        const char *name = chidb_column_name(st->stmt, i);
+
+        fields[i].format = st->text[i] ? "u" : "i";
+        fields[i].name = strdup(name != NULL ? name : "");
+        fields[i].flags = ARROW_FLAG_NULLABLE;
+        fields[i].release = chidb_arrow_release_field;
+        out->children[i] = &fields[i];
+        if(fields[i].name == NULL)
+        {
+            chidb_arrow_release_schema(out);
+            return chidb_arrow_error(st, ENOMEM, "Could not allocate the schema", CHIDB_ENOMEM);
+        }
+    }
+
+    return 0;
+}
+
+
+/* Arrays. A column array owns its buffers, so that it can be moved out
+ * of the struct array and released on its own. */
+
+static void chidb_arrow_release_column(struct ArrowArray *array)
+{
+    for(int64_t i = 0; i < array->n_buffers; i++)
+        free((void *) array->buffers[i]);
+    free(array->buffers);
+    array->release = NULL;
+}
+
+static void chidb_arrow_release_batch(struct ArrowArray *array)
+{
+    for(int64_t i = 0; i < array->n_children; i++)
+        if(array->children[i]->release != NULL)
+            array->children[i]->release(array->children[i]);
+    free(array->private_data);
+    free(array->children);
+    free(array->buffers);
+    array->release = NULL;
+}
+
+/* Text of a utf8 column where some rows are integers: the integers are
+ * written as decimal text, in new offsets and data buffers */
+static int chidb_arrow_itoa(chidb_rowbatch_column *col, int nrows, uint32_t **offsets, char **data)
+{
+    uint32_t size = col->offsets[nrows] + nrows * 12 + 1;
+
+    *offsets = malloc((nrows + 1) * sizeof(uint32_t));
+    *data = malloc(size);
+    if(*offsets == NULL || *data == NULL)
+    {
+        free(*offsets);
+        free(*data);
+        return CHIDB_ENOMEM;
+    }
+
+    (*offsets)[0] = 0;
+    for(int i = 0; i < nrows; i++)
+    {
+        uint32_t end = (*offsets)[i];
+        uint8_t bit = 1 << (i % 8);
+
+        if(col->texts[i / 8] & bit)
+        {
+            memcpy(*data + end, col->data + col->offsets[i], col->offsets[i + 1] - col->offsets[i]);
+            end += col->offsets[i + 1] - col->offsets[i];
+        }
+        else if(!(col->nulls[i / 8] & bit))
+            end += sprintf(*data + end, "%d", col->ints[i]);
+        (*offsets)[i + 1] = end;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Makes the array of a column, taking over the buffers of the batch */
+static int chidb_arrow_column(chidb_arrow_stream *st, chidb_rowbatch_column *col, bool text, int nrows,
+                              struct ArrowArray *out)
+{
+    int nbytes = (nrows + 7) / 8;
+    uint8_t *validity;
+    bool ints = false, texts = false;
+    int64_t nulls = 0;
+
+    validity = malloc(nbytes > 0 ? nbytes : 1);
+    out->buffers = calloc(3, sizeof(void *));
+    if(validity == NULL || out->buffers == NULL)
+    {
+        free(validity);
+        free(out->buffers);
+        return chidb_arrow_error(st, ENOMEM, "Could not allocate an array", CHIDB_ENOMEM);
+    }
+
+    for(int i = 0; i < nbytes; i++)
+    {
+        /* Bits past the last row are not defined in the batch */
+        uint8_t mask = (i == nbytes - 1 && nrows % 8) ? (1 << (nrows % 8)) - 1 : 0xFF;
+        uint8_t n = col->nulls[i] & mask;
+
+        validity[i] = ~n & mask;
+        nulls += __builtin_popcount(n);
+        texts |= (col->texts[i] & mask) != 0;
+        ints |= (~(col->nulls[i] | col->texts[i]) & mask) != 0;
+    }
+
+    out->length = nrows;
+    out->null_count = nulls;
+    out->release = chidb_arrow_release_column;
+    out->buffers[0] = validity;
+
+    if(!text)
+    {
+        out->n_buffers = 2;
+        if(texts)
+        {
+            chidb_arrow_release_column(out);
+            return chidb_arrow_error(st, EINVAL, "Text in an integer column", CHIDB_EMISMATCH);
+        }
+        out->buffers[1] = col->ints;
+        col->ints = NULL;
+        return 0;
+    }
+
+    out->n_buffers = 3;
+    if(ints)
+    {
+        uint32_t *offsets;
+        char *data;
+
+        if(chidb_arrow_itoa(col, nrows, &offsets, &data) != CHIDB_OK)
+        {
+            chidb_arrow_release_column(out);
+            return chidb_arrow_error(st, ENOMEM, "Could not allocate an array", CHIDB_ENOMEM);
+        }
+        out->buffers[1] = offsets;
+        out->buffers[2] = data;
+    }
+    else
+    {
+        /* Arrow wants a data buffer even if all strings are empty */
+        if(col->data == NULL && (col->data = malloc(1)) == NULL)
+        {
+            chidb_arrow_release_column(out);
+            return chidb_arrow_error(st, ENOMEM, "Could not allocate an array", CHIDB_ENOMEM);
+        }
+        out->buffers[1] = col->offsets;
+        out->buffers[2] = col->data;
+        col->offsets = NULL;
+        col->data = NULL;
+    }
+
+    /* utf8 offsets are signed 32-bit integers */
+    if(((uint32_t *) out->buffers[1])[nrows] > INT32_MAX)
+    {
+        chidb_arrow_release_column(out);
+        return chidb_arrow_error(st, EOVERFLOW, "Too much text in a batch", CHIDB_EMISUSE);
+    }
+
+    return 0;
+}
+
+static int chidb_arrow_get_next(struct ArrowArrayStream *stream, struct ArrowArray *out)
+{
+    chidb_arrow_stream *st = stream->private_data;
+    chidb_rowbatch batch;
+    struct ArrowArray *columns;
+    int rc, err = 0;
+
+    memset(out, 0, sizeof(*out));
+
+    if(st->pending)
+    {
+        batch = st->first;
+        st->pending = false;
+    }
+    else
+    {
+        rc = chidb_rowbatch_init(st->stmt, &batch, st->batch_size);
+        if(rc == CHIDB_OK)
+            rc = chidb_step_batch(st->stmt, st->batch_size, &batch);
+        if(rc != CHIDB_ROW && rc != CHIDB_DONE)
+        {
+            chidb_rowbatch_free(&batch);
+            return chidb_arrow_error(st, rc == CHIDB_ENOMEM ? ENOMEM : EIO, "Could not step through the statement", rc);
+        }
+    }
+
+    /* End of the stream */
+    if(batch.nrows == 0)
+    {
+        chidb_rowbatch_free(&batch);
+        return 0;
+    }
+
+    out->length = batch.nrows;
+    out->n_buffers = 1;
+    out->n_children = batch.ncols;
+    out->release = chidb_arrow_release_batch;
+    out->buffers = calloc(1, sizeof(void *));
+    out->children = calloc(batch.ncols, sizeof(struct ArrowArray *));
+    columns = calloc(batch.ncols, sizeof(struct ArrowArray));
+    out->private_data = columns;
+    if(out->buffers == NULL || (batch.ncols > 0 && (out->children == NULL || columns == NULL)))
+    {
+        out->n_children = 0;
+        err = chidb_arrow_error(st, ENOMEM, "Could not allocate an array", CHIDB_ENOMEM);
+    }
+
+    for(int i = 0; i < batch.ncols && err == 0; i++)
+    {
+        out->children[i] = &columns[i];
+        err = chidb_arrow_column(st, &batch.cols[i], st->text[i], batch.nrows, &columns[i]);
+    }
+
+    /* The buffers that were not taken over by the arrays */
+    chidb_rowbatch_free(&batch);
+
+    if(err != 0)
+    {
+        chidb_arrow_release_batch(out);
+        return err;
+    }
+
+    return 0;
+}
+
+static const char *chidb_arrow_get_last_error(struct ArrowArrayStream *stream)
+{
+    chidb_arrow_stream *st = stream->private_data;
+
+    return st->error[0] != '\0' ? st->error : NULL;
+}
+
+static void chidb_arrow_release_stream(struct ArrowArrayStream *stream)
+{
+    chidb_arrow_stream *st = stream->private_data;
+
+    if(st->pending)
+        chidb_rowbatch_free(&st->first);
+    free(st->text);
+    free(st);
+    stream->release = NULL;
+}
+
+
+int chidb_export_arrow(chidb_stmt *stmt, int batch_size, struct ArrowArrayStream *out)
+{
+    chidb_arrow_stream *st;
+    int rc;
+
+    if(batch_size <= 0)
+        return CHIDB_EMISUSE;
+
+    st = calloc(1, sizeof(chidb_arrow_stream));
+    if(st == NULL)
+        return CHIDB_ENOMEM;
+    st->stmt = stmt;
+    st->batch_size = batch_size;
+    st->ncols = chidb_column_count(stmt);
+
+    /* The first batch tells the types of the columns */
+    rc = chidb_rowbatch_init(stmt, &st->first, batch_size);
+    if(rc == CHIDB_OK)
+        rc = chidb_step_batch(stmt, batch_size, &st->first);
+    st->text = calloc(st->ncols > 0 ? st->ncols : 1, sizeof(bool));
+    if(rc == CHIDB_OK || rc == CHIDB_ROW || rc == CHIDB_DONE)
+        rc = st->text == NULL ? CHIDB_ENOMEM : CHIDB_OK;
+    if(rc != CHIDB_OK)
+    {
+        chidb_rowbatch_free(&st->first);
+        free(st->text);
+        free(st);
+        return rc;
+    }
+    st->pending = true;
+
+    for(int i = 0; i < st->ncols; i++)
+        for(int j = 0; j < (st->first.nrows + 7) / 8 && !st->text[i]; j++)
+            st->text[i] = st->first.cols[i].texts[j] != 0;
+
+    out->get_schema = chidb_arrow_get_schema;
+    out->get_next = chidb_arrow_get_next;
+    out->get_last_error = chidb_arrow_get_last_error;
+    out->release = chidb_arrow_release_stream;
+    out->private_data = st;
+
+    return CHIDB_OK;
+}
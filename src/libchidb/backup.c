@@ -0,0 +1,289 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module copies a database to another file while it is in use
+ * (see chidb_backup_init). The pages are copied in the order they are
+ * in the file, in runs that are read with chidb_Pager_readPages, which
+ * bypasses the buffer pool, and written to the copy with a single write
+ * each.
+ *
+ * With a write-ahead log, the backup reads a snapshot of the database
+ * (see chidb_Pager_beginSnapshot) from the first step to the last one.
+ * Without one, there is no older version of a page to read once it has
+ * been overwritten, so each step reads the database like a statement
+ * does (see chidb_Pager_beginRead), and the copy is started over when
+ * chidb_Pager_changes tells that the database changed since it started.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chidb/chidb.h>
+#include "btree.h"
+#include "pager.h"
+
+/* Most pages read (and written) at once */
+#define BACKUP_RUN_PAGES (256)
+
+struct chidb_backup
+{
+    chidb *db;
+    char *filename;           /* Name of the copy */
+    char *partial;            /* Name of the copy until it is complete */
+    int fd;                   /* The partial copy */
+    PagerSnapshot *snapshot;  /* Snapshot being copied (only with a write-ahead log) */
+    uint32_t nchanges;        /* chidb_Pager_changes when the copy (re)started */
+    npage_t npages;           /* Pages in the database being copied */
+    npage_t next;             /* Next page to copy */
+    uint8_t *buf;             /* BACKUP_RUN_PAGES pages */
+};
+
+
+/* Starts the copy over, if the database changed since it started (only
+ * without a snapshot, with chidb_Pager_beginRead in effect) */
+static void chidb_backup_restart(chidb_backup *backup)
+{
+    Pager *pager = backup->db->bt->pager;
+    uint32_t nchanges = chidb_Pager_changes(pager);
+
+    if (nchanges == backup->nchanges)
+        return;
+
+    chidb_Pager_getRealDBSize(pager, &backup->npages);
+    backup->nchanges = nchanges;
+    backup->next = 1;
+}
+
+
+/* Writes n bytes at offset, retrying short writes */
+static int chidb_backup_write(int fd, const uint8_t *buf, size_t n, off_t offset)
+{
+    size_t done = 0;
+
+    while (done < n)
+    {
+        ssize_t count = pwrite(fd, buf + done, n - done, offset + done);
+
+        if (count == -1 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return CHIDB_EIO;
+        done += count;
+    }
+
+    return CHIDB_OK;
+}
+
+
+int chidb_backup_init(chidb *db, const char *file, chidb_backup **backup)
+{
+    Pager *pager;
+    chidb_backup *b;
+    int rc;
+
+    if (db == NULL || db->bt == NULL)
+        return CHIDB_EMISUSE;
+    pager = db->bt->pager;
+
+    b = calloc(1, sizeof(chidb_backup));
+    if (b == NULL)
+        return CHIDB_ENOMEM;
+    b->db = db;
+    b->fd = -1;
+    b->next = 1;
+
+    /* With O_DIRECT, pages can only be read into aligned memory */
+    b->filename = strdup(file);
+    if (b->filename == NULL || asprintf(&b->partial, "%s-partial", file) < 0)
+        b->partial = NULL;
+    if (b->partial == NULL
+        || posix_memalign((void **) &b->buf, PAGER_BUF_ALIGN, (size_t) BACKUP_RUN_PAGES * pager->page_size) != 0)
+    {
+        free(b->partial);
+        free(b->filename);
+        free(b);
+        return CHIDB_ENOMEM;
+    }
+
+    if (pager->wal != NULL)
+    {
+        rc = chidb_Pager_beginSnapshot(pager, &b->snapshot);
+        if (rc != CHIDB_OK)
+        {
+            free(b->buf);
+            free(b->partial);
+            free(b->filename);
+            free(b);
+            return rc;
+        }
+        b->npages = b->snapshot->n_pages;
+    }
+    /* The first step starts the copy */
+    else
+        b->nchanges = chidb_Pager_changes(pager) - 1;
+
+    b->fd = open(b->partial, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (b->fd == -1)
+    {
+        if (b->snapshot != NULL)
+            chidb_Pager_endSnapshot(pager, b->snapshot);
+        free(b->buf);
+        free(b->partial);
+        free(b->filename);
+        free(b);
+        return CHIDB_ECANTOPEN;
+    }
+
+    *backup = b;
+
+    return CHIDB_OK;
+}
+
+
+int chidb_backup_step(chidb_backup *backup, int npages)
+{
+    Pager *pager = backup->db->bt->pager;
+    PagerSnapshot *prev = NULL;
+    npage_t last;
+    int rc = CHIDB_OK;
+
+    if (backup->snapshot != NULL)
+        prev = chidb_Pager_useSnapshot(backup->snapshot);
+    else
+    {
+        /* A transaction may have written pages that it hasn't committed */
+        if (chidb_Pager_inTransaction(pager))
+            return CHIDB_EBUSY;
+
+        rc = chidb_Pager_beginRead(pager);
+        if (rc != CHIDB_OK)
+            return rc;
+        chidb_backup_restart(backup);
+    }
+
+    last = backup->npages;
+    if (npages >= 0 && backup->next + npages - 1 < last)
+        last = backup->next + npages - 1;
+
+    while (rc == CHIDB_OK && backup->next <= last)
+    {
+        npage_t n = last - backup->next + 1;
+
+        if (n > BACKUP_RUN_PAGES)
+            n = BACKUP_RUN_PAGES;
+
+        rc = chidb_Pager_readPages(pager, backup->next, n, backup->buf);
+        if (rc == CHIDB_OK)
+            rc = chidb_backup_write(backup->fd, backup->buf, (size_t) n * pager->page_size,
+                                    (off_t) (backup->next - 1) * pager->page_size);
+        if (rc == CHIDB_OK)
+            backup->next += n;
+    }
+
+    if (backup->snapshot != NULL)
+        chidb_Pager_useSnapshot(prev);
+    else
+        chidb_Pager_endRead(pager);
+
+    if (rc != CHIDB_OK)
+        return rc;
+
+    return backup->next > backup->npages ? CHIDB_DONE : CHIDB_OK;
+}
+
+
+int chidb_backup_remaining(chidb_backup *backup)
+{
+    return backup->npages - backup->next + 1;
+}
+
+
+int chidb_backup_pagecount(chidb_backup *backup)
+{
+    return backup->npages;
+}
+
+
+int chidb_backup_finish(chidb_backup *backup)
+{
+    Pager *pager = backup->db->bt->pager;
+    bool complete = backup->next > backup->npages;
+    int rc = CHIDB_OK;
+
+    /* The copy may have been made over a longer file */
+    if (complete && (ftruncate(backup->fd, (off_t) backup->npages * pager->page_size) != 0
+                     || fdatasync(backup->fd) != 0))
+        rc = CHIDB_EIO;
+    if (close(backup->fd) != 0)
+        rc = CHIDB_EIO;
+
+    if (complete && rc == CHIDB_OK && rename(backup->partial, backup->filename) != 0)
+        rc = CHIDB_EIO;
+    if (!complete || rc != CHIDB_OK)
+        unlink(backup->partial);
+
+    if (backup->snapshot != NULL)
+        chidb_Pager_endSnapshot(pager, backup->snapshot);
+
+    free(backup->buf);
+    free(backup->partial);
+    free(backup->filename);
+    free(backup);
+
+    return rc;
+}
+
+
+int chidb_backup_run(chidb *db, const char *file, int npages, unsigned int sleep_ms)
+{
+    chidb_backup *backup;
+    int rc, frc;
+
+    rc = chidb_backup_init(db, file, &backup);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    while ((rc = chidb_backup_step(backup, npages)) == CHIDB_OK)
+        if (sleep_ms > 0)
+            usleep(sleep_ms * 1000);
+
+    frc = chidb_backup_finish(backup);
+
+    return rc == CHIDB_DONE ? frc : rc;
+}
@@ -0,0 +1,653 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Bloom filters
+ *
+ * A Bloom filter of a B-Tree tells, without reading the B-Tree, that a
+ * key is certainly not in it, so that looking up a key that isn't there
+ * (an EXISTS check, or a row of an anti-join) doesn't have to descend
+ * from the root to a leaf to find out. A filter can say that a key may
+ * be in the B-Tree when it isn't (about 1% of the time when it is sized
+ * for its keys, see BLOOM_BITS_PER_KEY), but never the other way round.
+ *
+ * The filters are split-block Bloom filters: the 64-bit hash of a key
+ * picks one 32-byte block with its high bits, and its low 32 bits,
+ * multiplied by a different odd constant for each of the block's eight
+ * words, set one bit in each word. Testing a key reads a single block
+ * (half a cache line), and its eight words are compared at once (with
+ * SSE2 or NEON where available).
+ *
+ * The same filters are used in memory, by hash joins (see dbm-hash.c),
+ * and on disk, where they are built on request for a table (over its
+ * primary keys) or a B-Tree index (over the indexed values), see
+ * chidb_bloom. Each filter on disk has a meta page, with the root of
+ * its B-Tree and the page numbers of the data pages with its blocks;
+ * the meta pages are chained from the file header (HEADER_BLOOM_OFFSET).
+ * Every insertion into the B-Tree adds its key to the filter (see
+ * chidb_Btree_insertLatched), but deletions leave it as it is, since a
+ * key can't be taken out of a Bloom filter: a deleted key is only a
+ * false positive. A filter is sized for the keys the B-Tree had when it
+ * was built, so it should be built again after the B-Tree has grown a
+ * lot.
+ *
+ * The pages of the filters are written through the pager like any other
+ * page, so they are part of the transactions that change the B-Trees.
+ * The pager's lock is held to read or change them, so a lookup never
+ * sees a filter half way through a change.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#include <chidb/chidb.h>
+#include "bloom.h"
+#include "catalog.h"
+#include "dbm-cursor.h"
+#include "util.h"
+
+
+/*** Filters ***/
+
+/* Multiplier of each word of a block (odd, so that every bit of the
+ * hash matters) */
+static const uint32_t bloom_salt[BLOOM_BLOCK_WORDS] =
+{
+    0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+    0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u
+};
+
+/* Hash of a key: the splitmix64 finalizer, so that both the high bits
+ * (the block) and the low bits (the bits in it) depend on all of the
+ * key's */
+uint64_t chidb_bloom_hash(uint32_t key)
+{
+    uint64_t h = key + 0x9e3779b97f4a7c15ull;
+
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+
+    return h ^ (h >> 31);
+}
+
+/* Blocks of a filter sized for nkeys keys (at least one) */
+uint32_t chidb_bloom_nblocks(uint64_t nkeys)
+{
+    uint64_t n = (nkeys * BLOOM_BITS_PER_KEY + BLOOM_BLOCK_SIZE * 8 - 1) / (BLOOM_BLOCK_SIZE * 8);
+
+    if (n == 0)
+        return 1;
+
+    return n > UINT32_MAX / BLOOM_BLOCK_SIZE ? UINT32_MAX / BLOOM_BLOCK_SIZE : (uint32_t) n;
+}
+
+/* Block of a hash, from its high bits (without a division) */
+static inline uint32_t bloom_block(uint64_t hash, uint32_t nblocks)
+{
+    return (uint32_t) (((hash >> 32) * nblocks) >> 32);
+}
+
+/* Sets the bits of a hash's low bits in a block, and tells whether any
+ * wasn't set already */
+static bool bloom_setBlock(uint8_t *block, uint32_t lo)
+{
+    bool changed = false;
+
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++)
+    {
+        uint32_t bit = (lo * bloom_salt[i]) >> 27;
+        uint8_t *b = block + 4 * i + bit / 8;
+
+        changed = changed || !(*b & (1 << (bit % 8)));
+        *b |= 1 << (bit % 8);
+    }
+
+    return changed;
+}
+
+/* Whether all the bits of a hash's low bits are set in a block. The
+ * words are little-endian, so the SIMD versions, which load them as
+ * they are, are only used on little-endian machines. */
+static bool bloom_testBlock(const uint8_t *block, uint32_t lo)
+{
+#if defined(__SSE2__)
+    /* SSE2 can't multiply 32-bit lanes, so the masks are made first */
+    uint32_t masks[BLOOM_BLOCK_WORDS];
+
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++)
+        masks[i] = 1u << ((lo * bloom_salt[i]) >> 27);
+
+    __m128i m0 = _mm_loadu_si128((const __m128i *) masks);
+    __m128i m1 = _mm_loadu_si128((const __m128i *) (masks + 4));
+    __m128i b0 = _mm_loadu_si128((const __m128i *) block);
+    __m128i b1 = _mm_loadu_si128((const __m128i *) (block + 16));
+    __m128i ok = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(b0, m0), m0),
+                               _mm_cmpeq_epi32(_mm_and_si128(b1, m1), m1));
+
+    return _mm_movemask_epi8(ok) == 0xFFFF;
+#elif defined(__ARM_NEON) && defined(__aarch64__) && defined(__BYTE_ORDER__) && \
+      __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint32x4_t k = vdupq_n_u32(lo), one = vdupq_n_u32(1);
+    uint32x4_t m0 = vshlq_u32(one, vreinterpretq_s32_u32(vshrq_n_u32(vmulq_u32(k, vld1q_u32(bloom_salt)), 27)));
+    uint32x4_t m1 = vshlq_u32(one, vreinterpretq_s32_u32(vshrq_n_u32(vmulq_u32(k, vld1q_u32(bloom_salt + 4)), 27)));
+    uint32x4_t b0 = vreinterpretq_u32_u8(vld1q_u8(block));
+    uint32x4_t b1 = vreinterpretq_u32_u8(vld1q_u8(block + 16));
+    uint32x4_t ok = vandq_u32(vceqq_u32(vandq_u32(b0, m0), m0), vceqq_u32(vandq_u32(b1, m1), m1));
+
+    return vminvq_u32(ok) == UINT32_MAX;
+#else
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++)
+    {
+        uint32_t bit = (lo * bloom_salt[i]) >> 27;
+
+        if (!(block[4 * i + bit / 8] & (1 << (bit % 8))))
+            return false;
+    }
+
+    return true;
+#endif
+}
+
+
+/* Create an empty filter in memory
+ *
+ * Parameters
+ * - bf: Filter
+ * - nblocks: Blocks of the filter (see chidb_bloom_nblocks)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: nblocks is 0
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_bloom_init(chidb_bloom_t *bf, uint32_t nblocks)
+{
+    bf->nblocks = 0;
+    if (nblocks == 0)
+        return CHIDB_EMISUSE;
+    if ((bf->blocks = calloc(nblocks, BLOOM_BLOCK_SIZE)) == NULL)
+        return CHIDB_ENOMEM;
+    bf->nblocks = nblocks;
+
+    return CHIDB_OK;
+}
+
+/* Add a hash (see chidb_bloom_hash) to a filter in memory */
+void chidb_bloom_add(chidb_bloom_t *bf, uint64_t hash)
+{
+    bloom_setBlock(bf->blocks + (size_t) bloom_block(hash, bf->nblocks) * BLOOM_BLOCK_SIZE, (uint32_t) hash);
+}
+
+/* Whether a hash may have been added to a filter in memory (always true
+ * if there is no filter) */
+bool chidb_bloom_test(const chidb_bloom_t *bf, uint64_t hash)
+{
+    if (bf->nblocks == 0)
+        return true;
+
+    return bloom_testBlock(bf->blocks + (size_t) bloom_block(hash, bf->nblocks) * BLOOM_BLOCK_SIZE, (uint32_t) hash);
+}
+
+/* Free a filter in memory */
+void chidb_bloom_free(chidb_bloom_t *bf)
+{
+    free(bf->blocks);
+    bf->blocks = NULL;
+    bf->nblocks = 0;
+}
+
+
+/*** Filters of B-Trees ***/
+
+/* Finds the meta page of the filter of a B-Tree, with the pager's lock
+ * held. prev is set to the meta page before it in the chain (0 if it is
+ * the first one). */
+static int bloom_findMeta(BTree *bt, npage_t nroot, MemPage **meta, npage_t *prev)
+{
+    MemPage *header;
+    npage_t npage, hops = 0;
+    int rc;
+
+    *prev = 0;
+    if (bt->pager->n_pages == 0)
+        return CHIDB_ENOTFOUND;
+    if ((rc = chidb_Pager_readPage(bt->pager, 1, &header)) != CHIDB_OK)
+        return rc;
+    npage = get4byte(header->data + HEADER_BLOOM_OFFSET);
+    chidb_Pager_releaseMemPage(bt->pager, header);
+
+    while (npage != 0)
+    {
+        if (npage > bt->pager->n_pages || ++hops > bt->pager->n_pages)
+            return CHIDB_ECORRUPT;
+        if ((rc = chidb_Pager_readPage(bt->pager, npage, meta)) != CHIDB_OK)
+            return rc;
+        if ((*meta)->data[PGHEADER_PGTYPE_OFFSET] != PGTYPE_BLOOM_META)
+        {
+            chidb_Pager_releaseMemPage(bt->pager, *meta);
+            return CHIDB_ECORRUPT;
+        }
+        if (get4byte((*meta)->data + BLOOMMETA_NROOT_OFFSET) == nroot)
+            return CHIDB_OK;
+
+        *prev = npage;
+        npage = get4byte((*meta)->data + BLOOMMETA_NEXT_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, *meta);
+    }
+
+    return CHIDB_ENOTFOUND;
+}
+
+/* Reads the data page with the block of a hash, and sets offset to
+ * where the block is in it */
+static int bloom_readBlock(BTree *bt, MemPage *meta, uint64_t hash, MemPage **page, uint32_t *offset)
+{
+    uint32_t usable = chidb_Pager_usableSize(bt->pager), perpage = BLOOMDATA_NBLOCKS(usable);
+    uint32_t nblocks = get4byte(meta->data + BLOOMMETA_NBLOCKS_OFFSET), b, i;
+    npage_t npage;
+    int rc;
+
+    if (nblocks == 0 || (nblocks - 1) / perpage >= BLOOMMETA_MAXPAGES(usable))
+        return CHIDB_ECORRUPT;
+    b = bloom_block(hash, nblocks);
+    i = b / perpage;
+    npage = get4byte(meta->data + BLOOMMETA_PAGES_OFFSET + 4 * i);
+    *offset = BLOOMDATA_BLOCKS_OFFSET + (b % perpage) * BLOOM_BLOCK_SIZE;
+
+    if ((rc = chidb_Pager_readPage(bt->pager, npage, page)) != CHIDB_OK)
+        return rc;
+    if ((*page)->data[PGHEADER_PGTYPE_OFFSET] != PGTYPE_BLOOM_DATA)
+    {
+        chidb_Pager_releaseMemPage(bt->pager, *page);
+        return CHIDB_ECORRUPT;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Writes a filter in memory to new pages, and chains its meta page
+ * first, with the pager's lock held */
+static int bloom_write(BTree *bt, npage_t nroot, chidb_bloom_t *bf)
+{
+    uint32_t usable = chidb_Pager_usableSize(bt->pager), perpage = BLOOMDATA_NBLOCKS(usable);
+    uint32_t npages = (bf->nblocks + perpage - 1) / perpage;
+    MemPage *header, *meta, *page;
+    npage_t nmeta;
+    int rc;
+
+    if ((rc = chidb_Btree_allocatePage(bt, &nmeta)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_Pager_readPage(bt->pager, nmeta, &meta)) != CHIDB_OK)
+        return rc;
+    memset(meta->data, 0, bt->pager->page_size);
+    meta->data[PGHEADER_PGTYPE_OFFSET] = PGTYPE_BLOOM_META;
+    put4byte(meta->data + BLOOMMETA_NROOT_OFFSET, nroot);
+    put4byte(meta->data + BLOOMMETA_NBLOCKS_OFFSET, bf->nblocks);
+
+    for (uint32_t i = 0; i < npages && rc == CHIDB_OK; i++)
+    {
+        uint32_t n = i == npages - 1 ? bf->nblocks - i * perpage : perpage;
+        npage_t npage;
+
+        if ((rc = chidb_Btree_allocatePage(bt, &npage)) != CHIDB_OK)
+            break;
+        if ((rc = chidb_Pager_readPage(bt->pager, npage, &page)) != CHIDB_OK)
+            break;
+        memset(page->data, 0, bt->pager->page_size);
+        page->data[PGHEADER_PGTYPE_OFFSET] = PGTYPE_BLOOM_DATA;
+        memcpy(page->data + BLOOMDATA_BLOCKS_OFFSET, bf->blocks + (size_t) i * perpage * BLOOM_BLOCK_SIZE,
+               (size_t) n * BLOOM_BLOCK_SIZE);
+        rc = chidb_Pager_writePage(bt->pager, page);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+        put4byte(meta->data + BLOOMMETA_PAGES_OFFSET + 4 * i, npage);
+    }
+
+    if (rc == CHIDB_OK)
+        rc = chidb_Pager_readPage(bt->pager, 1, &header);
+    if (rc == CHIDB_OK)
+    {
+        put4byte(meta->data + BLOOMMETA_NEXT_OFFSET, get4byte(header->data + HEADER_BLOOM_OFFSET));
+        put4byte(header->data + HEADER_BLOOM_OFFSET, nmeta);
+        rc = chidb_Pager_writePage(bt->pager, meta);
+        if (rc == CHIDB_OK)
+            rc = chidb_Pager_writePage(bt->pager, header);
+        chidb_Pager_releaseMemPage(bt->pager, header);
+    }
+    chidb_Pager_releaseMemPage(bt->pager, meta);
+
+    return rc;
+}
+
+
+/* Build the Bloom filter of a B-Tree
+ *
+ * Makes a filter sized for the entries the B-Tree has now, adds all of
+ * their keys to it (primary keys in a table, indexed values in an
+ * index), and writes it to new pages, replacing the filter the B-Tree
+ * had, if any. Filters larger than a meta page can list the data pages
+ * of (BLOOMMETA_MAXPAGES) are made that large, with more false
+ * positives.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root page of a table or index B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The page is not the root of a B-Tree
+ * - CHIDB_ECORRUPT: The chain of filters is not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_bloom_build(BTree *bt, npage_t nroot)
+{
+    uint32_t usable = chidb_Pager_usableSize(bt->pager), nblocks, maxblocks;
+    chidb_dbm_cursor_t c;
+    chidb_bloom_t bf;
+    MemPage *root;
+    uint64_t nkeys;
+    uint8_t type;
+    int rc;
+
+    if ((rc = chidb_Pager_readPage(bt->pager, nroot, &root)) != CHIDB_OK)
+        return rc;
+    type = root->data[PGHEADER_PGTYPE_OFFSET];
+    chidb_Pager_releaseMemPage(bt->pager, root);
+    if (type != PGTYPE_TABLE_INTERNAL && type != PGTYPE_TABLE_LEAF &&
+        type != PGTYPE_INDEX_INTERNAL && type != PGTYPE_INDEX_LEAF)
+        return CHIDB_EMISUSE;
+
+    if ((rc = chidb_Btree_count(bt, nroot, &nkeys)) != CHIDB_OK)
+        return rc;
+    nblocks = chidb_bloom_nblocks(nkeys);
+    maxblocks = BLOOMMETA_MAXPAGES(usable) * BLOOMDATA_NBLOCKS(usable);
+    if ((rc = chidb_bloom_init(&bf, nblocks < maxblocks ? nblocks : maxblocks)) != CHIDB_OK)
+        return rc;
+
+    if ((rc = chidb_dbm_cursor_open(&c, CURSOR_READ, bt, nroot)) != CHIDB_OK)
+    {
+        chidb_bloom_free(&bf);
+        return rc;
+    }
+    for (rc = chidb_dbm_cursor_rewind(&c); rc == CHIDB_OK; rc = chidb_dbm_cursor_next(&c))
+        chidb_bloom_add(&bf, chidb_bloom_hash(c.cell.key));
+    chidb_dbm_cursor_close(&c);
+
+    if (rc == CHIDB_DONE)
+    {
+        chidb_Pager_lock(bt->pager);
+        rc = chidb_bloom_drop(bt, nroot);
+        if (rc == CHIDB_OK)
+            rc = bloom_write(bt, nroot, &bf);
+        chidb_Pager_unlock(bt->pager);
+    }
+    chidb_bloom_free(&bf);
+
+    return rc;
+}
+
+
+/* Drop the Bloom filter of a B-Tree
+ *
+ * Takes the filter out of the chain, and frees its pages. Does nothing
+ * if the B-Tree has no filter.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root page of the B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The chain of filters is not well formed
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_bloom_drop(BTree *bt, npage_t nroot)
+{
+    uint32_t usable = chidb_Pager_usableSize(bt->pager), npages;
+    MemPage *meta, *link;
+    npage_t prev, next;
+    int rc;
+
+    chidb_Pager_lock(bt->pager);
+
+    rc = bloom_findMeta(bt, nroot, &meta, &prev);
+    if (rc != CHIDB_OK)
+    {
+        chidb_Pager_unlock(bt->pager);
+        return rc == CHIDB_ENOTFOUND ? CHIDB_OK : rc;
+    }
+
+    next = get4byte(meta->data + BLOOMMETA_NEXT_OFFSET);
+    rc = chidb_Pager_readPage(bt->pager, prev == 0 ? 1 : prev, &link);
+    if (rc == CHIDB_OK)
+    {
+        put4byte(link->data + (prev == 0 ? HEADER_BLOOM_OFFSET : BLOOMMETA_NEXT_OFFSET), next);
+        rc = chidb_Pager_writePage(bt->pager, link);
+        chidb_Pager_releaseMemPage(bt->pager, link);
+    }
+
+    npages = (get4byte(meta->data + BLOOMMETA_NBLOCKS_OFFSET) + BLOOMDATA_NBLOCKS(usable) - 1) / BLOOMDATA_NBLOCKS(usable);
+    if (npages > BLOOMMETA_MAXPAGES(usable))
+        rc = CHIDB_ECORRUPT;
+    for (uint32_t i = 0; i < npages && rc == CHIDB_OK; i++)
+        rc = chidb_Btree_freePage(bt, get4byte(meta->data + BLOOMMETA_PAGES_OFFSET + 4 * i));
+    if (rc == CHIDB_OK)
+        rc = chidb_Btree_freePage(bt, meta->npage);
+    chidb_Pager_releaseMemPage(bt->pager, meta);
+
+    chidb_Pager_unlock(bt->pager);
+
+    return rc;
+}
+
+
+/* Build the Bloom filter of a B-Tree again, if it has one (e.g., after
+ * chidb_Btree_bulkLoad has filled the B-Tree, so that the filter is
+ * sized for its new entries)
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root page of the B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - Any error returned by chidb_bloom_build
+ */
+int chidb_bloom_refresh(BTree *bt, npage_t nroot)
+{
+    MemPage *meta;
+    npage_t prev;
+    int rc;
+
+    chidb_Pager_lock(bt->pager);
+    rc = bloom_findMeta(bt, nroot, &meta, &prev);
+    if (rc == CHIDB_OK)
+        chidb_Pager_releaseMemPage(bt->pager, meta);
+    chidb_Pager_unlock(bt->pager);
+
+    if (rc == CHIDB_ENOTFOUND)
+        return CHIDB_OK;
+    if (rc != CHIDB_OK)
+        return rc;
+
+    return chidb_bloom_build(bt, nroot);
+}
+
+
+/* Add a key to the Bloom filter of a B-Tree
+ *
+ * Called for every entry inserted into a B-Tree. Does nothing if the
+ * B-Tree has no filter, and only writes the data page if the key sets
+ * a bit that wasn't set.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root page of the B-Tree
+ * - key: Key of the entry (keyIdx in an index)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The filter is not well formed
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_bloom_insert(BTree *bt, npage_t nroot, chidb_key_t key)
+{
+    uint64_t hash = chidb_bloom_hash(key);
+    MemPage *meta, *page;
+    npage_t prev;
+    uint32_t offset;
+    int rc;
+
+    chidb_Pager_lock(bt->pager);
+
+    rc = bloom_findMeta(bt, nroot, &meta, &prev);
+    if (rc == CHIDB_OK)
+    {
+        rc = bloom_readBlock(bt, meta, hash, &page, &offset);
+        chidb_Pager_releaseMemPage(bt->pager, meta);
+        if (rc == CHIDB_OK)
+        {
+            if (bloom_setBlock(page->data + offset, (uint32_t) hash))
+                rc = chidb_Pager_writePage(bt->pager, page);
+            chidb_Pager_releaseMemPage(bt->pager, page);
+        }
+    }
+    else if (rc == CHIDB_ENOTFOUND)
+        rc = CHIDB_OK;
+
+    chidb_Pager_unlock(bt->pager);
+
+    return rc;
+}
+
+
+/* Tell whether a key may be in a B-Tree, according to its Bloom filter
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root page of the B-Tree
+ * - key: Key (keyIdx in an index)
+ * - maybe: Set to false if the key is certainly not in the B-Tree, and
+ *          to true if it may be (or the B-Tree has no filter)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The filter is not well formed
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_bloom_lookup(BTree *bt, npage_t nroot, chidb_key_t key, bool *maybe)
+{
+    uint64_t hash = chidb_bloom_hash(key);
+    MemPage *meta, *page;
+    npage_t prev;
+    uint32_t offset;
+    int rc;
+
+    *maybe = true;
+    chidb_Pager_lock(bt->pager);
+
+    rc = bloom_findMeta(bt, nroot, &meta, &prev);
+    if (rc == CHIDB_OK)
+    {
+        rc = bloom_readBlock(bt, meta, hash, &page, &offset);
+        chidb_Pager_releaseMemPage(bt->pager, meta);
+        if (rc == CHIDB_OK)
+        {
+            *maybe = bloom_testBlock(page->data + offset, (uint32_t) hash);
+            chidb_Pager_releaseMemPage(bt->pager, page);
+        }
+    }
+    else if (rc == CHIDB_ENOTFOUND)
+        rc = CHIDB_OK;
+
+    chidb_Pager_unlock(bt->pager);
+
+    return rc;
+}
+
+
+int chidb_bloom(chidb *db, const char *table, const char *column)
+{
+    chidb_catalog_table_t *t;
+    chidb_catalog_index_t *idx = NULL;
+    Pager *pager;
+    bool autocommit;
+    int rc;
+
+    if (db == NULL || db->bt == NULL)
+        return CHIDB_EMISUSE;
+
+    /* Same locks as chidb_import_table */
+    pager = db->bt->pager;
+    if ((rc = chidb_Pager_beginWrite(pager)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_Pager_beginRead(pager)) != CHIDB_OK)
+    {
+        chidb_Pager_endWrite(pager);
+        return rc;
+    }
+
+    if ((t = chidb_catalog_table(db, table)) == NULL)
+        rc = CHIDB_EINVALIDSQL;
+    else if (column != NULL && chidb_catalog_column(t, column) < 0)
+        rc = CHIDB_EINVALIDSQL;
+    else if (column != NULL && (idx = chidb_catalog_index(t, column)) == NULL)
+        rc = CHIDB_EMISUSE;
+    else if (t->columnar)
+        rc = CHIDB_EMISUSE;
+
+    if (rc == CHIDB_OK)
+    {
+        autocommit = !chidb_Pager_inTransaction(pager);
+        if (!autocommit || (rc = chidb_Btree_begin(db->bt)) == CHIDB_OK)
+        {
+            rc = chidb_bloom_build(db->bt, idx != NULL ? idx->nroot : t->nroot);
+            if (autocommit && rc == CHIDB_OK)
+                rc = chidb_Btree_commit(db->bt);
+            if (autocommit && rc != CHIDB_OK)
+                chidb_Btree_rollback(db->bt);
+        }
+    }
+
+    chidb_Pager_endRead(pager);
+    chidb_Pager_endWrite(pager);
+
+    return rc;
+}
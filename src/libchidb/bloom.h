@@ -0,0 +1,94 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Bloom filters -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef BLOOM_H_
+#define BLOOM_H_
+
+#include "chidbInt.h"
+#include "btree.h"
+
+/* A filter is an array of 32-byte blocks, each of eight 32-bit words
+ * (little-endian, on disk and in memory). A key sets one bit in each
+ * word of one block. */
+#define BLOOM_BLOCK_SIZE (32)
+#define BLOOM_BLOCK_WORDS (8)
+
+/* Bits of filter per key it is sized for (about 1% false positives) */
+#define BLOOM_BITS_PER_KEY (10)
+
+/* Page types of the filters of a file (byte 0 of their pages) */
+#define PGTYPE_BLOOM_META (0x21)
+#define PGTYPE_BLOOM_DATA (0x29)
+
+/* Meta page of the filter of a B-Tree: type (1 byte), unused (3), next
+ * meta page (4, 0 for none), root of the B-Tree (4), blocks (4), and
+ * the page numbers of the data pages (4 bytes each). The first meta
+ * page is in the file header (HEADER_BLOOM_OFFSET). */
+#define BLOOMMETA_NEXT_OFFSET (4)
+#define BLOOMMETA_NROOT_OFFSET (8)
+#define BLOOMMETA_NBLOCKS_OFFSET (12)
+#define BLOOMMETA_PAGES_OFFSET (16)
+#define BLOOMMETA_MAXPAGES(usable) (((usable) - BLOOMMETA_PAGES_OFFSET) / 4)
+
+/* Data page: type (1 byte), unused (31), and blocks */
+#define BLOOMDATA_BLOCKS_OFFSET (BLOOM_BLOCK_SIZE)
+#define BLOOMDATA_NBLOCKS(usable) ((usable) / BLOOM_BLOCK_SIZE - 1)
+
+/* A filter in memory (see chidb_bloom_init) */
+typedef struct chidb_bloom
+{
+    uint8_t *blocks;
+    uint32_t nblocks;   /* 0 if there is no filter */
+} chidb_bloom_t;
+
+uint64_t chidb_bloom_hash(uint32_t key);
+uint32_t chidb_bloom_nblocks(uint64_t nkeys);
+int chidb_bloom_init(chidb_bloom_t *bf, uint32_t nblocks);
+void chidb_bloom_add(chidb_bloom_t *bf, uint64_t hash);
+bool chidb_bloom_test(const chidb_bloom_t *bf, uint64_t hash);
+void chidb_bloom_free(chidb_bloom_t *bf);
+
+int chidb_bloom_build(BTree *bt, npage_t nroot);
+int chidb_bloom_drop(BTree *bt, npage_t nroot);
+int chidb_bloom_refresh(BTree *bt, npage_t nroot);
+int chidb_bloom_insert(BTree *bt, npage_t nroot, chidb_key_t key);
+int chidb_bloom_lookup(BTree *bt, npage_t nroot, chidb_key_t key, bool *maybe);
+
+#endif /* BLOOM_H_ */
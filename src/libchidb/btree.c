@@ -44,40 +44,129 @@
 
 
 #include <stdio.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <chidb/log.h>
 #include "chidbInt.h"
 #include "btree.h"
 #include "record.h"
 #include "pager.h"
 #include "util.h"
+#include "zonemap.h"
+#include "bloom.h"
+#include "normkey.h"
+
+static int chidb_Btree_allocatePageLocked(BTree *bt, npage_t *npage);
+static int chidb_Btree_freePageLocked(BTree *bt, npage_t npage);
+static int chidb_Btree_insertPessimistic(BTree *bt, npage_t nroot, BTreeCell *btc);
+static int chidb_Btree_insertAppend(BTree *bt, npage_t nroot, BTreeCell *btc);
+static void chidb_Btree_cacheAppend(BTree *bt, npage_t nroot, npage_t nparent, npage_t nleaf);
+static int chidb_Btree_rebuildNode(BTree *bt, npage_t npage, uint8_t type, BTreeCell *cells, ncell_t n,
+                                   npage_t right_page, npage_t left_page);
+static npage_t chidb_Btree_childPage(BTreeNode *btn, ncell_t ncell);
+static int chidb_Btree_findOptimistic(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint32_t *size);
 
 
 /* Open a B-Tree file
+ *
+ * Same as chidb_Btree_open2, using the default page size and no
+ * pager flags.
+ *
+ * Parameters
+ * - filename: Database file (might not exist)
+ * - db: A chidb struct. Its bt field must be set to the newly
+ *       created BTree (unless flags has PAGER_TEMP: a temporary B-Tree
+ *       file is not the database's, see chidb_Btree_openTemp).
+ * - bt: An out parameter. Used to return a pointer to the
+ *       newly created BTree.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPTHEADER: Database file contains an invalid header
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
+{
+    return chidb_Btree_open2(filename, db, bt, DEFAULT_PAGE_SIZE, 0);
+}
+
+
+/* Open a B-Tree file with a given page size
  *
  * This function opens a database file and verifies that the file
  * header is correct. If the file is empty (which will happen
  * if the pager is given a filename for a file that does not exist)
  * then this function will (1) initialize the file header using
- * the default page size and (2) create an empty table leaf node
- * in page 1.
+ * page_size and (2) create an empty table leaf node in page 1.
+ * If the file is not empty, page_size is ignored, and the page size
+ * is read from the header.
+ *
+ * The page size is stored in bytes 16-17 of the header, with 65536
+ * stored as 1 (use PAGE_SIZE_DECODE/PAGE_SIZE_ENCODE). A header with a
+ * page size for which PAGE_SIZE_VALID is false is invalid. Note that
+ * bytes 32-39 of the header contain the freelist (see
+ * chidb_Btree_allocatePage), and are only zero if it is empty, and
+ * that bytes 40-43 contain the schema cookie (see catalog.c), which is
+ * zero in a new file.
+ *
+ * If the file is created with PAGER_CHECKSUM in flags, byte 20 of the
+ * header (HEADER_RESERVED_OFFSET) must be set to PAGER_CHECKSUM_SIZE;
+ * otherwise it is zero. When opening an existing file, checksums are
+ * enabled (chidb_Pager_setChecksum) if and only if byte 20 says so,
+ * regardless of flags, and any other value makes the header invalid.
+ * This must be done right after reading the header, before reading
+ * any page. The same goes for BTREE_FEATURE_COMPRESSED (see below),
+ * which enables chidb_Pager_setCompression: if that fails (chidb was
+ * built without LZ4), the file can't be opened (CHIDB_ECANTOPEN). In
+ * either case, B-Tree nodes may only use the first
+ * chidb_Pager_usableSize bytes of a page (e.g., the cell content area
+ * of an empty node starts there).
+ *
+ * Bytes 72-75 of the header (HEADER_FEATURES_OFFSET) contain the
+ * BTREE_FEATURE_* flags of the file, which must be stored in the
+ * features field of the BTree. A new file gets BTREE_FEATURE_OVERFLOW,
+ * plus BTREE_FEATURE_LINKEDLEAVES if BTREE_LINKEDLEAVES is in flags,
+ * BTREE_FEATURE_PACKEDINDEX if BTREE_PACKEDINDEX is in flags,
+ * BTREE_FEATURE_RECORDV2 if BTREE_RECORDV2 is in flags,
+ * BTREE_FEATURE_COMPRESSED if BTREE_COMPRESSED is in flags and
+ * BTREE_FEATURE_NORMKEY if BTREE_NORMKEY is in flags (in which case
+ * BTREE_PACKEDINDEX is ignored); an existing file keeps the features
+ * it was created with (in particular, the format of its records, see
+ * BTREE_RECORD_FORMAT, and of its keys). A header with bits that are
+ * not in BTREE_FEATURES_KNOWN, or with both BTREE_FEATURE_NORMKEY and
+ * BTREE_FEATURE_PACKEDINDEX, is invalid.
+ *
+ * The append_* fields of the BTree start as 0 (no rightmost leaf is
+ * cached, see chidb_Btree_insertAppend), and its zonemaps field as NULL
+ * (see zonemap.c).
  *
  * Parameters
  * - filename: Database file (might not exist)
  * - db: A chidb struct. Its bt field must be set to the newly
- *       created BTree.
+ *       created BTree (unless flags has PAGER_TEMP: a temporary B-Tree
+ *       file is not the database's, see chidb_Btree_openTemp).
  * - bt: An out parameter. Used to return a pointer to the
  *       newly created BTree.
+ * - page_size: Page size to use if the file is created
+ * - flags: Flags to open the pager with (see chidb_Pager_open2),
+ *          BTREE_LINKEDLEAVES, BTREE_PACKEDINDEX, BTREE_RECORDV2,
+ *          BTREE_COMPRESSED and BTREE_NORMKEY
  *
  * Return
  * - CHIDB_OK: Operation successful
  * - CHIDB_ECORRUPTHEADER: Database file contains an invalid header
+ * - CHIDB_EMISUSE: Invalid page size
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
+int chidb_Btree_open2(const char *filename, chidb *db, BTree **bt, uint32_t page_size, int flags)
 {
     /* Your code goes here */
 
@@ -88,7 +177,8 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
 /* Close a B-Tree file
  *
  * This function closes a database file, freeing any resource
- * used in memory, such as the pager.
+ * used in memory, such as the pager and the zone maps (see
+ * chidb_zonemap_free).
  *
  * Parameters
  * - bt: B-Tree file to close
@@ -105,6 +195,138 @@ int chidb_Btree_close(BTree *bt)
 }
 
 
+/* Open a temporary B-Tree file
+ *
+ * Creates an empty B-Tree file for scratch data that lives only as long
+ * as the BTree, such as ephemeral tables (see OpenEphemeral). The file
+ * is created in $TMPDIR (or /tmp) by a pager opened with PAGER_TEMP, so
+ * it is deleted right away, and never synced: its pages only reach the
+ * disk when its buffer pool runs out of room for them.
+ *
+ * Parameters
+ * - db: chidb database the temporary file is used by (its bt field is
+ *       left alone)
+ * - bt: An out parameter. Used to return a pointer to the
+ *       newly created BTree.
+ * - page_size: Page size of the file
+ * - npages: Number of pages its buffer pool can hold
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Invalid page size, or npages is zero
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not create the file
+ */
+int chidb_Btree_openTemp(chidb *db, BTree **bt, uint32_t page_size, uint32_t npages)
+{
+    const char *dir = getenv("TMPDIR");
+    char *template;
+    int rc;
+
+    if (npages == 0)
+        return CHIDB_EMISUSE;
+    if (asprintf(&template, "%s/chidb-temp-XXXXXX", dir != NULL && *dir != '\0' ? dir : "/tmp") < 0)
+        return CHIDB_ENOMEM;
+
+    rc = chidb_Btree_open2(template, db, bt, page_size, PAGER_TEMP);
+    free(template);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if ((rc = chidb_Pager_setCacheSize((*bt)->pager, npages)) != CHIDB_OK)
+    {
+        chidb_Btree_close(*bt);
+        return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Begin a transaction
+ *
+ * Until chidb_Btree_commit or chidb_Btree_rollback, the pages modified
+ * in the file are kept in the pager's buffer pool, and written once, in
+ * page number order, at commit (see chidb_Pager_begin).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: A transaction is already in progress
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_begin(BTree *bt)
+{
+    return chidb_Pager_begin(bt->pager);
+}
+
+
+/* Commit a transaction
+ *
+ * See chidb_Pager_commit. The zone maps that were up to date stay so
+ * (see chidb_zonemap_refresh).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: No transaction is in progress
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_commit(BTree *bt)
+{
+    uint32_t nchanges = chidb_Pager_changes(bt->pager);
+    int rc;
+
+    rc = chidb_Pager_commit(bt->pager);
+    if (rc == CHIDB_OK)
+        chidb_zonemap_refresh(bt, nchanges);
+
+    return rc;
+}
+
+
+/* Roll back a transaction
+ *
+ * Undoes every change made to the file since chidb_Btree_begin (see
+ * chidb_Pager_rollback), and forgets the rightmost leaf cached by
+ * chidb_Btree_insertAppend, which may not exist anymore. The zone maps
+ * keep the values of the rows that were rolled back, which only makes
+ * them less precise. No node of the file may be held.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: No transaction is in progress, or a node is held
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_rollback(BTree *bt)
+{
+    uint32_t nchanges;
+    int rc;
+
+    chidb_Pager_lock(bt->pager);
+    nchanges = chidb_Pager_changes(bt->pager);
+    rc = chidb_Pager_rollback(bt->pager);
+    if (rc == CHIDB_OK)
+    {
+        bt->append_root = 0;
+        chidb_zonemap_refresh(bt, nchanges);
+    }
+    chidb_Pager_unlock(bt->pager);
+
+    return rc;
+}
+
+
 /* Loads a B-Tree node from disk
  *
  * Reads a B-Tree node from a page in the disk. All the information regarding
@@ -115,6 +337,13 @@ int chidb_Btree_close(BTree *bt)
  * Any changes made to a BTreeNode variable will not be effective in the database
  * until chidb_Btree_writeNode is called on that BTreeNode.
  *
+ * The cell offset array starts chidb_Btree_headerSize bytes into the
+ * node. In files with BTREE_FEATURE_LINKEDLEAVES, the right_page and
+ * left_page of a table leaf are read from the extended leaf header;
+ * in any other leaf they are 0. The bt field is set to bt, and the latch
+ * field to BTREE_LATCH_NONE (no latch is taken on the page; see
+ * chidb_Btree_getNodeLatched).
+ *
  * Parameters
  * - bt: B-Tree file
  * - npage: Page of node to load
@@ -158,6 +387,8 @@ int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn)
 /* Create a new B-Tree node
  *
  * Allocates a new page in the file and initializes it as a B-Tree node.
+ * The page should be allocated with chidb_Btree_allocatePage, so that
+ * pages in the freelist are reused before the file is extended.
  *
  * Parameters
  * - bt: B-Tree file
@@ -179,11 +410,391 @@ int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type)
 }
 
 
+/* Allocate a page
+ *
+ * Takes a page from the freelist, if it is not empty. Otherwise, a new
+ * page is allocated at the end of the file. Either way, the page is
+ * returned zeroed out.
+ *
+ * The freelist is stored like in SQLite: the file header contains the
+ * page number of the first freelist trunk page (at byte 32) and the total
+ * number of free pages (at byte 36). Each trunk page contains the page
+ * number of the next trunk page, followed by the number of leaf pages
+ * listed in the trunk, and by the page numbers of those leaf pages.
+ *
+ * The freelist is not covered by the latches of any B-Tree, so this
+ * holds the pager's lock (see chidb_Pager_lock) while it is updated.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Out parameter. Returns the number of the page that
+ *          was allocated.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The freelist is not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_allocatePage(BTree *bt, npage_t *npage)
+{
+    int rc;
+
+    chidb_Pager_lock(bt->pager);
+    rc = chidb_Btree_allocatePageLocked(bt, npage);
+    chidb_Pager_unlock(bt->pager);
+
+    return rc;
+}
+
+/* chidb_Btree_allocatePage, with the pager's lock held */
+static int chidb_Btree_allocatePageLocked(BTree *bt, npage_t *npage)
+{
+    MemPage *header, *trunk, *page;
+    npage_t ntrunk, nfree;
+    uint32_t nleaves;
+    int rc;
+
+    /* There is no file header yet */
+    if (bt->pager->n_pages == 0)
+        return chidb_Pager_allocatePage(bt->pager, npage);
+
+    rc = chidb_Pager_readPage(bt->pager, 1, &header);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    ntrunk = get4byte(header->data + HEADER_FREELIST_TRUNK_OFFSET);
+    nfree = get4byte(header->data + HEADER_FREELIST_COUNT_OFFSET);
+
+    if (ntrunk == 0)
+    {
+        chidb_Pager_releaseMemPage(bt->pager, header);
+        return chidb_Pager_allocatePage(bt->pager, npage);
+    }
+
+    if (ntrunk > bt->pager->n_pages || nfree == 0)
+    {
+        chidb_Pager_releaseMemPage(bt->pager, header);
+        return CHIDB_ECORRUPT;
+    }
+
+    rc = chidb_Pager_readPage(bt->pager, ntrunk, &trunk);
+    if (rc != CHIDB_OK)
+    {
+        chidb_Pager_releaseMemPage(bt->pager, header);
+        return rc;
+    }
+
+    nleaves = get4byte(trunk->data + FREELIST_NLEAVES_OFFSET);
+    if (nleaves > FREELIST_MAX_LEAVES(chidb_Pager_usableSize(bt->pager)))
+        rc = CHIDB_ECORRUPT;
+    else if (nleaves > 0)
+    {
+        /* Take the last leaf in the trunk */
+        *npage = get4byte(trunk->data + FREELIST_LEAVES_OFFSET + (nleaves - 1) * 4);
+        put4byte(trunk->data + FREELIST_NLEAVES_OFFSET, nleaves - 1);
+        rc = chidb_Pager_writePage(bt->pager, trunk);
+    }
+    else
+    {
+        /* The trunk has no leaves left, so we take the trunk itself */
+        *npage = ntrunk;
+        put4byte(header->data + HEADER_FREELIST_TRUNK_OFFSET,
+                 get4byte(trunk->data + FREELIST_NEXT_OFFSET));
+    }
+    chidb_Pager_releaseMemPage(bt->pager, trunk);
+
+    if (rc == CHIDB_OK && (*npage <= 1 || *npage > bt->pager->n_pages))
+        rc = CHIDB_ECORRUPT;
+
+    if (rc == CHIDB_OK)
+    {
+        put4byte(header->data + HEADER_FREELIST_COUNT_OFFSET, nfree - 1);
+        rc = chidb_Pager_writePage(bt->pager, header);
+    }
+    chidb_Pager_releaseMemPage(bt->pager, header);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    rc = chidb_Pager_readPage(bt->pager, *npage, &page);
+    if (rc != CHIDB_OK)
+        return rc;
+    memset(page->data, 0, bt->pager->page_size);
+    rc = chidb_Pager_writePage(bt->pager, page);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+
+    chilog(TRACE, "Reused page %i from the freelist", *npage);
+
+    return rc;
+}
+
+
+/* Free a page
+ *
+ * Adds a page to the freelist (see chidb_Btree_allocatePage), so it can
+ * be reused by a later allocation. The page must not be in use by any
+ * B-Tree. Like chidb_Btree_allocatePage, this holds the pager's lock.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Page to free
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: Invalid page number (page 1 can't be freed)
+ * - CHIDB_ECORRUPT: The freelist is not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_freePage(BTree *bt, npage_t npage)
+{
+    int rc;
+
+    chidb_Pager_lock(bt->pager);
+    rc = chidb_Btree_freePageLocked(bt, npage);
+    chidb_Pager_unlock(bt->pager);
+
+    return rc;
+}
+
+/* chidb_Btree_freePage, with the pager's lock held */
+static int chidb_Btree_freePageLocked(BTree *bt, npage_t npage)
+{
+    MemPage *header, *page;
+    npage_t ntrunk, nfree;
+    bool added = false;
+    int rc;
+
+    if (npage <= 1 || npage > bt->pager->n_pages)
+        return CHIDB_EPAGENO;
+
+    rc = chidb_Pager_readPage(bt->pager, 1, &header);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    ntrunk = get4byte(header->data + HEADER_FREELIST_TRUNK_OFFSET);
+    nfree = get4byte(header->data + HEADER_FREELIST_COUNT_OFFSET);
+
+    if (ntrunk > bt->pager->n_pages)
+        rc = CHIDB_ECORRUPT;
+    else if (ntrunk != 0)
+    {
+        /* Add the page as a leaf of the first trunk, if it has room */
+        rc = chidb_Pager_readPage(bt->pager, ntrunk, &page);
+        if (rc == CHIDB_OK)
+        {
+            uint32_t nleaves = get4byte(page->data + FREELIST_NLEAVES_OFFSET);
+
+            if (nleaves < FREELIST_MAX_LEAVES(chidb_Pager_usableSize(bt->pager)))
+            {
+                put4byte(page->data + FREELIST_LEAVES_OFFSET + nleaves * 4, npage);
+                put4byte(page->data + FREELIST_NLEAVES_OFFSET, nleaves + 1);
+                rc = chidb_Pager_writePage(bt->pager, page);
+                added = true;
+            }
+            chidb_Pager_releaseMemPage(bt->pager, page);
+        }
+    }
+
+    if (rc == CHIDB_OK && !added)
+    {
+        /* The page becomes the new first trunk */
+        rc = chidb_Pager_readPage(bt->pager, npage, &page);
+        if (rc == CHIDB_OK)
+        {
+            put4byte(page->data + FREELIST_NEXT_OFFSET, ntrunk);
+            put4byte(page->data + FREELIST_NLEAVES_OFFSET, 0);
+            rc = chidb_Pager_writePage(bt->pager, page);
+            chidb_Pager_releaseMemPage(bt->pager, page);
+        }
+        put4byte(header->data + HEADER_FREELIST_TRUNK_OFFSET, npage);
+    }
+
+    if (rc == CHIDB_OK)
+    {
+        put4byte(header->data + HEADER_FREELIST_COUNT_OFFSET, nfree + 1);
+        rc = chidb_Pager_writePage(bt->pager, header);
+    }
+    chidb_Pager_releaseMemPage(bt->pager, header);
+
+    if (rc == CHIDB_OK)
+        chilog(TRACE, "Added page %i to the freelist", npage);
+
+    return rc;
+}
+
+
+/* Compares two page numbers (for qsort) */
+static int chidb_Btree_cmpPages(const void *a, const void *b)
+{
+    npage_t pa = *(const npage_t *) a, pb = *(const npage_t *) b;
+
+    return (pa > pb) - (pa < pb);
+}
+
+
+/* Incremental vacuum
+ *
+ * Shrinks the file by removing free pages from the end of the file.
+ * Only free pages that are at the very end of the file can be removed
+ * (since pages in use are never moved), so this is most effective
+ * right after a large delete. The freelist is rebuilt with the pages
+ * that remain free, in file order, so later allocations are clustered
+ * at the beginning of the file.
+ *
+ * Since it truncates the file, this must not run concurrently with any
+ * other access to it.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nmax: Maximum number of pages to remove (0 to remove as many as possible)
+ * - nremoved: Out parameter (may be NULL). Number of pages that were removed
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The freelist is not well formed
+ * - CHIDB_EMISUSE: A page that would be removed is still in use
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_incrVacuum(BTree *bt, npage_t nmax, npage_t *nremoved)
+{
+    MemPage *header, *page;
+    npage_t *pages, nfree, npages = 0, last, ntrunk, removed = 0;
+    uint32_t maxleaves = FREELIST_MAX_LEAVES(chidb_Pager_usableSize(bt->pager));
+    int rc;
+
+    /* Vacuuming moves pages around, including the cached rightmost leaf */
+    chidb_Btree_cacheAppend(bt, 0, 0, 0);
+
+    if (nremoved != NULL)
+        *nremoved = 0;
+
+    if (bt->pager->n_pages == 0)
+        return CHIDB_OK;
+
+    rc = chidb_Pager_readPage(bt->pager, 1, &header);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    ntrunk = get4byte(header->data + HEADER_FREELIST_TRUNK_OFFSET);
+    nfree = get4byte(header->data + HEADER_FREELIST_COUNT_OFFSET);
+    if (nfree == 0)
+    {
+        chidb_Pager_releaseMemPage(bt->pager, header);
+        return CHIDB_OK;
+    }
+
+    pages = malloc(nfree * sizeof(npage_t));
+    if (pages == NULL)
+    {
+        chidb_Pager_releaseMemPage(bt->pager, header);
+        return CHIDB_ENOMEM;
+    }
+
+    /* Read the whole freelist */
+    while (ntrunk != 0 && rc == CHIDB_OK)
+    {
+        uint32_t nleaves;
+
+        if (ntrunk > bt->pager->n_pages || npages >= nfree)
+        {
+            rc = CHIDB_ECORRUPT;
+            break;
+        }
+
+        rc = chidb_Pager_readPage(bt->pager, ntrunk, &page);
+        if (rc != CHIDB_OK)
+            break;
+
+        pages[npages++] = ntrunk;
+        nleaves = get4byte(page->data + FREELIST_NLEAVES_OFFSET);
+        if (nleaves > maxleaves || npages + nleaves > nfree)
+            rc = CHIDB_ECORRUPT;
+        for (uint32_t i = 0; i < nleaves && rc == CHIDB_OK; i++)
+            pages[npages++] = get4byte(page->data + FREELIST_LEAVES_OFFSET + i * 4);
+        ntrunk = get4byte(page->data + FREELIST_NEXT_OFFSET);
+
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+    if (rc == CHIDB_OK && npages != nfree)
+        rc = CHIDB_ECORRUPT;
+
+    if (rc != CHIDB_OK)
+    {
+        free(pages);
+        chidb_Pager_releaseMemPage(bt->pager, header);
+        return rc;
+    }
+
+    /* Free pages at the end of the file can be removed */
+    qsort(pages, npages, sizeof(npage_t), chidb_Btree_cmpPages);
+    last = bt->pager->n_pages;
+    while (npages > 0 && pages[npages - 1] == last && (nmax == 0 || removed < nmax))
+    {
+        npages--;
+        last--;
+        removed++;
+    }
+
+    if (removed == 0)
+    {
+        free(pages);
+        chidb_Pager_releaseMemPage(bt->pager, header);
+        return CHIDB_OK;
+    }
+
+    /* Rebuild the freelist with the remaining pages: each trunk is
+     * followed (in file order) by the leaves it lists */
+    ntrunk = 0;
+    for (npage_t i = npages; i > 0 && rc == CHIDB_OK; )
+    {
+        npage_t first = i > maxleaves + 1 ? i - (maxleaves + 1) : 0;
+
+        rc = chidb_Pager_readPage(bt->pager, pages[first], &page);
+        if (rc != CHIDB_OK)
+            break;
+        put4byte(page->data + FREELIST_NEXT_OFFSET, ntrunk);
+        put4byte(page->data + FREELIST_NLEAVES_OFFSET, i - first - 1);
+        for (npage_t j = first + 1; j < i; j++)
+            put4byte(page->data + FREELIST_LEAVES_OFFSET + (j - first - 1) * 4, pages[j]);
+        rc = chidb_Pager_writePage(bt->pager, page);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+
+        ntrunk = pages[first];
+        i = first;
+    }
+    free(pages);
+
+    if (rc == CHIDB_OK)
+    {
+        put4byte(header->data + HEADER_FREELIST_TRUNK_OFFSET, ntrunk);
+        put4byte(header->data + HEADER_FREELIST_COUNT_OFFSET, npages);
+        rc = chidb_Pager_writePage(bt->pager, header);
+    }
+    chidb_Pager_releaseMemPage(bt->pager, header);
+
+    if (rc == CHIDB_OK)
+        rc = chidb_Pager_truncate(bt->pager, last);
+
+    if (rc == CHIDB_OK)
+    {
+        chilog(TRACE, "Incremental vacuum removed %i pages", removed);
+        if (nremoved != NULL)
+            *nremoved = removed;
+    }
+
+    return rc;
+}
+
+
 /* Initialize a B-Tree node
  *
  * Initializes a database page to contain an empty B-Tree node. The
  * database page is assumed to exist and to have been already allocated
- * by the pager.
+ * by the pager. The free space starts chidb_Btree_headerSize bytes into
+ * the node, and the right page (or, in linked table leaves, the next and
+ * previous leaves) is 0.
  *
  * Parameters
  * - bt: B-Tree file
@@ -212,7 +823,8 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
  * offset array and the cells themselves are modified directly on the
  * page, the only thing to do is to store the values of "type",
  * "free_offset", "n_cells", "cells_offset" and "right_page" in the
- * in-memory page.
+ * in-memory page. In files with BTREE_FEATURE_LINKEDLEAVES, a table leaf
+ * stores its "right_page" and "left_page" too.
  *
  * Parameters
  * - bt: B-Tree file
@@ -239,6 +851,34 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *btn)
  *     contents (refer to The chidb File Format document for
  *     the format of cells).
  *
+ * The data of a table leaf cell is not copied: fields.tableLeaf.data
+ * points directly into the in-memory page of btn. It is a borrowed
+ * pointer, valid only for as long as btn's page is pinned (i.e., until
+ * btn is freed with chidb_Btree_freeMemNode), and it must not be
+ * modified. Callers that need the data afterwards must copy it.
+ *
+ * If the record has overflow pages (its data_size is greater than
+ * chidb_Btree_localSize), only the first chidb_Btree_localSize bytes
+ * are in the cell, and fields.tableLeaf.overflow_page is read from the
+ * four bytes after them. Otherwise, overflow_page is 0. Use
+ * chidb_Btree_readPayload to read any part of the record.
+ *
+ * In files with BTREE_FEATURE_PACKEDINDEX (see btn->bt), index cells
+ * are read with the PACKEDIDX*CELL_* layout, using getUvarint32 for the
+ * keys of leaf cells. In files without BTREE_FEATURE_NORMKEY, the
+ * four-byte keyIdx of an index cell is an int32_t value, which is
+ * sign-extended into key (the same key that (chidb_key_t) gives for
+ * the value), and every other key is zero-extended.
+ *
+ * In files with BTREE_FEATURE_NORMKEY, cells are read with the
+ * NORMTABLE*CELL_* and NORMIDX*CELL_* layouts (see
+ * chidb_normkey_getRowid). The nkey of an index cell points to its
+ * normalized key in the page (like tableLeaf.data, it is borrowed),
+ * and nkey_size is its size; keyPk is decoded from its last
+ * NORMKEY_ROWID_SIZE bytes, and key from the value before them if it
+ * is an integer (see chidb_normkey_getInt), or is 0 otherwise. The
+ * nkey of any other cell is NULL.
+ *
  * Parameters
  * - btn: BTreeNode where cell is contained
  * - ncell: Cell number
@@ -256,67 +896,691 @@ int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
 }
 
 
-/* Insert a new cell into a B-Tree node
- *
- * Inserts a new cell into a B-Tree node at a specified position ncell.
- * This involves the following:
- *  1. Add the cell at the top of the cell area. This involves "translating"
- *     the BTreeCell into the chidb format (refer to The chidb File Format
- *     document for the format of cells).
- *  2. Modify cells_offset in BTreeNode to reflect the growth in the cell area.
- *  3. Modify the cell offset array so that all values in positions >= ncell
- *     are shifted one position forward in the array. Then, set the value of
- *     position ncell to be the offset of the newly added cell.
+/* How keys are stored in the cells of a node */
+enum keyformat
+{
+    KEY_VARINT32,  /* Table cells: a varint32 (see getVarint32) */
+    KEY_4BYTE,     /* Index cells: a four-byte integer */
+    KEY_UVARINT32  /* Packed index leaf cells: a uvarint32 (see getUvarint32) */
+};
+
+/* Reads the key of cell i straight from the page, without decoding the
+ * rest of the cell (in a file without BTREE_FEATURE_NORMKEY) */
+static inline uint32_t chidb_Btree_cellKey(const BTreeNode *btn, uint32_t keyoff, enum keyformat format, ncell_t i)
+{
+    const uint8_t *offset = btn->celloffset_array + 2 * i;
+    const uint8_t *p = btn->page->data + get2byte(offset) + keyoff;
+    uint32_t v;
+
+    if (format == KEY_UVARINT32)
+    {
+        /* Most keys are short, so look at the first byte by itself */
+        if (p[0] < 0x80)
+            return p[0];
+        getUvarint32(p, &v);
+        return v;
+    }
+
+    v = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+
+    if (format == KEY_4BYTE)
+        return v;
+
+    return (v & 0x7F) | ((v >> 1) & 0x3F80) | ((v >> 2) & 0x1FC000) | ((v >> 3) & 0xFE00000);
+}
+
+
+/* Counts how many of the n (at most NODESEARCH_WINDOW) keys are smaller than key */
+static inline ncell_t chidb_Btree_countLess(const uint32_t *keys, ncell_t n, uint32_t key)
+{
+#ifdef __SSE2__
+    /* SSE2 only has signed comparisons, so flip the sign bits */
+    const __m128i bias = _mm_set1_epi32((int) 0x80000000);
+    __m128i k = _mm_xor_si128(_mm_set1_epi32((int) key), bias);
+    __m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i *) keys), bias);
+    __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (keys + 4)), bias);
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(a, k))) |
+               (_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(b, k))) << 4);
+
+    return __builtin_popcount(mask & ((1 << n) - 1));
+#else
+    ncell_t count = 0;
+
+    for (ncell_t i = 0; i < n; i++)
+        count += keys[i] < key;
+
+    return count;
+#endif
+}
+
+/* Normalized key of cell i, read straight from the page (in a file with
+ * BTREE_FEATURE_NORMKEY). Table keys have a fixed size; index keys
+ * have theirs before them. */
+static inline const uint8_t *chidb_Btree_cellNormKey(const BTreeNode *btn, ncell_t i, uint16_t *size)
+{
+    const uint8_t *c = btn->page->data + get2byte(btn->celloffset_array + 2 * i);
+
+    switch (btn->type)
+    {
+    case PGTYPE_TABLE_INTERNAL:
+        *size = NORMKEY_ROWID_SIZE;
+        return c + NORMTABLEINTCELL_KEY_OFFSET;
+    case PGTYPE_TABLE_LEAF:
+        *size = NORMKEY_ROWID_SIZE;
+        return c + NORMTABLELEAFCELL_KEY_OFFSET;
+    case PGTYPE_INDEX_INTERNAL:
+        *size = get2byte(c + NORMIDXINTCELL_KEYSIZE_OFFSET);
+        return c + NORMIDXINTCELL_KEY_OFFSET;
+    default:
+        *size = get2byte(c + NORMIDXLEAFCELL_KEYSIZE_OFFSET);
+        return c + NORMIDXLEAFCELL_KEY_OFFSET;
+    }
+}
+
+
+/* Normalized key of an index cell
  *
- * This function assumes that there is enough space for this cell in this node.
+ * In a file with BTREE_FEATURE_NORMKEY, the key of an index cell is
+ * its nkey or, if that is NULL, the normalized integer key followed by
+ * keyPk (see normkey.h), which is encoded into buf.
  *
  * Parameters
- * - btn: BTreeNode to insert cell in
- * - ncell: Cell number
- * - cell: BTreeCell to insert.
+ * - cell: An index cell
+ * - buf: Buffer of at least NORMKEY_INT_SIZE + NORMKEY_ROWID_SIZE bytes
+ * - size: Out-parameter where the size of the key is stored
  *
  * Return
- * - CHIDB_OK: Operation successful
- * - CHIDB_ECELLNO: The provided cell number is invalid
+ * - The key (either cell->nkey or buf)
  */
-int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
+const uint8_t *chidb_Btree_indexKey(BTreeCell *cell, uint8_t *buf, uint16_t *size)
 {
-    /* Your code goes here */
+    chidb_key_t keyPk;
 
-    return CHIDB_OK;
+    if (cell->nkey != NULL)
+    {
+        *size = cell->nkey_size;
+        return cell->nkey;
+    }
+
+    keyPk = cell->type == PGTYPE_INDEX_LEAF ? cell->fields.indexLeaf.keyPk : cell->fields.indexInternal.keyPk;
+    *size = chidb_normkey_int(buf, (int64_t) cell->key);
+    chidb_normkey_putRowid(buf + *size, keyPk);
+    *size += NORMKEY_ROWID_SIZE;
+
+    return buf;
 }
 
-/* Find an entry in a table B-Tree
+
+/* Search for a normalized key in a B-Tree node
  *
- * Finds the data associated for a given key in a table B-Tree
+ * Finds the position of a key in a node of a file with
+ * BTREE_FEATURE_NORMKEY, like chidb_Btree_nodeSearch: the first cell
+ * whose key is greater than or equal to nkey. Since normalized keys
+ * sort like byte strings, each cell that the binary search probes is
+ * compared with a single memcmp, whatever the type of the indexed
+ * values, and the search doesn't branch on the outcome.
+ *
+ * The key can be a prefix of the keys of the cells: an indexed value
+ * by itself (see chidb_normkey_int and chidb_normkey_text) finds the
+ * first entry with that value, whatever its keyPk.
  *
  * Parameters
- * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want search in
- * - key: Entry key
- * - data: Out-parameter where a copy of the data must be stored
- * - size: Out-parameter where the number of bytes of data must be stored
+ * - btn: BTreeNode to search in
+ * - nkey: Normalized key to look for (a rowid, see
+ *         chidb_normkey_putRowid, in a table node)
+ * - size: Size of nkey
+ * - ncell: Out-parameter where the position of the key must be stored
+ *          (between 0 and btn->n_cells)
  *
  * Return
- * - CHIDB_OK: Operation successful
- * - CHIDB_ENOTFOUND: No entry with the given key way found
- * - CHIDB_ENOMEM: Could not allocate memory
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_OK: The key of cell ncell starts with nkey
+ * - CHIDB_ENOTFOUND: No cell has a key that starts with nkey
  */
-int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size)
+int chidb_Btree_nodeSearchKey(BTreeNode *btn, const uint8_t *nkey, uint16_t size, ncell_t *ncell)
 {
-    /* Your code goes here */
+    ncell_t base = 0, n = btn->n_cells;
+    const uint8_t *k;
+    uint16_t ksize;
+
+    /* Invariant: every cell before base has a smaller key, and the
+     * position of nkey is at most base + n */
+    while (n > 1)
+    {
+        ncell_t half = n / 2;
+
+        k = chidb_Btree_cellNormKey(btn, base + half, &ksize);
+        base = chidb_normkey_cmp(k, ksize, nkey, size) < 0 ? base + half : base;
+        n -= half;
+    }
+    if (n == 1)
+    {
+        k = chidb_Btree_cellNormKey(btn, base, &ksize);
+        base += chidb_normkey_cmp(k, ksize, nkey, size) < 0;
+    }
+
+    *ncell = base;
+    if (base == btn->n_cells)
+        return CHIDB_ENOTFOUND;
+
+    k = chidb_Btree_cellNormKey(btn, base, &ksize);
+    return ksize >= size && memcmp(k, nkey, size) == 0 ? CHIDB_OK : CHIDB_ENOTFOUND;
+}
+
+
+/* Search for a key in a B-Tree node
+ *
+ * Finds the position of key in a node: the first cell whose key is
+ * greater than or equal to key (for index nodes, keyIdx is used). In a
+ * table internal node, this is the cell whose child page must be
+ * followed to find key (or the right page, if ncell == n_cells). In a
+ * leaf node, it is where key is found or must be inserted.
+ *
+ * This binary-searches the cell offset array, reading only the key of
+ * each cell it probes from the page, and doesn't branch on the outcome
+ * of each comparison. The last few candidates are compared all at
+ * once (with SSE2 where available). Only the low 32 bits of key are
+ * compared, since that is all the keys of the file have.
+ *
+ * In a file with BTREE_FEATURE_NORMKEY, key is normalized (as a rowid
+ * in a table node, and as an integer value in an index node, see
+ * chidb_Btree_indexKey) and searched for with
+ * chidb_Btree_nodeSearchKey.
+ *
+ * Parameters
+ * - btn: BTreeNode to search in
+ * - key: Key to look for
+ * - ncell: Out-parameter where the position of key must be stored
+ *          (between 0 and btn->n_cells)
+ *
+ * Return
+ * - CHIDB_OK: Cell ncell has exactly the given key
+ * - CHIDB_ENOTFOUND: No cell has the given key
+ */
+int chidb_Btree_nodeSearch(BTreeNode *btn, chidb_key_t key, ncell_t *ncell)
+{
+    uint32_t window[NODESEARCH_WINDOW];
+    uint32_t keyoff, key32 = (uint32_t) key;
+    enum keyformat format = KEY_VARINT32;
+    bool packed = btn->bt->features & BTREE_FEATURE_PACKEDINDEX;
+    ncell_t base = 0, n = btn->n_cells, i;
+
+    if (btn->bt->features & BTREE_FEATURE_NORMKEY)
+    {
+        uint8_t nkey[NORMKEY_INT_SIZE];
+
+        if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_TABLE_LEAF)
+        {
+            chidb_normkey_putRowid(nkey, key);
+            return chidb_Btree_nodeSearchKey(btn, nkey, NORMKEY_ROWID_SIZE, ncell);
+        }
+        return chidb_Btree_nodeSearchKey(btn, nkey, chidb_normkey_int(nkey, (int64_t) key), ncell);
+    }
+
+    switch (btn->type)
+    {
+    case PGTYPE_TABLE_INTERNAL:
+        keyoff = TABLEINTCELL_KEY_OFFSET;
+        break;
+    case PGTYPE_TABLE_LEAF:
+        keyoff = TABLELEAFCELL_KEY_OFFSET;
+        break;
+    case PGTYPE_INDEX_INTERNAL:
+        keyoff = packed ? PACKEDIDXINTCELL_KEYIDX_OFFSET : INDEXINTCELL_KEYIDX_OFFSET;
+        format = KEY_4BYTE;
+        break;
+    default:
+        keyoff = packed ? 0 : INDEXLEAFCELL_KEYIDX_OFFSET;
+        format = packed ? KEY_UVARINT32 : KEY_4BYTE;
+        break;
+    }
+
+    /* Invariant: every cell before base has a smaller key, and the
+     * position of key is at most base + n */
+    while (n > NODESEARCH_WINDOW)
+    {
+        ncell_t half = n / 2;
+
+        base = chidb_Btree_cellKey(btn, keyoff, format, base + half) < key32 ? base + half : base;
+        n -= half;
+    }
+
+    for (i = 0; i < NODESEARCH_WINDOW; i++)
+        window[i] = i < n ? chidb_Btree_cellKey(btn, keyoff, format, base + i) : 0;
+    base += chidb_Btree_countLess(window, n, key32);
+
+    *ncell = base;
+    if (base < btn->n_cells && chidb_Btree_cellKey(btn, keyoff, format, base) == key32)
+        return CHIDB_OK;
+    else
+        return CHIDB_ENOTFOUND;
+}
+
+
+/* Insert a new cell into a B-Tree node
+ *
+ * Inserts a new cell into a B-Tree node at a specified position ncell.
+ * This involves the following:
+ *  1. Add the cell at the top of the cell area. This involves "translating"
+ *     the BTreeCell into the chidb format (refer to The chidb File Format
+ *     document for the format of cells).
+ *  2. Modify cells_offset in BTreeNode to reflect the growth in the cell area.
+ *  3. Modify the cell offset array so that all values in positions >= ncell
+ *     are shifted one position forward in the array. Then, set the value of
+ *     position ncell to be the offset of the newly added cell.
+ *
+ * This function assumes that there is enough space for this cell in this node.
+ *
+ * A table leaf cell whose data_size is greater than chidb_Btree_localSize
+ * must have been spilled to overflow pages (see chidb_Btree_spillCell),
+ * or come from chidb_Btree_getCell: only the local part of the data is
+ * copied to the cell, followed by overflow_page. For any other table leaf
+ * cell, overflow_page is ignored.
+ *
+ * In files with BTREE_FEATURE_PACKEDINDEX, index cells are written with
+ * the PACKEDIDX*CELL_* layout. In files with BTREE_FEATURE_NORMKEY,
+ * cells are written with the NORMTABLE*CELL_* and NORMIDX*CELL_*
+ * layouts, and the key of an index cell is the one given by
+ * chidb_Btree_indexKey. Either way, the cell takes chidb_Btree_cellSize
+ * bytes.
+ *
+ * Parameters
+ * - btn: BTreeNode to insert cell in
+ * - ncell: Cell number
+ * - cell: BTreeCell to insert.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECELLNO: The provided cell number is invalid
+ */
+int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
+{
+    /* Your code goes here */
+
+    return CHIDB_OK;
+}
+
+/* Find an entry in a table B-Tree
+ *
+ * Finds the data associated for a given key in a table B-Tree. This is
+ * the same as chidb_Btree_find2, except that it can only return records
+ * of up to 65535 bytes (larger ones make it fail with CHIDB_EMISUSE).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want search in
+ * - key: Entry key
+ * - data: Out-parameter where a copy of the data must be stored
+ * - size: Out-parameter where the number of bytes of data must be stored
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key way found
+ * - CHIDB_EMISUSE: The record is larger than 65535 bytes
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size)
+{
+    /* Your code goes here */
+
+    return CHIDB_OK;
+}
+
+
+/* Find an entry in a table B-Tree
+ *
+ * Finds the data associated for a given key in a table B-Tree, like
+ * chidb_Btree_find, but for records of any size.
+ *
+ * Lookups first descend the tree without taking any latches (see
+ * chidb_Btree_findOptimistic), so concurrent lookups don't write to any
+ * shared latch. Only if that keeps failing because of concurrent
+ * writers, or if the record has overflow pages, does the lookup latch
+ * its path with chidb_Btree_findCell.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want search in
+ * - key: Entry key
+ * - data: Out-parameter where a copy of the data must be stored
+ * - size: Out-parameter where the number of bytes of data must be stored
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key way found
+ * - CHIDB_ECORRUPT: The record's overflow pages are not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_find2(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint32_t *size)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    int rc;
+
+    rc = chidb_Btree_findOptimistic(bt, nroot, key, data, size);
+    if (rc != CHIDB_EMISUSE)
+        return rc;
+
+    rc = chidb_Btree_findCell(bt, nroot, key, &btn, &cell);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    *size = cell.fields.tableLeaf.data_size;
+    *data = malloc(*size);
+    if (*data == NULL)
+        rc = CHIDB_ENOMEM;
+    else
+        rc = chidb_Btree_readPayload(bt, &cell, 0, *size, *data);
+    chidb_Btree_releaseNode(bt, btn);
+
+    if (rc != CHIDB_OK)
+        free(*data);
+
+    return rc;
+}
+
+
+/* Result of chidb_Btree_tryFindOptimistic when the lookup must start
+ * over, and of chidb_Btree_insertAppend when the regular path is needed */
+#define BTREE_RESTART (-1)
+#define BTREE_NEEDSPLIT (-2)
+
+/* Checks that a node read without a latch can be searched: a node read
+ * while it was being modified may have any type and number of cells */
+static bool chidb_Btree_nodeSane(BTree *bt, BTreeNode *btn)
+{
+    if (btn->type != PGTYPE_TABLE_INTERNAL && btn->type != PGTYPE_TABLE_LEAF)
+        return false;
+
+    return (btn->celloffset_array - btn->page->data) + 2 * (uint32_t) btn->n_cells <= bt->pager->page_size;
+}
+
+/* One attempt of chidb_Btree_findOptimistic */
+static int chidb_Btree_tryFindOptimistic(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint32_t *size)
+{
+    BTreeNode *node, *parent = NULL;
+    BTreeCell cell;
+    MemPage *page;
+    uint32_t version, parent_version = 0;
+    npage_t npage = nroot;
+    ncell_t i;
+    bool found, valid;
+
+    for (;;)
+    {
+        if (chidb_Pager_readPage(bt->pager, npage, &page) != CHIDB_OK)
+        {
+            if (parent != NULL)
+                chidb_Btree_freeMemNode(bt, parent);
+            return BTREE_RESTART;
+        }
+        version = chidb_Pager_pageVersion(page);
+
+        /* The parent still pointed to this page when its version was read */
+        if (parent != NULL)
+        {
+            valid = chidb_Pager_validatePage(parent->page, parent_version);
+            chidb_Btree_freeMemNode(bt, parent);
+            parent = NULL;
+            if (!valid)
+            {
+                chidb_Pager_releaseMemPage(bt->pager, page);
+                return BTREE_RESTART;
+            }
+        }
+
+        if ((version & 1) || chidb_Btree_getNodeByPage(bt, npage, &node) != CHIDB_OK)
+        {
+            chidb_Pager_releaseMemPage(bt->pager, page);
+            return BTREE_RESTART;
+        }
+        chidb_Pager_releaseMemPage(bt->pager, page);
+
+        if (!chidb_Btree_nodeSane(bt, node))
+        {
+            chidb_Btree_freeMemNode(bt, node);
+            return BTREE_RESTART;
+        }
+
+        found = chidb_Btree_nodeSearch(node, key, &i) == CHIDB_OK;
+        if (node->type == PGTYPE_TABLE_LEAF)
+            break;
+
+        /* Don't even read a page that a torn cell points to */
+        npage = chidb_Btree_childPage(node, i);
+        if (!chidb_Pager_validatePage(node->page, version))
+        {
+            chidb_Btree_freeMemNode(bt, node);
+            return BTREE_RESTART;
+        }
+        parent = node;
+        parent_version = version;
+    }
+
+    if (!found)
+    {
+        valid = chidb_Pager_validatePage(node->page, version);
+        chidb_Btree_freeMemNode(bt, node);
+        return valid ? CHIDB_ENOTFOUND : BTREE_RESTART;
+    }
+
+    chidb_Btree_getCell(node, i, &cell);
+    *size = cell.fields.tableLeaf.data_size;
+    if (*size > chidb_Btree_localSize(bt, *size) || cell.fields.tableLeaf.data < node->page->data ||
+        cell.fields.tableLeaf.data + *size > node->page->data + bt->pager->page_size)
+    {
+        /* Records with overflow pages are left to chidb_Btree_findCell */
+        valid = chidb_Pager_validatePage(node->page, version);
+        chidb_Btree_freeMemNode(bt, node);
+        return valid ? CHIDB_EMISUSE : BTREE_RESTART;
+    }
+
+    *data = malloc(*size);
+    if (*data == NULL)
+    {
+        chidb_Btree_freeMemNode(bt, node);
+        return CHIDB_ENOMEM;
+    }
+    memcpy(*data, cell.fields.tableLeaf.data, *size);
+
+    valid = chidb_Pager_validatePage(node->page, version);
+    chidb_Btree_freeMemNode(bt, node);
+    if (!valid)
+    {
+        free(*data);
+        return BTREE_RESTART;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Find an entry in a table B-Tree without latching it
+ *
+ * Same as chidb_Btree_find2, but none of the nodes on the path are
+ * latched. Instead, the version of each page is recorded before reading
+ * it (see chidb_Pager_pageVersion), and checked again before anything
+ * read from it is used: before following a child pointer (while the
+ * child's version is read, so that a split can't move the key out of
+ * the child in between), and after copying the record out of the leaf.
+ * If a check fails, a writer modified the page, and the lookup starts
+ * over from the root.
+ *
+ * Nodes read this way may be inconsistent until their version is
+ * checked, so this only searches nodes whose header makes sense (see
+ * chidb_Btree_nodeSane), and only copies data that lies within the
+ * page. Pages are still pinned while they are read, so they can't be
+ * evicted from under the lookup.
+ *
+ * Like chidb_Btree_findCell, this is only safe against writers that
+ * latch the nodes they modify (see chidb_Btree_insertLatched).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want search in
+ * - key: Entry key
+ * - data: Out-parameter where a copy of the data must be stored
+ * - size: Out-parameter where the number of bytes of data must be stored
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key way found
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EMISUSE: The lookup was restarted BTREE_OLC_RETRIES times, the
+ *                  record has overflow pages, or a page could not be
+ *                  read. The lookup must be done with chidb_Btree_findCell.
+ */
+static int chidb_Btree_findOptimistic(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint32_t *size)
+{
+    int rc;
+
+    for (uint32_t attempt = 0; attempt < BTREE_OLC_RETRIES; attempt++)
+    {
+        rc = chidb_Btree_tryFindOptimistic(bt, nroot, key, data, size);
+        if (rc != BTREE_RESTART)
+            return rc;
+    }
+
+    chilog(TRACE, "Optimistic lookup of key %" PRIu64 " gave up after %i attempts", (uint64_t) key, BTREE_OLC_RETRIES);
+
+    return CHIDB_EMISUSE;
+}
+
+
+/* Find the cell of an entry in a table B-Tree
+ *
+ * Finds the leaf cell with a given key, without reading any of its
+ * overflow pages. The leaf node is returned too, and its page remains
+ * pinned (and latched, see below) until the caller releases it with
+ * chidb_Btree_releaseNode; the cell's data (see chidb_Btree_getCell) is
+ * only valid until then. Parts
+ * of the record can then be read with chidb_Btree_readPayload, so a
+ * caller that only needs the first columns of a large record doesn't
+ * read its overflow pages at all.
+ *
+ * The tree is descended with shared latches (see
+ * chidb_Btree_getNodeLatched): the child's latch is taken before the
+ * parent's is released, so that a concurrent split can't move the key
+ * out of the child in between. Several lookups can then run at once,
+ * and they only wait for writers that are modifying the nodes they
+ * reach. The leaf keeps its shared latch until it is released, so the
+ * calling thread must not modify the tree before that.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want search in
+ * - key: Entry key
+ * - btn: Out-parameter where the leaf node containing the entry is
+ *        stored (only if the entry is found)
+ * - cell: Out-parameter where the cell is stored
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key way found
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_findCell(BTree *bt, npage_t nroot, chidb_key_t key, BTreeNode **btn, BTreeCell *cell)
+{
+    BTreeNode *node;
+    npage_t npage = nroot;
+    ncell_t i;
+    int rc;
+
+    rc = chidb_Btree_getNodeLatched(bt, npage, BTREE_LATCH_SHARED, &node);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    while (node->type != PGTYPE_TABLE_LEAF)
+    {
+        BTreeNode *child;
+
+        /* Descend into the first child whose keys can include key */
+        chidb_Btree_nodeSearch(node, key, &i);
+        npage = chidb_Btree_childPage(node, i);
+
+        rc = chidb_Btree_getNodeLatched(bt, npage, BTREE_LATCH_SHARED, &child);
+        chidb_Btree_releaseNode(bt, node);
+        if (rc != CHIDB_OK)
+            return rc;
+        node = child;
+    }
+
+    if (chidb_Btree_nodeSearch(node, key, &i) != CHIDB_OK)
+    {
+        chidb_Btree_releaseNode(bt, node);
+        return CHIDB_ENOTFOUND;
+    }
+
+    chidb_Btree_getCell(node, i, cell);
+    *btn = node;
 
     return CHIDB_OK;
 }
 
 
+/* Find an entry in a table B-Tree, without copying its data
+ *
+ * Same as chidb_Btree_find, but instead of returning a copy of the
+ * data, returns a pointer to the data in the in-memory page of the
+ * leaf node where the entry was found (see chidb_Btree_getCell). That
+ * node is returned too, and its page remains pinned and latched until
+ * the caller releases it with chidb_Btree_releaseNode (see
+ * chidb_Btree_findCell); data is only valid until then.
+ * This saves a malloc and a memcpy of the whole record per lookup.
+ *
+ * Records with overflow pages are not contiguous in memory, so they
+ * can't be returned by this function (use chidb_Btree_findCell).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want search in
+ * - key: Entry key
+ * - btn: Out-parameter where the leaf node containing the entry is
+ *        stored (only if the entry is found)
+ * - data: Out-parameter where a pointer to the data must be stored
+ * - size: Out-parameter where the number of bytes of data must be stored
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key way found
+ * - CHIDB_EMISUSE: The record has overflow pages
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_findRef(BTree *bt, npage_t nroot, chidb_key_t key, BTreeNode **btn,
+                        uint8_t **data, uint16_t *size)
+{
+    BTreeCell cell;
+    int rc;
+
+    rc = chidb_Btree_findCell(bt, nroot, key, btn, &cell);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if (cell.fields.tableLeaf.data_size > chidb_Btree_localSize(bt, cell.fields.tableLeaf.data_size))
+    {
+        chidb_Btree_releaseNode(bt, *btn);
+        return CHIDB_EMISUSE;
+    }
+
+    *data = cell.fields.tableLeaf.data;
+    *size = cell.fields.tableLeaf.data_size;
+
+    return CHIDB_OK;
+}
+
 
 /* Insert an entry into a table B-Tree
  *
  * This is a convenience function that wraps around chidb_Btree_insert.
  * It takes a key and data, and creates a BTreeCell that can be passed
- * along to chidb_Btree_insert.
+ * along to chidb_Btree_insertLatched (which calls chidb_Btree_insert
+ * when nodes have to be split, and makes the insertion safe to run
+ * concurrently with other insertions and lookups). If the data doesn't
+ * fit in a cell, it is first spilled to overflow pages with
+ * chidb_Btree_spillCell (which are freed with chidb_Btree_freeOverflow
+ * if the insertion fails).
  *
  * Parameters
  * - bt: B-Tree file
@@ -332,7 +1596,7 @@ int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data,
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size)
+int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint32_t size)
 {
     /* Your code goes here */
 
@@ -344,7 +1608,7 @@ int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t
  *
  * This is a convenience function that wraps around chidb_Btree_insert.
  * It takes a KeyIdx and a KeyPk, and creates a BTreeCell that can be passed
- * along to chidb_Btree_insert.
+ * along to chidb_Btree_insertLatched (see chidb_Btree_insertInTable).
  *
  * Parameters
  * - bt: B-Tree file
@@ -375,7 +1639,14 @@ int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chid
  * insertion. chidb_Btree_insert, however, first checks if the root
  * has to be split (a splitting operation that is different from
  * splitting any other node). If so, chidb_Btree_split is called
- * before calling chidb_Btree_insertNonFull.
+ * before calling chidb_Btree_insertNonFull. (A root that is a leaf is the
+ * only leaf of its tree, so it has no siblings to keep linked.) A node
+ * has to be split when chidb_Btree_nodeFull says so.
+ *
+ * This function, chidb_Btree_insertNonFull and chidb_Btree_split do not
+ * take any latches: the caller must make sure that no other thread can
+ * access the nodes they modify (chidb_Btree_insertLatched does this by
+ * holding exclusive latches on them).
  *
  * Parameters
  * - bt: B-Tree file
@@ -404,8 +1675,8 @@ int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
  * position according to its key. If the node is an internal node, the
  * function will determine what child node it must insert it in, and
  * calls itself recursively on that child node. However, before doing so
- * it will check if the child node is full or not. If it is, then it will
- * have to be split first.
+ * it will check if the child node is full or not (with
+ * chidb_Btree_nodeFull). If it is, then it will have to be split first.
  *
  * Parameters
  * - bt: B-Tree file
@@ -436,6 +1707,9 @@ int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc)
  *   cell is a table leaf cell, the median cell is moved too)
  * - Add a cell to the parent (which, by definition, will be an
  *   internal page) with the median key and the page number of M.
+ * - If N is a table leaf in a file with BTREE_FEATURE_LINKEDLEAVES,
+ *   insert M before N in the list of leaves with chidb_Btree_linkLeaf
+ *   (before writing N and M to disk).
  *
  * Parameters
  * - bt: B-Tree file
@@ -457,3 +1731,3319 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
     return CHIDB_OK;
 }
 
+
+
+/* Size of a node's header
+ *
+ * Returns the size of the header of a node of the given type, which is
+ * the offset (from the start of the node) of its cell offset array.
+ * Table leaves have a larger header in files with
+ * BTREE_FEATURE_LINKEDLEAVES, to store their siblings.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - type: Type of B-Tree node
+ *
+ * Return
+ * - The size of the header in bytes
+ */
+uint32_t chidb_Btree_headerSize(BTree *bt, uint8_t type)
+{
+    switch (type)
+    {
+    case PGTYPE_TABLE_INTERNAL:
+    case PGTYPE_INDEX_INTERNAL:
+        return INTPG_CELLSOFFSET_OFFSET;
+    case PGTYPE_TABLE_LEAF:
+        if (bt->features & BTREE_FEATURE_LINKEDLEAVES)
+            return LINKEDLEAFPG_CELLSOFFSET_OFFSET;
+        return LEAFPG_CELLSOFFSET_OFFSET;
+    default:
+        return LEAFPG_CELLSOFFSET_OFFSET;
+    }
+}
+
+
+/* Link a new table leaf before another one
+ *
+ * Inserts a new leaf into the list of leaves of a table B-Tree, right
+ * before another leaf. This is how chidb_Btree_split keeps the list up
+ * to date: the new node holds the lower half of the cells, so it goes
+ * between the node being split and its previous leaf. The previous leaf
+ * (if any) is updated on disk; btn and left are only updated in memory,
+ * and must be written by the caller.
+ *
+ * The previous leaf is not on the path that the caller has latched, so
+ * it is latched in exclusive mode while it is updated. Leaves are only
+ * ever latched from right to left while holding another leaf, so this
+ * can't deadlock with other splits.
+ *
+ * Does nothing if the file does not have BTREE_FEATURE_LINKEDLEAVES, or
+ * if the nodes are not table leaves.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - btn: Leaf already in the list
+ * - left: New leaf to link before btn
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_linkLeaf(BTree *bt, BTreeNode *btn, BTreeNode *left)
+{
+    BTreeNode *prev;
+    int rc;
+
+    if (!(bt->features & BTREE_FEATURE_LINKEDLEAVES) || btn->type != PGTYPE_TABLE_LEAF)
+        return CHIDB_OK;
+
+    if (btn->left_page != 0)
+    {
+        rc = chidb_Btree_getNodeLatched(bt, btn->left_page, BTREE_LATCH_EXCLUSIVE, &prev);
+        if (rc != CHIDB_OK)
+            return rc;
+        prev->right_page = left->page->npage;
+        rc = chidb_Btree_writeNode(bt, prev);
+        chidb_Btree_releaseNode(bt, prev);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    left->left_page = btn->left_page;
+    left->right_page = btn->page->npage;
+    btn->left_page = left->page->npage;
+
+    return CHIDB_OK;
+}
+
+
+/* Load the next leaf of a table B-Tree
+ *
+ * In files with BTREE_FEATURE_LINKEDLEAVES, a cursor that reaches the
+ * end of a table leaf can move to the next one with a single page read,
+ * instead of going back up the tree. No latch is taken on the next leaf,
+ * so this must not be used while the tree is being modified.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - btn: Table leaf
+ * - next: Out parameter. Used to return the next leaf, which must be
+ *         freed with chidb_Btree_freeMemNode.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: btn is the last leaf
+ * - CHIDB_EMISUSE: The file does not have linked leaves, or btn is not
+ *                  a table leaf
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_nextLeaf(BTree *bt, BTreeNode *btn, BTreeNode **next)
+{
+    if (!(bt->features & BTREE_FEATURE_LINKEDLEAVES) || btn->type != PGTYPE_TABLE_LEAF)
+        return CHIDB_EMISUSE;
+
+    if (btn->right_page == 0)
+        return CHIDB_ENOTFOUND;
+
+    return chidb_Btree_getNodeByPage(bt, btn->right_page, next);
+}
+
+
+/* Load the previous leaf of a table B-Tree
+ *
+ * Like chidb_Btree_nextLeaf, but in the other direction.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - btn: Table leaf
+ * - prev: Out parameter. Used to return the previous leaf, which must be
+ *         freed with chidb_Btree_freeMemNode.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: btn is the first leaf
+ * - CHIDB_EMISUSE: The file does not have linked leaves, or btn is not
+ *                  a table leaf
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_prevLeaf(BTree *bt, BTreeNode *btn, BTreeNode **prev)
+{
+    if (!(bt->features & BTREE_FEATURE_LINKEDLEAVES) || btn->type != PGTYPE_TABLE_LEAF)
+        return CHIDB_EMISUSE;
+
+    if (btn->left_page == 0)
+        return CHIDB_ENOTFOUND;
+
+    return chidb_Btree_getNodeByPage(bt, btn->left_page, prev);
+}
+
+
+/* Count the entries of a B-Tree
+ *
+ * Adds up the number of cells of the leaves (and, in an index, of the
+ * internal nodes, whose cells are entries too) without reading the
+ * cells themselves: internal nodes are only read for their child pages,
+ * which are prefetched before they are visited. This is what a COUNT(*)
+ * without a WHERE clause needs, and it doesn't decode a single record.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Root of the B-Tree
+ * - n: Out parameter. Number of entries.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_count(BTree *bt, npage_t npage, uint64_t *n)
+{
+    BTreeNode *btn;
+    int rc;
+
+    *n = 0;
+    if ((rc = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+        return rc;
+
+    if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
+    {
+        *n = btn->n_cells;
+        return chidb_Btree_freeMemNode(bt, btn);
+    }
+
+    if (btn->type == PGTYPE_INDEX_INTERNAL)
+        *n = btn->n_cells;
+    chidb_Btree_prefetchChildren(bt, btn, 0, btn->n_cells + 1);
+
+    for (ncell_t i = 0; i <= btn->n_cells && rc == CHIDB_OK; i++)
+    {
+        uint64_t nchild;
+
+        if ((rc = chidb_Btree_count(bt, chidb_Btree_childPage(btn, i), &nchild)) == CHIDB_OK)
+            *n += nchild;
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return rc;
+}
+
+
+/* Split a table B-Tree into morsels
+ *
+ * A morsel is a subtree of the table: its root is a valid root for a
+ * cursor, which then reads a range of leaves. The nodes of the B-Tree
+ * are expanded a level at a time, from the root down, until there are
+ * at least n of them, or they are leaves. The morsels are returned in
+ * key order, and, together, they have every row of the table. Only
+ * internal nodes are read.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root of a table B-Tree
+ * - n: Number of morsels wanted
+ * - morsels: Out parameter. A malloc'd array with the root page of each
+ *            morsel, which the caller must free.
+ * - nmorsels: Out parameter. Number of morsels.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The B-Tree is an index (its internal cells are
+ *   entries too, so its subtrees don't hold all of them)
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_morsels(BTree *bt, npage_t nroot, uint32_t n, npage_t **morsels, uint32_t *nmorsels)
+{
+    npage_t *level, *next;
+    uint32_t nlevel = 1, nnext;
+    BTreeNode *btn;
+    int rc;
+
+    *morsels = NULL;
+    *nmorsels = 0;
+    if ((level = malloc(sizeof(npage_t))) == NULL)
+        return CHIDB_ENOMEM;
+    level[0] = nroot;
+
+    while (nlevel < n)
+    {
+        next = NULL;
+        nnext = 0;
+
+        for (uint32_t i = 0; i < nlevel; i++)
+        {
+            npage_t *grown;
+
+            if ((rc = chidb_Btree_getNodeByPage(bt, level[i], &btn)) != CHIDB_OK)
+                goto fail;
+
+            if (btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_INDEX_LEAF)
+                rc = CHIDB_EMISUSE;
+            else if (btn->type == PGTYPE_TABLE_LEAF)
+            {
+                /* All the leaves are at the same depth */
+                chidb_Btree_freeMemNode(bt, btn);
+                free(next);
+                goto done;
+            }
+            else if ((grown = realloc(next, (nnext + btn->n_cells + 1) * sizeof(npage_t))) == NULL)
+                rc = CHIDB_ENOMEM;
+            else
+            {
+                next = grown;
+                for (ncell_t j = 0; j <= btn->n_cells; j++)
+                    next[nnext++] = chidb_Btree_childPage(btn, j);
+            }
+            chidb_Btree_freeMemNode(bt, btn);
+
+            if (rc != CHIDB_OK)
+            {
+                free(next);
+                goto fail;
+            }
+        }
+
+        free(level);
+        level = next;
+        nlevel = nnext;
+    }
+
+done:
+    *morsels = level;
+    *nmorsels = nlevel;
+    return CHIDB_OK;
+
+fail:
+    free(level);
+    return rc;
+}
+
+
+/* Smallest or largest key of a B-Tree: the first cell of its leftmost
+ * leaf, or the last cell of its rightmost one, reached by following the
+ * first child (or right_page) of each internal node */
+static int chidb_Btree_edgeKey(BTree *bt, npage_t npage, bool last, chidb_key_t *key)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    int rc;
+
+    for (;;)
+    {
+        if ((rc = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+            return rc;
+
+        if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
+            break;
+
+        npage = chidb_Btree_childPage(btn, last ? btn->n_cells : 0);
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+
+    if (btn->n_cells == 0)
+        rc = CHIDB_ENOTFOUND;
+    else if ((rc = chidb_Btree_getCell(btn, last ? btn->n_cells - 1 : 0, &cell)) == CHIDB_OK)
+        *key = cell.key;
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return rc;
+}
+
+
+/* Find the smallest key of a B-Tree
+ *
+ * Reads one node per level, down the left edge of the tree. This is
+ * MIN of the primary key of a table (on its table B-Tree) or of an
+ * indexed column (on its index, which has no NULLs), without a scan.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root of the B-Tree
+ * - key: Out parameter. Smallest key.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The B-Tree is empty
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_firstKey(BTree *bt, npage_t nroot, chidb_key_t *key)
+{
+    return chidb_Btree_edgeKey(bt, nroot, false, key);
+}
+
+
+/* Find the largest key of a B-Tree
+ *
+ * Like chidb_Btree_firstKey, down the right edge of the tree (the right
+ * page of each internal node). In an index, the largest key is always
+ * in the rightmost leaf, since every key of an internal node has a
+ * larger one in the subtree to its right.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root of the B-Tree
+ * - key: Out parameter. Largest key.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The B-Tree is empty
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_lastKey(BTree *bt, npage_t nroot, chidb_key_t *key)
+{
+    return chidb_Btree_edgeKey(bt, nroot, true, key);
+}
+
+
+/* Issue read-ahead for the children of an internal node
+ *
+ * Tells the pager that the child pages of cells ncell to ncell+n-1 will
+ * be read soon (if the range goes past the last cell, the right page is
+ * included too). A cursor that steps into an internal node during a scan
+ * should call this so that the next leaves are already on their way
+ * by the time the cursor reaches them.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - btn: An internal node (table or index)
+ * - ncell: First cell whose child page will be prefetched
+ * - n: Number of child pages to prefetch
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECELLNO: Cell number ncell is invalid (out of range)
+ */
+int chidb_Btree_prefetchChildren(BTree *bt, BTreeNode *btn, ncell_t ncell, ncell_t n)
+{
+    npage_t npages[BTREE_PREFETCH_MAX];
+    uint32_t count = 0;
+
+    if (btn->type != PGTYPE_TABLE_INTERNAL && btn->type != PGTYPE_INDEX_INTERNAL)
+        return CHIDB_OK;
+
+    if (ncell > btn->n_cells)
+        return CHIDB_ECELLNO;
+
+    for (ncell_t i = ncell; i < btn->n_cells && count < n && count < BTREE_PREFETCH_MAX; i++)
+    {
+        /* The child page is the first field of both kinds of internal cells */
+        uint16_t offset = get2byte(btn->celloffset_array + i * 2);
+        npages[count++] = get4byte(btn->page->data + offset + TABLEINTCELL_CHILD_OFFSET);
+    }
+
+    if (count < n && count < BTREE_PREFETCH_MAX)
+        npages[count++] = btn->right_page;
+
+    return chidb_Pager_prefetch(bt->pager, npages, count);
+}
+
+
+/* Loads a B-Tree node and latches its page
+ *
+ * Same as chidb_Btree_getNodeByPage, but the page is latched (see
+ * chidb_Pager_latchPage) before the node is read from it, so that the
+ * node can't be modified by another thread (shared latch) or accessed
+ * at all by other threads (exclusive latch) until it is released with
+ * chidb_Btree_releaseNode. Since the latch belongs to the in-memory
+ * page, all the BTreeNode structs of the same page share it.
+ *
+ * To keep latching free of deadlocks, a thread only latches a node while
+ * holding latches on its ancestors (or, see chidb_Btree_linkLeaf, on
+ * leaves to its right), and never latches a page more than once.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Page of node to load
+ * - latch: BTREE_LATCH_SHARED or BTREE_LATCH_EXCLUSIVE (or
+ *          BTREE_LATCH_NONE, which is the same as chidb_Btree_getNodeByPage)
+ * - btn: Out parameter. Used to return a pointer to newly creater BTreeNode
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_EMISUSE: The page could not be latched
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_getNodeLatched(BTree *bt, npage_t npage, uint8_t latch, BTreeNode **btn)
+{
+    MemPage *page;
+    int rc;
+
+    /* The page has to be pinned for its latch to remain the same */
+    rc = chidb_Pager_readPage(bt->pager, npage, &page);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if (latch != BTREE_LATCH_NONE)
+    {
+        rc = chidb_Pager_latchPage(bt->pager, page, latch == BTREE_LATCH_EXCLUSIVE);
+        if (rc != CHIDB_OK)
+        {
+            chidb_Pager_releaseMemPage(bt->pager, page);
+            return rc;
+        }
+    }
+
+    rc = chidb_Btree_getNodeByPage(bt, npage, btn);
+    if (rc == CHIDB_OK)
+        (*btn)->latch = latch;
+    else if (latch != BTREE_LATCH_NONE)
+        chidb_Pager_unlatchPage(bt->pager, page);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+
+    return rc;
+}
+
+
+/* Releases a B-Tree node
+ *
+ * Releases the latch held by a node, if any (see
+ * chidb_Btree_getNodeLatched), and frees it with chidb_Btree_freeMemNode.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - btn: BTreeNode to release
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Btree_releaseNode(BTree *bt, BTreeNode *btn)
+{
+    if (btn->latch != BTREE_LATCH_NONE)
+        chidb_Pager_unlatchPage(bt->pager, btn->page);
+
+    return chidb_Btree_freeMemNode(bt, btn);
+}
+
+
+/* Bytes that an internal node of the given type must keep free: room
+ * for a separator in most files, whose internal cells all have the same
+ * size. The separators of an index in a file with BTREE_FEATURE_NORMKEY
+ * can take up to NORMIDX_MAXKEY bytes, and replacing one with a longer
+ * one (see chidb_Btree_setSeparator) must not need a split, so room
+ * for two of the largest ones is kept. */
+static uint32_t chidb_Btree_sepReserve(BTree *bt, uint8_t type)
+{
+    BTreeCell sep = {.type = type, .nkey = NULL};
+
+    if (type == PGTYPE_INDEX_INTERNAL && (bt->features & BTREE_FEATURE_NORMKEY))
+        return 2 * (NORMIDXINTCELL_KEY_OFFSET + NORMIDX_MAXKEY(chidb_Pager_usableSize(bt->pager)) + 2);
+
+    return chidb_Btree_cellSize(bt, &sep) + 2;
+}
+
+/* Checks whether a node has to be split before an insertion
+ *
+ * A leaf is full if it doesn't have room for the cell being inserted.
+ * An internal node is full if it doesn't have room for another cell
+ * of its own type (which is what a split of one of its children adds
+ * to it, and internal cells of a given type all have the same size),
+ * or, in an index of a file with BTREE_FEATURE_NORMKEY, for two of the
+ * largest ones (see chidb_Btree_sepReserve).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - btn: A B-Tree node
+ * - cell: Leaf cell being inserted in the node's tree
+ *
+ * Return
+ * - true if the node has to be split, false otherwise
+ */
+bool chidb_Btree_nodeFull(BTree *bt, BTreeNode *btn, BTreeCell *cell)
+{
+    if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)
+        return btn->cells_offset - btn->free_offset < chidb_Btree_sepReserve(bt, btn->type);
+
+    return btn->cells_offset - btn->free_offset < chidb_Btree_cellSize(bt, cell) + 2;
+}
+
+
+/* Insert a BTreeCell into a B-Tree that is being accessed concurrently
+ *
+ * Inserts a cell like chidb_Btree_insert, but latching the nodes that
+ * are visited (see chidb_Btree_getNodeLatched), so that several threads
+ * can insert into (and look up, see chidb_Btree_findCell) B-Trees of the
+ * same file at once. This is latch crabbing, done in two passes:
+ *
+ * - The optimistic pass assumes that the leaf won't have to be split,
+ *   which is usually the case. It descends the tree with shared
+ *   latches, like a lookup, except that the leaf is latched in
+ *   exclusive mode (while its parent's latch is still held, so that
+ *   nobody can split it in between). If the leaf is not full, the cell
+ *   is inserted right away. Only one node is ever latched in exclusive
+ *   mode, so inserts into different leaves don't wait for each other.
+ *
+ * - Appends (a table cell with a key beyond the largest one in the
+ *   tree) skip the descent altogether (see chidb_Btree_insertAppend).
+ *   The optimistic pass remembers the rightmost leaf whenever it
+ *   reaches it, for the next append to find.
+ *
+ * - Otherwise, the pessimistic pass descends again with exclusive
+ *   latches. Once it reaches a node that is not full, a split below it
+ *   can't propagate above it, so the latches on its ancestors are
+ *   released. The insertion then proceeds with chidb_Btree_insert (if
+ *   the root is full) or chidb_Btree_insertNonFull on the highest node
+ *   still latched, which only modify the latched nodes (and new ones,
+ *   that other threads can't reach yet).
+ *
+ * Deleting entries and loading or vacuuming the file rearrange nodes in
+ * ways these latches don't cover, so chidb_Btree_delete,
+ * chidb_Btree_bulkLoad and chidb_Btree_incrVacuum still require
+ * exclusive access to the file, and so do cursors (which move between
+ * leaves without latching them). A thread must also not insert while
+ * it holds a latched node (e.g., one returned by chidb_Btree_findRef).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this cell in.
+ * - btc: BTreeCell to insert into B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ECORRUPT: The B-Tree is not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertLatched(BTree *bt, npage_t nroot, BTreeCell *btc)
+{
+    BTreeNode *node, *leaf;
+    npage_t npage, nparent;
+    ncell_t i;
+    bool rightmost = true;
+    int rc;
+
+    /* The key goes into the B-Tree's Bloom filter (if any) first, even
+     * if the insertion fails, which only makes a false positive */
+    if ((rc = chidb_bloom_insert(bt, nroot, btc->key)) != CHIDB_OK)
+        return rc;
+
+    if (btc->type == PGTYPE_TABLE_LEAF)
+    {
+        /* The zone maps are widened even if the insertion fails, which
+         * only makes them less precise */
+        chidb_zonemap_insert(bt, nroot, btc);
+        rc = chidb_Btree_insertAppend(bt, nroot, btc);
+        if (rc != BTREE_RESTART)
+            return rc;
+    }
+
+    rc = chidb_Btree_getNodeLatched(bt, nroot, BTREE_LATCH_SHARED, &node);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    /* A root that is a leaf can only be latched in exclusive mode from
+     * the start, which is what the pessimistic pass does */
+    if (node->type == PGTYPE_TABLE_LEAF || node->type == PGTYPE_INDEX_LEAF)
+    {
+        if (node->type == PGTYPE_TABLE_LEAF)
+            chidb_Btree_cacheAppend(bt, nroot, 0, nroot);
+        chidb_Btree_releaseNode(bt, node);
+        return chidb_Btree_insertPessimistic(bt, nroot, btc);
+    }
+
+    for (;;)
+    {
+        if (chidb_Btree_nodeSearch(node, btc->key, &i) == CHIDB_OK)
+        {
+            chidb_Btree_releaseNode(bt, node);
+            return CHIDB_EDUPLICATE;
+        }
+        npage = chidb_Btree_childPage(node, i);
+        rightmost = rightmost && i == node->n_cells;
+
+        rc = chidb_Btree_getNodeLatched(bt, npage, BTREE_LATCH_SHARED, &leaf);
+        if (rc != CHIDB_OK)
+        {
+            chidb_Btree_releaseNode(bt, node);
+            return rc;
+        }
+
+        if (leaf->type == PGTYPE_TABLE_LEAF || leaf->type == PGTYPE_INDEX_LEAF)
+        {
+            /* Other threads may insert into the leaf before we get the
+             * exclusive latch, but it can't be split while we hold the
+             * parent's latch */
+            chidb_Btree_releaseNode(bt, leaf);
+            rc = chidb_Btree_getNodeLatched(bt, npage, BTREE_LATCH_EXCLUSIVE, &leaf);
+            nparent = node->page->npage;
+            chidb_Btree_releaseNode(bt, node);
+            if (rc != CHIDB_OK)
+                return rc;
+            if (rightmost && leaf->type == PGTYPE_TABLE_LEAF)
+                chidb_Btree_cacheAppend(bt, nroot, nparent, npage);
+            break;
+        }
+
+        chidb_Btree_releaseNode(bt, node);
+        node = leaf;
+    }
+
+    if (chidb_Btree_nodeFull(bt, leaf, btc))
+    {
+        chidb_Btree_releaseNode(bt, leaf);
+        return chidb_Btree_insertPessimistic(bt, nroot, btc);
+    }
+
+    if (chidb_Btree_nodeSearch(leaf, btc->key, &i) == CHIDB_OK)
+        rc = CHIDB_EDUPLICATE;
+    else
+    {
+        rc = chidb_Btree_insertCell(leaf, i, btc);
+        if (rc == CHIDB_OK)
+            rc = chidb_Btree_writeNode(bt, leaf);
+    }
+    chidb_Btree_releaseNode(bt, leaf);
+
+    return rc;
+}
+
+/* The pessimistic pass of chidb_Btree_insertLatched */
+static int chidb_Btree_insertPessimistic(BTree *bt, npage_t nroot, BTreeCell *btc)
+{
+    BTreeNode *held[BTREE_MAX_DEPTH], *node, *child;
+    uint32_t nheld = 0;
+    ncell_t i;
+    int rc;
+
+    rc = chidb_Btree_getNodeLatched(bt, nroot, BTREE_LATCH_EXCLUSIVE, &node);
+    if (rc != CHIDB_OK)
+        return rc;
+    held[nheld++] = node;
+
+    while (node->type == PGTYPE_TABLE_INTERNAL || node->type == PGTYPE_INDEX_INTERNAL)
+    {
+        if (chidb_Btree_nodeSearch(node, btc->key, &i) == CHIDB_OK)
+        {
+            rc = CHIDB_EDUPLICATE;
+            goto out;
+        }
+
+        if (nheld == BTREE_MAX_DEPTH)
+        {
+            rc = CHIDB_ECORRUPT;
+            goto out;
+        }
+
+        rc = chidb_Btree_getNodeLatched(bt, chidb_Btree_childPage(node, i), BTREE_LATCH_EXCLUSIVE, &child);
+        if (rc != CHIDB_OK)
+            goto out;
+
+        /* Nothing above a node that won't be split can change */
+        if (!chidb_Btree_nodeFull(bt, child, btc))
+            while (nheld > 0)
+                chidb_Btree_releaseNode(bt, held[--nheld]);
+
+        held[nheld++] = child;
+        node = child;
+    }
+
+    if (held[0]->page->npage == nroot && chidb_Btree_nodeFull(bt, held[0], btc))
+        rc = chidb_Btree_insert(bt, nroot, btc);
+    else
+        rc = chidb_Btree_insertNonFull(bt, held[0]->page->npage, btc);
+
+out:
+    while (nheld > 0)
+        chidb_Btree_releaseNode(bt, held[--nheld]);
+
+    return rc;
+}
+
+
+/* Remembers the rightmost leaf of a table B-Tree (see
+ * chidb_Btree_insertAppend); nroot 0 forgets it */
+static void chidb_Btree_cacheAppend(BTree *bt, npage_t nroot, npage_t nparent, npage_t nleaf)
+{
+    chidb_Pager_lock(bt->pager);
+    bt->append_root = nroot;
+    bt->append_parent = nparent;
+    bt->append_leaf = nleaf;
+    chidb_Pager_unlock(bt->pager);
+}
+
+/* Moves all the cells of a full rightmost leaf to a new leaf on its
+ * left, and leaves the leaf with only btc. Both nodes are latched in
+ * exclusive mode, and the parent is not full. */
+static int chidb_Btree_appendSplit(BTree *bt, BTreeNode *parent, BTreeNode *leaf, BTreeCell *btc)
+{
+    BTreeNode *left;
+    BTreeCell *cells, sep;
+    npage_t nleft;
+    int rc;
+
+    cells = malloc(leaf->n_cells * sizeof(BTreeCell));
+    if (cells == NULL)
+        return CHIDB_ENOMEM;
+    for (ncell_t i = 0; i < leaf->n_cells; i++)
+        chidb_Btree_getCell(leaf, i, &cells[i]);
+
+    sep.type = PGTYPE_TABLE_INTERNAL;
+    sep.key = cells[leaf->n_cells - 1].key;
+
+    rc = chidb_Btree_allocatePage(bt, &nleft);
+    if (rc == CHIDB_OK)
+        rc = chidb_Btree_rebuildNode(bt, nleft, PGTYPE_TABLE_LEAF, cells, leaf->n_cells, 0, 0);
+    free(cells);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    rc = chidb_Btree_getNodeByPage(bt, nleft, &left);
+    if (rc != CHIDB_OK)
+        return rc;
+    rc = chidb_Btree_linkLeaf(bt, leaf, left);
+    if (rc == CHIDB_OK)
+        rc = chidb_Btree_writeNode(bt, left);
+    chidb_Btree_freeMemNode(bt, left);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    rc = chidb_Btree_rebuildNode(bt, leaf->page->npage, PGTYPE_TABLE_LEAF, btc, 1, leaf->right_page, leaf->left_page);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    sep.fields.tableInternal.child_page = nleft;
+    rc = chidb_Btree_insertCell(parent, parent->n_cells, &sep);
+    if (rc == CHIDB_OK)
+        rc = chidb_Btree_writeNode(bt, parent);
+
+    chilog(TRACE, "Appended key %" PRIu64 " to a new leaf after page %i", (uint64_t) btc->key, nleft);
+
+    return rc;
+}
+
+/* One attempt of chidb_Btree_insertAppend, latching the parent of the
+ * leaf in the given mode. Returns BTREE_NEEDSPLIT if the leaf is full
+ * but the parent was only latched in shared mode. */
+static int chidb_Btree_tryAppend(BTree *bt, npage_t nroot, BTreeCell *btc, uint8_t parent_latch)
+{
+    BTreeNode *parent = NULL, *leaf = NULL;
+    BTreeCell last;
+    npage_t nparent, nleaf;
+    bool cached;
+    int rc = BTREE_RESTART;
+
+    chidb_Pager_lock(bt->pager);
+    cached = bt->append_root == nroot;
+    nparent = bt->append_parent;
+    nleaf = bt->append_leaf;
+    chidb_Pager_unlock(bt->pager);
+
+    if (!cached)
+        return BTREE_RESTART;
+
+    /* The leaf is still the rightmost one if its parent still points to
+     * it with its right page (splits keep the upper half of a node in
+     * the original page, and anything else forgets the cached leaf) */
+    if (nparent != 0)
+    {
+        if (chidb_Btree_getNodeLatched(bt, nparent, parent_latch, &parent) != CHIDB_OK)
+            return BTREE_RESTART;
+        if (parent->type != PGTYPE_TABLE_INTERNAL || parent->right_page != nleaf)
+            goto out;
+    }
+    else if (nleaf != nroot)
+        return BTREE_RESTART;
+
+    if (chidb_Btree_getNodeLatched(bt, nleaf, BTREE_LATCH_EXCLUSIVE, &leaf) != CHIDB_OK)
+        goto out;
+    if (leaf->type != PGTYPE_TABLE_LEAF || leaf->n_cells == 0)
+        goto out;
+
+    chidb_Btree_getCell(leaf, leaf->n_cells - 1, &last);
+    if (btc->key <= last.key)
+        goto out;
+
+    if (!chidb_Btree_nodeFull(bt, leaf, btc))
+    {
+        rc = chidb_Btree_insertCell(leaf, leaf->n_cells, btc);
+        if (rc == CHIDB_OK)
+            rc = chidb_Btree_writeNode(bt, leaf);
+    }
+    else if (parent != NULL && parent_latch == BTREE_LATCH_SHARED)
+        rc = BTREE_NEEDSPLIT;
+    else if (parent != NULL && !chidb_Btree_nodeFull(bt, parent, btc))
+        rc = chidb_Btree_appendSplit(bt, parent, leaf, btc);
+
+out:
+    if (leaf != NULL)
+        chidb_Btree_releaseNode(bt, leaf);
+    if (parent != NULL)
+        chidb_Btree_releaseNode(bt, parent);
+
+    return rc;
+}
+
+/* Append a cell to a table B-Tree
+ *
+ * Most tables are keyed by increasing rowids, so most insertions go
+ * after the largest key in the tree, into its rightmost leaf. This
+ * inserts such a cell straight into the rightmost leaf that the last
+ * insertion into the tree found (see chidb_Btree_insertLatched),
+ * without descending the tree, after checking under latches that the
+ * leaf is still the rightmost one and that btc->key is larger than its
+ * last key.
+ *
+ * When that leaf is full, it is not split in half: all its cells move
+ * to a new leaf on its left, and the leaf starts over with just btc, so
+ * that a run of appends leaves full leaves behind (a half-empty leaf
+ * would never be filled again). This needs the parent to be latched in
+ * exclusive mode, so the parent is first latched in shared mode, and
+ * only latched again in exclusive mode if the leaf turns out to be
+ * full. If the parent is full too, or the leaf is the root, the
+ * insertion is left to the regular path, which splits as usual.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - btc: Table leaf cell to insert
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - BTREE_RESTART: The cell is not an append to the cached leaf, or
+ *                  the cached leaf can't take it. The cell must be
+ *                  inserted the regular way.
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_Btree_insertAppend(BTree *bt, npage_t nroot, BTreeCell *btc)
+{
+    int rc;
+
+    rc = chidb_Btree_tryAppend(bt, nroot, btc, BTREE_LATCH_SHARED);
+    if (rc == BTREE_NEEDSPLIT)
+        rc = chidb_Btree_tryAppend(bt, nroot, btc, BTREE_LATCH_EXCLUSIVE);
+
+    return rc == BTREE_NEEDSPLIT ? BTREE_RESTART : rc;
+}
+
+
+/* Size of a cell
+ *
+ * Computes the number of bytes a cell takes in a node of its type (not
+ * counting its entry in the cell offset array). Table leaf cells with
+ * overflow pages only count their local part (see
+ * chidb_Btree_localSize), index cells in files with
+ * BTREE_FEATURE_PACKEDINDEX use the packed layout, and cells in files
+ * with BTREE_FEATURE_NORMKEY use the NORMTABLE*CELL_* and NORMIDX*CELL_*
+ * layouts (the size of an index cell depends on its key, see
+ * chidb_Btree_indexKey).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - cell: A cell
+ *
+ * Return
+ * - The number of bytes of the cell
+ */
+uint32_t chidb_Btree_cellSize(BTree *bt, BTreeCell *cell)
+{
+    bool packed = bt->features & BTREE_FEATURE_PACKEDINDEX;
+    uint32_t local;
+
+    if (bt->features & BTREE_FEATURE_NORMKEY)
+    {
+        uint16_t nkey_size = cell->nkey != NULL ? cell->nkey_size : NORMKEY_INT_SIZE + NORMKEY_ROWID_SIZE;
+
+        switch (cell->type)
+        {
+        case PGTYPE_TABLE_INTERNAL:
+            return NORMTABLEINTCELL_SIZE;
+        case PGTYPE_TABLE_LEAF:
+            local = chidb_Btree_localSize(bt, cell->fields.tableLeaf.data_size);
+            return NORMTABLELEAFCELL_SIZE_WITHOUTDATA + local + (local < cell->fields.tableLeaf.data_size ? 4 : 0);
+        case PGTYPE_INDEX_INTERNAL:
+            return NORMIDXINTCELL_KEY_OFFSET + nkey_size;
+        default:
+            return NORMIDXLEAFCELL_KEY_OFFSET + nkey_size;
+        }
+    }
+
+    switch (cell->type)
+    {
+    case PGTYPE_TABLE_INTERNAL:
+        return TABLEINTCELL_SIZE;
+    case PGTYPE_TABLE_LEAF:
+        /* Records with overflow pages end with the first overflow page */
+        local = chidb_Btree_localSize(bt, cell->fields.tableLeaf.data_size);
+        return TABLELEAFCELL_SIZE_WITHOUTDATA + local + (local < cell->fields.tableLeaf.data_size ? 4 : 0);
+    case PGTYPE_INDEX_INTERNAL:
+        return packed ? PACKEDIDXINTCELL_SIZE : INDEXINTCELL_SIZE;
+    default:
+        if (!packed)
+            return INDEXLEAFCELL_SIZE;
+        return uvarint32Len(cell->key) + uvarint32Len(cell->fields.indexLeaf.keyPk);
+    }
+}
+
+
+/* Number of bytes of a record stored in its cell
+ *
+ * Records that are too large to keep at least four cells in a leaf are
+ * split between their cell and a chain of overflow pages (see
+ * chidb_Btree_spillCell). Like in SQLite, the part kept in the cell is
+ * chosen so that the last overflow page is as full as possible, as long
+ * as at least OVERFLOW_MINLOCAL bytes stay in the cell.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - size: Number of bytes in the record
+ *
+ * Return
+ * - The number of bytes of the record stored in its cell (size, if the
+ *   record has no overflow pages)
+ */
+uint32_t chidb_Btree_localSize(BTree *bt, uint32_t size)
+{
+    uint32_t usable = chidb_Pager_usableSize(bt->pager);
+    uint32_t minlocal = OVERFLOW_MINLOCAL(usable);
+    uint32_t maxlocal = bt->features & BTREE_FEATURE_NORMKEY ? OVERFLOW_MAXLOCAL_NORMKEY(usable)
+                                                              : OVERFLOW_MAXLOCAL(usable);
+    uint32_t local;
+
+    if (!(bt->features & BTREE_FEATURE_OVERFLOW) || size <= maxlocal)
+        return size;
+
+    local = minlocal + (size - minlocal) % (usable - OVERFLOW_DATA_OFFSET);
+
+    return local <= maxlocal ? local : minlocal;
+}
+
+
+/* Move the end of a large record to overflow pages
+ *
+ * If the data of a table leaf cell does not fit in the cell (see
+ * chidb_Btree_localSize), the bytes after the local part are written
+ * to a chain of newly allocated overflow pages. Each overflow page
+ * contains the page number of the next one (0 in the last one) followed
+ * by as many bytes of the record as fit in it. The first overflow page
+ * is stored in the cell's overflow_page, which is set to 0 if the record
+ * fits in the cell. The cell can then be passed to chidb_Btree_insert.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - cell: A table leaf cell
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_spillCell(BTree *bt, BTreeCell *cell)
+{
+    uint32_t size = cell->fields.tableLeaf.data_size;
+    uint32_t offset = chidb_Btree_localSize(bt, size);
+    uint32_t room = chidb_Pager_usableSize(bt->pager) - OVERFLOW_DATA_OFFSET;
+    MemPage *page = NULL;
+    npage_t npage;
+    int rc = CHIDB_OK;
+
+    cell->fields.tableLeaf.overflow_page = 0;
+
+    while (offset < size)
+    {
+        uint32_t n = size - offset < room ? size - offset : room;
+
+        rc = chidb_Btree_allocatePage(bt, &npage);
+        if (rc != CHIDB_OK)
+            break;
+
+        /* Link the new page from the previous one (or from the cell) */
+        if (page == NULL)
+            cell->fields.tableLeaf.overflow_page = npage;
+        else
+        {
+            put4byte(page->data + OVERFLOW_NEXT_OFFSET, npage);
+            rc = chidb_Pager_writePage(bt->pager, page);
+            chidb_Pager_releaseMemPage(bt->pager, page);
+            page = NULL;
+            if (rc != CHIDB_OK)
+                break;
+        }
+
+        rc = chidb_Pager_readPage(bt->pager, npage, &page);
+        if (rc != CHIDB_OK)
+            break;
+        put4byte(page->data + OVERFLOW_NEXT_OFFSET, 0);
+        memcpy(page->data + OVERFLOW_DATA_OFFSET, cell->fields.tableLeaf.data + offset, n);
+        offset += n;
+    }
+
+    if (page != NULL)
+    {
+        int rc2 = chidb_Pager_writePage(bt->pager, page);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+        if (rc == CHIDB_OK)
+            rc = rc2;
+    }
+
+    if (rc != CHIDB_OK)
+    {
+        chidb_Btree_freeOverflow(bt, cell->fields.tableLeaf.overflow_page);
+        cell->fields.tableLeaf.overflow_page = 0;
+    }
+
+    return rc;
+}
+
+
+/* Read part of a record
+ *
+ * Copies len bytes of the record in a table leaf cell (as returned by
+ * chidb_Btree_getCell), starting at byte offset, into buf. Only the
+ * overflow pages that contain the requested bytes (and the ones before
+ * them in the chain) are read.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - cell: A table leaf cell
+ * - offset: First byte of the record to read
+ * - len: Number of bytes to read
+ * - buf: Buffer where the bytes are copied (must have room for len bytes)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The bytes are not all in the record
+ * - CHIDB_ECORRUPT: The record's overflow pages are not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_readPayload(BTree *bt, BTreeCell *cell, uint32_t offset, uint32_t len, uint8_t *buf)
+{
+    uint32_t size = cell->fields.tableLeaf.data_size;
+    uint32_t local = chidb_Btree_localSize(bt, size);
+    uint32_t room = chidb_Pager_usableSize(bt->pager) - OVERFLOW_DATA_OFFSET;
+    uint32_t start = local;
+    npage_t npage = cell->fields.tableLeaf.overflow_page;
+    int rc;
+
+    if (offset > size || len > size - offset)
+        return CHIDB_EMISUSE;
+
+    if (offset < local)
+    {
+        uint32_t n = len < local - offset ? len : local - offset;
+
+        memcpy(buf, cell->fields.tableLeaf.data + offset, n);
+        buf += n;
+        offset += n;
+        len -= n;
+    }
+
+    while (len > 0)
+    {
+        MemPage *page;
+
+        if (npage == 0 || npage > bt->pager->n_pages)
+            return CHIDB_ECORRUPT;
+
+        rc = chidb_Pager_readPageRO(bt->pager, npage, &page);
+        if (rc != CHIDB_OK)
+            return rc;
+
+        /* Skip the pages (start is the first byte in this one) before offset */
+        if (offset < start + room)
+        {
+            uint32_t n = len < start + room - offset ? len : start + room - offset;
+
+            memcpy(buf, page->data + OVERFLOW_DATA_OFFSET + (offset - start), n);
+            buf += n;
+            offset += n;
+            len -= n;
+        }
+        start += room;
+        npage = get4byte(page->data + OVERFLOW_NEXT_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Free a chain of overflow pages
+ *
+ * Adds every page in a chain of overflow pages (see chidb_Btree_spillCell)
+ * to the freelist. Must be called when a cell with overflow pages is
+ * removed from a B-Tree, but not when it is only moved to another node.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: First overflow page (if 0, nothing is done)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The overflow pages are not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_freeOverflow(BTree *bt, npage_t npage)
+{
+    npage_t n = 0;
+    int rc;
+
+    while (npage != 0)
+    {
+        MemPage *page;
+        npage_t next;
+
+        /* A chain can't be longer than the file (this catches cycles) */
+        if (npage <= 1 || npage > bt->pager->n_pages || n++ > bt->pager->n_pages)
+            return CHIDB_ECORRUPT;
+
+        rc = chidb_Pager_readPage(bt->pager, npage, &page);
+        if (rc != CHIDB_OK)
+            return rc;
+        next = get4byte(page->data + OVERFLOW_NEXT_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+
+        rc = chidb_Btree_freePage(bt, npage);
+        if (rc != CHIDB_OK)
+            return rc;
+        npage = next;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Compares the keys of two cells of the same type (like memcmp). In an
+ * index, dup is set if they have the same indexed value, which makes
+ * them duplicates whatever their keyPk. */
+static int chidb_Btree_cmpKeys(BTree *bt, BTreeCell *a, BTreeCell *b, bool *dup)
+{
+    uint8_t abuf[NORMKEY_INT_SIZE + NORMKEY_ROWID_SIZE], bbuf[NORMKEY_INT_SIZE + NORMKEY_ROWID_SIZE];
+    const uint8_t *ka, *kb;
+    uint16_t na, nb;
+    uint32_t va;
+
+    if (!(bt->features & BTREE_FEATURE_NORMKEY) || a->type == PGTYPE_TABLE_INTERNAL || a->type == PGTYPE_TABLE_LEAF)
+    {
+        *dup = a->key == b->key;
+        return a->key < b->key ? -1 : a->key > b->key;
+    }
+
+    ka = chidb_Btree_indexKey(a, abuf, &na);
+    kb = chidb_Btree_indexKey(b, bbuf, &nb);
+    va = chidb_normkey_valueSize(ka, na);
+    *dup = va == chidb_normkey_valueSize(kb, nb) && memcmp(ka, kb, va) == 0;
+
+    return chidb_normkey_cmp(ka, na, kb, nb);
+}
+
+
+/* A child of a node being built by chidb_Btree_bulkLoad, and the cell
+ * that follows it in its parent: in a table B-Tree, only the key of the
+ * cell is used (the largest key in the child); in an index B-Tree, it
+ * is the entry promoted from the level below (unused for the last
+ * child of a level). */
+typedef struct BulkEntry
+{
+    npage_t npage;
+    BTreeCell sep;
+} BulkEntry;
+
+typedef struct BulkLevel
+{
+    BulkEntry *entries;
+    uint32_t n;
+    uint32_t size;
+} BulkLevel;
+
+static int chidb_Btree_bulkPush(BulkLevel *level, npage_t npage, BTreeCell *sep)
+{
+    if (level->n == level->size)
+    {
+        uint32_t size = level->size == 0 ? 64 : 2 * level->size;
+        BulkEntry *entries = realloc(level->entries, size * sizeof(BulkEntry));
+
+        if (entries == NULL)
+            return CHIDB_ENOMEM;
+        level->entries = entries;
+        level->size = size;
+    }
+
+    level->entries[level->n].npage = npage;
+    level->entries[level->n].sep = *sep;
+    level->n++;
+
+    return CHIDB_OK;
+}
+
+/* Bytes available for cells and their offsets in an empty node */
+static uint32_t chidb_Btree_nodeSpace(BTree *bt, npage_t npage, uint8_t type)
+{
+    return chidb_Pager_usableSize(bt->pager) - (npage == 1 ? 100 : 0) - chidb_Btree_headerSize(bt, type);
+}
+
+/* Bytes used by a cell in a node, including its entry in the cell offset array */
+static uint32_t chidb_Btree_cellSpace(BTree *bt, BTreeCell *cell)
+{
+    return chidb_Btree_cellSize(bt, cell) + 2;
+}
+
+/* Initializes a node in page npage, or in a new page at the end of the
+ * file if npage is 0, and loads it */
+static int chidb_Btree_bulkNewNode(BTree *bt, npage_t npage, uint8_t type, BTreeNode **btn)
+{
+    int rc;
+
+    if (npage == 0)
+    {
+        rc = chidb_Pager_allocatePage(bt->pager, &npage);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    rc = chidb_Btree_initEmptyNode(bt, npage, type);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    return chidb_Btree_getNodeByPage(bt, npage, btn);
+}
+
+static int chidb_Btree_bulkCloseNode(BTree *bt, BTreeNode *btn)
+{
+    int rc = chidb_Btree_writeNode(bt, btn);
+
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return rc;
+}
+
+/* Adds a cell to the leaf being filled by chidb_Btree_bulkLoad. If the
+ * leaf has reached the fill factor and promote is true, the leaf is
+ * closed instead, and (in an index B-Tree) the cell becomes the
+ * separator between it and the next leaf. */
+static int chidb_Btree_bulkAddToLeaf(BTree *bt, BulkLevel *level, BTreeNode **leaf, uint32_t *used,
+                                     uint32_t budget, BTreeCell *cell, bool promote)
+{
+    uint32_t space = chidb_Btree_cellSpace(bt, cell);
+    int rc;
+
+    if (*leaf != NULL && *used + space > budget && promote)
+    {
+        BTreeNode *next = NULL;
+        BTreeCell sep;
+        npage_t npage = (*leaf)->page->npage;
+
+        if (cell->type == PGTYPE_TABLE_LEAF)
+        {
+            /* Tables keep every entry in the leaves, so the separator
+             * is just the largest key in the leaf */
+            chidb_Btree_getCell(*leaf, (*leaf)->n_cells - 1, &sep);
+        }
+        else
+        {
+            sep = *cell;
+            sep.fields.indexInternal.keyPk = cell->fields.indexLeaf.keyPk;
+        }
+
+        /* Linked leaves need to know their next leaf before being written */
+        if (cell->type == PGTYPE_TABLE_LEAF && (bt->features & BTREE_FEATURE_LINKEDLEAVES))
+        {
+            rc = chidb_Btree_bulkNewNode(bt, 0, cell->type, &next);
+            if (rc != CHIDB_OK)
+                return rc;
+            next->left_page = npage;
+            (*leaf)->right_page = next->page->npage;
+            *used = 0;
+        }
+
+        rc = chidb_Btree_bulkCloseNode(bt, *leaf);
+        *leaf = next;
+        if (rc != CHIDB_OK)
+            return rc;
+
+        rc = chidb_Btree_bulkPush(level, npage, &sep);
+        if (rc != CHIDB_OK || cell->type != PGTYPE_TABLE_LEAF)
+            return rc;
+    }
+
+    if (*leaf == NULL)
+    {
+        rc = chidb_Btree_bulkNewNode(bt, 0, cell->type, leaf);
+        if (rc != CHIDB_OK)
+            return rc;
+        *used = 0;
+    }
+
+    rc = chidb_Btree_insertCell(*leaf, (*leaf)->n_cells, cell);
+    *used += space;
+
+    return rc;
+}
+
+/* Builds the level above the given one, in place. If all the children
+ * fit in the root, the root is built instead. */
+static int chidb_Btree_bulkBuildLevel(BTree *bt, npage_t nroot, uint8_t type, BulkLevel *level,
+                                      uint8_t fill_factor)
+{
+    BulkLevel parent = {NULL, 0, 0};
+    BTreeNode *btn;
+    BTreeCell cell = {.type = type, .nkey = NULL};
+    uint32_t cellspace, space, rootspace, percell, ngroups, k = 0;
+    int rc = CHIDB_OK;
+
+    cellspace = chidb_Btree_cellSpace(bt, &cell);
+    space = chidb_Btree_nodeSpace(bt, 0, type) * fill_factor / 100;
+    rootspace = chidb_Btree_nodeSpace(bt, nroot, type);
+
+    /* The separators of an index with normalized keys have different
+     * sizes: nodes are filled as if they all had the size of the
+     * largest one, and keep room to replace a separator with a longer
+     * one (see chidb_Btree_sepReserve) */
+    if (type == PGTYPE_INDEX_INTERNAL && (bt->features & BTREE_FEATURE_NORMKEY))
+    {
+        uint32_t reserve = chidb_Btree_sepReserve(bt, type) / 2;
+
+        for (uint32_t i = 0; i + 1 < level->n; i++)
+        {
+            cell = level->entries[i].sep;
+            cell.type = type;
+            if (chidb_Btree_cellSpace(bt, &cell) > cellspace)
+                cellspace = chidb_Btree_cellSpace(bt, &cell);
+        }
+        if (space > chidb_Btree_nodeSpace(bt, 0, type) - reserve)
+            space = chidb_Btree_nodeSpace(bt, 0, type) - reserve;
+        rootspace -= reserve;
+    }
+
+    /* Each node has one more child than cells (the right page) */
+    percell = space / cellspace;
+    if (percell == 0)
+        percell = 1;
+    ngroups = (level->n + percell) / (percell + 1);
+    if (ngroups == 1 && level->n - 1 > rootspace / cellspace)
+        ngroups = 2;
+
+    for (uint32_t g = 0; g < ngroups; g++)
+    {
+        /* Spread the children evenly over the nodes of this level */
+        uint32_t nchildren = level->n / ngroups + (g < level->n % ngroups ? 1 : 0);
+        BulkEntry *last = &level->entries[k + nchildren - 1];
+
+        rc = chidb_Btree_bulkNewNode(bt, ngroups == 1 ? nroot : 0, type, &btn);
+        if (rc != CHIDB_OK)
+            break;
+
+        for (; k < (uint32_t) (last - level->entries); k++)
+        {
+            BulkEntry *e = &level->entries[k];
+
+            cell = e->sep;
+            cell.type = type;
+            if (type == PGTYPE_TABLE_INTERNAL)
+                cell.fields.tableInternal.child_page = e->npage;
+            else
+                cell.fields.indexInternal.child_page = e->npage;
+
+            rc = chidb_Btree_insertCell(btn, btn->n_cells, &cell);
+            if (rc != CHIDB_OK)
+                break;
+        }
+        k++;
+        btn->right_page = last->npage;
+
+        if (rc == CHIDB_OK)
+            rc = chidb_Btree_bulkPush(&parent, btn->page->npage, &last->sep);
+        if (rc == CHIDB_OK)
+            rc = chidb_Btree_writeNode(bt, btn);
+        chidb_Btree_freeMemNode(bt, btn);
+        if (rc != CHIDB_OK)
+            break;
+    }
+
+    free(level->entries);
+    *level = parent;
+
+    return rc;
+}
+
+/* Moves the only leaf of a bulk-loaded B-Tree into its root */
+static int chidb_Btree_bulkMoveToRoot(BTree *bt, npage_t nroot, npage_t nleaf)
+{
+    BTreeNode *leaf, *root;
+    BTreeCell cell;
+    int rc;
+
+    rc = chidb_Btree_getNodeByPage(bt, nleaf, &leaf);
+    if (rc != CHIDB_OK)
+        return rc;
+    rc = chidb_Btree_getNodeByPage(bt, nroot, &root);
+    if (rc != CHIDB_OK)
+    {
+        chidb_Btree_freeMemNode(bt, leaf);
+        return rc;
+    }
+
+    for (ncell_t i = 0; i < leaf->n_cells && rc == CHIDB_OK; i++)
+    {
+        chidb_Btree_getCell(leaf, i, &cell);
+        rc = chidb_Btree_insertCell(root, i, &cell);
+    }
+
+    if (rc == CHIDB_OK)
+        rc = chidb_Btree_writeNode(bt, root);
+    chidb_Btree_freeMemNode(bt, root);
+    chidb_Btree_freeMemNode(bt, leaf);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    return chidb_Btree_freePage(bt, nleaf);
+}
+
+
+/* Load sorted entries into an empty B-Tree
+ *
+ * Builds a B-Tree bottom-up from entries provided in ascending key
+ * order, which is much faster than inserting them one by one: there
+ * are no descents from the root and no splits. Leaves are packed
+ * sequentially up to the fill factor, then each level of internal
+ * nodes is built from the one below it, and finally the top level is
+ * written into the root. New pages are appended to the end of the
+ * file (the freelist is not used), so the leaves end up in key order
+ * in the file, followed by the internal nodes.
+ *
+ * The iterator returns the entries one by one (see BTreeIterator). In
+ * a table B-Tree, the cells must be table leaf cells with increasing
+ * keys; in an index B-Tree, index leaf cells with increasing keyIdx
+ * (or, in a file with BTREE_FEATURE_NORMKEY, increasing keys, see
+ * chidb_Btree_indexKey). The type field of the cells is ignored. If the B-Tree has a Bloom
+ * filter, it is built again once the entries are loaded (see
+ * chidb_bloom_refresh).
+ *
+ * If an error occurs, the B-Tree is left in an unspecified state.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree, which must be
+ *          an empty leaf node
+ * - it: Iterator that returns the entries
+ * - fill_factor: How full to make each node, as a percentage of the
+ *                space for cells (1-100). A fill factor below 100
+ *                leaves room for later insertions without splits.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The root is not an empty leaf, the fill factor is
+ *                  not valid, the entries are not in ascending order,
+ *                  or an entry doesn't fit in a page
+ * - CHIDB_EDUPLICATE: Two entries have the same key
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - Any other error returned by the iterator
+ */
+int chidb_Btree_bulkLoad(BTree *bt, npage_t nroot, BTreeIterator *it, uint8_t fill_factor)
+{
+    BulkLevel level = {NULL, 0, 0};
+    BTreeNode *root, *leaf = NULL;
+    BTreeCell cell, last, held[2];
+    uint8_t leaftype, inttype;
+    uint32_t budget, leafspace, used = 0, nheld = 0;
+    bool empty, dup, first = true;
+    int rc;
+
+    /* The tree is rebuilt from scratch, so its rightmost leaf changes,
+     * and its zone maps have to be built again */
+    chidb_Btree_cacheAppend(bt, 0, 0, 0);
+    chidb_zonemap_drop(bt, nroot);
+
+    if (fill_factor == 0 || fill_factor > 100)
+        return CHIDB_EMISUSE;
+
+    rc = chidb_Btree_getNodeByPage(bt, nroot, &root);
+    if (rc != CHIDB_OK)
+        return rc;
+    leaftype = root->type;
+    empty = root->n_cells == 0;
+    chidb_Btree_freeMemNode(bt, root);
+
+    if (!empty || (leaftype != PGTYPE_TABLE_LEAF && leaftype != PGTYPE_INDEX_LEAF))
+        return CHIDB_EMISUSE;
+    inttype = leaftype == PGTYPE_TABLE_LEAF ? PGTYPE_TABLE_INTERNAL : PGTYPE_INDEX_INTERNAL;
+
+    leafspace = chidb_Btree_nodeSpace(bt, 0, leaftype);
+    budget = leafspace * fill_factor / 100;
+
+    while ((rc = it->next(it, &cell)) == CHIDB_OK)
+    {
+        cell.type = leaftype;
+
+        if (!first)
+        {
+            int cmp = chidb_Btree_cmpKeys(bt, &cell, &last, &dup);
+
+            if (dup)
+            {
+                rc = CHIDB_EDUPLICATE;
+                break;
+            }
+            if (cmp < 0)
+            {
+                rc = CHIDB_EMISUSE;
+                break;
+            }
+        }
+        last = cell;
+        first = false;
+
+        if (chidb_Btree_cellSpace(bt, &cell) > leafspace)
+        {
+            rc = CHIDB_EMISUSE;
+            break;
+        }
+
+        if (leaftype == PGTYPE_TABLE_LEAF)
+        {
+            rc = chidb_Btree_spillCell(bt, &cell);
+            if (rc != CHIDB_OK)
+                break;
+            rc = chidb_Btree_bulkAddToLeaf(bt, &level, &leaf, &used, budget, &cell, true);
+            if (rc != CHIDB_OK)
+                break;
+            continue;
+        }
+
+        /* In an index, an entry can only be promoted to separate two
+         * leaves if there will be at least one entry in the next leaf.
+         * We hold back the last two entries, which are dealt with at
+         * the end. */
+        if (nheld == 2)
+        {
+            rc = chidb_Btree_bulkAddToLeaf(bt, &level, &leaf, &used, budget, &held[0], true);
+            if (rc != CHIDB_OK)
+                break;
+            held[0] = held[1];
+            nheld--;
+        }
+        held[nheld++] = cell;
+    }
+
+    if (rc == CHIDB_EEMPTY)
+        rc = CHIDB_OK;
+
+    if (rc == CHIDB_OK && nheld > 0)
+    {
+        /* If the last two entries don't fit in the current leaf, the
+         * first one separates it from a new leaf with the second one */
+        bool split = nheld == 2 && leaf != NULL &&
+                     used + chidb_Btree_cellSpace(bt, &held[0]) + chidb_Btree_cellSpace(bt, &held[1]) > budget;
+
+        rc = chidb_Btree_bulkAddToLeaf(bt, &level, &leaf, &used, split ? 0 : budget, &held[0], split);
+        if (rc == CHIDB_OK && nheld == 2)
+            rc = chidb_Btree_bulkAddToLeaf(bt, &level, &leaf, &used, budget, &held[1], false);
+    }
+
+    if (leaf != NULL)
+    {
+        npage_t npage = leaf->page->npage;
+        int rc2;
+
+        if (rc == CHIDB_OK)
+            chidb_Btree_getCell(leaf, leaf->n_cells - 1, &cell);
+        rc2 = chidb_Btree_bulkCloseNode(bt, leaf);
+        if (rc == CHIDB_OK)
+            rc = rc2;
+        if (rc == CHIDB_OK)
+            rc = chidb_Btree_bulkPush(&level, npage, &cell);
+    }
+
+    /* A single leaf is moved into the root if it fits */
+    if (rc == CHIDB_OK && level.n == 1 && used <= chidb_Btree_nodeSpace(bt, nroot, leaftype))
+    {
+        rc = chidb_Btree_bulkMoveToRoot(bt, nroot, level.entries[0].npage);
+        level.n = 0;
+    }
+
+    while (rc == CHIDB_OK && level.n > 0 && level.entries[level.n - 1].npage != nroot)
+        rc = chidb_Btree_bulkBuildLevel(bt, nroot, inttype, &level, fill_factor);
+
+    /* A Bloom filter of the (empty) tree was sized for no entries */
+    if (rc == CHIDB_OK)
+        rc = chidb_bloom_refresh(bt, nroot);
+
+    free(level.entries);
+
+    return rc;
+}
+
+
+/* Collects the (column value, primary key) pairs of a table B-Tree. For
+ * a covering index, the entries are table leaf cells instead, with the
+ * record of each entry (see chidb_Btree_coveringRecord) as their data. */
+typedef struct IndexEntries
+{
+    BTreeCell *cells;
+    uint32_t n;
+    uint32_t size;
+    uint32_t next;          /* Next entry returned by the iterator */
+    const uint8_t *include; /* Included columns (covering index only) */
+    uint8_t ninclude;
+} IndexEntries;
+
+static void chidb_Btree_freeIndexEntries(IndexEntries *entries)
+{
+    for (uint32_t i = 0; i < entries->n; i++)
+    {
+        if (entries->ninclude > 0)
+            free(entries->cells[i].fields.tableLeaf.data);
+        free((uint8_t *) entries->cells[i].nkey);
+    }
+    free(entries->cells);
+}
+
+/* Record of a covering index entry: the primary key, followed by the
+ * included columns of the row, in the file's record format */
+static int chidb_Btree_coveringRecord(BTree *bt, DBRecordView *view, chidb_key_t keyPk,
+                                      const uint8_t *include, uint8_t ninclude, uint8_t **data, uint32_t *size)
+{
+    DBRecordBuffer dbrb;
+    DBRecord *dbr;
+    int rc;
+
+    rc = chidb_DBRecord_create_empty(&dbrb, ninclude + 1);
+    if (rc != CHIDB_OK)
+        return rc;
+    rc = chidb_DBRecord_appendInt32(&dbrb, (int32_t) keyPk);
+
+    for (uint8_t i = 0; i < ninclude && rc == CHIDB_OK; i++)
+    {
+        const char *s;
+        char *str;
+        int8_t v8;
+        int16_t v16;
+        int32_t v32;
+        int len;
+
+        switch (chidb_DBRecordView_getType(view, include[i]))
+        {
+        case SQL_NULL:
+            rc = chidb_DBRecord_appendNull(&dbrb);
+            break;
+        case SQL_INTEGER_1BYTE:
+            chidb_DBRecordView_getInt8(view, include[i], &v8);
+            rc = chidb_DBRecord_appendInt8(&dbrb, v8);
+            break;
+        case SQL_INTEGER_2BYTE:
+            chidb_DBRecordView_getInt16(view, include[i], &v16);
+            rc = chidb_DBRecord_appendInt16(&dbrb, v16);
+            break;
+        case SQL_INTEGER_4BYTE:
+            chidb_DBRecordView_getInt32(view, include[i], &v32);
+            rc = chidb_DBRecord_appendInt32(&dbrb, v32);
+            break;
+        case SQL_TEXT:
+            /* Strings in a record view are not NUL-terminated */
+            chidb_DBRecordView_getString(view, include[i], &s, &len);
+            if ((str = strndup(s, len)) == NULL)
+            {
+                rc = CHIDB_ENOMEM;
+                break;
+            }
+            rc = chidb_DBRecord_appendString(&dbrb, str);
+            free(str);
+            break;
+        default:
+            rc = CHIDB_EMISUSE;
+            break;
+        }
+    }
+
+    chidb_DBRecord_finalize(&dbrb, &dbr);
+    if (rc == CHIDB_OK)
+    {
+        if (BTREE_RECORD_FORMAT(bt) == DBRECORD_FORMAT_V2)
+            rc = chidb_DBRecord_packV2(dbr, data, size, NULL);
+        else if ((rc = chidb_DBRecord_pack(dbr, data)) == CHIDB_OK)
+            *size = dbr->packed_len;
+    }
+    chidb_DBRecord_destroy(dbr);
+
+    return rc;
+}
+
+static int chidb_Btree_collectIndexEntries(BTree *bt, npage_t npage, uint8_t column, IndexEntries *entries)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    bool normkey = bt->features & BTREE_FEATURE_NORMKEY;
+    int rc;
+
+    rc = chidb_Btree_getNodeByPage(bt, npage, &btn);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    for (ncell_t i = 0; i < btn->n_cells && rc == CHIDB_OK; i++)
+    {
+        DBRecordView view;
+        uint8_t *data = NULL, *record = NULL, *nkey = NULL;
+        uint32_t record_size = 0, nkey_size = 0;
+        const char *str;
+        int len;
+        int8_t v8;
+        int16_t v16;
+        int32_t v32 = 0;
+
+        chidb_Btree_getCell(btn, i, &cell);
+        if (btn->type == PGTYPE_TABLE_INTERNAL)
+        {
+            rc = chidb_Btree_collectIndexEntries(bt, cell.fields.tableInternal.child_page, column, entries);
+            continue;
+        }
+
+        if (cell.fields.tableLeaf.overflow_page != 0)
+        {
+            data = malloc(cell.fields.tableLeaf.data_size);
+            if (data == NULL)
+            {
+                rc = CHIDB_ENOMEM;
+                break;
+            }
+            rc = chidb_Btree_readPayload(bt, &cell, 0, cell.fields.tableLeaf.data_size, data);
+            if (rc != CHIDB_OK)
+            {
+                free(data);
+                break;
+            }
+        }
+
+        /* Only the header up to the indexed column is parsed */
+        if (BTREE_RECORD_FORMAT(bt) == DBRECORD_FORMAT_V2)
+            rc = chidb_DBRecordView_initV2(&view, data != NULL ? data : cell.fields.tableLeaf.data);
+        else
+            rc = chidb_DBRecordView_init(&view, data != NULL ? data : cell.fields.tableLeaf.data);
+        if (rc != CHIDB_OK)
+        {
+            free(data);
+            break;
+        }
+        switch (chidb_DBRecordView_getType(&view, column))
+        {
+        case SQL_NULL:
+            /* NULLs are not indexed */
+            free(data);
+            continue;
+        case SQL_INTEGER_1BYTE:
+            chidb_DBRecordView_getInt8(&view, column, &v8);
+            v32 = v8;
+            break;
+        case SQL_INTEGER_2BYTE:
+            chidb_DBRecordView_getInt16(&view, column, &v16);
+            v32 = v16;
+            break;
+        case SQL_INTEGER_4BYTE:
+            chidb_DBRecordView_getInt32(&view, column, &v32);
+            break;
+        case SQL_TEXT:
+            /* Text columns can only be indexed with normalized keys */
+            if (!normkey || entries->ninclude > 0)
+            {
+                rc = CHIDB_EMISMATCH;
+                break;
+            }
+            chidb_DBRecordView_getString(&view, column, &str, &len);
+            nkey_size = chidb_normkey_textSize(str, len) + NORMKEY_ROWID_SIZE;
+            if (nkey_size > NORMIDX_MAXKEY(chidb_Pager_usableSize(bt->pager)))
+                rc = CHIDB_EMISUSE;
+            else if ((nkey = malloc(nkey_size)) == NULL)
+                rc = CHIDB_ENOMEM;
+            else
+                chidb_normkey_text(nkey, str, len);
+            break;
+        case SQL_NOTVALID:
+            rc = column >= chidb_DBRecordView_nfields(&view) ? CHIDB_EMISUSE : CHIDB_EMISMATCH;
+            break;
+        default:
+            /* Only integer (and text) columns can be indexed */
+            rc = CHIDB_EMISMATCH;
+            break;
+        }
+        if (rc == CHIDB_OK && entries->ninclude > 0)
+            rc = chidb_Btree_coveringRecord(bt, &view, cell.key, entries->include, entries->ninclude,
+                                            &record, &record_size);
+
+        /* With normalized keys, the entries are sorted by their key */
+        if (rc == CHIDB_OK && normkey && entries->ninclude == 0 && nkey == NULL)
+        {
+            nkey_size = NORMKEY_INT_SIZE + NORMKEY_ROWID_SIZE;
+            if ((nkey = malloc(nkey_size)) == NULL)
+                rc = CHIDB_ENOMEM;
+            else
+                chidb_normkey_int(nkey, v32);
+        }
+        if (nkey != NULL)
+            chidb_normkey_putRowid(nkey + nkey_size - NORMKEY_ROWID_SIZE, cell.key);
+        free(data);
+        if (rc != CHIDB_OK)
+        {
+            free(nkey);
+            break;
+        }
+
+        if (entries->n == entries->size)
+        {
+            uint32_t size = entries->size == 0 ? 256 : 2 * entries->size;
+            BTreeCell *cells = realloc(entries->cells, size * sizeof(BTreeCell));
+
+            if (cells == NULL)
+            {
+                if (entries->ninclude > 0)
+                    free(record);
+                free(nkey);
+                rc = CHIDB_ENOMEM;
+                break;
+            }
+            entries->cells = cells;
+            entries->size = size;
+        }
+        entries->cells[entries->n].key = (chidb_key_t) v32;
+        entries->cells[entries->n].nkey = nkey;
+        entries->cells[entries->n].nkey_size = nkey_size;
+        if (entries->ninclude > 0)
+        {
+            entries->cells[entries->n].fields.tableLeaf.data = record;
+            entries->cells[entries->n].fields.tableLeaf.data_size = record_size;
+        }
+        else
+            entries->cells[entries->n].fields.indexLeaf.keyPk = cell.key;
+        entries->n++;
+    }
+
+    if (rc == CHIDB_OK && btn->type == PGTYPE_TABLE_INTERNAL)
+        rc = chidb_Btree_collectIndexEntries(bt, btn->right_page, column, entries);
+
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return rc;
+}
+
+static int chidb_Btree_cmpIndexEntries(const void *a, const void *b)
+{
+    const BTreeCell *ca = a, *cb = b;
+
+    if (ca->nkey != NULL)
+        return chidb_normkey_cmp(ca->nkey, ca->nkey_size, cb->nkey, cb->nkey_size);
+
+    return ca->key < cb->key ? -1 : ca->key > cb->key;
+}
+
+/* An index is built from sorted runs of entries, one per thread, that
+ * each collect the entries of the morsels of the table (see
+ * chidb_Btree_morsels) they take, and sort them. The runs are merged as
+ * they are bulk-loaded, with a heap of the runs by their next entry. */
+typedef struct IndexBuild
+{
+    BTree *bt;
+    uint8_t column;
+    npage_t *morsels;
+    uint32_t nmorsels;
+    uint32_t next;          /* Next morsel to take */
+    int failed;             /* Some thread failed: the others stop */
+
+    IndexEntries *runs;
+    uint32_t nruns;
+    uint32_t *heap;
+    uint32_t nheap;
+} IndexBuild;
+
+typedef struct IndexRun
+{
+    IndexBuild *build;
+    IndexEntries *entries;
+    pthread_t thread;
+    bool started;
+    int rc;
+} IndexRun;
+
+static void *chidb_Btree_collectRun(void *arg)
+{
+    IndexRun *run = arg;
+    IndexBuild *b = run->build;
+    uint32_t m;
+
+    while (!__atomic_load_n(&b->failed, __ATOMIC_RELAXED) &&
+           (m = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->nmorsels)
+    {
+        if ((run->rc = chidb_Btree_collectIndexEntries(b->bt, b->morsels[m], b->column, run->entries)) != CHIDB_OK)
+        {
+            __atomic_store_n(&b->failed, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+    }
+
+    qsort(run->entries->cells, run->entries->n, sizeof(BTreeCell), chidb_Btree_cmpIndexEntries);
+
+    return NULL;
+}
+
+/* Whether the next entry of a run comes before the next one of another */
+static bool chidb_Btree_runLess(IndexBuild *b, uint32_t run1, uint32_t run2)
+{
+    return chidb_Btree_cmpIndexEntries(&b->runs[run1].cells[b->runs[run1].next],
+                                       &b->runs[run2].cells[b->runs[run2].next]) < 0;
+}
+
+static void chidb_Btree_siftRun(IndexBuild *b, uint32_t i)
+{
+    for (;;)
+    {
+        uint32_t min = i, l = 2 * i + 1, r = l + 1, tmp;
+
+        if (l < b->nheap && chidb_Btree_runLess(b, b->heap[l], b->heap[min]))
+            min = l;
+        if (r < b->nheap && chidb_Btree_runLess(b, b->heap[r], b->heap[min]))
+            min = r;
+        if (min == i)
+            return;
+        tmp = b->heap[i];
+        b->heap[i] = b->heap[min];
+        b->heap[min] = tmp;
+        i = min;
+    }
+}
+
+static int chidb_Btree_nextIndexEntry(BTreeIterator *it, BTreeCell *cell)
+{
+    IndexBuild *b = it->arg;
+    IndexEntries *run;
+
+    if (b->nheap == 0)
+        return CHIDB_EEMPTY;
+
+    run = &b->runs[b->heap[0]];
+    *cell = run->cells[run->next++];
+    if (run->next == run->n)
+        b->heap[0] = b->heap[--b->nheap];
+    chidb_Btree_siftRun(b, 0);
+
+    return CHIDB_OK;
+}
+
+
+/* Populate an index with the rows already in a table
+ *
+ * Used by CREATE INDEX on a table that already has rows. Reads the
+ * value of the indexed column in every row of the table, sorts the
+ * (value, primary key) pairs, and bulk-loads them into the (empty)
+ * index with chidb_Btree_bulkLoad. Rows where the column is NULL are
+ * not indexed.
+ *
+ * The table is read and the pairs are sorted on nthreads threads: each
+ * of them takes ranges of leaves of the table (see
+ * chidb_Btree_morsels) until there are none left, and sorts the pairs
+ * it read, and the sorted runs of all the threads are merged as they
+ * are loaded.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - table_root: Page number of the root node of the table
+ * - index_root: Page number of the root node of the index, which must
+ *               be an empty index leaf node
+ * - column: Position of the indexed column in the table's records
+ * - nthreads: Threads to read the table on (0 for one per online
+ *             processor, see chidb_nthreads)
+ *
+ * In a file with BTREE_FEATURE_NORMKEY, the entries are sorted by
+ * their normalized keys (see chidb_Btree_indexKey), and text columns
+ * can be indexed too.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The column is not an integer column (or a text
+ *                    column, in a file with BTREE_FEATURE_NORMKEY)
+ * - CHIDB_EDUPLICATE: Two rows have the same value in the column
+ * - CHIDB_EMISUSE: The index is not empty, the column doesn't exist, or
+ *                  a value's key is longer than NORMIDX_MAXKEY
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_buildIndex(BTree *bt, npage_t table_root, npage_t index_root, uint8_t column, uint32_t nthreads)
+{
+    return chidb_Btree_buildCoveringIndex(bt, table_root, index_root, column, NULL, 0, nthreads);
+}
+
+
+/* Populate a covering index with the rows already in a table
+ *
+ * A covering index (CREATE INDEX ... INCLUDE (columns)) answers queries
+ * on the indexed column and the included columns without looking up
+ * the rows in the table. Since the indexed column is unique, it is
+ * stored as a table B-Tree keyed by the indexed column (keyIdx), where
+ * the record of each entry is the primary key of the row (keyPk),
+ * followed by the included columns, in the file's record format. A
+ * cursor on a covering index reads them with Column (keyPk is column 0,
+ * and the included columns follow it in the order they were given).
+ *
+ * Like chidb_Btree_buildIndex, the entries are sorted and bulk-loaded,
+ * and rows where the indexed column is NULL are not indexed. Without
+ * included columns, this is chidb_Btree_buildIndex.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - table_root: Page number of the root node of the table
+ * - index_root: Page number of the root node of the index, which must
+ *               be an empty table leaf node (an empty index leaf node
+ *               if ninclude is 0)
+ * - column: Position of the indexed column in the table's records
+ * - include: Positions of the included columns in the table's records
+ * - ninclude: Number of included columns
+ * - nthreads: Threads to read the table on (0 for one per online
+ *             processor)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The indexed column is not an integer column
+ * - CHIDB_EDUPLICATE: Two rows have the same value in the column
+ * - CHIDB_EMISUSE: The index is not empty, or a column doesn't exist
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_buildCoveringIndex(BTree *bt, npage_t table_root, npage_t index_root, uint8_t column,
+                                   const uint8_t *include, uint8_t ninclude, uint32_t nthreads)
+{
+    IndexBuild b = {bt, column};
+    BTreeIterator it = {chidb_Btree_nextIndexEntry, &b};
+    IndexRun *runs = NULL;
+    int rc;
+
+    if (nthreads == 0)
+        nthreads = chidb_nthreads(NULL);
+    rc = chidb_Btree_morsels(bt, table_root, nthreads * BTREE_BUILD_MORSELS, &b.morsels, &b.nmorsels);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    b.nruns = nthreads < b.nmorsels ? nthreads : b.nmorsels;
+    b.runs = calloc(b.nruns, sizeof(IndexEntries));
+    b.heap = malloc(b.nruns * sizeof(uint32_t));
+    runs = calloc(b.nruns, sizeof(IndexRun));
+    if (b.runs == NULL || b.heap == NULL || runs == NULL)
+    {
+        rc = CHIDB_ENOMEM;
+        goto done;
+    }
+
+    /* The thread that builds the index collects the first run, and the
+     * morsels of a thread that couldn't be started are left to the
+     * others */
+    for (uint32_t i = 0; i < b.nruns; i++)
+    {
+        b.runs[i].include = include;
+        b.runs[i].ninclude = ninclude;
+        runs[i].build = &b;
+        runs[i].entries = &b.runs[i];
+    }
+    for (uint32_t i = 1; i < b.nruns; i++)
+        runs[i].started = pthread_create(&runs[i].thread, NULL, chidb_Btree_collectRun, &runs[i]) == 0;
+    chidb_Btree_collectRun(&runs[0]);
+    for (uint32_t i = 1; i < b.nruns; i++)
+        if (runs[i].started)
+            pthread_join(runs[i].thread, NULL);
+
+    for (uint32_t i = 0; i < b.nruns && rc == CHIDB_OK; i++)
+        rc = runs[i].rc;
+    if (rc != CHIDB_OK)
+        goto done;
+
+    for (uint32_t i = 0; i < b.nruns; i++)
+        if (b.runs[i].n > 0)
+            b.heap[b.nheap++] = i;
+    for (uint32_t i = b.nheap / 2; i-- > 0; )
+        chidb_Btree_siftRun(&b, i);
+    rc = chidb_Btree_bulkLoad(bt, index_root, &it, BTREE_DEFAULT_FILLFACTOR);
+
+done:
+    for (uint32_t i = 0; b.runs != NULL && i < b.nruns; i++)
+        chidb_Btree_freeIndexEntries(&b.runs[i]);
+    free(b.runs);
+    free(b.heap);
+    free(runs);
+    free(b.morsels);
+
+    return rc;
+}
+
+
+/* Cells of one or two nodes being rebuilt by chidb_Btree_delete. The data
+ * of table leaf cells (and the normalized keys of index cells) is
+ * copied to a separate buffer, since the nodes' pages are reinitialized
+ * before the cells are inserted again. */
+typedef struct DeleteCells
+{
+    BTreeCell *cells;
+    ncell_t n;
+    uint8_t *data;
+    uint32_t used;
+} DeleteCells;
+
+static int chidb_Btree_deleteCellsInit(BTree *bt, DeleteCells *dc, uint32_t ncells)
+{
+    /* Two nodes, and (with normalized keys) the separator between them */
+    dc->cells = malloc(ncells * sizeof(BTreeCell));
+    dc->data = malloc(3 * bt->pager->page_size);
+    dc->n = 0;
+    dc->used = 0;
+
+    if (dc->cells == NULL || dc->data == NULL)
+    {
+        free(dc->cells);
+        free(dc->data);
+        return CHIDB_ENOMEM;
+    }
+
+    return CHIDB_OK;
+}
+
+static void chidb_Btree_deleteCellsFree(DeleteCells *dc)
+{
+    free(dc->cells);
+    free(dc->data);
+}
+
+static void chidb_Btree_deleteCellsAdd(BTree *bt, DeleteCells *dc, BTreeCell *cell)
+{
+    BTreeCell *c = &dc->cells[dc->n++];
+
+    *c = *cell;
+    if (c->type == PGTYPE_TABLE_LEAF)
+    {
+        /* Overflow pages stay where they are, only the cell moves */
+        uint32_t local = chidb_Btree_localSize(bt, cell->fields.tableLeaf.data_size);
+
+        memcpy(dc->data + dc->used, cell->fields.tableLeaf.data, local);
+        c->fields.tableLeaf.data = dc->data + dc->used;
+        dc->used += local;
+    }
+    if (c->nkey != NULL)
+    {
+        memcpy(dc->data + dc->used, cell->nkey, cell->nkey_size);
+        c->nkey = dc->data + dc->used;
+        dc->used += cell->nkey_size;
+    }
+}
+
+static void chidb_Btree_deleteCellsAddNode(BTree *bt, DeleteCells *dc, BTreeNode *btn)
+{
+    BTreeCell cell;
+
+    for (ncell_t i = 0; i < btn->n_cells; i++)
+    {
+        chidb_Btree_getCell(btn, i, &cell);
+        chidb_Btree_deleteCellsAdd(bt, dc, &cell);
+    }
+}
+
+/* Turns a separator taken from an internal node into a cell of the given
+ * type, pointing to child if the type is an internal one */
+static void chidb_Btree_castCell(BTreeCell *cell, uint8_t type, npage_t child)
+{
+    chidb_key_t keyPk = cell->type == PGTYPE_INDEX_LEAF ? cell->fields.indexLeaf.keyPk
+                                                        : cell->fields.indexInternal.keyPk;
+
+    switch (type)
+    {
+    case PGTYPE_TABLE_INTERNAL:
+        cell->fields.tableInternal.child_page = child;
+        break;
+    case PGTYPE_INDEX_INTERNAL:
+        cell->fields.indexInternal.keyPk = keyPk;
+        cell->fields.indexInternal.child_page = child;
+        break;
+    case PGTYPE_INDEX_LEAF:
+        cell->fields.indexLeaf.keyPk = keyPk;
+        break;
+    }
+    cell->type = type;
+}
+
+/* Removes a cell from a node. The cells stored before it in the page are
+ * moved over it, so that the free space stays in one piece (which is
+ * where chidb_Btree_insertCell takes space from). */
+static void chidb_Btree_removeCell(BTree *bt, BTreeNode *btn, ncell_t ncell)
+{
+    uint8_t *data = btn->page->data;
+    uint32_t offset = get2byte(btn->celloffset_array + 2 * ncell);
+    uint32_t size;
+    BTreeCell cell;
+
+    chidb_Btree_getCell(btn, ncell, &cell);
+    size = chidb_Btree_cellSpace(bt, &cell) - 2;
+
+    memmove(data + btn->cells_offset + size, data + btn->cells_offset, offset - btn->cells_offset);
+    for (ncell_t i = 0; i < btn->n_cells; i++)
+    {
+        uint32_t o = get2byte(btn->celloffset_array + 2 * i);
+
+        if (o < offset)
+            put2byte(btn->celloffset_array + 2 * i, o + size);
+    }
+    memmove(btn->celloffset_array + 2 * ncell, btn->celloffset_array + 2 * (ncell + 1),
+            2 * (btn->n_cells - ncell - 1));
+
+    btn->cells_offset += size;
+    btn->free_offset -= 2;
+    btn->n_cells--;
+}
+
+/* Replaces the key of a cell in an internal node (and, in an index, the
+ * primary key that goes with it). Internal cells have a fixed size, so
+ * this is done in place, except in an index with normalized keys: the
+ * cell is removed and inserted again with the new key, which there is
+ * always room for (see chidb_Btree_sepReserve). */
+static int chidb_Btree_setSeparator(BTreeNode *btn, ncell_t ncell, BTreeCell *sep)
+{
+    uint8_t *c = btn->page->data + get2byte(btn->celloffset_array + 2 * ncell);
+
+    if (btn->bt->features & BTREE_FEATURE_NORMKEY)
+    {
+        BTreeCell cell = *sep;
+        BTreeCell old;
+
+        if (btn->type == PGTYPE_TABLE_INTERNAL)
+        {
+            chidb_normkey_putRowid(c + NORMTABLEINTCELL_KEY_OFFSET, sep->key);
+            return CHIDB_OK;
+        }
+
+        chidb_Btree_castCell(&cell, PGTYPE_INDEX_INTERNAL, chidb_Btree_childPage(btn, ncell));
+        chidb_Btree_getCell(btn, ncell, &old);
+        if (btn->cells_offset - btn->free_offset + chidb_Btree_cellSize(btn->bt, &old) <
+            chidb_Btree_cellSize(btn->bt, &cell))
+            return CHIDB_ECORRUPT;
+        chidb_Btree_removeCell(btn->bt, btn, ncell);
+
+        return chidb_Btree_insertCell(btn, ncell, &cell);
+    }
+
+    if (btn->type == PGTYPE_TABLE_INTERNAL)
+        putVarint32(c + TABLEINTCELL_KEY_OFFSET, sep->key);
+    else
+    {
+        bool packed = btn->bt->features & BTREE_FEATURE_PACKEDINDEX;
+
+        put4byte(c + (packed ? PACKEDIDXINTCELL_KEYIDX_OFFSET : INDEXINTCELL_KEYIDX_OFFSET), sep->key);
+        put4byte(c + (packed ? PACKEDIDXINTCELL_KEYPK_OFFSET : INDEXINTCELL_KEYPK_OFFSET),
+                 sep->type == PGTYPE_INDEX_LEAF ? sep->fields.indexLeaf.keyPk : sep->fields.indexInternal.keyPk);
+    }
+
+    return CHIDB_OK;
+}
+
+static npage_t chidb_Btree_childPage(BTreeNode *btn, ncell_t ncell)
+{
+    BTreeCell cell;
+
+    if (ncell == btn->n_cells)
+        return btn->right_page;
+
+    chidb_Btree_getCell(btn, ncell, &cell);
+
+    return btn->type == PGTYPE_TABLE_INTERNAL ? cell.fields.tableInternal.child_page
+                                              : cell.fields.indexInternal.child_page;
+}
+
+/* Bytes used by the cells (and cell offsets) of a node */
+static uint32_t chidb_Btree_nodeUsed(BTree *bt, BTreeNode *btn)
+{
+    return chidb_Btree_nodeSpace(bt, btn->page->npage, btn->type) - (btn->cells_offset - btn->free_offset);
+}
+
+static bool chidb_Btree_underflow(BTree *bt, BTreeNode *btn)
+{
+    return chidb_Btree_nodeUsed(bt, btn) <
+           chidb_Btree_nodeSpace(bt, btn->page->npage, btn->type) * BTREE_MIN_FILLFACTOR / 100;
+}
+
+/* Reinitializes a node with the given cells (which must be of its type) */
+static int chidb_Btree_rebuildNode(BTree *bt, npage_t npage, uint8_t type, BTreeCell *cells, ncell_t n,
+                                   npage_t right_page, npage_t left_page)
+{
+    BTreeNode *btn;
+    int rc;
+
+    rc = chidb_Btree_initEmptyNode(bt, npage, type);
+    if (rc != CHIDB_OK)
+        return rc;
+    rc = chidb_Btree_getNodeByPage(bt, npage, &btn);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    for (ncell_t i = 0; i < n && rc == CHIDB_OK; i++)
+        rc = chidb_Btree_insertCell(btn, i, &cells[i]);
+    btn->right_page = right_page;
+    btn->left_page = left_page;
+
+    if (rc == CHIDB_OK)
+        rc = chidb_Btree_writeNode(bt, btn);
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return rc;
+}
+
+/* Fixes a child of an internal node that is too empty after a delete.
+ * The child and one of its siblings (with the cell that separates them
+ * in the parent, unless they are table leaves) are merged into the
+ * sibling on the right if they fit in one node, and the left one is
+ * freed. Otherwise, their cells are divided evenly between them. The
+ * parent is written to disk. */
+static int chidb_Btree_rebalance(BTree *bt, BTreeNode *parent, ncell_t nchild)
+{
+    BTreeNode *left, *right;
+    BTreeCell sep;
+    DeleteCells dc;
+    npage_t nleft, nright, left_left, left_right, right_left, right_right;
+    uint8_t type;
+    uint32_t total = 0, half = 0, space;
+    ncell_t p, m;
+    bool leaf;
+    int rc;
+
+    /* Only a root that is waiting to be collapsed has no cells */
+    if (parent->n_cells == 0)
+        return CHIDB_OK;
+
+    /* The child and its right sibling, or its left one if it is the last child */
+    p = nchild < parent->n_cells ? nchild : parent->n_cells - 1;
+    chidb_Btree_getCell(parent, p, &sep);
+    nleft = chidb_Btree_childPage(parent, p);
+    nright = chidb_Btree_childPage(parent, p + 1);
+
+    rc = chidb_Btree_getNodeByPage(bt, nleft, &left);
+    if (rc != CHIDB_OK)
+        return rc;
+    rc = chidb_Btree_getNodeByPage(bt, nright, &right);
+    if (rc != CHIDB_OK)
+    {
+        chidb_Btree_freeMemNode(bt, left);
+        return rc;
+    }
+
+    type = left->type;
+    leaf = type == PGTYPE_TABLE_LEAF || type == PGTYPE_INDEX_LEAF;
+    left_left = left->left_page;
+    left_right = left->right_page;
+    right_left = right->left_page;
+    right_right = right->right_page;
+
+    rc = chidb_Btree_deleteCellsInit(bt, &dc, left->n_cells + right->n_cells + 1);
+    if (rc == CHIDB_OK)
+    {
+        chidb_Btree_deleteCellsAddNode(bt, &dc, left);
+        if (type != PGTYPE_TABLE_LEAF)
+        {
+            chidb_Btree_castCell(&sep, type, left->right_page);
+            chidb_Btree_deleteCellsAdd(bt, &dc, &sep);
+        }
+        chidb_Btree_deleteCellsAddNode(bt, &dc, right);
+    }
+    chidb_Btree_freeMemNode(bt, left);
+    chidb_Btree_freeMemNode(bt, right);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    for (ncell_t i = 0; i < dc.n; i++)
+        total += chidb_Btree_cellSpace(bt, &dc.cells[i]);
+    space = chidb_Btree_nodeSpace(bt, nright, type);
+    /* A merged node with normalized separators keeps room to replace
+     * one of them (see chidb_Btree_sepReserve) */
+    if (type == PGTYPE_INDEX_INTERNAL && (bt->features & BTREE_FEATURE_NORMKEY))
+        space -= chidb_Btree_sepReserve(bt, type) / 2;
+
+    if (total <= space)
+    {
+        /* Merge */
+        rc = chidb_Btree_rebuildNode(bt, nright, type, dc.cells, dc.n, right_right, left_left);
+        if (rc == CHIDB_OK && type == PGTYPE_TABLE_LEAF && left_left != 0)
+        {
+            BTreeNode *prev;
+
+            rc = chidb_Btree_getNodeByPage(bt, left_left, &prev);
+            if (rc == CHIDB_OK)
+            {
+                prev->right_page = nright;
+                rc = chidb_Btree_writeNode(bt, prev);
+                chidb_Btree_freeMemNode(bt, prev);
+            }
+        }
+        if (rc == CHIDB_OK)
+        {
+            chidb_Btree_removeCell(bt, parent, p);
+            rc = chidb_Btree_writeNode(bt, parent);
+        }
+        if (rc == CHIDB_OK)
+            rc = chidb_Btree_freePage(bt, nleft);
+    }
+    else
+    {
+        /* Redistribute: the left node gets the first half of the bytes */
+        for (m = 0; m < dc.n - 1; m++)
+        {
+            uint32_t size = chidb_Btree_cellSpace(bt, &dc.cells[m]);
+
+            if (half + size > total / 2)
+                break;
+            half += size;
+        }
+        if (type == PGTYPE_TABLE_LEAF)
+        {
+            if (m == 0 || total - half > space)
+                m++;
+
+            rc = chidb_Btree_rebuildNode(bt, nleft, type, dc.cells, m, left_right, left_left);
+            if (rc == CHIDB_OK)
+                rc = chidb_Btree_rebuildNode(bt, nright, type, dc.cells + m, dc.n - m, right_right, right_left);
+            sep = dc.cells[m - 1];
+        }
+        else
+        {
+            /* The cell in the middle becomes the separator */
+            npage_t middle = type == PGTYPE_TABLE_INTERNAL ? dc.cells[m].fields.tableInternal.child_page
+                                                           : dc.cells[m].fields.indexInternal.child_page;
+
+            rc = chidb_Btree_rebuildNode(bt, nleft, type, dc.cells, m, leaf ? left_right : middle, left_left);
+            if (rc == CHIDB_OK)
+                rc = chidb_Btree_rebuildNode(bt, nright, type, dc.cells + m + 1, dc.n - m - 1,
+                                             right_right, right_left);
+            sep = dc.cells[m];
+        }
+
+        if (rc == CHIDB_OK)
+            rc = chidb_Btree_setSeparator(parent, p, &sep);
+        if (rc == CHIDB_OK)
+            rc = chidb_Btree_writeNode(bt, parent);
+    }
+
+    chidb_Btree_deleteCellsFree(&dc);
+
+    return rc;
+}
+
+/* Finds the largest key in a subtree (found is false if it is empty) */
+static int chidb_Btree_maxKey(BTree *bt, npage_t npage, BTreeCell *max, bool *found)
+{
+    BTreeNode *btn;
+    int rc;
+
+    for (;;)
+    {
+        rc = chidb_Btree_getNodeByPage(bt, npage, &btn);
+        if (rc != CHIDB_OK)
+            return rc;
+        if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
+            break;
+        npage = btn->right_page;
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+
+    *found = btn->n_cells > 0;
+    if (*found)
+        chidb_Btree_getCell(btn, btn->n_cells - 1, max);
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return CHIDB_OK;
+}
+
+/* Removes the largest entry of an index subtree, returning it in max.
+ * Its normalized key, if it has one, is copied to *key, which must be
+ * freed. */
+static int chidb_Btree_deleteMax(BTree *bt, npage_t npage, BTreeCell *max, uint8_t **key, bool *underflow)
+{
+    BTreeNode *btn;
+    bool child_underflow = false;
+    int rc;
+
+    rc = chidb_Btree_getNodeByPage(bt, npage, &btn);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if (btn->type == PGTYPE_INDEX_LEAF)
+    {
+        if (btn->n_cells == 0)
+            rc = CHIDB_ECORRUPT;
+        else
+        {
+            /* The key is in the page, which the removal overwrites */
+            chidb_Btree_getCell(btn, btn->n_cells - 1, max);
+            if (max->nkey != NULL)
+            {
+                if ((*key = malloc(max->nkey_size)) == NULL)
+                {
+                    chidb_Btree_freeMemNode(bt, btn);
+                    return CHIDB_ENOMEM;
+                }
+                memcpy(*key, max->nkey, max->nkey_size);
+                max->nkey = *key;
+            }
+            chidb_Btree_removeCell(bt, btn, btn->n_cells - 1);
+            rc = chidb_Btree_writeNode(bt, btn);
+        }
+    }
+    else
+    {
+        rc = chidb_Btree_deleteMax(bt, btn->right_page, max, key, &child_underflow);
+        if (rc == CHIDB_OK && child_underflow)
+            rc = chidb_Btree_rebalance(bt, btn, btn->n_cells);
+    }
+
+    *underflow = rc == CHIDB_OK && chidb_Btree_underflow(bt, btn);
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return rc;
+}
+
+/* Removes key from the subtree rooted at npage. underflow is set if the
+ * node at npage ends up too empty, which its parent must then fix
+ * with chidb_Btree_rebalance. */
+static int chidb_Btree_deleteEntry(BTree *bt, npage_t npage, chidb_key_t key, bool *underflow)
+{
+    BTreeNode *btn;
+    BTreeCell max;
+    uint8_t *maxkey = NULL;
+    ncell_t i;
+    bool found, child_underflow = false;
+    int rc;
+
+    rc = chidb_Btree_getNodeByPage(bt, npage, &btn);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    found = chidb_Btree_nodeSearch(btn, key, &i) == CHIDB_OK;
+
+    switch (btn->type)
+    {
+    case PGTYPE_TABLE_LEAF:
+    case PGTYPE_INDEX_LEAF:
+        if (!found)
+        {
+            rc = CHIDB_ENOTFOUND;
+            break;
+        }
+        if (btn->type == PGTYPE_TABLE_LEAF)
+        {
+            BTreeCell cell;
+
+            chidb_Btree_getCell(btn, i, &cell);
+            rc = chidb_Btree_freeOverflow(bt, cell.fields.tableLeaf.overflow_page);
+            if (rc != CHIDB_OK)
+                break;
+        }
+        chidb_Btree_removeCell(bt, btn, i);
+        rc = chidb_Btree_writeNode(bt, btn);
+        break;
+
+    case PGTYPE_INDEX_INTERNAL:
+        if (found)
+        {
+            /* The entry is replaced by the largest one to its left */
+            rc = chidb_Btree_deleteMax(bt, chidb_Btree_childPage(btn, i), &max, &maxkey, &child_underflow);
+            if (rc == CHIDB_OK)
+                rc = chidb_Btree_setSeparator(btn, i, &max);
+            if (rc == CHIDB_OK)
+                rc = chidb_Btree_writeNode(bt, btn);
+            break;
+        }
+        /* Fall through */
+
+    case PGTYPE_TABLE_INTERNAL:
+        rc = chidb_Btree_deleteEntry(bt, chidb_Btree_childPage(btn, i), key, &child_underflow);
+
+        /* Keep the separator equal to a key in the tree, since inserting
+         * a key that matches a separator is treated as a duplicate */
+        if (rc == CHIDB_OK && found && btn->type == PGTYPE_TABLE_INTERNAL)
+        {
+            bool nonempty;
+
+            rc = chidb_Btree_maxKey(bt, chidb_Btree_childPage(btn, i), &max, &nonempty);
+            if (rc == CHIDB_OK && nonempty)
+                rc = chidb_Btree_setSeparator(btn, i, &max);
+            if (rc == CHIDB_OK && nonempty)
+                rc = chidb_Btree_writeNode(bt, btn);
+        }
+        break;
+
+    default:
+        rc = CHIDB_ECORRUPT;
+        break;
+    }
+
+    if (rc == CHIDB_OK && child_underflow)
+        rc = chidb_Btree_rebalance(bt, btn, i);
+
+    *underflow = rc == CHIDB_OK && chidb_Btree_underflow(bt, btn);
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return rc;
+}
+
+/* Moves the only child of a root with no cells into the root, so that
+ * the tree becomes one level shorter (the root page never changes).
+ * collapsed is false if the root has cells, or is a leaf, or can't hold
+ * the cells of its child yet. */
+static int chidb_Btree_collapseRoot(BTree *bt, npage_t nroot, bool *collapsed)
+{
+    BTreeNode *root, *child;
+    DeleteCells dc;
+    npage_t nchild, right_page;
+    uint8_t type;
+    int rc;
+
+    *collapsed = false;
+
+    rc = chidb_Btree_getNodeByPage(bt, nroot, &root);
+    if (rc != CHIDB_OK)
+        return rc;
+    if (root->n_cells > 0 || root->type == PGTYPE_TABLE_LEAF || root->type == PGTYPE_INDEX_LEAF)
+    {
+        chidb_Btree_freeMemNode(bt, root);
+        return CHIDB_OK;
+    }
+    nchild = root->right_page;
+    chidb_Btree_freeMemNode(bt, root);
+
+    rc = chidb_Btree_getNodeByPage(bt, nchild, &child);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    /* The root may have less space than its child (if it is page 1), in
+     * which case it stays empty until the child shrinks */
+    if (chidb_Btree_nodeUsed(bt, child) > chidb_Btree_nodeSpace(bt, nroot, child->type))
+    {
+        chidb_Btree_freeMemNode(bt, child);
+        return CHIDB_OK;
+    }
+
+    rc = chidb_Btree_deleteCellsInit(bt, &dc, child->n_cells);
+    if (rc == CHIDB_OK)
+        chidb_Btree_deleteCellsAddNode(bt, &dc, child);
+    type = child->type;
+    right_page = type == PGTYPE_TABLE_INTERNAL || type == PGTYPE_INDEX_INTERNAL ? child->right_page : 0;
+    chidb_Btree_freeMemNode(bt, child);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    /* If the child is a leaf, it is the only one, so it has no siblings */
+    rc = chidb_Btree_rebuildNode(bt, nroot, type, dc.cells, dc.n, right_page, 0);
+    if (rc == CHIDB_OK)
+        rc = chidb_Btree_freePage(bt, nchild);
+    chidb_Btree_deleteCellsFree(&dc);
+    *collapsed = rc == CHIDB_OK;
+
+    return rc;
+}
+
+/* Delete an entry from a B-Tree
+ *
+ * Removes the entry with the given key from a table B-Tree (or, in an
+ * index B-Tree, the entry with that indexed key).
+ *
+ * Nodes that end up less than BTREE_MIN_FILLFACTOR percent full are
+ * rebalanced on the way back up the tree: an underflowing node is merged
+ * with a sibling if both fit in one node, and the page that is no
+ * longer used is added to the freelist (see chidb_Btree_freePage).
+ * Otherwise, it takes cells from the sibling so that both are about as
+ * full. When the root is left with no cells, its only child is moved into
+ * it, and the tree becomes one level shorter (the root page never
+ * changes).
+ *
+ * The keys in the internal nodes of a table B-Tree are always keys of
+ * entries in the tree: when an entry whose key is also a separator is
+ * deleted, the separator is replaced by the next smaller key.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - key: Key of the entry to delete
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key
+ * - CHIDB_ECORRUPT: The B-Tree is not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_delete(BTree *bt, npage_t nroot, chidb_key_t key)
+{
+    bool underflow, collapsed;
+    int rc;
+
+    /* Merges can free the cached rightmost leaf or its parent */
+    chidb_Btree_cacheAppend(bt, 0, 0, 0);
+
+    rc = chidb_Btree_deleteEntry(bt, nroot, key, &underflow);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    return chidb_Btree_collapseRoot(bt, nroot, &collapsed);
+}
+
+
+/* State of a chidb_Btree_deleteRange or chidb_Btree_truncate. The pages
+ * of the subtrees that are detached (and their overflow pages) are only
+ * added to the freelist once the tree no longer points to them, all at
+ * once. The first and last table leaves reached, in key order, are the
+ * ends of the run of leaves that is cut out of the list of leaves. */
+typedef struct RangeDelete
+{
+    chidb_key_t lo, hi;
+    npage_t *pages;
+    uint32_t npages, size;
+    uint64_t ndeleted;
+    npage_t first, first_left, last, last_right;
+    bool first_kept, last_kept;
+} RangeDelete;
+
+static int chidb_Btree_rangeAddPage(RangeDelete *rd, npage_t npage)
+{
+    if (rd->npages == rd->size)
+    {
+        uint32_t size = rd->size ? 2 * rd->size : 64;
+        npage_t *pages = realloc(rd->pages, size * sizeof(npage_t));
+
+        if (pages == NULL)
+            return CHIDB_ENOMEM;
+        rd->pages = pages;
+        rd->size = size;
+    }
+    rd->pages[rd->npages++] = npage;
+
+    return CHIDB_OK;
+}
+
+/* Adds a chain of overflow pages to the pages to free (like
+ * chidb_Btree_freeOverflow) */
+static int chidb_Btree_rangeAddOverflow(BTree *bt, RangeDelete *rd, npage_t npage)
+{
+    npage_t n = 0;
+    int rc;
+
+    while (npage != 0)
+    {
+        MemPage *page;
+
+        if (npage <= 1 || npage > bt->pager->n_pages || n++ > bt->pager->n_pages)
+            return CHIDB_ECORRUPT;
+        if ((rc = chidb_Btree_rangeAddPage(rd, npage)) != CHIDB_OK)
+            return rc;
+
+        rc = chidb_Pager_readPage(bt->pager, npage, &page);
+        if (rc != CHIDB_OK)
+            return rc;
+        npage = get4byte(page->data + OVERFLOW_NEXT_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    return CHIDB_OK;
+}
+
+/* Records a table leaf that was reached, and whether it stays in the tree */
+static void chidb_Btree_rangeLeaf(RangeDelete *rd, BTreeNode *btn, bool kept)
+{
+    if (rd->first == 0)
+    {
+        rd->first = btn->page->npage;
+        rd->first_left = btn->left_page;
+        rd->first_kept = kept;
+    }
+    rd->last = btn->page->npage;
+    rd->last_right = btn->right_page;
+    rd->last_kept = kept;
+}
+
+/* Adds every page of a subtree to the pages to free, and its entries to
+ * the ones deleted, without reading any record */
+static int chidb_Btree_rangeDetach(BTree *bt, RangeDelete *rd, npage_t npage)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+        return rc;
+    rc = chidb_Btree_rangeAddPage(rd, npage);
+
+    switch (btn->type)
+    {
+    case PGTYPE_TABLE_LEAF:
+        chidb_Btree_rangeLeaf(rd, btn, false);
+        rd->ndeleted += btn->n_cells;
+        for (ncell_t i = 0; i < btn->n_cells && rc == CHIDB_OK; i++)
+        {
+            chidb_Btree_getCell(btn, i, &cell);
+            rc = chidb_Btree_rangeAddOverflow(bt, rd, cell.fields.tableLeaf.overflow_page);
+        }
+        break;
+
+    case PGTYPE_INDEX_LEAF:
+        rd->ndeleted += btn->n_cells;
+        break;
+
+    case PGTYPE_TABLE_INTERNAL:
+    case PGTYPE_INDEX_INTERNAL:
+        if (btn->type == PGTYPE_INDEX_INTERNAL)
+            rd->ndeleted += btn->n_cells;
+        chidb_Btree_prefetchChildren(bt, btn, 0, btn->n_cells + 1);
+        for (ncell_t i = 0; i <= btn->n_cells && rc == CHIDB_OK; i++)
+            rc = chidb_Btree_rangeDetach(bt, rd, chidb_Btree_childPage(btn, i));
+        break;
+
+    default:
+        rc = CHIDB_ECORRUPT;
+        break;
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return rc;
+}
+
+/* Removes the entries with keys in [rd->lo, rd->hi] from the subtree of
+ * a table rooted at npage, whose keys are all in [clo, chi]. Children
+ * whose keys are all in the range are detached whole: only the (at most
+ * two) that also have keys outside of it are trimmed, recursively, and
+ * the separators of the children that are left stay keys in the tree.
+ * No node is rebalanced. empty is set if the subtree has no entries
+ * left, in which case the caller must detach its root too. */
+static int chidb_Btree_rangeTrim(BTree *bt, RangeDelete *rd, npage_t npage, chidb_key_t clo, chidb_key_t chi,
+                                 bool *empty)
+{
+    BTreeNode *btn;
+    BTreeCell cell, *cells;
+    npage_t right_page = 0, left_page;
+    ncell_t first, last, n = 0;
+    bool changed = false;
+    int rc;
+
+    *empty = false;
+    if ((rc = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+        return rc;
+
+    if (btn->type == PGTYPE_TABLE_LEAF)
+    {
+        chidb_Btree_nodeSearch(btn, rd->lo, &first);
+        for (last = first; last < btn->n_cells && rc == CHIDB_OK; last++)
+        {
+            chidb_Btree_getCell(btn, last, &cell);
+            if (cell.key > rd->hi)
+                break;
+            rc = chidb_Btree_rangeAddOverflow(bt, rd, cell.fields.tableLeaf.overflow_page);
+        }
+
+        if (rc == CHIDB_OK && last > first)
+        {
+            for (ncell_t i = last; i-- > first; )
+                chidb_Btree_removeCell(bt, btn, i);
+            rd->ndeleted += last - first;
+            rc = chidb_Btree_writeNode(bt, btn);
+        }
+        *empty = btn->n_cells == 0;
+        chidb_Btree_rangeLeaf(rd, btn, !*empty);
+        chidb_Btree_freeMemNode(bt, btn);
+
+        return rc;
+    }
+    if (btn->type != PGTYPE_TABLE_INTERNAL)
+    {
+        chidb_Btree_freeMemNode(bt, btn);
+        return CHIDB_ECORRUPT;
+    }
+
+    /* The cells of the node, without those of the children that go */
+    if ((cells = malloc((btn->n_cells + 1) * sizeof(BTreeCell))) == NULL)
+    {
+        chidb_Btree_freeMemNode(bt, btn);
+        return CHIDB_ENOMEM;
+    }
+
+    chidb_Btree_nodeSearch(btn, rd->lo, &first);
+    chidb_Btree_nodeSearch(btn, rd->hi, &last);
+    left_page = btn->left_page;
+
+    for (ncell_t i = 0; i <= btn->n_cells && rc == CHIDB_OK; i++)
+    {
+        npage_t child = chidb_Btree_childPage(btn, i);
+        chidb_key_t lo = clo, hi = chi;
+        bool gone = false;
+
+        if (i > 0)
+        {
+            chidb_Btree_getCell(btn, i - 1, &cell);
+            lo = cell.key + 1;
+        }
+        if (i < btn->n_cells)
+        {
+            chidb_Btree_getCell(btn, i, &cell);
+            hi = cell.key;
+        }
+
+        if (i >= first && i <= last)
+        {
+            if (lo >= rd->lo && hi <= rd->hi)
+            {
+                rc = chidb_Btree_rangeDetach(bt, rd, child);
+                gone = true;
+            }
+            else
+            {
+                rc = chidb_Btree_rangeTrim(bt, rd, child, lo, hi, &gone);
+                if (rc == CHIDB_OK && gone)
+                    rc = chidb_Btree_rangeAddPage(rd, child);
+
+                /* The largest key of the child may have been deleted */
+                if (rc == CHIDB_OK && !gone && i < btn->n_cells)
+                {
+                    BTreeCell max;
+                    bool nonempty;
+
+                    rc = chidb_Btree_maxKey(bt, child, &max, &nonempty);
+                    if (rc == CHIDB_OK && nonempty && max.key != hi)
+                    {
+                        hi = max.key;
+                        changed = true;
+                    }
+                }
+            }
+            changed |= gone;
+        }
+
+        if (rc != CHIDB_OK || gone)
+            continue;
+        if (i == btn->n_cells)
+            right_page = child;
+        else
+        {
+            cells[n] = (BTreeCell) {.type = PGTYPE_TABLE_INTERNAL, .key = hi, .nkey = NULL};
+            cells[n++].fields.tableInternal.child_page = child;
+        }
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    /* With the rightmost child gone, the last one left takes its place */
+    if (rc == CHIDB_OK && right_page == 0 && n > 0)
+        right_page = cells[--n].fields.tableInternal.child_page;
+
+    if (rc == CHIDB_OK && right_page == 0)
+        *empty = true;
+    else if (rc == CHIDB_OK && changed)
+        rc = chidb_Btree_rebuildNode(bt, npage, PGTYPE_TABLE_INTERNAL, cells, n, right_page, left_page);
+    free(cells);
+
+    return rc;
+}
+
+/* Joins the leaves on both sides of those that were detached (see
+ * chidb_Btree_linkLeaf) */
+static int chidb_Btree_rangeRelink(BTree *bt, RangeDelete *rd)
+{
+    npage_t left = rd->first_kept ? rd->first : rd->first_left;
+    npage_t right = rd->last_kept ? rd->last : rd->last_right;
+    BTreeNode *btn;
+    int rc = CHIDB_OK;
+
+    if (rd->first == 0 || left == right)
+        return CHIDB_OK;
+
+    if (left != 0 && (rc = chidb_Btree_getNodeByPage(bt, left, &btn)) == CHIDB_OK)
+    {
+        btn->right_page = right;
+        rc = chidb_Btree_writeNode(bt, btn);
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+    if (rc == CHIDB_OK && right != 0 && (rc = chidb_Btree_getNodeByPage(bt, right, &btn)) == CHIDB_OK)
+    {
+        btn->left_page = left;
+        rc = chidb_Btree_writeNode(bt, btn);
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+
+    return rc;
+}
+
+/* Adds the pages that were detached to the freelist, in file order,
+ * with the pager's lock held once for all of them */
+static int chidb_Btree_rangeFree(BTree *bt, npage_t *pages, uint32_t npages)
+{
+    int rc = CHIDB_OK;
+
+    qsort(pages, npages, sizeof(npage_t), chidb_Btree_cmpPages);
+
+    chidb_Pager_lock(bt->pager);
+    for (uint32_t i = 0; i < npages && rc == CHIDB_OK; i++)
+        rc = chidb_Btree_freePageLocked(bt, pages[i]);
+    chidb_Pager_unlock(bt->pager);
+
+    return rc;
+}
+
+/* Finds the largest key less than key (or, if after is true, the
+ * smallest key greater than it) in the subtree rooted at npage. found
+ * is false if there is none. */
+static int chidb_Btree_rangeNeighbor(BTree *bt, npage_t npage, chidb_key_t key, bool after,
+                                     chidb_key_t *neighbor, bool *found)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    ncell_t i;
+    int rc;
+
+    *found = false;
+    if ((rc = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+        return rc;
+
+    /* The first cell with a key greater than key (after), or not less
+     * than it (before) */
+    if (chidb_Btree_nodeSearch(btn, key, &i) == CHIDB_OK && after)
+        i++;
+
+    if (btn->type == PGTYPE_TABLE_LEAF)
+    {
+        if (after ? i < btn->n_cells : i > 0)
+        {
+            chidb_Btree_getCell(btn, after ? i : i - 1, &cell);
+            *neighbor = cell.key;
+            *found = true;
+        }
+    }
+    else
+    {
+        /* If the child has none, the sibling next to it has it */
+        rc = chidb_Btree_rangeNeighbor(bt, chidb_Btree_childPage(btn, i), key, after, neighbor, found);
+        if (rc == CHIDB_OK && !*found && after && i < btn->n_cells)
+        {
+            rc = chidb_Btree_firstKey(bt, chidb_Btree_childPage(btn, i + 1), neighbor);
+            *found = rc == CHIDB_OK;
+            if (rc == CHIDB_ENOTFOUND)
+                rc = CHIDB_OK;
+        }
+        else if (rc == CHIDB_OK && !*found && !after && i > 0)
+        {
+            rc = chidb_Btree_maxKey(bt, chidb_Btree_childPage(btn, i - 1), &cell, found);
+            *neighbor = cell.key;
+        }
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return rc;
+}
+
+/* Rebalances the nodes on the path from npage down to the leaf with
+ * key, bottom-up, as chidb_Btree_deleteEntry does on its way back up.
+ * A child with no cells (only one child of its own) is rebalanced on
+ * the way down instead, since it can't rebalance its children. */
+static int chidb_Btree_rangeFixPath(BTree *bt, npage_t npage, chidb_key_t key, bool *underflow)
+{
+    BTreeNode *btn, *child;
+    ncell_t i;
+    bool child_underflow = false;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+        return rc;
+
+    if (btn->type == PGTYPE_TABLE_INTERNAL)
+    {
+        chidb_Btree_nodeSearch(btn, key, &i);
+        rc = chidb_Btree_getNodeByPage(bt, chidb_Btree_childPage(btn, i), &child);
+        if (rc == CHIDB_OK)
+        {
+            child_underflow = child->type == PGTYPE_TABLE_INTERNAL && child->n_cells == 0;
+            chidb_Btree_freeMemNode(bt, child);
+        }
+        if (rc == CHIDB_OK && child_underflow)
+        {
+            rc = chidb_Btree_rebalance(bt, btn, i);
+            chidb_Btree_nodeSearch(btn, key, &i);
+        }
+
+        if (rc == CHIDB_OK)
+            rc = chidb_Btree_rangeFixPath(bt, chidb_Btree_childPage(btn, i), key, &child_underflow);
+        if (rc == CHIDB_OK && child_underflow)
+            rc = chidb_Btree_rebalance(bt, btn, i);
+    }
+
+    *underflow = rc == CHIDB_OK && chidb_Btree_underflow(bt, btn);
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return rc;
+}
+
+/* Collapses the root of a table as many times as it takes, and then
+ * rebalances the paths to the entries on both sides of [lo, hi]: only
+ * the nodes on them can have lost entries without being detached */
+static int chidb_Btree_rangeFix(BTree *bt, npage_t nroot, chidb_key_t lo, chidb_key_t hi)
+{
+    chidb_key_t key;
+    bool found, underflow, collapsed = true;
+    int rc = CHIDB_OK;
+
+    while (rc == CHIDB_OK && collapsed)
+        rc = chidb_Btree_collapseRoot(bt, nroot, &collapsed);
+
+    if (rc == CHIDB_OK && lo > 0)
+        rc = chidb_Btree_rangeNeighbor(bt, nroot, lo, false, &key, &found);
+    if (rc == CHIDB_OK && lo > 0 && found)
+        rc = chidb_Btree_rangeFixPath(bt, nroot, key, &underflow);
+
+    if (rc == CHIDB_OK && hi < CHIDB_KEY_MAX)
+        rc = chidb_Btree_rangeNeighbor(bt, nroot, hi, true, &key, &found);
+    if (rc == CHIDB_OK && hi < CHIDB_KEY_MAX && found)
+        rc = chidb_Btree_rangeFixPath(bt, nroot, key, &underflow);
+
+    for (collapsed = true; rc == CHIDB_OK && collapsed; )
+        rc = chidb_Btree_collapseRoot(bt, nroot, &collapsed);
+
+    return rc;
+}
+
+/* Type of the node at the root of a B-Tree (0 if the page is not one) */
+static int chidb_Btree_rootType(BTree *bt, npage_t nroot, uint8_t *type)
+{
+    MemPage *root;
+    int rc;
+
+    if ((rc = chidb_Pager_readPage(bt->pager, nroot, &root)) != CHIDB_OK)
+        return rc;
+    *type = root->data[PGHEADER_PGTYPE_OFFSET];
+    chidb_Pager_releaseMemPage(bt->pager, root);
+    if (*type != PGTYPE_TABLE_INTERNAL && *type != PGTYPE_TABLE_LEAF &&
+        *type != PGTYPE_INDEX_INTERNAL && *type != PGTYPE_INDEX_LEAF)
+        *type = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Delete a range of entries from a table B-Tree
+ *
+ * Removes the entries with keys from lo to hi (both included), which is
+ * what a DELETE with a range of primary keys in its WHERE clause does
+ * (DELETE FROM t WHERE ts < 1000, with ts as primary key). Instead of
+ * deleting them one at a time (see chidb_Btree_delete), with a search
+ * from the root and a rebalance for each, the subtrees whose keys are
+ * all in the range are detached from their parents as a whole, and all
+ * of their pages (overflow pages included) are added to the freelist at
+ * once, in file order. Their records are never read. Only the nodes on
+ * the paths from the root to the two ends of the range can end up with
+ * some of their entries: cells are removed from those nodes, and then
+ * only they are rebalanced, bottom-up. The root is collapsed as many
+ * times as it takes (see chidb_Btree_delete), and a table with no
+ * entries left is an empty leaf, at the same root page. The list of
+ * leaves skips the ones that were detached.
+ *
+ * As with chidb_Btree_delete, the separators in the internal nodes stay
+ * keys of entries in the tree, and the zone maps and Bloom filter of
+ * the table are left as they are: a deleted key is only a false
+ * positive for them.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of a table B-Tree
+ * - lo: Smallest key to delete
+ * - hi: Largest key to delete (if it is less than lo, nothing is deleted)
+ * - ndeleted: Out parameter (may be NULL). Number of entries deleted.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The B-Tree is an index (whose internal cells are
+ *   entries too), or the page is not the root of a B-Tree
+ * - CHIDB_ECORRUPT: The B-Tree is not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_deleteRange(BTree *bt, npage_t nroot, chidb_key_t lo, chidb_key_t hi, uint64_t *ndeleted)
+{
+    RangeDelete rd = {.lo = lo, .hi = hi};
+    bool empty;
+    uint8_t type;
+    int rc;
+
+    if (ndeleted != NULL)
+        *ndeleted = 0;
+    if ((rc = chidb_Btree_rootType(bt, nroot, &type)) != CHIDB_OK)
+        return rc;
+    if (type != PGTYPE_TABLE_INTERNAL && type != PGTYPE_TABLE_LEAF)
+        return CHIDB_EMISUSE;
+    if (lo > hi)
+        return CHIDB_OK;
+
+    /* Merges can free the cached rightmost leaf or its parent */
+    chidb_Btree_cacheAppend(bt, 0, 0, 0);
+
+    rc = chidb_Btree_rangeTrim(bt, &rd, nroot, 0, CHIDB_KEY_MAX, &empty);
+    if (rc == CHIDB_OK && empty && type == PGTYPE_TABLE_INTERNAL)
+        rc = chidb_Btree_initEmptyNode(bt, nroot, PGTYPE_TABLE_LEAF);
+    if (rc == CHIDB_OK)
+        rc = chidb_Btree_rangeRelink(bt, &rd);
+    if (rc == CHIDB_OK)
+        rc = chidb_Btree_rangeFree(bt, rd.pages, rd.npages);
+
+    if (rc == CHIDB_OK && !empty)
+        rc = chidb_Btree_rangeFix(bt, nroot, lo, hi);
+
+    if (rc == CHIDB_OK && ndeleted != NULL)
+        *ndeleted = rd.ndeleted;
+    free(rd.pages);
+
+    return rc;
+}
+
+
+/* Delete every entry of a B-Tree
+ *
+ * Empties a table or index B-Tree, which is what a DELETE without a
+ * WHERE clause does to a table and to each of its indexes. Every page of
+ * the tree but the root (overflow pages included) is added to the
+ * freelist at once, in file order, without reading any record, and the
+ * root becomes an empty leaf. Since the root page doesn't change, the
+ * schema table doesn't either. The zone maps and Bloom filter of the
+ * B-Tree are left as they are (see chidb_Btree_deleteRange).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - ndeleted: Out parameter (may be NULL). Number of entries deleted.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The page is not the root of a B-Tree
+ * - CHIDB_ECORRUPT: The B-Tree is not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_truncate(BTree *bt, npage_t nroot, uint64_t *ndeleted)
+{
+    RangeDelete rd = {.lo = 0, .hi = CHIDB_KEY_MAX};
+    uint8_t type;
+    int rc;
+
+    if (ndeleted != NULL)
+        *ndeleted = 0;
+    if ((rc = chidb_Btree_rootType(bt, nroot, &type)) != CHIDB_OK)
+        return rc;
+    if (type == 0)
+        return CHIDB_EMISUSE;
+
+    chidb_Btree_cacheAppend(bt, 0, 0, 0);
+
+    /* The root is the first page detached, and the only one kept */
+    rc = chidb_Btree_rangeDetach(bt, &rd, nroot);
+    if (rc == CHIDB_OK)
+        rc = chidb_Btree_initEmptyNode(bt, nroot, type == PGTYPE_TABLE_INTERNAL || type == PGTYPE_TABLE_LEAF
+                                                  ? PGTYPE_TABLE_LEAF : PGTYPE_INDEX_LEAF);
+    if (rc == CHIDB_OK)
+        rc = chidb_Btree_rangeFree(bt, rd.pages + 1, rd.npages - 1);
+
+    if (rc == CHIDB_OK && ndeleted != NULL)
+        *ndeleted = rd.ndeleted;
+    free(rd.pages);
+
+    return rc;
+}
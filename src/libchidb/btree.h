@@ -56,9 +56,74 @@
 #define PGHEADER_CELL_OFFSET (5)
 #define PGHEADER_ZERO_OFFSET (7)
 #define PGHEADER_RIGHTPG_OFFSET (8)
+#define PGHEADER_LEFTPG_OFFSET (12)  /* Linked table leaves only */
 
 #define LEAFPG_CELLSOFFSET_OFFSET (8)
 #define INTPG_CELLSOFFSET_OFFSET (12)
+#define LINKEDLEAFPG_CELLSOFFSET_OFFSET (16)
+
+/* In the page header, a cells offset of 65536 (an empty 64 KiB page) is stored as 0 */
+#define CELLS_OFFSET_DECODE(v) ((v) == 0 ? MAX_PAGE_SIZE : (uint32_t) (v))
+#define CELLS_OFFSET_ENCODE(o) ((uint16_t) ((o) == MAX_PAGE_SIZE ? 0 : (o)))
+
+/* File header */
+#define HEADER_PAGESIZE_OFFSET (16)
+
+/* Bytes reserved at the end of every page: PAGER_CHECKSUM_SIZE if the
+ * file has page checksums, 0 otherwise */
+#define HEADER_RESERVED_OFFSET (20)
+
+/* Optional features of the file format (BTREE_FEATURE_*), 0 if none.
+ * Features can only be chosen when the file is created. */
+#define HEADER_FEATURES_OFFSET (72)
+
+/* Table leaves are linked to their siblings: their header is extended
+ * with the page numbers of the next (PGHEADER_RIGHTPG_OFFSET) and
+ * previous (PGHEADER_LEFTPG_OFFSET) leaves in key order, 0 at the ends
+ * of the tree. Index trees are not affected. */
+#define BTREE_FEATURE_LINKEDLEAVES (0x01)
+
+/* Records that don't fit in a table leaf cell keep only a prefix in the
+ * cell, and the rest in a chain of overflow pages (see
+ * chidb_Btree_spillCell). All new files have this feature; in files
+ * without it, a record must fit in a page. */
+#define BTREE_FEATURE_OVERFLOW (0x02)
+
+/* Index cells are packed: leaf cells have no record header and store
+ * keyIdx and keyPk as variable-length integers (see putUvarint32), so
+ * small keys take as little as one byte each, and internal cells have
+ * no record header (see PACKEDIDX*CELL_*). Table trees are not affected. */
+#define BTREE_FEATURE_PACKEDINDEX (0x04)
+
+/* Table records are stored in record format v2 (see record.h), where
+ * any column can be found without decoding the ones before it. Index
+ * trees are not affected. */
+#define BTREE_FEATURE_RECORDV2 (0x08)
+
+/* Pages may be compressed in the file (see chidb_Pager_setCompression).
+ * Only builds of chidb with LZ4 can open such a file. */
+#define BTREE_FEATURE_COMPRESSED (0x10)
+
+/* Keys are normalized (see normkey.h), so that every node is searched
+ * with memcmp: table cells have 64-bit keys (NORMTABLE*CELL_*), and
+ * index cells have a variable-length key (NORMIDX*CELL_*), which can
+ * encode a text value. Incompatible with BTREE_FEATURE_PACKEDINDEX. */
+#define BTREE_FEATURE_NORMKEY (0x20)
+#define BTREE_FEATURES_KNOWN (BTREE_FEATURE_LINKEDLEAVES | BTREE_FEATURE_OVERFLOW | BTREE_FEATURE_PACKEDINDEX | \
+                              BTREE_FEATURE_RECORDV2 | BTREE_FEATURE_COMPRESSED | BTREE_FEATURE_NORMKEY)
+
+/* Record format (DBRECORD_FORMAT_*) of the table records of a file */
+#define BTREE_RECORD_FORMAT(bt) ((bt)->features & BTREE_FEATURE_RECORDV2 ? DBRECORD_FORMAT_V2 : DBRECORD_FORMAT_V1)
+
+/* chidb_Btree_open2 flags (in addition to the Pager flags): create the
+ * file with BTREE_FEATURE_LINKEDLEAVES, BTREE_FEATURE_PACKEDINDEX,
+ * BTREE_FEATURE_RECORDV2, BTREE_FEATURE_COMPRESSED or
+ * BTREE_FEATURE_NORMKEY */
+#define BTREE_LINKEDLEAVES (0x100)
+#define BTREE_PACKEDINDEX (0x200)
+#define BTREE_RECORDV2 (0x400)
+#define BTREE_COMPRESSED (0x800)
+#define BTREE_NORMKEY (0x1000)
 
 /* Cell offsets and sizes */
 
@@ -83,6 +148,85 @@
 #define INDEXINTCELL_SIZE (16)
 #define INDEXLEAFCELL_SIZE (12)
 
+/* Index cells in files with BTREE_FEATURE_PACKEDINDEX. A leaf cell is
+ * keyIdx followed by keyPk, each a variable-length integer of one to
+ * UVARINT32_MAXSIZE bytes. Internal cells keep a fixed size, so that a
+ * separator can be replaced in place. */
+#define PACKEDIDXINTCELL_CHILD_OFFSET (0)
+#define PACKEDIDXINTCELL_KEYIDX_OFFSET (4)
+#define PACKEDIDXINTCELL_KEYPK_OFFSET (8)
+
+#define PACKEDIDXINTCELL_SIZE (12)
+#define PACKEDIDXLEAFCELL_MAXSIZE (10)
+
+/* Cells in files with BTREE_FEATURE_NORMKEY. The key of a table cell
+ * is the rowid, in NORMKEY_ROWID_SIZE bytes. The key of an index cell
+ * is the normalized indexed value followed by keyPk (as a rowid), with
+ * its size (two bytes) before it, so that entries with the same value
+ * are ordered by keyPk. Index keys can take up to NORMIDX_MAXKEY
+ * bytes, so internal index nodes always have room to replace a
+ * separator with a longer one (see chidb_Btree_nodeFull). */
+#define NORMTABLEINTCELL_CHILD_OFFSET (0)
+#define NORMTABLEINTCELL_KEY_OFFSET (4)
+
+#define NORMTABLELEAFCELL_SIZE_OFFSET (0)
+#define NORMTABLELEAFCELL_KEY_OFFSET (4)
+#define NORMTABLELEAFCELL_DATA_OFFSET (12)
+
+#define NORMTABLEINTCELL_SIZE (12)
+#define NORMTABLELEAFCELL_SIZE_WITHOUTDATA (12)
+
+#define NORMIDXINTCELL_CHILD_OFFSET (0)
+#define NORMIDXINTCELL_KEYSIZE_OFFSET (4)
+#define NORMIDXINTCELL_KEY_OFFSET (6)
+
+#define NORMIDXLEAFCELL_KEYSIZE_OFFSET (0)
+#define NORMIDXLEAFCELL_KEY_OFFSET (2)
+
+#define NORMIDX_MAXKEY(usable) (((usable) - INTPG_CELLSOFFSET_OFFSET) / 8 - NORMIDXINTCELL_KEY_OFFSET - 2)
+
+/* Overflow pages (see chidb_Btree_spillCell). An overflow page holds the
+ * number of the next page in the chain (0 in the last one), followed by
+ * data. A record of size P keeps chidb_Btree_localSize bytes in its cell,
+ * which is P if P <= OVERFLOW_MAXLOCAL (so at least four cells fit in any
+ * leaf; OVERFLOW_MAXLOCAL_NORMKEY in files with BTREE_FEATURE_NORMKEY,
+ * whose cells have longer keys), followed by the number of its first
+ * overflow page. */
+#define OVERFLOW_NEXT_OFFSET (0)
+#define OVERFLOW_DATA_OFFSET (4)
+#define OVERFLOW_MAXLOCAL(usable) (((usable) - LINKEDLEAFPG_CELLSOFFSET_OFFSET) / 4 - TABLELEAFCELL_SIZE_WITHOUTDATA - 2 - 4)
+#define OVERFLOW_MAXLOCAL_NORMKEY(usable) (OVERFLOW_MAXLOCAL(usable) - \
+                                           (NORMTABLELEAFCELL_SIZE_WITHOUTDATA - TABLELEAFCELL_SIZE_WITHOUTDATA))
+#define OVERFLOW_MINLOCAL(usable) (((usable) - 12) * 32 / 255 - 23)
+
+/* Freelist (see chidb_Btree_freePage) */
+#define HEADER_FREELIST_TRUNK_OFFSET (32)
+#define HEADER_FREELIST_COUNT_OFFSET (36)
+
+/* Incremented every time the schema changes (see catalog.c) */
+#define HEADER_SCHEMA_COOKIE_OFFSET (40)
+
+/* First meta page of the Bloom filters of the file, 0 if none (see
+ * bloom.c) */
+#define HEADER_BLOOM_OFFSET (76)
+
+#define FREELIST_NEXT_OFFSET (0)
+#define FREELIST_NLEAVES_OFFSET (4)
+#define FREELIST_LEAVES_OFFSET (8)
+#define FREELIST_MAX_LEAVES(page_size) ((page_size) / 4 - 2)
+
+/* Morsels of the table that chidb_Btree_buildIndex splits the work
+ * into for each thread */
+#define BTREE_BUILD_MORSELS (4)
+
+/* Read-ahead (see chidb_Btree_prefetchChildren) */
+#define BTREE_PREFETCH_PAGES (8)   /* Children a scan should prefetch */
+#define BTREE_PREFETCH_MAX (64)    /* Most children prefetched at once */
+
+/* chidb_Btree_nodeSearch compares this many keys at once at the end of
+ * the binary search (must be 8, the width of its SIMD comparison) */
+#define NODESEARCH_WINDOW (8)
+
 // Advance declarations
 typedef struct BTreeCell BTreeCell;
 typedef struct BTreeNode BTreeNode;
@@ -94,37 +238,75 @@ typedef struct BTree
 {
     chidb *db;
     Pager *pager;
+    uint32_t features;  /* BTREE_FEATURE_* flags of the file */
+
+    /* Rightmost leaf of the B-Tree last inserted into, and its parent
+     * (see chidb_Btree_insertAppend). Protected by the pager's lock. */
+    npage_t append_root;    /* Root of that B-Tree (0 if nothing is cached) */
+    npage_t append_parent;  /* Parent of the leaf (0 if the leaf is the root) */
+    npage_t append_leaf;
+
+    struct chidb_zonemap *zonemaps;  /* Zone maps of the tables (see zonemap.c) */
 } Btree;
 
 /* The BTreeNode struct is an in-memory representation of a B-Tree node. Thus,
  * most of the values in this struct are simply a copy, for ease of access,
  * of what can be found in the raw disk page. When modifying type, free_offset,
- * n_cells, cells_offset, or right_page, do so in the corresponding field
+ * n_cells, cells_offset, right_page, or left_page, do so in the corresponding field
  * of the BTreeNode variable (the changes will be effective once the BTreeNode
  * is written to disk, using chidb_Btree_writeNode). Modifications of the
  * cell offset array or of the cells should be done directly on the in-memory
  * page returned by the Pager.
  *
  * See The chidb File Format document for more details on the meaning of each
- * field.
+ * field. Since pages can be up to 64 KiB, cells_offset can be 65536 in an
+ * empty node, which doesn't fit in the two bytes of the page header; it
+ * is stored as 0 instead (see CELLS_OFFSET_DECODE/ENCODE).
+ *
+ * In files with BTREE_FEATURE_LINKEDLEAVES, right_page and left_page of a
+ * table leaf are its next and previous leaves (see chidb_Btree_nextLeaf).
+ *
+ * latch is the latch the node holds on its page (BTREE_LATCH_*). It is
+ * BTREE_LATCH_NONE unless the node was loaded with
+ * chidb_Btree_getNodeLatched.
  */
 struct BTreeNode
 {
+    BTree *bt;                 /* B-Tree file the node belongs to */
     MemPage *page;             /* In-memory page returned by the Pager */
     uint8_t type;              /* Type of page  */
-    uint16_t free_offset;      /* Byte offset of free space in page */
+    uint32_t free_offset;      /* Byte offset of free space in page */
     ncell_t n_cells;           /* Number of cells */
-    uint16_t cells_offset;     /* Byte offset of start of cells in page */
-    npage_t right_page;        /* Right page (internal nodes only) */
+    uint32_t cells_offset;     /* Byte offset of start of cells in page (see CELLS_OFFSET_DECODE) */
+    npage_t right_page;        /* Right page (internal nodes), or next leaf (linked table leaves) */
+    npage_t left_page;         /* Previous leaf (linked table leaves only) */
     uint8_t *celloffset_array; /* Pointer to start of cell offset array in the in-memory page */
+    uint8_t latch;             /* Latch held on the page (see chidb_Btree_getNodeLatched) */
 };
 
+#define BTREE_LATCH_NONE (0)
+#define BTREE_LATCH_SHARED (1)
+#define BTREE_LATCH_EXCLUSIVE (2)
+
+/* Deepest B-Tree that chidb_Btree_insertLatched can latch a path of */
+#define BTREE_MAX_DEPTH (64)
+
+/* Number of times chidb_Btree_find2 restarts an optimistic lookup
+ * before falling back to latching the path (see chidb_Btree_findCell) */
+#define BTREE_OLC_RETRIES (8)
+
 /* BTreeCell is an in-memory representation of a cell. See The chidb File Format
  * document for more details on the meaning of each field */
 struct BTreeCell
 {
     uint8_t type;  /* Type of page where this cell is contained */
     chidb_key_t key;     /* Key */
+    /* Normalized key of an index cell in a file with
+     * BTREE_FEATURE_NORMKEY (NULL if it is to be encoded from key and
+     * keyPk, as integers). Like tableLeaf.data, it may point into an
+     * in-memory page (see chidb_Btree_getCell). */
+    const uint8_t *nkey;
+    uint16_t nkey_size;
     union
     {
         struct
@@ -133,8 +315,9 @@ struct BTreeCell
         } tableInternal;
         struct
         {
-            uint32_t data_size;  /* Number of bytes of data stored in this cell */
-            uint8_t *data;       /* Pointer to in-memory copy of data stored in this cell */
+            uint32_t data_size;  /* Number of bytes of data in the record */
+            uint8_t *data;       /* Pointer to the data in the in-memory page (see chidb_Btree_getCell) */
+            npage_t overflow_page; /* First overflow page (only if data_size > chidb_Btree_localSize) */
         } tableLeaf;
         struct
         {
@@ -149,26 +332,92 @@ struct BTreeCell
 };
 
 
+/* Source of entries for chidb_Btree_bulkLoad. Each call to next must
+ * either store the next entry in cell and return CHIDB_OK, or return
+ * CHIDB_EEMPTY if there are no more entries (any other value aborts the
+ * load). The data of a table leaf cell only needs to remain valid until
+ * the following call, but the nkey of an index cell (which may become
+ * a separator) must remain valid until the load ends. arg is for the
+ * iterator's own use. */
+typedef struct BTreeIterator
+{
+    int (*next)(struct BTreeIterator *it, BTreeCell *cell);
+    void *arg;
+} BTreeIterator;
+
+/* Fill factor used when there is no reason to choose another one */
+#define BTREE_DEFAULT_FILLFACTOR (90)
+
+/* After a delete, nodes less full than this (in percent) are merged with
+ * a sibling or take cells from it (see chidb_Btree_delete) */
+#define BTREE_MIN_FILLFACTOR (50)
+
+
 int chidb_Btree_open(const char *filename, chidb *db, BTree **bt);
+int chidb_Btree_open2(const char *filename, chidb *db, BTree **bt, uint32_t page_size, int flags);
 int chidb_Btree_close(BTree *bt);
+int chidb_Btree_openTemp(chidb *db, BTree **bt, uint32_t page_size, uint32_t npages);
+int chidb_Btree_begin(BTree *bt);
+int chidb_Btree_commit(BTree *bt);
+int chidb_Btree_rollback(BTree *bt);
 
 int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **node);
 int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn);
+int chidb_Btree_getNodeLatched(BTree *bt, npage_t npage, uint8_t latch, BTreeNode **btn);
+int chidb_Btree_releaseNode(BTree *bt, BTreeNode *btn);
+bool chidb_Btree_nodeFull(BTree *bt, BTreeNode *btn, BTreeCell *cell);
 
 int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type);
+int chidb_Btree_allocatePage(BTree *bt, npage_t *npage);
+int chidb_Btree_freePage(BTree *bt, npage_t npage);
+int chidb_Btree_incrVacuum(BTree *bt, npage_t nmax, npage_t *nremoved);
 int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type);
 int chidb_Btree_writeNode(BTree *bt, BTreeNode *node);
+uint32_t chidb_Btree_headerSize(BTree *bt, uint8_t type);
 
 int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
+int chidb_Btree_nodeSearch(BTreeNode *btn, chidb_key_t key, ncell_t *ncell);
+int chidb_Btree_nodeSearchKey(BTreeNode *btn, const uint8_t *nkey, uint16_t size, ncell_t *ncell);
+const uint8_t *chidb_Btree_indexKey(BTreeCell *cell, uint8_t *buf, uint16_t *size);
 int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
 
 int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size);
+int chidb_Btree_find2(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint32_t *size);
+int chidb_Btree_findCell(BTree *bt, npage_t nroot, chidb_key_t key, BTreeNode **btn, BTreeCell *cell);
+int chidb_Btree_findRef(BTree *bt, npage_t nroot, chidb_key_t key, BTreeNode **btn,
+                        uint8_t **data, uint16_t *size);
 
-int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size);
+int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint32_t size);
 int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk);
 int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc);
+int chidb_Btree_insertLatched(BTree *bt, npage_t nroot, BTreeCell *btc);
 int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc);
 int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_cell, npage_t *npage_child2);
 
+int chidb_Btree_delete(BTree *bt, npage_t nroot, chidb_key_t key);
+int chidb_Btree_deleteRange(BTree *bt, npage_t nroot, chidb_key_t lo, chidb_key_t hi, uint64_t *ndeleted);
+int chidb_Btree_truncate(BTree *bt, npage_t nroot, uint64_t *ndeleted);
+int chidb_Btree_linkLeaf(BTree *bt, BTreeNode *btn, BTreeNode *left);
+
+int chidb_Btree_nextLeaf(BTree *bt, BTreeNode *btn, BTreeNode **next);
+int chidb_Btree_prevLeaf(BTree *bt, BTreeNode *btn, BTreeNode **prev);
+int chidb_Btree_count(BTree *bt, npage_t npage, uint64_t *n);
+int chidb_Btree_morsels(BTree *bt, npage_t nroot, uint32_t n, npage_t **morsels, uint32_t *nmorsels);
+int chidb_Btree_firstKey(BTree *bt, npage_t nroot, chidb_key_t *key);
+int chidb_Btree_lastKey(BTree *bt, npage_t nroot, chidb_key_t *key);
+
+uint32_t chidb_Btree_cellSize(BTree *bt, BTreeCell *cell);
+uint32_t chidb_Btree_localSize(BTree *bt, uint32_t size);
+int chidb_Btree_spillCell(BTree *bt, BTreeCell *cell);
+int chidb_Btree_readPayload(BTree *bt, BTreeCell *cell, uint32_t offset, uint32_t len, uint8_t *buf);
+int chidb_Btree_freeOverflow(BTree *bt, npage_t npage);
+
+int chidb_Btree_prefetchChildren(BTree *bt, BTreeNode *btn, ncell_t ncell, ncell_t n);
+
+int chidb_Btree_bulkLoad(BTree *bt, npage_t nroot, BTreeIterator *it, uint8_t fill_factor);
+int chidb_Btree_buildIndex(BTree *bt, npage_t table_root, npage_t index_root, uint8_t column, uint32_t nthreads);
+int chidb_Btree_buildCoveringIndex(BTree *bt, npage_t table_root, npage_t index_root, uint8_t column,
+                                   const uint8_t *include, uint8_t ninclude, uint32_t nthreads);
+
 
 #endif /*BTREE_H_*/
@@ -0,0 +1,503 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * In-memory schema catalog
+ *
+ * The schema of a database is the table B-Tree in page 1, with a row
+ * for each table and index: its type, its name, the table it belongs
+ * to, its root page, and the CREATE statement that created it. Finding
+ * a table there means scanning that B-Tree, and parsing the statement
+ * to know its columns, so the catalog does it once, when the database
+ * is opened: it keeps every table, with its root page, its columns and
+ * their types, and its indexes, in a hash table keyed by name, in the
+ * chidb struct.
+ *
+ * Bytes 40-43 of the file header (HEADER_SCHEMA_COOKIE_OFFSET) hold the
+ * schema cookie, which CreateTable and CreateIndex increment (see
+ * chidb_catalog_changed). The catalog remembers the cookie it was
+ * loaded at, and chidb_catalog_table loads it again if the cookie in
+ * the header is a different one, which is also how it finds out about
+ * schema changes that were rolled back, or made by other connections.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <chidb/log.h>
+#include "catalog.h"
+#include "btree.h"
+#include "record.h"
+#include "util.h"
+#include "dbm-cache.h"
+#include "dbm-result.h"
+#include "dbm-cursor.h"
+
+
+/* Create an empty catalog
+ *
+ * Parameters
+ * - catalog: Out parameter. Returns the new catalog.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_catalog_init(chidb_catalog_t **catalog)
+{
+    *catalog = calloc(1, sizeof(chidb_catalog_t));
+    if (*catalog == NULL)
+        return CHIDB_ENOMEM;
+
+    return CHIDB_OK;
+}
+
+
+static void chidb_catalog_freeTable(chidb_catalog_table_t *t)
+{
+    chidb_catalog_index_t *idx, *next;
+
+    for (idx = t->indexes; idx != NULL; idx = next)
+    {
+        next = idx->next;
+        free(idx->name);
+        free(idx->column);
+        free(idx);
+    }
+    for (uint32_t i = 0; i < t->ncols; i++)
+        free(t->cols[i].name);
+    free(t->cols);
+    free(t->name);
+    free(t);
+}
+
+
+/* Removes every table from the catalog */
+static void chidb_catalog_clear(chidb_catalog_t *catalog)
+{
+    for (uint32_t i = 0; i < CATALOG_BUCKETS; i++)
+    {
+        chidb_catalog_table_t *t, *next;
+
+        for (t = catalog->buckets[i]; t != NULL; t = next)
+        {
+            next = t->hnext;
+            chidb_catalog_freeTable(t);
+        }
+        catalog->buckets[i] = NULL;
+    }
+    catalog->ntables = 0;
+    catalog->loaded = false;
+}
+
+
+/* Free a catalog, and all the tables in it
+ *
+ * Parameters
+ * - catalog: Catalog to free (may be NULL)
+ */
+void chidb_catalog_free(chidb_catalog_t *catalog)
+{
+    if (catalog == NULL)
+        return;
+
+    chidb_catalog_clear(catalog);
+    free(catalog);
+}
+
+
+/* Names are case-insensitive (FNV-1a of the lowercase name) */
+static uint32_t chidb_catalog_hash(const char *name)
+{
+    uint32_t h = 2166136261u;
+
+    for (; *name != '\0'; name++)
+    {
+        h ^= (uint8_t) tolower((unsigned char) *name);
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+
+static chidb_catalog_table_t *chidb_catalog_find(chidb_catalog_t *catalog, const char *name)
+{
+    chidb_catalog_table_t *t;
+
+    for (t = catalog->buckets[chidb_catalog_hash(name) % CATALOG_BUCKETS]; t != NULL; t = t->hnext)
+        if (strcasecmp(t->name, name) == 0)
+            return t;
+
+    return NULL;
+}
+
+
+/* Reads the schema cookie from the file header */
+static int chidb_catalog_readCookie(chidb *db, uint32_t *cookie)
+{
+    MemPage *page;
+    int rc;
+
+    rc = chidb_Pager_readPage(db->bt->pager, 1, &page);
+    if (rc != CHIDB_OK)
+        return rc;
+    *cookie = get4byte(page->data + HEADER_SCHEMA_COOKIE_OFFSET);
+    chidb_Pager_releaseMemPage(db->bt->pager, page);
+
+    return CHIDB_OK;
+}
+
+
+/* Returns an integer field of a schema row */
+static int chidb_catalog_getInt(DBRecordView *view, uint8_t field, int32_t *v)
+{
+    int8_t v8;
+    int16_t v16;
+
+    switch (chidb_DBRecordView_getType(view, field))
+    {
+    case SQL_INTEGER_1BYTE:
+        chidb_DBRecordView_getInt8(view, field, &v8);
+        *v = v8;
+        return CHIDB_OK;
+    case SQL_INTEGER_2BYTE:
+        chidb_DBRecordView_getInt16(view, field, &v16);
+        *v = v16;
+        return CHIDB_OK;
+    case SQL_INTEGER_4BYTE:
+        return chidb_DBRecordView_getInt32(view, field, v);
+    default:
+        return CHIDB_ECORRUPT;
+    }
+}
+
+
+/* Adds a table to the catalog, from its CREATE TABLE statement */
+static int chidb_catalog_addTable(chidb_catalog_t *catalog, Table_t *table, npage_t nroot)
+{
+    chidb_catalog_table_t *t;
+    Column_t *col;
+    uint32_t h, i;
+
+    t = calloc(1, sizeof(chidb_catalog_table_t));
+    if (t == NULL)
+        return CHIDB_ENOMEM;
+
+    for (col = table->columns; col != NULL; col = col->next)
+        t->ncols++;
+    t->nroot = nroot;
+    t->columnar = table->storage == STORAGE_COLUMNAR;
+    t->name = strdup(table->name);
+    t->cols = calloc(t->ncols ? t->ncols : 1, sizeof(chidb_catalog_column_t));
+    if (t->name == NULL || t->cols == NULL)
+    {
+        t->ncols = 0;
+        chidb_catalog_freeTable(t);
+        return CHIDB_ENOMEM;
+    }
+
+    for (col = table->columns, i = 0; col != NULL; col = col->next, i++)
+    {
+        t->cols[i].type = col->type;
+        for (Constraint_t *cons = col->constraints; cons != NULL; cons = cons->next)
+            t->cols[i].pkey |= cons->t == CONS_PRIMARY_KEY;
+        if ((t->cols[i].name = strdup(col->name)) == NULL)
+        {
+            chidb_catalog_freeTable(t);
+            return CHIDB_ENOMEM;
+        }
+    }
+
+    h = chidb_catalog_hash(t->name) % CATALOG_BUCKETS;
+    t->hnext = catalog->buckets[h];
+    catalog->buckets[h] = t;
+    catalog->ntables++;
+
+    return CHIDB_OK;
+}
+
+
+/* Adds an index to its table in the catalog, from its CREATE INDEX
+ * statement. Indexes are created after their table, so their row comes
+ * after the table's in the schema. */
+static int chidb_catalog_addIndex(chidb_catalog_t *catalog, Index_t *index, npage_t nroot)
+{
+    chidb_catalog_table_t *t = chidb_catalog_find(catalog, index->table_name);
+    chidb_catalog_index_t *idx;
+
+    if (t == NULL)
+    {
+        chilog(WARNING, "Index %s is on table %s, which is not in the schema", index->name, index->table_name);
+        return CHIDB_OK;
+    }
+
+    idx = calloc(1, sizeof(chidb_catalog_index_t));
+    if (idx == NULL)
+        return CHIDB_ENOMEM;
+    idx->nroot = nroot;
+    idx->unique = index->unique;
+    idx->covering = index->include != NULL;
+    idx->hash = index->method == INDEX_HASH;
+    idx->name = strdup(index->name);
+    idx->column = strdup(index->column_name);
+    if (idx->name == NULL || idx->column == NULL)
+    {
+        free(idx->name);
+        free(idx->column);
+        free(idx);
+        return CHIDB_ENOMEM;
+    }
+
+    idx->next = t->indexes;
+    t->indexes = idx;
+
+    return CHIDB_OK;
+}
+
+
+/* Adds the table or index of a row of the schema to the catalog */
+static int chidb_catalog_addRow(chidb_catalog_t *catalog, DBRecordView *view)
+{
+    chisql_statement_t *sql_stmt;
+    const char *sql;
+    char *text;
+    int32_t nroot;
+    int len, rc;
+
+    if (chidb_catalog_getInt(view, CATALOG_FIELD_ROOT, &nroot) != CHIDB_OK ||
+        chidb_DBRecordView_getString(view, CATALOG_FIELD_SQL, &sql, &len) != CHIDB_OK)
+        return CHIDB_ECORRUPT;
+
+    if ((text = strndup(sql, len)) == NULL)
+        return CHIDB_ENOMEM;
+    rc = chisql_parser(text, &sql_stmt);
+    free(text);
+    if (rc != CHIDB_OK || sql_stmt->type != STMT_CREATE)
+    {
+        if (rc == CHIDB_OK)
+            chisql_stmt_free(sql_stmt);
+        return CHIDB_ECORRUPT;
+    }
+
+    if (sql_stmt->stmt.create->t == CREATE_TABLE)
+        rc = chidb_catalog_addTable(catalog, sql_stmt->stmt.create->table, nroot);
+    else
+        rc = chidb_catalog_addIndex(catalog, sql_stmt->stmt.create->index, nroot);
+    chisql_stmt_free(sql_stmt);
+
+    return rc;
+}
+
+
+/* Load the catalog from the schema
+ *
+ * Scans the schema table, and replaces the tables in the catalog of
+ * the database with the ones in it.
+ *
+ * Parameters
+ * - db: Database
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: A row of the schema is not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_catalog_load(chidb *db)
+{
+    chidb_catalog_t *catalog = db->catalog;
+    chidb_dbm_cursor_t c;
+    DBRecordView view;
+    uint8_t *data;
+    int rc;
+
+    chidb_catalog_clear(catalog);
+
+    rc = chidb_catalog_readCookie(db, &catalog->cookie);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    rc = chidb_dbm_cursor_open(&c, CURSOR_READ, db->bt, 1);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    for (rc = chidb_dbm_cursor_rewind(&c); rc == CHIDB_OK; rc = chidb_dbm_cursor_next(&c))
+    {
+        BTreeCell *cell = &c.cell;
+
+        data = NULL;
+        if (cell->fields.tableLeaf.overflow_page != 0)
+        {
+            data = malloc(cell->fields.tableLeaf.data_size);
+            if (data == NULL)
+            {
+                rc = CHIDB_ENOMEM;
+                break;
+            }
+            rc = chidb_Btree_readPayload(db->bt, cell, 0, cell->fields.tableLeaf.data_size, data);
+            if (rc != CHIDB_OK)
+            {
+                free(data);
+                break;
+            }
+        }
+
+        if (BTREE_RECORD_FORMAT(db->bt) == DBRECORD_FORMAT_V2)
+            rc = chidb_DBRecordView_initV2(&view, data != NULL ? data : cell->fields.tableLeaf.data);
+        else
+            rc = chidb_DBRecordView_init(&view, data != NULL ? data : cell->fields.tableLeaf.data);
+        if (rc == CHIDB_OK)
+            rc = chidb_catalog_addRow(catalog, &view);
+        free(data);
+        if (rc != CHIDB_OK)
+            break;
+    }
+    chidb_dbm_cursor_close(&c);
+
+    if (rc != CHIDB_DONE)
+    {
+        chidb_catalog_clear(catalog);
+        return rc;
+    }
+
+    catalog->loaded = true;
+    chilog(TRACE, "Loaded %i tables from the schema", catalog->ntables);
+
+    return CHIDB_OK;
+}
+
+
+/* Look up a table in the catalog
+ *
+ * The catalog is loaded again first if the schema changed since it was
+ * loaded (see chidb_catalog_changed).
+ *
+ * Parameters
+ * - db: Database
+ * - name: Name of the table (case-insensitive)
+ *
+ * Return
+ * - The table, or NULL if there is no such table (or the schema
+ *   couldn't be read)
+ */
+chidb_catalog_table_t *chidb_catalog_table(chidb *db, const char *name)
+{
+    uint32_t cookie;
+
+    if (chidb_catalog_readCookie(db, &cookie) != CHIDB_OK)
+        return NULL;
+    if ((!db->catalog->loaded || cookie != db->catalog->cookie) && chidb_catalog_load(db) != CHIDB_OK)
+        return NULL;
+
+    return chidb_catalog_find(db->catalog, name);
+}
+
+
+/* Returns the position of a column in a table, or -1 if it has no such
+ * column */
+int chidb_catalog_column(chidb_catalog_table_t *table, const char *column)
+{
+    for (uint32_t i = 0; i < table->ncols; i++)
+        if (strcasecmp(table->cols[i].name, column) == 0)
+            return i;
+
+    return -1;
+}
+
+
+/* Returns the B-Tree index on a column of a table, or NULL if it has
+ * none. A plain index is preferred to a covering one. Hash indexes are
+ * not returned, since they can't be read in order (see
+ * chidb_catalog_hashIndex). */
+chidb_catalog_index_t *chidb_catalog_index(chidb_catalog_table_t *table, const char *column)
+{
+    chidb_catalog_index_t *idx, *found = NULL;
+
+    for (idx = table->indexes; idx != NULL; idx = idx->next)
+        if (!idx->hash && strcasecmp(idx->column, column) == 0 && (found == NULL || found->covering))
+            found = idx;
+
+    return found;
+}
+
+
+/* Returns the hash index on a column of a table, or NULL if it has
+ * none */
+chidb_catalog_index_t *chidb_catalog_hashIndex(chidb_catalog_table_t *table, const char *column)
+{
+    chidb_catalog_index_t *idx;
+
+    for (idx = table->indexes; idx != NULL; idx = idx->next)
+        if (idx->hash && strcasecmp(idx->column, column) == 0)
+            return idx;
+
+    return NULL;
+}
+
+
+/* Record a change to the schema
+ *
+ * Increments the schema cookie in the file header, so that every
+ * catalog of the database (this connection's, and those of others) is
+ * loaded again before it is used, and empties the program cache, whose
+ * programs were generated for the old schema, and the result cache.
+ *
+ * Parameters
+ * - db: Database
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_catalog_changed(chidb *db)
+{
+    MemPage *page;
+    int rc;
+
+    chidb_dbm_cache_invalidate(db->stmt_cache);
+    chidb_dbm_result_invalidate(db->result_cache);
+
+    rc = chidb_Pager_readPage(db->bt->pager, 1, &page);
+    if (rc != CHIDB_OK)
+        return rc;
+    put4byte(page->data + HEADER_SCHEMA_COOKIE_OFFSET,
+             get4byte(page->data + HEADER_SCHEMA_COOKIE_OFFSET) + 1);
+    rc = chidb_Pager_writePage(db->bt->pager, page);
+    chidb_Pager_releaseMemPage(db->bt->pager, page);
+
+    return rc;
+}
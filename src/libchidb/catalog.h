@@ -0,0 +1,105 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  In-memory schema catalog -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef CATALOG_H_
+#define CATALOG_H_
+
+#include "chidbInt.h"
+#include <chisql/chisql.h>
+
+/* Buckets of the catalog's hash table */
+#define CATALOG_BUCKETS (64)
+
+/* Fields of a row of the schema table (page 1) */
+#define CATALOG_FIELD_TYPE (0)       /* "table" or "index" */
+#define CATALOG_FIELD_NAME (1)
+#define CATALOG_FIELD_TABLE (2)      /* Table the row (or its index) belongs to */
+#define CATALOG_FIELD_ROOT (3)
+#define CATALOG_FIELD_SQL (4)
+
+typedef struct chidb_catalog_column
+{
+    char *name;
+    enum data_type type;
+    bool pkey;          /* PRIMARY KEY: the key of the table B-Tree */
+} chidb_catalog_column_t;
+
+typedef struct chidb_catalog_index
+{
+    char *name;
+    char *column;           /* Indexed column */
+    npage_t nroot;
+    bool unique;
+    bool covering;          /* Has an INCLUDE list (a table B-Tree) */
+    bool hash;              /* USING hash (see hashindex.c), not a B-Tree */
+    struct chidb_catalog_index *next;
+} chidb_catalog_index_t;
+
+typedef struct chidb_catalog_table
+{
+    char *name;
+    npage_t nroot;
+    uint32_t ncols;
+    chidb_catalog_column_t *cols;
+    chidb_catalog_index_t *indexes;
+    bool columnar;                       /* WITH (storage = columnar), see columnar.c */
+    struct chidb_catalog_table *hnext;   /* Next in the same bucket */
+} chidb_catalog_table_t;
+
+/* The tables of the schema, by name, as of schema cookie cookie (see
+ * catalog.c) */
+typedef struct chidb_catalog
+{
+    chidb_catalog_table_t *buckets[CATALOG_BUCKETS];
+    uint32_t ntables;
+    uint32_t cookie;
+    bool loaded;
+} chidb_catalog_t;
+
+int chidb_catalog_init(chidb_catalog_t **catalog);
+void chidb_catalog_free(chidb_catalog_t *catalog);
+int chidb_catalog_load(chidb *db);
+chidb_catalog_table_t *chidb_catalog_table(chidb *db, const char *name);
+int chidb_catalog_column(chidb_catalog_table_t *table, const char *column);
+chidb_catalog_index_t *chidb_catalog_index(chidb_catalog_table_t *table, const char *column);
+chidb_catalog_index_t *chidb_catalog_hashIndex(chidb_catalog_table_t *table, const char *column);
+int chidb_catalog_changed(chidb *db);
+
+#endif /*CATALOG_H_*/
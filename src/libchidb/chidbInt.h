@@ -63,16 +63,53 @@
 
 
 #define DEFAULT_PAGE_SIZE (1024)
+#define MIN_PAGE_SIZE (512)
+#define MAX_PAGE_SIZE (65536)
+
+/* The page size is stored in two bytes of the file header, so (like in
+ * SQLite) a page size of 65536 is stored as 1 */
+#define PAGE_SIZE_DECODE(v) ((v) == 1 ? MAX_PAGE_SIZE : (uint32_t) (v))
+#define PAGE_SIZE_ENCODE(s) ((s) == MAX_PAGE_SIZE ? 1 : (uint16_t) (s))
+#define PAGE_SIZE_VALID(s) ((s) >= MIN_PAGE_SIZE && (s) <= MAX_PAGE_SIZE && ((s) & ((s) - 1)) == 0)
+#define DEFAULT_CACHE_SIZE (128)
+
+/* Memory that the scratch space of a statement may take (see
+ * chidb_set_temp_budget) */
+#define DEFAULT_TEMP_BUDGET (16 * 1024 * 1024)
+
+/* Threads that a parallel scan runs on (see chidb_set_threads): 0 is
+ * one per online processor */
+#define DEFAULT_THREADS (0)
 
 #define MAX_STR_LEN (256)
 
 typedef uint16_t ncell_t;
 typedef uint32_t npage_t;
-typedef uint32_t chidb_key_t;
 
-/* Forward declaration */
+/* Keys of B-Tree entries (rowids, and indexed integer values). Files
+ * without BTREE_FEATURE_NORMKEY store only their low 32 bits. */
+typedef uint64_t chidb_key_t;
+#define CHIDB_KEY_MAX UINT64_MAX
+
+/* Forward declarations */
 typedef struct BTree BTree;
+struct chidb_dbm_cache;
+struct chidb_table_stats;
+
+
+/* Where a database reports its events (see chidb_set_trace). Its
+ * pager has one, which the pager's log points to. The mask is empty
+ * unless a callback is set, so that tracing costs a branch that is
+ * not taken (see CHIDB_TRACING) */
+typedef struct chidb_tracer
+{
+    uint32_t mask;
+    chidb_trace_callback callback;
+    chidb *db;
+    chidb_stmt *stmt;       /* Statement being stepped, if any */
+} chidb_tracer;
 
+#define CHIDB_TRACING(t, type) __builtin_expect(((t)->mask & (type)) != 0, 0)
 
   /* code */
 
@@ -84,6 +121,25 @@ typedef struct BTree BTree;
 struct chidb
 {
     BTree   *bt;
+
+    /* Programs generated by chidb_prepare (see dbm-cache.c) */
+    struct chidb_dbm_cache *stmt_cache;
+
+    /* Rows returned by read-only statements (see dbm-result.c) */
+    struct chidb_dbm_result *result_cache;
+
+    /* Statistics collected by ANALYZE (see stats.c) */
+    struct chidb_table_stats *table_stats;
+
+    /* Tables and indexes of the schema (see catalog.c) */
+    struct chidb_catalog *catalog;
+
+    /* Temporary memory budget of each statement (see
+     * chidb_stmt_temp_budget) */
+    size_t temp_budget;
+
+    /* Threads of a parallel scan (see chidb_dbm_parallel_scan) */
+    uint32_t nthreads;
 };
 
 #endif /*CHIDBINT_H_*/
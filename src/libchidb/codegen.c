@@ -41,9 +41,171 @@
 #include <chisql/chisql.h>
 #include "dbm.h"
 #include "util.h"
+#include "plan.h"
 
   /* ...code... */
 
+/* '?' placeholders are literals of type TYPE_PARAM, numbered from 0 in
+ * the order they appear in the statement: load the value bound to them
+ * with Variable (Variable n r loads the n-th one into register r).
+ *
+ * When every column a query on an indexed column needs is the indexed
+ * column, the primary key, or a column in the INCLUDE list of a
+ * covering index (Index_t.include), answer it from the index alone: emit
+ * Column on the index cursor (column 0 is the primary key, the included
+ * columns follow), instead of IdxPKey and a Seek on the table.
+ *
+ * The rows of a multi-row INSERT (Insert_t.rows) are inserted in primary
+ * key order, sorting them here when their keys are literals, so that
+ * Insert, and IdxInsert on each index (in key order too), add runs of
+ * consecutive keys to the same leaf through its cursor. Open the
+ * cursors once, before the first row.
+ *
+ * A DELETE without a WHERE clause (Delete_t.where is NULL) runs Clear
+ * on a cursor of the table, opened with OpenWrite, and on one of each of
+ * its B-Tree indexes, which frees their pages without reading a single
+ * row. A DELETE whose WHERE clause only bounds the primary key (with
+ * constants and '?' placeholders, as a seek range does) on a table with
+ * no index runs DeleteRange instead, with the bounds in two consecutive
+ * registers (NULL for a missing one, the value plus one for a strict
+ * lower bound, minus one for a strict upper one). Either one stores the
+ * number of rows deleted in its p2. Other DELETEs, and those on a table
+ * with a hash index (which can't be cleared), delete the rows one at a
+ * time (see chidb_Btree_delete).
+ *
+ * Conditions are checked conjunct by conjunct, in the order they come
+ * in their AND chain (chidb_exprc_compile has put the cheapest and most
+ * selective first), leaving the loop body at the first one that fails.
+ * Constants are already folded (see exprc.c). Compile each comparison
+ * to the instruction that chidb_exprc_cmpOp returns for it: EqInt to
+ * GeInt when both sides are integers, Eq to Ge otherwise. An IN list
+ * loads its values into consecutive registers and runs SetOpen once,
+ * before the loop, and InSet in the loop, which leaves it when the value
+ * of the expression is not in the set.
+ *
+ * A selection right above a table with a seek range (SRA_Select_t.seek
+ * and seek_end, chosen by the optimizer) reads the table through the
+ * index on the column they compare, instead of scanning it and checking
+ * every row: SeekGe (SeekGt for a strict bound, Rewind without one) on
+ * the index cursor to the start of the range, IdxGt (IdxGe for a strict
+ * bound) to leave the loop past its end, and IdxPKey and a Seek on the
+ * table for each entry.
+ * The rest of the condition is still evaluated on every row.
+ *
+ * A selection with a hash lookup (SRA_Select_t.hash, also chosen by
+ * the optimizer) loads the root page of the hash index, from the
+ * catalog (chidb_catalog_hashIndex), and the value the equality
+ * compares the column to into consecutive registers, and runs
+ * HashIdxSeek on the table cursor instead of a Rewind: it jumps past
+ * the loop when no row has the value, and the loop body runs once,
+ * without a Next. An INSERT into a table with a hash index runs
+ * HashIdxInsert for it, which needs no cursor, where a B-Tree index
+ * gets IdxInsert. CREATE INDEX ... USING hash runs CreateIndex with p2
+ * set.
+ *
+ * A selection with IN probes (SRA_Select_t.probe) makes the set of the
+ * list with SetOpen too, and loops over its members, in order, with
+ * SetNext instead of a Rewind and Next: for each one, a Seek on the
+ * table if the column is the primary key (the body runs once, or not
+ * at all if there is no such row), or a SeekGe on the index on the
+ * column, with IdxGt to go back to SetNext past the entries with that
+ * value, and IdxPKey and a Seek on the table for each entry. The rest
+ * of the condition (the IN included) is still evaluated on every row.
+ *
+ * A scan of a table with a zone map conjunct (SRA_Select_t.zone) puts
+ * its value in a register and runs ZoneFilter on the table cursor, with
+ * the column and the comparison (with the column on the left), before
+ * the Rewind, so that Next skips the subtrees that can't have a row
+ * that passes it. The whole condition is still evaluated on every row.
+ *
+ * Joins compile according to the method the optimizer chose for them
+ * (SRA_Join_t.method), with the equality they are keyed on in
+ * SRA_Join_t.key:
+ * - JOIN_HASH is a hash join (see HashOpen in dbm-ops.c), instead of a
+ *   nested loop that rewinds the inner input for every outer row: build
+ *   the hash table from sra2, which the optimizer makes the input with
+ *   fewer estimated rows, and probe it with sra1. Right after the
+ *   column of the key of a row of sra1 is read, run HashFilter on it,
+ *   to skip the row before anything else is read from it or checked on
+ *   it when the Bloom filter of the build keys rules it out.
+ * - JOIN_INDEX is an index join (see SorterOpen in dbm-ops.c): sra2 is
+ *   a table (or a selection on one) with an index on its column of the
+ *   key. Batch the rows of sra1 into a sorter, keyed by their column of
+ *   the key, and for each of them in sorted order, SeekGe the index to
+ *   the key, and IdxGt to leave the loop past it, with IdxPKey and a Seek
+ *   on the table for each entry. Run BloomFilter on the index cursor
+ *   before the SeekGe, to skip the keys that the Bloom filter of the
+ *   index (if any, see chidb_bloom) rules out, which is what an
+ *   anti-join or an EXISTS check mostly looks up.
+ * - JOIN_NESTED_LOOP rewinds sra2 for every row of sra1.
+ * A semi-join (SRA_Join_t.semi) is a hash join whose key is a x IN
+ * (SELECT ...) conjunct instead: open the hash table with "semi", build
+ * it from the only column of the rows of sra2, the subquery, and probe
+ * it with x for each row of sra1, which is produced once if HashProbe
+ * finds a match: there is no HashNext loop. The rows of sra1 that
+ * HashDeferred joins later are read back from the hash table with
+ * HashColumn, after the single value of the build row, and HashNext
+ * moves on to the next of them.
+ *
+ * ORDER BY loads each result row, with the ORDER BY expression in front,
+ * into a sorter (see SorterOpen in dbm-ops.c, with "desc" in p4 for
+ * ORDER BY ... DESC), and produces the rows from it once they have all
+ * been inserted. When the optimizer found that the rows already come in
+ * that order (SRA_Project_t.sorted), skip the sorter, and read the index
+ * on the ORDER BY column forward for ASC, or backward for DESC (SeekLe
+ * or SeekLt to the end of the seek range, or Last without one, then Prev,
+ * and IdxLt or IdxLe past its start).
+ *
+ * LIMIT and OFFSET (SRA_Project_t.limit and offset) are loaded into
+ * registers, with Integer or Variable, before the loop that produces the
+ * rows: skip the first OFFSET rows with IfPos, and leave the loop with
+ * DecrJumpZero after the LIMIT-th ResultRow (or before the first one,
+ * if LIMIT is 0). When rows are read in order from the index, that ends
+ * the query after LIMIT + OFFSET rows instead of reading the rest of the
+ * table. Otherwise, SorterLimit keeps only those rows in the sorter.
+ *
+ * GROUP BY and the aggregate functions (TERM_FUNC terms) go through an
+ * aggregator (see AggOpen in dbm-ops.c): AggStep each row, with the
+ * GROUP BY columns (none without a GROUP BY) followed by the argument of
+ * each function, and produce one row per group after AggFinal, reading
+ * the functions' results with AggColumn. The argument of COUNT(*) is an
+ * Integer. When the optimizer found that the rows come ordered by the
+ * GROUP BY column (SRA_Project_t.grouped), open the aggregator with -1
+ * in p3, and produce each group where AggStep jumps when it is done.
+ * A lone aggregate of a whole table that the optimizer found can be
+ * answered from its B-Trees (SRA_Project_t.shortcut) doesn't read its
+ * records: SHORTCUT_COUNT is a Count on a cursor of the table, and
+ * SHORTCUT_MIN (SHORTCUT_MAX) a MinKey (MaxKey) on the table if the
+ * column is its primary key, or on the index on the column if there is
+ * one. Otherwise, aggregate a scan as usual.
+ *
+ * DISTINCT, UNION, INTERSECT and EXCEPT also go through an aggregator,
+ * keyed by every column of the rows (see the AGGREGATES section of
+ * dbm-ops.c), with a "sides" function for INTERSECT and EXCEPT, whose
+ * AggColumn decides whether a group is produced. A DISTINCT with
+ * SRA_Project_t.grouped set uses a streaming aggregator. A set operation
+ * whose method (SRA_Binary_t.method, chosen by the optimizer) is
+ * SET_MERGE reads the indexes of both inputs at once, and steps the
+ * smaller of their current values into a streaming aggregator, while
+ * SET_HASH steps all the rows of sra1, and then those of sra2.
+ *
+ * An aggregate whose scan the optimizer made parallel
+ * (SRA_Project_t.parallel) opens its aggregator first, and puts the
+ * loop over the table (Rewind, the checks of the WHERE clause, AggStep,
+ * Next) right after a Parallel on the table, which jumps past the loop
+ * once every thread has run it (see the PARALLEL SCANS section of
+ * dbm-ops.c).
+ *
+ * ANALYZE (STMT_ANALYZE) compiles to a single Analyze with the name of
+ * the table in p4, and BEGIN, COMMIT and ROLLBACK (STMT_BEGIN,
+ * STMT_COMMIT and STMT_ROLLBACK) to a single AutoCommit.
+ *
+ * For EXPLAIN ANALYZE (see plan.c), once the instructions of each
+ * operator of the tree are generated, chidb_plan_mark them with it (a
+ * selection right above a table with the selection), and
+ * chidb_plan_row the instruction that each of its rows goes through:
+ * the Next of a scan, or the instruction right after a join has found
+ * a match. Both do nothing for other statements. */
 int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 {
     int opnum = 0;
@@ -83,3 +245,55 @@ int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 
 }
 
+
+/* Fuses common sequences of instructions into superinstructions
+ *
+ * Runs over the program generated by chidb_stmt_codegen, and replaces
+ * the first instruction of each of these sequences with the
+ * superinstruction that runs the whole sequence in one dispatch:
+ *
+ *  - Column, Column, Eq/Ne/Lt/Le/Gt/Ge (or EqInt...GeInt) -> ColumnCmpJump
+ *  - SeekGe, IdxPKey -> SeekGeIdxPKey
+ *  - Integer, ResultRow -> IntegerResultRow
+ *
+ * The rest of the sequence is left in place (the superinstruction reads
+ * it from there, and jumps into the middle of the sequence still work),
+ * so the program keeps its length and its jump addresses. An instruction
+ * is only ever part of one sequence. EXPLAIN shows the fused program.
+ *
+ * Parameters
+ * - stmt: Statement with a generated program
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_stmt_peephole(chidb_stmt *stmt)
+{
+    chidb_dbm_op_t *ops = stmt->ops;
+
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        uint32_t left = stmt->endOp - i;
+
+        /* Eq to Ge, and EqInt to GeInt, are consecutive opcodes */
+        if (left >= 3 && ops[i].opcode == Op_Column && ops[i + 1].opcode == Op_Column &&
+            ((ops[i + 2].opcode >= Op_Eq && ops[i + 2].opcode <= Op_Ge) ||
+             (ops[i + 2].opcode >= Op_EqInt && ops[i + 2].opcode <= Op_GeInt)))
+        {
+            ops[i].opcode = Op_ColumnCmpJump;
+            i += 2;
+        }
+        else if (left >= 2 && ops[i].opcode == Op_SeekGe && ops[i + 1].opcode == Op_IdxPKey)
+        {
+            ops[i].opcode = Op_SeekGeIdxPKey;
+            i += 1;
+        }
+        else if (left >= 2 && ops[i].opcode == Op_Integer && ops[i + 1].opcode == Op_ResultRow)
+        {
+            ops[i].opcode = Op_IntegerResultRow;
+            i += 1;
+        }
+    }
+
+    return CHIDB_OK;
+}
@@ -0,0 +1,682 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Columnar tables
+ *
+ * A table created WITH (storage = columnar) keeps its rows by column
+ * instead of by row, for analytic scans that read a few columns of
+ * many rows. Its rows are grouped into segments of up to
+ * COLUMNAR_SEGMENT_ROWS rows (one batch, see dbm-batch.c), and the
+ * values of each column in a segment are encoded into a chunk. The
+ * chunks are the records of the table's B-Tree, with key
+ * COLUMNAR_KEY(segment, column), so the chunk of a column is one cell
+ * and the run of overflow pages that follows it, and a scan that reads
+ * two columns of a table only reads the pages of those two columns.
+ *
+ * Only integer columns can be stored in columnar tables (as with batch
+ * scans), and the first column is the primary key, as in any other
+ * table. Each chunk starts with a header (COLUMNAR_HEADER_SIZE bytes),
+ * followed by a bitmap of the NULLs of the chunk, if it has any, and
+ * then the values, with whichever of these encodings is smallest:
+ *
+ * - COLUMNAR_PLAIN: Each value in 4 bytes.
+ * - COLUMNAR_RLE: Runs of equal values, as the value (4 bytes) and the
+ *   length of the run (2 bytes).
+ * - COLUMNAR_DICT: The distinct values (at most COLUMNAR_DICT_MAX),
+ *   sorted, in 4 bytes each, and then the position of each value in
+ *   them, bit-packed in as few bits as the largest position needs.
+ * - COLUMNAR_FOR (frame of reference): The difference between each
+ *   value and the minimum of the chunk, bit-packed in as few bits as
+ *   the largest difference needs.
+ *
+ * The values of NULLs are not stored, and take the value of the row
+ * before them, so they don't break runs or widen differences. The
+ * header also has the minimum and maximum of the values of the chunk:
+ * a zone map, with which a scan can skip the segments where none of
+ * the values can match a filter by reading only the first bytes of a
+ * cell (see chidb_dbm_scan_prune).
+ *
+ * Columnar tables are append-only: rows are added at the end of the
+ * last segment with chidb_columnar_append (or chidb_import_table),
+ * and read with chidb_dbm_scan_initColumnar. A segment that is not
+ * full when the rows are written is not filled any further, so
+ * appending a few rows at a time makes small segments.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "columnar.h"
+#include "util.h"
+
+/* Largest chunk: header, NULL bitmap and plain values */
+#define COLUMNAR_CHUNK_MAX (COLUMNAR_HEADER_SIZE + COLUMNAR_SEGMENT_ROWS / 8 + 4 * COLUMNAR_SEGMENT_ROWS)
+
+
+/* Bits needed to store v */
+static inline uint8_t chidb_columnar_bits(uint32_t v)
+{
+    return v ? 32 - __builtin_clz(v) : 0;
+}
+
+/* Size of n values of width bits, bit-packed */
+static inline uint32_t chidb_columnar_packedSize(uint32_t n, uint8_t width)
+{
+    return (n * width + 7) / 8;
+}
+
+/* Bit-packs n values of width bits at p, lowest bits first, and returns
+ * the first byte after them */
+static uint8_t *chidb_columnar_pack(uint8_t *p, const uint32_t *v, uint32_t n, uint8_t width)
+{
+    uint64_t acc = 0;
+    unsigned int nbits = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        acc |= (uint64_t) v[i] << nbits;
+        for (nbits += width; nbits >= 8; nbits -= 8, acc >>= 8)
+            *p++ = (uint8_t) acc;
+    }
+    if (nbits > 0)
+        *p++ = (uint8_t) acc;
+
+    return p;
+}
+
+/* Unpacks n values of width bits bit-packed at p */
+static void chidb_columnar_unpack(const uint8_t *p, uint32_t *v, uint32_t n, uint8_t width)
+{
+    uint64_t mask = ((uint64_t) 1 << width) - 1;
+    uint64_t acc = 0;
+    unsigned int nbits = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        for (; nbits < width; nbits += 8)
+            acc |= (uint64_t) *p++ << nbits;
+        v[i] = (uint32_t) (acc & mask);
+        acc >>= width;
+        nbits -= width;
+    }
+}
+
+static int chidb_columnar_cmp(const void *a, const void *b)
+{
+    int32_t x = *(const int32_t *) a, y = *(const int32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Position of v in a sorted dictionary that has it */
+static uint32_t chidb_columnar_dictFind(const int32_t *dict, uint32_t nd, int32_t v)
+{
+    uint32_t lo = 0, hi = nd - 1;
+
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+
+        if (dict[mid] < v)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+/* Encodes the values of a column in a segment into a chunk
+ *
+ * Parameters
+ * - values: Values of the rows (ignored where NULL)
+ * - nulls: Whether each row is NULL
+ * - n: Rows (at most COLUMNAR_SEGMENT_ROWS)
+ * - buf: Chunk (COLUMNAR_CHUNK_MAX bytes)
+ *
+ * Return
+ * - Size of the chunk
+ */
+static uint32_t chidb_columnar_encode(const int32_t *values, const uint8_t *nulls, uint32_t n, uint8_t *buf)
+{
+    int32_t vals[COLUMNAR_SEGMENT_ROWS], dict[COLUMNAR_SEGMENT_ROWS];
+    uint32_t codes[COLUMNAR_SEGMENT_ROWS];
+    int32_t min = INT32_MAX, max = INT32_MIN, prev;
+    uint32_t nnulls = 0, nruns = 0, nd = 0;
+    uint32_t size, best;
+    uint8_t encoding, width = 0, dwidth = 0;
+    uint8_t *p;
+
+    for (uint32_t i = 0; i < n; i++)
+        if (nulls[i])
+            nnulls++;
+        else
+        {
+            min = values[i] < min ? values[i] : min;
+            max = values[i] > max ? values[i] : max;
+        }
+    if (nnulls == n)
+        min = max = 0;
+
+    /* NULLs repeat the value before them */
+    prev = min;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        vals[i] = nulls[i] ? prev : values[i];
+        nruns += i == 0 || vals[i] != prev;
+        prev = vals[i];
+    }
+
+    /* Smallest encoding */
+    encoding = COLUMNAR_PLAIN;
+    best = 4 * n;
+    if (nruns * 6 < best)
+    {
+        encoding = COLUMNAR_RLE;
+        best = nruns * 6;
+    }
+
+    memcpy(dict, vals, n * sizeof(int32_t));
+    qsort(dict, n, sizeof(int32_t), chidb_columnar_cmp);
+    for (uint32_t i = 0; i < n; i++)
+        if (i == 0 || dict[i] != dict[nd - 1])
+            dict[nd++] = dict[i];
+    if (nd <= COLUMNAR_DICT_MAX)
+    {
+        dwidth = chidb_columnar_bits(nd - 1);
+        size = nd * 4 + chidb_columnar_packedSize(n, dwidth);
+        if (size < best)
+        {
+            encoding = COLUMNAR_DICT;
+            best = size;
+        }
+    }
+
+    size = chidb_columnar_packedSize(n, chidb_columnar_bits((uint32_t) max - (uint32_t) min));
+    if (size < best)
+        encoding = COLUMNAR_FOR;
+
+    /* Header and NULL bitmap */
+    memset(buf, 0, COLUMNAR_HEADER_SIZE);
+    buf[0] = encoding;
+    put2byte(buf + 2, n);
+    put4byte(buf + 4, (uint32_t) min);
+    put4byte(buf + 8, (uint32_t) max);
+    put2byte(buf + 12, nnulls);
+    p = buf + COLUMNAR_HEADER_SIZE;
+    if (nnulls > 0)
+    {
+        memset(p, 0, (n + 7) / 8);
+        for (uint32_t i = 0; i < n; i++)
+            p[i / 8] |= nulls[i] << (i % 8);
+        p += (n + 7) / 8;
+    }
+
+    switch (encoding)
+    {
+    case COLUMNAR_PLAIN:
+        for (uint32_t i = 0; i < n; i++, p += 4)
+            put4byte(p, (uint32_t) vals[i]);
+        break;
+    case COLUMNAR_RLE:
+        put2byte(buf + 14, nruns);
+        for (uint32_t i = 0, len; i < n; i += len, p += 6)
+        {
+            for (len = 1; i + len < n && vals[i + len] == vals[i]; len++);
+            put4byte(p, (uint32_t) vals[i]);
+            put2byte(p + 4, len);
+        }
+        break;
+    case COLUMNAR_DICT:
+        width = dwidth;
+        put2byte(buf + 14, nd);
+        for (uint32_t i = 0; i < nd; i++, p += 4)
+            put4byte(p, (uint32_t) dict[i]);
+        for (uint32_t i = 0; i < n; i++)
+            codes[i] = chidb_columnar_dictFind(dict, nd, vals[i]);
+        p = chidb_columnar_pack(p, codes, n, width);
+        break;
+    case COLUMNAR_FOR:
+        width = chidb_columnar_bits((uint32_t) max - (uint32_t) min);
+        for (uint32_t i = 0; i < n; i++)
+            codes[i] = (uint32_t) vals[i] - (uint32_t) min;
+        p = chidb_columnar_pack(p, codes, n, width);
+        break;
+    }
+    buf[1] = width;
+
+    return p - buf;
+}
+
+
+/* Reads the header of a chunk */
+static void chidb_columnar_header(const uint8_t *buf, chidb_columnar_zone_t *zone)
+{
+    zone->encoding = buf[0];
+    zone->nrows = get2byte(buf + 2);
+    zone->min = (int32_t) get4byte(buf + 4);
+    zone->max = (int32_t) get4byte(buf + 8);
+    zone->nnulls = get2byte(buf + 12);
+}
+
+
+/* Decodes a chunk into a vector
+ *
+ * Parameters
+ * - buf: Chunk
+ * - size: Size of the chunk
+ * - v: Vector where the values of the rows are stored (0 if NULL)
+ * - nrows: Out parameter. Rows of the chunk.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The chunk is not well formed
+ */
+static int chidb_columnar_decode(const uint8_t *buf, uint32_t size, chidb_dbm_vector_t *v, uint32_t *nrows)
+{
+    chidb_columnar_zone_t zone;
+    uint32_t codes[COLUMNAR_SEGMENT_ROWS];
+    int32_t dict[COLUMNAR_DICT_MAX];
+    const uint8_t *p = buf + COLUMNAR_HEADER_SIZE, *end = buf + size;
+    uint8_t width;
+    uint32_t n, nd, r;
+
+    if (size < COLUMNAR_HEADER_SIZE)
+        return CHIDB_ECORRUPT;
+    chidb_columnar_header(buf, &zone);
+    width = buf[1];
+    n = zone.nrows;
+    if (n > COLUMNAR_SEGMENT_ROWS || zone.nnulls > n || width > 32)
+        return CHIDB_ECORRUPT;
+
+    memset(v->nulls, 0, n);
+    if (zone.nnulls > 0)
+    {
+        if (end - p < (n + 7) / 8)
+            return CHIDB_ECORRUPT;
+        for (uint32_t i = 0; i < n; i++)
+            v->nulls[i] = (p[i / 8] >> (i % 8)) & 1;
+        p += (n + 7) / 8;
+    }
+
+    switch (zone.encoding)
+    {
+    case COLUMNAR_PLAIN:
+        if (end - p < 4 * n)
+            return CHIDB_ECORRUPT;
+        for (uint32_t i = 0; i < n; i++, p += 4)
+            v->values[i] = (int32_t) get4byte(p);
+        break;
+    case COLUMNAR_RLE:
+        nd = get2byte(buf + 14);
+        if (end - p < 6 * nd)
+            return CHIDB_ECORRUPT;
+        r = 0;
+        for (uint32_t i = 0; i < nd; i++, p += 6)
+        {
+            int32_t value = (int32_t) get4byte(p);
+            uint32_t len = get2byte(p + 4);
+
+            if (len > n - r)
+                return CHIDB_ECORRUPT;
+            for (uint32_t j = 0; j < len; j++)
+                v->values[r++] = value;
+        }
+        if (r != n)
+            return CHIDB_ECORRUPT;
+        break;
+    case COLUMNAR_DICT:
+        nd = get2byte(buf + 14);
+        if (nd == 0 || nd > COLUMNAR_DICT_MAX || end - p < 4 * nd + chidb_columnar_packedSize(n, width))
+            return CHIDB_ECORRUPT;
+        for (uint32_t i = 0; i < nd; i++, p += 4)
+            dict[i] = (int32_t) get4byte(p);
+        chidb_columnar_unpack(p, codes, n, width);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (codes[i] >= nd)
+                return CHIDB_ECORRUPT;
+            v->values[i] = dict[codes[i]];
+        }
+        break;
+    case COLUMNAR_FOR:
+        if (end - p < chidb_columnar_packedSize(n, width))
+            return CHIDB_ECORRUPT;
+        chidb_columnar_unpack(p, codes, n, width);
+        for (uint32_t i = 0; i < n; i++)
+            v->values[i] = (int32_t) ((uint32_t) zone.min + codes[i]);
+        break;
+    default:
+        return CHIDB_ECORRUPT;
+    }
+
+    if (zone.nnulls > 0)
+        for (uint32_t i = 0; i < n; i++)
+            v->values[i] &= -(int32_t) !v->nulls[i];
+
+    *nrows = n;
+
+    return CHIDB_OK;
+}
+
+
+/* Encodes the rows buffered in a writer into a segment */
+static int chidb_columnar_flush(chidb_columnar_writer_t *w)
+{
+    int rc;
+
+    for (uint32_t c = 0; c < w->ncols; c++)
+    {
+        uint32_t size = chidb_columnar_encode(w->values + c * COLUMNAR_SEGMENT_ROWS,
+                                              w->nulls + c * COLUMNAR_SEGMENT_ROWS, w->n, w->buf);
+
+        rc = chidb_Btree_insertInTable(w->bt, w->nroot, COLUMNAR_KEY(w->nsegment, c), w->buf, size);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    w->nsegment++;
+    w->n = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Start appending rows to a columnar table
+ *
+ * The rows are added to a new segment, after the last one of the
+ * table. The file must support overflow pages (BTREE_FEATURE_OVERFLOW),
+ * since chunks are usually larger than a page.
+ *
+ * Parameters
+ * - w: Writer to initialize
+ * - bt: B-Tree file
+ * - nroot: Root page of the table
+ * - ncols: Columns of the table
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Too many (or no) columns, or the file doesn't
+ *                  support overflow pages
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_columnar_writer_init(chidb_columnar_writer_t *w, BTree *bt, npage_t nroot, uint32_t ncols)
+{
+    int rc;
+
+    memset(w, 0, sizeof(chidb_columnar_writer_t));
+    if (ncols == 0 || ncols > COLUMNAR_MAXCOLS || !(bt->features & BTREE_FEATURE_OVERFLOW))
+        return CHIDB_EMISUSE;
+    if ((rc = chidb_columnar_segments(bt, nroot, &w->nsegment)) != CHIDB_OK)
+        return rc;
+
+    w->bt = bt;
+    w->nroot = nroot;
+    w->ncols = ncols;
+    w->values = malloc(ncols * COLUMNAR_SEGMENT_ROWS * sizeof(int32_t));
+    w->nulls = malloc(ncols * COLUMNAR_SEGMENT_ROWS);
+    w->buf = malloc(COLUMNAR_CHUNK_MAX);
+    if (w->values == NULL || w->nulls == NULL || w->buf == NULL)
+    {
+        chidb_columnar_writer_finish(w);
+        return CHIDB_ENOMEM;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Append a row to a columnar table
+ *
+ * The row is buffered, and the segment is written when it is full.
+ *
+ * Parameters
+ * - w: Writer
+ * - values: Value of each column (ignored where NULL)
+ * - nulls: Whether each column is NULL
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The table has no room for more segments
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_columnar_append(chidb_columnar_writer_t *w, const int32_t *values, const bool *nulls)
+{
+    if (w->nsegment > UINT32_MAX >> 8)
+        return CHIDB_EMISUSE;
+
+    for (uint32_t c = 0; c < w->ncols; c++)
+    {
+        w->values[c * COLUMNAR_SEGMENT_ROWS + w->n] = nulls[c] ? 0 : values[c];
+        w->nulls[c * COLUMNAR_SEGMENT_ROWS + w->n] = nulls[c];
+    }
+
+    return ++w->n == COLUMNAR_SEGMENT_ROWS ? chidb_columnar_flush(w) : CHIDB_OK;
+}
+
+
+/* Finish appending rows to a columnar table
+ *
+ * Writes the rows that are still buffered, as a last segment that is
+ * not full, and frees the writer.
+ *
+ * Parameters
+ * - w: Writer
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_columnar_writer_finish(chidb_columnar_writer_t *w)
+{
+    int rc = CHIDB_OK;
+
+    if (w->n > 0)
+        rc = chidb_columnar_flush(w);
+
+    free(w->values);
+    free(w->nulls);
+    free(w->buf);
+    w->values = NULL;
+    w->nulls = NULL;
+    w->buf = NULL;
+
+    return rc;
+}
+
+
+/* Count the segments of a columnar table
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root page of the table
+ * - nsegments: Out parameter. Number of segments.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_columnar_segments(BTree *bt, npage_t nroot, uint32_t *nsegments)
+{
+    chidb_key_t last;
+    int rc;
+
+    rc = chidb_Btree_lastKey(bt, nroot, &last);
+    if (rc == CHIDB_ENOTFOUND)
+    {
+        *nsegments = 0;
+        return CHIDB_OK;
+    }
+    if (rc == CHIDB_OK)
+        *nsegments = (last >> 8) + 1;
+
+    return rc;
+}
+
+
+/* Read the zone map of a column in a segment
+ *
+ * Only the header of the chunk is read, which is always in its cell,
+ * so none of the chunk's overflow pages are.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root page of the table
+ * - segment: Segment
+ * - col: Column
+ * - zone: Out parameter. Zone map.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The segment or the column doesn't exist
+ * - CHIDB_ECORRUPT: The chunk is not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_columnar_zone(BTree *bt, npage_t nroot, uint32_t segment, uint8_t col, chidb_columnar_zone_t *zone)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    uint8_t header[COLUMNAR_HEADER_SIZE];
+    int rc;
+
+    if ((rc = chidb_Btree_findCell(bt, nroot, COLUMNAR_KEY(segment, col), &btn, &cell)) != CHIDB_OK)
+        return rc;
+    if (cell.fields.tableLeaf.data_size < COLUMNAR_HEADER_SIZE)
+        rc = CHIDB_ECORRUPT;
+    else
+        rc = chidb_Btree_readPayload(bt, &cell, 0, COLUMNAR_HEADER_SIZE, header);
+    chidb_Btree_releaseNode(bt, btn);
+
+    if (rc == CHIDB_OK)
+        chidb_columnar_header(header, zone);
+
+    return rc;
+}
+
+
+/* Whether any of the values of a zone map can compare as given with k
+ *
+ * NULLs never compare true, so a chunk with only NULLs never matches.
+ *
+ * Parameters
+ * - zone: Zone map
+ * - cmp: Comparison (Op_Eq, Op_Ne, Op_Lt, Op_Le, Op_Gt or Op_Ge)
+ * - k: Value to compare with
+ *
+ * Return
+ * - false if no value of the chunk can match, true otherwise
+ */
+bool chidb_columnar_zoneMatch(const chidb_columnar_zone_t *zone, opcode_t cmp, int32_t k)
+{
+    if (zone->nnulls == zone->nrows)
+        return false;
+
+    switch (cmp)
+    {
+    case Op_Eq:
+        return zone->min <= k && k <= zone->max;
+    case Op_Ne:
+        return zone->min != k || zone->max != k;
+    case Op_Lt:
+        return zone->min < k;
+    case Op_Le:
+        return zone->min <= k;
+    case Op_Gt:
+        return zone->max > k;
+    case Op_Ge:
+        return zone->max >= k;
+    default:
+        return true;
+    }
+}
+
+
+/* Read the values of a column in a segment into a vector
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root page of the table
+ * - segment: Segment
+ * - col: Column
+ * - v: Vector where the values are stored
+ * - nrows: Out parameter. Rows of the segment.
+ * - buf, bufsize: Buffer for the chunk, grown as needed (freed by the
+ *                 caller)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The segment or the column doesn't exist
+ * - CHIDB_ECORRUPT: The chunk is not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_columnar_read(BTree *bt, npage_t nroot, uint32_t segment, uint8_t col,
+                        chidb_dbm_vector_t *v, uint32_t *nrows, uint8_t **buf, uint32_t *bufsize)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    uint32_t size;
+    int rc;
+
+    if ((rc = chidb_Btree_findCell(bt, nroot, COLUMNAR_KEY(segment, col), &btn, &cell)) != CHIDB_OK)
+        return rc;
+
+    size = cell.fields.tableLeaf.data_size;
+    if (*bufsize < size)
+    {
+        uint8_t *b = realloc(*buf, size);
+        if (b == NULL)
+        {
+            chidb_Btree_releaseNode(bt, btn);
+            return CHIDB_ENOMEM;
+        }
+        *buf = b;
+        *bufsize = size;
+    }
+    rc = chidb_Btree_readPayload(bt, &cell, 0, size, *buf);
+    chidb_Btree_releaseNode(bt, btn);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    return chidb_columnar_decode(*buf, size, v, nrows);
+}
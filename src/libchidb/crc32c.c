@@ -0,0 +1,343 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module computes CRC32C (Castagnoli) checksums, which the pager
+ * uses to detect corrupted pages.
+ *
+ * On x86-64 with SSE4.2 and on ARMv8 with the CRC extension, the
+ * checksum is computed with the CRC32C instructions. These have a
+ * latency of about three cycles but a throughput of one per cycle, so
+ * a single dependency chain would only use a third of the hardware.
+ * Instead, long buffers are split into three blocks whose CRCs are
+ * computed in parallel, and then combined by "shifting" the CRC of the
+ * first blocks over the length of the following ones (multiplying by
+ * x^(8 * length) modulo the CRC polynomial, done with lookup tables
+ * computed at startup). Which implementation to use is decided at run
+ * time, so the same binary works on CPUs without the instructions.
+ *
+ * The software fallback processes eight bytes at a time using eight
+ * lookup tables ("slicing-by-8").
+ *
+ * The combination technique follows Mark Adler's crc32c.c.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HW_X86
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRC32C_HW_ARM
+#endif
+
+/* CRC32C polynomial, bit-reversed */
+#define CRC32C_POLY (0x82f63b78)
+
+/* Block sizes for the three-way interleaved hardware CRC */
+#define CRC32C_LONG (8192)
+#define CRC32C_SHORT (256)
+
+static uint32_t crc32c_table[8][256];
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+
+static uint32_t (*crc32c_impl)(uint32_t crc, const uint8_t *data, size_t len);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+
+/* Multiplies a 32x32 GF(2) matrix by a vector */
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+
+    while (vec)
+    {
+        if (vec & 1)
+            sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat)
+{
+    for (int n = 0; n < 32; n++)
+        square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/* Computes the operator that applies len zero bytes to a CRC (len must
+ * be a power of two) */
+static void crc32c_zeros_op(uint32_t *even, size_t len)
+{
+    uint32_t odd[32];
+    uint32_t row = 1;
+
+    /* Operator for one zero bit */
+    odd[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n++)
+    {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    /* Two and four zero bits */
+    gf2_matrix_square(even, odd);
+    gf2_matrix_square(odd, even);
+
+    /* Keep squaring: first one zero byte, then two, four, ... */
+    do
+    {
+        gf2_matrix_square(even, odd);
+        len >>= 1;
+        if (len == 0)
+            return;
+        gf2_matrix_square(odd, even);
+        len >>= 1;
+    } while (len);
+
+    memcpy(even, odd, sizeof(odd));
+}
+
+/* Builds the tables to shift a CRC over len zero bytes, one byte at a time */
+static void crc32c_zeros(uint32_t zeros[][256], size_t len)
+{
+    uint32_t op[32];
+
+    crc32c_zeros_op(op, len);
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        zeros[0][n] = gf2_matrix_times(op, n);
+        zeros[1][n] = gf2_matrix_times(op, n << 8);
+        zeros[2][n] = gf2_matrix_times(op, n << 16);
+        zeros[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+static inline uint32_t crc32c_shift(uint32_t zeros[][256], uint32_t crc)
+{
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+           zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+static inline uint64_t crc32c_load64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *data, size_t len)
+{
+    crc = ~crc;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len >= 8)
+    {
+        uint64_t word = crc ^ crc32c_load64(data);
+
+        crc = crc32c_table[7][word & 0xff] ^
+              crc32c_table[6][(word >> 8) & 0xff] ^
+              crc32c_table[5][(word >> 16) & 0xff] ^
+              crc32c_table[4][(word >> 24) & 0xff] ^
+              crc32c_table[3][(word >> 32) & 0xff] ^
+              crc32c_table[2][(word >> 40) & 0xff] ^
+              crc32c_table[1][(word >> 48) & 0xff] ^
+              crc32c_table[0][word >> 56];
+        data += 8;
+        len -= 8;
+    }
+#endif
+
+    while (len--)
+        crc = crc32c_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+
+#if defined(CRC32C_HW_X86)
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#define CRC32C_U8(crc, v) _mm_crc32_u8((crc), (v))
+#define CRC32C_U64(crc, v) ((uint32_t) _mm_crc32_u64((crc), (v)))
+#elif defined(CRC32C_HW_ARM)
+#define CRC32C_TARGET __attribute__((target("+crc")))
+#define CRC32C_U8(crc, v) __crc32cb((crc), (v))
+#define CRC32C_U64(crc, v) __crc32cd((crc), (v))
+#endif
+
+#ifdef CRC32C_TARGET
+CRC32C_TARGET
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *data, size_t len)
+{
+    uint32_t crc0 = ~crc, crc1, crc2;
+    const uint8_t *end;
+
+    /* Align to eight bytes */
+    while (len && ((uintptr_t) data & 7))
+    {
+        crc0 = CRC32C_U8(crc0, *data++);
+        len--;
+    }
+
+    /* Three blocks of CRC32C_LONG bytes in parallel */
+    while (len >= 3 * CRC32C_LONG)
+    {
+        crc1 = 0;
+        crc2 = 0;
+        end = data + CRC32C_LONG;
+        do
+        {
+            crc0 = CRC32C_U64(crc0, crc32c_load64(data));
+            crc1 = CRC32C_U64(crc1, crc32c_load64(data + CRC32C_LONG));
+            crc2 = CRC32C_U64(crc2, crc32c_load64(data + 2 * CRC32C_LONG));
+            data += 8;
+        } while (data < end);
+        crc0 = crc32c_shift(crc32c_long, crc0) ^ crc1;
+        crc0 = crc32c_shift(crc32c_long, crc0) ^ crc2;
+        data += 2 * CRC32C_LONG;
+        len -= 3 * CRC32C_LONG;
+    }
+
+    /* Same thing with CRC32C_SHORT blocks (a 4 KiB page is mostly
+     * processed here) */
+    while (len >= 3 * CRC32C_SHORT)
+    {
+        crc1 = 0;
+        crc2 = 0;
+        end = data + CRC32C_SHORT;
+        do
+        {
+            crc0 = CRC32C_U64(crc0, crc32c_load64(data));
+            crc1 = CRC32C_U64(crc1, crc32c_load64(data + CRC32C_SHORT));
+            crc2 = CRC32C_U64(crc2, crc32c_load64(data + 2 * CRC32C_SHORT));
+            data += 8;
+        } while (data < end);
+        crc0 = crc32c_shift(crc32c_short, crc0) ^ crc1;
+        crc0 = crc32c_shift(crc32c_short, crc0) ^ crc2;
+        data += 2 * CRC32C_SHORT;
+        len -= 3 * CRC32C_SHORT;
+    }
+
+    /* The rest, eight bytes at a time and then one byte at a time */
+    while (len >= 8)
+    {
+        crc0 = CRC32C_U64(crc0, crc32c_load64(data));
+        data += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc0 = CRC32C_U8(crc0, *data++);
+
+    return ~crc0;
+}
+#endif
+
+
+static bool crc32c_hw_available(void)
+{
+#if defined(CRC32C_HW_X86)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+#elif defined(CRC32C_HW_ARM)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return false;
+#endif
+}
+
+
+static void crc32c_init(void)
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+
+        for (int k = 0; k < 8; k++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc32c_table[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = crc32c_table[0][n];
+
+        for (int k = 1; k < 8; k++)
+        {
+            crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+            crc32c_table[k][n] = crc;
+        }
+    }
+
+    crc32c_impl = crc32c_sw;
+
+#ifdef CRC32C_TARGET
+    if (crc32c_hw_available())
+    {
+        crc32c_zeros(crc32c_long, CRC32C_LONG);
+        crc32c_zeros(crc32c_short, CRC32C_SHORT);
+        crc32c_impl = crc32c_hw;
+    }
+#endif
+}
+
+
+/* Compute a CRC32C checksum
+ *
+ * Parameters
+ * - crc: CRC of the preceding data (0 for the first call), so that a
+ *        checksum can be computed incrementally
+ * - data: Data to checksum
+ * - len: Number of bytes in data
+ *
+ * Return
+ * - The CRC32C of the data
+ */
+uint32_t chidb_crc32c(uint32_t crc, const void *data, size_t len)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+
+    return crc32c_impl(crc, data, len);
+}
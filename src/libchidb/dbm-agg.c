@@ -0,0 +1,945 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine aggregates
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "dbm-agg.h"
+#include "dbm.h"
+
+/* A group in the buffer of an aggregator, followed by the state of each
+ * function and by its key (keylen bytes, padded to a multiple of 8).
+ * Groups are referred to by their offset in the buffer + 1, so that 0
+ * means no group. */
+typedef struct chidb_dbm_agg_group
+{
+    uint32_t hash;
+    uint32_t keylen;
+} chidb_dbm_agg_group_t;
+
+#define AGG_GROUP(a, ref) ((chidb_dbm_agg_group_t *) ((a)->buf + (ref) - 1))
+#define AGG_STATES(g) ((chidb_dbm_agg_state_t *) ((g) + 1))
+#define AGG_KEY(a, g) ((uint8_t *) (AGG_STATES(g) + (a)->naggs))
+#define AGG_ALIGN(len) (((len) + 7) & ~7u)
+#define AGG_GROUP_SIZE(a, keylen) \
+    (sizeof(chidb_dbm_agg_group_t) + (a)->naggs * sizeof(chidb_dbm_agg_state_t) + AGG_ALIGN(keylen))
+
+/* Partition of a group, from the top bits of its hash (the bottom ones
+ * pick its slot) */
+#define AGG_PARTITION(hash) ((hash) / (UINT32_MAX / DBM_AGG_NPARTITIONS + 1))
+
+#define AGG_MIN_SLOTS (16)
+
+/* Rows, and the states of groups that are written to partitions, are
+ * both kept in a->row as a record: the length of the key and the key,
+ * followed by the count and the sum of each function, as int64_t's, and
+ * by its value (a NULL if it has none), serialized:
+ *
+ *   keylen | key | count sum value | count sum value | ...
+ */
+#define AGG_RECORD_KEY(rec) ((rec) + sizeof(uint32_t))
+
+
+/*** Keys and values ***/
+
+static uint32_t agg_hash(const uint8_t *key, uint32_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        hash ^= key[i];
+        hash *= 16777619u;
+    }
+
+    /* The top bits pick the partition (see dbm-hash.c) */
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+static uint32_t agg_keylen(const uint8_t *rec)
+{
+    uint32_t keylen;
+
+    memcpy(&keylen, rec, sizeof(keylen));
+    return keylen;
+}
+
+/* Compares two serialized values: NULLs go before integers, integers
+ * before strings, and strings before binaries */
+static int agg_cmp(const uint8_t *v1, const uint8_t *v2)
+{
+    uint32_t len1, len2;
+    int32_t i1, i2;
+    int c;
+
+    if (v1[0] != v2[0])
+        return v1[0] < v2[0] ? -1 : 1;
+
+    switch (v1[0])
+    {
+    case REG_INT32:
+        memcpy(&i1, v1 + 1, sizeof(i1));
+        memcpy(&i2, v2 + 1, sizeof(i2));
+        return (i1 > i2) - (i1 < i2);
+    case REG_STRING:
+    case REG_BINARY:
+        memcpy(&len1, v1 + 1, sizeof(len1));
+        memcpy(&len2, v2 + 1, sizeof(len2));
+        c = memcmp(v1 + 1 + sizeof(len1), v2 + 1 + sizeof(len2), len1 < len2 ? len1 : len2);
+        return c != 0 ? c : (len1 > len2) - (len1 < len2);
+    default:
+        return 0;
+    }
+}
+
+/* Makes room for len bytes in a->row */
+static int agg_reserve(chidb_dbm_agg_t *a, uint32_t len)
+{
+    uint8_t *row;
+
+    if (len <= a->rowsize)
+        return CHIDB_OK;
+    if ((row = realloc(a->row, len)) == NULL)
+        return CHIDB_ENOMEM;
+    a->row = row;
+    a->rowsize = len;
+
+    return CHIDB_OK;
+}
+
+/* Builds the record of a row in a->row: the group key and the state of
+ * a group with just that row */
+static int agg_rowRecord(chidb_dbm_agg_t *a, chidb_dbm_register_t *regs)
+{
+    chidb_dbm_register_t *args = regs + a->nkeys;
+    uint32_t keylen = chidb_dbm_reg_serialize(regs, a->nkeys, NULL), len, off;
+    uint8_t null = REG_NULL;
+    int rc;
+
+    len = sizeof(uint32_t) + keylen;
+    for (uint32_t i = 0; i < a->naggs; i++)
+    {
+        len += 2 * sizeof(int64_t);
+        if (a->funcs[i] == AGG_MIN || a->funcs[i] == AGG_MAX)
+            len += chidb_dbm_reg_serialize(&args[i], 1, NULL);
+        else
+            len += 1;
+    }
+    if ((rc = agg_reserve(a, len)) != CHIDB_OK)
+        return rc;
+
+    memcpy(a->row, &keylen, sizeof(keylen));
+    chidb_dbm_reg_serialize(regs, a->nkeys, AGG_RECORD_KEY(a->row));
+    off = sizeof(uint32_t) + keylen;
+    for (uint32_t i = 0; i < a->naggs; i++)
+    {
+        chidb_dbm_register_t *r = &args[i];
+        bool isnull = r->type != REG_INT32 && r->type != REG_STRING && r->type != REG_BINARY;
+        int64_t count = isnull ? 0 : 1, sum = 0;
+
+        if (!isnull && (a->funcs[i] == AGG_SUM || a->funcs[i] == AGG_AVG || a->funcs[i] == AGG_SIDES))
+        {
+            if (r->type != REG_INT32)
+                return CHIDB_EMISMATCH;
+            sum = r->value.i;
+        }
+
+        memcpy(a->row + off, &count, sizeof(count));
+        memcpy(a->row + off + sizeof(count), &sum, sizeof(sum));
+        off += 2 * sizeof(int64_t);
+        if (a->funcs[i] == AGG_MIN || a->funcs[i] == AGG_MAX)
+            off += chidb_dbm_reg_serialize(r, 1, a->row + off);
+        else
+            a->row[off++] = null;
+    }
+    a->rowlen = len;
+
+    return CHIDB_OK;
+}
+
+/* Builds the record of a group in a->row. Its values are in vals (which
+ * may be the buffer the group's values were in before a spill). */
+static int agg_groupRecord(chidb_dbm_agg_t *a, chidb_dbm_agg_group_t *g, const uint8_t *vals)
+{
+    chidb_dbm_agg_state_t *states = AGG_STATES(g);
+    uint32_t len = sizeof(uint32_t) + g->keylen, off;
+    int rc;
+
+    for (uint32_t i = 0; i < a->naggs; i++)
+        len += 2 * sizeof(int64_t) + (states[i].value ? chidb_dbm_reg_serialsize(vals + states[i].value - 1) : 1);
+    if ((rc = agg_reserve(a, len)) != CHIDB_OK)
+        return rc;
+
+    memcpy(a->row, &g->keylen, sizeof(g->keylen));
+    memcpy(AGG_RECORD_KEY(a->row), AGG_KEY(a, g), g->keylen);
+    off = sizeof(uint32_t) + g->keylen;
+    for (uint32_t i = 0; i < a->naggs; i++)
+    {
+        memcpy(a->row + off, &states[i].count, sizeof(int64_t));
+        memcpy(a->row + off + sizeof(int64_t), &states[i].sum, sizeof(int64_t));
+        off += 2 * sizeof(int64_t);
+        if (states[i].value)
+        {
+            uint32_t n = chidb_dbm_reg_serialsize(vals + states[i].value - 1);
+
+            memcpy(a->row + off, vals + states[i].value - 1, n);
+            off += n;
+        }
+        else
+            a->row[off++] = REG_NULL;
+    }
+    a->rowlen = len;
+
+    return CHIDB_OK;
+}
+
+
+/*** Groups ***/
+
+/* Makes v the value of a MIN or MAX state, in place if it fits */
+static int agg_setValue(chidb_dbm_agg_t *a, chidb_dbm_agg_state_t *st, const uint8_t *v)
+{
+    uint32_t n = chidb_dbm_reg_serialsize(v);
+
+    if (st->value != 0 && n <= st->len)
+    {
+        memcpy(a->vals + st->value - 1, v, n);
+        return CHIDB_OK;
+    }
+
+    if (a->valsused + n > a->valssize)
+    {
+        uint32_t size = a->valssize ? a->valssize * 2 : 1024;
+        uint8_t *vals;
+
+        while (size < a->valsused + n)
+            size *= 2;
+        if ((vals = realloc(a->vals, size)) == NULL)
+            return CHIDB_ENOMEM;
+        a->vals = vals;
+        a->valssize = size;
+    }
+
+    memcpy(a->vals + a->valsused, v, n);
+    st->value = a->valsused + 1;
+    st->len = n;
+    a->valsused += n;
+
+    return CHIDB_OK;
+}
+
+/* Merges the states of a record (of a row, or of a partial group) into
+ * those of a group */
+static int agg_merge(chidb_dbm_agg_t *a, uint32_t ref, const uint8_t *rec)
+{
+    chidb_dbm_agg_state_t *states = AGG_STATES(AGG_GROUP(a, ref));
+    const uint8_t *p = AGG_RECORD_KEY(rec) + agg_keylen(rec);
+    int rc;
+
+    for (uint32_t i = 0; i < a->naggs; i++)
+    {
+        chidb_dbm_agg_state_t *st = &states[i];
+        int64_t count, sum;
+        const uint8_t *v;
+
+        memcpy(&count, p, sizeof(count));
+        memcpy(&sum, p + sizeof(count), sizeof(sum));
+        v = p + 2 * sizeof(int64_t);
+        p = v + chidb_dbm_reg_serialsize(v);
+        if (count == 0)
+            continue;
+
+        st->count += count;
+        if (a->funcs[i] == AGG_SIDES)
+            st->sum |= sum;
+        else
+            st->sum += sum;
+        if ((a->funcs[i] == AGG_MIN || a->funcs[i] == AGG_MAX) &&
+            (st->value == 0 ||
+             (a->funcs[i] == AGG_MIN ? agg_cmp(v, a->vals + st->value - 1) < 0
+                                     : agg_cmp(v, a->vals + st->value - 1) > 0)) &&
+            (rc = agg_setValue(a, st, v)) != CHIDB_OK)
+            return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Adds a group with no rows to the buffer, and returns it in *ref */
+static int agg_newGroup(chidb_dbm_agg_t *a, uint32_t hash, const uint8_t *key, uint32_t keylen, uint32_t *ref)
+{
+    uint32_t need = AGG_GROUP_SIZE(a, keylen);
+    chidb_dbm_agg_group_t *g;
+
+    if (a->used + need > a->size)
+    {
+        uint32_t size = a->size ? a->size * 2 : 4096;
+        uint8_t *buf;
+
+        while (size < a->used + need)
+            size *= 2;
+        if ((buf = realloc(a->buf, size)) == NULL)
+            return CHIDB_ENOMEM;
+        a->buf = buf;
+        a->size = size;
+    }
+
+    *ref = a->used + 1;
+    g = AGG_GROUP(a, *ref);
+    g->hash = hash;
+    g->keylen = keylen;
+    memset(AGG_STATES(g), 0, a->naggs * sizeof(chidb_dbm_agg_state_t));
+    if (keylen > 0)
+        memcpy(AGG_KEY(a, g), key, keylen);
+    a->used += need;
+    a->ngroups++;
+
+    return CHIDB_OK;
+}
+
+static int agg_growSlots(chidb_dbm_agg_t *a)
+{
+    uint32_t nslots = a->nslots * 2, mask = nslots - 1;
+    chidb_dbm_agg_slot_t *slots = calloc(nslots, sizeof(chidb_dbm_agg_slot_t));
+
+    if (slots == NULL)
+        return CHIDB_ENOMEM;
+
+    for (uint32_t i = 0; i < a->nslots; i++)
+    {
+        uint32_t idx;
+
+        if (a->slots[i].group == 0)
+            continue;
+        for (idx = a->slots[i].hash & mask; slots[idx].group != 0; idx = (idx + 1) & mask)
+            ;
+        slots[idx] = a->slots[i];
+    }
+
+    free(a->slots);
+    a->slots = slots;
+    a->nslots = nslots;
+
+    return CHIDB_OK;
+}
+
+/* Merges a record into the group with its key, which is created if
+ * there is none yet */
+static int agg_add(chidb_dbm_agg_t *a, uint32_t hash, const uint8_t *rec)
+{
+    const uint8_t *key = AGG_RECORD_KEY(rec);
+    uint32_t keylen = agg_keylen(rec), mask, idx;
+    int rc;
+
+    /* At most half of the slots are used, so probes stay short */
+    if ((a->ngroups + 1) * 2 > a->nslots && (rc = agg_growSlots(a)) != CHIDB_OK)
+        return rc;
+
+    mask = a->nslots - 1;
+    for (idx = hash & mask; a->slots[idx].group != 0; idx = (idx + 1) & mask)
+    {
+        chidb_dbm_agg_group_t *g = AGG_GROUP(a, a->slots[idx].group);
+
+        if (a->slots[idx].hash == hash && g->keylen == keylen && !memcmp(AGG_KEY(a, g), key, keylen))
+            return agg_merge(a, a->slots[idx].group, rec);
+    }
+
+    if ((rc = agg_newGroup(a, hash, key, keylen, &a->slots[idx].group)) != CHIDB_OK)
+        return rc;
+    a->slots[idx].hash = hash;
+
+    return agg_merge(a, a->slots[idx].group, rec);
+}
+
+static void agg_clear(chidb_dbm_agg_t *a)
+{
+    a->used = 0;
+    a->valsused = 0;
+    a->ngroups = 0;
+    a->out = 0;
+    memset(a->slots, 0, a->nslots * sizeof(chidb_dbm_agg_slot_t));
+}
+
+/* Adds the row in a->row to a streaming aggregator. A new key finishes
+ * the current group, which becomes the one that can be read; it is
+ * dropped when the next row is added. */
+static int agg_stream(chidb_dbm_agg_t *a, bool *done)
+{
+    const uint8_t *key = AGG_RECORD_KEY(a->row);
+    uint32_t keylen = agg_keylen(a->row);
+    int rc;
+
+    if (a->out != 0)
+    {
+        chidb_dbm_agg_state_t *states;
+
+        memmove(a->buf, a->buf + a->cur - 1, a->used - (a->cur - 1));
+        a->used -= a->cur - 1;
+        a->cur = 1;
+        if (a->curvals > 0)
+            memmove(a->vals, a->vals + a->curvals, a->valsused - a->curvals);
+        states = AGG_STATES(AGG_GROUP(a, a->cur));
+        for (uint32_t i = 0; i < a->naggs; i++)
+            if (states[i].value != 0)
+                states[i].value -= a->curvals;
+        a->valsused -= a->curvals;
+        a->curvals = 0;
+        a->ngroups = 1;
+        a->out = 0;
+    }
+
+    if (a->cur != 0)
+    {
+        chidb_dbm_agg_group_t *g = AGG_GROUP(a, a->cur);
+
+        if (g->keylen == keylen && !memcmp(AGG_KEY(a, g), key, keylen))
+            return agg_merge(a, a->cur, a->row);
+
+        a->out = a->cur;
+        *done = true;
+    }
+
+    a->curvals = a->valsused;
+    if ((rc = agg_newGroup(a, 0, key, keylen, &a->cur)) != CHIDB_OK)
+        return rc;
+
+    return agg_merge(a, a->cur, a->row);
+}
+
+
+/*** Partitions ***/
+
+/* Records are written to the file of their partition as their hash and
+ * length, followed by the record */
+static int agg_write(FILE *f, uint32_t hash, const uint8_t *rec, uint32_t len)
+{
+    if (fwrite(&hash, sizeof(hash), 1, f) != 1 ||
+        fwrite(&len, sizeof(len), 1, f) != 1 ||
+        fwrite(rec, 1, len, f) != len)
+        return CHIDB_EIO;
+
+    return CHIDB_OK;
+}
+
+/* Reads the next record of a partition file into a->row. Sets *read to
+ * false at the end of the file. */
+static int agg_read(chidb_dbm_agg_t *a, FILE *f, uint32_t *hash, bool *read)
+{
+    uint32_t len;
+    int rc;
+
+    *read = false;
+    if (fread(hash, sizeof(*hash), 1, f) != 1)
+        return ferror(f) ? CHIDB_EIO : CHIDB_OK;
+    if (fread(&len, sizeof(len), 1, f) != 1)
+        return CHIDB_EIO;
+    if ((rc = agg_reserve(a, len)) != CHIDB_OK)
+        return rc;
+    if (fread(a->row, 1, len, f) != len)
+        return CHIDB_EIO;
+
+    a->rowlen = len;
+    *read = true;
+
+    return CHIDB_OK;
+}
+
+/* Splits the groups in memory into partitions: those in partition 0
+ * are kept, and the states of the others are written to their files */
+static int agg_spill(chidb_dbm_agg_t *a)
+{
+    uint8_t *buf = a->buf, *vals = a->vals;
+    uint32_t used = a->used;
+    int rc = CHIDB_OK;
+
+    for (int p = 1; p < DBM_AGG_NPARTITIONS; p++)
+        if ((a->parts[p] = chidb_dbm_tmpfile()) == NULL)
+            return CHIDB_EIO;
+
+    a->buf = NULL;
+    a->size = 0;
+    a->vals = NULL;
+    a->valssize = 0;
+    agg_clear(a);
+    a->spilled = true;
+
+    for (uint32_t off = 0; off < used && rc == CHIDB_OK; )
+    {
+        chidb_dbm_agg_group_t *g = (chidb_dbm_agg_group_t *) (buf + off);
+        uint32_t p = AGG_PARTITION(g->hash);
+
+        if ((rc = agg_groupRecord(a, g, vals)) != CHIDB_OK)
+            break;
+        if (p == 0)
+            rc = agg_add(a, g->hash, a->row);
+        else
+            rc = agg_write(a->parts[p], g->hash, a->row, a->rowlen);
+        off += AGG_GROUP_SIZE(a, g->keylen);
+    }
+
+    free(buf);
+    free(vals);
+    return rc;
+}
+
+/* Adds a record to the group with its key, in memory or in the file of
+ * its partition, and spills once the groups in memory outgrow the
+ * budget */
+static int agg_insert(chidb_dbm_agg_t *a, uint32_t hash, const uint8_t *rec, uint32_t len)
+{
+    uint32_t p = AGG_PARTITION(hash);
+    int rc;
+
+    if (a->spilled && p != 0)
+        return agg_write(a->parts[p], hash, rec, len);
+
+    if ((rc = agg_add(a, hash, rec)) != CHIDB_OK)
+        return rc;
+    if (!a->spilled && a->used + a->valsused > a->budget)
+        return agg_spill(a);
+
+    return CHIDB_OK;
+}
+
+/* Moves to the next group, loading the next partition into memory when
+ * the groups of the current one are done */
+static int agg_advance(chidb_dbm_agg_t *a, bool *found)
+{
+    uint32_t hash;
+    bool read;
+    int rc;
+
+    for (;;)
+    {
+        uint32_t next = a->out == 0 ? 1 : a->out + AGG_GROUP_SIZE(a, AGG_GROUP(a, a->out)->keylen);
+
+        if (next - 1 < a->used)
+        {
+            a->out = next;
+            *found = true;
+            return CHIDB_OK;
+        }
+
+        if (!a->spilled || ++a->part >= DBM_AGG_NPARTITIONS)
+        {
+            a->out = 0;
+            a->part = DBM_AGG_NPARTITIONS;
+            *found = false;
+            return CHIDB_OK;
+        }
+
+        agg_clear(a);
+        rewind(a->parts[a->part]);
+        while ((rc = agg_read(a, a->parts[a->part], &hash, &read)) == CHIDB_OK && read)
+            if ((rc = agg_add(a, hash, a->row)) != CHIDB_OK)
+                return rc;
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+}
+
+
+/*** Interface ***/
+
+/* Create an aggregator
+ *
+ * Parameters
+ * - a: Aggregator to initialize
+ * - nkeys: Values in a group key (0 to aggregate all the rows together)
+ * - funcs: Names of the aggregate functions, separated by commas
+ *          ("count", "sum", "avg", "min", "max" or "sides"), or NULL
+ *          if there are none
+ * - streaming: The rows will come ordered by their key
+ * - budget: Bytes of groups to keep in memory before spilling partitions
+ *           to temporary files (usually DBM_AGG_BUDGET)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: A function name is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_agg_init(chidb_dbm_agg_t *a, uint32_t nkeys, const char *funcs, bool streaming, size_t budget)
+{
+    static const char *names[] = {"count", "sum", "avg", "min", "max", "sides"};
+    const char *p = funcs;
+
+    memset(a, 0, sizeof(chidb_dbm_agg_t));
+
+    while (p != NULL && *p != '\0')
+    {
+        size_t n = strcspn(p, ",");
+        uint8_t *f = realloc(a->funcs, a->naggs + 1);
+        uint8_t i;
+
+        if (f == NULL)
+        {
+            chidb_dbm_agg_free(a);
+            return CHIDB_ENOMEM;
+        }
+        a->funcs = f;
+        for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+            if (strlen(names[i]) == n && !strncmp(p, names[i], n))
+                break;
+        if (i == sizeof(names) / sizeof(names[0]))
+        {
+            chidb_dbm_agg_free(a);
+            return CHIDB_EMISUSE;
+        }
+        a->funcs[a->naggs++] = i;
+        p += n + (p[n] == ',');
+    }
+
+    a->slots = calloc(AGG_MIN_SLOTS, sizeof(chidb_dbm_agg_slot_t));
+    if (a->slots == NULL)
+    {
+        chidb_dbm_agg_free(a);
+        return CHIDB_ENOMEM;
+    }
+    a->nslots = AGG_MIN_SLOTS;
+    a->nkeys = nkeys;
+    a->streaming = streaming;
+    a->budget = budget;
+    a->open = true;
+
+    return CHIDB_OK;
+}
+
+
+/* Create an empty aggregator like another one
+ *
+ * Gives a the key and the functions of like, for instance to aggregate
+ * part of the rows apart, and merge its groups into like later (see
+ * chidb_dbm_agg_merge).
+ *
+ * Parameters
+ * - a: Aggregator to initialize
+ * - like: Open aggregator
+ * - budget: Bytes of groups that a keeps in memory before spilling
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_agg_clone(chidb_dbm_agg_t *a, chidb_dbm_agg_t *like, size_t budget)
+{
+    memset(a, 0, sizeof(chidb_dbm_agg_t));
+
+    if (like->naggs > 0 && (a->funcs = malloc(like->naggs)) == NULL)
+        return CHIDB_ENOMEM;
+    if ((a->slots = calloc(AGG_MIN_SLOTS, sizeof(chidb_dbm_agg_slot_t))) == NULL)
+    {
+        chidb_dbm_agg_free(a);
+        return CHIDB_ENOMEM;
+    }
+    if (like->naggs > 0)
+        memcpy(a->funcs, like->funcs, like->naggs);
+    a->naggs = like->naggs;
+    a->nslots = AGG_MIN_SLOTS;
+    a->nkeys = like->nkeys;
+    a->streaming = like->streaming;
+    a->budget = budget;
+    a->open = true;
+
+    return CHIDB_OK;
+}
+
+
+/* Free an aggregator, and delete its partition files */
+void chidb_dbm_agg_free(chidb_dbm_agg_t *a)
+{
+    for (int p = 0; p < DBM_AGG_NPARTITIONS; p++)
+        if (a->parts[p] != NULL)
+            fclose(a->parts[p]);
+    free(a->funcs);
+    free(a->buf);
+    free(a->vals);
+    free(a->slots);
+    free(a->row);
+    memset(a, 0, sizeof(chidb_dbm_agg_t));
+}
+
+
+/* Add a row to an aggregator
+ *
+ * Adds the values of the row to the state of the functions of its
+ * group. NULLs are left out of every function (COUNT(*) counts a value
+ * that is never NULL instead).
+ *
+ * Parameters
+ * - a: Aggregator
+ * - regs: The a->nkeys registers with the key of the row, followed by
+ *         the argument of each function
+ * - done: Set to whether the row finished a group, which can now be
+ *         read with chidb_dbm_agg_column (streaming aggregators only)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The aggregator is not open, or its input is over
+ * - CHIDB_EMISMATCH: The argument of a SUM, an AVG or a SIDES is not an
+ *   integer
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not write a partition file
+ */
+int chidb_dbm_agg_step(chidb_dbm_agg_t *a, chidb_dbm_register_t *regs, bool *done)
+{
+    uint32_t hash;
+    int rc;
+
+    *done = false;
+    if (!a->open || a->final)
+        return CHIDB_EMISUSE;
+    if ((rc = agg_rowRecord(a, regs)) != CHIDB_OK)
+        return rc;
+    a->stepped = true;
+
+    if (a->streaming)
+        return agg_stream(a, done);
+
+    hash = agg_hash(AGG_RECORD_KEY(a->row), agg_keylen(a->row));
+    return agg_insert(a, hash, a->row, a->rowlen);
+}
+
+
+/* Finish the input of an aggregator
+ *
+ * Once every row has gone through chidb_dbm_agg_step, moves to the first
+ * group whose results haven't been read yet. Without a key, there is
+ * always one group, even if there were no rows (COUNT is then 0, and
+ * the other functions NULL). The groups of the partitions that were
+ * spilled are read back, and their states merged, a partition at a time.
+ *
+ * Parameters
+ * - a: Aggregator
+ * - found: Set to whether there is a group
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The aggregator is not open
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not read a partition file
+ */
+int chidb_dbm_agg_final(chidb_dbm_agg_t *a, bool *found)
+{
+    int rc;
+
+    *found = false;
+    if (!a->open || a->final)
+        return CHIDB_EMISUSE;
+    a->final = true;
+
+    if (a->nkeys == 0 && !a->stepped)
+    {
+        uint32_t ref;
+
+        if ((rc = agg_newGroup(a, agg_hash(NULL, 0), NULL, 0, &ref)) != CHIDB_OK)
+            return rc;
+        a->cur = ref;
+    }
+
+    if (a->streaming)
+    {
+        a->out = a->cur;
+        *found = a->out != 0;
+        return CHIDB_OK;
+    }
+
+    a->out = 0;
+    a->part = 0;
+
+    return agg_advance(a, found);
+}
+
+
+/* Move to the next group
+ *
+ * Parameters
+ * - a: Aggregator
+ * - found: Set to whether there is another group
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: chidb_dbm_agg_final hasn't been called
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not read a partition file
+ */
+int chidb_dbm_agg_next(chidb_dbm_agg_t *a, bool *found)
+{
+    *found = false;
+    if (!a->open || !a->final)
+        return CHIDB_EMISUSE;
+
+    if (a->streaming || a->part == DBM_AGG_NPARTITIONS)
+    {
+        a->out = 0;
+        return CHIDB_OK;
+    }
+
+    return agg_advance(a, found);
+}
+
+
+/* Read a value of the current group
+ *
+ * The values of the group key come first, followed by the result of
+ * each function: COUNT is the number of values that weren't NULL, AVG
+ * is the integer average of those values, SIDES is their OR, and SUM,
+ * MIN and MAX are NULL if there were none. Strings and binaries are not copied: the register
+ * points into the aggregator, and is valid until it moves to another
+ * group (or takes another row).
+ *
+ * Parameters
+ * - a: Aggregator
+ * - col: Value of the group (starting at 0)
+ * - r: Register to store it in
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no such value, or no current group
+ * - CHIDB_EMISMATCH: The result doesn't fit in an integer register
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_agg_column(chidb_dbm_agg_t *a, uint32_t col, chidb_dbm_register_t *r)
+{
+    chidb_dbm_agg_group_t *g;
+    chidb_dbm_agg_state_t *st;
+    int64_t v;
+
+    if (!a->open || a->out == 0 || col >= a->nkeys + a->naggs)
+        return CHIDB_EMISUSE;
+
+    g = AGG_GROUP(a, a->out);
+    if (col < a->nkeys)
+    {
+        const uint8_t *k = AGG_KEY(a, g);
+
+        while (col-- > 0)
+            k += chidb_dbm_reg_serialsize(k);
+        return chidb_dbm_reg_deserialize(r, k);
+    }
+
+    st = &AGG_STATES(g)[col - a->nkeys];
+    chidb_dbm_reg_clear(r);
+    if (a->funcs[col - a->nkeys] != AGG_COUNT && st->count == 0)
+    {
+        r->type = REG_NULL;
+        return CHIDB_OK;
+    }
+
+    switch (a->funcs[col - a->nkeys])
+    {
+    case AGG_COUNT:
+        v = st->count;
+        break;
+    case AGG_SUM:
+    case AGG_SIDES:
+        v = st->sum;
+        break;
+    case AGG_AVG:
+        v = st->sum / st->count;
+        break;
+    default:
+        return chidb_dbm_reg_deserialize(r, a->vals + st->value - 1);
+    }
+
+    if (v < INT32_MIN || v > INT32_MAX)
+        return CHIDB_EMISMATCH;
+    r->type = REG_INT32;
+    r->value.i = (int32_t) v;
+
+    return CHIDB_OK;
+}
+
+
+/* Merge the groups of an aggregator into another one
+ *
+ * Adds the state of every group of from to the group with the same key
+ * in a (as if a had taken the rows of from too), spilling if a outgrows
+ * its budget. This is how the partial aggregates of the rows of a
+ * parallel scan are put together (see chidb_dbm_parallel_scan). from
+ * must have the key and the functions of a (see chidb_dbm_agg_clone),
+ * and its input is over afterwards.
+ *
+ * Parameters
+ * - a: Aggregator
+ * - from: Aggregator to merge into a
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The aggregators are not open, their inputs are over,
+ *   or one of them is a streaming aggregator (whose groups must come
+ *   in order)
+ * - CHIDB_EMISMATCH: The aggregators don't have the same key and
+ *   functions
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not read or write a partition file
+ */
+int chidb_dbm_agg_merge(chidb_dbm_agg_t *a, chidb_dbm_agg_t *from)
+{
+    bool found;
+    int rc;
+
+    if (!a->open || !from->open || a->final || from->final || a->streaming || from->streaming)
+        return CHIDB_EMISUSE;
+    if (a->nkeys != from->nkeys || a->naggs != from->naggs ||
+        (a->naggs > 0 && memcmp(a->funcs, from->funcs, a->naggs)))
+        return CHIDB_EMISMATCH;
+
+    /* Without a key, final would make up an empty group */
+    if (!from->stepped)
+        return CHIDB_OK;
+
+    for (rc = chidb_dbm_agg_final(from, &found); rc == CHIDB_OK && found; rc = chidb_dbm_agg_next(from, &found))
+    {
+        chidb_dbm_agg_group_t *g = AGG_GROUP(from, from->out);
+
+        if ((rc = agg_groupRecord(from, g, from->vals)) != CHIDB_OK ||
+            (rc = agg_insert(a, g->hash, from->row, from->rowlen)) != CHIDB_OK)
+            return rc;
+        a->stepped = true;
+    }
+
+    return rc;
+}
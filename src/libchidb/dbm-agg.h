@@ -0,0 +1,161 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine aggregates -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef DBM_AGG_H_
+#define DBM_AGG_H_
+
+#include <stdio.h>
+#include "chidbInt.h"
+#include "dbm-types.h"
+
+/* Bytes of groups that an aggregator keeps in memory by default before
+ * it spills partitions to temporary files, and number of partitions */
+#define DBM_AGG_BUDGET (4 * 1024 * 1024)
+#define DBM_AGG_NPARTITIONS (16)
+
+/* Aggregate functions (see the AggOpen instruction). SIDES is not an SQL
+ * function: it ORs together integers that say which inputs of a UNION,
+ * INTERSECT or EXCEPT a row came from (1 for the first, 2 for the
+ * second), so that a group tells which of them had its row. */
+typedef enum chidb_dbm_agg_func
+{
+    AGG_COUNT,
+    AGG_SUM,
+    AGG_AVG,
+    AGG_MIN,
+    AGG_MAX,
+    AGG_SIDES
+} chidb_dbm_agg_func_t;
+
+/* State of an aggregate function in a group: the number of values that
+ * weren't NULL and, depending on the function, their sum (their OR for
+ * SIDES) or the smallest (largest) of them so far */
+typedef struct chidb_dbm_agg_state
+{
+    int64_t count;
+    int64_t sum;
+    uint32_t value;         /* Offset of the serialized value in vals + 1, 0 if none */
+    uint32_t len;           /* Bytes of vals that it can take */
+} chidb_dbm_agg_state_t;
+
+/* A slot of the open-addressing table: the hash of a group key, and
+ * where the group is */
+typedef struct chidb_dbm_agg_slot
+{
+    uint32_t hash;
+    uint32_t group;         /* Offset of the group in buf + 1, 0 if the slot is empty */
+} chidb_dbm_agg_slot_t;
+
+/* An aggregator (see the AggOpen instruction), that computes aggregate
+ * functions over the rows of each group, the rows with the same key.
+ *
+ * The groups are kept in buf, one after the other, each with the state
+ * of every function (chidb_dbm_agg_state_t) followed by its key,
+ * serialized (see chidb_dbm_reg_serialize). The smallest and largest
+ * values of MIN and MAX go in vals, where a value is replaced in place
+ * if the new one fits. The table is an array of slots, probed linearly,
+ * that holds the hash of each key and where its group is.
+ *
+ * Once the groups in memory take more than budget bytes, the table is
+ * split into DBM_AGG_NPARTITIONS partitions by the top bits of the hash:
+ * partition 0 stays in memory, and the states of the groups in the
+ * others are written to temporary files, as are those of the rows that
+ * fall in them from then on (a row is a group of one). Partitions are
+ * read back a group at a time, and their states merged, once the input
+ * is over (chidb_dbm_agg_final).
+ *
+ * If the rows come ordered by their key, for instance from an index,
+ * a streaming aggregator only needs the group being built: when a row
+ * with a new key arrives, the previous group is done and can be read
+ * (chidb_dbm_agg_step sets *done), and the table is never used.
+ */
+typedef struct chidb_dbm_agg
+{
+    bool open;
+    uint32_t nkeys;         /* Values in a group key (0 for a single group) */
+    uint32_t naggs;
+    uint8_t *funcs;         /* naggs chidb_dbm_agg_func_t */
+    bool streaming;
+    size_t budget;
+
+    uint8_t *buf;
+    uint32_t used;
+    uint32_t size;
+
+    uint8_t *vals;
+    uint32_t valsused;
+    uint32_t valssize;
+
+    chidb_dbm_agg_slot_t *slots;
+    uint32_t nslots;        /* A power of two */
+    uint32_t ngroups;
+    bool stepped;           /* Some row has been added */
+
+    bool spilled;
+    FILE *parts[DBM_AGG_NPARTITIONS];
+
+    /* A row, or the state of a group, being added or read from a
+     * partition */
+    uint8_t *row;
+    uint32_t rowlen;
+    uint32_t rowsize;
+
+    /* Group that rows are added to in a streaming aggregator (offset in
+     * buf + 1), and where its values start in vals */
+    uint32_t cur;
+    uint32_t curvals;
+
+    /* Group that can be read (offset in buf + 1, or 0), and, once the
+     * input is over, partition being read */
+    uint32_t out;
+    bool final;
+    uint32_t part;
+} chidb_dbm_agg_t;
+
+int chidb_dbm_agg_init(chidb_dbm_agg_t *a, uint32_t nkeys, const char *funcs, bool streaming, size_t budget);
+int chidb_dbm_agg_clone(chidb_dbm_agg_t *a, chidb_dbm_agg_t *like, size_t budget);
+void chidb_dbm_agg_free(chidb_dbm_agg_t *a);
+int chidb_dbm_agg_step(chidb_dbm_agg_t *a, chidb_dbm_register_t *regs, bool *done);
+int chidb_dbm_agg_final(chidb_dbm_agg_t *a, bool *found);
+int chidb_dbm_agg_next(chidb_dbm_agg_t *a, bool *found);
+int chidb_dbm_agg_column(chidb_dbm_agg_t *a, uint32_t col, chidb_dbm_register_t *r);
+int chidb_dbm_agg_merge(chidb_dbm_agg_t *a, chidb_dbm_agg_t *from);
+
+#endif /* DBM_AGG_H_ */
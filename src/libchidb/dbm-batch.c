@@ -0,0 +1,606 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine batch (vectorized) scans
+ *
+ * The DBM runs one row at a time: every Next reads one cell, and every
+ * Column decodes one value into a register. That's the right thing for
+ * statements that touch a few rows, but analytic scans (e.g.,
+ * SELECT SUM(x) FROM t WHERE y > 5) spend most of their time
+ * dispatching instructions. This module reads a table in batches of up
+ * to DBM_BATCH_SIZE rows instead, with each integer column that is
+ * needed decoded into a vector, and provides tight loops over those
+ * vectors that compilers can vectorize:
+ *
+ *   chidb_dbm_scan_t scan;
+ *   chidb_dbm_batch_t *batch = malloc(sizeof(chidb_dbm_batch_t));
+ *   chidb_dbm_aggregate_t sum;
+ *   uint8_t cols[] = {1, 2};    // x, y
+ *
+ *   chidb_dbm_scan_init(&scan, bt, nroot, cols, 2);
+ *   chidb_dbm_aggregate_init(&sum);
+ *   while (chidb_dbm_scan_next(&scan, batch) == CHIDB_OK)
+ *   {
+ *       chidb_dbm_batch_filter(batch, 1, Op_Gt, 5);   // y > 5
+ *       chidb_dbm_batch_aggregate(batch, 0, &sum);     // SUM(x)
+ *   }
+ *   chidb_dbm_scan_free(&scan);
+ *
+ * Only integer columns can be read into vectors; statements that need
+ * strings keep using the row-at-a-time DBM.
+ *
+ * Columnar tables (see columnar.c) are scanned the same way, starting
+ * with chidb_dbm_scan_initColumnar: each batch is a segment, and only
+ * the chunks of the scanned columns are read. Filters given to
+ * chidb_dbm_scan_prune skip the segments whose zone maps rule them out.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "dbm-batch.h"
+#include "columnar.h"
+#include "zonemap.h"
+#include "record.h"
+
+
+/* Start a batch scan of a table
+ *
+ * Parameters
+ * - scan: Scan to initialize
+ * - bt: B-Tree file
+ * - nroot: Root page of a table B-Tree
+ * - cols: Columns to read into the vectors of each batch (vector i of
+ *         a batch has the values of column cols[i])
+ * - ncols: Number of columns (at most DBM_BATCH_MAXCOLS)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Too many columns
+ */
+int chidb_dbm_scan_init(chidb_dbm_scan_t *scan, BTree *bt, npage_t nroot, const uint8_t *cols, uint8_t ncols)
+{
+    if (ncols > DBM_BATCH_MAXCOLS)
+        return CHIDB_EMISUSE;
+
+    scan->bt = bt;
+    memcpy(scan->cols, cols, ncols);
+    scan->ncols = ncols;
+    scan->stack[0].npage = nroot;
+    scan->stack[0].ncell = 0;
+    scan->stack[0].lo = 0;
+    scan->stack[0].hi = CHIDB_KEY_MAX;
+    scan->depth = 0;
+    scan->buf = NULL;
+    scan->bufsize = 0;
+    scan->columnar = false;
+    scan->nroot = nroot;
+    scan->nprune = 0;
+    scan->nskipped = 0;
+    scan->keys = NULL;
+
+    return CHIDB_OK;
+}
+
+
+/* Start a batch scan of a columnar table
+ *
+ * Like chidb_dbm_scan_init, for a table created WITH (storage =
+ * columnar). The segments of the table are read in order, one per
+ * batch, so batches can have fewer than DBM_BATCH_SIZE rows.
+ *
+ * Parameters
+ * - scan: Scan to initialize
+ * - bt: B-Tree file
+ * - nroot: Root page of a columnar table
+ * - cols: Columns to read into the vectors of each batch
+ * - ncols: Number of columns (at most DBM_BATCH_MAXCOLS)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Too many columns
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_dbm_scan_initColumnar(chidb_dbm_scan_t *scan, BTree *bt, npage_t nroot, const uint8_t *cols, uint8_t ncols)
+{
+    int rc;
+
+    if ((rc = chidb_dbm_scan_init(scan, bt, nroot, cols, ncols)) != CHIDB_OK)
+        return rc;
+
+    scan->columnar = true;
+    scan->nsegment = 0;
+
+    return chidb_columnar_segments(bt, nroot, &scan->nsegments);
+}
+
+
+/* Skip the parts of a scan where no row can match a filter
+ *
+ * The segments of a columnar table where no value of a vector can
+ * compare as given with k (according to the minimum and maximum in
+ * their zone maps) are not read at all. In other tables, the same goes
+ * for the subtrees where no value of the column can, according to the
+ * zone map of the column (see zonemap.c), if it has one that is up to
+ * date. The rows of the batches that are read still have to be
+ * filtered with chidb_dbm_batch_filter.
+ *
+ * Parameters
+ * - scan: Batch scan, before its first batch is read
+ * - vector: Vector to compare
+ * - cmp: Comparison (Op_Eq, Op_Ne, Op_Lt, Op_Le, Op_Gt or Op_Ge)
+ * - k: Value to compare with
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The vector is not scanned, cmp is not a comparison,
+ *                  or the scan has DBM_BATCH_MAXCOLS filters already
+ */
+int chidb_dbm_scan_prune(chidb_dbm_scan_t *scan, uint8_t vector, opcode_t cmp, int32_t k)
+{
+    if (vector >= scan->ncols || scan->nprune == DBM_BATCH_MAXCOLS ||
+        cmp < Op_Eq || cmp > Op_Ge)
+        return CHIDB_EMISUSE;
+
+    scan->prune[scan->nprune].vector = vector;
+    scan->prune[scan->nprune].cmp = cmp;
+    scan->prune[scan->nprune].k = k;
+    scan->prune[scan->nprune].zone = NULL;
+    if (!scan->columnar &&
+        chidb_zonemap_interval(cmp, k, &scan->prune[scan->nprune].min, &scan->prune[scan->nprune].max))
+        scan->prune[scan->nprune].zone = chidb_zonemap_get(scan->bt, scan->nroot, scan->cols[vector]);
+    scan->nprune++;
+
+    return CHIDB_OK;
+}
+
+
+/* Whether the rows with keys from lo to hi can pass the filters of a
+ * scan of a row table, according to the zone maps of their columns */
+static bool chidb_dbm_scan_zone(chidb_dbm_scan_t *scan, chidb_key_t lo, chidb_key_t hi)
+{
+    for (uint8_t i = 0; i < scan->nprune; i++)
+        if (scan->prune[i].zone != NULL &&
+            !chidb_zonemap_match(scan->prune[i].zone, lo, hi, scan->prune[i].min, scan->prune[i].max))
+            return false;
+
+    return true;
+}
+
+
+/* Reads the columns of the row in a table leaf cell into row n of a batch */
+static int chidb_dbm_scan_row(chidb_dbm_scan_t *scan, BTreeCell *cell, chidb_dbm_batch_t *batch, uint32_t n)
+{
+    DBRecordView view;
+    uint8_t *data = cell->fields.tableLeaf.data;
+    int8_t v8;
+    int16_t v16;
+    int32_t v32;
+    int rc;
+
+    if (cell->fields.tableLeaf.overflow_page != 0)
+    {
+        if (scan->bufsize < cell->fields.tableLeaf.data_size)
+        {
+            uint8_t *buf = realloc(scan->buf, cell->fields.tableLeaf.data_size);
+            if (buf == NULL)
+                return CHIDB_ENOMEM;
+            scan->buf = buf;
+            scan->bufsize = cell->fields.tableLeaf.data_size;
+        }
+        rc = chidb_Btree_readPayload(scan->bt, cell, 0, cell->fields.tableLeaf.data_size, scan->buf);
+        if (rc != CHIDB_OK)
+            return rc;
+        data = scan->buf;
+    }
+
+    if (BTREE_RECORD_FORMAT(scan->bt) == DBRECORD_FORMAT_V2)
+        rc = chidb_DBRecordView_initV2(&view, data);
+    else
+        rc = chidb_DBRecordView_init(&view, data);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    batch->keys[n] = cell->key;
+    for (uint8_t i = 0; i < scan->ncols; i++)
+    {
+        chidb_dbm_vector_t *v = &batch->vectors[i];
+        uint8_t col = scan->cols[i];
+
+        v->values[n] = 0;
+        v->nulls[n] = 0;
+        switch (chidb_DBRecordView_getType(&view, col))
+        {
+        case SQL_NULL:
+            v->nulls[n] = 1;
+            break;
+        case SQL_INTEGER_1BYTE:
+            chidb_DBRecordView_getInt8(&view, col, &v8);
+            v->values[n] = v8;
+            break;
+        case SQL_INTEGER_2BYTE:
+            chidb_DBRecordView_getInt16(&view, col, &v16);
+            v->values[n] = v16;
+            break;
+        case SQL_INTEGER_4BYTE:
+            chidb_DBRecordView_getInt32(&view, col, &v32);
+            v->values[n] = v32;
+            break;
+        case SQL_NOTVALID:
+            return col >= chidb_DBRecordView_nfields(&view) ? CHIDB_EMISUSE : CHIDB_EMISMATCH;
+        default:
+            return CHIDB_EMISMATCH;
+        }
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Reads the next segment of a columnar table, that the filters of
+ * the scan don't rule out, into a batch */
+static int chidb_dbm_scan_nextSegment(chidb_dbm_scan_t *scan, chidb_dbm_batch_t *batch)
+{
+    chidb_columnar_zone_t zone;
+    chidb_dbm_vector_t *keys = NULL;
+    uint32_t n;
+    int rc;
+
+    batch->n = 0;
+    for (; scan->nsegment < scan->nsegments; scan->nsegment++, scan->nskipped++)
+    {
+        bool match = true;
+
+        for (uint8_t i = 0; i < scan->nprune && match; i++)
+        {
+            rc = chidb_columnar_zone(scan->bt, scan->nroot, scan->nsegment,
+                                     scan->cols[scan->prune[i].vector], &zone);
+            if (rc != CHIDB_OK)
+                return rc == CHIDB_ENOTFOUND ? CHIDB_EMISUSE : rc;
+            match = chidb_columnar_zoneMatch(&zone, scan->prune[i].cmp, scan->prune[i].k);
+        }
+        if (match)
+            break;
+    }
+    if (scan->nsegment == scan->nsegments)
+        return CHIDB_DONE;
+
+    for (uint8_t i = 0; i < scan->ncols; i++)
+    {
+        rc = chidb_columnar_read(scan->bt, scan->nroot, scan->nsegment, scan->cols[i],
+                                 &batch->vectors[i], &n, &scan->buf, &scan->bufsize);
+        if (rc != CHIDB_OK)
+            return rc == CHIDB_ENOTFOUND ? CHIDB_EMISUSE : rc;
+        if (i > 0 && n != batch->n)
+            return CHIDB_ECORRUPT;
+        batch->n = n;
+        if (scan->cols[i] == 0)
+            keys = &batch->vectors[i];
+    }
+
+    /* The primary key is the first column, which is only read again if
+     * it isn't one of the scanned ones */
+    if (keys == NULL)
+    {
+        if (scan->keys == NULL && (scan->keys = malloc(sizeof(chidb_dbm_vector_t))) == NULL)
+            return CHIDB_ENOMEM;
+        keys = scan->keys;
+        rc = chidb_columnar_read(scan->bt, scan->nroot, scan->nsegment, 0,
+                                 keys, &n, &scan->buf, &scan->bufsize);
+        if (rc != CHIDB_OK)
+            return rc == CHIDB_ENOTFOUND ? CHIDB_ECORRUPT : rc;
+        if (scan->ncols > 0 && n != batch->n)
+            return CHIDB_ECORRUPT;
+        batch->n = n;
+    }
+    for (uint32_t i = 0; i < batch->n; i++)
+        batch->keys[i] = (chidb_key_t) keys->values[i];
+
+    scan->nsegment++;
+    for (uint32_t i = 0; i < batch->n; i++)
+        batch->sel[i] = i;
+    batch->nsel = batch->n;
+
+    return batch->n > 0 ? CHIDB_OK : CHIDB_DONE;
+}
+
+
+/* Read the next batch of a batch scan
+ *
+ * Fills a batch with the next rows of the table, in key order, until
+ * it has DBM_BATCH_SIZE rows or the table runs out. Rows are read from
+ * consecutive leaves, and each leaf is loaded once per batch. All the
+ * rows of the batch are selected. As with chidb_Btree_nextLeaf, no
+ * latches are taken, so the table must not be modified during the scan.
+ * In a columnar table, the batch is the next segment instead (that the
+ * filters of the scan don't rule out, see chidb_dbm_scan_prune).
+ *
+ * Parameters
+ * - scan: Batch scan
+ * - batch: Batch to fill
+ *
+ * Return
+ * - CHIDB_OK: The batch has at least one row
+ * - CHIDB_DONE: There are no more rows (batch->n is 0)
+ * - CHIDB_EMISMATCH: A scanned column holds a string
+ * - CHIDB_EMISUSE: A scanned column doesn't exist, or the tree is not a table
+ * - CHIDB_ECORRUPT: The tree is deeper than BTREE_MAX_DEPTH, or a
+ *                   chunk of a columnar table is not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_dbm_scan_next(chidb_dbm_scan_t *scan, chidb_dbm_batch_t *batch)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    int rc = CHIDB_OK;
+
+    if (scan->columnar)
+        return chidb_dbm_scan_nextSegment(scan, batch);
+
+    batch->n = 0;
+    while (batch->n < DBM_BATCH_SIZE && scan->depth >= 0 && rc == CHIDB_OK)
+    {
+        typeof(scan->stack[0]) *top = &scan->stack[scan->depth];
+
+        rc = chidb_Btree_getNodeByPage(scan->bt, top->npage, &btn);
+        if (rc != CHIDB_OK)
+            break;
+
+        if (btn->type == PGTYPE_TABLE_INTERNAL)
+        {
+            npage_t child;
+
+            if (top->ncell > btn->n_cells)
+                scan->depth--;
+            else if (scan->depth + 1 == BTREE_MAX_DEPTH)
+                rc = CHIDB_ECORRUPT;
+            else
+            {
+                /* The child has the keys after the separator before it
+                 * (none if that is CHIDB_KEY_MAX), up to the one after it */
+                chidb_key_t lo = top->lo, hi = top->hi;
+                bool empty = false;
+
+                if (top->ncell > 0)
+                {
+                    chidb_Btree_getCell(btn, top->ncell - 1, &cell);
+                    empty = cell.key == CHIDB_KEY_MAX;
+                    lo = cell.key + 1;
+                }
+                if (top->ncell < btn->n_cells)
+                {
+                    chidb_Btree_getCell(btn, top->ncell, &cell);
+                    child = cell.fields.tableInternal.child_page;
+                    hi = cell.key;
+                }
+                else
+                    child = btn->right_page;
+                top->ncell++;
+
+                if (empty || !chidb_dbm_scan_zone(scan, lo, hi))
+                    scan->nskipped++;
+                else
+                {
+                    scan->depth++;
+                    scan->stack[scan->depth].npage = child;
+                    scan->stack[scan->depth].ncell = 0;
+                    scan->stack[scan->depth].lo = lo;
+                    scan->stack[scan->depth].hi = hi;
+                }
+            }
+        }
+        else if (btn->type == PGTYPE_TABLE_LEAF)
+        {
+            for (; top->ncell < btn->n_cells && batch->n < DBM_BATCH_SIZE && rc == CHIDB_OK; top->ncell++)
+            {
+                chidb_Btree_getCell(btn, top->ncell, &cell);
+                rc = chidb_dbm_scan_row(scan, &cell, batch, batch->n);
+                if (rc == CHIDB_OK)
+                    batch->n++;
+            }
+            if (top->ncell == btn->n_cells)
+                scan->depth--;
+        }
+        else
+            rc = CHIDB_EMISUSE;
+
+        chidb_Btree_freeMemNode(scan->bt, btn);
+    }
+
+    if (rc != CHIDB_OK)
+        return rc;
+
+    for (uint32_t i = 0; i < batch->n; i++)
+        batch->sel[i] = i;
+    batch->nsel = batch->n;
+
+    return batch->n > 0 ? CHIDB_OK : CHIDB_DONE;
+}
+
+
+/* Free the resources of a batch scan
+ *
+ * Parameters
+ * - scan: Batch scan
+ */
+void chidb_dbm_scan_free(chidb_dbm_scan_t *scan)
+{
+    free(scan->buf);
+    free(scan->keys);
+    scan->buf = NULL;
+    scan->bufsize = 0;
+    scan->keys = NULL;
+}
+
+
+/* Narrow down the selected rows of a batch with a comparison
+ *
+ * Keeps only the selected rows whose value in a vector compares as
+ * given with k. NULLs never compare true. The loop doesn't branch on
+ * the outcome of the comparison, so the compiler can vectorize it.
+ *
+ * Parameters
+ * - batch: Batch
+ * - vector: Vector to compare
+ * - cmp: Comparison (Op_Eq, Op_Ne, Op_Lt, Op_Le, Op_Gt or Op_Ge)
+ * - k: Value to compare with
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: cmp is not a comparison
+ */
+int chidb_dbm_batch_filter(chidb_dbm_batch_t *batch, uint8_t vector, opcode_t cmp, int32_t k)
+{
+    const int32_t *values = batch->vectors[vector].values;
+    const uint8_t *nulls = batch->vectors[vector].nulls;
+    uint16_t *sel = batch->sel;
+    uint32_t m = 0;
+
+    /* Expands to a loop that keeps the rows for which values[r] OP k */
+#define BATCH_FILTER(OP)                                        \
+    for (uint32_t i = 0; i < batch->nsel; i++)                  \
+    {                                                           \
+        uint16_t r = sel[i];                                    \
+        sel[m] = r;                                             \
+        m += (values[r] OP k) & !nulls[r];                      \
+    }
+
+    switch (cmp)
+    {
+    case Op_Eq:
+        BATCH_FILTER(==);
+        break;
+    case Op_Ne:
+        BATCH_FILTER(!=);
+        break;
+    case Op_Lt:
+        BATCH_FILTER(<);
+        break;
+    case Op_Le:
+        BATCH_FILTER(<=);
+        break;
+    case Op_Gt:
+        BATCH_FILTER(>);
+        break;
+    case Op_Ge:
+        BATCH_FILTER(>=);
+        break;
+    default:
+        return CHIDB_EMISUSE;
+    }
+#undef BATCH_FILTER
+
+    batch->nsel = m;
+
+    return CHIDB_OK;
+}
+
+
+/* Initialize an aggregate
+ *
+ * Parameters
+ * - agg: Aggregate to initialize
+ */
+void chidb_dbm_aggregate_init(chidb_dbm_aggregate_t *agg)
+{
+    agg->count = 0;
+    agg->sum = 0;
+    agg->min = INT32_MAX;
+    agg->max = INT32_MIN;
+}
+
+
+/* Add the selected rows of a batch to an aggregate
+ *
+ * Adds the non-NULL values of a vector, in the selected rows, to the
+ * count, sum, minimum and maximum of an aggregate (AVG is sum / count,
+ * and COUNT(*) is the number of selected rows, batch->nsel). min and
+ * max are only meaningful once count is not 0.
+ *
+ * Parameters
+ * - batch: Batch
+ * - vector: Vector to aggregate
+ * - agg: Aggregate to update
+ */
+void chidb_dbm_batch_aggregate(chidb_dbm_batch_t *batch, uint8_t vector, chidb_dbm_aggregate_t *agg)
+{
+    const int32_t *values = batch->vectors[vector].values;
+    const uint8_t *nulls = batch->vectors[vector].nulls;
+    uint32_t count = agg->count;
+    int64_t sum = agg->sum;
+    int32_t min = agg->min, max = agg->max;
+
+    for (uint32_t i = 0; i < batch->nsel; i++)
+    {
+        uint16_t r = batch->sel[i];
+        int32_t v = values[r];
+        bool valid = !nulls[r];
+
+        count += valid;
+        sum += valid ? v : 0;
+        min = (valid && v < min) ? v : min;
+        max = (valid && v > max) ? v : max;
+    }
+
+    agg->count = count;
+    agg->sum = sum;
+    agg->min = min;
+    agg->max = max;
+}
+
+
+/* Copy the values of the selected rows of a batch
+ *
+ * Parameters
+ * - batch: Batch
+ * - vector: Vector to copy from
+ * - out: Array of at least batch->nsel values where the values of the
+ *        selected rows are copied, in order (NULLs are copied as 0)
+ *
+ * Return
+ * - Number of values copied (batch->nsel)
+ */
+uint32_t chidb_dbm_batch_project(chidb_dbm_batch_t *batch, uint8_t vector, int32_t *out)
+{
+    const int32_t *values = batch->vectors[vector].values;
+
+    for (uint32_t i = 0; i < batch->nsel; i++)
+        out[i] = values[batch->sel[i]];
+
+    return batch->nsel;
+}
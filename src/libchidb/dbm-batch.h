@@ -0,0 +1,132 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine batch (vectorized) scans -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef DBM_BATCH_H_
+#define DBM_BATCH_H_
+
+#include "chidbInt.h"
+#include "btree.h"
+#include "dbm-types.h"
+
+/* Rows in a batch, and integer columns that can be read into one */
+#define DBM_BATCH_SIZE (1024)
+#define DBM_BATCH_MAXCOLS (8)
+
+/* The values of one column for the rows of a batch */
+typedef struct chidb_dbm_vector
+{
+    int32_t values[DBM_BATCH_SIZE];   /* 0 if NULL */
+    uint8_t nulls[DBM_BATCH_SIZE];    /* 1 if NULL, 0 otherwise */
+} chidb_dbm_vector_t;
+
+/* A batch of consecutive rows of a table. Vector operations only look
+ * at the rows in the selection vector, which starts with all of them
+ * and is narrowed down by chidb_dbm_batch_filter. */
+typedef struct chidb_dbm_batch
+{
+    uint32_t n;                                      /* Rows in the batch */
+    chidb_key_t keys[DBM_BATCH_SIZE];
+    chidb_dbm_vector_t vectors[DBM_BATCH_MAXCOLS];   /* One per scanned column */
+
+    uint16_t sel[DBM_BATCH_SIZE];                    /* Selected rows */
+    uint32_t nsel;
+} chidb_dbm_batch_t;
+
+/* Scans a table B-Tree a batch at a time (see chidb_dbm_scan_next) */
+typedef struct chidb_dbm_scan
+{
+    BTree *bt;
+    uint8_t cols[DBM_BATCH_MAXCOLS];   /* Column of each vector */
+    uint8_t ncols;
+
+    /* Path from the root to the next leaf cell to read: page, next
+     * cell in it (n_cells is the right page of an internal node), and
+     * the keys the page can have */
+    struct
+    {
+        npage_t npage;
+        ncell_t ncell;
+        chidb_key_t lo, hi;
+    } stack[BTREE_MAX_DEPTH];
+    int depth;                         /* -1 when the scan is done */
+
+    uint8_t *buf;                      /* Records with overflow pages */
+    uint32_t bufsize;
+
+    /* Columnar tables (see chidb_dbm_scan_initColumnar) */
+    bool columnar;
+    npage_t nroot;
+    uint32_t nsegment;                 /* Next segment to read */
+    uint32_t nsegments;
+
+    struct
+    {
+        uint8_t vector;
+        opcode_t cmp;
+        int32_t k;
+        struct chidb_zonemap *zone;    /* Zone map of a row table (or NULL) */
+        int32_t min, max;              /* Values that can compare as given */
+    } prune[DBM_BATCH_MAXCOLS];        /* See chidb_dbm_scan_prune */
+    uint8_t nprune;
+    uint32_t nskipped;                 /* Segments (or subtrees) skipped by zone maps */
+    chidb_dbm_vector_t *keys;          /* Primary keys, if not scanned */
+} chidb_dbm_scan_t;
+
+/* Running aggregate of a column over the rows selected in each batch */
+typedef struct chidb_dbm_aggregate
+{
+    uint32_t count;                    /* Non-NULL values */
+    int64_t sum;
+    int32_t min;
+    int32_t max;
+} chidb_dbm_aggregate_t;
+
+int chidb_dbm_scan_init(chidb_dbm_scan_t *scan, BTree *bt, npage_t nroot, const uint8_t *cols, uint8_t ncols);
+int chidb_dbm_scan_initColumnar(chidb_dbm_scan_t *scan, BTree *bt, npage_t nroot, const uint8_t *cols, uint8_t ncols);
+int chidb_dbm_scan_prune(chidb_dbm_scan_t *scan, uint8_t vector, opcode_t cmp, int32_t k);
+int chidb_dbm_scan_next(chidb_dbm_scan_t *scan, chidb_dbm_batch_t *batch);
+void chidb_dbm_scan_free(chidb_dbm_scan_t *scan);
+
+int chidb_dbm_batch_filter(chidb_dbm_batch_t *batch, uint8_t vector, opcode_t cmp, int32_t k);
+void chidb_dbm_aggregate_init(chidb_dbm_aggregate_t *agg);
+void chidb_dbm_batch_aggregate(chidb_dbm_batch_t *batch, uint8_t vector, chidb_dbm_aggregate_t *agg);
+uint32_t chidb_dbm_batch_project(chidb_dbm_batch_t *batch, uint8_t vector, int32_t *out);
+
+#endif /* DBM_BATCH_H_ */
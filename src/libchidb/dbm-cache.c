@@ -0,0 +1,370 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine program cache
+ *
+ * Preparing a statement parses its SQL, optimizes it, and generates its
+ * DBM program. Clients that keep sending the same SQL text would redo
+ * all of that every time, so chidb_prepare keeps the programs it
+ * generates in an LRU cache (one per database), keyed by the SQL text
+ * with its whitespace normalized, and clones a cached program into new
+ * statements instead. Programs depend on the schema (e.g., the root
+ * page of each table), so CreateTable and CreateIndex empty the cache.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <ctype.h>
+#include "dbm-cache.h"
+#include "crc32c.h"
+
+/* Defined in dbm.c */
+int realloc_reg(chidb_stmt *stmt, uint32_t size);
+int realloc_cur(chidb_stmt *stmt, uint32_t size);
+
+
+/* Create an empty program cache
+ *
+ * Parameters
+ * - cache: Out parameter. Returns the new cache.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_cache_init(chidb_dbm_cache_t **cache)
+{
+    *cache = calloc(1, sizeof(chidb_dbm_cache_t));
+    if (*cache == NULL)
+        return CHIDB_ENOMEM;
+
+    return CHIDB_OK;
+}
+
+
+static void chidb_dbm_cache_entry_free(chidb_dbm_cache_entry_t *e)
+{
+    for (uint32_t i = 0; i < e->nOps; i++)
+        free(e->ops[i].p4);
+    for (uint32_t i = 0; i < e->nCols; i++)
+        free(e->cols[i]);
+    free(e->ops);
+    free(e->cols);
+    free(e->sql);
+    free(e);
+}
+
+
+/* Removes an entry from the hash table and the LRU list, and frees it */
+static void chidb_dbm_cache_remove(chidb_dbm_cache_t *cache, chidb_dbm_cache_entry_t *e)
+{
+    chidb_dbm_cache_entry_t **p = &cache->buckets[e->hash % DBM_CACHE_BUCKETS];
+
+    while (*p != e)
+        p = &(*p)->hnext;
+    *p = e->hnext;
+
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        cache->first = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        cache->last = e->prev;
+
+    cache->n--;
+    chidb_dbm_cache_entry_free(e);
+}
+
+
+/* Free a program cache, and all the programs in it
+ *
+ * Parameters
+ * - cache: Cache to free (may be NULL)
+ */
+void chidb_dbm_cache_free(chidb_dbm_cache_t *cache)
+{
+    if (cache == NULL)
+        return;
+
+    chidb_dbm_cache_invalidate(cache);
+    free(cache);
+}
+
+
+/* Remove all the programs from a program cache
+ *
+ * Called when the schema changes, since programs generated for the old
+ * schema may not be valid anymore. The hit and miss counters are kept.
+ *
+ * Parameters
+ * - cache: Cache (may be NULL)
+ */
+void chidb_dbm_cache_invalidate(chidb_dbm_cache_t *cache)
+{
+    if (cache == NULL)
+        return;
+
+    while (cache->first != NULL)
+        chidb_dbm_cache_remove(cache, cache->first);
+}
+
+
+/* Normalize a SQL statement
+ *
+ * Returns the statement with comments dropped and every run of
+ * whitespace outside quotes replaced by a single space, and without
+ * leading and trailing whitespace or semicolons, so that statements
+ * that only differ in their layout share a cache entry. Comments are
+ * dropped the way the lexer skips them: a -- comment ends at the end
+ * of its line, and a comment that is not closed runs to the end of the
+ * statement. Nothing else (e.g., case) is changed, since it may be
+ * significant.
+ *
+ * Parameters
+ * - sql: SQL statement
+ *
+ * Return
+ * - The normalized statement (to be freed by the caller), or NULL if
+ *   memory could not be allocated
+ */
+char *chidb_dbm_cache_normalize(const char *sql)
+{
+    char *norm = malloc(strlen(sql) + 1);
+    char quote = '\0';
+    size_t n = 0;
+
+    if (norm == NULL)
+        return NULL;
+
+    for (const char *c = sql; *c != '\0'; c++)
+    {
+        if (quote != '\0')
+        {
+            if (*c == quote)
+                quote = '\0';
+        }
+        else if (*c == '\'' || *c == '"')
+            quote = *c;
+        else if (isspace((unsigned char) *c) || (c[0] == '-' && c[1] == '-') || (c[0] == '/' && c[1] == '*'))
+        {
+            /* A comment separates tokens like whitespace does */
+            if (c[0] == '-' && c[1] == '-')
+                while (c[1] != '\0' && c[1] != '\n')
+                    c++;
+            else if (c[0] == '/')
+            {
+                for (c += 2; *c != '\0' && !(c[0] == '*' && c[1] == '/'); c++)
+                    ;
+                if (*c == '\0')
+                    break;
+                c++;
+            }
+            if (n > 0 && norm[n - 1] != ' ')
+                norm[n++] = ' ';
+            continue;
+        }
+        norm[n++] = *c;
+    }
+    while (n > 0 && quote == '\0' && (norm[n - 1] == ' ' || norm[n - 1] == ';'))
+        n--;
+    norm[n] = '\0';
+
+    return norm;
+}
+
+
+/* Looks up a normalized statement */
+static chidb_dbm_cache_entry_t *chidb_dbm_cache_lookup(chidb_dbm_cache_t *cache, const char *norm, uint32_t hash)
+{
+    for (chidb_dbm_cache_entry_t *e = cache->buckets[hash % DBM_CACHE_BUCKETS]; e != NULL; e = e->hnext)
+        if (e->hash == hash && strcmp(e->sql, norm) == 0)
+            return e;
+
+    return NULL;
+}
+
+
+/* Get a program from a program cache
+ *
+ * If the program generated for a statement with the same normalized
+ * SQL is in the cache, loads a copy of it (instructions, result row
+ * columns, and number of registers, cursors and parameters) into stmt,
+ * and makes it the most recently used.
+ *
+ * Parameters
+ * - cache: Cache
+ * - sql: SQL statement
+ * - stmt: Statement initialized with chidb_stmt_init, with no program
+ *
+ * Return
+ * - CHIDB_OK: The program was in the cache, and is now in stmt
+ * - CHIDB_ENOTFOUND: The program is not in the cache
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_cache_get(chidb_dbm_cache_t *cache, const char *sql, chidb_stmt *stmt)
+{
+    chidb_dbm_cache_entry_t *e;
+    char *norm;
+    uint32_t hash;
+    int rc;
+
+    norm = chidb_dbm_cache_normalize(sql);
+    if (norm == NULL)
+        return CHIDB_ENOMEM;
+    hash = chidb_crc32c(0, norm, strlen(norm));
+    e = chidb_dbm_cache_lookup(cache, norm, hash);
+    free(norm);
+
+    if (e == NULL)
+    {
+        cache->misses++;
+        return CHIDB_ENOTFOUND;
+    }
+    cache->hits++;
+
+    for (uint32_t i = 0; i < e->nOps; i++)
+        if ((rc = chidb_stmt_set_op(stmt, &e->ops[i], i)) != CHIDB_OK)
+            return rc;
+    if (e->nReg > stmt->nReg && (rc = realloc_reg(stmt, e->nReg)) != CHIDB_OK)
+        return rc;
+    if (e->nCursors > stmt->nCursors && (rc = realloc_cur(stmt, e->nCursors)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_stmt_set_nparams(stmt, e->nParams)) != CHIDB_OK)
+        return rc;
+
+    stmt->cols = malloc(sizeof(char *) * e->nCols);
+    if (e->nCols > 0 && stmt->cols == NULL)
+        return CHIDB_ENOMEM;
+    for (uint32_t i = 0; i < e->nCols; i++)
+        stmt->cols[i] = strdup(e->cols[i]);
+    stmt->nCols = e->nCols;
+    stmt->explain = e->explain;
+
+    /* Move to the front of the LRU list */
+    if (e != cache->first)
+    {
+        e->prev->next = e->next;
+        if (e->next)
+            e->next->prev = e->prev;
+        else
+            cache->last = e->prev;
+        e->prev = NULL;
+        e->next = cache->first;
+        cache->first->prev = e;
+        cache->first = e;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Add a program to a program cache
+ *
+ * Copies the program of a statement that has just been prepared into
+ * the cache, evicting the least recently used program if the cache is
+ * full. Does nothing if the statement is already in the cache.
+ *
+ * Parameters
+ * - cache: Cache
+ * - sql: SQL statement
+ * - stmt: Statement with the program generated for sql
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_cache_put(chidb_dbm_cache_t *cache, const char *sql, chidb_stmt *stmt)
+{
+    chidb_dbm_cache_entry_t *e;
+    char *norm;
+    uint32_t hash;
+
+    norm = chidb_dbm_cache_normalize(sql);
+    if (norm == NULL)
+        return CHIDB_ENOMEM;
+    hash = chidb_crc32c(0, norm, strlen(norm));
+    if (chidb_dbm_cache_lookup(cache, norm, hash) != NULL)
+    {
+        free(norm);
+        return CHIDB_OK;
+    }
+
+    e = calloc(1, sizeof(chidb_dbm_cache_entry_t));
+    if (e == NULL)
+    {
+        free(norm);
+        return CHIDB_ENOMEM;
+    }
+    e->sql = norm;
+    e->hash = hash;
+    e->ops = calloc(stmt->endOp, sizeof(chidb_dbm_op_t));
+    e->cols = calloc(stmt->nCols, sizeof(char *));
+    if ((stmt->endOp > 0 && e->ops == NULL) || (stmt->nCols > 0 && e->cols == NULL))
+    {
+        chidb_dbm_cache_entry_free(e);
+        return CHIDB_ENOMEM;
+    }
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        e->ops[i] = stmt->ops[i];
+        if (stmt->ops[i].p4 != NULL)
+            e->ops[i].p4 = strdup(stmt->ops[i].p4);
+    }
+    e->nOps = stmt->endOp;
+    for (uint32_t i = 0; i < stmt->nCols; i++)
+        e->cols[i] = strdup(stmt->cols[i]);
+    e->nCols = stmt->nCols;
+    e->nReg = stmt->nReg;
+    e->nCursors = stmt->nCursors;
+    e->nParams = stmt->nParams;
+    e->explain = stmt->explain;
+
+    if (cache->n == DBM_CACHE_SIZE)
+        chidb_dbm_cache_remove(cache, cache->last);
+
+    e->hnext = cache->buckets[hash % DBM_CACHE_BUCKETS];
+    cache->buckets[hash % DBM_CACHE_BUCKETS] = e;
+    e->next = cache->first;
+    if (cache->first)
+        cache->first->prev = e;
+    else
+        cache->last = e;
+    cache->first = e;
+    cache->n++;
+
+    return CHIDB_OK;
+}
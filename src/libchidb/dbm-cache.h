@@ -0,0 +1,90 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine program cache -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef DBM_CACHE_H_
+#define DBM_CACHE_H_
+
+#include "chidbInt.h"
+#include "dbm.h"
+
+/* Programs kept in the cache, and buckets of its hash table */
+#define DBM_CACHE_SIZE (64)
+#define DBM_CACHE_BUCKETS (128)
+
+/* A program generated for a SQL statement, ready to be cloned into new
+ * statements (see chidb_dbm_cache_get) */
+typedef struct chidb_dbm_cache_entry
+{
+    char *sql;                  /* Normalized SQL */
+    uint32_t hash;
+
+    chidb_dbm_op_t *ops;
+    uint32_t nOps;
+    uint32_t nReg;
+    uint32_t nCursors;
+    char **cols;
+    uint32_t nCols;
+    uint32_t nParams;
+    bool explain;
+
+    struct chidb_dbm_cache_entry *hnext;         /* Next in the same bucket */
+    struct chidb_dbm_cache_entry *prev, *next;   /* LRU list */
+} chidb_dbm_cache_entry_t;
+
+/* LRU cache of the programs generated for SQL statements, keyed by
+ * their normalized text */
+typedef struct chidb_dbm_cache
+{
+    chidb_dbm_cache_entry_t *buckets[DBM_CACHE_BUCKETS];
+    chidb_dbm_cache_entry_t *first, *last;       /* Most recently used first */
+    uint32_t n;
+
+    uint64_t hits;
+    uint64_t misses;
+} chidb_dbm_cache_t;
+
+int chidb_dbm_cache_init(chidb_dbm_cache_t **cache);
+void chidb_dbm_cache_free(chidb_dbm_cache_t *cache);
+char *chidb_dbm_cache_normalize(const char *sql);
+int chidb_dbm_cache_get(chidb_dbm_cache_t *cache, const char *sql, chidb_stmt *stmt);
+int chidb_dbm_cache_put(chidb_dbm_cache_t *cache, const char *sql, chidb_stmt *stmt);
+void chidb_dbm_cache_invalidate(chidb_dbm_cache_t *cache);
+
+#endif /* DBM_CACHE_H_ */
@@ -39,6 +39,653 @@
 
 
 #include "dbm-cursor.h"
+#include "zonemap.h"
+#include "bloom.h"
 
-/* Your code goes here */
 
+/* A cursor keeps the path from the root of its B-Tree to the entry it is
+ * on, with every node in it pinned. Next and Prev move within the node
+ * at the bottom of the path, and only go up (and down again) when they
+ * run out of entries in it. A seek keeps the top of the path whose nodes
+ * can contain the key (see chidb_dbm_cursor_level_t), and only descends
+ * from there, so seeks to nearby keys don't start from the root.
+ *
+ * Nodes in the path are copies of the pages they were loaded from: once
+ * the B-Tree is modified other than through chidb_dbm_cursor_insert on
+ * this same cursor, the path must be released with
+ * chidb_dbm_cursor_release, and the cursor positioned again. */
+
+
+static inline bool chidb_dbm_cursor_isleaf(BTreeNode *btn)
+{
+    return btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF;
+}
+
+static inline chidb_dbm_cursor_level_t *chidb_dbm_cursor_top(chidb_dbm_cursor_t *c)
+{
+    return &c->path[c->depth - 1];
+}
+
+
+/* Loads a node and adds it to the bottom of the path, with the given
+ * key bounds */
+static int chidb_dbm_cursor_push(chidb_dbm_cursor_t *c, npage_t npage, chidb_dbm_cursor_level_t *bounds)
+{
+    chidb_dbm_cursor_level_t *l;
+    int rc;
+
+    if (c->depth == BTREE_MAX_DEPTH)
+        return CHIDB_ECORRUPT;
+
+    l = &c->path[c->depth];
+    rc = chidb_Btree_getNodeByPage(c->bt, npage, &l->btn);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    l->ncell = 0;
+    l->has_lo = bounds->has_lo;
+    l->lo = bounds->lo;
+    l->has_hi = bounds->has_hi;
+    l->hi = bounds->hi;
+    c->depth++;
+
+    return CHIDB_OK;
+}
+
+/* Removes the bottom node of the path */
+static void chidb_dbm_cursor_pop(chidb_dbm_cursor_t *c)
+{
+    c->depth--;
+    chidb_Btree_freeMemNode(c->bt, c->path[c->depth].btn);
+}
+
+/* Adds the root to an empty path */
+static int chidb_dbm_cursor_pushroot(chidb_dbm_cursor_t *c)
+{
+    chidb_dbm_cursor_level_t unbounded = {.has_lo = false, .has_hi = false};
+
+    return chidb_dbm_cursor_push(c, c->nroot, &unbounded);
+}
+
+/* Adds child i (the right page, if i == n_cells) of the internal node at
+ * the bottom of the path to the path */
+static int chidb_dbm_cursor_descend(chidb_dbm_cursor_t *c, int i)
+{
+    chidb_dbm_cursor_level_t *top = chidb_dbm_cursor_top(c), bounds = *top;
+    BTreeCell cell;
+    npage_t child;
+
+    top->ncell = i;
+    if (i > 0)
+    {
+        chidb_Btree_getCell(top->btn, i - 1, &cell);
+        bounds.has_lo = true;
+        bounds.lo = cell.key;
+    }
+    if (i < top->btn->n_cells)
+    {
+        chidb_Btree_getCell(top->btn, i, &cell);
+        bounds.has_hi = true;
+        bounds.hi = cell.key;
+        child = top->btn->type == PGTYPE_TABLE_INTERNAL ?
+                cell.fields.tableInternal.child_page : cell.fields.indexInternal.child_page;
+    }
+    else
+        child = top->btn->right_page;
+
+    return chidb_dbm_cursor_push(c, child, &bounds);
+}
+
+/* First child, from child i on, of the internal node at the bottom of
+ * the path whose rows can pass the cursor's filter (n_cells + 1 if
+ * there is none). Child i has the keys after separator i - 1, up to
+ * separator i. */
+static int chidb_dbm_cursor_nextchild(chidb_dbm_cursor_t *c, int i)
+{
+    chidb_dbm_cursor_level_t *top = chidb_dbm_cursor_top(c);
+    BTreeCell cell;
+    chidb_key_t after, hi;
+    bool bounded;
+
+    if (c->zone == NULL)
+        return i;
+
+    for (; i <= top->btn->n_cells; i++)
+    {
+        /* The child has the keys after after (if bounded), up to hi */
+        bounded = i > 0 || top->has_lo;
+        after = top->lo;
+        hi = top->has_hi ? top->hi : CHIDB_KEY_MAX;
+        if (i > 0)
+        {
+            chidb_Btree_getCell(top->btn, i - 1, &cell);
+            after = cell.key;
+        }
+        if (i < top->btn->n_cells)
+        {
+            chidb_Btree_getCell(top->btn, i, &cell);
+            hi = cell.key;
+        }
+
+        if ((!bounded || after < CHIDB_KEY_MAX) &&
+            chidb_zonemap_match(c->zone, bounded ? after + 1 : 0, hi, c->zone_min, c->zone_max))
+            return i;
+        c->nskipped++;
+    }
+
+    return i;
+}
+
+/* Extends the path down to the first (or last) entry of the leftmost (or
+ * rightmost) leaf below it. In an empty leaf, ncell is past the end.
+ * Going forward, the subtrees that the cursor's filter rules out are
+ * skipped; if all of them are, ncell is past the end of the internal
+ * node at the bottom of the path. */
+static int chidb_dbm_cursor_descend_edge(chidb_dbm_cursor_t *c, bool last)
+{
+    chidb_dbm_cursor_level_t *top;
+    int i, rc;
+
+    while (!chidb_dbm_cursor_isleaf((top = chidb_dbm_cursor_top(c))->btn))
+    {
+        i = last ? top->btn->n_cells : chidb_dbm_cursor_nextchild(c, 0);
+        if (i > top->btn->n_cells)
+        {
+            top->ncell = top->btn->n_cells;
+            return CHIDB_OK;
+        }
+        rc = chidb_dbm_cursor_descend(c, i);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+    top->ncell = last ? (int) top->btn->n_cells - 1 : 0;
+
+    return CHIDB_OK;
+}
+
+/* Puts the cursor on the cell at the bottom of the path */
+static int chidb_dbm_cursor_load(chidb_dbm_cursor_t *c)
+{
+    chidb_dbm_cursor_level_t *top = chidb_dbm_cursor_top(c);
+
+    chidb_Btree_getCell(top->btn, top->ncell, &c->cell);
+    c->valid = true;
+
+    return CHIDB_OK;
+}
+
+/* Whether the position at the bottom of the path is on an entry (it may
+ * be past either end of a leaf) */
+static inline bool chidb_dbm_cursor_onentry(chidb_dbm_cursor_t *c)
+{
+    chidb_dbm_cursor_level_t *top = chidb_dbm_cursor_top(c);
+
+    return top->ncell >= 0 && top->ncell < top->btn->n_cells;
+}
+
+/* Goes up the path from a node with no entries left after the cursor's
+ * position, until there is a next entry (in an index, that's the
+ * separator after the child the path came from; in a table, it's the
+ * first entry in the next subtree) */
+static int chidb_dbm_cursor_climbnext(chidb_dbm_cursor_t *c)
+{
+    chidb_dbm_cursor_level_t *top;
+    int i, rc;
+
+    while (c->depth > 1)
+    {
+        chidb_dbm_cursor_pop(c);
+        top = chidb_dbm_cursor_top(c);
+        if (top->ncell == top->btn->n_cells)
+            continue;
+
+        if (c->index)
+            return chidb_dbm_cursor_load(c);
+
+        if ((i = chidb_dbm_cursor_nextchild(c, top->ncell + 1)) > top->btn->n_cells)
+        {
+            top->ncell = top->btn->n_cells;
+            continue;
+        }
+        if ((rc = chidb_dbm_cursor_descend(c, i)) != CHIDB_OK ||
+            (rc = chidb_dbm_cursor_descend_edge(c, false)) != CHIDB_OK)
+            return rc;
+        if (chidb_dbm_cursor_onentry(c))
+            return chidb_dbm_cursor_load(c);
+    }
+
+    c->valid = false;
+    return CHIDB_DONE;
+}
+
+/* Same as chidb_dbm_cursor_climbnext, for the previous entry */
+static int chidb_dbm_cursor_climbprev(chidb_dbm_cursor_t *c)
+{
+    chidb_dbm_cursor_level_t *top;
+    int rc;
+
+    while (c->depth > 1)
+    {
+        chidb_dbm_cursor_pop(c);
+        top = chidb_dbm_cursor_top(c);
+        if (top->ncell == 0)
+            continue;
+
+        if (c->index)
+        {
+            top->ncell--;
+            return chidb_dbm_cursor_load(c);
+        }
+
+        if ((rc = chidb_dbm_cursor_descend(c, top->ncell - 1)) != CHIDB_OK ||
+            (rc = chidb_dbm_cursor_descend_edge(c, true)) != CHIDB_OK)
+            return rc;
+        if (chidb_dbm_cursor_onentry(c))
+            return chidb_dbm_cursor_load(c);
+    }
+
+    c->valid = false;
+    return CHIDB_DONE;
+}
+
+
+/* Open a cursor
+ *
+ * The cursor is not on any entry until it is positioned with
+ * chidb_dbm_cursor_rewind, chidb_dbm_cursor_last or
+ * chidb_dbm_cursor_seek.
+ *
+ * Parameters
+ * - c: Cursor to open
+ * - type: CURSOR_READ or CURSOR_WRITE
+ * - bt: B-Tree file
+ * - nroot: Root page of a table or index B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_dbm_cursor_open(chidb_dbm_cursor_t *c, chidb_dbm_cursor_type_t type, BTree *bt, npage_t nroot)
+{
+    BTreeNode *btn;
+    int rc;
+
+    rc = chidb_Btree_getNodeByPage(bt, nroot, &btn);
+    if (rc != CHIDB_OK)
+        return rc;
+    c->index = btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_INDEX_LEAF;
+    chidb_Btree_freeMemNode(bt, btn);
+
+    c->type = type;
+    c->bt = bt;
+    c->nroot = nroot;
+    c->depth = 0;
+    c->valid = false;
+    c->zone = NULL;
+    c->nskipped = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Unpin the nodes in the path of a cursor
+ *
+ * Must be called after the cursor's B-Tree is modified, before the
+ * cursor is positioned again (its entry, if any, is no longer valid).
+ *
+ * Parameters
+ * - c: Cursor
+ */
+void chidb_dbm_cursor_release(chidb_dbm_cursor_t *c)
+{
+    while (c->depth > 0)
+        chidb_dbm_cursor_pop(c);
+    c->valid = false;
+}
+
+
+/* Close a cursor
+ *
+ * Parameters
+ * - c: Cursor to close
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_cursor_close(chidb_dbm_cursor_t *c)
+{
+    chidb_dbm_cursor_release(c);
+    c->type = CURSOR_UNSPECIFIED;
+
+    return CHIDB_OK;
+}
+
+
+/* Position a cursor on the first (or last) entry of its B-Tree
+ *
+ * Parameters
+ * - c: Cursor
+ *
+ * Return
+ * - CHIDB_OK: The cursor is on the first (last) entry
+ * - CHIDB_DONE: The B-Tree is empty
+ * - CHIDB_ECORRUPT: The B-Tree is deeper than BTREE_MAX_DEPTH
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_dbm_cursor_edge(chidb_dbm_cursor_t *c, bool last)
+{
+    int rc;
+
+    chidb_dbm_cursor_release(c);
+    if ((rc = chidb_dbm_cursor_pushroot(c)) != CHIDB_OK ||
+        (rc = chidb_dbm_cursor_descend_edge(c, last)) != CHIDB_OK)
+        return rc;
+
+    if (chidb_dbm_cursor_onentry(c))
+        return chidb_dbm_cursor_load(c);
+
+    return last ? chidb_dbm_cursor_climbprev(c) : chidb_dbm_cursor_climbnext(c);
+}
+
+int chidb_dbm_cursor_rewind(chidb_dbm_cursor_t *c)
+{
+    return chidb_dbm_cursor_edge(c, false);
+}
+
+int chidb_dbm_cursor_last(chidb_dbm_cursor_t *c)
+{
+    return chidb_dbm_cursor_edge(c, true);
+}
+
+
+/* Move a cursor to the next entry of its B-Tree
+ *
+ * Moves within the leaf the cursor is on, without accessing the
+ * B-Tree, except at the end of the leaf.
+ *
+ * Parameters
+ * - c: Cursor
+ *
+ * Return
+ * - CHIDB_OK: The cursor is on the next entry
+ * - CHIDB_DONE: The cursor was on the last entry (or on no entry), and
+ *               is now on no entry
+ * - CHIDB_ECORRUPT: The B-Tree is deeper than BTREE_MAX_DEPTH
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_dbm_cursor_next(chidb_dbm_cursor_t *c)
+{
+    chidb_dbm_cursor_level_t *top;
+    int rc;
+
+    if (!c->valid)
+        return CHIDB_DONE;
+
+    top = chidb_dbm_cursor_top(c);
+    if (!chidb_dbm_cursor_isleaf(top->btn))
+    {
+        /* On a separator of an index: the next entry is the first one
+         * in the child after it */
+        if ((rc = chidb_dbm_cursor_descend(c, top->ncell + 1)) != CHIDB_OK ||
+            (rc = chidb_dbm_cursor_descend_edge(c, false)) != CHIDB_OK)
+            return rc;
+    }
+    else
+        top->ncell++;
+
+    if (chidb_dbm_cursor_onentry(c))
+        return chidb_dbm_cursor_load(c);
+
+    return chidb_dbm_cursor_climbnext(c);
+}
+
+
+/* Move a cursor to the previous entry of its B-Tree
+ *
+ * Same as chidb_dbm_cursor_next, backwards.
+ */
+int chidb_dbm_cursor_prev(chidb_dbm_cursor_t *c)
+{
+    chidb_dbm_cursor_level_t *top;
+    int rc;
+
+    if (!c->valid)
+        return CHIDB_DONE;
+
+    top = chidb_dbm_cursor_top(c);
+    if (!chidb_dbm_cursor_isleaf(top->btn))
+    {
+        if ((rc = chidb_dbm_cursor_descend(c, top->ncell)) != CHIDB_OK ||
+            (rc = chidb_dbm_cursor_descend_edge(c, true)) != CHIDB_OK)
+            return rc;
+    }
+    else
+        top->ncell--;
+
+    if (chidb_dbm_cursor_onentry(c))
+        return chidb_dbm_cursor_load(c);
+
+    return chidb_dbm_cursor_climbprev(c);
+}
+
+
+/* Extends the path down to the node where key is (or must go, which is
+ * a leaf), and stores the position of key in it in *ncell. Returns
+ * CHIDB_OK if key is in that node. */
+static int chidb_dbm_cursor_find(chidb_dbm_cursor_t *c, chidb_key_t key, ncell_t *ncell)
+{
+    chidb_dbm_cursor_level_t *top;
+    int rc;
+
+    /* Keep the part of the path that can contain key. The separators of
+     * an index with normalized keys are not ordered like integers, so
+     * its searches start from the root. */
+    if (c->index && (c->bt->features & BTREE_FEATURE_NORMKEY))
+        while (c->depth > 1)
+            chidb_dbm_cursor_pop(c);
+    while (c->depth > 1)
+    {
+        top = chidb_dbm_cursor_top(c);
+        if ((!top->has_lo || key > top->lo) && (!top->has_hi || key < top->hi))
+            break;
+        chidb_dbm_cursor_pop(c);
+    }
+    if (c->depth == 0 && (rc = chidb_dbm_cursor_pushroot(c)) != CHIDB_OK)
+        return rc;
+
+    for (;;)
+    {
+        top = chidb_dbm_cursor_top(c);
+        rc = chidb_Btree_nodeSearch(top->btn, key, ncell);
+        if (chidb_dbm_cursor_isleaf(top->btn) || (c->index && rc == CHIDB_OK))
+            return rc;
+        if ((rc = chidb_dbm_cursor_descend(c, *ncell)) != CHIDB_OK)
+            return rc;
+    }
+}
+
+/* Position a cursor on the first entry with a key >= key */
+static int chidb_dbm_cursor_seekge(chidb_dbm_cursor_t *c, chidb_key_t key)
+{
+    ncell_t i;
+    int rc;
+
+    rc = chidb_dbm_cursor_find(c, key, &i);
+    if (rc != CHIDB_OK && rc != CHIDB_ENOTFOUND)
+        return rc;
+    chidb_dbm_cursor_top(c)->ncell = i;
+
+    if (chidb_dbm_cursor_onentry(c))
+        return chidb_dbm_cursor_load(c);
+
+    return chidb_dbm_cursor_climbnext(c);
+}
+
+
+/* Position a cursor by key
+ *
+ * Positions the cursor on the entry with the given key (CURSOR_SEEK_EQ),
+ * or on the first entry with a key greater than or equal to it
+ * (CURSOR_SEEK_GE), ..., or on the last entry with a key less than it
+ * (CURSOR_SEEK_LT). In an index, keys are keyIdx.
+ *
+ * Parameters
+ * - c: Cursor
+ * - key: Key
+ * - mode: CURSOR_SEEK_EQ, CURSOR_SEEK_GE, CURSOR_SEEK_GT, CURSOR_SEEK_LE
+ *         or CURSOR_SEEK_LT
+ *
+ * With CURSOR_SEEK_EQ, a key that the Bloom filter of the B-Tree (if
+ * it has one, see bloom.c) says is not in it is not looked for.
+ *
+ * Return
+ * - CHIDB_OK: The cursor is on the entry
+ * - CHIDB_DONE: There is no such entry (with CURSOR_SEEK_EQ, the cursor
+ *               may be left on the first entry with a greater key, or on
+ *               no entry)
+ * - CHIDB_ECORRUPT: The B-Tree is deeper than BTREE_MAX_DEPTH
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_dbm_cursor_seek(chidb_dbm_cursor_t *c, chidb_key_t key, chidb_dbm_seek_t mode)
+{
+    bool maybe;
+    int rc;
+
+    /* A key that the B-Tree's Bloom filter rules out is not looked for */
+    if (mode == CURSOR_SEEK_EQ)
+    {
+        if ((rc = chidb_bloom_lookup(c->bt, c->nroot, key, &maybe)) != CHIDB_OK)
+            return rc;
+        if (!maybe)
+        {
+            chidb_dbm_cursor_release(c);
+            return CHIDB_DONE;
+        }
+    }
+
+    rc = chidb_dbm_cursor_seekge(c, key);
+    if (rc != CHIDB_OK && rc != CHIDB_DONE)
+        return rc;
+
+    switch (mode)
+    {
+    case CURSOR_SEEK_EQ:
+        return (rc == CHIDB_OK && c->cell.key == key) ? CHIDB_OK : CHIDB_DONE;
+    case CURSOR_SEEK_GE:
+        return rc;
+    case CURSOR_SEEK_GT:
+        return (rc == CHIDB_OK && c->cell.key == key) ? chidb_dbm_cursor_next(c) : rc;
+    case CURSOR_SEEK_LE:
+        if (rc == CHIDB_OK && c->cell.key == key)
+            return CHIDB_OK;
+        /* Fall through */
+    case CURSOR_SEEK_LT:
+        return rc == CHIDB_OK ? chidb_dbm_cursor_prev(c) : chidb_dbm_cursor_last(c);
+    default:
+        return CHIDB_EMISUSE;
+    }
+}
+
+
+/* Insert an entry through a cursor
+ *
+ * Inserts a cell into the cursor's B-Tree, reusing the part of the
+ * cursor's path that can contain its key, as chidb_dbm_cursor_seek
+ * does. A run of insertions with nearby keys (e.g., the rows of a
+ * multi-row INSERT, in key order) goes into the leaf at the bottom of
+ * the path without descending from the root again.
+ *
+ * If the leaf can take the cell, only the leaf is modified, through the
+ * node in the path, so the path stays valid. Otherwise the path is
+ * released and the cell is inserted with chidb_Btree_insertLatched,
+ * which splits nodes. Either way, the cursor is left on no entry.
+ *
+ * Parameters
+ * - c: Write cursor
+ * - cell: Cell to insert (a table leaf cell with overflow pages must
+ *         already be spilled)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_EMISUSE: The cursor is not a write cursor
+ * - CHIDB_ECORRUPT: The B-Tree is deeper than BTREE_MAX_DEPTH
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_dbm_cursor_insert(chidb_dbm_cursor_t *c, BTreeCell *cell)
+{
+    chidb_dbm_cursor_level_t *top;
+    ncell_t i;
+    int rc;
+
+    if (c->type != CURSOR_WRITE)
+        return CHIDB_EMISUSE;
+    c->valid = false;
+
+    rc = chidb_dbm_cursor_find(c, cell->key, &i);
+    if (rc == CHIDB_OK)
+        return CHIDB_EDUPLICATE;
+    if (rc != CHIDB_ENOTFOUND)
+        return rc;
+
+    top = chidb_dbm_cursor_top(c);
+    if (!chidb_Btree_nodeFull(c->bt, top->btn, cell))
+    {
+        if ((rc = chidb_bloom_insert(c->bt, c->nroot, cell->key)) != CHIDB_OK)
+        {
+            chidb_dbm_cursor_release(c);
+            return rc;
+        }
+        if (!c->index)
+            chidb_zonemap_insert(c->bt, c->nroot, cell);
+        rc = chidb_Btree_insertCell(top->btn, i, cell);
+        if (rc == CHIDB_OK)
+            rc = chidb_Btree_writeNode(c->bt, top->btn);
+        if (rc != CHIDB_OK)
+            chidb_dbm_cursor_release(c);
+        return rc;
+    }
+
+    chidb_dbm_cursor_release(c);
+    return chidb_Btree_insertLatched(c->bt, c->nroot, cell);
+}
+
+
+/* Skip the rows whose column can't be in an interval
+ *
+ * From then on, whenever the cursor moves forward to another leaf
+ * (chidb_dbm_cursor_rewind, chidb_dbm_cursor_next, or
+ * chidb_dbm_cursor_seek past the end of a leaf), it skips every subtree
+ * of the B-Tree where, according to a zone map of one of its columns,
+ * no row has a value of the column from min to max, and counts them in
+ * c->nskipped. Rows that are not in the interval can still be returned
+ * (the zone map only tells which subtrees can't have any that are), so
+ * the condition must still be checked on each row. Moving backwards
+ * doesn't skip anything.
+ *
+ * Parameters
+ * - c: Cursor on a table
+ * - zm: Zone map of the table that is up to date (see
+ *       chidb_zonemap_get), or NULL to skip nothing
+ * - min, max: Interval (see chidb_zonemap_interval)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The cursor is on an index
+ */
+int chidb_dbm_cursor_filter(chidb_dbm_cursor_t *c, struct chidb_zonemap *zm, int32_t min, int32_t max)
+{
+    if (c->index && zm != NULL)
+        return CHIDB_EMISUSE;
+
+    c->zone = zm;
+    c->zone_min = min;
+    c->zone_max = max;
+
+    return CHIDB_OK;
+}
@@ -51,15 +51,63 @@ typedef enum chidb_dbm_cursor_type
     CURSOR_WRITE
 } chidb_dbm_cursor_type_t;
 
+/* A level of the path of a cursor: a node, pinned for as long as it is
+ * in the path, and the position in it. In the node the cursor is on,
+ * ncell is its cell. In the nodes above it, ncell is the child that the
+ * path goes through (n_cells is the right page). lo and hi bound the
+ * keys in the node (lo < key < hi), as given by the separators above it,
+ * so that a seek can tell which part of the path it can reuse. */
+typedef struct chidb_dbm_cursor_level
+{
+    BTreeNode *btn;
+    int ncell;
+    bool has_lo, has_hi;
+    chidb_key_t lo, hi;
+} chidb_dbm_cursor_level_t;
+
+/* Where chidb_dbm_cursor_seek positions a cursor: on the entry with
+ * key equal to, greater than or equal to, ... the given key */
+typedef enum chidb_dbm_seek
+{
+    CURSOR_SEEK_EQ,
+    CURSOR_SEEK_GE,
+    CURSOR_SEEK_GT,
+    CURSOR_SEEK_LE,
+    CURSOR_SEEK_LT
+} chidb_dbm_seek_t;
+
 typedef struct chidb_dbm_cursor
 {
     chidb_dbm_cursor_type_t type;
 
-    /* Your code goes here */
+    BTree *bt;
+    npage_t nroot;
+    bool index;                    /* Index B-Tree (entries in internal nodes too) */
+
+    /* Path from the root to the node with the entry the cursor is on */
+    chidb_dbm_cursor_level_t path[BTREE_MAX_DEPTH];
+    int depth;                     /* Levels in path (0 if there is no path) */
+
+    bool valid;                    /* The cursor is on an entry */
+    BTreeCell cell;                /* The entry (if valid) */
+
+    /* Zone map that Next skips subtrees with (see chidb_dbm_cursor_filter) */
+    struct chidb_zonemap *zone;    /* NULL if there is none */
+    int32_t zone_min, zone_max;
+    uint32_t nskipped;             /* Subtrees skipped */
 
 } chidb_dbm_cursor_t;
 
-/* Cursor function definitions go here */
+int chidb_dbm_cursor_open(chidb_dbm_cursor_t *c, chidb_dbm_cursor_type_t type, BTree *bt, npage_t nroot);
+int chidb_dbm_cursor_close(chidb_dbm_cursor_t *c);
+void chidb_dbm_cursor_release(chidb_dbm_cursor_t *c);
+int chidb_dbm_cursor_rewind(chidb_dbm_cursor_t *c);
+int chidb_dbm_cursor_last(chidb_dbm_cursor_t *c);
+int chidb_dbm_cursor_next(chidb_dbm_cursor_t *c);
+int chidb_dbm_cursor_prev(chidb_dbm_cursor_t *c);
+int chidb_dbm_cursor_seek(chidb_dbm_cursor_t *c, chidb_key_t key, chidb_dbm_seek_t mode);
+int chidb_dbm_cursor_insert(chidb_dbm_cursor_t *c, BTreeCell *cell);
+int chidb_dbm_cursor_filter(chidb_dbm_cursor_t *c, struct chidb_zonemap *zm, int32_t min, int32_t max);
 
 
 #endif /* DBM_CURSOR_H_ */
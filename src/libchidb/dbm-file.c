@@ -75,7 +75,7 @@ typedef enum dbm_file_program_type
 int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt);
 
 /* Implemented in optimizer.c */
-int chidb_stmt_optimize(chidb_stmt *stmt, chisql_statement_t *sql_stmt, chisql_statement_t **sql_stmt_opt);
+int chidb_stmt_optimize(chidb *db, chisql_statement_t *sql_stmt, chisql_statement_t **sql_stmt_opt);
 
 
 int __chidb_dbm_file_read_line(FILE *f, char* line)
@@ -193,6 +193,7 @@ int __chidb_dbm_file_load_db(chidb_dbm_file_t *dbmf, char *line, const char* dbf
         // "Could not open chidb file %s", line
         return CHIDB_ENOMEM;
     }
+    dbmf->close_db = true;
 
     free(linedup);
     return CHIDB_OK;
@@ -266,6 +267,7 @@ int __chidb_dbm_file_parse_register(char *line, chidb_dbm_file_register_t *reg)
 
     reg->nReg = nReg;
     reg->has_value = false;
+    reg->reg.storage = REG_BORROWED;
 
     if (strcmp(tokens[1], "unspecified") == 0)
     {
@@ -359,7 +361,7 @@ int __chidb_dbm_file_load(const char* filename, chidb_dbm_file_t **_dbmf, chidb
     dbm_file_program_type_t program_type = UNKNOWN;
     chidb_dbm_file_t *dbmf;
 
-    *_dbmf = malloc(sizeof(chidb_dbm_file_t));
+    *_dbmf = calloc(1, sizeof(chidb_dbm_file_t));
 
     dbmf = *_dbmf;
 
@@ -445,14 +447,24 @@ int __chidb_dbm_file_load(const char* filename, chidb_dbm_file_t **_dbmf, chidb
         	        return rc;
         	    }
 
-        	    rc = chidb_stmt_optimize(&dbmf->stmt, sql_stmt, &sql_stmt_opt);
+        	    rc = chidb_stmt_optimize(dbmf->db, sql_stmt, &sql_stmt_opt);
 
         	    if(rc != CHIDB_OK)
         	    {
+        	        chisql_stmt_free(sql_stmt);
         	        return rc;
         	    }
 
         	    rc = chidb_stmt_codegen(&dbmf->stmt, sql_stmt_opt);
+        	    free(sql_stmt_opt);
+        	    chisql_stmt_free(sql_stmt);
+
+        	    if(rc != CHIDB_OK)
+        	    {
+        	        return rc;
+        	    }
+
+        	    rc = chidb_stmt_peephole(&dbmf->stmt);
 
         	    if(rc != CHIDB_OK)
         	    {
@@ -529,11 +541,233 @@ int chidb_dbm_file_close(chidb_dbm_file_t *dbmf)
 
     free(dbmf->filename);
 
+    if(dbmf->stmt.db != NULL)
+        chidb_stmt_free(&dbmf->stmt);
+
+    if(dbmf->close_db)
+        chidb_close(dbmf->db);
+
     if(dbmf->delete_dbfile)
     {
         remove(dbmf->dbfile);
     }
 
+    free(dbmf);
+
+    return CHIDB_OK;
+}
+
+
+
+static int __chidb_dbm_file_cmp_ns(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Runs a DBM file to completion */
+static int __chidb_dbm_file_run_all(chidb_dbm_file_t *dbmf)
+{
+    int rc;
+
+    while ((rc = chidb_dbm_file_run(dbmf)) == CHIDB_ROW)
+        ;
+
+    return rc == CHIDB_DONE ? CHIDB_OK : rc;
+}
+
+/* Benchmarks a DBM file
+ *
+ * Loads the file nruns times, with a fresh copy of its database each
+ * time (see copyOnUse in chidb_dbm_file_load2), and times running it to
+ * completion. Then, it runs it once more, profiled (see
+ * chidb_profile_start), to count the instructions it executes. The
+ * copies of the database are removed.
+ *
+ * Parameters
+ * - filename: DBM file
+ * - dbfiledir: Directory with the databases the DBM file uses
+ * - genfiledir: Directory for the copies of the database
+ * - nruns: Number of timed runs (at least one)
+ * - bench: Out parameter. Must be freed with chidb_dbm_file_bench_free.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: nruns is zero
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Any error code returned by chidb_dbm_file_load2 or while running
+ *   the program.
+ */
+int chidb_dbm_file_bench(const char* filename, const char* dbfiledir, const char* genfiledir,
+                         unsigned int nruns, chidb_dbm_file_bench_t *bench)
+{
+    chidb_dbm_file_t *dbmf;
+    const chidb_profile_op *profile;
+    char dbfile[MAX_FILENAME_SIZE];
+    uint64_t *ns;
+    int rc = CHIDB_OK, nops;
+
+    memset(bench, 0, sizeof(chidb_dbm_file_bench_t));
+    if (nruns == 0)
+        return CHIDB_EMISUSE;
+
+    ns = malloc(nruns * sizeof(uint64_t));
+    bench->nopcodes = Op_Halt + 1;
+    bench->opcounts = calloc(bench->nopcodes, sizeof(uint64_t));
+    if (ns == NULL || bench->opcounts == NULL)
+    {
+        free(ns);
+        chidb_dbm_file_bench_free(bench);
+        return CHIDB_ENOMEM;
+    }
+
+    /* nruns timed runs, and a profiled one */
+    for (unsigned int i = 0; i <= nruns && rc == CHIDB_OK; i++)
+    {
+        rc = chidb_dbm_file_load2(filename, &dbmf, dbfiledir, genfiledir, true);
+        if (rc != CHIDB_OK)
+            break;
+
+        if (bench->program == NULL)
+            bench->program = strdup(dbmf->filename);
+
+        if (i < nruns)
+        {
+            uint64_t start = chidb_time_ns();
+            rc = __chidb_dbm_file_run_all(dbmf);
+            ns[i] = chidb_time_ns() - start;
+        }
+        else if ((rc = chidb_profile_start(&dbmf->stmt)) == CHIDB_OK &&
+                 (rc = __chidb_dbm_file_run_all(dbmf)) == CHIDB_OK)
+        {
+            profile = chidb_profile_get(&dbmf->stmt, &nops);
+            for (int pc = 0; pc < nops; pc++)
+            {
+                bench->opcounts[dbmf->stmt.ops[pc].opcode] += profile[pc].count;
+                bench->ninstr += profile[pc].count;
+            }
+        }
+
+        strcpy(dbfile, dbmf->dbfile);
+        chidb_dbm_file_close(dbmf);
+        remove(dbfile);
+    }
+
+    if (rc != CHIDB_OK)
+    {
+        free(ns);
+        chidb_dbm_file_bench_free(bench);
+        return rc;
+    }
+
+    qsort(ns, nruns, sizeof(uint64_t), __chidb_dbm_file_cmp_ns);
+    bench->nruns = nruns;
+    bench->min_ns = ns[0];
+    bench->median_ns = ns[nruns / 2];
+    free(ns);
+
+    return CHIDB_OK;
+}
+
+/* Prints the timings of a DBM file
+ *
+ * Prints a line with tab-separated fields, as make bench does (see
+ * tests/bench.c): "dbm_program", the name of the program, the number
+ * of instructions of a run, and the nanoseconds per instruction; then
+ * the median and fastest time of a run, in nanoseconds, the number of
+ * runs, and the instructions by opcode (e.g. "Column:4,Next:2").
+ * Saved, these lines are a baseline for chidb_dbm_file_bench_compare.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_file_bench_print(FILE *f, chidb_dbm_file_bench_t *bench)
+{
+    bool first = true;
+
+    fprintf(f, "dbm_program\t%s\t%lu\t%.1f\t%lu\t%lu\t%u\t", bench->program,
+            (unsigned long) bench->ninstr,
+            bench->ninstr ? (double) bench->median_ns / bench->ninstr : 0.0,
+            (unsigned long) bench->median_ns, (unsigned long) bench->min_ns, bench->nruns);
+
+    for (int op = 0; op < bench->nopcodes; op++)
+        if (bench->opcounts[op] > 0)
+        {
+            fprintf(f, "%s%s:%lu", first ? "" : ",", opcode_to_str(op), (unsigned long) bench->opcounts[op]);
+            first = false;
+        }
+    fprintf(f, "\n");
+
     return CHIDB_OK;
 }
 
+/* Compares the timings of a DBM file with a baseline
+ *
+ * Looks for the program in a file with lines printed by
+ * chidb_dbm_file_bench_print (other lines are ignored), and prints a
+ * line with tab-separated fields: "dbm_baseline", the name of the
+ * program, the median time of a run in the baseline and now, their
+ * ratio, the number of instructions of a run in the baseline and now,
+ * and a verdict: "slower" or "faster" if the median time changed by
+ * more than tolerance (e.g. 0.1 for 10%), "same" otherwise, or "new"
+ * if the program is not in the baseline.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The program is slower than in the baseline
+ * - CHIDB_EIO: Could not read the baseline
+ */
+int chidb_dbm_file_bench_compare(FILE *f, const char *baseline, chidb_dbm_file_bench_t *bench, double tolerance)
+{
+    char line[4096];
+    unsigned long base_ns = 0, base_instr = 0;
+    bool found = false;
+    const char *verdict;
+    double ratio = 0.0;
+    FILE *bf;
+
+    bf = fopen(baseline, "r");
+    if (bf == NULL)
+        return CHIDB_EIO;
+
+    while (!found && fgets(line, sizeof(line), bf) != NULL)
+    {
+        char *fields[5];
+        char *s = line;
+        int n;
+
+        for (n = 0; n < 5 && s != NULL; n++)
+            fields[n] = strsep(&s, "\t");
+
+        if (n == 5 && s != NULL && !strcmp(fields[0], "dbm_program") && !strcmp(fields[1], bench->program))
+        {
+            base_instr = strtoul(fields[2], NULL, 10);
+            base_ns = strtoul(fields[4], NULL, 10);
+            found = true;
+        }
+    }
+    fclose(bf);
+
+    if (!found)
+        verdict = "new";
+    else
+    {
+        ratio = base_ns ? (double) bench->median_ns / base_ns : 1.0;
+        verdict = ratio > 1.0 + tolerance ? "slower" : ratio < 1.0 - tolerance ? "faster" : "same";
+    }
+
+    fprintf(f, "dbm_baseline\t%s\t%lu\t%lu\t%.3f\t%lu\t%lu\t%s\n", bench->program,
+            base_ns, (unsigned long) bench->median_ns, ratio,
+            base_instr, (unsigned long) bench->ninstr, verdict);
+
+    return strcmp(verdict, "slower") ? CHIDB_OK : CHIDB_EMISMATCH;
+}
+
+void chidb_dbm_file_bench_free(chidb_dbm_file_bench_t *bench)
+{
+    free(bench->program);
+    free(bench->opcounts);
+    bench->program = NULL;
+    bench->opcounts = NULL;
+}
@@ -62,6 +62,7 @@ typedef struct chidb_dbm_file
 
     char dbfile[MAX_FILENAME_SIZE];
     bool delete_dbfile;
+    bool close_db;      /* db was opened by chidb_dbm_file_load2 */
     bool copyOnUse;
 } chidb_dbm_file_t;
 
@@ -0,0 +1,658 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine hash joins
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "dbm-hash.h"
+#include "dbm.h"
+
+/* A row in the buffer of a hash table, followed by its values (len
+ * bytes, padded to a multiple of 4). Rows are referred to by their
+ * offset in the buffer + 1, so that 0 means no row. */
+typedef struct chidb_dbm_hash_row
+{
+    uint32_t next;      /* Next row with the same key */
+    uint32_t hash;
+    uint32_t len;
+} chidb_dbm_hash_row_t;
+
+#define HASH_ROW(h, ref) ((chidb_dbm_hash_row_t *) ((h)->buf + (ref) - 1))
+#define HASH_ROW_DATA(row) ((uint8_t *) ((row) + 1))
+#define HASH_ALIGN(len) (((len) + 3) & ~3u)
+
+/* Partition of a row, from the top bits of its hash (the bottom ones
+ * pick its slot) */
+#define HASH_PARTITION(hash) ((hash) / (UINT32_MAX / DBM_HASH_NPARTITIONS + 1))
+
+#define HASH_MIN_SLOTS (16)
+
+
+/*** Keys ***/
+
+/* Hash of the key (the first value) of a row, serialized with
+ * chidb_dbm_reg_serialize */
+static uint32_t hash_key(const uint8_t *v)
+{
+    uint32_t n = chidb_dbm_reg_serialsize(v), hash = 2166136261u;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        hash ^= v[i];
+        hash *= 16777619u;
+    }
+
+    /* FNV-1a leaves the top bits, which pick the partition, poorly
+     * mixed: finish with the MurmurHash3 finalizer */
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+static bool hash_keyEq(const uint8_t *v1, const uint8_t *v2)
+{
+    uint32_t n = chidb_dbm_reg_serialsize(v1);
+
+    return n == chidb_dbm_reg_serialsize(v2) && memcmp(v1, v2, n) == 0;
+}
+
+
+/*** Table ***/
+
+static int hash_growSlots(chidb_dbm_hash_t *h)
+{
+    uint32_t nslots = h->nslots * 2, mask = nslots - 1;
+    chidb_dbm_hash_slot_t *slots = calloc(nslots, sizeof(chidb_dbm_hash_slot_t));
+
+    if (slots == NULL)
+        return CHIDB_ENOMEM;
+
+    for (uint32_t i = 0; i < h->nslots; i++)
+    {
+        uint32_t idx;
+
+        if (h->slots[i].row == 0)
+            continue;
+        for (idx = h->slots[i].hash & mask; slots[idx].row != 0; idx = (idx + 1) & mask)
+            ;
+        slots[idx] = h->slots[i];
+    }
+
+    free(h->slots);
+    h->slots = slots;
+    h->nslots = nslots;
+
+    return CHIDB_OK;
+}
+
+/* Adds a row to the buffer, and to the slot of its key */
+static int hash_append(chidb_dbm_hash_t *h, uint32_t hash, const uint8_t *data, uint32_t len)
+{
+    uint32_t need = sizeof(chidb_dbm_hash_row_t) + HASH_ALIGN(len), mask, idx, ref;
+    chidb_dbm_hash_row_t *row;
+    int rc;
+
+    if (h->used + need > h->size)
+    {
+        uint32_t size = h->size ? h->size * 2 : 4096;
+        uint8_t *buf;
+
+        while (size < h->used + need)
+            size *= 2;
+        if ((buf = realloc(h->buf, size)) == NULL)
+            return CHIDB_ENOMEM;
+        h->buf = buf;
+        h->size = size;
+    }
+
+    ref = h->used + 1;
+    row = HASH_ROW(h, ref);
+    row->next = 0;
+    row->hash = hash;
+    row->len = len;
+    memcpy(HASH_ROW_DATA(row), data, len);
+    h->used += need;
+
+    /* At most half of the slots are used, so probes stay short */
+    if ((h->nkeys + 1) * 2 > h->nslots && (rc = hash_growSlots(h)) != CHIDB_OK)
+        return rc;
+
+    mask = h->nslots - 1;
+    for (idx = hash & mask; h->slots[idx].row != 0; idx = (idx + 1) & mask)
+    {
+        if (h->slots[idx].hash == hash &&
+            hash_keyEq(HASH_ROW_DATA(HASH_ROW(h, h->slots[idx].row)), data))
+        {
+            row->next = h->slots[idx].row;
+            h->slots[idx].row = ref;
+            return CHIDB_OK;
+        }
+    }
+
+    h->slots[idx].hash = hash;
+    h->slots[idx].row = ref;
+    h->nkeys++;
+
+    return CHIDB_OK;
+}
+
+/* Returns the first row with the key of data, or 0 if there is none */
+static uint32_t hash_lookup(chidb_dbm_hash_t *h, uint32_t hash, const uint8_t *data)
+{
+    uint32_t mask = h->nslots - 1;
+
+    for (uint32_t idx = hash & mask; h->slots[idx].row != 0; idx = (idx + 1) & mask)
+        if (h->slots[idx].hash == hash &&
+            hash_keyEq(HASH_ROW_DATA(HASH_ROW(h, h->slots[idx].row)), data))
+            return h->slots[idx].row;
+
+    return 0;
+}
+
+static void hash_clear(chidb_dbm_hash_t *h)
+{
+    h->used = 0;
+    h->nkeys = 0;
+    h->match = 0;
+    memset(h->slots, 0, h->nslots * sizeof(chidb_dbm_hash_slot_t));
+}
+
+/* Makes room for len bytes in h->row (a row being inserted or probed,
+ * or read from a partition) */
+static int hash_reserve(chidb_dbm_hash_t *h, uint32_t len)
+{
+    uint8_t *row;
+
+    if (len <= h->rowsize)
+        return CHIDB_OK;
+    if ((row = realloc(h->row, len)) == NULL)
+        return CHIDB_ENOMEM;
+    h->row = row;
+    h->rowsize = len;
+
+    return CHIDB_OK;
+}
+
+
+/*** Partitions ***/
+
+/* Rows are written to the file of their partition as their hash and
+ * length, followed by their values */
+static int hash_write(FILE *f, uint32_t hash, const uint8_t *data, uint32_t len)
+{
+    if (fwrite(&hash, sizeof(hash), 1, f) != 1 ||
+        fwrite(&len, sizeof(len), 1, f) != 1 ||
+        fwrite(data, 1, len, f) != len)
+        return CHIDB_EIO;
+
+    return CHIDB_OK;
+}
+
+/* Reads the next row of a partition file into h->row. Sets *read to
+ * false at the end of the file. */
+static int hash_read(chidb_dbm_hash_t *h, FILE *f, uint32_t *hash, bool *read)
+{
+    uint32_t len;
+    int rc;
+
+    *read = false;
+    if (fread(hash, sizeof(*hash), 1, f) != 1)
+        return ferror(f) ? CHIDB_EIO : CHIDB_OK;
+    if (fread(&len, sizeof(len), 1, f) != 1)
+        return CHIDB_EIO;
+    if ((rc = hash_reserve(h, len)) != CHIDB_OK)
+        return rc;
+    if (fread(h->row, 1, len, f) != len)
+        return CHIDB_EIO;
+
+    h->rowlen = len;
+    *read = true;
+
+    return CHIDB_OK;
+}
+
+/* Splits the rows in memory into partitions: those in partition 0 are
+ * kept, and the others are written to their files */
+static int hash_spill(chidb_dbm_hash_t *h)
+{
+    uint8_t *buf = h->buf;
+    uint32_t used = h->used;
+    int rc = CHIDB_OK;
+
+    for (int p = 1; p < DBM_HASH_NPARTITIONS; p++)
+        if ((h->build[p] = chidb_dbm_tmpfile()) == NULL || (h->probe[p] = chidb_dbm_tmpfile()) == NULL)
+            return CHIDB_EIO;
+
+    h->buf = NULL;
+    h->size = 0;
+    hash_clear(h);
+    h->spilled = true;
+
+    for (uint32_t off = 0; off < used && rc == CHIDB_OK; )
+    {
+        chidb_dbm_hash_row_t *row = (chidb_dbm_hash_row_t *) (buf + off);
+        uint32_t p = HASH_PARTITION(row->hash);
+
+        if (p == 0)
+            rc = hash_append(h, row->hash, HASH_ROW_DATA(row), row->len);
+        else
+            rc = hash_write(h->build[p], row->hash, HASH_ROW_DATA(row), row->len);
+        off += sizeof(chidb_dbm_hash_row_t) + HASH_ALIGN(row->len);
+    }
+
+    free(buf);
+    return rc;
+}
+
+/*** Bloom filter ***/
+
+/* Adds the hash of a build key to the filter, or keeps it for when the
+ * filter is made */
+static int hash_addKey(chidb_dbm_hash_t *h, uint32_t hash)
+{
+    if (h->bloom.nblocks != 0)
+    {
+        chidb_bloom_add(&h->bloom, chidb_bloom_hash(hash));
+        return CHIDB_OK;
+    }
+
+    if (h->nhashes == h->hashsize)
+    {
+        uint32_t size = h->hashsize == 0 ? HASH_MIN_SLOTS : h->hashsize * 2;
+        uint32_t *hashes = realloc(h->hashes, size * sizeof(uint32_t));
+
+        if (hashes == NULL)
+            return CHIDB_ENOMEM;
+        h->hashes = hashes;
+        h->hashsize = size;
+    }
+    h->hashes[h->nhashes++] = hash;
+
+    return CHIDB_OK;
+}
+
+/* Makes the filter from the hashes of the build keys, the first time
+ * the table is probed */
+static int hash_seal(chidb_dbm_hash_t *h)
+{
+    int rc;
+
+    if (h->bloom.nblocks != 0)
+        return CHIDB_OK;
+    if ((rc = chidb_bloom_init(&h->bloom, chidb_bloom_nblocks(h->nhashes))) != CHIDB_OK)
+        return rc;
+
+    for (uint32_t i = 0; i < h->nhashes; i++)
+        chidb_bloom_add(&h->bloom, chidb_bloom_hash(h->hashes[i]));
+    free(h->hashes);
+    h->hashes = NULL;
+    h->nhashes = h->hashsize = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Moves to the first match of the next probe row of the spilled
+ * partitions, loading the next partition into memory when the probe
+ * rows of the current one are done */
+static int hash_advance(chidb_dbm_hash_t *h, bool *found)
+{
+    uint32_t hash;
+    bool read;
+    int rc;
+
+    for (;;)
+    {
+        if (h->part > 0)
+        {
+            while ((rc = hash_read(h, h->probe[h->part], &hash, &read)) == CHIDB_OK && read)
+            {
+                if ((h->match = hash_lookup(h, hash, h->row)) != 0)
+                {
+                    *found = true;
+                    return CHIDB_OK;
+                }
+            }
+            if (rc != CHIDB_OK)
+                return rc;
+        }
+
+        if (++h->part == DBM_HASH_NPARTITIONS)
+        {
+            *found = false;
+            return CHIDB_OK;
+        }
+
+        hash_clear(h);
+        rewind(h->build[h->part]);
+        while ((rc = hash_read(h, h->build[h->part], &hash, &read)) == CHIDB_OK && read)
+            if ((rc = hash_append(h, hash, h->row, h->rowlen)) != CHIDB_OK)
+                return rc;
+        if (rc != CHIDB_OK)
+            return rc;
+        rewind(h->probe[h->part]);
+    }
+}
+
+
+/*** Interface ***/
+
+/* Create a hash table
+ *
+ * Parameters
+ * - h: Hash table to initialize
+ * - nbuild: Values in a row of the build side
+ * - nprobe: Values in a row of the probe side
+ * - budget: Bytes of rows to keep in memory before spilling partitions
+ *           to temporary files (usually DBM_HASH_BUDGET)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_hash_init(chidb_dbm_hash_t *h, uint32_t nbuild, uint32_t nprobe, size_t budget)
+{
+    memset(h, 0, sizeof(chidb_dbm_hash_t));
+
+    h->slots = calloc(HASH_MIN_SLOTS, sizeof(chidb_dbm_hash_slot_t));
+    if (h->slots == NULL)
+        return CHIDB_ENOMEM;
+    h->nslots = HASH_MIN_SLOTS;
+    h->nbuild = nbuild;
+    h->nprobe = nprobe;
+    h->budget = budget;
+
+    return CHIDB_OK;
+}
+
+
+/* Free a hash table, and delete its partition files */
+void chidb_dbm_hash_free(chidb_dbm_hash_t *h)
+{
+    for (int p = 0; p < DBM_HASH_NPARTITIONS; p++)
+    {
+        if (h->build[p] != NULL)
+            fclose(h->build[p]);
+        if (h->probe[p] != NULL)
+            fclose(h->probe[p]);
+    }
+    free(h->buf);
+    free(h->slots);
+    free(h->row);
+    free(h->hashes);
+    chidb_bloom_free(&h->bloom);
+    memset(h, 0, sizeof(chidb_dbm_hash_t));
+}
+
+
+/* Add a row of the build side to a hash table
+ *
+ * Rows with a NULL key are left out, since they can't match any row,
+ * and so are those of a semi-join whose key is already in memory.
+ *
+ * Parameters
+ * - h: Hash table
+ * - regs: The h->nbuild registers with the values of the row
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The table is being probed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not write a partition file
+ */
+int chidb_dbm_hash_insert(chidb_dbm_hash_t *h, chidb_dbm_register_t *regs)
+{
+    uint32_t len = chidb_dbm_reg_serialize(regs, h->nbuild, NULL), hash, p;
+    int rc;
+
+    if (h->deferred)
+        return CHIDB_EMISUSE;
+    if ((rc = hash_reserve(h, len)) != CHIDB_OK)
+        return rc;
+    chidb_dbm_reg_serialize(regs, h->nbuild, h->row);
+    if (h->row[0] == REG_NULL)
+        return CHIDB_OK;
+
+    hash = hash_key(h->row);
+    p = HASH_PARTITION(hash);
+    if (h->semi && (!h->spilled || p == 0) && hash_lookup(h, hash, h->row) != 0)
+        return CHIDB_OK;
+    if ((rc = hash_addKey(h, hash)) != CHIDB_OK)
+        return rc;
+    if (h->spilled && p != 0)
+        return hash_write(h->build[p], hash, h->row, len);
+
+    if ((rc = hash_append(h, hash, h->row, len)) != CHIDB_OK)
+        return rc;
+    if (!h->spilled && h->used > h->budget)
+        return hash_spill(h);
+
+    return CHIDB_OK;
+}
+
+
+/* Look up the rows of the build side that match a row of the probe side
+ *
+ * Moves to the first build row with the same key as the probe row,
+ * whose values can then be read with chidb_dbm_hash_column. If the key
+ * is in a partition that was spilled, the probe row is saved to be
+ * joined by chidb_dbm_hash_deferred, and isn't found now. A key that
+ * the Bloom filter of the build keys rules out is not looked up, or
+ * saved. The first probe ends the build side.
+ *
+ * Parameters
+ * - h: Hash table
+ * - regs: The h->nprobe registers with the values of the probe row
+ * - found: Set to whether there is a match
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not write a partition file
+ */
+int chidb_dbm_hash_probe(chidb_dbm_hash_t *h, chidb_dbm_register_t *regs, bool *found)
+{
+    uint32_t len = chidb_dbm_reg_serialize(regs, h->nprobe, NULL), hash, p;
+    int rc;
+
+    *found = false;
+    h->match = 0;
+    if ((rc = hash_reserve(h, len)) != CHIDB_OK)
+        return rc;
+    chidb_dbm_reg_serialize(regs, h->nprobe, h->row);
+    h->rowlen = len;
+    if (h->row[0] == REG_NULL)
+        return CHIDB_OK;
+
+    hash = hash_key(h->row);
+    if ((rc = hash_seal(h)) != CHIDB_OK)
+        return rc;
+    if (!chidb_bloom_test(&h->bloom, chidb_bloom_hash(hash)))
+        return CHIDB_OK;
+    p = HASH_PARTITION(hash);
+    if (h->spilled && p != 0)
+        return hash_write(h->probe[p], hash, h->row, len);
+
+    h->match = hash_lookup(h, hash, h->row);
+    *found = h->match != 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Tell whether a join key may match a row of the build side
+ *
+ * Checks the key against the Bloom filter of the build keys, without
+ * looking it up, so that the probe side can drop a row that can't have
+ * a match before it reads the rest of its values. Like a probe, this
+ * ends the build side.
+ *
+ * Parameters
+ * - h: Hash table
+ * - r: Register with the join key
+ * - maybe: Set to false if no build row has the key (or it is NULL),
+ *          and to true if one may have it
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_hash_filter(chidb_dbm_hash_t *h, chidb_dbm_register_t *r, bool *maybe)
+{
+    uint8_t local[64], *key = local;
+    uint32_t len = chidb_dbm_reg_serialize(r, 1, NULL);
+    int rc;
+
+    *maybe = false;
+    if ((rc = hash_seal(h)) != CHIDB_OK)
+        return rc;
+    if (len > sizeof(local) && (key = malloc(len)) == NULL)
+        return CHIDB_ENOMEM;
+    chidb_dbm_reg_serialize(r, 1, key);
+
+    if (key[0] != REG_NULL)
+        *maybe = chidb_bloom_test(&h->bloom, chidb_bloom_hash(hash_key(key)));
+    if (key != local)
+        free(key);
+
+    return CHIDB_OK;
+}
+
+
+/* Move to the next match
+ *
+ * Moves to the next build row that matches the probe row (a semi-join
+ * has a single match per probe row). Once
+ * chidb_dbm_hash_deferred has been called, moves on to the matches of
+ * the next saved probe row when those of the current one are done.
+ *
+ * Parameters
+ * - h: Hash table
+ * - found: Set to whether there is another match
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not read a partition file
+ */
+int chidb_dbm_hash_next(chidb_dbm_hash_t *h, bool *found)
+{
+    if (h->match != 0)
+        h->match = h->semi ? 0 : HASH_ROW(h, h->match)->next;
+
+    if (h->match != 0 || !h->deferred)
+    {
+        *found = h->match != 0;
+        return CHIDB_OK;
+    }
+
+    return hash_advance(h, found);
+}
+
+
+/* Join the probe rows of the spilled partitions
+ *
+ * Once every probe row has gone through chidb_dbm_hash_probe, moves to
+ * the first match of the probe rows that were saved because their
+ * partition was spilled. The build rows of each partition are loaded
+ * into memory in turn.
+ *
+ * Parameters
+ * - h: Hash table
+ * - found: Set to whether there is a match (false if nothing spilled)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not read a partition file
+ */
+int chidb_dbm_hash_deferred(chidb_dbm_hash_t *h, bool *found)
+{
+    *found = false;
+    h->match = 0;
+    if (!h->spilled)
+        return CHIDB_OK;
+
+    h->deferred = true;
+    h->part = 0;
+
+    return hash_advance(h, found);
+}
+
+
+/* Read a value of the current joined row
+ *
+ * The values of the build row come first, followed by those of the
+ * probe row. Strings and binaries are not copied: the register points
+ * into the hash table, and is valid until the table moves to another
+ * row.
+ *
+ * Parameters
+ * - h: Hash table
+ * - col: Value of the joined row (starting at 0)
+ * - r: Register to store it in
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no such value, or no current match
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_hash_column(chidb_dbm_hash_t *h, uint32_t col, chidb_dbm_register_t *r)
+{
+    const uint8_t *v;
+
+    if (h->match == 0 || col >= h->nbuild + h->nprobe)
+        return CHIDB_EMISUSE;
+
+    if (col < h->nbuild)
+        v = HASH_ROW_DATA(HASH_ROW(h, h->match));
+    else
+    {
+        v = h->row;
+        col -= h->nbuild;
+    }
+    while (col-- > 0)
+        v += chidb_dbm_reg_serialsize(v);
+
+    return chidb_dbm_reg_deserialize(r, v);
+}
@@ -0,0 +1,137 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine hash joins -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef DBM_HASH_H_
+#define DBM_HASH_H_
+
+#include <stdio.h>
+#include "chidbInt.h"
+#include "dbm-types.h"
+#include "bloom.h"
+
+/* Bytes of rows that a hash table keeps in memory before it spills
+ * partitions to temporary files, and number of partitions */
+#define DBM_HASH_BUDGET (4 * 1024 * 1024)
+#define DBM_HASH_NPARTITIONS (16)
+
+/* A slot of the open-addressing table: the hash of a key, and the first
+ * row with that key (see chidb_dbm_hash_t) */
+typedef struct chidb_dbm_hash_slot
+{
+    uint32_t hash;
+    uint32_t row;       /* Offset of the row in buf + 1, 0 if the slot is empty */
+} chidb_dbm_hash_slot_t;
+
+/* The hash table of a hash join (see the HashOpen instruction).
+ *
+ * The rows of the build side are copied from registers into buf, one
+ * after the other, and those with the same key are chained. The table
+ * itself is an array of slots, probed linearly, that only holds the
+ * hash of each key and where its rows are, so that a lookup touches one
+ * or two cache lines before it finds the row it wants.
+ *
+ * The first value of a row is its key. A join on several columns can
+ * use a record (MakeRecord) as its key.
+ *
+ * Once the rows in memory take more than budget bytes, the table is
+ * split into DBM_HASH_NPARTITIONS partitions by the top bits of the
+ * hash (a Grace hash join): partition 0 stays in memory, and the rows
+ * of the others are written to temporary files, as are the probe rows
+ * that fall in them. Those are joined at the end (chidb_dbm_hash_deferred),
+ * a partition at a time. A partition is not split again if it doesn't
+ * fit in the budget by itself.
+ *
+ * The hashes of the build keys also go into a Bloom filter, which is
+ * made when the probing starts, once their number is known. A probe
+ * row whose key the filter rules out is not looked up (nor written to a
+ * partition file), and the probe side can check its keys against it
+ * before it even reads the rest of the row (see chidb_dbm_hash_filter).
+ *
+ * A semi-join (the rows of the probe side that have a match, each once,
+ * as for an IN subquery) only keeps the first build row of each key in
+ * memory, and moves on to the next probe row after the first match.
+ */
+typedef struct chidb_dbm_hash
+{
+    uint32_t nbuild;        /* Values in a row of the build side (0 if not open) */
+    uint32_t nprobe;        /* Values in a row of the probe side */
+    bool semi;              /* Semi-join: a single match per probe row */
+    size_t budget;
+
+    uint8_t *buf;
+    uint32_t used;
+    uint32_t size;
+
+    chidb_dbm_hash_slot_t *slots;
+    uint32_t nslots;        /* A power of two */
+    uint32_t nkeys;
+
+    bool spilled;
+    FILE *build[DBM_HASH_NPARTITIONS];
+    FILE *probe[DBM_HASH_NPARTITIONS];
+
+    /* Row being probed, and its current match (offset in buf + 1, or 0) */
+    uint8_t *row;
+    uint32_t rowlen;
+    uint32_t rowsize;
+    uint32_t match;
+
+    /* Joining the probe rows of the spilled partitions, and partition
+     * being joined */
+    bool deferred;
+    uint32_t part;
+
+    /* Hashes of the build keys until the filter is made, and the filter */
+    uint32_t *hashes;
+    uint32_t nhashes;
+    uint32_t hashsize;
+    chidb_bloom_t bloom;      /* nblocks is 0 until the first probe */
+} chidb_dbm_hash_t;
+
+int chidb_dbm_hash_init(chidb_dbm_hash_t *h, uint32_t nbuild, uint32_t nprobe, size_t budget);
+void chidb_dbm_hash_free(chidb_dbm_hash_t *h);
+int chidb_dbm_hash_insert(chidb_dbm_hash_t *h, chidb_dbm_register_t *regs);
+int chidb_dbm_hash_probe(chidb_dbm_hash_t *h, chidb_dbm_register_t *regs, bool *found);
+int chidb_dbm_hash_filter(chidb_dbm_hash_t *h, chidb_dbm_register_t *r, bool *maybe);
+int chidb_dbm_hash_next(chidb_dbm_hash_t *h, bool *found);
+int chidb_dbm_hash_deferred(chidb_dbm_hash_t *h, bool *found);
+int chidb_dbm_hash_column(chidb_dbm_hash_t *h, uint32_t col, chidb_dbm_register_t *r);
+
+#endif /* DBM_HASH_H_ */
@@ -41,7 +41,23 @@
 #include "dbm.h"
 #include "btree.h"
 #include "record.h"
-
+#include "util.h"
+#include "dbm-cache.h"
+#include "dbm-hash.h"
+#include "dbm-sorter.h"
+#include "dbm-agg.h"
+#include "dbm-set.h"
+#include "dbm-parallel.h"
+#include "catalog.h"
+#include "zonemap.h"
+#include "hashindex.h"
+#include "bloom.h"
+#include "probes.h"
+
+
+/* Defined in dbm.c */
+int realloc_reg(chidb_stmt *stmt, uint32_t size);
+int realloc_cur(chidb_stmt *stmt, uint32_t size);
 
 /* Function pointer for dispatch table */
 typedef int (*handler_function)(chidb_stmt *stmt, chidb_dbm_op_t *op);
@@ -78,6 +94,315 @@ int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* Compilers with labels as values (GCC, clang) jump straight from one
+ * instruction's handler to the next one's. Define DBM_NO_THREADED to
+ * use a switch instead. */
+#if defined(__GNUC__) && !defined(DBM_NO_THREADED)
+#define DBM_THREADED
+#endif
+
+/* Run instructions, starting at stmt->pc, until one of them returns
+ * something other than CHIDB_OK or the end of the program is reached.
+ *
+ * Unlike calling chidb_dbm_op_handle for each instruction, handlers are
+ * called directly (not through dbm_handlers), so the compiler can inline
+ * the simple ones. With DBM_THREADED, each handler is followed by its
+ * own dispatch of the next instruction, which branch predictors handle
+ * much better than a single shared indirect jump. Handlers may change
+ * stmt->pc (jumps), so it is read again after each instruction.
+ *
+ * Return
+ * - CHIDB_OK: The end of the program was reached
+ * - Anything else returned by an instruction handler
+ */
+int chidb_dbm_op_run (chidb_stmt *stmt)
+{
+    chidb_dbm_op_t *op;
+    int rc;
+
+#ifdef DBM_THREADED
+    /* Expands to [Op_Noop] = &&do_Noop, [Op_OpenRead] = &&do_OpenRead, ... */
+#define DISPATCH_LABEL(OP) [Op_ ## OP] = &&do_ ## OP,
+    static void *labels[] =
+    {
+        FOREACH_OP(DISPATCH_LABEL)
+    };
+
+#define DISPATCH()                                  \
+    do {                                            \
+        if (stmt->pc >= stmt->endOp)                \
+            return CHIDB_OK;                        \
+        op = &stmt->ops[stmt->pc++];                \
+        stmt->ninstr++;                             \
+        CHIDB_PROBE3(op, stmt, stmt->pc - 1, op->opcode); \
+        goto *labels[op->opcode];                   \
+    } while (0)
+
+    DISPATCH();
+
+    /* Expands to do_Noop: rc = chidb_dbm_op_Noop(stmt, op); ... */
+#define DISPATCH_HANDLER(OP)                        \
+    do_ ## OP:                                      \
+        rc = chidb_dbm_op_ ## OP (stmt, op);        \
+        if (rc != CHIDB_OK)                         \
+            return rc;                              \
+        DISPATCH();
+
+    FOREACH_OP(DISPATCH_HANDLER)
+
+#undef DISPATCH_HANDLER
+#undef DISPATCH
+#undef DISPATCH_LABEL
+#else
+    while (stmt->pc < stmt->endOp)
+    {
+        op = &stmt->ops[stmt->pc++];
+        stmt->ninstr++;
+        CHIDB_PROBE3(op, stmt, stmt->pc - 1, op->opcode);
+
+        /* Expands to case Op_Noop: rc = chidb_dbm_op_Noop(stmt, op); break; ... */
+#define DISPATCH_CASE(OP)                           \
+        case Op_ ## OP:                             \
+            rc = chidb_dbm_op_ ## OP (stmt, op);    \
+            break;
+
+        switch (op->opcode)
+        {
+        FOREACH_OP(DISPATCH_CASE)
+        default:
+            rc = CHIDB_EMISUSE;
+            break;
+        }
+#undef DISPATCH_CASE
+
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    return CHIDB_OK;
+#endif
+}
+
+
+/* Same as chidb_dbm_op_run, but counting the executions, cycles and
+ * page reads of each instruction in stmt->profile (see
+ * chidb_profile_start). The cycles of an instruction include everything
+ * its handler does, such as reading pages. */
+int chidb_dbm_profiled_run (chidb_stmt *stmt)
+{
+    while (stmt->pc < stmt->endOp)
+    {
+        uint32_t pc = stmt->pc++;
+        chidb_dbm_op_t *op = &stmt->ops[pc];
+        chidb_stats *stats = &stmt->db->bt->pager->stats;
+        uint64_t start, pages;
+        int rc;
+
+        stmt->ninstr++;
+        pages = stats->cache_hits + stats->cache_misses;
+        start = chidb_cycles();
+        rc = chidb_dbm_op_handle(stmt, op);
+        stmt->profile[pc].cycles += chidb_cycles() - start;
+        stmt->profile[pc].pages += stats->cache_hits + stats->cache_misses - pages;
+        stmt->profile[pc].count++;
+
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Kinds of compiled instructions. COP_HANDLER calls the instruction's
+ * handler, the others are run inline by chidb_dbm_compiled_run. */
+typedef enum cop_kind
+{
+    COP_HANDLER,
+    COP_NOOP,
+    COP_INTEGER,
+    COP_EQ,
+    COP_NE,
+    COP_LT,
+    COP_LE,
+    COP_GT,
+    COP_GE
+} cop_kind_t;
+
+/* A compiled instruction. There is one per instruction of the program,
+ * so that stmt->pc is the same in the compiled program and in the
+ * interpreted one. */
+struct chidb_dbm_cop
+{
+    cop_kind_t kind;
+    handler_function func;
+    chidb_dbm_op_t *op;
+    int32_t a, b;       /* Registers (or integer value, for COP_INTEGER) */
+    uint32_t target;    /* Jump address */
+};
+
+/* Compile a DBM program
+ *
+ * Translates stmt->ops into an array of compiled instructions
+ * (stmt->compiled), which chidb_stmt_exec runs with
+ * chidb_dbm_compiled_run instead of the interpreter. The handler of
+ * every instruction is resolved once, here, and Noop, Integer and the
+ * comparisons (Eq, Ne, Lt, Le, Gt and Ge, and their typed versions,
+ * EqInt to GeInt) become inline code that works on the registers
+ * directly: when both registers hold integers, a comparison is a native
+ * compare and branch. Any other case falls back to the instruction's
+ * handler, which has the last word on strings, NULLs and errors.
+ *
+ * The comparisons follow the DBM semantics: Lt p1 p2 p3 jumps to p2 if
+ * the contents of register p3 are less than those of register p1.
+ *
+ * The compiled program is discarded if an instruction is changed with
+ * chidb_stmt_set_op.
+ *
+ * Parameters
+ * - stmt: DBM to compile
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory (the program keeps running
+ *                 in the interpreter)
+ */
+int chidb_dbm_compile (chidb_stmt *stmt)
+{
+    struct chidb_dbm_cop *cops;
+
+    cops = malloc(sizeof(struct chidb_dbm_cop) * (stmt->endOp + 1));
+    if (cops == NULL)
+        return CHIDB_ENOMEM;
+
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *op = &stmt->ops[i];
+        struct chidb_dbm_cop *cop = &cops[i];
+
+        cop->kind = COP_HANDLER;
+        cop->func = dbm_handlers[op->opcode].func;
+        cop->op = op;
+        cop->a = op->p1;
+        cop->b = op->p3;
+        cop->target = op->p2;
+
+        switch (op->opcode)
+        {
+        case Op_Noop:
+            cop->kind = COP_NOOP;
+            break;
+        case Op_Integer:
+            cop->kind = COP_INTEGER;
+            cop->b = op->p2;
+            break;
+        case Op_Eq:
+        case Op_Ne:
+        case Op_Lt:
+        case Op_Le:
+        case Op_Gt:
+        case Op_Ge:
+            /* Invalid jumps are left to the handler to report */
+            if (IS_VALID_ADDRESS(stmt, op->p2) || op->p2 == stmt->endOp)
+                cop->kind = COP_EQ + (op->opcode - Op_Eq);
+            break;
+        case Op_EqInt:
+        case Op_NeInt:
+        case Op_LtInt:
+        case Op_LeInt:
+        case Op_GtInt:
+        case Op_GeInt:
+            if (IS_VALID_ADDRESS(stmt, op->p2) || op->p2 == stmt->endOp)
+                cop->kind = COP_EQ + (op->opcode - Op_EqInt);
+            break;
+        default:
+            break;
+        }
+    }
+
+    free(stmt->compiled);
+    stmt->compiled = cops;
+
+    return CHIDB_OK;
+}
+
+/* Run a compiled DBM program
+ *
+ * Same as chidb_dbm_op_run, but running stmt->compiled, which must
+ * be up to date (see chidb_dbm_compile).
+ *
+ * Return
+ * - CHIDB_OK: The end of the program was reached
+ * - Anything else returned by an instruction handler
+ */
+int chidb_dbm_compiled_run (chidb_stmt *stmt)
+{
+    struct chidb_dbm_cop *cops = stmt->compiled;
+    chidb_dbm_register_t *reg = stmt->reg;
+    uint32_t nreg = stmt->nReg;
+    uint32_t pc = stmt->pc, end = stmt->endOp;
+    int rc;
+
+    /* Both registers of a comparison hold integers */
+#define COP_INTS(cop) ((uint32_t) (cop)->a < nreg && (uint32_t) (cop)->b < nreg       \
+                       && reg[(cop)->a].type == REG_INT32 && reg[(cop)->b].type == REG_INT32)
+
+    /* Expands to a native compare and branch if the registers hold
+     * integers, and to a call to the handler otherwise */
+#define COP_CMP(KIND, OP)                                                           \
+        case KIND:                                                                  \
+            if (!COP_INTS(cop))                                                     \
+                goto handler;                                                       \
+            if (reg[cop->b].value.i OP reg[cop->a].value.i)                         \
+                pc = cop->target;                                                   \
+            break;
+
+    while (pc < end)
+    {
+        struct chidb_dbm_cop *cop = &cops[pc++];
+
+        CHIDB_PROBE3(op, stmt, pc - 1, cop->op->opcode);
+        switch (cop->kind)
+        {
+        case COP_NOOP:
+            break;
+        case COP_INTEGER:
+            if ((uint32_t) cop->b >= nreg)
+                goto handler;
+            chidb_dbm_reg_clear(&reg[cop->b]);
+            reg[cop->b].type = REG_INT32;
+            reg[cop->b].value.i = cop->a;
+            break;
+        COP_CMP(COP_EQ, ==)
+        COP_CMP(COP_NE, !=)
+        COP_CMP(COP_LT, <)
+        COP_CMP(COP_LE, <=)
+        COP_CMP(COP_GT, >)
+        COP_CMP(COP_GE, >=)
+        case COP_HANDLER:
+        handler:
+            /* Handlers see (and may change) the program counter and the
+             * registers, so they are written back before the call, and
+             * read again after it */
+            stmt->pc = pc;
+            rc = cop->func(stmt, cop->op);
+            pc = stmt->pc;
+            reg = stmt->reg;
+            nreg = stmt->nReg;
+            if (rc != CHIDB_OK)
+                return rc;
+            break;
+        }
+    }
+#undef COP_CMP
+#undef COP_INTS
+
+    stmt->pc = pc;
+
+    return CHIDB_OK;
+}
+
+
 /*** INSTRUCTION HANDLER IMPLEMENTATIONS ***/
 
 
@@ -111,6 +436,49 @@ int chidb_dbm_op_Close (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* OpenEphemeral p1 p2 * *
+ *
+ * p1: cursor
+ * p2: 0 for a table, 1 for an index
+ *
+ * open a write cursor p1 on a new, empty table (or index) in the
+ * statement's temporary B-Tree file (see chidb_stmt_temp_btree), for
+ * rows that the program needs to keep aside, such as those of a
+ * subquery that it reads more than once. The ephemeral table is used
+ * like any other, through its cursor (Insert, Rewind, Next, Column...),
+ * and never goes to the database file: the temporary file is never
+ * synced, its pages stay in its buffer pool until it runs out of room,
+ * and it is dropped, with all its tables, when the statement is reset.
+ */
+int chidb_dbm_op_OpenEphemeral (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    BTree *bt;
+    npage_t nroot;
+    int rc;
+
+    if (op->p1 < 0 || op->p2 < 0 || op->p2 > 1)
+        return CHIDB_EMISUSE;
+
+    if (!EXISTS_CURSOR(stmt, op->p1) && (rc = realloc_cur(stmt, op->p1 + 1)) != CHIDB_OK)
+        return rc;
+    if (stmt->cursors[op->p1].type != CURSOR_UNSPECIFIED)
+        chidb_dbm_cursor_close(&stmt->cursors[op->p1]);
+
+    if ((rc = chidb_stmt_temp_btree(stmt, &bt)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_Btree_newNode(bt, &nroot, op->p2 ? PGTYPE_INDEX_LEAF : PGTYPE_TABLE_LEAF)) != CHIDB_OK)
+        return rc;
+
+    return chidb_dbm_cursor_open(&stmt->cursors[op->p1], CURSOR_WRITE, bt, nroot);
+}
+
+
+/* Rewind, Last, Next, Prev and Seek* position the cursor with
+ * chidb_dbm_cursor_rewind, chidb_dbm_cursor_last, chidb_dbm_cursor_next,
+ * chidb_dbm_cursor_prev and chidb_dbm_cursor_seek (CURSOR_SEEK_EQ, ...,
+ * CURSOR_SEEK_LE), which return CHIDB_DONE where these jump to p2. The cursor keeps its path
+ * through the B-Tree between them, so Next and Prev don't descend from
+ * the root, and neither do seeks to nearby keys. */
 int chidb_dbm_op_Rewind (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -119,6 +487,23 @@ int chidb_dbm_op_Rewind (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* Last p1 p2 * *
+ *
+ * p1: cursor
+ * p2: jump addr
+ *
+ * move cursor p1 to the last entry of its B-Tree, to read it backward
+ * with Prev (e.g., an index for ORDER BY ... DESC). If it is empty, jump
+ * to p2.
+ */
+int chidb_dbm_op_Last (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    /* Your code goes here */
+
+    return CHIDB_OK;
+}
+
+
 int chidb_dbm_op_Next (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -173,6 +558,25 @@ int chidb_dbm_op_SeekLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
     return CHIDB_OK;
 }
 
+/* Column p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: column number
+ * p3: register
+ *
+ * store the value of column p2 of the record at cursor p1 in register p3.
+ * A large record may continue in overflow pages: read just the record
+ * header and the bytes of the column with chidb_Btree_readPayload, so
+ * that the overflow pages of columns that are not needed are not read.
+ * In files with BTREE_FEATURE_RECORDV2, read the record with
+ * chidb_DBRecordView_initV2: the header says where column p2 is,
+ * without decoding the columns before it. Store text with
+ * chidb_dbm_reg_set_string and REG_BORROWED_PAGE when the column is in
+ * the page the cursor has pinned (the register points into the page,
+ * nothing is copied), and REG_OWNED when it was read from overflow
+ * pages. A cursor on a covering index (see
+ * chidb_Btree_buildCoveringIndex) reads its records the same way.
+ */
 int chidb_dbm_op_Column (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -197,6 +601,16 @@ int chidb_dbm_op_Integer (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* String p1 p2 * p4
+ *
+ * p1: length of the string
+ * p2: register
+ * p4: string
+ *
+ * store string p4 in register p2. The instruction outlives the
+ * register's value, so store it with chidb_dbm_reg_set_string and
+ * REG_BORROWED: nothing is allocated.
+ */
 int chidb_dbm_op_String (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -223,6 +637,19 @@ int chidb_dbm_op_ResultRow (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* MakeRecord p1 p2 p3 *
+ *
+ * p1: register
+ * p2: number of registers
+ * p3: register
+ *
+ * Create a database record from the p2 registers starting at p1, and
+ * store it in register p3. Build the record in the statement's arena
+ * (chidb_DBRecord_create_empty2 and chidb_DBRecord_pack2 with
+ * &stmt->arena), so that no memory has to be allocated or freed for
+ * every row. In files with BTREE_FEATURE_RECORDV2, pack it with
+ * chidb_DBRecord_packV2 instead.
+ */
 int chidb_dbm_op_MakeRecord (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -231,6 +658,20 @@ int chidb_dbm_op_MakeRecord (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* Insert p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: register containing the record
+ * p3: register containing the key
+ *
+ * Insert the record in p2, with key p3, in the B-Tree of cursor p1,
+ * with chidb_dbm_cursor_insert: the rows of a multi-row INSERT come in
+ * key order, and those that go into the same leaf are inserted into the
+ * leaf the cursor has pinned, without descending the B-Tree again.
+ * Once it is in the B-Tree, reset the statement's arena with
+ * chidb_DBRecordArena_reset: the record made for the next row reuses
+ * its memory.
+ */
 int chidb_dbm_op_Insert (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -239,6 +680,102 @@ int chidb_dbm_op_Insert (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* Stores the number of entries a Clear or DeleteRange deleted in
+ * register r, unless it is negative */
+static int chidb_dbm_op_ndeleted(chidb_stmt *stmt, int32_t r, uint64_t n)
+{
+    int rc;
+
+    if (r < 0)
+        return CHIDB_OK;
+    if (!EXISTS_REGISTER(stmt, r) && (rc = realloc_reg(stmt, r + 1)) != CHIDB_OK)
+        return rc;
+    if (n > INT32_MAX)
+        return CHIDB_EMISMATCH;
+
+    chidb_dbm_reg_clear(&stmt->reg[r]);
+    stmt->reg[r].type = REG_INT32;
+    stmt->reg[r].value.i = (int32_t) n;
+
+    return CHIDB_OK;
+}
+
+
+/* Clear p1 p2 * *
+ *
+ * p1: cursor
+ * p2: register (or -1)
+ *
+ * delete every entry of the B-Tree of cursor p1 (a table or an index)
+ * with chidb_Btree_truncate, which frees all of its pages but the root
+ * without reading them one entry at a time, and store the number of
+ * entries deleted in register p2. The cursor is left on no entry.
+ */
+int chidb_dbm_op_Clear (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c;
+    uint64_t n;
+    int rc;
+
+    if (!IS_VALID_CURSOR(stmt, op->p1))
+        return CHIDB_EMISUSE;
+
+    c = &stmt->cursors[op->p1];
+    chidb_dbm_cursor_release(c);
+    if ((rc = chidb_Btree_truncate(c->bt, c->nroot, &n)) != CHIDB_OK)
+        return rc;
+
+    return chidb_dbm_op_ndeleted(stmt, op->p2, n);
+}
+
+
+/* DeleteRange p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: register (or -1)
+ * p3: register
+ *
+ * delete the rows of the table of cursor p1 whose keys are from the
+ * integer in register p3 to the one in register p3+1, both included
+ * (NULL for no bound), with chidb_Btree_deleteRange, which detaches and
+ * frees the subtrees that are entirely in the range, and store the
+ * number of rows deleted in register p2. The cursor is left on no entry.
+ */
+int chidb_dbm_op_DeleteRange (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c;
+    chidb_key_t lo = 0, hi = CHIDB_KEY_MAX;
+    uint64_t n;
+    int rc;
+
+    if (!IS_VALID_CURSOR(stmt, op->p1) || op->p3 < 0 || !EXISTS_REGISTER(stmt, op->p3 + 1))
+        return CHIDB_EMISUSE;
+
+    for (int i = 0; i < 2; i++)
+    {
+        chidb_dbm_register_t *r = &stmt->reg[op->p3 + i];
+
+        if (r->type == REG_NULL)
+            continue;
+        if (r->type != REG_INT32)
+            return CHIDB_EMISMATCH;
+        if (i == 0)
+            lo = (chidb_key_t) r->value.i;
+        else
+            hi = (chidb_key_t) r->value.i;
+    }
+
+    c = &stmt->cursors[op->p1];
+    if (c->index)
+        return CHIDB_EMISUSE;
+    chidb_dbm_cursor_release(c);
+    if ((rc = chidb_Btree_deleteRange(c->bt, c->nroot, lo, hi, &n)) != CHIDB_OK)
+        return rc;
+
+    return chidb_dbm_op_ndeleted(stmt, op->p2, n);
+}
+
+
 int chidb_dbm_op_Eq (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -287,6 +824,86 @@ int chidb_dbm_op_Ge (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* Runs the typed comparison cmp (EqInt to GeInt) of op: jumps to p2 if
+ * it holds for the integers in registers p3 and p1, in that order */
+static inline int chidb_dbm_op_cmpInt (chidb_stmt *stmt, chidb_dbm_op_t *op, opcode_t cmp)
+{
+    chidb_dbm_register_t *r1, *r3;
+    bool jump;
+
+    if (!EXISTS_REGISTER(stmt, op->p1) || !EXISTS_REGISTER(stmt, op->p3))
+        return CHIDB_EMISUSE;
+
+    r1 = &stmt->reg[op->p1];
+    r3 = &stmt->reg[op->p3];
+    if (r1->type != REG_INT32 || r3->type != REG_INT32)
+        return CHIDB_OK;
+
+    switch (cmp)
+    {
+    case Op_EqInt: jump = r3->value.i == r1->value.i; break;
+    case Op_NeInt: jump = r3->value.i != r1->value.i; break;
+    case Op_LtInt: jump = r3->value.i <  r1->value.i; break;
+    case Op_LeInt: jump = r3->value.i <= r1->value.i; break;
+    case Op_GtInt: jump = r3->value.i >  r1->value.i; break;
+    default:       jump = r3->value.i >= r1->value.i; break;
+    }
+    if (jump)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* EqInt p1 p2 p3 *
+ *
+ * p1: register
+ * p2: jump addr
+ * p3: register
+ *
+ * EqInt, NeInt, LtInt, LeInt, GtInt and GeInt are Eq, Ne, Lt, Le, Gt
+ * and Ge for registers that hold integers or NULL, which is what codegen
+ * uses when the catalog says that both sides of a comparison are
+ * integers (see chidb_exprc_cmpOp). They compare the integers as they
+ * are, without the checks for strings and type conversions of the
+ * generic comparisons. If either register is NULL, they don't jump.
+ */
+int chidb_dbm_op_EqInt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_op_cmpInt(stmt, op, Op_EqInt);
+}
+
+
+int chidb_dbm_op_NeInt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_op_cmpInt(stmt, op, Op_NeInt);
+}
+
+
+int chidb_dbm_op_LtInt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_op_cmpInt(stmt, op, Op_LtInt);
+}
+
+
+int chidb_dbm_op_LeInt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_op_cmpInt(stmt, op, Op_LeInt);
+}
+
+
+int chidb_dbm_op_GtInt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_op_cmpInt(stmt, op, Op_GtInt);
+}
+
+
+int chidb_dbm_op_GeInt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_op_cmpInt(stmt, op, Op_GeInt);
+}
+
+
 /* IdxGt p1 p2 p3 *
  *
  * p1: cursor
@@ -349,7 +966,8 @@ int chidb_dbm_op_IdxLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
  * p1: cursor
  * p2: register
  *
- * store pkey from (cell at cursor p1) in (register at p2)
+ * store pkey from (cell at cursor p1) in (register at p2). On a
+ * covering index, pkey is column 0 of the entry's record.
  */
 int chidb_dbm_op_IdxPKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
@@ -363,7 +981,9 @@ int chidb_dbm_op_IdxPKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
  * p2: register containing IdxKey
  * p2: register containing PKey
  *
- * add new (IdkKey,PKey) entry in index BTree pointed at by cursor at p1
+ * add new (IdkKey,PKey) entry in index BTree pointed at by cursor at p1,
+ * with chidb_dbm_cursor_insert (as in Insert, consecutive entries that
+ * go into the same leaf reuse the cursor's path)
  */
 int chidb_dbm_op_IdxInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
@@ -372,38 +992,1448 @@ int chidb_dbm_op_IdxInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* HashIdxSeek p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: jump addr
+ * p3: register
+ *
+ * look up the integer in register p3+1 in the hash index whose meta
+ * page is in register p3 (see chidb_hashindex_find), and move table
+ * cursor p1 to the row with the primary key it maps to. If no row has
+ * that value (or register p3+1 is NULL), jump to p2. The index has at
+ * most one entry per value, so there is no next match to move to.
+ */
+int chidb_dbm_op_HashIdxSeek (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c;
+    chidb_key_t keyPk;
+    int rc;
+
+    if (!IS_VALID_CURSOR(stmt, op->p1) || op->p3 < 0 || !EXISTS_REGISTER(stmt, op->p3 + 1) ||
+        stmt->reg[op->p3].type != REG_INT32)
+        return CHIDB_EMISUSE;
+
+    c = &stmt->cursors[op->p1];
+    if (c->index)
+        return CHIDB_EMISUSE;
+    if (stmt->reg[op->p3 + 1].type == REG_NULL)
+    {
+        stmt->pc = op->p2;
+        return CHIDB_OK;
+    }
+    if (stmt->reg[op->p3 + 1].type != REG_INT32)
+        return CHIDB_EMISMATCH;
+
+    rc = chidb_hashindex_find(c->bt, stmt->reg[op->p3].value.i, stmt->reg[op->p3 + 1].value.i, &keyPk);
+    if (rc == CHIDB_OK)
+        rc = chidb_dbm_cursor_seek(c, keyPk, CURSOR_SEEK_EQ);
+    if (rc == CHIDB_ENOTFOUND || rc == CHIDB_DONE)
+    {
+        stmt->pc = op->p2;
+        return CHIDB_OK;
+    }
+
+    return rc;
+}
+
+
+/* HashIdxInsert p1 p2 p3 *
+ *
+ * p1: register
+ * p2: register containing IdxKey
+ * p3: register containing PKey
+ *
+ * add new (IdxKey,PKey) entry to the hash index whose meta page is in
+ * register p1, with chidb_hashindex_insert. Hash indexes have no
+ * cursors: this is what INSERT runs for them instead of IdxInsert. A
+ * NULL IdxKey is not indexed.
+ */
+int chidb_dbm_op_HashIdxInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (op->p1 < 0 || op->p2 < 0 || op->p3 < 0 || !EXISTS_REGISTER(stmt, op->p1) ||
+        !EXISTS_REGISTER(stmt, op->p2) || !EXISTS_REGISTER(stmt, op->p3) ||
+        stmt->reg[op->p1].type != REG_INT32 || stmt->reg[op->p3].type != REG_INT32)
+        return CHIDB_EMISUSE;
+
+    if (stmt->reg[op->p2].type == REG_NULL)
+        return CHIDB_OK;
+    if (stmt->reg[op->p2].type != REG_INT32)
+        return CHIDB_EMISMATCH;
+
+    return chidb_hashindex_insert(stmt->db->bt, stmt->reg[op->p1].value.i,
+                                  stmt->reg[op->p2].value.i, stmt->reg[op->p3].value.i);
+}
+
+
+/* BloomFilter p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: jump addr
+ * p3: register
+ *
+ * if the Bloom filter of the B-Tree of cursor p1 (see chidb_bloom_lookup)
+ * says that the integer in register p3 is not one of its keys, jump to
+ * p2. Does nothing if the B-Tree has no filter, or if register p3 is not
+ * an integer. This goes before the seek of an equality lookup (SeekGe
+ * and IdxGe, or Seek), to skip it when the key is certainly not there.
+ */
+int chidb_dbm_op_BloomFilter (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c;
+    bool maybe;
+    int rc;
+
+    if (!IS_VALID_CURSOR(stmt, op->p1) || !EXISTS_REGISTER(stmt, op->p3))
+        return CHIDB_EMISUSE;
+    if (stmt->reg[op->p3].type != REG_INT32)
+        return CHIDB_OK;
+
+    c = &stmt->cursors[op->p1];
+    if ((rc = chidb_bloom_lookup(c->bt, c->nroot, stmt->reg[op->p3].value.i, &maybe)) != CHIDB_OK)
+        return rc;
+    if (!maybe)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* CreateTable p1 * * *
+ *
+ * p1: register
+ *
+ * create a new, empty table B-Tree and store its root page number in
+ * register p1. When the rows are already known and sorted by primary key,
+ * the tree can be filled bottom-up with chidb_Btree_bulkLoad.
+ */
 int chidb_dbm_op_CreateTable (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
+    /* Catalogs and cached programs are for the old schema */
+    int rc = chidb_catalog_changed(stmt->db);
+    if (rc != CHIDB_OK)
+        return rc;
+
     /* Your code goes here */
 
     return CHIDB_OK;
 }
 
 
+/* CreateIndex p1 p2 * *
+ *
+ * p1: register
+ * p2: 1 for a hash index (CREATE INDEX ... USING hash), 0 otherwise
+ *
+ * create a new, empty index B-Tree and store its root page number in
+ * register p1. An index created on a table that already has rows can be
+ * populated with chidb_Btree_buildIndex, which sorts the entries and
+ * builds the tree bottom-up instead of inserting them one at a time,
+ * reading the table on the threads of the database (chidb_nthreads).
+ * A covering index (CREATE INDEX ... INCLUDE) is a table B-Tree,
+ * populated with chidb_Btree_buildCoveringIndex. A hash index is not a
+ * B-Tree: its meta page is created with chidb_hashindex_create, and it
+ * is populated with chidb_hashindex_build.
+ */
 int chidb_dbm_op_CreateIndex (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
+    /* Catalogs and cached programs are for the old schema */
+    int rc = chidb_catalog_changed(stmt->db);
+    if (rc != CHIDB_OK)
+        return rc;
+
     /* Your code goes here */
 
     return CHIDB_OK;
 }
 
 
-int chidb_dbm_op_Copy (chidb_stmt *stmt, chidb_dbm_op_t *op)
+/* Analyze * * * p4
+ *
+ * p4: table name
+ *
+ * collect the statistics of table p4 with chidb_stats_analyze, passing
+ * it the table's root page, its columns, and the root page of the
+ * B-Tree index on each column, from the catalog (see chidb_catalog_table
+ * and chidb_catalog_index). Hash indexes are left out: the optimizer
+ * picks them without statistics.
+ */
+int chidb_dbm_op_Analyze (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
+    /* Cached programs were planned with the old statistics */
+    chidb_dbm_cache_invalidate(stmt->db->stmt_cache);
+
     /* Your code goes here */
 
     return CHIDB_OK;
 }
 
 
-int chidb_dbm_op_SCopy (chidb_stmt *stmt, chidb_dbm_op_t *op)
+/* AutoCommit p1 p2 * *
+ *
+ * p1: 0 to begin a transaction, 1 to end it
+ * p2: 1 to end it with a rollback, 0 with a commit
+ *
+ * begin (chidb_begin), commit (chidb_commit) or roll back (chidb_rollback)
+ * a transaction.
+ */
+int chidb_dbm_op_AutoCommit (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    if (op->p1 == 0)
+        return chidb_begin(stmt->db);
+
+    return op->p2 ? chidb_rollback(stmt->db) : chidb_commit(stmt->db);
+}
+
+
+/*** HASH JOINS ***/
+
+/* A hash join reads the smaller input once, into a hash table keyed by
+ * its join column, and then looks up each row of the larger input in
+ * it, instead of scanning the inner input again for every outer row:
+ *
+ *       HashOpen      h  nb np
+ *   build: (load the nb values of a row, key first, into rb..)
+ *       HashInsert    h  rb
+ *       Next          c1 build
+ *   probe: (load the np values of a row, key first, into rp..)
+ *       HashProbe     h  skip rp
+ *   match: HashColumn  h  i  r  ... ResultRow
+ *       HashNext      h  match
+ *   skip: Next        c2 probe
+ *       HashDeferred  h  end
+ *   match2: HashColumn h i  r  ... ResultRow
+ *       HashNext      h  match2
+ *   end:
+ *
+ * The rows that HashDeferred joins are those whose partition was spilled
+ * to a temporary file (see chidb_dbm_hash_t).
+ *
+ * A WHERE x IN (SELECT y ...) is a semi-join: the subquery is the build
+ * side (HashOpen with "semi", and y as the only value of its rows), and
+ * each row of the outer query is produced once if it has a match, so
+ * HashProbe goes straight on to the code of the row, without a HashNext
+ * loop. After HashDeferred, HashNext moves on to the next deferred row
+ * that has a match. */
+
+/* Returns hash table n of stmt, or NULL if it isn't open */
+static chidb_dbm_hash_t *chidb_dbm_op_hash(chidb_stmt *stmt, int32_t n)
+{
+    if (n < 0 || n >= stmt->nHashes || stmt->hashes[n].nbuild == 0)
+        return NULL;
+    return &stmt->hashes[n];
+}
+
+
+/* HashOpen p1 p2 p3 p4
+ *
+ * p1: hash table
+ * p2: number of values in a row of the build side
+ * p3: number of values in a row of the probe side
+ * p4: "semi" for a semi-join, or NULL
+ *
+ * create hash table p1 (emptying it if it was already open), to join
+ * rows of p2 values with rows of p3 values. The first value of a row is
+ * its join key. It keeps the statement's share of temporary memory (see
+ * chidb_stmt_temp_budget) in memory. In a semi-join, a probe row has at
+ * most one match, so HashNext never finds another one.
+ */
+int chidb_dbm_op_HashOpen (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rc;
+
+    if (op->p1 < 0 || op->p2 <= 0 || op->p3 <= 0)
+        return CHIDB_EMISUSE;
+
+    if (op->p1 >= stmt->nHashes)
+    {
+        chidb_dbm_hash_t *hashes = realloc(stmt->hashes, sizeof(chidb_dbm_hash_t) * (op->p1 + 1));
+        if (hashes == NULL)
+            return CHIDB_ENOMEM;
+        memset(hashes + stmt->nHashes, 0, sizeof(chidb_dbm_hash_t) * (op->p1 + 1 - stmt->nHashes));
+        stmt->hashes = hashes;
+        stmt->nHashes = op->p1 + 1;
+    }
+
+    chidb_dbm_hash_free(&stmt->hashes[op->p1]);
+    if ((rc = chidb_dbm_hash_init(&stmt->hashes[op->p1], op->p2, op->p3, chidb_stmt_temp_budget(stmt))) != CHIDB_OK)
+        return rc;
+    stmt->hashes[op->p1].semi = op->p4 != NULL && !strcmp(op->p4, "semi");
+
+    return CHIDB_OK;
+}
+
+
+/* HashInsert p1 p2 * *
+ *
+ * p1: hash table
+ * p2: register
+ *
+ * add the row in the registers starting at p2 to the build side of hash
+ * table p1. Its values are copied.
+ */
+int chidb_dbm_op_HashInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_hash_t *h = chidb_dbm_op_hash(stmt, op->p1);
+
+    if (h == NULL || op->p2 < 0 || !EXISTS_REGISTER(stmt, op->p2 + h->nbuild - 1))
+        return CHIDB_EMISUSE;
+
+    return chidb_dbm_hash_insert(h, &stmt->reg[op->p2]);
+}
+
+
+/* HashProbe p1 p2 p3 *
+ *
+ * p1: hash table
+ * p2: jump addr
+ * p3: register
+ *
+ * look up the row of the probe side in the registers starting at p3 in
+ * hash table p1, and move to its first match. If there is none, jump
+ * to p2 (rows in a spilled partition jump too, and are joined later by
+ * HashDeferred).
+ */
+int chidb_dbm_op_HashProbe (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_hash_t *h = chidb_dbm_op_hash(stmt, op->p1);
+    bool found;
+    int rc;
+
+    if (h == NULL || op->p3 < 0 || !EXISTS_REGISTER(stmt, op->p3 + h->nprobe - 1))
+        return CHIDB_EMISUSE;
+
+    if ((rc = chidb_dbm_hash_probe(h, &stmt->reg[op->p3], &found)) != CHIDB_OK)
+        return rc;
+    if (!found)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* HashFilter p1 p2 p3 *
+ *
+ * p1: hash table
+ * p2: jump addr
+ * p3: register
+ *
+ * if the join key in register p3 can't match any row of the build side
+ * of hash table p1, according to the Bloom filter of its keys (see
+ * chidb_dbm_hash_filter), jump to p2. A NULL key jumps too. This goes
+ * in the scan of the probe side, as soon as the key is read, so that a
+ * row without a match is dropped before the rest of it is read (and
+ * before any other condition is checked on it). Like HashProbe, this
+ * ends the build side.
+ */
+int chidb_dbm_op_HashFilter (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_hash_t *h = chidb_dbm_op_hash(stmt, op->p1);
+    bool maybe;
+    int rc;
+
+    if (h == NULL || !EXISTS_REGISTER(stmt, op->p3))
+        return CHIDB_EMISUSE;
+
+    if ((rc = chidb_dbm_hash_filter(h, &stmt->reg[op->p3], &maybe)) != CHIDB_OK)
+        return rc;
+    if (!maybe)
+        stmt->pc = op->p2;
 
     return CHIDB_OK;
 }
 
 
+/* HashNext p1 p2 * *
+ *
+ * p1: hash table
+ * p2: jump addr
+ *
+ * move hash table p1 to its next match, and jump to p2 if there is one.
+ * After HashDeferred, that may be a match of the next deferred row.
+ */
+int chidb_dbm_op_HashNext (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_hash_t *h = chidb_dbm_op_hash(stmt, op->p1);
+    bool found;
+    int rc;
+
+    if (h == NULL)
+        return CHIDB_EMISUSE;
+
+    if ((rc = chidb_dbm_hash_next(h, &found)) != CHIDB_OK)
+        return rc;
+    if (found)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* HashDeferred p1 p2 * *
+ *
+ * p1: hash table
+ * p2: jump addr
+ *
+ * once every probe row has gone through HashProbe, move hash table p1
+ * to the first match of the rows whose partition was spilled. If there
+ * is none, jump to p2.
+ */
+int chidb_dbm_op_HashDeferred (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_hash_t *h = chidb_dbm_op_hash(stmt, op->p1);
+    bool found;
+    int rc;
+
+    if (h == NULL)
+        return CHIDB_EMISUSE;
+
+    if ((rc = chidb_dbm_hash_deferred(h, &found)) != CHIDB_OK)
+        return rc;
+    if (!found)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* HashColumn p1 p2 p3 *
+ *
+ * p1: hash table
+ * p2: column number
+ * p3: register
+ *
+ * store value p2 of the current match of hash table p1 in register p3.
+ * The values of the build row come first, followed by those of the probe
+ * row. Like Column, strings point into the hash table instead of being
+ * copied.
+ */
+int chidb_dbm_op_HashColumn (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_hash_t *h = chidb_dbm_op_hash(stmt, op->p1);
+
+    if (h == NULL || op->p2 < 0 || op->p3 < 0)
+        return CHIDB_EMISUSE;
+
+    if (!EXISTS_REGISTER(stmt, op->p3))
+    {
+        int rc = realloc_reg(stmt, op->p3 + 1);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    return chidb_dbm_hash_column(h, op->p2, &stmt->reg[op->p3]);
+}
+
+
+/*** IN SETS ***/
+
+/* An IN list is made into a set once, before the rows are read, and
+ * each row is checked against it with a binary search, instead of
+ * being compared with every value of the list:
+ *
+ *       (load the n values of the list into rv..)
+ *       SetOpen       s  rv n
+ *   loop: (load the expression of the row into r)
+ *       InSet         s  skip r
+ *       ... ResultRow
+ *   skip: Next        c  loop
+ *
+ * If the expression is the primary key of the table, or a column with
+ * an index, the rows of the list are sought instead of scanning the
+ * table, one member at a time, in order (so the cursor moves forward
+ * through the B-Tree, and a value in the list twice is sought once):
+ *
+ *       SetOpen       s  rv n
+ *       Integer       0  zero
+ *   probe: SetNext    s  end r
+ *       Seek          c  probe r        (or SeekGe and IdxGt on an index)
+ *       ... ResultRow
+ *       Eq            zero probe zero
+ *   end:
+ */
+
+/* Returns set n of stmt, or NULL if it isn't open */
+static chidb_dbm_set_t *chidb_dbm_op_set(chidb_stmt *stmt, int32_t n)
+{
+    if (n < 0 || n >= stmt->nSets || !stmt->sets[n].open)
+        return NULL;
+    return &stmt->sets[n];
+}
+
+
+/* SetOpen p1 p2 p3 *
+ *
+ * p1: set
+ * p2: register
+ * p3: number of registers
+ *
+ * create set p1 (emptying it if it was already open) with the values of
+ * the p3 registers starting at p2. NULLs are left out.
+ */
+int chidb_dbm_op_SetOpen (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (op->p1 < 0 || op->p2 < 0 || op->p3 < 0 || (op->p3 > 0 && !EXISTS_REGISTER(stmt, op->p2 + op->p3 - 1)))
+        return CHIDB_EMISUSE;
+
+    if (op->p1 >= stmt->nSets)
+    {
+        chidb_dbm_set_t *sets = realloc(stmt->sets, sizeof(chidb_dbm_set_t) * (op->p1 + 1));
+        if (sets == NULL)
+            return CHIDB_ENOMEM;
+        memset(sets + stmt->nSets, 0, sizeof(chidb_dbm_set_t) * (op->p1 + 1 - stmt->nSets));
+        stmt->sets = sets;
+        stmt->nSets = op->p1 + 1;
+    }
+
+    chidb_dbm_set_free(&stmt->sets[op->p1]);
+    return chidb_dbm_set_init(&stmt->sets[op->p1], &stmt->reg[op->p2], op->p3);
+}
+
+
+/* InSet p1 p2 p3 *
+ *
+ * p1: set
+ * p2: jump addr
+ * p3: register
+ *
+ * if the value in register p3 is not in set p1, jump to p2. A NULL
+ * jumps too.
+ */
+int chidb_dbm_op_InSet (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_set_t *s = chidb_dbm_op_set(stmt, op->p1);
+
+    if (s == NULL || !EXISTS_REGISTER(stmt, op->p3))
+        return CHIDB_EMISUSE;
+
+    if (!chidb_dbm_set_contains(s, &stmt->reg[op->p3]))
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* SetNext p1 p2 p3 *
+ *
+ * p1: set
+ * p2: jump addr
+ * p3: register
+ *
+ * store the next member of set p1, in sorted order, in register p3, or
+ * jump to p2 if there are no more. Strings point into the set instead
+ * of being copied.
+ */
+int chidb_dbm_op_SetNext (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_set_t *s = chidb_dbm_op_set(stmt, op->p1);
+    bool found;
+    int rc;
+
+    if (s == NULL || op->p3 < 0)
+        return CHIDB_EMISUSE;
+
+    if (!EXISTS_REGISTER(stmt, op->p3))
+    {
+        if ((rc = realloc_reg(stmt, op->p3 + 1)) != CHIDB_OK)
+            return rc;
+    }
+
+    if ((rc = chidb_dbm_set_next(s, &stmt->reg[op->p3], &found)) != CHIDB_OK)
+        return rc;
+    if (!found)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/*** SORTERS ***/
+
+/* A sorter sorts rows by their first value. ORDER BY loads each row of
+ * the result, with the ORDER BY expression first, into a sorter, and
+ * then produces them from it, in order:
+ *
+ *       SorterOpen    s  n  0  [desc]
+ *   loop: (load the n values of a row, key first, into r..)
+ *       SorterInsert  s  r  0
+ *       Next          c  loop
+ *       SorterSort    s  end
+ *   out: SorterColumn s  i  r  ... ResultRow
+ *       SorterNext    s  out
+ *   end:
+ *
+ * With a LIMIT in register l and an OFFSET in register o, the sorter
+ * only keeps the rows that can make it to the result (SorterLimit s l o,
+ * right after SorterOpen), and the loop that produces them skips the
+ * first o and stops after l more:
+ *
+ *   out: IfPos        o  skip 1
+ *       SorterColumn  s  i  r  ... ResultRow
+ *       DecrJumpZero  l  end
+ *   skip: SorterNext  s  out
+ *
+ * Rows that don't fit in the memory of the sorter are written to sorted
+ * runs in temporary files, which SorterSort merges (see
+ * chidb_dbm_sorter_t).
+ *
+ * An index join looks up each row of the outer input in an index of the
+ * inner table. Its keys are sorted first, as many rows at a time as fit
+ * in the memory of the sorter, so that consecutive lookups walk the
+ * index (and the table, for rows whose primary keys follow the order of
+ * the index) forward instead of jumping around it:
+ *
+ *       SorterOpen    s  n
+ *       Integer       0  eof
+ *   outer: (load the n values of a row, key first, into r..)
+ *       SorterInsert  s  r  batch
+ *   next: Next        c1 outer
+ *       Integer       1  eof
+ *   batch: SorterSort s  done
+ *   probe: SorterColumn s 0 k
+ *       SeekGe        ci skip k
+ *   match: IdxGt      ci skip k
+ *       IdxPKey       ci pk
+ *       Seek          c2 skip2 pk  ... ResultRow
+ *   skip2: Next       ci match
+ *   skip: SorterNext  s  probe
+ *       Ne            eof next zero
+ *   done:
+ *
+ * where register zero holds 0, and eof becomes 1 once the outer input
+ * has been read, so that its last (partial) batch is the last one. */
+
+/* Returns sorter n of stmt, or NULL if it isn't open */
+static chidb_dbm_sorter_t *chidb_dbm_op_sorter(chidb_stmt *stmt, int32_t n)
+{
+    if (n < 0 || n >= stmt->nSorters || stmt->sorters[n].nvals == 0)
+        return NULL;
+    return &stmt->sorters[n];
+}
+
+
+/* SorterOpen p1 p2 p3 p4
+ *
+ * p1: sorter
+ * p2: number of values in a row
+ * p3: memory for the rows, in KiB (0 for the statement's share of
+ *     temporary memory, see chidb_stmt_temp_budget)
+ * p4: "desc" to sort in descending order (NULL for ascending)
+ *
+ * create sorter p1 (emptying it if it was already open), for rows of p2
+ * values that are sorted by the first one.
+ */
+int chidb_dbm_op_SorterOpen (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    size_t budget = op->p3 > 0 ? (size_t) op->p3 * 1024 : chidb_stmt_temp_budget(stmt);
+    bool desc = op->p4 != NULL && !strcmp(op->p4, "desc");
+
+    if (op->p1 < 0 || op->p2 <= 0 || op->p3 < 0)
+        return CHIDB_EMISUSE;
+
+    if (op->p1 >= stmt->nSorters)
+    {
+        chidb_dbm_sorter_t *sorters = realloc(stmt->sorters, sizeof(chidb_dbm_sorter_t) * (op->p1 + 1));
+        if (sorters == NULL)
+            return CHIDB_ENOMEM;
+        memset(sorters + stmt->nSorters, 0, sizeof(chidb_dbm_sorter_t) * (op->p1 + 1 - stmt->nSorters));
+        stmt->sorters = sorters;
+        stmt->nSorters = op->p1 + 1;
+    }
+
+    chidb_dbm_sorter_free(&stmt->sorters[op->p1]);
+    return chidb_dbm_sorter_init(&stmt->sorters[op->p1], op->p2, desc, budget);
+}
+
+
+/* SorterLimit p1 p2 p3 *
+ *
+ * p1: sorter
+ * p2: register
+ * p3: register (-1 if there is none)
+ *
+ * make sorter p1, which must be empty, keep only its first rows: as many
+ * as the integer in register p2 (a LIMIT) plus the one in register p3
+ * (an OFFSET). A negative LIMIT means there is no limit. See
+ * chidb_dbm_sorter_limit.
+ */
+int chidb_dbm_op_SorterLimit (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_sorter_t *s = chidb_dbm_op_sorter(stmt, op->p1);
+    int64_t limit;
+
+    if (s == NULL || !EXISTS_REGISTER(stmt, op->p2) || (op->p3 >= 0 && !EXISTS_REGISTER(stmt, op->p3)))
+        return CHIDB_EMISUSE;
+    if (stmt->reg[op->p2].type != REG_INT32 || stmt->reg[op->p2].value.i < 0)
+        return chidb_dbm_sorter_limit(s, 0);
+
+    limit = stmt->reg[op->p2].value.i;
+    if (op->p3 >= 0 && stmt->reg[op->p3].type == REG_INT32 && stmt->reg[op->p3].value.i > 0)
+        limit += stmt->reg[op->p3].value.i;
+
+    /* A LIMIT of 0 never reads the sorter, but the sorter needs a limit
+     * to keep nothing */
+    if (limit == 0)
+        limit = 1;
+
+    return chidb_dbm_sorter_limit(s, limit < UINT32_MAX ? (uint32_t) limit : 0);
+}
+
+
+/* SorterInsert p1 p2 p3 *
+ *
+ * p1: sorter
+ * p2: register
+ * p3: jump addr
+ *
+ * add the row in the registers starting at p2 to sorter p1. Its values
+ * are copied. If that fills the memory of the sorter, and p3 is 0, the
+ * rows in memory are written to a sorted run. Otherwise, jump to p3,
+ * where the program sorts and consumes the rows it has so far.
+ */
+int chidb_dbm_op_SorterInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_sorter_t *s = chidb_dbm_op_sorter(stmt, op->p1);
+    int rc;
+
+    if (s == NULL || op->p2 < 0 || !EXISTS_REGISTER(stmt, op->p2 + s->nvals - 1))
+        return CHIDB_EMISUSE;
+
+    if ((rc = chidb_dbm_sorter_insert(s, &stmt->reg[op->p2])) != CHIDB_OK)
+        return rc;
+    if (!chidb_dbm_sorter_full(s))
+        return CHIDB_OK;
+
+    if (op->p3 == 0)
+    {
+        chidb_tracer *trace = &stmt->db->bt->pager->trace;
+
+        if (CHIDB_TRACING(trace, CHIDB_TRACE_SPILL))
+        {
+            chidb_trace_event ev = {.type = CHIDB_TRACE_SPILL, .phase = CHIDB_TRACE_END,
+                                    .stmt = stmt, .bytes = s->used};
+            uint64_t start = chidb_time_ns();
+
+            ev.rc = chidb_dbm_sorter_spill(s);
+            chidb_trace_emit(trace, &ev, start);
+            return ev.rc;
+        }
+        return chidb_dbm_sorter_spill(s);
+    }
+    stmt->pc = op->p3;
+
+    return CHIDB_OK;
+}
+
+
+/* SorterSort p1 p2 * *
+ *
+ * p1: sorter
+ * p2: jump addr
+ *
+ * sort the rows of sorter p1, and move to the first one. If it is
+ * empty, jump to p2.
+ */
+int chidb_dbm_op_SorterSort (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_sorter_t *s = chidb_dbm_op_sorter(stmt, op->p1);
+    bool found;
+    int rc;
+
+    if (s == NULL)
+        return CHIDB_EMISUSE;
+
+    if ((rc = chidb_dbm_sorter_sort(s, &found)) != CHIDB_OK)
+        return rc;
+    if (!found)
+    {
+        chidb_dbm_sorter_clear(s);
+        stmt->pc = op->p2;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* SorterNext p1 p2 * *
+ *
+ * p1: sorter
+ * p2: jump addr
+ *
+ * move sorter p1 to its next row, and jump to p2 if there is one.
+ * Otherwise, the sorter is emptied, to take new rows.
+ */
+int chidb_dbm_op_SorterNext (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_sorter_t *s = chidb_dbm_op_sorter(stmt, op->p1);
+    bool found;
+    int rc;
+
+    if (s == NULL)
+        return CHIDB_EMISUSE;
+
+    if ((rc = chidb_dbm_sorter_next(s, &found)) != CHIDB_OK)
+        return rc;
+    if (found)
+        stmt->pc = op->p2;
+    else
+        chidb_dbm_sorter_clear(s);
+
+    return CHIDB_OK;
+}
+
+
+/* SorterColumn p1 p2 p3 *
+ *
+ * p1: sorter
+ * p2: column number
+ * p3: register
+ *
+ * store value p2 of the current row of sorter p1 in register p3. Like
+ * Column, strings point into the sorter instead of being copied.
+ */
+int chidb_dbm_op_SorterColumn (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_sorter_t *s = chidb_dbm_op_sorter(stmt, op->p1);
+
+    if (s == NULL || op->p2 < 0 || op->p3 < 0)
+        return CHIDB_EMISUSE;
+
+    if (!EXISTS_REGISTER(stmt, op->p3))
+    {
+        int rc = realloc_reg(stmt, op->p3 + 1);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    return chidb_dbm_sorter_column(s, op->p2, &stmt->reg[op->p3]);
+}
+
+
+/*** AGGREGATES ***/
+
+/* An aggregator computes the aggregate functions of a query (COUNT, SUM,
+ * AVG, MIN and MAX) over the rows of each group of a GROUP BY, in a hash
+ * table keyed by the GROUP BY columns, and then produces one row per
+ * group:
+ *
+ *       AggOpen       a  k  0  [funcs]
+ *   loop: (load the k values of the key of a row, followed by the
+ *          argument of each function, into r..)
+ *       AggStep       a  r  0
+ *       Next          c  loop
+ *       AggFinal      a  end
+ *   out: AggColumn    a  i  r  ... ResultRow
+ *       AggNext       a  out
+ *   end:
+ *
+ * where funcs names the functions, separated by commas (for instance,
+ * "count,max"). Without a GROUP BY, k is 0, and there is a single group.
+ * The argument of COUNT(*) is a constant, loaded with Integer.
+ *
+ * If the rows are read from an index on the GROUP BY column, they come
+ * ordered by their key, and a streaming aggregator (p3 of AggOpen is -1)
+ * produces each group as soon as the next one starts, without keeping
+ * the groups in memory:
+ *
+ *       AggOpen       a  k  -1 [funcs]
+ *       Integer       0  zero
+ *   loop: (load the key and the arguments of a row into r..)
+ *       AggStep       a  r  group
+ *   next: Next        c  loop
+ *       AggFinal      a  end
+ *       AggColumn     a  i  r  ... ResultRow
+ *   end: Halt
+ *   group: AggColumn  a  i  r  ... ResultRow
+ *       Eq            zero next zero
+ *
+ * DISTINCT is a GROUP BY on every column, without functions. UNION,
+ * INTERSECT and EXCEPT also go through an aggregator keyed by the whole
+ * row, into which the rows of both inputs are stepped. For INTERSECT
+ * and EXCEPT, each row is followed by an Integer with the input it comes
+ * from (1 for the first, 2 for the second), and "sides" ORs them for
+ * each group: only the groups with sides 3 are produced for INTERSECT,
+ * and those with sides 1 for EXCEPT. So every row is looked up once in
+ * the hash table (which spills to partitions if it outgrows its memory)
+ * instead of being compared with every row of the other input. When
+ * both inputs come ordered from indexes, they are merged instead: the
+ * loop steps the current value of the input whose value is smaller (or
+ * of the only one left) into a streaming aggregator, with its side, and
+ * moves that input forward:
+ *
+ *       AggOpen       a  1  -1 "sides"
+ *       Integer       0  zero
+ *       (Rewind the index cursors c1 and c2, and load the side of each
+ *        input, 1 and 2, into k+1 when it is stepped)
+ *   loop: (jump to take2 if c1 is over, to take1 if c2 is, and to end
+ *          if both are; otherwise load the value of c1 into r1, and
+ *          that of c2 into r2)
+ *       Lt            r1 take2 r2
+ *   take1: SCopy      r1 k
+ *       AggStep       a  k  group1
+ *   next1: Next       c1 loop
+ *       ...
+ *   group1: (produce the group, if its sides qualify)
+ *       Eq            zero next1 zero
+ *
+ * with the same code for c2, whose group jumps back to its own Next. The
+ * groups come out in order, and none is kept once the next one starts.
+ *
+ * A COUNT(*) of a whole table, without a WHERE clause, doesn't need to
+ * read its rows at all: Count adds up the cells of the table's leaves.
+ * Nor does a MIN or MAX of its primary key, or of an indexed column:
+ * MinKey and MaxKey read the first or last key of the table or index.
+ */
+
+/* Returns aggregator n of stmt, or NULL if it isn't open */
+static chidb_dbm_agg_t *chidb_dbm_op_agg(chidb_stmt *stmt, int32_t n)
+{
+    if (n < 0 || n >= stmt->nAggs || !stmt->aggs[n].open)
+        return NULL;
+    return &stmt->aggs[n];
+}
+
+
+/* AggOpen p1 p2 p3 p4
+ *
+ * p1: aggregator
+ * p2: number of values in a group key
+ * p3: memory for the groups, in KiB (0 for the statement's share of
+ *     temporary memory, see chidb_stmt_temp_budget), or -1 if the rows
+ *     come ordered by their key
+ * p4: aggregate functions ("count", "sum", "avg", "min", "max" or
+ *     "sides"), separated by commas
+ *
+ * create aggregator p1 (emptying it if it was already open), for groups
+ * with keys of p2 values, and the functions in p4.
+ */
+int chidb_dbm_op_AggOpen (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    size_t budget = op->p3 > 0 ? (size_t) op->p3 * 1024 : chidb_stmt_temp_budget(stmt);
+
+    if (op->p1 < 0 || op->p2 < 0 || op->p3 < -1)
+        return CHIDB_EMISUSE;
+
+    if (op->p1 >= stmt->nAggs)
+    {
+        chidb_dbm_agg_t *aggs = realloc(stmt->aggs, sizeof(chidb_dbm_agg_t) * (op->p1 + 1));
+        if (aggs == NULL)
+            return CHIDB_ENOMEM;
+        memset(aggs + stmt->nAggs, 0, sizeof(chidb_dbm_agg_t) * (op->p1 + 1 - stmt->nAggs));
+        stmt->aggs = aggs;
+        stmt->nAggs = op->p1 + 1;
+    }
+
+    chidb_dbm_agg_free(&stmt->aggs[op->p1]);
+    return chidb_dbm_agg_init(&stmt->aggs[op->p1], op->p2, op->p4, op->p3 < 0, budget);
+}
+
+
+/* AggStep p1 p2 p3 *
+ *
+ * p1: aggregator
+ * p2: register
+ * p3: jump addr
+ *
+ * add the row in the registers starting at p2 (the key of its group,
+ * followed by the argument of each function) to aggregator p1. If the
+ * aggregator is a streaming one, and the row starts a new group, jump
+ * to p3, where the previous group can be read with AggColumn.
+ */
+int chidb_dbm_op_AggStep (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_agg_t *a = chidb_dbm_op_agg(stmt, op->p1);
+    bool done;
+    int rc;
+
+    if (a == NULL || op->p2 < 0 ||
+        (a->nkeys + a->naggs > 0 && !EXISTS_REGISTER(stmt, op->p2 + a->nkeys + a->naggs - 1)))
+        return CHIDB_EMISUSE;
+
+    if ((rc = chidb_dbm_agg_step(a, &stmt->reg[op->p2], &done)) != CHIDB_OK)
+        return rc;
+    if (done)
+        stmt->pc = op->p3;
+
+    return CHIDB_OK;
+}
+
+
+/* AggFinal p1 p2 * *
+ *
+ * p1: aggregator
+ * p2: jump addr
+ *
+ * end the input of aggregator p1, and move to its first group (or, if
+ * it is a streaming one, to its last group). If there is none, jump
+ * to p2.
+ */
+int chidb_dbm_op_AggFinal (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_agg_t *a = chidb_dbm_op_agg(stmt, op->p1);
+    bool found;
+    int rc;
+
+    if (a == NULL)
+        return CHIDB_EMISUSE;
+
+    if ((rc = chidb_dbm_agg_final(a, &found)) != CHIDB_OK)
+        return rc;
+    if (!found)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* AggNext p1 p2 * *
+ *
+ * p1: aggregator
+ * p2: jump addr
+ *
+ * move aggregator p1 to its next group, and jump to p2 if there is one.
+ */
+int chidb_dbm_op_AggNext (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_agg_t *a = chidb_dbm_op_agg(stmt, op->p1);
+    bool found;
+    int rc;
+
+    if (a == NULL)
+        return CHIDB_EMISUSE;
+
+    if ((rc = chidb_dbm_agg_next(a, &found)) != CHIDB_OK)
+        return rc;
+    if (found)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* AggColumn p1 p2 p3 *
+ *
+ * p1: aggregator
+ * p2: column number
+ * p3: register
+ *
+ * store value p2 of the current group of aggregator p1 in register p3:
+ * the values of its key come first, followed by the result of each
+ * function. Strings point into the aggregator instead of being copied.
+ */
+int chidb_dbm_op_AggColumn (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_agg_t *a = chidb_dbm_op_agg(stmt, op->p1);
+
+    if (a == NULL || op->p2 < 0 || op->p3 < 0)
+        return CHIDB_EMISUSE;
+
+    if (!EXISTS_REGISTER(stmt, op->p3))
+    {
+        int rc = realloc_reg(stmt, op->p3 + 1);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    return chidb_dbm_agg_column(a, op->p2, &stmt->reg[op->p3]);
+}
+
+
+/* Count p1 p2 * *
+ *
+ * p1: cursor
+ * p2: register
+ *
+ * store the number of entries of the B-Tree of cursor p1 in register
+ * p2, with chidb_Btree_count, which reads the leaves' cell counts and
+ * none of their records.
+ */
+int chidb_dbm_op_Count (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c;
+    uint64_t n;
+    int rc;
+
+    if (!IS_VALID_CURSOR(stmt, op->p1) || op->p2 < 0)
+        return CHIDB_EMISUSE;
+
+    if (!EXISTS_REGISTER(stmt, op->p2) && (rc = realloc_reg(stmt, op->p2 + 1)) != CHIDB_OK)
+        return rc;
+
+    c = &stmt->cursors[op->p1];
+    if ((rc = chidb_Btree_count(c->bt, c->nroot, &n)) != CHIDB_OK)
+        return rc;
+    if (n > INT32_MAX)
+        return CHIDB_EMISMATCH;
+
+    chidb_dbm_reg_clear(&stmt->reg[op->p2]);
+    stmt->reg[op->p2].type = REG_INT32;
+    stmt->reg[op->p2].value.i = (int32_t) n;
+
+    return CHIDB_OK;
+}
+
+
+/* Stores the first or last key of the B-Tree of cursor op->p1 in
+ * register op->p2, or NULL if the B-Tree is empty */
+static int chidb_dbm_op_edgeKey(chidb_stmt *stmt, chidb_dbm_op_t *op, bool last)
+{
+    chidb_dbm_cursor_t *c;
+    chidb_key_t key;
+    int rc;
+
+    if (!IS_VALID_CURSOR(stmt, op->p1) || op->p2 < 0)
+        return CHIDB_EMISUSE;
+
+    if (!EXISTS_REGISTER(stmt, op->p2) && (rc = realloc_reg(stmt, op->p2 + 1)) != CHIDB_OK)
+        return rc;
+
+    c = &stmt->cursors[op->p1];
+    rc = last ? chidb_Btree_lastKey(c->bt, c->nroot, &key) : chidb_Btree_firstKey(c->bt, c->nroot, &key);
+    chidb_dbm_reg_clear(&stmt->reg[op->p2]);
+    if (rc == CHIDB_ENOTFOUND)
+    {
+        stmt->reg[op->p2].type = REG_NULL;
+        return CHIDB_OK;
+    }
+    if (rc != CHIDB_OK)
+        return rc;
+
+    stmt->reg[op->p2].type = REG_INT32;
+    stmt->reg[op->p2].value.i = (int32_t) key;
+
+    return CHIDB_OK;
+}
+
+
+/* MinKey p1 p2 * *
+ *
+ * p1: cursor
+ * p2: register
+ *
+ * store the smallest key of the B-Tree of cursor p1 in register p2 (NULL
+ * if it is empty), with chidb_Btree_firstKey, which only reads the left
+ * edge of the tree. On a table, this is MIN of its primary key; on an
+ * index, MIN of the indexed column.
+ */
+int chidb_dbm_op_MinKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_op_edgeKey(stmt, op, false);
+}
+
+
+/* MaxKey p1 p2 * *
+ *
+ * p1: cursor
+ * p2: register
+ *
+ * same as MinKey, for the largest key (MAX), from the last cell of the
+ * rightmost leaf.
+ */
+int chidb_dbm_op_MaxKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_op_edgeKey(stmt, op, true);
+}
+
+
+/* ZoneFilter p1 p2 p3 p4
+ *
+ * p1: cursor
+ * p2: column
+ * p3: register
+ * p4: comparison ("Eq", "Lt", "Le", "Gt" or "Ge")
+ *
+ * make the Next of table cursor p1 skip the subtrees where, according
+ * to the zone map of column p2 (see zonemap.c), no row has a value that
+ * compares as given by p4 with the integer in register p3 (see
+ * chidb_dbm_cursor_filter). Does nothing if the column has no zone map
+ * that is up to date, or if register p3 is not an integer. The rows
+ * that are not skipped must still be checked.
+ */
+int chidb_dbm_op_ZoneFilter (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c;
+    chidb_zonemap_t *zm;
+    int32_t min, max;
+    int cmp;
+
+    if (!IS_VALID_CURSOR(stmt, op->p1) || op->p2 < 0 || op->p2 > UINT8_MAX ||
+        !EXISTS_REGISTER(stmt, op->p3) || op->p4 == NULL)
+        return CHIDB_EMISUSE;
+
+    c = &stmt->cursors[op->p1];
+    if ((cmp = str_to_opcode(op->p4)) < 0 || !chidb_zonemap_interval(cmp, 0, &min, &max) || c->index)
+        return CHIDB_EMISUSE;
+    if (stmt->reg[op->p3].type != REG_INT32)
+        return CHIDB_OK;
+
+    chidb_zonemap_interval(cmp, stmt->reg[op->p3].value.i, &min, &max);
+    if ((zm = chidb_zonemap_get(c->bt, c->nroot, op->p2)) == NULL)
+        return CHIDB_OK;
+
+    return chidb_dbm_cursor_filter(c, zm, min, max);
+}
+
+
+/* Copy p1 p2 * *
+ *
+ * p1: register
+ * p2: register
+ *
+ * copy the value of register p1 into register p2, with
+ * chidb_dbm_reg_copy (only strings and bytes that don't fit in the
+ * register are allocated).
+ */
+int chidb_dbm_op_Copy (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    /* Your code goes here */
+
+    return CHIDB_OK;
+}
+
+
+/* SCopy p1 p2 * *
+ *
+ * p1: register
+ * p2: register
+ *
+ * make register p2 a shallow copy of register p1, with
+ * chidb_dbm_reg_scopy (which never allocates).
+ */
+int chidb_dbm_op_SCopy (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    /* Your code goes here */
+
+    return CHIDB_OK;
+}
+
+
+/* Variable p1 p2 * *
+ *
+ * p1: parameter (starting at 0)
+ * p2: register
+ *
+ * store the value bound to parameter p1 (the p1-th '?' of the SQL
+ * statement) in register p2. Like SCopy, strings are not copied: the
+ * register points to the bound string, which lives until it is bound
+ * again or the statement is finalized.
+ */
+int chidb_dbm_op_Variable (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (op->p1 < 0 || op->p1 >= stmt->nParams || op->p2 < 0)
+        return CHIDB_EMISUSE;
+
+    if (!EXISTS_REGISTER(stmt, op->p2))
+    {
+        int rc = realloc_reg(stmt, op->p2 + 1);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    chidb_dbm_reg_scopy(&stmt->reg[op->p2], &stmt->params[op->p1]);
+
+    return CHIDB_OK;
+}
+
+
+/* DecrJumpZero p1 p2 * *
+ *
+ * p1: register
+ * p2: jump addr
+ *
+ * subtract 1 from the integer in register p1, and jump to p2 if it
+ * becomes 0. With the LIMIT of a query in p1, run after each result
+ * row, it ends the query once it has produced them all, without reading
+ * the rest of a table or index whose rows come in order. A LIMIT of 0
+ * must be checked for before the first row.
+ */
+int chidb_dbm_op_DecrJumpZero (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_register_t *r;
+
+    if (!EXISTS_REGISTER(stmt, op->p1) || stmt->reg[op->p1].type != REG_INT32)
+        return CHIDB_EMISUSE;
+
+    r = &stmt->reg[op->p1];
+    r->value.i--;
+    if (r->value.i == 0)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* IfPos p1 p2 p3 *
+ *
+ * p1: register
+ * p2: jump addr
+ * p3: decrement
+ *
+ * if the integer in register p1 is positive, subtract p3 from it, and
+ * jump to p2. With the OFFSET of a query in p1, and 1 in p3, it skips
+ * the first OFFSET rows.
+ */
+int chidb_dbm_op_IfPos (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_register_t *r;
+
+    if (!EXISTS_REGISTER(stmt, op->p1))
+        return CHIDB_EMISUSE;
+
+    r = &stmt->reg[op->p1];
+    if (r->type == REG_INT32 && r->value.i > 0)
+    {
+        r->value.i -= op->p3;
+        stmt->pc = op->p2;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/*** PARALLEL SCANS ***/
+
+/* A scan of a whole table that only feeds aggregators (a GROUP BY, an
+ * aggregate function, a DISTINCT) can run on several threads at once
+ * (see dbm-parallel.c). The loop that reads the table is a fragment of
+ * the program, right after the Parallel instruction:
+ *
+ *       AggOpen       a  nkeys 0  "count,sum"
+ *       Parallel      c  done  root
+ *       Rewind        c  done
+ *   loop: (load the key and the arguments into k...)
+ *       AggStep       a  k
+ *       Next          c  loop
+ *   done: AggFinal    a  end
+ *       ...
+ *
+ * Each thread runs the fragment on the ranges of leaves that it takes
+ * (subtrees of the table, with cursor c opened on their roots), with
+ * its own copy of the registers, and of aggregator a. Their groups are
+ * merged into a once they are all done. The fragment can't produce
+ * rows, and the aggregators it feeds must be opened before Parallel
+ * (and can't be streaming ones).
+ */
+
+/* Parallel p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: jump addr
+ * p3: root page of a table
+ *
+ * run the instructions that follow, up to p2, on the rows of the table
+ * with root page p3, which cursor p1 reads: on several threads, each
+ * with its own part of the table, and then jump to p2 (see
+ * chidb_dbm_parallel_scan). With a single thread (see chidb_set_threads),
+ * or a small table, just open cursor p1 on the table, and go on.
+ */
+int chidb_dbm_op_Parallel (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_parallel_scan(stmt, op);
+}
+
+
+/*** SUPERINSTRUCTIONS ***/
+
+/* A superinstruction replaces the first of a sequence of instructions
+ * (see chidb_stmt_peephole), and runs it and the rest of the sequence,
+ * which is left in place after it. It must stop as soon as one of them
+ * returns something other than CHIDB_OK, or jumps (changes stmt->pc),
+ * just like the instructions themselves would. Jumps into the middle of
+ * the sequence still find the original instructions there. */
+
+/* Checks the return value rc of the instruction at position pos, run as
+ * part of a superinstruction. Returns true, moving stmt->pc past the
+ * next instruction, if the superinstruction must go on with it. Otherwise,
+ * returns false, and *ret is what the superinstruction must return. */
+static inline bool chidb_dbm_op_continue(chidb_stmt *stmt, uint32_t pos, int rc, int *ret)
+{
+    *ret = rc;
+    if (rc != CHIDB_OK || stmt->pc != pos + 1)
+        return false;
+
+    stmt->pc = pos + 2;
+    return true;
+}
+
+
+/* ColumnCmpJump p1 p2 p3 *
+ *
+ * Column p1 p2 p3, followed by another Column and a comparison (Eq, Ne,
+ * Lt, Le, Gt or Ge, or one of their typed versions, EqInt to GeInt),
+ * e.g., to check the condition of a WHERE clause that compares two
+ * columns.
+ */
+int chidb_dbm_op_ColumnCmpJump (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    uint32_t pos = op - stmt->ops;
+    int rc;
+
+    if (!chidb_dbm_op_continue(stmt, pos, chidb_dbm_op_Column(stmt, op), &rc))
+        return rc;
+    if (!chidb_dbm_op_continue(stmt, pos + 1, chidb_dbm_op_Column(stmt, op + 1), &rc))
+        return rc;
+
+    switch (op[2].opcode)
+    {
+    case Op_Eq:
+        return chidb_dbm_op_Eq(stmt, op + 2);
+    case Op_Ne:
+        return chidb_dbm_op_Ne(stmt, op + 2);
+    case Op_Lt:
+        return chidb_dbm_op_Lt(stmt, op + 2);
+    case Op_Le:
+        return chidb_dbm_op_Le(stmt, op + 2);
+    case Op_Gt:
+        return chidb_dbm_op_Gt(stmt, op + 2);
+    case Op_Ge:
+        return chidb_dbm_op_Ge(stmt, op + 2);
+    case Op_EqInt:
+    case Op_NeInt:
+    case Op_LtInt:
+    case Op_LeInt:
+    case Op_GtInt:
+    case Op_GeInt:
+        return chidb_dbm_op_cmpInt(stmt, op + 2, op[2].opcode);
+    default:
+        return CHIDB_EMISUSE;
+    }
+}
+
+
+/* SeekGeIdxPKey p1 p2 p3 *
+ *
+ * SeekGe p1 p2 p3, followed by IdxPKey, e.g., to look up the primary
+ * key of the first index entry of a range.
+ */
+int chidb_dbm_op_SeekGeIdxPKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    uint32_t pos = op - stmt->ops;
+    int rc;
+
+    if (!chidb_dbm_op_continue(stmt, pos, chidb_dbm_op_SeekGe(stmt, op), &rc))
+        return rc;
+
+    return chidb_dbm_op_IdxPKey(stmt, op + 1);
+}
+
+
+/* IntegerResultRow p1 p2 * *
+ *
+ * Integer p1 p2, followed by ResultRow, e.g., to return a constant.
+ */
+int chidb_dbm_op_IntegerResultRow (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    uint32_t pos = op - stmt->ops;
+    int rc;
+
+    if (!chidb_dbm_op_continue(stmt, pos, chidb_dbm_op_Integer(stmt, op), &rc))
+        return rc;
+
+    return chidb_dbm_op_ResultRow(stmt, op + 1);
+}
+
+
 int chidb_dbm_op_Halt (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -0,0 +1,361 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine parallel scans
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "dbm-parallel.h"
+#include "dbm.h"
+#include "dbm-agg.h"
+#include "btree.h"
+#include "util.h"
+
+int realloc_reg(chidb_stmt *stmt, uint32_t size);
+int realloc_cur(chidb_stmt *stmt, uint32_t size);
+int chidb_dbm_op_run (chidb_stmt *stmt);
+
+/* A parallel scan reads the morsels of a table (see chidb_Btree_morsels)
+ * on several threads. Each thread is a worker, that runs the fragment
+ * of the program that reads a row of the table and aggregates it in a
+ * copy of the statement, with its own registers, cursors and
+ * aggregators, on every morsel it takes.
+ *
+ * The morsels are split into a range for each worker, which takes them
+ * in order from the front of its range. A worker whose range is empty
+ * steals the back half of the range of another one, so that they all
+ * keep busy until the last morsels, even if some morsels take longer
+ * than others. Ranges are only ever locked one at a time. */
+
+struct chidb_dbm_parallel;
+
+typedef struct chidb_dbm_worker
+{
+    struct chidb_dbm_parallel *par;
+    chidb_stmt stmt;
+    pthread_t thread;
+    bool started;
+
+    /* Morsels left in its range, protected by lock */
+    pthread_mutex_t lock;
+    uint32_t next;
+    uint32_t end;
+
+    int rc;
+} chidb_dbm_worker_t;
+
+typedef struct chidb_dbm_parallel
+{
+    npage_t *morsels;
+    chidb_dbm_worker_t *workers;
+    uint32_t nworkers;
+
+    int32_t cursor;         /* Cursor that the fragment reads */
+    uint32_t start;         /* First instruction of the fragment */
+    PagerSnapshot *snapshot;/* Snapshot the statement reads (see chidb_stmt_exec) */
+
+    int failed;             /* Some worker failed: the others stop */
+} chidb_dbm_parallel_t;
+
+
+/*** Workers ***/
+
+/* Makes w->stmt a copy of stmt that runs the fragment of op: it shares
+ * the instructions and the parameters of stmt, and has copies of its
+ * registers, cursors on the same B-Trees as its cursors (except the one
+ * the fragment reads), and empty aggregators like its own, which get
+ * an even share of their budgets */
+static int parallel_clone(chidb_dbm_worker_t *w, chidb_stmt *stmt, chidb_dbm_op_t *op, uint32_t nworkers)
+{
+    chidb_stmt *c = &w->stmt;
+    int rc;
+
+    if ((rc = chidb_stmt_init(c, stmt->db)) != CHIDB_OK)
+        return rc;
+
+    free(c->ops);
+    c->ops = stmt->ops;
+    c->nOps = stmt->nOps;
+    c->endOp = op->p2;
+    c->params = stmt->params;
+    c->nParams = stmt->nParams;
+    c->compile = DBM_COMPILE_NEVER;
+
+    if ((stmt->nReg > c->nReg && (rc = realloc_reg(c, stmt->nReg)) != CHIDB_OK) ||
+        (stmt->nCursors > c->nCursors && (rc = realloc_cur(c, stmt->nCursors)) != CHIDB_OK))
+        return rc;
+
+    for (uint32_t i = 0; i < stmt->nReg; i++)
+        if (stmt->reg[i].type != REG_UNSPECIFIED && (rc = chidb_dbm_reg_copy(&c->reg[i], &stmt->reg[i])) != CHIDB_OK)
+            return rc;
+
+    for (uint32_t i = 0; i < stmt->nCursors; i++)
+    {
+        chidb_dbm_cursor_t *cur = &stmt->cursors[i];
+
+        if (i != op->p1 && cur->type != CURSOR_UNSPECIFIED &&
+            (rc = chidb_dbm_cursor_open(&c->cursors[i], cur->type, cur->bt, cur->nroot)) != CHIDB_OK)
+            return rc;
+    }
+
+    if (stmt->nAggs > 0)
+    {
+        if ((c->aggs = calloc(stmt->nAggs, sizeof(chidb_dbm_agg_t))) == NULL)
+            return CHIDB_ENOMEM;
+        c->nAggs = stmt->nAggs;
+    }
+    for (uint32_t i = 0; i < stmt->nAggs; i++)
+        if (stmt->aggs[i].open &&
+            (rc = chidb_dbm_agg_clone(&c->aggs[i], &stmt->aggs[i], stmt->aggs[i].budget / nworkers)) != CHIDB_OK)
+            return rc;
+
+    return CHIDB_OK;
+}
+
+/* Frees the copy of a statement, leaving alone what it shares with it */
+static void parallel_free(chidb_dbm_worker_t *w, chidb_stmt *stmt)
+{
+    chidb_stmt *c = &w->stmt;
+
+    for (uint32_t i = 0; i < c->nCursors; i++)
+        if (c->cursors[i].type != CURSOR_UNSPECIFIED)
+            chidb_dbm_cursor_close(&c->cursors[i]);
+
+    if (c->ops == stmt->ops)
+        c->ops = NULL;
+    if (c->params == stmt->params)
+    {
+        c->params = NULL;
+        c->nParams = 0;
+    }
+    chidb_stmt_free(c);
+}
+
+/* Takes the next morsel of a worker's range, or steals from another
+ * worker if its range is empty. Returns false once every range is. */
+static bool parallel_take(chidb_dbm_parallel_t *par, chidb_dbm_worker_t *w, npage_t *morsel)
+{
+    uint32_t self = w - par->workers;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->next < w->end)
+    {
+        *morsel = par->morsels[w->next++];
+        pthread_mutex_unlock(&w->lock);
+        return true;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    for (uint32_t i = 1; i < par->nworkers; i++)
+    {
+        chidb_dbm_worker_t *v = &par->workers[(self + i) % par->nworkers];
+        uint32_t lo = 0, hi = 0;
+
+        pthread_mutex_lock(&v->lock);
+        if (v->next < v->end)
+        {
+            hi = v->end;
+            lo = v->end - (v->end - v->next + 1) / 2;
+            v->end = lo;
+        }
+        pthread_mutex_unlock(&v->lock);
+
+        if (lo < hi)
+        {
+            pthread_mutex_lock(&w->lock);
+            w->next = lo + 1;
+            w->end = hi;
+            pthread_mutex_unlock(&w->lock);
+            *morsel = par->morsels[lo];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Runs the fragment on every morsel the worker can take */
+static void *parallel_work(void *arg)
+{
+    chidb_dbm_worker_t *w = arg;
+    chidb_dbm_parallel_t *par = w->par;
+    chidb_dbm_cursor_t *cur = &w->stmt.cursors[par->cursor];
+    PagerSnapshot *prev = chidb_Pager_useSnapshot(par->snapshot);
+    npage_t morsel;
+
+    while (!__atomic_load_n(&par->failed, __ATOMIC_RELAXED) && parallel_take(par, w, &morsel))
+    {
+        if ((w->rc = chidb_dbm_cursor_open(cur, CURSOR_READ, w->stmt.db->bt, morsel)) == CHIDB_OK)
+        {
+            w->stmt.pc = par->start;
+            w->rc = chidb_dbm_op_run(&w->stmt);
+            chidb_dbm_cursor_close(cur);
+        }
+
+        /* A fragment can't produce rows, or halt the statement */
+        if (w->rc != CHIDB_OK)
+        {
+            if (w->rc == CHIDB_ROW || w->rc == CHIDB_DONE)
+                w->rc = CHIDB_EMISUSE;
+            __atomic_store_n(&par->failed, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    chidb_Pager_useSnapshot(prev);
+    return NULL;
+}
+
+
+/*** Interface ***/
+
+/* Run a parallel scan (see the Parallel instruction)
+ *
+ * Splits the table into morsels, and runs the fragment of the program
+ * that follows op on all of them, on chidb_nthreads workers
+ * (the thread that runs the statement is one of them). Once they are
+ * done, the groups of the aggregators of each worker are merged into the
+ * statement's (see chidb_dbm_agg_merge), and the statement goes on
+ * after the fragment.
+ *
+ * With a single thread, or a table that fits in a single morsel, the
+ * statement just opens cursor op->p1 on the table, and runs the fragment
+ * itself.
+ *
+ * Parameters
+ * - stmt: DBM, whose pc is the first instruction of the fragment
+ * - op: Parallel instruction
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The table is an index, or the fragment produced a row,
+ *   halted, or used a hash table or a sorter (which the workers don't
+ *   have)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - Any error code returned by an instruction of the fragment
+ */
+int chidb_dbm_parallel_scan(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_parallel_t par;
+    uint32_t nthreads = chidb_nthreads(stmt->db);
+    uint32_t nmorsels;
+    int rc;
+
+    if (op->p1 < 0 || op->p2 < stmt->pc || op->p2 > stmt->endOp)
+        return CHIDB_EMISUSE;
+
+    if (!EXISTS_CURSOR(stmt, op->p1) && (rc = realloc_cur(stmt, op->p1 + 1)) != CHIDB_OK)
+        return rc;
+    if (stmt->cursors[op->p1].type != CURSOR_UNSPECIFIED)
+        chidb_dbm_cursor_close(&stmt->cursors[op->p1]);
+
+    nmorsels = 1;
+    par.morsels = NULL;
+    if (nthreads > 1 &&
+        (rc = chidb_Btree_morsels(stmt->db->bt, op->p3, nthreads * DBM_PARALLEL_MORSELS, &par.morsels, &nmorsels)) != CHIDB_OK)
+        return rc;
+
+    if (nmorsels <= 1)
+    {
+        free(par.morsels);
+        return chidb_dbm_cursor_open(&stmt->cursors[op->p1], CURSOR_READ, stmt->db->bt, op->p3);
+    }
+
+    par.nworkers = nthreads < nmorsels ? nthreads : nmorsels;
+    par.cursor = op->p1;
+    par.start = stmt->pc;
+    par.snapshot = stmt->snapshot;
+    par.failed = 0;
+    if ((par.workers = calloc(par.nworkers, sizeof(chidb_dbm_worker_t))) == NULL)
+    {
+        free(par.morsels);
+        return CHIDB_ENOMEM;
+    }
+
+    rc = CHIDB_OK;
+    for (uint32_t i = 0; i < par.nworkers; i++)
+    {
+        chidb_dbm_worker_t *w = &par.workers[i];
+
+        w->par = &par;
+        pthread_mutex_init(&w->lock, NULL);
+        w->next = (uint64_t) nmorsels * i / par.nworkers;
+        w->end = (uint64_t) nmorsels * (i + 1) / par.nworkers;
+        if (rc == CHIDB_OK)
+            rc = parallel_clone(w, stmt, op, par.nworkers);
+        else
+            chidb_stmt_init(&w->stmt, stmt->db);
+    }
+
+    if (rc == CHIDB_OK)
+    {
+        /* A worker whose thread couldn't be started leaves its range to
+         * be stolen by the others */
+        for (uint32_t i = 1; i < par.nworkers; i++)
+            par.workers[i].started = pthread_create(&par.workers[i].thread, NULL, parallel_work, &par.workers[i]) == 0;
+        parallel_work(&par.workers[0]);
+        for (uint32_t i = 1; i < par.nworkers; i++)
+            if (par.workers[i].started)
+                pthread_join(par.workers[i].thread, NULL);
+
+        for (uint32_t i = 0; i < par.nworkers && rc == CHIDB_OK; i++)
+            rc = par.workers[i].rc;
+    }
+
+    for (uint32_t i = 0; i < par.nworkers; i++)
+    {
+        chidb_dbm_worker_t *w = &par.workers[i];
+
+        for (uint32_t j = 0; j < stmt->nAggs && rc == CHIDB_OK; j++)
+            if (stmt->aggs[j].open)
+                rc = chidb_dbm_agg_merge(&stmt->aggs[j], &w->stmt.aggs[j]);
+        stmt->ninstr += w->stmt.ninstr;
+        parallel_free(w, stmt);
+        pthread_mutex_destroy(&w->lock);
+    }
+    free(par.workers);
+    free(par.morsels);
+
+    if (rc == CHIDB_OK)
+        stmt->pc = op->p2;
+
+    return rc;
+}
@@ -0,0 +1,601 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine result cache
+ *
+ * Clients such as dashboards keep running the same read-only queries on
+ * tables that rarely change. When it is enabled (see
+ * chidb_set_result_cache), chidb_step keeps the rows that such a
+ * statement returned in an LRU cache (one per database), keyed by its
+ * normalized SQL and the values bound to its parameters, and returns
+ * them the next time the statement runs with the same parameters,
+ * without running its program, for as long as they are still what it
+ * would return.
+ *
+ * Whether they are is decided with counters of modifications. Each
+ * table (and index) has one, found by its root page, which a statement
+ * that writes to it increments when it starts and when it is done (see
+ * chidb_dbm_result_written), and the rows are kept with the values of
+ * the counters of everything the statement read when it started. Writes
+ * by other connections are detected with chidb_Pager_changes, which
+ * this connection's own commits also change, so entries of tables that
+ * a commit didn't write are moved on to its new value (see
+ * chidb_dbm_result_refresh). Rollbacks and schema changes empty the
+ * cache.
+ *
+ * The tables a statement reads are found in its program: the root page
+ * of OpenRead and HashIdxSeek is the integer that the closest Integer
+ * instruction before them stores in their register, which is how the
+ * code generator loads it. A statement that reads a table any other way,
+ * or too many of them, is not cached, and one that writes to a table any
+ * other way empties the cache.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "dbm-result.h"
+#include "dbm-cache.h"
+#include "crc32c.h"
+
+/* Defined in dbm.c */
+int realloc_reg(chidb_stmt *stmt, uint32_t size);
+
+
+/* Create an empty result cache
+ *
+ * The cache is disabled (it may use no memory) until
+ * chidb_dbm_result_setmax.
+ *
+ * Parameters
+ * - cache: Out parameter. Returns the new cache.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_result_init(chidb_dbm_result_t **cache)
+{
+    *cache = calloc(1, sizeof(chidb_dbm_result_t));
+    if (*cache == NULL)
+        return CHIDB_ENOMEM;
+
+    return CHIDB_OK;
+}
+
+
+static void chidb_dbm_result_entry_free(chidb_dbm_result_entry_t *e)
+{
+    free(e->sql);
+    free(e->params);
+    free(e->rows);
+    free(e);
+}
+
+
+/* Removes an entry from the hash table and the LRU list, and frees it,
+ * unless a statement is still returning its rows */
+static void chidb_dbm_result_remove(chidb_dbm_result_t *cache, chidb_dbm_result_entry_t *e)
+{
+    chidb_dbm_result_entry_t **p = &cache->buckets[e->hash % DBM_RESULT_BUCKETS];
+
+    while (*p != e)
+        p = &(*p)->hnext;
+    *p = e->hnext;
+
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        cache->first = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        cache->last = e->prev;
+
+    cache->n--;
+    cache->bytes -= e->bytes;
+    e->cached = false;
+    if (e->nrefs == 0)
+        chidb_dbm_result_entry_free(e);
+}
+
+
+/* Free a result cache, and all the results in it
+ *
+ * Parameters
+ * - cache: Cache to free (may be NULL)
+ */
+void chidb_dbm_result_free(chidb_dbm_result_t *cache)
+{
+    if (cache == NULL)
+        return;
+
+    chidb_dbm_result_invalidate(cache);
+    free(cache);
+}
+
+
+/* Remove all the results from a result cache
+ *
+ * Called when a transaction is rolled back, since results read in it
+ * may include rows that no longer exist, when the schema changes, and
+ * when a statement writes to a table that can't be told from its
+ * program. The hit and miss counters are kept.
+ *
+ * Parameters
+ * - cache: Cache (may be NULL)
+ */
+void chidb_dbm_result_invalidate(chidb_dbm_result_t *cache)
+{
+    if (cache == NULL)
+        return;
+
+    while (cache->first != NULL)
+        chidb_dbm_result_remove(cache, cache->first);
+}
+
+
+/* Set the memory of a result cache
+ *
+ * Evicts the least recently used results until the others fit.
+ *
+ * Parameters
+ * - cache: Cache
+ * - bytes: Memory that the cached rows may use, or 0 to disable the cache
+ */
+void chidb_dbm_result_setmax(chidb_dbm_result_t *cache, size_t bytes)
+{
+    cache->max = bytes;
+    while (cache->bytes > cache->max)
+        chidb_dbm_result_remove(cache, cache->last);
+}
+
+
+/* Get a statement ready to use the result cache
+ *
+ * Called by chidb_prepare. A statement that doesn't write to the
+ * database, and isn't an EXPLAIN, keeps its normalized SQL, which
+ * chidb_dbm_result_begin looks up. Statements prepared while the cache
+ * is disabled, or if there is no memory for their SQL, don't use it.
+ *
+ * Parameters
+ * - cache: Cache
+ * - sql: SQL statement
+ * - stmt: Statement with the program generated for sql
+ */
+void chidb_dbm_result_prepare(chidb_dbm_result_t *cache, const char *sql, chidb_stmt *stmt)
+{
+    if (cache->max == 0 || stmt->explain || stmt->plan != NULL || chidb_stmt_writes(stmt))
+        return;
+
+    free(stmt->result_sql);
+    stmt->result_sql = chidb_dbm_cache_normalize(sql);
+}
+
+
+/* Finds the root page loaded into register reg before instruction pos
+ * (see the comments at the top of this file) */
+static bool chidb_dbm_result_root(chidb_stmt *stmt, uint32_t pos, int32_t reg, npage_t *nroot)
+{
+    while (pos-- > 0)
+    {
+        chidb_dbm_op_t *op = &stmt->ops[pos];
+
+        if ((op->opcode == Op_Integer || op->opcode == Op_IntegerResultRow) && op->p2 == reg)
+        {
+            *nroot = op->p1;
+            return op->p1 > 0;
+        }
+    }
+
+    return false;
+}
+
+
+/* Root pages of the tables and indexes that a statement reads, or -1 if
+ * they can't be told, or there are more than DBM_RESULT_MAXROOTS */
+static int chidb_dbm_result_roots(chidb_stmt *stmt, npage_t *roots)
+{
+    int n = 0;
+
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *op = &stmt->ops[i];
+        npage_t nroot;
+
+        switch (op->opcode)
+        {
+        case Op_OpenRead:
+            if (!chidb_dbm_result_root(stmt, i, op->p2, &nroot))
+                return -1;
+            break;
+        case Op_HashIdxSeek:
+            if (!chidb_dbm_result_root(stmt, i, op->p3, &nroot))
+                return -1;
+            break;
+        case Op_Parallel:
+            nroot = op->p3;
+            break;
+        default:
+            continue;
+        }
+
+        if (n == DBM_RESULT_MAXROOTS)
+            return -1;
+        roots[n++] = nroot;
+    }
+
+    return n;
+}
+
+
+/* Whether the rows of an entry are still what its statement returns */
+static bool chidb_dbm_result_valid(chidb_dbm_result_t *cache, chidb_dbm_result_entry_t *e, uint32_t nchanges)
+{
+    if (e->nchanges != nchanges)
+        return false;
+
+    for (uint32_t i = 0; i < e->nroots; i++)
+        if (cache->mods[e->roots[i] % DBM_RESULT_NMODS] != e->mods[i])
+            return false;
+
+    return true;
+}
+
+
+/* Looks up a normalized statement and the values of its parameters */
+static chidb_dbm_result_entry_t *chidb_dbm_result_lookup(chidb_dbm_result_t *cache, const char *sql,
+                                                         const uint8_t *params, uint32_t nparams, uint32_t hash)
+{
+    for (chidb_dbm_result_entry_t *e = cache->buckets[hash % DBM_RESULT_BUCKETS]; e != NULL; e = e->hnext)
+        if (e->hash == hash && e->nparams == nparams && strcmp(e->sql, sql) == 0 &&
+            memcmp(e->params, params, nparams) == 0)
+            return e;
+
+    return NULL;
+}
+
+
+/* Start running a statement with the result cache
+ *
+ * Called before the first instruction of a statement prepared with
+ * chidb_dbm_result_prepare. If the rows it returned the last time it ran
+ * with the same parameters are in the cache, and still valid, the
+ * statement returns them (see chidb_dbm_result_next) instead of running
+ * its program. Otherwise, unless the tables it reads can't be told, it
+ * records the rows that its program returns (see
+ * chidb_dbm_result_record). Either way, stmt->result is the entry it
+ * uses, until chidb_dbm_result_release. If there is no memory for the
+ * entry, the statement just runs its program.
+ *
+ * Parameters
+ * - cache: Cache
+ * - stmt: Statement
+ * - nchanges: chidb_Pager_changes, before the statement runs
+ */
+void chidb_dbm_result_begin(chidb_dbm_result_t *cache, chidb_stmt *stmt, uint32_t nchanges)
+{
+    chidb_dbm_result_entry_t *e;
+    npage_t roots[DBM_RESULT_MAXROOTS];
+    uint8_t *params;
+    uint32_t nparams, hash;
+    int nroots;
+
+    /* A profiled statement is run to count its instructions */
+    if (cache->max == 0 || stmt->result_sql == NULL || stmt->profile != NULL)
+        return;
+
+    nparams = chidb_dbm_reg_serialize(stmt->params, stmt->nParams, NULL);
+    params = malloc(nparams > 0 ? nparams : 1);
+    if (params == NULL)
+        return;
+    chidb_dbm_reg_serialize(stmt->params, stmt->nParams, params);
+    hash = chidb_crc32c(chidb_crc32c(0, stmt->result_sql, strlen(stmt->result_sql)), params, nparams);
+
+    e = chidb_dbm_result_lookup(cache, stmt->result_sql, params, nparams, hash);
+    if (e != NULL && e->ncols == stmt->nCols && chidb_dbm_result_valid(cache, e, nchanges))
+    {
+        free(params);
+        cache->hits++;
+
+        /* Move to the front of the LRU list */
+        if (e != cache->first)
+        {
+            e->prev->next = e->next;
+            if (e->next)
+                e->next->prev = e->prev;
+            else
+                cache->last = e->prev;
+            e->prev = NULL;
+            e->next = cache->first;
+            cache->first->prev = e;
+            cache->first = e;
+        }
+
+        e->nrefs++;
+        stmt->result = e;
+        stmt->result_pos = 0;
+        return;
+    }
+    if (e != NULL)
+        chidb_dbm_result_remove(cache, e);
+    cache->misses++;
+
+    nroots = chidb_dbm_result_roots(stmt, roots);
+    if (nroots < 0 || (e = calloc(1, sizeof(chidb_dbm_result_entry_t))) == NULL)
+    {
+        free(params);
+        return;
+    }
+    e->params = params;
+    e->nparams = nparams;
+    e->hash = hash;
+    if ((e->sql = strdup(stmt->result_sql)) == NULL)
+    {
+        chidb_dbm_result_entry_free(e);
+        return;
+    }
+    for (int i = 0; i < nroots; i++)
+    {
+        e->roots[i] = roots[i];
+        e->mods[i] = cache->mods[roots[i] % DBM_RESULT_NMODS];
+    }
+    e->nroots = nroots;
+    e->nchanges = nchanges;
+    e->ncols = stmt->nCols;
+    e->bytes = sizeof(chidb_dbm_result_entry_t) + strlen(e->sql) + 1 + nparams;
+    e->nrefs = 1;
+
+    stmt->result = e;
+    stmt->result_pos = 0;
+}
+
+
+/* Return the next cached row of a statement
+ *
+ * The values of the row are loaded into the first registers of the
+ * statement, which is its result row. Strings are not copied: the
+ * registers point to the entry, which is kept until the statement is
+ * reset.
+ *
+ * Parameters
+ * - stmt: Statement returning the rows of a complete entry
+ *
+ * Return
+ * - CHIDB_ROW: The row is in the result row of the statement
+ * - CHIDB_DONE: There are no more rows
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_result_next(chidb_stmt *stmt)
+{
+    chidb_dbm_result_entry_t *e = stmt->result;
+    int rc;
+
+    if (stmt->result_pos == e->size)
+        return CHIDB_DONE;
+
+    if (e->ncols > stmt->nReg && (rc = realloc_reg(stmt, e->ncols)) != CHIDB_OK)
+        return rc;
+    for (uint32_t i = 0; i < e->ncols; i++)
+    {
+        if ((rc = chidb_dbm_reg_deserialize(&stmt->reg[i], e->rows + stmt->result_pos)) != CHIDB_OK)
+            return rc;
+        stmt->result_pos += chidb_dbm_reg_serialsize(e->rows + stmt->result_pos);
+    }
+    stmt->startRR = 0;
+    stmt->nRR = e->ncols;
+
+    return CHIDB_ROW;
+}
+
+
+/* Record what a step of a statement returned
+ *
+ * Called after each step of a statement that is recording its rows (see
+ * chidb_dbm_result_begin). A row is added to the entry, unless it
+ * doesn't fit in the cache, in which case the statement stops recording.
+ * When the statement is done, the entry goes to the cache if none of
+ * what it read has changed since it started, evicting the least
+ * recently used results that it doesn't leave room for. If it fails,
+ * what it recorded is thrown away.
+ *
+ * Parameters
+ * - cache: Cache
+ * - stmt: Statement
+ * - rc: What the step returned
+ * - nchanges: chidb_Pager_changes, after the step
+ */
+void chidb_dbm_result_record(chidb_dbm_result_t *cache, chidb_stmt *stmt, int rc, uint32_t nchanges)
+{
+    chidb_dbm_result_entry_t *e = stmt->result, *old;
+    size_t size;
+
+    if (rc == CHIDB_ROW)
+    {
+        size = chidb_dbm_reg_serialize(&stmt->reg[stmt->startRR], stmt->nRR, NULL);
+        if (e->bytes + e->size + size > cache->max)
+        {
+            chidb_dbm_result_release(stmt);
+            return;
+        }
+        if (e->size + size > e->alloc)
+        {
+            size_t alloc = e->alloc > 0 ? e->alloc * 2 : 256;
+            uint8_t *rows;
+
+            while (alloc < e->size + size)
+                alloc *= 2;
+            if ((rows = realloc(e->rows, alloc)) == NULL)
+            {
+                chidb_dbm_result_release(stmt);
+                return;
+            }
+            e->rows = rows;
+            e->alloc = alloc;
+        }
+        e->size += chidb_dbm_reg_serialize(&stmt->reg[stmt->startRR], stmt->nRR, e->rows + e->size);
+        return;
+    }
+
+    if (rc != CHIDB_DONE || !chidb_dbm_result_valid(cache, e, nchanges) || e->bytes + e->size > cache->max)
+    {
+        chidb_dbm_result_release(stmt);
+        return;
+    }
+
+    if (e->size < e->alloc)
+    {
+        uint8_t *rows = realloc(e->rows, e->size > 0 ? e->size : 1);
+
+        if (rows != NULL)
+            e->rows = rows;
+    }
+    e->bytes += e->size;
+
+    if ((old = chidb_dbm_result_lookup(cache, e->sql, e->params, e->nparams, e->hash)) != NULL)
+        chidb_dbm_result_remove(cache, old);
+    while (cache->bytes + e->bytes > cache->max)
+        chidb_dbm_result_remove(cache, cache->last);
+
+    e->hnext = cache->buckets[e->hash % DBM_RESULT_BUCKETS];
+    cache->buckets[e->hash % DBM_RESULT_BUCKETS] = e;
+    e->prev = NULL;
+    e->next = cache->first;
+    if (cache->first)
+        cache->first->prev = e;
+    else
+        cache->last = e;
+    cache->first = e;
+    cache->n++;
+    cache->bytes += e->bytes;
+    e->complete = true;
+    e->cached = true;
+
+    /* The statement has returned all of its rows */
+    stmt->result_pos = e->size;
+}
+
+
+/* Stop using the result cache entry of a statement
+ *
+ * Called when the statement is reset or freed. An entry that was being
+ * recorded, or that was evicted while the statement returned its rows,
+ * is freed.
+ *
+ * Parameters
+ * - stmt: Statement
+ */
+void chidb_dbm_result_release(chidb_stmt *stmt)
+{
+    chidb_dbm_result_entry_t *e = stmt->result;
+
+    if (e == NULL)
+        return;
+
+    stmt->result = NULL;
+    if (--e->nrefs == 0 && !e->cached)
+        chidb_dbm_result_entry_free(e);
+}
+
+
+/* Count a write to a table
+ *
+ * Increments the counter of modifications of the table (or index) with
+ * root page nroot, which makes the results that read it stale.
+ *
+ * Parameters
+ * - cache: Cache
+ * - nroot: Root page of the table
+ */
+void chidb_dbm_result_touch(chidb_dbm_result_t *cache, npage_t nroot)
+{
+    cache->mods[nroot % DBM_RESULT_NMODS]++;
+}
+
+
+/* Count the writes of a statement
+ *
+ * Called when a statement that writes to the database starts and when
+ * it is done (see chidb_stmt_exec), so that no result read while it runs
+ * is kept. Touches the tables and indexes it opens for writing
+ * (OpenWrite) and the hash indexes it inserts into (HashIdxInsert), or,
+ * if they can't be told, empties the cache.
+ *
+ * Parameters
+ * - cache: Cache
+ * - stmt: Statement
+ */
+void chidb_dbm_result_written(chidb_dbm_result_t *cache, chidb_stmt *stmt)
+{
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *op = &stmt->ops[i];
+        npage_t nroot;
+        bool found;
+
+        if (op->opcode == Op_OpenWrite)
+            found = chidb_dbm_result_root(stmt, i, op->p2, &nroot);
+        else if (op->opcode == Op_HashIdxInsert)
+            found = chidb_dbm_result_root(stmt, i, op->p1, &nroot);
+        else
+            continue;
+
+        if (!found)
+        {
+            chidb_dbm_result_invalidate(cache);
+            return;
+        }
+        chidb_dbm_result_touch(cache, nroot);
+    }
+}
+
+
+/* Keep the results of the tables a commit didn't write
+ *
+ * Called after this connection commits. The results that were valid
+ * right before the commit only read tables whose counters of
+ * modifications it didn't increment, so they are valid with the new
+ * value of chidb_Pager_changes too (see chidb_zonemap_refresh).
+ *
+ * Parameters
+ * - cache: Cache
+ * - nchanges: chidb_Pager_changes right before the commit
+ * - now: chidb_Pager_changes after it
+ */
+void chidb_dbm_result_refresh(chidb_dbm_result_t *cache, uint32_t nchanges, uint32_t now)
+{
+    for (chidb_dbm_result_entry_t *e = cache->first; e != NULL; e = e->next)
+        if (e->nchanges == nchanges)
+            e->nchanges = now;
+}
@@ -0,0 +1,113 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine result cache -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef DBM_RESULT_H_
+#define DBM_RESULT_H_
+
+#include "chidbInt.h"
+#include "dbm.h"
+
+/* Buckets of the hash table of the cache, counters of modifications of
+ * the tables (shared by the root pages with the same remainder), and
+ * tables a cached statement may read */
+#define DBM_RESULT_BUCKETS (128)
+#define DBM_RESULT_NMODS (256)
+#define DBM_RESULT_MAXROOTS (16)
+
+/* The rows a read-only statement returned, for a set of values of its
+ * parameters, and what they depend on: the root pages of the tables and
+ * indexes it read, with their counters of modifications, and
+ * chidb_Pager_changes, when it started running */
+typedef struct chidb_dbm_result_entry
+{
+    char *sql;                  /* Normalized SQL */
+    uint8_t *params;            /* Parameters (see chidb_dbm_reg_serialize) */
+    uint32_t nparams;           /* Size of params, in bytes */
+    uint32_t hash;
+
+    npage_t roots[DBM_RESULT_MAXROOTS];
+    uint64_t mods[DBM_RESULT_MAXROOTS];
+    uint32_t nroots;
+    uint32_t nchanges;
+
+    uint8_t *rows;              /* nCols values per row (see chidb_dbm_reg_serialize) */
+    size_t size, alloc;         /* Bytes of rows used, and allocated */
+    uint32_t ncols;
+    size_t bytes;               /* Memory of the entry, as counted against the cache's */
+
+    bool complete;              /* All of the rows are there */
+    bool cached;                /* The entry is in the cache */
+    uint32_t nrefs;             /* Statements that are using the entry */
+
+    struct chidb_dbm_result_entry *hnext;        /* Next in the same bucket */
+    struct chidb_dbm_result_entry *prev, *next;  /* LRU list */
+} chidb_dbm_result_entry_t;
+
+/* LRU cache of the results of read-only statements, keyed by their
+ * normalized text and the values of their parameters, up to max bytes
+ * of memory */
+typedef struct chidb_dbm_result
+{
+    chidb_dbm_result_entry_t *buckets[DBM_RESULT_BUCKETS];
+    chidb_dbm_result_entry_t *first, *last;      /* Most recently used first */
+    uint32_t n;
+    size_t bytes;
+    size_t max;
+
+    uint64_t mods[DBM_RESULT_NMODS];
+
+    uint64_t hits;
+    uint64_t misses;
+} chidb_dbm_result_t;
+
+int chidb_dbm_result_init(chidb_dbm_result_t **cache);
+void chidb_dbm_result_free(chidb_dbm_result_t *cache);
+void chidb_dbm_result_setmax(chidb_dbm_result_t *cache, size_t bytes);
+void chidb_dbm_result_prepare(chidb_dbm_result_t *cache, const char *sql, chidb_stmt *stmt);
+void chidb_dbm_result_begin(chidb_dbm_result_t *cache, chidb_stmt *stmt, uint32_t nchanges);
+int chidb_dbm_result_next(chidb_stmt *stmt);
+void chidb_dbm_result_record(chidb_dbm_result_t *cache, chidb_stmt *stmt, int rc, uint32_t nchanges);
+void chidb_dbm_result_release(chidb_stmt *stmt);
+void chidb_dbm_result_written(chidb_dbm_result_t *cache, chidb_stmt *stmt);
+void chidb_dbm_result_touch(chidb_dbm_result_t *cache, npage_t nroot);
+void chidb_dbm_result_refresh(chidb_dbm_result_t *cache, uint32_t nchanges, uint32_t now);
+void chidb_dbm_result_invalidate(chidb_dbm_result_t *cache);
+
+#endif /* DBM_RESULT_H_ */
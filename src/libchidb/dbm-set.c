@@ -0,0 +1,275 @@
+/*
+ *  chidb - a didactic relational database management system
+ *  Database Machine sets
+ *  Database Machine sorters
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "dbm-set.h"
+#include "dbm.h"
+
+
+/*** Members ***/
+
+static int set_cmpInt(const void *a, const void *b)
+{
+    int32_t i1 = *(const int32_t *) a, i2 = *(const int32_t *) b;
+
+    return (i1 > i2) - (i1 < i2);
+}
+
+/* Compares two serialized strings or binaries, by type and then by bytes */
+static int set_cmpVal(const void *a, const void *b)
+{
+    const uint8_t *v1 = *(const uint8_t * const *) a, *v2 = *(const uint8_t * const *) b;
+    uint32_t len1, len2;
+    int c;
+
+    if (v1[0] != v2[0])
+        return v1[0] < v2[0] ? -1 : 1;
+
+    memcpy(&len1, v1 + 1, sizeof(len1));
+    memcpy(&len2, v2 + 1, sizeof(len2));
+    c = memcmp(v1 + 1 + sizeof(len1), v2 + 1 + sizeof(len2), len1 < len2 ? len1 : len2);
+    return c != 0 ? c : (len1 > len2) - (len1 < len2);
+}
+
+/* Compares a string or binary register with a serialized member */
+static int set_cmpReg(chidb_dbm_register_t *r, const uint8_t *v)
+{
+    const void *bytes;
+    uint32_t len, vlen;
+    int c;
+
+    if (r->type != v[0])
+        return r->type < v[0] ? -1 : 1;
+
+    if (r->type == REG_STRING)
+    {
+        bytes = chidb_dbm_reg_str(r);
+        len = chidb_dbm_reg_strlen(r);
+    }
+    else
+    {
+        bytes = chidb_dbm_reg_bytes(r);
+        len = chidb_dbm_reg_nbytes(r);
+    }
+    memcpy(&vlen, v + 1, sizeof(vlen));
+    c = memcmp(bytes, v + 1 + sizeof(vlen), len < vlen ? len : vlen);
+    return c != 0 ? c : (len > vlen) - (len < vlen);
+}
+
+
+/*** Sets ***/
+
+/* Create a set from the values of registers
+ *
+ * Parameters
+ * - s: Set to initialize
+ * - regs: Registers with the values
+ * - n: Number of registers
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_set_init(chidb_dbm_set_t *s, chidb_dbm_register_t *regs, uint32_t n)
+{
+    const uint8_t **ptrs = NULL;
+    uint32_t size = 0, nints = 0, nvals = 0, used = 0;
+
+    memset(s, 0, sizeof(chidb_dbm_set_t));
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (regs[i].type == REG_INT32)
+            nints++;
+        else if (regs[i].type == REG_STRING || regs[i].type == REG_BINARY)
+        {
+            nvals++;
+            size += chidb_dbm_reg_serialize(&regs[i], 1, NULL);
+        }
+    }
+
+    if ((nints > 0 && (s->ints = malloc(nints * sizeof(int32_t))) == NULL) ||
+        (nvals > 0 && ((s->buf = malloc(size)) == NULL ||
+                       (s->vals = malloc(nvals * sizeof(uint32_t))) == NULL ||
+                       (ptrs = malloc(nvals * sizeof(uint8_t *))) == NULL)))
+    {
+        chidb_dbm_set_free(s);
+        return CHIDB_ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (regs[i].type == REG_INT32)
+            s->ints[s->nints++] = regs[i].value.i;
+        else if (regs[i].type == REG_STRING || regs[i].type == REG_BINARY)
+        {
+            ptrs[s->nvals++] = s->buf + used;
+            used += chidb_dbm_reg_serialize(&regs[i], 1, s->buf + used);
+        }
+    }
+
+    /* Sort the members, and drop the duplicates */
+    if (s->nints > 0)
+    {
+        qsort(s->ints, s->nints, sizeof(int32_t), set_cmpInt);
+        nints = 1;
+        for (uint32_t i = 1; i < s->nints; i++)
+            if (s->ints[i] != s->ints[nints - 1])
+                s->ints[nints++] = s->ints[i];
+        s->nints = nints;
+    }
+    if (s->nvals > 0)
+    {
+        qsort(ptrs, s->nvals, sizeof(uint8_t *), set_cmpVal);
+        nvals = 0;
+        for (uint32_t i = 0; i < s->nvals; i++)
+            if (nvals == 0 || set_cmpVal(&ptrs[i], &ptrs[nvals - 1]) != 0)
+                ptrs[nvals++] = ptrs[i];
+        s->nvals = nvals;
+        for (uint32_t i = 0; i < s->nvals; i++)
+            s->vals[i] = ptrs[i] - s->buf;
+        free(ptrs);
+    }
+
+    s->open = true;
+
+    return CHIDB_OK;
+}
+
+/* Free the memory of a set
+ *
+ * Parameters
+ * - s: Set
+ */
+void chidb_dbm_set_free(chidb_dbm_set_t *s)
+{
+    free(s->ints);
+    free(s->buf);
+    free(s->vals);
+    memset(s, 0, sizeof(chidb_dbm_set_t));
+}
+
+/* Whether the value of a register is in a set
+ *
+ * NULL is never in a set.
+ *
+ * Parameters
+ * - s: Set
+ * - r: Register
+ *
+ * Return
+ * - Whether the value is a member of the set
+ */
+bool chidb_dbm_set_contains(chidb_dbm_set_t *s, chidb_dbm_register_t *r)
+{
+    uint32_t lo = 0, hi;
+    int c;
+
+    if (r->type == REG_INT32)
+    {
+        hi = s->nints;
+        while (lo < hi)
+        {
+            uint32_t mid = lo + (hi - lo) / 2;
+
+            if (s->ints[mid] == r->value.i)
+                return true;
+            if (s->ints[mid] < r->value.i)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+    }
+    else if (r->type == REG_STRING || r->type == REG_BINARY)
+    {
+        hi = s->nvals;
+        while (lo < hi)
+        {
+            uint32_t mid = lo + (hi - lo) / 2;
+
+            if ((c = set_cmpReg(r, s->buf + s->vals[mid])) == 0)
+                return true;
+            if (c > 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+    }
+
+    return false;
+}
+
+/* Read the next member of a set, in sorted order
+ *
+ * Strings and binaries are borrowed from the set, and are valid until it
+ * is freed.
+ *
+ * Parameters
+ * - s: Set
+ * - r: Register to store the member in
+ * - found: Stores whether there was a member left
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_set_next(chidb_dbm_set_t *s, chidb_dbm_register_t *r, bool *found)
+{
+    uint32_t i = s->next;
+
+    if (i >= s->nints + s->nvals)
+    {
+        *found = false;
+        return CHIDB_OK;
+    }
+
+    s->next++;
+    *found = true;
+    if (i < s->nints)
+    {
+        chidb_dbm_reg_clear(r);
+        r->type = REG_INT32;
+        r->value.i = s->ints[i];
+        return CHIDB_OK;
+    }
+
+    return chidb_dbm_reg_deserialize(r, s->buf + s->vals[i - s->nints]);
+}
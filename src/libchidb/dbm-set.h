@@ -0,0 +1,84 @@
+/*
+ *  chidb - a didactic relational database management system
+ *  Database Machine sets -- header
+ *  Database Machine sorters -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef DBM_SET_H_
+#define DBM_SET_H_
+
+#include "chidbInt.h"
+#include "dbm-types.h"
+
+/* The set of values of an IN list (see the SetOpen instruction).
+ *
+ * The values are copied from registers once, when the set is made,
+ * sorted and without duplicates, so that checking a row against a list
+ * of n values is a binary search (log n comparisons) instead of n
+ * comparisons. NULLs are left out, since a value is never equal to
+ * NULL.
+ *
+ * Integers, which is what most lists have, are kept in an array of
+ * their own. Strings and binaries are serialized (see
+ * chidb_dbm_reg_serialize) into buf, and sorted through an array of
+ * their offsets. The members are in the order of the sorters and
+ * aggregators: integers first, then strings, then binaries, each by
+ * value (bytes, for strings and binaries).
+ *
+ * The members can also be read in that order (chidb_dbm_set_next), to
+ * seek an index or a table for each of them in turn.
+ */
+typedef struct chidb_dbm_set
+{
+    bool open;
+
+    int32_t *ints;
+    uint32_t nints;
+
+    uint8_t *buf;
+    uint32_t *vals;         /* Offsets in buf of the other members */
+    uint32_t nvals;
+
+    uint32_t next;          /* Member that chidb_dbm_set_next reads next */
+} chidb_dbm_set_t;
+
+int chidb_dbm_set_init(chidb_dbm_set_t *s, chidb_dbm_register_t *regs, uint32_t n);
+void chidb_dbm_set_free(chidb_dbm_set_t *s);
+bool chidb_dbm_set_contains(chidb_dbm_set_t *s, chidb_dbm_register_t *r);
+int chidb_dbm_set_next(chidb_dbm_set_t *s, chidb_dbm_register_t *r, bool *found);
+
+#endif /* DBM_SET_H_ */
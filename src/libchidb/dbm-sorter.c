@@ -0,0 +1,748 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine sorters
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "dbm-sorter.h"
+#include "dbm.h"
+
+/* Bytes of a string or binary key in its prefix */
+#define SORTER_PREFIX_BYTES (7)
+
+/* Rows sorted by insertion sort instead of merging */
+#define SORTER_MIN_MERGE (16)
+
+
+/*** Keys ***/
+
+/* Normalized prefix of a key, serialized with chidb_dbm_reg_serialize:
+ * its type in the top byte, followed by the integer (with its sign bit
+ * flipped, so that negative numbers come first), or the first
+ * SORTER_PREFIX_BYTES bytes of the string or binary (padded with zeros).
+ * Descending sorters invert it. */
+static uint64_t sorter_prefix(chidb_dbm_sorter_t *s, const uint8_t *v)
+{
+    uint64_t prefix = (uint64_t) v[0] << 56;
+    uint32_t len;
+    int32_t i;
+
+    switch (v[0])
+    {
+    case REG_INT32:
+        memcpy(&i, v + 1, sizeof(i));
+        prefix |= (uint64_t) ((uint32_t) i ^ 0x80000000u) << 24;
+        break;
+    case REG_STRING:
+    case REG_BINARY:
+        memcpy(&len, v + 1, sizeof(len));
+        for (uint32_t j = 0; j < SORTER_PREFIX_BYTES && j < len; j++)
+            prefix |= (uint64_t) v[1 + sizeof(len) + j] << (8 * (SORTER_PREFIX_BYTES - 1 - j));
+        break;
+    }
+
+    return s->desc ? ~prefix : prefix;
+}
+
+/* Whether keys with the same prefix can still be different (strings and
+ * binaries that don't fit in it) */
+static bool sorter_prefixTies(const uint8_t *v)
+{
+    return v[0] == REG_STRING || v[0] == REG_BINARY;
+}
+
+/* Compares two rows, by the prefixes of their keys and then, if they
+ * are equal, by the keys */
+static int sorter_cmp(chidb_dbm_sorter_t *s, uint64_t prefix1, const uint8_t *v1,
+                      uint64_t prefix2, const uint8_t *v2)
+{
+    uint32_t len1, len2;
+    int cmp;
+
+    if (prefix1 != prefix2)
+        return prefix1 < prefix2 ? -1 : 1;
+    if (!sorter_prefixTies(v1))
+        return 0;
+
+    memcpy(&len1, v1 + 1, sizeof(len1));
+    memcpy(&len2, v2 + 1, sizeof(len2));
+    cmp = memcmp(v1 + 1 + sizeof(len1), v2 + 1 + sizeof(len2), len1 < len2 ? len1 : len2);
+    if (cmp == 0)
+        cmp = (len1 > len2) - (len1 < len2);
+
+    return s->desc ? -cmp : cmp;
+}
+
+
+/*** Sorting in memory ***/
+
+#define SORTER_ROW(s, e) ((s)->buf + (e)->row)
+
+/* Compares two rows in memory. Rows are appended to buf as they are
+ * inserted (and compacted in order), so ties go to the one that was
+ * inserted first. */
+static int sorter_cmpEntries(chidb_dbm_sorter_t *s, chidb_dbm_sorter_entry_t *e1,
+                             chidb_dbm_sorter_entry_t *e2)
+{
+    int cmp = sorter_cmp(s, e1->prefix, SORTER_ROW(s, e1), e2->prefix, SORTER_ROW(s, e2));
+
+    return cmp != 0 ? cmp : (e1->row > e2->row) - (e1->row < e2->row);
+}
+
+/* Stable merge sort of the n entries of e, using tmp (with room for n
+ * entries) */
+static void sorter_msort(chidb_dbm_sorter_t *s, chidb_dbm_sorter_entry_t *e,
+                         chidb_dbm_sorter_entry_t *tmp, uint32_t n)
+{
+    uint32_t mid = n / 2, i, j, k;
+
+    if (n <= SORTER_MIN_MERGE)
+    {
+        for (i = 1; i < n; i++)
+        {
+            chidb_dbm_sorter_entry_t entry = e[i];
+
+            for (j = i; j > 0 && sorter_cmpEntries(s, &e[j - 1], &entry) > 0; j--)
+                e[j] = e[j - 1];
+            e[j] = entry;
+        }
+        return;
+    }
+
+    sorter_msort(s, e, tmp, mid);
+    sorter_msort(s, e + mid, tmp, n - mid);
+
+    for (i = 0, j = mid, k = 0; k < n; k++)
+    {
+        if (j == n || (i < mid && sorter_cmpEntries(s, &e[i], &e[j]) <= 0))
+            tmp[k] = e[i++];
+        else
+            tmp[k] = e[j++];
+    }
+    memcpy(e, tmp, sizeof(chidb_dbm_sorter_entry_t) * n);
+}
+
+/* Sorts the rows in memory: a least significant digit radix sort of
+ * their prefixes, a byte at a time (skipping the bytes that all of them
+ * share, like the type), followed by a merge sort of each run of rows
+ * whose prefixes are equal but whose keys may not be. Both are stable. */
+static int sorter_sortMemory(chidb_dbm_sorter_t *s)
+{
+    chidb_dbm_sorter_entry_t *src = s->entries, *dst, *tmp;
+    uint32_t n = s->nentries, counts[256], i, j;
+
+    if (n < 2)
+        return CHIDB_OK;
+
+    tmp = malloc(sizeof(chidb_dbm_sorter_entry_t) * n);
+    if (tmp == NULL)
+        return CHIDB_ENOMEM;
+    dst = tmp;
+
+    /* The rows of a heap are not in the order they were inserted, which
+     * the radix sort would keep for ties: merge sort them all */
+    if (s->limit > 0)
+    {
+        sorter_msort(s, s->entries, tmp, n);
+        free(tmp);
+        return CHIDB_OK;
+    }
+
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        uint32_t total = 0;
+
+        memset(counts, 0, sizeof(counts));
+        for (i = 0; i < n; i++)
+            counts[(src[i].prefix >> shift) & 0xFF]++;
+        if (counts[(src[0].prefix >> shift) & 0xFF] == n)
+            continue;
+
+        for (i = 0; i < 256; i++)
+        {
+            uint32_t c = counts[i];
+
+            counts[i] = total;
+            total += c;
+        }
+        for (i = 0; i < n; i++)
+            dst[counts[(src[i].prefix >> shift) & 0xFF]++] = src[i];
+
+        dst = src;
+        src = src == tmp ? s->entries : tmp;
+    }
+    if (src != s->entries)
+        memcpy(s->entries, src, sizeof(chidb_dbm_sorter_entry_t) * n);
+
+    for (i = 0; i < n; i = j)
+    {
+        for (j = i + 1; j < n && s->entries[j].prefix == s->entries[i].prefix; j++)
+            ;
+        if (j - i > 1 && sorter_prefixTies(SORTER_ROW(s, &s->entries[i])))
+            sorter_msort(s, s->entries + i, tmp, j - i);
+    }
+
+    free(tmp);
+    return CHIDB_OK;
+}
+
+
+/*** Heaps ***/
+
+/* Moves entry i of the heap up or down to its place. The top of the heap
+ * (entry 0) is the row that goes last. */
+static void sorter_siftUp(chidb_dbm_sorter_t *s, uint32_t i)
+{
+    chidb_dbm_sorter_entry_t e = s->entries[i];
+
+    while (i > 0 && sorter_cmpEntries(s, &s->entries[(i - 1) / 2], &e) < 0)
+    {
+        s->entries[i] = s->entries[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    s->entries[i] = e;
+}
+
+static void sorter_siftDown(chidb_dbm_sorter_t *s, uint32_t i)
+{
+    chidb_dbm_sorter_entry_t e = s->entries[i];
+    uint32_t child;
+
+    while ((child = 2 * i + 1) < s->nentries)
+    {
+        if (child + 1 < s->nentries && sorter_cmpEntries(s, &s->entries[child], &s->entries[child + 1]) < 0)
+            child++;
+        if (sorter_cmpEntries(s, &s->entries[child], &e) <= 0)
+            break;
+        s->entries[i] = s->entries[child];
+        i = child;
+    }
+    s->entries[i] = e;
+}
+
+static int sorter_cmpOffsets(const void *a, const void *b)
+{
+    uint32_t r1 = (*(chidb_dbm_sorter_entry_t * const *) a)->row;
+    uint32_t r2 = (*(chidb_dbm_sorter_entry_t * const *) b)->row;
+
+    return (r1 > r2) - (r1 < r2);
+}
+
+/* Moves the rows of a heap to the start of buf, over the rows it has
+ * dropped, keeping them in the order they were inserted */
+static int sorter_compact(chidb_dbm_sorter_t *s)
+{
+    chidb_dbm_sorter_entry_t **order = malloc(sizeof(chidb_dbm_sorter_entry_t *) * s->nentries);
+    uint32_t used = 0;
+
+    if (order == NULL)
+        return CHIDB_ENOMEM;
+
+    for (uint32_t i = 0; i < s->nentries; i++)
+        order[i] = &s->entries[i];
+    qsort(order, s->nentries, sizeof(chidb_dbm_sorter_entry_t *), sorter_cmpOffsets);
+
+    for (uint32_t i = 0; i < s->nentries; i++)
+    {
+        memmove(s->buf + used, s->buf + order[i]->row, order[i]->len);
+        order[i]->row = used;
+        used += order[i]->len;
+    }
+    s->used = used;
+    s->garbage = 0;
+
+    free(order);
+    return CHIDB_OK;
+}
+
+
+/*** Runs ***/
+
+/* Rows are written to a run as their length, followed by their values */
+static int sorter_write(FILE *f, const uint8_t *data, uint32_t len)
+{
+    if (fwrite(&len, sizeof(len), 1, f) != 1 || fwrite(data, 1, len, f) != len)
+        return CHIDB_EIO;
+
+    return CHIDB_OK;
+}
+
+/* Reads the next row of a run, or sets run->eof at its end */
+static int sorter_read(chidb_dbm_sorter_t *s, chidb_dbm_sorter_run_t *run)
+{
+    uint32_t len;
+
+    if (fread(&len, sizeof(len), 1, run->f) != 1)
+    {
+        if (ferror(run->f))
+            return CHIDB_EIO;
+        run->eof = true;
+        return CHIDB_OK;
+    }
+
+    if (len > run->rowsize)
+    {
+        uint8_t *row = realloc(run->row, len);
+        if (row == NULL)
+            return CHIDB_ENOMEM;
+        run->row = row;
+        run->rowsize = len;
+    }
+    if (fread(run->row, 1, len, run->f) != len)
+        return CHIDB_EIO;
+
+    run->rowlen = len;
+    run->prefix = sorter_prefix(s, run->row);
+
+    return CHIDB_OK;
+}
+
+
+/*** Merging ***/
+
+/* The current row of source i of the merge (a run, or the rows in
+ * memory if i is nruns). Returns false if it has no more rows. */
+static bool sorter_source(chidb_dbm_sorter_t *s, uint32_t i, uint64_t *prefix, const uint8_t **row)
+{
+    if (i < s->nruns)
+    {
+        if (s->runs[i].eof)
+            return false;
+        *prefix = s->runs[i].prefix;
+        *row = s->runs[i].row;
+        return true;
+    }
+
+    if (s->cur >= s->nentries)
+        return false;
+    *prefix = s->entries[s->cur].prefix;
+    *row = SORTER_ROW(s, &s->entries[s->cur]);
+    return true;
+}
+
+/* Whether the current row of source i goes before that of source j.
+ * Sources without rows go last, and ties go to the source that was
+ * filled first (runs in order, and the rows in memory after them). */
+static bool sorter_before(chidb_dbm_sorter_t *s, uint32_t i, uint32_t j)
+{
+    uint64_t prefix1, prefix2;
+    const uint8_t *row1, *row2;
+    int cmp;
+
+    if (!sorter_source(s, i, &prefix1, &row1))
+        return false;
+    if (!sorter_source(s, j, &prefix2, &row2))
+        return true;
+
+    cmp = sorter_cmp(s, prefix1, row1, prefix2, row2);
+    return cmp < 0 || (cmp == 0 && i < j);
+}
+
+/* Plays the matches of the subtree of the loser tree at node, whose k
+ * leaves (k + i for source i) are below nodes 1 to k - 1. Each node
+ * keeps its loser, and the winner is returned. */
+static uint32_t sorter_build(chidb_dbm_sorter_t *s, uint32_t node, uint32_t k)
+{
+    uint32_t w1, w2;
+
+    if (node >= k)
+        return node - k;
+
+    w1 = sorter_build(s, 2 * node, k);
+    w2 = sorter_build(s, 2 * node + 1, k);
+    if (sorter_before(s, w2, w1))
+    {
+        s->tree[node] = w1;
+        return w2;
+    }
+    s->tree[node] = w2;
+    return w1;
+}
+
+/* Once the source of the current row (the winner) has moved to its next
+ * row, replays its matches on the way up to the root */
+static void sorter_replay(chidb_dbm_sorter_t *s)
+{
+    uint32_t k = s->nruns + 1, w = s->tree[0];
+
+    for (uint32_t node = (w + k) / 2; node > 0; node /= 2)
+    {
+        if (sorter_before(s, s->tree[node], w))
+        {
+            uint32_t loser = w;
+
+            w = s->tree[node];
+            s->tree[node] = loser;
+        }
+    }
+    s->tree[0] = w;
+}
+
+/* The values of the current row, or NULL if there is none */
+static const uint8_t *sorter_current(chidb_dbm_sorter_t *s)
+{
+    uint64_t prefix;
+    const uint8_t *row;
+
+    if (!s->sorted || !sorter_source(s, s->nruns > 0 ? s->tree[0] : s->nruns, &prefix, &row))
+        return NULL;
+    return row;
+}
+
+
+/*** Sorters ***/
+
+/* Create a sorter
+ *
+ * Parameters
+ * - s: Sorter to initialize
+ * - nvals: Values in a row
+ * - desc: Whether to sort in descending order
+ * - budget: Bytes of rows to keep in memory before chidb_dbm_sorter_full
+ *           returns true
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_sorter_init(chidb_dbm_sorter_t *s, uint32_t nvals, bool desc, size_t budget)
+{
+    memset(s, 0, sizeof(chidb_dbm_sorter_t));
+    s->nvals = nvals;
+    s->desc = desc;
+    s->budget = budget;
+
+    return CHIDB_OK;
+}
+
+
+/* Empty a sorter, to take new rows. Its memory is kept for them. */
+void chidb_dbm_sorter_clear(chidb_dbm_sorter_t *s)
+{
+    for (uint32_t i = 0; i < s->nruns; i++)
+    {
+        fclose(s->runs[i].f);
+        free(s->runs[i].row);
+    }
+    free(s->runs);
+    free(s->tree);
+    s->runs = NULL;
+    s->nruns = 0;
+    s->tree = NULL;
+
+    s->used = 0;
+    s->garbage = 0;
+    s->nentries = 0;
+    s->cur = 0;
+    s->sorted = false;
+}
+
+
+void chidb_dbm_sorter_free(chidb_dbm_sorter_t *s)
+{
+    chidb_dbm_sorter_clear(s);
+    free(s->buf);
+    free(s->entries);
+    memset(s, 0, sizeof(chidb_dbm_sorter_t));
+}
+
+
+/* Keep only the first rows of a sorter
+ *
+ * Must be called before any row is inserted. Limits above
+ * DBM_SORTER_MAX_LIMIT are ignored: the sorter sorts all of its rows, and
+ * the program stops reading them once it has what it wants.
+ *
+ * Parameters
+ * - s: Sorter
+ * - limit: Rows to keep (0 to keep all of them)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The sorter already has rows
+ */
+int chidb_dbm_sorter_limit(chidb_dbm_sorter_t *s, uint32_t limit)
+{
+    if (s->nentries > 0 || s->nruns > 0 || s->sorted)
+        return CHIDB_EMISUSE;
+
+    s->limit = limit <= DBM_SORTER_MAX_LIMIT ? limit : 0;
+    return CHIDB_OK;
+}
+
+
+/* Add a row to a sorter
+ *
+ * Parameters
+ * - s: Sorter
+ * - regs: The s->nvals registers with the values of the row, which are
+ *         copied
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The sorter has been sorted (and not cleared since)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_sorter_insert(chidb_dbm_sorter_t *s, chidb_dbm_register_t *regs)
+{
+    uint32_t len = chidb_dbm_reg_serialize(regs, s->nvals, NULL);
+    chidb_dbm_sorter_entry_t *e;
+
+    if (s->sorted)
+        return CHIDB_EMISUSE;
+
+    if (s->used + len > s->size)
+    {
+        uint32_t size = s->size ? s->size : 4096;
+        uint8_t *buf;
+
+        while (size < s->used + len)
+            size *= 2;
+        if ((buf = realloc(s->buf, size)) == NULL)
+            return CHIDB_ENOMEM;
+        s->buf = buf;
+        s->size = size;
+    }
+    if (s->nentries == s->maxentries)
+    {
+        uint32_t max = s->maxentries ? 2 * s->maxentries : 64;
+
+        if ((e = realloc(s->entries, sizeof(chidb_dbm_sorter_entry_t) * max)) == NULL)
+            return CHIDB_ENOMEM;
+        s->entries = e;
+        s->maxentries = max;
+    }
+
+    chidb_dbm_reg_serialize(regs, s->nvals, s->buf + s->used);
+
+    if (s->limit > 0 && s->nentries == s->limit)
+    {
+        chidb_dbm_sorter_entry_t row = {sorter_prefix(s, s->buf + s->used), s->used, len};
+
+        /* Rows that go after the last one kept are dropped (and so are
+         * ties, which go after the rows that were inserted first) */
+        if (sorter_cmpEntries(s, &row, &s->entries[0]) >= 0)
+            return CHIDB_OK;
+
+        s->garbage += s->entries[0].len;
+        s->entries[0] = row;
+        s->used += len;
+        sorter_siftDown(s, 0);
+
+        if (s->garbage > s->used / 2)
+            return sorter_compact(s);
+        return CHIDB_OK;
+    }
+
+    e = &s->entries[s->nentries++];
+    e->row = s->used;
+    e->len = len;
+    e->prefix = sorter_prefix(s, s->buf + s->used);
+    s->used += len;
+    if (s->limit > 0)
+        sorter_siftUp(s, s->nentries - 1);
+
+    return CHIDB_OK;
+}
+
+
+/* Whether the rows in memory (and the room to sort them) take up the
+ * budget of a sorter. A sorter with a limit is never full. */
+bool chidb_dbm_sorter_full(chidb_dbm_sorter_t *s)
+{
+    if (s->limit > 0)
+        return false;
+    return s->used + (size_t) s->nentries * 2 * sizeof(chidb_dbm_sorter_entry_t) >= s->budget;
+}
+
+
+/* Sort the rows in memory, and write them to a temporary file as a run
+ *
+ * Parameters
+ * - s: Sorter
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The sorter has been sorted (and not cleared since)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not write the run
+ */
+int chidb_dbm_sorter_spill(chidb_dbm_sorter_t *s)
+{
+    chidb_dbm_sorter_run_t *runs;
+    FILE *f;
+    int rc;
+
+    if (s->sorted)
+        return CHIDB_EMISUSE;
+    if (s->nentries == 0)
+        return CHIDB_OK;
+
+    if ((rc = sorter_sortMemory(s)) != CHIDB_OK)
+        return rc;
+    if ((runs = realloc(s->runs, sizeof(chidb_dbm_sorter_run_t) * (s->nruns + 1))) == NULL)
+        return CHIDB_ENOMEM;
+    s->runs = runs;
+    if ((f = chidb_dbm_tmpfile()) == NULL)
+        return CHIDB_EIO;
+
+    for (uint32_t i = 0; i < s->nentries; i++)
+    {
+        if ((rc = sorter_write(f, SORTER_ROW(s, &s->entries[i]), s->entries[i].len)) != CHIDB_OK)
+        {
+            fclose(f);
+            return rc;
+        }
+    }
+    if (fflush(f) != 0 || fseek(f, 0, SEEK_SET) != 0)
+    {
+        fclose(f);
+        return CHIDB_EIO;
+    }
+
+    memset(&s->runs[s->nruns], 0, sizeof(chidb_dbm_sorter_run_t));
+    s->runs[s->nruns++].f = f;
+    s->used = 0;
+    s->nentries = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Sort the rows of a sorter, and move to the first one
+ *
+ * Once sorted, no rows can be added until the sorter is cleared.
+ *
+ * Parameters
+ * - s: Sorter
+ * - found: Set to whether it has a row
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not read a run
+ */
+int chidb_dbm_sorter_sort(chidb_dbm_sorter_t *s, bool *found)
+{
+    int rc;
+
+    if (!s->sorted)
+    {
+        if ((rc = sorter_sortMemory(s)) != CHIDB_OK)
+            return rc;
+        s->cur = 0;
+
+        if (s->nruns > 0)
+        {
+            if ((s->tree = malloc(sizeof(uint32_t) * (s->nruns + 1))) == NULL)
+                return CHIDB_ENOMEM;
+            for (uint32_t i = 0; i < s->nruns; i++)
+                if ((rc = sorter_read(s, &s->runs[i])) != CHIDB_OK)
+                    return rc;
+            s->tree[0] = sorter_build(s, 1, s->nruns + 1);
+        }
+        s->sorted = true;
+    }
+
+    *found = sorter_current(s) != NULL;
+    return CHIDB_OK;
+}
+
+
+/* Move a sorted sorter to its next row
+ *
+ * Parameters
+ * - s: Sorter
+ * - found: Set to whether there is one
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The sorter hasn't been sorted
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not read a run
+ */
+int chidb_dbm_sorter_next(chidb_dbm_sorter_t *s, bool *found)
+{
+    int rc;
+
+    if (!s->sorted)
+        return CHIDB_EMISUSE;
+
+    if (s->nruns == 0)
+        s->cur++;
+    else if (sorter_current(s) != NULL)
+    {
+        if (s->tree[0] == s->nruns)
+            s->cur++;
+        else if ((rc = sorter_read(s, &s->runs[s->tree[0]])) != CHIDB_OK)
+            return rc;
+        sorter_replay(s);
+    }
+
+    *found = sorter_current(s) != NULL;
+    return CHIDB_OK;
+}
+
+
+/* Load a value of the current row of a sorter into a register
+ *
+ * Strings and bytes are not copied: the register points into the
+ * sorter, until it moves to its next row.
+ *
+ * Parameters
+ * - s: Sorter
+ * - col: Number of the value in the row
+ * - r: Register to store it in
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no such value, or no current row
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_sorter_column(chidb_dbm_sorter_t *s, uint32_t col, chidb_dbm_register_t *r)
+{
+    const uint8_t *v = sorter_current(s);
+
+    if (v == NULL || col >= s->nvals)
+        return CHIDB_EMISUSE;
+
+    while (col-- > 0)
+        v += chidb_dbm_reg_serialsize(v);
+
+    return chidb_dbm_reg_deserialize(r, v);
+}
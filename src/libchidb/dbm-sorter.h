@@ -0,0 +1,139 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine sorters -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef DBM_SORTER_H_
+#define DBM_SORTER_H_
+
+#include <stdio.h>
+#include "chidbInt.h"
+#include "dbm-types.h"
+
+/* Bytes of rows that a sorter keeps in memory by default before it
+ * writes them to a sorted run (see the SorterOpen instruction) */
+#define DBM_SORTER_BUDGET (4 * 1024 * 1024)
+
+/* Largest number of rows that a sorter keeps in a heap, instead of
+ * sorting them all, when only the first ones are wanted (see
+ * chidb_dbm_sorter_limit) */
+#define DBM_SORTER_MAX_LIMIT (65536)
+
+/* A row in memory: the normalized prefix of its key, and where its
+ * values are. Prefixes compare as unsigned integers in the same order as
+ * the keys they come from, so that most comparisons, and the radix sort
+ * of the rows, only look at them. */
+typedef struct chidb_dbm_sorter_entry
+{
+    uint64_t prefix;
+    uint32_t row;           /* Offset of the row in buf */
+    uint32_t len;
+} chidb_dbm_sorter_entry_t;
+
+/* A sorted run that was written to a temporary file, and its current
+ * row while the runs are merged */
+typedef struct chidb_dbm_sorter_run
+{
+    FILE *f;
+    uint8_t *row;
+    uint32_t rowlen;
+    uint32_t rowsize;
+    uint64_t prefix;
+    bool eof;
+} chidb_dbm_sorter_run_t;
+
+/* A sorter (see the SorterOpen instruction), that sorts rows by their
+ * first value, ascending or descending: NULLs come before integers,
+ * integers before strings, and strings before binaries.
+ *
+ * The rows are copied from registers into buf, serialized (see
+ * chidb_dbm_reg_serialize), and sorted by radix sort on the prefixes of
+ * their keys, with a merge sort of the rows whose prefixes are equal.
+ *
+ * Once the rows in memory take more than budget bytes, they can be
+ * sorted and written to a temporary file as a run (chidb_dbm_sorter_spill).
+ * The runs and the rows still in memory are then merged, with a loser
+ * tree that picks the next row out of nruns + 1 in log2(nruns + 1)
+ * comparisons. Rows with equal keys come out in the order they went in.
+ *
+ * A sorter with a limit only keeps the first limit rows, in a heap whose
+ * top is the last of them: a row that goes after it is dropped right
+ * away, and one that goes before it takes its place. The rows that are
+ * replaced leave garbage in buf, which is compacted once it takes up
+ * half of it.
+ */
+typedef struct chidb_dbm_sorter
+{
+    uint32_t nvals;         /* Values in a row (0 if not open) */
+    bool desc;
+    size_t budget;
+
+    uint8_t *buf;
+    uint32_t used;
+    uint32_t size;
+
+    chidb_dbm_sorter_entry_t *entries;
+    uint32_t nentries;
+    uint32_t maxentries;
+    uint32_t cur;           /* Current entry, once sorted */
+
+    uint32_t limit;         /* Rows to keep (0 to keep them all) */
+    uint32_t garbage;       /* Bytes of buf taken by dropped rows */
+
+    chidb_dbm_sorter_run_t *runs;
+    uint32_t nruns;
+
+    /* Loser tree of the merge, over the runs and the rows in memory
+     * (source nruns): tree[0] is the source of the current row, and the
+     * others hold the loser of each match */
+    uint32_t *tree;
+    bool sorted;
+} chidb_dbm_sorter_t;
+
+int chidb_dbm_sorter_init(chidb_dbm_sorter_t *s, uint32_t nvals, bool desc, size_t budget);
+void chidb_dbm_sorter_free(chidb_dbm_sorter_t *s);
+void chidb_dbm_sorter_clear(chidb_dbm_sorter_t *s);
+int chidb_dbm_sorter_limit(chidb_dbm_sorter_t *s, uint32_t limit);
+int chidb_dbm_sorter_insert(chidb_dbm_sorter_t *s, chidb_dbm_register_t *regs);
+bool chidb_dbm_sorter_full(chidb_dbm_sorter_t *s);
+int chidb_dbm_sorter_spill(chidb_dbm_sorter_t *s);
+int chidb_dbm_sorter_sort(chidb_dbm_sorter_t *s, bool *found);
+int chidb_dbm_sorter_next(chidb_dbm_sorter_t *s, bool *found);
+int chidb_dbm_sorter_column(chidb_dbm_sorter_t *s, uint32_t col, chidb_dbm_register_t *r);
+
+#endif /* DBM_SORTER_H_ */
@@ -45,6 +45,7 @@
 #include <chidb/chisql.h>
 #include "chidbInt.h"
 #include "dbm-cursor.h"
+#include "record.h"
 
 #define DEFAULT_OPS_SIZE (50)
 #define DEFAULT_REG_SIZE (10)
@@ -60,7 +61,9 @@
         OP(OpenRead)    \
         OP(OpenWrite)   \
         OP(Close)       \
+        OP(OpenEphemeral) \
         OP(Rewind)      \
+        OP(Last)        \
         OP(Next)        \
         OP(Prev)        \
         OP(Seek)        \
@@ -76,24 +79,74 @@
         OP(ResultRow)   \
         OP(MakeRecord)  \
         OP(Insert)      \
+        OP(Clear)       \
+        OP(DeleteRange) \
         OP(Eq)          \
         OP(Ne)          \
         OP(Lt)          \
         OP(Le)          \
         OP(Gt)          \
         OP(Ge)          \
+        OP(EqInt)       \
+        OP(NeInt)       \
+        OP(LtInt)       \
+        OP(LeInt)       \
+        OP(GtInt)       \
+        OP(GeInt)       \
         OP(IdxGt)       \
         OP(IdxGe)       \
         OP(IdxLt)       \
         OP(IdxLe)       \
         OP(IdxPKey)     \
         OP(IdxInsert)   \
+        OP(HashIdxSeek) \
+        OP(HashIdxInsert) \
+        OP(BloomFilter) \
         OP(CreateTable) \
         OP(CreateIndex) \
+        OP(Analyze)     \
+        OP(AutoCommit)  \
+        OP(HashOpen)    \
+        OP(HashInsert)  \
+        OP(HashProbe)   \
+        OP(HashFilter)  \
+        OP(HashNext)    \
+        OP(HashDeferred) \
+        OP(HashColumn)  \
+        OP(SetOpen)     \
+        OP(InSet)       \
+        OP(SetNext)     \
+        OP(SorterOpen)  \
+        OP(SorterLimit) \
+        OP(SorterInsert) \
+        OP(SorterSort)  \
+        OP(SorterNext)  \
+        OP(SorterColumn) \
+        OP(AggOpen)     \
+        OP(AggStep)     \
+        OP(AggFinal)    \
+        OP(AggNext)     \
+        OP(AggColumn)   \
+        OP(Count)       \
+        OP(MinKey)      \
+        OP(MaxKey)      \
+        OP(ZoneFilter)  \
         OP(Copy)        \
         OP(SCopy)       \
+        OP(Variable)    \
+        OP(DecrJumpZero) \
+        OP(IfPos)       \
+        OP(Parallel)    \
+        OP(ColumnCmpJump) \
+        OP(SeekGeIdxPKey) \
+        OP(IntegerResultRow) \
         OP(Halt)
 
+/* ColumnCmpJump, SeekGeIdxPKey and IntegerResultRow are superinstructions
+ * (see chidb_stmt_peephole): each of them runs the instructions that
+ * follow it, as well as its own, in a single dispatch. Halt must remain
+ * the last opcode. */
+
 /* The following generates an enum type for the opcode. It expands to:
  *
  * typedef enum opcode
@@ -189,10 +242,28 @@ static inline const char* regtype_to_str(register_type_t regtype)
     }
 }
 
+/* Where the contents of a string or binary register are. Short values
+ * are stored in the register itself, and values that live elsewhere
+ * for at least as long as the register needs them (an instruction's
+ * p4, a bound parameter, a cell of a page pinned by a cursor, another
+ * register) are borrowed, so that most registers never allocate. */
+typedef enum register_storage
+{
+    REG_BORROWED       = 0,   /* value.s / value.bin point to memory owned by someone else */
+    REG_OWNED          = 1,   /* value.s / value.bin were malloc'd for the register */
+    REG_INLINE         = 2,   /* In value.inl (len bytes, strings NUL-terminated) */
+    REG_BORROWED_PAGE  = 3    /* value.s points into a pinned page, and is not
+                               * NUL-terminated (len bytes) */
+} register_storage_t;
+
+#define REG_INLINE_SIZE (16)
+
 /* A type representing a single register */
 typedef struct chidb_dbm_register
 {
     register_type_t type;
+    register_storage_t storage;
+    uint32_t len;
 
     union
     {
@@ -203,10 +274,44 @@ typedef struct chidb_dbm_register
             uint8_t* bytes;
             uint32_t nbytes;
         } bin;
+        char inl[REG_INLINE_SIZE];
     } value;
 
 } chidb_dbm_register_t;
 
+/* The contents of string and binary registers (see register_storage_t).
+ * Strings in REG_BORROWED_PAGE registers are not NUL-terminated. */
+static inline char *chidb_dbm_reg_str(chidb_dbm_register_t *r)
+{
+    return r->storage == REG_INLINE ? r->value.inl : r->value.s;
+}
+
+static inline uint32_t chidb_dbm_reg_strlen(chidb_dbm_register_t *r)
+{
+    return (r->storage == REG_INLINE || r->storage == REG_BORROWED_PAGE) ? r->len : strlen(r->value.s);
+}
+
+static inline uint8_t *chidb_dbm_reg_bytes(chidb_dbm_register_t *r)
+{
+    return r->storage == REG_INLINE ? (uint8_t *) r->value.inl : r->value.bin.bytes;
+}
+
+static inline uint32_t chidb_dbm_reg_nbytes(chidb_dbm_register_t *r)
+{
+    return r->storage == REG_INLINE ? r->len : r->value.bin.nbytes;
+}
+
+/* When to run a statement's program compiled (see chidb_dbm_compile)
+ * instead of in the interpreter */
+typedef enum dbm_compile
+{
+    DBM_COMPILE_AUTO    = 0,   /* Once it has run DBM_COMPILE_THRESHOLD instructions */
+    DBM_COMPILE_ALWAYS  = 1,   /* As soon as it starts running */
+    DBM_COMPILE_NEVER   = 2
+} dbm_compile_t;
+
+#define DBM_COMPILE_THRESHOLD (10000)
+
 /*  This is the struct that represents a single DBM program.
  *
  *  Notice how a single DBM program has its own registers and cursors;
@@ -259,6 +364,79 @@ struct chidb_stmt
      * per operation */
     bool explain;
 
+    /* Records built by MakeRecord are allocated from this arena, which
+     * is reset once Insert has stored them, so that building a row
+     * doesn't need any malloc's once the arena has grown to fit one. */
+    DBRecordArena arena;
+
+    /* Values bound to the '?' placeholders of the SQL statement (see
+     * chidb_bind_int), which Variable loads into registers. Unbound
+     * parameters are NULL. */
+    chidb_dbm_register_t *params;
+    uint32_t nParams;
+
+    /* Compiled form of the program, or NULL while it runs in the
+     * interpreter. ninstr counts the instructions interpreted so far,
+     * to decide when to compile it (see chidb_stmt_exec). */
+    dbm_compile_t compile;
+    struct chidb_dbm_cop *compiled;
+    uint64_t ninstr;
+
+    /* Hash tables of the hash joins of the program (see HashOpen),
+     * allocated as they are opened. nHashes is the size of the array. */
+    struct chidb_dbm_hash *hashes;
+    uint32_t nHashes;
+
+    /* Sorters of the index joins of the program (see SorterOpen), also
+     * allocated as they are opened */
+    struct chidb_dbm_sorter *sorters;
+    uint32_t nSorters;
+
+    /* Aggregators of GROUP BY and the aggregate functions (see AggOpen),
+     * also allocated as they are opened */
+    struct chidb_dbm_agg *aggs;
+    uint32_t nAggs;
+
+    /* Sets of the IN lists of the program (see SetOpen), also allocated
+     * as they are opened */
+    struct chidb_dbm_set *sets;
+    uint32_t nSets;
+
+    /* Temporary B-Tree file that the ephemeral tables of the program
+     * are in (see OpenEphemeral), opened by the first one, and closed,
+     * with all of them, when the statement is reset */
+    BTree *temp;
+
+    /* Snapshot of the database that a read-only statement reads, from
+     * the first time it runs until it is done (see chidb_stmt_exec) */
+    PagerSnapshot *snapshot;
+
+    /* Locks held on the database while the statement runs (see
+     * chidb_stmt_exec) */
+    bool reading;
+    bool writing;
+
+    /* The statement writes outside a transaction, in one of its own that
+     * it commits when it is done, or rolls back if it fails (see
+     * chidb_stmt_lock) */
+    bool autocommit;
+
+    /* Executions and cycles of each instruction (endOp entries), while
+     * the statement is profiled (see chidb_profile_start), or NULL */
+    chidb_profile_op *profile;
+
+    /* Plan of an EXPLAIN QUERY PLAN or EXPLAIN ANALYZE statement (see
+     * plan.c), or NULL */
+    struct chidb_plan *plan;
+
+    /* Normalized SQL of a read-only statement whose rows may be kept in
+     * the result cache of its database, or NULL, and the entry of the
+     * cache that it returns rows from, or records them into, and where
+     * it is in its rows (see dbm-result.c) */
+    char *result_sql;
+    struct chidb_dbm_result_entry *result;
+    size_t result_pos;
+
     /* Additional fields go here */
 };
 
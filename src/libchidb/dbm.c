@@ -40,11 +40,28 @@
 #include <assert.h>
 #include <stdbool.h>
 #include "dbm.h"
+#include "dbm-hash.h"
+#include "dbm-sorter.h"
+#include "dbm-agg.h"
+#include "dbm-set.h"
+#include "dbm-result.h"
+#include "btree.h"
+#include "pager.h"
+#include "plan.h"
+#include "probes.h"
 
 /* Forward declaration of auxiliary functions. */
 int realloc_ops(chidb_stmt *stmt, uint32_t size);
 int realloc_reg(chidb_stmt *stmt, uint32_t size);
 int realloc_cur(chidb_stmt *stmt, uint32_t size);
+int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op);
+static void chidb_stmt_temp_close(chidb_stmt *stmt);
+static void chidb_stmt_snapshot_begin(chidb_stmt *stmt);
+static void chidb_stmt_snapshot_end(chidb_stmt *stmt);
+static int chidb_stmt_lock(chidb_stmt *stmt);
+static void chidb_stmt_unlock(chidb_stmt *stmt);
+static int chidb_stmt_autocommit_end(chidb_stmt *stmt, int rc);
+static void chidb_stmt_close_cursors(chidb_stmt *stmt);
 
 
 
@@ -110,6 +127,37 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
     stmt->cols = NULL;
     stmt->nCols = 0;
 
+    chidb_DBRecordArena_init(&stmt->arena);
+
+    /* There are no parameters until chidb_stmt_set_nparams */
+    stmt->params = NULL;
+    stmt->nParams = 0;
+
+    /* Programs start running in the interpreter */
+    stmt->compile = DBM_COMPILE_AUTO;
+    stmt->compiled = NULL;
+    stmt->ninstr = 0;
+
+    /* Hash tables are allocated by HashOpen */
+    stmt->hashes = NULL;
+    stmt->nHashes = 0;
+    stmt->sorters = NULL;
+    stmt->nSorters = 0;
+    stmt->aggs = NULL;
+    stmt->nAggs = 0;
+    stmt->sets = NULL;
+    stmt->nSets = 0;
+    stmt->temp = NULL;
+    stmt->snapshot = NULL;
+    stmt->reading = false;
+    stmt->writing = false;
+    stmt->autocommit = false;
+    stmt->profile = NULL;
+    stmt->plan = NULL;
+    stmt->result_sql = NULL;
+    stmt->result = NULL;
+    stmt->result_pos = 0;
+
     return CHIDB_OK;
 }
 
@@ -125,13 +173,549 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
  */
 int chidb_stmt_free(chidb_stmt *stmt)
 {
+	for(uint32_t i = 0; i < stmt->nReg; i++)
+		chidb_dbm_reg_clear(&stmt->reg[i]);
 	free(stmt->ops);
 	free(stmt->reg);
 	free(stmt->cursors);
+    chidb_DBRecordArena_free(&stmt->arena);
+    for(uint32_t i = 0; i < stmt->nHashes; i++)
+        chidb_dbm_hash_free(&stmt->hashes[i]);
+    free(stmt->hashes);
+    for(uint32_t i = 0; i < stmt->nSorters; i++)
+        chidb_dbm_sorter_free(&stmt->sorters[i]);
+    free(stmt->sorters);
+    for(uint32_t i = 0; i < stmt->nAggs; i++)
+        chidb_dbm_agg_free(&stmt->aggs[i]);
+    free(stmt->aggs);
+    for(uint32_t i = 0; i < stmt->nSets; i++)
+        chidb_dbm_set_free(&stmt->sets[i]);
+    free(stmt->sets);
+    chidb_stmt_temp_close(stmt);
+    chidb_stmt_unlock(stmt);
+    free(stmt->compiled);
+    free(stmt->profile);
+    chidb_plan_free(stmt->plan);
+    chidb_dbm_result_release(stmt);
+    free(stmt->result_sql);
+    chidb_stmt_set_nparams(stmt, 0);
+    return CHIDB_OK;
+}
+
+
+/* Clear a register
+ *
+ * Frees the string or bytes of the register, if it owns them, and
+ * leaves it unspecified.
+ *
+ * Parameters
+ * - r: Register
+ */
+void chidb_dbm_reg_clear(chidb_dbm_register_t *r)
+{
+    if (r->storage == REG_OWNED)
+    {
+        if (r->type == REG_STRING)
+            free(r->value.s);
+        else if (r->type == REG_BINARY)
+            free(r->value.bin.bytes);
+    }
+    r->type = REG_UNSPECIFIED;
+    r->storage = REG_BORROWED;
+}
+
+/* Store a string in a register
+ *
+ * Strings shorter than REG_INLINE_SIZE are copied into the register
+ * itself. Longer ones are stored as given by storage:
+ *
+ * - REG_BORROWED: s is NUL-terminated, and outlives the register's
+ *   value (e.g., an instruction's p4), so the register points to it.
+ * - REG_BORROWED_PAGE: s is in a page that is pinned while the
+ *   register's value is used (e.g., the record a cursor is on), and
+ *   need not be NUL-terminated, so the register points to it.
+ * - REG_OWNED: s is copied to memory owned by the register.
+ *
+ * Parameters
+ * - r: Register
+ * - s: String
+ * - len: Length of the string
+ * - storage: REG_BORROWED, REG_BORROWED_PAGE or REG_OWNED
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_reg_set_string(chidb_dbm_register_t *r, const char *s, uint32_t len, register_storage_t storage)
+{
+    char *copy = NULL;
+
+    if (len < REG_INLINE_SIZE)
+        storage = REG_INLINE;
+    else if (storage == REG_OWNED && (copy = strndup(s, len)) == NULL)
+        return CHIDB_ENOMEM;
+
+    chidb_dbm_reg_clear(r);
+    r->type = REG_STRING;
+    r->storage = storage;
+    r->len = len;
+    if (storage == REG_INLINE)
+    {
+        memcpy(r->value.inl, s, len);
+        r->value.inl[len] = '\0';
+    }
+    else
+        r->value.s = storage == REG_OWNED ? copy : (char *) s;
+
+    return CHIDB_OK;
+}
+
+/* Store bytes in a register
+ *
+ * Same as chidb_dbm_reg_set_string, for binary values (storage is
+ * REG_BORROWED or REG_OWNED).
+ *
+ * Parameters
+ * - r: Register
+ * - bytes: Bytes
+ * - nbytes: Number of bytes
+ * - storage: REG_BORROWED or REG_OWNED
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_reg_set_binary(chidb_dbm_register_t *r, const uint8_t *bytes, uint32_t nbytes, register_storage_t storage)
+{
+    uint8_t *copy = NULL;
+
+    if (nbytes <= REG_INLINE_SIZE)
+        storage = REG_INLINE;
+    else if (storage == REG_OWNED)
+    {
+        if ((copy = malloc(nbytes)) == NULL)
+            return CHIDB_ENOMEM;
+        memcpy(copy, bytes, nbytes);
+    }
+
+    chidb_dbm_reg_clear(r);
+    r->type = REG_BINARY;
+    r->storage = storage;
+    if (storage == REG_INLINE)
+    {
+        memcpy(r->value.inl, bytes, nbytes);
+        r->len = nbytes;
+    }
+    else
+    {
+        r->value.bin.bytes = storage == REG_OWNED ? copy : (uint8_t *) bytes;
+        r->value.bin.nbytes = nbytes;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Shallow copy of a register (SCopy)
+ *
+ * dst gets the value of src without copying strings or bytes that are
+ * not inline: dst borrows them from src (or from whoever src borrows
+ * them from), so it is only valid while src keeps its value.
+ *
+ * Parameters
+ * - dst: Register to copy to
+ * - src: Register to copy from
+ */
+void chidb_dbm_reg_scopy(chidb_dbm_register_t *dst, chidb_dbm_register_t *src)
+{
+    if (dst == src)
+        return;
+
+    chidb_dbm_reg_clear(dst);
+    *dst = *src;
+    if (dst->storage == REG_OWNED)
+        dst->storage = REG_BORROWED;
+}
+
+/* Deep copy of a register (Copy)
+ *
+ * dst gets its own copy of strings and bytes that are not inline
+ * (including those src borrows), so it stays valid after src changes.
+ *
+ * Parameters
+ * - dst: Register to copy to
+ * - src: Register to copy from
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_reg_copy(chidb_dbm_register_t *dst, chidb_dbm_register_t *src)
+{
+    if (dst == src)
+        return CHIDB_OK;
+
+    if (src->type == REG_STRING)
+        return chidb_dbm_reg_set_string(dst, chidb_dbm_reg_str(src), chidb_dbm_reg_strlen(src), REG_OWNED);
+    if (src->type == REG_BINARY)
+        return chidb_dbm_reg_set_binary(dst, chidb_dbm_reg_bytes(src), chidb_dbm_reg_nbytes(src), REG_OWNED);
+
+    chidb_dbm_reg_clear(dst);
+    *dst = *src;
+
     return CHIDB_OK;
 }
 
 
+/* Serialize the values of registers
+ *
+ * Rows that the DBM keeps outside of its registers (in hash tables and
+ * sorters, and in the temporary files they spill to) are stored as a
+ * sequence of values: a byte with the type of the register it came from
+ * (register_type_t), followed by the integer (4 bytes), or the length
+ * (4 bytes) and the bytes of a string or binary. Unspecified registers
+ * are stored as NULL.
+ *
+ * Parameters
+ * - regs: Registers
+ * - n: Number of registers
+ * - out: Where to write the values, or NULL to only compute their size
+ *
+ * Return
+ * - Size of the values, in bytes
+ */
+uint32_t chidb_dbm_reg_serialize(chidb_dbm_register_t *regs, uint32_t n, uint8_t *out)
+{
+    uint32_t size = 0, len;
+    const void *bytes;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        chidb_dbm_register_t *r = &regs[i];
+
+        switch (r->type)
+        {
+        case REG_INT32:
+            if (out != NULL)
+            {
+                out[size] = REG_INT32;
+                memcpy(out + size + 1, &r->value.i, sizeof(int32_t));
+            }
+            size += 1 + sizeof(int32_t);
+            break;
+        case REG_STRING:
+        case REG_BINARY:
+            if (r->type == REG_STRING)
+            {
+                bytes = chidb_dbm_reg_str(r);
+                len = chidb_dbm_reg_strlen(r);
+            }
+            else
+            {
+                bytes = chidb_dbm_reg_bytes(r);
+                len = chidb_dbm_reg_nbytes(r);
+            }
+            if (out != NULL)
+            {
+                out[size] = r->type;
+                memcpy(out + size + 1, &len, sizeof(len));
+                memcpy(out + size + 1 + sizeof(len), bytes, len);
+            }
+            size += 1 + sizeof(len) + len;
+            break;
+        default:
+            if (out != NULL)
+                out[size] = REG_NULL;
+            size += 1;
+            break;
+        }
+    }
+
+    return size;
+}
+
+/* Size of a serialized value (see chidb_dbm_reg_serialize), in bytes */
+uint32_t chidb_dbm_reg_serialsize(const uint8_t *v)
+{
+    uint32_t len;
+
+    switch (v[0])
+    {
+    case REG_INT32:
+        return 1 + sizeof(int32_t);
+    case REG_STRING:
+    case REG_BINARY:
+        memcpy(&len, v + 1, sizeof(len));
+        return 1 + sizeof(len) + len;
+    default:
+        return 1;
+    }
+}
+
+/* Load a serialized value into a register
+ *
+ * Strings and bytes are not copied: the register points to v, which must
+ * not change while it is in use.
+ *
+ * Parameters
+ * - r: Register
+ * - v: Serialized value (see chidb_dbm_reg_serialize)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_reg_deserialize(chidb_dbm_register_t *r, const uint8_t *v)
+{
+    uint32_t len;
+
+    switch (v[0])
+    {
+    case REG_INT32:
+        chidb_dbm_reg_clear(r);
+        r->type = REG_INT32;
+        memcpy(&r->value.i, v + 1, sizeof(int32_t));
+        return CHIDB_OK;
+    case REG_STRING:
+        memcpy(&len, v + 1, sizeof(len));
+        return chidb_dbm_reg_set_string(r, (const char *) v + 1 + sizeof(len), len, REG_BORROWED_PAGE);
+    case REG_BINARY:
+        memcpy(&len, v + 1, sizeof(len));
+        return chidb_dbm_reg_set_binary(r, v + 1 + sizeof(len), len, REG_BORROWED);
+    default:
+        chidb_dbm_reg_clear(r);
+        r->type = REG_NULL;
+        return CHIDB_OK;
+    }
+}
+
+
+/* Set the number of parameters of a DBM
+ *
+ * Allocates the values of the parameters loaded by Variable, one for
+ * each '?' placeholder of the SQL statement, and sets them to NULL.
+ * Frees the values of the previous parameters, if any.
+ *
+ * Parameters
+ * - stmt: DBM
+ * - nParams: Number of parameters
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stmt_set_nparams(chidb_stmt *stmt, uint32_t nParams)
+{
+    for(uint32_t i = 0; i < stmt->nParams; i++)
+        chidb_stmt_set_param(stmt, i, NULL);
+    free(stmt->params);
+    stmt->params = NULL;
+    stmt->nParams = 0;
+
+    if (nParams == 0)
+        return CHIDB_OK;
+
+    stmt->params = malloc(sizeof(chidb_dbm_register_t) * nParams);
+    if (stmt->params == NULL)
+        return CHIDB_ENOMEM;
+    for(uint32_t i = 0; i < nParams; i++)
+    {
+        stmt->params[i].type = REG_NULL;
+        stmt->params[i].storage = REG_BORROWED;
+    }
+    stmt->nParams = nParams;
+
+    return CHIDB_OK;
+}
+
+/* Set the value of a parameter
+ *
+ * Parameters
+ * - stmt: DBM
+ * - i: Parameter (starting at 0)
+ * - r: Value (an integer, a string, or NULL). Strings are copied.
+ *      If r is NULL, the parameter is set to NULL.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no such parameter
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stmt_set_param(chidb_stmt *stmt, uint32_t i, chidb_dbm_register_t *r)
+{
+    if (i >= stmt->nParams)
+        return CHIDB_EMISUSE;
+
+    if (r != NULL)
+        return chidb_dbm_reg_copy(&stmt->params[i], r);
+
+    chidb_dbm_reg_clear(&stmt->params[i]);
+    stmt->params[i].type = REG_NULL;
+
+    return CHIDB_OK;
+}
+
+/* Rewind a DBM
+ *
+ * Gets a DBM ready to run its program again, from the start: closes
+ * its cursors, hash tables, sorters and aggregators, clears its
+ * registers and the result row, and resets the program counter. The
+ * program itself, compiled or not, and the values bound to its
+ * parameters are kept, so that a prepared statement can be run any
+ * number of times without generating it again.
+ *
+ * Parameters
+ * - stmt: DBM to rewind
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_stmt_reset(chidb_stmt *stmt)
+{
+    chidb_stmt_close_cursors(stmt);
+
+    for(uint32_t i = 0; i < stmt->nReg; i++)
+        chidb_dbm_reg_clear(&stmt->reg[i]);
+
+    for(uint32_t i = 0; i < stmt->nHashes; i++)
+        chidb_dbm_hash_free(&stmt->hashes[i]);
+    for(uint32_t i = 0; i < stmt->nSorters; i++)
+        chidb_dbm_sorter_free(&stmt->sorters[i]);
+    for(uint32_t i = 0; i < stmt->nAggs; i++)
+        chidb_dbm_agg_free(&stmt->aggs[i]);
+    for(uint32_t i = 0; i < stmt->nSets; i++)
+        chidb_dbm_set_free(&stmt->sets[i]);
+    chidb_stmt_temp_close(stmt);
+    chidb_stmt_unlock(stmt);
+    chidb_dbm_result_release(stmt);
+
+    chidb_DBRecordArena_reset(&stmt->arena);
+
+    stmt->startRR = 0;
+    stmt->nRR = 0;
+    stmt->pc = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Memory for the scratch space of an operator of a statement
+ *
+ * The hash tables, sorters and aggregators of a statement, and the
+ * buffer pool of its temporary B-Tree file (see OpenEphemeral), share
+ * the temporary memory budget of its database (see
+ * chidb_set_temp_budget). Each of them gets an even share of it, among
+ * all the HashOpen, SorterOpen and AggOpen instructions of the program,
+ * and the temporary B-Tree file if it has an OpenEphemeral. An operator
+ * that outgrows its share spills to temporary files.
+ *
+ * Parameters
+ * - stmt: DBM
+ *
+ * Return
+ * - Bytes of memory that an operator of the statement may use
+ */
+size_t chidb_stmt_temp_budget(chidb_stmt *stmt)
+{
+    uint32_t n = 0;
+    bool ephemeral = false;
+
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        switch(stmt->ops[i].opcode)
+        {
+        case Op_HashOpen:
+        case Op_SorterOpen:
+        case Op_AggOpen:
+            n++;
+            break;
+        case Op_OpenEphemeral:
+            ephemeral = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    n += ephemeral;
+    return stmt->db->temp_budget / (n > 0 ? n : 1);
+}
+
+/* Get the temporary B-Tree file of a statement
+ *
+ * Opens it the first time (see chidb_Btree_openTemp), with the page
+ * size of the database, and a buffer pool that takes the statement's
+ * share of temporary memory for it (see chidb_stmt_temp_budget).
+ *
+ * Parameters
+ * - stmt: DBM
+ * - bt: Out parameter. The temporary B-Tree file is stored here.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not create the file
+ */
+int chidb_stmt_temp_btree(chidb_stmt *stmt, BTree **bt)
+{
+    if (stmt->temp == NULL)
+    {
+        uint32_t page_size = stmt->db->bt->pager->page_size;
+        size_t npages = chidb_stmt_temp_budget(stmt) / page_size;
+        int rc;
+
+        if (npages < DBM_TEMP_MIN_PAGES)
+            npages = DBM_TEMP_MIN_PAGES;
+        if (npages > UINT32_MAX)
+            npages = UINT32_MAX;
+        rc = chidb_Btree_openTemp(stmt->db, &stmt->temp, page_size, (uint32_t) npages);
+        if (rc != CHIDB_OK)
+        {
+            stmt->temp = NULL;
+            return rc;
+        }
+    }
+
+    *bt = stmt->temp;
+    return CHIDB_OK;
+}
+
+/* Closes the temporary B-Tree file of a statement, if it has one, and
+ * the cursors still open on its ephemeral tables */
+static void chidb_stmt_temp_close(chidb_stmt *stmt)
+{
+    if (stmt->temp == NULL)
+        return;
+
+    for(uint32_t i = 0; i < stmt->nCursors; i++)
+    {
+        if (stmt->cursors[i].type != CURSOR_UNSPECIFIED && stmt->cursors[i].bt == stmt->temp)
+            chidb_dbm_cursor_close(&stmt->cursors[i]);
+    }
+
+    chidb_Btree_close(stmt->temp);
+    stmt->temp = NULL;
+}
+
+/* Create a temporary file to spill to
+ *
+ * The file is deleted when it is closed (see tmpfile). It is written
+ * and read through a buffer of DBM_SPILL_BUFSIZE bytes, so that spills
+ * go to the disk in large sequential writes, instead of a write per
+ * row.
+ *
+ * Return
+ * - The file, or NULL if it could not be created
+ */
+FILE *chidb_dbm_tmpfile(void)
+{
+    FILE *f = tmpfile();
+
+    if (f != NULL)
+        setvbuf(f, NULL, _IOFBF, DBM_SPILL_BUFSIZE);
+    return f;
+}
+
+
 /* Set the value of a specific instruction
  *
  * Given an instruction (of type chidb_dbm_op_t, which includes
@@ -161,6 +745,10 @@ int chidb_stmt_set_op(chidb_stmt *stmt, chidb_dbm_op_t *op, uint32_t pos)
 
     memcpy(&stmt->ops[pos], op, sizeof(chidb_dbm_op_t));
 
+    /* The compiled program no longer matches the instructions */
+    free(stmt->compiled);
+    stmt->compiled = NULL;
+
     if(op->p4 != NULL)
         stmt->ops[pos].p4 = strdup(op->p4);
 
@@ -170,8 +758,12 @@ int chidb_stmt_set_op(chidb_stmt *stmt, chidb_dbm_op_t *op, uint32_t pos)
     return CHIDB_OK;
 }
 
-/* Forward declaration of instruction handler. See dbm-ops.c for details */
-int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op);
+/* Forward declaration of interpreter loop and compiler. See dbm-ops.c
+ * for details */
+int chidb_dbm_op_run (chidb_stmt *stmt);
+int chidb_dbm_compile (chidb_stmt *stmt);
+int chidb_dbm_compiled_run (chidb_stmt *stmt);
+int chidb_dbm_profiled_run (chidb_stmt *stmt);
 
 
 /* Run the DBM
@@ -187,35 +779,253 @@ int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op);
  *    or CHIDB_ROW. The program stops executing and and the return
  *    value of the instruction handler is returned.
  *
+ * The program runs in the interpreter until it has run
+ * DBM_COMPILE_THRESHOLD instructions, which only long-running
+ * statements do, and compiled (see chidb_dbm_compile) from then on.
+ * stmt->compile can be set to DBM_COMPILE_ALWAYS or DBM_COMPILE_NEVER
+ * to compile it as soon as it starts running, or never. If it can't be
+ * compiled, it keeps running in the interpreter. A statement that is
+ * being profiled (see chidb_profile_start) always runs in the
+ * interpreter, which counts the executions and cycles of each
+ * instruction.
+ *
+ * A statement that doesn't write to the database, run outside of a
+ * transaction on a database with a write-ahead log, reads a snapshot of
+ * the database as it was when it started (see
+ * chidb_Pager_beginSnapshot), so that what is committed while it runs
+ * neither waits for it nor changes its results. A statement that writes
+ * outside of a transaction runs in one of its own, which is committed
+ * when it is done, and rolled back if it fails, so that it never leaves
+ * part of its writes behind (see chidb_stmt_lock).
+ *
+ * Other connections to the same database, in this process or others,
+ * are kept out while the statement runs (see chidb_Pager_beginRead and
+ * chidb_Pager_beginWrite): a statement that writes waits for the one
+ * that is writing, if any, before its first instruction.
+ *
  * Parameters
  * - stmt: DBM to run.
  *
  * Returns
  * - CHIDB_ROW: Statement returned a row.
  * - CHIDB_DONE: Statement has finished executing.
- * - Any error code returned by an individual instruction handler.
+ * - Any error code returned by an individual instruction handler, or
+ *   by the commit of the statement's own transaction.
  */
 int chidb_stmt_exec(chidb_stmt *stmt)
 {
-    int rc = CHIDB_OK;
+    PagerSnapshot *prev;
+    int rc;
 
-    while(stmt->pc < stmt->endOp)
+    if (stmt->pc == 0 && !stmt->reading)
     {
-        chidb_dbm_op_t *op = &stmt->ops[stmt->pc++];
-        rc = chidb_dbm_op_handle(stmt, op);
-
+        rc = chidb_stmt_lock(stmt);
         if (rc != CHIDB_OK)
-            break;
+            return rc;
+        chidb_stmt_snapshot_begin(stmt);
     }
+    prev = chidb_Pager_useSnapshot(stmt->snapshot);
+    CHIDB_PROBE1(stmt__start, stmt);
+
+    if (stmt->profile == NULL && stmt->compiled == NULL &&
+        (stmt->compile == DBM_COMPILE_ALWAYS ||
+         (stmt->compile == DBM_COMPILE_AUTO && stmt->ninstr >= DBM_COMPILE_THRESHOLD)))
+        chidb_dbm_compile(stmt);
+
+    if (stmt->profile != NULL)
+        rc = chidb_dbm_profiled_run(stmt);
+    else if (stmt->compiled != NULL)
+        rc = chidb_dbm_compiled_run(stmt);
+    else
+        rc = chidb_dbm_op_run(stmt);
 
+    CHIDB_PROBE2(stmt__done, stmt, rc);
     assert(stmt->nRR == stmt->nCols);
 
+    chidb_Pager_useSnapshot(prev);
+    if (rc != CHIDB_ROW)
+    {
+        rc = chidb_stmt_autocommit_end(stmt, rc);
+        chidb_stmt_unlock(stmt);
+    }
+
     if (rc == CHIDB_OK || rc == CHIDB_DONE)
         rc = CHIDB_DONE;
 
     return rc;
 }
 
+/* Begins a snapshot for a statement that only reads the database, if
+ * the database has a write-ahead log and no transaction is in progress
+ * (a transaction reads what it wrote). Without one, the statement reads
+ * the current pages. */
+static void chidb_stmt_snapshot_begin(chidb_stmt *stmt)
+{
+    Pager *pager = stmt->db->bt->pager;
+
+    if (stmt->snapshot != NULL || pager->wal == NULL || chidb_Pager_inTransaction(pager) || stmt->writing)
+        return;
+
+    if (chidb_Pager_beginSnapshot(pager, &stmt->snapshot) != CHIDB_OK)
+        stmt->snapshot = NULL;
+}
+
+/* Ends the snapshot of a statement, if it has one */
+static void chidb_stmt_snapshot_end(chidb_stmt *stmt)
+{
+    if (stmt->snapshot == NULL)
+        return;
+
+    chidb_Pager_endSnapshot(stmt->db->bt->pager, stmt->snapshot);
+    stmt->snapshot = NULL;
+}
+
+/* Returns true if the program of a statement may write to the database */
+bool chidb_stmt_writes(chidb_stmt *stmt)
+{
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        switch(stmt->ops[i].opcode)
+        {
+        case Op_OpenWrite:
+        case Op_CreateTable:
+        case Op_CreateIndex:
+        case Op_HashIdxInsert:
+        case Op_AutoCommit:
+            return true;
+        default:
+            break;
+        }
+    }
+
+    return false;
+}
+
+/* Returns true if the program of a statement begins or ends a
+ * transaction */
+static bool chidb_stmt_transacts(chidb_stmt *stmt)
+{
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+        if (stmt->ops[i].opcode == Op_AutoCommit)
+            return true;
+
+    return false;
+}
+
+/* Takes the locks a statement holds while it runs (see chidb_stmt_exec):
+ * the write lock first, if it writes, so that it reads what the last
+ * writer committed. The writes of the statement are counted in the
+ * result cache once it has the write lock, and again when it releases
+ * it (see chidb_dbm_result_written). */
+static int chidb_stmt_lock(chidb_stmt *stmt)
+{
+    Pager *pager = stmt->db->bt->pager;
+    int rc;
+
+    stmt->writing = chidb_stmt_writes(stmt);
+    if (stmt->writing)
+    {
+        rc = chidb_Pager_beginWrite(pager);
+        if (rc != CHIDB_OK)
+        {
+            stmt->writing = false;
+            return rc;
+        }
+        chidb_dbm_result_written(stmt->db->result_cache, stmt);
+    }
+
+    rc = chidb_Pager_beginRead(pager);
+    if (rc != CHIDB_OK)
+    {
+        if (stmt->writing)
+            chidb_Pager_endWrite(pager);
+        stmt->writing = false;
+        return rc;
+    }
+    stmt->reading = true;
+
+    /* Outside a transaction, a statement that writes runs in one of its
+     * own, so that a failure halfway leaves nothing behind. Those that
+     * begin or end transactions (AutoCommit) are left alone. */
+    if (stmt->writing && !chidb_Pager_inTransaction(pager) && !chidb_stmt_transacts(stmt))
+    {
+        rc = chidb_Btree_begin(stmt->db->bt);
+        if (rc != CHIDB_OK)
+        {
+            chidb_stmt_unlock(stmt);
+            return rc;
+        }
+        stmt->autocommit = true;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Releases the locks taken by chidb_stmt_lock, and the snapshot of the
+ * statement, if it has them */
+static void chidb_stmt_unlock(chidb_stmt *stmt)
+{
+    Pager *pager = stmt->db->bt->pager;
+
+    chidb_stmt_snapshot_end(stmt);
+    if (stmt->autocommit)
+    {
+        /* Reset or freed before it was done */
+        chidb_stmt_close_cursors(stmt);
+        chidb_stmt_autocommit_end(stmt, CHIDB_EMISUSE);
+    }
+    if (stmt->reading)
+        chidb_Pager_endRead(pager);
+    if (stmt->writing)
+    {
+        chidb_dbm_result_written(stmt->db->result_cache, stmt);
+        chidb_Pager_endWrite(pager);
+    }
+    stmt->reading = false;
+    stmt->writing = false;
+}
+
+/* Ends the transaction of a statement that runs in one of its own (see
+ * chidb_stmt_lock): commits it if the statement is done (rc is
+ * CHIDB_OK or CHIDB_DONE), and otherwise, or if the commit fails, rolls
+ * it back, with the cursors of the statement closed first, since no
+ * page may be pinned. Returns rc, or the error of the commit. */
+static int chidb_stmt_autocommit_end(chidb_stmt *stmt, int rc)
+{
+    if (!stmt->autocommit)
+        return rc;
+    stmt->autocommit = false;
+
+    if (rc == CHIDB_OK || rc == CHIDB_DONE)
+    {
+        int commit = chidb_commit(stmt->db);
+
+        if (commit == CHIDB_OK)
+            return rc;
+        rc = commit;
+    }
+
+    chidb_stmt_close_cursors(stmt);
+    chidb_rollback(stmt->db);
+
+    return rc;
+}
+
+/* Closes the cursors that a statement has open */
+static void chidb_stmt_close_cursors(chidb_stmt *stmt)
+{
+    for(uint32_t i = 0; i < stmt->nCursors; i++)
+    {
+        if (stmt->cursors[i].type != CURSOR_UNSPECIFIED)
+        {
+            chidb_dbm_op_t close = {Op_Close, i, 0, 0, NULL};
+
+            chidb_dbm_op_handle(stmt, &close);
+            stmt->cursors[i].type = CURSOR_UNSPECIFIED;
+        }
+    }
+}
+
 /* Prints a human-readable representation of an instruction */
 int chidb_stmt_op_print(chidb_dbm_op_t *op)
 {
@@ -253,10 +1063,10 @@ char* chidb_stmt_reg_str(chidb_dbm_register_t *r)
         snprintf(s, MAX_STR_LEN, "%i", r->value.i);
         break;
     case REG_STRING:
-        snprintf(s, MAX_STR_LEN, "\"%s\"", r->value.s);
+        snprintf(s, MAX_STR_LEN, "\"%.*s\"", (int) chidb_dbm_reg_strlen(r), chidb_dbm_reg_str(r));
         break;
     case REG_BINARY:
-        snprintf(s, MAX_STR_LEN, "(%i bytes)", r->value.bin.nbytes);
+        snprintf(s, MAX_STR_LEN, "(%i bytes)", chidb_dbm_reg_nbytes(r));
         break;
     }
 
@@ -389,6 +1199,7 @@ int realloc_reg(chidb_stmt *stmt, uint32_t size)
     for(int i=stmt->nReg; i < size; i++)
     {
         stmt->reg[i].type = REG_UNSPECIFIED;
+        stmt->reg[i].storage = REG_BORROWED;
     }
 
     stmt->nReg = size;
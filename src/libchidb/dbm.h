@@ -40,14 +40,39 @@
 #ifndef DBM_H_
 #define DBM_H_
 
+#include <stdio.h>
 #include "chidbInt.h"
 #include "dbm-types.h"
 
+/* Size of the stdio buffer of the temporary files that hash tables,
+ * sorters and aggregators spill to (see chidb_dbm_tmpfile) */
+#define DBM_SPILL_BUFSIZE (64 * 1024)
+
+/* Fewest pages in the buffer pool of a statement's temporary B-Tree
+ * file, whatever its share of the temporary memory budget */
+#define DBM_TEMP_MIN_PAGES (16)
+
 
 int chidb_stmt_init(chidb_stmt *stmt, chidb *db);
 int chidb_stmt_free(chidb_stmt *stmt);
 int chidb_stmt_set_op(chidb_stmt *stmt, chidb_dbm_op_t *op, uint32_t pos);
 int chidb_stmt_exec(chidb_stmt *stmt);
+int chidb_stmt_peephole(chidb_stmt *stmt);
+int chidb_stmt_set_nparams(chidb_stmt *stmt, uint32_t nParams);
+int chidb_stmt_set_param(chidb_stmt *stmt, uint32_t i, chidb_dbm_register_t *r);
+int chidb_stmt_reset(chidb_stmt *stmt);
+bool chidb_stmt_writes(chidb_stmt *stmt);
+size_t chidb_stmt_temp_budget(chidb_stmt *stmt);
+int chidb_stmt_temp_btree(chidb_stmt *stmt, BTree **bt);
+FILE *chidb_dbm_tmpfile(void);
+void chidb_dbm_reg_clear(chidb_dbm_register_t *r);
+int chidb_dbm_reg_set_string(chidb_dbm_register_t *r, const char *s, uint32_t len, register_storage_t storage);
+int chidb_dbm_reg_set_binary(chidb_dbm_register_t *r, const uint8_t *bytes, uint32_t nbytes, register_storage_t storage);
+void chidb_dbm_reg_scopy(chidb_dbm_register_t *dst, chidb_dbm_register_t *src);
+int chidb_dbm_reg_copy(chidb_dbm_register_t *dst, chidb_dbm_register_t *src);
+uint32_t chidb_dbm_reg_serialize(chidb_dbm_register_t *regs, uint32_t n, uint8_t *out);
+uint32_t chidb_dbm_reg_serialsize(const uint8_t *v);
+int chidb_dbm_reg_deserialize(chidb_dbm_register_t *r, const uint8_t *v);
 char* chidb_stmt_rr_str(chidb_stmt *stmt, char sep);
 int chidb_stmt_rr_print(chidb_stmt *stmt, char sep);
 int chidb_stmt_print(chidb_stmt *stmt);
@@ -0,0 +1,722 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Expression compiler
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chidb/chidb.h>
+#include "exprc.h"
+#include "catalog.h"
+
+/* The expression compiler works on the expressions and conditions of the
+ * SRA tree of a SELECT statement, on both sides of the optimizer (see
+ * chidb_stmt_optimize):
+ *
+ * - Before it, chidb_exprc_fold folds their constant parts: arithmetic
+ *   on integers (unless it overflows, or divides by zero), arithmetic
+ *   with NULL (which is NULL), the concatenation of two strings, and
+ *   comparisons of two integers or two strings, which become 1 = 1 if
+ *   they hold, and 1 = 0 otherwise. A true conjunct is dropped from its
+ *   AND, and a false one makes the whole AND false (the other way around
+ *   for ORs). NOTs are pushed down to the comparisons, which take the
+ *   opposite operator, through ANDs and ORs (De Morgan's laws), except
+ *   for equalities, which have none. A selection that always holds is
+ *   removed. Folding comes first so that a = 2 * 3 can seek an index.
+ *   Comparisons with NULL are left alone: they neither hold nor fail, so
+ *   a NOT on them doesn't make them hold either.
+ *
+ * - After it, chidb_exprc_compile reorders the conjuncts of each
+ *   selection and ON condition so that the rows they rule out are ruled
+ *   out as cheaply as possible: by increasing cost / (1 - selectivity),
+ *   which puts a cheap conjunct that rules out most rows first, and one
+ *   that rules out none last. The selectivities are the optimizer's,
+ *   and the cost is the number of instructions a conjunct takes, with
+ *   a comparison that can't be typed costing more. The conjuncts
+ *   themselves are kept (the optimizer points at some of them), and so
+ *   are the AND nodes, which are only relinked.
+ *
+ * - Codegen asks chidb_exprc_cmpOp for the instruction of a comparison,
+ *   which is one of the typed ones (EqInt to GeInt), that compare two
+ *   integers without looking at the types of their registers, when the
+ *   catalog says that both sides are integers.
+ *
+ * The DBM has no arithmetic instructions, so only comparisons have a
+ * typed version.
+ */
+
+/* Cost, on top of the comparison itself, of comparing values whose
+ * types aren't known (the instruction looks at the types of both
+ * registers first), and of comparing two strings */
+#define EXPRC_UNTYPED_COST (1)
+#define EXPRC_TEXT_COST (4)
+
+/* Implemented in optimizer.c */
+double chidb_stmt_selectivity(chidb *db, SRA_t **scope, int nscope, Condition_t *cond);
+TableReference_t *chidb_stmt_columnTable(chidb *db, SRA_t **scope, int nscope, ColumnReference_t *ref);
+
+
+/*** Folding ***/
+
+static bool exprc_isInt(Expression_t *expr)
+{
+    return expr->t == EXPR_TERM && expr->expr.term.t == TERM_LITERAL &&
+           expr->expr.term.val->t == TYPE_INT;
+}
+
+static bool exprc_isText(Expression_t *expr)
+{
+    return expr->t == EXPR_TERM && expr->expr.term.t == TERM_LITERAL &&
+           expr->expr.term.val->t == TYPE_TEXT;
+}
+
+static bool exprc_isNull(Expression_t *expr)
+{
+    return expr->t == EXPR_TERM && expr->expr.term.t == TERM_NULL;
+}
+
+/* Whether expr has an aggregate function, which folding it away would
+ * turn an aggregate query into a plain one */
+static bool exprc_hasFunc(Expression_t *expr)
+{
+    switch (expr->t)
+    {
+    case EXPR_TERM:
+        return expr->expr.term.t == TERM_FUNC;
+    case EXPR_NEG:
+        return exprc_hasFunc(expr->expr.unary.expr);
+    default:
+        return exprc_hasFunc(expr->expr.binary.expr1) || exprc_hasFunc(expr->expr.binary.expr2);
+    }
+}
+
+/* Makes expr what its operand op is (keeping its alias, and its place
+ * in its list). op is freed, but not what it points to. */
+static void exprc_become(Expression_t *expr, Expression_t *op)
+{
+    expr->t = op->t;
+    expr->expr = op->expr;
+    chisql_free(op);
+}
+
+/* Computes a op b into *r, unless it overflows or divides by zero */
+static bool exprc_intOp(enum ExprType op, int a, int b, int *r)
+{
+    switch (op)
+    {
+    case EXPR_PLUS:
+        return !__builtin_add_overflow(a, b, r);
+    case EXPR_MINUS:
+        return !__builtin_sub_overflow(a, b, r);
+    case EXPR_MULTIPLY:
+        return !__builtin_mul_overflow(a, b, r);
+    case EXPR_DIVIDE:
+        if (b == 0 || (a == INT_MIN && b == -1))
+            return false;
+        *r = a / b;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Folds the constant parts of expr, in place */
+static void exprc_foldExpr(Expression_t *expr)
+{
+    Expression_t *e1, *e2;
+    Literal_t *lit;
+    size_t len1, len2;
+    char *str;
+    int r;
+
+    switch (expr->t)
+    {
+    case EXPR_TERM:
+        if (expr->expr.term.t == TERM_FUNC && expr->expr.term.f.expr != NULL)
+            exprc_foldExpr(expr->expr.term.f.expr);
+        return;
+    case EXPR_NEG:
+        e1 = expr->expr.unary.expr;
+        exprc_foldExpr(e1);
+        if (exprc_isInt(e1) && e1->expr.term.val->val.ival != INT_MIN)
+        {
+            e1->expr.term.val->val.ival = -e1->expr.term.val->val.ival;
+            exprc_become(expr, e1);
+        }
+        else if (exprc_isNull(e1))
+            exprc_become(expr, e1);
+        return;
+    default:
+        break;
+    }
+
+    e1 = expr->expr.binary.expr1;
+    e2 = expr->expr.binary.expr2;
+    exprc_foldExpr(e1);
+    exprc_foldExpr(e2);
+
+    if (exprc_isNull(e1) && !exprc_hasFunc(e2))
+    {
+        Expression_free(e2);
+        exprc_become(expr, e1);
+    }
+    else if (exprc_isNull(e2) && !exprc_hasFunc(e1))
+    {
+        Expression_free(e1);
+        exprc_become(expr, e2);
+    }
+    else if (exprc_isInt(e1) && exprc_isInt(e2) &&
+             exprc_intOp(expr->t, e1->expr.term.val->val.ival, e2->expr.term.val->val.ival, &r))
+    {
+        e1->expr.term.val->val.ival = r;
+        Expression_free(e2);
+        exprc_become(expr, e1);
+    }
+    else if (expr->t == EXPR_CONCAT && exprc_isText(e1) && exprc_isText(e2))
+    {
+        lit = e1->expr.term.val;
+        len1 = strlen(lit->val.strval);
+        len2 = strlen(e2->expr.term.val->val.strval);
+        if ((str = chisql_alloc(len1 + len2 + 1)) == NULL)
+            return;
+        memcpy(str, lit->val.strval, len1);
+        memcpy(str + len1, e2->expr.term.val->val.strval, len2 + 1);
+        chisql_free(lit->val.strval);
+        lit->val.strval = str;
+        Expression_free(e2);
+        exprc_become(expr, e1);
+    }
+}
+
+/* Whether cond is a comparison of two integers or two strings, and if
+ * it is, whether it holds, in *value */
+static bool exprc_truth(Condition_t *cond, bool *value)
+{
+    Expression_t *e1, *e2;
+    int a, b, c;
+
+    if (cond->t > RA_COND_GEQ)
+        return false;
+
+    e1 = cond->cond.comp.expr1;
+    e2 = cond->cond.comp.expr2;
+    if (exprc_isInt(e1) && exprc_isInt(e2))
+    {
+        a = e1->expr.term.val->val.ival;
+        b = e2->expr.term.val->val.ival;
+        c = (a > b) - (a < b);
+    }
+    else if (exprc_isText(e1) && exprc_isText(e2))
+    {
+        c = strcmp(e1->expr.term.val->val.strval, e2->expr.term.val->val.strval);
+        c = (c > 0) - (c < 0);
+    }
+    else
+        return false;
+
+    switch (cond->t)
+    {
+    case RA_COND_EQ:  *value = c == 0; break;
+    case RA_COND_LT:  *value = c < 0;  break;
+    case RA_COND_GT:  *value = c > 0;  break;
+    case RA_COND_LEQ: *value = c <= 0; break;
+    default:          *value = c >= 0; break;
+    }
+    return true;
+}
+
+/* Turns a comparison of two values (see exprc_truth) into 1 = 1, if
+ * value is true, or 1 = 0 */
+static void exprc_setTruth(Condition_t *cond, bool value)
+{
+    Literal_t *lit1 = cond->cond.comp.expr1->expr.term.val;
+    Literal_t *lit2 = cond->cond.comp.expr2->expr.term.val;
+
+    if (lit1->t == TYPE_TEXT)
+        chisql_free(lit1->val.strval);
+    if (lit2->t == TYPE_TEXT)
+        chisql_free(lit2->val.strval);
+
+    cond->t = RA_COND_EQ;
+    lit1->t = lit2->t = TYPE_INT;
+    lit1->val.ival = 1;
+    lit2->val.ival = value;
+}
+
+/* Pushes the NOT node neg down into cond, its (folded) operand. Returns
+ * the condition that replaces neg, which is reused or freed. */
+static Condition_t *exprc_not(Condition_t *neg, Condition_t *cond)
+{
+    Condition_t *cond1;
+    bool value;
+
+    switch (cond->t)
+    {
+    case RA_COND_NOT:
+        cond1 = cond->cond.unary.cond;
+        chisql_free(cond);
+        chisql_free(neg);
+        return cond1;
+    case RA_COND_AND:
+    case RA_COND_OR:
+        cond->t = cond->t == RA_COND_AND ? RA_COND_OR : RA_COND_AND;
+        cond->cond.binary.cond1 = exprc_not(neg, cond->cond.binary.cond1);
+        cond->cond.binary.cond2 = exprc_not(Not(cond->cond.binary.cond2), cond->cond.binary.cond2);
+        return cond;
+    case RA_COND_LT:
+    case RA_COND_GT:
+    case RA_COND_LEQ:
+    case RA_COND_GEQ:
+        cond->t = cond->t == RA_COND_LT ? RA_COND_GEQ :
+                  cond->t == RA_COND_GT ? RA_COND_LEQ :
+                  cond->t == RA_COND_LEQ ? RA_COND_GT : RA_COND_LT;
+        chisql_free(neg);
+        return cond;
+    case RA_COND_EQ:
+        if (exprc_truth(cond, &value))
+        {
+            exprc_setTruth(cond, !value);
+            chisql_free(neg);
+            return cond;
+        }
+        /* Fall through: there is no inequality to turn it into */
+    default:
+        neg->cond.unary.cond = cond;
+        return neg;
+    }
+}
+
+/* Folds the constant parts of cond. Returns the condition that replaces
+ * it (cond itself, or one of its parts). */
+static Condition_t *exprc_foldCond(Condition_t *cond)
+{
+    Condition_t *cond1, *cond2, *keep;
+    bool value, absorb;
+
+    switch (cond->t)
+    {
+    case RA_COND_AND:
+    case RA_COND_OR:
+        cond1 = cond->cond.binary.cond1 = exprc_foldCond(cond->cond.binary.cond1);
+        cond2 = cond->cond.binary.cond2 = exprc_foldCond(cond->cond.binary.cond2);
+
+        /* false decides an AND on its own, and true an OR */
+        absorb = cond->t == RA_COND_OR;
+        if (exprc_truth(cond1, &value))
+            keep = value == absorb ? cond1 : cond2;
+        else if (exprc_truth(cond2, &value))
+            keep = value == absorb ? cond2 : cond1;
+        else
+            return cond;
+
+        Condition_free(keep == cond1 ? cond2 : cond1);
+        chisql_free(cond);
+        return keep;
+    case RA_COND_NOT:
+        return exprc_not(cond, exprc_foldCond(cond->cond.unary.cond));
+    case RA_COND_IN:
+        exprc_foldExpr(cond->cond.in.expr);
+        if (cond->cond.in.select != NULL)
+            cond->cond.in.select = chidb_exprc_fold(cond->cond.in.select);
+        return cond;
+    default:
+        exprc_foldExpr(cond->cond.comp.expr1);
+        exprc_foldExpr(cond->cond.comp.expr2);
+        if (exprc_truth(cond, &value))
+            exprc_setTruth(cond, value);
+        return cond;
+    }
+}
+
+static void exprc_foldList(Expression_t *list)
+{
+    for (Expression_t *expr = list; expr != NULL; expr = expr->next)
+        exprc_foldExpr(expr);
+}
+
+/* Folds the constant parts of the expressions and conditions of an SRA
+ * tree
+ *
+ * Runs on the tree of a SELECT statement before it is optimized, in the
+ * arena of the statement (see chisql_arena_use): the tree is changed in
+ * place, and the nodes that it no longer needs are freed.
+ *
+ * Parameters
+ * - sra: SRA tree
+ *
+ * Return
+ * - The folded tree (sra, unless a selection at its top always holds)
+ */
+SRA_t *chidb_exprc_fold(SRA_t *sra)
+{
+    SRA_t *child;
+    bool value;
+
+    switch (sra->t)
+    {
+    case SRA_TABLE:
+        break;
+    case SRA_PROJECT:
+        exprc_foldList(sra->project.expr_list);
+        exprc_foldList(sra->project.order_by);
+        exprc_foldList(sra->project.group_by);
+        sra->project.sra = chidb_exprc_fold(sra->project.sra);
+        break;
+    case SRA_SELECT:
+        sra->select.sra = chidb_exprc_fold(sra->select.sra);
+        sra->select.cond = exprc_foldCond(sra->select.cond);
+        if (exprc_truth(sra->select.cond, &value) && value)
+        {
+            child = sra->select.sra;
+            Condition_free(sra->select.cond);
+            chisql_free(sra);
+            return child;
+        }
+        break;
+    case SRA_JOIN:
+    case SRA_LEFT_OUTER_JOIN:
+    case SRA_RIGHT_OUTER_JOIN:
+    case SRA_FULL_OUTER_JOIN:
+        sra->join.sra1 = chidb_exprc_fold(sra->join.sra1);
+        sra->join.sra2 = chidb_exprc_fold(sra->join.sra2);
+        if (sra->join.opt_cond != NULL && sra->join.opt_cond->t == JOIN_COND_ON)
+            sra->join.opt_cond->on = exprc_foldCond(sra->join.opt_cond->on);
+        break;
+    default:
+        sra->binary.sra1 = chidb_exprc_fold(sra->binary.sra1);
+        sra->binary.sra2 = chidb_exprc_fold(sra->binary.sra2);
+        break;
+    }
+
+    return sra;
+}
+
+
+/*** Types ***/
+
+static chidb_exprc_type_t exprc_dataType(enum data_type type)
+{
+    switch (type)
+    {
+    case TYPE_INT:
+        return EXPRC_INT;
+    case TYPE_CHAR:
+    case TYPE_TEXT:
+        return EXPRC_TEXT;
+    default:
+        return EXPRC_UNKNOWN;
+    }
+}
+
+static chidb_exprc_type_t exprc_termType(chidb *db, SRA_t **scope, int nscope, ExprTerm *term)
+{
+    TableReference_t *tref;
+    chidb_catalog_table_t *t;
+    int col;
+
+    switch (term->t)
+    {
+    case TERM_LITERAL:
+        return exprc_dataType(term->val->t);
+    case TERM_COLREF:
+        tref = chidb_stmt_columnTable(db, scope, nscope, term->ref);
+        if (tref == NULL || (t = chidb_catalog_table(db, tref->table_name)) == NULL)
+            return EXPRC_UNKNOWN;
+        col = chidb_catalog_column(t, term->ref->columnName);
+        return col >= 0 ? exprc_dataType(t->cols[col].type) : EXPRC_UNKNOWN;
+    case TERM_FUNC:
+        switch (term->f.t)
+        {
+        case FUNC_COUNT:
+            return EXPRC_INT;
+        case FUNC_MIN:
+        case FUNC_MAX:
+            return chidb_exprc_type(db, scope, nscope, term->f.expr);
+        case FUNC_SUM:
+            return chidb_exprc_type(db, scope, nscope, term->f.expr) == EXPRC_INT ? EXPRC_INT
+                                                                                 : EXPRC_UNKNOWN;
+        default:
+            return EXPRC_UNKNOWN;
+        }
+    default:
+        return EXPRC_UNKNOWN;
+    }
+}
+
+/* Type of the values of an expression
+ *
+ * Parameters
+ * - db: Database (for the types of the columns, in its catalog)
+ * - scope, nscope: The SRAs whose tables the columns of expr are from
+ * - expr: Expression
+ *
+ * Return
+ * - EXPRC_INT or EXPRC_TEXT if all its values (other than NULL) are
+ *   integers or strings
+ * - EXPRC_UNKNOWN otherwise
+ */
+chidb_exprc_type_t chidb_exprc_type(chidb *db, SRA_t **scope, int nscope, Expression_t *expr)
+{
+    switch (expr->t)
+    {
+    case EXPR_TERM:
+        return exprc_termType(db, scope, nscope, &expr->expr.term);
+    case EXPR_CONCAT:
+        return EXPRC_TEXT;
+    case EXPR_NEG:
+        return chidb_exprc_type(db, scope, nscope, expr->expr.unary.expr) == EXPRC_INT ? EXPRC_INT
+                                                                                        : EXPRC_UNKNOWN;
+    default:
+        return chidb_exprc_type(db, scope, nscope, expr->expr.binary.expr1) == EXPRC_INT &&
+               chidb_exprc_type(db, scope, nscope, expr->expr.binary.expr2) == EXPRC_INT
+               ? EXPRC_INT : EXPRC_UNKNOWN;
+    }
+}
+
+/* The instruction that runs a comparison
+ *
+ * Parameters
+ * - db: Database
+ * - scope, nscope: The SRAs whose tables the columns of cond are from
+ * - cond: Comparison
+ * - op: Instruction that codegen would run it with otherwise (Eq, Ne,
+ *   Lt, Le, Gt or Ge, with the sides of cond in its registers)
+ *
+ * Return
+ * - The typed version of op (EqInt to GeInt) if both sides of cond are
+ *   integers
+ * - op otherwise
+ */
+opcode_t chidb_exprc_cmpOp(chidb *db, SRA_t **scope, int nscope, Condition_t *cond, opcode_t op)
+{
+    if (op < Op_Eq || op > Op_Ge || cond->t > RA_COND_GEQ)
+        return op;
+
+    if (chidb_exprc_type(db, scope, nscope, cond->cond.comp.expr1) != EXPRC_INT ||
+        chidb_exprc_type(db, scope, nscope, cond->cond.comp.expr2) != EXPRC_INT)
+        return op;
+
+    return Op_EqInt + (op - Op_Eq);
+}
+
+
+/*** Conjunct order ***/
+
+static double exprc_exprCost(Expression_t *expr)
+{
+    switch (expr->t)
+    {
+    case EXPR_TERM:
+        if (expr->expr.term.t == TERM_FUNC && expr->expr.term.f.expr != NULL)
+            return 1 + exprc_exprCost(expr->expr.term.f.expr);
+        return 1;
+    case EXPR_NEG:
+        return 1 + exprc_exprCost(expr->expr.unary.expr);
+    default:
+        return 1 + exprc_exprCost(expr->expr.binary.expr1) + exprc_exprCost(expr->expr.binary.expr2);
+    }
+}
+
+/* Estimated cost of evaluating cond on a row, in instructions */
+static double exprc_cost(chidb *db, SRA_t **scope, int nscope, Condition_t *cond)
+{
+    chidb_exprc_type_t t1, t2;
+    unsigned int n = 0;
+    double cost;
+
+    switch (cond->t)
+    {
+    case RA_COND_AND:
+    case RA_COND_OR:
+        return exprc_cost(db, scope, nscope, cond->cond.binary.cond1) +
+               exprc_cost(db, scope, nscope, cond->cond.binary.cond2);
+    case RA_COND_NOT:
+        return 1 + exprc_cost(db, scope, nscope, cond->cond.unary.cond);
+    case RA_COND_IN:
+        /* A binary search of the set of the list (see InSet) */
+        cost = 1 + exprc_exprCost(cond->cond.in.expr);
+        for (Literal_t *val = cond->cond.in.values_list; val != NULL; val = val->next)
+            n++;
+        for (; n > 1; n /= 2)
+            cost++;
+        return cost;
+    default:
+        cost = 1 + exprc_exprCost(cond->cond.comp.expr1) + exprc_exprCost(cond->cond.comp.expr2);
+        t1 = chidb_exprc_type(db, scope, nscope, cond->cond.comp.expr1);
+        t2 = chidb_exprc_type(db, scope, nscope, cond->cond.comp.expr2);
+        if (t1 == EXPRC_TEXT || t2 == EXPRC_TEXT)
+            cost += EXPRC_TEXT_COST;
+        else if (t1 != EXPRC_INT || t2 != EXPRC_INT)
+            cost += EXPRC_UNTYPED_COST;
+        return cost;
+    }
+}
+
+/* Rank of a conjunct: the lower, the earlier it is checked */
+static double exprc_rank(chidb *db, SRA_t **scope, int nscope, Condition_t *cond)
+{
+    double s;
+    bool value;
+
+    if (exprc_truth(cond, &value))
+        s = value;
+    else
+        s = chidb_stmt_selectivity(db, scope, nscope, cond);
+
+    return s < 1 ? exprc_cost(db, scope, nscope, cond) / (1 - s) : HUGE_VAL;
+}
+
+/* Appends the conjuncts of cond to *conds, and its AND nodes to *ands */
+static bool exprc_conjuncts(Condition_t *cond, Vector_t **conds, Vector_t **ands)
+{
+    Vector_t *v;
+
+    if (cond->t != RA_COND_AND)
+    {
+        if ((v = Vector_push(*conds, cond)) == NULL)
+            return false;
+        *conds = v;
+        return true;
+    }
+
+    if ((v = Vector_push(*ands, cond)) == NULL)
+        return false;
+    *ands = v;
+    return exprc_conjuncts(cond->cond.binary.cond1, conds, ands) &&
+           exprc_conjuncts(cond->cond.binary.cond2, conds, ands);
+}
+
+/* Reorders the conjuncts of *cond by rank, relinking its AND nodes
+ * into a left-deep chain */
+static int exprc_reorder(chidb *db, SRA_t **scope, int nscope, Condition_t **cond)
+{
+    Vector_t *conds = NULL, *ands = NULL;
+    Condition_t *c, *node;
+    double *ranks = NULL, r;
+    unsigned int n, j;
+    int rc = CHIDB_ENOMEM;
+
+    if (*cond == NULL || (*cond)->t != RA_COND_AND)
+        return CHIDB_OK;
+
+    if (!exprc_conjuncts(*cond, &conds, &ands))
+        goto done;
+    n = Vector_size(conds);
+    if ((ranks = malloc(n * sizeof(double))) == NULL)
+        goto done;
+
+    /* An insertion sort: there are few conjuncts, and those of the same
+     * rank keep their order */
+    for (unsigned int i = 0; i < n; i++)
+    {
+        c = Vector_get(conds, i);
+        r = exprc_rank(db, scope, nscope, c);
+        for (j = i; j > 0 && ranks[j - 1] > r; j--)
+        {
+            ranks[j] = ranks[j - 1];
+            Vector_get(conds, j) = Vector_get(conds, j - 1);
+        }
+        ranks[j] = r;
+        Vector_get(conds, j) = c;
+    }
+
+    /* There is one AND node fewer than there are conjuncts */
+    for (unsigned int i = 0; i + 1 < n; i++)
+    {
+        node = Vector_get(ands, i);
+        node->cond.binary.cond1 = i == 0 ? Vector_get(conds, 0) : Vector_get(ands, i - 1);
+        node->cond.binary.cond2 = Vector_get(conds, i + 1);
+    }
+    *cond = Vector_get(ands, n - 2);
+    rc = CHIDB_OK;
+
+done:
+    free(ranks);
+    Vector_free(conds);
+    Vector_free(ands);
+    return rc;
+}
+
+/* Reorders the conjuncts of the conditions of an optimized SRA tree
+ *
+ * Runs on the tree of a SELECT statement once it is optimized, in the
+ * arena of the statement: the conditions are relinked in place.
+ *
+ * Parameters
+ * - db: Database (for the statistics and the catalog)
+ * - sra: SRA tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_exprc_compile(chidb *db, SRA_t *sra)
+{
+    SRA_t *scope[2];
+    int rc;
+
+    switch (sra->t)
+    {
+    case SRA_TABLE:
+        return CHIDB_OK;
+    case SRA_PROJECT:
+        return chidb_exprc_compile(db, sra->project.sra);
+    case SRA_SELECT:
+        if ((rc = chidb_exprc_compile(db, sra->select.sra)) != CHIDB_OK)
+            return rc;
+        return exprc_reorder(db, &sra->select.sra, 1, &sra->select.cond);
+    case SRA_JOIN:
+    case SRA_LEFT_OUTER_JOIN:
+    case SRA_RIGHT_OUTER_JOIN:
+    case SRA_FULL_OUTER_JOIN:
+        scope[0] = sra->join.sra1;
+        scope[1] = sra->join.sra2;
+        if ((rc = chidb_exprc_compile(db, scope[0])) != CHIDB_OK ||
+            (rc = chidb_exprc_compile(db, scope[1])) != CHIDB_OK)
+            return rc;
+        if (sra->join.opt_cond == NULL || sra->join.opt_cond->t != JOIN_COND_ON)
+            return CHIDB_OK;
+        return exprc_reorder(db, scope, 2, &sra->join.opt_cond->on);
+    default:
+        if ((rc = chidb_exprc_compile(db, sra->binary.sra1)) != CHIDB_OK)
+            return rc;
+        return chidb_exprc_compile(db, sra->binary.sra2);
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Expression compiler -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef EXPRC_H_
+#define EXPRC_H_
+
+#include "chidbInt.h"
+#include "dbm-types.h"
+#include <chisql/chisql.h>
+
+/* Type of the values of an expression, as far as the catalog tells */
+typedef enum chidb_exprc_type
+{
+    EXPRC_UNKNOWN,     /* Parameters, doubles, NULL, or columns it can't resolve */
+    EXPRC_INT,
+    EXPRC_TEXT
+} chidb_exprc_type_t;
+
+SRA_t *chidb_exprc_fold(SRA_t *sra);
+int chidb_exprc_compile(chidb *db, SRA_t *sra);
+chidb_exprc_type_t chidb_exprc_type(chidb *db, SRA_t **scope, int nscope, Expression_t *expr);
+opcode_t chidb_exprc_cmpOp(chidb *db, SRA_t **scope, int nscope, Condition_t *cond, opcode_t op);
+
+#endif /* EXPRC_H_ */
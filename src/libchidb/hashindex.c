@@ -0,0 +1,631 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Hash indexes
+ *
+ * A hash index (CREATE INDEX ... USING hash) maps the values of an
+ * integer column to the primary keys of their rows, like an index
+ * B-Tree, but with linear hashing instead of a tree: the entries are in
+ * buckets, picked by the low bits of a hash of the value, so that
+ * finding a value reads the page of its bucket (and the root, which
+ * stays in the buffer pool) instead of a path from the root to a leaf.
+ * In exchange, the entries are in no order, so a hash index can only
+ * be used for equalities (see chidb_catalog_hashIndex).
+ *
+ * The root of the index is a meta page, with the number of entries and
+ * buckets and the page number of each bucket. When there are too many
+ * entries for the buckets (see HASHINDEX_FILLFACTOR), the next bucket
+ * in turn is split in two, with one more bit of the hash, so the index
+ * grows one bucket at a time, and only the entries of that bucket are
+ * moved. A bucket whose page is full gets more pages, chained after
+ * it, which is also how the index keeps growing once the meta page
+ * has no room for more buckets (HASHMETA_MAXBUCKETS). Deleting entries
+ * never merges buckets or frees pages.
+ *
+ * All the pages of an index are allocated like B-Tree pages, with
+ * chidb_Btree_allocatePage. The latch of the meta page (see
+ * chidb_Pager_latchPage) covers the whole index: it is held in shared
+ * mode to find a value, and in exclusive mode to change the index.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <chidb/chidb.h>
+#include "hashindex.h"
+#include "dbm-cursor.h"
+#include "record.h"
+#include "util.h"
+
+
+/* Hash of an indexed value: the MurmurHash3 finalizer, so that the low
+ * bits, which pick the bucket, depend on all of the value's */
+static uint32_t chidb_hashindex_hash(chidb_key_t key)
+{
+    uint32_t h = key;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+
+    return h;
+}
+
+/* Largest power of two that is not larger than nbuckets: the buckets
+ * below nbuckets - level have been split with the hash's low bits up to
+ * 2 * level, the others not yet */
+static uint32_t chidb_hashindex_level(uint32_t nbuckets)
+{
+    uint32_t level = 1;
+
+    while (level <= nbuckets / 2)
+        level *= 2;
+
+    return level;
+}
+
+/* Bucket of a hash */
+static uint32_t chidb_hashindex_bucket(uint32_t nbuckets, uint32_t h)
+{
+    uint32_t level = chidb_hashindex_level(nbuckets);
+    uint32_t b = h & (2 * level - 1);
+
+    return b < nbuckets ? b : h & (level - 1);
+}
+
+/* Reads a page of an index, which must be of the given type */
+static int chidb_hashindex_read(BTree *bt, npage_t npage, uint8_t type, MemPage **page)
+{
+    int rc = chidb_Pager_readPage(bt->pager, npage, page);
+
+    if (rc != CHIDB_OK)
+        return rc;
+    if ((*page)->data[PGHEADER_PGTYPE_OFFSET] != type)
+    {
+        chidb_Pager_releaseMemPage(bt->pager, *page);
+        return type == PGTYPE_HASH_META ? CHIDB_EMISUSE : CHIDB_ECORRUPT;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Allocates an empty page of the given type */
+static int chidb_hashindex_newPage(BTree *bt, uint8_t type, npage_t *npage)
+{
+    MemPage *page;
+    int rc;
+
+    if ((rc = chidb_Btree_allocatePage(bt, npage)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_Pager_readPage(bt->pager, *npage, &page)) != CHIDB_OK)
+        return rc;
+
+    page->data[PGHEADER_PGTYPE_OFFSET] = type;
+    rc = chidb_Pager_writePage(bt->pager, page);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+
+    return rc;
+}
+
+/* First page of the bucket of a value, from the meta page */
+static npage_t chidb_hashindex_head(MemPage *meta, chidb_key_t keyIdx)
+{
+    uint32_t nbuckets = get4byte(meta->data + HASHMETA_NBUCKETS_OFFSET);
+    uint32_t b = chidb_hashindex_bucket(nbuckets, chidb_hashindex_hash(keyIdx));
+
+    return get4byte(meta->data + HASHMETA_BUCKETS_OFFSET + 4 * b);
+}
+
+/* Position of a value in a bucket page, or -1 if it is not in it */
+static int chidb_hashindex_search(MemPage *page, chidb_key_t keyIdx)
+{
+    uint16_t n = get2byte(page->data + HASHBUCKET_NENTRIES_OFFSET);
+    uint8_t *entry = page->data + HASHBUCKET_ENTRIES_OFFSET;
+
+    for (uint16_t i = 0; i < n; i++, entry += HASHBUCKET_ENTRY_SIZE)
+        if (get4byte(entry) == (uint32_t) keyIdx)
+            return i;
+
+    return -1;
+}
+
+
+/* Create a hash index
+ *
+ * Allocates the meta page of a new, empty index, with a single bucket.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Out parameter. Returns the page number of the meta page,
+ *          which is the root page of the index in the schema.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_hashindex_create(BTree *bt, npage_t *nroot)
+{
+    MemPage *meta;
+    npage_t bucket;
+    int rc;
+
+    if ((rc = chidb_hashindex_newPage(bt, PGTYPE_HASH_META, nroot)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_hashindex_newPage(bt, PGTYPE_HASH_BUCKET, &bucket)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_Pager_readPage(bt->pager, *nroot, &meta)) != CHIDB_OK)
+        return rc;
+
+    put4byte(meta->data + HASHMETA_NBUCKETS_OFFSET, 1);
+    put4byte(meta->data + HASHMETA_BUCKETS_OFFSET, bucket);
+    rc = chidb_Pager_writePage(bt->pager, meta);
+    chidb_Pager_releaseMemPage(bt->pager, meta);
+
+    return rc;
+}
+
+
+/* Find a value in a hash index
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the meta page of the index
+ * - keyIdx: Indexed value
+ * - keyPk: Out parameter. Returns the primary key of the row with
+ *          that value.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No row has that value
+ * - CHIDB_EMISUSE: nroot is not the meta page of a hash index
+ * - CHIDB_ECORRUPT: The pages of the index are not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_hashindex_find(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t *keyPk)
+{
+    MemPage *meta, *page;
+    npage_t npage;
+    int i, rc;
+
+    if ((rc = chidb_hashindex_read(bt, nroot, PGTYPE_HASH_META, &meta)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_Pager_latchPage(bt->pager, meta, false)) != CHIDB_OK)
+    {
+        chidb_Pager_releaseMemPage(bt->pager, meta);
+        return rc;
+    }
+
+    rc = CHIDB_ENOTFOUND;
+    for (npage = chidb_hashindex_head(meta, keyIdx); npage != 0 && rc == CHIDB_ENOTFOUND; )
+    {
+        if ((rc = chidb_hashindex_read(bt, npage, PGTYPE_HASH_BUCKET, &page)) != CHIDB_OK)
+            break;
+        if ((i = chidb_hashindex_search(page, keyIdx)) >= 0)
+            *keyPk = get4byte(page->data + HASHBUCKET_ENTRIES_OFFSET + i * HASHBUCKET_ENTRY_SIZE + 4);
+        else
+            rc = CHIDB_ENOTFOUND;
+        npage = get4byte(page->data + HASHBUCKET_NEXT_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    chidb_Pager_unlatchPage(bt->pager, meta);
+    chidb_Pager_releaseMemPage(bt->pager, meta);
+
+    return rc;
+}
+
+
+/* Writes the entries of a bucket (n entries of HASHBUCKET_ENTRY_SIZE
+ * bytes) to a chain of pages: the npages pages it had first, and new
+ * ones after them. The pages it no longer needs are freed. */
+static int chidb_hashindex_fill(BTree *bt, npage_t *pages, uint32_t npages, uint8_t *entries, uint32_t n)
+{
+    uint32_t cap = HASHBUCKET_CAPACITY(chidb_Pager_usableSize(bt->pager));
+    uint32_t need = n == 0 ? 1 : (n + cap - 1) / cap;
+    npage_t *chain;
+    MemPage *page;
+    int rc = CHIDB_OK;
+
+    if ((chain = malloc((need > npages ? need : npages) * sizeof(npage_t))) == NULL)
+        return CHIDB_ENOMEM;
+    memcpy(chain, pages, npages * sizeof(npage_t));
+    for (uint32_t i = npages; i < need && rc == CHIDB_OK; i++)
+        rc = chidb_hashindex_newPage(bt, PGTYPE_HASH_BUCKET, &chain[i]);
+
+    for (uint32_t i = 0; i < need && rc == CHIDB_OK; i++)
+    {
+        uint32_t m = i < need - 1 ? cap : n - i * cap;
+
+        if ((rc = chidb_Pager_readPage(bt->pager, chain[i], &page)) != CHIDB_OK)
+            break;
+        put2byte(page->data + HASHBUCKET_NENTRIES_OFFSET, m);
+        put4byte(page->data + HASHBUCKET_NEXT_OFFSET, i < need - 1 ? chain[i + 1] : 0);
+        if (m > 0)
+            memcpy(page->data + HASHBUCKET_ENTRIES_OFFSET, entries + i * cap * HASHBUCKET_ENTRY_SIZE,
+                   m * HASHBUCKET_ENTRY_SIZE);
+        rc = chidb_Pager_writePage(bt->pager, page);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    for (uint32_t i = need; i < npages && rc == CHIDB_OK; i++)
+        rc = chidb_Btree_freePage(bt, chain[i]);
+
+    free(chain);
+
+    return rc;
+}
+
+/* Splits the next bucket in turn (nbuckets - level) in two: the
+ * entries whose hash has the next bit set move to a new bucket,
+ * nbuckets. The meta page must be latched in exclusive mode. */
+static int chidb_hashindex_split(BTree *bt, MemPage *meta)
+{
+    uint32_t nbuckets = get4byte(meta->data + HASHMETA_NBUCKETS_OFFSET);
+    uint32_t level = chidb_hashindex_level(nbuckets);
+    npage_t npage = get4byte(meta->data + HASHMETA_BUCKETS_OFFSET + 4 * (nbuckets - level));
+    npage_t *pages = NULL, bucket;
+    uint8_t *entries = NULL, *moved;
+    uint32_t npages = 0, n = 0, nkept = 0, nmoved = 0;
+    MemPage *page;
+    int rc = CHIDB_OK;
+
+    /* Read the whole bucket */
+    while (npage != 0 && rc == CHIDB_OK)
+    {
+        uint16_t m;
+        void *p;
+
+        if ((rc = chidb_hashindex_read(bt, npage, PGTYPE_HASH_BUCKET, &page)) != CHIDB_OK)
+            break;
+        m = get2byte(page->data + HASHBUCKET_NENTRIES_OFFSET);
+        if ((p = realloc(pages, (npages + 1) * sizeof(npage_t))) != NULL)
+            pages = p;
+        if (p == NULL || (p = realloc(entries, 2 * (n + m) * HASHBUCKET_ENTRY_SIZE)) == NULL)
+            rc = CHIDB_ENOMEM;
+        else
+        {
+            entries = p;
+            pages[npages++] = npage;
+            memcpy(entries + n * HASHBUCKET_ENTRY_SIZE, page->data + HASHBUCKET_ENTRIES_OFFSET,
+                   m * HASHBUCKET_ENTRY_SIZE);
+            n += m;
+        }
+        npage = get4byte(page->data + HASHBUCKET_NEXT_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    /* The entries that stay are moved to the front of entries, the
+     * others after its first n */
+    moved = entries + n * HASHBUCKET_ENTRY_SIZE;
+    for (uint32_t i = 0; i < n && rc == CHIDB_OK; i++)
+    {
+        uint8_t *entry = entries + i * HASHBUCKET_ENTRY_SIZE;
+
+        if ((chidb_hashindex_hash(get4byte(entry)) & (2 * level - 1)) == nbuckets)
+            memcpy(moved + nmoved++ * HASHBUCKET_ENTRY_SIZE, entry, HASHBUCKET_ENTRY_SIZE);
+        else
+            memmove(entries + nkept++ * HASHBUCKET_ENTRY_SIZE, entry, HASHBUCKET_ENTRY_SIZE);
+    }
+
+    if (rc == CHIDB_OK)
+        rc = chidb_hashindex_newPage(bt, PGTYPE_HASH_BUCKET, &bucket);
+    if (rc == CHIDB_OK)
+        rc = chidb_hashindex_fill(bt, pages, npages, entries, nkept);
+    if (rc == CHIDB_OK)
+        rc = chidb_hashindex_fill(bt, &bucket, 1, moved, nmoved);
+    if (rc == CHIDB_OK)
+    {
+        put4byte(meta->data + HASHMETA_BUCKETS_OFFSET + 4 * nbuckets, bucket);
+        put4byte(meta->data + HASHMETA_NBUCKETS_OFFSET, nbuckets + 1);
+        rc = chidb_Pager_writePage(bt->pager, meta);
+    }
+
+    free(pages);
+    free(entries);
+
+    return rc;
+}
+
+
+/* Insert an entry into a hash index
+ *
+ * Adds the entry to the first page of its bucket with room for it (or
+ * to a new page at the end of the bucket), and then splits a bucket if
+ * the index is too full (see HASHINDEX_FILLFACTOR).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the meta page of the index
+ * - keyIdx: Indexed value
+ * - keyPk: Primary key of the row with that value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: The index already has an entry with that value
+ * - CHIDB_EMISUSE: nroot is not the meta page of a hash index
+ * - CHIDB_ECORRUPT: The pages of the index are not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_hashindex_insert(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk)
+{
+    uint32_t usable = chidb_Pager_usableSize(bt->pager);
+    MemPage *meta, *page;
+    npage_t npage, last = 0, target = 0;
+    uint32_t nentries, nbuckets;
+    uint16_t n;
+    int rc;
+
+    if ((rc = chidb_hashindex_read(bt, nroot, PGTYPE_HASH_META, &meta)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_Pager_latchPage(bt->pager, meta, true)) != CHIDB_OK)
+    {
+        chidb_Pager_releaseMemPage(bt->pager, meta);
+        return rc;
+    }
+
+    /* The whole bucket is read, to look for the value */
+    for (npage = chidb_hashindex_head(meta, keyIdx); npage != 0 && rc == CHIDB_OK; )
+    {
+        if ((rc = chidb_hashindex_read(bt, npage, PGTYPE_HASH_BUCKET, &page)) != CHIDB_OK)
+            break;
+        if (chidb_hashindex_search(page, keyIdx) >= 0)
+            rc = CHIDB_EDUPLICATE;
+        else if (target == 0 && get2byte(page->data + HASHBUCKET_NENTRIES_OFFSET) < HASHBUCKET_CAPACITY(usable))
+            target = npage;
+        last = npage;
+        npage = get4byte(page->data + HASHBUCKET_NEXT_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    /* The bucket is full: chain a new page after its last one */
+    if (rc == CHIDB_OK && target == 0 &&
+        (rc = chidb_hashindex_newPage(bt, PGTYPE_HASH_BUCKET, &target)) == CHIDB_OK &&
+        (rc = chidb_hashindex_read(bt, last, PGTYPE_HASH_BUCKET, &page)) == CHIDB_OK)
+    {
+        put4byte(page->data + HASHBUCKET_NEXT_OFFSET, target);
+        rc = chidb_Pager_writePage(bt->pager, page);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    if (rc == CHIDB_OK && (rc = chidb_hashindex_read(bt, target, PGTYPE_HASH_BUCKET, &page)) == CHIDB_OK)
+    {
+        uint8_t *entry;
+
+        n = get2byte(page->data + HASHBUCKET_NENTRIES_OFFSET);
+        entry = page->data + HASHBUCKET_ENTRIES_OFFSET + n * HASHBUCKET_ENTRY_SIZE;
+        put4byte(entry, keyIdx);
+        put4byte(entry + 4, keyPk);
+        put2byte(page->data + HASHBUCKET_NENTRIES_OFFSET, n + 1);
+        rc = chidb_Pager_writePage(bt->pager, page);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    if (rc == CHIDB_OK)
+    {
+        nentries = get4byte(meta->data + HASHMETA_NENTRIES_OFFSET) + 1;
+        nbuckets = get4byte(meta->data + HASHMETA_NBUCKETS_OFFSET);
+        put4byte(meta->data + HASHMETA_NENTRIES_OFFSET, nentries);
+        rc = chidb_Pager_writePage(bt->pager, meta);
+
+        if (rc == CHIDB_OK && nbuckets < HASHMETA_MAXBUCKETS(usable) &&
+            (uint64_t) nentries * 100 > (uint64_t) nbuckets * HASHBUCKET_CAPACITY(usable) * HASHINDEX_FILLFACTOR)
+            rc = chidb_hashindex_split(bt, meta);
+    }
+
+    chidb_Pager_unlatchPage(bt->pager, meta);
+    chidb_Pager_releaseMemPage(bt->pager, meta);
+
+    return rc;
+}
+
+
+/* Delete an entry from a hash index
+ *
+ * The last entry of the page the entry is in takes its place. Pages
+ * that are left empty stay in their bucket.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the meta page of the index
+ * - keyIdx: Indexed value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The index has no entry with that value
+ * - CHIDB_EMISUSE: nroot is not the meta page of a hash index
+ * - CHIDB_ECORRUPT: The pages of the index are not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_hashindex_delete(BTree *bt, npage_t nroot, chidb_key_t keyIdx)
+{
+    MemPage *meta, *page;
+    npage_t npage;
+    int i = -1, rc;
+
+    if ((rc = chidb_hashindex_read(bt, nroot, PGTYPE_HASH_META, &meta)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_Pager_latchPage(bt->pager, meta, true)) != CHIDB_OK)
+    {
+        chidb_Pager_releaseMemPage(bt->pager, meta);
+        return rc;
+    }
+
+    for (npage = chidb_hashindex_head(meta, keyIdx); npage != 0 && i < 0; )
+    {
+        if ((rc = chidb_hashindex_read(bt, npage, PGTYPE_HASH_BUCKET, &page)) != CHIDB_OK)
+            break;
+        if ((i = chidb_hashindex_search(page, keyIdx)) >= 0)
+        {
+            uint16_t n = get2byte(page->data + HASHBUCKET_NENTRIES_OFFSET) - 1;
+            uint8_t *entries = page->data + HASHBUCKET_ENTRIES_OFFSET;
+
+            memcpy(entries + i * HASHBUCKET_ENTRY_SIZE, entries + n * HASHBUCKET_ENTRY_SIZE, HASHBUCKET_ENTRY_SIZE);
+            put2byte(page->data + HASHBUCKET_NENTRIES_OFFSET, n);
+            rc = chidb_Pager_writePage(bt->pager, page);
+        }
+        npage = get4byte(page->data + HASHBUCKET_NEXT_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    if (rc == CHIDB_OK && i < 0)
+        rc = CHIDB_ENOTFOUND;
+    else if (rc == CHIDB_OK)
+    {
+        put4byte(meta->data + HASHMETA_NENTRIES_OFFSET, get4byte(meta->data + HASHMETA_NENTRIES_OFFSET) - 1);
+        rc = chidb_Pager_writePage(bt->pager, meta);
+    }
+
+    chidb_Pager_unlatchPage(bt->pager, meta);
+    chidb_Pager_releaseMemPage(bt->pager, meta);
+
+    return rc;
+}
+
+
+/* Populate a hash index with the rows already in a table
+ *
+ * Reads the value of the indexed column in every row of the table, and
+ * inserts its entry into the index. Rows where the column is NULL are
+ * not indexed. Unlike chidb_Btree_buildIndex, there is nothing to gain
+ * from sorting the entries first, since they go to their buckets in no
+ * order anyway.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - table_root: Page number of the root node of the table
+ * - nroot: Page number of the meta page of the index
+ * - column: Position of the indexed column in the table's records
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The column is not an integer column
+ * - CHIDB_EDUPLICATE: Two rows have the same value in the column (or a
+ *                     row has a value that is already in the index)
+ * - CHIDB_EMISUSE: The column doesn't exist, or nroot is not the meta
+ *                  page of a hash index
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_hashindex_build(BTree *bt, npage_t table_root, npage_t nroot, uint8_t column)
+{
+    chidb_dbm_cursor_t c;
+    DBRecordView view;
+    uint8_t *buf = NULL;
+    uint32_t bufsize = 0;
+    int8_t v8;
+    int16_t v16;
+    int32_t v32;
+    int rc;
+
+    if ((rc = chidb_dbm_cursor_open(&c, CURSOR_READ, bt, table_root)) != CHIDB_OK)
+        return rc;
+    if (c.index)
+    {
+        chidb_dbm_cursor_close(&c);
+        return CHIDB_EMISUSE;
+    }
+
+    for (rc = chidb_dbm_cursor_rewind(&c); rc == CHIDB_OK; rc = chidb_dbm_cursor_next(&c))
+    {
+        BTreeCell *cell = &c.cell;
+        uint8_t *data = cell->fields.tableLeaf.data;
+
+        if (cell->fields.tableLeaf.overflow_page != 0)
+        {
+            if (bufsize < cell->fields.tableLeaf.data_size)
+            {
+                uint8_t *b = realloc(buf, cell->fields.tableLeaf.data_size);
+                if (b == NULL)
+                {
+                    rc = CHIDB_ENOMEM;
+                    break;
+                }
+                buf = b;
+                bufsize = cell->fields.tableLeaf.data_size;
+            }
+            rc = chidb_Btree_readPayload(bt, cell, 0, cell->fields.tableLeaf.data_size, buf);
+            if (rc != CHIDB_OK)
+                break;
+            data = buf;
+        }
+
+        if (BTREE_RECORD_FORMAT(bt) == DBRECORD_FORMAT_V2)
+            rc = chidb_DBRecordView_initV2(&view, data);
+        else
+            rc = chidb_DBRecordView_init(&view, data);
+        if (rc != CHIDB_OK)
+            break;
+
+        switch (chidb_DBRecordView_getType(&view, column))
+        {
+        case SQL_NULL:
+            /* NULLs are not indexed */
+            continue;
+        case SQL_INTEGER_1BYTE:
+            chidb_DBRecordView_getInt8(&view, column, &v8);
+            v32 = v8;
+            break;
+        case SQL_INTEGER_2BYTE:
+            chidb_DBRecordView_getInt16(&view, column, &v16);
+            v32 = v16;
+            break;
+        case SQL_INTEGER_4BYTE:
+            chidb_DBRecordView_getInt32(&view, column, &v32);
+            break;
+        case SQL_NOTVALID:
+            rc = column >= chidb_DBRecordView_nfields(&view) ? CHIDB_EMISUSE : CHIDB_EMISMATCH;
+            break;
+        default:
+            /* Only integer columns can be indexed */
+            rc = CHIDB_EMISMATCH;
+            break;
+        }
+        if (rc != CHIDB_OK ||
+            (rc = chidb_hashindex_insert(bt, nroot, (chidb_key_t) v32, cell->key)) != CHIDB_OK)
+            break;
+    }
+
+    chidb_dbm_cursor_close(&c);
+    free(buf);
+
+    return rc == CHIDB_DONE ? CHIDB_OK : rc;
+}
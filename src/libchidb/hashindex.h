@@ -0,0 +1,78 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Hash indexes -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef HASHINDEX_H_
+#define HASHINDEX_H_
+
+#include "chidbInt.h"
+#include "btree.h"
+
+/* Page types of a hash index (byte 0 of its pages) */
+#define PGTYPE_HASH_META (0x11)
+#define PGTYPE_HASH_BUCKET (0x19)
+
+/* Meta page (the root of the index): type (1 byte), unused (3), entries
+ * (4), buckets (4), unused (4), and the page number of the first page
+ * of each bucket (4 bytes each) */
+#define HASHMETA_NENTRIES_OFFSET (4)
+#define HASHMETA_NBUCKETS_OFFSET (8)
+#define HASHMETA_BUCKETS_OFFSET (16)
+#define HASHMETA_MAXBUCKETS(usable) (((usable) - HASHMETA_BUCKETS_OFFSET) / 4)
+
+/* Bucket page: type (1 byte), unused (1), entries (2), next page of the
+ * bucket (4, 0 for none), and the entries, in no order: the indexed
+ * value (4) and the primary key (4) */
+#define HASHBUCKET_NENTRIES_OFFSET (2)
+#define HASHBUCKET_NEXT_OFFSET (4)
+#define HASHBUCKET_ENTRIES_OFFSET (8)
+#define HASHBUCKET_ENTRY_SIZE (8)
+#define HASHBUCKET_CAPACITY(usable) (((usable) - HASHBUCKET_ENTRIES_OFFSET) / HASHBUCKET_ENTRY_SIZE)
+
+/* A bucket is split when the entries fill more than this percentage of
+ * the first pages of the buckets */
+#define HASHINDEX_FILLFACTOR (75)
+
+int chidb_hashindex_create(BTree *bt, npage_t *nroot);
+int chidb_hashindex_find(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t *keyPk);
+int chidb_hashindex_insert(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk);
+int chidb_hashindex_delete(BTree *bt, npage_t nroot, chidb_key_t keyIdx);
+int chidb_hashindex_build(BTree *bt, npage_t table_root, npage_t nroot, uint8_t column);
+
+#endif /* HASHINDEX_H_ */
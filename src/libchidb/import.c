@@ -0,0 +1,789 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module loads rows from a text file into a table, building the
+ * table's B-Tree bottom-up with chidb_Btree_bulkLoad instead of inserting
+ * the rows one at a time.
+ *
+ * Each line of the file is a row, with the values of its columns separated
+ * by "|" (the same format the shell uses to print rows). The first value
+ * is the row's primary key, and the rows must be sorted by it. Values that
+ * are integers are stored as 4-byte integers, empty values as NULL, and
+ * everything else as a string.
+ *
+ * chidb_import_table loads a CSV, TSV or "|"-separated file into a table
+ * by name instead (see chidb_import_table in chidb.h). The file is
+ * mapped into memory and split into fields by a SIMD scan for the
+ * separator, the end of the line and, in CSV files, quotes. Each row is
+ * built into a record in an arena that is reset for the next one, and
+ * the rows are loaded in a single transaction: bulk-loaded, with the
+ * indexes of the table built afterwards, if the table is empty and the
+ * rows are sorted by primary key, and inserted one at a time, with
+ * their index entries, otherwise. Rows imported into a columnar table
+ * are appended to it in new segments instead (see columnar.c).
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#include <chidb/chidb.h>
+#include "btree.h"
+#include "record.h"
+#include "catalog.h"
+#include "columnar.h"
+#include "hashindex.h"
+#include "dbm-result.h"
+
+#define IMPORT_SEPARATOR '|'
+
+/* State of the iterator that feeds the rows of a file to chidb_Btree_bulkLoad */
+typedef struct ImportIterator
+{
+    FILE *f;
+    char *line;
+    size_t linecap;
+    uint8_t *data;    // Packed record of the last row returned
+    ssize_t maxlen;   // Longest line that can fit in a page
+    unsigned int nrows;
+    int format;       // Record format of the file (DBRECORD_FORMAT_*)
+} ImportIterator;
+
+
+/* Parses a value as a 4-byte integer
+ *
+ * Return
+ * - true if the whole value is an integer that fits in 4 bytes
+ */
+static bool chidb_import_parseInt(const char *s, int32_t *v)
+{
+    char *end;
+    long long l;
+
+    if (*s == '\0')
+        return false;
+
+    errno = 0;
+    l = strtoll(s, &end, 10);
+    if (*end != '\0' || errno != 0 || l < INT32_MIN || l > INT32_MAX)
+        return false;
+
+    *v = l;
+    return true;
+}
+
+
+/* Returns the next row of the file as a table leaf cell
+ *
+ * Return
+ * - CHIDB_OK: Row returned in cell
+ * - CHIDB_EEMPTY: No more rows
+ * - CHIDB_EMISMATCH: The first value of a row is not a valid key
+ * - CHIDB_EMISUSE: A row has too many values (or, in record format v1, too
+ *   many strings), or is too long to fit in a page (only in files without
+ *   overflow pages)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: I/O error reading the file
+ */
+static int chidb_import_next(BTreeIterator *bit, BTreeCell *cell)
+{
+    ImportIterator *it = bit->arg;
+    DBRecordBuffer dbrb;
+    DBRecord *dbr;
+    ssize_t len;
+    char *value, *next;
+    int32_t key, v;
+    int nfields;
+    uint32_t size;
+    int rc;
+
+    /* Skip blank lines */
+    do
+    {
+        errno = 0;
+        len = getline(&it->line, &it->linecap, it->f);
+        if (len == -1)
+            return errno == ENOMEM ? CHIDB_ENOMEM : (ferror(it->f) ? CHIDB_EIO : CHIDB_EEMPTY);
+
+        while (len > 0 && (it->line[len - 1] == '\n' || it->line[len - 1] == '\r'))
+            it->line[--len] = '\0';
+    } while (len == 0);
+
+    if (len > it->maxlen)
+        return CHIDB_EMISUSE;
+
+    nfields = 1;
+    for(char *c = it->line; *c; c++)
+        if (*c == IMPORT_SEPARATOR)
+            nfields++;
+    if (nfields > UINT8_MAX)
+        return CHIDB_EMISUSE;
+
+    value = it->line;
+    next = strchr(value, IMPORT_SEPARATOR);
+    if (next)
+        *next = '\0';
+    if (!chidb_import_parseInt(value, &key) || key < 0)
+        return CHIDB_EMISMATCH;
+
+    chidb_DBRecord_create_empty(&dbrb, nfields);
+    chidb_DBRecord_appendInt32(&dbrb, key);
+    while (next)
+    {
+        value = next + 1;
+        next = strchr(value, IMPORT_SEPARATOR);
+        if (next)
+            *next = '\0';
+
+        if (*value == '\0')
+            chidb_DBRecord_appendNull(&dbrb);
+        else if (chidb_import_parseInt(value, &v))
+            chidb_DBRecord_appendInt32(&dbrb, v);
+        else
+            chidb_DBRecord_appendString(&dbrb, value);
+    }
+    chidb_DBRecord_finalize(&dbrb, &dbr);
+
+    free(it->data);
+    it->data = NULL;
+    if (it->format == DBRECORD_FORMAT_V2)
+        rc = chidb_DBRecord_packV2(dbr, &it->data, &size, NULL);
+    else
+    {
+        rc = chidb_DBRecord_pack(dbr, &it->data);
+        size = dbr->packed_len;
+    }
+    chidb_DBRecord_destroy(dbr);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    cell->key = key;
+    cell->fields.tableLeaf.data = it->data;
+    cell->fields.tableLeaf.data_size = size;
+
+    it->nrows++;
+
+    return CHIDB_OK;
+}
+
+
+int chidb_import(chidb *db, const char *filename, unsigned int root_page, unsigned int *nrows)
+{
+    ImportIterator it = {NULL, NULL, 0, NULL, 0, 0, DBRECORD_FORMAT_V1};
+    BTreeIterator bit = {chidb_import_next, &it};
+    int rc;
+
+    if (db == NULL || db->bt == NULL)
+        return CHIDB_EMISUSE;
+
+    it.f = fopen(filename, "r");
+    if (it.f == NULL)
+        return CHIDB_ECANTOPEN;
+    it.format = BTREE_RECORD_FORMAT(db->bt);
+
+    /* A row's record is at least as long as its values, so a line that
+     * is longer than a page can't fit in a leaf cell (unless the end of
+     * the record can go to overflow pages) */
+    if (db->bt->features & BTREE_FEATURE_OVERFLOW)
+        it.maxlen = SSIZE_MAX;
+    else
+        it.maxlen = chidb_Pager_usableSize(db->bt->pager);
+
+    rc = chidb_Btree_bulkLoad(db->bt, root_page, &bit, BTREE_DEFAULT_FILLFACTOR);
+    chidb_dbm_result_touch(db->result_cache, root_page);
+
+    if (nrows)
+        *nrows = it.nrows;
+
+    free(it.data);
+    free(it.line);
+    fclose(it.f);
+
+    return rc;
+}
+
+
+/*** Importing into a table by name ***/
+
+/* A text file mapped into memory, and the fields of its current row */
+typedef struct ImportFile
+{
+    const char *data;
+    size_t size;
+    const char *pos;      // Start of the next row
+    const char *end;
+    char sep;
+    char quote;           // '"' in CSV files, 0 in the others
+
+    char *buf;            // Fields of the current row, each NUL-terminated
+    size_t buflen, bufcap;
+    uint32_t *fields;     // Offset of each field in buf
+    uint32_t nfields, fieldcap;
+} ImportFile;
+
+/* State of the iterator that feeds the rows of a file to a table */
+typedef struct ImportTable
+{
+    ImportFile file;
+    BTree *bt;
+    chidb_catalog_table_t *table;
+    DBRecordArena arena;  // Record of the current row
+    int format;           // Record format of the file (DBRECORD_FORMAT_*)
+    uint32_t maxsize;     // Largest record that fits in a page
+    int32_t *ints;        // Integer value of each column of the current row
+    bool *nulls;          // Whether each column of the current row is NULL
+    chidb_key_t last;     // Key of the previous row
+    unsigned int nrows;
+} ImportTable;
+
+
+/* Returns the first of the sixteen bytes at p that is c1 or c2, or
+ * p + 16 if none is, or NULL if there's no SIMD support */
+static inline const char *chidb_import_scan16(const char *p, char c1, char c2)
+{
+#if defined(__SSE2__)
+    __m128i b = _mm_loadu_si128((const __m128i *) p);
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8(c1)), _mm_cmpeq_epi8(b, _mm_set1_epi8(c2)));
+    int mask = _mm_movemask_epi8(m);
+
+    return p + (mask ? __builtin_ctz(mask) : 16);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint8x16_t b = vld1q_u8((const uint8_t *) p);
+    uint8x16_t m = vorrq_u8(vceqq_u8(b, vdupq_n_u8(c1)), vceqq_u8(b, vdupq_n_u8(c2)));
+    /* Four bits per byte, set if it matched */
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+
+    return p + (mask ? __builtin_ctzll(mask) / 4 : 16);
+#else
+    return NULL;
+#endif
+}
+
+/* Returns the first byte from p to end that ends an unquoted field (the
+ * separator or a newline), or end */
+static const char *chidb_import_scan(ImportFile *f, const char *p)
+{
+    while (f->end - p >= 16)
+    {
+        const char *q = chidb_import_scan16(p, f->sep, '\n');
+
+        if (q == NULL)
+            break;
+        if (q < p + 16)
+            return q;
+        p += 16;
+    }
+
+    for (; p < f->end; p++)
+        if (*p == f->sep || *p == '\n')
+            return p;
+    return f->end;
+}
+
+/* Appends len bytes to the current field */
+static int chidb_import_append(ImportFile *f, const char *s, size_t len)
+{
+    if (f->buflen + len + 1 > f->bufcap)
+    {
+        size_t cap = f->bufcap ? f->bufcap : 256;
+        char *buf;
+
+        while (f->buflen + len + 1 > cap)
+            cap *= 2;
+        if ((buf = realloc(f->buf, cap)) == NULL)
+            return CHIDB_ENOMEM;
+        f->buf = buf;
+        f->bufcap = cap;
+    }
+
+    memcpy(f->buf + f->buflen, s, len);
+    f->buflen += len;
+    return CHIDB_OK;
+}
+
+/* Ends the current field, which started at offset start of buf */
+static int chidb_import_endField(ImportFile *f, uint32_t start)
+{
+    if (f->nfields == f->fieldcap)
+    {
+        uint32_t cap = f->fieldcap ? f->fieldcap * 2 : 16;
+        uint32_t *fields = realloc(f->fields, cap * sizeof(uint32_t));
+
+        if (fields == NULL)
+            return CHIDB_ENOMEM;
+        f->fields = fields;
+        f->fieldcap = cap;
+    }
+
+    if (chidb_import_append(f, "", 0) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    f->buf[f->buflen++] = '\0';
+    f->fields[f->nfields++] = start;
+
+    return CHIDB_OK;
+}
+
+/* Splits the next row of the file into fields (f->buf + f->fields[i]).
+ * A field that starts with a quote (in a CSV file) can have separators
+ * and newlines, and "" in it is a quote; elsewhere, quotes are just
+ * text. Blank lines are skipped, and a "\r" before a newline is
+ * dropped.
+ *
+ * Return
+ * - CHIDB_OK: Row split
+ * - CHIDB_EEMPTY: No more rows
+ * - CHIDB_EMISMATCH: A quoted field is not closed, or has text after it
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+static int chidb_import_row(ImportFile *f)
+{
+    const char *p = f->pos;
+
+    while (p < f->end && (*p == '\n' || *p == '\r'))
+        p++;
+    if (p == f->end)
+        return CHIDB_EEMPTY;
+
+    f->buflen = 0;
+    f->nfields = 0;
+
+    for (;;)
+    {
+        uint32_t start = f->buflen;
+        const char *q;
+
+        if (f->quote && p < f->end && *p == f->quote)
+        {
+            /* Quoted field, up to a quote that isn't followed by another */
+            for (p++;; p = q + 2)
+            {
+                q = memchr(p, f->quote, f->end - p);
+                if (q == NULL)
+                    return CHIDB_EMISMATCH;
+                if (chidb_import_append(f, p, q - p + (q + 1 < f->end && q[1] == f->quote)) != CHIDB_OK)
+                    return CHIDB_ENOMEM;
+                if (q + 1 == f->end || q[1] != f->quote)
+                    break;
+            }
+            p = q + 1;
+            if (p < f->end && *p == '\r')
+                p++;
+            if (p < f->end && *p != f->sep && *p != '\n')
+                return CHIDB_EMISMATCH;
+            q = p;
+        }
+        else
+        {
+            q = chidb_import_scan(f, p);
+            if (chidb_import_append(f, p, q > p && q[-1] == '\r' && (q == f->end || *q == '\n') ? q - p - 1 : q - p) != CHIDB_OK)
+                return CHIDB_ENOMEM;
+        }
+
+        if (chidb_import_endField(f, start) != CHIDB_OK)
+            return CHIDB_ENOMEM;
+
+        if (q == f->end || *q == '\n')
+        {
+            f->pos = q == f->end ? q : q + 1;
+            return CHIDB_OK;
+        }
+        p = q + 1;
+    }
+}
+
+/* Maps a file into memory, with the format its extension tells: ".csv"
+ * files are separated by commas, with quoted fields, ".tsv" files by
+ * tabs, and the others by "|" */
+static int chidb_import_open(ImportFile *f, const char *filename)
+{
+    const char *ext = strrchr(filename, '.');
+    struct stat st;
+    int fd;
+
+    memset(f, 0, sizeof(ImportFile));
+    f->sep = IMPORT_SEPARATOR;
+    if (ext != NULL && !strcasecmp(ext, ".csv"))
+    {
+        f->sep = ',';
+        f->quote = '"';
+    }
+    else if (ext != NULL && !strcasecmp(ext, ".tsv"))
+        f->sep = '\t';
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+        return CHIDB_ECANTOPEN;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return CHIDB_EIO;
+    }
+
+    f->size = st.st_size;
+    if (f->size > 0)
+    {
+        void *data = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            return CHIDB_EIO;
+        }
+        madvise(data, f->size, MADV_SEQUENTIAL);
+        f->data = data;
+    }
+    close(fd);
+
+    f->pos = f->data;
+    f->end = f->data + f->size;
+
+    return CHIDB_OK;
+}
+
+static void chidb_import_close(ImportFile *f)
+{
+    if (f->size > 0)
+        munmap((void *) f->data, f->size);
+    free(f->buf);
+    free(f->fields);
+}
+
+/* Splits the next row of the file into the values of the columns of the
+ * table: the integer columns (the first of which is the primary key)
+ * parsed into it->ints, empty values as NULL, and the text left in the
+ * fields
+ *
+ * Return
+ * - CHIDB_OK: Row read
+ * - CHIDB_EEMPTY: No more rows
+ * - CHIDB_EMISMATCH: The row doesn't have a value for each column, a
+ *   value of an integer column isn't an integer, or the primary key is
+ *   NULL or negative
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+static int chidb_import_values(ImportTable *it)
+{
+    ImportFile *f = &it->file;
+    int rc;
+
+    if ((rc = chidb_import_row(f)) != CHIDB_OK)
+        return rc;
+    it->nrows++;
+
+    if (f->nfields != it->table->ncols)
+        return CHIDB_EMISMATCH;
+
+    for (uint32_t i = 0; i < f->nfields; i++)
+    {
+        const char *value = f->buf + f->fields[i];
+
+        it->nulls[i] = *value == '\0';
+        if (!it->nulls[i] && it->table->cols[i].type == TYPE_INT &&
+            !chidb_import_parseInt(value, &it->ints[i]))
+            return CHIDB_EMISMATCH;
+    }
+
+    if (it->nulls[0] || it->table->cols[0].type != TYPE_INT || it->ints[0] < 0)
+        return CHIDB_EMISMATCH;
+
+    return CHIDB_OK;
+}
+
+/* Builds the record of the current row in the arena */
+static int chidb_import_record(ImportTable *it, uint8_t **data, uint32_t *size)
+{
+    ImportFile *f = &it->file;
+    DBRecordBuffer dbrb;
+    DBRecord *dbr;
+    int rc;
+
+    chidb_DBRecordArena_reset(&it->arena);
+    chidb_DBRecord_create_empty2(&dbrb, f->nfields, &it->arena);
+    for (uint32_t i = 0; i < f->nfields; i++)
+    {
+        if (it->nulls[i])
+            chidb_DBRecord_appendNull(&dbrb);
+        else if (it->table->cols[i].type == TYPE_INT)
+            chidb_DBRecord_appendInt32(&dbrb, it->ints[i]);
+        else
+            chidb_DBRecord_appendString(&dbrb, f->buf + f->fields[i]);
+    }
+    chidb_DBRecord_finalize(&dbrb, &dbr);
+
+    if (it->format == DBRECORD_FORMAT_V2)
+        rc = chidb_DBRecord_packV2(dbr, data, size, &it->arena);
+    else
+    {
+        rc = chidb_DBRecord_pack2(dbr, data, &it->arena);
+        *size = dbr->packed_len;
+    }
+    if (rc != CHIDB_OK)
+        return rc;
+
+    return *size > it->maxsize ? CHIDB_EMISUSE : CHIDB_OK;
+}
+
+/* Returns the next row of the file as a table leaf cell, for
+ * chidb_Btree_bulkLoad */
+static int chidb_import_nextCell(BTreeIterator *bit, BTreeCell *cell)
+{
+    ImportTable *it = bit->arg;
+    uint8_t *data;
+    uint32_t size;
+    int rc;
+
+    if ((rc = chidb_import_values(it)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_import_record(it, &data, &size)) != CHIDB_OK)
+        return rc;
+
+    cell->key = it->ints[0];
+    cell->fields.tableLeaf.data = data;
+    cell->fields.tableLeaf.data_size = size;
+
+    return CHIDB_OK;
+}
+
+/* Whether the rows of the file are sorted by primary key, with no two
+ * the same (which chidb_Btree_bulkLoad needs), up to the first row that
+ * can't be imported, if any. Only the rows are split, without making
+ * records. The file is left at its first row. */
+static bool chidb_import_sorted(ImportTable *it)
+{
+    const char *start = it->file.pos;
+    bool sorted = true;
+
+    while (sorted && chidb_import_values(it) == CHIDB_OK)
+    {
+        sorted = it->nrows == 1 || (chidb_key_t) it->ints[0] > it->last;
+        it->last = it->ints[0];
+    }
+
+    it->file.pos = start;
+    it->nrows = 0;
+
+    return sorted;
+}
+
+/* Loads the rows of the file into the table with chidb_Btree_bulkLoad,
+ * and then builds its indexes from them */
+static int chidb_import_bulk(ImportTable *it)
+{
+    BTreeIterator bit = {chidb_import_nextCell, it};
+    int rc;
+
+    rc = chidb_Btree_bulkLoad(it->bt, it->table->nroot, &bit, BTREE_DEFAULT_FILLFACTOR);
+
+    for (chidb_catalog_index_t *idx = it->table->indexes; idx != NULL && rc == CHIDB_OK; idx = idx->next)
+        if (idx->hash)
+            rc = chidb_hashindex_build(it->bt, it->table->nroot, idx->nroot,
+                                       chidb_catalog_column(it->table, idx->column));
+        else
+            rc = chidb_Btree_buildIndex(it->bt, it->table->nroot, idx->nroot,
+                                        chidb_catalog_column(it->table, idx->column), 0);
+
+    return rc;
+}
+
+/* Inserts the rows of the file into the table one at a time, and the
+ * entries of their non-NULL values into the indexes of the table */
+static int chidb_import_insert(ImportTable *it)
+{
+    uint8_t *data;
+    uint32_t size;
+    int rc;
+
+    while ((rc = chidb_import_values(it)) == CHIDB_OK)
+    {
+        if ((rc = chidb_import_record(it, &data, &size)) != CHIDB_OK)
+            return rc;
+        if ((rc = chidb_Btree_insertInTable(it->bt, it->table->nroot, it->ints[0], data, size)) != CHIDB_OK)
+            return rc;
+
+        for (chidb_catalog_index_t *idx = it->table->indexes; idx != NULL; idx = idx->next)
+        {
+            int col = chidb_catalog_column(it->table, idx->column);
+
+            if (it->nulls[col])
+                continue;
+            if (idx->hash)
+                rc = chidb_hashindex_insert(it->bt, idx->nroot, it->ints[col], it->ints[0]);
+            else
+                rc = chidb_Btree_insertInIndex(it->bt, idx->nroot, it->ints[col], it->ints[0]);
+            if (rc != CHIDB_OK)
+                return rc;
+        }
+    }
+
+    return rc == CHIDB_EEMPTY ? CHIDB_OK : rc;
+}
+
+/* Appends the rows of the file to a columnar table, a segment at a
+ * time (see columnar.c) */
+static int chidb_import_columnar(ImportTable *it)
+{
+    chidb_columnar_writer_t w;
+    int rc, rc2;
+
+    rc = chidb_columnar_writer_init(&w, it->bt, it->table->nroot, it->table->ncols);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    while ((rc = chidb_import_values(it)) == CHIDB_OK &&
+           (rc = chidb_columnar_append(&w, it->ints, it->nulls)) == CHIDB_OK);
+
+    rc2 = chidb_columnar_writer_finish(&w);
+
+    return rc == CHIDB_EEMPTY ? rc2 : rc;
+}
+
+int chidb_import_table(chidb *db, const char *filename, const char *table, unsigned int *nrows)
+{
+    ImportTable it;
+    Pager *pager;
+    bool autocommit;
+    chidb_key_t first;
+    int rc;
+
+    if (nrows)
+        *nrows = 0;
+    if (db == NULL || db->bt == NULL)
+        return CHIDB_EMISUSE;
+
+    memset(&it, 0, sizeof(ImportTable));
+    if ((rc = chidb_import_open(&it.file, filename)) != CHIDB_OK)
+        return rc;
+    it.bt = db->bt;
+    it.format = BTREE_RECORD_FORMAT(db->bt);
+    it.maxsize = db->bt->features & BTREE_FEATURE_OVERFLOW ? UINT32_MAX : chidb_Pager_usableSize(db->bt->pager);
+    chidb_DBRecordArena_init(&it.arena);
+
+    /* Same locks as a statement that writes (see chidb_stmt_exec) */
+    pager = db->bt->pager;
+    if ((rc = chidb_Pager_beginWrite(pager)) != CHIDB_OK)
+        goto out;
+    if ((rc = chidb_Pager_beginRead(pager)) != CHIDB_OK)
+    {
+        chidb_Pager_endWrite(pager);
+        goto out;
+    }
+
+    it.table = chidb_catalog_table(db, table);
+    if (it.table == NULL)
+    {
+        rc = CHIDB_EINVALIDSQL;
+        goto unlock;
+    }
+    for (uint32_t i = 0; it.table->columnar && i < it.table->ncols; i++)
+        if (it.table->cols[i].type != TYPE_INT)
+        {
+            rc = CHIDB_EMISMATCH;
+            goto unlock;
+        }
+    for (chidb_catalog_index_t *idx = it.table->indexes; idx != NULL; idx = idx->next)
+    {
+        /* The catalog doesn't know which columns a covering index
+         * includes */
+        if (idx->covering || it.table->columnar)
+        {
+            rc = CHIDB_EMISUSE;
+            goto unlock;
+        }
+        int col = chidb_catalog_column(it.table, idx->column);
+
+        if (col < 0 || it.table->cols[col].type != TYPE_INT)
+        {
+            rc = CHIDB_EMISMATCH;
+            goto unlock;
+        }
+    }
+
+    it.ints = calloc(it.table->ncols, sizeof(int32_t));
+    it.nulls = calloc(it.table->ncols, sizeof(bool));
+    if (it.ints == NULL || it.nulls == NULL)
+    {
+        rc = CHIDB_ENOMEM;
+        goto unlock;
+    }
+
+    autocommit = !chidb_Pager_inTransaction(pager);
+    if (autocommit && (rc = chidb_Btree_begin(db->bt)) != CHIDB_OK)
+        goto unlock;
+
+    if (it.table->columnar)
+        rc = chidb_import_columnar(&it);
+    else if ((rc = chidb_Btree_firstKey(db->bt, it.table->nroot, &first)) == CHIDB_ENOTFOUND &&
+             chidb_import_sorted(&it))
+        rc = chidb_import_bulk(&it);
+    else if (rc == CHIDB_OK || rc == CHIDB_ENOTFOUND)
+        rc = chidb_import_insert(&it);
+    if (rc == CHIDB_EDUPLICATE)
+        rc = CHIDB_ECONSTRAINT;
+
+    /* The cached results of the table (and its indexes) are stale */
+    chidb_dbm_result_touch(db->result_cache, it.table->nroot);
+    for (chidb_catalog_index_t *idx = it.table->indexes; idx != NULL; idx = idx->next)
+        chidb_dbm_result_touch(db->result_cache, idx->nroot);
+
+    if (autocommit && rc == CHIDB_OK)
+        rc = chidb_Btree_commit(db->bt);
+    if (autocommit && rc != CHIDB_OK)
+        chidb_Btree_rollback(db->bt);
+
+unlock:
+    chidb_Pager_endRead(pager);
+    chidb_Pager_endWrite(pager);
+out:
+    if (nrows)
+        *nrows = it.nrows;
+    free(it.ints);
+    free(it.nulls);
+    chidb_DBRecordArena_free(&it.arena);
+    chidb_import_close(&it.file);
+
+    return rc;
+}
@@ -38,6 +38,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <string.h>
@@ -47,52 +48,163 @@
 
 
 /* Logging level. Set by default to print just errors */
-static int loglevel = ERROR;
+loglevel_t __chilog_level = ERROR;
+
+/* A message buffered by the ring backend */
+typedef struct chilog_slot
+{
+    uint64_t seq;                   /* Position of the message in the ring, plus one,
+                                       once the message is complete */
+    loglevel_t level;
+    char where[31];
+    char msg[CHILOG_RING_MSGLEN];
+} chilog_slot_t;
+
+static chilog_backend_t backend = CHILOG_BACKEND_STDOUT;
+
+/* The ring is a bounded multi-producer, single-consumer queue. Writers
+ * claim a position by advancing ring_head with a CAS, fill in the slot,
+ * and then publish it by storing its seq. The reader (chilog_flush)
+ * consumes from ring_tail, stopping at the first unpublished slot. A
+ * slot is only reused once the reader has advanced ring_tail past it. */
+static chilog_slot_t *ring = NULL;
+static uint64_t ring_head = 0;
+static uint64_t ring_tail = 0;
+static uint32_t ring_dropped = 0;
+static int ring_draining = 0;
 
 
 void chilog_setloglevel(loglevel_t level)
 {
-    loglevel = level;
+    __chilog_level = level;
 }
 
 
-void __chilog(loglevel_t level, char *file, int line, char *fmt, ...)
+static const char *chilog_levelstr(loglevel_t level)
 {
-    char buf[31], *levelstr;
-    va_list argptr;
-
-    if(level > loglevel)
-        return;
-
-    snprintf(buf, 31, "%s:%i", file, line);
-
     switch(level)
     {
     case CRITICAL:
-        levelstr = "CRITIC";
-        break;
+        return "CRITIC";
     case ERROR:
-        levelstr = "ERROR";
-        break;
+        return "ERROR";
     case WARNING:
-        levelstr = "WARN";
-        break;
+        return "WARN";
     case INFO:
-        levelstr = "INFO";
-        break;
+        return "INFO";
     case DEBUG:
-        levelstr = "DEBUG";
-        break;
+        return "DEBUG";
     case TRACE:
-        levelstr = "TRACE";
-        break;
+        return "TRACE";
     default:
-        levelstr = "UNKNOWN";
-        break;
+        return "UNKNOWN";
+    }
+}
+
+
+static void chilog_atexit(void)
+{
+    chilog_flush();
+}
+
+
+void chilog_setbackend(chilog_backend_t new_backend)
+{
+    if(new_backend == CHILOG_BACKEND_RING && ring == NULL)
+    {
+        ring = calloc(CHILOG_RING_SIZE, sizeof(chilog_slot_t));
+        if(ring == NULL)
+            return;
+        atexit(chilog_atexit);
     }
 
+    __atomic_store_n(&backend, new_backend, __ATOMIC_RELEASE);
+
+    if(new_backend == CHILOG_BACKEND_STDOUT)
+        chilog_flush();
+}
+
+
+static void chilog_ring_put(loglevel_t level, char *file, int line, char *fmt, va_list argptr)
+{
+    uint64_t pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+    chilog_slot_t *slot;
+
+    do
+    {
+        if(pos - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) >= CHILOG_RING_SIZE)
+        {
+            __atomic_fetch_add(&ring_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while(!__atomic_compare_exchange_n(&ring_head, &pos, pos + 1, 1,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    slot = &ring[pos % CHILOG_RING_SIZE];
+    slot->level = level;
+    snprintf(slot->where, sizeof(slot->where), "%s:%i", file, line);
+    vsnprintf(slot->msg, sizeof(slot->msg), fmt, argptr);
+
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+
+int chilog_flush(void)
+{
+    uint64_t tail;
+    uint32_t dropped;
+    int n = 0;
+
+    if(ring == NULL || __atomic_exchange_n(&ring_draining, 1, __ATOMIC_ACQUIRE))
+        return 0;
+
+    flockfile(stdout);
+    tail = __atomic_load_n(&ring_tail, __ATOMIC_RELAXED);
+    for(;;)
+    {
+        chilog_slot_t *slot = &ring[tail % CHILOG_RING_SIZE];
+
+        if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != tail + 1)
+            break;
+
+        printf(" %6s %-30s %s\n", chilog_levelstr(slot->level), slot->where, slot->msg);
+        tail++;
+        n++;
+        __atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    dropped = __atomic_exchange_n(&ring_dropped, 0, __ATOMIC_RELAXED);
+    if(dropped)
+        printf(" %6s %-30s %u messages dropped (log ring full)\n", chilog_levelstr(WARNING), "log.c", dropped);
+    funlockfile(stdout);
+    fflush(stdout);
+
+    __atomic_store_n(&ring_draining, 0, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+
+void __chilog(loglevel_t level, char *file, int line, char *fmt, ...)
+{
+    char buf[31];
+    va_list argptr;
+
+    if(level > __chilog_level)
+        return;
+
+    if(__atomic_load_n(&backend, __ATOMIC_ACQUIRE) == CHILOG_BACKEND_RING)
+    {
+        va_start(argptr, fmt);
+        chilog_ring_put(level, file, line, fmt, argptr);
+        va_end(argptr);
+        return;
+    }
+
+    snprintf(buf, 31, "%s:%i", file, line);
+
     flockfile(stdout);
-    printf(" %6s %-30s ", levelstr, buf);
+    printf(" %6s %-30s ", chilog_levelstr(level), buf);
     va_start(argptr, fmt);
     vprintf(fmt, argptr);
     printf("\n");
@@ -0,0 +1,197 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Normalized keys
+ *
+ * Encodes values as byte strings that sort like the values themselves
+ * (see normkey.h), so that a B-Tree node is searched with memcmp alone,
+ * whatever the type of its keys. This is what makes text columns
+ * indexable: an index cell holds the normalized value followed by the
+ * primary key of its row, and two cells compare like (value, primary
+ * key) pairs.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <string.h>
+#include <chidb/chidb.h>
+#include "normkey.h"
+
+
+/* Writes a 64-bit integer, big-endian */
+static inline void normkey_put8(uint8_t *p, uint64_t v)
+{
+    for (int i = 7; i >= 0; i--, v >>= 8)
+        p[i] = (uint8_t) v;
+}
+
+static inline uint64_t normkey_get8(const uint8_t *p)
+{
+    uint64_t v = 0;
+
+    for (int i = 0; i < 8; i++)
+        v = (v << 8) | p[i];
+
+    return v;
+}
+
+
+/* Encode a NULL into buf, returning the number of bytes written */
+uint32_t chidb_normkey_null(uint8_t *buf)
+{
+    buf[0] = NORMKEY_NULL;
+
+    return NORMKEY_NULL_SIZE;
+}
+
+/* Encode an integer into buf (NORMKEY_INT_SIZE bytes), returning the
+ * number of bytes written */
+uint32_t chidb_normkey_int(uint8_t *buf, int64_t v)
+{
+    buf[0] = NORMKEY_INT;
+    normkey_put8(buf + 1, (uint64_t) v ^ (UINT64_C(1) << 63));
+
+    return NORMKEY_INT_SIZE;
+}
+
+/* Number of bytes that a string of len bytes (not necessarily
+ * NUL-terminated) takes once encoded */
+uint32_t chidb_normkey_textSize(const char *s, uint32_t len)
+{
+    uint32_t size = 1 + len + 2;
+
+    for (const char *z = memchr(s, 0, len); z != NULL; z = memchr(z + 1, 0, len - (z + 1 - s)))
+        size++;
+
+    return size;
+}
+
+/* Encode a string of len bytes into buf (which must have room for
+ * chidb_normkey_textSize bytes), returning the number of bytes written */
+uint32_t chidb_normkey_text(uint8_t *buf, const char *s, uint32_t len)
+{
+    uint8_t *p = buf;
+
+    *p++ = NORMKEY_TEXT;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        *p++ = (uint8_t) s[i];
+        if (s[i] == 0)
+            *p++ = 0xFF;
+    }
+    *p++ = 0;
+    *p++ = 0;
+
+    return p - buf;
+}
+
+/* Encode a rowid into buf (NORMKEY_ROWID_SIZE bytes) */
+void chidb_normkey_putRowid(uint8_t *buf, chidb_key_t key)
+{
+    normkey_put8(buf, key);
+}
+
+chidb_key_t chidb_normkey_getRowid(const uint8_t *buf)
+{
+    return normkey_get8(buf);
+}
+
+
+/* Number of bytes of the value that a normalized key starts with (the
+ * rest of the key, if any, is what follows the value, like the primary
+ * key of an index entry), or 0 if the key doesn't start with a valid
+ * value */
+uint32_t chidb_normkey_valueSize(const uint8_t *key, uint32_t size)
+{
+    if (size == 0)
+        return 0;
+
+    switch (key[0])
+    {
+    case NORMKEY_NULL:
+        return NORMKEY_NULL_SIZE;
+    case NORMKEY_INT:
+        return size >= NORMKEY_INT_SIZE ? NORMKEY_INT_SIZE : 0;
+    case NORMKEY_TEXT:
+        /* The value ends at the first 0x00 0x00 */
+        for (uint32_t i = 1; i + 1 < size; i++)
+            if (key[i] == 0)
+            {
+                if (key[i + 1] == 0)
+                    return i + 2;
+                i++;
+            }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+/* Decodes the integer that a normalized key starts with. Returns false
+ * if the key doesn't start with an integer. */
+bool chidb_normkey_getInt(const uint8_t *key, uint32_t size, int64_t *v)
+{
+    if (size < NORMKEY_INT_SIZE || key[0] != NORMKEY_INT)
+        return false;
+
+    *v = (int64_t) (normkey_get8(key + 1) ^ (UINT64_C(1) << 63));
+
+    return true;
+}
+
+
+/* Compare two normalized keys
+ *
+ * Keys are compared as byte strings, so the comparison is a single
+ * memcmp, whatever the values they encode (the shorter key comes first
+ * if it is a prefix of the other).
+ *
+ * Parameters
+ * - a, na: First key, and its size
+ * - b, nb: Second key, and its size
+ *
+ * Return
+ * - A negative value if a sorts before b, a positive one if it sorts
+ *   after b, and 0 if they are equal
+ */
+int chidb_normkey_cmp(const uint8_t *a, uint32_t na, const uint8_t *b, uint32_t nb)
+{
+    int c = memcmp(a, b, na < nb ? na : nb);
+
+    if (c != 0)
+        return c;
+
+    return na < nb ? -1 : na > nb;
+}
@@ -0,0 +1,83 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Normalized keys -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef NORMKEY_H_
+#define NORMKEY_H_
+
+#include "chidbInt.h"
+
+/* A normalized key is a string of bytes that sorts (with memcmp, the
+ * shorter one first if one is a prefix of the other) like the values
+ * it encodes, so that keys of any type are compared without looking at
+ * their type. Files with BTREE_FEATURE_NORMKEY store their keys this
+ * way (see btree.h).
+ *
+ * A value is a tag byte, which orders values of different types (NULL
+ * before integers before text), followed by:
+ * - Integers: the eight bytes of the value, big-endian, with the sign
+ *   bit flipped (so that negative values come first).
+ * - Text: the bytes of the string, with every 0x00 byte written as
+ *   0x00 0xFF, followed by 0x00 0x00. A string then never encodes to a
+ *   prefix of another, so values can be followed by more values.
+ *
+ * Rowids (and the primary keys that index entries point to) are
+ * unsigned, and are stored as their eight bytes, big-endian, without a
+ * tag. */
+#define NORMKEY_NULL (0x01)
+#define NORMKEY_INT (0x02)
+#define NORMKEY_TEXT (0x03)
+
+#define NORMKEY_ROWID_SIZE (8)
+#define NORMKEY_NULL_SIZE (1)
+#define NORMKEY_INT_SIZE (1 + 8)
+
+uint32_t chidb_normkey_null(uint8_t *buf);
+uint32_t chidb_normkey_int(uint8_t *buf, int64_t v);
+uint32_t chidb_normkey_textSize(const char *s, uint32_t len);
+uint32_t chidb_normkey_text(uint8_t *buf, const char *s, uint32_t len);
+void chidb_normkey_putRowid(uint8_t *buf, chidb_key_t key);
+chidb_key_t chidb_normkey_getRowid(const uint8_t *buf);
+
+uint32_t chidb_normkey_valueSize(const uint8_t *key, uint32_t size);
+bool chidb_normkey_getInt(const uint8_t *key, uint32_t size, int64_t *v);
+int chidb_normkey_cmp(const uint8_t *a, uint32_t na, const uint8_t *b, uint32_t nb);
+
+
+#endif /* NORMKEY_H_ */
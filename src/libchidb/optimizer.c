@@ -37,18 +37,1481 @@
  *
  */
 
+#include <strings.h>
 #include <chidb/chidb.h>
+#include <chisql/chisql.h>
 #include "dbm-types.h"
+#include "stats.h"
+#include "catalog.h"
+#include "zonemap.h"
+#include "exprc.h"
 
-int chidb_stmt_optimize(chidb *db, chisql_statement_t *sql_stmt, chisql_statement_t **sql_stmt_opt)
+/* The optimizer rewrites the SRA tree of a SELECT statement:
+ *
+ * - Selections are split into their conjuncts, and each conjunct is
+ *   pushed down to the lowest point where all the tables it refers to
+ *   are available: right above its table if it refers to a single one,
+ *   or on the join that brings its tables together.
+ *
+ * - The inputs of a tree of inner joins are reordered. The input with
+ *   the fewest rows goes first, and each following join adds the input
+ *   that gives the smallest intermediate result (so a join with a
+ *   predicate is preferred to a cross product).
+ *
+ * - When every column that a query uses is qualified with its table,
+ *   the tables under a join are projected on the columns used above them.
+ *
+ * - Each of those joins chooses how it is run: seeking an index of one
+ *   input for the rows of the other, a hash join, or a nested loop
+ *   (see SRA_Join_t.method).
+ *
+ * - A selection right above a table chooses its access path: a scan of
+ *   the table, or a seek on the index of a column over the range that
+ *   its conjuncts comparing the column to values bound (see
+ *   SRA_Select_t.seek), or a lookup in the hash index of a column that
+ *   one of them sets equal to a value (see SRA_Select_t.hash). An
+ *   ORDER BY on the column of a seek's index needs no sort (see
+ *   SRA_Project_t.sorted), and neither does one on an indexed column
+ *   with a LIMIT small enough to read the index instead of the table.
+ *   A scan skips the parts of the table that a conjunct on a column
+ *   with a zone map rules out (see SRA_Select_t.zone). An IN list on
+ *   the primary key, or on an indexed column, can instead seek the
+ *   table (or the index) for each of its values (see
+ *   SRA_Select_t.probe).
+ *
+ * - A x IN (SELECT ...) conjunct becomes a hash semi-join of the
+ *   selection with the subquery (see SRA_Join_t.semi).
+ *
+ * Row counts and selectivities are estimated from the statistics that
+ * ANALYZE collects (see stats.c), with fixed guesses for the tables that
+ * have none. A condition on a column that doesn't name its table is left
+ * where it is, but its selectivity is still estimated, from the table in
+ * scope that has the column in the catalog (see catalog.c).
+ *
+ * The rewritten tree is built in the statement's arena, from the nodes
+ * of the original one. The expression compiler (see exprc.c) folds the
+ * constants of the tree before it is rewritten, and orders the
+ * conjuncts of its conditions once it is.
+ */
+
+/* Rows assumed in a table that hasn't been analyzed */
+#define OPT_DEFAULT_ROWS (1000)
+
+/* Values an IN list on the primary key of a table without statistics can
+ * have for its rows to be sought instead of scanning the table */
+#define OPT_MAX_BLIND_PROBES (16)
+
+/* Leaves a table needs for an aggregate of a scan of it to be worth
+ * running on several threads */
+#define OPT_PARALLEL_MIN_LEAVES (64)
+
+typedef struct opt_ctx
+{
+    chidb *db;
+    int rc;
+} opt_ctx_t;
+
+/* Appends item to v. If the vector can't grow, the error is recorded in
+ * ctx, and the statement is discarded once the optimizer returns. */
+static Vector_t *opt_add(opt_ctx_t *ctx, Vector_t *v, void *item)
+{
+    Vector_t *res = Vector_push(v, item);
+
+    if (res == NULL)
+    {
+        ctx->rc = CHIDB_ENOMEM;
+        return v;
+    }
+    return res;
+}
+
+/* Appends the conjuncts of cond to conds. The AND nodes are freed. */
+static Vector_t *opt_conjuncts(opt_ctx_t *ctx, Condition_t *cond, Vector_t *conds)
+{
+    Condition_t *cond1, *cond2;
+
+    if (cond == NULL)
+        return conds;
+    if (cond->t != RA_COND_AND)
+        return opt_add(ctx, conds, cond);
+
+    cond1 = cond->cond.binary.cond1;
+    cond2 = cond->cond.binary.cond2;
+    chisql_free(cond);
+    return opt_conjuncts(ctx, cond2, opt_conjuncts(ctx, cond1, conds));
+}
+
+/* The conjunction of the conditions in conds (NULL if there are none).
+ * The vector is freed. */
+static Condition_t *opt_and(Vector_t *conds)
+{
+    Condition_t *cond = NULL;
+
+    for (unsigned int i = 0; i < Vector_size(conds); i++)
+        cond = cond == NULL ? Vector_get(conds, i) : And(cond, Vector_get(conds, i));
+    Vector_free(conds);
+    return cond;
+}
+
+
+/*** Tables and columns ***/
+
+/* Returns the table named name (by its alias, if it has one) among the
+ * inputs of sra, or NULL if there is none */
+static TableReference_t *opt_findTable(SRA_t *sra, const char *name)
+{
+    TableReference_t *ref;
+
+    switch (sra->t)
+    {
+    case SRA_TABLE:
+        ref = sra->table.ref;
+        return strcasecmp(ref->alias ? ref->alias : ref->table_name, name) == 0 ? ref : NULL;
+    case SRA_SELECT:
+        return opt_findTable(sra->select.sra, name);
+    case SRA_PROJECT:
+        return opt_findTable(sra->project.sra, name);
+    case SRA_JOIN:
+    case SRA_LEFT_OUTER_JOIN:
+    case SRA_RIGHT_OUTER_JOIN:
+    case SRA_FULL_OUTER_JOIN:
+        ref = opt_findTable(sra->join.sra1, name);
+        /* Nor are those of the subquery of a semi-join */
+        return ref || sra->join.semi ? ref : opt_findTable(sra->join.sra2, name);
+    case SRA_NATURAL_JOIN:
+        ref = opt_findTable(sra->binary.sra1, name);
+        return ref ? ref : opt_findTable(sra->binary.sra2, name);
+    default:
+        /* The tables of a set operation aren't visible outside of it */
+        return NULL;
+    }
+}
+
+/* Returns the table among the inputs of sra that has a column named
+ * column in the catalog, or NULL if none of them (or more than one) has
+ * it */
+static TableReference_t *opt_findColumnTable(opt_ctx_t *ctx, SRA_t *sra, const char *column)
+{
+    TableReference_t *ref1, *ref2;
+    chidb_catalog_table_t *t;
+
+    switch (sra->t)
+    {
+    case SRA_TABLE:
+        t = chidb_catalog_table(ctx->db, sra->table.ref->table_name);
+        return t != NULL && chidb_catalog_column(t, column) >= 0 ? sra->table.ref : NULL;
+    case SRA_SELECT:
+        return opt_findColumnTable(ctx, sra->select.sra, column);
+    case SRA_PROJECT:
+        return opt_findColumnTable(ctx, sra->project.sra, column);
+    case SRA_JOIN:
+    case SRA_LEFT_OUTER_JOIN:
+    case SRA_RIGHT_OUTER_JOIN:
+    case SRA_FULL_OUTER_JOIN:
+        ref1 = opt_findColumnTable(ctx, sra->join.sra1, column);
+        if (sra->join.semi)
+            return ref1;
+        ref2 = opt_findColumnTable(ctx, sra->join.sra2, column);
+        return ref1 == NULL ? ref2 : ref2 == NULL ? ref1 : NULL;
+    case SRA_NATURAL_JOIN:
+        ref1 = opt_findColumnTable(ctx, sra->binary.sra1, column);
+        ref2 = opt_findColumnTable(ctx, sra->binary.sra2, column);
+        return ref1 == NULL ? ref2 : ref2 == NULL ? ref1 : NULL;
+    default:
+        return NULL;
+    }
+}
+
+/* Appends the columns that expr (and the expressions after it in its
+ * list, if list is true) refers to to cols. Returns false if one of them
+ * doesn't name its table, or is a '*'. */
+static bool opt_exprColumns(opt_ctx_t *ctx, Expression_t *expr, bool list, Vector_t **cols)
+{
+    for (; expr != NULL; expr = list ? expr->next : NULL)
+    {
+        switch (expr->t)
+        {
+        case EXPR_TERM:
+            if (expr->expr.term.t == TERM_ID)
+                return false;
+            if (expr->expr.term.t == TERM_FUNC &&
+                !opt_exprColumns(ctx, expr->expr.term.f.expr, false, cols))
+                return false;
+            if (expr->expr.term.t == TERM_COLREF)
+            {
+                if (expr->expr.term.ref->tableName == NULL ||
+                    strcmp(expr->expr.term.ref->columnName, "*") == 0)
+                    return false;
+                *cols = opt_add(ctx, *cols, expr->expr.term.ref);
+            }
+            break;
+        case EXPR_NEG:
+            if (!opt_exprColumns(ctx, expr->expr.unary.expr, false, cols))
+                return false;
+            break;
+        default:
+            if (!opt_exprColumns(ctx, expr->expr.binary.expr1, false, cols) ||
+                !opt_exprColumns(ctx, expr->expr.binary.expr2, false, cols))
+                return false;
+            break;
+        }
+    }
+
+    return true;
+}
+
+/* Same as opt_exprColumns, for the columns of a condition */
+static bool opt_condColumns(opt_ctx_t *ctx, Condition_t *cond, Vector_t **cols)
+{
+    switch (cond->t)
+    {
+    case RA_COND_AND:
+    case RA_COND_OR:
+        return opt_condColumns(ctx, cond->cond.binary.cond1, cols) &&
+               opt_condColumns(ctx, cond->cond.binary.cond2, cols);
+    case RA_COND_NOT:
+        return opt_condColumns(ctx, cond->cond.unary.cond, cols);
+    case RA_COND_IN:
+        return opt_exprColumns(ctx, cond->cond.in.expr, false, cols);
+    default:
+        return opt_exprColumns(ctx, cond->cond.comp.expr1, false, cols) &&
+               opt_exprColumns(ctx, cond->cond.comp.expr2, false, cols);
+    }
+}
+
+/* Whether every column that cond refers to belongs to a table of one
+ * of the nscope SRAs in scope */
+static bool opt_covers(opt_ctx_t *ctx, SRA_t **scope, int nscope, Condition_t *cond)
+{
+    Vector_t *cols = NULL;
+    bool covered = opt_condColumns(ctx, cond, &cols);
+
+    for (unsigned int i = 0; covered && i < Vector_size(cols); i++)
+    {
+        ColumnReference_t *ref = Vector_get(cols, i);
+
+        covered = false;
+        for (int j = 0; !covered && j < nscope; j++)
+            covered = opt_findTable(scope[j], ref->tableName) != NULL;
+    }
+    Vector_free(cols);
+    return covered;
+}
+
+
+/*** Estimates ***/
+
+static bool opt_isColumn(Expression_t *expr)
+{
+    return expr->t == EXPR_TERM && expr->expr.term.t == TERM_COLREF;
+}
+
+static bool opt_isValue(Expression_t *expr)
+{
+    return expr->t == EXPR_TERM && expr->expr.term.t == TERM_LITERAL;
+}
+
+/* Returns the table of the column that ref is, among the tables in
+ * scope, or NULL if it isn't one of theirs */
+static TableReference_t *opt_columnTable(opt_ctx_t *ctx, SRA_t **scope, int nscope,
+                                         ColumnReference_t *ref)
+{
+    TableReference_t *tref = NULL;
+
+    for (int i = 0; tref == NULL && i < nscope; i++)
+        tref = ref->tableName != NULL ? opt_findTable(scope[i], ref->tableName)
+                                      : opt_findColumnTable(ctx, scope[i], ref->columnName);
+    return tref;
+}
+
+/* Returns the statistics of the column that expr is, if it is a column
+ * of a table in scope (and in *ts those of its table, if any) */
+static chidb_column_stats_t *opt_columnStats(opt_ctx_t *ctx, SRA_t **scope, int nscope,
+                                             Expression_t *expr, chidb_table_stats_t **ts)
+{
+    ColumnReference_t *ref;
+    TableReference_t *tref;
+
+    *ts = NULL;
+    if (!opt_isColumn(expr))
+        return NULL;
+
+    ref = expr->expr.term.ref;
+    tref = opt_columnTable(ctx, scope, nscope, ref);
+    if (tref == NULL)
+        return NULL;
+
+    *ts = chidb_stats_table(ctx->db, tref->table_name);
+    return chidb_stats_column(*ts, ref->columnName);
+}
+
+/* The operator of a comparison, as if its column (if it has one) was on
+ * the left: 5 < t.a is t.a > 5. *col and *other are set to its sides. */
+static chidb_stats_op_t opt_compOp(Condition_t *cond, Expression_t **col, Expression_t **other)
+{
+    chidb_stats_op_t op;
+
+    switch (cond->t)
+    {
+    case RA_COND_EQ:  op = STATS_EQ; break;
+    case RA_COND_LT:  op = STATS_LT; break;
+    case RA_COND_GT:  op = STATS_GT; break;
+    case RA_COND_LEQ: op = STATS_LE; break;
+    default:          op = STATS_GE; break;
+    }
+
+    *col = cond->cond.comp.expr1;
+    *other = cond->cond.comp.expr2;
+    if (opt_isColumn(*col))
+        return op;
+
+    *col = cond->cond.comp.expr2;
+    *other = cond->cond.comp.expr1;
+    switch (op)
+    {
+    case STATS_LT: return STATS_GT;
+    case STATS_GT: return STATS_LT;
+    case STATS_LE: return STATS_GE;
+    case STATS_GE: return STATS_LE;
+    default:       return op;
+    }
+}
+
+/* Estimated selectivity of a comparison, evaluated on the tables in scope */
+static double opt_compSelectivity(opt_ctx_t *ctx, SRA_t **scope, int nscope, Condition_t *cond)
+{
+    Expression_t *col, *other;
+    chidb_table_stats_t *ts1, *ts2;
+    chidb_column_stats_t *cs1, *cs2;
+    chidb_stats_op_t op = opt_compOp(cond, &col, &other);
+    double d1, d2;
+    int32_t value = 0;
+    bool has_value;
+
+    if (!opt_isColumn(col))
+        return op == STATS_EQ ? STATS_DEFAULT_EQ : STATS_DEFAULT_RANGE;
+
+    cs1 = opt_columnStats(ctx, scope, nscope, col, &ts1);
+    if (opt_isColumn(other))
+    {
+        /* A join predicate. With an equality, each value of the column
+         * with fewer distinct values matches one of the other column. */
+        if (op != STATS_EQ)
+            return STATS_DEFAULT_RANGE;
+        cs2 = opt_columnStats(ctx, scope, nscope, other, &ts2);
+        d1 = cs1 ? cs1->ndistinct : 0;
+        d2 = cs2 ? cs2->ndistinct : 0;
+        if (d1 < 1 && d2 < 1)
+            return STATS_DEFAULT_EQ;
+        return 1 / (d1 > d2 ? d1 : d2);
+    }
+
+    has_value = opt_isValue(other) && other->expr.term.val->t == TYPE_INT;
+    if (has_value)
+        value = other->expr.term.val->val.ival;
+    return chidb_stats_selectivity(ts1, cs1, op, has_value, value);
+}
+
+/* Estimated fraction of the rows of the tables in scope for which cond
+ * holds (the conjuncts and disjuncts are assumed to be independent) */
+static double opt_selectivity(opt_ctx_t *ctx, SRA_t **scope, int nscope, Condition_t *cond)
+{
+    chidb_table_stats_t *ts;
+    chidb_column_stats_t *cs;
+    double s1, s2;
+    int n = 0;
+
+    switch (cond->t)
+    {
+    case RA_COND_AND:
+        return opt_selectivity(ctx, scope, nscope, cond->cond.binary.cond1) *
+               opt_selectivity(ctx, scope, nscope, cond->cond.binary.cond2);
+    case RA_COND_OR:
+        s1 = opt_selectivity(ctx, scope, nscope, cond->cond.binary.cond1);
+        s2 = opt_selectivity(ctx, scope, nscope, cond->cond.binary.cond2);
+        return s1 + s2 - s1 * s2;
+    case RA_COND_NOT:
+        return 1 - opt_selectivity(ctx, scope, nscope, cond->cond.unary.cond);
+    case RA_COND_IN:
+        /* The values of a subquery aren't known until it runs: it is
+         * guessed to keep as many rows as a range would */
+        if (cond->cond.in.select != NULL)
+            return STATS_DEFAULT_RANGE;
+        for (Literal_t *val = cond->cond.in.values_list; val != NULL; val = val->next)
+            n++;
+        cs = opt_columnStats(ctx, scope, nscope, cond->cond.in.expr, &ts);
+        s1 = n * chidb_stats_selectivity(ts, cs, STATS_EQ, false, 0);
+        return s1 < 1 ? s1 : 1;
+    default:
+        return opt_compSelectivity(ctx, scope, nscope, cond);
+    }
+}
+
+/* Estimated number of rows of sra */
+static double opt_rows(opt_ctx_t *ctx, SRA_t *sra)
+{
+    chidb_table_stats_t *ts;
+    SRA_t *scope[2];
+    double r1, r2, r;
+
+    switch (sra->t)
+    {
+    case SRA_TABLE:
+        ts = chidb_stats_table(ctx->db, sra->table.ref->table_name);
+        return ts != NULL ? ts->nrows : OPT_DEFAULT_ROWS;
+    case SRA_SELECT:
+        return opt_rows(ctx, sra->select.sra) *
+               opt_selectivity(ctx, &sra->select.sra, 1, sra->select.cond);
+    case SRA_PROJECT:
+        return opt_rows(ctx, sra->project.sra);
+    case SRA_JOIN:
+    case SRA_LEFT_OUTER_JOIN:
+    case SRA_RIGHT_OUTER_JOIN:
+    case SRA_FULL_OUTER_JOIN:
+        scope[0] = sra->join.sra1;
+        scope[1] = sra->join.sra2;
+        r1 = opt_rows(ctx, scope[0]);
+        if (sra->join.semi)
+            return r1 * opt_selectivity(ctx, scope, 1, sra->join.key);
+        r2 = opt_rows(ctx, scope[1]);
+        if (sra->join.opt_cond == NULL)
+            r = r1 * r2;
+        else if (sra->join.opt_cond->t == JOIN_COND_ON)
+            r = r1 * r2 * opt_selectivity(ctx, scope, 2, sra->join.opt_cond->on);
+        else
+            r = r1 > r2 ? r1 : r2;
+        /* An outer join has at least a row for each row it preserves */
+        if (sra->t != SRA_JOIN && sra->t != SRA_RIGHT_OUTER_JOIN && r < r1)
+            r = r1;
+        if (sra->t != SRA_JOIN && sra->t != SRA_LEFT_OUTER_JOIN && r < r2)
+            r = r2;
+        return r;
+    case SRA_NATURAL_JOIN:
+    case SRA_EXCEPT:
+        r1 = opt_rows(ctx, sra->binary.sra1);
+        r2 = opt_rows(ctx, sra->binary.sra2);
+        return sra->t == SRA_EXCEPT || r1 > r2 ? r1 : r2;
+    case SRA_INTERSECT:
+        r1 = opt_rows(ctx, sra->binary.sra1);
+        r2 = opt_rows(ctx, sra->binary.sra2);
+        return r1 < r2 ? r1 : r2;
+    case SRA_UNION:
+        return opt_rows(ctx, sra->binary.sra1) + opt_rows(ctx, sra->binary.sra2);
+    }
+
+    return OPT_DEFAULT_ROWS;
+}
+
+/* Estimated number of rows of sra, for EXPLAIN QUERY PLAN (see plan.c) */
+double chidb_stmt_estimate(chidb *db, SRA_t *sra)
+{
+    opt_ctx_t ctx = {db, CHIDB_OK};
+
+    return opt_rows(&ctx, sra);
+}
+
+/* Estimated selectivity of cond on the tables in scope, for the
+ * expression compiler (see exprc.c) */
+double chidb_stmt_selectivity(chidb *db, SRA_t **scope, int nscope, Condition_t *cond)
+{
+    opt_ctx_t ctx = {db, CHIDB_OK};
+
+    return opt_selectivity(&ctx, scope, nscope, cond);
+}
+
+/* Table of the column that ref is, among the tables in scope, for the
+ * expression compiler (see exprc.c) */
+TableReference_t *chidb_stmt_columnTable(chidb *db, SRA_t **scope, int nscope, ColumnReference_t *ref)
+{
+    opt_ctx_t ctx = {db, CHIDB_OK};
+
+    return opt_columnTable(&ctx, scope, nscope, ref);
+}
+
+
+/*** Rewriting ***/
+
+static SRA_t *opt_sra(opt_ctx_t *ctx, SRA_t *sra, Vector_t *conds, Vector_t *needed);
+
+static bool opt_isComparison(Condition_t *cond)
+{
+    return cond->t == RA_COND_EQ || cond->t == RA_COND_LT || cond->t == RA_COND_GT ||
+           cond->t == RA_COND_LEQ || cond->t == RA_COND_GEQ;
+}
+
+/* If cond compares a column of table that has an index to a value,
+ * returns the statistics of the column, and in *op the comparison (with
+ * the column on the left) */
+static chidb_column_stats_t *opt_indexBound(opt_ctx_t *ctx, SRA_t *table, Condition_t *cond,
+                                            chidb_stats_op_t *op)
+{
+    chidb_table_stats_t *ts;
+    chidb_column_stats_t *cs;
+    Expression_t *col, *other;
+
+    if (!opt_isComparison(cond))
+        return NULL;
+    *op = opt_compOp(cond, &col, &other);
+    if (!opt_isColumn(col) || !opt_isValue(other))
+        return NULL;
+
+    cs = opt_columnStats(ctx, &table, 1, col, &ts);
+    return cs != NULL && cs->index_root != 0 ? cs : NULL;
+}
+
+/* If cond is an equality between a column of table that has a hash
+ * index (see chidb_catalog_hashIndex) and an integer (or a parameter) */
+static bool opt_hashBound(opt_ctx_t *ctx, SRA_t *table, Condition_t *cond)
+{
+    chidb_catalog_table_t *t;
+    ColumnReference_t *ref;
+    Expression_t *col, *other;
+
+    if (cond->t != RA_COND_EQ)
+        return false;
+    opt_compOp(cond, &col, &other);
+    if (!opt_isColumn(col) || !opt_isValue(other) ||
+        (other->expr.term.val->t != TYPE_INT && other->expr.term.val->t != TYPE_PARAM))
+        return false;
+
+    ref = col->expr.term.ref;
+    if (ref->tableName != NULL && opt_findTable(table, ref->tableName) == NULL)
+        return false;
+    t = chidb_catalog_table(ctx->db, table->table.ref->table_name);
+
+    return t != NULL && chidb_catalog_hashIndex(t, ref->columnName) != NULL;
+}
+
+/* If cond is an IN list on the primary key of table, or on a column of
+ * it with an index, returns the number of values in the list (0 if it
+ * is neither), and in *cs the statistics of the indexed column (NULL
+ * for the primary key) */
+static unsigned int opt_inBound(opt_ctx_t *ctx, SRA_t *table, Condition_t *cond,
+                                chidb_column_stats_t **cs)
+{
+    chidb_catalog_table_t *t;
+    chidb_table_stats_t *ts;
+    ColumnReference_t *ref;
+    unsigned int n = 0;
+    int ncol;
+
+    if (cond->t != RA_COND_IN || cond->cond.in.select != NULL || !opt_isColumn(cond->cond.in.expr))
+        return 0;
+
+    ref = cond->cond.in.expr->expr.term.ref;
+    if (ref->tableName != NULL && opt_findTable(table, ref->tableName) == NULL)
+        return 0;
+    t = chidb_catalog_table(ctx->db, table->table.ref->table_name);
+    if (t == NULL || (ncol = chidb_catalog_column(t, ref->columnName)) < 0)
+        return 0;
+
+    for (Literal_t *val = cond->cond.in.values_list; val != NULL; val = val->next)
+        n++;
+    *cs = NULL;
+    if (t->cols[ncol].pkey)
+        return n;
+    *cs = opt_columnStats(ctx, &table, 1, cond->cond.in.expr, &ts);
+    return *cs != NULL && (*cs)->index_root != 0 ? n : 0;
+}
+
+/* Chooses how a selection right above a table reads the table. A scan
+ * reads all of its leaves. A seek on the index of a column reads the
+ * range of the index that the conjuncts comparing the column to a value
+ * bound, and then the table for each entry in the range: an equality
+ * bounds both ends of the range, and t.a > 1 AND t.a <= 9 one each.
+ * An equality on a column with a hash index is looked up in it instead,
+ * whatever the statistics: that reads the page of one bucket and then
+ * the path to the row, which neither a seek, which reads the path to
+ * the entry first, nor a scan of more than a leaf can beat. An IN list
+ * on the primary key (or an indexed column) seeks each of its values,
+ * which reads a path per value (and, on an index, per matching row):
+ * that is chosen if it reads fewer pages than the scan or the seek
+ * range, and, on the primary key of a table without statistics, as
+ * long as the list is short. */
+static void opt_accessPath(opt_ctx_t *ctx, SRA_t *select, Vector_t *conds)
+{
+    SRA_t *table = select->select.sra;
+    chidb_table_stats_t *ts = chidb_stats_table(ctx->db, table->table.ref->table_name);
+    chidb_column_stats_t *cs;
+    chidb_stats_op_t op;
+    double best, cost, sel;
+
+    select->select.seek = NULL;
+    select->select.seek_end = NULL;
+    select->select.hash = NULL;
+    select->select.probe = NULL;
+    for (unsigned int i = 0; i < Vector_size(conds); i++)
+        if (opt_hashBound(ctx, table, Vector_get(conds, i)))
+        {
+            select->select.hash = Vector_get(conds, i);
+            return;
+        }
+    if (ts == NULL)
+    {
+        for (unsigned int i = 0; i < Vector_size(conds); i++)
+        {
+            unsigned int n = opt_inBound(ctx, table, Vector_get(conds, i), &cs);
+
+            if (n > 0 && n <= OPT_MAX_BLIND_PROBES && cs == NULL)
+            {
+                select->select.probe = Vector_get(conds, i);
+                return;
+            }
+        }
+        return;
+    }
+
+    best = ts->nleaves;
+    for (unsigned int i = 0; i < Vector_size(conds); i++)
+    {
+        Condition_t *lo = NULL, *hi = NULL;
+
+        if ((cs = opt_indexBound(ctx, table, Vector_get(conds, i), &op)) == NULL)
+            continue;
+
+        /* The tightest bounds we know of: an equality, or the first
+         * lower and upper bounds on the column */
+        for (unsigned int j = 0; j < Vector_size(conds); j++)
+        {
+            Condition_t *cond = Vector_get(conds, j);
+
+            if (opt_indexBound(ctx, table, cond, &op) != cs)
+                continue;
+            if (op == STATS_EQ)
+            {
+                lo = hi = cond;
+                break;
+            }
+            if ((op == STATS_GT || op == STATS_GE) && lo == NULL)
+                lo = cond;
+            if ((op == STATS_LT || op == STATS_LE) && hi == NULL)
+                hi = cond;
+        }
+
+        if (lo == hi)
+            sel = opt_compSelectivity(ctx, &table, 1, lo);
+        else if (lo != NULL && hi != NULL)
+            sel = opt_compSelectivity(ctx, &table, 1, lo) + opt_compSelectivity(ctx, &table, 1, hi) - 1;
+        else
+            sel = opt_compSelectivity(ctx, &table, 1, lo ? lo : hi);
+        if (sel < 0)
+            sel = 0;
+
+        cost = ts->depth + sel * ts->nrows * ts->depth;
+        if (cost < best)
+        {
+            best = cost;
+            select->select.seek = lo;
+            select->select.seek_end = hi;
+        }
+    }
+
+    for (unsigned int i = 0; i < Vector_size(conds); i++)
+    {
+        Condition_t *cond = Vector_get(conds, i);
+        unsigned int n = opt_inBound(ctx, table, cond, &cs);
+
+        if (n == 0)
+            continue;
+        cost = n * ts->depth;
+        if (cs != NULL)
+            cost += opt_selectivity(ctx, &table, 1, cond) * ts->nrows * ts->depth;
+        if (cost < best)
+        {
+            best = cost;
+            select->select.seek = NULL;
+            select->select.seek_end = NULL;
+            select->select.probe = cond;
+        }
+    }
+}
+
+/* If cond compares a column of table that has a zone map (that is up
+ * to date, see chidb_zonemap) to an integer (or a parameter) */
+static bool opt_zoneBound(opt_ctx_t *ctx, SRA_t *table, Condition_t *cond)
+{
+    chidb_catalog_table_t *t;
+    ColumnReference_t *ref;
+    Expression_t *col, *other;
+    int ncol;
+
+    if (!opt_isComparison(cond))
+        return false;
+    opt_compOp(cond, &col, &other);
+    if (!opt_isColumn(col) || !opt_isValue(other) ||
+        (other->expr.term.val->t != TYPE_INT && other->expr.term.val->t != TYPE_PARAM))
+        return false;
+
+    ref = col->expr.term.ref;
+    if (ref->tableName != NULL && opt_findTable(table, ref->tableName) == NULL)
+        return false;
+    t = chidb_catalog_table(ctx->db, table->table.ref->table_name);
+    if (t == NULL || t->columnar || (ncol = chidb_catalog_column(t, ref->columnName)) < 0 || ncol > UINT8_MAX)
+        return false;
+
+    return chidb_zonemap_get(ctx->db->bt, t->nroot, ncol) != NULL;
+}
+
+/* Chooses the conjunct, if any, that a scan of a table (a selection
+ * right above it with no seek range) skips parts of the table with: the
+ * first one on a column with a zone map */
+static void opt_zone(opt_ctx_t *ctx, SRA_t *select, Vector_t *conds)
+{
+    select->select.zone = NULL;
+    if (select->select.seek != NULL || select->select.seek_end != NULL || select->select.hash != NULL ||
+        select->select.probe != NULL)
+        return;
+
+    for (unsigned int i = 0; i < Vector_size(conds); i++)
+        if (opt_zoneBound(ctx, select->select.sra, Vector_get(conds, i)))
+        {
+            select->select.zone = Vector_get(conds, i);
+            return;
+        }
+}
+
+/* Applies the conjuncts in conds (if any) to sra with a selection. The
+ * vector is freed. */
+static SRA_t *opt_selection(opt_ctx_t *ctx, SRA_t *sra, Vector_t *conds)
+{
+    SRA_t *res;
+
+    if (Vector_size(conds) == 0)
+    {
+        Vector_free(conds);
+        return sra;
+    }
+
+    res = (SRA_t *)chisql_alloc(sizeof(SRA_t));
+    if (res == NULL)
+    {
+        ctx->rc = CHIDB_ENOMEM;
+        Vector_free(conds);
+        return sra;
+    }
+    res->t = SRA_SELECT;
+    res->select.sra = sra;
+    if (sra->t == SRA_TABLE)
+    {
+        opt_accessPath(ctx, res, conds);
+        opt_zone(ctx, res, conds);
+    }
+    res->select.cond = opt_and(conds);
+    return res;
+}
+
+/* Whether cond has an IN (SELECT ...) */
+static bool opt_hasSubquery(Condition_t *cond)
+{
+    switch (cond->t)
+    {
+    case RA_COND_AND:
+    case RA_COND_OR:
+        return opt_hasSubquery(cond->cond.binary.cond1) || opt_hasSubquery(cond->cond.binary.cond2);
+    case RA_COND_NOT:
+        return opt_hasSubquery(cond->cond.unary.cond);
+    case RA_COND_IN:
+        return cond->cond.in.select != NULL;
+    default:
+        return false;
+    }
+}
+
+/* Applies a x IN (SELECT ...) conjunct to sra with a hash semi-join,
+ * whose hash table is built from the rows of the subquery (optimized on
+ * its own, so it can't refer to the tables of sra). The subquery must
+ * have a single column. */
+static SRA_t *opt_semiJoin(opt_ctx_t *ctx, SRA_t *sra, Condition_t *cond)
+{
+    SRA_t *sub = cond->cond.in.select, *join;
+
+    if (sub->t == SRA_PROJECT && sub->project.expr_list != NULL && sub->project.expr_list->next != NULL)
+    {
+        ctx->rc = CHIDB_EINVALIDSQL;
+        return sra;
+    }
+
+    join = SRAJoin(sra, NULL, NULL);
+    if (join == NULL)
+    {
+        ctx->rc = CHIDB_ENOMEM;
+        return sra;
+    }
+    join->join.sra2 = opt_sra(ctx, sub, NULL, NULL);
+    join->join.method = JOIN_HASH;
+    join->join.semi = 1;
+    join->join.key = cond;
+    cond->cond.in.select = NULL;
+
+    return join;
+}
+
+/* Applies the conjuncts in conds (if any) to sra with a selection, and
+ * a semi-join above it for each IN (SELECT ...) among them. A subquery
+ * that is not a conjunct of its own (under an OR or a NOT) is not
+ * supported. The vector is freed. */
+static SRA_t *opt_select(opt_ctx_t *ctx, SRA_t *sra, Vector_t *conds)
+{
+    Vector_t *rest = NULL, *semi = NULL;
+    SRA_t *res;
+
+    for (unsigned int i = 0; i < Vector_size(conds); i++)
+    {
+        Condition_t *cond = Vector_get(conds, i);
+
+        if (cond->t == RA_COND_IN && cond->cond.in.select != NULL)
+            semi = opt_add(ctx, semi, cond);
+        else
+        {
+            if (opt_hasSubquery(cond))
+                ctx->rc = CHIDB_EINVALIDSQL;
+            rest = opt_add(ctx, rest, cond);
+        }
+    }
+    Vector_free(conds);
+
+    res = opt_selection(ctx, sra, rest);
+    for (unsigned int i = 0; i < Vector_size(semi); i++)
+        res = opt_semiJoin(ctx, res, Vector_get(semi, i));
+    Vector_free(semi);
+
+    return res;
+}
+
+/* Projects sra, if it reads a single table, on the columns of that
+ * table in needed (nothing is done if needed is NULL) */
+static SRA_t *opt_project(SRA_t *sra, Vector_t *needed)
+{
+    Expression_t *expr_list = NULL;
+    SRA_t *base = sra;
+
+    while (base->t == SRA_SELECT)
+        base = base->select.sra;
+    if (needed == NULL || base->t != SRA_TABLE)
+        return sra;
+
+    for (unsigned int i = 0; i < Vector_size(needed); i++)
+    {
+        ColumnReference_t *ref = Vector_get(needed, i);
+        bool seen = false;
+
+        if (opt_findTable(base, ref->tableName) == NULL)
+            continue;
+        for (unsigned int j = 0; !seen && j < i; j++)
+        {
+            ColumnReference_t *prev = Vector_get(needed, j);
+
+            seen = strcasecmp(prev->tableName, ref->tableName) == 0 &&
+                   strcasecmp(prev->columnName, ref->columnName) == 0;
+        }
+        if (!seen)
+            expr_list = append_expression(expr_list,
+                    TermColumnReference(ColumnReference_make(ref->tableName, ref->columnName)));
+    }
+
+    /* A table that none of the columns come from (as in SELECT t.a FROM
+     * t, u) is only there for its number of rows */
+    return expr_list ? SRAProject(sra, expr_list) : sra;
+}
+
+/* The columns in needed, and those that the conditions in conds (which
+ * may be NULL) refer to. Returns NULL if needed is NULL, or one of the
+ * columns doesn't name its table. */
+static Vector_t *opt_needed(opt_ctx_t *ctx, Vector_t *needed, Vector_t *conds)
+{
+    Vector_t *res = NULL;
+
+    if (needed == NULL)
+        return NULL;
+
+    for (unsigned int i = 0; i < Vector_size(needed); i++)
+        res = opt_add(ctx, res, Vector_get(needed, i));
+    for (unsigned int i = 0; i < Vector_size(conds); i++)
+    {
+        if (Vector_get(conds, i) != NULL && !opt_condColumns(ctx, Vector_get(conds, i), &res))
+        {
+            Vector_free(res);
+            return NULL;
+        }
+    }
+
+    return res;
+}
+
+/* Whether sra is an inner join without a USING clause */
+static bool opt_isInnerJoin(SRA_t *sra)
+{
+    return sra->t == SRA_JOIN && (sra->join.opt_cond == NULL || sra->join.opt_cond->t == JOIN_COND_ON);
+}
+
+/* Number of inputs of a tree of inner joins */
+static unsigned int opt_ninputs(SRA_t *sra)
+{
+    if (!opt_isInnerJoin(sra))
+        return 1;
+    return opt_ninputs(sra->join.sra1) + opt_ninputs(sra->join.sra2);
+}
+
+/* Collects the inputs of a tree of inner joins, and the conjuncts of
+ * their ON conditions. The join nodes are freed. */
+static void opt_joinInputs(opt_ctx_t *ctx, SRA_t *sra, Vector_t **inputs, Vector_t **conds)
+{
+    if (!opt_isInnerJoin(sra))
+    {
+        *inputs = opt_add(ctx, *inputs, sra);
+        return;
+    }
+
+    opt_joinInputs(ctx, sra->join.sra1, inputs, conds);
+    opt_joinInputs(ctx, sra->join.sra2, inputs, conds);
+    if (sra->join.opt_cond)
+    {
+        *conds = opt_conjuncts(ctx, sra->join.opt_cond->on, *conds);
+        chisql_free(sra->join.opt_cond);
+    }
+    chisql_free(sra);
+}
+
+/* The table that sra reads, if it only selects and projects its rows */
+static SRA_t *opt_baseTable(SRA_t *sra)
+{
+    while (sra->t == SRA_SELECT || sra->t == SRA_PROJECT)
+        sra = sra->t == SRA_SELECT ? sra->select.sra : sra->project.sra;
+    return sra->t == SRA_TABLE ? sra : NULL;
+}
+
+/* If cond is an equality between a column of sra1 and a column of sra2,
+ * returns the column of sra2 */
+static Expression_t *opt_joinKey(SRA_t *sra1, SRA_t *sra2, Condition_t *cond)
+{
+    Expression_t *e1 = cond->cond.comp.expr1, *e2 = cond->cond.comp.expr2;
+
+    if (cond->t != RA_COND_EQ || !opt_isColumn(e1) || !opt_isColumn(e2) ||
+        e1->expr.term.ref->tableName == NULL || e2->expr.term.ref->tableName == NULL)
+        return NULL;
+    if (opt_findTable(sra1, e1->expr.term.ref->tableName) && opt_findTable(sra2, e2->expr.term.ref->tableName))
+        return e2;
+    if (opt_findTable(sra1, e2->expr.term.ref->tableName) && opt_findTable(sra2, e1->expr.term.ref->tableName))
+        return e1;
+    return NULL;
+}
+
+/* Joins sra1 (with rows1 estimated rows) and sra2 (rows2) on the
+ * conjuncts in on (freed), choosing how the join is run:
+ *
+ * - An index join, if one input is a table with an index on its column
+ *   of an equality in on, and seeking the index for each row of the
+ *   other input (in key order, so that consecutive seeks mostly land on
+ *   the same pages) reads fewer pages than the table has leaves.
+ * - Otherwise, a hash join if there is such an equality, with the hash
+ *   table built from the input with fewer rows.
+ * - Otherwise, a nested loop.
+ *
+ * The inputs are swapped so that the indexed table, or the input the
+ * hash table is built from, is sra2. */
+static SRA_t *opt_joinMethod(opt_ctx_t *ctx, SRA_t *sra1, SRA_t *sra2, Vector_t *on,
+                             double rows1, double rows2)
+{
+    enum JoinMethod method = JOIN_NESTED_LOOP;
+    Condition_t *key = NULL;
+    double best = 0;
+    bool swap = false;
+    SRA_t *join;
+
+    for (unsigned int i = 0; i < Vector_size(on); i++)
+    {
+        Condition_t *cond = Vector_get(on, i);
+
+        /* Try sra2 as the indexed table, and then sra1 */
+        for (int side = 0; side < 2; side++)
+        {
+            SRA_t *outer = side ? sra2 : sra1, *inner = side ? sra1 : sra2;
+            SRA_t *table = opt_baseTable(inner);
+            Expression_t *col = opt_joinKey(outer, inner, cond);
+            chidb_table_stats_t *ts;
+            chidb_column_stats_t *cs;
+            double cost;
+
+            if (col == NULL)
+                continue;
+
+            if (key == NULL)
+            {
+                key = cond;
+                method = JOIN_HASH;
+                swap = rows1 < rows2;
+            }
+
+            if (table == NULL)
+                continue;
+            cs = opt_columnStats(ctx, &table, 1, col, &ts);
+            if (cs == NULL || cs->index_root == 0)
+                continue;
+
+            cost = (side ? rows2 : rows1) * ts->depth;
+            if (cost < ts->nleaves && (method != JOIN_INDEX || cost < best))
+            {
+                key = cond;
+                method = JOIN_INDEX;
+                swap = side == 1;
+                best = cost;
+            }
+        }
+    }
+
+    join = swap ? SRAJoin(sra2, sra1, NULL) : SRAJoin(sra1, sra2, NULL);
+    if (join == NULL)
+    {
+        ctx->rc = CHIDB_ENOMEM;
+        return sra1;
+    }
+    join->join.opt_cond = on ? On(opt_and(on)) : NULL;
+    join->join.method = method;
+    join->join.key = key;
+
+    return join;
+}
+
+/* Optimizes a tree of inner joins, and applies conds to it */
+static SRA_t *opt_joins(opt_ctx_t *ctx, SRA_t *sra, Vector_t *conds, Vector_t *needed)
 {
-    /* Your code goes here */
+    Vector_t *inputs = NULL, *rest = NULL, *inputNeeded, **mine;
+    SRA_t *acc, *scope[2];
+    double *rows, accRows, bestRows = 0;
+    unsigned int n, first = 0, best;
+
+    n = opt_ninputs(sra);
+    rows = malloc(n * sizeof(double));
+    mine = calloc(n, sizeof(Vector_t *));
+    if (rows == NULL || mine == NULL)
+    {
+        free(rows);
+        free(mine);
+        ctx->rc = CHIDB_ENOMEM;
+        return opt_select(ctx, sra, conds);
+    }
+    opt_joinInputs(ctx, sra, &inputs, &conds);
+    if (ctx->rc != CHIDB_OK)
+    {
+        /* The statement is discarded (the nodes are still in its arena) */
+        free(rows);
+        free(mine);
+        return sra;
+    }
+
+    /* Conjuncts on a single input go right above it. The rest refer to
+     * several inputs, and are applied by the joins. */
+    for (unsigned int j = 0; j < Vector_size(conds); j++)
+    {
+        Condition_t *cond = Vector_get(conds, j);
+        unsigned int i = 0;
 
-    /* Right now, the "optimizer" simply returns a copy of the provided statement */
+        while (i < n && !opt_covers(ctx, (SRA_t **) &Vector_get(inputs, i), 1, cond))
+            i++;
+        if (i < n)
+            mine[i] = opt_add(ctx, mine[i], cond);
+        else
+            rest = opt_add(ctx, rest, cond);
+    }
+    Vector_free(conds);
+
+    inputNeeded = opt_needed(ctx, needed, rest);
+    for (unsigned int i = 0; i < n; i++)
+    {
+        SRA_t *input = opt_sra(ctx, Vector_get(inputs, i), mine[i], inputNeeded);
+
+        Vector_get(inputs, i) = opt_project(input, inputNeeded);
+        rows[i] = opt_rows(ctx, input);
+        if (rows[i] < rows[first])
+            first = i;
+    }
+    Vector_free(inputNeeded);
+
+    /* Join the inputs greedily, applying each of the other conjuncts as
+     * soon as the inputs it refers to have been joined */
+    acc = Vector_get(inputs, first);
+    accRows = rows[first];
+    Vector_get(inputs, first) = NULL;
+    for (unsigned int k = 1; k < n; k++)
+    {
+        Vector_t *on = NULL;
+
+        scope[0] = acc;
+        best = n;
+        for (unsigned int i = 0; i < n; i++)
+        {
+            double r;
+
+            if ((scope[1] = Vector_get(inputs, i)) == NULL)
+                continue;
+            r = accRows * rows[i];
+            for (unsigned int j = 0; j < Vector_size(rest); j++)
+                if (Vector_get(rest, j) != NULL && opt_covers(ctx, scope, 2, Vector_get(rest, j)))
+                    r *= opt_selectivity(ctx, scope, 2, Vector_get(rest, j));
+            if (best == n || r < bestRows)
+            {
+                best = i;
+                bestRows = r;
+            }
+        }
+
+        scope[1] = Vector_get(inputs, best);
+        for (unsigned int j = 0; j < Vector_size(rest); j++)
+        {
+            if (Vector_get(rest, j) != NULL && opt_covers(ctx, scope, 2, Vector_get(rest, j)))
+            {
+                on = opt_add(ctx, on, Vector_get(rest, j));
+                Vector_get(rest, j) = NULL;
+            }
+        }
+
+        acc = opt_joinMethod(ctx, acc, scope[1], on, accRows, rows[best]);
+        accRows = bestRows;
+        Vector_get(inputs, best) = NULL;
+    }
+
+    /* Conjuncts with a column that doesn't name its table go on top */
+    conds = NULL;
+    for (unsigned int j = 0; j < Vector_size(rest); j++)
+        if (Vector_get(rest, j) != NULL)
+            conds = opt_add(ctx, conds, Vector_get(rest, j));
+
+    Vector_free(rest);
+    Vector_free(inputs);
+    free(mine);
+    free(rows);
+    return opt_select(ctx, acc, conds);
+}
+
+/* Optimizes a join that can't be reordered (an outer join, or a join
+ * on common columns), and applies conds to it */
+static SRA_t *opt_join2(opt_ctx_t *ctx, SRA_t *sra, Vector_t *conds, Vector_t *needed)
+{
+    Vector_t *conds1 = NULL, *conds2 = NULL, *above = NULL, *used = NULL, *sideNeeded = NULL;
+    SRA_t **sra1, **sra2;
+    bool push1, push2;
+
+    if (sra->t == SRA_NATURAL_JOIN)
+    {
+        sra1 = &sra->binary.sra1;
+        sra2 = &sra->binary.sra2;
+    }
+    else
+    {
+        sra1 = &sra->join.sra1;
+        sra2 = &sra->join.sra2;
+    }
+
+    /* A conjunct can't go below a side of an outer join that may be
+     * padded with NULLs */
+    push1 = sra->t != SRA_RIGHT_OUTER_JOIN && sra->t != SRA_FULL_OUTER_JOIN;
+    push2 = sra->t != SRA_LEFT_OUTER_JOIN && sra->t != SRA_FULL_OUTER_JOIN;
+    for (unsigned int j = 0; j < Vector_size(conds); j++)
+    {
+        Condition_t *cond = Vector_get(conds, j);
+
+        if (push1 && opt_covers(ctx, sra1, 1, cond))
+            conds1 = opt_add(ctx, conds1, cond);
+        else if (push2 && opt_covers(ctx, sra2, 1, cond))
+            conds2 = opt_add(ctx, conds2, cond);
+        else
+            above = opt_add(ctx, above, cond);
+    }
+    Vector_free(conds);
+
+    /* The columns that NATURAL and USING joins compare don't name their
+     * tables, so the inputs of those can't be projected */
+    if (sra->t != SRA_NATURAL_JOIN &&
+        (sra->join.opt_cond == NULL || sra->join.opt_cond->t == JOIN_COND_ON))
+    {
+        for (unsigned int j = 0; j < Vector_size(above); j++)
+            used = opt_add(ctx, used, Vector_get(above, j));
+        if (sra->join.opt_cond)
+            used = opt_add(ctx, used, sra->join.opt_cond->on);
+        sideNeeded = opt_needed(ctx, needed, used);
+        Vector_free(used);
+    }
+
+    *sra1 = opt_project(opt_sra(ctx, *sra1, conds1, sideNeeded), sideNeeded);
+    *sra2 = opt_project(opt_sra(ctx, *sra2, conds2, sideNeeded), sideNeeded);
+    Vector_free(sideNeeded);
+
+    return opt_select(ctx, sra, above);
+}
+
+/* Returns the statistics of column expr, if the input of a projection
+ * reads a single table (through a selection, set in *select, if any),
+ * and expr is a column of that table with an index */
+static chidb_column_stats_t *opt_indexedInput(opt_ctx_t *ctx, SRA_t *project, Expression_t *expr,
+                                              SRA_t **select, SRA_t **table, chidb_table_stats_t **ts)
+{
+    SRA_t *input = project->project.sra;
+    chidb_column_stats_t *cs;
+
+    *select = NULL;
+    while (input->t == SRA_PROJECT)
+        input = input->project.sra;
+    if (input->t == SRA_SELECT)
+    {
+        *select = input;
+        input = input->select.sra;
+    }
+    if (input->t != SRA_TABLE)
+        return NULL;
+
+    *table = input;
+    cs = opt_columnStats(ctx, table, 1, expr, ts);
+    return cs != NULL && cs->index_root != 0 ? cs : NULL;
+}
+
+/* Whether the selection on a table seeks a range of the index of cs */
+static bool opt_seeksIndex(opt_ctx_t *ctx, SRA_t *select, SRA_t *table, chidb_column_stats_t *cs)
+{
+    Condition_t *bound;
+    chidb_stats_op_t op;
+
+    if (select == NULL || (select->select.seek == NULL && select->select.seek_end == NULL))
+        return false;
+
+    bound = select->select.seek ? select->select.seek : select->select.seek_end;
+    return opt_indexBound(ctx, table, bound, &op) == cs;
+}
+
+/* Lets a projection with ORDER BY on a column skip sorting its rows,
+ * when its input reads a single table whose rows it can read through
+ * the index on that column (forward for ASC, backward for DESC):
+ *
+ * - If its selection already seeks a range of that index (see
+ *   opt_accessPath), at no extra cost.
+ * - If the table would be scanned, but a LIMIT (and OFFSET) that are
+ *   known let the query stop after a few rows: it then reads the index
+ *   until as many rows as they add up to go through the selection, and
+ *   the table for each, which must read fewer pages than the scan. */
+static void opt_order(opt_ctx_t *ctx, SRA_t *project)
+{
+    Literal_t *limit = project->project.limit, *offset = project->project.offset;
+    SRA_t *select, *table;
+    chidb_table_stats_t *ts;
+    chidb_column_stats_t *cs;
+    double n, sel;
+
+    if (project->project.order_by == NULL)
+        return;
+    cs = opt_indexedInput(ctx, project, project->project.order_by, &select, &table, &ts);
+    if (cs == NULL)
+        return;
+
+    if (select != NULL && (select->select.seek != NULL || select->select.seek_end != NULL))
+    {
+        project->project.sorted = opt_seeksIndex(ctx, select, table, cs);
+        return;
+    }
+    if (select != NULL && (select->select.hash != NULL || select->select.probe != NULL))
+        return;
+
+    if (limit == NULL || limit->t != TYPE_INT || limit->val.ival < 0 ||
+        (offset != NULL && offset->t != TYPE_INT) || ts->nrows == 0)
+        return;
+
+    n = limit->val.ival + (offset != NULL && offset->val.ival > 0 ? offset->val.ival : 0);
+    sel = select != NULL ? opt_rows(ctx, select) / ts->nrows : 1;
+    if (sel > 0 && n / sel * ts->depth < ts->nleaves)
+        project->project.sorted = 1;
+}
+
+/* Whether a projection of a single column, with no aggregate, produces
+ * its rows ordered by that column, because it reads them through the
+ * index on it: its selection seeks a range of the index, or there is no
+ * selection, and the index alone has the column */
+static bool opt_ordered(opt_ctx_t *ctx, SRA_t *project)
+{
+    Expression_t *expr = project->project.expr_list;
+    SRA_t *select, *table;
+    chidb_table_stats_t *ts;
+    chidb_column_stats_t *cs;
+
+    if (project->t != SRA_PROJECT || project->project.group_by != NULL ||
+        expr == NULL || expr->next != NULL || !opt_isColumn(expr))
+        return false;
+    cs = opt_indexedInput(ctx, project, expr, &select, &table, &ts);
+    return cs != NULL && (select == NULL || opt_seeksIndex(ctx, select, table, cs));
+}
+
+/* Lets a projection with GROUP BY on a column aggregate its groups as
+ * they come (a streaming aggregate), instead of in a hash table, when
+ * its selection seeks a range of the index on that column: the rows
+ * then come ordered by it, so each group is done when the next starts.
+ * A scan is left to the hash table, since reading the whole table
+ * through the index would cost a lookup per row. A DISTINCT of a lone
+ * column is a group by that column, which can also be read from the
+ * index alone. */
+static void opt_group(opt_ctx_t *ctx, SRA_t *project)
+{
+    SRA_t *select, *table;
+    chidb_table_stats_t *ts;
+    chidb_column_stats_t *cs;
+
+    if (project->project.group_by == NULL)
+    {
+        project->project.grouped = project->project.distinct && opt_ordered(ctx, project);
+        return;
+    }
+    if (project->project.group_by->next != NULL)
+        return;
+    cs = opt_indexedInput(ctx, project, project->project.group_by, &select, &table, &ts);
+    project->project.grouped = cs != NULL && opt_seeksIndex(ctx, select, table, cs);
+}
+
+/* Chooses how a UNION, INTERSECT or EXCEPT matches the rows of its
+ * inputs: by merging them, if both come ordered by their only column,
+ * which reads each input once and keeps a single group in memory, or
+ * else in a hash table of the rows of both */
+static void opt_setMethod(opt_ctx_t *ctx, SRA_t *sra)
+{
+    sra->binary.method = opt_ordered(ctx, sra->binary.sra1) && opt_ordered(ctx, sra->binary.sra2)
+                         ? SET_MERGE : SET_HASH;
+}
+
+/* Lets a projection of a lone COUNT(*), MIN or MAX of a whole table
+ * (without a WHERE or a GROUP BY) be answered from its B-Trees, without
+ * reading its rows. Whether the column of a MIN or MAX is the primary
+ * key, or has an index, is left to the code generator, which has the
+ * schema, and aggregates a scan of the table if it is neither. */
+static void opt_shortcut(SRA_t *project)
+{
+    Expression_t *expr = project->project.expr_list, *arg;
+    SRA_t *input = project->project.sra;
+    ColumnReference_t *ref;
+
+    if (expr == NULL || expr->next != NULL || project->project.group_by != NULL ||
+        expr->t != EXPR_TERM || expr->expr.term.t != TERM_FUNC)
+        return;
+
+    arg = expr->expr.term.f.expr;
+    if (input->t != SRA_TABLE || !opt_isColumn(arg))
+        return;
+    ref = arg->expr.term.ref;
+    if (ref->tableName != NULL && opt_findTable(input, ref->tableName) == NULL)
+        return;
+
+    if (strcmp(ref->columnName, "*") == 0)
+    {
+        if (expr->expr.term.f.t == FUNC_COUNT)
+            project->project.shortcut = SHORTCUT_COUNT;
+    }
+    else if (expr->expr.term.f.t == FUNC_MIN)
+        project->project.shortcut = SHORTCUT_MIN;
+    else if (expr->expr.term.f.t == FUNC_MAX)
+        project->project.shortcut = SHORTCUT_MAX;
+}
+
+/* Lets an aggregate of a scan of a whole table (a GROUP BY, aggregate
+ * functions, or a DISTINCT) read it on several threads, each with its
+ * own partial aggregates, when the table has enough leaves to split it
+ * into many ranges. Streaming aggregates and seeks through an index
+ * need their rows in order, and shortcuts don't read them at all. */
+static void opt_parallel(opt_ctx_t *ctx, SRA_t *project)
+{
+    SRA_t *input = project->project.sra;
+    chidb_table_stats_t *ts;
+    bool aggregate = project->project.group_by != NULL || project->project.distinct;
+
+    for (Expression_t *expr = project->project.expr_list; expr != NULL && !aggregate; expr = expr->next)
+        aggregate = expr->t == EXPR_TERM && expr->expr.term.t == TERM_FUNC;
+    if (!aggregate || project->project.grouped || project->project.shortcut != SHORTCUT_NONE)
+        return;
+
+    if (input->t == SRA_SELECT)
+    {
+        if (input->select.seek != NULL || input->select.seek_end != NULL || input->select.hash != NULL ||
+            input->select.probe != NULL)
+            return;
+        input = input->select.sra;
+    }
+    if (input->t != SRA_TABLE)
+        return;
+
+    ts = chidb_stats_table(ctx->db, input->table.ref->table_name);
+    project->project.parallel = ts != NULL && ts->nleaves >= OPT_PARALLEL_MIN_LEAVES;
+}
+
+/* Optimizes sra, and applies the conjuncts in conds to it (as low as
+ * possible). needed has the columns that are used above sra, or is NULL
+ * if they aren't known. conds is freed. */
+static SRA_t *opt_sra(opt_ctx_t *ctx, SRA_t *sra, Vector_t *conds, Vector_t *needed)
+{
+    Vector_t *used = NULL;
+    SRA_t *child;
+
+    switch (sra->t)
+    {
+    case SRA_SELECT:
+        conds = opt_conjuncts(ctx, sra->select.cond, conds);
+        child = sra->select.sra;
+        chisql_free(sra);
+        return opt_sra(ctx, child, conds, needed);
+    case SRA_PROJECT:
+        if (!opt_exprColumns(ctx, sra->project.expr_list, true, &used) ||
+            !opt_exprColumns(ctx, sra->project.order_by, true, &used) ||
+            !opt_exprColumns(ctx, sra->project.group_by, true, &used))
+        {
+            Vector_free(used);
+            used = NULL;
+        }
+        sra->project.sra = opt_sra(ctx, sra->project.sra, NULL, used);
+        Vector_free(used);
+        opt_order(ctx, sra);
+        opt_group(ctx, sra);
+        opt_shortcut(sra);
+        opt_parallel(ctx, sra);
+        return opt_select(ctx, sra, conds);
+    case SRA_TABLE:
+        return opt_select(ctx, sra, conds);
+    case SRA_JOIN:
+        if (opt_isInnerJoin(sra))
+            return opt_joins(ctx, sra, conds, needed);
+        return opt_join2(ctx, sra, conds, needed);
+    case SRA_NATURAL_JOIN:
+    case SRA_LEFT_OUTER_JOIN:
+    case SRA_RIGHT_OUTER_JOIN:
+    case SRA_FULL_OUTER_JOIN:
+        return opt_join2(ctx, sra, conds, needed);
+    default:
+        sra->binary.sra1 = opt_sra(ctx, sra->binary.sra1, NULL, NULL);
+        sra->binary.sra2 = opt_sra(ctx, sra->binary.sra2, NULL, NULL);
+        opt_setMethod(ctx, sra);
+        return opt_select(ctx, sra, conds);
+    }
+}
+
+
+int chidb_stmt_optimize(chidb *db, chisql_statement_t *sql_stmt, chisql_statement_t **sql_stmt_opt)
+{
+    opt_ctx_t ctx = {db, CHIDB_OK};
+    chisql_arena_t *prev;
 
     *sql_stmt_opt = malloc(sizeof(chisql_statement_t));
+    if (*sql_stmt_opt == NULL)
+        return CHIDB_ENOMEM;
     memcpy(*sql_stmt_opt, sql_stmt, sizeof(chisql_statement_t));
 
-    return CHIDB_OK;
-}
+    if (sql_stmt->type == STMT_SELECT)
+    {
+        prev = chisql_arena_use(sql_stmt->arena);
+        sql_stmt->stmt.select = chidb_exprc_fold(sql_stmt->stmt.select);
+        (*sql_stmt_opt)->stmt.select = opt_sra(&ctx, sql_stmt->stmt.select, NULL, NULL);
+        if (ctx.rc == CHIDB_OK)
+            ctx.rc = chidb_exprc_compile(db, (*sql_stmt_opt)->stmt.select);
+        chisql_arena_use(prev);
 
+        /* The nodes of the original tree are now in the optimized one */
+        sql_stmt->stmt.select = (*sql_stmt_opt)->stmt.select;
+    }
+
+    if (ctx.rc != CHIDB_OK)
+    {
+        free(*sql_stmt_opt);
+        *sql_stmt_opt = NULL;
+    }
+    return ctx.rc;
+}
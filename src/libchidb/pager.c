@@ -9,12 +9,126 @@
  * modify the page returned by the pager and instruct the pager to
  * write it back to disk.
  *
- * The default pager is very simple and always creates an in-memory copy
- * of any page that is read (even if that page has already been read before).
- * More specifically, pages are read into a MemPage structure, which must
- * be freed (using the releaseMemPage function) once they are not needed.
- * In a real database, the pager component typically does some caching
- * of pages to reduce the number of disk accesses.
+ * Pages are read into a MemPage structure, which must be released (using
+ * the releaseMemPage function) once they are not needed. MemPages live in
+ * a fixed-size buffer pool: reading a page that is already in the pool
+ * does not access the file, and simply "pins" the existing MemPage. Since
+ * the MemPage is shared, all the users of a page see the same in-memory
+ * copy. A page can't be evicted from the pool while it is pinned.
+ *
+ * Writing a page only marks it as dirty; dirty pages are written back to
+ * the file when they are evicted, when chidb_Pager_flush is called, or
+ * when the pager is closed. Eviction uses the CLOCK algorithm: each frame
+ * has a reference bit that is set whenever the page is read, and the
+ * clock hand skips (and clears) referenced frames before picking a victim.
+ *
+ * If every frame in the pool is pinned, the page is read into a MemPage
+ * allocated outside the pool, which is freed when it is released.
+ *
+ * Optionally, the pager can map the file into memory. Pages that are
+ * only going to be read (see chidb_Pager_readPageRO) are then not copied
+ * at all: the data field of the MemPage points straight into the mapping.
+ * If such a page is later read with chidb_Pager_readPage, it is first
+ * copied into the frame's own buffer (copy-on-write), since the mapping
+ * itself is read-only and changes are only written through writePage.
+ *
+ * All file accesses use pread/pwrite on a raw file descriptor, so there
+ * is no shared file position and no extra layer of stdio buffering. Page
+ * buffers are aligned to the page size, which allows the file to be
+ * opened with O_DIRECT (see chidb_Pager_open2) to bypass the OS page
+ * cache entirely.
+ *
+ * Sequential scans can hide the latency of reading pages by telling the
+ * pager which pages they will need next (chidb_Pager_prefetch). The pager
+ * passes this on to the OS (posix_fadvise/madvise), which reads the pages
+ * into its page cache in the background, so the readPage that follows
+ * doesn't block on the device.
+ *
+ * The pager keeps I/O statistics (pages and bytes read and written,
+ * cache hits and misses, syncs, and latency histograms; see chidb_stats
+ * in chidb.h) in its stats field. These are always collected, since
+ * they only cost a few increments and two clock_gettime calls (which
+ * don't enter the kernel on most platforms) per I/O operation.
+ *
+ * With PAGER_CHECKSUM, every page ends in a CRC32C checksum of the rest
+ * of the page (see chidb_Pager_setChecksum). The checksum is computed
+ * when a page is written to the file or the log, not when writePage
+ * marks it dirty, and verified when a page is brought into the buffer
+ * pool. It is cheap enough to leave on: with the CRC32C instructions
+ * (see crc32c.c) a 4 KiB page takes well under a microsecond.
+ *
+ * With PAGER_COMPRESS, pages are compressed when they are written to
+ * the file, into the first blocks of their slot, and the blocks left
+ * over are punched out of the file (see chidb_Pager_setCompression).
+ * Pages keep their offsets, so nothing else in the pager changes.
+ *
+ * If the pager is opened with PAGER_WAL, pages are never written to the
+ * database file directly. Instead, they are appended to a write-ahead log
+ * (see wal.c), and chidb_Pager_flush commits them. Reads consult the WAL
+ * index before falling back to the database file, and committed pages
+ * are copied back into the database file when the log is checkpointed.
+ *
+ * Between chidb_Pager_begin and chidb_Pager_commit, the pages modified
+ * by a transaction stay dirty in the buffer pool (eviction prefers clean
+ * frames while there are any), and are written once at commit, in page
+ * number order. When the pool does run out of clean frames, dirty pages
+ * are still written back early, but the transaction can be rolled back:
+ * with a log, they are appended as uncommitted frames, which a rollback
+ * forgets; without one, the original contents of every page that is
+ * overwritten in the database file are saved first in a rollback journal
+ * (the database file's name followed by "-journal"), which a rollback
+ * copies back. The journal is synced before the first of those pages is
+ * overwritten, and deleting it is what commits the transaction; a
+ * journal that is found when the database is opened belongs to a
+ * transaction that was interrupted, and is rolled back.
+ *
+ * A Pager can be shared by several threads. The buffer pool (and every
+ * function that reads, writes, allocates or releases pages) is protected
+ * by a mutex, which is held only while the pool is being updated, never
+ * while waiting on another thread. Each frame also has a reader/writer
+ * latch (see chidb_Pager_latchPage), which the pager itself never takes:
+ * it is up to the users of a page (in practice, the B-Tree module) to
+ * latch it before looking at or modifying its contents. Functions that
+ * change the shape of the pool (setPageSize, setCacheSize, setMmap,
+ * close) must not run concurrently with anything else.
+ *
+ * Readers can also skip the latch altogether: every frame has a version
+ * counter that is bumped when its exclusive latch is taken and again
+ * when it is released, so a reader that records the version before
+ * reading a page and finds it unchanged (and even) afterwards knows that
+ * nobody modified the page in between (see chidb_Pager_pageVersion).
+ *
+ * With a log, readers can also work on a snapshot of the database (see
+ * chidb_Pager_beginSnapshot), which neither waits for nor holds up the
+ * writers: a snapshot remembers the last frame committed to the log
+ * when it began, and a thread that uses it reads each page as of that
+ * frame (the most recent frame of the page up to it, or the database
+ * file if there is none). Those older versions of a page are kept in
+ * frames of their own, outside the pool, and chained to the same hash
+ * bucket as the current version (several snapshots share the frame of
+ * a version), and a version is dropped once no snapshot needs it. A
+ * checkpoint doesn't copy frames past the oldest snapshot into the
+ * database file, and the log is only reset when there are none.
+ *
+ * Several pagers, in the same process or in different ones, can have
+ * the same file open at once. They coordinate through its shared memory
+ * file (see shm.c), which holds the WAL index, and which they lock:
+ * only the pager that holds SHM_LOCK_WRITE modifies the database (it
+ * takes it before the first page it changes, or in chidb_Pager_beginWrite,
+ * and releases it once the changes are committed). Without a log,
+ * readers hold SHM_LOCK_DB in shared mode between chidb_Pager_beginRead
+ * and chidb_Pager_endRead, and the writer holds it exclusively from the
+ * first page it writes to the file until it commits; its rollback
+ * journal is only hot (left by a writer that is gone) if no pager holds
+ * SHM_LOCK_JOURNAL. With a log, readers never wait: each pager that
+ * reads holds one of the SHM_LOCK_READ locks, with a read mark, the
+ * oldest commit its readers and snapshots see, and checkpoints stop at
+ * the oldest read mark. Each pager keeps its own buffer pool: when it
+ * begins reading (or writing), it catches up with what the other pagers
+ * committed (a counter in the shared memory file tells it whether there
+ * is anything new), dropping the pages they changed from the pool. The
+ * pager's mutex is never held while waiting for SHM_LOCK_WRITE, since
+ * the pager that holds it may be waiting for this one's readers.
  *
  */
 
@@ -55,14 +169,88 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <chidb/log.h>
 
 #include "chidbInt.h"
 
 #include "pager.h"
+#include "util.h"
+#include "crc32c.h"
+#ifdef CHIDB_LZ4
+#include <lz4.h>
+#endif
+
+static int chidb_Pager_initCache(Pager *pager);
+static int chidb_Pager_freeCache(Pager *pager);
+static bool chidb_Pager_hasPinnedPages(Pager *pager);
+static int chidb_Pager_evictFrame(Pager *pager, MemPage **frame);
+static int chidb_Pager_readFrame(Pager *pager, npage_t npage, uint32_t max_frame, uint8_t *data, uint32_t *wal_frame);
+static int chidb_Pager_writeFrame(Pager *pager, MemPage *frame);
+static int chidb_Pager_remap(Pager *pager);
+static void chidb_Pager_unmap(Pager *pager);
+static size_t chidb_Pager_bufAlign(Pager *pager);
+static int chidb_Pager_verifyPage(Pager *pager, npage_t npage, const uint8_t *data);
+static void chidb_Pager_stampPage(Pager *pager, uint8_t *data);
+static uint32_t chidb_Pager_deflatePage(Pager *pager, const uint8_t *data);
+static int chidb_Pager_inflatePage(Pager *pager, npage_t npage, uint8_t *data);
+static int chidb_Pager_writeCompressed(Pager *pager, npage_t npage, uint32_t size);
+static int chidb_Pager_allocatePageLocked(Pager *pager, npage_t *npage);
+static int chidb_Pager_truncateLocked(Pager *pager, npage_t npages);
+static int chidb_Pager_readPageLocked(Pager *pager, npage_t npage, MemPage **page);
+static int chidb_Pager_readPageROLocked(Pager *pager, npage_t npage, MemPage **page);
+static int chidb_Pager_prefetchLocked(Pager *pager, const npage_t *npages, uint32_t n);
+static int chidb_Pager_writePageLocked(Pager *pager, MemPage *page);
+static int chidb_Pager_releaseMemPageLocked(Pager *pager, MemPage *page);
+static int chidb_Pager_flushLocked(Pager *pager);
+static MemPage *chidb_Pager_newFrame(Pager *pager);
+static void chidb_Pager_freeFrame(MemPage *frame);
+static int chidb_Pager_pwrite(int fd, const uint8_t *buf, size_t n, off_t offset);
+static int chidb_Pager_memWrite(Pager *pager, MemPage *frame);
+static void chidb_Pager_memTruncate(Pager *pager, npage_t npages);
+static void chidb_Pager_memEndTxn(Pager *pager, bool restore);
+static int chidb_Pager_fdatasync(Pager *pager, int fd);
+static int chidb_Pager_beginLocked(Pager *pager);
+static int chidb_Pager_commitLocked(Pager *pager);
+static int chidb_Pager_rollbackLocked(Pager *pager);
+static int chidb_Pager_journalPage(Pager *pager, npage_t npage);
+static int chidb_Pager_syncJournal(Pager *pager);
+static void chidb_Pager_closeJournal(Pager *pager, bool remove_file);
+static int chidb_Pager_playbackJournal(Pager *pager, int fd);
+static int chidb_Pager_recoverJournal(Pager *pager);
+static int chidb_Pager_checkpointLocked(Pager *pager);
+static uint32_t chidb_Pager_snapshotFrame(PagerSnapshot *snapshot, npage_t npage);
+static int chidb_Pager_readVersionLocked(Pager *pager, PagerSnapshot *snapshot, npage_t npage, MemPage **page);
+static bool chidb_Pager_versionNeeded(Pager *pager, MemPage *frame);
+static void chidb_Pager_dropVersion(Pager *pager, MemPage *frame);
+static bool chidb_Pager_hasDirtyPages(Pager *pager);
+static void chidb_Pager_dropPage(Pager *pager, MemPage *frame);
+static int chidb_Pager_refreshLocked(Pager *pager);
+static int chidb_Pager_lockWriter(Pager *pager);
+static void chidb_Pager_unlockWriter(Pager *pager);
+static int chidb_Pager_lockDb(Pager *pager, short type);
+static int chidb_Pager_holdReadMark(Pager *pager);
+static void chidb_Pager_releaseReadMark(Pager *pager);
+static int chidb_Pager_lockReaders(Pager *pager, short type);
+
+/* Times chidb_Pager_holdReadMark goes through the SHM_LOCK_READ locks
+ * before it gives up */
+#define PAGER_READ_TRIES (100)
+
+/* Slots in the array of page buffers of an in-memory database when the
+ * first page is written (it doubles every time it runs out) */
+#define PAGER_MEM_INITIAL (64)
+
+/* Snapshot that the pages read by this thread come from (see
+ * chidb_Pager_useSnapshot) */
+static __thread PagerSnapshot *current_snapshot = NULL;
 
 /* Open a file
  *
@@ -80,16 +268,192 @@
  */
 int chidb_Pager_open(Pager **pager, const char *filename)
 {
+    return chidb_Pager_open2(pager, filename, 0);
+}
+
+
+/* Open a file with flags
+ *
+ * Same as chidb_Pager_open, but allows the following flags to be
+ * specified (combined with bitwise OR):
+ *
+ * - PAGER_DIRECT: Open the file with O_DIRECT, so that pages are
+ *   transferred directly between the buffer pool and the device.
+ *   If the file system does not support O_DIRECT, the file is opened
+ *   normally.
+ * - PAGER_WAL: Use a write-ahead log. The log is opened (and, if
+ *   necessary, recovered) when the page size is set.
+ * - PAGER_MMAP: Enable memory-mapped reads (see chidb_Pager_setMmap).
+ * - PAGER_TEMP: Open a new scratch file, for data that doesn't outlive
+ *   the pager (such as ephemeral tables). filename is a template for
+ *   mkstemp (ending in XXXXXX), and the file is unlinked as soon as it
+ *   is created, so that it goes away even if the process doesn't close
+ *   it. Nothing is ever synced to it, and its dirty pages are dropped,
+ *   instead of written back, when the pager is closed. Since no other
+ *   pager can open it, it has no shared memory file.
+ * - PAGER_MEMORY: Don't open a file at all, and keep the pages in
+ *   memory, as an array of buffers that grows with the database
+ *   (filename is only used in messages). Writing a page back copies it
+ *   into its buffer, and nothing is ever synced. The rollback journal
+ *   is the old buffers of the pages written by the transaction. The
+ *   database goes away when the pager is closed, and no other pager can
+ *   open it, so it has no log (PAGER_WAL is ignored) and no shared
+ *   memory file.
+ *
+ * Parameters
+ * - pager: An out parameter. Used to return a pointer to the
+ *			 newly created Pager.
+ * - filename: Database file (might not exist)
+ * - flags: Zero or more PAGER_* flags
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_open2(Pager **pager, const char *filename, int flags)
+{
+    int oflags = O_RDWR | O_CREAT;
+
     *pager = malloc(sizeof(Pager));
-    if (pager == NULL)
+    if (*pager == NULL)
         return CHIDB_ENOMEM;
-    (*pager)->f = fopen(filename, "r+");
+    (*pager)->n_pages = 0;
+    (*pager)->page_size = 0;
+    (*pager)->frames = NULL;
+    (*pager)->frames_data = NULL;
+    (*pager)->cache_size = DEFAULT_CACHE_SIZE;
+    (*pager)->clock_hand = 0;
+    (*pager)->hash = NULL;
+    (*pager)->hash_mask = 0;
+    (*pager)->use_mmap = (flags & PAGER_MMAP) != 0;
+    (*pager)->map = NULL;
+    (*pager)->map_size = 0;
+    (*pager)->map_pins = 0;
+    (*pager)->flags = flags;
+    memset(&(*pager)->stats, 0, sizeof(chidb_stats));
+    memset(&(*pager)->trace, 0, sizeof(chidb_tracer));
+    (*pager)->zblock = PAGER_BUF_ALIGN;
+    (*pager)->zbuf = NULL;
+    (*pager)->zbuf_size = 0;
+    (*pager)->wal = NULL;
+    (*pager)->autocheckpoint = DEFAULT_WAL_AUTOCHECKPOINT;
+    (*pager)->snapshots = NULL;
+    (*pager)->nversions = 0;
+    (*pager)->shm = NULL;
+    (*pager)->nchanges = 0;
+    (*pager)->nreaders = 0;
+    (*pager)->nwriters = 0;
+    (*pager)->lock_waiters = 0;
+    (*pager)->write_locked = false;
+    (*pager)->db_lock = F_UNLCK;
+    (*pager)->read_slot = -1;
+    (*pager)->in_txn = false;
+    (*pager)->txn_pages = 0;
+    (*pager)->journal_name = NULL;
+    (*pager)->journal_fd = -1;
+    (*pager)->journal_size = 0;
+    (*pager)->journal_unsynced = false;
+    (*pager)->journaled = NULL;
+    (*pager)->journal_buf = NULL;
+    (*pager)->mem = NULL;
+    (*pager)->mem_pages = 0;
+    (*pager)->mem_alloc = 0;
+    (*pager)->mem_saved = NULL;
+    (*pager)->fd = -1;
+    (*pager)->filename = strdup(filename);
+    if ((*pager)->filename == NULL)
+    {
+        free(*pager);
+        return CHIDB_ENOMEM;
+    }
+
+    /* Recursive, since some locked functions call others */
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&(*pager)->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    if (flags & PAGER_MEMORY)
+    {
+        (*pager)->flags &= ~(PAGER_DIRECT | PAGER_WAL | PAGER_MMAP | PAGER_TEMP);
+        (*pager)->use_mmap = false;
+        return CHIDB_OK;
+    }
 
-    if ((*pager)->f == NULL)
-        (*pager)->f = fopen(filename, "w+");
+    if (flags & PAGER_TEMP)
+    {
+        (*pager)->flags &= ~(PAGER_DIRECT | PAGER_WAL);
+        (*pager)->fd = mkstemp((*pager)->filename);
+        if ((*pager)->fd != -1)
+        {
+            unlink((*pager)->filename);
+            return CHIDB_OK;
+        }
+        flags = (*pager)->flags;
+    }
 
-    if ((*pager)->f == NULL)
+#ifdef O_DIRECT
+    if (flags & PAGER_DIRECT)
+    {
+        (*pager)->fd = open(filename, oflags | O_DIRECT, 0644);
+        if ((*pager)->fd == -1 && errno == EINVAL)
+        {
+            chilog(WARNING, "O_DIRECT not supported for %s, using buffered I/O", filename);
+            (*pager)->flags &= ~PAGER_DIRECT;
+        }
+    }
+#else
+    (*pager)->flags &= ~PAGER_DIRECT;
+#endif
+
+    if (!(flags & PAGER_TEMP) && (*pager)->fd == -1)
+        (*pager)->fd = open(filename, oflags, 0644);
+
+    if ((*pager)->fd != -1 && asprintf(&(*pager)->journal_name, "%s-journal", filename) < 0)
+    {
+        close((*pager)->fd);
+        (*pager)->fd = -1;
+        (*pager)->journal_name = NULL;
+    }
+
+    if ((*pager)->fd != -1 && chidb_Shm_open(&(*pager)->shm, filename) != CHIDB_OK)
+    {
+        close((*pager)->fd);
+        (*pager)->fd = -1;
+        (*pager)->shm = NULL;
+    }
+
+    /* A transaction that was interrupted is rolled back before anything
+     * is read from the file */
+    if ((*pager)->fd != -1)
+    {
+        int rc = chidb_Pager_lockDb(*pager, F_RDLCK);
+
+        if (rc == CHIDB_OK)
+            rc = chidb_Pager_recoverJournal(*pager);
+        if (rc == CHIDB_OK)
+            rc = chidb_Pager_lockDb(*pager, F_UNLCK);
+        if (rc != CHIDB_OK)
+        {
+            chidb_Shm_close((*pager)->shm, false);
+            close((*pager)->fd);
+            (*pager)->fd = -1;
+        }
+        else
+            (*pager)->nchanges = __atomic_load_n(&(*pager)->shm->header->nchanges, __ATOMIC_ACQUIRE);
+    }
+
+    if ((*pager)->fd == -1)
+    {
+        pthread_mutex_destroy(&(*pager)->lock);
+        free((*pager)->journal_name);
+        free((*pager)->filename);
+        free(*pager);
+        *pager = NULL;
         return CHIDB_EIO;
+    }
     else
         return CHIDB_OK;
 }
@@ -109,15 +473,200 @@ int chidb_Pager_open(Pager **pager, const char *filename)
  * Return
  * - CHIDB_OK: Operation successful
  */
-int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize)
+int chidb_Pager_setPageSize(Pager *pager, uint32_t pagesize)
 {
+    /* The frames are sized for the old page size */
+    if (pager->frames != NULL && pager->page_size != pagesize)
+    {
+        int rc;
+
+        if (chidb_Pager_hasPinnedPages(pager))
+            return CHIDB_EMISUSE;
+
+        rc = chidb_Pager_freeCache(pager);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    /* The log is specific to a page size */
+    if ((pager->flags & PAGER_WAL) && pager->wal != NULL && pager->page_size != pagesize)
+    {
+        int rc = chidb_Pager_checkpoint(pager);
+        if (rc != CHIDB_OK)
+            return rc;
+        chidb_Wal_close(pager->wal, pager->wal->max_frame == 0 && chidb_Shm_isLast(pager->shm));
+        chidb_Shm_lock(pager->shm, SHM_LOCK_DMS, 1, F_RDLCK, false);
+        pager->wal = NULL;
+    }
+
     pager->page_size = pagesize;
+
+    if ((pager->flags & PAGER_WAL) && pager->wal == NULL)
+    {
+        int rc = chidb_Wal_open(&pager->wal, pager->filename, pagesize, pager->shm);
+        if (rc != CHIDB_OK)
+            return rc;
+        pager->wal->stats = &pager->stats;
+        pager->wal->trace = &pager->trace;
+    }
+
     chidb_Pager_getRealDBSize(pager, &pager->n_pages);
 
     return CHIDB_OK;
 }
 
 
+/* Set the size of the buffer pool
+ *
+ * Frames are allocated the first time a page is read, so this function
+ * is cheap to call right after opening the pager. If the buffer pool has
+ * already been allocated, all dirty pages are written back to the file
+ * and the pool is reallocated with the new size.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npages: Number of pages the buffer pool can hold.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: A page is still pinned, or npages is zero
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_setCacheSize(Pager *pager, uint32_t npages)
+{
+    if (npages == 0)
+        return CHIDB_EMISUSE;
+
+    if (pager->frames != NULL)
+    {
+        int rc;
+
+        if (chidb_Pager_hasPinnedPages(pager))
+            return CHIDB_EMISUSE;
+
+        rc = chidb_Pager_freeCache(pager);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    pager->cache_size = npages;
+
+    return CHIDB_OK;
+}
+
+
+/* Enable or disable page checksums
+ *
+ * When checksums are enabled, the last PAGER_CHECKSUM_SIZE bytes of
+ * every page hold the CRC32C of the rest of the page. The checksum is
+ * computed when the page is written to the file (or to the log), and
+ * verified whenever the page is read back from it, so users of the
+ * pager must leave those bytes alone: only the first
+ * chidb_Pager_usableSize bytes of a page are available to them.
+ *
+ * Whether a file has checksums is not known to the pager (the B-Tree
+ * module records this in the file header), so this must be set before
+ * reading any page of the file. Pages that were allocated but never
+ * written (all zeroes, including the trailer) are not considered
+ * corrupted.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - enable: Whether to compute and verify checksums
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_setChecksum(Pager *pager, bool enable)
+{
+    if (enable)
+        pager->flags |= PAGER_CHECKSUM;
+    else
+        pager->flags &= ~PAGER_CHECKSUM;
+
+    return CHIDB_OK;
+}
+
+
+/* Enable or disable page compression
+ *
+ * With compression, a page that is written to the file is compressed
+ * with LZ4, if that frees at least one block of the file system. The
+ * page's slot in the file then starts with a header (see
+ * PAGER_COMPRESSED_MAGIC) and the compressed page, and the blocks after
+ * them are deallocated (punched out of the file), so they take no space
+ * on disk and cost no I/O to read. Pages keep their offsets in the file,
+ * so the journal, prefetching and the rest of the pager are unaffected,
+ * and a file can mix compressed pages with pages that were not worth
+ * compressing. Pages are decompressed when they are read from the file,
+ * before their checksum is verified.
+ *
+ * This only pays off with pages of at least two blocks of the file
+ * system (8 KiB, usually). Page 1 is never compressed, since its header
+ * is read directly from the file. Memory-mapped reads, which would see
+ * the compressed pages, are disabled. Pages that are written to the
+ * write-ahead log, and copied from there to the file by a checkpoint,
+ * are not compressed.
+ *
+ * Whether a file has compressed pages is not known to the pager (the
+ * B-Tree module records this in the file header), so this must be set
+ * before reading any page of the file.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - enable: Whether to compress pages
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: chidb was built without LZ4, or a page is still
+ *   pinned (in the memory mapping)
+ */
+int chidb_Pager_setCompression(Pager *pager, bool enable)
+{
+    if (!enable)
+    {
+        pager->flags &= ~PAGER_COMPRESS;
+        return CHIDB_OK;
+    }
+
+#ifdef CHIDB_LZ4
+    struct stat st;
+
+    if (chidb_Pager_setMmap(pager, false) != CHIDB_OK)
+        return CHIDB_EMISUSE;
+
+    /* There is no file to compress */
+    if (pager->flags & PAGER_MEMORY)
+        return CHIDB_OK;
+
+    pager->flags |= PAGER_COMPRESS;
+    if (fstat(pager->fd, &st) == 0 && st.st_blksize >= PAGER_COMPRESSED_HEADER_SIZE)
+        pager->zblock = st.st_blksize;
+
+    return CHIDB_OK;
+#else
+    return CHIDB_EMISUSE;
+#endif
+}
+
+
+/* Number of bytes of each page available to users of the pager
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - The page size, minus the checksum trailer if checksums are enabled
+ */
+uint32_t chidb_Pager_usableSize(Pager *pager)
+{
+    if (pager->flags & PAGER_CHECKSUM)
+        return pager->page_size - PAGER_CHECKSUM_SIZE;
+    else
+        return pager->page_size;
+}
+
+
 /* Read the chidb file header
  *
  * This function reads in the header of a chidb file and returns it
@@ -135,10 +684,49 @@ int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize)
  */
 int chidb_Pager_readHeader(Pager *pager, uint8_t *header)
 {
-    int count;
-    count = fseek(pager->f, 0, SEEK_SET);
-    count = fread(header, 1, 100, pager->f);
-    if (count != 100)
+    uint8_t *buf;
+    ssize_t count;
+
+    /* The most recent version of page 1 (or the one the snapshot of
+     * this thread sees) may be in the log */
+    if (pager->wal != NULL && pager->wal->n_frames > 0)
+    {
+        uint32_t frame, max_frame = pager->wal->n_frames;
+
+        if (current_snapshot != NULL && current_snapshot->pager == pager)
+            max_frame = current_snapshot->horizon;
+
+        if (chidb_Wal_findFrame(pager->wal, 1, max_frame, &frame) == CHIDB_OK)
+        {
+            buf = malloc(pager->page_size);
+            if (buf == NULL)
+                return CHIDB_ENOMEM;
+            count = chidb_Wal_readFrame(pager->wal, frame, buf) == CHIDB_OK ? pager->page_size : 0;
+            if (count >= 100)
+                memcpy(header, buf, 100);
+            free(buf);
+            return count >= 100 ? CHIDB_OK : CHIDB_NOHEADER;
+        }
+    }
+
+    if (pager->flags & PAGER_MEMORY)
+    {
+        if (pager->mem_pages == 0 || pager->mem[0] == NULL)
+            return CHIDB_NOHEADER;
+        memcpy(header, pager->mem[0], 100);
+        return CHIDB_OK;
+    }
+
+    /* With O_DIRECT, we can only read whole blocks into aligned memory */
+    if (posix_memalign((void **) &buf, PAGER_BUF_ALIGN, PAGER_BUF_ALIGN) != 0)
+        return CHIDB_ENOMEM;
+
+    count = pread(pager->fd, buf, PAGER_BUF_ALIGN, 0);
+    if (count >= 100)
+        memcpy(header, buf, 100);
+    free(buf);
+
+    if (count < 100)
         return CHIDB_NOHEADER;
     else
         return CHIDB_OK;
@@ -157,27 +745,62 @@ int chidb_Pager_readHeader(Pager *pager, uint8_t *header)
  */
 int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
 {
-    /* We simply increment the page number counter. readPage
-     * and writePage take care of the rest. */
-    *npage = ++pager->n_pages;
+    int rc;
 
-    return CHIDB_OK;
+    pthread_mutex_lock(&pager->lock);
+    rc = chidb_Pager_allocatePageLocked(pager, npage);
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* Shrink the file
+ *
+ * Removes all the pages after page npages from the file. Pages that are
+ * removed are discarded from the buffer pool, even if they are dirty.
+ * If npages is not smaller than the current number of pages, this
+ * function does nothing.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npages: New number of pages in the file.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: One of the pages to be removed is pinned (or, with
+ *                  memory-mapped reads, any mapped page is pinned)
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_truncate(Pager *pager, npage_t npages)
+{
+    int rc;
+
+    pthread_mutex_lock(&pager->lock);
+    rc = chidb_Pager_truncateLocked(pager, npages);
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
 }
 
 
 /* Read a page from file
  *
- * This page reads a page from the file, and creates an in-memory copy
- * in a MemPage struct (see header file for more details on this struct).
- * Always use chidb_Pager_releaseMemPage to free the memory allocated for
- * a MemPage created by this function.
- * Any changes done to a MemPage will not be effective until you call
+ * This function returns an in-memory copy of a page in a MemPage struct
+ * (see header file for more details on this struct). If the page is
+ * already in the buffer pool, the file is not accessed. Otherwise, a
+ * frame is evicted to make room for it (see the comments at the top
+ * of this file).
+ * Always use chidb_Pager_releaseMemPage to release a MemPage returned
+ * by this function.
+ * Changes done to a MemPage are visible to every user of that page,
+ * but will not be effective in the file until you call
  * chidb_Pager_writePage with that MemPage.
  *
  * Parameters
  * - pager: A Pager.
  * - npage: Page number of page to read.
- * - page: Out parameter. Used to return a pointer to newly created MemPage
+ * - page: Out parameter. Used to return a pointer to the MemPage
  *
  * Return
  * - CHIDB_OK: Operation successful
@@ -186,52 +809,251 @@ int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
  */
 int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
 {
-    if (npage > pager->n_pages || npage <= 0)
-        return CHIDB_EPAGENO;
-    int n;
+    int rc;
 
-    *page = malloc(sizeof(MemPage));
-    if (page == NULL)
-        return CHIDB_ENOMEM;
-    (*page)->npage = npage;
-    (*page)->data = calloc(pager->page_size, 1);
-    if ((*page)->data == NULL)
-        return CHIDB_ENOMEM;
-    fseek(pager->f, (npage - 1) * pager->page_size, SEEK_SET);
-    n = fread((*page)->data, 1, pager->page_size, pager->f);
-    chilog(TRACE, "Read %i bytes from page %i into memory [%x data: %x]", n, npage, *page, (*page)->data);
+    pthread_mutex_lock(&pager->lock);
+    rc = chidb_Pager_readPageLocked(pager, npage, page);
+    pthread_mutex_unlock(&pager->lock);
 
-    return CHIDB_OK;
+    return rc;
 }
 
 
-/* Write a page to file
+/* Read a page that will not be modified
  *
- * This page writes the in-memory copy of a page (stored in a MemPage
- * struct) back to disk.
+ * Same as chidb_Pager_readPage, but the caller promises not to modify
+ * the page (and not to call chidb_Pager_writePage on it). This allows
+ * the pager, if memory-mapped I/O has been enabled with
+ * chidb_Pager_setMmap, to return a MemPage whose data points directly
+ * into the mapping of the file, without copying the page. The mapping
+ * is extended as needed when the file grows. If memory-mapped I/O is
+ * not enabled, this function is equivalent to chidb_Pager_readPage.
  *
  * Parameters
  * - pager: A Pager.
- * - page: In-memory copy of page to write
+ * - npage: Page number of page to read.
+ * - page: Out parameter. Used to return a pointer to the MemPage
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EPAGENO: The page has an incorrect page number
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int	chidb_Pager_writePage(Pager *pager, MemPage *page)
+int chidb_Pager_readPageRO(Pager *pager, npage_t npage, MemPage **page)
 {
-    if (page->npage > pager->n_pages)
+    int rc;
+
+    pthread_mutex_lock(&pager->lock);
+    rc = chidb_Pager_readPageROLocked(pager, npage, page);
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* Start reading pages in the background
+ *
+ * Hints that the given pages will be read soon. This function does not
+ * wait for the pages to be read, and it doesn't read them into the
+ * buffer pool; instead, it issues asynchronous read-ahead so that a
+ * subsequent chidb_Pager_readPage on those pages finds them in the OS
+ * page cache. Pages that are already in the buffer pool, and invalid
+ * page numbers, are ignored.
+ *
+ * Since O_DIRECT bypasses the OS page cache, this is a no-op if the
+ * pager was opened with PAGER_DIRECT.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npages: Array of page numbers
+ * - n: Number of page numbers in npages
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_prefetch(Pager *pager, const npage_t *npages, uint32_t n)
+{
+    int rc;
+
+    pthread_mutex_lock(&pager->lock);
+    rc = chidb_Pager_prefetchLocked(pager, npages, n);
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* Read consecutive pages without the buffer pool
+ *
+ * Copies n pages, starting with page first, into buf, as they were
+ * last written back (or, for a thread that uses a snapshot, see
+ * chidb_Pager_useSnapshot, as of the snapshot). The whole run is read
+ * from the file with a single system call, and then the pages that have
+ * a newer version in the write-ahead log are read from it. The pages
+ * are not kept in the buffer pool, so that reading the whole file (to
+ * back it up, for instance) doesn't evict the pages that are being
+ * used. Dirty pages in the pool are not read.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - first: Number of the first page
+ * - n: Number of pages
+ * - buf: At least n times the page size bytes, aligned to
+ *        PAGER_BUF_ALIGN if the pager was opened with PAGER_DIRECT
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: Some of the pages are past the end of the database
+ * - CHIDB_ECORRUPT: The checksum of a page doesn't match its contents
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_readPages(Pager *pager, npage_t first, npage_t n, uint8_t *buf)
+{
+    size_t length = (size_t) n * pager->page_size, done = 0;
+    off_t offset = (off_t) (first - 1) * pager->page_size;
+    npage_t n_pages = pager->n_pages;
+    uint32_t max_frame = 0, frame;
+    uint64_t start;
+    int rc = CHIDB_OK;
+
+    pthread_mutex_lock(&pager->lock);
+
+    if (current_snapshot != NULL && current_snapshot->pager == pager)
+    {
+        max_frame = current_snapshot->horizon;
+        n_pages = current_snapshot->n_pages;
+    }
+    else if (pager->wal != NULL)
+        max_frame = pager->wal->max_frame;
+
+    if (first == 0 || n > n_pages || first > n_pages - n + 1)
+    {
+        pthread_mutex_unlock(&pager->lock);
         return CHIDB_EPAGENO;
-    int n;
-    fseek(pager->f, (page->npage - 1) * pager->page_size, SEEK_SET);
-    n = fwrite(page->data, 1, pager->page_size, pager->f);
-    chilog(TRACE, "Wrote %i bytes to page %i", n, page->npage);
+    }
+
+    if (pager->flags & PAGER_MEMORY)
+    {
+        for (npage_t i = 0; i < n; i++)
+            if (first + i <= pager->mem_pages && pager->mem[first + i - 1] != NULL)
+                memcpy(buf + (size_t) i * pager->page_size, pager->mem[first + i - 1], pager->page_size);
+            else
+                memset(buf + (size_t) i * pager->page_size, 0, pager->page_size);
+        done = length;
+    }
+    else if (pager->map != NULL && (size_t) offset + length <= pager->map_size)
+    {
+        memcpy(buf, pager->map + offset, length);
+        done = length;
+    }
+    else
+    {
+        /* A short read means we've hit the end of the file */
+        start = chidb_time_ns();
+        while (done < length)
+        {
+            ssize_t count = pread(pager->fd, buf + done, length - done, offset + done);
+
+            if (count == -1 && errno == EINTR)
+                continue;
+            if (count == -1)
+            {
+                pthread_mutex_unlock(&pager->lock);
+                return CHIDB_EIO;
+            }
+            if (count == 0)
+                break;
+            done += count;
+        }
+        chidb_histogram_add(&pager->stats.read_latency, chidb_time_ns() - start);
+        memset(buf + done, 0, length - done);
+        if (CHIDB_TRACING(&pager->trace, CHIDB_TRACE_PAGE_READ))
+        {
+            chidb_trace_event ev = {.type = CHIDB_TRACE_PAGE_READ, .phase = CHIDB_TRACE_END,
+                                    .npage = first, .bytes = done};
+            chidb_trace_emit(&pager->trace, &ev, start);
+        }
+    }
+    pager->stats.pages_read += n;
+    pager->stats.bytes_read += done;
+
+    for (npage_t i = 0; rc == CHIDB_OK && i < n; i++)
+    {
+        uint8_t *data = buf + (size_t) i * pager->page_size;
+
+        if (max_frame > 0 && chidb_Wal_findFrame(pager->wal, first + i, max_frame, &frame) == CHIDB_OK)
+            rc = chidb_Wal_readFrame(pager->wal, frame, data);
+        else if (pager->flags & PAGER_COMPRESS)
+            rc = chidb_Pager_inflatePage(pager, first + i, data);
+        if (rc == CHIDB_OK)
+            rc = chidb_Pager_verifyPage(pager, first + i, data);
+    }
+
+    pthread_mutex_unlock(&pager->lock);
+    chilog(TRACE, "Read pages %i-%i without the buffer pool", first, first + n - 1);
+
+    return rc;
+}
+
+
+/* Count the changes to the database
+ *
+ * Returns a number that changes every time a change to the database is
+ * committed, by this pager or others of the same file (or, in memory,
+ * every time a page is written back), so that comparing it with an
+ * earlier value tells whether the database changed in between.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - The current value of the counter
+ */
+uint32_t chidb_Pager_changes(Pager *pager)
+{
+    if (pager->shm != NULL)
+        return __atomic_load_n(&pager->shm->header->nchanges, __ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&pager->nchanges, __ATOMIC_ACQUIRE);
+}
+
+
+/* Enable or disable memory-mapped reads
+ *
+ * See chidb_Pager_readPageRO. The file is mapped lazily, the first
+ * time a page is read through the mapping.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - enable: Whether or not to use memory-mapped reads
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: A page is still pinned
+ */
+int chidb_Pager_setMmap(Pager *pager, bool enable)
+{
+    if (!enable && pager->map != NULL)
+    {
+        if (chidb_Pager_hasPinnedPages(pager))
+            return CHIDB_EMISUSE;
+        chidb_Pager_unmap(pager);
+    }
+
+    /* There is no file to map */
+    pager->use_mmap = enable && !(pager->flags & (PAGER_MEMORY | PAGER_COMPRESS));
+
     return CHIDB_OK;
 }
 
 
-/* Release an in-memory copy of a page
+/* Write a page to file
+ *
+ * This function tells the pager that the in-memory copy of a page
+ * (stored in a MemPage struct) must be written back to disk. Pages in
+ * the buffer pool are only marked as dirty, and are actually written
+ * to the file when they are evicted or flushed.
  *
  * Parameters
  * - pager: A Pager.
@@ -240,52 +1062,2722 @@ int	chidb_Pager_writePage(Pager *pager, MemPage *page)
  * Return
  * - CHIDB_OK: Operation successful
  * - CHIDB_EPAGENO: The page has an incorrect page number
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int	chidb_Pager_releaseMemPage(Pager *pager, MemPage *page)
+int	chidb_Pager_writePage(Pager *pager, MemPage *page)
 {
-    if (page->npage > pager->n_pages)
-        return CHIDB_EPAGENO;
+    int rc;
 
-    chilog(TRACE, "Releasing page %i from memory [%x data: %x]", page->npage, page, page->data);
-    free(page->data);
-    free(page);
+    pthread_mutex_lock(&pager->lock);
+    rc = chidb_Pager_writePageLocked(pager, page);
+    pthread_mutex_unlock(&pager->lock);
 
-    return CHIDB_OK;
+    return rc;
 }
 
 
-/* Computes the number of pages in a file.
+/* Latch a page
+ *
+ * Acquires the reader/writer latch of a pinned page: a shared latch
+ * (several threads can hold it at once) to read the page, or an
+ * exclusive latch to modify it. This blocks until the latch is
+ * available. The latch belongs to the page, so all the threads that
+ * have the page pinned see the same latch, but it is not recursive: a
+ * thread that already holds the latch must not ask for it again.
+ *
+ * The pager's lock is not taken, so latching never blocks other
+ * threads' access to the buffer pool.
  *
  * Parameters
  * - pager: A Pager.
- * - npages: Out parameter. Number of pages.
+ * - page: A page returned by chidb_Pager_readPage (and not released)
+ * - exclusive: Whether to acquire the latch in exclusive mode
  *
  * Return
  * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The latch could not be acquired (e.g., the calling
+ *                  thread already holds it)
  */
-int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
+int chidb_Pager_latchPage(Pager *pager, MemPage *page, bool exclusive)
 {
-    struct stat buf;
-    fstat(fileno(pager->f), &buf);
-    *npages = buf.st_size / pager->page_size;
+    int err;
+
+    if (exclusive)
+        err = pthread_rwlock_wrlock(&page->latch);
+    else
+        err = pthread_rwlock_rdlock(&page->latch);
+
+    if (err != 0)
+        return CHIDB_EMISUSE;
+
+    if (exclusive)
+    {
+        /* Readers that see an odd version know the page may be in flux */
+        page->exclusive = true;
+        __atomic_store_n(&page->version, page->version + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
 
     return CHIDB_OK;
 }
 
 
-/* Closes a pager and frees up all resources used by the pager.
+/* Release the latch of a page
+ *
+ * Releases a latch acquired with chidb_Pager_latchPage. This must be
+ * done before the page is released.
  *
  * Parameters
  * - pager: A Pager.
+ * - page: A latched page
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_EMISUSE: The calling thread does not hold the latch
  */
-int chidb_Pager_close(Pager *pager)
+int chidb_Pager_unlatchPage(Pager *pager, MemPage *page)
 {
-    fclose(pager->f);
-    free(pager);
+    if (page->exclusive)
+    {
+        page->exclusive = false;
+        __atomic_store_n(&page->version, page->version + 1, __ATOMIC_RELEASE);
+    }
 
-    return CHIDB_OK;
+    return pthread_rwlock_unlock(&page->latch) == 0 ? CHIDB_OK : CHIDB_EMISUSE;
+}
+
+
+/* Get the version of a page
+ *
+ * Returns the version counter of a pinned page, for a reader that
+ * wants to look at the page without latching it. The reader must check
+ * with chidb_Pager_validatePage, after reading the page and before
+ * trusting anything it read, that the version hasn't changed. If it
+ * has, or if the version returned here is odd (a thread holds the
+ * page's exclusive latch), the page may have been modified while it
+ * was read, and the reader has to start over.
+ *
+ * Until it is validated, what the reader sees may be inconsistent, so
+ * it must not follow pointers read from the page without checking them
+ * first (cell offsets can be followed up to PAGER_POOL_SLACK bytes past
+ * the start of a page in the buffer pool). Pages that are not in the
+ * buffer pool (e.g., mapped pages) don't have that slack.
+ *
+ * Parameters
+ * - page: A page returned by chidb_Pager_readPage (and not released)
+ *
+ * Return
+ * - The page's version
+ */
+uint32_t chidb_Pager_pageVersion(MemPage *page)
+{
+    return __atomic_load_n(&page->version, __ATOMIC_ACQUIRE);
+}
+
+
+/* Validate the version of a page
+ *
+ * Checks that a page hasn't been latched in exclusive mode since
+ * chidb_Pager_pageVersion returned version.
+ *
+ * Parameters
+ * - page: A page returned by chidb_Pager_readPage (and not released)
+ * - version: Version returned by chidb_Pager_pageVersion
+ *
+ * Return
+ * - true if whatever was read from the page since then is consistent
+ */
+bool chidb_Pager_validatePage(MemPage *page, uint32_t version)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return (version & 1) == 0 && __atomic_load_n(&page->version, __ATOMIC_RELAXED) == version;
+}
+
+
+/* Lock the pager
+ *
+ * Acquires the pager's lock, which is what makes the other Pager
+ * functions thread-safe. Since the lock is recursive, a thread that
+ * holds it can still call them. This is for operations on several
+ * pages that must look atomic to other threads but that don't fit the
+ * latches of a B-Tree (e.g., changes to the freelist). Waiting for a
+ * page latch while holding the lock is not allowed.
+ *
+ * Parameters
+ * - pager: A Pager.
+ */
+void chidb_Pager_lock(Pager *pager)
+{
+    pthread_mutex_lock(&pager->lock);
+}
+
+
+/* Unlock the pager
+ *
+ * Releases the lock acquired with chidb_Pager_lock.
+ *
+ * Parameters
+ * - pager: A Pager.
+ */
+void chidb_Pager_unlock(Pager *pager)
+{
+    pthread_mutex_unlock(&pager->lock);
+}
+
+
+/* Release an in-memory copy of a page
+ *
+ * Unpins a page returned by chidb_Pager_readPage. The page
+ * stays in the buffer pool until it is evicted.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - page: In-memory copy of page to release
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page has an incorrect page number
+ */
+int	chidb_Pager_releaseMemPage(Pager *pager, MemPage *page)
+{
+    int rc;
+
+    pthread_mutex_lock(&pager->lock);
+    rc = chidb_Pager_releaseMemPageLocked(pager, page);
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* Write all dirty pages to the file
+ *
+ * If the pager uses a write-ahead log, the dirty pages are appended to
+ * the log instead, and all the pages written to the log since the last
+ * call to this function are committed.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_flush(Pager *pager)
+{
+    int rc;
+
+    pthread_mutex_lock(&pager->lock);
+    rc = chidb_Pager_flushLocked(pager);
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* Begin a transaction
+ *
+ * Until chidb_Pager_commit or chidb_Pager_rollback, the pages written
+ * with chidb_Pager_writePage are kept in the buffer pool, as far as it
+ * has room for them, instead of being written back whenever a frame is
+ * needed (see the comments at the top of this file). The pages that the
+ * previous writes left dirty are flushed first, so that they are not
+ * part of the transaction.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: A transaction is already in progress
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_begin(Pager *pager)
+{
+    int rc;
+
+    pthread_mutex_lock(&pager->lock);
+    rc = chidb_Pager_beginLocked(pager);
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* Commit a transaction
+ *
+ * Writes the dirty pages to the file (or to the log, where the last one
+ * is the commit frame) in page number order. Without a log, the file is
+ * then synced and the rollback journal deleted. If this fails, the
+ * transaction is still in progress, and can be rolled back.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: No transaction is in progress
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_commit(Pager *pager)
+{
+    int rc;
+
+    pthread_mutex_lock(&pager->lock);
+    rc = chidb_Pager_commitLocked(pager);
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* Roll back a transaction
+ *
+ * Discards every page in the buffer pool, forgets the frames that the
+ * transaction appended to the log or copies the pages saved in the
+ * rollback journal back into the file, and restores the number of pages
+ * the file had when the transaction began.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: No transaction is in progress, or a page is pinned
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_rollback(Pager *pager)
+{
+    int rc;
+
+    pthread_mutex_lock(&pager->lock);
+    rc = chidb_Pager_rollbackLocked(pager);
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* Returns true between chidb_Pager_begin and the end of the transaction */
+bool chidb_Pager_inTransaction(Pager *pager)
+{
+    return pager->in_txn;
+}
+
+
+/* Begin reading
+ *
+ * Tells the pager that pages are about to be read, until the matching
+ * chidb_Pager_endRead (calls can be nested, and made by several
+ * threads). Other pagers of the same file, in this process or others,
+ * can't change the pages read in between: without a write-ahead log,
+ * a pager that is writing the file is waited for (and a rollback
+ * journal it left behind, if it is gone, rolled back), and it waits
+ * for the readers; with one, readers don't wait for anybody, and keep
+ * reading as of the last commit they saw until the last of them ends.
+ * The first reader catches up with the changes that other pagers
+ * committed since the last one.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EBUSY: Too many other pagers are reading the log
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_beginRead(Pager *pager)
+{
+    int rc = CHIDB_OK;
+
+    pthread_mutex_lock(&pager->lock);
+
+    if (pager->shm != NULL && pager->nreaders == 0)
+    {
+        if (pager->wal != NULL)
+            rc = chidb_Pager_holdReadMark(pager);
+        else
+        {
+            if (pager->db_lock == F_UNLCK)
+                rc = chidb_Pager_lockDb(pager, F_RDLCK);
+            if (rc == CHIDB_OK)
+                rc = chidb_Pager_recoverJournal(pager);
+            if (rc == CHIDB_OK && !pager->write_locked)
+                rc = chidb_Pager_refreshLocked(pager);
+            if (rc != CHIDB_OK && pager->db_lock == F_RDLCK)
+                chidb_Pager_lockDb(pager, F_UNLCK);
+        }
+    }
+    if (rc == CHIDB_OK)
+        pager->nreaders++;
+
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* End reading (see chidb_Pager_beginRead)
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no chidb_Pager_beginRead to end
+ */
+int chidb_Pager_endRead(Pager *pager)
+{
+    pthread_mutex_lock(&pager->lock);
+
+    if (pager->nreaders == 0)
+    {
+        pthread_mutex_unlock(&pager->lock);
+        return CHIDB_EMISUSE;
+    }
+
+    if (--pager->nreaders == 0)
+    {
+        if (pager->snapshots == NULL)
+            chidb_Pager_releaseReadMark(pager);
+        if (pager->db_lock == F_RDLCK)
+            chidb_Pager_lockDb(pager, F_UNLCK);
+    }
+
+    pthread_mutex_unlock(&pager->lock);
+
+    return CHIDB_OK;
+}
+
+
+/* Begin writing
+ *
+ * Waits until no other pager of the same file (in this process or
+ * others) is modifying it, and keeps the others from modifying it
+ * until the matching chidb_Pager_endWrite, and the changes made in
+ * between are committed (calls can be nested, and made by several
+ * threads). This pager then catches up with the changes the others
+ * committed. Pages can also be written without calling this function,
+ * but then, writing fails if another pager is modifying the file, or
+ * modified it since this one last caught up.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_beginWrite(Pager *pager)
+{
+    int rc = CHIDB_OK;
+
+    pthread_mutex_lock(&pager->lock);
+
+    if (pager->shm != NULL && !pager->write_locked)
+    {
+        /* Not while holding the mutex: the pager that holds the lock
+         * may be waiting for this one's readers to finish */
+        pager->lock_waiters++;
+        pthread_mutex_unlock(&pager->lock);
+        rc = chidb_Shm_lock(pager->shm, SHM_LOCK_WRITE, 1, F_WRLCK, true);
+        pthread_mutex_lock(&pager->lock);
+        pager->lock_waiters--;
+
+        if (rc == CHIDB_OK && !pager->write_locked)
+        {
+            pager->write_locked = true;
+            rc = chidb_Pager_refreshLocked(pager);
+            if (rc != CHIDB_OK)
+                chidb_Pager_unlockWriter(pager);
+        }
+    }
+    if (rc == CHIDB_OK)
+        pager->nwriters++;
+
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* End writing (see chidb_Pager_beginWrite)
+ *
+ * Other pagers can modify the file again once this pager's changes are
+ * committed (right away, if there are none).
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no chidb_Pager_beginWrite to end
+ */
+int chidb_Pager_endWrite(Pager *pager)
+{
+    pthread_mutex_lock(&pager->lock);
+
+    if (pager->nwriters == 0)
+    {
+        pthread_mutex_unlock(&pager->lock);
+        return CHIDB_EMISUSE;
+    }
+
+    pager->nwriters--;
+    chidb_Pager_unlockWriter(pager);
+
+    pthread_mutex_unlock(&pager->lock);
+
+    return CHIDB_OK;
+}
+
+
+/* Begin a read snapshot
+ *
+ * Takes a snapshot of the pages committed to the write-ahead log so
+ * far. A thread that uses the snapshot (see chidb_Pager_useSnapshot)
+ * keeps reading the pages as they were when it began, whatever is
+ * committed after that, until chidb_Pager_endSnapshot. The pages it
+ * reads can't be written. Other pagers of the same file don't
+ * checkpoint the log past the snapshot either (see
+ * chidb_Pager_beginRead).
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - snapshot: Out parameter. The snapshot is stored here.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The pager does not use a write-ahead log
+ * - CHIDB_EBUSY: Too many other pagers are reading the log
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_beginSnapshot(Pager *pager, PagerSnapshot **snapshot)
+{
+    struct stat buf;
+    PagerSnapshot *s;
+    int rc;
+
+    if (pager->wal == NULL)
+        return CHIDB_EMISUSE;
+
+    s = malloc(sizeof(PagerSnapshot));
+    if (s == NULL)
+        return CHIDB_ENOMEM;
+
+    pthread_mutex_lock(&pager->lock);
+
+    rc = chidb_Pager_holdReadMark(pager);
+    if (rc != CHIDB_OK)
+    {
+        pthread_mutex_unlock(&pager->lock);
+        free(s);
+        return rc;
+    }
+
+    s->pager = pager;
+    s->horizon = pager->wal->max_frame;
+    if (s->horizon > 0)
+        s->n_pages = pager->wal->db_size;
+    else if (fstat(pager->fd, &buf) == 0)
+        s->n_pages = buf.st_size / pager->page_size;
+    else
+    {
+        if (pager->snapshots == NULL && pager->nreaders == 0)
+            chidb_Pager_releaseReadMark(pager);
+        pthread_mutex_unlock(&pager->lock);
+        free(s);
+        return CHIDB_EIO;
+    }
+    s->next = pager->snapshots;
+    pager->snapshots = s;
+
+    pthread_mutex_unlock(&pager->lock);
+
+    chilog(TRACE, "Began a snapshot at WAL frame %i", s->horizon);
+    *snapshot = s;
+
+    return CHIDB_OK;
+}
+
+
+/* End a read snapshot
+ *
+ * Frees a snapshot returned by chidb_Pager_beginSnapshot, and the older
+ * versions of pages that no other snapshot needs (except those that are
+ * still pinned, which are freed when they are released). No thread may
+ * be using the snapshot anymore.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - snapshot: A snapshot of this pager
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The snapshot is not one of this pager's
+ */
+int chidb_Pager_endSnapshot(Pager *pager, PagerSnapshot *snapshot)
+{
+    PagerSnapshot **s;
+
+    pthread_mutex_lock(&pager->lock);
+
+    for (s = &pager->snapshots; *s != NULL && *s != snapshot; s = &(*s)->next)
+        ;
+    if (*s == NULL)
+    {
+        pthread_mutex_unlock(&pager->lock);
+        return CHIDB_EMISUSE;
+    }
+    *s = snapshot->next;
+    free(snapshot);
+
+    for (uint32_t i = 0; pager->nversions > 0 && i <= pager->hash_mask; i++)
+    {
+        MemPage *frame, *next;
+
+        for (frame = pager->hash[i]; frame != NULL; frame = next)
+        {
+            next = frame->hash_next;
+            if (frame->snapshot && frame->pins == 0 && !chidb_Pager_versionNeeded(pager, frame))
+                chidb_Pager_dropVersion(pager, frame);
+        }
+    }
+
+    if (pager->snapshots == NULL && pager->nreaders == 0)
+        chidb_Pager_releaseReadMark(pager);
+
+    pthread_mutex_unlock(&pager->lock);
+
+    return CHIDB_OK;
+}
+
+
+/* Use a read snapshot in this thread
+ *
+ * From now on, the pages this thread reads from the snapshot's pager
+ * come from the snapshot (other pagers are not affected).
+ *
+ * Parameters
+ * - snapshot: A snapshot, or NULL to read the current pages again
+ *
+ * Return
+ * - The snapshot this thread used before
+ */
+PagerSnapshot *chidb_Pager_useSnapshot(PagerSnapshot *snapshot)
+{
+    PagerSnapshot *prev = current_snapshot;
+
+    current_snapshot = snapshot;
+    return prev;
+}
+
+
+/* Copy the write-ahead log into the database file
+ *
+ * Only committed pages are copied (see chidb_Pager_flush), and only up
+ * to the oldest snapshot in progress (see chidb_Pager_beginSnapshot), or
+ * the oldest read mark of another pager (see chidb_Pager_beginRead).
+ * Does nothing if the pager does not use a write-ahead log, or if
+ * another pager is checkpointing it.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_checkpoint(Pager *pager)
+{
+    int rc;
+
+    pthread_mutex_lock(&pager->lock);
+    rc = chidb_Pager_checkpointLocked(pager);
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* Set the automatic checkpoint threshold
+ *
+ * When the pager uses a write-ahead log, chidb_Pager_flush checkpoints
+ * the log once it contains this many committed frames.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - nframes: Number of frames (0 disables automatic checkpoints)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_setAutoCheckpoint(Pager *pager, uint32_t nframes)
+{
+    pager->autocheckpoint = nframes;
+
+    return CHIDB_OK;
+}
+
+
+/* Computes the number of pages in a file.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npages: Out parameter. Number of pages.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
+{
+    struct stat buf;
+
+    if (pager->flags & PAGER_MEMORY)
+    {
+        *npages = pager->mem_pages;
+        return CHIDB_OK;
+    }
+
+    fstat(pager->fd, &buf);
+    *npages = buf.st_size / pager->page_size;
+
+    /* The database may have grown in the log */
+    if (pager->wal != NULL && pager->wal->db_size > *npages)
+        *npages = pager->wal->db_size;
+
+    return CHIDB_OK;
+}
+
+
+/* Closes a pager and frees up all resources used by the pager.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_close(Pager *pager)
+{
+    bool last;
+    int rc;
+
+    /* A transaction that wasn't committed is rolled back */
+    if (pager->in_txn)
+        chidb_Pager_rollback(pager);
+
+    /* Nothing in a scratch file (or in memory) is read once it is closed */
+    if ((pager->flags & (PAGER_TEMP | PAGER_MEMORY)) && pager->frames != NULL)
+        for (uint32_t i = 0; i < pager->cache_size; i++)
+            pager->frames[i].dirty = false;
+
+    rc = chidb_Pager_freeCache(pager);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if (pager->map != NULL)
+        munmap(pager->map, pager->map_size);
+
+    /* The last pager to close the file cleans up after all of them */
+    last = pager->shm != NULL && chidb_Shm_isLast(pager->shm);
+
+    if (pager->wal != NULL)
+    {
+        /* What the others committed is checkpointed too */
+        rc = chidb_Pager_refreshLocked(pager);
+        if (rc == CHIDB_OK)
+            rc = chidb_Pager_checkpoint(pager);
+        if (chidb_Wal_close(pager->wal, rc == CHIDB_OK && pager->wal->max_frame == 0 && last) != CHIDB_OK)
+            rc = CHIDB_EIO;
+    }
+
+    /* If the transaction couldn't be rolled back, the journal is left
+     * behind, and it will be when the file is opened again */
+    if (pager->journal_fd != -1)
+        chidb_Pager_closeJournal(pager, false);
+
+    /* Every lock goes away with it */
+    if (pager->shm != NULL && chidb_Shm_close(pager->shm, last) != CHIDB_OK)
+        rc = CHIDB_EIO;
+
+    if (pager->flags & PAGER_MEMORY)
+        chidb_Pager_memTruncate(pager, 0);
+    else if (close(pager->fd) != 0)
+        rc = CHIDB_EIO;
+    free(pager->mem);
+    free(pager->zbuf);
+    pthread_mutex_destroy(&pager->lock);
+    free(pager->journal_name);
+    free(pager->filename);
+    free(pager);
+
+    return rc;
+}
+
+
+/* Allocates the buffer pool (all frames start out empty) */
+static int chidb_Pager_initCache(Pager *pager)
+{
+    uint32_t nbuckets = 1;
+
+    while (nbuckets < pager->cache_size * 2)
+        nbuckets <<= 1;
+
+    pager->frames = calloc(pager->cache_size, sizeof(MemPage));
+    if (posix_memalign((void **) &pager->frames_data, chidb_Pager_bufAlign(pager),
+                       (size_t) pager->cache_size * pager->page_size + PAGER_POOL_SLACK) != 0)
+        pager->frames_data = NULL;
+    pager->hash = calloc(nbuckets, sizeof(MemPage *));
+
+    if (pager->frames == NULL || pager->frames_data == NULL || pager->hash == NULL)
+    {
+        free(pager->frames);
+        free(pager->frames_data);
+        free(pager->hash);
+        pager->frames = NULL;
+        pager->frames_data = NULL;
+        pager->hash = NULL;
+        return CHIDB_ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < pager->cache_size; i++)
+    {
+        pager->frames[i].npage = 0;
+        pager->frames[i].buf = pager->frames_data + (size_t) i * pager->page_size;
+        pager->frames[i].data = pager->frames[i].buf;
+        pager->frames[i].cached = true;
+        pager->frames[i].mapped = false;
+        pager->frames[i].map_pins = 0;
+        pager->frames[i].exclusive = false;
+        pager->frames[i].version = 0;
+        pager->frames[i].wal_frame = 0;
+        pager->frames[i].snapshot = false;
+        pthread_rwlock_init(&pager->frames[i].latch, NULL);
+    }
+
+    pager->hash_mask = nbuckets - 1;
+    pager->clock_hand = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Returns true if any frame in the buffer pool is pinned */
+static bool chidb_Pager_hasPinnedPages(Pager *pager)
+{
+    for (uint32_t i = 0; i < pager->cache_size; i++)
+        if (pager->frames[i].pins > 0)
+            return true;
+
+    return false;
+}
+
+
+/* Writes back all dirty pages and frees the buffer pool */
+static int chidb_Pager_freeCache(Pager *pager)
+{
+    int rc;
+
+    if (pager->frames == NULL)
+        return CHIDB_OK;
+
+    rc = chidb_Pager_flush(pager);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    for (uint32_t i = 0; pager->nversions > 0 && i <= pager->hash_mask; i++)
+    {
+        MemPage *frame, *next;
+
+        for (frame = pager->hash[i]; frame != NULL; frame = next)
+        {
+            next = frame->hash_next;
+            if (frame->snapshot)
+                chidb_Pager_dropVersion(pager, frame);
+        }
+    }
+
+    for (uint32_t i = 0; i < pager->cache_size; i++)
+        pthread_rwlock_destroy(&pager->frames[i].latch);
+    free(pager->frames);
+    free(pager->frames_data);
+    free(pager->hash);
+    pager->frames = NULL;
+    pager->frames_data = NULL;
+    pager->hash = NULL;
+
+    return CHIDB_OK;
+}
+
+
+/* Allocates a frame outside the buffer pool */
+static MemPage *chidb_Pager_newFrame(Pager *pager)
+{
+    MemPage *frame = malloc(sizeof(MemPage));
+
+    if (frame == NULL)
+        return NULL;
+    if (posix_memalign((void **) &frame->data, chidb_Pager_bufAlign(pager), pager->page_size) != 0)
+    {
+        free(frame);
+        return NULL;
+    }
+    frame->buf = frame->data;
+    frame->cached = false;
+    frame->mapped = false;
+    frame->map_pins = 0;
+    frame->hash_next = NULL;
+    frame->exclusive = false;
+    frame->version = 0;
+    frame->wal_frame = 0;
+    frame->snapshot = false;
+    pthread_rwlock_init(&frame->latch, NULL);
+
+    return frame;
+}
+
+
+/* Frees a frame allocated by chidb_Pager_newFrame */
+static void chidb_Pager_freeFrame(MemPage *frame)
+{
+    pthread_rwlock_destroy(&frame->latch);
+    free(frame->buf);
+    free(frame);
+}
+
+
+/* Picks an unpinned frame using the CLOCK algorithm, writes it back to
+ * the file if it is dirty, and removes it from the hash table. During a
+ * transaction, dirty frames are only picked if every unpinned frame is
+ * dirty. If all the frames are pinned, *frame is set to NULL. */
+static int chidb_Pager_evictFrame(Pager *pager, MemPage **frame)
+{
+    /* Two sweeps are enough: the first one clears all reference bits */
+    for (uint32_t n = 0; n < (pager->in_txn ? 4 : 2) * pager->cache_size; n++)
+    {
+        MemPage *victim = &pager->frames[pager->clock_hand];
+
+        pager->clock_hand = (pager->clock_hand + 1) % pager->cache_size;
+
+        if (victim->pins > 0)
+            continue;
+
+        if (victim->dirty && pager->in_txn && n < 2 * pager->cache_size)
+            continue;
+
+        if (victim->referenced)
+        {
+            victim->referenced = false;
+            continue;
+        }
+
+        if (victim->npage != 0)
+        {
+            MemPage **p;
+
+            if (victim->dirty)
+            {
+                int rc = chidb_Pager_writeFrame(pager, victim);
+                if (rc != CHIDB_OK)
+                    return rc;
+                victim->dirty = false;
+            }
+
+            for (p = &pager->hash[victim->npage & pager->hash_mask]; *p != victim; p = &(*p)->hash_next)
+                ;
+            *p = victim->hash_next;
+
+            chilog(TRACE, "Evicted page %i from buffer pool", victim->npage);
+            if (CHIDB_TRACING(&pager->trace, CHIDB_TRACE_EVICT))
+            {
+                chidb_trace_event ev = {.type = CHIDB_TRACE_EVICT, .phase = CHIDB_TRACE_END,
+                                        .npage = victim->npage};
+                chidb_trace_emit(&pager->trace, &ev, 0);
+            }
+            victim->npage = 0;
+        }
+
+        victim->data = victim->buf;
+        victim->mapped = false;
+
+        *frame = victim;
+        return CHIDB_OK;
+    }
+
+    *frame = NULL;
+    return CHIDB_OK;
+}
+
+
+/* Reads page npage from the file into data, or its most recent version
+ * in the first max_frame frames of the log. *wal_frame is set to the
+ * frame it was read from (0 for the file). Pages that have been
+ * allocated but not written yet are read as zeroes. */
+static int chidb_Pager_readFrame(Pager *pager, npage_t npage, uint32_t max_frame, uint8_t *data, uint32_t *wal_frame)
+{
+    uint32_t frame;
+    uint64_t start;
+    ssize_t n;
+
+    int rc;
+
+    *wal_frame = 0;
+    if (pager->wal != NULL && chidb_Wal_findFrame(pager->wal, npage, max_frame, &frame) == CHIDB_OK)
+    {
+        rc = chidb_Wal_readFrame(pager->wal, frame, data);
+        if (rc != CHIDB_OK)
+            return rc;
+        *wal_frame = frame;
+        return chidb_Pager_verifyPage(pager, npage, data);
+    }
+
+    pager->stats.pages_read++;
+
+    if (pager->flags & PAGER_MEMORY)
+    {
+        if (npage <= pager->mem_pages && pager->mem[npage - 1] != NULL)
+            memcpy(data, pager->mem[npage - 1], pager->page_size);
+        else
+            memset(data, 0, pager->page_size);
+        pager->stats.bytes_read += pager->page_size;
+        return CHIDB_OK;
+    }
+
+    if (pager->map != NULL && (size_t) npage * pager->page_size <= pager->map_size)
+    {
+        /* No need for a system call if the page is already mapped */
+        memcpy(data, pager->map + (size_t) (npage - 1) * pager->page_size, pager->page_size);
+        pager->stats.bytes_read += pager->page_size;
+        return chidb_Pager_verifyPage(pager, npage, data);
+    }
+
+    /* A short read from a regular file means we've hit the end of the file */
+    start = chidb_time_ns();
+    do
+        n = pread(pager->fd, data, pager->page_size, (off_t) (npage - 1) * pager->page_size);
+    while (n == -1 && errno == EINTR);
+    chidb_histogram_add(&pager->stats.read_latency, chidb_time_ns() - start);
+
+    if (n == -1)
+        return CHIDB_EIO;
+    if (CHIDB_TRACING(&pager->trace, CHIDB_TRACE_PAGE_READ))
+    {
+        chidb_trace_event ev = {.type = CHIDB_TRACE_PAGE_READ, .phase = CHIDB_TRACE_END,
+                                .npage = npage, .bytes = n};
+        chidb_trace_emit(&pager->trace, &ev, start);
+    }
+    pager->stats.bytes_read += n;
+    chilog(TRACE, "Read %i bytes from page %i into memory [data: %x]", (int) n, npage, data);
+    if (n < pager->page_size)
+    {
+        memset(data + n, 0, pager->page_size - n);
+        return CHIDB_OK;
+    }
+
+    if ((pager->flags & PAGER_COMPRESS) && (rc = chidb_Pager_inflatePage(pager, npage, data)) != CHIDB_OK)
+        return rc;
+
+    return chidb_Pager_verifyPage(pager, npage, data);
+}
+
+
+/* Checks the checksum trailer of a page read from the file, if
+ * checksums are enabled */
+static int chidb_Pager_verifyPage(Pager *pager, npage_t npage, const uint8_t *data)
+{
+    uint32_t usable = pager->page_size - PAGER_CHECKSUM_SIZE;
+    uint32_t stored;
+
+    if (!(pager->flags & PAGER_CHECKSUM))
+        return CHIDB_OK;
+
+    stored = get4byte(data + usable);
+    if (stored == chidb_crc32c(0, data, usable))
+        return CHIDB_OK;
+
+    /* A page that was allocated but never written (e.g., a hole left
+     * in the file because a later page was written first) */
+    if (stored == 0 && data[0] == 0 && memcmp(data, data + 1, pager->page_size - 1) == 0)
+        return CHIDB_OK;
+
+    chilog(ERROR, "Checksum mismatch in page %i", npage);
+    return CHIDB_ECORRUPT;
+}
+
+
+/* Stores the checksum of a page in its trailer, if checksums are enabled */
+static void chidb_Pager_stampPage(Pager *pager, uint8_t *data)
+{
+    uint32_t usable = pager->page_size - PAGER_CHECKSUM_SIZE;
+
+    if (pager->flags & PAGER_CHECKSUM)
+        put4byte(data + usable, chidb_crc32c(0, data, usable));
+}
+
+
+/* Writes the page in a frame to the file (or appends it to the log).
+ * During a transaction, the page is saved in the rollback journal first. */
+static int chidb_Pager_writeFrame(Pager *pager, MemPage *frame)
+{
+    off_t offset = (off_t) (frame->npage - 1) * pager->page_size;
+    uint64_t start;
+    uint32_t size;
+    int rc;
+
+    chidb_Pager_stampPage(pager, frame->data);
+
+    if (pager->wal != NULL)
+    {
+        rc = chidb_Wal_appendFrame(pager->wal, frame->npage, frame->data, 0);
+        if (rc == CHIDB_OK)
+            frame->wal_frame = pager->wal->n_frames;
+        return rc;
+    }
+
+    if (pager->flags & PAGER_MEMORY)
+    {
+        rc = chidb_Pager_journalPage(pager, frame->npage);
+        if (rc != CHIDB_OK)
+            return rc;
+        return chidb_Pager_memWrite(pager, frame);
+    }
+
+    rc = chidb_Pager_journalPage(pager, frame->npage);
+    if (rc == CHIDB_OK)
+        rc = chidb_Pager_syncJournal(pager);
+    if (rc == CHIDB_OK)
+        rc = chidb_Pager_lockDb(pager, F_WRLCK);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    start = chidb_time_ns();
+    size = (pager->flags & PAGER_COMPRESS) && frame->npage > 1 ? chidb_Pager_deflatePage(pager, frame->data) : 0;
+    if (size > 0)
+        rc = chidb_Pager_writeCompressed(pager, frame->npage, size);
+    else
+    {
+        size = pager->page_size;
+        rc = chidb_Pager_pwrite(pager->fd, frame->data, size, offset);
+    }
+    if (rc != CHIDB_OK)
+        return CHIDB_EIO;
+    chidb_histogram_add(&pager->stats.write_latency, chidb_time_ns() - start);
+    pager->stats.pages_written++;
+    pager->stats.bytes_written += size;
+    if (CHIDB_TRACING(&pager->trace, CHIDB_TRACE_PAGE_WRITE))
+    {
+        chidb_trace_event ev = {.type = CHIDB_TRACE_PAGE_WRITE, .phase = CHIDB_TRACE_END,
+                                .npage = frame->npage, .bytes = size};
+        chidb_trace_emit(&pager->trace, &ev, start);
+    }
+    chilog(TRACE, "Wrote %i bytes to page %i", (int) size, frame->npage);
+
+    return CHIDB_OK;
+}
+
+
+#ifdef CHIDB_LZ4
+/* Allocates pager->zbuf, for a page of the current size */
+static int chidb_Pager_zbuf(Pager *pager)
+{
+    if (pager->zbuf != NULL && pager->zbuf_size == pager->page_size)
+        return CHIDB_OK;
+
+    free(pager->zbuf);
+    pager->zbuf_size = 0;
+    if (posix_memalign((void **) &pager->zbuf, chidb_Pager_bufAlign(pager), pager->page_size) != 0)
+    {
+        pager->zbuf = NULL;
+        return CHIDB_ENOMEM;
+    }
+    pager->zbuf_size = pager->page_size;
+
+    return CHIDB_OK;
+}
+#endif
+
+
+/* Compresses a page into pager->zbuf, with its header, and zeroes up to
+ * the end of the block. Returns the number of bytes of its slot that
+ * the compressed page takes (a multiple of the block size), or 0 if it
+ * would not free a block. */
+static uint32_t chidb_Pager_deflatePage(Pager *pager, const uint8_t *data)
+{
+#ifdef CHIDB_LZ4
+    uint32_t max = pager->page_size - pager->zblock, size;
+    int n;
+
+    if (pager->page_size < 2 * pager->zblock || chidb_Pager_zbuf(pager) != CHIDB_OK)
+        return 0;
+
+    n = LZ4_compress_default((const char *) data, (char *) pager->zbuf + PAGER_COMPRESSED_HEADER_SIZE,
+                             pager->page_size, max - PAGER_COMPRESSED_HEADER_SIZE);
+    if (n <= 0)
+        return 0;
+
+    size = (PAGER_COMPRESSED_HEADER_SIZE + n + pager->zblock - 1) / pager->zblock * pager->zblock;
+    put4byte(pager->zbuf, PAGER_COMPRESSED_MAGIC);
+    put4byte(pager->zbuf + 4, n);
+    put4byte(pager->zbuf + 8, chidb_crc32c(0, pager->zbuf + PAGER_COMPRESSED_HEADER_SIZE, n));
+    memset(pager->zbuf + PAGER_COMPRESSED_HEADER_SIZE + n, 0, size - PAGER_COMPRESSED_HEADER_SIZE - n);
+
+    return size;
+#else
+    return 0;
+#endif
+}
+
+
+/* Writes the first size bytes of pager->zbuf (see chidb_Pager_deflatePage)
+ * to the slot of page npage, and punches the rest of the slot out of the
+ * file. The file is first extended to the end of the slot, if needed,
+ * so that the size of the file still counts the page. If the file
+ * system can't punch holes, the rest of the slot keeps its blocks,
+ * which are never read. */
+static int chidb_Pager_writeCompressed(Pager *pager, npage_t npage, uint32_t size)
+{
+    off_t offset = (off_t) (npage - 1) * pager->page_size;
+    struct stat st;
+
+    if (fstat(pager->fd, &st) != 0)
+        return CHIDB_EIO;
+    if (st.st_size < offset + pager->page_size && ftruncate(pager->fd, offset + pager->page_size) != 0)
+        return CHIDB_EIO;
+
+    if (chidb_Pager_pwrite(pager->fd, pager->zbuf, size, offset) != CHIDB_OK)
+        return CHIDB_EIO;
+
+    if (fallocate(pager->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset + size, pager->page_size - size) != 0)
+        chilog(DEBUG, "Could not punch out the end of page %i: %s", npage, strerror(errno));
+
+    return CHIDB_OK;
+}
+
+
+/* Decompresses a page read from the file, in place, if it is compressed.
+ * A page that only looks compressed (its header's checksum doesn't
+ * match) is left alone. */
+static int chidb_Pager_inflatePage(Pager *pager, npage_t npage, uint8_t *data)
+{
+    uint32_t n = get4byte(data + 4);
+
+    if (npage == 1 || get4byte(data) != PAGER_COMPRESSED_MAGIC || n > pager->page_size - PAGER_COMPRESSED_HEADER_SIZE)
+        return CHIDB_OK;
+    if (get4byte(data + 8) != chidb_crc32c(0, data + PAGER_COMPRESSED_HEADER_SIZE, n))
+        return CHIDB_OK;
+
+#ifdef CHIDB_LZ4
+    if (chidb_Pager_zbuf(pager) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    if (LZ4_decompress_safe((const char *) data + PAGER_COMPRESSED_HEADER_SIZE, (char *) pager->zbuf,
+                            n, pager->page_size) != (int) pager->page_size)
+    {
+        chilog(ERROR, "Page %i could not be decompressed", npage);
+        return CHIDB_ECORRUPT;
+    }
+    memcpy(data, pager->zbuf, pager->page_size);
+
+    return CHIDB_OK;
+#else
+    return CHIDB_ECORRUPT;
+#endif
+}
+
+
+/* Copies the page in a frame into its buffer in memory (allocating it,
+ * and growing the array of buffers, if needed) */
+static int chidb_Pager_memWrite(Pager *pager, MemPage *frame)
+{
+    npage_t i = frame->npage - 1;
+
+    if (frame->npage > pager->mem_alloc)
+    {
+        npage_t nalloc = pager->mem_alloc > 0 ? pager->mem_alloc : PAGER_MEM_INITIAL;
+        uint8_t **mem;
+
+        while (nalloc < frame->npage)
+            nalloc *= 2;
+        mem = realloc(pager->mem, nalloc * sizeof(uint8_t *));
+        if (mem == NULL)
+            return CHIDB_ENOMEM;
+        memset(mem + pager->mem_alloc, 0, (nalloc - pager->mem_alloc) * sizeof(uint8_t *));
+        pager->mem = mem;
+        pager->mem_alloc = nalloc;
+    }
+
+    if (pager->mem[i] == NULL && (pager->mem[i] = malloc(pager->page_size)) == NULL)
+        return CHIDB_ENOMEM;
+    memcpy(pager->mem[i], frame->data, pager->page_size);
+    if (frame->npage > pager->mem_pages)
+        pager->mem_pages = frame->npage;
+    __atomic_add_fetch(&pager->nchanges, 1, __ATOMIC_ACQ_REL);
+
+    pager->stats.pages_written++;
+    pager->stats.bytes_written += pager->page_size;
+
+    return CHIDB_OK;
+}
+
+
+/* Frees the buffers of the pages past npages */
+static void chidb_Pager_memTruncate(Pager *pager, npage_t npages)
+{
+    for (npage_t i = npages; i < pager->mem_pages; i++)
+    {
+        free(pager->mem[i]);
+        pager->mem[i] = NULL;
+    }
+    if (pager->mem_pages > npages)
+        pager->mem_pages = npages;
+    __atomic_add_fetch(&pager->nchanges, 1, __ATOMIC_ACQ_REL);
+}
+
+
+/* Ends a transaction in memory: the buffers set aside by
+ * chidb_Pager_journalPage are put back if restore is true (along with
+ * the size of the database), and freed otherwise */
+static void chidb_Pager_memEndTxn(Pager *pager, bool restore)
+{
+    if (restore)
+        chidb_Pager_memTruncate(pager, pager->txn_pages);
+
+    for (npage_t i = 0; pager->mem_saved != NULL && i < pager->txn_pages; i++)
+    {
+        if (!(pager->journaled[i / 8] & (1 << (i % 8))))
+            continue;
+
+        if (!restore)
+            free(pager->mem_saved[i]);
+        else if (i < pager->mem_alloc)
+        {
+            free(pager->mem[i]);
+            pager->mem[i] = pager->mem_saved[i];
+            if (pager->mem[i] != NULL && i >= pager->mem_pages)
+                pager->mem_pages = i + 1;
+        }
+    }
+
+    free(pager->mem_saved);
+    free(pager->journaled);
+    pager->mem_saved = NULL;
+    pager->journaled = NULL;
+}
+
+
+/* Writes n bytes at offset, retrying short writes */
+static int chidb_Pager_pwrite(int fd, const uint8_t *buf, size_t n, off_t offset)
+{
+    size_t done = 0;
+
+    while (done < n)
+    {
+        ssize_t count = pwrite(fd, buf + done, n - done, offset + done);
+
+        if (count == -1 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return CHIDB_EIO;
+        done += count;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Syncs a file, counting it in the statistics */
+static int chidb_Pager_fdatasync(Pager *pager, int fd)
+{
+    uint64_t start = chidb_time_ns();
+
+    if (fdatasync(fd) != 0)
+        return CHIDB_EIO;
+
+    chidb_histogram_add(&pager->stats.sync_latency, chidb_time_ns() - start);
+    pager->stats.syncs++;
+    if (CHIDB_TRACING(&pager->trace, CHIDB_TRACE_FSYNC))
+    {
+        chidb_trace_event ev = {.type = CHIDB_TRACE_FSYNC, .phase = CHIDB_TRACE_END};
+        chidb_trace_emit(&pager->trace, &ev, start);
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Drops every mapped frame from the buffer pool (they are never dirty)
+ * and unmaps the file. Must not be called while a mapped frame is pinned. */
+static void chidb_Pager_unmap(Pager *pager)
+{
+    for (uint32_t i = 0; pager->frames != NULL && i < pager->cache_size; i++)
+    {
+        MemPage *frame = &pager->frames[i], **p;
+
+        if (!frame->mapped)
+            continue;
+
+        for (p = &pager->hash[frame->npage & pager->hash_mask]; *p != frame; p = &(*p)->hash_next)
+            ;
+        *p = frame->hash_next;
+
+        frame->npage = 0;
+        frame->data = frame->buf;
+        frame->mapped = false;
+        frame->referenced = false;
+    }
+
+    if (pager->map != NULL)
+        munmap(pager->map, pager->map_size);
+    pager->map = NULL;
+    pager->map_size = 0;
+}
+
+
+/* Maps the whole file, replacing the current mapping. The mapping can't
+ * be moved while a page in it is pinned, in which case the current mapping
+ * is kept (readPageRO will fall back to copying pages beyond its end). */
+static int chidb_Pager_remap(Pager *pager)
+{
+    struct stat buf;
+    size_t size;
+    void *map;
+
+    if (fstat(pager->fd, &buf) != 0)
+        return CHIDB_EIO;
+
+    size = (buf.st_size / pager->page_size) * pager->page_size;
+    if (size <= pager->map_size)
+        return CHIDB_OK;
+
+    if (pager->map_pins > 0)
+        return CHIDB_OK;
+    for (uint32_t i = 0; i < pager->cache_size; i++)
+        if (pager->frames[i].mapped && pager->frames[i].pins > 0)
+            return CHIDB_OK;
+
+    chidb_Pager_unmap(pager);
+
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, pager->fd, 0);
+    if (map == MAP_FAILED)
+        return CHIDB_EIO;
+
+    pager->map = map;
+    pager->map_size = size;
+    chilog(TRACE, "Mapped %i bytes of the file", (int) size);
+
+    return CHIDB_OK;
+}
+
+
+/* Alignment of page buffers: the page size, but never less than what
+ * O_DIRECT may require */
+static size_t chidb_Pager_bufAlign(Pager *pager)
+{
+    return pager->page_size > PAGER_BUF_ALIGN ? pager->page_size : PAGER_BUF_ALIGN;
+}
+
+
+/* chidb_Pager_allocatePage, with the pager's lock held */
+static int chidb_Pager_allocatePageLocked(Pager *pager, npage_t *npage)
+{
+    int rc = chidb_Pager_lockWriter(pager);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    /* We simply increment the page number counter. readPage
+     * and writePage take care of the rest. */
+    *npage = ++pager->n_pages;
+
+    return CHIDB_OK;
+}
+
+
+/* chidb_Pager_truncate, with the pager's lock held */
+static int chidb_Pager_truncateLocked(Pager *pager, npage_t npages)
+{
+    int rc;
+
+    if (npages >= pager->n_pages)
+        return CHIDB_OK;
+
+    rc = chidb_Pager_lockWriter(pager);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    for (uint32_t i = 0; pager->frames != NULL && i < pager->cache_size; i++)
+    {
+        MemPage *frame = &pager->frames[i];
+
+        if (frame->npage > npages && frame->pins > 0)
+            return CHIDB_EMISUSE;
+        if ((frame->mapped && frame->pins > 0) || frame->map_pins > 0)
+            if (pager->map_size > (size_t) npages * pager->page_size)
+                return CHIDB_EMISUSE;
+    }
+
+    /* A rollback must be able to bring back the pages cut off the file */
+    for (npage_t npage = npages + 1; pager->in_txn && npage <= pager->n_pages; npage++)
+    {
+        rc = chidb_Pager_journalPage(pager, npage);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+    if (chidb_Pager_syncJournal(pager) != CHIDB_OK)
+        return CHIDB_EIO;
+
+    /* Touching the mapping past the end of the file would fault */
+    if (pager->map != NULL && pager->map_size > (size_t) npages * pager->page_size)
+        chidb_Pager_unmap(pager);
+
+    for (uint32_t i = 0; pager->frames != NULL && i < pager->cache_size; i++)
+    {
+        MemPage *frame = &pager->frames[i], **p;
+
+        if (frame->npage <= npages)
+            continue;
+
+        for (p = &pager->hash[frame->npage & pager->hash_mask]; *p != frame; p = &(*p)->hash_next)
+            ;
+        *p = frame->hash_next;
+        frame->npage = 0;
+        frame->dirty = false;
+        frame->referenced = false;
+    }
+
+    pager->n_pages = npages;
+
+    /* With a log, the new size is recorded by the next commit, and the
+     * file is truncated when the log is checkpointed */
+    if (pager->flags & PAGER_MEMORY)
+        chidb_Pager_memTruncate(pager, npages);
+    else if (pager->wal == NULL)
+    {
+        rc = chidb_Pager_lockDb(pager, F_WRLCK);
+        if (rc != CHIDB_OK)
+            return rc;
+        if (ftruncate(pager->fd, (off_t) npages * pager->page_size) != 0)
+            return CHIDB_EIO;
+    }
+
+    chilog(TRACE, "Truncated file to %i pages", npages);
+
+    return CHIDB_OK;
+}
+
+
+/* chidb_Pager_readPage, with the pager's lock held */
+static int chidb_Pager_readPageLocked(Pager *pager, npage_t npage, MemPage **page)
+{
+    MemPage *frame;
+    int rc;
+
+    if (current_snapshot != NULL && current_snapshot->pager == pager)
+        return chidb_Pager_readVersionLocked(pager, current_snapshot, npage, page);
+
+    if (npage > pager->n_pages || npage <= 0)
+        return CHIDB_EPAGENO;
+
+    if (pager->frames == NULL)
+    {
+        rc = chidb_Pager_initCache(pager);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    for (frame = pager->hash[npage & pager->hash_mask]; frame != NULL; frame = frame->hash_next)
+    {
+        if (frame->npage == npage && !frame->snapshot)
+        {
+            if (frame->mapped)
+            {
+                /* The caller may modify the page, so it can't keep
+                 * pointing into the read-only mapping. Those who pinned
+                 * it before may still be reading the mapping, which
+                 * can't be moved or cut until they release it */
+                memcpy(frame->buf, frame->data, pager->page_size);
+                frame->data = frame->buf;
+                frame->mapped = false;
+                frame->map_pins = frame->pins;
+                pager->map_pins += frame->pins;
+            }
+            frame->pins++;
+            frame->referenced = true;
+            pager->stats.cache_hits++;
+            *page = frame;
+            chilog(TRACE, "Page %i found in buffer pool [%x data: %x]", npage, frame, frame->data);
+            return CHIDB_OK;
+        }
+    }
+
+    pager->stats.cache_misses++;
+    rc = chidb_Pager_evictFrame(pager, &frame);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if (frame == NULL)
+    {
+        /* Every frame is pinned */
+        frame = chidb_Pager_newFrame(pager);
+        if (frame == NULL)
+            return CHIDB_ENOMEM;
+    }
+
+    rc = chidb_Pager_readFrame(pager, npage, pager->wal != NULL ? pager->wal->n_frames : 0,
+                               frame->data, &frame->wal_frame);
+    if (rc != CHIDB_OK)
+    {
+        if (!frame->cached)
+            chidb_Pager_freeFrame(frame);
+        return rc;
+    }
+
+    frame->npage = npage;
+    frame->snapshot = false;
+    frame->pins = 1;
+    frame->dirty = false;
+    frame->referenced = true;
+
+    /* Frames outside the pool are in the hash table too, so that all
+     * the users of a page share (and latch) the same copy until the
+     * last one releases it */
+    frame->hash_next = pager->hash[npage & pager->hash_mask];
+    pager->hash[npage & pager->hash_mask] = frame;
+
+    *page = frame;
+
+    return CHIDB_OK;
+}
+
+
+/* chidb_Pager_readPageRO, with the pager's lock held */
+static int chidb_Pager_readPageROLocked(Pager *pager, npage_t npage, MemPage **page)
+{
+    MemPage *frame;
+    uint32_t iframe;
+    int rc;
+
+    if (!pager->use_mmap || (current_snapshot != NULL && current_snapshot->pager == pager))
+        return chidb_Pager_readPage(pager, npage, page);
+
+    if (npage > pager->n_pages || npage <= 0)
+        return CHIDB_EPAGENO;
+
+    if (pager->frames == NULL)
+    {
+        rc = chidb_Pager_initCache(pager);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    for (frame = pager->hash[npage & pager->hash_mask]; frame != NULL; frame = frame->hash_next)
+    {
+        if (frame->npage == npage && !frame->snapshot)
+        {
+            frame->pins++;
+            frame->referenced = true;
+            pager->stats.cache_hits++;
+            *page = frame;
+            return CHIDB_OK;
+        }
+    }
+
+    if ((size_t) npage * pager->page_size > pager->map_size)
+    {
+        rc = chidb_Pager_remap(pager);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    /* Allocated but never written, the mapping couldn't be extended, or
+     * the file doesn't have the most recent version of the page */
+    if ((size_t) npage * pager->page_size > pager->map_size)
+        return chidb_Pager_readPage(pager, npage, page);
+    if (pager->wal != NULL && chidb_Wal_findFrame(pager->wal, npage, pager->wal->n_frames, &iframe) == CHIDB_OK)
+        return chidb_Pager_readPage(pager, npage, page);
+
+    pager->stats.cache_misses++;
+    rc = chidb_Pager_evictFrame(pager, &frame);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if (frame == NULL)
+        return chidb_Pager_readPage(pager, npage, page);
+
+    rc = chidb_Pager_verifyPage(pager, npage, pager->map + (size_t) (npage - 1) * pager->page_size);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    frame->npage = npage;
+    frame->data = pager->map + (size_t) (npage - 1) * pager->page_size;
+    frame->mapped = true;
+    frame->wal_frame = 0;
+    frame->snapshot = false;
+    frame->pins = 1;
+    frame->dirty = false;
+    frame->referenced = true;
+    frame->hash_next = pager->hash[npage & pager->hash_mask];
+    pager->hash[npage & pager->hash_mask] = frame;
+
+    *page = frame;
+
+    return CHIDB_OK;
+}
+
+
+/* chidb_Pager_prefetch, with the pager's lock held */
+static int chidb_Pager_prefetchLocked(Pager *pager, const npage_t *npages, uint32_t n)
+{
+    npage_t start = 0, count = 0;
+
+    /* Pages in memory are as close as they will ever be */
+    if (pager->flags & (PAGER_DIRECT | PAGER_MEMORY))
+        return CHIDB_OK;
+
+    for (uint32_t i = 0; i <= n; i++)
+    {
+        npage_t npage = i < n ? npages[i] : 0;
+        uint32_t iframe;
+        MemPage *frame = NULL;
+
+        if (npage > 0 && npage <= pager->n_pages)
+        {
+            if (pager->frames != NULL)
+                for (frame = pager->hash[npage & pager->hash_mask]; frame != NULL; frame = frame->hash_next)
+                    if (frame->npage == npage)
+                        break;
+
+            if (frame != NULL)
+                npage = 0;
+            else if (pager->wal != NULL && chidb_Wal_findFrame(pager->wal, npage, pager->wal->n_frames, &iframe) == CHIDB_OK)
+            {
+                chidb_Wal_prefetchFrame(pager->wal, iframe);
+                npage = 0;
+            }
+            else if (count > 0 && npage == start + count)
+            {
+                /* Extend the current run of consecutive pages */
+                count++;
+                continue;
+            }
+        }
+        else
+            npage = 0;
+
+        /* Issue read-ahead for the current run */
+        if (count > 0)
+        {
+            size_t offset = (size_t) (start - 1) * pager->page_size;
+            size_t length = (size_t) count * pager->page_size;
+
+            if (pager->map != NULL && offset + length <= pager->map_size)
+                madvise(pager->map + offset, length, MADV_WILLNEED);
+#ifdef POSIX_FADV_WILLNEED
+            else
+                posix_fadvise(pager->fd, offset, length, POSIX_FADV_WILLNEED);
+#endif
+            chilog(TRACE, "Prefetching pages %i-%i", start, start + count - 1);
+        }
+
+        start = npage;
+        count = npage ? 1 : 0;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* chidb_Pager_writePage, with the pager's lock held */
+static int chidb_Pager_writePageLocked(Pager *pager, MemPage *page)
+{
+    int rc;
+
+    /* Older versions of a page can't be written either */
+    if (page->snapshot)
+        return CHIDB_EMISUSE;
+
+    if (page->npage > pager->n_pages)
+        return CHIDB_EPAGENO;
+
+    rc = chidb_Pager_lockWriter(pager);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if (!page->cached)
+        return chidb_Pager_writeFrame(pager, page);
+
+    /* Pages returned by readPageRO can't be written */
+    if (page->mapped)
+        return CHIDB_EMISUSE;
+
+    page->dirty = true;
+    chilog(TRACE, "Marked page %i as dirty", page->npage);
+
+    return CHIDB_OK;
+}
+
+
+/* chidb_Pager_releaseMemPage, with the pager's lock held */
+static int chidb_Pager_releaseMemPageLocked(Pager *pager, MemPage *page)
+{
+    /* The file may have shrunk since the snapshot began */
+    if (page->snapshot)
+    {
+        assert(page->pins > 0);
+        page->pins--;
+        if (page->pins == 0 && !chidb_Pager_versionNeeded(pager, page))
+            chidb_Pager_dropVersion(pager, page);
+        return CHIDB_OK;
+    }
+
+    if (page->npage > pager->n_pages)
+        return CHIDB_EPAGENO;
+
+    chilog(TRACE, "Releasing page %i from memory [%x data: %x]", page->npage, page, page->data);
+
+    assert(page->pins > 0);
+    page->pins--;
+
+    /* Pins can't be told apart, so the mapping is only known to be
+     * unused by a page once fewer pins are left than were taken on it */
+    if (page->map_pins > page->pins)
+    {
+        pager->map_pins -= page->map_pins - page->pins;
+        page->map_pins = page->pins;
+    }
+
+    if (!page->cached && page->pins == 0)
+    {
+        MemPage **p;
+
+        for (p = &pager->hash[page->npage & pager->hash_mask]; *p != page; p = &(*p)->hash_next)
+            ;
+        *p = page->hash_next;
+        chidb_Pager_freeFrame(page);
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Orders frames by page number */
+static int chidb_Pager_cmpFrames(const void *a, const void *b)
+{
+    npage_t pa = (*(MemPage * const *) a)->npage;
+    npage_t pb = (*(MemPage * const *) b)->npage;
+
+    return pa < pb ? -1 : pa > pb;
+}
+
+
+/* chidb_Pager_flush, with the pager's lock held. Dirty pages are written
+ * in page number order, so that the writes of a transaction are as
+ * sequential as the file allows. During a transaction, pages are
+ * journaled first, and nothing is committed to the log. */
+static int chidb_Pager_flushLocked(Pager *pager)
+{
+    MemPage **dirty = NULL;
+    uint32_t ndirty = 0, nwrite;
+    int rc = CHIDB_OK;
+
+    for (uint32_t i = 0; pager->frames != NULL && i < pager->cache_size; i++)
+        if (pager->frames[i].npage != 0 && pager->frames[i].dirty)
+            ndirty++;
+
+    if (ndirty > 0)
+    {
+        dirty = malloc(ndirty * sizeof(MemPage *));
+        if (dirty == NULL)
+            return CHIDB_ENOMEM;
+
+        ndirty = 0;
+        for (uint32_t i = 0; i < pager->cache_size; i++)
+            if (pager->frames[i].npage != 0 && pager->frames[i].dirty)
+                dirty[ndirty++] = &pager->frames[i];
+        qsort(dirty, ndirty, sizeof(MemPage *), chidb_Pager_cmpFrames);
+    }
+
+    /* A single sync of the journal before any page is overwritten */
+    for (uint32_t i = 0; i < ndirty && rc == CHIDB_OK; i++)
+        rc = chidb_Pager_journalPage(pager, dirty[i]->npage);
+    if (rc == CHIDB_OK)
+        rc = chidb_Pager_syncJournal(pager);
+
+    /* With a log, the last page is written below as the commit frame */
+    nwrite = pager->wal != NULL && !pager->in_txn && ndirty > 0 ? ndirty - 1 : ndirty;
+    for (uint32_t i = 0; i < nwrite && rc == CHIDB_OK; i++)
+    {
+        rc = chidb_Pager_writeFrame(pager, dirty[i]);
+        if (rc == CHIDB_OK)
+            dirty[i]->dirty = false;
+    }
+
+    if (rc == CHIDB_OK && nwrite < ndirty)
+    {
+        MemPage *last = dirty[ndirty - 1];
+
+        chidb_Pager_stampPage(pager, last->data);
+        rc = chidb_Wal_appendFrame(pager->wal, last->npage, last->data, pager->n_pages);
+        if (rc == CHIDB_OK)
+        {
+            last->dirty = false;
+            last->wal_frame = pager->wal->n_frames;
+        }
+    }
+    else if (rc == CHIDB_OK && pager->wal != NULL && !pager->in_txn)
+        rc = chidb_Wal_commit(pager->wal, pager->n_pages);
+
+    free(dirty);
+    if (rc != CHIDB_OK || pager->in_txn)
+        return rc;
+
+    if (pager->wal != NULL && pager->autocheckpoint > 0 && pager->wal->max_frame >= pager->autocheckpoint)
+        rc = chidb_Pager_checkpointLocked(pager);
+
+    /* Everything is committed: other pagers can write again, and commit
+     * while we wait for the log to be synced */
+    chidb_Pager_unlockWriter(pager);
+
+    if (rc == CHIDB_OK && pager->wal != NULL)
+        rc = chidb_Wal_sync(pager->wal);
+
+    return rc;
+}
+
+
+/* chidb_Pager_begin, with the pager's lock held */
+static int chidb_Pager_beginLocked(Pager *pager)
+{
+    int rc;
+
+    if (pager->in_txn)
+        return CHIDB_EMISUSE;
+
+    rc = chidb_Pager_lockWriter(pager);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    rc = chidb_Pager_flushLocked(pager);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    pager->in_txn = true;
+    pager->txn_pages = pager->n_pages;
+    chilog(TRACE, "Began a transaction on %i pages", pager->n_pages);
+
+    return CHIDB_OK;
+}
+
+
+/* chidb_Pager_commit, with the pager's lock held */
+static int chidb_Pager_commitLocked(Pager *pager)
+{
+    int rc;
+
+    if (!pager->in_txn)
+        return CHIDB_EMISUSE;
+
+    /* With a log, flushing outside a transaction is what commits */
+    if (pager->wal != NULL)
+    {
+        pager->in_txn = false;
+        rc = chidb_Pager_flushLocked(pager);
+        if (rc != CHIDB_OK)
+            pager->in_txn = true;
+        return rc;
+    }
+
+    rc = chidb_Pager_flushLocked(pager);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    /* The pages must be durable before the journal goes away */
+    if (pager->journal_fd != -1)
+    {
+        rc = chidb_Pager_fdatasync(pager, pager->fd);
+        if (rc != CHIDB_OK)
+            return rc;
+        chidb_Pager_closeJournal(pager, true);
+    }
+    if (pager->mem_saved != NULL)
+        chidb_Pager_memEndTxn(pager, false);
+
+    pager->in_txn = false;
+    chidb_Pager_unlockWriter(pager);
+    chilog(TRACE, "Committed a transaction on %i pages", pager->n_pages);
+
+    return CHIDB_OK;
+}
+
+
+/* chidb_Pager_rollback, with the pager's lock held */
+static int chidb_Pager_rollbackLocked(Pager *pager)
+{
+    struct stat buf;
+    int rc = CHIDB_OK;
+
+    if (!pager->in_txn)
+        return CHIDB_EMISUSE;
+    if (pager->frames != NULL && chidb_Pager_hasPinnedPages(pager))
+        return CHIDB_EMISUSE;
+
+    /* The file is about to change under the mapping, and the frames */
+    if (pager->map != NULL)
+        chidb_Pager_unmap(pager);
+
+    for (uint32_t i = 0; pager->frames != NULL && i < pager->cache_size; i++)
+    {
+        MemPage *frame = &pager->frames[i], **p;
+
+        if (frame->npage == 0)
+            continue;
+
+        for (p = &pager->hash[frame->npage & pager->hash_mask]; *p != frame; p = &(*p)->hash_next)
+            ;
+        *p = frame->hash_next;
+        frame->npage = 0;
+        frame->dirty = false;
+        frame->referenced = false;
+    }
+
+    if (pager->wal != NULL)
+        rc = chidb_Wal_rollback(pager->wal);
+    else if (pager->flags & PAGER_MEMORY)
+        chidb_Pager_memEndTxn(pager, true);
+    else if (pager->journal_fd != -1)
+    {
+        rc = chidb_Pager_lockDb(pager, F_WRLCK);
+        if (rc == CHIDB_OK)
+            rc = chidb_Pager_playbackJournal(pager, pager->journal_fd);
+        if (rc == CHIDB_OK)
+            chidb_Pager_closeJournal(pager, true);
+    }
+    /* Pages allocated by the transaction may have been written back */
+    else if (fstat(pager->fd, &buf) != 0)
+        rc = CHIDB_EIO;
+    else if (buf.st_size > (off_t) pager->txn_pages * pager->page_size
+             && ftruncate(pager->fd, (off_t) pager->txn_pages * pager->page_size) != 0)
+        rc = CHIDB_EIO;
+
+    if (rc != CHIDB_OK)
+        return rc;
+
+    pager->n_pages = pager->txn_pages;
+    pager->in_txn = false;
+    chidb_Pager_unlockWriter(pager);
+    chilog(TRACE, "Rolled back a transaction to %i pages", pager->n_pages);
+
+    return CHIDB_OK;
+}
+
+
+/* Saves the contents that page npage had when the transaction began in
+ * the rollback journal, before it is overwritten in the file (the
+ * journal is created by the first page saved in it). Does nothing
+ * outside a transaction, with a log (a rollback only has to forget the
+ * frames appended to it), in a scratch file, for pages allocated by the
+ * transaction, and for pages that are already in the journal. The
+ * record is only durable after chidb_Pager_syncJournal. In memory, the
+ * journal is the buffer of the page itself, which is set aside (and the
+ * page gets a new one when it is written). */
+static int chidb_Pager_journalPage(Pager *pager, npage_t npage)
+{
+    size_t align = chidb_Pager_bufAlign(pager);
+    uint32_t size = PAGER_JOURNAL_RECORD_SIZE(pager->page_size);
+    uint8_t *record, *page;
+    ssize_t n;
+
+    if (!pager->in_txn || npage > pager->txn_pages)
+        return CHIDB_OK;
+    if (pager->journaled != NULL && (pager->journaled[(npage - 1) / 8] & (1 << ((npage - 1) % 8))))
+        return CHIDB_OK;
+
+    if (pager->flags & PAGER_MEMORY)
+    {
+        if (pager->mem_saved == NULL)
+        {
+            pager->journaled = calloc(pager->txn_pages / 8 + 1, 1);
+            pager->mem_saved = calloc(pager->txn_pages, sizeof(uint8_t *));
+            if (pager->journaled == NULL || pager->mem_saved == NULL)
+            {
+                free(pager->journaled);
+                free(pager->mem_saved);
+                pager->journaled = NULL;
+                pager->mem_saved = NULL;
+                return CHIDB_ENOMEM;
+            }
+        }
+        if (npage <= pager->mem_pages)
+        {
+            pager->mem_saved[npage - 1] = pager->mem[npage - 1];
+            pager->mem[npage - 1] = NULL;
+        }
+        pager->journaled[(npage - 1) / 8] |= 1 << ((npage - 1) % 8);
+        return CHIDB_OK;
+    }
+
+    if (pager->wal != NULL || pager->journal_name == NULL)
+        return CHIDB_OK;
+
+    if (pager->journal_fd == -1)
+    {
+        uint8_t header[PAGER_JOURNAL_HEADER_SIZE];
+
+        /* The page of a record is aligned, so that it can be read from
+         * (and written to) a file opened with O_DIRECT */
+        pager->journaled = calloc(pager->txn_pages / 8 + 1, 1);
+        if (posix_memalign((void **) &pager->journal_buf, align, align + size) != 0)
+            pager->journal_buf = NULL;
+        if (pager->journaled == NULL || pager->journal_buf == NULL)
+        {
+            chidb_Pager_closeJournal(pager, false);
+            return CHIDB_ENOMEM;
+        }
+
+        /* Before the file exists, so that other pagers never take it
+         * for a journal left behind */
+        if (pager->shm != NULL && chidb_Shm_lock(pager->shm, SHM_LOCK_JOURNAL, 1, F_WRLCK, false) != CHIDB_OK)
+        {
+            chidb_Pager_closeJournal(pager, false);
+            return CHIDB_EBUSY;
+        }
+
+        pager->journal_fd = open(pager->journal_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (pager->journal_fd == -1)
+        {
+            chidb_Pager_closeJournal(pager, false);
+            return CHIDB_EIO;
+        }
+
+        put4byte(header, PAGER_JOURNAL_MAGIC);
+        put4byte(header + 4, pager->page_size);
+        put4byte(header + 8, pager->txn_pages);
+        if (chidb_Pager_pwrite(pager->journal_fd, header, PAGER_JOURNAL_HEADER_SIZE, 0) != CHIDB_OK)
+        {
+            chidb_Pager_closeJournal(pager, true);
+            return CHIDB_EIO;
+        }
+        pager->journal_size = PAGER_JOURNAL_HEADER_SIZE;
+    }
+
+    page = pager->journal_buf + align;
+    record = page - 4;
+
+    do
+        n = pread(pager->fd, page, pager->page_size, (off_t) (npage - 1) * pager->page_size);
+    while (n == -1 && errno == EINTR);
+    if (n == -1)
+        return CHIDB_EIO;
+    /* Allocated, but never written */
+    if (n < pager->page_size)
+        memset(page + n, 0, pager->page_size - n);
+
+    put4byte(record, npage);
+    put4byte(page + pager->page_size, chidb_crc32c(0, record, pager->page_size + 4));
+    if (chidb_Pager_pwrite(pager->journal_fd, record, size, pager->journal_size) != CHIDB_OK)
+        return CHIDB_EIO;
+
+    pager->journal_size += size;
+    pager->journal_unsynced = true;
+    pager->journaled[(npage - 1) / 8] |= 1 << ((npage - 1) % 8);
+
+    return CHIDB_OK;
+}
+
+
+/* Syncs the records added to the rollback journal since its last sync */
+static int chidb_Pager_syncJournal(Pager *pager)
+{
+    if (!pager->journal_unsynced)
+        return CHIDB_OK;
+
+    if (chidb_Pager_fdatasync(pager, pager->journal_fd) != CHIDB_OK)
+        return CHIDB_EIO;
+    pager->journal_unsynced = false;
+
+    return CHIDB_OK;
+}
+
+
+/* Closes the rollback journal, deleting it if remove_file is true */
+static void chidb_Pager_closeJournal(Pager *pager, bool remove_file)
+{
+    if (pager->journal_fd != -1)
+    {
+        close(pager->journal_fd);
+        if (remove_file)
+            unlink(pager->journal_name);
+    }
+    if (pager->shm != NULL)
+        chidb_Shm_lock(pager->shm, SHM_LOCK_JOURNAL, 1, F_UNLCK, false);
+
+    free(pager->journaled);
+    free(pager->journal_buf);
+    pager->journal_fd = -1;
+    pager->journal_size = 0;
+    pager->journal_unsynced = false;
+    pager->journaled = NULL;
+    pager->journal_buf = NULL;
+}
+
+
+/* Copies the pages saved in the rollback journal open in fd back into the
+ * database file, truncates the file to the size it had when the journal
+ * was started, and syncs it. Playback stops at the first record that is
+ * incomplete or whose checksum doesn't match: it was being written when
+ * the transaction was interrupted, so its page hadn't been overwritten
+ * yet. A journal without a valid header has nothing to play back. */
+static int chidb_Pager_playbackJournal(Pager *pager, int fd)
+{
+    uint8_t header[PAGER_JOURNAL_HEADER_SIZE];
+    uint8_t *buf, *record, *page;
+    uint32_t page_size, size;
+    npage_t npages;
+    size_t align;
+    off_t offset;
+    int rc = CHIDB_OK;
+
+    if (pread(fd, header, PAGER_JOURNAL_HEADER_SIZE, 0) != PAGER_JOURNAL_HEADER_SIZE
+        || get4byte(header) != PAGER_JOURNAL_MAGIC)
+        return CHIDB_OK;
+
+    page_size = get4byte(header + 4);
+    npages = get4byte(header + 8);
+    if (!PAGE_SIZE_VALID(page_size))
+        return CHIDB_OK;
+
+    align = page_size > PAGER_BUF_ALIGN ? page_size : PAGER_BUF_ALIGN;
+    size = PAGER_JOURNAL_RECORD_SIZE(page_size);
+    if (posix_memalign((void **) &buf, align, align + size) != 0)
+        return CHIDB_ENOMEM;
+    page = buf + align;
+    record = page - 4;
+
+    for (offset = PAGER_JOURNAL_HEADER_SIZE; rc == CHIDB_OK; offset += size)
+    {
+        if (pread(fd, record, size, offset) != size
+            || get4byte(page + page_size) != chidb_crc32c(0, record, page_size + 4))
+            break;
+
+        rc = chidb_Pager_pwrite(pager->fd, page, page_size, (off_t) (get4byte(record) - 1) * page_size);
+    }
+    free(buf);
+
+    if (rc == CHIDB_OK && ftruncate(pager->fd, (off_t) npages * page_size) != 0)
+        rc = CHIDB_EIO;
+    if (rc == CHIDB_OK)
+        rc = chidb_Pager_fdatasync(pager, pager->fd);
+
+    chilog(INFO, "Rolled back %i pages from %s", (int) ((offset - PAGER_JOURNAL_HEADER_SIZE) / size), pager->journal_name);
+
+    return rc;
+}
+
+
+/* Rolls back the transaction of a rollback journal left behind by a
+ * pager that didn't get to commit it, if there is one. A journal is
+ * only left behind if no pager holds SHM_LOCK_JOURNAL: otherwise, its
+ * transaction is still in progress. Rolling it back takes SHM_LOCK_DB
+ * exclusively, and then restores whatever lock the pager held on it. */
+static int chidb_Pager_recoverJournal(Pager *pager)
+{
+    short prev = pager->db_lock;
+    int fd, rc = CHIDB_OK;
+
+    if (pager->journal_name == NULL || pager->journal_fd != -1)
+        return CHIDB_OK;
+
+    while (access(pager->journal_name, F_OK) == 0
+           && (pager->shm == NULL || !chidb_Shm_lockedByOthers(pager->shm, SHM_LOCK_JOURNAL)))
+    {
+        rc = chidb_Pager_lockDb(pager, F_UNLCK);
+        if (rc == CHIDB_OK)
+            rc = chidb_Pager_lockDb(pager, F_WRLCK);
+        if (rc != CHIDB_OK)
+            break;
+
+        /* Another pager may have rolled it back, or started a new
+         * transaction, while we waited */
+        if (pager->shm != NULL && chidb_Shm_lockedByOthers(pager->shm, SHM_LOCK_JOURNAL))
+            continue;
+
+        fd = open(pager->journal_name, O_RDONLY);
+        if (fd == -1)
+        {
+            if (errno != ENOENT)
+                rc = CHIDB_EIO;
+            break;
+        }
+
+        rc = chidb_Pager_playbackJournal(pager, fd);
+        close(fd);
+        if (rc != CHIDB_OK)
+            break;
+        unlink(pager->journal_name);
+        if (pager->shm != NULL)
+            __atomic_add_fetch(&pager->shm->header->nchanges, 1, __ATOMIC_ACQ_REL);
+        break;
+    }
+
+    if (pager->db_lock != prev)
+    {
+        int lrc = chidb_Pager_lockDb(pager, F_UNLCK);
+        if (lrc == CHIDB_OK)
+            lrc = chidb_Pager_lockDb(pager, prev);
+        if (rc == CHIDB_OK)
+            rc = lrc;
+    }
+
+    return rc;
+}
+
+
+/* chidb_Pager_checkpoint, with the pager's lock held */
+static int chidb_Pager_checkpointLocked(Pager *pager)
+{
+    uint32_t max_frame;
+    bool reset, locked_writer = false;
+    int rc;
+
+    if (pager->wal == NULL)
+        return CHIDB_OK;
+
+    /* Somebody else is already at it */
+    if (pager->shm != NULL && chidb_Shm_lock(pager->shm, SHM_LOCK_CKPT, 1, F_WRLCK, false) != CHIDB_OK)
+        return CHIDB_OK;
+
+    /* A snapshot may still read the database file as of its horizon, and
+     * so may the readers of other pagers as of their read mark (which
+     * they can't choose while we hold SHM_LOCK_CKPT) */
+    max_frame = pager->wal->max_frame;
+    for (PagerSnapshot *s = pager->snapshots; s != NULL; s = s->next)
+        if (s->horizon < max_frame)
+            max_frame = s->horizon;
+    for (int i = 0; pager->shm != NULL && i < SHM_NREADERS; i++)
+    {
+        uint32_t mark;
+
+        if (i == pager->read_slot || !chidb_Shm_lockedByOthers(pager->shm, SHM_LOCK_READ + i))
+            continue;
+        mark = __atomic_load_n(&pager->shm->header->read_marks[i], __ATOMIC_ACQUIRE);
+        if (mark < max_frame)
+            max_frame = mark;
+    }
+
+    /* Resetting the log rewrites it: nobody else may be writing it, or
+     * reading it */
+    reset = pager->snapshots == NULL;
+    if (reset && pager->shm != NULL && !pager->write_locked)
+    {
+        locked_writer = chidb_Shm_lock(pager->shm, SHM_LOCK_WRITE, 1, F_WRLCK, false) == CHIDB_OK;
+        reset = locked_writer;
+    }
+    if (reset && pager->shm != NULL)
+        reset = chidb_Pager_lockReaders(pager, F_WRLCK) == CHIDB_OK;
+
+    rc = chidb_Wal_checkpoint(pager->wal, pager->fd, max_frame, reset);
+
+    if (reset && pager->shm != NULL)
+        chidb_Pager_lockReaders(pager, F_UNLCK);
+    if (locked_writer)
+        chidb_Shm_lock(pager->shm, SHM_LOCK_WRITE, 1, F_UNLCK, false);
+    if (pager->shm != NULL)
+        chidb_Shm_lock(pager->shm, SHM_LOCK_CKPT, 1, F_UNLCK, false);
+
+    if (rc != CHIDB_OK || pager->wal->n_frames > 0)
+        return rc;
+
+    /* Our own readers read the log as of the reset from now on */
+    if (pager->read_slot != -1)
+        __atomic_store_n(&pager->shm->header->read_marks[pager->read_slot], 0, __ATOMIC_RELEASE);
+
+    /* The log was reset, and frame numbers start over: the pages in the
+     * pool are now the ones in the file, and the older versions that
+     * are still pinned are never found again */
+    for (uint32_t i = 0; pager->frames != NULL && i <= pager->hash_mask; i++)
+        for (MemPage *frame = pager->hash[i]; frame != NULL; frame = frame->hash_next)
+            frame->wal_frame = frame->snapshot ? UINT32_MAX : 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Frame of the log that a snapshot reads page npage from (0 if it reads
+ * it from the database file) */
+static uint32_t chidb_Pager_snapshotFrame(PagerSnapshot *snapshot, npage_t npage)
+{
+    uint32_t frame;
+
+    if (chidb_Wal_findFrame(snapshot->pager->wal, npage, snapshot->horizon, &frame) != CHIDB_OK)
+        return 0;
+    return frame;
+}
+
+
+/* chidb_Pager_readPage for a thread that uses a snapshot, with the
+ * pager's lock held. The version of the page that the snapshot sees is
+ * pinned if some snapshot already read it; otherwise, it is copied
+ * from the current version of the page if that is still the same one
+ * (and nobody is modifying it: pages are marked dirty before their
+ * exclusive latch is released), or read from the log or the file. */
+static int chidb_Pager_readVersionLocked(Pager *pager, PagerSnapshot *snapshot, npage_t npage, MemPage **page)
+{
+    MemPage *frame, *current = NULL;
+    uint32_t wal_frame, version;
+    bool copied = false;
+    int rc;
+
+    if (npage > snapshot->n_pages || npage <= 0)
+        return CHIDB_EPAGENO;
+
+    if (pager->frames == NULL)
+    {
+        rc = chidb_Pager_initCache(pager);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    wal_frame = chidb_Pager_snapshotFrame(snapshot, npage);
+
+    for (frame = pager->hash[npage & pager->hash_mask]; frame != NULL; frame = frame->hash_next)
+    {
+        if (frame->npage != npage)
+            continue;
+
+        if (frame->snapshot && frame->wal_frame == wal_frame)
+        {
+            frame->pins++;
+            frame->referenced = true;
+            pager->stats.cache_hits++;
+            *page = frame;
+            return CHIDB_OK;
+        }
+        if (!frame->snapshot)
+            current = frame;
+    }
+
+    pager->stats.cache_misses++;
+    frame = chidb_Pager_newFrame(pager);
+    if (frame == NULL)
+        return CHIDB_ENOMEM;
+
+    if (current != NULL && !current->dirty && current->wal_frame == wal_frame)
+    {
+        version = chidb_Pager_pageVersion(current);
+        memcpy(frame->data, current->data, pager->page_size);
+        copied = chidb_Pager_validatePage(current, version) && !current->dirty;
+    }
+
+    if (!copied)
+    {
+        rc = chidb_Pager_readFrame(pager, npage, snapshot->horizon, frame->data, &frame->wal_frame);
+        if (rc != CHIDB_OK)
+        {
+            chidb_Pager_freeFrame(frame);
+            return rc;
+        }
+    }
+
+    frame->npage = npage;
+    frame->wal_frame = wal_frame;
+    frame->snapshot = true;
+    frame->pins = 1;
+    frame->dirty = false;
+    frame->referenced = true;
+    frame->hash_next = pager->hash[npage & pager->hash_mask];
+    pager->hash[npage & pager->hash_mask] = frame;
+    pager->nversions++;
+
+    *page = frame;
+
+    return CHIDB_OK;
+}
+
+
+/* Returns true if a snapshot in progress reads this version of a page */
+static bool chidb_Pager_versionNeeded(Pager *pager, MemPage *frame)
+{
+    for (PagerSnapshot *s = pager->snapshots; s != NULL; s = s->next)
+        if (frame->npage <= s->n_pages && chidb_Pager_snapshotFrame(s, frame->npage) == frame->wal_frame)
+            return true;
+
+    return false;
+}
+
+
+/* Removes an older version of a page from the hash table, and frees it */
+static void chidb_Pager_dropVersion(Pager *pager, MemPage *frame)
+{
+    MemPage **p;
+
+    for (p = &pager->hash[frame->npage & pager->hash_mask]; *p != frame; p = &(*p)->hash_next)
+        ;
+    *p = frame->hash_next;
+    pager->nversions--;
+    chidb_Pager_freeFrame(frame);
+}
+
+
+/* Returns true if a page in the buffer pool has changes that haven't
+ * been written out */
+static bool chidb_Pager_hasDirtyPages(Pager *pager)
+{
+    for (uint32_t i = 0; pager->frames != NULL && i < pager->cache_size; i++)
+        if (pager->frames[i].npage != 0 && pager->frames[i].dirty)
+            return true;
+
+    return false;
+}
+
+
+/* Removes a page that another pager changed from the buffer pool, unless
+ * it is pinned (or dirty, or an older version of it) */
+static void chidb_Pager_dropPage(Pager *pager, MemPage *frame)
+{
+    MemPage **p;
+
+    if (!frame->cached || frame->snapshot || frame->pins > 0 || frame->dirty)
+        return;
+
+    for (p = &pager->hash[frame->npage & pager->hash_mask]; *p != frame; p = &(*p)->hash_next)
+        ;
+    *p = frame->hash_next;
+    frame->npage = 0;
+    frame->referenced = false;
+}
+
+
+/* Catches up with the changes that other pagers committed since this
+ * one last did, with the pager's lock held: the pages they changed are
+ * dropped from the buffer pool, and the size of the database is read
+ * again. With a log, the frames they appended tell which pages changed,
+ * unless the log was reset in between. */
+static int chidb_Pager_refreshLocked(Pager *pager)
+{
+    uint32_t nchanges, old_max;
+    int rc;
+
+    if (pager->shm == NULL)
+        return CHIDB_OK;
+
+    nchanges = __atomic_load_n(&pager->shm->header->nchanges, __ATOMIC_ACQUIRE);
+
+    if (pager->wal != NULL)
+    {
+        uint32_t ckpt_seq = pager->wal->ckpt_seq;
+
+        old_max = pager->wal->max_frame;
+        if (pager->write_locked)
+            rc = chidb_Wal_beginWrite(pager->wal);
+        else if (nchanges != pager->nchanges)
+            rc = chidb_Wal_refresh(pager->wal);
+        else
+            return CHIDB_OK;
+        if (rc != CHIDB_OK)
+            return rc;
+
+        if (ckpt_seq != pager->wal->ckpt_seq || pager->wal->max_frame - old_max >= pager->cache_size)
+        {
+            for (uint32_t i = 0; pager->frames != NULL && i < pager->cache_size; i++)
+                if (pager->frames[i].npage != 0)
+                    chidb_Pager_dropPage(pager, &pager->frames[i]);
+        }
+        else
+        {
+            for (uint32_t f = old_max + 1; pager->frames != NULL && f <= pager->wal->max_frame; f++)
+            {
+                npage_t npage = chidb_Wal_framePage(pager->wal, f);
+
+                for (MemPage *frame = pager->hash[npage & pager->hash_mask], *next; frame != NULL; frame = next)
+                {
+                    next = frame->hash_next;
+                    if (frame->npage == npage)
+                        chidb_Pager_dropPage(pager, frame);
+                }
+            }
+        }
+
+        if (pager->wal->max_frame > 0)
+            pager->n_pages = pager->wal->db_size;
+        else
+            chidb_Pager_getRealDBSize(pager, &pager->n_pages);
+    }
+    else if (nchanges != pager->nchanges)
+    {
+        for (uint32_t i = 0; pager->frames != NULL && i < pager->cache_size; i++)
+            if (pager->frames[i].npage != 0)
+                chidb_Pager_dropPage(pager, &pager->frames[i]);
+
+        /* The file may have shrunk under the mapping */
+        if (pager->map != NULL && (pager->frames == NULL || !chidb_Pager_hasPinnedPages(pager)))
+            chidb_Pager_unmap(pager);
+
+        if (pager->page_size != 0)
+            chidb_Pager_getRealDBSize(pager, &pager->n_pages);
+    }
+
+    pager->nchanges = nchanges;
+
+    return CHIDB_OK;
+}
+
+
+/* Takes SHM_LOCK_WRITE before this pager changes the database, if it
+ * doesn't hold it yet, without waiting for it (see
+ * chidb_Pager_beginWrite). Fails if another pager committed changes
+ * that this one hasn't caught up with, while its pages are pinned: they
+ * may be out of date. */
+static int chidb_Pager_lockWriter(Pager *pager)
+{
+    int rc;
+
+    if (pager->shm == NULL || pager->write_locked)
+        return CHIDB_OK;
+
+    rc = chidb_Shm_lock(pager->shm, SHM_LOCK_WRITE, 1, F_WRLCK, false);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if (__atomic_load_n(&pager->shm->header->nchanges, __ATOMIC_ACQUIRE) != pager->nchanges
+        && pager->frames != NULL && chidb_Pager_hasPinnedPages(pager))
+    {
+        chidb_Shm_lock(pager->shm, SHM_LOCK_WRITE, 1, F_UNLCK, false);
+        return CHIDB_EBUSY;
+    }
+
+    pager->write_locked = true;
+    rc = chidb_Pager_refreshLocked(pager);
+
+    /* A writer that died may have left a journal */
+    if (rc == CHIDB_OK && pager->wal == NULL)
+        rc = chidb_Pager_recoverJournal(pager);
+
+    if (rc != CHIDB_OK)
+        chidb_Pager_unlockWriter(pager);
+
+    return rc;
+}
+
+
+/* Releases SHM_LOCK_WRITE once nobody in this pager is writing, and
+ * everything it changed is committed. Without a log, this is also when
+ * the writer stops holding SHM_LOCK_DB exclusively, and tells the other
+ * pagers that the file changed. */
+static void chidb_Pager_unlockWriter(Pager *pager)
+{
+    if (!pager->write_locked || pager->nwriters > 0 || pager->lock_waiters > 0
+        || pager->in_txn || chidb_Pager_hasDirtyPages(pager))
+        return;
+
+    /* Pages evicted to the log outside a transaction aren't committed yet */
+    if (pager->wal != NULL && pager->wal->n_frames > pager->wal->max_frame)
+        return;
+
+    if (pager->wal == NULL && pager->db_lock == F_WRLCK)
+    {
+        __atomic_add_fetch(&pager->shm->header->nchanges, 1, __ATOMIC_ACQ_REL);
+        chidb_Pager_lockDb(pager, pager->nreaders > 0 ? F_RDLCK : F_UNLCK);
+    }
+
+    pager->nchanges = __atomic_load_n(&pager->shm->header->nchanges, __ATOMIC_ACQUIRE);
+    chidb_Shm_lock(pager->shm, SHM_LOCK_WRITE, 1, F_UNLCK, false);
+    pager->write_locked = false;
+}
+
+
+/* Changes the lock this pager holds on SHM_LOCK_DB, waiting for it */
+static int chidb_Pager_lockDb(Pager *pager, short type)
+{
+    int rc;
+
+    if (pager->shm == NULL || pager->db_lock == type)
+        return CHIDB_OK;
+
+    rc = chidb_Shm_lock(pager->shm, SHM_LOCK_DB, 1, type, true);
+    if (rc == CHIDB_OK)
+        pager->db_lock = type;
+
+    return rc;
+}
+
+
+/* Takes one of the SHM_LOCK_READ locks for this pager's readers and
+ * snapshots, if it doesn't hold one yet, and sets its read mark to the
+ * last commit, after catching up with it. The mark is chosen while
+ * holding SHM_LOCK_CKPT in shared mode, so that a checkpoint that
+ * already went past this lock doesn't copy frames beyond it. */
+static int chidb_Pager_holdReadMark(Pager *pager)
+{
+    ShmHeader *h;
+    int rc = CHIDB_EBUSY;
+
+    if (pager->shm == NULL || pager->read_slot != -1)
+        return CHIDB_OK;
+    h = pager->shm->header;
+
+    for (int tries = 0; tries < PAGER_READ_TRIES && rc == CHIDB_EBUSY; tries++)
+    {
+        if (tries > 0)
+            sched_yield();
+        for (int i = 0; i < SHM_NREADERS && rc == CHIDB_EBUSY; i++)
+        {
+            rc = chidb_Shm_lock(pager->shm, SHM_LOCK_READ + i, 1, F_WRLCK, false);
+            if (rc == CHIDB_OK)
+                pager->read_slot = i;
+        }
+    }
+    if (rc != CHIDB_OK)
+        return rc;
+
+    rc = chidb_Shm_lock(pager->shm, SHM_LOCK_CKPT, 1, F_RDLCK, true);
+    if (rc == CHIDB_OK)
+    {
+        if (!pager->write_locked)
+            rc = chidb_Pager_refreshLocked(pager);
+        __atomic_store_n(&h->read_marks[pager->read_slot], pager->wal->max_frame, __ATOMIC_RELEASE);
+        chidb_Shm_lock(pager->shm, SHM_LOCK_CKPT, 1, F_UNLCK, false);
+    }
+
+    if (rc != CHIDB_OK)
+        chidb_Pager_releaseReadMark(pager);
+
+    return rc;
+}
+
+
+/* Releases the SHM_LOCK_READ lock taken by chidb_Pager_holdReadMark */
+static void chidb_Pager_releaseReadMark(Pager *pager)
+{
+    if (pager->read_slot == -1)
+        return;
+
+    chidb_Shm_lock(pager->shm, SHM_LOCK_READ + pager->read_slot, 1, F_UNLCK, false);
+    pager->read_slot = -1;
+}
+
+
+/* Changes the lock on every SHM_LOCK_READ lock but this pager's own,
+ * without waiting (all of them, or none) */
+static int chidb_Pager_lockReaders(Pager *pager, short type)
+{
+    int slot = pager->read_slot, rc;
+
+    if (slot == -1)
+        return chidb_Shm_lock(pager->shm, SHM_LOCK_READ, SHM_NREADERS, type, false);
+
+    rc = slot > 0 ? chidb_Shm_lock(pager->shm, SHM_LOCK_READ, slot, type, false) : CHIDB_OK;
+    if (rc == CHIDB_OK && slot < SHM_NREADERS - 1)
+    {
+        rc = chidb_Shm_lock(pager->shm, SHM_LOCK_READ + slot + 1, SHM_NREADERS - slot - 1, type, false);
+        if (rc != CHIDB_OK && slot > 0)
+            chidb_Shm_lock(pager->shm, SHM_LOCK_READ, slot, F_UNLCK, false);
+    }
+
+    return rc;
 }
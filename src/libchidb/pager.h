@@ -41,30 +41,190 @@
 #define PAGER_H_
 
 #include <stdio.h>
+#include <pthread.h>
 #include "chidbInt.h"
+#include "wal.h"
 
+/* Flags for chidb_Pager_open2 */
+#define PAGER_DIRECT (0x01)    /* Bypass the OS page cache (O_DIRECT) */
+#define PAGER_WAL    (0x02)    /* Use a write-ahead log (see wal.c) */
+#define PAGER_MMAP   (0x04)    /* Enable memory-mapped reads (see chidb_Pager_setMmap) */
+#define PAGER_CHECKSUM (0x08)  /* Keep a checksum at the end of every page */
+#define PAGER_TEMP   (0x10)    /* Scratch file, never synced (see chidb_Pager_open2) */
+#define PAGER_MEMORY (0x20)    /* No file, pages are kept in memory (see chidb_Pager_open2) */
+#define PAGER_COMPRESS (0x40)  /* Compress the pages written to the file (see chidb_Pager_setCompression) */
+
+/* Size of the checksum trailer of each page (see chidb_Pager_setChecksum) */
+#define PAGER_CHECKSUM_SIZE (4)
+
+/* Header of a compressed page (see chidb_Pager_setCompression): the
+ * magic number, the size of the compressed page, and the CRC32C of the
+ * compressed page, which follows */
+#define PAGER_COMPRESSED_MAGIC (0x63685a70)
+#define PAGER_COMPRESSED_HEADER_SIZE (12)
+
+/* Minimum alignment of page buffers. O_DIRECT requires buffers aligned
+ * to the logical block size of the device, so we never go below this. */
+#define PAGER_BUF_ALIGN (4096)
+
+/* Extra bytes after the last frame of the buffer pool. A reader that
+ * doesn't latch a page (see chidb_Pager_pageVersion) may follow a cell
+ * offset that is being rewritten, which can point up to this far past
+ * the start of the page; the slack keeps that read inside the pool. */
+#define PAGER_POOL_SLACK (65536 + 16)
+
+/* Rollback journal (see chidb_Pager_begin). The header holds the magic
+ * number, the page size and the number of pages in the database when the
+ * transaction began. Each record is a page number, the page, and the
+ * CRC32C of both. */
+#define PAGER_JOURNAL_MAGIC (0x63684a6c)
+#define PAGER_JOURNAL_HEADER_SIZE (12)
+#define PAGER_JOURNAL_RECORD_SIZE(page_size) ((page_size) + 8)
+
+/* A MemPage is a frame in the Pager's buffer pool. The npage and data
+ * fields are the only ones that should be used outside the pager; the
+ * remaining fields are buffer pool bookkeeping (see pager.c) */
 struct MemPage
 {
     npage_t npage;
     uint8_t *data;
+
+    uint32_t pins;              /* Number of readPage calls not yet released */
+    bool dirty;                 /* Modified in memory, not yet written to file */
+    bool referenced;            /* CLOCK reference bit */
+    bool cached;                /* False if allocated outside the buffer pool */
+    bool mapped;                /* True if data points into the file mapping */
+    uint32_t map_pins;          /* Pins taken while it pointed into the mapping, that
+                                   may still be using it (see chidb_Pager_readPage) */
+    uint8_t *buf;               /* The frame's own page buffer */
+    struct MemPage *hash_next;  /* Next frame in the same hash bucket */
+    pthread_rwlock_t latch;     /* See chidb_Pager_latchPage */
+    bool exclusive;             /* True while latch is held in exclusive mode */
+    uint32_t version;           /* Odd while latched in exclusive mode (see chidb_Pager_pageVersion) */
+    uint32_t wal_frame;         /* Log frame the page was read from or written to (0 for the file) */
+    bool snapshot;              /* An older version of the page, only seen by snapshots */
 };
 typedef struct MemPage MemPage;
 
+/* A read snapshot (see chidb_Pager_beginSnapshot): the pages as of a
+ * commit in the write-ahead log */
+struct PagerSnapshot
+{
+    struct Pager *pager;
+    uint32_t horizon;            /* Last log frame it sees (0 for none) */
+    npage_t n_pages;             /* Size of the database as of horizon */
+    struct PagerSnapshot *next;  /* Next snapshot of the same pager */
+};
+typedef struct PagerSnapshot PagerSnapshot;
+
 struct Pager
 {
-    FILE *f;
+    int fd;
+    int flags;
+    char *filename;
     npage_t n_pages;
-    uint16_t page_size;
+    uint32_t page_size;
+
+    /* Buffer pool */
+    MemPage *frames;         /* cache_size frames (NULL until first read) */
+    uint8_t *frames_data;    /* cache_size * page_size bytes backing the frames */
+    uint32_t cache_size;     /* Number of frames in the pool */
+    uint32_t clock_hand;     /* Next frame to consider for eviction */
+    MemPage **hash;          /* Page number -> frame, chained on hash_next */
+    uint32_t hash_mask;      /* Number of hash buckets minus one */
+
+    /* Memory-mapped read path (see chidb_Pager_readPageRO) */
+    bool use_mmap;
+    uint8_t *map;            /* Read-only mapping of the file, or NULL */
+    size_t map_size;         /* Number of bytes in the mapping */
+    uint32_t map_pins;       /* Sum of map_pins of the frames */
+
+    /* I/O statistics (see chidb_stats_get) */
+    chidb_stats stats;
+
+    /* Page compression (see chidb_Pager_setCompression) */
+    uint32_t zblock;         /* Block size of the file system */
+    uint8_t *zbuf;           /* A page, to compress or decompress into (NULL until needed) */
+    uint32_t zbuf_size;
+
+    /* Trace callback (see chidb_set_trace) */
+    chidb_tracer trace;
+
+    /* Write-ahead log (only if opened with PAGER_WAL) */
+    Wal *wal;                /* NULL until the page size is set */
+    uint32_t autocheckpoint; /* Checkpoint when the log has this many frames */
+    PagerSnapshot *snapshots;/* Snapshots in progress (see chidb_Pager_beginSnapshot) */
+    uint32_t nversions;      /* Frames holding older versions of pages */
+
+    /* Other pagers of the same file, in this process or others (see
+     * chidb_Pager_beginRead) */
+    Shm *shm;                /* Shared memory file (NULL for scratch files) */
+    uint32_t nchanges;       /* Changes to the file that the pool is up to date with (see chidb_Pager_changes) */
+    uint32_t nreaders;       /* chidb_Pager_beginRead calls not yet ended */
+    uint32_t nwriters;       /* chidb_Pager_beginWrite calls not yet ended */
+    uint32_t lock_waiters;   /* Threads waiting for SHM_LOCK_WRITE in beginWrite */
+    bool write_locked;       /* SHM_LOCK_WRITE is held */
+    short db_lock;           /* SHM_LOCK_DB lock held (F_UNLCK, F_RDLCK or F_WRLCK) */
+    int read_slot;           /* SHM_LOCK_READ lock held (-1 for none) */
+
+    /* Explicit transaction (see chidb_Pager_begin) */
+    bool in_txn;
+    npage_t txn_pages;       /* n_pages when the transaction began */
+    char *journal_name;      /* Rollback journal (NULL for scratch files) */
+    int journal_fd;          /* -1 until a page is saved in the journal */
+    off_t journal_size;
+    bool journal_unsynced;   /* Records were added since the last sync */
+    uint8_t *journaled;      /* Bitmap of the pages in the journal */
+    uint8_t *journal_buf;    /* A record, with the page aligned (see chidb_Pager_journalPage) */
+
+    /* Contents of the database, when opened with PAGER_MEMORY */
+    uint8_t **mem;           /* One buffer per page (NULL if never written) */
+    npage_t mem_pages;       /* Pages in the database, as the size of the file would be */
+    npage_t mem_alloc;       /* Slots in mem */
+    uint8_t **mem_saved;     /* Buffers of the pages in the journal (txn_pages slots) */
+
+    pthread_mutex_t lock;    /* Protects the buffer pool (see pager.c) */
 };
 typedef struct Pager Pager;
 
 int chidb_Pager_open(Pager **pager, const char *filename);
-int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize);
+int chidb_Pager_open2(Pager **pager, const char *filename, int flags);
+int chidb_Pager_setPageSize(Pager *pager, uint32_t pagesize);
+int chidb_Pager_setCacheSize(Pager *pager, uint32_t npages);
+int chidb_Pager_setChecksum(Pager *pager, bool enable);
+int chidb_Pager_setCompression(Pager *pager, bool enable);
+uint32_t chidb_Pager_usableSize(Pager *pager);
 int chidb_Pager_readHeader(Pager *pager, uint8_t *header);
 int chidb_Pager_allocatePage(Pager *pager, npage_t *npage);
+int chidb_Pager_truncate(Pager *pager, npage_t npages);
 int chidb_Pager_releaseMemPage(Pager *pager, MemPage *page);
 int	chidb_Pager_readPage(Pager *pager, npage_t page_num, MemPage **page);
+int chidb_Pager_readPageRO(Pager *pager, npage_t page_num, MemPage **page);
+int chidb_Pager_setMmap(Pager *pager, bool enable);
+int chidb_Pager_prefetch(Pager *pager, const npage_t *npages, uint32_t n);
+int chidb_Pager_readPages(Pager *pager, npage_t first, npage_t n, uint8_t *buf);
+uint32_t chidb_Pager_changes(Pager *pager);
 int chidb_Pager_writePage(Pager *pager, MemPage *page);
+int chidb_Pager_latchPage(Pager *pager, MemPage *page, bool exclusive);
+int chidb_Pager_unlatchPage(Pager *pager, MemPage *page);
+uint32_t chidb_Pager_pageVersion(MemPage *page);
+bool chidb_Pager_validatePage(MemPage *page, uint32_t version);
+void chidb_Pager_lock(Pager *pager);
+void chidb_Pager_unlock(Pager *pager);
+int chidb_Pager_flush(Pager *pager);
+int chidb_Pager_begin(Pager *pager);
+int chidb_Pager_commit(Pager *pager);
+int chidb_Pager_rollback(Pager *pager);
+bool chidb_Pager_inTransaction(Pager *pager);
+int chidb_Pager_beginRead(Pager *pager);
+int chidb_Pager_endRead(Pager *pager);
+int chidb_Pager_beginWrite(Pager *pager);
+int chidb_Pager_endWrite(Pager *pager);
+int chidb_Pager_beginSnapshot(Pager *pager, PagerSnapshot **snapshot);
+int chidb_Pager_endSnapshot(Pager *pager, PagerSnapshot *snapshot);
+PagerSnapshot *chidb_Pager_useSnapshot(PagerSnapshot *snapshot);
+int chidb_Pager_checkpoint(Pager *pager);
+int chidb_Pager_setAutoCheckpoint(Pager *pager, uint32_t nframes);
 int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages);
 int chidb_Pager_close(Pager *pager);
 
@@ -0,0 +1,879 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * Query plans: EXPLAIN QUERY PLAN and EXPLAIN ANALYZE.
+ *
+ * The plan of a statement is its optimized SRA tree, one node per
+ * operator, each with what the optimizer chose for it (a scan of a
+ * table or a seek on one of its indexes, how a join is run, whether an
+ * aggregate hashes its rows or streams them, whether an ORDER BY sorts
+ * them) and the number of rows it expects from it (see optimizer.c).
+ *
+ * EXPLAIN QUERY PLAN produces the plan, one row per node, instead of
+ * running the statement. EXPLAIN ANALYZE generates the program of the
+ * statement as usual, and the first time it is stepped, runs it to the
+ * end, profiled (see chidb_profile_start), discarding its rows. Each
+ * instruction is attributed to the node codegen generated it for (see
+ * chidb_plan_mark), so that the rows, page reads and time of each node
+ * can be added up, and the program is then replaced with one that
+ * produces the plan with those figures next to the estimates.
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include "plan.h"
+#include "dbm.h"
+#include "catalog.h"
+#include "util.h"
+
+/* Implemented in optimizer.c */
+double chidb_stmt_estimate(chidb *db, SRA_t *sra);
+
+/* Columns of the plan: EXPLAIN QUERY PLAN has the first
+ * PLAN_QUERY_NCOLS, and EXPLAIN ANALYZE all of them */
+#define PLAN_QUERY_NCOLS (4)
+#define PLAN_ANALYZE_NCOLS (7)
+
+static const char *plan_cols[PLAN_ANALYZE_NCOLS] =
+    {"id", "parent", "detail", "est_rows", "rows", "pages", "time_us"};
+
+
+/*** Describing operators ***/
+
+static void plan_expr(FILE *f, Expression_t *expr);
+
+static void plan_literal(FILE *f, Literal_t *lit)
+{
+    switch (lit->t)
+    {
+    case TYPE_INT:
+        fprintf(f, "%d", lit->val.ival);
+        break;
+    case TYPE_DOUBLE:
+        fprintf(f, "%g", lit->val.dval);
+        break;
+    case TYPE_CHAR:
+        fprintf(f, "'%c'", lit->val.cval);
+        break;
+    case TYPE_TEXT:
+        fprintf(f, "'%s'", lit->val.strval);
+        break;
+    case TYPE_PARAM:
+        fprintf(f, "?%d", lit->val.ival + 1);
+        break;
+    }
+}
+
+static void plan_term(FILE *f, ExprTerm *term)
+{
+    static const char *funcs[] = {"MAX", "MIN", "COUNT", "AVG", "SUM"};
+
+    switch (term->t)
+    {
+    case TERM_LITERAL:
+        plan_literal(f, term->val);
+        break;
+    case TERM_ID:
+        fputs(term->id, f);
+        break;
+    case TERM_NULL:
+        fputs("NULL", f);
+        break;
+    case TERM_COLREF:
+        if (term->ref->tableName != NULL)
+            fprintf(f, "%s.", term->ref->tableName);
+        fputs(term->ref->columnName, f);
+        break;
+    case TERM_FUNC:
+        fprintf(f, "%s(", funcs[term->f.t]);
+        plan_expr(f, term->f.expr);
+        fputc(')', f);
+        break;
+    }
+}
+
+/* An operand of an operator, in parentheses unless it is a term */
+static void plan_operand(FILE *f, Expression_t *expr)
+{
+    if (expr->t == EXPR_TERM)
+        plan_expr(f, expr);
+    else
+    {
+        fputc('(', f);
+        plan_expr(f, expr);
+        fputc(')', f);
+    }
+}
+
+static void plan_expr(FILE *f, Expression_t *expr)
+{
+    static const char *ops[] = {NULL, " + ", " - ", " * ", " / ", " || "};
+
+    switch (expr->t)
+    {
+    case EXPR_TERM:
+        plan_term(f, &expr->expr.term);
+        break;
+    case EXPR_NEG:
+        fputc('-', f);
+        plan_operand(f, expr->expr.unary.expr);
+        break;
+    default:
+        plan_operand(f, expr->expr.binary.expr1);
+        fputs(ops[expr->t], f);
+        plan_operand(f, expr->expr.binary.expr2);
+        break;
+    }
+}
+
+/* A list of expressions (the columns of a projection, or of a GROUP BY) */
+static void plan_exprList(FILE *f, Expression_t *expr)
+{
+    for (; expr != NULL; expr = expr->next)
+    {
+        plan_expr(f, expr);
+        if (expr->alias != NULL)
+            fprintf(f, " AS %s", expr->alias);
+        if (expr->next != NULL)
+            fputs(", ", f);
+    }
+}
+
+static void plan_cond(FILE *f, Condition_t *cond);
+
+/* An operand of AND or OR, in parentheses if it is the other one */
+static void plan_condOperand(FILE *f, Condition_t *cond, enum CondType t)
+{
+    if ((cond->t == RA_COND_AND || cond->t == RA_COND_OR) && cond->t != t)
+    {
+        fputc('(', f);
+        plan_cond(f, cond);
+        fputc(')', f);
+    }
+    else
+        plan_cond(f, cond);
+}
+
+static void plan_cond(FILE *f, Condition_t *cond)
+{
+    static const char *ops[] = {" = ", " < ", " > ", " <= ", " >= ", " AND ", " OR "};
+
+    switch (cond->t)
+    {
+    case RA_COND_EQ:
+    case RA_COND_LT:
+    case RA_COND_GT:
+    case RA_COND_LEQ:
+    case RA_COND_GEQ:
+        plan_expr(f, cond->cond.comp.expr1);
+        fputs(ops[cond->t], f);
+        plan_expr(f, cond->cond.comp.expr2);
+        break;
+    case RA_COND_AND:
+    case RA_COND_OR:
+        plan_condOperand(f, cond->cond.binary.cond1, cond->t);
+        fputs(ops[cond->t], f);
+        plan_condOperand(f, cond->cond.binary.cond2, cond->t);
+        break;
+    case RA_COND_NOT:
+        fputs("NOT (", f);
+        plan_cond(f, cond->cond.unary.cond);
+        fputc(')', f);
+        break;
+    case RA_COND_IN:
+        plan_expr(f, cond->cond.in.expr);
+        fputs(" IN (", f);
+        if (cond->cond.in.select != NULL)
+            fputs("SELECT ...", f);
+        for (Literal_t *lit = cond->cond.in.values_list; lit != NULL; lit = lit->next)
+        {
+            plan_literal(f, lit);
+            if (lit->next != NULL)
+                fputs(", ", f);
+        }
+        fputc(')', f);
+        break;
+    }
+}
+
+static void plan_tableName(FILE *f, TableReference_t *ref)
+{
+    fprintf(f, "TABLE %s", ref->table_name);
+    if (ref->alias != NULL)
+        fprintf(f, " AS %s", ref->alias);
+}
+
+/* Name of the index that a selection on a table reads: the hash index
+ * it looks up, or else the one that its seek range (or IN probes) is
+ * read from, on the column its first bound compares to a value */
+static const char *plan_seekIndex(chidb *db, SRA_t *select)
+{
+    Condition_t *bound = select->select.hash != NULL ? select->select.hash :
+                         select->select.probe != NULL ? select->select.probe :
+                         select->select.seek != NULL ? select->select.seek : select->select.seek_end;
+    Expression_t *col = bound->cond.comp.expr1;
+    chidb_catalog_table_t *table;
+    chidb_catalog_index_t *index;
+
+    if (bound->t == RA_COND_IN)
+        col = bound->cond.in.expr;
+    else if (col->t != EXPR_TERM || col->expr.term.t != TERM_COLREF)
+        col = bound->cond.comp.expr2;
+    if (col->t != EXPR_TERM || col->expr.term.t != TERM_COLREF)
+        return "?";
+
+    table = chidb_catalog_table(db, select->select.sra->table.ref->table_name);
+    if (table == NULL)
+        return "?";
+    index = select->select.hash != NULL ? chidb_catalog_hashIndex(table, col->expr.term.ref->columnName)
+                                        : chidb_catalog_index(table, col->expr.term.ref->columnName);
+    return index != NULL ? index->name : "?";
+}
+
+/* Whether a list of expressions has an aggregate function */
+static bool plan_hasAggregate(Expression_t *expr)
+{
+    for (; expr != NULL; expr = expr->next)
+        if (expr->t == EXPR_TERM && expr->expr.term.t == TERM_FUNC)
+            return true;
+    return false;
+}
+
+/* Separator before each of the choices of a projection after the
+ * first: "PROJECT a (HASH AGGREGATE BY a, SORT BY a)" */
+static void plan_choice(FILE *f, int *nchoices)
+{
+    fputs((*nchoices)++ == 0 ? " (" : ", ", f);
+}
+
+static void plan_project(FILE *f, SRA_t *sra)
+{
+    SRA_Project_t *p = &sra->project;
+    static const char *shortcuts[] = {NULL, "COUNT", "MIN", "MAX"};
+    int nchoices = 0;
+
+    fputs("PROJECT ", f);
+    plan_exprList(f, p->expr_list);
+
+    if (p->shortcut != SHORTCUT_NONE)
+    {
+        plan_choice(f, &nchoices);
+        fprintf(f, "SHORTCUT %s", shortcuts[p->shortcut]);
+    }
+    else if (p->group_by != NULL || plan_hasAggregate(p->expr_list))
+    {
+        plan_choice(f, &nchoices);
+        fprintf(f, "%s%s AGGREGATE", p->parallel ? "PARALLEL " : "", p->grouped ? "STREAM" : "HASH");
+        if (p->group_by != NULL)
+        {
+            fputs(" BY ", f);
+            plan_exprList(f, p->group_by);
+        }
+    }
+    if (p->distinct)
+    {
+        plan_choice(f, &nchoices);
+        fprintf(f, "%s DISTINCT", p->grouped ? "STREAM" : "HASH");
+    }
+    if (p->order_by != NULL)
+    {
+        plan_choice(f, &nchoices);
+        fputs(p->sorted ? "ORDER BY " : "SORT BY ", f);
+        plan_expr(f, p->order_by);
+        if (p->asc_desc == ORDER_BY_DESC)
+            fputs(" DESC", f);
+        if (p->sorted)
+            fputs(" USING INDEX", f);
+    }
+    if (p->limit != NULL)
+    {
+        plan_choice(f, &nchoices);
+        fputs("LIMIT ", f);
+        plan_literal(f, p->limit);
+        if (p->offset != NULL)
+        {
+            fputs(" OFFSET ", f);
+            plan_literal(f, p->offset);
+        }
+    }
+    if (nchoices > 0)
+        fputc(')', f);
+}
+
+static void plan_join(FILE *f, SRA_t *sra)
+{
+    static const char *methods[] = {"NESTED LOOP", "HASH", "INDEX"};
+    JoinCondition_t *cond = sra->join.opt_cond;
+
+    fputs(methods[sra->join.method], f);
+    if (sra->join.semi)
+    {
+        fputs(" SEMI JOIN ON ", f);
+        plan_cond(f, sra->join.key);
+        return;
+    }
+    switch (sra->t)
+    {
+    case SRA_LEFT_OUTER_JOIN:
+        fputs(" LEFT OUTER", f);
+        break;
+    case SRA_RIGHT_OUTER_JOIN:
+        fputs(" RIGHT OUTER", f);
+        break;
+    case SRA_FULL_OUTER_JOIN:
+        fputs(" FULL OUTER", f);
+        break;
+    default:
+        break;
+    }
+    fputs(" JOIN", f);
+
+    if (cond != NULL && cond->t == JOIN_COND_ON)
+    {
+        fputs(" ON ", f);
+        plan_cond(f, cond->on);
+    }
+    else if (cond != NULL)
+    {
+        fputs(" USING (", f);
+        for (unsigned int i = 0; i < StrList_size(cond->col_list); i++)
+            fprintf(f, "%s%s", i > 0 ? ", " : "", StrList_get(cond->col_list, i));
+        fputc(')', f);
+    }
+}
+
+/* Describes the operator sra into f. A selection right above a table is
+ * a single operator, that reads the table. */
+static void plan_describe(chidb *db, FILE *f, SRA_t *sra)
+{
+    static const char *sets[] = {"HASH", "MERGE"};
+
+    switch (sra->t)
+    {
+    case SRA_TABLE:
+        fputs("SCAN ", f);
+        plan_tableName(f, sra->table.ref);
+        break;
+    case SRA_SELECT:
+        if (sra->select.sra->t != SRA_TABLE)
+            fputs("FILTER", f);
+        else if (sra->select.hash != NULL)
+        {
+            fputs("SEARCH ", f);
+            plan_tableName(f, sra->select.sra->table.ref);
+            fprintf(f, " USING HASH INDEX %s (", plan_seekIndex(db, sra));
+            plan_cond(f, sra->select.hash);
+            fputc(')', f);
+        }
+        else if (sra->select.probe != NULL)
+        {
+            /* On the primary key, the table itself is sought */
+            const char *index = plan_seekIndex(db, sra);
+
+            fputs("SEARCH ", f);
+            plan_tableName(f, sra->select.sra->table.ref);
+            if (strcmp(index, "?") != 0)
+                fprintf(f, " USING INDEX %s", index);
+            fputs(" FOR EACH OF (", f);
+            plan_cond(f, sra->select.probe);
+            fputc(')', f);
+        }
+        else if (sra->select.seek == NULL && sra->select.seek_end == NULL)
+        {
+            fputs("SCAN ", f);
+            plan_tableName(f, sra->select.sra->table.ref);
+            if (sra->select.zone != NULL)
+            {
+                fputs(" USING ZONE MAP (", f);
+                plan_cond(f, sra->select.zone);
+                fputc(')', f);
+            }
+        }
+        else
+        {
+            fputs("SEARCH ", f);
+            plan_tableName(f, sra->select.sra->table.ref);
+            fprintf(f, " USING INDEX %s (", plan_seekIndex(db, sra));
+            if (sra->select.seek != NULL)
+                plan_cond(f, sra->select.seek);
+            if (sra->select.seek_end != NULL && sra->select.seek_end != sra->select.seek)
+            {
+                if (sra->select.seek != NULL)
+                    fputs(" AND ", f);
+                plan_cond(f, sra->select.seek_end);
+            }
+            fputc(')', f);
+        }
+        fputs(" WHERE ", f);
+        plan_cond(f, sra->select.cond);
+        break;
+    case SRA_PROJECT:
+        plan_project(f, sra);
+        break;
+    case SRA_JOIN:
+    case SRA_LEFT_OUTER_JOIN:
+    case SRA_RIGHT_OUTER_JOIN:
+    case SRA_FULL_OUTER_JOIN:
+        plan_join(f, sra);
+        break;
+    case SRA_NATURAL_JOIN:
+        fputs("NATURAL JOIN", f);
+        break;
+    case SRA_UNION:
+        fprintf(f, "UNION (%s)", sets[sra->binary.method]);
+        break;
+    case SRA_INTERSECT:
+        fprintf(f, "INTERSECT (%s)", sets[sra->binary.method]);
+        break;
+    case SRA_EXCEPT:
+        fprintf(f, "EXCEPT (%s)", sets[sra->binary.method]);
+        break;
+    }
+}
+
+/* Rows the optimizer expects from sra. Those of a projection also
+ * account for its aggregate and its LIMIT. */
+static double plan_estimate(chidb *db, SRA_t *sra)
+{
+    SRA_Project_t *p = &sra->project;
+    double rows = chidb_stmt_estimate(db, sra);
+
+    if (sra->t != SRA_PROJECT)
+        return rows;
+
+    if (p->shortcut != SHORTCUT_NONE || (p->group_by == NULL && plan_hasAggregate(p->expr_list)))
+        rows = 1;
+    if (p->limit != NULL && p->limit->t == TYPE_INT && rows > p->limit->val.ival)
+        rows = p->limit->val.ival;
+
+    return rows;
+}
+
+
+/*** Building the plan ***/
+
+/* Appends a node to the plan, and returns its index (or -1 if there
+ * isn't enough memory). detail is formatted as for printf, and indented
+ * for depth. */
+static int32_t plan_add(chidb_plan_t *plan, int32_t parent, int depth, SRA_t *sra,
+                        double est_rows, const char *detail)
+{
+    chidb_plan_node_t *node;
+
+    if (plan->n == plan->cap)
+    {
+        uint32_t cap = plan->cap ? plan->cap * 2 : 8;
+        chidb_plan_node_t *nodes = realloc(plan->nodes, cap * sizeof(chidb_plan_node_t));
+
+        if (nodes == NULL)
+            return -1;
+        plan->nodes = nodes;
+        plan->cap = cap;
+    }
+
+    node = &plan->nodes[plan->n];
+    memset(node, 0, sizeof(chidb_plan_node_t));
+    if (depth == 0)
+        node->detail = strdup(detail);
+    else if (asprintf(&node->detail, "%*s-> %s", 2 * (depth - 1), "", detail) < 0)
+        node->detail = NULL;
+    if (node->detail == NULL)
+        return -1;
+
+    node->parent = parent;
+    node->sra = sra;
+    node->row_pc = -1;
+    node->est_rows = est_rows;
+
+    return plan->n++;
+}
+
+/* Adds sra, and the operators below it, to the plan, in pre-order */
+static int plan_walk(chidb *db, chidb_plan_t *plan, SRA_t *sra, int32_t parent, int depth)
+{
+    char *detail = NULL;
+    size_t len;
+    FILE *f;
+    int32_t node;
+    int rc = CHIDB_OK;
+
+    if ((f = open_memstream(&detail, &len)) == NULL)
+        return CHIDB_ENOMEM;
+    plan_describe(db, f, sra);
+    fclose(f);
+
+    node = plan_add(plan, parent, depth, sra, plan_estimate(db, sra), detail);
+    free(detail);
+    if (node < 0)
+        return CHIDB_ENOMEM;
+
+    switch (sra->t)
+    {
+    case SRA_TABLE:
+        break;
+    case SRA_SELECT:
+        if (sra->select.sra->t != SRA_TABLE)
+            rc = plan_walk(db, plan, sra->select.sra, node, depth + 1);
+        break;
+    case SRA_PROJECT:
+        rc = plan_walk(db, plan, sra->project.sra, node, depth + 1);
+        break;
+    case SRA_JOIN:
+    case SRA_LEFT_OUTER_JOIN:
+    case SRA_RIGHT_OUTER_JOIN:
+    case SRA_FULL_OUTER_JOIN:
+        rc = plan_walk(db, plan, sra->join.sra1, node, depth + 1);
+        if (rc == CHIDB_OK)
+            rc = plan_walk(db, plan, sra->join.sra2, node, depth + 1);
+        break;
+    default:
+        rc = plan_walk(db, plan, sra->binary.sra1, node, depth + 1);
+        if (rc == CHIDB_OK)
+            rc = plan_walk(db, plan, sra->binary.sra2, node, depth + 1);
+        break;
+    }
+
+    return rc;
+}
+
+/* Builds the plan of an EXPLAIN QUERY PLAN or EXPLAIN ANALYZE
+ * statement (sql_stmt->plan) into stmt->plan, from its optimized tree.
+ * A statement other than a SELECT is a single node.
+ *
+ * Parameters
+ * - stmt: Statement being prepared
+ * - sql_stmt: Optimized statement
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_plan_build(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+{
+    chidb_plan_t *plan;
+    char *detail = NULL;
+    int rc = CHIDB_OK;
+
+    if ((plan = calloc(1, sizeof(chidb_plan_t))) == NULL)
+        return CHIDB_ENOMEM;
+    plan->analyze = sql_stmt->plan == PLAN_ANALYZE;
+    stmt->plan = plan;
+
+    switch (sql_stmt->type)
+    {
+    case STMT_SELECT:
+        return plan_walk(stmt->db, plan, sql_stmt->stmt.select, -1, 0);
+    case STMT_INSERT:
+        rc = asprintf(&detail, "INSERT INTO TABLE %s", sql_stmt->stmt.insert->table_name);
+        break;
+    case STMT_DELETE:
+        rc = asprintf(&detail, "DELETE FROM TABLE %s", sql_stmt->stmt.delete->table_name);
+        break;
+    case STMT_CREATE:
+        if (sql_stmt->stmt.create->t == CREATE_TABLE)
+            rc = asprintf(&detail, "CREATE TABLE %s", sql_stmt->stmt.create->table->name);
+        else
+            rc = asprintf(&detail, "CREATE INDEX %s ON TABLE %s",
+                          sql_stmt->stmt.create->index->name, sql_stmt->stmt.create->index->table_name);
+        break;
+    case STMT_ANALYZE:
+        rc = asprintf(&detail, "ANALYZE TABLE %s", sql_stmt->stmt.analyze);
+        break;
+    default:
+        detail = strdup("TRANSACTION CONTROL");
+        break;
+    }
+
+    if (rc < 0 || detail == NULL)
+        return CHIDB_ENOMEM;
+    rc = plan_add(plan, -1, 0, NULL, 1, detail) < 0 ? CHIDB_ENOMEM : CHIDB_OK;
+    free(detail);
+
+    return rc;
+}
+
+static int32_t plan_find(chidb_plan_t *plan, SRA_t *sra)
+{
+    for (uint32_t i = 0; i < plan->n; i++)
+        if (plan->nodes[i].sra == sra)
+            return i;
+    return -1;
+}
+
+/* Attributes instructions start to end - 1 to the node of sra, except
+ * for those already attributed to another node. Codegen marks the
+ * instructions of each operator once it has generated them, so that
+ * those of the operators below it, generated (and marked) first, stay
+ * theirs. Does nothing if the statement has no plan.
+ *
+ * Parameters
+ * - stmt: Statement being generated
+ * - sra: Operator of its optimized tree (the selection, for a
+ *        selection right above a table)
+ * - start, end: Instructions generated for it
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_plan_mark(chidb_stmt *stmt, SRA_t *sra, uint32_t start, uint32_t end)
+{
+    chidb_plan_t *plan = stmt->plan;
+    int32_t node;
+
+    if (plan == NULL || (node = plan_find(plan, sra)) < 0)
+        return CHIDB_OK;
+
+    if (end > plan->nowner)
+    {
+        int32_t *owner = realloc(plan->owner, end * sizeof(int32_t));
+
+        if (owner == NULL)
+            return CHIDB_ENOMEM;
+        for (uint32_t i = plan->nowner; i < end; i++)
+            owner[i] = -1;
+        plan->owner = owner;
+        plan->nowner = end;
+    }
+
+    for (uint32_t i = start; i < end; i++)
+        if (plan->owner[i] < 0)
+            plan->owner[i] = node;
+
+    return CHIDB_OK;
+}
+
+/* Tells the plan that each row produced by sra goes through instruction
+ * pc (where a scan moves to its next row, or where a join has found a
+ * match), so that EXPLAIN ANALYZE counts its rows. The rows of the root
+ * are those that the statement returns, unless codegen tells otherwise.
+ * Does nothing if the statement has no plan. */
+void chidb_plan_row(chidb_stmt *stmt, SRA_t *sra, uint32_t pc)
+{
+    int32_t node;
+
+    if (stmt->plan != NULL && (node = plan_find(stmt->plan, sra)) >= 0)
+        stmt->plan->nodes[node].row_pc = pc;
+}
+
+
+/*** Running it ***/
+
+/* Runs an EXPLAIN ANALYZE statement, discarding its rows, and replaces
+ * its program with one that produces its plan with the figures of the
+ * run (see chidb_plan_codegen). Called by chidb_step the first time it
+ * steps the statement.
+ *
+ * The figures of a node include those of the nodes below it.
+ * Instructions that codegen didn't attribute to a node (such as those
+ * that open cursors) count for the root. The time of each node is
+ * the share of the wall-clock time of the run that its instructions
+ * took in cycles.
+ *
+ * Parameters
+ * - stmt: EXPLAIN ANALYZE statement
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Any error of the statement, which is reset, so that it can be
+ *   stepped again
+ */
+int chidb_plan_analyze(chidb_stmt *stmt)
+{
+    chidb_plan_t *plan = stmt->plan;
+    bool profiled = stmt->profile != NULL;
+    uint64_t nrows = 0, cycles = 0, ns;
+    uint64_t *nodecycles;
+    int rc;
+
+    rc = chidb_profile_start(stmt);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    plan->running = true;
+    ns = chidb_time_ns();
+    while ((rc = chidb_step(stmt)) == CHIDB_ROW)
+        nrows++;
+    ns = chidb_time_ns() - ns;
+    plan->running = false;
+
+    if (rc != CHIDB_DONE || (nodecycles = calloc(plan->n, sizeof(uint64_t))) == NULL)
+    {
+        chidb_stmt_reset(stmt);
+        if (!profiled)
+        {
+            free(stmt->profile);
+            stmt->profile = NULL;
+        }
+        return rc != CHIDB_DONE ? rc : CHIDB_ENOMEM;
+    }
+
+    for (uint32_t pc = 0; pc < stmt->endOp; pc++)
+    {
+        int32_t node = pc < plan->nowner && plan->owner[pc] >= 0 ? plan->owner[pc] : 0;
+
+        nodecycles[node] += stmt->profile[pc].cycles;
+        plan->nodes[node].pages += stmt->profile[pc].pages;
+        cycles += stmt->profile[pc].cycles;
+    }
+    for (uint32_t i = 0; i < plan->n; i++)
+    {
+        chidb_plan_node_t *node = &plan->nodes[i];
+
+        if (node->row_pc >= 0 && node->row_pc < stmt->endOp)
+            node->rows = stmt->profile[node->row_pc].count;
+        else if (i == 0)
+            node->rows = nrows;
+    }
+
+    /* Children come after their parent */
+    for (uint32_t i = plan->n; i-- > 1; )
+    {
+        chidb_plan_node_t *node = &plan->nodes[i];
+
+        nodecycles[node->parent] += nodecycles[i];
+        plan->nodes[node->parent].pages += node->pages;
+    }
+    for (uint32_t i = 0; i < plan->n; i++)
+        plan->nodes[i].ns = cycles > 0 ? (uint64_t) ((double) nodecycles[i] * ns / cycles) : 0;
+    free(nodecycles);
+
+    chidb_stmt_reset(stmt);
+    free(stmt->profile);
+    stmt->profile = NULL;
+    plan->analyzed = true;
+
+    rc = chidb_plan_codegen(stmt);
+    if (rc == CHIDB_OK && profiled)
+        rc = chidb_profile_start(stmt);
+
+    return rc;
+}
+
+
+/*** Producing it ***/
+
+/* Replaces the program of a statement with one that produces its plan,
+ * a row per node: its id (index in the plan), the id of its parent
+ * (NULL for the root), its detail and the rows the optimizer expects
+ * from it, followed, once EXPLAIN ANALYZE has run it, by the rows, page
+ * reads and microseconds it took (NULL rows for an operator that codegen
+ * didn't count the rows of).
+ *
+ * Parameters
+ * - stmt: Statement with a plan
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_plan_codegen(chidb_stmt *stmt)
+{
+    chidb_plan_t *plan = stmt->plan;
+    int ncols = chidb_plan_ncols(plan);
+    uint32_t opnum = 0;
+    int rc = CHIDB_OK;
+
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        free(stmt->ops[i].p4);
+        stmt->ops[i].p4 = NULL;
+    }
+    stmt->endOp = 0;
+    for (uint32_t i = 0; i < stmt->nCols; i++)
+        free(stmt->cols[i]);
+    free(stmt->cols);
+
+    stmt->nCols = ncols;
+    if ((stmt->cols = calloc(ncols, sizeof(char *))) == NULL)
+    {
+        stmt->nCols = 0;
+        return CHIDB_ENOMEM;
+    }
+    for (int i = 0; i < ncols; i++)
+        if ((stmt->cols[i] = strdup(plan_cols[i])) == NULL)
+            return CHIDB_ENOMEM;
+
+    for (uint32_t i = 0; i < plan->n && rc == CHIDB_OK; i++)
+    {
+        chidb_plan_node_t *node = &plan->nodes[i];
+        double est = node->est_rows < INT32_MAX ? node->est_rows + 0.5 : INT32_MAX;
+        chidb_dbm_op_t ops[] = {
+                {Op_Integer, i, 0, 0, NULL},
+                {Op_Integer, node->parent, 1, 0, NULL},
+                {Op_String, strlen(node->detail), 2, 0, node->detail},
+                {Op_Integer, (int32_t) est, 3, 0, NULL},
+                {Op_Integer, node->rows < INT32_MAX ? node->rows : INT32_MAX, 4, 0, NULL},
+                {Op_Integer, node->pages < INT32_MAX ? node->pages : INT32_MAX, 5, 0, NULL},
+                {Op_Integer, node->ns / 1000 < INT32_MAX ? node->ns / 1000 : INT32_MAX, 6, 0, NULL},
+        };
+
+        if (node->parent < 0)
+            ops[1] = (chidb_dbm_op_t) {Op_Null, 0, 1, 0, NULL};
+        if (node->row_pc < 0 && i > 0)
+            ops[4] = (chidb_dbm_op_t) {Op_Null, 0, 4, 0, NULL};
+
+        for (int j = 0; j < ncols && rc == CHIDB_OK; j++)
+            rc = chidb_stmt_set_op(stmt, &ops[j], opnum++);
+        if (rc == CHIDB_OK)
+            rc = chidb_stmt_set_op(stmt, &(chidb_dbm_op_t) {Op_ResultRow, 0, ncols, 0, NULL}, opnum++);
+    }
+    if (rc == CHIDB_OK)
+        rc = chidb_stmt_set_op(stmt, &(chidb_dbm_op_t) {Op_Halt, 0, 0, 0, NULL}, opnum++);
+
+    return rc;
+}
+
+int chidb_plan_ncols(chidb_plan_t *plan)
+{
+    return plan->analyze ? PLAN_ANALYZE_NCOLS : PLAN_QUERY_NCOLS;
+}
+
+const char *chidb_plan_colname(chidb_plan_t *plan, int col)
+{
+    return col >= 0 && col < chidb_plan_ncols(plan) ? plan_cols[col] : NULL;
+}
+
+void chidb_plan_free(chidb_plan_t *plan)
+{
+    if (plan == NULL)
+        return;
+
+    for (uint32_t i = 0; i < plan->n; i++)
+        free(plan->nodes[i].detail);
+    free(plan->nodes);
+    free(plan->owner);
+    free(plan);
+}
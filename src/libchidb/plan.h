@@ -0,0 +1,94 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Query plans (EXPLAIN QUERY PLAN and EXPLAIN ANALYZE) -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef PLAN_H_
+#define PLAN_H_
+
+#include "chidbInt.h"
+#include <chisql/chisql.h>
+
+/* An operator of the plan of a statement: a node of its optimized SRA
+ * tree (see chidb_plan_build) */
+typedef struct chidb_plan_node
+{
+    int32_t parent;         /* Index of the parent node (-1 for the root) */
+    char *detail;           /* What the operator does, indented by depth */
+    double est_rows;        /* Rows the optimizer expects it to produce */
+
+    /* Operator of the SRA tree it describes (only valid while the
+     * statement is prepared), and the instruction that each of its rows
+     * goes through (-1 if codegen didn't tell, see chidb_plan_row) */
+    SRA_t *sra;
+    int32_t row_pc;
+
+    /* Filled in by EXPLAIN ANALYZE, including those of the operators
+     * below it */
+    uint64_t rows;
+    uint64_t pages;
+    uint64_t ns;
+} chidb_plan_node_t;
+
+/* The plan of an EXPLAIN QUERY PLAN or EXPLAIN ANALYZE statement. The
+ * nodes are in pre-order, so the parent of a node comes before it. */
+typedef struct chidb_plan
+{
+    chidb_plan_node_t *nodes;
+    uint32_t n, cap;
+
+    /* Node that each instruction of the program belongs to (see
+     * chidb_plan_mark), or -1 */
+    int32_t *owner;
+    uint32_t nowner;
+
+    bool analyze;           /* EXPLAIN ANALYZE */
+    bool running;           /* chidb_plan_analyze is running the statement */
+    bool analyzed;          /* The actual figures are in */
+} chidb_plan_t;
+
+int chidb_plan_build(chidb_stmt *stmt, chisql_statement_t *sql_stmt);
+int chidb_plan_mark(chidb_stmt *stmt, SRA_t *sra, uint32_t start, uint32_t end);
+void chidb_plan_row(chidb_stmt *stmt, SRA_t *sra, uint32_t pc);
+int chidb_plan_analyze(chidb_stmt *stmt);
+int chidb_plan_codegen(chidb_stmt *stmt);
+int chidb_plan_ncols(chidb_plan_t *plan);
+const char *chidb_plan_colname(chidb_plan_t *plan, int col);
+void chidb_plan_free(chidb_plan_t *plan);
+
+#endif /* PLAN_H_ */
@@ -0,0 +1,79 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Static probes for tracing and profiling tools -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PROBES_H_
+#define PROBES_H_
+
+/* USDT probes (the static tracepoints of SystemTap, which perf,
+ * bpftrace and DTrace also understand), built with --enable-probes.
+ * Each probe is a nop instruction, with its arguments left where a
+ * tool that attaches to it can find them. Without --enable-probes,
+ * they are compiled out.
+ *
+ * There is no generated machine code to describe in a perf map (a
+ * compiled program calls the same handlers as the interpreter), so
+ * attributing samples to statements and instructions is left to the
+ * tool, with these probes, all in the "chidb" provider:
+ *
+ * - prepare(const char *sql, chidb_stmt *stmt): a statement was
+ *   prepared from sql
+ * - stmt__start(chidb_stmt *stmt): the statement starts or resumes
+ *   running (once per chidb_step)
+ * - stmt__done(chidb_stmt *stmt, int rc): it stops, returning rc
+ * - op(chidb_stmt *stmt, uint32_t pc, int opcode): an instruction is
+ *   dispatched, by the interpreter or the compiled program (a profiled
+ *   statement reports its instructions with chidb_profile_get instead)
+ *
+ * For instance, to count the instructions of each opcode that a
+ * server runs:
+ *
+ *   bpftrace -e 'usdt:./.libs/libchidb.so:chidb:op { @[arg2] = count(); }'
+ */
+#ifdef CHIDB_PROBES
+#include <sys/sdt.h>
+#define CHIDB_PROBE1(name, a) DTRACE_PROBE1(chidb, name, a)
+#define CHIDB_PROBE2(name, a, b) DTRACE_PROBE2(chidb, name, a, b)
+#define CHIDB_PROBE3(name, a, b, c) DTRACE_PROBE3(chidb, name, a, b, c)
+#else
+#define CHIDB_PROBE1(name, a) do { } while (0)
+#define CHIDB_PROBE2(name, a, b) do { } while (0)
+#define CHIDB_PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+#endif /* PROBES_H_ */
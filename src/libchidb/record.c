@@ -29,6 +29,18 @@
  *   chidb_DBRecord_appendNull(&dbrb);
  *   chidb_DBRecord_finalize(&dbrb, &dbr);
  *
+ * Code that only needs to read a few fields of a record (e.g., one
+ * column of every row in a scan) should use a DBRecordView instead of
+ * unpacking it. A view lives on the stack and reads the record where it
+ * is (e.g., in the in-memory page), parsing the header only as far as
+ * the fields that are asked for:
+ *
+ *   DBRecordView view;
+ *   int32_t v;
+ *   chidb_DBRecordView_init(&view, raw);
+ *   if (chidb_DBRecordView_getType(&view, 2) == SQL_INTEGER_4BYTE)
+ *       chidb_DBRecordView_getInt32(&view, 2, &v);
+ *
  */
 
 /*
@@ -92,16 +104,109 @@
  */
 int chidb_DBRecord_create_empty(DBRecordBuffer *dbrb, uint8_t nfields)
 {
-    dbrb->dbr = malloc(sizeof(DBRecord));
+    return chidb_DBRecord_create_empty2(dbrb, nfields, NULL);
+}
+
+
+/* Create an empty record in an arena
+ *
+ * Like chidb_DBRecord_create_empty, but the record (and everything the
+ * append* functions and chidb_DBRecord_finalize allocate for it) is
+ * allocated from an arena. Such a record must not be destroyed: it
+ * is freed, along with every other record in the arena, when the
+ * arena is reset.
+ *
+ * Parameters
+ * - dbrb: Pointer to an uninitialized DBRecordBuffer.
+ * - nfields: Number of fields in the record
+ * - arena: Arena to allocate the record from. If NULL, the record
+ *          is allocated with malloc.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_create_empty2(DBRecordBuffer *dbrb, uint8_t nfields, DBRecordArena *arena)
+{
+    DBRecord *dbr;
+
+    dbrb->arena = arena;
     dbrb->buf_size = 1024;
     dbrb->field = 0;
     dbrb->offset = 0;
     dbrb->header_size = 1;
 
-    dbrb->dbr->nfields = nfields;
-    dbrb->dbr->types = malloc(dbrb->dbr->nfields * sizeof(uint32_t));
-    dbrb->dbr->offsets = malloc(dbrb->dbr->nfields * sizeof(uint32_t));
-    dbrb->dbr->data = malloc(dbrb->buf_size);
+    if (arena)
+    {
+        /* The record, its types and offsets and its data, in one go */
+        uint8_t *p = chidb_DBRecordArena_alloc(arena, sizeof(DBRecord) +
+                     2 * nfields * sizeof(uint32_t) + dbrb->buf_size);
+        if (p == NULL)
+            return CHIDB_ENOMEM;
+        dbr = (DBRecord *) p;
+        dbr->types = (uint32_t *) (p + sizeof(DBRecord));
+        dbr->offsets = dbr->types + nfields;
+        dbr->data = (uint8_t *) (dbr->offsets + nfields);
+    }
+    else
+    {
+        dbr = malloc(sizeof(DBRecord));
+        if (dbr == NULL)
+            return CHIDB_ENOMEM;
+        dbr->types = malloc(nfields * sizeof(uint32_t));
+        dbr->offsets = malloc(nfields * sizeof(uint32_t));
+        dbr->data = malloc(dbrb->buf_size);
+        if (dbr->types == NULL || dbr->offsets == NULL || dbr->data == NULL)
+        {
+            free(dbr->types);
+            free(dbr->offsets);
+            free(dbr->data);
+            free(dbr);
+            return CHIDB_ENOMEM;
+        }
+    }
+
+    dbr->nfields = nfields;
+    dbr->in_arena = arena != NULL;
+    dbrb->dbr = dbr;
+
+    return CHIDB_OK;
+}
+
+
+/* Make room for len more bytes of data in a DBRecordBuffer
+ *
+ * Records in an arena can't be realloc'd, so their data is copied to
+ * a larger chunk of the arena (the old chunk is only reclaimed when
+ * the arena is reset).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+static int chidb_DBRecord_reserve(DBRecordBuffer *dbrb, uint32_t len)
+{
+    uint32_t buf_size;
+    uint8_t *data;
+
+    if (dbrb->offset + len <= dbrb->buf_size)
+        return CHIDB_OK;
+
+    buf_size = dbrb->offset + len + 1024;
+    if (dbrb->arena)
+    {
+        data = chidb_DBRecordArena_alloc(dbrb->arena, buf_size);
+        if (data != NULL)
+            memcpy(data, dbrb->dbr->data, dbrb->offset);
+    }
+    else
+        data = realloc(dbrb->dbr->data, buf_size);
+
+    if (data == NULL)
+        return CHIDB_ENOMEM;
+
+    dbrb->dbr->data = data;
+    dbrb->buf_size = buf_size;
 
     return CHIDB_OK;
 }
@@ -122,11 +227,8 @@ int chidb_DBRecord_appendInt8(DBRecordBuffer *dbrb, int8_t v)
     dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
 
     dbrb->dbr->types[dbrb->field] = SQL_INTEGER_1BYTE;
-    if (dbrb->offset + 1 > dbrb->buf_size)
-    {
-        dbrb->buf_size += 1024;
-        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
-    }
+    if (chidb_DBRecord_reserve(dbrb, 1) != CHIDB_OK)
+        return CHIDB_ENOMEM;
     dbrb->dbr->data[dbrb->offset] = v;
     dbrb->offset += 1;
     dbrb->header_size++;
@@ -151,11 +253,8 @@ int chidb_DBRecord_appendInt16(DBRecordBuffer *dbrb, int16_t v)
     dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
 
     dbrb->dbr->types[dbrb->field] = SQL_INTEGER_2BYTE;
-    if (dbrb->offset + 2 > dbrb->buf_size)
-    {
-        dbrb->buf_size += 1024;
-        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
-    }
+    if (chidb_DBRecord_reserve(dbrb, 2) != CHIDB_OK)
+        return CHIDB_ENOMEM;
     put2byte(&dbrb->dbr->data[dbrb->offset], v);
     dbrb->offset += 2;
     dbrb->header_size++;
@@ -180,11 +279,8 @@ int chidb_DBRecord_appendInt32(DBRecordBuffer *dbrb, int32_t v)
     dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
 
     dbrb->dbr->types[dbrb->field] = SQL_INTEGER_4BYTE;
-    if (dbrb->offset + 4 > dbrb->buf_size)
-    {
-        dbrb->buf_size += 1024;
-        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
-    }
+    if (chidb_DBRecord_reserve(dbrb, 4) != CHIDB_OK)
+        return CHIDB_ENOMEM;
     put4byte(&dbrb->dbr->data[dbrb->offset], v);
     dbrb->offset += 4;
     dbrb->header_size++;
@@ -229,11 +325,8 @@ int chidb_DBRecord_appendString(DBRecordBuffer *dbrb,  char *v)
     dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
 
     len = strlen(v);
-    if (dbrb->offset + len > dbrb->buf_size)
-    {
-        dbrb->buf_size += 1024;
-        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
-    }
+    if (chidb_DBRecord_reserve(dbrb, len) != CHIDB_OK)
+        return CHIDB_ENOMEM;
     memcpy(&dbrb->dbr->data[dbrb->offset], v, len);
     dbrb->offset += len;
     dbrb->dbr->types[dbrb->field] = len * 2 + SQL_TEXT;
@@ -260,7 +353,13 @@ int chidb_DBRecord_appendString(DBRecordBuffer *dbrb,  char *v)
 int chidb_DBRecord_finalize(DBRecordBuffer *dbrb, DBRecord **dbr)
 {
     dbrb->dbr->nfields = dbrb->field;
-    dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->offset);
+    /* Arena records aren't shrunk: the slack goes away on reset */
+    if (!dbrb->dbr->in_arena && dbrb->offset > 0)
+    {
+        uint8_t *data = realloc(dbrb->dbr->data, dbrb->offset);
+        if (data != NULL)
+            dbrb->dbr->data = data;
+    }
     dbrb->dbr->data_len = dbrb->offset;
     dbrb->dbr->packed_len = dbrb->header_size + dbrb->offset;
 
@@ -287,25 +386,14 @@ int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
         return CHIDB_ENOMEM;
 
     (*dbr)->nfields = 0;
+    (*dbr)->in_arena = false;
 
     uint8_t header_size = raw[0];
-    uint8_t header_pos = 1;
+    uint32_t header_used;
     (*dbr)->types = malloc(0xFF * sizeof(uint32_t));
-    while(header_pos < header_size)
-    {
-        if (raw[header_pos] & 0x80)
-        {
-            getVarint32(&raw[header_pos], &(*dbr)->types[(*dbr)->nfields]);
-            header_pos += 4;
-        }
-        else
-        {
-            (*dbr)->types[(*dbr)->nfields] = raw[header_pos];
-            header_pos += 1;
-        }
-
-        (*dbr)->nfields++;
-    }
+    if ((*dbr)->types == NULL)
+        return CHIDB_ENOMEM;
+    (*dbr)->nfields = getRecordTypes(raw + 1, header_size - 1, (*dbr)->types, 0xFF, &header_used);
     (*dbr)->types = realloc((*dbr)->types, (*dbr)->nfields * sizeof(uint32_t));
 
     uint32_t offset = 0;
@@ -344,6 +432,10 @@ int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
 
 
 /* Create a raw binary database record from a DBRecord
+ *
+ * The size of the record header is stored in a single byte, so records
+ * whose header doesn't fit in it (e.g., more than 63 strings) can't be
+ * packed in format v1 (see chidb_DBRecord_packV2).
  *
  * Parameters
  * - dbr: The DBRecord
@@ -353,29 +445,220 @@ int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
  * Return
  * - CHIDB_OK: Operation successful
  * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EMISUSE: The record header is larger than 255 bytes
  */
 int chidb_DBRecord_pack(DBRecord *dbr, uint8_t **p)
 {
-    *p = malloc(dbr->packed_len);
-    if (p == NULL)
+    return chidb_DBRecord_pack2(dbr, p, NULL);
+}
+
+
+/* Create a raw binary database record from a DBRecord in an arena
+ *
+ * Like chidb_DBRecord_pack, but the raw record is allocated from an
+ * arena, and must not be freed.
+ *
+ * Parameters
+ * - dbr: The DBRecord
+ * - p: Out paremeter used to return a pointer to a raw binary representation
+ *      of the record
+ * - arena: Arena to allocate the raw record from. If NULL, it is
+ *          allocated with malloc.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EMISUSE: The record header is larger than 255 bytes
+ */
+int chidb_DBRecord_pack2(DBRecord *dbr, uint8_t **p, DBRecordArena *arena)
+{
+    if (dbr->packed_len - dbr->data_len > 0xFF)
+        return CHIDB_EMISUSE;
+
+    if (arena)
+        *p = chidb_DBRecordArena_alloc(arena, dbr->packed_len);
+    else
+        *p = malloc(dbr->packed_len);
+    if (*p == NULL)
         return CHIDB_ENOMEM;
     (*p)[0] = dbr->packed_len - dbr->data_len;
 
-    uint8_t header_pos = 1;
-    for(int i=0; i < dbr->nfields; i++)
+    putRecordTypes(*p + 1, dbr->types, dbr->nfields);
+    memcpy(*p + (*p)[0], dbr->data, dbr->data_len);
+
+    return CHIDB_OK;
+}
+
+
+/* Length of the data of a field of a DBRecord */
+static uint32_t chidb_DBRecord_fieldLength(DBRecord *dbr, uint8_t field)
+{
+    switch (chidb_DBRecord_getType(dbr, field))
     {
-        if (chidb_DBRecord_getType(dbr, i) == SQL_TEXT)
+    case SQL_INTEGER_1BYTE:
+        return 1;
+    case SQL_INTEGER_2BYTE:
+        return 2;
+    case SQL_INTEGER_4BYTE:
+        return 4;
+    case SQL_TEXT:
+        return (dbr->types[field] - SQL_TEXT) / 2;
+    default:
+        return 0;
+    }
+}
+
+static inline uint32_t getOffsetV2(const uint8_t *p, uint8_t width)
+{
+    return width == 2 ? (uint32_t) get2byte(p) : get4byte(p);
+}
+
+static inline void putOffsetV2(uint8_t *p, uint8_t width, uint32_t v)
+{
+    if (width == 2)
+        put2byte(p, v);
+    else
+        put4byte(p, v);
+}
+
+
+/* Create a DBRecord from a raw binary database record in format v2
+ *
+ * Same as chidb_DBRecord_unpack, for a record in format v2 (see
+ * record.h). The packed_len of the DBRecord is still the length of
+ * the record in format v1.
+ *
+ * Parameters
+ * - dbr: Out paremeter used to return a pointer to a DBRecord.
+ * - raw: Pointer to first byte of raw binary database record
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The record is not a valid format v2 record
+ */
+int chidb_DBRecord_unpackV2(DBRecord **dbr, uint8_t *raw)
+{
+    uint8_t nfields = raw[0];
+    uint8_t width = raw[1];
+    const uint8_t *offsets = raw + DBRECORDV2_TYPES_OFFSET + nfields;
+    uint32_t start, end, header_size = 1;
+
+    if (width != 2 && width != 4)
+        return CHIDB_ECORRUPT;
+
+    start = getOffsetV2(offsets, width);
+    end = getOffsetV2(offsets + width * nfields, width);
+    if (start != DBRECORDV2_TYPES_OFFSET + nfields + width * (nfields + 1) || end < start)
+        return CHIDB_ECORRUPT;
+
+    *dbr = malloc(sizeof(DBRecord));
+    if (*dbr == NULL)
+        return CHIDB_ENOMEM;
+    (*dbr)->nfields = nfields;
+    (*dbr)->in_arena = false;
+    (*dbr)->types = malloc(nfields * sizeof(uint32_t));
+    (*dbr)->offsets = malloc(nfields * sizeof(uint32_t));
+    (*dbr)->data = malloc(end - start);
+    if ((*dbr)->types == NULL || (*dbr)->offsets == NULL || (end > start && (*dbr)->data == NULL))
+    {
+        free((*dbr)->types);
+        free((*dbr)->offsets);
+        free((*dbr)->data);
+        free(*dbr);
+        return CHIDB_ENOMEM;
+    }
+
+    for(int i=0; i<nfields; i++)
+    {
+        uint32_t off = getOffsetV2(offsets + width * i, width);
+        uint32_t next = getOffsetV2(offsets + width * (i + 1), width);
+        uint8_t type = raw[DBRECORDV2_TYPES_OFFSET + i];
+
+        if (off < start || next < off || next > end)
+        {
+            chidb_DBRecord_destroy(*dbr);
+            return CHIDB_ECORRUPT;
+        }
+
+        (*dbr)->offsets[i] = off - start;
+        if (type == SQL_TEXT)
         {
-            putVarint32(*p + header_pos, dbr->types[i]);
-            header_pos +=4;
+            (*dbr)->types[i] = (next - off) * 2 + SQL_TEXT;
+            header_size += 4;
         }
         else
         {
-            (*p)[header_pos] = dbr->types[i];
-            header_pos +=1;
+            (*dbr)->types[i] = type;
+            header_size += 1;
         }
     }
-    memcpy(*p + (*p)[0], dbr->data, dbr->data_len);
+
+    (*dbr)->data_len = end - start;
+    (*dbr)->packed_len = header_size + (*dbr)->data_len;
+    memcpy((*dbr)->data, raw + start, (*dbr)->data_len);
+
+    return CHIDB_OK;
+}
+
+
+/* Create a raw binary database record in format v2 from a DBRecord
+ *
+ * Same as chidb_DBRecord_pack2, but the record is written in format v2
+ * (see record.h). Since its length is not dbr->packed_len, it is
+ * returned in len.
+ *
+ * Parameters
+ * - dbr: The DBRecord
+ * - p: Out paremeter used to return a pointer to a raw binary representation
+ *      of the record
+ * - len: Out parameter used to return the length of the raw record
+ * - arena: Arena to allocate the raw record from. If NULL, it is
+ *          allocated with malloc.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_packV2(DBRecord *dbr, uint8_t **p, uint32_t *len, DBRecordArena *arena)
+{
+    uint8_t nfields = dbr->nfields;
+    uint8_t width = 2;
+    uint32_t start, size, off;
+
+    start = DBRECORDV2_TYPES_OFFSET + nfields + width * (nfields + 1);
+    if (start + dbr->data_len > 0xFFFF)
+    {
+        width = 4;
+        start = DBRECORDV2_TYPES_OFFSET + nfields + width * (nfields + 1);
+    }
+    size = start + dbr->data_len;
+
+    if (arena)
+        *p = chidb_DBRecordArena_alloc(arena, size);
+    else
+        *p = malloc(size);
+    if (*p == NULL)
+        return CHIDB_ENOMEM;
+
+    (*p)[0] = nfields;
+    (*p)[1] = width;
+
+    /* The offsets of NULLs in dbr are not meaningful, so they're
+     * computed from the lengths of the fields */
+    off = start;
+    for(int i=0; i<nfields; i++)
+    {
+        int type = chidb_DBRecord_getType(dbr, i);
+
+        (*p)[DBRECORDV2_TYPES_OFFSET + i] = type == SQL_TEXT ? SQL_TEXT : dbr->types[i];
+        putOffsetV2(*p + DBRECORDV2_TYPES_OFFSET + nfields + width * i, width, off);
+        off += chidb_DBRecord_fieldLength(dbr, i);
+    }
+    putOffsetV2(*p + DBRECORDV2_TYPES_OFFSET + nfields + width * nfields, width, size);
+    memcpy(*p + start, dbr->data, dbr->data_len);
+
+    *len = size;
 
     return CHIDB_OK;
 }
@@ -637,6 +920,9 @@ int chidb_DBRecord_create(DBRecord **dbr, const char *spec, ...)
 
 
 /* Destroys a DBRecord and frees resources associated with it.
+ *
+ * Records allocated from an arena are left alone (see
+ * chidb_DBRecordArena_reset).
  *
  * Parameters
  * - dbr: The DBRecord
@@ -646,6 +932,10 @@ int chidb_DBRecord_create(DBRecord **dbr, const char *spec, ...)
  */
 int chidb_DBRecord_destroy(DBRecord *dbr)
 {
+    /* Freed when its arena is reset */
+    if (dbr->in_arena)
+        return CHIDB_OK;
+
     free(dbr->data);
     free(dbr->types);
     free(dbr->offsets);
@@ -653,3 +943,376 @@ int chidb_DBRecord_destroy(DBRecord *dbr)
 
     return CHIDB_OK;
 }
+
+
+/* Create a view of a raw binary database record
+ *
+ * Initializes a DBRecordView to read the fields of a raw record in
+ * place. Nothing is parsed yet: the first call that asks for a field
+ * parses the header up to that field, and remembers the types and
+ * offsets it found, so asking for the same or an earlier field again
+ * doesn't parse anything. The record must remain valid (and unmodified)
+ * for as long as the view is used.
+ *
+ * Parameters
+ * - view: DBRecordView to initialize (usually on the stack)
+ * - raw: Pointer to first byte of raw binary database record
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_DBRecordView_init(DBRecordView *view, const uint8_t *raw)
+{
+    view->raw = raw;
+    view->format = DBRECORD_FORMAT_V1;
+    view->header_size = raw[0];
+    view->header_pos = 1;
+    view->nparsed = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Create a view of a raw binary database record in format v2
+ *
+ * Same as chidb_DBRecordView_init, for a record in format v2 (see
+ * record.h). The type and offset of a field are read directly from
+ * the header when the field is asked for, regardless of its position.
+ *
+ * Parameters
+ * - view: DBRecordView to initialize (usually on the stack)
+ * - raw: Pointer to first byte of raw binary database record
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The record is not a valid format v2 record
+ */
+int chidb_DBRecordView_initV2(DBRecordView *view, const uint8_t *raw)
+{
+    if (raw[1] != 2 && raw[1] != 4)
+        return CHIDB_ECORRUPT;
+
+    view->raw = raw;
+    view->format = DBRECORD_FORMAT_V2;
+    view->nparsed = raw[0];
+
+    return CHIDB_OK;
+}
+
+
+/* Reads the type and offset of a field of a view in format v2 */
+static bool chidb_DBRecordView_parseV2(DBRecordView *view, uint8_t field)
+{
+    uint8_t nfields = view->raw[0];
+    uint8_t width = view->raw[1];
+    const uint8_t *offsets = view->raw + DBRECORDV2_TYPES_OFFSET + nfields;
+    uint32_t type;
+
+    if (field >= nfields)
+        return false;
+
+    type = view->raw[DBRECORDV2_TYPES_OFFSET + field];
+    view->offsets[field] = getOffsetV2(offsets + width * field, width);
+    if (type == SQL_TEXT)
+        type += (getOffsetV2(offsets + width * (field + 1), width) - view->offsets[field]) * 2;
+    view->types[field] = type;
+
+    return true;
+}
+
+
+/* Parses the header of a view until the type and offset of the given
+ * field are known. Returns false if the record has no such field. */
+static bool chidb_DBRecordView_parse(DBRecordView *view, uint8_t field)
+{
+    uint32_t used;
+    int ntypes;
+
+    if (view->format == DBRECORD_FORMAT_V2)
+        return chidb_DBRecordView_parseV2(view, field);
+
+    if (view->nparsed > field || view->header_pos >= view->header_size)
+        return view->nparsed > field;
+
+    ntypes = getRecordTypes(&view->raw[view->header_pos], view->header_size - view->header_pos,
+                            &view->types[view->nparsed], field + 1 - view->nparsed, &used);
+    view->header_pos += used;
+
+    for (uint8_t n = view->nparsed; n < view->nparsed + ntypes; n++)
+    {
+        if (n == 0)
+            view->offsets[n] = view->header_size;
+        else switch (view->types[n - 1])
+        {
+        case SQL_NULL:
+            view->offsets[n] = view->offsets[n - 1];
+            break;
+        case SQL_INTEGER_1BYTE:
+            view->offsets[n] = view->offsets[n - 1] + 1;
+            break;
+        case SQL_INTEGER_2BYTE:
+            view->offsets[n] = view->offsets[n - 1] + 2;
+            break;
+        case SQL_INTEGER_4BYTE:
+            view->offsets[n] = view->offsets[n - 1] + 4;
+            break;
+        default:
+            view->offsets[n] = view->offsets[n - 1] + (view->types[n - 1] - SQL_TEXT) / 2;
+            break;
+        }
+    }
+    view->nparsed += ntypes;
+
+    return view->nparsed > field;
+}
+
+
+/* Returns the number of fields of a record view
+ *
+ * In format v1, this has to parse the whole header.
+ *
+ * Parameters
+ * - view: The DBRecordView
+ *
+ * Return
+ * - The number of fields in the record
+ */
+int chidb_DBRecordView_nfields(DBRecordView *view)
+{
+    chidb_DBRecordView_parse(view, DBRECORDVIEW_MAX_FIELDS - 1);
+
+    return view->nparsed;
+}
+
+
+/* Returns the type of a field of a record view
+ *
+ * Same as chidb_DBRecord_getType, for a DBRecordView.
+ *
+ * Parameters
+ * - view: The DBRecordView
+ * - field: Index of the field
+ *
+ * Return
+ * - SQL_NULL, SQL_INTEGER_1BYTE, SQL_INTEGER_2BYTE, SQL_INTEGER_4BYTE,
+ *   or SQL_TEXT depending on the field type.
+ * - SQL_NOTVALID if the field has an invalid field type, or if the
+ *   record doesn't have that many fields.
+ */
+int chidb_DBRecordView_getType(DBRecordView *view, uint8_t field)
+{
+    uint32_t type;
+
+    if (!chidb_DBRecordView_parse(view, field))
+        return SQL_NOTVALID;
+
+    type = view->types[field];
+    if (type == SQL_NULL || type == SQL_INTEGER_1BYTE || type == SQL_INTEGER_2BYTE || type == SQL_INTEGER_4BYTE)
+        return type;
+    else if (type >= SQL_TEXT && (type - SQL_TEXT) % 2 == 0)
+        return SQL_TEXT;
+    else
+        return SQL_NOTVALID;
+}
+
+
+/* Returns the value of a 1-byte integer field of a record view
+ *
+ * Parameters
+ * - view: The DBRecordView
+ * - field: Index of the field
+ * - v: Out parameter used to return the value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The field doesn't exist or is not a 1-byte integer
+ */
+int chidb_DBRecordView_getInt8(DBRecordView *view, uint8_t field, int8_t *v)
+{
+    if (chidb_DBRecordView_getType(view, field) != SQL_INTEGER_1BYTE)
+        return CHIDB_EMISMATCH;
+
+    *v = view->raw[view->offsets[field]];
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the value of a 2-byte integer field of a record view
+ *
+ * Parameters
+ * - view: The DBRecordView
+ * - field: Index of the field
+ * - v: Out parameter used to return the value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The field doesn't exist or is not a 2-byte integer
+ */
+int chidb_DBRecordView_getInt16(DBRecordView *view, uint8_t field, int16_t *v)
+{
+    if (chidb_DBRecordView_getType(view, field) != SQL_INTEGER_2BYTE)
+        return CHIDB_EMISMATCH;
+
+    *v = get2byte(&view->raw[view->offsets[field]]);
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the value of a 4-byte integer field of a record view
+ *
+ * Parameters
+ * - view: The DBRecordView
+ * - field: Index of the field
+ * - v: Out parameter used to return the value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The field doesn't exist or is not a 4-byte integer
+ */
+int chidb_DBRecordView_getInt32(DBRecordView *view, uint8_t field, int32_t *v)
+{
+    if (chidb_DBRecordView_getType(view, field) != SQL_INTEGER_4BYTE)
+        return CHIDB_EMISMATCH;
+
+    *v = get4byte(&view->raw[view->offsets[field]]);
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the value of a string field of a record view
+ *
+ * Unlike chidb_DBRecord_getString, the string is not copied: v points
+ * to the string in the record itself, which is not NUL-terminated, so
+ * its length is returned too.
+ *
+ * Parameters
+ * - view: The DBRecordView
+ * - field: Index of the field
+ * - v: Out parameter used to return a pointer to the string
+ * - len: Out parameter used to return the length of the string
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The field doesn't exist or is not a string
+ */
+int chidb_DBRecordView_getString(DBRecordView *view, uint8_t field, const char **v, int *len)
+{
+    if (chidb_DBRecordView_getType(view, field) != SQL_TEXT)
+        return CHIDB_EMISMATCH;
+
+    *v = (const char *) &view->raw[view->offsets[field]];
+    *len = (view->types[field] - SQL_TEXT) / 2;
+
+    return CHIDB_OK;
+}
+
+
+/* Initialize a record arena
+ *
+ * No memory is allocated until the first call to chidb_DBRecordArena_alloc.
+ *
+ * Parameters
+ * - arena: Arena to initialize
+ */
+void chidb_DBRecordArena_init(DBRecordArena *arena)
+{
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->used = 0;
+}
+
+
+/* Allocate memory from a record arena
+ *
+ * Allocations are carved out of the current block, moving on to the
+ * next block (or a new one, if there isn't one large enough) when it
+ * runs out of room. Blocks are DBRECORDARENA_BLOCK_SIZE bytes, unless
+ * an allocation doesn't fit in one.
+ *
+ * Parameters
+ * - arena: Initialized arena
+ * - size: Number of bytes to allocate
+ *
+ * Return
+ * - A pointer to the memory, aligned for any of the types in a record,
+ *   or NULL if it could not be allocated.
+ */
+void *chidb_DBRecordArena_alloc(DBRecordArena *arena, uint32_t size)
+{
+    DBRecordArenaBlock *block;
+    void *p;
+
+    size = (size + 7) & ~7;
+
+    if (arena->current == NULL || arena->used + size > arena->current->size)
+    {
+        block = arena->current ? arena->current->next : arena->first;
+        if (block == NULL || size > block->size)
+        {
+            uint32_t block_size = size > DBRECORDARENA_BLOCK_SIZE ? size : DBRECORDARENA_BLOCK_SIZE;
+
+            block = malloc(sizeof(DBRecordArenaBlock) + block_size);
+            if (block == NULL)
+                return NULL;
+            block->size = block_size;
+
+            /* The new block goes after the current one, so the blocks
+             * after it are still used after the next reset */
+            if (arena->current)
+            {
+                block->next = arena->current->next;
+                arena->current->next = block;
+            }
+            else
+            {
+                block->next = arena->first;
+                arena->first = block;
+            }
+        }
+        arena->current = block;
+        arena->used = 0;
+    }
+
+    p = arena->current->data + arena->used;
+    arena->used += size;
+
+    return p;
+}
+
+
+/* Reset a record arena
+ *
+ * Everything allocated from the arena is freed at once, in constant
+ * time. The arena's blocks are kept for the allocations that follow.
+ *
+ * Parameters
+ * - arena: Initialized arena
+ */
+void chidb_DBRecordArena_reset(DBRecordArena *arena)
+{
+    arena->current = arena->first;
+    arena->used = 0;
+}
+
+
+/* Free a record arena
+ *
+ * Parameters
+ * - arena: Initialized arena. It can be used again after calling
+ *          this function, as if it had just been initialized.
+ */
+void chidb_DBRecordArena_free(DBRecordArena *arena)
+{
+    DBRecordArenaBlock *block, *next;
+
+    for(block = arena->first; block != NULL; block = next)
+    {
+        next = block->next;
+        free(block);
+    }
+
+    chidb_DBRecordArena_init(arena);
+}
@@ -50,22 +50,83 @@ struct DBRecord
     uint32_t packed_len;
     uint32_t *types;
     uint32_t *offsets;
+    bool in_arena;           /* Allocated from a DBRecordArena */
 };
 typedef struct DBRecord DBRecord;
 
+/* A DBRecordArena hands out memory for records that only live until
+ * the arena is reset (e.g., the record built for each row of an
+ * INSERT). Blocks are kept across resets, so once the arena has grown
+ * to the size of a row, building further rows doesn't call malloc. */
+#define DBRECORDARENA_BLOCK_SIZE (4096)
+
+struct DBRecordArenaBlock
+{
+    struct DBRecordArenaBlock *next;
+    size_t size;             /* Keeps data 8-byte aligned */
+    uint8_t data[];
+};
+typedef struct DBRecordArenaBlock DBRecordArenaBlock;
+
+struct DBRecordArena
+{
+    DBRecordArenaBlock *first;
+    DBRecordArenaBlock *current;   /* Block allocations are made from */
+    uint32_t used;                 /* Bytes used in the current block */
+};
+typedef struct DBRecordArena DBRecordArena;
+
 struct DBRecordBuffer
 {
     DBRecord *dbr;
-    uint16_t buf_size;
+    DBRecordArena *arena;    /* NULL if the record is malloc'd */
+    uint32_t buf_size;
     uint8_t field;
     uint32_t offset;
-    uint8_t header_size;
+    uint32_t header_size;    /* May exceed what the header byte can hold */
 };
 typedef struct DBRecordBuffer DBRecordBuffer;
 
+/* Record formats. Files with BTREE_FEATURE_RECORDV2 store table records
+ * in format v2, where the type and offset of any field can be found
+ * without reading the ones before it:
+ *
+ *   byte 0:  number of fields N
+ *   byte 1:  width W of the offsets, 2 or 4 bytes (4 only if the record
+ *            is larger than 65535 bytes)
+ *   N bytes: type of each field (SQL_NULL, SQL_INTEGER_*, or SQL_TEXT;
+ *            the length of a string is given by the offsets)
+ *   N+1 W-byte big-endian offsets, from the start of the record, of
+ *            each field and of the end of the record
+ *   data of the fields, as in format v1
+ */
+#define DBRECORD_FORMAT_V1 (1)
+#define DBRECORD_FORMAT_V2 (2)
+#define DBRECORDV2_TYPES_OFFSET (2)
+
+/* A DBRecordView reads the fields of a raw record in place, without
+ * allocating anything (see chidb_DBRecordView_init). The header is only
+ * parsed as far as the fields that have been asked for (in format v2,
+ * only the fields that have been asked for are read). */
+#define DBRECORDVIEW_MAX_FIELDS (255)
+
+struct DBRecordView
+{
+    const uint8_t *raw;      /* Raw record */
+    uint8_t format;          /* DBRECORD_FORMAT_* */
+    uint8_t header_size;
+    uint32_t header_pos;     /* Offset in raw of the first unparsed type */
+    uint8_t nparsed;         /* Fields whose type and offset are known
+                              * (format v2: number of fields) */
+    uint32_t types[DBRECORDVIEW_MAX_FIELDS];
+    uint32_t offsets[DBRECORDVIEW_MAX_FIELDS];  /* From the start of raw */
+};
+typedef struct DBRecordView DBRecordView;
+
 int chidb_DBRecord_create(DBRecord **dbr, const char *, ...);
 
 int chidb_DBRecord_create_empty(DBRecordBuffer *dbrb, uint8_t nfields);
+int chidb_DBRecord_create_empty2(DBRecordBuffer *dbrb, uint8_t nfields, DBRecordArena *arena);
 int chidb_DBRecord_appendInt8(DBRecordBuffer *dbrb, int8_t v);
 int chidb_DBRecord_appendInt16(DBRecordBuffer *dbrb, int16_t v);
 int chidb_DBRecord_appendInt32(DBRecordBuffer *dbrb, int32_t v);
@@ -75,6 +136,9 @@ int chidb_DBRecord_finalize(DBRecordBuffer *dbrb, DBRecord **dbr);
 
 int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *);
 int chidb_DBRecord_pack(DBRecord *dbr, uint8_t **);
+int chidb_DBRecord_pack2(DBRecord *dbr, uint8_t **, DBRecordArena *arena);
+int chidb_DBRecord_unpackV2(DBRecord **dbr, uint8_t *);
+int chidb_DBRecord_packV2(DBRecord *dbr, uint8_t **, uint32_t *len, DBRecordArena *arena);
 
 int chidb_DBRecord_getType(DBRecord *dbr, uint8_t field);
 
@@ -86,6 +150,19 @@ int chidb_DBRecord_getStringLength(DBRecord *dbr, uint8_t field, int *len);
 
 int chidb_DBRecord_print(DBRecord *dbr);
 
+int chidb_DBRecordView_init(DBRecordView *view, const uint8_t *raw);
+int chidb_DBRecordView_initV2(DBRecordView *view, const uint8_t *raw);
+int chidb_DBRecordView_nfields(DBRecordView *view);
+int chidb_DBRecordView_getType(DBRecordView *view, uint8_t field);
+int chidb_DBRecordView_getInt8(DBRecordView *view, uint8_t field, int8_t *v);
+int chidb_DBRecordView_getInt16(DBRecordView *view, uint8_t field, int16_t *v);
+int chidb_DBRecordView_getInt32(DBRecordView *view, uint8_t field, int32_t *v);
+int chidb_DBRecordView_getString(DBRecordView *view, uint8_t field, const char **v, int *len);
+
+void chidb_DBRecordArena_init(DBRecordArena *arena);
+void *chidb_DBRecordArena_alloc(DBRecordArena *arena, uint32_t size);
+void chidb_DBRecordArena_reset(DBRecordArena *arena);
+void chidb_DBRecordArena_free(DBRecordArena *arena);
 
 int chidb_DBRecord_destroy(DBRecord *dbr);
 
@@ -0,0 +1,416 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module implements the shared memory file, which lets several
+ * processes (or several pagers in one process) open the same database
+ * at once. The file is called like the database file followed by
+ * "-shm", and every pager that opens the database maps it into memory
+ * (MAP_SHARED), so that what one of them writes into it is seen by all
+ * the others right away, without a system call.
+ *
+ * The file starts with a header (ShmHeader, padded to SHM_HEADER_SIZE)
+ * that holds the committed state of the write-ahead log, a counter of
+ * the changes made to the database, and the read marks of the readers
+ * of the log. It is followed by regions of a fixed size (see
+ * chidb_Shm_region), which the write-ahead log uses for its index (see
+ * wal.c). Regions are mapped one at a time, as they are needed, so a
+ * region that is mapped never moves. Nothing in the file needs to
+ * survive the processes that use it: the first pager to open it starts
+ * it over, and the last one to close it deletes it.
+ *
+ * The file is also what pagers lock (with POSIX advisory locks, see
+ * chidb_Shm_lock), one byte per lock (the SHM_LOCK_* constants). The
+ * locks are taken on the open file description (F_OFD_SETLK) where the
+ * system has them, so that two pagers in the same process lock each
+ * other out just like two processes do, and closing one pager doesn't
+ * release the locks of another. A process that dies releases its locks.
+ *
+ * The fields of the header that describe the log are protected by a
+ * sequence lock: the pager that changes them (the one that holds
+ * SHM_LOCK_WRITE) makes seq odd while it does, and readers copy them
+ * out and try again if seq was odd or changed in the meantime.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+
+#include <chidb/log.h>
+
+#include "chidbInt.h"
+
+#include "shm.h"
+
+/* Locks that belong to the open file description, where available */
+#ifdef F_OFD_SETLK
+#define SHM_SETLK F_OFD_SETLK
+#define SHM_SETLKW F_OFD_SETLKW
+#define SHM_GETLK F_OFD_GETLK
+#else
+#define SHM_SETLK F_SETLK
+#define SHM_SETLKW F_SETLKW
+#define SHM_GETLK F_GETLK
+#endif
+
+/* Times a reader retries while seq is odd before it checks whether the
+ * pager that was changing the header is still there */
+#define SHM_SPINS (1000)
+
+
+/* Open the shared memory file of a database
+ *
+ * Opens (or creates) the file and maps its header. If no other pager
+ * has it open, whatever it contains is left over from pagers that are
+ * gone, and it is started over.
+ *
+ * Parameters
+ * - shm: An out parameter. Used to return a pointer to the
+ *        newly created Shm.
+ * - dbfilename: Database file. The file is called dbfilename-shm
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Shm_open(Shm **shm, const char *dbfilename)
+{
+    struct stat st, path_st;
+    bool first = false;
+    int rc;
+
+    *shm = calloc(1, sizeof(Shm));
+    if (*shm == NULL)
+        return CHIDB_ENOMEM;
+    (*shm)->fd = -1;
+    if (asprintf(&(*shm)->filename, "%s-shm", dbfilename) < 0)
+    {
+        free(*shm);
+        return CHIDB_ENOMEM;
+    }
+
+    for (;;)
+    {
+        (*shm)->fd = open((*shm)->filename, O_RDWR | O_CREAT, 0644);
+        if ((*shm)->fd == -1)
+        {
+            rc = CHIDB_EIO;
+            goto error;
+        }
+
+        /* Nobody else has the file open if we can lock it exclusively */
+        rc = chidb_Shm_lock(*shm, SHM_LOCK_DMS, 1, F_WRLCK, false);
+        first = rc == CHIDB_OK;
+        if (rc == CHIDB_EBUSY)
+            rc = chidb_Shm_lock(*shm, SHM_LOCK_DMS, 1, F_RDLCK, true);
+        if (rc != CHIDB_OK)
+            goto error;
+
+        /* The last pager to close the file may have deleted it while we
+         * were waiting for the lock */
+        if (fstat((*shm)->fd, &st) == 0 && stat((*shm)->filename, &path_st) == 0
+            && st.st_dev == path_st.st_dev && st.st_ino == path_st.st_ino)
+            break;
+        close((*shm)->fd);
+    }
+
+    if ((first && ftruncate((*shm)->fd, 0) != 0)
+        || ((first || st.st_size < SHM_HEADER_SIZE) && ftruncate((*shm)->fd, SHM_HEADER_SIZE) != 0))
+    {
+        rc = CHIDB_EIO;
+        goto error;
+    }
+
+    (*shm)->header = mmap(NULL, SHM_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, (*shm)->fd, 0);
+    if ((*shm)->header == MAP_FAILED)
+    {
+        (*shm)->header = NULL;
+        rc = CHIDB_EIO;
+        goto error;
+    }
+
+    if (first)
+    {
+        (*shm)->header->magic = SHM_MAGIC;
+        rc = chidb_Shm_lock(*shm, SHM_LOCK_DMS, 1, F_RDLCK, false);
+        if (rc != CHIDB_OK)
+            goto error;
+        chilog(TRACE, "Started %s over", (*shm)->filename);
+    }
+
+    return CHIDB_OK;
+
+error:
+    if ((*shm)->header != NULL)
+        munmap((*shm)->header, SHM_HEADER_SIZE);
+    if ((*shm)->fd != -1)
+        close((*shm)->fd);
+    free((*shm)->filename);
+    free(*shm);
+    return rc;
+}
+
+
+/* Close the shared memory file
+ *
+ * Unmaps the file, and releases every lock the pager holds on it.
+ *
+ * Parameters
+ * - shm: A Shm
+ * - remove_file: If true, the file is deleted. This should only be done
+ *                if chidb_Shm_isLast returned true.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Shm_close(Shm *shm, bool remove_file)
+{
+    int rc = CHIDB_OK;
+
+    for (uint32_t i = 0; i < shm->nregions; i++)
+        if (shm->regions[i] != NULL)
+            munmap(shm->regions[i], shm->region_size);
+    munmap(shm->header, SHM_HEADER_SIZE);
+
+    /* Deleted before the lock goes away with the file descriptor, so
+     * that nobody attaches to it in between */
+    if (remove_file)
+        unlink(shm->filename);
+    if (close(shm->fd) != 0)
+        rc = CHIDB_EIO;
+
+    free(shm->regions);
+    free(shm->filename);
+    free(shm);
+
+    return rc;
+}
+
+
+/* Check whether this is the only pager that has the file open
+ *
+ * If it is, nobody else can open the file until it is closed.
+ *
+ * Parameters
+ * - shm: A Shm
+ *
+ * Return
+ * - true if no other pager has the file open
+ */
+bool chidb_Shm_isLast(Shm *shm)
+{
+    return chidb_Shm_lock(shm, SHM_LOCK_DMS, 1, F_WRLCK, false) == CHIDB_OK;
+}
+
+
+/* Map a region of the file
+ *
+ * Regions are numbered from 0, and all have the same size, which must
+ * be a multiple of the system's page size. A region that doesn't exist
+ * yet is added to the file (zeroed) if create is true.
+ *
+ * Parameters
+ * - shm: A Shm
+ * - i: Region number
+ * - size: Size of a region
+ * - create: Whether to extend the file if the region is past its end
+ *
+ * Return
+ * - The region, or NULL if it doesn't exist (and create is false) or
+ *   couldn't be mapped
+ */
+void *chidb_Shm_region(Shm *shm, uint32_t i, size_t size, bool create)
+{
+    off_t offset = SHM_HEADER_SIZE + (off_t) i * size;
+    struct stat st;
+    void *p;
+
+    if (i < shm->nregions && shm->regions[i] != NULL)
+        return shm->regions[i];
+
+    if (i >= shm->nregions)
+    {
+        uint32_t nregions = shm->nregions ? shm->nregions : 4;
+        uint8_t **regions;
+
+        while (nregions <= i)
+            nregions *= 2;
+        regions = realloc(shm->regions, nregions * sizeof(uint8_t *));
+        if (regions == NULL)
+            return NULL;
+        memset(regions + shm->nregions, 0, (nregions - shm->nregions) * sizeof(uint8_t *));
+        shm->regions = regions;
+        shm->nregions = nregions;
+    }
+
+    if (fstat(shm->fd, &st) != 0)
+        return NULL;
+    if (st.st_size < offset + (off_t) size)
+    {
+        if (!create || ftruncate(shm->fd, offset + size) != 0)
+            return NULL;
+    }
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, offset);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    shm->region_size = size;
+    shm->regions[i] = p;
+
+    return p;
+}
+
+
+/* Lock bytes of the file
+ *
+ * Parameters
+ * - shm: A Shm
+ * - byte: First byte to lock (one of the SHM_LOCK_* constants)
+ * - n: Number of bytes to lock
+ * - type: F_RDLCK (shared), F_WRLCK (exclusive) or F_UNLCK (to unlock)
+ * - wait: Whether to wait until the lock can be taken
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EBUSY: Another pager holds a conflicting lock (only if wait
+ *                is false)
+ * - CHIDB_EIO: The file couldn't be locked
+ */
+int chidb_Shm_lock(Shm *shm, int byte, int n, short type, bool wait)
+{
+    struct flock fl;
+    int r;
+
+    /* l_pid must be zero for open file description locks */
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = byte;
+    fl.l_len = n;
+
+    do
+        r = fcntl(shm->fd, wait ? SHM_SETLKW : SHM_SETLK, &fl);
+    while (r == -1 && errno == EINTR);
+
+    if (r == 0)
+        return CHIDB_OK;
+    if (errno == EAGAIN || errno == EACCES || errno == EDEADLK)
+        return CHIDB_EBUSY;
+
+    return CHIDB_EIO;
+}
+
+
+/* Check whether another pager holds a lock on a byte of the file
+ *
+ * Parameters
+ * - shm: A Shm
+ * - byte: Byte to check (one of the SHM_LOCK_* constants)
+ *
+ * Return
+ * - true if another pager holds a lock on it (or if that can't be
+ *   found out)
+ */
+bool chidb_Shm_lockedByOthers(Shm *shm, int byte)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = byte;
+    fl.l_len = 1;
+
+    if (fcntl(shm->fd, SHM_GETLK, &fl) != 0)
+        return true;
+
+    return fl.l_type != F_UNLCK;
+}
+
+
+/* Start changing the fields of the header that describe the log. Only
+ * the pager that holds SHM_LOCK_WRITE may do so. */
+void chidb_Shm_beginChange(Shm *shm)
+{
+    __atomic_store_n(&shm->header->seq, shm->header->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+
+/* Done changing the header (see chidb_Shm_beginChange) */
+void chidb_Shm_endChange(Shm *shm)
+{
+    __atomic_store_n(&shm->header->seq, shm->header->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+/* Start copying fields out of the header. Returns the sequence number
+ * to pass to chidb_Shm_endRead. */
+uint32_t chidb_Shm_beginRead(Shm *shm)
+{
+    uint32_t seq;
+
+    for (uint32_t spins = 1; (seq = __atomic_load_n(&shm->header->seq, __ATOMIC_ACQUIRE)) & 1; spins++)
+    {
+        /* A pager that died in the middle of a change leaves seq odd.
+         * The fields it was changing are fixed by the next writer. */
+        if (spins % SHM_SPINS == 0 && !chidb_Shm_lockedByOthers(shm, SHM_LOCK_WRITE))
+            __atomic_compare_exchange_n(&shm->header->seq, &seq, seq + 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        sched_yield();
+    }
+
+    return seq;
+}
+
+
+/* Returns true if the fields copied since chidb_Shm_beginRead are
+ * consistent, or false if they must be copied again */
+bool chidb_Shm_endRead(Shm *shm, uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&shm->header->seq, __ATOMIC_RELAXED) == seq;
+}
@@ -0,0 +1,109 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Shared memory file header. See shm.c for more details.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SHM_H_
+#define SHM_H_
+
+#include "chidbInt.h"
+
+#define SHM_MAGIC (0x43485348)     /* "CHSH" */
+#define SHM_HEADER_SIZE (4096)
+#define SHM_NREADERS (32)
+
+/* Bytes of the file that are locked (see chidb_Shm_lock) */
+#define SHM_LOCK_DMS (0)           /* Shared by every pager that has the file open */
+#define SHM_LOCK_WRITE (1)         /* The one pager that may modify the database */
+#define SHM_LOCK_CKPT (2)          /* The one pager checkpointing the log */
+#define SHM_LOCK_DB (3)            /* Shared while reading the database file, exclusive while writing it */
+#define SHM_LOCK_JOURNAL (4)       /* Held by the pager whose transaction the rollback journal is */
+#define SHM_LOCK_SYNC (5)          /* The one pager syncing the log for every committer (see chidb_Wal_sync) */
+#define SHM_LOCK_READ (6)          /* SHM_NREADERS bytes, one per read mark */
+
+/* The header of the file. The fields that describe the log are only
+ * changed by the pager that holds SHM_LOCK_WRITE, with seq odd while it
+ * does (see chidb_Shm_beginChange) */
+typedef struct ShmHeader
+{
+    uint32_t magic;
+    uint32_t seq;              /* Odd while the fields below are changing */
+    uint32_t nchanges;         /* Incremented every time the database changes */
+
+    /* Committed state of the write-ahead log (see struct Wal) */
+    uint32_t wal_page_size;    /* 0 until the WAL index is built */
+    uint32_t ckpt_seq;
+    uint32_t salt[2];
+    uint32_t cksum[2];
+    uint32_t max_frame;
+    npage_t db_size;
+    uint32_t backfill;         /* Frames already copied into the database file */
+    uint32_t index_frames;     /* Frames in the WAL index, committed or not */
+
+    /* Last log frame known to be durable, with the ckpt_seq of its log in
+     * the upper 32 bits. Only raised, by the pager holding SHM_LOCK_SYNC
+     * or checkpointing */
+    uint64_t synced;
+
+    /* Oldest log frame that the pager holding SHM_LOCK_READ + i reads as
+     * of (0 while it is choosing one) */
+    uint32_t read_marks[SHM_NREADERS];
+} ShmHeader;
+
+struct Shm
+{
+    int fd;
+    char *filename;
+    ShmHeader *header;
+    size_t region_size;      /* Size of each region (see chidb_Shm_region) */
+    uint8_t **regions;       /* Mapped regions (NULL if not mapped yet) */
+    uint32_t nregions;
+};
+typedef struct Shm Shm;
+
+int chidb_Shm_open(Shm **shm, const char *dbfilename);
+int chidb_Shm_close(Shm *shm, bool remove_file);
+bool chidb_Shm_isLast(Shm *shm);
+void *chidb_Shm_region(Shm *shm, uint32_t i, size_t size, bool create);
+int chidb_Shm_lock(Shm *shm, int byte, int n, short type, bool wait);
+bool chidb_Shm_lockedByOthers(Shm *shm, int byte);
+void chidb_Shm_beginChange(Shm *shm);
+void chidb_Shm_endChange(Shm *shm);
+uint32_t chidb_Shm_beginRead(Shm *shm);
+bool chidb_Shm_endRead(Shm *shm, uint32_t seq);
+
+#endif /*SHM_H_*/
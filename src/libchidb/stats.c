@@ -0,0 +1,446 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * Table and column statistics, collected by ANALYZE and used by the
+ * optimizer (see optimizer.c) to estimate how many rows each part of a
+ * query produces.
+ *
+ * chidb_stats_analyze scans a table once, and keeps for each column the
+ * number of NULLs, an equi-depth histogram of its integer values, and
+ * an estimate of its number of distinct values. The estimate comes from
+ * the STATS_KMV_SIZE smallest hashes of the values (a "k minimum
+ * values" sketch): if the hashes are uniform, the k-th smallest of d
+ * distinct hashes is about k/d of the way through the hash space. This
+ * takes constant memory per column, however many values it has.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <strings.h>
+#include "stats.h"
+#include "btree.h"
+#include "record.h"
+#include "crc32c.h"
+#include "dbm-cursor.h"
+
+/* State of a column while its table is scanned */
+typedef struct chidb_stats_scan
+{
+    uint32_t kmv[STATS_KMV_SIZE];   /* Smallest hashes seen, sorted */
+    uint32_t nkmv;
+    int32_t *ints;                  /* Integer values, for the histogram */
+    uint32_t nints, capacity;
+} chidb_stats_scan_t;
+
+
+static uint32_t chidb_stats_mix(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+/* Adds a hash to a k minimum values sketch */
+static void chidb_stats_kmvAdd(chidb_stats_scan_t *s, uint32_t h)
+{
+    uint32_t lo = 0, hi = s->nkmv;
+
+    if (s->nkmv == STATS_KMV_SIZE && h >= s->kmv[s->nkmv - 1])
+        return;
+
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (s->kmv[mid] < h)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < s->nkmv && s->kmv[lo] == h)
+        return;
+
+    if (s->nkmv < STATS_KMV_SIZE)
+        s->nkmv++;
+    memmove(&s->kmv[lo + 1], &s->kmv[lo], (s->nkmv - 1 - lo) * sizeof(uint32_t));
+    s->kmv[lo] = h;
+}
+
+static double chidb_stats_kmvEstimate(chidb_stats_scan_t *s)
+{
+    if (s->nkmv < STATS_KMV_SIZE)
+        return s->nkmv;
+
+    return (STATS_KMV_SIZE - 1) * (4294967296.0 / ((double) s->kmv[STATS_KMV_SIZE - 1] + 1));
+}
+
+static int chidb_stats_cmpInt(const void *a, const void *b)
+{
+    int32_t x = *(const int32_t *) a, y = *(const int32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Adds the value of a column in a row to its statistics */
+static int chidb_stats_addValue(chidb_column_stats_t *cs, chidb_stats_scan_t *s, DBRecordView *view, uint8_t field)
+{
+    const char *str;
+    int8_t v8;
+    int16_t v16;
+    int32_t v32;
+    int len;
+
+    switch (field < chidb_DBRecordView_nfields(view) ? chidb_DBRecordView_getType(view, field) : SQL_NULL)
+    {
+    case SQL_NULL:
+        cs->nnull++;
+        return CHIDB_OK;
+    case SQL_INTEGER_1BYTE:
+        chidb_DBRecordView_getInt8(view, field, &v8);
+        v32 = v8;
+        break;
+    case SQL_INTEGER_2BYTE:
+        chidb_DBRecordView_getInt16(view, field, &v16);
+        v32 = v16;
+        break;
+    case SQL_INTEGER_4BYTE:
+        chidb_DBRecordView_getInt32(view, field, &v32);
+        break;
+    case SQL_TEXT:
+        chidb_DBRecordView_getString(view, field, &str, &len);
+        chidb_stats_kmvAdd(s, chidb_stats_mix(chidb_crc32c(0, str, len)));
+        return CHIDB_OK;
+    default:
+        return CHIDB_ECORRUPT;
+    }
+
+    if (s->nints == s->capacity)
+    {
+        uint32_t capacity = s->capacity ? 2 * s->capacity : 64;
+        int32_t *ints = realloc(s->ints, capacity * sizeof(int32_t));
+        if (ints == NULL)
+            return CHIDB_ENOMEM;
+        s->ints = ints;
+        s->capacity = capacity;
+    }
+    s->ints[s->nints++] = v32;
+    cs->nint++;
+    chidb_stats_kmvAdd(s, chidb_stats_mix((uint32_t) v32 ^ 0x9e3779b9));
+
+    return CHIDB_OK;
+}
+
+/* Fills in the histogram and distinct estimate of a scanned column */
+static void chidb_stats_finishColumn(chidb_column_stats_t *cs, chidb_stats_scan_t *s)
+{
+    cs->ndistinct = chidb_stats_kmvEstimate(s);
+
+    if (s->nints == 0)
+        return;
+
+    qsort(s->ints, s->nints, sizeof(int32_t), chidb_stats_cmpInt);
+    cs->nbounds = STATS_NBUCKETS + 1;
+    for (uint32_t i = 0; i <= STATS_NBUCKETS; i++)
+        cs->bounds[i] = s->ints[(uint64_t) i * (s->nints - 1) / STATS_NBUCKETS];
+}
+
+/* Scans a table B-Tree, and collects the statistics of its columns */
+static int chidb_stats_scanTable(BTree *bt, chidb_table_stats_t *ts, chidb_stats_scan_t *scans)
+{
+    chidb_dbm_cursor_t c;
+    DBRecordView view;
+    npage_t leaf = 0;
+    uint8_t *data;
+    int rc;
+
+    rc = chidb_dbm_cursor_open(&c, CURSOR_READ, bt, ts->nroot);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    for (rc = chidb_dbm_cursor_rewind(&c); rc == CHIDB_OK; rc = chidb_dbm_cursor_next(&c))
+    {
+        BTreeCell *cell = &c.cell;
+
+        ts->nrows++;
+        if (c.path[c.depth - 1].btn->page->npage != leaf)
+        {
+            leaf = c.path[c.depth - 1].btn->page->npage;
+            ts->nleaves++;
+        }
+        if ((uint32_t) c.depth > ts->depth)
+            ts->depth = c.depth;
+
+        data = NULL;
+        if (cell->fields.tableLeaf.overflow_page != 0)
+        {
+            data = malloc(cell->fields.tableLeaf.data_size);
+            if (data == NULL)
+            {
+                rc = CHIDB_ENOMEM;
+                break;
+            }
+            rc = chidb_Btree_readPayload(bt, cell, 0, cell->fields.tableLeaf.data_size, data);
+            if (rc != CHIDB_OK)
+            {
+                free(data);
+                break;
+            }
+        }
+
+        if (BTREE_RECORD_FORMAT(bt) == DBRECORD_FORMAT_V2)
+            rc = chidb_DBRecordView_initV2(&view, data != NULL ? data : cell->fields.tableLeaf.data);
+        else
+            rc = chidb_DBRecordView_init(&view, data != NULL ? data : cell->fields.tableLeaf.data);
+        for (uint32_t i = 0; rc == CHIDB_OK && i < ts->ncols; i++)
+            rc = chidb_stats_addValue(&ts->cols[i], &scans[i], &view, i);
+        free(data);
+        if (rc != CHIDB_OK)
+            break;
+    }
+    chidb_dbm_cursor_close(&c);
+
+    return rc == CHIDB_DONE ? CHIDB_OK : rc;
+}
+
+static void chidb_stats_freeTable(chidb_table_stats_t *ts)
+{
+    for (uint32_t i = 0; i < ts->ncols; i++)
+        free(ts->cols[i].name);
+    free(ts->cols);
+    free(ts->name);
+    free(ts);
+}
+
+
+/* Collect the statistics of a table
+ *
+ * Scans a table and replaces its statistics (if it had any) with new
+ * ones: its number of rows, leaf pages and levels, and for each column,
+ * its number of NULLs, an estimate of its number of distinct values and
+ * a histogram of its integer values. The columns are the first ncols
+ * fields of the table's records.
+ *
+ * This is what ANALYZE runs for every table (or the table it names),
+ * with the columns and indexes from the schema.
+ *
+ * Parameters
+ * - db: Database
+ * - table: Name of the table
+ * - nroot: Root page of the table B-Tree
+ * - columns: Names of the columns of the table
+ * - index_roots: Root page of an index on each column (0 if the column
+ *                is not indexed), or NULL if there are no indexes
+ * - ncols: Number of columns
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: A record of the table is not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_stats_analyze(chidb *db, const char *table, npage_t nroot,
+                        const char **columns, const npage_t *index_roots, uint32_t ncols)
+{
+    chidb_table_stats_t *ts, **p;
+    chidb_stats_scan_t *scans;
+    int rc = CHIDB_OK;
+
+    ts = calloc(1, sizeof(chidb_table_stats_t));
+    scans = calloc(ncols ? ncols : 1, sizeof(chidb_stats_scan_t));
+    if (ts == NULL || scans == NULL || (ts->name = strdup(table)) == NULL ||
+        (ts->cols = calloc(ncols ? ncols : 1, sizeof(chidb_column_stats_t))) == NULL)
+        rc = CHIDB_ENOMEM;
+
+    if (rc == CHIDB_OK)
+    {
+        ts->nroot = nroot;
+        ts->ncols = ncols;
+        for (uint32_t i = 0; i < ncols && rc == CHIDB_OK; i++)
+        {
+            if ((ts->cols[i].name = strdup(columns[i])) == NULL)
+                rc = CHIDB_ENOMEM;
+            ts->cols[i].index_root = index_roots != NULL ? index_roots[i] : 0;
+        }
+    }
+
+    if (rc == CHIDB_OK)
+        rc = chidb_stats_scanTable(db->bt, ts, scans);
+    for (uint32_t i = 0; rc == CHIDB_OK && i < ncols; i++)
+        chidb_stats_finishColumn(&ts->cols[i], &scans[i]);
+
+    for (uint32_t i = 0; scans != NULL && i < ncols; i++)
+        free(scans[i].ints);
+    free(scans);
+    if (rc != CHIDB_OK)
+    {
+        if (ts != NULL)
+        {
+            ts->ncols = ts->cols != NULL ? ncols : 0;
+            chidb_stats_freeTable(ts);
+        }
+        return rc;
+    }
+
+    /* Replace the table's old statistics */
+    for (p = &db->table_stats; *p != NULL; p = &(*p)->next)
+    {
+        if (strcasecmp((*p)->name, table) == 0)
+        {
+            chidb_table_stats_t *old = *p;
+            *p = old->next;
+            chidb_stats_freeTable(old);
+            break;
+        }
+    }
+    ts->next = db->table_stats;
+    db->table_stats = ts;
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the statistics of a table, or NULL if it hasn't been analyzed */
+chidb_table_stats_t *chidb_stats_table(chidb *db, const char *table)
+{
+    chidb_table_stats_t *ts;
+
+    for (ts = db->table_stats; ts != NULL; ts = ts->next)
+        if (strcasecmp(ts->name, table) == 0)
+            return ts;
+
+    return NULL;
+}
+
+/* Returns the statistics of a column of a table, or NULL if there are none */
+chidb_column_stats_t *chidb_stats_column(chidb_table_stats_t *ts, const char *column)
+{
+    if (ts == NULL)
+        return NULL;
+
+    for (uint32_t i = 0; i < ts->ncols; i++)
+        if (strcasecmp(ts->cols[i].name, column) == 0)
+            return &ts->cols[i];
+
+    return NULL;
+}
+
+
+/* Fraction of the integers of a column's histogram that are less than v */
+static double chidb_stats_fractionLess(chidb_column_stats_t *cs, int32_t v)
+{
+    uint32_t nbuckets = cs->nbounds - 1, i;
+
+    if (v <= cs->bounds[0])
+        return 0;
+    if (v > cs->bounds[nbuckets])
+        return 1;
+
+    for (i = 0; i < nbuckets && v > cs->bounds[i + 1]; i++)
+        ;
+    if (cs->bounds[i + 1] == cs->bounds[i])
+        return (double) i / nbuckets;
+
+    return (i + ((double) v - cs->bounds[i]) / ((double) cs->bounds[i + 1] - cs->bounds[i])) / nbuckets;
+}
+
+/* Estimate the selectivity of a predicate
+ *
+ * Estimates the fraction of the rows of a table where "column op value"
+ * holds. Range predicates use the histogram of the column (if value is
+ * known), and equality assumes that values are spread evenly among the
+ * distinct ones. Without statistics, the usual fixed guesses are used.
+ *
+ * Parameters
+ * - ts: Statistics of the table (NULL if there are none)
+ * - cs: Statistics of the column (NULL if there are none)
+ * - op: Comparison
+ * - has_value: Whether value is known (it isn't for text or parameters)
+ * - value: Integer the column is compared to
+ *
+ * Return
+ * - Estimated selectivity, between 0 and 1
+ */
+double chidb_stats_selectivity(chidb_table_stats_t *ts, chidb_column_stats_t *cs,
+                               chidb_stats_op_t op, bool has_value, int32_t value)
+{
+    double nonnull, ints, eq, less, sel;
+
+    if (ts == NULL || cs == NULL)
+        return op == STATS_EQ ? STATS_DEFAULT_EQ : STATS_DEFAULT_RANGE;
+    if (ts->nrows == 0)
+        return 0;
+
+    nonnull = (double) (ts->nrows - cs->nnull) / ts->nrows;
+    eq = cs->ndistinct >= 1 ? nonnull / cs->ndistinct : 0;
+    if (op == STATS_EQ)
+        return eq;
+    if (!has_value || cs->nbounds == 0)
+        return nonnull * STATS_DEFAULT_RANGE;
+
+    ints = (double) cs->nint / ts->nrows;
+    less = chidb_stats_fractionLess(cs, value) * ints;
+    switch (op)
+    {
+    case STATS_LT:
+        sel = less;
+        break;
+    case STATS_LE:
+        sel = less + eq;
+        break;
+    case STATS_GT:
+        sel = ints - less - eq;
+        break;
+    default:
+        sel = ints - less;
+        break;
+    }
+
+    return sel < 0 ? 0 : sel > 1 ? 1 : sel;
+}
+
+
+/* Free the statistics of every table of a database */
+void chidb_stats_free(chidb *db)
+{
+    chidb_table_stats_t *ts, *next;
+
+    for (ts = db->table_stats; ts != NULL; ts = next)
+    {
+        next = ts->next;
+        chidb_stats_freeTable(ts);
+    }
+    db->table_stats = NULL;
+}
@@ -0,0 +1,104 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Table and column statistics -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include "chidbInt.h"
+
+/* Buckets of a column's histogram, and size of the sample of hashes
+ * that the number of distinct values is estimated from */
+#define STATS_NBUCKETS (16)
+#define STATS_KMV_SIZE (256)
+
+/* Selectivity of a predicate on a column without statistics (the
+ * usual System R guesses) */
+#define STATS_DEFAULT_EQ (0.1)
+#define STATS_DEFAULT_RANGE (1.0 / 3)
+
+typedef enum chidb_stats_op
+{
+    STATS_EQ,
+    STATS_LT,
+    STATS_LE,
+    STATS_GT,
+    STATS_GE
+} chidb_stats_op_t;
+
+/* Statistics of a column, collected by chidb_stats_analyze */
+typedef struct chidb_column_stats
+{
+    char *name;
+    npage_t index_root;     /* Root of an index on the column (0 if none) */
+    uint32_t nnull;         /* Rows where the column is NULL */
+    uint32_t nint;          /* Rows where the column is an integer */
+    double ndistinct;       /* Estimated number of distinct non-NULL values */
+
+    /* Equi-depth histogram of the integer values: each of the nbounds - 1
+     * buckets from bounds[i] to bounds[i + 1] has the same number of
+     * values (nbounds is 0 if there are no integers) */
+    uint32_t nbounds;
+    int32_t bounds[STATS_NBUCKETS + 1];
+} chidb_column_stats_t;
+
+/* Statistics of a table (see chidb_stats_analyze). The statistics of
+ * the tables of a database are kept in a list in its chidb struct. */
+typedef struct chidb_table_stats
+{
+    char *name;
+    npage_t nroot;
+    uint32_t nrows;
+    uint32_t nleaves;       /* Leaf pages */
+    uint32_t depth;         /* Levels of the B-Tree */
+    uint32_t ncols;
+    chidb_column_stats_t *cols;
+
+    struct chidb_table_stats *next;
+} chidb_table_stats_t;
+
+int chidb_stats_analyze(chidb *db, const char *table, npage_t nroot,
+                        const char **columns, const npage_t *index_roots, uint32_t ncols);
+chidb_table_stats_t *chidb_stats_table(chidb *db, const char *table);
+chidb_column_stats_t *chidb_stats_column(chidb_table_stats_t *ts, const char *column);
+double chidb_stats_selectivity(chidb_table_stats_t *ts, chidb_column_stats_t *cs,
+                               chidb_stats_op_t op, bool has_value, int32_t value);
+void chidb_stats_free(chidb *db);
+
+#endif /*STATS_H_*/
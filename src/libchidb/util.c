@@ -39,8 +39,20 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
 #include "chidbInt.h"
 #include "util.h"
 #include "record.h"
@@ -91,14 +103,177 @@ int putVarint32(uint8_t *p, uint32_t v)
     return CHIDB_OK;
 }
 
+/*
+** Read or write a variable-length integer of one to five bytes. Unlike
+** the varints above, these use as few bytes as possible: seven bits per
+** byte, most significant group first, with the high bit set in every
+** byte but the last. Both functions return the number of bytes used.
+* Based on SQLite code
+*/
+int getUvarint32(const uint8_t *p, uint32_t *v)
+{
+    uint32_t x = 0;
+    int i = 0;
+
+    do
+        x = (x << 7) | (p[i] & 0x7F);
+    while ((p[i++] & 0x80) && i < UVARINT32_MAXSIZE);
+
+    *v = x;
+    return i;
+}
+
+int putUvarint32(uint8_t *p, uint32_t v)
+{
+    int n = uvarint32Len(v);
+
+    for (int i = n - 1; i >= 0; i--)
+    {
+        p[i] = (uint8_t)((v & 0x7F) | (i == n - 1 ? 0 : 0x80));
+        v >>= 7;
+    }
+
+    return n;
+}
+
+int uvarint32Len(uint32_t v)
+{
+    int n = 1;
+
+    while (v >= 0x80 && n < UVARINT32_MAXSIZE)
+    {
+        v >>= 7;
+        n++;
+    }
+
+    return n;
+}
+
+/*
+** Read or write the types in a record header: one byte for each type
+** below 0x80 that isn't a string, and a four-byte varint (see
+** getVarint32) for strings. getRecordTypes decodes up to max types
+** from the len bytes at p, returning how many it decoded and storing
+** in *used the number of bytes they took up; a varint cut short by
+** the end of the header isn't decoded. Runs of one-byte types are
+** widened sixteen at a time with SSE2 or NEON, which may write up to
+** max types even if fewer are decoded. putRecordTypes returns the
+** number of bytes written.
+*/
+static inline uint32_t getRecordVarint(const uint8_t *p)
+{
+#ifdef __BMI2__
+    uint32_t x;
+
+    memcpy(&x, p, sizeof(x));
+    return _pext_u32(__builtin_bswap32(x), 0x7F7F7F7F);
+#else
+    uint32_t v;
+
+    getVarint32(p, &v);
+    return v;
+#endif
+}
+
+/* Number of one-byte types at the start of the sixteen bytes at p (whose
+ * types are stored in types[0..15]), or -1 if there's no SIMD support */
+static inline int getRecordTypes16(const uint8_t *p, uint32_t *types)
+{
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i b = _mm_loadu_si128((const __m128i *) p);
+    __m128i lo = _mm_unpacklo_epi8(b, zero);
+    __m128i hi = _mm_unpackhi_epi8(b, zero);
+    int mask = _mm_movemask_epi8(b);
+
+    _mm_storeu_si128((__m128i *) types, _mm_unpacklo_epi16(lo, zero));
+    _mm_storeu_si128((__m128i *) (types + 4), _mm_unpackhi_epi16(lo, zero));
+    _mm_storeu_si128((__m128i *) (types + 8), _mm_unpacklo_epi16(hi, zero));
+    _mm_storeu_si128((__m128i *) (types + 12), _mm_unpackhi_epi16(hi, zero));
+
+    return mask ? __builtin_ctz(mask) : 16;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint8x16_t b = vld1q_u8(p);
+    uint16x8_t lo = vmovl_u8(vget_low_u8(b));
+    uint16x8_t hi = vmovl_u8(vget_high_u8(b));
+    /* Four bits per byte, set if its high bit is */
+    uint8x16_t high = vcltzq_s8(vreinterpretq_s8_u8(b));
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(high), 4)), 0);
+
+    vst1q_u32(types, vmovl_u16(vget_low_u16(lo)));
+    vst1q_u32(types + 4, vmovl_u16(vget_high_u16(lo)));
+    vst1q_u32(types + 8, vmovl_u16(vget_low_u16(hi)));
+    vst1q_u32(types + 12, vmovl_u16(vget_high_u16(hi)));
+
+    return mask ? __builtin_ctzll(mask) / 4 : 16;
+#else
+    return -1;
+#endif
+}
+
+int getRecordTypes(const uint8_t *p, uint32_t len, uint32_t *types, int max, uint32_t *used)
+{
+    uint32_t pos = 0;
+    int n = 0;
+
+    while (pos < len && n < max)
+    {
+        if (len - pos >= 16 && max - n >= 16)
+        {
+            int run = getRecordTypes16(p + pos, types + n);
+
+            if (run > 0)
+            {
+                pos += run;
+                n += run;
+                continue;
+            }
+        }
+
+        if (p[pos] & 0x80)
+        {
+            if (len - pos < 4)
+                break;
+            types[n++] = getRecordVarint(p + pos);
+            pos += 4;
+        }
+        else
+            types[n++] = p[pos++];
+    }
+
+    *used = pos;
+    return n;
+}
+
+int putRecordTypes(uint8_t *p, const uint32_t *types, int n)
+{
+    uint32_t pos = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (types[i] >= SQL_TEXT && (types[i] - SQL_TEXT) % 2 == 0)
+        {
+            putVarint32(p + pos, types[i]);
+            pos += 4;
+        }
+        else
+            p[pos++] = (uint8_t) types[i];
+    }
+
+    return pos;
+}
+
 
 void chidb_BTree_recordPrinter(BTreeNode *btn, BTreeCell *btc)
 {
     DBRecord *dbr;
 
-    chidb_DBRecord_unpack(&dbr, btc->fields.tableLeaf.data);
+    if (BTREE_RECORD_FORMAT(btn->bt) == DBRECORD_FORMAT_V2)
+        chidb_DBRecord_unpackV2(&dbr, btc->fields.tableLeaf.data);
+    else
+        chidb_DBRecord_unpack(&dbr, btc->fields.tableLeaf.data);
 
-    printf("< %5i >", btc->key);
+    printf("< %5" PRIi64 " >", (int64_t) btc->key);
     chidb_DBRecord_print(dbr);
     printf("\n");
 
@@ -107,7 +282,7 @@ void chidb_BTree_recordPrinter(BTreeNode *btn, BTreeCell *btc)
 
 void chidb_BTree_stringPrinter(BTreeNode *btn, BTreeCell *btc)
 {
-    printf("%5i -> %10s\n", btc->key, btc->fields.tableLeaf.data);
+    printf("%5" PRIi64 " -> %10s\n", (int64_t) btc->key, btc->fields.tableLeaf.data);
 }
 
 int chidb_astrcat(char **dst, char *src)
@@ -120,6 +295,69 @@ int chidb_astrcat(char **dst, char *src)
 }
 
 
+/* Returns the number of threads that the parallel operations of a
+ * database run on (see chidb_set_threads) */
+uint32_t chidb_nthreads(chidb *db)
+{
+    long n;
+
+    if (db != NULL && db->nthreads > 0)
+        return db->nthreads;
+
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint32_t) n : 1;
+}
+
+/* Returns a monotonic timestamp, in nanoseconds */
+uint64_t chidb_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Returns the CPU's cycle counter, where there is one to read cheaply,
+ * or chidb_time_ns otherwise */
+uint64_t chidb_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return chidb_time_ns();
+#endif
+}
+
+/* Reports an event to a database's trace callback, timestamping it. An
+ * event that ends took since start (0 if it has no duration); the
+ * others happen now. Callers test CHIDB_TRACING first. */
+void chidb_trace_emit(chidb_tracer *t, chidb_trace_event *ev, uint64_t start)
+{
+    ev->ns = chidb_time_ns();
+    ev->duration_ns = ev->phase == CHIDB_TRACE_END && start != 0 ? ev->ns - start : 0;
+    if (ev->stmt == NULL)
+        ev->stmt = t->stmt;
+
+    t->callback(t->db, ev);
+}
+
+/* Adds an operation that took ns nanoseconds to a latency histogram */
+void chidb_histogram_add(chidb_histogram *hist, uint64_t ns)
+{
+    int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+
+    if (bucket >= CHIDB_HIST_NBUCKETS)
+        bucket = CHIDB_HIST_NBUCKETS - 1;
+
+    hist->buckets[bucket]++;
+    hist->count++;
+    hist->total_ns += ns;
+    if (ns > hist->max_ns)
+        hist->max_ns = ns;
+}
+
+
 int chidb_Btree_print(BTree *bt, npage_t npage, fBTreeCellPrinter printer, bool verbose)
 {
     BTreeNode *btn;
@@ -152,11 +390,11 @@ int chidb_Btree_print(BTree *bt, npage_t npage, fBTreeCellPrinter printer, bool
 
             last_key = btc.key;
             if(verbose)
-                printf("Printing Keys <= %i\n", last_key);
+                printf("Printing Keys <= %" PRIi64 "\n", (int64_t) last_key);
             chidb_Btree_print(bt, btc.fields.tableInternal.child_page, printer, verbose);
         }
         if(verbose)
-            printf("Printing Keys > %i\n", last_key);
+            printf("Printing Keys > %" PRIi64 "\n", (int64_t) last_key);
         chidb_Btree_print(bt, btn->right_page, printer, verbose);
     }
     else if (btn->type == PGTYPE_INDEX_LEAF)
@@ -168,7 +406,7 @@ int chidb_Btree_print(BTree *bt, npage_t npage, fBTreeCellPrinter printer, bool
             BTreeCell btc;
 
             chidb_Btree_getCell(btn, i, &btc);
-            printf("%10i -> %10i\n", btc.key, btc.fields.indexLeaf.keyPk);
+            printf("%10" PRIi64 " -> %10" PRIi64 "\n", (int64_t) btc.key, (int64_t) btc.fields.indexLeaf.keyPk);
         }
     }
     else if (btn->type == PGTYPE_INDEX_INTERNAL)
@@ -184,12 +422,12 @@ int chidb_Btree_print(BTree *bt, npage_t npage, fBTreeCellPrinter printer, bool
             chidb_Btree_getCell(btn, i, &btc);
             last_key = btc.key;
             if(verbose)
-                printf("Printing Keys < %i\n", last_key);
+                printf("Printing Keys < %" PRIi64 "\n", (int64_t) last_key);
             chidb_Btree_print(bt, btc.fields.indexInternal.child_page, printer, verbose);
-            printf("%10i -> %10i\n", btc.key, btc.fields.indexInternal.keyPk);
+            printf("%10" PRIi64 " -> %10" PRIi64 "\n", (int64_t) btc.key, (int64_t) btc.fields.indexInternal.keyPk);
         }
         if(verbose)
-            printf("Printing Keys > %i\n", last_key);
+            printf("Printing Keys > %" PRIi64 "\n", (int64_t) last_key);
         chidb_Btree_print(bt, btn->right_page, printer, verbose);
     }
 
@@ -59,8 +59,24 @@ void put4byte(unsigned char *p, uint32_t v);
 int getVarint32(const uint8_t *p, uint32_t *v);
 int putVarint32(uint8_t *p, uint32_t v);
 
+/* Variable-length integers of one to five bytes (see putUvarint32) */
+#define UVARINT32_MAXSIZE (5)
+int getUvarint32(const uint8_t *p, uint32_t *v);
+int putUvarint32(uint8_t *p, uint32_t v);
+int uvarint32Len(uint32_t v);
+
+/* All the types in a record header at once (see getRecordTypes) */
+int getRecordTypes(const uint8_t *p, uint32_t len, uint32_t *types, int max, uint32_t *used);
+int putRecordTypes(uint8_t *p, const uint32_t *types, int n);
+
 int chidb_astrcat(char **dst, char *src);
 
+uint32_t chidb_nthreads(chidb *db);
+uint64_t chidb_time_ns(void);
+uint64_t chidb_cycles(void);
+void chidb_histogram_add(chidb_histogram *hist, uint64_t ns);
+void chidb_trace_emit(chidb_tracer *t, chidb_trace_event *ev, uint64_t start);
+
 typedef void (*fBTreeCellPrinter)(BTreeNode *, BTreeCell*);
 int chidb_Btree_print(BTree *bt, npage_t nroot, fBTreeCellPrinter printer, bool verbose);
 void chidb_BTree_recordPrinter(BTreeNode *btn, BTreeCell *btc);
@@ -0,0 +1,1063 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module implements the write-ahead log (WAL). When the WAL is
+ * enabled, the pager never overwrites pages in the database file.
+ * Instead, modified pages are appended to a separate log file (the
+ * database file name followed by "-wal"), so all writes are sequential.
+ *
+ * The log starts with a 32-byte header:
+ *
+ *   0: Magic number (WAL_MAGIC)
+ *   4: Format version (WAL_VERSION)
+ *   8: Page size
+ *  12: Checkpoint sequence number
+ *  16: Salt (two 4-byte values)
+ *  24: Checksum of the first 24 bytes (two 4-byte values)
+ *
+ * followed by any number of frames. A frame is a 24-byte frame header
+ * followed by a copy of a page:
+ *
+ *   0: Page number
+ *   4: For commit frames, the size of the database (in pages) after the
+ *      commit. Zero for all other frames
+ *   8: Salt (must match the salt in the log header)
+ *  16: Running checksum (two 4-byte values) of the log header, and of the
+ *      first 8 bytes and the page contents of every frame up to this one
+ *
+ * All values are 4-byte big-endian integers. A transaction is committed
+ * once its commit frame is in the log; frames after the last valid commit
+ * frame are ignored when the log is recovered. Since every frame's
+ * checksum depends on all the previous frames, a torn write at the end
+ * of the log is always detected.
+ *
+ * A commit is only reported once the log is synced up to its commit
+ * frame, but pagers that commit at the same time share a single
+ * fdatasync (see chidb_Wal_sync): whichever one gets to sync first
+ * syncs the log up to the last commit of any of them.
+ *
+ * To find the most recent version of a page, we consult the WAL index:
+ * a hash table from page numbers to the most recent frame with that page,
+ * plus, for every frame, the previous frame with the same page. A reader
+ * can use this to look up a page as of any committed frame (a snapshot),
+ * ignoring any frames that were appended after it.
+ *
+ * The WAL index lives in the shared memory file (see shm.c), so that
+ * every pager that has the database open, in any process, uses the same
+ * one: a pager that opens a log that another pager already indexed
+ * doesn't read it at all. The index is split into segments of
+ * WAL_INDEX_FRAMES frames, each one with a hash table of its own, which
+ * is what lets the shared memory file grow by whole regions without
+ * moving what is already there; a lookup searches the segments from the
+ * newest one down. The committed state of the log (its last commit
+ * frame, the size of the database then, and so on) is in the header of
+ * the shared memory file, which the writer updates on every commit
+ * (chidb_Wal_refresh copies it). Only the pager that holds
+ * SHM_LOCK_WRITE appends frames, and it only ever changes the index past
+ * the last commit, which readers never look at; they still check the
+ * page of every frame past their snapshot that they go through, and
+ * start over if it doesn't match (the frame was truncated and appended
+ * again under them).
+ *
+ * Checkpointing copies the most recent committed version of every page
+ * in the log back into the database file, and then starts a new log.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include <chidb/log.h>
+
+#include "chidbInt.h"
+
+#include "wal.h"
+#include "util.h"
+
+static int chidb_Wal_reset(Wal *wal);
+static int chidb_Wal_recover(Wal *wal);
+static int chidb_Wal_indexAdd(Wal *wal, npage_t npage, uint32_t frame);
+static void chidb_Wal_indexTruncate(Wal *wal, uint32_t max_frame);
+static void chidb_Wal_publish(Wal *wal);
+static void chidb_Wal_markSynced(Wal *wal, uint32_t ckpt_seq, uint32_t frame);
+static void chidb_Wal_checksum(const uint8_t *data, size_t n, uint32_t *cksum);
+static off_t chidb_Wal_frameOffset(Wal *wal, uint32_t frame);
+static int chidb_Wal_pwrite(Wal *wal, int fd, const uint8_t *buf, size_t n, off_t offset, npage_t npage);
+static int chidb_Wal_fdatasync(Wal *wal, int fd);
+
+
+/* Open a write-ahead log
+ *
+ * Opens (or creates) the log for a database file. If the log already
+ * exists, e.g., because the database wasn't closed cleanly, all the
+ * transactions committed to it are recovered, unless another pager
+ * already did, and indexed it in the shared memory file. The caller
+ * must not hold SHM_LOCK_WRITE.
+ *
+ * Parameters
+ * - wal: An out parameter. Used to return a pointer to the
+ *        newly created Wal.
+ * - dbfilename: Database file. The log is called dbfilename-wal
+ * - page_size: Page size of the database
+ * - shm: The database's shared memory file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Wal_open(Wal **wal, const char *dbfilename, uint32_t page_size, Shm *shm)
+{
+    int rc;
+
+    *wal = calloc(1, sizeof(Wal));
+    if (*wal == NULL)
+        return CHIDB_ENOMEM;
+
+    (*wal)->page_size = page_size;
+    (*wal)->shm = shm;
+    (*wal)->filename = malloc(strlen(dbfilename) + 5);
+    (*wal)->buf = malloc(WAL_FRAME_HEADER_SIZE + page_size);
+    if ((*wal)->filename == NULL || (*wal)->buf == NULL)
+    {
+        free((*wal)->filename);
+        free((*wal)->buf);
+        free(*wal);
+        return CHIDB_ENOMEM;
+    }
+    sprintf((*wal)->filename, "%s-wal", dbfilename);
+
+    (*wal)->fd = open((*wal)->filename, O_RDWR | O_CREAT, 0644);
+    if ((*wal)->fd == -1)
+    {
+        rc = CHIDB_EIO;
+        goto error;
+    }
+
+    /* Only one pager builds the index */
+    if (__atomic_load_n(&shm->header->wal_page_size, __ATOMIC_ACQUIRE) != page_size)
+    {
+        rc = chidb_Shm_lock(shm, SHM_LOCK_WRITE, 1, F_WRLCK, true);
+        if (rc != CHIDB_OK)
+            goto error;
+        if (shm->header->wal_page_size != page_size)
+            rc = chidb_Wal_recover(*wal);
+        else
+            rc = chidb_Wal_refresh(*wal);
+        chidb_Shm_lock(shm, SHM_LOCK_WRITE, 1, F_UNLCK, false);
+    }
+    else
+        rc = chidb_Wal_refresh(*wal);
+    if (rc != CHIDB_OK)
+        goto error;
+
+    return CHIDB_OK;
+
+error:
+    if ((*wal)->fd != -1)
+        close((*wal)->fd);
+    free((*wal)->filename);
+    free((*wal)->buf);
+    free(*wal);
+    return rc;
+}
+
+
+/* Close a write-ahead log
+ *
+ * Any unsynced commits are synced before closing the log.
+ *
+ * Parameters
+ * - wal: A Wal
+ * - remove_file: If true, the log file is deleted. This should only be
+ *                done after a checkpoint that emptied the log, by the
+ *                last pager that has the database open.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Wal_close(Wal *wal, bool remove_file)
+{
+    int rc;
+
+    rc = chidb_Wal_sync(wal);
+
+    if (close(wal->fd) != 0)
+        rc = CHIDB_EIO;
+    if (rc == CHIDB_OK && remove_file)
+    {
+        unlink(wal->filename);
+        chidb_Shm_beginChange(wal->shm);
+        wal->shm->header->wal_page_size = 0;
+        chidb_Shm_endChange(wal->shm);
+    }
+
+    free(wal->filename);
+    free(wal->buf);
+    free(wal);
+
+    return rc;
+}
+
+
+/* Catch up with the commits of other pagers
+ *
+ * Copies the committed state of the log from the shared memory file.
+ * Frames past the last commit that this pager appended are forgotten,
+ * so this should only be called when it has none.
+ *
+ * Parameters
+ * - wal: A Wal
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: The log was indexed for another page size
+ */
+int chidb_Wal_refresh(Wal *wal)
+{
+    ShmHeader *h = wal->shm->header;
+    uint32_t seq, page_size;
+
+    do
+    {
+        seq = chidb_Shm_beginRead(wal->shm);
+        page_size = h->wal_page_size;
+        wal->ckpt_seq = h->ckpt_seq;
+        wal->salt[0] = h->salt[0];
+        wal->salt[1] = h->salt[1];
+        wal->commit_cksum[0] = h->cksum[0];
+        wal->commit_cksum[1] = h->cksum[1];
+        wal->max_frame = h->max_frame;
+        wal->db_size = h->db_size;
+    }
+    while (!chidb_Shm_endRead(wal->shm, seq));
+
+    if (page_size != wal->page_size)
+        return CHIDB_EIO;
+
+    wal->n_frames = wal->max_frame;
+    wal->cksum[0] = wal->commit_cksum[0];
+    wal->cksum[1] = wal->commit_cksum[1];
+
+    return CHIDB_OK;
+}
+
+
+/* Get ready to append frames
+ *
+ * Must be called by a pager that just took SHM_LOCK_WRITE. Catches up
+ * with the commits of other pagers (see chidb_Wal_refresh), and removes
+ * the frames that a writer that died before committing left in the
+ * WAL index.
+ *
+ * Parameters
+ * - wal: A Wal
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: The log was indexed for another page size
+ */
+int chidb_Wal_beginWrite(Wal *wal)
+{
+    int rc = chidb_Wal_refresh(wal);
+
+    if (rc == CHIDB_OK && wal->shm->header->index_frames > wal->max_frame)
+        chidb_Wal_indexTruncate(wal, wal->max_frame);
+
+    return rc;
+}
+
+
+/* Find the most recent version of a page in the log
+ *
+ * Parameters
+ * - wal: A Wal
+ * - npage: Page number
+ * - max_frame: Only frames up to this one are considered. Readers pass
+ *              the value of max_frame when they started reading (their
+ *              snapshot); the writer passes n_frames.
+ * - frame: Out parameter. Frame containing the page
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The page is not in the log (as of max_frame), and
+ *                    must be read from the database file
+ */
+int chidb_Wal_findFrame(Wal *wal, npage_t npage, uint32_t max_frame, uint32_t *frame)
+{
+    uint32_t s, f;
+
+retry:
+    for (s = max_frame > 0 ? (max_frame - 1) / WAL_INDEX_FRAMES + 1 : 0; s > 0; s--)
+    {
+        WalIndexSegment *seg = chidb_Shm_region(wal->shm, s - 1, sizeof(WalIndexSegment), false);
+        npage_t p;
+        uint32_t i;
+
+        if (seg == NULL)
+            return CHIDB_ENOTFOUND;
+
+        for (i = npage & (WAL_INDEX_SLOTS - 1); (p = __atomic_load_n(&seg->hash[i].npage, __ATOMIC_ACQUIRE)) != 0; i = (i + 1) & (WAL_INDEX_SLOTS - 1))
+            if (p == npage)
+                break;
+
+        f = p == 0 ? 0 : __atomic_load_n(&seg->hash[i].frame, __ATOMIC_ACQUIRE);
+        if (f == 0)
+            continue;
+
+        /* Frames past max_frame may be truncated and appended again
+         * while we follow them */
+        while (f > max_frame)
+        {
+            WalIndexSegment *fseg = chidb_Shm_region(wal->shm, (f - 1) / WAL_INDEX_FRAMES, sizeof(WalIndexSegment), false);
+            uint32_t prev;
+
+            if (fseg == NULL)
+                return CHIDB_ENOTFOUND;
+            prev = __atomic_load_n(&fseg->prev[(f - 1) % WAL_INDEX_FRAMES], __ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&fseg->npage[(f - 1) % WAL_INDEX_FRAMES], __ATOMIC_ACQUIRE) != npage)
+                goto retry;
+            f = prev;
+        }
+
+        if (f == 0)
+            return CHIDB_ENOTFOUND;
+
+        *frame = f;
+        return CHIDB_OK;
+    }
+
+    return CHIDB_ENOTFOUND;
+}
+
+
+/* Page stored in a frame (0 if the frame isn't in the WAL index) */
+npage_t chidb_Wal_framePage(Wal *wal, uint32_t frame)
+{
+    WalIndexSegment *seg = chidb_Shm_region(wal->shm, (frame - 1) / WAL_INDEX_FRAMES, sizeof(WalIndexSegment), false);
+
+    return seg == NULL ? 0 : seg->npage[(frame - 1) % WAL_INDEX_FRAMES];
+}
+
+
+/* Read the page stored in a frame
+ *
+ * Parameters
+ * - wal: A Wal
+ * - frame: Frame number (as returned by chidb_Wal_findFrame)
+ * - data: Buffer with space for one page
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Wal_readFrame(Wal *wal, uint32_t frame, uint8_t *data)
+{
+    off_t offset = chidb_Wal_frameOffset(wal, frame) + WAL_FRAME_HEADER_SIZE;
+    uint64_t start = chidb_time_ns();
+    ssize_t n;
+
+    do
+        n = pread(wal->fd, data, wal->page_size, offset);
+    while (n == -1 && errno == EINTR);
+
+    if (n != wal->page_size)
+        return CHIDB_EIO;
+
+    if (wal->stats != NULL)
+    {
+        chidb_histogram_add(&wal->stats->read_latency, chidb_time_ns() - start);
+        wal->stats->pages_read++;
+        wal->stats->bytes_read += n;
+    }
+
+    if (wal->trace != NULL && CHIDB_TRACING(wal->trace, CHIDB_TRACE_PAGE_READ))
+    {
+        chidb_trace_event ev = {.type = CHIDB_TRACE_PAGE_READ, .phase = CHIDB_TRACE_END,
+                                .npage = chidb_Wal_framePage(wal, frame), .bytes = n};
+        chidb_trace_emit(wal->trace, &ev, start);
+    }
+
+    chilog(TRACE, "Read page %i from WAL frame %i", chidb_Wal_framePage(wal, frame), frame);
+
+    return CHIDB_OK;
+}
+
+
+/* Start reading a frame in the background
+ *
+ * Asks the OS to read the page in a frame into its page cache, so a
+ * later chidb_Wal_readFrame doesn't have to wait for the device.
+ *
+ * Parameters
+ * - wal: A Wal
+ * - frame: Frame number (as returned by chidb_Wal_findFrame)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Wal_prefetchFrame(Wal *wal, uint32_t frame)
+{
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(wal->fd, chidb_Wal_frameOffset(wal, frame) + WAL_FRAME_HEADER_SIZE,
+                  wal->page_size, POSIX_FADV_WILLNEED);
+#endif
+
+    return CHIDB_OK;
+}
+
+
+/* Append a page to the log
+ *
+ * Parameters
+ * - wal: A Wal
+ * - npage: Page number
+ * - data: Contents of the page
+ * - commit: If non-zero, this frame commits the current transaction, and
+ *           commit is the size of the database (in pages) after the commit.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Wal_appendFrame(Wal *wal, npage_t npage, const uint8_t *data, npage_t commit)
+{
+    uint32_t frame = wal->n_frames + 1;
+    uint32_t cksum[2] = { wal->cksum[0], wal->cksum[1] };
+    int rc;
+
+    put4byte(wal->buf, npage);
+    put4byte(wal->buf + 4, commit);
+    put4byte(wal->buf + 8, wal->salt[0]);
+    put4byte(wal->buf + 12, wal->salt[1]);
+    memcpy(wal->buf + WAL_FRAME_HEADER_SIZE, data, wal->page_size);
+    chidb_Wal_checksum(wal->buf, 8, cksum);
+    chidb_Wal_checksum(wal->buf + WAL_FRAME_HEADER_SIZE, wal->page_size, cksum);
+    put4byte(wal->buf + 16, cksum[0]);
+    put4byte(wal->buf + 20, cksum[1]);
+
+    rc = chidb_Wal_pwrite(wal, wal->fd, wal->buf, WAL_FRAME_HEADER_SIZE + wal->page_size,
+                          chidb_Wal_frameOffset(wal, frame), npage);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    rc = chidb_Wal_indexAdd(wal, npage, frame);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    wal->n_frames = frame;
+    wal->cksum[0] = cksum[0];
+    wal->cksum[1] = cksum[1];
+
+    chilog(TRACE, "Appended page %i to WAL frame %i%s", npage, frame, commit ? " (commit)" : "");
+
+    if (commit != 0)
+    {
+        wal->max_frame = frame;
+        wal->db_size = commit;
+        wal->commit_cksum[0] = cksum[0];
+        wal->commit_cksum[1] = cksum[1];
+        chidb_Wal_publish(wal);
+
+        /* Not durable until chidb_Wal_sync */
+        wal->sync_seq = wal->ckpt_seq;
+        wal->sync_frame = frame;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Commit the frames appended since the last commit
+ *
+ * Normally, a transaction is committed by passing a non-zero commit value
+ * to chidb_Wal_appendFrame when appending its last page. This function
+ * is for when all the pages of the transaction have already been appended
+ * (or no pages have been modified at all).
+ *
+ * Parameters
+ * - wal: A Wal
+ * - db_size: Size of the database (in pages) after the commit
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Wal_commit(Wal *wal, npage_t db_size)
+{
+    uint8_t *data;
+    npage_t npage;
+    int rc;
+
+    if (wal->n_frames == wal->max_frame)
+        return CHIDB_OK;
+
+    /* There is no way to flag the last frame as a commit frame after the
+     * fact (its checksum covers the commit field), so we append its page
+     * again */
+    data = malloc(wal->page_size);
+    if (data == NULL)
+        return CHIDB_ENOMEM;
+
+    npage = chidb_Wal_framePage(wal, wal->n_frames);
+    rc = chidb_Wal_readFrame(wal, wal->n_frames, data);
+    if (rc == CHIDB_OK)
+        rc = chidb_Wal_appendFrame(wal, npage, data, db_size);
+    free(data);
+
+    return rc;
+}
+
+
+/* Discard the frames appended since the last commit
+ *
+ * They are removed from the WAL index, and the next frame is appended
+ * right after the last commit frame, over them. A rollback doesn't write
+ * anything: frames that are left past the end of the log after a crash
+ * are not part of the checksum chain, and are ignored by recovery.
+ *
+ * Parameters
+ * - wal: A Wal
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Wal_rollback(Wal *wal)
+{
+    chidb_Wal_indexTruncate(wal, wal->max_frame);
+    wal->n_frames = wal->max_frame;
+    wal->cksum[0] = wal->commit_cksum[0];
+    wal->cksum[1] = wal->commit_cksum[1];
+
+    chilog(TRACE, "Rolled back the WAL to frame %i", wal->max_frame);
+
+    return CHIDB_OK;
+}
+
+
+/* Make the commits of this pager durable
+ *
+ * Waits until the log is synced up to the last commit frame that this
+ * pager appended. Only one pager syncs at a time (the one that holds
+ * SHM_LOCK_SYNC), and it syncs the log up to the last commit of any
+ * pager, so the pagers that committed while it was syncing usually find
+ * their commits already durable when they get the lock, and don't sync
+ * at all. For that to happen, the caller must not hold SHM_LOCK_WRITE.
+ *
+ * Parameters
+ * - wal: A Wal
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Wal_sync(Wal *wal)
+{
+    ShmHeader *h = wal->shm->header;
+    uint64_t mine;
+    uint32_t seq, ckpt_seq, max_frame;
+    int rc;
+
+    if (wal->sync_frame == 0)
+        return CHIDB_OK;
+
+    mine = (uint64_t) wal->sync_seq << 32 | wal->sync_frame;
+    if (__atomic_load_n(&h->synced, __ATOMIC_ACQUIRE) < mine)
+    {
+        rc = chidb_Shm_lock(wal->shm, SHM_LOCK_SYNC, 1, F_WRLCK, true);
+        if (rc != CHIDB_OK)
+            return rc;
+
+        /* The pager that had the lock before us may have synced it */
+        if (__atomic_load_n(&h->synced, __ATOMIC_ACQUIRE) < mine)
+        {
+            do
+            {
+                seq = chidb_Shm_beginRead(wal->shm);
+                ckpt_seq = h->ckpt_seq;
+                max_frame = h->max_frame;
+            }
+            while (!chidb_Shm_endRead(wal->shm, seq));
+
+            rc = chidb_Wal_fdatasync(wal, wal->fd);
+            if (rc == CHIDB_OK)
+            {
+                chilog(TRACE, "Synced the WAL up to frame %i", max_frame);
+                chidb_Wal_markSynced(wal, ckpt_seq, max_frame);
+            }
+        }
+
+        chidb_Shm_lock(wal->shm, SHM_LOCK_SYNC, 1, F_UNLCK, false);
+        if (rc != CHIDB_OK)
+            return CHIDB_EIO;
+    }
+
+    wal->sync_frame = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Compares two hash entries by page number (for qsort) */
+static int chidb_Wal_cmpEntries(const void *a, const void *b)
+{
+    npage_t pa = ((const WalHashEntry *) a)->npage, pb = ((const WalHashEntry *) b)->npage;
+
+    return (pa > pb) - (pa < pb);
+}
+
+
+/* Copy the log into the database file
+ *
+ * Writes the most recent version of every page in the first max_frame
+ * frames of the log into the database file, skipping the pages that a
+ * previous checkpoint (by any pager) already copied. A checkpoint that
+ * stops short of the last commit (because a reader still needs the
+ * database file as it was at an older one) leaves the size of the file
+ * alone. If every committed frame was copied, there are no uncommitted
+ * frames in the log, and reset is true, the log is then reset, so new
+ * frames are appended from the beginning.
+ *
+ * Only one pager may checkpoint at a time (the one that holds
+ * SHM_LOCK_CKPT), and reset may only be true if it also holds
+ * SHM_LOCK_WRITE, and every SHM_LOCK_READ lock.
+ *
+ * Parameters
+ * - wal: A Wal
+ * - db_fd: File descriptor of the database file
+ * - max_frame: Last frame to copy (at most wal->max_frame)
+ * - reset: Whether the log may be reset
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Wal_checkpoint(Wal *wal, int db_fd, uint32_t max_frame, bool reset)
+{
+    ShmHeader *h = wal->shm->header;
+    uint32_t backfill = __atomic_load_n(&h->backfill, __ATOMIC_ACQUIRE);
+    WalHashEntry *pages;
+    uint32_t npages = 0;
+    struct stat st;
+    int rc = CHIDB_OK;
+
+    if (max_frame > wal->max_frame)
+        max_frame = wal->max_frame;
+
+    /* The log may only be reset if nobody committed anything that this
+     * pager hasn't seen */
+    reset = reset && max_frame == wal->max_frame && wal->n_frames == wal->max_frame
+            && wal->ckpt_seq == h->ckpt_seq && wal->max_frame == h->max_frame
+            && h->index_frames == h->max_frame;
+
+    if (max_frame <= backfill)
+    {
+        if (reset && max_frame > 0)
+            return chidb_Wal_reset(wal);
+        return CHIDB_OK;
+    }
+
+    /* The log must be durable before we start overwriting the database
+     * (including the commits of other pagers that are not synced yet) */
+    if (chidb_Wal_fdatasync(wal, wal->fd) != CHIDB_OK)
+        return CHIDB_EIO;
+    chidb_Wal_markSynced(wal, wal->ckpt_seq, wal->max_frame);
+
+    pages = malloc((max_frame - backfill) * sizeof(WalHashEntry));
+    if (pages == NULL)
+        return CHIDB_ENOMEM;
+
+    for (uint32_t f = backfill + 1; f <= max_frame; f++)
+    {
+        npage_t npage = chidb_Wal_framePage(wal, f);
+        uint32_t latest;
+
+        if (npage != 0 && chidb_Wal_findFrame(wal, npage, max_frame, &latest) == CHIDB_OK && latest == f)
+        {
+            pages[npages].npage = npage;
+            pages[npages].frame = f;
+            npages++;
+        }
+    }
+
+    /* Write the pages in file order */
+    qsort(pages, npages, sizeof(WalHashEntry), chidb_Wal_cmpEntries);
+
+    for (uint32_t i = 0; i < npages && rc == CHIDB_OK; i++)
+    {
+        rc = chidb_Wal_readFrame(wal, pages[i].frame, wal->buf);
+        if (rc == CHIDB_OK)
+            rc = chidb_Wal_pwrite(wal, db_fd, wal->buf, wal->page_size,
+                                  (off_t) (pages[i].npage - 1) * wal->page_size, pages[i].npage);
+    }
+    free(pages);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    /* Pages that were allocated but never written must still exist, and
+     * the database may also have been truncated */
+    if (max_frame == wal->max_frame && wal->max_frame == h->max_frame)
+    {
+        if (fstat(db_fd, &st) != 0)
+            return CHIDB_EIO;
+        if (st.st_size != (off_t) wal->db_size * wal->page_size
+            && ftruncate(db_fd, (off_t) wal->db_size * wal->page_size) != 0)
+            return CHIDB_EIO;
+    }
+
+    if (chidb_Wal_fdatasync(wal, db_fd) != CHIDB_OK)
+        return CHIDB_EIO;
+
+    chilog(TRACE, "Checkpointed %i pages from %i WAL frames", npages, max_frame);
+    __atomic_store_n(&h->backfill, max_frame, __ATOMIC_RELEASE);
+
+    if (reset)
+        return chidb_Wal_reset(wal);
+
+    return CHIDB_OK;
+}
+
+
+/* Starts a new, empty log */
+static int chidb_Wal_reset(Wal *wal)
+{
+    uint8_t header[WAL_HEADER_SIZE];
+    int rc;
+
+    wal->ckpt_seq++;
+    wal->salt[0]++;
+    wal->salt[1] = (uint32_t) time(NULL) ^ ((uint32_t) getpid() << 16);
+
+    put4byte(header, WAL_MAGIC);
+    put4byte(header + 4, WAL_VERSION);
+    put4byte(header + 8, wal->page_size);
+    put4byte(header + 12, wal->ckpt_seq);
+    put4byte(header + 16, wal->salt[0]);
+    put4byte(header + 20, wal->salt[1]);
+    wal->cksum[0] = wal->cksum[1] = 0;
+    chidb_Wal_checksum(header, 24, wal->cksum);
+    put4byte(header + 24, wal->cksum[0]);
+    put4byte(header + 28, wal->cksum[1]);
+
+    if (ftruncate(wal->fd, 0) != 0)
+        return CHIDB_EIO;
+    rc = chidb_Wal_pwrite(wal, wal->fd, header, WAL_HEADER_SIZE, 0, 0);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    wal->commit_cksum[0] = wal->cksum[0];
+    wal->commit_cksum[1] = wal->cksum[1];
+    wal->n_frames = wal->max_frame = 0;
+    __atomic_store_n(&wal->shm->header->backfill, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&wal->shm->header->index_frames, 0, __ATOMIC_RELEASE);
+    chidb_Wal_publish(wal);
+
+    return CHIDB_OK;
+}
+
+
+/* Reads the log header and all the valid frames in the log, and builds
+ * the WAL index. If the log is empty or its header is not valid, a new
+ * log is started. The caller holds SHM_LOCK_WRITE. */
+static int chidb_Wal_recover(Wal *wal)
+{
+    uint8_t header[WAL_HEADER_SIZE];
+    uint32_t cksum[2] = { 0, 0 };
+    ssize_t n;
+    int rc;
+
+    n = pread(wal->fd, header, WAL_HEADER_SIZE, 0);
+    if (n == -1)
+        return CHIDB_EIO;
+
+    chidb_Wal_checksum(header, 24, cksum);
+    if (n < WAL_HEADER_SIZE
+        || get4byte(header) != WAL_MAGIC
+        || get4byte(header + 4) != WAL_VERSION
+        || get4byte(header + 8) != wal->page_size
+        || get4byte(header + 24) != cksum[0]
+        || get4byte(header + 28) != cksum[1])
+        return chidb_Wal_reset(wal);
+
+    /* Nothing in the shared memory file is left from an earlier log */
+    __atomic_store_n(&wal->shm->header->index_frames, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&wal->shm->header->backfill, 0, __ATOMIC_RELEASE);
+    wal->db_size = 0;
+
+    wal->ckpt_seq = get4byte(header + 12);
+    wal->salt[0] = get4byte(header + 16);
+    wal->salt[1] = get4byte(header + 20);
+    wal->cksum[0] = wal->commit_cksum[0] = cksum[0];
+    wal->cksum[1] = wal->commit_cksum[1] = cksum[1];
+
+    for (uint32_t frame = 1; ; frame++)
+    {
+        uint8_t *data = wal->buf + WAL_FRAME_HEADER_SIZE;
+        npage_t npage, commit;
+
+        n = pread(wal->fd, wal->buf, WAL_FRAME_HEADER_SIZE + wal->page_size,
+                  chidb_Wal_frameOffset(wal, frame));
+        if (n != WAL_FRAME_HEADER_SIZE + wal->page_size)
+            break;
+
+        npage = get4byte(wal->buf);
+        commit = get4byte(wal->buf + 4);
+        chidb_Wal_checksum(wal->buf, 8, cksum);
+        chidb_Wal_checksum(data, wal->page_size, cksum);
+        if (npage == 0
+            || get4byte(wal->buf + 8) != wal->salt[0]
+            || get4byte(wal->buf + 12) != wal->salt[1]
+            || get4byte(wal->buf + 16) != cksum[0]
+            || get4byte(wal->buf + 20) != cksum[1])
+            break;
+
+        rc = chidb_Wal_indexAdd(wal, npage, frame);
+        if (rc != CHIDB_OK)
+            return rc;
+        wal->n_frames = frame;
+
+        if (commit != 0)
+        {
+            wal->max_frame = frame;
+            wal->db_size = commit;
+            wal->commit_cksum[0] = cksum[0];
+            wal->commit_cksum[1] = cksum[1];
+        }
+    }
+
+    /* Frames after the last commit belong to a transaction that never
+     * committed. New frames will overwrite them. */
+    chidb_Wal_indexTruncate(wal, wal->max_frame);
+    wal->n_frames = wal->max_frame;
+    wal->cksum[0] = wal->commit_cksum[0];
+    wal->cksum[1] = wal->commit_cksum[1];
+    chidb_Wal_publish(wal);
+
+    chilog(TRACE, "Recovered %i WAL frames (database size: %i pages)", wal->max_frame, wal->db_size);
+
+    return CHIDB_OK;
+}
+
+
+/* Adds a frame to the WAL index, adding a segment to the shared memory
+ * file if it is the first frame of one. The frame is only published in
+ * the hash table once its page and previous frame are set. */
+static int chidb_Wal_indexAdd(Wal *wal, npage_t npage, uint32_t frame)
+{
+    WalIndexSegment *seg = chidb_Shm_region(wal->shm, (frame - 1) / WAL_INDEX_FRAMES, sizeof(WalIndexSegment), true);
+    uint32_t slot = (frame - 1) % WAL_INDEX_FRAMES, prev, i;
+
+    if (seg == NULL)
+        return CHIDB_ENOMEM;
+
+    /* Whatever the hash table holds is from frames that were truncated,
+     * or from an earlier log */
+    if (slot == 0)
+        memset(seg->hash, 0, sizeof(seg->hash));
+
+    for (i = npage & (WAL_INDEX_SLOTS - 1); seg->hash[i].npage != 0; i = (i + 1) & (WAL_INDEX_SLOTS - 1))
+        if (seg->hash[i].npage == npage)
+            break;
+
+    if (chidb_Wal_findFrame(wal, npage, frame - 1, &prev) != CHIDB_OK)
+        prev = 0;
+
+    __atomic_store_n(&seg->npage[slot], npage, __ATOMIC_RELEASE);
+    __atomic_store_n(&seg->prev[slot], prev, __ATOMIC_RELEASE);
+    __atomic_store_n(&seg->hash[i].npage, npage, __ATOMIC_RELEASE);
+    __atomic_store_n(&seg->hash[i].frame, frame, __ATOMIC_RELEASE);
+    __atomic_store_n(&wal->shm->header->index_frames, frame, __ATOMIC_RELEASE);
+
+    return CHIDB_OK;
+}
+
+
+/* Removes all frames after max_frame from the WAL index. A page whose
+ * only frames in a segment are removed is left in the segment's hash
+ * table, pointing to frame 0, which chidb_Wal_findFrame treats as "not
+ * in this segment". */
+static void chidb_Wal_indexTruncate(Wal *wal, uint32_t max_frame)
+{
+    for (uint32_t f = wal->shm->header->index_frames; f > max_frame; f--)
+    {
+        WalIndexSegment *seg = chidb_Shm_region(wal->shm, (f - 1) / WAL_INDEX_FRAMES, sizeof(WalIndexSegment), false);
+        uint32_t slot = (f - 1) % WAL_INDEX_FRAMES, prev, i;
+        npage_t npage;
+
+        if (seg == NULL)
+            continue;
+
+        npage = seg->npage[slot];
+        prev = seg->prev[slot];
+        for (i = npage & (WAL_INDEX_SLOTS - 1); seg->hash[i].npage != 0; i = (i + 1) & (WAL_INDEX_SLOTS - 1))
+            if (seg->hash[i].npage == npage)
+                break;
+
+        /* Earlier segments have hash tables of their own */
+        if (seg->hash[i].npage == npage && seg->hash[i].frame == f)
+            __atomic_store_n(&seg->hash[i].frame, prev > f - 1 - slot ? prev : 0, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&wal->shm->header->index_frames, max_frame, __ATOMIC_RELEASE);
+}
+
+
+/* Copies the committed state of the log into the shared memory file,
+ * for the other pagers to see (see chidb_Wal_refresh) */
+static void chidb_Wal_publish(Wal *wal)
+{
+    ShmHeader *h = wal->shm->header;
+
+    chidb_Shm_beginChange(wal->shm);
+    h->wal_page_size = wal->page_size;
+    h->ckpt_seq = wal->ckpt_seq;
+    h->salt[0] = wal->salt[0];
+    h->salt[1] = wal->salt[1];
+    h->cksum[0] = wal->commit_cksum[0];
+    h->cksum[1] = wal->commit_cksum[1];
+    h->max_frame = wal->max_frame;
+    h->db_size = wal->db_size;
+    h->nchanges++;
+    chidb_Shm_endChange(wal->shm);
+}
+
+
+/* Records that the log with checkpoint sequence number ckpt_seq is
+ * durable up to frame, unless a later frame already is */
+static void chidb_Wal_markSynced(Wal *wal, uint32_t ckpt_seq, uint32_t frame)
+{
+    uint64_t *synced = &wal->shm->header->synced;
+    uint64_t old = __atomic_load_n(synced, __ATOMIC_ACQUIRE);
+    uint64_t new = (uint64_t) ckpt_seq << 32 | frame;
+
+    while (old < new && !__atomic_compare_exchange_n(synced, &old, new, false,
+                                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        ;
+}
+
+
+/* Updates a running checksum with n bytes of data (n must be a multiple
+ * of 8). Same algorithm as the SQLite WAL checksum. */
+static void chidb_Wal_checksum(const uint8_t *data, size_t n, uint32_t *cksum)
+{
+    uint32_t s1 = cksum[0], s2 = cksum[1];
+
+    for (size_t i = 0; i < n; i += 8)
+    {
+        s1 += get4byte(data + i) + s2;
+        s2 += get4byte(data + i + 4) + s1;
+    }
+
+    cksum[0] = s1;
+    cksum[1] = s2;
+}
+
+
+/* Returns the offset of a frame (starting at 1) in the log file */
+static off_t chidb_Wal_frameOffset(Wal *wal, uint32_t frame)
+{
+    return WAL_HEADER_SIZE + (off_t) (frame - 1) * (WAL_FRAME_HEADER_SIZE + wal->page_size);
+}
+
+
+/* Writes n bytes at offset, retrying on short writes. They hold page
+ * npage, or a header if it is 0. */
+static int chidb_Wal_pwrite(Wal *wal, int fd, const uint8_t *buf, size_t n, off_t offset, npage_t npage)
+{
+    size_t written = 0;
+    uint64_t start = chidb_time_ns();
+
+    while (written < n)
+    {
+        ssize_t count = pwrite(fd, buf + written, n - written, offset + written);
+
+        if (count == -1 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return CHIDB_EIO;
+        written += count;
+    }
+
+    if (wal->stats != NULL)
+    {
+        chidb_histogram_add(&wal->stats->write_latency, chidb_time_ns() - start);
+        if (n >= wal->page_size)
+            wal->stats->pages_written++;
+        wal->stats->bytes_written += n;
+    }
+
+    if (npage != 0 && wal->trace != NULL && CHIDB_TRACING(wal->trace, CHIDB_TRACE_PAGE_WRITE))
+    {
+        chidb_trace_event ev = {.type = CHIDB_TRACE_PAGE_WRITE, .phase = CHIDB_TRACE_END,
+                                .npage = npage, .bytes = n};
+        chidb_trace_emit(wal->trace, &ev, start);
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Syncs a file, counting it in the statistics */
+static int chidb_Wal_fdatasync(Wal *wal, int fd)
+{
+    uint64_t start = chidb_time_ns();
+
+    if (fdatasync(fd) != 0)
+        return CHIDB_EIO;
+
+    if (wal->stats != NULL)
+    {
+        chidb_histogram_add(&wal->stats->sync_latency, chidb_time_ns() - start);
+        wal->stats->syncs++;
+    }
+
+    if (wal->trace != NULL && CHIDB_TRACING(wal->trace, CHIDB_TRACE_FSYNC))
+    {
+        chidb_trace_event ev = {.type = CHIDB_TRACE_FSYNC, .phase = CHIDB_TRACE_END};
+        chidb_trace_emit(wal->trace, &ev, start);
+    }
+
+    return CHIDB_OK;
+}
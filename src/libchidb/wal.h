@@ -0,0 +1,119 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Write-ahead log header. See wal.c for more details.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WAL_H_
+#define WAL_H_
+
+#include "chidbInt.h"
+#include "shm.h"
+
+#define WAL_HEADER_SIZE (32)
+#define WAL_FRAME_HEADER_SIZE (24)
+#define WAL_MAGIC (0x43484957)     /* "CHIW" */
+#define WAL_VERSION (1)
+
+#define DEFAULT_WAL_AUTOCHECKPOINT (1000)
+
+/* Frames covered by each segment of the WAL index */
+#define WAL_INDEX_FRAMES (4096)
+#define WAL_INDEX_SLOTS (2 * WAL_INDEX_FRAMES)
+
+/* One entry per page in the hash table of a segment of the WAL index */
+typedef struct WalHashEntry
+{
+    npage_t npage;       /* 0 if the slot is empty */
+    uint32_t frame;      /* Most recent frame containing npage in the segment (0 for none) */
+} WalHashEntry;
+
+/* A segment of the WAL index, for WAL_INDEX_FRAMES consecutive frames.
+ * Segment i is region i of the shared memory file (see wal.c) */
+typedef struct WalIndexSegment
+{
+    npage_t npage[WAL_INDEX_FRAMES];      /* Page in each frame */
+    uint32_t prev[WAL_INDEX_FRAMES];      /* Previous frame with the same page (0 for none) */
+    WalHashEntry hash[WAL_INDEX_SLOTS];   /* Page -> most recent frame with it */
+} WalIndexSegment;
+
+struct Wal
+{
+    int fd;
+    char *filename;
+    uint32_t page_size;
+
+    /* What this pager knows of the log. The committed state is shared
+     * with the other pagers through the shared memory file (see
+     * chidb_Wal_refresh). */
+    uint32_t ckpt_seq;       /* Incremented every time the log is reset */
+    uint32_t salt[2];        /* Copied into every frame of the current log */
+    uint32_t cksum[2];       /* Running checksum up to the last frame */
+
+    uint32_t n_frames;       /* Frames in the log, including uncommitted ones */
+    uint32_t max_frame;      /* Last committed frame */
+    npage_t db_size;         /* Database size (in pages) as of max_frame */
+    uint32_t commit_cksum[2];/* Running checksum up to max_frame */
+
+    /* The WAL index, and the committed state of the log */
+    Shm *shm;
+
+    /* Group commit (see chidb_Wal_sync) */
+    uint32_t sync_seq;       /* ckpt_seq of the log that sync_frame is in */
+    uint32_t sync_frame;     /* Last commit frame that may not be durable yet (0 if none) */
+
+    uint8_t *buf;            /* Frame header + page */
+
+    chidb_stats *stats;      /* Where to count I/O (may be NULL) */
+    chidb_tracer *trace;     /* Where to report I/O (may be NULL) */
+};
+typedef struct Wal Wal;
+
+int chidb_Wal_open(Wal **wal, const char *dbfilename, uint32_t page_size, Shm *shm);
+int chidb_Wal_close(Wal *wal, bool remove_file);
+int chidb_Wal_refresh(Wal *wal);
+int chidb_Wal_beginWrite(Wal *wal);
+int chidb_Wal_findFrame(Wal *wal, npage_t npage, uint32_t max_frame, uint32_t *frame);
+npage_t chidb_Wal_framePage(Wal *wal, uint32_t frame);
+int chidb_Wal_readFrame(Wal *wal, uint32_t frame, uint8_t *data);
+int chidb_Wal_prefetchFrame(Wal *wal, uint32_t frame);
+int chidb_Wal_appendFrame(Wal *wal, npage_t npage, const uint8_t *data, npage_t commit);
+int chidb_Wal_commit(Wal *wal, npage_t db_size);
+int chidb_Wal_rollback(Wal *wal);
+int chidb_Wal_sync(Wal *wal);
+int chidb_Wal_checkpoint(Wal *wal, int db_fd, uint32_t max_frame, bool reset);
+
+#endif /*WAL_H_*/
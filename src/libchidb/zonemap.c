@@ -0,0 +1,524 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Zone maps
+ *
+ * A zone map of a column of a table splits the keys of the table into
+ * ranges, one per leaf when it is built, and keeps the smallest and
+ * largest integer value of the column in the rows of each range. A
+ * scan that only wants the rows where the column is in some interval
+ * (WHERE ts > 1000) can then skip every subtree of the table whose
+ * keys (which the separators above it bound, see chidb_dbm_cursor_t)
+ * only fall in ranges with no value in that interval, without reading
+ * any of its pages (see chidb_dbm_cursor_filter and
+ * chidb_dbm_scan_prune). That pays off when the column grows with the
+ * key, as timestamps of appended rows do.
+ *
+ * Zone maps are summaries, kept in memory with the B-Tree file, like
+ * the statistics of ANALYZE are with the database, and built by
+ * chidb_zonemap. Since the ranges are ranges of keys, and not pages,
+ * splits, merges and vacuums don't change them, and keeping a zone map
+ * up to date only takes widening a range when a row is inserted into
+ * it (by chidb_Btree_insertLatched or chidb_dbm_cursor_insert, which
+ * every insertion into a table goes through). Deleting rows doesn't
+ * narrow the ranges, which only makes them less precise. A bulk load
+ * (chidb_Btree_bulkLoad) drops the zone maps of its table instead.
+ *
+ * Other connections to the same file don't update these zone maps, so
+ * a zone map is only used while chidb_Pager_changes is the one it was
+ * last up to date with: the commits (and rollbacks) of this connection
+ * move it forward (see chidb_zonemap_refresh), and any other change to
+ * the file makes the zone map useless until it is built again.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <chidb/chidb.h>
+#include "zonemap.h"
+#include "dbm-cursor.h"
+#include "record.h"
+#include "catalog.h"
+
+/* What a record has in a column */
+#define ZONEMAP_NULL (0)
+#define ZONEMAP_INT (1)
+#define ZONEMAP_OTHER (2)
+
+
+/* Reads a column of a record */
+static int chidb_zonemap_value(DBRecordView *view, uint8_t column, int32_t *v)
+{
+    int8_t v8;
+    int16_t v16;
+
+    switch (chidb_DBRecordView_getType(view, column))
+    {
+    case SQL_NULL:
+    case SQL_NOTVALID:
+        return ZONEMAP_NULL;
+    case SQL_INTEGER_1BYTE:
+        chidb_DBRecordView_getInt8(view, column, &v8);
+        *v = v8;
+        return ZONEMAP_INT;
+    case SQL_INTEGER_2BYTE:
+        chidb_DBRecordView_getInt16(view, column, &v16);
+        *v = v16;
+        return ZONEMAP_INT;
+    case SQL_INTEGER_4BYTE:
+        chidb_DBRecordView_getInt32(view, column, v);
+        return ZONEMAP_INT;
+    default:
+        return ZONEMAP_OTHER;
+    }
+}
+
+/* Adds a value to a range. Ranges are only ever widened, with atomic
+ * operations, so that threads inserting at once don't lose values. */
+static void chidb_zonemap_widen(chidb_zonemap_range_t *r, int kind, int32_t v)
+{
+    int32_t old;
+
+    if (kind == ZONEMAP_OTHER)
+        __atomic_store_n(&r->other, 1, __ATOMIC_RELAXED);
+    if (kind != ZONEMAP_INT)
+        return;
+
+    old = __atomic_load_n(&r->min, __ATOMIC_RELAXED);
+    while (v < old && !__atomic_compare_exchange_n(&r->min, &old, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    old = __atomic_load_n(&r->max, __ATOMIC_RELAXED);
+    while (v > old && !__atomic_compare_exchange_n(&r->max, &old, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* First range that a key can be in */
+static uint32_t chidb_zonemap_find(chidb_zonemap_t *zm, chidb_key_t key)
+{
+    uint32_t lo = 0, hi = zm->nranges - 1;
+
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+
+        if (zm->ranges[mid].last < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* Adds a range that has no values yet to a zone map */
+static int chidb_zonemap_addRange(chidb_zonemap_t *zm, uint32_t *capacity)
+{
+    if (zm->nranges == *capacity)
+    {
+        uint32_t n = *capacity ? *capacity * 2 : 64;
+        chidb_zonemap_range_t *ranges = realloc(zm->ranges, n * sizeof(chidb_zonemap_range_t));
+
+        if (ranges == NULL)
+            return CHIDB_ENOMEM;
+        zm->ranges = ranges;
+        *capacity = n;
+    }
+
+    zm->ranges[zm->nranges].last = CHIDB_KEY_MAX;
+    zm->ranges[zm->nranges].min = INT32_MAX;
+    zm->ranges[zm->nranges].max = INT32_MIN;
+    zm->ranges[zm->nranges].other = 0;
+    zm->nranges++;
+
+    return CHIDB_OK;
+}
+
+/* Reads the rows of a table into the ranges of a new zone map, one per
+ * leaf */
+static int chidb_zonemap_scan(BTree *bt, chidb_zonemap_t *zm)
+{
+    chidb_dbm_cursor_t c;
+    DBRecordView view;
+    uint8_t *buf = NULL;
+    uint32_t bufsize = 0, capacity = 0;
+    npage_t leaf = 0;
+    chidb_key_t prev = 0;
+    int32_t v = 0;
+    int kind, rc;
+
+    if ((rc = chidb_zonemap_addRange(zm, &capacity)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_dbm_cursor_open(&c, CURSOR_READ, bt, zm->nroot)) != CHIDB_OK)
+        return rc;
+    if (c.index)
+    {
+        chidb_dbm_cursor_close(&c);
+        return CHIDB_EMISUSE;
+    }
+
+    for (rc = chidb_dbm_cursor_rewind(&c); rc == CHIDB_OK; rc = chidb_dbm_cursor_next(&c))
+    {
+        BTreeCell *cell = &c.cell;
+        uint8_t *data = cell->fields.tableLeaf.data;
+        npage_t npage = c.path[c.depth - 1].btn->page->npage;
+
+        /* The previous leaf's range ends at its last key */
+        if (leaf != 0 && npage != leaf)
+        {
+            if ((rc = chidb_zonemap_addRange(zm, &capacity)) != CHIDB_OK)
+                break;
+            zm->ranges[zm->nranges - 2].last = prev;
+        }
+        leaf = npage;
+        prev = cell->key;
+
+        if (cell->fields.tableLeaf.overflow_page != 0)
+        {
+            if (bufsize < cell->fields.tableLeaf.data_size)
+            {
+                uint8_t *b = realloc(buf, cell->fields.tableLeaf.data_size);
+                if (b == NULL)
+                {
+                    rc = CHIDB_ENOMEM;
+                    break;
+                }
+                buf = b;
+                bufsize = cell->fields.tableLeaf.data_size;
+            }
+            rc = chidb_Btree_readPayload(bt, cell, 0, cell->fields.tableLeaf.data_size, buf);
+            if (rc != CHIDB_OK)
+                break;
+            data = buf;
+        }
+
+        if (BTREE_RECORD_FORMAT(bt) == DBRECORD_FORMAT_V2)
+            rc = chidb_DBRecordView_initV2(&view, data);
+        else
+            rc = chidb_DBRecordView_init(&view, data);
+        if (rc != CHIDB_OK)
+            break;
+
+        kind = chidb_zonemap_value(&view, zm->column, &v);
+        chidb_zonemap_widen(&zm->ranges[zm->nranges - 1], kind, v);
+    }
+
+    chidb_dbm_cursor_close(&c);
+    free(buf);
+
+    return rc == CHIDB_DONE ? CHIDB_OK : rc;
+}
+
+
+/* Build the zone map of a column of a table
+ *
+ * Reads the whole table, and replaces the zone map of the column, if
+ * there was one. No other thread may use the B-Tree file meanwhile, and
+ * no other connection may write to the file (see chidb_zonemap, which
+ * takes the locks).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root page of the table
+ * - column: Column
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The B-Tree is an index
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_zonemap_build(BTree *bt, npage_t nroot, uint8_t column)
+{
+    chidb_zonemap_t *zm, **p;
+    int rc;
+
+    if ((zm = calloc(1, sizeof(chidb_zonemap_t))) == NULL)
+        return CHIDB_ENOMEM;
+    zm->nroot = nroot;
+    zm->column = column;
+    zm->nchanges = chidb_Pager_changes(bt->pager);
+
+    if ((rc = chidb_zonemap_scan(bt, zm)) != CHIDB_OK)
+    {
+        free(zm->ranges);
+        free(zm);
+        return rc;
+    }
+
+    for (p = &bt->zonemaps; *p != NULL; p = &(*p)->next)
+        if ((*p)->nroot == nroot && (*p)->column == column)
+        {
+            chidb_zonemap_t *old = *p;
+
+            *p = old->next;
+            free(old->ranges);
+            free(old);
+            break;
+        }
+    zm->next = bt->zonemaps;
+    bt->zonemaps = zm;
+
+    return CHIDB_OK;
+}
+
+
+/* Find the zone map of a column of a table
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root page of the table
+ * - column: Column
+ *
+ * Return
+ * - The zone map, or NULL if there is none, or if the file has changed
+ *   in ways it doesn't know about
+ */
+chidb_zonemap_t *chidb_zonemap_get(BTree *bt, npage_t nroot, uint8_t column)
+{
+    for (chidb_zonemap_t *zm = bt->zonemaps; zm != NULL; zm = zm->next)
+        if (zm->nroot == nroot && zm->column == column)
+            return zm->nchanges == chidb_Pager_changes(bt->pager) ? zm : NULL;
+
+    return NULL;
+}
+
+
+/* The interval of the values that compare as given with k
+ *
+ * Parameters
+ * - cmp: Comparison (Op_Eq, Op_Lt, Op_Le, Op_Gt or Op_Ge)
+ * - k: Value to compare with
+ * - min, max: Out parameters. The interval (min > max if it's empty).
+ *
+ * Return
+ * - false if cmp is not one of those comparisons (Op_Ne rules out a
+ *   single value, which zone maps can't tell apart from others)
+ */
+bool chidb_zonemap_interval(opcode_t cmp, int32_t k, int32_t *min, int32_t *max)
+{
+    *min = INT32_MIN;
+    *max = INT32_MAX;
+
+    switch (cmp)
+    {
+    case Op_Eq:
+        *min = *max = k;
+        return true;
+    case Op_Lt:
+        if (k == INT32_MIN)
+            *min = INT32_MAX;
+        else
+            *max = k - 1;
+        return true;
+    case Op_Le:
+        *max = k;
+        return true;
+    case Op_Gt:
+        if (k == INT32_MAX)
+            *max = INT32_MIN;
+        else
+            *min = k + 1;
+        return true;
+    case Op_Ge:
+        *min = k;
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+/* Whether the rows with keys from lo to hi can have a value in an
+ * interval
+ *
+ * Parameters
+ * - zm: Zone map
+ * - lo, hi: Keys (inclusive)
+ * - min, max: Interval (inclusive)
+ *
+ * Return
+ * - false if none of the ranges with those keys has values in the
+ *   interval (or values that aren't integers), true otherwise
+ */
+bool chidb_zonemap_match(chidb_zonemap_t *zm, chidb_key_t lo, chidb_key_t hi, int32_t min, int32_t max)
+{
+    if (min > max)
+        return false;
+
+    for (uint32_t i = chidb_zonemap_find(zm, lo); i < zm->nranges; i++)
+    {
+        chidb_zonemap_range_t *r = &zm->ranges[i];
+
+        if (__atomic_load_n(&r->other, __ATOMIC_RELAXED) ||
+            (__atomic_load_n(&r->min, __ATOMIC_RELAXED) <= max &&
+             __atomic_load_n(&r->max, __ATOMIC_RELAXED) >= min))
+            return true;
+        if (r->last >= hi)
+            break;
+    }
+
+    return false;
+}
+
+
+/* Add a row that is being inserted into a table to its zone maps
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root page of the table
+ * - cell: Table leaf cell of the row (with the whole record)
+ */
+void chidb_zonemap_insert(BTree *bt, npage_t nroot, BTreeCell *cell)
+{
+    DBRecordView view;
+    int32_t v = 0;
+    int kind, rc;
+
+    for (chidb_zonemap_t *zm = bt->zonemaps; zm != NULL; zm = zm->next)
+    {
+        if (zm->nroot != nroot)
+            continue;
+
+        if (BTREE_RECORD_FORMAT(bt) == DBRECORD_FORMAT_V2)
+            rc = chidb_DBRecordView_initV2(&view, cell->fields.tableLeaf.data);
+        else
+            rc = chidb_DBRecordView_init(&view, cell->fields.tableLeaf.data);
+
+        /* A record that can't be read can't be skipped either */
+        kind = rc == CHIDB_OK ? chidb_zonemap_value(&view, zm->column, &v) : ZONEMAP_OTHER;
+        chidb_zonemap_widen(&zm->ranges[chidb_zonemap_find(zm, cell->key)], kind, v);
+    }
+}
+
+
+/* Drop the zone maps of a table
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root page of the table
+ */
+void chidb_zonemap_drop(BTree *bt, npage_t nroot)
+{
+    chidb_zonemap_t **p = &bt->zonemaps;
+
+    while (*p != NULL)
+    {
+        chidb_zonemap_t *zm = *p;
+
+        if (zm->nroot == nroot)
+        {
+            *p = zm->next;
+            free(zm->ranges);
+            free(zm);
+        }
+        else
+            p = &zm->next;
+    }
+}
+
+
+/* Bring the zone maps up to date with a commit or rollback
+ *
+ * The zone maps that were up to date before this connection committed
+ * (or rolled back) a transaction have seen every change it made, so
+ * they still are afterwards. chidb_Btree_commit and
+ * chidb_Btree_rollback call this.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nchanges: chidb_Pager_changes right before the commit (or rollback)
+ */
+void chidb_zonemap_refresh(BTree *bt, uint32_t nchanges)
+{
+    uint32_t now = chidb_Pager_changes(bt->pager);
+
+    for (chidb_zonemap_t *zm = bt->zonemaps; zm != NULL; zm = zm->next)
+        if (zm->nchanges == nchanges)
+            zm->nchanges = now;
+}
+
+
+/* Free the zone maps of a B-Tree file
+ *
+ * Parameters
+ * - bt: B-Tree file
+ */
+void chidb_zonemap_free(BTree *bt)
+{
+    while (bt->zonemaps != NULL)
+    {
+        chidb_zonemap_t *zm = bt->zonemaps;
+
+        bt->zonemaps = zm->next;
+        free(zm->ranges);
+        free(zm);
+    }
+}
+
+
+int chidb_zonemap(chidb *db, const char *table, const char *column)
+{
+    chidb_catalog_table_t *t;
+    Pager *pager;
+    int col, rc;
+
+    if (db == NULL || db->bt == NULL)
+        return CHIDB_EMISUSE;
+
+    /* Same locks as chidb_import_table: no other connection may write
+     * while the table is read */
+    pager = db->bt->pager;
+    if ((rc = chidb_Pager_beginWrite(pager)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_Pager_beginRead(pager)) != CHIDB_OK)
+    {
+        chidb_Pager_endWrite(pager);
+        return rc;
+    }
+
+    if ((t = chidb_catalog_table(db, table)) == NULL)
+        rc = CHIDB_EINVALIDSQL;
+    else if ((col = chidb_catalog_column(t, column)) < 0)
+        rc = CHIDB_EINVALIDSQL;
+    else if (t->columnar || col > UINT8_MAX)
+        rc = CHIDB_EMISUSE;
+    else
+        rc = chidb_zonemap_build(db->bt, t->nroot, col);
+
+    chidb_Pager_endRead(pager);
+    chidb_Pager_endWrite(pager);
+
+    return rc;
+}
@@ -0,0 +1,78 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Zone maps -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef ZONEMAP_H_
+#define ZONEMAP_H_
+
+#include "chidbInt.h"
+#include "btree.h"
+#include "dbm-types.h"
+
+/* A range of keys of a table, and the smallest and largest integer
+ * values of a column in its rows (min > max if there are none) */
+typedef struct chidb_zonemap_range
+{
+    chidb_key_t last;     /* Largest key of the range (it starts after the previous one's) */
+    int32_t min;
+    int32_t max;
+    uint8_t other;        /* The range has values other than integers and NULLs */
+} chidb_zonemap_range_t;
+
+/* Zone map of a column of a table (see zonemap.c) */
+typedef struct chidb_zonemap
+{
+    npage_t nroot;
+    uint8_t column;
+    uint32_t nchanges;    /* chidb_Pager_changes it is up to date with */
+    chidb_zonemap_range_t *ranges;
+    uint32_t nranges;     /* At least one, and the last one ends at CHIDB_KEY_MAX */
+    struct chidb_zonemap *next;
+} chidb_zonemap_t;
+
+int chidb_zonemap_build(BTree *bt, npage_t nroot, uint8_t column);
+chidb_zonemap_t *chidb_zonemap_get(BTree *bt, npage_t nroot, uint8_t column);
+bool chidb_zonemap_interval(opcode_t cmp, int32_t k, int32_t *min, int32_t *max);
+bool chidb_zonemap_match(chidb_zonemap_t *zm, chidb_key_t lo, chidb_key_t hi, int32_t min, int32_t max);
+void chidb_zonemap_insert(BTree *bt, npage_t nroot, BTreeCell *cell);
+void chidb_zonemap_drop(BTree *bt, npage_t nroot);
+void chidb_zonemap_refresh(BTree *bt, uint32_t nchanges);
+void chidb_zonemap_free(BTree *bt);
+
+#endif /* ZONEMAP_H_ */
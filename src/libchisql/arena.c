@@ -0,0 +1,131 @@
+#include <chisql/chisql.h>
+
+#define ARENA_BLOCK_SIZE (4096)
+
+/* Every allocation starts with a header that says whether it was made
+ * outside of an arena (and must be freed by chisql_free) */
+typedef union chisql_alloc_header
+{
+    long double ld;
+    long long ll;
+    void *p;
+    int heap;
+} chisql_alloc_header_t;
+
+typedef struct chisql_arena_block
+{
+    struct chisql_arena_block *next;
+    size_t size;
+    size_t used;
+    chisql_alloc_header_t data[];
+} chisql_arena_block_t;
+
+struct chisql_arena
+{
+    chisql_arena_block_t *blocks;
+};
+
+static __thread chisql_arena_t *current_arena = NULL;
+
+
+chisql_arena_t *chisql_arena_new(void)
+{
+    return (chisql_arena_t *)calloc(1, sizeof(chisql_arena_t));
+}
+
+void chisql_arena_destroy(chisql_arena_t *arena)
+{
+    chisql_arena_block_t *block, *next;
+
+    if (arena == NULL)
+        return;
+
+    for (block = arena->blocks; block != NULL; block = next)
+    {
+        next = block->next;
+        free(block);
+    }
+    free(arena);
+}
+
+/* Makes arena the one chisql_alloc uses in this thread (NULL to use
+ * the heap), and returns the one it used before */
+chisql_arena_t *chisql_arena_use(chisql_arena_t *arena)
+{
+    chisql_arena_t *prev = current_arena;
+
+    current_arena = arena;
+    return prev;
+}
+
+static void *arena_alloc(chisql_arena_t *arena, size_t size)
+{
+    chisql_arena_block_t *block = arena->blocks;
+    size_t align = sizeof(chisql_alloc_header_t);
+    void *p;
+
+    size = (size + align - 1) / align * align;
+    if (block == NULL || block->size - block->used < size)
+    {
+        size_t bsize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+
+        /* Not zeroed: allocations are zeroed when they are handed out */
+        block = (chisql_arena_block_t *)malloc(sizeof(chisql_arena_block_t) + bsize);
+        if (block == NULL)
+            return NULL;
+        block->size = bsize;
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    p = (char *)block->data + block->used;
+    block->used += size;
+    return memset(p, 0, size);
+}
+
+/* Returns zeroed memory from the arena in use, or from the heap if
+ * there is none */
+void *chisql_alloc(size_t size)
+{
+    chisql_alloc_header_t *h;
+
+    if (current_arena != NULL)
+        h = (chisql_alloc_header_t *)arena_alloc(current_arena, sizeof(*h) + size);
+    else
+    {
+        h = (chisql_alloc_header_t *)calloc(1, sizeof(*h) + size);
+        if (h != NULL)
+            h->heap = 1;
+    }
+
+    return h == NULL ? NULL : h + 1;
+}
+
+char *chisql_strndup(const char *s, size_t n)
+{
+    size_t len = strnlen(s, n);
+    char *d = (char *)chisql_alloc(len + 1);
+
+    if (d != NULL)
+        memcpy(d, s, len);
+    return d;
+}
+
+char *chisql_strdup(const char *s)
+{
+    return chisql_strndup(s, strlen(s));
+}
+
+/* Memory in an arena is only freed with the arena */
+void chisql_free(void *p)
+{
+    chisql_alloc_header_t *h;
+
+    if (p == NULL)
+        return;
+
+    h = (chisql_alloc_header_t *)p - 1;
+    if (h->heap)
+        free(h);
+}
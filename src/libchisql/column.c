@@ -1,31 +1,33 @@
 #include <chisql/chisql.h>
 
-static ssize_t size_constraint = -1;
+/* Size of the column being parsed, set by the parser before it makes the
+ * column. Per thread, since statements are parsed in several at once. */
+static __thread ssize_t size_constraint = -1;
 
 Constraint_t *NotNull(void)
 {
-    Constraint_t *con = (Constraint_t *)calloc(1, sizeof(Constraint_t));
+    Constraint_t *con = (Constraint_t *)chisql_alloc(sizeof(Constraint_t));
     con->t = CONS_NOT_NULL;
     return con;
 }
 
 Constraint_t *AutoIncrement(void)
 {
-    Constraint_t *con = (Constraint_t *)calloc(1, sizeof(Constraint_t));
+    Constraint_t *con = (Constraint_t *)chisql_alloc(sizeof(Constraint_t));
     con->t = CONS_AUTO_INCREMENT;
     return con;
 }
 
 Constraint_t *PrimaryKey(void)
 {
-    Constraint_t *con = (Constraint_t *)calloc(1, sizeof(Constraint_t));
+    Constraint_t *con = (Constraint_t *)chisql_alloc(sizeof(Constraint_t));
     con->t = CONS_PRIMARY_KEY;
     return con;
 }
 
 Constraint_t *ForeignKey(ForeignKeyRef_t fkr)
 {
-    Constraint_t *con = (Constraint_t *)calloc(1, sizeof(Constraint_t));
+    Constraint_t *con = (Constraint_t *)chisql_alloc(sizeof(Constraint_t));
     con->t = CONS_FOREIGN_KEY;
     con->constraint.ref = fkr;
     return con;
@@ -33,7 +35,7 @@ Constraint_t *ForeignKey(ForeignKeyRef_t fkr)
 
 Constraint_t *Default(Literal_t *val)
 {
-    Constraint_t *con = (Constraint_t *)calloc(1, sizeof(Constraint_t));
+    Constraint_t *con = (Constraint_t *)chisql_alloc(sizeof(Constraint_t));
     con->t = CONS_DEFAULT;
     con->constraint.default_val = val;
     return con;
@@ -41,14 +43,14 @@ Constraint_t *Default(Literal_t *val)
 
 Constraint_t *Unique(void)
 {
-    Constraint_t *con = (Constraint_t *)calloc(1, sizeof(Constraint_t));
+    Constraint_t *con = (Constraint_t *)chisql_alloc(sizeof(Constraint_t));
     con->t = CONS_UNIQUE;
     return con;
 }
 
 Constraint_t *Check(Condition_t *cond)
 {
-    Constraint_t *con = (Constraint_t *)calloc(1, sizeof(Constraint_t));
+    Constraint_t *con = (Constraint_t *)chisql_alloc(sizeof(Constraint_t));
     con->t = CONS_CHECK;
     con->constraint.check = cond;
     return con;
@@ -56,7 +58,7 @@ Constraint_t *Check(Condition_t *cond)
 
 Constraint_t *ColumnSize(unsigned size)
 {
-    Constraint_t *con = (Constraint_t *)calloc(1, sizeof(Constraint_t));
+    Constraint_t *con = (Constraint_t *)chisql_alloc(sizeof(Constraint_t));
     con->t = CONS_SIZE;
     con->constraint.size = size;
     return con;
@@ -87,9 +89,9 @@ void Column_freeList(Column_t *column)
     if (column)
     {
         Column_t *next = column->next;
-        free(column->name);
+        chisql_free(column->name);
         deleteConstraint_ts(column->constraints);
-        free(column);
+        chisql_free(column);
         Column_freeList(next);
     }
 }
@@ -113,6 +115,8 @@ size_t Column_getSize(Column_t *col)
         return sizeof(int);
     case TYPE_TEXT:
         return 250; /* default text length */
+    case TYPE_PARAM:
+        return 0; /* not a column type */
     }
 
     return 0;
@@ -170,14 +174,14 @@ ForeignKeyRef_t ForeignKeyRef_make(const char *foreign_tname,
 
 Column_t *Column(const char *name, enum data_type type, Constraint_t *constraints)
 {
-    Column_t *new_column = (Column_t *)calloc(1, sizeof(Column_t));
-    new_column->name = strdup(name);
+    Column_t *new_column = (Column_t *)chisql_alloc(sizeof(Column_t));
+    new_column->name = chisql_strdup(name);
     new_column->type = type;
     new_column->constraints = constraints;
     /* if the parser found a size constraint, then size_constraitn will be > 0 */
     if (size_constraint > 0)
     {
-        Constraint_append(new_column->constraints, ColumnSize(size_constraint));
+        new_column->constraints = Constraint_append(new_column->constraints, ColumnSize(size_constraint));
         size_constraint = -1;
     }
     return new_column;
@@ -254,9 +258,9 @@ Column_t *Column_append(Column_t *col1, Column_t *col2)
 
 ColumnReference_t *ColumnReference_make(const char *tname, const char *cname)
 {
-    ColumnReference_t *ref = (ColumnReference_t *)calloc(1, sizeof(ColumnReference_t));
-    if (tname) ref->tableName = strdup(tname);
-    if (cname) ref->columnName = strdup(cname);
+    ColumnReference_t *ref = (ColumnReference_t *)chisql_alloc(sizeof(ColumnReference_t));
+    if (tname) ref->tableName = chisql_strdup(tname);
+    if (cname) ref->columnName = chisql_strdup(cname);
     return ref;
 }
 
@@ -267,9 +271,9 @@ int Column_compareByName(const void *c1, const void *c2)
 
 void *Column_copy(void *col)
 {
-    Column_t *copy = (Column_t *)malloc(sizeof(Column_t));
+    Column_t *copy = (Column_t *)chisql_alloc(sizeof(Column_t));
     memcpy(copy, col, sizeof(Column_t));
-    copy->name = strdup(((Column_t *)col)->name);
+    copy->name = chisql_strdup(((Column_t *)col)->name);
     copy->next = NULL; /* just in case */
     return copy;
 }
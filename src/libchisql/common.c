@@ -16,40 +16,31 @@ char *typeToString(enum data_type type, char *buf)
     case TYPE_TEXT:
         sprintf(buf, "text");
         break;
+    case TYPE_PARAM:
+        sprintf(buf, "param");
+        break;
     }
     return buf;
 }
 
-StrList_t *StrList_makeWithNext(const char *str, StrList_t *next)
-{
-    StrList_t *list = (StrList_t *)calloc(1, sizeof(StrList_t));
-    list->str = strdup(str);
-    list->next = next;
-    return list;
-}
-
 void StrList_print(StrList_t *list)
 {
-    int first = 1;
+    unsigned int i;
     printf("[");
-    while (list)
+    for (i = 0; i < StrList_size(list); ++i)
     {
-        if (first) first=0;
-        else printf(", ");
-        printf("%s", list->str);
-        list = list->next;
+        if (i > 0) printf(", ");
+        printf("%s", StrList_get(list, i));
     }
     printf("]");
 }
 
 void StrList_free(StrList_t *list)
 {
-    while (list)
-    {
-        StrList_t *next = list->next;
-        free(list);
-        list = next;
-    }
+    unsigned int i;
+    for (i = 0; i < StrList_size(list); ++i)
+        chisql_free(StrList_get(list, i));
+    Vector_free(list);
 }
 
 int ind = 0;
@@ -90,23 +81,14 @@ void indent_print(const char *format,...)
     fflush(stdout);
 }
 
-static StrList_t *StrList_app(StrList_t *list1, StrList_t *list2)
-{
-    list1->next = list2;
-    return list1;
-}
-
 StrList_t *StrList_append(StrList_t *list1, StrList_t *list2)
 {
-    if (!list1) return list2;
-    return StrList_app(list1, StrList_append(list1->next, list2));
+    return Vector_concat(list1, list2);
 }
 
 StrList_t *StrList_make(char *str)
 {
-    StrList_t *list = (StrList_t *)calloc(1, sizeof(StrList_t));
-    list->str = str;
-    return list;
+    return Vector_push(NULL, str);
 }
 
 
@@ -136,14 +118,14 @@ void Query_free(Query_t *query)
 #ifdef COMMON_TEST
 int main(int argc, char const *argv[])
 {
-    StrList_t *list = StrList_makeWithNext("hello", NULL);
+    StrList_t *list = StrList_make(chisql_strdup("hello"));
     const char *strs[] = {"hi", "how", "are", "you"};
     int i;
     for (i=0; i<sizeof(strs)/sizeof(char *); ++i)
     {
         printf("going to add %s\n", strs[i]);
         fflush(stdout);
-        StrList_append(list, StrList_makeWithNext(strs[i], NULL));
+        StrList_append(list, StrList_make(chisql_strdup(strs[i])));
         StrList_print(list);
     }
     return 0;
@@ -1,3 +1,4 @@
+#include <strings.h>
 #include <chisql/chisql.h>
 
 static Table_t *Table_addPrimaryKey(Table_t *table, const char *col_name);
@@ -26,15 +27,17 @@ Table_t *Table_addForeignKey(Table_t *table, ForeignKeyRef_t fkr)
 Table_t *Table_addKeyDecs(Table_t *table, KeyDec_t *decs)
 {
     StrList_t *slist;
+    unsigned int i;
     for (; decs; decs = decs->next)
     {
         switch (decs->t)
         {
         case KEY_DEC_PRIMARY:
-            for (slist = decs->dec.primary_keys; slist; slist = slist->next)
+            slist = decs->dec.primary_keys;
+            for (i = 0; i < StrList_size(slist); i++)
             {
-                if (!Table_addPrimaryKey(table, slist->str))
-                    fprintf(stderr, "Error: column '%s' not found\n", slist->str);
+                if (!Table_addPrimaryKey(table, StrList_get(slist, i)))
+                    fprintf(stderr, "Error: column '%s' not found\n", StrList_get(slist, i));
             }
             break;
         case KEY_DEC_FOREIGN:
@@ -50,14 +53,14 @@ Table_t *Table_addKeyDecs(Table_t *table, KeyDec_t *decs)
 
 KeyDec_t *ForeignKeyDec(ForeignKeyRef_t fkr)
 {
-    KeyDec_t *kdec = (KeyDec_t *)calloc(1, sizeof(KeyDec_t));
+    KeyDec_t *kdec = (KeyDec_t *)chisql_alloc(sizeof(KeyDec_t));
     kdec->t = KEY_DEC_FOREIGN;
     kdec->dec.fkey = fkr;
     return kdec;
 }
 KeyDec_t *PrimaryKeyDec(StrList_t *col_names)
 {
-    KeyDec_t *kdec = (KeyDec_t *)calloc(1, sizeof(KeyDec_t));
+    KeyDec_t *kdec = (KeyDec_t *)chisql_alloc(sizeof(KeyDec_t));
     kdec->t = KEY_DEC_PRIMARY;
     kdec->dec.primary_keys = col_names;
     return kdec;
@@ -65,13 +68,27 @@ KeyDec_t *PrimaryKeyDec(StrList_t *col_names)
 
 Table_t *Table_make(char *name, Column_t *columns, KeyDec_t *decs)
 {
-    Table_t *new_table = (Table_t *)calloc(1, sizeof(Table_t));
+    Table_t *new_table = (Table_t *)chisql_alloc(sizeof(Table_t));
     new_table->name = name;
     new_table->columns = columns;
+    new_table->storage = STORAGE_ROW;
     Column_getOffsets(columns);
     return Table_addKeyDecs(new_table, decs);
 }
 
+/* Sets the storage of a table from WITH (storage = ...). Returns NULL
+ * if it isn't "row" or "columnar". */
+Table_t *Table_setStorage(Table_t *table, const char *storage)
+{
+    if (!strcasecmp(storage, "row"))
+        table->storage = STORAGE_ROW;
+    else if (!strcasecmp(storage, "columnar"))
+        table->storage = STORAGE_COLUMNAR;
+    else
+        return NULL;
+    return table;
+}
+
 static Table_t *Table_addPrimaryKey(Table_t *table, const char *col_name)
 {
     Column_t *col = table->columns;
@@ -90,8 +107,8 @@ void Table_free(void *table_vptr)
 {
     Table_t *table = (Table_t *)table_vptr;
     Column_freeList(table->columns);
-    free(table->name);
-    free(table);
+    chisql_free(table->name);
+    chisql_free(table);
 }
 
 void TableReference_free(TableReference_t *tref)
@@ -101,11 +118,11 @@ void TableReference_free(TableReference_t *tref)
         fprintf(stderr, "Warning: TableReference_free called on null pointer\n");
         return;
     }
-    free(tref->table_name);
+    chisql_free(tref->table_name);
     /* alias is optional */
     if (tref->alias)
-        free(tref->alias);
-    free(tref);
+        chisql_free(tref->alias);
+    chisql_free(tref);
 }
 
 void Table_print(Table_t *table)
@@ -122,7 +139,9 @@ void Table_print(Table_t *table)
         Constraint_printList(col->constraints);
         if (++count == 10) break;
     }
-    printf("\n)\n");
+    printf("\n)");
+    if (table->storage == STORAGE_COLUMNAR) printf(" with storage = columnar");
+    puts("");
 }
 
 KeyDec_t *KeyDec_append(KeyDec_t *decs, KeyDec_t *dec)
@@ -133,7 +152,7 @@ KeyDec_t *KeyDec_append(KeyDec_t *decs, KeyDec_t *dec)
 
 TableReference_t *TableReference_make(char *table_name, char *alias)
 {
-    TableReference_t *ref = (TableReference_t *)calloc(1, sizeof(TableReference_t));
+    TableReference_t *ref = (TableReference_t *)chisql_alloc(sizeof(TableReference_t));
     ref->table_name = table_name;
     ref->alias = alias;
     return ref;
@@ -141,7 +160,7 @@ TableReference_t *TableReference_make(char *table_name, char *alias)
 
 Index_t *Index_make(char *name, char *table_name, char *column_name)
 {
-    Index_t *idx = (Index_t *)calloc(1, sizeof(Index_t));
+    Index_t *idx = (Index_t *)chisql_alloc(sizeof(Index_t));
     idx->name = name;
     idx->table_name = table_name;
     idx->column_name = column_name;
@@ -154,26 +173,50 @@ Index_t *Index_makeUnique(Index_t *idx)
     return idx;
 }
 
+Index_t *Index_addInclude(Index_t *idx, StrList_t *columns)
+{
+    idx->include = columns;
+    return idx;
+}
+
+Index_t *Index_setMethod(Index_t *idx, const char *method)
+{
+    if (!strcasecmp(method, "btree"))
+        idx->method = INDEX_BTREE;
+    else if (!strcasecmp(method, "hash"))
+        idx->method = INDEX_HASH;
+    else
+        return NULL;
+    return idx;
+}
+
 void Index_print(Index_t *idx)
 {
     printf("Index '%s' on %s (%s)", idx->column_name,
            idx->table_name,
            idx->column_name);
+    if (idx->include)
+    {
+        printf(" include ");
+        StrList_print(idx->include);
+    }
+    if (idx->method == INDEX_HASH) printf(" using hash");
     if (idx->unique) printf(", unique");
     puts("");
 }
 
 void Index_free(Index_t *idx)
 {
-    free(idx->name);
-    free(idx->column_name);
-    free(idx->table_name);
-    free(idx);
+    chisql_free(idx->name);
+    chisql_free(idx->column_name);
+    chisql_free(idx->table_name);
+    if (idx->include) StrList_free(idx->include);
+    chisql_free(idx);
 }
 
 Create_t *Create_fromTable(Table_t *table)
 {
-    Create_t *c = (Create_t *)calloc(1, sizeof(Create_t));
+    Create_t *c = (Create_t *)chisql_alloc(sizeof(Create_t));
     c->t = CREATE_TABLE;
     c->table = table;
     return c;
@@ -181,7 +224,7 @@ Create_t *Create_fromTable(Table_t *table)
 
 Create_t *Create_fromIndex(Index_t *idx)
 {
-    Create_t *c = (Create_t *)calloc(1, sizeof(Create_t));
+    Create_t *c = (Create_t *)chisql_alloc(sizeof(Create_t));
     c->t = CREATE_INDEX;
     c->index = idx;
     return c;
@@ -202,5 +245,5 @@ void Create_free(Create_t *cre)
         Table_free(cre->table);
     else
         Index_free(cre->index);
-    free(cre);
+    chisql_free(cre);
 }
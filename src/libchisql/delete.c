@@ -2,8 +2,8 @@
 
 Delete_t *Delete_make(const char *table_name, Condition_t *where)
 {
-    Delete_t *new_free = (Delete_t *)calloc(1, sizeof(Delete_t));
-    new_free->table_name = strdup(table_name);
+    Delete_t *new_free = (Delete_t *)chisql_alloc(sizeof(Delete_t));
+    new_free->table_name = chisql_strdup(table_name);
     new_free->where = where;
     return new_free;
 }
@@ -11,8 +11,8 @@ Delete_t *Delete_make(const char *table_name, Condition_t *where)
 void deleteDelete(Delete_t *del)
 {
     Condition_free(del->where);
-    free(del->table_name);
-    free(del);
+    chisql_free(del->table_name);
+    chisql_free(del);
 }
 
 void Delete_print(Delete_t *del)
@@ -29,8 +29,8 @@ void Delete_free(Delete_t *del)
         fprintf(stderr, "Warning: Delete_free called on null pointer\n");
         return;
     }
-    free(del->table_name);
+    chisql_free(del->table_name);
     if (del->where)
         Condition_free(del->where);
-    free(del);
+    chisql_free(del);
 }
@@ -1,37 +1,44 @@
 #include <chisql/chisql.h>
 
 
-Insert_t *Insert_make(const char *table_name, StrList_t *opt_col_names, Literal_t *values)
+static unsigned int Literal_count(Literal_t *values)
 {
-    Insert_t *new_insert = (Insert_t *)calloc(1, sizeof(Insert_t));
-    new_insert->table_name = strdup(table_name);
+    unsigned int n = 0;
+    for (; values; values = values->next)
+        n++;
+    return n;
+}
+
+Insert_t *Insert_make(const char *table_name, StrList_t *opt_col_names, Vector_t *rows)
+{
+    Insert_t *new_insert = (Insert_t *)chisql_alloc(sizeof(Insert_t));
+    unsigned int i, ncols;
+    new_insert->table_name = chisql_strdup(table_name);
     new_insert->col_names = opt_col_names;
-    new_insert->values = values;
-    if (!values)
+    new_insert->rows = rows;
+    if (!Vector_size(rows))
+    {
         fprintf(stderr, "Warning: no values given to insert\n");
+        return new_insert;
+    }
 
-    /* if there are any column names specified, ensure equal cardinality */
-    if (opt_col_names)
+    /* every row must have as many values as there are column names
+     * (or, if none are specified, as the first row) */
+    ncols = opt_col_names ? StrList_size(opt_col_names) : Literal_count(Vector_get(rows, 0));
+    for (i = 0; i < Vector_size(rows); ++i)
     {
-        while(true)
+        unsigned int nvalues = Literal_count(Vector_get(rows, i));
+        if (ncols > nvalues)
         {
-            if (opt_col_names && !values)
-            {
-                fprintf(stderr, "Error: more column names specified than values\n");
-                return NULL;
-            }
-            else if (!opt_col_names && values)
-            {
-                fprintf(stderr, "Error: more values specified than column names\n");
-                return NULL;
-            }
-            else if (!opt_col_names && !values)
-            {
-                /* then both are the same cardinality, OK */
-                break;
-            }
-            opt_col_names = opt_col_names->next;
-            values = values->next;
+            fprintf(stderr, "Error: more %s specified than values in row %u\n",
+                    opt_col_names ? "column names" : "values in row 1", i + 1);
+            return NULL;
+        }
+        else if (ncols < nvalues)
+        {
+            fprintf(stderr, "Error: more values in row %u specified than %s\n",
+                    i + 1, opt_col_names ? "column names" : "values in row 1");
+            return NULL;
         }
     }
     return new_insert;
@@ -39,30 +46,16 @@ Insert_t *Insert_make(const char *table_name, StrList_t *opt_col_names, Literal_
 
 void Insert_print(Insert_t *insert)
 {
-    Literal_t *val = insert->values;
-    int first = 1;
+    Literal_t *val;
+    unsigned int i;
+    int first;
     printf("Insert ");
-    printf("[");
-    while (val)
+    for (i = 0; i < Vector_size(insert->rows); ++i)
     {
-        if (first)
-        {
-            first = 0;
-        }
-        else
-        {
-            printf(", ");
-        }
-        Literal_print(val);
-        val = val->next;
-    }
-    printf("] into %s", insert->table_name);
-    if (insert->col_names)
-    {
-        StrList_t *list = insert->col_names;
+        if (i > 0) printf(", ");
+        printf("[");
         first = 1;
-        printf(" using columns [");
-        while (list)
+        for (val = Vector_get(insert->rows, i); val; val = val->next)
         {
             if (first)
             {
@@ -72,11 +65,16 @@ void Insert_print(Insert_t *insert)
             {
                 printf(", ");
             }
-            printf("%s", list->str);
-            list = list->next;
+            Literal_print(val);
         }
         printf("]");
     }
+    printf(" into %s", insert->table_name);
+    if (insert->col_names)
+    {
+        printf(" using columns ");
+        StrList_print(insert->col_names);
+    }
     puts("");
 }
 
@@ -88,8 +86,10 @@ void Insert_free(Insert_t *insert)
         fprintf(stderr, "Warning: Insert_free called on null pointer\n");
         return;
     }
-    free(insert->table_name);
+    chisql_free(insert->table_name);
     StrList_free(insert->col_names);
-    Literal_free(insert->values);
-    free(insert);
+    for (unsigned int i = 0; i < Vector_size(insert->rows); ++i)
+        Literal_freeList(Vector_get(insert->rows, i));
+    Vector_free(insert->rows);
+    chisql_free(insert);
 }
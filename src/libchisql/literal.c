@@ -3,7 +3,7 @@
 
 Literal_t *litInt(int i)
 {
-    Literal_t *lval = (Literal_t *)calloc(1, sizeof(Literal_t));
+    Literal_t *lval = (Literal_t *)chisql_alloc(sizeof(Literal_t));
     lval->t = TYPE_INT;
     lval->val.ival = i;
     return lval;
@@ -11,7 +11,7 @@ Literal_t *litInt(int i)
 
 Literal_t *litDouble(double d)
 {
-    Literal_t *lval = (Literal_t *)calloc(1, sizeof(Literal_t));
+    Literal_t *lval = (Literal_t *)chisql_alloc(sizeof(Literal_t));
     lval->t = TYPE_DOUBLE;
     lval->val.dval = d;
     return lval;
@@ -19,7 +19,7 @@ Literal_t *litDouble(double d)
 
 Literal_t *litChar(char c)
 {
-    Literal_t *lval = (Literal_t *)calloc(1, sizeof(Literal_t));
+    Literal_t *lval = (Literal_t *)chisql_alloc(sizeof(Literal_t));
     lval->t = TYPE_CHAR;
     lval->val.cval = c;
     return lval;
@@ -27,12 +27,21 @@ Literal_t *litChar(char c)
 
 Literal_t *litText(char *str)
 {
-    Literal_t *lval = (Literal_t *)calloc(1, sizeof(Literal_t));
+    Literal_t *lval = (Literal_t *)chisql_alloc(sizeof(Literal_t));
     lval->t = TYPE_TEXT;
     lval->val.strval = str;
     return lval;
 }
 
+/* The n-th '?' placeholder of a statement (starting at 0) */
+Literal_t *litParam(int n)
+{
+    Literal_t *lval = (Literal_t *)chisql_alloc(sizeof(Literal_t));
+    lval->t = TYPE_PARAM;
+    lval->val.ival = n;
+    return lval;
+}
+
 void Literal_print(Literal_t *val)
 {
     char buf[100];
@@ -51,6 +60,9 @@ void Literal_print(Literal_t *val)
     case TYPE_TEXT:
         printf("\"%s\"", val->val.strval);
         break;
+    case TYPE_PARAM:
+        printf("?%d", val->val.ival + 1);
+        break;
     default:
         printf("(unknown type)");
     }
@@ -85,8 +97,8 @@ Literal_t *Literal_append(Literal_t *lit1, Literal_t *lit2)
 void Literal_free(Literal_t *lval)
 {
     if (lval->t == TYPE_TEXT)
-        free(lval->val.strval);
-    free(lval);
+        chisql_free(lval->val.strval);
+    chisql_free(lval);
 }
 
 void Literal_freeList(Literal_t *lval)
@@ -96,6 +108,6 @@ void Literal_freeList(Literal_t *lval)
     {
         temp = lval;
         lval = lval->next;
-        free(temp);
+        chisql_free(temp);
     }
 }
@@ -83,16 +83,16 @@ void RA_print(RA_t *ra)
  */
 RA_t *RA_Table (const char *name)
 {
-    RA_t *new_ra = (RA_t *)calloc(1, sizeof(RA_t));
+    RA_t *new_ra = (RA_t *)chisql_alloc(sizeof(RA_t));
     new_ra->t = RA_TABLE;
-    new_ra->table.name = strdup(name);
+    new_ra->table.name = chisql_strdup(name);
     new_ra->columns = NULL; /* <-- No columns. See comment above */
     return new_ra;
 }
 
 RA_t *RA_Sigma (RA_t *ra, Condition_t *cond)
 {
-    RA_t *new_ra = (RA_t *)calloc(1, sizeof(RA_t));
+    RA_t *new_ra = (RA_t *)chisql_alloc(sizeof(RA_t));
     new_ra->t = RA_SIGMA;
     new_ra->sigma.cond = cond;
     new_ra->sigma.ra = ra;
@@ -102,7 +102,7 @@ RA_t *RA_Sigma (RA_t *ra, Condition_t *cond)
 
 RA_t *RA_Pi (RA_t *ra, Expression_t *expr_list)
 {
-    RA_t *new_ra = (RA_t *)calloc(1, sizeof(RA_t));
+    RA_t *new_ra = (RA_t *)chisql_alloc(sizeof(RA_t));
     new_ra->t = RA_PI;
     new_ra->pi.ra = ra;
     new_ra->pi.expr_list = expr_list;
@@ -112,7 +112,7 @@ RA_t *RA_Pi (RA_t *ra, Expression_t *expr_list)
 
 RA_t *RA_Union (RA_t *ra1, RA_t *ra2)
 {
-    RA_t *new_ra = (RA_t *)calloc(1, sizeof(RA_t));
+    RA_t *new_ra = (RA_t *)chisql_alloc(sizeof(RA_t));
     new_ra->t = RA_UNION;
     new_ra->binary.ra1 = ra1;
     new_ra->binary.ra2 = ra2;
@@ -122,7 +122,7 @@ RA_t *RA_Union (RA_t *ra1, RA_t *ra2)
 
 RA_t *RA_Difference (RA_t *ra1, RA_t *ra2)
 {
-    RA_t *new_ra = (RA_t *)calloc(1, sizeof(RA_t));
+    RA_t *new_ra = (RA_t *)chisql_alloc(sizeof(RA_t));
     new_ra->t = RA_DIFFERENCE;
     new_ra->binary.ra1 = ra1;
     new_ra->binary.ra2 = ra2;
@@ -132,7 +132,7 @@ RA_t *RA_Difference (RA_t *ra1, RA_t *ra2)
 
 RA_t *RA_Cross (RA_t *ra1, RA_t *ra2)
 {
-    RA_t *new_ra = (RA_t *)calloc(1, sizeof(RA_t));
+    RA_t *new_ra = (RA_t *)chisql_alloc(sizeof(RA_t));
     new_ra->t = RA_CROSS;
     new_ra->binary.ra1 = ra1;
     new_ra->binary.ra2 = ra2;
@@ -142,19 +142,19 @@ RA_t *RA_Cross (RA_t *ra1, RA_t *ra2)
 
 RA_t *RA_RhoTable (RA_t *ra, const char *new_name)
 {
-    RA_t *new_ra = (RA_t *)calloc(1, sizeof(RA_t));
+    RA_t *new_ra = (RA_t *)chisql_alloc(sizeof(RA_t));
     new_ra->t = RA_RHO_TABLE;
-    new_ra->rho.new_name = strdup(new_name);
+    new_ra->rho.new_name = chisql_strdup(new_name);
     new_ra->columns = NULL; // See comment in RA_Table.  list_deepCopy(&ra->columns);
     return new_ra;
 }
 
 RA_t *RA_RhoExpr (RA_t *ra, Expression_t *expr, const char *new_name)
 {
-    RA_t *new_ra = (RA_t *)calloc(1, sizeof(RA_t));
+    RA_t *new_ra = (RA_t *)chisql_alloc(sizeof(RA_t));
     new_ra->t = RA_RHO_EXPR;
     new_ra->rho.to_rename = expr;
-    new_ra->rho.new_name = strdup(new_name);
+    new_ra->rho.new_name = chisql_strdup(new_name);
     new_ra->columns = NULL; // See comment in RA_Table.  list_deepCopy(&ra->columns);
     return new_ra;
 }
@@ -179,18 +179,18 @@ void RA_free(RA_t *ra)
         break;
     case RA_RHO_EXPR:
         RA_free(ra->rho.ra);
-        free(ra->rho.new_name);
+        chisql_free(ra->rho.new_name);
         Expression_free(ra->rho.to_rename);
         break;
     case RA_RHO_TABLE:
         RA_free(ra->rho.ra);
-        free(ra->rho.new_name);
+        chisql_free(ra->rho.new_name);
         break;
     case RA_TABLE:
-        free(ra->table.name);
+        chisql_free(ra->table.name);
         break;
     }
-    free(ra);
+    chisql_free(ra);
 }
 
 #ifdef RA_TEST
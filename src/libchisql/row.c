@@ -2,7 +2,7 @@
 
 Row_t *Row_makeFirst(Column_t *cols)
 {
-    Row_t *row = (Row_t *)calloc(1, sizeof(Row_t));
+    Row_t *row = (Row_t *)chisql_alloc(sizeof(Row_t));
     Column_t *c = cols;
     while (c)
     {
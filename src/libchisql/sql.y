@@ -2,24 +2,38 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <strings.h>
 #include <chidb/chidb.h>
 #include <chisql/chisql.h>
-#include "sql-lexer.h"
 
 #define YYERROR_VERBOSE
 
-void yyerror(const char *s);
-int yylex(void);
-extern int yylineno;
 #define YYDEBUG 0
 int yydebug=0;
 int to_print = 0;
 int num_stmts = 0;
 
-chisql_statement_t *__stmt;
-
 %}
 
+%code requires {
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+}
+
+%code {
+#include "sql-lexer.h"
+
+void yyerror(yyscan_t scanner, chisql_statement_t *__stmt, const char *s);
+}
+
+/* The parser keeps no global state: the scanner and the statement being
+ * built are passed to it */
+%define api.pure full
+%lex-param {yyscan_t scanner}
+%parse-param {yyscan_t scanner} {chisql_statement_t *__stmt}
+
 %union {
 	double dval;
 	int ival;
@@ -30,6 +44,7 @@ chisql_statement_t *__stmt;
 	Column_t *col;
 	KeyDec_t *kdec;
 	StrList_t *slist;
+	Vector_t *vec;
 	Insert_t *ins;
 	Condition_t *cond;
 	Expression_t *expr;
@@ -53,6 +68,10 @@ chisql_statement_t *__stmt;
 %token COUNT SUM AVG MIN MAX INTERSECT EXCEPT DISTINCT
 %token CONCAT TRUE FALSE CASE WHEN DECLARE BIT GROUP
 %token INDEX EXPLAIN
+/* Context keywords: they carry their spelling, and are also names (see
+ * any_identifier) */
+%token TOKEN_BEGIN COMMIT ROLLBACK
+%token <strval> INCLUDE WITH ANALYZE LIMIT OFFSET QUERY PLAN TRANSACTION
 %token <strval> IDENTIFIER
 %token <strval> STRING_LITERAL
 %token <dval> DOUBLE_LITERAL
@@ -61,10 +80,11 @@ chisql_statement_t *__stmt;
 %type <ival> column_type bool_op comp_op select_combo
 %type <ival> function_name opt_distinct join opt_unique
 %type <strval> column_name table_name opt_alias 
-%type <strval> index_name column_name_or_star
-%type <slist> column_names_list opt_column_names
+%type <strval> index_name column_name_or_star opt_with opt_using any_identifier
+%type <slist> column_names_list opt_column_names opt_include
 %type <constr> opt_constraints constraints constraint
-%type <lval> literal_value values_list in_statement
+%type <lval> literal_value values_list in_statement limit_value
+%type <vec> values_rows
 %type <fkeyref> references_stmt
 %type <col> column_dec column_dec_list
 %type <kdec> key_dec opt_key_dec_list key_dec_list
@@ -74,7 +94,7 @@ chisql_statement_t *__stmt;
 %type <colref> column_reference
 %type <del> delete_from
 %type <sra> select select_statement table
-%type <opt> order_by group_by opt_options
+%type <opt> order_by group_by opt_options opt_limit
 %type <tref> table_ref
 %type <tbl> create_table
 %type <jcond> join_condition opt_join_condition
@@ -91,8 +111,10 @@ sql_queries
 	;
 
 sql_query
-	: sql_line ';'         { __stmt->explain = false; }
-	| EXPLAIN sql_line ';' { __stmt->explain = true; }
+	: sql_line ';'         { __stmt->explain = false; __stmt->plan = PLAN_NONE; }
+	| EXPLAIN sql_line ';' { __stmt->explain = true; __stmt->plan = PLAN_NONE; }
+	| EXPLAIN QUERY PLAN sql_line ';' { __stmt->explain = false; __stmt->plan = PLAN_QUERY; }
+	| EXPLAIN ANALYZE sql_line ';' { __stmt->explain = false; __stmt->plan = PLAN_ANALYZE; }
 	;
 
 sql_line
@@ -100,6 +122,15 @@ sql_line
 	| select 		{ __stmt->stmt.select = $1; __stmt->type = STMT_SELECT; }
 	| insert_into 	{ __stmt->stmt.insert = $1; __stmt->type = STMT_INSERT; }
 	| delete_from 	{ __stmt->stmt.delete = $1; __stmt->type = STMT_DELETE; }
+	| ANALYZE table_name { __stmt->stmt.analyze = $2; __stmt->type = STMT_ANALYZE; }
+	| TOKEN_BEGIN opt_transaction { __stmt->type = STMT_BEGIN; }
+	| COMMIT opt_transaction { __stmt->type = STMT_COMMIT; }
+	| ROLLBACK opt_transaction { __stmt->type = STMT_ROLLBACK; }
+	| /* empty */
+	;
+
+opt_transaction
+	: TRANSACTION
 	| /* empty */
 	;
 
@@ -109,29 +140,68 @@ create
 	;
 
 create_index
-        : CREATE opt_unique INDEX index_name ON table_name '(' column_name ')'
+        : CREATE opt_unique INDEX index_name ON table_name '(' column_name ')' opt_include opt_using
 		{ 
 			$$ = Index_make($4, $6, $8); 
 		  	if ($2 == UNIQUE) $$ = Index_makeUnique($$); 
+			if ($10) $$ = Index_addInclude($$, $10);
+			if ($11 && !Index_setMethod($$, $11))
+			{
+				yyerror(scanner, __stmt, "unknown index method (must be btree or hash)");
+				YYERROR;
+			}
+			if ($$->method == INDEX_HASH && $10)
+			{
+				yyerror(scanner, __stmt, "a hash index cannot include columns");
+				YYERROR;
+			}
 		}
 	;
 
+opt_using
+	: USING any_identifier { $$ = $2; }
+	| /* empty */ { $$ = NULL; }
+	;
+
+opt_include
+	: INCLUDE '(' column_names_list ')' { $$ = $3; }
+	| /* empty */ { $$ = NULL; }
+	;
+
 opt_unique
 	: UNIQUE { $$ = UNIQUE; }
 	| /* empty */ { $$ = 0; }
 	;
 
 index_name
-	: IDENTIFIER
+	: any_identifier
 	;
 
 create_table
-	: CREATE TABLE table_name '(' column_dec_list opt_key_dec_list ')' 
+	: CREATE TABLE table_name '(' column_dec_list opt_key_dec_list ')' opt_with
 		{
 			$$ = Table_make($3, $5, $6);
+			if ($8 && $$ && !Table_setStorage($$, $8))
+			{
+				yyerror(scanner, __stmt, "unknown storage (must be row or columnar)");
+				YYERROR;
+			}
 		}
 	;
 
+opt_with
+	: WITH '(' any_identifier '=' any_identifier ')'
+		{
+			if (strcasecmp($3, "storage"))
+			{
+				yyerror(scanner, __stmt, "unknown table option (must be storage)");
+				YYERROR;
+			}
+			$$ = $5;
+		}
+	| /* empty */ { $$ = NULL; }
+	;
+
 column_dec_list
 	: column_dec
 	| column_dec_list ',' column_dec { $$ = Column_append($1, $3); }
@@ -155,7 +225,7 @@ column_type
 		{ 
 			$$ = $1;
 			if ($3 <= 0) {
-				fprintf(stderr, "Error: sizes must be greater than 0 (line %d).\n", yylineno);
+				fprintf(stderr, "Error: sizes must be greater than 0 (line %d).\n", yyget_lineno(scanner));
 				exit(1);
 			}
 			Column_setSize($3);
@@ -228,7 +298,7 @@ select_combo
 	;
 
 select_statement
-	: SELECT opt_distinct expression_list FROM table opt_where_condition opt_options
+	: SELECT opt_distinct expression_list FROM table opt_where_condition opt_options opt_limit
 		{
 			if ($6 != NULL) 
 				$$ = SRAProject(SRASelect($5, $6), $3);
@@ -236,6 +306,8 @@ select_statement
 				$$ = SRAProject($5, $3);
 			if ($7 != NULL)
 				$$ = SRA_applyOption($$, $7); 
+			if ($8 != NULL)
+				$$ = SRA_applyOption($$, $8);
 			if ($2 == DISTINCT)
 				$$ = SRA_makeDistinct($$);
 		}
@@ -274,6 +346,17 @@ order_by
 	| ORDER BY expression DESC { $$ = OrderBy_make($3, ORDER_BY_DESC); }
 	;
 
+opt_limit
+	: LIMIT limit_value { $$ = Limit_make($2, NULL); }
+	| LIMIT limit_value OFFSET limit_value { $$ = Limit_make($2, $4); }
+	| /* empty */ { $$ = NULL; }
+	;
+
+limit_value
+	: INT_LITERAL { $$ = litInt($1); }
+	| '?' { $$ = litParam(__stmt->nparams++); }
+	;
+
 condition
    : bool_term { $$ = $1; /*printf("Found condition: \n"); Condition_print($$); puts(""); */}
    | bool_term bool_op condition 
@@ -289,21 +372,18 @@ bool_term
    		$$ = ($2 == '=') ? Eq($1, $3) :
    			  ($2 == '>') ? Gt($1, $3) :
    			  ($2 == '<') ? Lt($1, $3) :
-   			  ($2 == GEQ) ? Leq($1, $3) :
-   			  ($2 == LEQ) ? Geq($1, $3) :
+   			  ($2 == GEQ) ? Geq($1, $3) :
+   			  ($2 == LEQ) ? Leq($1, $3) :
    			  Not(Eq($1, $3));
    	}
    | expression in_statement { $$ = In($1, $2); }
+   | expression IN '(' select ')' { $$ = InSelect($1, $4); }
    | '(' condition ')' 	{ $$ = $2; }
    | NOT bool_term 		{ $$ = Not($2); }
    ;
 
 in_statement
 	:  IN '(' values_list ')' { $$ = $3; }
-	|	IN '(' select ')'
-   	{
-   		fprintf(stderr, "****WARNING: IN SELECT statement not yet supported\n");
-   	}
    ;
 
 bool_op
@@ -358,7 +438,7 @@ column_reference
 	;
 
 opt_alias
-	: AS IDENTIFIER { $$ = $2; }
+	: AS any_identifier { $$ = $2; }
 	| IDENTIFIER
 	| /* empty */ { $$ = NULL; }
 	;
@@ -372,16 +452,30 @@ function_name
 	;
 
 column_name_or_star
-	: '*' { $$ = strdup("*"); }
+	: '*' { $$ = chisql_strdup("*"); }
 	| column_name
 	;
 
 column_name
-	: IDENTIFIER
+	: any_identifier
 	;
 
 table_name
+	: any_identifier
+	;
+
+/* A name: an identifier, or a keyword that is only a keyword where a
+ * name cannot be (so that, for instance, a column can be called plan) */
+any_identifier
 	: IDENTIFIER
+	| QUERY
+	| PLAN
+	| INCLUDE
+	| WITH
+	| ANALYZE
+	| TRANSACTION
+	| LIMIT
+	| OFFSET
 	;
 
 table
@@ -395,7 +489,7 @@ table
 					if ($4) {
 						fprintf(stderr, 
 								  "Line %d: WARNING: a NATURAL join cannot have an ON "
-								  "or USING clause. This will be ignored.\n", yylineno);
+								  "or USING clause. This will be ignored.\n", yyget_lineno(scanner));
 					}
 					break;
 				case SRA_LEFT_OUTER_JOIN:
@@ -440,12 +534,17 @@ opt_outer
 	;
 
 insert_into
-	: INSERT INTO table_name opt_column_names VALUES '(' values_list ')'
+	: INSERT INTO table_name opt_column_names VALUES values_rows
 		{
-			$$ = Insert_make($3, $4, $7);
+			$$ = Insert_make($3, $4, $6);
 		}
 	;
 
+values_rows
+	: '(' values_list ')' { $$ = Vector_push(NULL, $2); }
+	| values_rows ',' '(' values_list ')' { $$ = Vector_push($1, $4); }
+	;
+
 opt_column_names
 	: '(' column_names_list ')' { $$ = $2; }
 	| /* empty */					 { $$ = NULL; }
@@ -475,6 +574,7 @@ literal_value
 			else
 				$$ = litText($1);
 		}
+	| '?' { $$ = litParam(__stmt->nparams++); }
 	;
 
 delete_from
@@ -486,8 +586,8 @@ delete_from
 
 %%
 
-void yyerror(const char *s) {
-	fprintf(stderr, "%s (line %d)\n", s, yylineno);
+void yyerror(yyscan_t scanner, chisql_statement_t *__stmt, const char *s) {
+	fprintf(stderr, "%s (line %d)\n", s, yyget_lineno(scanner));
 }
 
 int chisql_stmt_print(chisql_statement_t *stmt)
@@ -506,42 +606,79 @@ int chisql_stmt_print(chisql_statement_t *stmt)
     case STMT_DELETE:
         Delete_print(stmt->stmt.delete);
         break;
+    case STMT_ANALYZE:
+        printf("Analyze %s\n", stmt->stmt.analyze);
+        break;
+    case STMT_BEGIN:
+        printf("Begin\n");
+        break;
+    case STMT_COMMIT:
+        printf("Commit\n");
+        break;
+    case STMT_ROLLBACK:
+        printf("Rollback\n");
+        break;
     }
 
     return 0;
 }
 
 
+/* Frees a statement and its whole tree */
+void chisql_stmt_free(chisql_statement_t *stmt)
+{
+  if (stmt != NULL)
+    chisql_arena_destroy(stmt->arena);
+}
+
+
 char *__sql_semicolon(const char *sql)
 {
   int len = strlen(sql);
-  char *t = strdup(sql);
-  if (t[len-1]!=';') {
-    t = realloc(t,len+2);
+  char *t = chisql_alloc(len + 2);
+  memcpy(t, sql, len);
+  if (len == 0 || t[len-1]!=';')
     t[len]=';';
-    t[len+1]=0;
-  }
   return t;
 }
 
+/* The statement, its text and every node of its tree are allocated
+ * from an arena of their own, so chisql_stmt_free frees them at once */
 int chisql_parser(const char *sql, chisql_statement_t **stmt)
 {
   int rc;
-  
-  __stmt = malloc(sizeof(chisql_statement_t));
-  char *tsql = __sql_semicolon(sql);
-    
-  YY_BUFFER_STATE my_string_buffer = yy_scan_string (tsql);
-  rc = yyparse();
-  yy_delete_buffer (my_string_buffer);
-  
+  yyscan_t scanner;
+  chisql_statement_t *__stmt;
+  chisql_arena_t *arena, *prev;
+
+  if ((arena = chisql_arena_new()) == NULL)
+    return CHIDB_ENOMEM;
+  prev = chisql_arena_use(arena);
+
+  __stmt = chisql_alloc(sizeof(chisql_statement_t));
+  char *tsql = __stmt ? __sql_semicolon(sql) : NULL;
+  if (tsql == NULL || yylex_init_extra(0, &scanner) != 0)
+  {
+    chisql_arena_use(prev);
+    chisql_arena_destroy(arena);
+    return CHIDB_ENOMEM;
+  }
+  __stmt->arena = arena;
+  __stmt->nparams = 0;
+
+  YY_BUFFER_STATE my_string_buffer = yy_scan_string (tsql, scanner);
+  rc = yyparse(scanner, __stmt);
+  yy_delete_buffer (my_string_buffer, scanner);
+  yylex_destroy(scanner);
+  chisql_arena_use(prev);
+
   if (rc == 0) {
     __stmt->text = tsql; /* strdup(sql); */
     *stmt = __stmt;
     return CHIDB_OK;
   } else {
     fprintf(stderr,"invalid sql: \"%s\"\n", tsql);
-    free(__stmt);
+    chisql_arena_destroy(arena);
     return CHIDB_EINVALIDSQL;
   }
 
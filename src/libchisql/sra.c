@@ -5,7 +5,7 @@ static SRA_t *SRABinary(SRA_t *sra1, SRA_t *sra2, enum SRAType t);
 
 SRA_t *SRATable(TableReference_t *ref)
 {
-    SRA_t *sra = (SRA_t *)calloc(1, sizeof(SRA_t));
+    SRA_t *sra = (SRA_t *)chisql_alloc(sizeof(SRA_t));
     sra->t = SRA_TABLE;
     sra->table.ref = ref;
     return sra;
@@ -13,7 +13,7 @@ SRA_t *SRATable(TableReference_t *ref)
 
 SRA_t *SRAProject(SRA_t *sra, Expression_t *expr)
 {
-    SRA_t *new_sra = (SRA_t *)calloc(1, sizeof(SRA_t));
+    SRA_t *new_sra = (SRA_t *)chisql_alloc(sizeof(SRA_t));
     new_sra->t = SRA_PROJECT;
     new_sra->project.sra = sra;
     new_sra->project.expr_list = expr;
@@ -28,7 +28,7 @@ SRA_t *SRASelect(SRA_t *sra, Condition_t *cond)
     }
     else
     {
-        SRA_t *new_sra = (SRA_t *)calloc(1, sizeof(SRA_t));
+        SRA_t *new_sra = (SRA_t *)chisql_alloc(sizeof(SRA_t));
         new_sra->t = SRA_SELECT;
         new_sra->select.sra = sra;
         new_sra->select.cond = cond;
@@ -38,7 +38,7 @@ SRA_t *SRASelect(SRA_t *sra, Condition_t *cond)
 
 SRA_t *SRAJoin(SRA_t *sra1, SRA_t *sra2, JoinCondition_t *cond)
 {
-    SRA_t *new_sra = (SRA_t *)calloc(1, sizeof(SRA_t));
+    SRA_t *new_sra = (SRA_t *)chisql_alloc(sizeof(SRA_t));
     new_sra->t = SRA_JOIN;
     new_sra->join.sra1 = sra1;
     new_sra->join.sra2 = sra2;
@@ -68,7 +68,7 @@ SRA_t *SRAFullOuterJoin(SRA_t *sra1, SRA_t *sra2, JoinCondition_t *cond)
 
 static SRA_t *SRABinary(SRA_t *sra1, SRA_t *sra2, enum SRAType t)
 {
-    SRA_t *sra = (SRA_t *)calloc(1, sizeof(SRA_t));
+    SRA_t *sra = (SRA_t *)chisql_alloc(sizeof(SRA_t));
     sra->t = t;
     sra->binary.sra1 = sra1;
     sra->binary.sra2 = sra2;
@@ -108,6 +108,39 @@ void SRA_print(SRA_t *sra)
     case SRA_SELECT:
         indent_print("Select(");
         Condition_print(sra->select.cond);
+        if (sra->select.seek || sra->select.seek_end)
+        {
+            printf(" [seek");
+            if (sra->select.seek)
+            {
+                printf(" from ");
+                Condition_print(sra->select.seek);
+            }
+            if (sra->select.seek_end && sra->select.seek_end != sra->select.seek)
+            {
+                printf(" to ");
+                Condition_print(sra->select.seek_end);
+            }
+            printf("]");
+        }
+        if (sra->select.hash)
+        {
+            printf(" [hash index ");
+            Condition_print(sra->select.hash);
+            printf("]");
+        }
+        if (sra->select.probe)
+        {
+            printf(" [in probes ");
+            Condition_print(sra->select.probe);
+            printf("]");
+        }
+        if (sra->select.zone)
+        {
+            printf(" [zone map ");
+            Condition_print(sra->select.zone);
+            printf("]");
+        }
         printf(", ");
         upInd();
         SRA_print(sra->select.sra);
@@ -122,16 +155,27 @@ void SRA_print(SRA_t *sra)
         SRA_print(sra->project.sra);
         if (sra->project.distinct ||
                 sra->project.group_by ||
-                sra->project.order_by)
+                sra->project.order_by ||
+                sra->project.limit ||
+                sra->project.shortcut != SHORTCUT_NONE ||
+                sra->project.parallel)
         {
             printf(",\n");
             indent_print("Options: ");
+            if (sra->project.shortcut == SHORTCUT_COUNT)
+                printf("Count from leaves ");
+            else if (sra->project.shortcut != SHORTCUT_NONE)
+                printf("%s from B-Tree edge ", sra->project.shortcut == SHORTCUT_MIN ? "Min" : "Max");
+            if (sra->project.parallel)
+                printf("Parallel scan ");
             if (sra->project.distinct)
-                printf("Distinct ");
+                printf(sra->project.grouped && !sra->project.group_by ? "Distinct (streaming) " : "Distinct ");
             if (sra->project.group_by)
             {
                 printf("Group by ");
                 Expression_print(sra->project.group_by);
+                if (sra->project.grouped)
+                    printf(" (streaming)");
                 printf(" ");
             }
             if (sra->project.order_by)
@@ -140,13 +184,27 @@ void SRA_print(SRA_t *sra)
                 Expression_print(sra->project.order_by);
                 printf(sra->project.asc_desc == ORDER_BY_ASC ? " a" : " de");
                 printf("scending");
+                if (sra->project.sorted)
+                    printf(" (from index)");
+                printf(" ");
+            }
+            if (sra->project.limit)
+            {
+                printf("Limit ");
+                Literal_print(sra->project.limit);
+                if (sra->project.offset)
+                {
+                    printf(" offset ");
+                    Literal_print(sra->project.offset);
+                }
             }
         }
         downInd();
         indent_print(")");
         break;
     case SRA_UNION:
-        indent_print("Union(");
+        indent_print(sra->binary.method == SET_MERGE ? "Merge" : "");
+        printf("Union(");
         upInd();
         SRA_print(sra->binary.sra1);
         indent_print(", ");
@@ -155,7 +213,8 @@ void SRA_print(SRA_t *sra)
         indent_print(")");
         break;
     case SRA_EXCEPT:
-        indent_print("Except(");
+        indent_print(sra->binary.method == SET_MERGE ? "Merge" : "");
+        printf("Except(");
         upInd();
         SRA_print(sra->binary.sra1);
         indent_print(", ");
@@ -164,7 +223,8 @@ void SRA_print(SRA_t *sra)
         indent_print(")");
         break;
     case SRA_INTERSECT:
-        indent_print("Intersect(");
+        indent_print(sra->binary.method == SET_MERGE ? "Merge" : "");
+        printf("Intersect(");
         upInd();
         SRA_print(sra->binary.sra1);
         indent_print(", ");
@@ -173,11 +233,20 @@ void SRA_print(SRA_t *sra)
         indent_print(")");
         break;
     case SRA_JOIN:
-        indent_print("Join(");
+        if (sra->join.method == JOIN_HASH) indent_print("Hash");
+        else if (sra->join.method == JOIN_INDEX) indent_print("Index");
+        else indent_print("");
+        printf(sra->join.semi ? "SemiJoin(" : "Join(");
         upInd();
         SRA_print(sra->binary.sra1);
         printf(", \n");
         SRA_print(sra->binary.sra2);
+        if (sra->join.semi)
+        {
+            printf(",\n");
+            indent_print("");
+            Expression_print(sra->join.key->cond.in.expr);
+        }
         if (sra->join.opt_cond)
         {
             printf(",\n");
@@ -257,6 +326,11 @@ SRA_t *SRA_applyOption(SRA_t *sra, ProjectOption_t *option)
         {
             sra->project.group_by = option->group_by;
         }
+        if (option->limit)
+        {
+            sra->project.limit = option->limit;
+            sra->project.offset = option->offset;
+        }
     }
     return sra;
 }
@@ -267,12 +341,14 @@ void ProjectOption_free(ProjectOption_t *opt)
         Expression_free(opt->group_by);
     if (opt->order_by)
         Expression_free(opt->order_by);
-    free(opt);
+    Literal_freeList(opt->limit);
+    Literal_freeList(opt->offset);
+    chisql_free(opt);
 }
 
 ProjectOption_t *OrderBy_make(Expression_t *expr, enum OrderBy asc_desc)
 {
-    ProjectOption_t *ob = (ProjectOption_t *)calloc(1, sizeof(ProjectOption_t));
+    ProjectOption_t *ob = (ProjectOption_t *)chisql_alloc(sizeof(ProjectOption_t));
     ob->asc_desc = asc_desc;
     ob->order_by = expr;
     return ob;
@@ -280,11 +356,19 @@ ProjectOption_t *OrderBy_make(Expression_t *expr, enum OrderBy asc_desc)
 
 ProjectOption_t *GroupBy_make(Expression_t *expr)
 {
-    ProjectOption_t *gb = (ProjectOption_t *)calloc(1, sizeof(ProjectOption_t));
+    ProjectOption_t *gb = (ProjectOption_t *)chisql_alloc(sizeof(ProjectOption_t));
     gb->group_by = expr;
     return gb;
 }
 
+ProjectOption_t *Limit_make(Literal_t *limit, Literal_t *offset)
+{
+    ProjectOption_t *lim = (ProjectOption_t *)chisql_alloc(sizeof(ProjectOption_t));
+    lim->limit = limit;
+    lim->offset = offset;
+    return lim;
+}
+
 ProjectOption_t *ProjectOption_combine(ProjectOption_t *op1,
                                        ProjectOption_t *op2)
 {
@@ -329,7 +413,7 @@ SRA_t *SRA_makeDistinct(SRA_t *sra)
 
 JoinCondition_t *On(Condition_t *cond)
 {
-    JoinCondition_t *jc = (JoinCondition_t *)calloc(1, sizeof(JoinCondition_t));
+    JoinCondition_t *jc = (JoinCondition_t *)chisql_alloc(sizeof(JoinCondition_t));
     jc->t = JOIN_COND_ON;
     jc->on = cond;
     return jc;
@@ -337,7 +421,7 @@ JoinCondition_t *On(Condition_t *cond)
 
 JoinCondition_t *Using(StrList_t *col_list)
 {
-    JoinCondition_t *jc = (JoinCondition_t *)calloc(1, sizeof(JoinCondition_t));
+    JoinCondition_t *jc = (JoinCondition_t *)chisql_alloc(sizeof(JoinCondition_t));
     jc->t = JOIN_COND_USING;
     jc->col_list = col_list;
     return jc;
@@ -387,6 +471,8 @@ void SRA_free(SRA_t *sra)
         Expression_freeList(sra->project.expr_list);
         Expression_free(sra->project.order_by);
         Expression_free(sra->project.group_by);
+        Literal_freeList(sra->project.limit);
+        Literal_freeList(sra->project.offset);
         break;
     case SRA_SELECT:
         SRA_free(sra->select.sra);
@@ -400,6 +486,8 @@ void SRA_free(SRA_t *sra)
         SRA_free(sra->join.sra2);
         if (sra->join.opt_cond)
             JoinCondition_free(sra->join.opt_cond);
+        if (sra->join.semi)
+            Condition_free(sra->join.key);
         break;
     case SRA_NATURAL_JOIN:
     case SRA_UNION:
@@ -409,7 +497,7 @@ void SRA_free(SRA_t *sra)
         SRA_free(sra->binary.sra2);
         break;
     }
-    free(sra);
+    chisql_free(sra);
 }
 
 static RA_t *desugar_table(SRA_t *sra)
@@ -0,0 +1,57 @@
+#include <chisql/chisql.h>
+
+Vector_t *Vector_make(void)
+{
+    Vector_t *v = (Vector_t *)chisql_alloc(sizeof(Vector_t));
+    if (v == NULL)
+        return NULL;
+    v->capacity = VECTOR_INLINE;
+    v->items = v->inline_items;
+    return v;
+}
+
+/* Appends item to v (which is created if it is NULL). Returns the
+ * vector, or NULL if it couldn't grow */
+Vector_t *Vector_push(Vector_t *v, void *item)
+{
+    if (v == NULL && (v = Vector_make()) == NULL)
+        return NULL;
+
+    if (v->size == v->capacity)
+    {
+        void **items = (void **)chisql_alloc(2 * v->capacity * sizeof(void *));
+        if (items == NULL)
+            return NULL;
+        memcpy(items, v->items, v->size * sizeof(void *));
+        if (v->items != v->inline_items)
+            chisql_free(v->items);
+        v->items = items;
+        v->capacity *= 2;
+    }
+
+    v->items[v->size++] = item;
+    return v;
+}
+
+/* Appends the items of v2 to v1, and frees v2 (but not its items) */
+Vector_t *Vector_concat(Vector_t *v1, Vector_t *v2)
+{
+    if (v1 == NULL)
+        return v2;
+
+    for (unsigned int i = 0; i < Vector_size(v2); i++)
+        if (Vector_push(v1, Vector_get(v2, i)) == NULL)
+            return NULL;
+    Vector_free(v2);
+    return v1;
+}
+
+/* Frees the vector, but not its items */
+void Vector_free(Vector_t *v)
+{
+    if (v == NULL)
+        return;
+    if (v->items != v->inline_items)
+        chisql_free(v->items);
+    chisql_free(v);
+}
@@ -0,0 +1,448 @@
+/*****************************************************************************
+ *
+ *																 chidb
+ *
+ * Executors of the chidb server.
+ *
+ * A fixed pool of threads runs the requests of every connection on the
+ * same chidb database (and so, with the same buffer pool). Statements
+ * that only read run on several executors at once; a statement that
+ * writes has the database to itself (see chidb_stmt_readonly), and so
+ * does a connection between BEGIN and COMMIT or ROLLBACK. Executors
+ * never block waiting for the database: a connection whose next request
+ * can't have it stays in the ready queue, and the executors take the
+ * first one that can run. A request that turns out to write, once
+ * prepared, goes back to the queue, until nobody else is reading. Reads
+ * queued behind a waiting write wait for it.
+ *
+\*****************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "server.h"
+#include "protocol.h"
+
+/* How a request has the database (see server_acquire) */
+#define SERVER_DB_NONE (0)
+#define SERVER_DB_SHARED (1)
+#define SERVER_DB_OWNED (2)
+
+
+void chidb_server_request_free(server_request_t *req)
+{
+    if (req == NULL)
+        return;
+
+    for (int i = 0; i < req->nparams; i++)
+        free(req->params[i].s);
+    free(req->params);
+    free(req->sql);
+    free(req);
+}
+
+
+void chidb_server_conn_release(server_conn_t *conn)
+{
+    server_t *server = conn->server;
+    bool last;
+
+    pthread_mutex_lock(&server->sched_lock);
+    last = --conn->refs == 0;
+    pthread_mutex_unlock(&server->sched_lock);
+
+    if (!last)
+        return;
+
+    close(conn->fd);
+    free(conn->in.data);
+    free(conn->out.data);
+    pthread_mutex_destroy(&conn->lock);
+    pthread_cond_destroy(&conn->drained);
+    free(conn);
+}
+
+
+/* Adds a connection to the end of the ready queue (with sched_lock held) */
+static void server_enqueue(server_t *server, server_conn_t *conn)
+{
+    conn->queued = true;
+    conn->next_ready = NULL;
+    if (server->ready_tail != NULL)
+        server->ready_tail->next_ready = conn;
+    else
+        server->ready_head = conn;
+    server->ready_tail = conn;
+}
+
+
+/* Queues a request of a connection. The connection is referenced while
+ * it has requests. */
+void chidb_server_submit(server_t *server, server_conn_t *conn, server_request_t *req)
+{
+    pthread_mutex_lock(&server->sched_lock);
+
+    req->next = NULL;
+    if (conn->tail != NULL)
+        conn->tail->next = req;
+    else
+        conn->head = req;
+    conn->tail = req;
+    if (req->sql == NULL)
+        conn->closed = true;
+
+    if (!conn->queued && !conn->running)
+    {
+        conn->refs++;
+        server_enqueue(server, conn);
+        pthread_cond_signal(&server->sched_cond);
+    }
+
+    pthread_mutex_unlock(&server->sched_lock);
+}
+
+
+/* Gives the database to the next request of a connection, if it can
+ * have it now. Returns SERVER_DB_* (or -1 if it has to wait). */
+static int server_acquire(server_t *server, server_conn_t *conn, bool write_waiting)
+{
+    server_request_t *req = conn->head;
+
+    if (server->writer == conn)
+        return SERVER_DB_OWNED;
+    if (req->sql == NULL)
+        return SERVER_DB_NONE;
+    if (server->writer != NULL)
+        return -1;
+
+    if (req->writes)
+    {
+        if (server->nreaders > 0)
+            return -1;
+        server->writer = conn;
+        return SERVER_DB_OWNED;
+    }
+
+    if (write_waiting)
+        return -1;
+    server->nreaders++;
+    return SERVER_DB_SHARED;
+}
+
+
+/* Takes the first connection in the ready queue whose next request can
+ * run (with sched_lock held), or returns NULL */
+static server_conn_t *server_pick(server_t *server, int *mode)
+{
+    server_conn_t **p = &server->ready_head, *prev = NULL;
+    bool write_waiting = false;
+
+    for (; *p != NULL; prev = *p, p = &(*p)->next_ready)
+    {
+        server_conn_t *conn = *p;
+
+        *mode = server_acquire(server, conn, write_waiting);
+        if (*mode == -1)
+        {
+            write_waiting = write_waiting || conn->head->writes;
+            continue;
+        }
+
+        *p = conn->next_ready;
+        if (server->ready_tail == conn)
+            server->ready_tail = prev;
+        conn->queued = false;
+        return conn;
+    }
+
+    return NULL;
+}
+
+
+static const char *server_error_message(int rc)
+{
+    switch (rc)
+    {
+    case CHIDB_EINVALIDSQL:
+        return "Invalid SQL statement";
+    case CHIDB_ENOMEM:
+        return "Out of memory";
+    case CHIDB_ECORRUPT:
+        return "The database is corrupted";
+    case CHIDB_ECONSTRAINT:
+        return "Constraint violation";
+    case CHIDB_EMISMATCH:
+        return "Data type mismatch";
+    case CHIDB_EIO:
+        return "I/O error";
+    case CHIDB_EMISUSE:
+        return "Invalid request";
+    case CHIDB_EBUSY:
+        return "The database is busy";
+    default:
+        return "Error";
+    }
+}
+
+
+/* Starts a frame in buf */
+static void server_frame_begin(server_buf_t *buf, uint8_t type)
+{
+    buf->start = buf->len = 0;
+    if (chidb_server_buf_reserve(buf, SERVER_FRAME_HEADER) != 0)
+        return;
+    buf->data[4] = type;
+    buf->len = SERVER_FRAME_HEADER;
+}
+
+/* Appends n bytes to the frame in buf, and returns where they go (NULL
+ * if there is no memory for them) */
+static uint8_t *server_frame_add(server_buf_t *buf, size_t n)
+{
+    uint8_t *p;
+
+    if (buf->len == 0 || chidb_server_buf_reserve(buf, n) != 0)
+        return NULL;
+    p = buf->data + buf->len;
+    buf->len += n;
+    return p;
+}
+
+/* Sends the frame in buf */
+static int server_frame_send(server_conn_t *conn, server_buf_t *buf)
+{
+    if (buf->len == 0)
+        return CHIDB_ENOMEM;
+
+    server_put4(buf->data, buf->len - 4);
+    chidb_server_send(conn, buf->data, buf->len);
+    return CHIDB_OK;
+}
+
+
+static void server_send_error(server_conn_t *conn, server_buf_t *buf, int rc)
+{
+    const char *msg = server_error_message(rc);
+    size_t len = strlen(msg);
+    uint8_t *p;
+
+    server_frame_begin(buf, SERVER_RESP_ERROR);
+    p = server_frame_add(buf, 6 + len);
+    if (p == NULL)
+        return;
+    server_put4(p, rc);
+    server_put2(p + 4, len);
+    memcpy(p + 6, msg, len);
+    server_frame_send(conn, buf);
+}
+
+
+static int server_send_columns(server_conn_t *conn, server_buf_t *buf, chidb_stmt *stmt)
+{
+    int ncols = chidb_column_count(stmt);
+    uint8_t *p;
+
+    server_frame_begin(buf, SERVER_RESP_COLUMNS);
+    if ((p = server_frame_add(buf, 2)) == NULL)
+        return CHIDB_ENOMEM;
+    server_put2(p, ncols);
+
+    for (int i = 0; i < ncols; i++)
+    {
+        const char *name = chidb_column_name(stmt, i);
+        size_t len = name != NULL ? strlen(name) : 0;
+
+        if ((p = server_frame_add(buf, 2 + len)) == NULL)
+            return CHIDB_ENOMEM;
+        server_put2(p, len);
+        memcpy(p + 2, name, len);
+    }
+
+    return server_frame_send(conn, buf);
+}
+
+
+static int server_send_batch(server_conn_t *conn, server_buf_t *buf, chidb_rowbatch *batch)
+{
+    uint32_t nrows = batch->nrows, nbitmap = (nrows + 7) / 8;
+    uint8_t *p;
+
+    server_frame_begin(buf, SERVER_RESP_BATCH);
+    if ((p = server_frame_add(buf, 6)) == NULL)
+        return CHIDB_ENOMEM;
+    server_put4(p, nrows);
+    server_put2(p + 4, batch->ncols);
+
+    for (int i = 0; i < batch->ncols; i++)
+    {
+        chidb_rowbatch_column *col = &batch->cols[i];
+        uint32_t ntext = col->offsets[nrows];
+
+        p = server_frame_add(buf, 2 * nbitmap + 4 * nrows + 4 * (nrows + 1) + ntext);
+        if (p == NULL)
+            return CHIDB_ENOMEM;
+
+        memcpy(p, col->nulls, nbitmap);
+        memcpy(p + nbitmap, col->texts, nbitmap);
+        p += 2 * nbitmap;
+        for (uint32_t j = 0; j < nrows; j++, p += 4)
+            server_put4(p, col->ints[j]);
+        for (uint32_t j = 0; j <= nrows; j++, p += 4)
+            server_put4(p, col->offsets[j]);
+        memcpy(p, col->data, ntext);
+    }
+
+    return server_frame_send(conn, buf);
+}
+
+
+static void server_finalize(server_t *server, chidb_stmt *stmt)
+{
+    pthread_mutex_lock(&server->prepare_lock);
+    chidb_finalize(stmt);
+    pthread_mutex_unlock(&server->prepare_lock);
+}
+
+
+/* Runs a request, and sends its response. Returns true if it has to
+ * run again with the database to itself. */
+static bool server_execute(server_t *server, server_conn_t *conn, server_request_t *req, int mode, server_buf_t *buf)
+{
+    chidb_stmt *stmt;
+    chidb_rowbatch batch;
+    int rc;
+
+    /* The client went away in the middle of a transaction */
+    if (req->sql == NULL)
+    {
+        if (mode == SERVER_DB_OWNED && !chidb_get_autocommit(server->db))
+            chidb_rollback(server->db);
+        return false;
+    }
+
+    pthread_mutex_lock(&server->prepare_lock);
+    rc = chidb_prepare(server->db, req->sql, &stmt);
+    pthread_mutex_unlock(&server->prepare_lock);
+    if (rc != CHIDB_OK)
+    {
+        server_send_error(conn, buf, rc);
+        return false;
+    }
+
+    if (mode == SERVER_DB_SHARED && !chidb_stmt_readonly(stmt))
+    {
+        server_finalize(server, stmt);
+        return true;
+    }
+
+    for (int i = 0; rc == CHIDB_OK && i < req->nparams; i++)
+    {
+        server_param_t *param = &req->params[i];
+
+        if (param->type == SERVER_VALUE_INT)
+            rc = chidb_bind_int(stmt, i + 1, param->i);
+        else
+            rc = chidb_bind_text(stmt, i + 1, param->s);
+    }
+
+    if (rc == CHIDB_OK)
+        rc = server_send_columns(conn, buf, stmt);
+    if (rc == CHIDB_OK && (rc = chidb_rowbatch_init(stmt, &batch, SERVER_BATCH_ROWS)) == CHIDB_OK)
+    {
+        while ((rc = chidb_step_batch(stmt, SERVER_BATCH_ROWS, &batch)) == CHIDB_ROW)
+            if ((rc = server_send_batch(conn, buf, &batch)) != CHIDB_OK)
+                break;
+        chidb_rowbatch_free(&batch);
+    }
+
+    if (rc == CHIDB_DONE)
+    {
+        server_frame_begin(buf, SERVER_RESP_DONE);
+        server_frame_send(conn, buf);
+    }
+    else
+        server_send_error(conn, buf, rc);
+
+    server_finalize(server, stmt);
+
+    return false;
+}
+
+
+static void *server_executor(void *arg)
+{
+    server_t *server = arg;
+    server_buf_t buf = {NULL, 0, 0, 0};
+
+    for (;;)
+    {
+        server_conn_t *conn = NULL;
+        server_request_t *req;
+        bool again, idle;
+        int mode;
+
+        pthread_mutex_lock(&server->sched_lock);
+        while (!server->stopping && (conn = server_pick(server, &mode)) == NULL)
+            pthread_cond_wait(&server->sched_cond, &server->sched_lock);
+        if (conn == NULL)
+        {
+            pthread_mutex_unlock(&server->sched_lock);
+            break;
+        }
+        req = conn->head;
+        conn->head = req->next;
+        if (conn->head == NULL)
+            conn->tail = NULL;
+        conn->running = true;
+        pthread_mutex_unlock(&server->sched_lock);
+
+        again = server_execute(server, conn, req, mode, &buf);
+
+        pthread_mutex_lock(&server->sched_lock);
+        if (mode == SERVER_DB_SHARED)
+            server->nreaders--;
+        else if (mode == SERVER_DB_OWNED && (conn->closed || chidb_get_autocommit(server->db)))
+            server->writer = NULL;
+
+        if (again)
+        {
+            req->writes = true;
+            req->next = conn->head;
+            conn->head = req;
+            if (conn->tail == NULL)
+                conn->tail = req;
+        }
+        else
+            chidb_server_request_free(req);
+
+        conn->running = false;
+        idle = conn->head == NULL;
+        if (!idle)
+            server_enqueue(server, conn);
+        pthread_cond_broadcast(&server->sched_cond);
+        pthread_mutex_unlock(&server->sched_lock);
+
+        if (idle)
+            chidb_server_conn_release(conn);
+    }
+
+    free(buf.data);
+
+    return NULL;
+}
+
+
+int chidb_server_start_executors(server_t *server)
+{
+    server->threads = calloc(server->nthreads, sizeof(pthread_t));
+    if (server->threads == NULL)
+        return -1;
+
+    for (int i = 0; i < server->nthreads; i++)
+        if (pthread_create(&server->threads[i], NULL, server_executor, server) != 0)
+        {
+            server->nthreads = i;
+            return i > 0 ? 0 : -1;
+        }
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*****************************************************************************
+ *
+ *																 chidb
+ *
+ * This module provides the chidb server.
+ *
+ * The server opens a database and runs the statements that clients send
+ * over TCP (see protocol.h) on it, with a pool of executor threads.
+ *
+\*****************************************************************************/
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chidb/chidb.h>
+#include <chidb/log.h>
+#include "server.h"
+
+int main(int argc, char *argv[])
+{
+    server_t server;
+    chidb *db;
+    int opt;
+    int rc;
+    int verbosity = 0;
+    int port = SERVER_DEFAULT_PORT;
+    int nthreads = SERVER_DEFAULT_THREADS;
+    int flags = 0;
+
+    /* Process command-line arguments */
+    while ((opt = getopt(argc, argv, "p:t:wvh")) != -1)
+        switch (opt)
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'w':
+            flags |= CHIDB_OPEN_WAL;
+            break;
+        case 'v':
+            verbosity++;
+            break;
+        case 'h':
+            printf("Usage: chidb-server [-p PORT] [-t THREADS] [-w] DATABASE\n");
+            exit(0);
+        default:
+            printf("ERROR: Unknown option -%c\n", opt);
+            exit(-1);
+        }
+
+    /* Set logging level based on verbosity */
+    switch(verbosity)
+    {
+    case 0:
+        chilog_setloglevel(CRITICAL);
+        break;
+    case 1:
+        chilog_setloglevel(INFO);
+        break;
+    case 2:
+        chilog_setloglevel(DEBUG);
+        break;
+    default:
+        chilog_setloglevel(TRACE);
+        break;
+    }
+
+    if (optind >= argc || nthreads < 1 || port < 1 || port > 65535)
+    {
+        fprintf(stderr, "Usage: chidb-server [-p PORT] [-t THREADS] [-w] DATABASE\n");
+        exit(1);
+    }
+
+    rc = chidb_open2(argv[optind], &db, 0, flags);
+    if (rc)
+    {
+        fprintf(stderr, "ERROR: Could not open file %s or file is not well formed.\n", argv[optind]);
+        exit(1);
+    }
+
+    if (chidb_server_init(&server, db, port, nthreads) != 0)
+    {
+        perror("ERROR: Could not listen for connections");
+        chidb_close(db);
+        exit(1);
+    }
+
+    chilog(INFO, "Listening on port %i with %i executors", port, nthreads);
+    rc = chidb_server_run(&server);
+
+    chidb_close(db);
+
+    return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+/*****************************************************************************
+ *
+ *																 chidb
+ *
+ * Wire protocol of the chidb server.
+ *
+ * Every message, in both directions, is a frame: a 4-byte length (of
+ * the rest of the frame), a 1-byte type and the payload. Integers are
+ * big-endian.
+ *
+ * Requests:
+ * - SERVER_REQ_QUERY: [4: length][SQL statement][2: nparams], and, for
+ *   each parameter (see chidb_bind_int), [1: SERVER_VALUE_* type] and
+ *   its value: nothing for NULL, [4: integer], or [4: length][text].
+ *
+ * A client can send any number of requests without waiting for their
+ * responses (pipelining). The requests of a connection run in order,
+ * one at a time, and their responses come back in the same order.
+ *
+ * Responses to a query:
+ * - SERVER_RESP_COLUMNS: [2: ncols], and [2: length][name] per column.
+ * - SERVER_RESP_BATCH, any number of them: [4: nrows][2: ncols], and,
+ *   for each column (see chidb_rowbatch_column), the nulls bitmap and
+ *   the texts bitmap ((nrows + 7) / 8 bytes each), nrows integers,
+ *   nrows + 1 offsets into the text, and the text.
+ * - SERVER_RESP_DONE, with no payload.
+ * An error ends the response with SERVER_RESP_ERROR instead, with
+ * [4: chidb error code][2: length][message].
+ *
+ * BEGIN gives the connection the database to itself, until COMMIT or
+ * ROLLBACK (a connection that goes away in between is rolled back).
+ *
+\*****************************************************************************/
+
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+#include <stdint.h>
+
+#define SERVER_FRAME_HEADER (5)
+
+#define SERVER_REQ_QUERY    (0x01)
+
+#define SERVER_RESP_COLUMNS (0x81)
+#define SERVER_RESP_BATCH   (0x82)
+#define SERVER_RESP_DONE    (0x83)
+#define SERVER_RESP_ERROR   (0x84)
+
+#define SERVER_VALUE_NULL   (0)
+#define SERVER_VALUE_INT    (1)
+#define SERVER_VALUE_TEXT   (2)
+
+static inline uint32_t server_get4(const uint8_t *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static inline uint16_t server_get2(const uint8_t *p)
+{
+    return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static inline void server_put4(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static inline void server_put2(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+#endif
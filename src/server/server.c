@@ -0,0 +1,444 @@
+/*****************************************************************************
+ *
+ *																 chidb
+ *
+ * Event loop of the chidb server.
+ *
+ * One thread waits on every socket with epoll: it accepts connections,
+ * reads requests (see protocol.h) and hands them to the executors (see
+ * executor.c), and sends the responses that didn't fit in a socket when
+ * an executor produced them.
+ *
+\*****************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "server.h"
+#include "protocol.h"
+
+#define SERVER_MAX_EVENTS (64)
+#define SERVER_READ_SIZE (64 * 1024)
+#define SERVER_SEND_WAIT_MS (100)
+
+/* Set by SIGINT and SIGTERM (see chidb_server_run) */
+static volatile sig_atomic_t server_interrupted = 0;
+
+static void server_interrupt(int sig)
+{
+    server_interrupted = 1;
+}
+
+
+/* Makes room for n more bytes at the end of a buffer (dropping the bytes
+ * that were consumed). Returns 0, or -1 if it can't grow. */
+int chidb_server_buf_reserve(server_buf_t *buf, size_t n)
+{
+    size_t cap;
+    uint8_t *data;
+
+    if (buf->start > 0)
+    {
+        memmove(buf->data, buf->data + buf->start, buf->len - buf->start);
+        buf->len -= buf->start;
+        buf->start = 0;
+    }
+
+    if (buf->len + n <= buf->cap)
+        return 0;
+
+    cap = buf->cap > 0 ? buf->cap : 4096;
+    while (cap < buf->len + n)
+        cap *= 2;
+
+    data = realloc(buf->data, cap);
+    if (data == NULL)
+        return -1;
+    buf->data = data;
+    buf->cap = cap;
+
+    return 0;
+}
+
+
+int chidb_server_init(server_t *server, chidb *db, int port, int nthreads)
+{
+    struct sockaddr_in addr;
+    struct epoll_event ev;
+    int one = 1;
+
+    memset(server, 0, sizeof(server_t));
+    server->db = db;
+    server->port = port;
+    server->nthreads = nthreads;
+    pthread_mutex_init(&server->sched_lock, NULL);
+    pthread_cond_init(&server->sched_cond, NULL);
+    pthread_mutex_init(&server->prepare_lock, NULL);
+
+    server->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listen_fd == -1)
+        return -1;
+    setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(server->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+        || listen(server->listen_fd, SOMAXCONN) == -1)
+    {
+        close(server->listen_fd);
+        return -1;
+    }
+
+    server->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (server->epfd == -1)
+    {
+        close(server->listen_fd);
+        return -1;
+    }
+
+    /* The listening socket is the only one without a connection */
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->listen_fd, &ev) == -1)
+    {
+        close(server->epfd);
+        close(server->listen_fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void server_accept(server_t *server)
+{
+    struct epoll_event ev;
+    int fd, one = 1;
+
+    while ((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+    {
+        server_conn_t *conn = calloc(1, sizeof(server_conn_t));
+
+        if (conn == NULL)
+        {
+            close(fd);
+            continue;
+        }
+
+        /* Batches are sent as soon as they are produced */
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        conn->fd = fd;
+        conn->server = server;
+        conn->refs = 1;
+        pthread_mutex_init(&conn->lock, NULL);
+        pthread_cond_init(&conn->drained, NULL);
+
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = conn;
+        if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+            chidb_server_conn_release(conn);
+    }
+}
+
+
+/* Parses the payload of a SERVER_REQ_QUERY. Returns NULL if it is
+ * malformed (or there is no memory for it). */
+server_request_t *chidb_server_parse_query(const uint8_t *p, uint32_t n)
+{
+    server_request_t *req;
+    uint32_t pos = 4, len;
+    int nparams;
+
+    if (n < 4 || (len = server_get4(p)) > n - 4)
+        return NULL;
+
+    req = calloc(1, sizeof(server_request_t));
+    if (req == NULL)
+        return NULL;
+    req->sql = strndup((const char *) p + pos, len);
+    pos += len;
+    if (req->sql == NULL || n - pos < 2)
+        goto fail;
+
+    nparams = server_get2(p + pos);
+    pos += 2;
+    req->params = calloc(nparams > 0 ? nparams : 1, sizeof(server_param_t));
+    if (req->params == NULL)
+        goto fail;
+
+    for (int i = 0; i < nparams; i++)
+    {
+        server_param_t *param = &req->params[i];
+
+        req->nparams = i + 1;
+        if (pos >= n)
+            goto fail;
+        param->type = p[pos++];
+
+        switch (param->type)
+        {
+        case SERVER_VALUE_NULL:
+            break;
+        case SERVER_VALUE_INT:
+            if (n - pos < 4)
+                goto fail;
+            param->i = (int32_t) server_get4(p + pos);
+            pos += 4;
+            break;
+        case SERVER_VALUE_TEXT:
+            if (n - pos < 4 || (len = server_get4(p + pos)) > n - pos - 4)
+                goto fail;
+            param->s = strndup((const char *) p + pos + 4, len);
+            if (param->s == NULL)
+                goto fail;
+            pos += 4 + len;
+            break;
+        default:
+            goto fail;
+        }
+    }
+
+    if (pos != n)
+        goto fail;
+
+    return req;
+
+fail:
+    chidb_server_request_free(req);
+    return NULL;
+}
+
+
+/* Reads what a client sent, and submits the complete requests in it.
+ * Returns -1 if the connection must be closed. */
+int chidb_server_read(server_conn_t *conn)
+{
+    server_buf_t *in = &conn->in;
+
+    for (;;)
+    {
+        ssize_t n;
+
+        if (chidb_server_buf_reserve(in, SERVER_READ_SIZE) != 0)
+            return -1;
+
+        n = recv(conn->fd, in->data + in->len, in->cap - in->len, 0);
+        if (n > 0)
+            in->len += n;
+        else if (n == 0)
+            return -1;
+        else if (errno == EINTR)
+            continue;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        else
+            return -1;
+    }
+
+    while (in->len - in->start >= SERVER_FRAME_HEADER)
+    {
+        const uint8_t *p = in->data + in->start;
+        uint32_t len = server_get4(p);
+        server_request_t *req;
+
+        if (len == 0 || len > SERVER_MAX_FRAME)
+            return -1;
+        if (in->len - in->start < 4 + (size_t) len)
+            break;
+        if (p[4] != SERVER_REQ_QUERY || (req = chidb_server_parse_query(p + SERVER_FRAME_HEADER, len - 1)) == NULL)
+            return -1;
+
+        chidb_server_submit(conn->server, conn, req);
+        in->start += 4 + len;
+    }
+
+    return 0;
+}
+
+
+/* Stops listening to a client. The requests it already sent still run
+ * (without sending their responses), and the last one to run rolls back
+ * the transaction it left open, if any. */
+static void server_close(server_conn_t *conn)
+{
+    server_request_t *end = calloc(1, sizeof(server_request_t));
+
+    epoll_ctl(conn->server->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    shutdown(conn->fd, SHUT_RDWR);
+
+    pthread_mutex_lock(&conn->lock);
+    conn->broken = true;
+    pthread_cond_broadcast(&conn->drained);
+    pthread_mutex_unlock(&conn->lock);
+
+    /* Without memory for it, the transaction is rolled back when the
+     * server exits */
+    if (end != NULL)
+        chidb_server_submit(conn->server, conn, end);
+}
+
+
+/* Sends as much of the pending responses of a connection as the socket
+ * takes, and waits for it to be writable if some are left */
+void chidb_server_flush(server_conn_t *conn)
+{
+    server_buf_t *out = &conn->out;
+    struct epoll_event ev;
+    bool want;
+
+    pthread_mutex_lock(&conn->lock);
+
+    while (!conn->broken && out->len > out->start)
+    {
+        ssize_t n = send(conn->fd, out->data + out->start, out->len - out->start, MSG_NOSIGNAL);
+
+        if (n > 0)
+            out->start += n;
+        else if (n == -1 && errno == EINTR)
+            continue;
+        else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        else
+            conn->broken = true;
+    }
+    if (out->start == out->len || conn->broken)
+        out->start = out->len = 0;
+
+    want = !conn->broken && out->len > out->start;
+    if (want != conn->want_out)
+    {
+        ev.events = EPOLLIN | EPOLLRDHUP | (want ? EPOLLOUT : 0);
+        ev.data.ptr = conn;
+        epoll_ctl(conn->server->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->want_out = want;
+    }
+
+    if (conn->broken || out->len - out->start < SERVER_OUT_HIGH)
+        pthread_cond_broadcast(&conn->drained);
+
+    pthread_mutex_unlock(&conn->lock);
+}
+
+
+/* Queues a frame (or part of one) to be sent to a client, waiting while
+ * too much is queued already, and sends what the socket takes */
+void chidb_server_send(server_conn_t *conn, const uint8_t *data, size_t len)
+{
+    pthread_mutex_lock(&conn->lock);
+
+    while (!conn->broken && conn->out.len - conn->out.start >= SERVER_OUT_HIGH)
+    {
+        struct timespec until;
+
+        /* A client that stopped reading doesn't hold the server up when
+         * it exits */
+        if (__atomic_load_n(&conn->server->stopping, __ATOMIC_RELAXED))
+        {
+            conn->broken = true;
+            break;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += SERVER_SEND_WAIT_MS * 1000000L;
+        if (until.tv_nsec >= 1000000000L)
+        {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&conn->drained, &conn->lock, &until);
+    }
+
+    if (!conn->broken)
+    {
+        if (chidb_server_buf_reserve(&conn->out, len) == 0)
+        {
+            memcpy(conn->out.data + conn->out.len, data, len);
+            conn->out.len += len;
+        }
+        else
+            conn->broken = true;
+    }
+
+    pthread_mutex_unlock(&conn->lock);
+
+    chidb_server_flush(conn);
+}
+
+
+int chidb_server_run(server_t *server)
+{
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    server_conn_t *closed[SERVER_MAX_EVENTS];
+    struct sigaction sa;
+    int rc = 0;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = server_interrupt;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (chidb_server_start_executors(server) != 0)
+        return -1;
+
+    while (!server_interrupted)
+    {
+        int n = epoll_wait(server->epfd, events, SERVER_MAX_EVENTS, -1), nclosed = 0;
+
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            rc = -1;
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            server_conn_t *conn = events[i].data.ptr;
+
+            if (conn == NULL)
+            {
+                server_accept(server);
+                continue;
+            }
+
+            if (events[i].events & EPOLLOUT)
+                chidb_server_flush(conn);
+            if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && chidb_server_read(conn) != 0)
+            {
+                server_close(conn);
+                closed[nclosed++] = conn;
+            }
+        }
+
+        /* Only once nothing else in events refers to them */
+        for (int i = 0; i < nclosed; i++)
+            chidb_server_conn_release(closed[i]);
+    }
+
+    /* The executors finish the requests they are running */
+    pthread_mutex_lock(&server->sched_lock);
+    __atomic_store_n(&server->stopping, true, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&server->sched_cond);
+    pthread_mutex_unlock(&server->sched_lock);
+    for (int i = 0; i < server->nthreads; i++)
+        pthread_join(server->threads[i], NULL);
+    free(server->threads);
+
+    close(server->epfd);
+    close(server->listen_fd);
+
+    return rc;
+}
@@ -0,0 +1,112 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <chidb/chidb.h>
+
+#define SERVER_DEFAULT_PORT (7433)
+#define SERVER_DEFAULT_THREADS (4)
+
+/* Rows in each SERVER_RESP_BATCH */
+#define SERVER_BATCH_ROWS (256)
+
+/* Longest request accepted (longer ones close the connection) */
+#define SERVER_MAX_FRAME (16 * 1024 * 1024)
+
+/* An executor stops producing rows while this many bytes of responses
+ * are waiting to be sent on the connection */
+#define SERVER_OUT_HIGH (4 * 1024 * 1024)
+
+typedef struct server_buf
+{
+    uint8_t *data;
+    size_t start;             /* Bytes already consumed */
+    size_t len;               /* Bytes in data (including consumed ones) */
+    size_t cap;
+} server_buf_t;
+
+typedef struct server_param
+{
+    uint8_t type;             /* SERVER_VALUE_* */
+    int32_t i;
+    char *s;                  /* NUL-terminated */
+} server_param_t;
+
+/* A statement waiting to run, or the end of the connection (sql NULL) */
+typedef struct server_request
+{
+    char *sql;
+    int nparams;
+    server_param_t *params;
+    bool writes;              /* Known to write (it needs the database to itself) */
+    struct server_request *next;
+} server_request_t;
+
+typedef struct server_conn
+{
+    int fd;
+    struct server *server;
+
+    /* Only touched by the event loop */
+    server_buf_t in;
+
+    /* Responses not sent yet, protected by lock. The executor running a
+     * request sends them right away, as far as the socket takes them,
+     * and the event loop sends the rest once the socket is writable. */
+    pthread_mutex_t lock;
+    pthread_cond_t drained;
+    server_buf_t out;
+    bool want_out;            /* Registered for EPOLLOUT */
+    bool broken;              /* Sending failed, responses are dropped */
+
+    /* Protected by the server's sched_lock */
+    server_request_t *head, *tail;
+    bool queued;              /* In the ready queue */
+    bool running;             /* A request of it is running */
+    bool closed;              /* The client went away */
+    int refs;
+    struct server_conn *next_ready;
+} server_conn_t;
+
+typedef struct server
+{
+    chidb *db;
+    int port;
+    int nthreads;
+
+    int epfd;
+    int listen_fd;
+    pthread_t *threads;
+
+    /* Scheduling of the requests on the executors (see executor.c) */
+    pthread_mutex_t sched_lock;
+    pthread_cond_t sched_cond;
+    server_conn_t *ready_head, *ready_tail;
+    int nreaders;             /* Requests running with the database shared */
+    server_conn_t *writer;    /* Connection that has the database to itself */
+    bool stopping;
+
+    /* chidb_prepare and chidb_finalize are called by one thread at a time */
+    pthread_mutex_t prepare_lock;
+} server_t;
+
+int chidb_server_init(server_t *server, chidb *db, int port, int nthreads);
+int chidb_server_run(server_t *server);
+
+/* Implemented in executor.c */
+int chidb_server_start_executors(server_t *server);
+void chidb_server_submit(server_t *server, server_conn_t *conn, server_request_t *req);
+void chidb_server_conn_release(server_conn_t *conn);
+void chidb_server_request_free(server_request_t *req);
+
+/* Implemented in server.c */
+void chidb_server_send(server_conn_t *conn, const uint8_t *data, size_t len);
+void chidb_server_flush(server_conn_t *conn);
+int chidb_server_buf_reserve(server_buf_t *buf, size_t n);
+server_request_t *chidb_server_parse_query(const uint8_t *p, uint32_t n);
+int chidb_server_read(server_conn_t *conn);
+
+#endif
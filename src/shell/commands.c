@@ -1,5 +1,7 @@
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include <sys/resource.h>
 #include <chidb/dbm-file.h>
 #include "shell.h"
 #include "commands.h"
@@ -14,12 +16,24 @@ struct handler_entry handlers[] =
     HANDLER_ENTRY (open,      ".open FILENAME     Close existing database (if any) and open FILENAME"),
     HANDLER_ENTRY (parse,     ".parse \"SQL\"       Show parse tree for statement SQL"),
     HANDLER_ENTRY (opt,       ".opt \"SQL\"       Show parse tree and optimized parse tree for statement SQL"),
-    HANDLER_ENTRY (dbmrun,    ".dbmrun DBMFILE    Run DBM program in DBMFILE"),
+    HANDLER_ENTRY (dbmrun,    ".dbmrun DBMFILE    Run DBM program in DBMFILE\n"
+                              ".dbmrun --bench N DBMFILE [BASELINE]\n"
+                              "                   Time N runs of DBMFILE, each on a fresh copy of its database, and\n"
+                              "                   compare them with BASELINE (the saved output of earlier runs)"),
     HANDLER_ENTRY (headers,   ".headers on|off    Switch display of headers on or off in query results"),
     HANDLER_ENTRY (mode,      ".mode MODE         Switch display mode. MODE is one of:\n"
     		                  "                     column  Left-aligned columns\n"
     		                  "                     list    Values delimited by | (default)"),
     HANDLER_ENTRY (explain,   ".explain on|off    Turn output mode suitable for EXPLAIN on or off."),
+    HANDLER_ENTRY (timer,     ".timer on|off      Show the wall-clock and CPU time of each SQL statement"),
+    HANDLER_ENTRY (profile,   ".profile on|off    Show the executions and CPU cycles of each instruction (by address,\n"
+                              "                   as in EXPLAIN, and by opcode) and the page reads of each SQL statement"),
+    HANDLER_ENTRY (stats,     ".stats [reset]     Show I/O statistics of the database (or reset them)"),
+    HANDLER_ENTRY (import,    ".import FILE TABLE Load the rows in FILE (CSV, TSV or separated by |) into TABLE\n"
+                              ".import FILE ROOT  Load the sorted rows in FILE into the empty table with root page ROOT"),
+    HANDLER_ENTRY (backup,    ".backup FILE [PAGES [MS]]\n"
+                              "                   Copy the database to FILE while it is in use, PAGES pages at a time\n"
+                              "                   (100 by default), waiting MS milliseconds between steps (none by default)"),
     HANDLER_ENTRY (help,      ".help              Show this message"),
 
     NULL_ENTRY
@@ -85,10 +99,110 @@ int chidb_shell_handle_cmd(chidb_shell_ctx_t *ctx, const char *cmd)
     return 0;
 }
 
+/* Times of a statement (see .timer) */
+typedef struct shell_times
+{
+    struct timespec real;
+    struct rusage usage;
+} shell_times_t;
+
+static void get_times(shell_times_t *t)
+{
+    clock_gettime(CLOCK_MONOTONIC, &t->real);
+    getrusage(RUSAGE_SELF, &t->usage);
+}
+
+static double timeval_diff(struct timeval *end, struct timeval *start)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_usec - start->tv_usec) / 1e6;
+}
+
+static void print_times(shell_times_t *start)
+{
+    shell_times_t end;
+
+    get_times(&end);
+    printf("Run Time: real %.6f user %.6f sys %.6f\n",
+           (end.real.tv_sec - start->real.tv_sec) + (end.real.tv_nsec - start->real.tv_nsec) / 1e9,
+           timeval_diff(&end.usage.ru_utime, &start->usage.ru_utime),
+           timeval_diff(&end.usage.ru_stime, &start->usage.ru_stime));
+}
+
+/* Prints the profile of a statement (see .profile): each instruction,
+ * by address, with the pages it read, then each opcode, by the cycles
+ * it took, and the pages the statement read since the statistics in
+ * start */
+static void print_profile(chidb_shell_ctx_t *ctx, chidb_stmt *stmt, chidb_stats *start)
+{
+    const chidb_profile_op *prof;
+    chidb_profile_op *byop;
+    chidb_stats end;
+    uint64_t total = 0;
+    int nops, nbyop = 0;
+
+    chidb_stats_get(ctx->db, &end);
+    printf("Page reads: %llu (%llu from the file)\n",
+           (unsigned long long) (end.cache_hits + end.cache_misses - start->cache_hits - start->cache_misses),
+           (unsigned long long) (end.pages_read - start->pages_read));
+
+    prof = chidb_profile_get(stmt, &nops);
+    if (prof == NULL || nops == 0)
+        return;
+
+    for (int i = 0; i < nops; i++)
+        total += prof[i].cycles;
+    if (total == 0)
+        total = 1;
+
+    printf("%-5s %-15s %12s %14s %6s %10s\n", "addr", "opcode", "count", "cycles", "%", "pages");
+    for (int i = 0; i < nops; i++)
+        printf("%-5i %-15s %12llu %14llu %5.1f%% %10llu\n", i, prof[i].opcode,
+               (unsigned long long) prof[i].count, (unsigned long long) prof[i].cycles,
+               100.0 * prof[i].cycles / total, (unsigned long long) prof[i].pages);
+
+    byop = calloc(nops, sizeof(chidb_profile_op));
+    if (byop == NULL)
+        return;
+
+    for (int i = 0; i < nops; i++)
+    {
+        int j;
+
+        for (j = 0; j < nbyop && strcmp(byop[j].opcode, prof[i].opcode); j++)
+            ;
+        if (j == nbyop)
+            byop[nbyop++].opcode = prof[i].opcode;
+        byop[j].count += prof[i].count;
+        byop[j].cycles += prof[i].cycles;
+    }
+
+    /* Insertion sort, most cycles first */
+    for (int i = 1; i < nbyop; i++)
+        for (int j = i; j > 0 && byop[j].cycles > byop[j - 1].cycles; j--)
+        {
+            chidb_profile_op tmp = byop[j];
+            byop[j] = byop[j - 1];
+            byop[j - 1] = tmp;
+        }
+
+    printf("\n%-21s %12s %14s %6s\n", "opcode", "count", "cycles", "%");
+    for (int i = 0; i < nbyop; i++)
+        printf("%-21s %12llu %14llu %5.1f%%\n", byop[i].opcode,
+               (unsigned long long) byop[i].count, (unsigned long long) byop[i].cycles,
+               100.0 * byop[i].cycles / total);
+
+    free(byop);
+}
+
 int chidb_shell_handle_sql(chidb_shell_ctx_t *ctx, const char *sql)
 {
     int rc;
     chidb_stmt *stmt;
+    shell_times_t times;
+    chidb_stats stats;
+
+    if (ctx->timer)
+        get_times(&times);
 
     rc = chidb_prepare(ctx->db, sql, &stmt);
 
@@ -96,6 +210,13 @@ int chidb_shell_handle_sql(chidb_shell_ctx_t *ctx, const char *sql)
     {
         int numcol = chidb_column_count(stmt);
 
+        if (ctx->profile)
+        {
+            if (chidb_profile_start(stmt) != CHIDB_OK)
+                printf("ERROR: Could not allocate memory for the profile.\n");
+            chidb_stats_get(ctx->db, &stats);
+        }
+
         if(ctx->header)
         {
             for(int i = 0; i < numcol; i ++)
@@ -197,9 +318,15 @@ int chidb_shell_handle_sql(chidb_shell_ctx_t *ctx, const char *sql)
             break;
         }
 
+        if (ctx->profile)
+            print_profile(ctx, stmt, &stats);
+
         rc = chidb_finalize(stmt);
         if(rc == CHIDB_EMISUSE)
             printf("API used incorrectly.\n");
+
+        if (ctx->timer)
+            print_times(&times);
     }
     else if (rc == CHIDB_EINVALIDSQL)
         printf("SQL syntax error.\n");
@@ -221,7 +348,7 @@ int chidb_shell_handle_cmd_open(chidb_shell_ctx_t *ctx, struct handler_entry *e,
     	return 1;
     }
 
-    rc = chidb_open(tokens[1], &newdb);
+    rc = chidb_open2(tokens[1], &newdb, ctx->page_size, ctx->open_flags);
 
 	if (rc != CHIDB_OK)
     {
@@ -263,6 +390,7 @@ int chidb_shell_handle_cmd_parse(chidb_shell_ctx_t *ctx, struct handler_entry *e
 
     chisql_stmt_print(sql_stmt);
     printf("\n");
+    chisql_stmt_free(sql_stmt);
 
     return CHIDB_OK;
 }
@@ -303,21 +431,69 @@ int chidb_shell_handle_cmd_opt(chidb_shell_ctx_t *ctx, struct handler_entry *e,
 
     if(rc != CHIDB_OK)
     {
+        chisql_stmt_free(sql_stmt);
         return rc;
     }
 
     chisql_stmt_print(sql_stmt_opt);
     printf("\n");
+    free(sql_stmt_opt);
+    chisql_stmt_free(sql_stmt);
 
     return CHIDB_OK;
 }
 
+/* .dbmrun --bench: the database named in the DBM file is copied from
+ * the current directory to the temporary directory for each run, so
+ * the open database (if any) is not used */
+static int chidb_shell_dbmrun_bench(struct handler_entry *e, const char **tokens, int ntokens)
+{
+    chidb_dbm_file_bench_t bench;
+    int nruns, rc;
+
+    if(ntokens < 4 || ntokens > 5 || (nruns = atoi(tokens[2])) <= 0)
+    {
+        usage_error(e, "Invalid arguments");
+        return 1;
+    }
+
+    if(access(tokens[3], F_OK) == -1)
+    {
+        fprintf(stderr, "ERROR: File does not exist: %s\n", tokens[3]);
+        return 1;
+    }
+
+    rc = chidb_dbm_file_bench(tokens[3], ".", P_tmpdir, nruns, &bench);
+    if(rc != CHIDB_OK)
+    {
+        fprintf(stderr, "ERROR: Error while running DBM file %s\n", tokens[3]);
+        return 1;
+    }
+
+    printf("# benchmark\tprogram\tinstructions\tns/instruction\tmedian_ns\tmin_ns\truns\topcodes\n");
+    chidb_dbm_file_bench_print(stdout, &bench);
+
+    if(ntokens == 5)
+    {
+        rc = chidb_dbm_file_bench_compare(stdout, tokens[4], &bench, 0.1);
+        if(rc == CHIDB_EIO)
+            fprintf(stderr, "ERROR: Could not read baseline %s\n", tokens[4]);
+    }
+
+    chidb_dbm_file_bench_free(&bench);
+
+    return rc == CHIDB_EIO ? 1 : 0;
+}
+
 int chidb_shell_handle_cmd_dbmrun(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
 {
     int rc;
     chidb_dbm_file_t *dbmf;
     bool results = false;
 
+    if(ntokens >= 2 && !strcmp(tokens[1], "--bench"))
+        return chidb_shell_dbmrun_bench(e, tokens, ntokens);
+
     if(ntokens != 2)
     {
     	usage_error(e, "Invalid arguments");
@@ -444,6 +620,239 @@ int chidb_shell_handle_cmd_explain(chidb_shell_ctx_t *ctx, struct handler_entry
     return CHIDB_OK;
 }
 
+int chidb_shell_handle_cmd_timer(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    if(ntokens != 2)
+    {
+    	usage_error(e, "Invalid arguments");
+    	return 1;
+    }
+
+    if(strcmp(tokens[1],"on")==0)
+        ctx->timer = true;
+    else if(strcmp(tokens[1],"off")==0)
+        ctx->timer = false;
+    else
+    {
+    	usage_error(e, "Invalid argument");
+    	return 1;
+    }
+
+    return CHIDB_OK;
+}
+
+int chidb_shell_handle_cmd_profile(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    if(ntokens != 2)
+    {
+    	usage_error(e, "Invalid arguments");
+    	return 1;
+    }
+
+    if(strcmp(tokens[1],"on")==0)
+        ctx->profile = true;
+    else if(strcmp(tokens[1],"off")==0)
+        ctx->profile = false;
+    else
+    {
+    	usage_error(e, "Invalid argument");
+    	return 1;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Formats a duration in nanoseconds using the most appropriate unit */
+static void format_ns(char *buf, size_t len, uint64_t ns)
+{
+    if (ns < 1000)
+        snprintf(buf, len, "%lluns", (unsigned long long) ns);
+    else if (ns < 1000000)
+        snprintf(buf, len, "%.1fus", ns / 1e3);
+    else if (ns < 1000000000)
+        snprintf(buf, len, "%.1fms", ns / 1e6);
+    else
+        snprintf(buf, len, "%.1fs", ns / 1e9);
+}
+
+static void print_histogram(const char *name, chidb_histogram *hist)
+{
+    char avg[16], max[16], lo[16], hi[16];
+
+    if (hist->count == 0)
+    {
+        printf("%-15s -\n", name);
+        return;
+    }
+
+    format_ns(avg, sizeof(avg), hist->total_ns / hist->count);
+    format_ns(max, sizeof(max), hist->max_ns);
+    printf("%-15s %llu ops, avg %s, max %s\n", name, (unsigned long long) hist->count, avg, max);
+
+    for (int i = 0; i < CHIDB_HIST_NBUCKETS; i++)
+    {
+        if (hist->buckets[i] == 0)
+            continue;
+
+        format_ns(lo, sizeof(lo), i == 0 ? 0 : 1ULL << i);
+        format_ns(hi, sizeof(hi), 1ULL << (i + 1));
+        printf("  %8s - %-8s %10llu  %5.1f%%\n", lo, hi, (unsigned long long) hist->buckets[i],
+               100.0 * hist->buckets[i] / hist->count);
+    }
+}
+
+int chidb_shell_handle_cmd_stats(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    chidb_stats stats;
+    uint64_t reads;
+
+    if(ntokens > 2 || (ntokens == 2 && strcmp(tokens[1], "reset")))
+    {
+        usage_error(e, "Invalid arguments");
+        return 1;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    if(ntokens == 2)
+        return chidb_stats_reset(ctx->db);
+
+    chidb_stats_get(ctx->db, &stats);
+    reads = stats.cache_hits + stats.cache_misses;
+
+    printf("%-15s %llu\n", "Pages read", (unsigned long long) stats.pages_read);
+    printf("%-15s %llu\n", "Pages written", (unsigned long long) stats.pages_written);
+    printf("%-15s %llu (%.1f%%)\n", "Cache hits", (unsigned long long) stats.cache_hits,
+           reads ? 100.0 * stats.cache_hits / reads : 0.0);
+    printf("%-15s %llu\n", "Cache misses", (unsigned long long) stats.cache_misses);
+    printf("%-15s %llu\n", "Bytes read", (unsigned long long) stats.bytes_read);
+    printf("%-15s %llu\n", "Bytes written", (unsigned long long) stats.bytes_written);
+    printf("%-15s %llu\n", "Syncs", (unsigned long long) stats.syncs);
+    print_histogram("Read latency", &stats.read_latency);
+    print_histogram("Write latency", &stats.write_latency);
+    print_histogram("Sync latency", &stats.sync_latency);
+
+    return CHIDB_OK;
+}
+
+int chidb_shell_handle_cmd_import(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    unsigned int nroot, nrows;
+    char *end;
+    int rc;
+
+    if(ntokens != 3)
+    {
+        usage_error(e, "Invalid arguments");
+        return 1;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    /* A number is the root page of the table */
+    nroot = strtoul(tokens[2], &end, 10);
+    if(*end == '\0' && nroot == 0)
+    {
+        usage_error(e, "Invalid root page");
+        return 1;
+    }
+    else if(*end == '\0')
+        rc = chidb_import(ctx->db, tokens[1], nroot, &nrows);
+    else
+        rc = chidb_import_table(ctx->db, tokens[1], tokens[2], &nrows);
+
+    if(rc == CHIDB_ECANTOPEN)
+    {
+        fprintf(stderr, "ERROR: Could not open file %s\n", tokens[1]);
+        return 1;
+    }
+    else if(rc == CHIDB_EINVALIDSQL)
+    {
+        fprintf(stderr, "ERROR: No such table: %s\n", tokens[2]);
+        return 1;
+    }
+    else if(rc != CHIDB_OK)
+    {
+        fprintf(stderr, "ERROR: Could not import row %u of %s (error code %i)\n", nrows, tokens[1], rc);
+        return 1;
+    }
+
+    printf("Imported %u rows\n", nrows);
+
+    return CHIDB_OK;
+}
+
+int chidb_shell_handle_cmd_backup(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    chidb_backup *backup;
+    long npages = 100, sleep_ms = 0;
+    char *end;
+    int rc, frc, ncopied;
+
+    if(ntokens < 2 || ntokens > 4)
+    {
+        usage_error(e, "Invalid arguments");
+        return 1;
+    }
+
+    if(ntokens >= 3 && ((npages = strtol(tokens[2], &end, 10)) <= 0 || *end != '\0'))
+    {
+        usage_error(e, "Invalid number of pages");
+        return 1;
+    }
+
+    if(ntokens == 4 && ((sleep_ms = strtol(tokens[3], &end, 10)) < 0 || *end != '\0'))
+    {
+        usage_error(e, "Invalid number of milliseconds");
+        return 1;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    rc = chidb_backup_init(ctx->db, tokens[1], &backup);
+    if(rc == CHIDB_ECANTOPEN)
+    {
+        fprintf(stderr, "ERROR: Could not create file %s\n", tokens[1]);
+        return 1;
+    }
+    else if(rc != CHIDB_OK)
+    {
+        fprintf(stderr, "ERROR: Could not start the backup (error code %i)\n", rc);
+        return 1;
+    }
+
+    while((rc = chidb_backup_step(backup, npages)) == CHIDB_OK)
+        if(sleep_ms > 0)
+            usleep(sleep_ms * 1000);
+
+    ncopied = chidb_backup_pagecount(backup);
+    frc = chidb_backup_finish(backup);
+    if(rc == CHIDB_DONE)
+        rc = frc;
+
+    if(rc != CHIDB_OK)
+    {
+        fprintf(stderr, "ERROR: Could not back up the database (error code %i)\n", rc);
+        return 1;
+    }
+
+    printf("Copied %i pages to %s\n", ncopied, tokens[1]);
+
+    return CHIDB_OK;
+}
+
 int chidb_shell_handle_cmd_help(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
 {
     for(int h=0; handlers[h].name != NULL; h++)
@@ -37,17 +37,20 @@ int main(int argc, char *argv[])
     chidb_shell_init_ctx(&shell_ctx);
 
     /* Process command-line arguments */
-    while ((opt = getopt(argc, argv, "c:vh")) != -1)
+    while ((opt = getopt(argc, argv, "c:p:vh")) != -1)
         switch (opt)
         {
         case 'c':
             command = strdup(optarg);
             break;
+        case 'p':
+            shell_ctx.page_size = atoi(optarg);
+            break;
         case 'v':
             verbosity++;
             break;
         case 'h':
-            printf("Usage: chidb [-c COMMAND] [DATABASE]\n");
+            printf("Usage: chidb [-c COMMAND] [-p PAGE_SIZE] [DATABASE]\n");
             exit(0);
         default:
             printf("ERROR: Unknown option -%c\n", opt);
@@ -8,13 +8,18 @@ void chidb_shell_init_ctx(chidb_shell_ctx_t *ctx)
 
     ctx->header = false;
     ctx->mode = MODE_LIST;
+    ctx->timer = false;
+    ctx->profile = false;
+
+    ctx->page_size = 0;
+    ctx->open_flags = 0;
 }
 
 int chidb_shell_open_db(chidb_shell_ctx_t *ctx, char *file)
 {
     int rc;
 
-    rc = chidb_open(file, &ctx->db);
+    rc = chidb_open2(file, &ctx->db, ctx->page_size, ctx->open_flags);
 
     if (rc != CHIDB_OK)
         return 1;
@@ -17,6 +17,15 @@ typedef struct chidb_shell_ctx
     bool header;
     shell_mode_t mode;
 
+    /* Print the time each statement takes (.timer), and where it
+     * goes (.profile) */
+    bool timer;
+    bool profile;
+
+    /* Used when opening a database (see chidb_open2) */
+    unsigned int page_size;
+    int open_flags;
+
 } chidb_shell_ctx_t;
 
 void chidb_shell_init_ctx(chidb_shell_ctx_t *ctx);
@@ -0,0 +1,606 @@
+/*****************************************************************************
+ *
+ *																 chidb
+ *
+ * Micro-benchmarks of the pager, the B-Tree, records and the DBM.
+ *
+ * Run with "make bench". Each benchmark prints one line with four
+ * tab-separated fields: the name of the benchmark, its parameter, the
+ * number of operations timed, and the nanoseconds per operation:
+ *
+ *   btree_find	depth=2	100000	412.7
+ *
+ * Lines starting with # are comments. A benchmark whose setup fails
+ * prints a comment instead of a result, so a failing benchmark does not
+ * hide the others. If arguments are given, only the benchmarks whose
+ * name contains one of them are run.
+ *
+ * The dbm_program lines (one per DBM program, see
+ * chidb_dbm_file_bench_print) have more fields after these four. With
+ * "-b BASELINE", where BASELINE is the saved output of an earlier run,
+ * each of them is followed by a dbm_baseline line comparing the two
+ * (see chidb_dbm_file_bench_compare).
+ *
+ * The timings are not checked against anything: the point is to keep
+ * the output of each release and compare it with the previous one.
+ *
+\*****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <chidb/chidb.h>
+#include <chidb/log.h>
+#include "libchidb/btree.h"
+#include "libchidb/record.h"
+#include "libchidb/dbm.h"
+#include "libchidb/dbm-file.h"
+#include "libchidb/util.h"
+
+#ifndef TEST_DIR
+#define TEST_DIR "./tests/"
+#endif
+
+#define DATABASES_DIR TEST_DIR "files/databases/"
+#define GENERATED_DIR TEST_DIR "files/generated/"
+#define DBM_PROGRAMS_DIR TEST_DIR "files/dbm-programs/"
+
+#define BENCH_LARGE_DB "1table-largebtree.cdb"
+#define BENCH_PAGE_SIZE (1024)
+
+#define PAGER_READS (1000000)
+#define FIND_LOOKUPS (100000)
+#define INSERT_KEYS (20000)
+#define RECORD_OPS (200000)
+#define DBM_RUNS (20)
+
+// From libchidb/util.c
+FILE *copy(const char *from, const char *to);
+
+static int nfilters;
+static char **filters;
+static const char *baseline;
+
+
+static bool bench_selected(const char *name)
+{
+    if (nfilters == 0)
+        return true;
+
+    for (int i = 0; i < nfilters; i++)
+        if (strstr(name, filters[i]))
+            return true;
+
+    return false;
+}
+
+static void bench_report(const char *name, const char *param, uint64_t n, uint64_t ns)
+{
+    printf("%s\t%s\t%lu\t%.1f\n", name, param, (unsigned long) n, n ? (double) ns / n : 0.0);
+    fflush(stdout);
+}
+
+static void bench_skip(const char *name, const char *param, const char *why)
+{
+    printf("# %s\t%s\tskipped: %s\n", name, param, why);
+    fflush(stdout);
+}
+
+/* Deterministic keys for the random benchmarks (xorshift) */
+static uint32_t bench_random(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *state = x;
+}
+
+/* Shuffle keys 1..n */
+static chidb_key_t *bench_shuffled(uint32_t n, uint32_t seed)
+{
+    chidb_key_t *keys = malloc(n * sizeof(chidb_key_t));
+
+    for (uint32_t i = 0; i < n; i++)
+        keys[i] = i + 1;
+
+    for (uint32_t i = n - 1; i > 0; i--)
+    {
+        uint32_t j = bench_random(&seed) % (i + 1);
+        chidb_key_t k = keys[i];
+        keys[i] = keys[j];
+        keys[j] = k;
+    }
+
+    return keys;
+}
+
+/* A fresh copy of a database in the generated files directory */
+static char *bench_copy(const char *src, const char *dst)
+{
+    char *srcfile = malloc(strlen(DATABASES_DIR) + strlen(src) + 1);
+    char *dstfile = malloc(strlen(GENERATED_DIR) + strlen(dst) + 1);
+    FILE *f;
+
+    sprintf(srcfile, "%s%s", DATABASES_DIR, src);
+    sprintf(dstfile, "%s%s", GENERATED_DIR, dst);
+
+    remove(dstfile);
+    f = copy(srcfile, dstfile);
+    free(srcfile);
+
+    if (f == NULL)
+    {
+        free(dstfile);
+        return NULL;
+    }
+
+    return dstfile;
+}
+
+static char *bench_new_file(const char *name)
+{
+    char *fname = malloc(strlen(GENERATED_DIR) + strlen(name) + 1);
+
+    sprintf(fname, "%s%s", GENERATED_DIR, name);
+    remove(fname);
+
+    return fname;
+}
+
+
+/*
+ * Pager
+ */
+
+/* Reads every page of the file in turn. Hot: the buffer pool holds the
+ * whole file, so only the first pass misses (and is not timed). Cold: the
+ * pool has a single frame, so every read goes to the file (which is
+ * likely in the OS page cache, so this measures the pager, not the disk). */
+static void bench_pager(bool hot)
+{
+    const char *name = "pager_readPage";
+    const char *param = hot ? "hot" : "cold";
+    Pager *pager;
+    MemPage *page;
+    uint64_t start, ns;
+    char *fname;
+    npage_t npages;
+
+    if (!bench_selected(name))
+        return;
+
+    fname = bench_copy(BENCH_LARGE_DB, "bench-pager.cdb");
+    if (fname == NULL || chidb_Pager_open(&pager, fname) != CHIDB_OK)
+    {
+        bench_skip(name, param, "could not open " BENCH_LARGE_DB);
+        free(fname);
+        return;
+    }
+
+    chidb_Pager_setPageSize(pager, BENCH_PAGE_SIZE);
+    chidb_Pager_setCacheSize(pager, hot ? pager->n_pages : 1);
+    npages = pager->n_pages;
+
+    for (npage_t p = 1; p <= npages; p++)
+        if (chidb_Pager_readPage(pager, p, &page) == CHIDB_OK)
+            chidb_Pager_releaseMemPage(pager, page);
+
+    start = chidb_time_ns();
+    for (uint32_t i = 0; i < PAGER_READS; i++)
+    {
+        if (chidb_Pager_readPage(pager, 1 + i % npages, &page) != CHIDB_OK)
+        {
+            bench_skip(name, param, "read failed");
+            goto out;
+        }
+        chidb_Pager_releaseMemPage(pager, page);
+    }
+    ns = chidb_time_ns() - start;
+
+    bench_report(name, param, PAGER_READS, ns);
+
+out:
+    chidb_Pager_close(pager);
+    remove(fname);
+    free(fname);
+}
+
+
+/*
+ * B-Tree
+ */
+
+static int bench_btree_open(const char *fname, chidb **db)
+{
+    *db = calloc(1, sizeof(chidb));
+
+    if (chidb_Btree_open(fname, *db, &(*db)->bt) != CHIDB_OK)
+    {
+        free(*db);
+        return CHIDB_ECANTOPEN;
+    }
+
+    return CHIDB_OK;
+}
+
+static void bench_btree_close(chidb *db, char *fname)
+{
+    chidb_Btree_close(db->bt);
+    free(db);
+    remove(fname);
+    free(fname);
+}
+
+static int bench_btree_depth(BTree *bt, npage_t nroot)
+{
+    BTreeNode *btn;
+    int depth = 0;
+
+    while (chidb_Btree_getNodeByPage(bt, nroot, &btn) == CHIDB_OK)
+    {
+        depth++;
+        nroot = btn->right_page;
+        bool leaf = btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF;
+        chidb_Btree_freeMemNode(bt, btn);
+        if (leaf)
+            break;
+    }
+
+    return depth;
+}
+
+/* Table B-Trees of increasing size, so that the lookups go through
+ * one, two and three levels of nodes (with 1K pages and 32-byte rows) */
+static void bench_btree_find()
+{
+    const char *name = "btree_find";
+    static const uint32_t sizes[] = {20, 2000, 100000};
+    uint8_t data[32];
+    char param[32];
+
+    if (!bench_selected(name))
+        return;
+
+    memset(data, 'x', sizeof(data));
+
+    for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        uint32_t nkeys = sizes[s];
+        uint32_t seed = 0x2545F491;
+        chidb *db;
+        uint64_t start, ns;
+        char *fname = bench_new_file("bench-find.cdb");
+
+        sprintf(param, "keys=%u", nkeys);
+        if (bench_btree_open(fname, &db) != CHIDB_OK)
+        {
+            bench_skip(name, param, "could not create B-Tree");
+            free(fname);
+            continue;
+        }
+
+        for (uint32_t k = 1; k <= nkeys; k++)
+            chidb_Btree_insertInTable(db->bt, 1, k, data, sizeof(data));
+
+        sprintf(param, "depth=%i", bench_btree_depth(db->bt, 1));
+
+        start = chidb_time_ns();
+        for (uint32_t i = 0; i < FIND_LOOKUPS; i++)
+        {
+            uint8_t *found;
+            uint16_t size;
+
+            if (chidb_Btree_find(db->bt, 1, 1 + bench_random(&seed) % nkeys, &found, &size) != CHIDB_OK)
+            {
+                bench_skip(name, param, "key not found");
+                goto next;
+            }
+            free(found);
+        }
+        ns = chidb_time_ns() - start;
+
+        bench_report(name, param, FIND_LOOKUPS, ns);
+
+next:
+        bench_btree_close(db, fname);
+    }
+}
+
+static void bench_btree_insert(bool sequential)
+{
+    const char *name = "btree_insertInTable";
+    const char *param = sequential ? "sequential" : "random";
+    chidb_key_t *keys = bench_shuffled(INSERT_KEYS, 0x9E3779B9);
+    uint8_t data[32];
+    chidb *db;
+    uint64_t start, ns;
+    char *fname;
+
+    if (!bench_selected(name))
+    {
+        free(keys);
+        return;
+    }
+
+    if (sequential)
+        for (uint32_t i = 0; i < INSERT_KEYS; i++)
+            keys[i] = i + 1;
+
+    memset(data, 'x', sizeof(data));
+
+    fname = bench_new_file("bench-insert.cdb");
+    if (bench_btree_open(fname, &db) != CHIDB_OK)
+    {
+        bench_skip(name, param, "could not create B-Tree");
+        free(fname);
+        free(keys);
+        return;
+    }
+
+    start = chidb_time_ns();
+    for (uint32_t i = 0; i < INSERT_KEYS; i++)
+        if (chidb_Btree_insertInTable(db->bt, 1, keys[i], data, sizeof(data)) != CHIDB_OK)
+        {
+            bench_skip(name, param, "insertion failed");
+            goto out;
+        }
+    ns = chidb_time_ns() - start;
+
+    bench_report(name, param, INSERT_KEYS, ns);
+
+out:
+    bench_btree_close(db, fname);
+    free(keys);
+}
+
+
+/*
+ * Records
+ */
+
+/* A record with nfields fields, cycling through the field types */
+static DBRecord *bench_record(uint8_t nfields)
+{
+    DBRecordBuffer dbrb;
+    DBRecord *dbr;
+
+    chidb_DBRecord_create_empty(&dbrb, nfields);
+    for (uint8_t i = 0; i < nfields; i++)
+        switch (i % 4)
+        {
+        case 0:
+            chidb_DBRecord_appendInt32(&dbrb, 100000 + i);
+            break;
+        case 1:
+            chidb_DBRecord_appendString(&dbrb, "cromulent");
+            break;
+        case 2:
+            chidb_DBRecord_appendInt16(&dbrb, 1000 + i);
+            break;
+        default:
+            chidb_DBRecord_appendNull(&dbrb);
+            break;
+        }
+    chidb_DBRecord_finalize(&dbrb, &dbr);
+
+    return dbr;
+}
+
+static void bench_dbrecord()
+{
+    static const uint8_t nfields[] = {1, 4, 16, 64};
+    char param[32];
+
+    for (int f = 0; f < sizeof(nfields) / sizeof(nfields[0]); f++)
+    {
+        DBRecord *dbr = bench_record(nfields[f]);
+        uint8_t *buf;
+        uint64_t start, ns;
+
+        sprintf(param, "fields=%u", nfields[f]);
+
+        if (bench_selected("dbrecord_pack"))
+        {
+            start = chidb_time_ns();
+            for (uint32_t i = 0; i < RECORD_OPS; i++)
+            {
+                chidb_DBRecord_pack(dbr, &buf);
+                free(buf);
+            }
+            ns = chidb_time_ns() - start;
+            bench_report("dbrecord_pack", param, RECORD_OPS, ns);
+        }
+
+        if (bench_selected("dbrecord_unpack"))
+        {
+            chidb_DBRecord_pack(dbr, &buf);
+
+            start = chidb_time_ns();
+            for (uint32_t i = 0; i < RECORD_OPS; i++)
+            {
+                DBRecord *unpacked;
+                chidb_DBRecord_unpack(&unpacked, buf);
+                chidb_DBRecord_destroy(unpacked);
+            }
+            ns = chidb_time_ns() - start;
+            bench_report("dbrecord_unpack", param, RECORD_OPS, ns);
+
+            free(buf);
+        }
+
+        chidb_DBRecord_destroy(dbr);
+    }
+}
+
+
+/*
+ * DBM
+ */
+
+/* Runs every program of a suite (a subdirectory of the DBM programs
+ * directory) DBM_RUNS times in the interpreter, and reports the time per
+ * instruction. Loading a program (which copies its database) is not
+ * timed. */
+static void bench_dbm_suite(const char *suite)
+{
+    const char *name = "dbm_dispatch";
+    char *dirname = malloc(strlen(DBM_PROGRAMS_DIR) + strlen(suite) + 2);
+    uint64_t ninstr = 0, ns = 0;
+    struct dirent *ent;
+    DIR *dir;
+
+    sprintf(dirname, "%s%s/", DBM_PROGRAMS_DIR, suite);
+
+    dir = opendir(dirname);
+    if (dir == NULL)
+    {
+        free(dirname);
+        return;
+    }
+
+    while ((ent = readdir(dir)) != NULL)
+    {
+        char *fname;
+
+        if (ent->d_type != DT_REG)
+            continue;
+
+        fname = malloc(strlen(dirname) + strlen(ent->d_name) + 1);
+        sprintf(fname, "%s%s", dirname, ent->d_name);
+
+        for (int run = 0; run < DBM_RUNS; run++)
+        {
+            chidb_dbm_file_t *dbmf;
+            uint64_t start;
+            int rc;
+
+            if (chidb_dbm_file_load2(fname, &dbmf, DATABASES_DIR, GENERATED_DIR, true) != CHIDB_OK)
+                break;
+
+            dbmf->stmt.compile = DBM_COMPILE_NEVER;
+
+            start = chidb_time_ns();
+            do
+                rc = chidb_dbm_file_run(dbmf);
+            while (rc == CHIDB_ROW);
+            ns += chidb_time_ns() - start;
+            ninstr += dbmf->stmt.ninstr;
+
+            chidb_dbm_file_close(dbmf);
+        }
+
+        free(fname);
+    }
+
+    closedir(dir);
+    free(dirname);
+
+    if (ninstr == 0)
+        bench_skip(name, suite, "no instructions run");
+    else
+        bench_report(name, suite, ninstr, ns);
+}
+
+/* Times every program of a suite with chidb_dbm_file_bench */
+static void bench_dbm_programs(const char *suite)
+{
+    char *dirname = malloc(strlen(DBM_PROGRAMS_DIR) + strlen(suite) + 2);
+    struct dirent *ent;
+    DIR *dir;
+
+    sprintf(dirname, "%s%s/", DBM_PROGRAMS_DIR, suite);
+
+    dir = opendir(dirname);
+    if (dir == NULL)
+    {
+        free(dirname);
+        return;
+    }
+
+    while ((ent = readdir(dir)) != NULL)
+    {
+        chidb_dbm_file_bench_t bench;
+        char *fname;
+
+        if (ent->d_type != DT_REG)
+            continue;
+
+        fname = malloc(strlen(dirname) + strlen(ent->d_name) + 1);
+        sprintf(fname, "%s%s", dirname, ent->d_name);
+
+        if (chidb_dbm_file_bench(fname, DATABASES_DIR, GENERATED_DIR, DBM_RUNS, &bench) != CHIDB_OK)
+            bench_skip("dbm_program", ent->d_name, "could not run");
+        else
+        {
+            chidb_dbm_file_bench_print(stdout, &bench);
+            if (baseline != NULL && chidb_dbm_file_bench_compare(stdout, baseline, &bench, 0.1) == CHIDB_EIO)
+                bench_skip("dbm_baseline", ent->d_name, "could not read the baseline");
+            fflush(stdout);
+            chidb_dbm_file_bench_free(&bench);
+        }
+
+        free(fname);
+    }
+
+    closedir(dir);
+    free(dirname);
+}
+
+static void bench_dbm()
+{
+    struct dirent *ent;
+    DIR *dir;
+
+    if (!bench_selected("dbm_dispatch") && !bench_selected("dbm_program"))
+        return;
+
+    dir = opendir(DBM_PROGRAMS_DIR);
+    if (dir == NULL)
+    {
+        bench_skip("dbm", "-", "no DBM programs directory");
+        return;
+    }
+
+    while ((ent = readdir(dir)) != NULL)
+        if (ent->d_type == DT_DIR && strcmp(ent->d_name, ".") && strcmp(ent->d_name, ".."))
+        {
+            if (bench_selected("dbm_dispatch"))
+                bench_dbm_suite(ent->d_name);
+            if (bench_selected("dbm_program"))
+                bench_dbm_programs(ent->d_name);
+        }
+
+    closedir(dir);
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 3 && !strcmp(argv[1], "-b"))
+    {
+        baseline = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+
+    nfilters = argc - 1;
+    filters = argv + 1;
+
+    chilog_setloglevel(CRITICAL);
+
+    printf("# benchmark\tparameter\toperations\tns/op\n");
+
+    bench_pager(true);
+    bench_pager(false);
+    bench_btree_find();
+    bench_btree_insert(true);
+    bench_btree_insert(false);
+    bench_dbrecord();
+    bench_dbm();
+
+    return 0;
+}
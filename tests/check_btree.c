@@ -15,6 +15,20 @@ Suite* make_btree_suite (void)
     suite_add_tcase (s, make_btree_6_tc());
     suite_add_tcase (s, make_btree_7_tc());
     suite_add_tcase (s, make_btree_8_tc());
+    suite_add_tcase (s, make_btree_freelist_tc());
+    suite_add_tcase (s, make_btree_bulkload_tc());
+    suite_add_tcase (s, make_btree_linkedleaves_tc());
+    suite_add_tcase (s, make_btree_delete_tc());
+    suite_add_tcase (s, make_btree_overflow_tc());
+    suite_add_tcase (s, make_btree_packedindex_tc());
+    suite_add_tcase (s, make_btree_concurrent_tc());
+    suite_add_tcase (s, make_btree_append_tc());
+    suite_add_tcase (s, make_btree_recordv2_tc());
+    suite_add_tcase (s, make_btree_batch_tc());
+    suite_add_tcase (s, make_btree_cursor_tc());
+    suite_add_tcase (s, make_btree_hashindex_tc());
+    suite_add_tcase (s, make_btree_bloom_tc());
+    suite_add_tcase (s, make_btree_normkey_tc());
 
     return s;
 }
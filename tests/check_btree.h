@@ -27,6 +27,20 @@ TCase* make_btree_5_tc(void);
 TCase* make_btree_6_tc(void);
 TCase* make_btree_7_tc(void);
 TCase* make_btree_8_tc(void);
+TCase* make_btree_freelist_tc(void);
+TCase* make_btree_bulkload_tc(void);
+TCase* make_btree_linkedleaves_tc(void);
+TCase* make_btree_delete_tc(void);
+TCase* make_btree_overflow_tc(void);
+TCase* make_btree_packedindex_tc(void);
+TCase* make_btree_concurrent_tc(void);
+TCase* make_btree_append_tc(void);
+TCase* make_btree_recordv2_tc(void);
+TCase* make_btree_batch_tc(void);
+TCase* make_btree_cursor_tc(void);
+TCase* make_btree_hashindex_tc(void);
+TCase* make_btree_bloom_tc(void);
+TCase* make_btree_normkey_tc(void);
 
 
 
@@ -48,6 +62,10 @@ void test_values(BTree *bt, chidb_key_t *keys, char **values, chidb_key_t nkeys)
 
 void insert_bigfile(chidb *db, int i);
 
+/* Inserts a row with a single INTEGER (or TEXT) column into a table */
+void insert_row(BTree *bt, npage_t nroot, chidb_key_t key, int32_t value);
+void insert_row_text(BTree *bt, npage_t nroot, chidb_key_t key, char *value);
+
 void test_bigfile(chidb *db);
 
 int chidb_Btree_findInIndex(BTree *bt, npage_t nroot, chidb_key_t ikey, chidb_key_t *pkey);
@@ -140,6 +140,45 @@ START_TEST (test_4_4)
 END_TEST
 
 
+START_TEST (test_4_5)
+{
+    chidb *db;
+    BTreeNode *btn;
+    BTreeCell btc;
+    ncell_t ncell, expected;
+    int rc;
+
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-4-5.dat");
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open(fname, db, &db->bt);
+
+    /* Page 1 is an internal node, page 5 is a leaf node */
+    for(npage_t npage = 1; npage <= 5; npage += 4)
+    {
+        chidb_Btree_getNodeByPage(db->bt, npage, &btn);
+        for(chidb_key_t key = 0; key < 1000; key++)
+        {
+            for(expected = 0; expected < btn->n_cells; expected++)
+            {
+                chidb_Btree_getCell(btn, expected, &btc);
+                if(btc.key >= key)
+                    break;
+            }
+
+            rc = chidb_Btree_nodeSearch(btn, key, &ncell);
+            ck_assert_int_eq(ncell, expected);
+            ck_assert(rc == ((expected < btn->n_cells && btc.key == key) ? CHIDB_OK : CHIDB_ENOTFOUND));
+        }
+        chidb_Btree_freeMemNode(db->bt, btn);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
 TCase* make_btree_4_tc(void)
 {
     TCase *tc = tcase_create ("Step 4: Manipulating B-Tree cells");
@@ -147,6 +186,7 @@ TCase* make_btree_4_tc(void)
     tcase_add_test (tc, test_4_2);
     tcase_add_test (tc, test_4_3);
     tcase_add_test (tc, test_4_4);
+    tcase_add_test (tc, test_4_5);
 
     return tc;
 }
@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define APPEND_NKEYS (4000)
+
+static uint8_t append_data[40];
+
+/* Inserts keys 1..APPEND_NKEYS (in increasing order, or scrambled), and
+ * returns the number of pages in the file */
+static npage_t append_build(const char *fname, bool ordered, chidb **db, npage_t *nroot)
+{
+    *db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, *db, &(*db)->bt) == CHIDB_OK);
+    chidb_Btree_newNode((*db)->bt, nroot, PGTYPE_TABLE_LEAF);
+
+    for(int i = 0; i < APPEND_NKEYS; i++)
+    {
+        chidb_key_t key = ordered ? i + 1 : (i * 7919) % APPEND_NKEYS + 1;
+
+        ck_assert(chidb_Btree_insertInTable((*db)->bt, *nroot, key, append_data, sizeof(append_data)) == CHIDB_OK);
+    }
+
+    return (*db)->bt->pager->n_pages;
+}
+
+static void append_close(const char *fname, chidb *db)
+{
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+
+
+/* Appends fill their leaves, instead of leaving them half empty */
+START_TEST (test_append_1)
+{
+    chidb *db;
+    npage_t nroot, npages, npages_ordered;
+    uint8_t *data;
+    uint32_t size;
+
+    char *fname = create_tmp_file();
+    npages = append_build(fname, false, &db, &nroot);
+    append_close(fname, db);
+
+    fname = create_tmp_file();
+    npages_ordered = append_build(fname, true, &db, &nroot);
+    ck_assert(npages_ordered < npages * 3 / 4);
+    ck_assert_int_eq(db->bt->append_root, nroot);
+    bt_sanity_check(db->bt, nroot);
+
+    for(chidb_key_t key = 1; key <= APPEND_NKEYS; key++)
+    {
+        ck_assert(chidb_Btree_find2(db->bt, nroot, key, &data, &size) == CHIDB_OK);
+        ck_assert_int_eq(size, sizeof(append_data));
+        free(data);
+    }
+
+    append_close(fname, db);
+}
+END_TEST
+
+
+/* Keys that are not appends, and deletes, still go through the regular path */
+START_TEST (test_append_2)
+{
+    chidb *db;
+    npage_t nroot;
+    uint8_t *data;
+    uint32_t size;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+
+    for(chidb_key_t key = 2; key <= 2 * APPEND_NKEYS; key += 2)
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, key, append_data, sizeof(append_data)) == CHIDB_OK);
+    ck_assert(chidb_Btree_insertInTable(db->bt, nroot, 2 * APPEND_NKEYS, append_data, 1) == CHIDB_EDUPLICATE);
+    for(chidb_key_t key = 1; key <= 2 * APPEND_NKEYS; key += 2)
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, key, append_data, sizeof(append_data)) == CHIDB_OK);
+
+    ck_assert(chidb_Btree_delete(db->bt, nroot, 2 * APPEND_NKEYS) == CHIDB_OK);
+    ck_assert_int_eq(db->bt->append_root, 0);
+    for(chidb_key_t key = 2 * APPEND_NKEYS; key <= 3 * APPEND_NKEYS; key++)
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, key, append_data, sizeof(append_data)) == CHIDB_OK);
+
+    bt_sanity_check(db->bt, nroot);
+    for(chidb_key_t key = 1; key <= 3 * APPEND_NKEYS; key++)
+    {
+        ck_assert(chidb_Btree_find2(db->bt, nroot, key, &data, &size) == CHIDB_OK);
+        free(data);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_append_tc(void)
+{
+    TCase *tc = tcase_create ("Rightmost appends");
+    tcase_add_test (tc, test_append_1);
+    tcase_add_test (tc, test_append_2);
+
+    return tc;
+}
@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/record.h"
+#include "libchidb/dbm-batch.h"
+#include "libchidb/columnar.h"
+
+#define BATCH_NKEYS (5000)
+#define COLUMNAR_NCOLS (5)
+
+/* Row of the test table: (key, "foo", x, y), where every seventh x is NULL */
+static void batch_row(chidb_key_t key, bool *xnull, int32_t *x, int32_t *y)
+{
+    *xnull = key % 7 == 0;
+    *x = (key % 2) ? key * 1000 : -(int32_t) key;
+    *y = key % 10;
+}
+
+static npage_t batch_create_table(BTree *bt, bool v2)
+{
+    npage_t nroot;
+
+    chidb_Btree_newNode(bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(chidb_key_t key = 1; key <= BATCH_NKEYS; key++)
+    {
+        DBRecordBuffer dbrb;
+        DBRecord *dbr;
+        uint8_t *data;
+        uint32_t len;
+        bool xnull;
+        int32_t x, y;
+
+        batch_row(key, &xnull, &x, &y);
+        chidb_DBRecord_create_empty(&dbrb, 3);
+        chidb_DBRecord_appendString(&dbrb, "foo");
+        if (xnull)
+            chidb_DBRecord_appendNull(&dbrb);
+        else
+            chidb_DBRecord_appendInt32(&dbrb, x);
+        chidb_DBRecord_appendInt8(&dbrb, y);
+        chidb_DBRecord_finalize(&dbrb, &dbr);
+        if (v2)
+            ck_assert(chidb_DBRecord_packV2(dbr, &data, &len, NULL) == CHIDB_OK);
+        else
+        {
+            ck_assert(chidb_DBRecord_pack(dbr, &data) == CHIDB_OK);
+            len = dbr->packed_len;
+        }
+        ck_assert(chidb_Btree_insertInTable(bt, nroot, key, data, len) == CHIDB_OK);
+        chidb_DBRecord_destroy(dbr);
+        free(data);
+    }
+
+    return nroot;
+}
+
+/* SELECT COUNT(x), SUM(x), MIN(x), MAX(x) FROM t WHERE y > 5, a batch
+ * at a time, gives the same result as going through the rows one at
+ * a time */
+static void batch_check_aggregate(bool v2)
+{
+    chidb *db;
+    npage_t nroot;
+    chidb_dbm_scan_t scan;
+    chidb_dbm_batch_t *batch;
+    chidb_dbm_aggregate_t agg;
+    uint8_t cols[] = {1, 2};
+    uint32_t nbatches = 0, count = 0;
+    int64_t sum = 0;
+    int32_t min = INT32_MAX, max = INT32_MIN;
+    chidb_key_t prev = 0;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open2(fname, db, &db->bt, DEFAULT_PAGE_SIZE, v2 ? BTREE_RECORDV2 : 0) == CHIDB_OK);
+    nroot = batch_create_table(db->bt, v2);
+
+    batch = malloc(sizeof(chidb_dbm_batch_t));
+    ck_assert(chidb_dbm_scan_init(&scan, db->bt, nroot, cols, 2) == CHIDB_OK);
+    chidb_dbm_aggregate_init(&agg);
+    while (chidb_dbm_scan_next(&scan, batch) == CHIDB_OK)
+    {
+        nbatches++;
+        ck_assert(batch->n == DBM_BATCH_SIZE || nbatches == (BATCH_NKEYS + DBM_BATCH_SIZE - 1) / DBM_BATCH_SIZE);
+        for(uint32_t i = 0; i < batch->n; i++)
+        {
+            ck_assert_int_eq(batch->keys[i], prev + 1);
+            prev = batch->keys[i];
+        }
+
+        ck_assert(chidb_dbm_batch_filter(batch, 1, Op_Gt, 5) == CHIDB_OK);
+        chidb_dbm_batch_aggregate(batch, 0, &agg);
+    }
+    ck_assert_int_eq(prev, BATCH_NKEYS);
+    ck_assert_int_eq(nbatches, (BATCH_NKEYS + DBM_BATCH_SIZE - 1) / DBM_BATCH_SIZE);
+    ck_assert(chidb_dbm_scan_next(&scan, batch) == CHIDB_DONE);
+    chidb_dbm_scan_free(&scan);
+
+    for(chidb_key_t key = 1; key <= BATCH_NKEYS; key++)
+    {
+        bool xnull;
+        int32_t x, y;
+
+        batch_row(key, &xnull, &x, &y);
+        if (xnull || y <= 5)
+            continue;
+        count++;
+        sum += x;
+        min = x < min ? x : min;
+        max = x > max ? x : max;
+    }
+    ck_assert_int_eq(agg.count, count);
+    ck_assert(agg.sum == sum);
+    ck_assert_int_eq(agg.min, min);
+    ck_assert_int_eq(agg.max, max);
+
+    free(batch);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+
+START_TEST (test_batch_1)
+{
+    batch_check_aggregate(false);
+    batch_check_aggregate(true);
+}
+END_TEST
+
+
+/* Filters narrow down the selection, NULLs never match, and projections
+ * return the selected values in key order */
+START_TEST (test_batch_2)
+{
+    chidb *db;
+    npage_t nroot;
+    chidb_dbm_scan_t scan;
+    chidb_dbm_batch_t *batch;
+    int32_t *out;
+    uint8_t cols[] = {2, 1};
+    uint32_t n;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    nroot = batch_create_table(db->bt, false);
+
+    batch = malloc(sizeof(chidb_dbm_batch_t));
+    out = malloc(DBM_BATCH_SIZE * sizeof(int32_t));
+    ck_assert(chidb_dbm_scan_init(&scan, db->bt, nroot, cols, 2) == CHIDB_OK);
+    ck_assert(chidb_dbm_scan_next(&scan, batch) == CHIDB_OK);
+
+    /* y = 3 AND x <> 0: every tenth row, minus those where x is NULL */
+    ck_assert(chidb_dbm_batch_filter(batch, 0, Op_Eq, 3) == CHIDB_OK);
+    ck_assert_int_eq(batch->nsel, DBM_BATCH_SIZE / 10 + 1);
+    ck_assert(chidb_dbm_batch_filter(batch, 1, Op_Ne, 0) == CHIDB_OK);
+    n = chidb_dbm_batch_project(batch, 1, out);
+    ck_assert_int_eq(n, batch->nsel);
+    for(uint32_t i = 0, j = 0; i < DBM_BATCH_SIZE; i++)
+    {
+        bool xnull;
+        int32_t x, y;
+
+        batch_row(batch->keys[i], &xnull, &x, &y);
+        if (y != 3 || xnull)
+            continue;
+        ck_assert(j < n);
+        ck_assert_int_eq(out[j++], x);
+    }
+
+    ck_assert(chidb_dbm_batch_filter(batch, 0, Op_Next, 3) == CHIDB_EMISUSE);
+    chidb_dbm_scan_free(&scan);
+
+    /* Strings can't be read into vectors, and neither can columns
+     * that don't exist */
+    cols[0] = 0;
+    ck_assert(chidb_dbm_scan_init(&scan, db->bt, nroot, cols, 1) == CHIDB_OK);
+    ck_assert(chidb_dbm_scan_next(&scan, batch) == CHIDB_EMISMATCH);
+    chidb_dbm_scan_free(&scan);
+    cols[0] = 3;
+    ck_assert(chidb_dbm_scan_init(&scan, db->bt, nroot, cols, 1) == CHIDB_OK);
+    ck_assert(chidb_dbm_scan_next(&scan, batch) == CHIDB_EMISUSE);
+    chidb_dbm_scan_free(&scan);
+
+    free(out);
+    free(batch);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Row i of the columnar test table: (i, y, z, w, x), with y in long
+ * runs, z one of five values, w in a small range, x anything, and
+ * every seventh x NULL */
+static void columnar_row(uint32_t i, int32_t *values, bool *nulls)
+{
+    values[0] = i;
+    values[1] = i / 300;
+    values[2] = (i * 7919) % 5 * 1000 - 2000;
+    values[3] = 100000 + (i * 31) % 1000;
+    values[4] = (int32_t) (i * 2654435761u);
+    for (int c = 0; c < COLUMNAR_NCOLS; c++)
+        nulls[c] = c == 4 && i % 7 == 0;
+}
+
+/* A columnar table gives back the rows written to it, each column with
+ * the smallest encoding, and its zone maps skip the segments that
+ * can't match a filter */
+START_TEST (test_batch_3)
+{
+    chidb *db;
+    npage_t nroot;
+    chidb_columnar_writer_t w;
+    chidb_columnar_zone_t zone;
+    chidb_dbm_scan_t scan;
+    chidb_dbm_batch_t *batch;
+    int32_t values[COLUMNAR_NCOLS];
+    bool nulls[COLUMNAR_NCOLS];
+    uint8_t cols[] = {3, 4};
+    uint8_t encodings[] = {COLUMNAR_FOR, COLUMNAR_RLE, COLUMNAR_DICT, COLUMNAR_FOR, COLUMNAR_PLAIN};
+    uint32_t nsegments, nrows = 0, nsel = 0;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+
+    /* Four full segments and a partial one, and then a sixth segment
+     * from a second writer */
+    ck_assert(chidb_columnar_writer_init(&w, db->bt, nroot, COLUMNAR_NCOLS) == CHIDB_OK);
+    for (uint32_t i = 0; i < BATCH_NKEYS; i++)
+    {
+        columnar_row(i, values, nulls);
+        ck_assert(chidb_columnar_append(&w, values, nulls) == CHIDB_OK);
+    }
+    ck_assert(chidb_columnar_writer_finish(&w) == CHIDB_OK);
+    ck_assert(chidb_columnar_writer_init(&w, db->bt, nroot, COLUMNAR_NCOLS) == CHIDB_OK);
+    for (uint32_t i = BATCH_NKEYS; i < BATCH_NKEYS + 10; i++)
+    {
+        columnar_row(i, values, nulls);
+        ck_assert(chidb_columnar_append(&w, values, nulls) == CHIDB_OK);
+    }
+    ck_assert(chidb_columnar_writer_finish(&w) == CHIDB_OK);
+    ck_assert(chidb_columnar_segments(db->bt, nroot, &nsegments) == CHIDB_OK);
+    ck_assert_int_eq(nsegments, 6);
+
+    for (uint8_t c = 0; c < COLUMNAR_NCOLS; c++)
+    {
+        ck_assert(chidb_columnar_zone(db->bt, nroot, 0, c, &zone) == CHIDB_OK);
+        ck_assert_int_eq(zone.encoding, encodings[c]);
+        ck_assert_int_eq(zone.nrows, DBM_BATCH_SIZE);
+    }
+    ck_assert_int_eq(zone.nnulls, (DBM_BATCH_SIZE + 6) / 7);
+    ck_assert(chidb_columnar_zone(db->bt, nroot, 0, COLUMNAR_NCOLS, &zone) == CHIDB_ENOTFOUND);
+
+    /* Every row, with only w and x read */
+    batch = malloc(sizeof(chidb_dbm_batch_t));
+    ck_assert(chidb_dbm_scan_initColumnar(&scan, db->bt, nroot, cols, 2) == CHIDB_OK);
+    while (chidb_dbm_scan_next(&scan, batch) == CHIDB_OK)
+    {
+        for (uint32_t i = 0; i < batch->n; i++, nrows++)
+        {
+            columnar_row(nrows, values, nulls);
+            ck_assert_int_eq(batch->keys[i], nrows);
+            ck_assert_int_eq(batch->vectors[0].values[i], values[3]);
+            ck_assert_int_eq(batch->vectors[1].nulls[i], nulls[4]);
+            ck_assert_int_eq(batch->vectors[1].values[i], nulls[4] ? 0 : values[4]);
+        }
+    }
+    ck_assert_int_eq(nrows, BATCH_NKEYS + 10);
+    chidb_dbm_scan_free(&scan);
+
+    /* y = 10 is only in rows 3000-3299, in the third and fourth
+     * segments */
+    cols[0] = 1;
+    ck_assert(chidb_dbm_scan_initColumnar(&scan, db->bt, nroot, cols, 1) == CHIDB_OK);
+    ck_assert(chidb_dbm_scan_prune(&scan, 1, Op_Eq, 10) == CHIDB_EMISUSE);
+    ck_assert(chidb_dbm_scan_prune(&scan, 0, Op_Eq, 10) == CHIDB_OK);
+    while (chidb_dbm_scan_next(&scan, batch) == CHIDB_OK)
+    {
+        ck_assert(chidb_dbm_batch_filter(batch, 0, Op_Eq, 10) == CHIDB_OK);
+        nsel += batch->nsel;
+    }
+    ck_assert_int_eq(nsel, 300);
+    ck_assert_int_eq(scan.nskipped, 4);
+    chidb_dbm_scan_free(&scan);
+
+    /* Columns that don't exist */
+    cols[0] = COLUMNAR_NCOLS;
+    ck_assert(chidb_dbm_scan_initColumnar(&scan, db->bt, nroot, cols, 1) == CHIDB_OK);
+    ck_assert(chidb_dbm_scan_next(&scan, batch) == CHIDB_EMISUSE);
+    chidb_dbm_scan_free(&scan);
+
+    free(batch);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_batch_tc(void)
+{
+    TCase *tc = tcase_create ("Batch scans");
+    tcase_add_test (tc, test_batch_1);
+    tcase_add_test (tc, test_batch_2);
+    tcase_add_test (tc, test_batch_3);
+
+    return tc;
+}
@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/bloom.h"
+#include "libchidb/hashindex.h"
+#include "libchidb/record.h"
+
+#define BLOOM_NKEYS (5000)
+
+/* Keys from first to first + n - 1 that a filter says may be in a B-Tree */
+static uint32_t bloom_count_maybe(BTree *bt, npage_t nroot, chidb_key_t first, uint32_t n)
+{
+    uint32_t count = 0;
+    bool maybe;
+
+    for(chidb_key_t k = first; k < first + n; k++)
+    {
+        ck_assert(chidb_bloom_lookup(bt, nroot, k, &maybe) == CHIDB_OK);
+        count += maybe;
+    }
+
+    return count;
+}
+
+
+/* A filter in memory has no false negatives, and few false positives */
+START_TEST (test_bloom_1)
+{
+    chidb_bloom_t bf;
+    uint32_t fp = 0;
+
+    ck_assert(chidb_bloom_init(&bf, chidb_bloom_nblocks(BLOOM_NKEYS)) == CHIDB_OK);
+    for(uint32_t i = 0; i < BLOOM_NKEYS; i++)
+        chidb_bloom_add(&bf, chidb_bloom_hash(2 * i));
+
+    for(uint32_t i = 0; i < BLOOM_NKEYS; i++)
+    {
+        ck_assert(chidb_bloom_test(&bf, chidb_bloom_hash(2 * i)));
+        fp += chidb_bloom_test(&bf, chidb_bloom_hash(2 * i + 1));
+    }
+    ck_assert(fp < BLOOM_NKEYS / 20);
+
+    chidb_bloom_free(&bf);
+    ck_assert(chidb_bloom_test(&bf, chidb_bloom_hash(1)));
+}
+END_TEST
+
+
+/* The filter of a table has all of its keys, including those inserted
+ * after it was built, and rules out most others */
+START_TEST (test_bloom_2)
+{
+    chidb *db;
+    npage_t nroot;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(chidb_key_t i = 1; i <= BLOOM_NKEYS; i++)
+        insert_row(db->bt, nroot, i, i);
+
+    /* Without a filter, every key may be there */
+    ck_assert_int_eq(bloom_count_maybe(db->bt, nroot, BLOOM_NKEYS + 1, BLOOM_NKEYS), BLOOM_NKEYS);
+
+    ck_assert(chidb_bloom_build(db->bt, nroot) == CHIDB_OK);
+    ck_assert_int_eq(bloom_count_maybe(db->bt, nroot, 1, BLOOM_NKEYS), BLOOM_NKEYS);
+    ck_assert(bloom_count_maybe(db->bt, nroot, BLOOM_NKEYS + 1, BLOOM_NKEYS) < BLOOM_NKEYS / 20);
+
+    for(chidb_key_t i = BLOOM_NKEYS + 1; i <= BLOOM_NKEYS + 100; i++)
+        insert_row(db->bt, nroot, i, i);
+    ck_assert_int_eq(bloom_count_maybe(db->bt, nroot, 1, BLOOM_NKEYS + 100), BLOOM_NKEYS + 100);
+
+    ck_assert(chidb_bloom_drop(db->bt, nroot) == CHIDB_OK);
+    ck_assert_int_eq(bloom_count_maybe(db->bt, nroot, 2 * BLOOM_NKEYS, 100), 100);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Filters of several B-Trees are kept apart, building one again frees
+ * the pages of the old one, and a page that is not the root of a
+ * B-Tree can't have one */
+START_TEST (test_bloom_3)
+{
+    chidb *db;
+    npage_t table_root, index_root, hash_root;
+    MemPage *header;
+    uint32_t nfree;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &table_root, PGTYPE_TABLE_LEAF);
+    chidb_Btree_newNode(db->bt, &index_root, PGTYPE_INDEX_LEAF);
+    for(chidb_key_t i = 1; i <= BLOOM_NKEYS; i++)
+    {
+        insert_row(db->bt, table_root, i, 3 * i);
+        ck_assert(chidb_Btree_insertInIndex(db->bt, index_root, 3 * i, i) == CHIDB_OK);
+    }
+
+    ck_assert(chidb_bloom_build(db->bt, table_root) == CHIDB_OK);
+    ck_assert(chidb_bloom_build(db->bt, index_root) == CHIDB_OK);
+    ck_assert_int_eq(bloom_count_maybe(db->bt, table_root, 1, BLOOM_NKEYS), BLOOM_NKEYS);
+    for(chidb_key_t i = 1; i <= BLOOM_NKEYS; i++)
+    {
+        bool maybe;
+
+        ck_assert(chidb_bloom_lookup(db->bt, index_root, 3 * i, &maybe) == CHIDB_OK);
+        ck_assert(maybe);
+    }
+
+    ck_assert(chidb_Pager_readPage(db->bt->pager, 1, &header) == CHIDB_OK);
+    nfree = get4byte(header->data + HEADER_FREELIST_COUNT_OFFSET);
+    chidb_Pager_releaseMemPage(db->bt->pager, header);
+
+    ck_assert(chidb_bloom_build(db->bt, table_root) == CHIDB_OK);
+    ck_assert(chidb_Pager_readPage(db->bt->pager, 1, &header) == CHIDB_OK);
+    ck_assert_int_eq(get4byte(header->data + HEADER_FREELIST_COUNT_OFFSET), nfree);
+    chidb_Pager_releaseMemPage(db->bt->pager, header);
+
+    ck_assert(chidb_bloom_drop(db->bt, table_root) == CHIDB_OK);
+    ck_assert(bloom_count_maybe(db->bt, index_root, 3 * BLOOM_NKEYS + 1, BLOOM_NKEYS) < BLOOM_NKEYS / 20);
+
+    ck_assert(chidb_hashindex_create(db->bt, &hash_root) == CHIDB_OK);
+    ck_assert(chidb_bloom_build(db->bt, hash_root) == CHIDB_EMISUSE);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_bloom_tc(void)
+{
+    TCase *tc = tcase_create ("Bloom filters");
+    tcase_add_test (tc, test_bloom_1);
+    tcase_add_test (tc, test_bloom_2);
+    tcase_add_test (tc, test_bloom_3);
+
+    return tc;
+}
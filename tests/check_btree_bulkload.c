@@ -0,0 +1,327 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/record.h"
+
+#define BULKLOAD_NROWS (5000)
+
+/* Returns rows with keys 3, 6, 9, ... and a record with (key, -key) */
+struct bulkload_rows
+{
+    chidb_key_t i, n;
+    uint8_t *data;
+};
+
+static int bulkload_next(BTreeIterator *it, BTreeCell *cell)
+{
+    struct bulkload_rows *rows = it->arg;
+    DBRecordBuffer dbrb;
+    DBRecord *dbr;
+
+    if (rows->i == rows->n)
+        return CHIDB_EEMPTY;
+    rows->i++;
+
+    free(rows->data);
+    chidb_DBRecord_create_empty(&dbrb, 2);
+    chidb_DBRecord_appendInt32(&dbrb, rows->i * 3);
+    chidb_DBRecord_appendInt32(&dbrb, -rows->i * 3);
+    chidb_DBRecord_finalize(&dbrb, &dbr);
+    chidb_DBRecord_pack(dbr, &rows->data);
+
+    cell->key = rows->i * 3;
+    cell->fields.tableLeaf.data = rows->data;
+    cell->fields.tableLeaf.data_size = dbr->packed_len;
+    chidb_DBRecord_destroy(dbr);
+
+    return CHIDB_OK;
+}
+
+static void bulkload_check_table(BTree *bt, npage_t nroot, chidb_key_t n)
+{
+    uint8_t *data;
+    uint16_t size;
+    DBRecord *dbr;
+    int32_t v;
+
+    for(chidb_key_t key = 1; key <= 3 * n + 1; key++)
+    {
+        int rc = chidb_Btree_find(bt, nroot, key, &data, &size);
+
+        if (key % 3)
+        {
+            ck_assert(rc == CHIDB_ENOTFOUND);
+            continue;
+        }
+        ck_assert(rc == CHIDB_OK);
+        chidb_DBRecord_unpack(&dbr, data);
+        chidb_DBRecord_getInt32(dbr, 1, &v);
+        ck_assert_int_eq(v, -(int32_t) key);
+        chidb_DBRecord_destroy(dbr);
+        free(data);
+    }
+}
+
+/* Checks that an index has exactly the given (keyIdx, keyPk) pairs, in order */
+static void bulkload_check_index(BTree *bt, npage_t npage, chidb_key_t *keys, chidb_key_t *pks, chidb_key_t *next)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+
+    chidb_Btree_getNodeByPage(bt, npage, &btn);
+    for(ncell_t i = 0; i < btn->n_cells; i++)
+    {
+        chidb_Btree_getCell(btn, i, &btc);
+        if (btn->type == PGTYPE_INDEX_INTERNAL)
+        {
+            bulkload_check_index(bt, btc.fields.indexInternal.child_page, keys, pks, next);
+            ck_assert_int_eq(btc.key, keys[*next]);
+            ck_assert_int_eq(btc.fields.indexInternal.keyPk, pks[*next]);
+        }
+        else
+        {
+            ck_assert_int_eq(btc.key, keys[*next]);
+            ck_assert_int_eq(btc.fields.indexLeaf.keyPk, pks[*next]);
+        }
+        (*next)++;
+    }
+    if (btn->type == PGTYPE_INDEX_INTERNAL)
+        bulkload_check_index(bt, btn->right_page, keys, pks, next);
+    chidb_Btree_freeMemNode(bt, btn);
+}
+
+
+START_TEST (test_bulkload_1)
+{
+    chidb *db;
+    struct bulkload_rows rows = {0, BULKLOAD_NROWS, NULL};
+    BTreeIterator it = {bulkload_next, &rows};
+    npage_t npages_full, npages_half;
+    int rc;
+
+    /* Loading into the schema table, whose root has less space */
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open(fname, db, &db->bt);
+    rc = chidb_Btree_bulkLoad(db->bt, 1, &it, 100);
+    ck_assert(rc == CHIDB_OK);
+    bulkload_check_table(db->bt, 1, BULKLOAD_NROWS);
+
+    /* The tree can still be modified as usual */
+    rc = chidb_Btree_insertInTable(db->bt, 1, 4, rows.data, 11);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Btree_insertInTable(db->bt, 1, 3, rows.data, 11);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+    npages_full = db->bt->pager->n_pages;
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+
+    /* A lower fill factor needs more pages */
+    fname = create_tmp_file();
+    chidb_Btree_open(fname, db, &db->bt);
+    rows.i = 0;
+    rc = chidb_Btree_bulkLoad(db->bt, 1, &it, 50);
+    ck_assert(rc == CHIDB_OK);
+    bulkload_check_table(db->bt, 1, BULKLOAD_NROWS);
+    npages_half = db->bt->pager->n_pages;
+    ck_assert(npages_half > npages_full * 3 / 2);
+
+    /* The tree is no longer empty */
+    rows.i = 0;
+    rc = chidb_Btree_bulkLoad(db->bt, 1, &it, 50);
+    ck_assert(rc == CHIDB_EMISUSE);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(rows.data);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_bulkload_2)
+{
+    chidb *db;
+    struct bulkload_rows rows = {0, 1, NULL};
+    BTreeIterator it = {bulkload_next, &rows};
+    npage_t nroot, npage, npages;
+    int rc;
+
+    /* A single row ends up in the root, and its leaf is freed */
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open(fname, db, &db->bt);
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    rc = chidb_Btree_bulkLoad(db->bt, nroot, &it, BTREE_DEFAULT_FILLFACTOR);
+    ck_assert(rc == CHIDB_OK);
+    bulkload_check_table(db->bt, nroot, 1);
+    npages = db->bt->pager->n_pages;
+    chidb_Btree_allocatePage(db->bt, &npage);
+    ck_assert_int_eq(npage, nroot + 1);
+    ck_assert_int_eq(db->bt->pager->n_pages, npages);
+
+    /* No rows at all don't need any page */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    npages = db->bt->pager->n_pages;
+    rows.i = rows.n = 0;
+    rc = chidb_Btree_bulkLoad(db->bt, nroot, &it, BTREE_DEFAULT_FILLFACTOR);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(db->bt->pager->n_pages, npages);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(rows.data);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_bulkload_3)
+{
+    chidb *db;
+    chidb_key_t *keys, *pks, next;
+    npage_t nindex;
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open(fname, db, &db->bt);
+
+    /* Rows inserted in the usual way */
+    keys = malloc(BULKLOAD_NROWS * sizeof(chidb_key_t));
+    pks = malloc(BULKLOAD_NROWS * sizeof(chidb_key_t));
+    for(int i = 0; i < BULKLOAD_NROWS; i++)
+    {
+        DBRecord *dbr;
+        uint8_t *data;
+        chidb_key_t pk = (i * 7919) % BULKLOAD_NROWS + 1;
+
+        chidb_DBRecord_create(&dbr, "i4i4", pk, 2 * pk + 1);
+        chidb_DBRecord_pack(dbr, &data);
+        rc = chidb_Btree_insertInTable(db->bt, 1, pk, data, dbr->packed_len);
+        ck_assert(rc == CHIDB_OK);
+        chidb_DBRecord_destroy(dbr);
+        free(data);
+    }
+    for(int i = 0; i < BULKLOAD_NROWS; i++)
+    {
+        pks[i] = i + 1;
+        keys[i] = 2 * (i + 1) + 1;
+    }
+
+    /* Read and sorted on one thread, or merged from the runs of several */
+    for(uint32_t nthreads = 1; nthreads <= 4; nthreads += 3)
+    {
+        chidb_Btree_newNode(db->bt, &nindex, PGTYPE_INDEX_LEAF);
+        rc = chidb_Btree_buildIndex(db->bt, 1, nindex, 1, nthreads);
+        ck_assert(rc == CHIDB_OK);
+        next = 0;
+        bulkload_check_index(db->bt, nindex, keys, pks, &next);
+        ck_assert_int_eq(next, BULKLOAD_NROWS);
+    }
+
+    /* Column 1 is unique, but two rows with the same value can't be indexed */
+    chidb_Btree_insertInTable(db->bt, 1, BULKLOAD_NROWS + 1, (uint8_t *) "\x03\x04\x04\x00\x00\x00\x00\x00\x00\x00\x03", 11);
+    chidb_Btree_newNode(db->bt, &nindex, PGTYPE_INDEX_LEAF);
+    rc = chidb_Btree_buildIndex(db->bt, 1, nindex, 1, 0);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(keys);
+    free(pks);
+    free(db);
+}
+END_TEST
+
+
+/* A covering index has the primary key and the included columns of
+ * every row, so lookups on the index don't need the table */
+START_TEST (test_bulkload_4)
+{
+    chidb *db;
+    npage_t ntable, nindex;
+    uint8_t include[] = {2, 0};
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open(fname, db, &db->bt);
+
+    /* Rows (pk, 2 * pk + 1, "row pk") */
+    chidb_Btree_newNode(db->bt, &ntable, PGTYPE_TABLE_LEAF);
+    for(int i = 0; i < BULKLOAD_NROWS; i++)
+    {
+        DBRecordBuffer dbrb;
+        DBRecord *dbr;
+        uint8_t *data;
+        char str[32];
+        chidb_key_t pk = (i * 7919) % BULKLOAD_NROWS + 1;
+
+        sprintf(str, "row %u", pk);
+        chidb_DBRecord_create_empty(&dbrb, 3);
+        chidb_DBRecord_appendInt32(&dbrb, pk);
+        chidb_DBRecord_appendInt32(&dbrb, 2 * pk + 1);
+        chidb_DBRecord_appendString(&dbrb, str);
+        chidb_DBRecord_finalize(&dbrb, &dbr);
+        chidb_DBRecord_pack(dbr, &data);
+        ck_assert(chidb_Btree_insertInTable(db->bt, ntable, pk, data, dbr->packed_len) == CHIDB_OK);
+        chidb_DBRecord_destroy(dbr);
+        free(data);
+    }
+
+    /* CREATE INDEX ... ON t (column 1) INCLUDE (column 2, column 0) */
+    chidb_Btree_newNode(db->bt, &nindex, PGTYPE_TABLE_LEAF);
+    rc = chidb_Btree_buildCoveringIndex(db->bt, ntable, nindex, 1, include, 2, 0);
+    ck_assert(rc == CHIDB_OK);
+
+    for(chidb_key_t pk = 1; pk <= BULKLOAD_NROWS; pk++)
+    {
+        DBRecordView view;
+        uint8_t *data;
+        uint32_t size;
+        const char *s;
+        int32_t v;
+        int len;
+        char str[32];
+
+        ck_assert(chidb_Btree_find2(db->bt, nindex, 2 * pk + 1, &data, &size) == CHIDB_OK);
+        ck_assert(chidb_DBRecordView_init(&view, data) == CHIDB_OK);
+        ck_assert_int_eq(chidb_DBRecordView_nfields(&view), 3);
+        chidb_DBRecordView_getInt32(&view, 0, &v);
+        ck_assert_int_eq(v, pk);
+        sprintf(str, "row %u", pk);
+        ck_assert(chidb_DBRecordView_getString(&view, 1, &s, &len) == CHIDB_OK);
+        ck_assert_int_eq(len, strlen(str));
+        ck_assert(!strncmp(s, str, len));
+        chidb_DBRecordView_getInt32(&view, 2, &v);
+        ck_assert_int_eq(v, pk);
+        free(data);
+    }
+    bt_sanity_check(db->bt, nindex);
+
+    /* Included columns must exist */
+    include[1] = 3;
+    chidb_Btree_newNode(db->bt, &nindex, PGTYPE_TABLE_LEAF);
+    rc = chidb_Btree_buildCoveringIndex(db->bt, ntable, nindex, 1, include, 2, 0);
+    ck_assert(rc == CHIDB_EMISUSE);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_bulkload_tc(void)
+{
+    TCase *tc = tcase_create ("Bulk-loading a B-Tree");
+    tcase_add_test (tc, test_bulkload_1);
+    tcase_add_test (tc, test_bulkload_2);
+    tcase_add_test (tc, test_bulkload_3);
+    tcase_add_test (tc, test_bulkload_4);
+
+    return tc;
+}
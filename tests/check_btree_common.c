@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <check.h>
 #include "check_btree.h"
+#include "libchidb/record.h"
 
 
 void btn_sanity_check(BTree *bt, BTreeNode *btn, bool empty)
@@ -114,6 +115,38 @@ void insert_bigfile(chidb *db, int i)
 
 }
 
+/* Inserts a row with a single column, an integer or a string, into a
+ * table. The record is always packed in format v1. */
+static void insert_record(BTree *bt, npage_t nroot, chidb_key_t key, DBRecordBuffer *dbrb)
+{
+    DBRecord *dbr;
+    uint8_t *data;
+
+    chidb_DBRecord_finalize(dbrb, &dbr);
+    ck_assert(chidb_DBRecord_pack(dbr, &data) == CHIDB_OK);
+    ck_assert(chidb_Btree_insertInTable(bt, nroot, key, data, dbr->packed_len) == CHIDB_OK);
+    chidb_DBRecord_destroy(dbr);
+    free(data);
+}
+
+void insert_row(BTree *bt, npage_t nroot, chidb_key_t key, int32_t value)
+{
+    DBRecordBuffer dbrb;
+
+    chidb_DBRecord_create_empty(&dbrb, 1);
+    chidb_DBRecord_appendInt32(&dbrb, value);
+    insert_record(bt, nroot, key, &dbrb);
+}
+
+void insert_row_text(BTree *bt, npage_t nroot, chidb_key_t key, char *value)
+{
+    DBRecordBuffer dbrb;
+
+    chidb_DBRecord_create_empty(&dbrb, 1);
+    chidb_DBRecord_appendString(&dbrb, value);
+    insert_record(bt, nroot, key, &dbrb);
+}
+
 void test_bigfile(chidb *db)
 {
     int rc;
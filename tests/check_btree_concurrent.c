@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define CONCURRENT_NTHREADS (4)
+#define CONCURRENT_NKEYS (2000)
+
+struct concurrent_arg
+{
+    BTree *bt;
+    npage_t nroot;
+    int nthread;
+    int nerrors;
+};
+
+/* Keys of a thread, interleaved with those of the other threads */
+static chidb_key_t concurrent_key(int nthread, int i)
+{
+    return i * CONCURRENT_NTHREADS + nthread + 1;
+}
+
+static void *concurrent_insert(void *p)
+{
+    struct concurrent_arg *arg = p;
+    uint8_t data[32];
+
+    for(int i = 0; i < CONCURRENT_NKEYS; i++)
+    {
+        chidb_key_t key = concurrent_key(arg->nthread, i);
+
+        memset(data, key & 0xFF, sizeof(data));
+        if (chidb_Btree_insertInTable(arg->bt, arg->nroot, key, data, sizeof(data)) != CHIDB_OK)
+            arg->nerrors++;
+    }
+
+    return NULL;
+}
+
+static void *concurrent_find(void *p)
+{
+    struct concurrent_arg *arg = p;
+    BTreeNode *btn;
+    uint8_t *data;
+    uint16_t size;
+
+    for(int i = 0; i < CONCURRENT_NKEYS; i++)
+    {
+        chidb_key_t key = concurrent_key(arg->nthread, i);
+
+        if (chidb_Btree_findRef(arg->bt, arg->nroot, key, &btn, &data, &size) != CHIDB_OK)
+        {
+            arg->nerrors++;
+            continue;
+        }
+        if (size != 32 || data[0] != (key & 0xFF))
+            arg->nerrors++;
+        chidb_Btree_releaseNode(arg->bt, btn);
+    }
+
+    return NULL;
+}
+
+static void concurrent_run(BTree *bt, npage_t nroot, void *(*fn)(void *))
+{
+    pthread_t threads[CONCURRENT_NTHREADS];
+    struct concurrent_arg args[CONCURRENT_NTHREADS];
+
+    for(int i = 0; i < CONCURRENT_NTHREADS; i++)
+    {
+        args[i].bt = bt;
+        args[i].nroot = nroot;
+        args[i].nthread = i;
+        args[i].nerrors = 0;
+        ck_assert(pthread_create(&threads[i], NULL, fn, &args[i]) == 0);
+    }
+    for(int i = 0; i < CONCURRENT_NTHREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        ck_assert_int_eq(args[i].nerrors, 0);
+    }
+}
+
+
+/* Several threads inserting into the same table, and then looking up
+ * its entries, end up with a well-formed tree with all the entries */
+START_TEST (test_concurrent_1)
+{
+    chidb *db;
+    npage_t nroot;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+
+    concurrent_run(db->bt, nroot, concurrent_insert);
+    bt_sanity_check(db->bt, nroot);
+    concurrent_run(db->bt, nroot, concurrent_find);
+
+    ck_assert(chidb_Btree_insertInTable(db->bt, nroot, concurrent_key(0, 0), NULL, 0) == CHIDB_EDUPLICATE);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* A node that is latched in exclusive mode can't be latched again
+ * until it is released, but shared latches can be held at once */
+START_TEST (test_concurrent_2)
+{
+    chidb *db;
+    npage_t nroot;
+    BTreeNode *btn1, *btn2;
+    BTreeCell btc;
+    MemPage *page;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+
+    ck_assert(chidb_Btree_getNodeLatched(db->bt, nroot, BTREE_LATCH_SHARED, &btn1) == CHIDB_OK);
+    ck_assert(chidb_Btree_getNodeLatched(db->bt, nroot, BTREE_LATCH_SHARED, &btn2) == CHIDB_OK);
+    ck_assert_int_eq(btn1->latch, BTREE_LATCH_SHARED);
+    ck_assert(btn1->page == btn2->page);
+    ck_assert(pthread_rwlock_trywrlock(&btn1->page->latch) != 0);
+    chidb_Btree_releaseNode(db->bt, btn1);
+    chidb_Btree_releaseNode(db->bt, btn2);
+
+    ck_assert(chidb_Btree_getNodeLatched(db->bt, nroot, BTREE_LATCH_EXCLUSIVE, &btn1) == CHIDB_OK);
+    page = btn1->page;
+    ck_assert(pthread_rwlock_tryrdlock(&page->latch) != 0);
+    chidb_Btree_releaseNode(db->bt, btn1);
+    ck_assert(pthread_rwlock_trywrlock(&page->latch) == 0);
+    pthread_rwlock_unlock(&page->latch);
+
+    /* Only leaves that can't take another cell are full */
+    ck_assert(chidb_Btree_getNodeByPage(db->bt, nroot, &btn1) == CHIDB_OK);
+    btc.type = PGTYPE_TABLE_LEAF;
+    btc.key = 1;
+    btc.fields.tableLeaf.data_size = 16;
+    ck_assert(!chidb_Btree_nodeFull(db->bt, btn1, &btc));
+    btn1->cells_offset = btn1->free_offset + 16;
+    ck_assert(chidb_Btree_nodeFull(db->bt, btn1, &btc));
+    chidb_Btree_freeMemNode(db->bt, btn1);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+static void *concurrent_find2(void *p)
+{
+    struct concurrent_arg *arg = p;
+    uint8_t *data;
+    uint32_t size;
+
+    for(int i = 0; i < CONCURRENT_NKEYS; i++)
+    {
+        chidb_key_t key = concurrent_key(0, i);
+
+        if (chidb_Btree_find2(arg->bt, arg->nroot, key, &data, &size) != CHIDB_OK)
+        {
+            arg->nerrors++;
+            continue;
+        }
+        if (size != 32 || data[31] != (key & 0xFF))
+            arg->nerrors++;
+        free(data);
+    }
+
+    return NULL;
+}
+
+/* Lookups that don't latch find every entry inserted before them, even
+ * while other threads are splitting nodes */
+START_TEST (test_concurrent_3)
+{
+    chidb *db;
+    npage_t nroot;
+    pthread_t readers[CONCURRENT_NTHREADS], writer;
+    struct concurrent_arg rargs[CONCURRENT_NTHREADS], warg;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+
+    /* Thread 0's keys are in the tree before the readers start */
+    warg.bt = db->bt;
+    warg.nroot = nroot;
+    warg.nthread = 0;
+    warg.nerrors = 0;
+    concurrent_insert(&warg);
+
+    warg.nthread = 1;
+    ck_assert(pthread_create(&writer, NULL, concurrent_insert, &warg) == 0);
+    for(int i = 0; i < CONCURRENT_NTHREADS; i++)
+    {
+        rargs[i] = warg;
+        ck_assert(pthread_create(&readers[i], NULL, concurrent_find2, &rargs[i]) == 0);
+    }
+    pthread_join(writer, NULL);
+    ck_assert_int_eq(warg.nerrors, 0);
+    for(int i = 0; i < CONCURRENT_NTHREADS; i++)
+    {
+        pthread_join(readers[i], NULL);
+        ck_assert_int_eq(rargs[i].nerrors, 0);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Exclusive latches change the version of a page */
+START_TEST (test_concurrent_4)
+{
+    chidb *db;
+    npage_t nroot;
+    BTreeNode *btn;
+    MemPage *page;
+    uint32_t version;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+
+    ck_assert(chidb_Pager_readPage(db->bt->pager, nroot, &page) == CHIDB_OK);
+    version = chidb_Pager_pageVersion(page);
+    ck_assert(chidb_Pager_validatePage(page, version));
+
+    /* Shared latches don't */
+    ck_assert(chidb_Btree_getNodeLatched(db->bt, nroot, BTREE_LATCH_SHARED, &btn) == CHIDB_OK);
+    chidb_Btree_releaseNode(db->bt, btn);
+    ck_assert(chidb_Pager_validatePage(page, version));
+
+    ck_assert(chidb_Btree_getNodeLatched(db->bt, nroot, BTREE_LATCH_EXCLUSIVE, &btn) == CHIDB_OK);
+    ck_assert(!chidb_Pager_validatePage(page, version));
+    ck_assert(chidb_Pager_pageVersion(page) & 1);
+    ck_assert(!chidb_Pager_validatePage(page, chidb_Pager_pageVersion(page)));
+    chidb_Btree_releaseNode(db->bt, btn);
+    ck_assert(!chidb_Pager_validatePage(page, version));
+    ck_assert_int_eq(chidb_Pager_pageVersion(page), version + 2);
+    chidb_Pager_releaseMemPage(db->bt->pager, page);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_concurrent_tc(void)
+{
+    TCase *tc = tcase_create ("Concurrent access");
+    tcase_add_test (tc, test_concurrent_1);
+    tcase_add_test (tc, test_concurrent_2);
+    tcase_add_test (tc, test_concurrent_3);
+    tcase_add_test (tc, test_concurrent_4);
+
+    return tc;
+}
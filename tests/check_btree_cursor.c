@@ -0,0 +1,357 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+#include "libchidb/record.h"
+#include "libchidb/zonemap.h"
+
+#define CURSOR_NKEYS (3000)
+
+/* Keys in the test trees are the even numbers 2..2*CURSOR_NKEYS */
+static npage_t cursor_create_tree(BTree *bt, bool index)
+{
+    npage_t nroot;
+    uint8_t data[64] = {0};
+
+    chidb_Btree_newNode(bt, &nroot, index ? PGTYPE_INDEX_LEAF : PGTYPE_TABLE_LEAF);
+    for(chidb_key_t i = 1; i <= CURSOR_NKEYS; i++)
+    {
+        /* Out of order, so that nodes are split everywhere */
+        chidb_key_t key = 2 * (((i * 7919) % CURSOR_NKEYS) + 1);
+
+        if (index)
+            ck_assert(chidb_Btree_insertInIndex(bt, nroot, key, key + 1) == CHIDB_OK);
+        else
+            ck_assert(chidb_Btree_insertInTable(bt, nroot, key, data, sizeof(data)) == CHIDB_OK);
+    }
+
+    return nroot;
+}
+
+/* Going forwards and backwards through the tree visits every key, in
+ * order, and seeks land on the right entry */
+static void cursor_check(bool index)
+{
+    chidb *db;
+    npage_t nroot;
+    chidb_dbm_cursor_t c;
+    chidb_key_t key;
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    nroot = cursor_create_tree(db->bt, index);
+
+    ck_assert(chidb_dbm_cursor_open(&c, CURSOR_READ, db->bt, nroot) == CHIDB_OK);
+    ck_assert(c.index == index);
+
+    key = 0;
+    for(rc = chidb_dbm_cursor_rewind(&c); rc == CHIDB_OK; rc = chidb_dbm_cursor_next(&c))
+    {
+        ck_assert_int_eq(c.cell.key, key + 2);
+        key = c.cell.key;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_eq(key, 2 * CURSOR_NKEYS);
+    ck_assert(c.depth > 1);
+
+    for(rc = chidb_dbm_cursor_last(&c); rc == CHIDB_OK; rc = chidb_dbm_cursor_prev(&c))
+    {
+        ck_assert_int_eq(c.cell.key, key);
+        key -= 2;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_eq(key, 0);
+
+    for(key = 1; key <= 2 * CURSOR_NKEYS + 1; key++)
+    {
+        bool even = key % 2 == 0;
+
+        rc = chidb_dbm_cursor_seek(&c, key, CURSOR_SEEK_EQ);
+        ck_assert_int_eq(rc, even ? CHIDB_OK : CHIDB_DONE);
+        if (even)
+            ck_assert_int_eq(c.cell.key, key);
+
+        rc = chidb_dbm_cursor_seek(&c, key, CURSOR_SEEK_GE);
+        if (key > 2 * CURSOR_NKEYS)
+            ck_assert_int_eq(rc, CHIDB_DONE);
+        else
+            ck_assert_int_eq(c.cell.key, even ? key : key + 1);
+
+        rc = chidb_dbm_cursor_seek(&c, key, CURSOR_SEEK_GT);
+        if (key >= 2 * CURSOR_NKEYS)
+            ck_assert_int_eq(rc, CHIDB_DONE);
+        else
+            ck_assert_int_eq(c.cell.key, even ? key + 2 : key + 1);
+
+        rc = chidb_dbm_cursor_seek(&c, key, CURSOR_SEEK_LE);
+        if (key < 2)
+            ck_assert_int_eq(rc, CHIDB_DONE);
+        else
+            ck_assert_int_eq(c.cell.key, even ? key : key - 1);
+
+        rc = chidb_dbm_cursor_seek(&c, key, CURSOR_SEEK_LT);
+        if (key <= 2)
+            ck_assert_int_eq(rc, CHIDB_DONE);
+        else
+            ck_assert_int_eq(c.cell.key, even ? key - 2 : key - 1);
+    }
+
+    /* A cursor can keep going after a seek */
+    ck_assert(chidb_dbm_cursor_seek(&c, 1001, CURSOR_SEEK_GE) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_next(&c) == CHIDB_OK);
+    ck_assert_int_eq(c.cell.key, 1004);
+    ck_assert(chidb_dbm_cursor_prev(&c) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_prev(&c) == CHIDB_OK);
+    ck_assert_int_eq(c.cell.key, 1000);
+
+    ck_assert(chidb_dbm_cursor_close(&c) == CHIDB_OK);
+    ck_assert_int_eq(c.depth, 0);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+
+START_TEST (test_cursor_1)
+{
+    cursor_check(false);
+}
+END_TEST
+
+START_TEST (test_cursor_2)
+{
+    cursor_check(true);
+}
+END_TEST
+
+
+/* Seeking to a key near the one the cursor is on reuses its path: the
+ * nodes above the leaf are not loaded again */
+START_TEST (test_cursor_3)
+{
+    chidb *db;
+    npage_t nroot;
+    chidb_dbm_cursor_t c;
+    BTreeNode *root, *leaf;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    nroot = cursor_create_tree(db->bt, false);
+
+    ck_assert(chidb_dbm_cursor_open(&c, CURSOR_READ, db->bt, nroot) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_seek(&c, 1000, CURSOR_SEEK_EQ) == CHIDB_OK);
+    root = c.path[0].btn;
+    leaf = c.path[c.depth - 1].btn;
+    ck_assert(chidb_dbm_cursor_seek(&c, 1000, CURSOR_SEEK_EQ) == CHIDB_OK);
+    ck_assert(c.path[0].btn == root);
+    ck_assert(c.path[c.depth - 1].btn == leaf);
+    ck_assert(chidb_dbm_cursor_seek(&c, 4000, CURSOR_SEEK_EQ) == CHIDB_OK);
+    ck_assert(c.path[0].btn == root);
+    ck_assert_int_eq(c.cell.key, 4000);
+
+    /* Once released, the path is loaded again */
+    chidb_dbm_cursor_release(&c);
+    ck_assert_int_eq(c.depth, 0);
+    ck_assert(!c.valid);
+    ck_assert(chidb_dbm_cursor_seek(&c, 1000, CURSOR_SEEK_EQ) == CHIDB_OK);
+    ck_assert_int_eq(c.cell.key, 1000);
+
+    ck_assert(chidb_dbm_cursor_close(&c) == CHIDB_OK);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Inserting keys in order through a write cursor fills the gaps in the
+ * tree, and keys that fall in the pinned leaf don't reload the path */
+START_TEST (test_cursor_4)
+{
+    chidb *db;
+    npage_t nroot;
+    chidb_dbm_cursor_t c;
+    BTreeNode *root;
+    BTreeCell cell;
+    uint8_t data[64] = {0};
+    chidb_key_t key;
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    nroot = cursor_create_tree(db->bt, false);
+
+    ck_assert(chidb_dbm_cursor_open(&c, CURSOR_READ, db->bt, nroot) == CHIDB_OK);
+    cell.type = PGTYPE_TABLE_LEAF;
+    cell.key = 1;
+    cell.fields.tableLeaf.data_size = sizeof(data);
+    cell.fields.tableLeaf.data = data;
+    cell.fields.tableLeaf.overflow_page = 0;
+    ck_assert(chidb_dbm_cursor_insert(&c, &cell) == CHIDB_EMISUSE);
+    ck_assert(chidb_dbm_cursor_close(&c) == CHIDB_OK);
+
+    ck_assert(chidb_dbm_cursor_open(&c, CURSOR_WRITE, db->bt, nroot) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_insert(&c, &cell) == CHIDB_OK);
+    root = c.path[0].btn;
+    cell.key = 3;
+    ck_assert(chidb_dbm_cursor_insert(&c, &cell) == CHIDB_OK);
+    ck_assert(c.path[0].btn == root);
+    for(key = 5; key < 2 * CURSOR_NKEYS; key += 2)
+    {
+        cell.key = key;
+        ck_assert(chidb_dbm_cursor_insert(&c, &cell) == CHIDB_OK);
+    }
+    cell.key = 1000;
+    ck_assert(chidb_dbm_cursor_insert(&c, &cell) == CHIDB_EDUPLICATE);
+
+    key = 0;
+    for(rc = chidb_dbm_cursor_rewind(&c); rc == CHIDB_OK; rc = chidb_dbm_cursor_next(&c))
+        ck_assert_int_eq(c.cell.key, ++key);
+    ck_assert_int_eq(key, 2 * CURSOR_NKEYS);
+
+    ck_assert(chidb_dbm_cursor_close(&c) == CHIDB_OK);
+    bt_sanity_check(db->bt, nroot);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* The number of entries, and the smallest and largest keys, of table
+ * and index trees come from their edges and cell counts alone */
+START_TEST (test_cursor_5)
+{
+    chidb *db;
+    npage_t nroot, nempty;
+    chidb_key_t key;
+    uint64_t n;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+
+    for(int index = 0; index < 2; index++)
+    {
+        nroot = cursor_create_tree(db->bt, index);
+        ck_assert(chidb_Btree_count(db->bt, nroot, &n) == CHIDB_OK);
+        ck_assert_int_eq(n, CURSOR_NKEYS);
+        ck_assert(chidb_Btree_firstKey(db->bt, nroot, &key) == CHIDB_OK);
+        ck_assert_int_eq(key, 2);
+        ck_assert(chidb_Btree_lastKey(db->bt, nroot, &key) == CHIDB_OK);
+        ck_assert_int_eq(key, 2 * CURSOR_NKEYS);
+
+        chidb_Btree_newNode(db->bt, &nempty, index ? PGTYPE_INDEX_LEAF : PGTYPE_TABLE_LEAF);
+        ck_assert(chidb_Btree_count(db->bt, nempty, &n) == CHIDB_OK);
+        ck_assert_int_eq(n, 0);
+        ck_assert(chidb_Btree_firstKey(db->bt, nempty, &key) == CHIDB_ENOTFOUND);
+        ck_assert(chidb_Btree_lastKey(db->bt, nempty, &key) == CHIDB_ENOTFOUND);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Counts the rows with ts >= 20000 that a cursor filtered with the zone
+ * map of ts visits, and the rows it visits in all */
+static void cursor_scan_ts(chidb_dbm_cursor_t *c, chidb_zonemap_t *zm, uint32_t *nmatch, uint32_t *nrows)
+{
+    DBRecordView view;
+    int32_t ts, min, max;
+    int rc;
+
+    ck_assert(chidb_zonemap_interval(Op_Ge, 20000, &min, &max));
+    ck_assert(chidb_dbm_cursor_filter(c, zm, min, max) == CHIDB_OK);
+    c->nskipped = 0;
+
+    *nmatch = *nrows = 0;
+    for(rc = chidb_dbm_cursor_rewind(c); rc == CHIDB_OK; rc = chidb_dbm_cursor_next(c))
+    {
+        ck_assert(chidb_DBRecordView_init(&view, c->cell.fields.tableLeaf.data) == CHIDB_OK);
+        chidb_DBRecordView_getInt32(&view, 0, &ts);
+        *nmatch += ts >= 20000;
+        (*nrows)++;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+}
+
+/* A zone map on a column that grows with the key (ts = 10 * key) lets
+ * a cursor skip the subtrees with no row where ts >= 20000, and rows
+ * inserted afterwards are still found */
+START_TEST (test_cursor_6)
+{
+    chidb *db;
+    npage_t nroot;
+    chidb_dbm_cursor_t c;
+    chidb_zonemap_t *zm;
+    uint32_t nmatch, nrows;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(chidb_key_t i = 1; i <= CURSOR_NKEYS; i++)
+    {
+        chidb_key_t key = 2 * (((i * 7919) % CURSOR_NKEYS) + 1);
+        insert_row(db->bt, nroot, key, 10 * key);
+    }
+
+    ck_assert(chidb_zonemap_get(db->bt, nroot, 0) == NULL);
+    ck_assert(chidb_zonemap_build(db->bt, nroot, 0) == CHIDB_OK);
+    ck_assert((zm = chidb_zonemap_get(db->bt, nroot, 0)) != NULL);
+    ck_assert(zm->nranges > 2);
+    ck_assert(chidb_zonemap_match(zm, 0, UINT32_MAX, 20, 20));
+    ck_assert(!chidb_zonemap_match(zm, 0, UINT32_MAX, 60001, INT32_MAX));
+
+    /* Without a filter, every row; with one, every matching row */
+    ck_assert(chidb_dbm_cursor_open(&c, CURSOR_READ, db->bt, nroot) == CHIDB_OK);
+    cursor_scan_ts(&c, NULL, &nmatch, &nrows);
+    ck_assert_int_eq(nrows, CURSOR_NKEYS);
+    ck_assert_int_eq(nmatch, CURSOR_NKEYS - 999);
+    ck_assert_int_eq(c.nskipped, 0);
+
+    cursor_scan_ts(&c, zm, &nmatch, &nrows);
+    ck_assert_int_eq(nmatch, CURSOR_NKEYS - 999);
+    ck_assert(nrows < CURSOR_NKEYS);
+    ck_assert(c.nskipped > 0);
+    ck_assert(chidb_dbm_cursor_close(&c) == CHIDB_OK);
+
+    /* A row inserted among the skipped ones widens their range */
+    insert_row(db->bt, nroot, 1, 50000);
+    ck_assert(chidb_dbm_cursor_open(&c, CURSOR_READ, db->bt, nroot) == CHIDB_OK);
+    cursor_scan_ts(&c, zm, &nmatch, &nrows);
+    ck_assert_int_eq(nmatch, CURSOR_NKEYS - 998);
+    ck_assert(chidb_dbm_cursor_close(&c) == CHIDB_OK);
+
+    /* Zone maps only apply to tables */
+    ck_assert(chidb_dbm_cursor_open(&c, CURSOR_READ, db->bt, cursor_create_tree(db->bt, true)) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_filter(&c, zm, 0, 0) == CHIDB_EMISUSE);
+    ck_assert(chidb_dbm_cursor_close(&c) == CHIDB_OK);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_cursor_tc(void)
+{
+    TCase *tc = tcase_create ("Cursors");
+    tcase_add_test (tc, test_cursor_1);
+    tcase_add_test (tc, test_cursor_2);
+    tcase_add_test (tc, test_cursor_3);
+    tcase_add_test (tc, test_cursor_4);
+    tcase_add_test (tc, test_cursor_5);
+    tcase_add_test (tc, test_cursor_6);
+
+    return tc;
+}
@@ -0,0 +1,416 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/hashindex.h"
+
+#define DELETE_NKEYS (4000)
+
+static uint8_t delete_data[100];
+
+/* Keys in a scrambled order (DELETE_NKEYS and 7919 are coprime) */
+static chidb_key_t delete_key(int i)
+{
+    return (i * 7919) % DELETE_NKEYS + 1;
+}
+
+static npage_t delete_nfree(BTree *bt)
+{
+    MemPage *page;
+    npage_t nfree;
+
+    chidb_Pager_readPage(bt->pager, 1, &page);
+    nfree = get4byte(page->data + HEADER_FREELIST_COUNT_OFFSET);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+
+    return nfree;
+}
+
+/* Checks that a B-Tree is in order, that all its leaves are at the same
+ * depth, and that nodes other than the root are not underflowing (which
+ * is a little laxer for internal nodes, whose separators can't be split)
+ * Returns the number of entries. */
+static int delete_check(BTree *bt, npage_t npage, bool root, int depth, int *leafdepth,
+                        chidb_key_t *last, bool *first)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    uint32_t space, used;
+    int n = 0;
+    bool leaf;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+    leaf = btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF;
+
+    space = chidb_Pager_usableSize(bt->pager) - chidb_Btree_headerSize(bt, btn->type) - (npage == 1 ? 100 : 0);
+    used = space - (btn->cells_offset - btn->free_offset);
+    if (!root)
+        ck_assert(used + (leaf ? 0 : INDEXINTCELL_SIZE + 2) >= space * BTREE_MIN_FILLFACTOR / 100 / 2);
+
+    for(ncell_t i = 0; i < btn->n_cells; i++)
+    {
+        chidb_Btree_getCell(btn, i, &btc);
+        if (btn->type == PGTYPE_TABLE_INTERNAL)
+            n += delete_check(bt, btc.fields.tableInternal.child_page, false, depth + 1, leafdepth, last, first);
+        else if (btn->type == PGTYPE_INDEX_INTERNAL)
+            n += delete_check(bt, btc.fields.indexInternal.child_page, false, depth + 1, leafdepth, last, first);
+
+        if (btn->type != PGTYPE_TABLE_INTERNAL)
+        {
+            ck_assert(*first || btc.key > *last);
+            *last = btc.key;
+            *first = false;
+            n++;
+        }
+        else
+            ck_assert(btc.key >= *last);
+    }
+
+    if (leaf)
+    {
+        if (*leafdepth == -1)
+            *leafdepth = depth;
+        ck_assert_int_eq(depth, *leafdepth);
+    }
+    else
+        n += delete_check(bt, btn->right_page, false, depth + 1, leafdepth, last, first);
+
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return n;
+}
+
+static int delete_count(BTree *bt, npage_t nroot)
+{
+    int leafdepth = -1;
+    chidb_key_t last = 0;
+    bool first = true;
+
+    return delete_check(bt, nroot, true, 0, &leafdepth, &last, &first);
+}
+
+
+/* Walks the list of leaves of a table, checking that the keys are in
+ * order and that every leaf links back to the one before it. Returns
+ * the number of entries. */
+static int delete_walk(BTree *bt, npage_t nroot)
+{
+    BTreeNode *btn, *next;
+    BTreeCell btc;
+    chidb_key_t last = 0;
+    int n = 0, rc;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, nroot, &btn) == CHIDB_OK);
+    while (btn->type != PGTYPE_TABLE_LEAF)
+    {
+        chidb_Btree_getCell(btn, 0, &btc);
+        chidb_Btree_freeMemNode(bt, btn);
+        ck_assert(chidb_Btree_getNodeByPage(bt, btc.fields.tableInternal.child_page, &btn) == CHIDB_OK);
+    }
+    ck_assert_int_eq(btn->left_page, 0);
+    for(;;)
+    {
+        for(ncell_t i = 0; i < btn->n_cells; i++, n++)
+        {
+            chidb_Btree_getCell(btn, i, &btc);
+            ck_assert(n == 0 || btc.key > last);
+            last = btc.key;
+        }
+        rc = chidb_Btree_nextLeaf(bt, btn, &next);
+        if (rc == CHIDB_ENOTFOUND)
+            break;
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(next->left_page, btn->page->npage);
+        chidb_Btree_freeMemNode(bt, btn);
+        btn = next;
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return n;
+}
+
+
+/* Deleting from a table */
+START_TEST (test_delete_1)
+{
+    chidb *db;
+    uint8_t *data;
+    uint16_t size;
+    npage_t npages;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open(fname, db, &db->bt);
+
+    for(int i = 0; i < DELETE_NKEYS; i++)
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, delete_key(i), delete_data, sizeof(delete_data)) == CHIDB_OK);
+    npages = db->bt->pager->n_pages;
+
+    /* Delete the odd keys */
+    for(int i = 0; i < DELETE_NKEYS; i++)
+        if (delete_key(i) % 2)
+            ck_assert(chidb_Btree_delete(db->bt, 1, delete_key(i)) == CHIDB_OK);
+    ck_assert_int_eq(delete_count(db->bt, 1), DELETE_NKEYS / 2);
+    ck_assert(delete_nfree(db->bt) > npages / 4);
+
+    for(chidb_key_t key = 1; key <= DELETE_NKEYS; key++)
+    {
+        int rc = chidb_Btree_find(db->bt, 1, key, &data, &size);
+
+        if (key % 2)
+            ck_assert(rc == CHIDB_ENOTFOUND);
+        else
+        {
+            ck_assert(rc == CHIDB_OK);
+            free(data);
+        }
+    }
+    ck_assert(chidb_Btree_delete(db->bt, 1, 1) == CHIDB_ENOTFOUND);
+    ck_assert(chidb_Btree_delete(db->bt, 1, DELETE_NKEYS + 1) == CHIDB_ENOTFOUND);
+
+    /* Freed pages are reused */
+    for(chidb_key_t key = 1; key <= DELETE_NKEYS; key += 2)
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, key, delete_data, sizeof(delete_data)) == CHIDB_OK);
+    ck_assert_int_eq(delete_count(db->bt, 1), DELETE_NKEYS);
+    ck_assert(db->bt->pager->n_pages <= npages + npages / 4);
+
+    /* Delete everything: all the pages but the root end up in the freelist */
+    for(int i = 0; i < DELETE_NKEYS; i++)
+        ck_assert(chidb_Btree_delete(db->bt, 1, delete_key(i)) == CHIDB_OK);
+    ck_assert_int_eq(delete_count(db->bt, 1), 0);
+    ck_assert_int_eq(delete_nfree(db->bt), db->bt->pager->n_pages - 1);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Deleting from an index, where internal nodes have entries too */
+START_TEST (test_delete_2)
+{
+    chidb *db;
+    npage_t nroot;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open(fname, db, &db->bt);
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+
+    for(int i = 0; i < DELETE_NKEYS; i++)
+        ck_assert(chidb_Btree_insertInIndex(db->bt, nroot, delete_key(i), i) == CHIDB_OK);
+
+    for(int i = 0; i < DELETE_NKEYS; i++)
+    {
+        if (delete_key(i) % 3)
+            ck_assert(chidb_Btree_delete(db->bt, nroot, delete_key(i)) == CHIDB_OK);
+        if (i % 500 == 0)
+            delete_count(db->bt, nroot);
+    }
+    ck_assert_int_eq(delete_count(db->bt, nroot), DELETE_NKEYS / 3);
+    ck_assert(chidb_Btree_delete(db->bt, nroot, 1) == CHIDB_ENOTFOUND);
+
+    for(int i = 0; i < DELETE_NKEYS; i++)
+        if (delete_key(i) % 3 == 0)
+            ck_assert(chidb_Btree_delete(db->bt, nroot, delete_key(i)) == CHIDB_OK);
+    ck_assert_int_eq(delete_count(db->bt, nroot), 0);
+    ck_assert_int_eq(delete_nfree(db->bt), db->bt->pager->n_pages - 2);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Merged leaves are unlinked */
+START_TEST (test_delete_3)
+{
+    chidb *db;
+    BTreeNode *btn, *next;
+    BTreeCell btc;
+    chidb_key_t key;
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open2(fname, db, &db->bt, DEFAULT_PAGE_SIZE, BTREE_LINKEDLEAVES);
+
+    for(int i = 0; i < DELETE_NKEYS; i++)
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, delete_key(i), delete_data, sizeof(delete_data)) == CHIDB_OK);
+    for(chidb_key_t k = 1; k <= DELETE_NKEYS; k++)
+        if (k % 4)
+            ck_assert(chidb_Btree_delete(db->bt, 1, k) == CHIDB_OK);
+    delete_count(db->bt, 1);
+
+    /* Find the first leaf, and walk the list */
+    ck_assert(chidb_Btree_getNodeByPage(db->bt, 1, &btn) == CHIDB_OK);
+    while (btn->type != PGTYPE_TABLE_LEAF)
+    {
+        chidb_Btree_getCell(btn, 0, &btc);
+        chidb_Btree_freeMemNode(db->bt, btn);
+        chidb_Btree_getNodeByPage(db->bt, btc.fields.tableInternal.child_page, &btn);
+    }
+    ck_assert_int_eq(btn->left_page, 0);
+    key = 0;
+    for(;;)
+    {
+        for(ncell_t i = 0; i < btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &btc);
+            key += 4;
+            ck_assert_int_eq(btc.key, key);
+        }
+        rc = chidb_Btree_nextLeaf(db->bt, btn, &next);
+        if (rc == CHIDB_ENOTFOUND)
+            break;
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(next->left_page, btn->page->npage);
+        chidb_Btree_freeMemNode(db->bt, btn);
+        btn = next;
+    }
+    chidb_Btree_freeMemNode(db->bt, btn);
+    ck_assert_int_eq(key, DELETE_NKEYS);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Deleting a range of keys from a table detaches the subtrees in it
+ * whole, and leaves a balanced tree with its leaves linked */
+START_TEST (test_delete_4)
+{
+    chidb *db;
+    npage_t nindex, npages;
+    uint8_t *data;
+    uint16_t size;
+    uint64_t n;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open2(fname, db, &db->bt, DEFAULT_PAGE_SIZE, BTREE_LINKEDLEAVES);
+
+    for(int i = 0; i < DELETE_NKEYS; i++)
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, delete_key(i), delete_data, sizeof(delete_data)) == CHIDB_OK);
+    npages = db->bt->pager->n_pages;
+
+    ck_assert(chidb_Btree_deleteRange(db->bt, 1, 1001, 3000, &n) == CHIDB_OK);
+    ck_assert_int_eq(n, 2000);
+    ck_assert_int_eq(delete_count(db->bt, 1), DELETE_NKEYS - 2000);
+    ck_assert_int_eq(delete_walk(db->bt, 1), DELETE_NKEYS - 2000);
+    ck_assert(delete_nfree(db->bt) > npages / 3);
+
+    for(chidb_key_t key = 1; key <= DELETE_NKEYS; key++)
+    {
+        int rc = chidb_Btree_find(db->bt, 1, key, &data, &size);
+
+        if (key >= 1001 && key <= 3000)
+            ck_assert(rc == CHIDB_ENOTFOUND);
+        else
+        {
+            ck_assert(rc == CHIDB_OK);
+            free(data);
+        }
+    }
+
+    /* Empty ranges, and both ends of the table */
+    ck_assert(chidb_Btree_deleteRange(db->bt, 1, 5, 2, &n) == CHIDB_OK);
+    ck_assert_int_eq(n, 0);
+    ck_assert(chidb_Btree_deleteRange(db->bt, 1, 1001, 3000, &n) == CHIDB_OK);
+    ck_assert_int_eq(n, 0);
+    ck_assert(chidb_Btree_deleteRange(db->bt, 1, 0, 10, &n) == CHIDB_OK);
+    ck_assert_int_eq(n, 10);
+    ck_assert(chidb_Btree_deleteRange(db->bt, 1, DELETE_NKEYS - 10, CHIDB_KEY_MAX, &n) == CHIDB_OK);
+    ck_assert_int_eq(n, 11);
+    ck_assert_int_eq(delete_count(db->bt, 1), DELETE_NKEYS - 2021);
+    ck_assert_int_eq(delete_walk(db->bt, 1), DELETE_NKEYS - 2021);
+
+    /* The deleted keys can be inserted again */
+    for(chidb_key_t key = 1001; key <= 3000; key++)
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, key, delete_data, sizeof(delete_data)) == CHIDB_OK);
+    ck_assert_int_eq(delete_walk(db->bt, 1), DELETE_NKEYS - 21);
+
+    /* Everything: all the pages but the root end up in the freelist */
+    ck_assert(chidb_Btree_deleteRange(db->bt, 1, 0, CHIDB_KEY_MAX, &n) == CHIDB_OK);
+    ck_assert_int_eq(n, DELETE_NKEYS - 21);
+    ck_assert_int_eq(delete_count(db->bt, 1), 0);
+    ck_assert_int_eq(delete_nfree(db->bt), db->bt->pager->n_pages - 1);
+
+    /* Only tables have ranges of keys that are whole subtrees */
+    chidb_Btree_newNode(db->bt, &nindex, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Btree_deleteRange(db->bt, nindex, 0, 10, &n) == CHIDB_EMISUSE);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Truncating a table (overflow pages included) and an index frees all
+ * of their pages but the roots */
+START_TEST (test_delete_5)
+{
+    chidb *db;
+    npage_t nindex, nhash;
+    uint8_t big[3000] = {0};
+    uint64_t n;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open(fname, db, &db->bt);
+    chidb_Btree_newNode(db->bt, &nindex, PGTYPE_INDEX_LEAF);
+
+    for(int i = 0; i < DELETE_NKEYS; i++)
+    {
+        if (delete_key(i) % 100 == 0)
+            ck_assert(chidb_Btree_insertInTable(db->bt, 1, delete_key(i), big, sizeof(big)) == CHIDB_OK);
+        else
+            ck_assert(chidb_Btree_insertInTable(db->bt, 1, delete_key(i), delete_data, sizeof(delete_data)) == CHIDB_OK);
+        ck_assert(chidb_Btree_insertInIndex(db->bt, nindex, delete_key(i), i) == CHIDB_OK);
+    }
+
+    ck_assert(chidb_Btree_truncate(db->bt, nindex, &n) == CHIDB_OK);
+    ck_assert_int_eq(n, DELETE_NKEYS);
+    ck_assert_int_eq(delete_count(db->bt, nindex), 0);
+    ck_assert_int_eq(delete_count(db->bt, 1), DELETE_NKEYS);
+
+    ck_assert(chidb_Btree_truncate(db->bt, 1, &n) == CHIDB_OK);
+    ck_assert_int_eq(n, DELETE_NKEYS);
+    ck_assert_int_eq(delete_count(db->bt, 1), 0);
+    ck_assert_int_eq(delete_nfree(db->bt), db->bt->pager->n_pages - 2);
+
+    /* Both can be filled again, from the freed pages */
+    for(int i = 0; i < DELETE_NKEYS; i++)
+    {
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, delete_key(i), delete_data, sizeof(delete_data)) == CHIDB_OK);
+        ck_assert(chidb_Btree_insertInIndex(db->bt, nindex, delete_key(i), i) == CHIDB_OK);
+    }
+    ck_assert_int_eq(delete_count(db->bt, 1), DELETE_NKEYS);
+    ck_assert_int_eq(delete_count(db->bt, nindex), DELETE_NKEYS);
+
+    /* A hash index is not a B-Tree */
+    ck_assert(chidb_hashindex_create(db->bt, &nhash) == CHIDB_OK);
+    ck_assert(chidb_Btree_truncate(db->bt, nhash, &n) == CHIDB_EMISUSE);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_delete_tc(void)
+{
+    TCase *tc = tcase_create ("Deleting from a B-Tree");
+    tcase_add_test (tc, test_delete_1);
+    tcase_add_test (tc, test_delete_2);
+    tcase_add_test (tc, test_delete_3);
+    tcase_add_test (tc, test_delete_4);
+    tcase_add_test (tc, test_delete_5);
+
+    return tc;
+}
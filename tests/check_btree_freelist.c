@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define FREELIST_NPAGES (600)  // Enough pages to need several trunk pages
+
+/* The freelist only uses the pager, so we don't need a full B-Tree file */
+static BTree *freelist_open(const char *fname)
+{
+    BTree *bt = malloc(sizeof(BTree));
+    npage_t npage;
+
+    bt->db = NULL;
+    ck_assert(chidb_Pager_open(&bt->pager, fname) == CHIDB_OK);
+    chidb_Pager_setPageSize(bt->pager, DEFAULT_PAGE_SIZE);
+    if (bt->pager->n_pages == 0)
+    {
+        ck_assert(chidb_Btree_allocatePage(bt, &npage) == CHIDB_OK);
+        ck_assert(npage == 1);
+    }
+
+    return bt;
+}
+
+static void freelist_close(BTree *bt)
+{
+    chidb_Pager_close(bt->pager);
+    free(bt);
+}
+
+static npage_t freelist_count(BTree *bt)
+{
+    MemPage *page;
+    npage_t nfree;
+
+    chidb_Pager_readPage(bt->pager, 1, &page);
+    nfree = get4byte(page->data + HEADER_FREELIST_COUNT_OFFSET);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+
+    return nfree;
+}
+
+
+START_TEST (test_freelist_1)
+{
+    BTree *bt;
+    MemPage *page;
+    npage_t npage;
+    bool reused[FREELIST_NPAGES + 1] = { false };
+
+    char *fname = create_tmp_file();
+    bt = freelist_open(fname);
+
+    for(int i=2; i<=FREELIST_NPAGES; i++)
+    {
+        ck_assert(chidb_Btree_allocatePage(bt, &npage) == CHIDB_OK);
+        ck_assert_int_eq(npage, i);
+        chidb_Pager_readPage(bt->pager, npage, &page);
+        memset(page->data, 0xAB, bt->pager->page_size);
+        chidb_Pager_writePage(bt->pager, page);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    /* Free every other page */
+    for(int i=2; i<=FREELIST_NPAGES; i+=2)
+        ck_assert(chidb_Btree_freePage(bt, i) == CHIDB_OK);
+    ck_assert(chidb_Btree_freePage(bt, 1) == CHIDB_EPAGENO);
+    ck_assert_int_eq(freelist_count(bt), FREELIST_NPAGES / 2);
+
+    /* The freelist survives closing the file */
+    freelist_close(bt);
+    bt = freelist_open(fname);
+    ck_assert_int_eq(freelist_count(bt), FREELIST_NPAGES / 2);
+
+    /* Allocations reuse the free pages (zeroed out) before growing the file */
+    for(int i=0; i<FREELIST_NPAGES / 2; i++)
+    {
+        ck_assert(chidb_Btree_allocatePage(bt, &npage) == CHIDB_OK);
+        ck_assert(npage % 2 == 0 && npage <= FREELIST_NPAGES && !reused[npage]);
+        reused[npage] = true;
+
+        chidb_Pager_readPage(bt->pager, npage, &page);
+        for(int j=0; j<bt->pager->page_size; j++)
+            if(page->data[j] != 0)
+            {
+                ck_abort_msg("Reused page was not zeroed out");
+                break;
+            }
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+    ck_assert_int_eq(freelist_count(bt), 0);
+    ck_assert_int_eq(bt->pager->n_pages, FREELIST_NPAGES);
+
+    ck_assert(chidb_Btree_allocatePage(bt, &npage) == CHIDB_OK);
+    ck_assert_int_eq(npage, FREELIST_NPAGES + 1);
+
+    freelist_close(bt);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_freelist_2)
+{
+    BTree *bt;
+    npage_t npage, nremoved;
+    struct stat st;
+
+    char *fname = create_tmp_file();
+    bt = freelist_open(fname);
+
+    for(int i=2; i<=FREELIST_NPAGES; i++)
+        chidb_Btree_allocatePage(bt, &npage);
+
+    /* Page 10 and the last half of the file */
+    chidb_Btree_freePage(bt, 10);
+    for(int i=FREELIST_NPAGES / 2 + 1; i<=FREELIST_NPAGES; i++)
+        chidb_Btree_freePage(bt, i);
+
+    ck_assert(chidb_Btree_incrVacuum(bt, 10, &nremoved) == CHIDB_OK);
+    ck_assert_int_eq(nremoved, 10);
+    ck_assert_int_eq(bt->pager->n_pages, FREELIST_NPAGES - 10);
+
+    ck_assert(chidb_Btree_incrVacuum(bt, 0, &nremoved) == CHIDB_OK);
+    ck_assert_int_eq(nremoved, FREELIST_NPAGES / 2 - 10);
+    ck_assert_int_eq(bt->pager->n_pages, FREELIST_NPAGES / 2);
+    ck_assert_int_eq(freelist_count(bt), 1);
+
+    freelist_close(bt);
+    stat(fname, &st);
+    ck_assert_int_eq(st.st_size, (FREELIST_NPAGES / 2) * DEFAULT_PAGE_SIZE);
+
+    /* Page 10 is still in the freelist */
+    bt = freelist_open(fname);
+    ck_assert(chidb_Btree_allocatePage(bt, &npage) == CHIDB_OK);
+    ck_assert_int_eq(npage, 10);
+    freelist_close(bt);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+TCase* make_btree_freelist_tc(void)
+{
+    TCase *tc = tcase_create ("Freelist and incremental vacuum");
+    tcase_add_test (tc, test_freelist_1);
+    tcase_add_test (tc, test_freelist_2);
+
+    return tc;
+}
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/hashindex.h"
+#include "libchidb/record.h"
+
+#define HASHINDEX_NKEYS (5000)
+
+/* Number of buckets of a hash index, from its meta page */
+static uint32_t hashindex_nbuckets(BTree *bt, npage_t nroot)
+{
+    MemPage *meta;
+    uint32_t n;
+
+    ck_assert(chidb_Pager_readPage(bt->pager, nroot, &meta) == CHIDB_OK);
+    ck_assert_int_eq(meta->data[PGHEADER_PGTYPE_OFFSET], PGTYPE_HASH_META);
+    n = get4byte(meta->data + HASHMETA_NBUCKETS_OFFSET);
+    chidb_Pager_releaseMemPage(bt->pager, meta);
+
+    return n;
+}
+
+
+/* Entries inserted one at a time are all found, and the index splits
+ * buckets as it grows */
+START_TEST (test_hashindex_1)
+{
+    chidb *db;
+    npage_t nroot;
+    chidb_key_t pk;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+
+    ck_assert(chidb_hashindex_create(db->bt, &nroot) == CHIDB_OK);
+    ck_assert_int_eq(hashindex_nbuckets(db->bt, nroot), 1);
+    ck_assert(chidb_hashindex_find(db->bt, nroot, 1, &pk) == CHIDB_ENOTFOUND);
+
+    for(chidb_key_t i = 1; i <= HASHINDEX_NKEYS; i++)
+        ck_assert(chidb_hashindex_insert(db->bt, nroot, (i * 7919) % 100003, i) == CHIDB_OK);
+    ck_assert(hashindex_nbuckets(db->bt, nroot) > 1);
+
+    for(chidb_key_t i = 1; i <= HASHINDEX_NKEYS; i++)
+    {
+        ck_assert(chidb_hashindex_find(db->bt, nroot, (i * 7919) % 100003, &pk) == CHIDB_OK);
+        ck_assert_int_eq(pk, i);
+    }
+    ck_assert(chidb_hashindex_find(db->bt, nroot, 100003, &pk) == CHIDB_ENOTFOUND);
+    ck_assert(chidb_hashindex_insert(db->bt, nroot, 7919, 1) == CHIDB_EDUPLICATE);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Deleted entries are no longer found, the others still are, and a
+ * deleted value can be inserted again */
+START_TEST (test_hashindex_2)
+{
+    chidb *db;
+    npage_t nroot;
+    chidb_key_t pk;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+
+    ck_assert(chidb_hashindex_create(db->bt, &nroot) == CHIDB_OK);
+    for(chidb_key_t i = 1; i <= HASHINDEX_NKEYS; i++)
+        ck_assert(chidb_hashindex_insert(db->bt, nroot, 3 * i, i) == CHIDB_OK);
+
+    for(chidb_key_t i = 1; i <= HASHINDEX_NKEYS; i += 2)
+        ck_assert(chidb_hashindex_delete(db->bt, nroot, 3 * i) == CHIDB_OK);
+    ck_assert(chidb_hashindex_delete(db->bt, nroot, 3) == CHIDB_ENOTFOUND);
+
+    for(chidb_key_t i = 1; i <= HASHINDEX_NKEYS; i++)
+    {
+        int rc = chidb_hashindex_find(db->bt, nroot, 3 * i, &pk);
+
+        if (i % 2)
+            ck_assert(rc == CHIDB_ENOTFOUND);
+        else
+        {
+            ck_assert(rc == CHIDB_OK);
+            ck_assert_int_eq(pk, i);
+        }
+    }
+
+    ck_assert(chidb_hashindex_insert(db->bt, nroot, 3, 42) == CHIDB_OK);
+    ck_assert(chidb_hashindex_find(db->bt, nroot, 3, &pk) == CHIDB_OK);
+    ck_assert_int_eq(pk, 42);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* An index built from a table maps each value of the column to the key
+ * of its row, and a page that is not the meta page of an index is
+ * rejected */
+START_TEST (test_hashindex_3)
+{
+    chidb *db;
+    npage_t table_root, nroot;
+    chidb_key_t pk;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &table_root, PGTYPE_TABLE_LEAF);
+    for(chidb_key_t i = 1; i <= HASHINDEX_NKEYS; i++)
+        insert_row(db->bt, table_root, i, -(int32_t) i);
+
+    ck_assert(chidb_hashindex_create(db->bt, &nroot) == CHIDB_OK);
+    ck_assert(chidb_hashindex_build(db->bt, table_root, nroot, 0) == CHIDB_OK);
+    for(chidb_key_t i = 1; i <= HASHINDEX_NKEYS; i++)
+    {
+        ck_assert(chidb_hashindex_find(db->bt, nroot, (chidb_key_t) -(int32_t) i, &pk) == CHIDB_OK);
+        ck_assert_int_eq(pk, i);
+    }
+
+    ck_assert(chidb_hashindex_find(db->bt, table_root, 1, &pk) == CHIDB_EMISUSE);
+    ck_assert(chidb_hashindex_build(db->bt, table_root, nroot, 0) == CHIDB_EDUPLICATE);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_hashindex_tc(void)
+{
+    TCase *tc = tcase_create ("Hash indexes");
+    tcase_add_test (tc, test_hashindex_1);
+    tcase_add_test (tc, test_hashindex_2);
+    tcase_add_test (tc, test_hashindex_3);
+
+    return tc;
+}
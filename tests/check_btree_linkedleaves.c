@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define LINKEDLEAVES_NROWS (3000)
+
+static uint8_t linkedleaves_data[64];
+
+struct linkedleaves_rows
+{
+    chidb_key_t i, n;
+};
+
+static int linkedleaves_next(BTreeIterator *it, BTreeCell *cell)
+{
+    struct linkedleaves_rows *rows = it->arg;
+
+    if (rows->i == rows->n)
+        return CHIDB_EEMPTY;
+    rows->i++;
+
+    cell->key = rows->i;
+    cell->fields.tableLeaf.data = linkedleaves_data;
+    cell->fields.tableLeaf.data_size = sizeof(linkedleaves_data);
+
+    return CHIDB_OK;
+}
+
+/* Loads the leftmost leaf of a table B-Tree */
+static BTreeNode *linkedleaves_first(BTree *bt, npage_t nroot)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    npage_t npage = nroot;
+
+    for(;;)
+    {
+        ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+        if (btn->type == PGTYPE_TABLE_LEAF)
+            return btn;
+        chidb_Btree_getCell(btn, 0, &btc);
+        npage = btc.fields.tableInternal.child_page;
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+}
+
+/* Walks the leaves forward and then backward, checking that every key
+ * from 1 to n is found in order. Returns the number of leaves. */
+static int linkedleaves_walk(BTree *bt, npage_t nroot, chidb_key_t n)
+{
+    BTreeNode *btn, *next;
+    BTreeCell btc;
+    chidb_key_t key = 0;
+    int nleaves = 1, rc;
+
+    btn = linkedleaves_first(bt, nroot);
+    ck_assert_int_eq(btn->left_page, 0);
+    for(;;)
+    {
+        for(ncell_t i = 0; i < btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &btc);
+            ck_assert_int_eq(btc.key, ++key);
+        }
+
+        rc = chidb_Btree_nextLeaf(bt, btn, &next);
+        if (rc == CHIDB_ENOTFOUND)
+            break;
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(next->left_page, btn->page->npage);
+        chidb_Btree_freeMemNode(bt, btn);
+        btn = next;
+        nleaves++;
+    }
+    ck_assert_int_eq(key, n);
+
+    for(;;)
+    {
+        for(ncell_t i = btn->n_cells; i > 0; i--)
+        {
+            chidb_Btree_getCell(btn, i - 1, &btc);
+            ck_assert_int_eq(btc.key, key--);
+        }
+
+        rc = chidb_Btree_prevLeaf(bt, btn, &next);
+        if (rc == CHIDB_ENOTFOUND)
+            break;
+        ck_assert(rc == CHIDB_OK);
+        chidb_Btree_freeMemNode(bt, btn);
+        btn = next;
+    }
+    ck_assert_int_eq(key, 0);
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return nleaves;
+}
+
+
+/* Leaves are linked as they are split */
+START_TEST (test_linkedleaves_1)
+{
+    chidb *db;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open2(fname, db, &db->bt, DEFAULT_PAGE_SIZE, BTREE_LINKEDLEAVES) == CHIDB_OK);
+    ck_assert(db->bt->features & BTREE_FEATURE_LINKEDLEAVES);
+
+    for(int i = 0; i < LINKEDLEAVES_NROWS; i++)
+    {
+        chidb_key_t key = (i * 7919) % LINKEDLEAVES_NROWS + 1;
+
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, key, linkedleaves_data, sizeof(linkedleaves_data)) == CHIDB_OK);
+    }
+    ck_assert(linkedleaves_walk(db->bt, 1, LINKEDLEAVES_NROWS) > 2);
+
+    /* The feature is kept when the file is reopened */
+    chidb_Btree_close(db->bt);
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    ck_assert(db->bt->features & BTREE_FEATURE_LINKEDLEAVES);
+    linkedleaves_walk(db->bt, 1, LINKEDLEAVES_NROWS);
+
+    /* Index leaves are not linked */
+    ck_assert(chidb_Btree_headerSize(db->bt, PGTYPE_INDEX_LEAF) == LEAFPG_CELLSOFFSET_OFFSET);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Leaves are linked as they are bulk-loaded */
+START_TEST (test_linkedleaves_2)
+{
+    chidb *db;
+    struct linkedleaves_rows rows = {0, LINKEDLEAVES_NROWS};
+    BTreeIterator it = {linkedleaves_next, &rows};
+    npage_t nroot;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open2(fname, db, &db->bt, DEFAULT_PAGE_SIZE, BTREE_LINKEDLEAVES) == CHIDB_OK);
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    ck_assert(chidb_Btree_bulkLoad(db->bt, nroot, &it, BTREE_DEFAULT_FILLFACTOR) == CHIDB_OK);
+    ck_assert(linkedleaves_walk(db->bt, nroot, LINKEDLEAVES_NROWS) > 2);
+
+    /* And they stay linked when more rows are added */
+    for(chidb_key_t key = LINKEDLEAVES_NROWS + 1; key <= 2 * LINKEDLEAVES_NROWS; key++)
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, key, linkedleaves_data, sizeof(linkedleaves_data)) == CHIDB_OK);
+    linkedleaves_walk(db->bt, nroot, 2 * LINKEDLEAVES_NROWS);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Files without the feature don't have links */
+START_TEST (test_linkedleaves_3)
+{
+    chidb *db;
+    BTreeNode *btn, *next;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    ck_assert(!(db->bt->features & BTREE_FEATURE_LINKEDLEAVES));
+    ck_assert(chidb_Btree_headerSize(db->bt, PGTYPE_TABLE_LEAF) == LEAFPG_CELLSOFFSET_OFFSET);
+
+    chidb_Btree_getNodeByPage(db->bt, 1, &btn);
+    ck_assert(chidb_Btree_nextLeaf(db->bt, btn, &next) == CHIDB_EMISUSE);
+    ck_assert(chidb_Btree_prevLeaf(db->bt, btn, &next) == CHIDB_EMISUSE);
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_linkedleaves_tc(void)
+{
+    TCase *tc = tcase_create ("Linked table leaves");
+    tcase_add_test (tc, test_linkedleaves_1);
+    tcase_add_test (tc, test_linkedleaves_2);
+    tcase_add_test (tc, test_linkedleaves_3);
+
+    return tc;
+}
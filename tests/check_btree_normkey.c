@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/normkey.h"
+#include "libchidb/record.h"
+
+#define NORMKEY_NKEYS (2000)
+
+/* Rowids that don't fit in 32 bits, in a scrambled order */
+static chidb_key_t normkey_rowid(int i)
+{
+    return ((chidb_key_t) 1 << 40) + (chidb_key_t) ((i * 7919) % NORMKEY_NKEYS);
+}
+
+/* Looks up a complete normalized key in an index, and returns the
+ * keyPk of its entry */
+static int normkey_find(BTree *bt, npage_t nroot, const uint8_t *nkey, uint16_t size, chidb_key_t *keyPk)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    ncell_t ncell;
+    npage_t child;
+    int rc;
+
+    for (;;)
+    {
+        ck_assert(chidb_Btree_getNodeByPage(bt, nroot, &btn) == CHIDB_OK);
+        rc = chidb_Btree_nodeSearchKey(btn, nkey, size, &ncell);
+        if (rc == CHIDB_OK || btn->type == PGTYPE_INDEX_LEAF)
+        {
+            if (rc == CHIDB_OK)
+            {
+                chidb_Btree_getCell(btn, ncell, &btc);
+                *keyPk = btn->type == PGTYPE_INDEX_LEAF ? btc.fields.indexLeaf.keyPk : btc.fields.indexInternal.keyPk;
+            }
+            chidb_Btree_freeMemNode(bt, btn);
+            return rc;
+        }
+
+        if (ncell == btn->n_cells)
+            child = btn->right_page;
+        else
+        {
+            chidb_Btree_getCell(btn, ncell, &btc);
+            child = btc.fields.indexInternal.child_page;
+        }
+        chidb_Btree_freeMemNode(bt, btn);
+        nroot = child;
+    }
+}
+
+
+/* Normalized values sort like the values they encode: NULL first, then
+ * integers (negative ones included), then strings, and a string before
+ * any longer one that starts with it, embedded NULs included */
+START_TEST (test_normkey_1)
+{
+    int64_t ints[] = {INT64_MIN, INT32_MIN, -256, -1, 0, 1, 255, 256, INT32_MAX, (int64_t) 1 << 40, INT64_MAX};
+    const char *strs[] = {"", "\0", "\0\0", "\0a", "a", "a\0", "a\0b", "ab", "b"};
+    uint32_t lens[] = {0, 1, 2, 2, 1, 2, 3, 2, 1};
+    uint32_t nints = sizeof(ints) / sizeof(ints[0]), nstrs = sizeof(strs) / sizeof(strs[0]);
+    uint8_t keys[32][32];
+    uint32_t sizes[32], n = 0;
+    int64_t v;
+
+    sizes[n++] = chidb_normkey_null(keys[0]);
+    for(uint32_t i = 0; i < nints; i++, n++)
+        sizes[n] = chidb_normkey_int(keys[n], ints[i]);
+    for(uint32_t i = 0; i < nstrs; i++, n++)
+    {
+        sizes[n] = chidb_normkey_text(keys[n], strs[i], lens[i]);
+        ck_assert_int_eq(sizes[n], chidb_normkey_textSize(strs[i], lens[i]));
+    }
+
+    for(uint32_t i = 0; i < n; i++)
+    {
+        ck_assert_int_eq(chidb_normkey_valueSize(keys[i], sizes[i]), sizes[i]);
+        for(uint32_t j = 0; j < n; j++)
+        {
+            int cmp = chidb_normkey_cmp(keys[i], sizes[i], keys[j], sizes[j]);
+
+            ck_assert(i < j ? cmp < 0 : i > j ? cmp > 0 : cmp == 0);
+        }
+    }
+
+    for(uint32_t i = 0; i < nints; i++)
+    {
+        ck_assert(chidb_normkey_getInt(keys[i + 1], sizes[i + 1], &v));
+        ck_assert(v == ints[i]);
+    }
+    ck_assert(!chidb_normkey_getInt(keys[0], sizes[0], &v));
+    ck_assert(!chidb_normkey_getInt(keys[n - 1], sizes[n - 1], &v));
+
+    chidb_normkey_putRowid(keys[0], (chidb_key_t) 1 << 40);
+    chidb_normkey_putRowid(keys[1], UINT32_MAX);
+    ck_assert(chidb_normkey_getRowid(keys[0]) == (chidb_key_t) 1 << 40);
+    ck_assert(memcmp(keys[1], keys[0], NORMKEY_ROWID_SIZE) < 0);
+}
+END_TEST
+
+
+/* A file with normalized keys has 64-bit rowids, and keeps its format
+ * when it is reopened; packed index cells can't be used with it */
+START_TEST (test_normkey_2)
+{
+    chidb *db;
+    npage_t nroot;
+    uint8_t *data;
+    uint16_t size;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open2(fname, db, &db->bt, DEFAULT_PAGE_SIZE, BTREE_NORMKEY | BTREE_PACKEDINDEX) == CHIDB_OK);
+    ck_assert(db->bt->features & BTREE_FEATURE_NORMKEY);
+    ck_assert(!(db->bt->features & BTREE_FEATURE_PACKEDINDEX));
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(int i = 0; i < NORMKEY_NKEYS; i++)
+        insert_row_text(db->bt, nroot, normkey_rowid(i), "row");
+
+    chidb_Btree_close(db->bt);
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    ck_assert(db->bt->features & BTREE_FEATURE_NORMKEY);
+    for(int i = 0; i < NORMKEY_NKEYS; i++)
+    {
+        ck_assert(chidb_Btree_find(db->bt, nroot, normkey_rowid(i), &data, &size) == CHIDB_OK);
+        free(data);
+    }
+    ck_assert(chidb_Btree_find(db->bt, nroot, (chidb_key_t) 1 << 32, &data, &size) == CHIDB_ENOTFOUND);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* A text column can be indexed in a file with normalized keys (and only
+ * there), and every entry is found by its value and rowid */
+START_TEST (test_normkey_3)
+{
+    chidb *db;
+    npage_t table_root, index_root;
+    uint8_t nkey[64];
+    uint32_t size;
+    chidb_key_t pk;
+    char token[32];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open2(fname, db, &db->bt, DEFAULT_PAGE_SIZE, BTREE_NORMKEY) == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &table_root, PGTYPE_TABLE_LEAF);
+    for(int i = 0; i < NORMKEY_NKEYS; i++)
+    {
+        sprintf(token, "token-%d", (i * 7919) % NORMKEY_NKEYS);
+        insert_row_text(db->bt, table_root, normkey_rowid(i), token);
+    }
+
+    chidb_Btree_newNode(db->bt, &index_root, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Btree_buildIndex(db->bt, table_root, index_root, 0, 1) == CHIDB_OK);
+    for(int i = 0; i < NORMKEY_NKEYS; i++)
+    {
+        sprintf(token, "token-%d", (i * 7919) % NORMKEY_NKEYS);
+        size = chidb_normkey_text(nkey, token, strlen(token));
+        chidb_normkey_putRowid(nkey + size, normkey_rowid(i));
+        ck_assert(normkey_find(db->bt, index_root, nkey, size + NORMKEY_ROWID_SIZE, &pk) == CHIDB_OK);
+        ck_assert(pk == normkey_rowid(i));
+    }
+    size = chidb_normkey_text(nkey, "token-", 6);
+    ck_assert(normkey_find(db->bt, index_root, nkey, size, &pk) == CHIDB_ENOTFOUND);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+
+    /* Without normalized keys, only integer columns can be indexed */
+    fname = create_tmp_file();
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    chidb_Btree_newNode(db->bt, &table_root, PGTYPE_TABLE_LEAF);
+    insert_row_text(db->bt, table_root, 1, "token");
+    chidb_Btree_newNode(db->bt, &index_root, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Btree_buildIndex(db->bt, table_root, index_root, 0, 1) == CHIDB_EMISMATCH);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_normkey_tc(void)
+{
+    TCase *tc = tcase_create ("Normalized keys");
+    tcase_add_test (tc, test_normkey_1);
+    tcase_add_test (tc, test_normkey_2);
+    tcase_add_test (tc, test_normkey_3);
+
+    return tc;
+}
@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define OVERFLOW_PAGE_SIZE (1024)
+#define OVERFLOW_BIG (5000)
+#define OVERFLOW_NKEYS (200)
+
+static uint8_t overflow_data[OVERFLOW_BIG];
+
+static void overflow_fill(chidb_key_t key)
+{
+    for(int i = 0; i < OVERFLOW_BIG; i++)
+        overflow_data[i] = (uint8_t) (key * 31 + i * 7);
+}
+
+/* Size of the record stored with key (some are large, some aren't) */
+static uint32_t overflow_size(chidb_key_t key)
+{
+    return key % 3 ? OVERFLOW_BIG - key : 100 + key;
+}
+
+static npage_t overflow_nfree(BTree *bt)
+{
+    MemPage *page;
+    npage_t nfree;
+
+    chidb_Pager_readPage(bt->pager, 1, &page);
+    nfree = get4byte(page->data + HEADER_FREELIST_COUNT_OFFSET);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+
+    return nfree;
+}
+
+static void overflow_check(BTree *bt, npage_t nroot, chidb_key_t key)
+{
+    uint8_t *data;
+    uint32_t size;
+
+    ck_assert(chidb_Btree_find2(bt, nroot, key, &data, &size) == CHIDB_OK);
+    ck_assert_int_eq(size, overflow_size(key));
+    overflow_fill(key);
+    ck_assert(memcmp(data, overflow_data, size) == 0);
+    free(data);
+}
+
+
+/* Large records are stored in overflow pages and read back */
+START_TEST (test_overflow_1)
+{
+    chidb *db;
+    uint8_t *data;
+    uint16_t size;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open2(fname, db, &db->bt, OVERFLOW_PAGE_SIZE, 0) == CHIDB_OK);
+    ck_assert(db->bt->features & BTREE_FEATURE_OVERFLOW);
+    ck_assert_int_eq(chidb_Btree_localSize(db->bt, 100), 100);
+    ck_assert(chidb_Btree_localSize(db->bt, OVERFLOW_BIG) < OVERFLOW_PAGE_SIZE / 4);
+
+    for(chidb_key_t key = 1; key <= OVERFLOW_NKEYS; key++)
+    {
+        overflow_fill(key);
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, key, overflow_data, overflow_size(key)) == CHIDB_OK);
+    }
+    ck_assert(db->bt->pager->n_pages > OVERFLOW_NKEYS * 2 / 3 * (OVERFLOW_BIG / OVERFLOW_PAGE_SIZE));
+
+    for(chidb_key_t key = 1; key <= OVERFLOW_NKEYS; key++)
+        overflow_check(db->bt, 1, key);
+
+    /* The 16-bit API still works for records that fit in it */
+    ck_assert(chidb_Btree_find(db->bt, 1, 2, &data, &size) == CHIDB_OK);
+    ck_assert_int_eq(size, overflow_size(2));
+    free(data);
+
+    /* The records survive closing the file */
+    chidb_Btree_close(db->bt);
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    for(chidb_key_t key = 1; key <= OVERFLOW_NKEYS; key++)
+        overflow_check(db->bt, 1, key);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Parts of a record can be read without reading all of it */
+START_TEST (test_overflow_2)
+{
+    chidb *db;
+    BTreeNode *btn;
+    BTreeCell cell;
+    uint8_t buf[OVERFLOW_BIG], *data;
+    uint16_t size;
+    uint32_t offsets[] = {0, 10, 200, 1000, 1019, 1020, 2500, OVERFLOW_BIG - 1};
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open2(fname, db, &db->bt, OVERFLOW_PAGE_SIZE, 0);
+
+    overflow_fill(1);
+    ck_assert(chidb_Btree_insertInTable(db->bt, 1, 1, overflow_data, OVERFLOW_BIG) == CHIDB_OK);
+
+    ck_assert(chidb_Btree_findCell(db->bt, 1, 1, &btn, &cell) == CHIDB_OK);
+    ck_assert_int_eq(cell.fields.tableLeaf.data_size, OVERFLOW_BIG);
+    ck_assert(cell.fields.tableLeaf.overflow_page != 0);
+    for(int i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++)
+    {
+        uint32_t len = OVERFLOW_BIG - offsets[i] < 1500 ? OVERFLOW_BIG - offsets[i] : 1500;
+
+        memset(buf, 0, sizeof(buf));
+        ck_assert(chidb_Btree_readPayload(db->bt, &cell, offsets[i], len, buf) == CHIDB_OK);
+        ck_assert(memcmp(buf, overflow_data + offsets[i], len) == 0);
+    }
+    ck_assert(chidb_Btree_readPayload(db->bt, &cell, OVERFLOW_BIG - 1, 2, buf) == CHIDB_EMISUSE);
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    /* Such records can't be returned without copying them, or in 16 bits */
+    ck_assert(chidb_Btree_findRef(db->bt, 1, 1, &btn, &data, &size) == CHIDB_EMISUSE);
+    data = calloc(UINT16_MAX + 1, 1);
+    ck_assert(chidb_Btree_insertInTable(db->bt, 1, 2, data, UINT16_MAX + 1) == CHIDB_OK);
+    free(data);
+    ck_assert(chidb_Btree_find(db->bt, 1, 2, &data, &size) == CHIDB_EMISUSE);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Deleting a record frees its overflow pages */
+START_TEST (test_overflow_3)
+{
+    chidb *db;
+    npage_t npages;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open2(fname, db, &db->bt, OVERFLOW_PAGE_SIZE, 0);
+
+    for(chidb_key_t key = 1; key <= OVERFLOW_NKEYS; key++)
+    {
+        overflow_fill(key);
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, key, overflow_data, overflow_size(key)) == CHIDB_OK);
+    }
+    npages = db->bt->pager->n_pages;
+
+    for(chidb_key_t key = 1; key <= OVERFLOW_NKEYS; key += 2)
+        ck_assert(chidb_Btree_delete(db->bt, 1, key) == CHIDB_OK);
+    ck_assert(overflow_nfree(db->bt) > npages / 3);
+    for(chidb_key_t key = 2; key <= OVERFLOW_NKEYS; key += 2)
+        overflow_check(db->bt, 1, key);
+
+    /* The freed pages are reused by new records */
+    for(chidb_key_t key = 1; key <= OVERFLOW_NKEYS; key += 2)
+    {
+        overflow_fill(key);
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, key, overflow_data, overflow_size(key)) == CHIDB_OK);
+    }
+    ck_assert(db->bt->pager->n_pages <= npages + npages / 10);
+    for(chidb_key_t key = 1; key <= OVERFLOW_NKEYS; key++)
+        overflow_check(db->bt, 1, key);
+
+    for(chidb_key_t key = 1; key <= OVERFLOW_NKEYS; key++)
+        ck_assert(chidb_Btree_delete(db->bt, 1, key) == CHIDB_OK);
+    ck_assert_int_eq(overflow_nfree(db->bt), db->bt->pager->n_pages - 1);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_overflow_tc(void)
+{
+    TCase *tc = tcase_create ("Overflow pages");
+    tcase_add_test (tc, test_overflow_1);
+    tcase_add_test (tc, test_overflow_2);
+    tcase_add_test (tc, test_overflow_3);
+
+    return tc;
+}
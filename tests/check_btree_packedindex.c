@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/record.h"
+
+#define PACKEDINDEX_NKEYS (5000)
+
+/* Keys in a scrambled order (PACKEDINDEX_NKEYS and 7919 are coprime) */
+static chidb_key_t packedindex_key(int i)
+{
+    return (i * 7919) % PACKEDINDEX_NKEYS + 1;
+}
+
+/* Builds an index with PACKEDINDEX_NKEYS entries, and returns the
+ * number of pages in the file */
+static npage_t packedindex_build(const char *fname, int flags, chidb **db, npage_t *nroot)
+{
+    *db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open2(fname, *db, &(*db)->bt, DEFAULT_PAGE_SIZE, flags) == CHIDB_OK);
+    chidb_Btree_newNode((*db)->bt, nroot, PGTYPE_INDEX_LEAF);
+
+    for(int i = 0; i < PACKEDINDEX_NKEYS; i++)
+        ck_assert(chidb_Btree_insertInIndex((*db)->bt, *nroot, packedindex_key(i), 3 * packedindex_key(i)) == CHIDB_OK);
+
+    return (*db)->bt->pager->n_pages;
+}
+
+static void packedindex_close(const char *fname, chidb *db)
+{
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+
+
+/* Packed cells hold the same entries in fewer pages */
+START_TEST (test_packedindex_1)
+{
+    chidb *db;
+    npage_t nroot, npages, npages_packed;
+    chidb_key_t pkey;
+
+    char *fname = create_tmp_file();
+    npages = packedindex_build(fname, 0, &db, &nroot);
+    packedindex_close(fname, db);
+
+    fname = create_tmp_file();
+    npages_packed = packedindex_build(fname, BTREE_PACKEDINDEX, &db, &nroot);
+    ck_assert(db->bt->features & BTREE_FEATURE_PACKEDINDEX);
+    ck_assert(npages_packed < npages * 2 / 3);
+
+    for(chidb_key_t key = 1; key <= PACKEDINDEX_NKEYS; key++)
+    {
+        ck_assert(chidb_Btree_findInIndex(db->bt, nroot, key, &pkey) == CHIDB_OK);
+        ck_assert_int_eq(pkey, 3 * key);
+    }
+    ck_assert(chidb_Btree_insertInIndex(db->bt, nroot, 1, 3) == CHIDB_EDUPLICATE);
+
+    /* The format is kept when the file is reopened */
+    chidb_Btree_close(db->bt);
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    ck_assert(db->bt->features & BTREE_FEATURE_PACKEDINDEX);
+    for(chidb_key_t key = 1; key <= PACKEDINDEX_NKEYS; key++)
+    {
+        ck_assert(chidb_Btree_findInIndex(db->bt, nroot, key, &pkey) == CHIDB_OK);
+        ck_assert_int_eq(pkey, 3 * key);
+    }
+
+    packedindex_close(fname, db);
+}
+END_TEST
+
+
+/* Packed leaf cells take as many bytes as their keys need */
+START_TEST (test_packedindex_2)
+{
+    chidb *db;
+    npage_t nroot;
+    BTreeNode *btn;
+    BTreeCell btc;
+    ncell_t ncell;
+    chidb_key_t keys[] = {1, 200, 70000, 4000000000u};
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open2(fname, db, &db->bt, DEFAULT_PAGE_SIZE, BTREE_PACKEDINDEX);
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+
+    btc.type = PGTYPE_INDEX_LEAF;
+    btc.key = 1;
+    btc.fields.indexLeaf.keyPk = 2;
+    ck_assert_int_eq(chidb_Btree_cellSize(db->bt, &btc), 2);
+    btc.key = 4000000000u;
+    ck_assert_int_eq(chidb_Btree_cellSize(db->bt, &btc), 6);
+    btc.type = PGTYPE_INDEX_INTERNAL;
+    ck_assert_int_eq(chidb_Btree_cellSize(db->bt, &btc), PACKEDIDXINTCELL_SIZE);
+
+    for(int i = 3; i >= 0; i--)
+        ck_assert(chidb_Btree_insertInIndex(db->bt, nroot, keys[i], i) == CHIDB_OK);
+
+    chidb_Btree_getNodeByPage(db->bt, nroot, &btn);
+    ck_assert_int_eq(btn->n_cells, 4);
+    ck_assert_int_eq(chidb_Pager_usableSize(db->bt->pager) - (btn->cells_offset - btn->free_offset)
+                     - chidb_Btree_headerSize(db->bt, PGTYPE_INDEX_LEAF) - 4 * 2, 2 + 3 + 4 + 6);
+    for(int i = 0; i < 4; i++)
+    {
+        chidb_Btree_getCell(btn, i, &btc);
+        ck_assert_int_eq(btc.key, keys[i]);
+        ck_assert_int_eq(btc.fields.indexLeaf.keyPk, i);
+        ck_assert(chidb_Btree_nodeSearch(btn, keys[i], &ncell) == CHIDB_OK);
+        ck_assert_int_eq(ncell, i);
+    }
+    ck_assert(chidb_Btree_nodeSearch(btn, 100, &ncell) == CHIDB_ENOTFOUND);
+    ck_assert_int_eq(ncell, 1);
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    packedindex_close(fname, db);
+}
+END_TEST
+
+
+/* Deleting and bulk loading work on packed indexes too */
+START_TEST (test_packedindex_3)
+{
+    chidb *db;
+    npage_t nroot, nroot2;
+    chidb_key_t pkey;
+
+    char *fname = create_tmp_file();
+    packedindex_build(fname, BTREE_PACKEDINDEX, &db, &nroot);
+
+    for(int i = 0; i < PACKEDINDEX_NKEYS; i++)
+        if (packedindex_key(i) % 2)
+            ck_assert(chidb_Btree_delete(db->bt, nroot, packedindex_key(i)) == CHIDB_OK);
+    for(chidb_key_t key = 1; key <= PACKEDINDEX_NKEYS; key++)
+        ck_assert(chidb_Btree_findInIndex(db->bt, nroot, key, &pkey) == (key % 2 ? CHIDB_ENOTFOUND : CHIDB_OK));
+
+    /* Rebuild the same index bottom-up from a table */
+    chidb_Btree_newNode(db->bt, &nroot2, PGTYPE_TABLE_LEAF);
+    for(chidb_key_t key = 1; key <= PACKEDINDEX_NKEYS; key++)
+    {
+        DBRecordBuffer dbrb;
+        DBRecord *dbr;
+        uint8_t *data;
+
+        chidb_DBRecord_create_empty(&dbrb, 2);
+        chidb_DBRecord_appendInt32(&dbrb, key);
+        chidb_DBRecord_appendInt32(&dbrb, PACKEDINDEX_NKEYS - key);
+        chidb_DBRecord_finalize(&dbrb, &dbr);
+        chidb_DBRecord_pack(dbr, &data);
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot2, key, data, dbr->packed_len) == CHIDB_OK);
+        chidb_DBRecord_destroy(dbr);
+        free(data);
+    }
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Btree_buildIndex(db->bt, nroot2, nroot, 1, 0) == CHIDB_OK);
+    for(chidb_key_t key = 1; key <= PACKEDINDEX_NKEYS; key++)
+    {
+        ck_assert(chidb_Btree_findInIndex(db->bt, nroot, PACKEDINDEX_NKEYS - key, &pkey) == CHIDB_OK);
+        ck_assert_int_eq(pkey, key);
+    }
+
+    packedindex_close(fname, db);
+}
+END_TEST
+
+
+TCase* make_btree_packedindex_tc(void)
+{
+    TCase *tc = tcase_create ("Packed index cells");
+    tcase_add_test (tc, test_packedindex_1);
+    tcase_add_test (tc, test_packedindex_2);
+    tcase_add_test (tc, test_packedindex_3);
+
+    return tc;
+}
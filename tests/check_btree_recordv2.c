@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/record.h"
+
+#define RECORDV2_NKEYS (2000)
+
+
+/* The record format is chosen when the file is created, and kept when
+ * it is reopened */
+START_TEST (test_recordv2_1)
+{
+    chidb *db;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open2(fname, db, &db->bt, DEFAULT_PAGE_SIZE, BTREE_RECORDV2) == CHIDB_OK);
+    ck_assert(db->bt->features & BTREE_FEATURE_RECORDV2);
+    ck_assert_int_eq(BTREE_RECORD_FORMAT(db->bt), DBRECORD_FORMAT_V2);
+
+    chidb_Btree_close(db->bt);
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    ck_assert(db->bt->features & BTREE_FEATURE_RECORDV2);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+
+    fname = create_tmp_file();
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    ck_assert_int_eq(BTREE_RECORD_FORMAT(db->bt), DBRECORD_FORMAT_V1);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* An index can be built on any column of a table of format v2 records */
+START_TEST (test_recordv2_2)
+{
+    chidb *db;
+    npage_t ntable, nindex;
+    chidb_key_t pkey;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open2(fname, db, &db->bt, DEFAULT_PAGE_SIZE, BTREE_RECORDV2) == CHIDB_OK);
+    chidb_Btree_newNode(db->bt, &ntable, PGTYPE_TABLE_LEAF);
+
+    for(chidb_key_t key = 1; key <= RECORDV2_NKEYS; key++)
+    {
+        DBRecordBuffer dbrb;
+        DBRecord *dbr;
+        uint8_t *data;
+        uint32_t len;
+
+        chidb_DBRecord_create_empty(&dbrb, 4);
+        chidb_DBRecord_appendString(&dbrb, "foo");
+        chidb_DBRecord_appendNull(&dbrb);
+        chidb_DBRecord_appendString(&dbrb, "scrumptrulescent");
+        chidb_DBRecord_appendInt32(&dbrb, RECORDV2_NKEYS - key);
+        chidb_DBRecord_finalize(&dbrb, &dbr);
+        ck_assert(chidb_DBRecord_packV2(dbr, &data, &len, NULL) == CHIDB_OK);
+        ck_assert(chidb_Btree_insertInTable(db->bt, ntable, key, data, len) == CHIDB_OK);
+        chidb_DBRecord_destroy(dbr);
+        free(data);
+    }
+
+    chidb_Btree_newNode(db->bt, &nindex, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Btree_buildIndex(db->bt, ntable, nindex, 3, 0) == CHIDB_OK);
+    for(chidb_key_t key = 1; key <= RECORDV2_NKEYS; key++)
+    {
+        ck_assert(chidb_Btree_findInIndex(db->bt, nindex, RECORDV2_NKEYS - key, &pkey) == CHIDB_OK);
+        ck_assert_int_eq(pkey, key);
+    }
+
+    /* Strings can't be indexed */
+    chidb_Btree_newNode(db->bt, &nindex, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Btree_buildIndex(db->bt, ntable, nindex, 2, 0) == CHIDB_EMISMATCH);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_recordv2_tc(void)
+{
+    TCase *tc = tcase_create ("Record format v2");
+    tcase_add_test (tc, test_recordv2_1);
+    tcase_add_test (tc, test_recordv2_2);
+
+    return tc;
+}
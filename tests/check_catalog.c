@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#include <chidb/chidb.h>
+#include "libchidb/catalog.h"
+#include "check_common.h"
+
+/* Runs a statement that returns no rows */
+static void exec_sql(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+
+/* The catalog has the tables of the schema, their columns and their
+ * indexes, and finds them whatever the case of their names */
+START_TEST (test_catalog_lookup)
+{
+    chidb *db;
+    chidb_catalog_table_t *t;
+    chidb_catalog_index_t *idx;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert(chidb_catalog_table(db, "t") == NULL);
+
+    exec_sql(db, "CREATE TABLE t (id INTEGER PRIMARY KEY, a INTEGER, s TEXT);");
+    exec_sql(db, "CREATE UNIQUE INDEX t_a ON t (a);");
+    exec_sql(db, "CREATE INDEX t_a_s ON t (a) INCLUDE (s);");
+    exec_sql(db, "CREATE INDEX t_id ON t (id) USING hash;");
+
+    t = chidb_catalog_table(db, "T");
+    ck_assert(t != NULL);
+    ck_assert_str_eq(t->name, "t");
+    ck_assert(t->nroot > 1);
+    ck_assert(!t->columnar);
+    ck_assert_int_eq(t->ncols, 3);
+    ck_assert_str_eq(t->cols[1].name, "a");
+    ck_assert_int_eq(t->cols[1].type, TYPE_INT);
+    ck_assert_int_eq(t->cols[2].type, TYPE_TEXT);
+    ck_assert(t->cols[0].pkey && !t->cols[1].pkey);
+    ck_assert_int_eq(chidb_catalog_column(t, "S"), 2);
+    ck_assert_int_eq(chidb_catalog_column(t, "nosuchcolumn"), -1);
+
+    /* The plain index on a is preferred to the covering one */
+    idx = chidb_catalog_index(t, "A");
+    ck_assert(idx != NULL);
+    ck_assert_str_eq(idx->name, "t_a");
+    ck_assert(idx->unique && !idx->covering && !idx->hash);
+    ck_assert(idx->nroot != t->nroot);
+    ck_assert(chidb_catalog_index(t, "s") == NULL);
+    ck_assert(chidb_catalog_hashIndex(t, "a") == NULL);
+
+    /* The hash index isn't read in order, so it's only a hash index */
+    ck_assert(chidb_catalog_index(t, "id") == NULL);
+    idx = chidb_catalog_hashIndex(t, "id");
+    ck_assert(idx != NULL);
+    ck_assert_str_eq(idx->name, "t_id");
+    ck_assert(idx->hash);
+
+    ck_assert(chidb_catalog_table(db, "nosuchtable") == NULL);
+    chidb_close(db);
+
+    /* And it's loaded from the schema when the file is opened again */
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    t = chidb_catalog_table(db, "t");
+    ck_assert(t != NULL);
+    ck_assert_int_eq(t->ncols, 3);
+    ck_assert_str_eq(chidb_catalog_index(t, "a")->name, "t_a");
+    chidb_close(db);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* A change to the schema through one connection increments the schema
+ * cookie, which makes the catalog of another connection load again
+ * before it's next used */
+START_TEST (test_catalog_cookie)
+{
+    chidb *db1, *db2;
+    chidb_catalog_table_t *t;
+    uint32_t cookie;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db1) == CHIDB_OK);
+    ck_assert(chidb_open(fname, &db2) == CHIDB_OK);
+
+    exec_sql(db1, "CREATE TABLE t (id INTEGER PRIMARY KEY, a INTEGER);");
+    ck_assert(chidb_catalog_table(db1, "t") != NULL);
+    ck_assert(chidb_catalog_table(db2, "t") != NULL);
+    ck_assert(db2->catalog->loaded);
+    cookie = db2->catalog->cookie;
+    ck_assert_int_eq(db1->catalog->cookie, cookie);
+
+    /* Looking up again, with no change, doesn't load it again */
+    ck_assert(chidb_catalog_table(db2, "t") != NULL);
+    ck_assert_int_eq(db2->catalog->cookie, cookie);
+
+    exec_sql(db1, "CREATE INDEX t_a ON t (a);");
+    exec_sql(db1, "CREATE TABLE u (id INTEGER PRIMARY KEY, b TEXT);");
+
+    /* db2 still has the old catalog until it looks a table up */
+    ck_assert_int_eq(db2->catalog->cookie, cookie);
+    ck_assert_int_eq(db2->catalog->ntables, 1);
+
+    t = chidb_catalog_table(db2, "t");
+    ck_assert(t != NULL);
+    ck_assert(db2->catalog->cookie != cookie);
+    ck_assert_int_eq(db2->catalog->ntables, 2);
+    ck_assert(chidb_catalog_index(t, "a") != NULL);
+    ck_assert_str_eq(chidb_catalog_index(t, "a")->name, "t_a");
+    ck_assert(chidb_catalog_table(db2, "u") != NULL);
+
+    /* And the other way round */
+    cookie = db2->catalog->cookie;
+    exec_sql(db2, "CREATE TABLE v (id INTEGER PRIMARY KEY);");
+    ck_assert(chidb_catalog_table(db1, "v") != NULL);
+    ck_assert(db1->catalog->cookie != cookie);
+    ck_assert_int_eq(db1->catalog->ntables, 3);
+
+    chidb_close(db2);
+    chidb_close(db1);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+Suite* make_catalog_suite (void)
+{
+    Suite *s = suite_create ("Catalog");
+
+    TCase *tc_catalog = tcase_create ("Catalog");
+    tcase_add_test (tc_catalog, test_catalog_lookup);
+    tcase_add_test (tc_catalog, test_catalog_cookie);
+    suite_add_tcase (s, tc_catalog);
+
+    return s;
+}
+
+int main (void)
+{
+    SRunner *sr;
+    int number_failed;
+
+    sr = srunner_create (make_catalog_suite ());
+
+    srunner_run_all (sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,11 +1,21 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <check.h>
 #include <dirent.h>
 #include <chidb/chidb.h>
+#include <chidb/arrow.h>
 #include "libchidb/dbm.h"
 #include "libchidb/dbm-file.h"
 #include "libchidb/dbm-types.h"
+#include "libchidb/dbm-cache.h"
+#include "libchidb/dbm-result.h"
+#include "libchidb/dbm-hash.h"
+#include "libchidb/dbm-sorter.h"
+#include "libchidb/dbm-agg.h"
+#include "libchidb/dbm-set.h"
+#include "libchidb/hashindex.h"
+#include "libchidb/plan.h"
 #include "check_common.h"
 
 // Make this array bigger if we ever have more than 1024 DBM tests
@@ -68,8 +78,10 @@ START_TEST (test_dbm)
                         "Expected register %i to have value %i but it has value %i", nReg, expected->value.i, actual->value.i);
                 break;
             case REG_STRING:
-                ck_assert_msg(strcmp(expected->value.s, actual->value.s) == 0,
-                        "Expected register %i to have value '%s' but it has value '%s'", nReg, expected->value.s, actual->value.s);
+                ck_assert_msg(chidb_dbm_reg_strlen(expected) == chidb_dbm_reg_strlen(actual) &&
+                        memcmp(chidb_dbm_reg_str(expected), chidb_dbm_reg_str(actual), chidb_dbm_reg_strlen(actual)) == 0,
+                        "Expected register %i to have value '%s' but it has value '%.*s'", nReg, chidb_dbm_reg_str(expected),
+                        (int) chidb_dbm_reg_strlen(actual), chidb_dbm_reg_str(actual));
                 break;
             case REG_BINARY:
                 /* TODO: Check value. Currently not supported by DMB file format. */
@@ -90,6 +102,1382 @@ END_TEST
 
 
 
+/* Common sequences are fused into superinstructions, leaving the rest
+ * of each sequence in place */
+START_TEST (test_peephole)
+{
+    chidb db;
+    chidb_stmt stmt;
+    chidb_dbm_op_t ops[] = {
+            {Op_Integer, 1, 0, 0, NULL},
+            {Op_ResultRow, 0, 1, 0, NULL},
+            {Op_Column, 0, 0, 1, NULL},
+            {Op_Column, 0, 1, 2, NULL},
+            {Op_Lt, 1, 9, 2, NULL},
+            {Op_Column, 0, 2, 3, NULL},
+            {Op_Column, 0, 3, 4, NULL},
+            {Op_Integer, 5, 5, 0, NULL},
+            {Op_SeekGe, 1, 10, 5, NULL},
+            {Op_IdxPKey, 1, 6, 0, NULL},
+            {Op_Halt, 0, 0, 0, NULL},
+    };
+    opcode_t fused[] = {Op_IntegerResultRow, Op_ResultRow, Op_ColumnCmpJump, Op_Column, Op_Lt,
+                        Op_Column, Op_Column, Op_Integer, Op_SeekGeIdxPKey, Op_IdxPKey, Op_Halt};
+    int nOps = sizeof(ops) / sizeof(chidb_dbm_op_t);
+
+    ck_assert(chidb_stmt_init(&stmt, &db) == CHIDB_OK);
+    for(int i=0; i < nOps; i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+
+    ck_assert(chidb_stmt_peephole(&stmt) == CHIDB_OK);
+    ck_assert_int_eq(stmt.endOp, nOps);
+    for(int i=0; i < nOps; i++)
+    {
+        ck_assert_int_eq(stmt.ops[i].opcode, fused[i]);
+        ck_assert_int_eq(stmt.ops[i].p1, ops[i].p1);
+        ck_assert_int_eq(stmt.ops[i].p2, ops[i].p2);
+    }
+
+    chidb_stmt_free(&stmt);
+}
+END_TEST
+
+
+/* Compiled programs branch on integer comparisons like the interpreter,
+ * and are discarded when the program changes */
+START_TEST (test_compile)
+{
+    chidb db;
+    chidb_stmt stmt;
+    chidb_dbm_op_t ops[] = {
+            {Op_Integer, 5, 0, 0, NULL},
+            {Op_Integer, 7, 1, 0, NULL},
+            {Op_Lt, 1, 4, 0, NULL},
+            {Op_Integer, 1, 2, 0, NULL},
+            {Op_Ge, 1, 6, 0, NULL},
+            {Op_Integer, 3, 3, 0, NULL},
+            {Op_Noop, 0, 0, 0, NULL},
+    };
+    int nOps = sizeof(ops) / sizeof(chidb_dbm_op_t);
+
+    ck_assert(chidb_stmt_init(&stmt, &db) == CHIDB_OK);
+    for(int i=0; i < nOps; i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+
+    stmt.compile = DBM_COMPILE_ALWAYS;
+    ck_assert(chidb_stmt_exec(&stmt) == CHIDB_DONE);
+    ck_assert(stmt.compiled != NULL);
+    ck_assert_int_eq(stmt.ninstr, 0);
+    ck_assert_int_eq(stmt.reg[0].value.i, 5);
+    ck_assert_int_eq(stmt.reg[1].value.i, 7);
+    ck_assert_int_eq(stmt.reg[2].type, REG_UNSPECIFIED);
+    ck_assert_int_eq(stmt.reg[3].type, REG_INT32);
+    ck_assert_int_eq(stmt.reg[3].value.i, 3);
+
+    chidb_stmt_set_op(&stmt, &ops[0], 0);
+    ck_assert(stmt.compiled == NULL);
+
+    chidb_stmt_free(&stmt);
+}
+END_TEST
+
+
+/* Typed comparisons branch on integers like the generic ones, compiled
+ * or not, don't jump on a register that holds no integer, and are fused
+ * like them */
+START_TEST (test_typed_compare)
+{
+    chidb *db;
+    chidb_stmt stmt;
+    chidb_dbm_op_t ops[] = {
+            {Op_Integer, 5, 0, 0, NULL},
+            {Op_Integer, 7, 1, 0, NULL},
+            {Op_LtInt, 1, 4, 0, NULL},
+            {Op_IfPos, 1, 4, 1, NULL},
+            {Op_GeInt, 1, 6, 0, NULL},
+            {Op_IfPos, 0, 6, 1, NULL},
+            {Op_EqInt, 2, 8, 2, NULL},
+            {Op_IfPos, 1, 8, 2, NULL},
+            {Op_Noop, 0, 0, 0, NULL},
+    };
+    chidb_dbm_op_t noop = {Op_Noop, 0, 0, 0, NULL};
+    chidb_dbm_op_t fuse[] = {
+            {Op_Column, 0, 0, 1, NULL},
+            {Op_Column, 0, 1, 2, NULL},
+            {Op_NeInt, 1, 3, 2, NULL},
+            {Op_Halt, 0, 0, 0, NULL},
+    };
+    int nOps = sizeof(ops) / sizeof(chidb_dbm_op_t);
+
+    ck_assert(chidb_open(":memory:", &db) == CHIDB_OK);
+    ck_assert(chidb_stmt_init(&stmt, db) == CHIDB_OK);
+    for(int i=0; i < nOps; i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+
+    stmt.compile = DBM_COMPILE_ALWAYS;
+    ck_assert(chidb_stmt_exec(&stmt) == CHIDB_DONE);
+    ck_assert(stmt.compiled != NULL);
+    ck_assert_int_eq(stmt.reg[0].value.i, 4);
+    ck_assert_int_eq(stmt.reg[1].value.i, 5);
+    ck_assert_int_eq(stmt.reg[2].type, REG_UNSPECIFIED);
+
+    /* Again in the interpreter, with the registers left as they are */
+    chidb_stmt_set_op(&stmt, &noop, 0);
+    chidb_stmt_set_op(&stmt, &noop, 1);
+    stmt.compile = DBM_COMPILE_NEVER;
+    stmt.pc = 0;
+    ck_assert(chidb_stmt_exec(&stmt) == CHIDB_DONE);
+    ck_assert(stmt.compiled == NULL);
+    ck_assert_int_eq(stmt.reg[0].value.i, 3);
+    ck_assert_int_eq(stmt.reg[1].value.i, 3);
+    chidb_stmt_free(&stmt);
+
+    ck_assert(chidb_stmt_init(&stmt, db) == CHIDB_OK);
+    for(int i=0; i < 4; i++)
+        chidb_stmt_set_op(&stmt, &fuse[i], i);
+    ck_assert(chidb_stmt_peephole(&stmt) == CHIDB_OK);
+    ck_assert_int_eq(stmt.ops[0].opcode, Op_ColumnCmpJump);
+    ck_assert_int_eq(stmt.ops[2].opcode, Op_NeInt);
+    chidb_stmt_free(&stmt);
+    chidb_close(db);
+}
+END_TEST
+
+
+/* A profiled statement counts the executions of each instruction, and
+ * runs in the interpreter even if it would be compiled */
+START_TEST (test_profile)
+{
+    chidb *db;
+    chidb_stmt stmt;
+    chidb_dbm_op_t ops[] = {
+            {Op_Integer, 5, 0, 0, NULL},
+            {Op_Integer, 7, 1, 0, NULL},
+            {Op_Lt, 1, 4, 0, NULL},
+            {Op_Integer, 1, 2, 0, NULL},
+            {Op_Noop, 0, 0, 0, NULL},
+    };
+    int nOps = sizeof(ops) / sizeof(chidb_dbm_op_t), n;
+    const chidb_profile_op *prof;
+
+    ck_assert(chidb_open(":memory:", &db) == CHIDB_OK);
+    ck_assert(chidb_stmt_init(&stmt, db) == CHIDB_OK);
+    for(int i=0; i < nOps; i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+
+    ck_assert(chidb_profile_get(&stmt, &n) == NULL);
+    ck_assert_int_eq(n, 0);
+
+    ck_assert(chidb_profile_start(&stmt) == CHIDB_OK);
+    stmt.compile = DBM_COMPILE_ALWAYS;
+    ck_assert(chidb_stmt_exec(&stmt) == CHIDB_DONE);
+    ck_assert(stmt.compiled == NULL);
+    ck_assert(chidb_stmt_reset(&stmt) == CHIDB_OK);
+    ck_assert(chidb_stmt_exec(&stmt) == CHIDB_DONE);
+
+    prof = chidb_profile_get(&stmt, &n);
+    ck_assert(prof != NULL);
+    ck_assert_int_eq(n, nOps);
+    ck_assert_str_eq(prof[0].opcode, "Integer");
+    ck_assert_str_eq(prof[2].opcode, "Lt");
+    ck_assert_int_eq(prof[0].count, 2);
+    ck_assert_int_eq(prof[2].count, 2);
+    ck_assert_int_eq(prof[3].count, 0);
+    ck_assert_int_eq(prof[3].cycles, 0);
+    ck_assert_int_eq(prof[4].count, 2);
+
+    chidb_stmt_free(&stmt);
+    chidb_close(db);
+}
+END_TEST
+
+
+/* A trace callback is told when each step begins and ends, with the
+ * statement stepped, and nothing once it is unset */
+static chidb_trace_event trace_events[8];
+static int trace_nevents;
+
+static void trace_record(chidb *db, const chidb_trace_event *ev)
+{
+    if (trace_nevents < 8)
+        trace_events[trace_nevents] = *ev;
+    trace_nevents++;
+}
+
+START_TEST (test_trace)
+{
+    chidb *db;
+    chidb_stmt stmt;
+    chidb_dbm_op_t ops[] = {
+            {Op_Integer, 5, 0, 0, NULL},
+            {Op_ResultRow, 0, 1, 0, NULL},
+            {Op_Halt, 0, 0, 0, NULL},
+    };
+    int nOps = sizeof(ops) / sizeof(chidb_dbm_op_t);
+
+    ck_assert(chidb_open(":memory:", &db) == CHIDB_OK);
+    ck_assert(chidb_stmt_init(&stmt, db) == CHIDB_OK);
+    for(int i=0; i < nOps; i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+
+    trace_nevents = 0;
+    ck_assert(chidb_set_trace(db, trace_record, CHIDB_TRACE_STEP) == CHIDB_OK);
+    ck_assert(chidb_step(&stmt) == CHIDB_ROW);
+    ck_assert_int_eq(trace_nevents, 2);
+    ck_assert_int_eq(trace_events[0].type, CHIDB_TRACE_STEP);
+    ck_assert_int_eq(trace_events[0].phase, CHIDB_TRACE_BEGIN);
+    ck_assert(trace_events[0].stmt == &stmt);
+    ck_assert_int_eq(trace_events[1].phase, CHIDB_TRACE_END);
+    ck_assert_int_eq(trace_events[1].rc, CHIDB_ROW);
+    ck_assert(trace_events[1].ns >= trace_events[0].ns);
+    ck_assert(trace_events[1].duration_ns == trace_events[1].ns - trace_events[0].ns);
+
+    ck_assert(chidb_set_trace(db, NULL, CHIDB_TRACE_ALL) == CHIDB_OK);
+    ck_assert(chidb_step(&stmt) == CHIDB_DONE);
+    ck_assert_int_eq(trace_nevents, 2);
+
+    chidb_stmt_free(&stmt);
+    chidb_close(db);
+}
+END_TEST
+
+
+/* EXPLAIN ANALYZE attributes each instruction to the operator it was
+ * marked with, counts the rows of each operator at the instruction that
+ * codegen told, and replaces the program with one that produces the
+ * plan */
+START_TEST (test_plan_analyze)
+{
+    chidb *db;
+    chidb_stmt stmt;
+    chidb_plan_t *plan;
+    chisql_statement_t sql_stmt = {.type = STMT_SELECT, .plan = PLAN_ANALYZE};
+    SRA_t *table, *select;
+    chidb_dbm_op_t ops[] = {
+            {Op_Integer, 5, 0, 0, NULL},
+            {Op_Integer, 7, 1, 0, NULL},
+            {Op_Lt, 1, 4, 0, NULL},
+            {Op_Integer, 1, 2, 0, NULL},
+            {Op_Noop, 0, 0, 0, NULL},
+    };
+    int nOps = sizeof(ops) / sizeof(chidb_dbm_op_t);
+
+    table = SRATable(TableReference_make("t", NULL));
+    select = SRASelect(table, Eq(TermColumnReference(ColumnReference_make("t", "a")), TermLiteral(litInt(1))));
+    sql_stmt.stmt.select = SRAProject(select, TermColumnReference(ColumnReference_make("t", "a")));
+
+    ck_assert(chidb_open(":memory:", &db) == CHIDB_OK);
+    ck_assert(chidb_stmt_init(&stmt, db) == CHIDB_OK);
+    ck_assert(chidb_plan_build(&stmt, &sql_stmt) == CHIDB_OK);
+    plan = stmt.plan;
+    ck_assert_int_eq(plan->n, 2);
+    ck_assert_str_eq(plan->nodes[0].detail, "PROJECT t.a");
+    ck_assert_str_eq(plan->nodes[1].detail, "-> SCAN TABLE t WHERE t.a = 1");
+    ck_assert_int_eq(plan->nodes[1].parent, 0);
+    ck_assert_int_eq(chidb_column_count(&stmt), 7);
+
+    for(int i=0; i < nOps; i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+    ck_assert(chidb_plan_mark(&stmt, select, 0, 3) == CHIDB_OK);
+    ck_assert(chidb_plan_mark(&stmt, sql_stmt.stmt.select, 0, nOps) == CHIDB_OK);
+    chidb_plan_row(&stmt, select, 2);
+
+    ck_assert(chidb_plan_analyze(&stmt) == CHIDB_OK);
+    ck_assert(plan->analyzed);
+    ck_assert_int_eq(plan->owner[1], 1);
+    ck_assert_int_eq(plan->owner[3], 0);
+    ck_assert_int_eq(plan->nodes[1].rows, 1);
+    ck_assert_int_eq(plan->nodes[0].rows, 0);
+    ck_assert(plan->nodes[0].ns >= plan->nodes[1].ns);
+
+    /* A row of seven columns per node, and a Halt */
+    ck_assert_int_eq(stmt.nCols, 7);
+    ck_assert_str_eq(stmt.cols[6], "time_us");
+    ck_assert_int_eq(stmt.endOp, 2 * 8 + 1);
+    ck_assert(stmt.ops[0].opcode == Op_Integer);
+    ck_assert(stmt.ops[1].opcode == Op_Null);
+    ck_assert(stmt.ops[7].opcode == Op_ResultRow);
+    ck_assert(stmt.ops[16].opcode == Op_Halt);
+    ck_assert(stmt.profile == NULL);
+
+    chidb_stmt_free(&stmt);
+    chidb_close(db);
+}
+END_TEST
+
+
+/* Variable loads the values bound to parameters, and a statement can be
+ * rebound and run again after a reset */
+START_TEST (test_variable)
+{
+    chidb db;
+    chidb_stmt stmt;
+    chidb_dbm_register_t r;
+    chidb_dbm_op_t ops[] = {
+            {Op_Variable, 0, 0, 0, NULL},
+            {Op_Variable, 1, 1, 0, NULL},
+            {Op_Variable, 2, 2, 0, NULL},
+    };
+    char s[] = "foo";
+    int nOps = sizeof(ops) / sizeof(chidb_dbm_op_t);
+
+    ck_assert(chidb_stmt_init(&stmt, &db) == CHIDB_OK);
+    for(int i=0; i < nOps; i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+    ck_assert(chidb_stmt_set_nparams(&stmt, 3) == CHIDB_OK);
+
+    r.type = REG_INT32;
+    r.value.i = 42;
+    ck_assert(chidb_stmt_set_param(&stmt, 0, &r) == CHIDB_OK);
+    r.type = REG_STRING;
+    r.value.s = s;
+    ck_assert(chidb_stmt_set_param(&stmt, 1, &r) == CHIDB_OK);
+    ck_assert(chidb_stmt_set_param(&stmt, 3, &r) == CHIDB_EMISUSE);
+    s[0] = 'b';
+
+    ck_assert(chidb_stmt_exec(&stmt) == CHIDB_DONE);
+    ck_assert_int_eq(stmt.reg[0].type, REG_INT32);
+    ck_assert_int_eq(stmt.reg[0].value.i, 42);
+    ck_assert_int_eq(stmt.reg[1].type, REG_STRING);
+    ck_assert_str_eq(chidb_dbm_reg_str(&stmt.reg[1]), "foo");
+    ck_assert_int_eq(stmt.reg[2].type, REG_NULL);
+
+    ck_assert(chidb_stmt_reset(&stmt) == CHIDB_OK);
+    ck_assert_int_eq(stmt.pc, 0);
+    ck_assert_int_eq(stmt.reg[0].type, REG_UNSPECIFIED);
+
+    r.type = REG_INT32;
+    r.value.i = 43;
+    ck_assert(chidb_stmt_set_param(&stmt, 0, &r) == CHIDB_OK);
+    ck_assert(chidb_stmt_set_param(&stmt, 1, NULL) == CHIDB_OK);
+    ck_assert(chidb_stmt_exec(&stmt) == CHIDB_DONE);
+    ck_assert_int_eq(stmt.reg[0].value.i, 43);
+    ck_assert_int_eq(stmt.reg[1].type, REG_NULL);
+
+    chidb_stmt_free(&stmt);
+}
+END_TEST
+
+
+/* chidb_step_batch returns the same rows as chidb_step, in columns
+ * (EXPLAIN rows are produced without running the program) */
+START_TEST (test_step_batch)
+{
+    chidb db;
+    chidb_stmt stmt;
+    chidb_rowbatch batch;
+    chidb_dbm_op_t ops[] = {
+            {Op_Integer, 1, 0, 0, NULL},
+            {Op_String, 3, 1, 0, "foo"},
+            {Op_Null, 0, 2, 0, NULL},
+            {Op_ResultRow, 0, 3, 0, NULL},
+            {Op_Halt, 0, 0, 0, NULL},
+    };
+    int nOps = sizeof(ops) / sizeof(chidb_dbm_op_t);
+    chidb_rowbatch_column *opcode, *p4;
+
+    ck_assert(chidb_stmt_init(&stmt, &db) == CHIDB_OK);
+    for(int i=0; i < nOps; i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+    stmt.explain = true;
+
+    ck_assert(chidb_rowbatch_init(&stmt, &batch, 3) == CHIDB_OK);
+    ck_assert_int_eq(batch.ncols, 6);
+    ck_assert(chidb_step_batch(&stmt, 4, &batch) == CHIDB_EMISUSE);
+
+    ck_assert(chidb_step_batch(&stmt, 3, &batch) == CHIDB_ROW);
+    ck_assert_int_eq(batch.nrows, 3);
+    opcode = &batch.cols[1];
+    p4 = &batch.cols[5];
+    for(int i = 0; i < 3; i++)
+    {
+        const char *name = opcode_to_str(ops[i].opcode);
+
+        ck_assert_int_eq(batch.cols[0].ints[i], i);
+        ck_assert_int_eq(batch.cols[3].ints[i], ops[i].p2);
+        ck_assert_int_eq(opcode->offsets[i + 1] - opcode->offsets[i], strlen(name));
+        ck_assert(!memcmp(opcode->data + opcode->offsets[i], name, strlen(name)));
+        ck_assert_int_eq(!!(p4->nulls[0] & (1 << i)), ops[i].p4 == NULL);
+    }
+    ck_assert_int_eq(p4->offsets[2] - p4->offsets[1], 3);
+    ck_assert(!memcmp(p4->data + p4->offsets[1], "foo", 3));
+
+    ck_assert(chidb_step_batch(&stmt, 3, &batch) == CHIDB_ROW);
+    ck_assert_int_eq(batch.nrows, 2);
+    ck_assert_int_eq(batch.cols[0].ints[1], 4);
+    ck_assert(chidb_step_batch(&stmt, 3, &batch) == CHIDB_DONE);
+    ck_assert_int_eq(batch.nrows, 0);
+
+    chidb_rowbatch_free(&batch);
+    chidb_stmt_free(&stmt);
+}
+END_TEST
+
+
+/* Result rows exported as an Arrow stream of struct arrays, with an
+ * int32 or utf8 child array per column */
+START_TEST (test_arrow)
+{
+    chidb db;
+    chidb_stmt stmt;
+    struct ArrowArrayStream stream;
+    struct ArrowSchema schema;
+    struct ArrowArray array, column;
+    chidb_dbm_op_t ops[] = {
+            {Op_Integer, 1, 0, 0, NULL},
+            {Op_String, 3, 1, 0, "foo"},
+            {Op_Null, 0, 2, 0, NULL},
+            {Op_ResultRow, 0, 3, 0, NULL},
+            {Op_Halt, 0, 0, 0, NULL},
+    };
+    const char *formats[] = {"i", "u", "i", "i", "i", "u"};
+    int nOps = sizeof(ops) / sizeof(chidb_dbm_op_t);
+    const uint8_t *validity;
+    const int32_t *offsets;
+
+    ck_assert(chidb_stmt_init(&stmt, &db) == CHIDB_OK);
+    for(int i=0; i < nOps; i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+    stmt.explain = true;
+
+    ck_assert(chidb_export_arrow(&stmt, 3, &stream) == CHIDB_OK);
+
+    ck_assert_int_eq(stream.get_schema(&stream, &schema), 0);
+    ck_assert_str_eq(schema.format, "+s");
+    ck_assert_int_eq(schema.n_children, 6);
+    for(int i = 0; i < 6; i++)
+    {
+        ck_assert_str_eq(schema.children[i]->format, formats[i]);
+        ck_assert_str_eq(schema.children[i]->name, chidb_column_name(&stmt, i));
+    }
+    schema.release(&schema);
+    ck_assert(schema.release == NULL);
+
+    ck_assert_int_eq(stream.get_next(&stream, &array), 0);
+    ck_assert_int_eq(array.length, 3);
+    ck_assert_int_eq(array.children[0]->length, 3);
+    ck_assert_int_eq(((const int32_t *) array.children[0]->buffers[1])[2], 2);
+    ck_assert_int_eq(array.children[5]->null_count, 2);
+    validity = array.children[5]->buffers[0];
+    ck_assert_int_eq(validity[0] & 0x7, 0x2);
+    offsets = array.children[5]->buffers[1];
+    ck_assert_int_eq(offsets[2] - offsets[1], 3);
+    ck_assert(!memcmp((const char *) array.children[5]->buffers[2] + offsets[1], "foo", 3));
+
+    /* A column can be moved out of the batch, and outlive it */
+    column = *array.children[1];
+    array.children[1]->release = NULL;
+    array.release(&array);
+    offsets = column.buffers[1];
+    ck_assert(!memcmp((const char *) column.buffers[2] + offsets[0], "Integer", offsets[1] - offsets[0]));
+    column.release(&column);
+
+    ck_assert_int_eq(stream.get_next(&stream, &array), 0);
+    ck_assert_int_eq(array.length, 2);
+    array.release(&array);
+    ck_assert_int_eq(stream.get_next(&stream, &array), 0);
+    ck_assert(array.release == NULL);
+
+    stream.release(&stream);
+    ck_assert(stream.release == NULL);
+    chidb_stmt_free(&stmt);
+}
+END_TEST
+
+
+/* Programs are cached by their normalized SQL, cloned into new
+ * statements, and evicted in LRU order */
+START_TEST (test_cache)
+{
+    chidb db;
+    chidb_stmt stmt, stmt2;
+    chidb_dbm_cache_t *cache;
+    chidb_dbm_op_t ops[] = {
+            {Op_Variable, 0, 0, 0, NULL},
+            {Op_String, 3, 1, 0, "foo"},
+            {Op_ResultRow, 0, 2, 0, NULL},
+    };
+    char sql[32], *norm;
+    int nOps = sizeof(ops) / sizeof(chidb_dbm_op_t);
+
+    norm = chidb_dbm_cache_normalize("  SELECT\t*  FROM t\n WHERE s = 'a  b' ;");
+    ck_assert_str_eq(norm, "SELECT * FROM t WHERE s = 'a  b'");
+    free(norm);
+
+    /* Comments are dropped, and a -- comment ends at its line */
+    norm = chidb_dbm_cache_normalize("SELECT * FROM t -- c\nWHERE id = 1");
+    ck_assert_str_eq(norm, "SELECT * FROM t WHERE id = 1");
+    free(norm);
+    norm = chidb_dbm_cache_normalize("SELECT * FROM t -- c WHERE id = 1");
+    ck_assert_str_eq(norm, "SELECT * FROM t");
+    free(norm);
+    norm = chidb_dbm_cache_normalize("SELECT/* it's */* FROM t -- isn't\nWHERE s = 'a--b' /* c");
+    ck_assert_str_eq(norm, "SELECT * FROM t WHERE s = 'a--b'");
+    free(norm);
+
+    ck_assert(chidb_dbm_cache_init(&cache) == CHIDB_OK);
+    ck_assert(chidb_stmt_init(&stmt, &db) == CHIDB_OK);
+    for(int i=0; i < nOps; i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+    stmt.nCols = 2;
+    stmt.cols = malloc(sizeof(char *) * 2);
+    stmt.cols[0] = "a";
+    stmt.cols[1] = "b";
+    chidb_stmt_set_nparams(&stmt, 1);
+    ck_assert(chidb_dbm_cache_put(cache, "SELECT a, b FROM t WHERE id = ?;", &stmt) == CHIDB_OK);
+
+    ck_assert(chidb_stmt_init(&stmt2, &db) == CHIDB_OK);
+    ck_assert(chidb_dbm_cache_get(cache, "select a, b from t where id = ?", &stmt2) == CHIDB_ENOTFOUND);
+    ck_assert(chidb_dbm_cache_get(cache, "SELECT a, b\n  FROM t WHERE id = ?", &stmt2) == CHIDB_OK);
+    ck_assert_int_eq(cache->hits, 1);
+    ck_assert_int_eq(cache->misses, 1);
+    ck_assert_int_eq(stmt2.endOp, nOps);
+    for(int i=0; i < nOps; i++)
+    {
+        ck_assert_int_eq(stmt2.ops[i].opcode, ops[i].opcode);
+        ck_assert_int_eq(stmt2.ops[i].p2, ops[i].p2);
+    }
+    ck_assert_str_eq(stmt2.ops[1].p4, "foo");
+    ck_assert(stmt2.ops[1].p4 != stmt.ops[1].p4);
+    ck_assert_int_eq(stmt2.nCols, 2);
+    ck_assert_str_eq(stmt2.cols[1], "b");
+    ck_assert_int_eq(stmt2.nParams, 1);
+    chidb_stmt_free(&stmt2);
+
+    /* The least recently used program is evicted */
+    for(int i=0; i < DBM_CACHE_SIZE; i++)
+    {
+        snprintf(sql, sizeof(sql), "SELECT %d", i);
+        ck_assert(chidb_dbm_cache_put(cache, sql, &stmt) == CHIDB_OK);
+    }
+    ck_assert_int_eq(cache->n, DBM_CACHE_SIZE);
+    ck_assert(chidb_stmt_init(&stmt2, &db) == CHIDB_OK);
+    ck_assert(chidb_dbm_cache_get(cache, "SELECT a, b FROM t WHERE id = ?", &stmt2) == CHIDB_ENOTFOUND);
+    ck_assert(chidb_dbm_cache_get(cache, "SELECT 0", &stmt2) == CHIDB_OK);
+    chidb_stmt_free(&stmt2);
+
+    chidb_dbm_cache_invalidate(cache);
+    ck_assert_int_eq(cache->n, 0);
+    ck_assert(cache->first == NULL && cache->last == NULL);
+
+    chidb_dbm_cache_free(cache);
+    free(stmt.cols);
+    chidb_stmt_free(&stmt);
+}
+END_TEST
+
+
+/* Loads a program into a statement */
+static void result_program(chidb *db, chidb_stmt *stmt, chidb_dbm_op_t *ops, int nOps)
+{
+    ck_assert(chidb_stmt_init(stmt, db) == CHIDB_OK);
+    for(int i=0; i < nOps; i++)
+        chidb_stmt_set_op(stmt, &ops[i], i);
+}
+
+/* Runs a statement that returns the value of its parameter, from the
+ * result cache or not, and returns whether it came from the cache */
+static bool result_run(chidb_stmt *stmt, int v)
+{
+    uint64_t hits = stmt->db->result_cache->hits;
+
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, v) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), v);
+    ck_assert_str_eq(chidb_column_text(stmt, 1), "a string that isn't inlined");
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+
+    return stmt->db->result_cache->hits > hits;
+}
+
+/* Rows of read-only statements are cached by their normalized SQL and
+ * parameters, until a statement writes to a table they read, and within
+ * the memory of the cache */
+START_TEST (test_result_cache)
+{
+    chidb *db;
+    chidb_stmt stmt, stmt2, write, write2, unknown;
+    chidb_dbm_op_t ops[] = {
+            {Op_Integer, 2, 3, 0, NULL},
+            {Op_OpenRead, 0, 3, 1, NULL},
+            {Op_Variable, 0, 0, 0, NULL},
+            {Op_String, 27, 1, 0, "a string that isn't inlined"},
+            {Op_ResultRow, 0, 2, 0, NULL},
+            {Op_Halt, 0, 0, 0, NULL},
+    };
+    chidb_dbm_op_t write_ops[] = {
+            {Op_Integer, 2, 0, 0, NULL},
+            {Op_OpenWrite, 0, 0, 1, NULL},
+            {Op_Halt, 0, 0, 0, NULL},
+    };
+    chidb_dbm_op_t write2_ops[] = {
+            {Op_Integer, 7, 0, 0, NULL},
+            {Op_OpenWrite, 0, 0, 1, NULL},
+            {Op_Halt, 0, 0, 0, NULL},
+    };
+    chidb_dbm_op_t unknown_ops[] = {
+            {Op_Null, 0, 0, 0, NULL},
+            {Op_OpenWrite, 0, 0, 1, NULL},
+            {Op_Halt, 0, 0, 0, NULL},
+    };
+    int nOps = sizeof(ops) / sizeof(chidb_dbm_op_t);
+    char *cols[] = {"a", "b"};
+    chidb_stats stats;
+
+    ck_assert(chidb_open(":memory:", &db) == CHIDB_OK);
+    result_program(db, &stmt, ops, nOps);
+    stmt.cols = cols;
+    stmt.nCols = 2;
+    chidb_stmt_set_nparams(&stmt, 1);
+    result_program(db, &write, write_ops, 3);
+    result_program(db, &write2, write2_ops, 3);
+    result_program(db, &unknown, unknown_ops, 3);
+
+    /* Disabled by default */
+    chidb_dbm_result_prepare(db->result_cache, "SELECT a, b FROM t WHERE a = ?", &stmt);
+    ck_assert(stmt.result_sql == NULL);
+    ck_assert(chidb_set_result_cache(db, 1 << 20) == CHIDB_OK);
+    chidb_dbm_result_prepare(db->result_cache, "SELECT a, b FROM t WHERE a = ?", &write);
+    ck_assert(write.result_sql == NULL);
+    chidb_dbm_result_prepare(db->result_cache, "SELECT a, b FROM t WHERE a = ?;", &stmt);
+    ck_assert_str_eq(stmt.result_sql, "SELECT a, b FROM t WHERE a = ?");
+
+    ck_assert(!result_run(&stmt, 1));
+    ck_assert(result_run(&stmt, 1));
+    ck_assert(!result_run(&stmt, 2));
+    ck_assert(result_run(&stmt, 2));
+    ck_assert(result_run(&stmt, 1));
+    ck_assert_int_eq(db->result_cache->n, 2);
+
+    /* Writing to another table keeps them, writing to the table doesn't */
+    ck_assert(chidb_step(&write2) == CHIDB_DONE);
+    ck_assert(result_run(&stmt, 1));
+    ck_assert(chidb_step(&write) == CHIDB_DONE);
+    ck_assert(!result_run(&stmt, 1));
+    ck_assert(result_run(&stmt, 1));
+    ck_assert(!result_run(&stmt, 2));
+
+    /* Neither does a write to tables that can't be told */
+    ck_assert(chidb_step(&unknown) == CHIDB_DONE);
+    ck_assert_int_eq(db->result_cache->n, 0);
+    ck_assert(!result_run(&stmt, 1));
+
+    /* An entry that is evicted while its rows are returned is kept until
+     * the statement is done with them */
+    result_program(db, &stmt2, ops, nOps);
+    stmt2.cols = cols;
+    stmt2.nCols = 2;
+    chidb_stmt_set_nparams(&stmt2, 1);
+    chidb_dbm_result_prepare(db->result_cache, "SELECT a, b\n FROM t WHERE a = ?", &stmt2);
+    ck_assert(chidb_bind_int(&stmt2, 1, 1) == CHIDB_OK);
+    ck_assert(chidb_step(&stmt2) == CHIDB_ROW);
+    ck_assert_int_eq(db->result_cache->hits, 6);
+    ck_assert(chidb_begin(db) == CHIDB_OK);
+    ck_assert(chidb_rollback(db) == CHIDB_OK);
+    ck_assert_int_eq(db->result_cache->n, 0);
+    ck_assert_str_eq(chidb_column_text(&stmt2, 1), "a string that isn't inlined");
+    ck_assert(chidb_step(&stmt2) == CHIDB_DONE);
+    ck_assert(chidb_reset(&stmt2) == CHIDB_OK);
+
+    /* A -- comment ends at the end of its line, so these are not the
+     * same query */
+    chidb_dbm_result_prepare(db->result_cache, "SELECT a, b FROM t -- c\nWHERE a = ?", &stmt2);
+    ck_assert_str_eq(stmt2.result_sql, "SELECT a, b FROM t WHERE a = ?");
+    ck_assert(!result_run(&stmt2, 3));
+    ck_assert(result_run(&stmt2, 3));
+    chidb_dbm_result_prepare(db->result_cache, "SELECT a, b FROM t -- c WHERE a = ?", &stmt2);
+    ck_assert_str_eq(stmt2.result_sql, "SELECT a, b FROM t");
+    ck_assert(!result_run(&stmt2, 3));
+    ck_assert_int_eq(db->result_cache->n, 2);
+    chidb_dbm_result_invalidate(db->result_cache);
+
+    /* Rows that don't fit are not cached, and entries are evicted in
+     * LRU order */
+    ck_assert(!result_run(&stmt, 1));
+    ck_assert(chidb_set_result_cache(db, db->result_cache->bytes) == CHIDB_OK);
+    ck_assert(!result_run(&stmt, 2));
+    ck_assert(!result_run(&stmt, 1));
+    ck_assert_int_eq(db->result_cache->n, 1);
+    ck_assert(chidb_set_result_cache(db, 16) == CHIDB_OK);
+    ck_assert_int_eq(db->result_cache->n, 0);
+    ck_assert(!result_run(&stmt, 1));
+    ck_assert_int_eq(db->result_cache->n, 0);
+
+    ck_assert(chidb_stats_get(db, &stats) == CHIDB_OK);
+    ck_assert_int_eq(stats.result_cache_hits, db->result_cache->hits);
+    ck_assert_int_eq(stats.result_cache_misses, db->result_cache->misses);
+
+    chidb_stmt_free(&stmt);
+    chidb_stmt_free(&stmt2);
+    chidb_stmt_free(&write);
+    chidb_stmt_free(&write2);
+    chidb_stmt_free(&unknown);
+    chidb_close(db);
+}
+END_TEST
+
+
+/* Outside a transaction, a statement that fails halfway leaves the file
+ * as it was, and the next statement doesn't commit what it wrote */
+START_TEST (test_autocommit)
+{
+    chidb *db;
+    chidb_stmt stmt, stmt2;
+    npage_t nroot;
+    chidb_key_t pk;
+    chidb_dbm_op_t ops[] = {
+            {Op_Integer, 0, 0, 0, NULL},
+            {Op_Integer, 1, 2, 0, NULL},
+            {Op_Integer, 1, 1, 0, NULL},
+            {Op_HashIdxInsert, 0, 1, 2, NULL},
+            {Op_Integer, 2, 1, 0, NULL},
+            {Op_HashIdxInsert, 0, 1, 2, NULL},
+            {Op_Integer, 1, 1, 0, NULL},
+            {Op_HashIdxInsert, 0, 1, 2, NULL},
+            {Op_Halt, 0, 0, 0, NULL},
+    };
+    int nOps = sizeof(ops) / sizeof(chidb_dbm_op_t);
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert(chidb_hashindex_create(db->bt, &nroot) == CHIDB_OK);
+    ck_assert(chidb_Pager_flush(db->bt->pager) == CHIDB_OK);
+    ops[0].p1 = nroot;
+
+    /* Inserts 1 and 2, and then 1 again */
+    ck_assert(chidb_stmt_init(&stmt, db) == CHIDB_OK);
+    for(int i=0; i < nOps; i++)
+        chidb_stmt_set_op(&stmt, &ops[i], i);
+    ck_assert(chidb_step(&stmt) == CHIDB_EDUPLICATE);
+    ck_assert(chidb_get_autocommit(db));
+    ck_assert(chidb_hashindex_find(db->bt, nroot, 1, &pk) == CHIDB_ENOTFOUND);
+    ck_assert(chidb_hashindex_find(db->bt, nroot, 2, &pk) == CHIDB_ENOTFOUND);
+    chidb_stmt_free(&stmt);
+
+    /* Inserts 3 */
+    ck_assert(chidb_stmt_init(&stmt2, db) == CHIDB_OK);
+    for(int i=0; i < 4; i++)
+        chidb_stmt_set_op(&stmt2, &ops[i], i);
+    ops[2].p1 = 3;
+    chidb_stmt_set_op(&stmt2, &ops[2], 2);
+    ck_assert(chidb_step(&stmt2) == CHIDB_DONE);
+    ck_assert(chidb_get_autocommit(db));
+    chidb_stmt_free(&stmt2);
+    chidb_close(db);
+
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert(chidb_hashindex_find(db->bt, nroot, 1, &pk) == CHIDB_ENOTFOUND);
+    ck_assert(chidb_hashindex_find(db->bt, nroot, 2, &pk) == CHIDB_ENOTFOUND);
+    ck_assert(chidb_hashindex_find(db->bt, nroot, 3, &pk) == CHIDB_OK);
+    ck_assert_int_eq(pk, 1);
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Short values are stored in the register, long ones are borrowed or
+ * owned, and shallow copies never allocate */
+START_TEST (test_registers)
+{
+    chidb_dbm_register_t r1 = {REG_UNSPECIFIED}, r2 = {REG_UNSPECIFIED}, r3 = {REG_UNSPECIFIED};
+    const char *s = "a string that doesn't fit in a register";
+    char page[] = "short|long string in a page|";
+    uint8_t bytes[64] = {1, 2, 3};
+
+    ck_assert(chidb_dbm_reg_set_string(&r1, page, 5, REG_BORROWED_PAGE) == CHIDB_OK);
+    ck_assert_int_eq(r1.storage, REG_INLINE);
+    ck_assert_str_eq(chidb_dbm_reg_str(&r1), "short");
+
+    ck_assert(chidb_dbm_reg_set_string(&r1, s, strlen(s), REG_BORROWED) == CHIDB_OK);
+    ck_assert_int_eq(r1.storage, REG_BORROWED);
+    ck_assert(chidb_dbm_reg_str(&r1) == s);
+    ck_assert_int_eq(chidb_dbm_reg_strlen(&r1), strlen(s));
+
+    ck_assert(chidb_dbm_reg_set_string(&r1, page + 6, 21, REG_BORROWED_PAGE) == CHIDB_OK);
+    ck_assert(chidb_dbm_reg_str(&r1) == page + 6);
+    ck_assert_int_eq(chidb_dbm_reg_strlen(&r1), 21);
+
+    /* Copies own what they don't borrow from an instruction or a page */
+    ck_assert(chidb_dbm_reg_copy(&r2, &r1) == CHIDB_OK);
+    ck_assert_int_eq(r2.storage, REG_OWNED);
+    ck_assert_str_eq(chidb_dbm_reg_str(&r2), "long string in a page");
+    chidb_dbm_reg_scopy(&r3, &r2);
+    ck_assert_int_eq(r3.storage, REG_BORROWED);
+    ck_assert(chidb_dbm_reg_str(&r3) == chidb_dbm_reg_str(&r2));
+
+    ck_assert(chidb_dbm_reg_set_binary(&r1, bytes, 3, REG_BORROWED) == CHIDB_OK);
+    ck_assert_int_eq(r1.storage, REG_INLINE);
+    ck_assert_int_eq(chidb_dbm_reg_nbytes(&r1), 3);
+    ck_assert_int_eq(chidb_dbm_reg_bytes(&r1)[2], 3);
+    ck_assert(chidb_dbm_reg_set_binary(&r1, bytes, sizeof(bytes), REG_OWNED) == CHIDB_OK);
+    ck_assert(chidb_dbm_reg_bytes(&r1) != bytes);
+    ck_assert_int_eq(chidb_dbm_reg_nbytes(&r1), sizeof(bytes));
+
+    chidb_dbm_reg_clear(&r1);
+    chidb_dbm_reg_clear(&r3);
+    chidb_dbm_reg_clear(&r2);
+    ck_assert_int_eq(r2.type, REG_UNSPECIFIED);
+}
+END_TEST
+
+
+/* A hash join finds the same matches whether the build side fits in
+ * memory or has its partitions spilled to files */
+START_TEST (test_hashjoin)
+{
+    size_t budgets[] = {DBM_HASH_BUDGET, 256};
+
+    for(int b = 0; b < 2; b++)
+    {
+        chidb_dbm_hash_t h;
+        chidb_dbm_register_t row[2] = {{REG_UNSPECIFIED}}, r = {REG_UNSPECIFIED};
+        char s[32];
+        int nmatches = 0, sum = 0;
+        bool found;
+
+        ck_assert(chidb_dbm_hash_init(&h, 2, 2, budgets[b]) == CHIDB_OK);
+
+        /* Keys 0 to 199, five rows each, and a NULL key that never matches */
+        for(int i = 0; i < 1000; i++)
+        {
+            row[0].type = REG_INT32;
+            row[0].value.i = i % 200;
+            snprintf(s, sizeof(s), "build row %d", i);
+            ck_assert(chidb_dbm_reg_set_string(&row[1], s, strlen(s), REG_OWNED) == CHIDB_OK);
+            ck_assert(chidb_dbm_hash_insert(&h, row) == CHIDB_OK);
+        }
+        row[0].type = REG_NULL;
+        ck_assert(chidb_dbm_hash_insert(&h, row) == CHIDB_OK);
+        ck_assert(h.spilled == (b == 1));
+
+        chidb_dbm_reg_clear(&row[1]);
+        for(int j = 0; j < 300; j++)
+        {
+            row[0].type = REG_INT32;
+            row[0].value.i = j;
+            row[1].type = REG_INT32;
+            row[1].value.i = j * 10;
+            ck_assert(chidb_dbm_hash_probe(&h, row, &found) == CHIDB_OK);
+            for(; found; ck_assert(chidb_dbm_hash_next(&h, &found) == CHIDB_OK))
+            {
+                ck_assert(chidb_dbm_hash_column(&h, 0, &r) == CHIDB_OK);
+                ck_assert_int_eq(r.value.i, j);
+                ck_assert(chidb_dbm_hash_column(&h, 3, &r) == CHIDB_OK);
+                sum += r.value.i;
+                nmatches++;
+            }
+        }
+
+        ck_assert(chidb_dbm_hash_deferred(&h, &found) == CHIDB_OK);
+        for(; found; ck_assert(chidb_dbm_hash_next(&h, &found) == CHIDB_OK))
+        {
+            ck_assert(chidb_dbm_hash_column(&h, 0, &r) == CHIDB_OK);
+            int key = r.value.i;
+            ck_assert(chidb_dbm_hash_column(&h, 1, &r) == CHIDB_OK);
+            ck_assert_int_eq(r.type, REG_STRING);
+            ck_assert(!memcmp(chidb_dbm_reg_str(&r), "build row ", 10));
+            ck_assert(chidb_dbm_hash_column(&h, 3, &r) == CHIDB_OK);
+            ck_assert_int_eq(r.value.i, key * 10);
+            sum += r.value.i;
+            nmatches++;
+        }
+
+        ck_assert_int_eq(nmatches, 1000);
+        ck_assert_int_eq(sum, 5 * 10 * (199 * 200 / 2));
+        chidb_dbm_hash_free(&h);
+    }
+}
+END_TEST
+
+
+/* A semi-join finds a single match per probe row, however many build
+ * rows have its key, in memory or in a spilled partition */
+START_TEST (test_hashjoin_semi)
+{
+    size_t budgets[] = {DBM_HASH_BUDGET, 64};
+
+    for(int b = 0; b < 2; b++)
+    {
+        chidb_dbm_hash_t h;
+        chidb_dbm_register_t row = {REG_INT32}, r = {REG_UNSPECIFIED};
+        int nmatches = 0, sum = 0;
+        bool found;
+
+        ck_assert(chidb_dbm_hash_init(&h, 1, 1, budgets[b]) == CHIDB_OK);
+        h.semi = true;
+
+        /* Keys 0 to 199, five times each */
+        for(int i = 0; i < 1000; i++)
+        {
+            row.value.i = i % 200;
+            ck_assert(chidb_dbm_hash_insert(&h, &row) == CHIDB_OK);
+        }
+        if (b == 0)
+            ck_assert_int_eq(h.nkeys, 200);
+
+        for(int j = 0; j < 300; j++)
+        {
+            row.value.i = j;
+            ck_assert(chidb_dbm_hash_probe(&h, &row, &found) == CHIDB_OK);
+            if (found)
+            {
+                ck_assert(chidb_dbm_hash_column(&h, 1, &r) == CHIDB_OK);
+                sum += r.value.i;
+                nmatches++;
+                ck_assert(chidb_dbm_hash_next(&h, &found) == CHIDB_OK);
+                ck_assert(!found);
+            }
+        }
+
+        ck_assert(chidb_dbm_hash_deferred(&h, &found) == CHIDB_OK);
+        for(; found; ck_assert(chidb_dbm_hash_next(&h, &found) == CHIDB_OK))
+        {
+            ck_assert(chidb_dbm_hash_column(&h, 1, &r) == CHIDB_OK);
+            sum += r.value.i;
+            nmatches++;
+        }
+
+        ck_assert_int_eq(nmatches, 200);
+        ck_assert_int_eq(sum, 199 * 200 / 2);
+        chidb_dbm_hash_free(&h);
+    }
+}
+END_TEST
+
+
+/* A set has the values of an IN list, without NULLs or duplicates, and
+ * returns them sorted: integers first, then strings */
+START_TEST (test_set)
+{
+    const char *strs[] = {"pear", "apple", "fig", "apple", "figs"};
+    int32_t ints[] = {42, -7, 1000000, 42, 0, -7};
+    chidb_dbm_register_t regs[12] = {{REG_UNSPECIFIED}}, r = {REG_UNSPECIFIED};
+    chidb_dbm_set_t set;
+    bool found;
+    uint32_t n = 0;
+
+    for(int i = 0; i < 6; i++, n++)
+    {
+        regs[n].type = REG_INT32;
+        regs[n].value.i = ints[i];
+    }
+    for(int i = 0; i < 5; i++, n++)
+        ck_assert(chidb_dbm_reg_set_string(&regs[n], strs[i], strlen(strs[i]), REG_OWNED) == CHIDB_OK);
+    regs[n++].type = REG_NULL;
+
+    ck_assert(chidb_dbm_set_init(&set, regs, n) == CHIDB_OK);
+    ck_assert_int_eq(set.nints, 4);
+    ck_assert_int_eq(set.nvals, 4);
+
+    for(uint32_t i = 0; i < n; i++)
+        ck_assert(chidb_dbm_set_contains(&set, &regs[i]) == (regs[i].type != REG_NULL));
+    r.type = REG_INT32;
+    r.value.i = 41;
+    ck_assert(!chidb_dbm_set_contains(&set, &r));
+    ck_assert(chidb_dbm_reg_set_string(&r, "fi", 2, REG_OWNED) == CHIDB_OK);
+    ck_assert(!chidb_dbm_set_contains(&set, &r));
+    ck_assert(chidb_dbm_reg_set_string(&r, "42", 2, REG_OWNED) == CHIDB_OK);
+    ck_assert(!chidb_dbm_set_contains(&set, &r));
+    chidb_dbm_reg_clear(&r);
+
+    const char *expected[] = {"apple", "fig", "figs", "pear"};
+    int32_t expectedInts[] = {-7, 0, 42, 1000000};
+    for(int i = 0; i < 8; i++)
+    {
+        ck_assert(chidb_dbm_set_next(&set, &r, &found) == CHIDB_OK);
+        ck_assert(found);
+        if (i < 4)
+        {
+            ck_assert_int_eq(r.type, REG_INT32);
+            ck_assert_int_eq(r.value.i, expectedInts[i]);
+        }
+        else
+        {
+            ck_assert_int_eq(r.type, REG_STRING);
+            ck_assert_int_eq(chidb_dbm_reg_strlen(&r), strlen(expected[i - 4]));
+            ck_assert(!memcmp(chidb_dbm_reg_str(&r), expected[i - 4], strlen(expected[i - 4])));
+        }
+    }
+    ck_assert(chidb_dbm_set_next(&set, &r, &found) == CHIDB_OK);
+    ck_assert(!found);
+
+    chidb_dbm_reg_clear(&r);
+    chidb_dbm_set_free(&set);
+    for(uint32_t i = 0; i < n; i++)
+        chidb_dbm_reg_clear(&regs[i]);
+}
+END_TEST
+
+
+/* A sorter returns its rows ordered by their first value (NULLs, then
+ * integers, then strings), in either order, keeping rows with equal
+ * keys in the order they were inserted, whether they fit in memory or
+ * are merged from runs */
+START_TEST (test_sorter)
+{
+    size_t budgets[] = {DBM_SORTER_BUDGET, 1024};
+
+    for(int t = 0; t < 4; t++)
+    {
+        chidb_dbm_sorter_t s;
+        chidb_dbm_register_t row[2] = {{REG_UNSPECIFIED}}, r = {REG_UNSPECIFIED};
+        bool desc = t & 1, found;
+        char str[64], prevStr[64] = "";
+        int n = 0, nstr = 0, prev = 0, prevSeq = 0;
+        int type, prevType = desc ? REG_STRING + 1 : REG_UNSPECIFIED;
+
+        ck_assert(chidb_dbm_sorter_init(&s, 2, desc, budgets[t / 2]) == CHIDB_OK);
+
+        /* Integer keys, repeated, strings that only differ past their
+         * prefix, and a NULL */
+        for(int i = 0; i < 2000; i++)
+        {
+            if (i % 10 == 9)
+            {
+                snprintf(str, sizeof(str), "a long string key %d", (i * 7919) % 101);
+                ck_assert(chidb_dbm_reg_set_string(&row[0], str, strlen(str), REG_OWNED) == CHIDB_OK);
+            }
+            else
+            {
+                chidb_dbm_reg_clear(&row[0]);
+                row[0].type = i == 1000 ? REG_NULL : REG_INT32;
+                row[0].value.i = (i * 7919) % 500 - 250;
+            }
+            row[1].type = REG_INT32;
+            row[1].value.i = i;
+            ck_assert(chidb_dbm_sorter_insert(&s, row) == CHIDB_OK);
+            if (chidb_dbm_sorter_full(&s))
+                ck_assert(chidb_dbm_sorter_spill(&s) == CHIDB_OK);
+        }
+        chidb_dbm_reg_clear(&row[0]);
+        ck_assert((s.nruns > 0) == (t / 2 == 1));
+
+        ck_assert(chidb_dbm_sorter_sort(&s, &found) == CHIDB_OK);
+        for(; found; ck_assert(chidb_dbm_sorter_next(&s, &found) == CHIDB_OK))
+        {
+            ck_assert(chidb_dbm_sorter_column(&s, 0, &r) == CHIDB_OK);
+            type = r.type;
+            ck_assert(desc ? type <= prevType : type >= prevType);
+            if (type == REG_STRING)
+            {
+                snprintf(str, sizeof(str), "%.*s", chidb_dbm_reg_strlen(&r), chidb_dbm_reg_str(&r));
+                if (type == prevType)
+                    ck_assert(desc ? strcmp(str, prevStr) <= 0 : strcmp(str, prevStr) >= 0);
+                strcpy(prevStr, str);
+                nstr++;
+            }
+            else if (type == REG_INT32)
+            {
+                if (type == prevType)
+                    ck_assert(desc ? r.value.i <= prev : r.value.i >= prev);
+                if (type == prevType && r.value.i == prev)
+                {
+                    ck_assert(chidb_dbm_sorter_column(&s, 1, &r) == CHIDB_OK);
+                    ck_assert(r.value.i > prevSeq);
+                }
+                ck_assert(chidb_dbm_sorter_column(&s, 0, &r) == CHIDB_OK);
+                prev = r.value.i;
+            }
+            ck_assert(chidb_dbm_sorter_column(&s, 1, &r) == CHIDB_OK);
+            prevSeq = r.value.i;
+            prevType = type;
+            n++;
+        }
+        ck_assert_int_eq(n, 2000);
+        ck_assert_int_eq(nstr, 200);
+
+        chidb_dbm_sorter_free(&s);
+    }
+}
+END_TEST
+
+
+/* A sorter with a limit returns the same rows as the start of a full
+ * sort, including among ties, whatever order the rows come in */
+START_TEST (test_sorter_limit)
+{
+    for(int t = 0; t < 4; t++)
+    {
+        chidb_dbm_sorter_t full, top;
+        chidb_dbm_register_t row[2] = {{REG_UNSPECIFIED}}, r1 = {REG_UNSPECIFIED}, r2 = {REG_UNSPECIFIED};
+        bool desc = t & 1, found1, found2;
+        int n = 0;
+
+        ck_assert(chidb_dbm_sorter_init(&full, 2, desc, DBM_SORTER_BUDGET) == CHIDB_OK);
+        ck_assert(chidb_dbm_sorter_init(&top, 2, desc, DBM_SORTER_BUDGET) == CHIDB_OK);
+        ck_assert(chidb_dbm_sorter_limit(&top, 50) == CHIDB_OK);
+
+        /* Keys with many ties, or keys in the order that replaces the
+         * top of the heap for every row */
+        for(int i = 0; i < 5000; i++)
+        {
+            row[0].type = REG_INT32;
+            row[0].value.i = t < 2 ? (i * 7919) % 300 : (desc ? i : -i);
+            row[1].type = REG_INT32;
+            row[1].value.i = i;
+            ck_assert(chidb_dbm_sorter_insert(&full, row) == CHIDB_OK);
+            ck_assert(chidb_dbm_sorter_insert(&top, row) == CHIDB_OK);
+        }
+        ck_assert_int_eq(top.nentries, 50);
+        ck_assert(top.used <= 2 * 50 * 10);
+
+        ck_assert(chidb_dbm_sorter_sort(&full, &found1) == CHIDB_OK);
+        ck_assert(chidb_dbm_sorter_sort(&top, &found2) == CHIDB_OK);
+        for(; found2; n++)
+        {
+            ck_assert(found1);
+            for(int col = 0; col < 2; col++)
+            {
+                ck_assert(chidb_dbm_sorter_column(&full, col, &r1) == CHIDB_OK);
+                ck_assert(chidb_dbm_sorter_column(&top, col, &r2) == CHIDB_OK);
+                ck_assert_int_eq(r1.value.i, r2.value.i);
+            }
+            ck_assert(chidb_dbm_sorter_next(&full, &found1) == CHIDB_OK);
+            ck_assert(chidb_dbm_sorter_next(&top, &found2) == CHIDB_OK);
+        }
+        ck_assert_int_eq(n, 50);
+
+        chidb_dbm_sorter_free(&full);
+        chidb_dbm_sorter_free(&top);
+    }
+}
+END_TEST
+
+
+/* An aggregator computes the functions of each group, whether its groups
+ * fit in memory or some are spilled to partitions, and whether it hashes
+ * the groups or gets its rows ordered by their key (streaming) */
+START_TEST (test_agg)
+{
+    size_t budgets[] = {DBM_AGG_BUDGET, 256, DBM_AGG_BUDGET};
+
+    for(int t = 0; t < 3; t++)
+    {
+        chidb_dbm_agg_t a;
+        chidb_dbm_register_t row[5] = {{REG_UNSPECIFIED}}, r = {REG_UNSPECIFIED};
+        bool streaming = t == 2, done, found, seen[200] = {false};
+        char s[32];
+        int ngroups = 0;
+
+        ck_assert(chidb_dbm_agg_init(&a, 1, "count,sum,min,max", streaming, budgets[t]) == CHIDB_OK);
+
+        /* Keys 0 to 199, fifteen rows each (in key order when streaming),
+         * and a NULL that only COUNT(*) counts */
+        for(int i = 0; i < 3000; i++)
+        {
+            int k = streaming ? i / 15 : i % 200, v = streaming ? k + 200 * (i % 15) : i;
+
+            row[0].type = REG_INT32;
+            row[0].value.i = k;
+            row[1].type = REG_INT32;
+            row[1].value.i = 1;
+            row[2].type = REG_INT32;
+            row[2].value.i = v;
+            row[3].type = REG_INT32;
+            row[3].value.i = v;
+            snprintf(s, sizeof(s), "v%05d", v);
+            ck_assert(chidb_dbm_reg_set_string(&row[4], s, strlen(s), REG_OWNED) == CHIDB_OK);
+            ck_assert(chidb_dbm_agg_step(&a, row, &done) == CHIDB_OK);
+            ck_assert(done == (streaming && i > 0 && i % 15 == 0));
+            if (done)
+            {
+                ck_assert(chidb_dbm_agg_column(&a, 0, &r) == CHIDB_OK);
+                ck_assert_int_eq(r.value.i, k - 1);
+                ck_assert(chidb_dbm_agg_column(&a, 1, &r) == CHIDB_OK);
+                ck_assert_int_eq(r.value.i, 15);
+                ngroups++;
+            }
+        }
+        row[2].type = REG_NULL;
+        row[3].type = REG_NULL;
+        chidb_dbm_reg_clear(&row[4]);
+        row[4].type = REG_NULL;
+        ck_assert(chidb_dbm_agg_step(&a, row, &done) == CHIDB_OK);
+        ck_assert(a.spilled == (t == 1));
+
+        ck_assert(chidb_dbm_agg_final(&a, &found) == CHIDB_OK);
+        for(; found; ck_assert(chidb_dbm_agg_next(&a, &found) == CHIDB_OK))
+        {
+            ck_assert(chidb_dbm_agg_column(&a, 0, &r) == CHIDB_OK);
+            int k = r.value.i;
+            ck_assert(k >= 0 && k < 200 && !seen[k]);
+            seen[k] = true;
+            ck_assert(chidb_dbm_agg_column(&a, 1, &r) == CHIDB_OK);
+            ck_assert_int_eq(r.value.i, k == 199 ? 16 : 15);
+            ck_assert(chidb_dbm_agg_column(&a, 2, &r) == CHIDB_OK);
+            ck_assert_int_eq(r.value.i, 15 * k + 200 * (14 * 15 / 2));
+            ck_assert(chidb_dbm_agg_column(&a, 3, &r) == CHIDB_OK);
+            ck_assert_int_eq(r.value.i, k);
+            ck_assert(chidb_dbm_agg_column(&a, 4, &r) == CHIDB_OK);
+            snprintf(s, sizeof(s), "v%05d", k + 200 * 14);
+            ck_assert_int_eq(r.type, REG_STRING);
+            ck_assert(chidb_dbm_reg_strlen(&r) == strlen(s) && !memcmp(chidb_dbm_reg_str(&r), s, strlen(s)));
+            ngroups++;
+        }
+        ck_assert_int_eq(ngroups, 200);
+        chidb_dbm_agg_free(&a);
+    }
+}
+END_TEST
+
+
+/* The rows of a parallel scan are aggregated by several copies of an
+ * aggregator, some of which spill, and their groups are merged into it
+ * (itself spilling or not) */
+START_TEST (test_agg_merge)
+{
+    size_t budgets[] = {DBM_AGG_BUDGET, 256};
+
+    for(int t = 0; t < 2; t++)
+    {
+        chidb_dbm_agg_t a, parts[4];
+        chidb_dbm_register_t row[5] = {{REG_UNSPECIFIED}}, r = {REG_UNSPECIFIED};
+        bool done, found, seen[200] = {false};
+        int ngroups = 0;
+
+        ck_assert(chidb_dbm_agg_init(&a, 1, "count,sum,min,max", false, budgets[t]) == CHIDB_OK);
+        for(int p = 0; p < 4; p++)
+            ck_assert(chidb_dbm_agg_clone(&parts[p], &a, p % 2 ? 256 : DBM_AGG_BUDGET) == CHIDB_OK);
+
+        /* Keys 0 to 199, fifteen rows each, spread over the copies */
+        for(int i = 0; i < 3000; i++)
+        {
+            row[0].type = REG_INT32;
+            row[0].value.i = i % 200;
+            row[1].type = REG_INT32;
+            row[1].value.i = 1;
+            for(int c = 2; c < 5; c++)
+            {
+                row[c].type = REG_INT32;
+                row[c].value.i = i;
+            }
+            ck_assert(chidb_dbm_agg_step(&parts[i % 4], row, &done) == CHIDB_OK);
+        }
+        ck_assert(parts[1].spilled && !parts[0].spilled);
+
+        for(int p = 0; p < 4; p++)
+        {
+            ck_assert(chidb_dbm_agg_merge(&a, &parts[p]) == CHIDB_OK);
+            chidb_dbm_agg_free(&parts[p]);
+        }
+        ck_assert(a.spilled == (t == 1));
+
+        ck_assert(chidb_dbm_agg_final(&a, &found) == CHIDB_OK);
+        for(; found; ck_assert(chidb_dbm_agg_next(&a, &found) == CHIDB_OK))
+        {
+            ck_assert(chidb_dbm_agg_column(&a, 0, &r) == CHIDB_OK);
+            int k = r.value.i;
+            ck_assert(k >= 0 && k < 200 && !seen[k]);
+            seen[k] = true;
+            ck_assert(chidb_dbm_agg_column(&a, 1, &r) == CHIDB_OK);
+            ck_assert_int_eq(r.value.i, 15);
+            ck_assert(chidb_dbm_agg_column(&a, 2, &r) == CHIDB_OK);
+            ck_assert_int_eq(r.value.i, 15 * k + 200 * (14 * 15 / 2));
+            ck_assert(chidb_dbm_agg_column(&a, 3, &r) == CHIDB_OK);
+            ck_assert_int_eq(r.value.i, k);
+            ck_assert(chidb_dbm_agg_column(&a, 4, &r) == CHIDB_OK);
+            ck_assert_int_eq(r.value.i, k + 200 * 14);
+            ngroups++;
+        }
+        ck_assert_int_eq(ngroups, 200);
+        chidb_dbm_agg_free(&a);
+    }
+}
+END_TEST
+
+
+/* Checks the sides of the current group of test_agg_sides */
+static void check_agg_sides(chidb_dbm_agg_t *a, bool *seen, int *nboth, int *nfirst)
+{
+    chidb_dbm_register_t r = {REG_UNSPECIFIED};
+    int v;
+
+    ck_assert(chidb_dbm_agg_column(a, 0, &r) == CHIDB_OK);
+    v = r.value.i;
+    ck_assert(v >= 0 && v < 1500 && !seen[v]);
+    seen[v] = true;
+    ck_assert(chidb_dbm_agg_column(a, 1, &r) == CHIDB_OK);
+    ck_assert_int_eq(r.type, REG_INT32);
+    ck_assert_int_eq(r.value.i, v >= 1000 ? 2 : v % 3 == 0 ? 3 : 1);
+    *nboth += r.value.i == 3;
+    *nfirst += r.value.i == 1;
+}
+
+/* INTERSECT and EXCEPT: the values 0 to 999 of a first input, and the
+ * multiples of 3 of a second one, each value twice, with "sides" telling
+ * which inputs had each value, whether it is in memory, in a spilled
+ * partition, or in a streaming aggregator fed by merging the inputs */
+START_TEST (test_agg_sides)
+{
+    size_t budgets[] = {DBM_AGG_BUDGET, 512, DBM_AGG_BUDGET};
+
+    for(int t = 0; t < 3; t++)
+    {
+        chidb_dbm_agg_t a;
+        chidb_dbm_register_t row[2] = {{REG_UNSPECIFIED}};
+        bool streaming = t == 2, done, found, seen[1500] = {false};
+        int nboth = 0, nfirst = 0, i1 = 0, i2 = 0;
+
+        ck_assert(chidb_dbm_agg_init(&a, 1, "sides", streaming, budgets[t]) == CHIDB_OK);
+
+        /* Step both inputs one after the other, or merged in order */
+        while (i1 < 2000 || i2 < 1000)
+        {
+            bool first = streaming ? i2 == 1000 || (i1 < 2000 && i1 / 2 <= i2 / 2 * 3)
+                                   : i1 < 2000;
+
+            row[0].type = REG_INT32;
+            row[0].value.i = first ? i1++ / 2 : i2++ / 2 * 3;
+            row[1].type = REG_INT32;
+            row[1].value.i = first ? 1 : 2;
+            ck_assert(chidb_dbm_agg_step(&a, row, &done) == CHIDB_OK);
+            if (done)
+                check_agg_sides(&a, seen, &nboth, &nfirst);
+        }
+        ck_assert(a.spilled == (t == 1));
+
+        ck_assert(chidb_dbm_agg_final(&a, &found) == CHIDB_OK);
+        for(; found; ck_assert(chidb_dbm_agg_next(&a, &found) == CHIDB_OK))
+            check_agg_sides(&a, seen, &nboth, &nfirst);
+        ck_assert_int_eq(nboth, 334);
+        ck_assert_int_eq(nfirst, 666);
+        chidb_dbm_agg_free(&a);
+    }
+}
+END_TEST
+
+
+/* Without a key, an aggregator has a single group, even if it has no
+ * rows, whose COUNT is 0 and whose other functions are NULL */
+START_TEST (test_agg_empty)
+{
+    chidb_dbm_agg_t a;
+    chidb_dbm_register_t r = {REG_UNSPECIFIED};
+    bool found;
+
+    ck_assert(chidb_dbm_agg_init(&a, 0, "count,sum,avg,max", false, DBM_AGG_BUDGET) == CHIDB_OK);
+    ck_assert(chidb_dbm_agg_final(&a, &found) == CHIDB_OK);
+    ck_assert(found);
+    ck_assert(chidb_dbm_agg_column(&a, 0, &r) == CHIDB_OK);
+    ck_assert_int_eq(r.type, REG_INT32);
+    ck_assert_int_eq(r.value.i, 0);
+    for(int col = 1; col < 4; col++)
+    {
+        ck_assert(chidb_dbm_agg_column(&a, col, &r) == CHIDB_OK);
+        ck_assert_int_eq(r.type, REG_NULL);
+    }
+    ck_assert(chidb_dbm_agg_next(&a, &found) == CHIDB_OK);
+    ck_assert(!found);
+    chidb_dbm_agg_free(&a);
+
+    ck_assert(chidb_dbm_agg_init(&a, 0, "count,median", false, DBM_AGG_BUDGET) == CHIDB_EMISUSE);
+}
+END_TEST
+
+
 int main (void)
 {
     SRunner *sr;
@@ -152,6 +1540,59 @@ int main (void)
         exit(1);
     }
 
+    s = suite_create ("dbm-peephole");
+    TCase *tc = tcase_create ("Superinstructions");
+    tcase_add_test (tc, test_peephole);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Compiled programs");
+    tcase_add_test (tc, test_compile);
+    tcase_add_test (tc, test_typed_compare);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Profiling");
+    tcase_add_test (tc, test_profile);
+    tcase_add_test (tc, test_plan_analyze);
+    tcase_add_test (tc, test_trace);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Parameters");
+    tcase_add_test (tc, test_variable);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Registers");
+    tcase_add_test (tc, test_registers);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Program cache");
+    tcase_add_test (tc, test_cache);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Result cache");
+    tcase_add_test (tc, test_result_cache);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Transactions");
+    tcase_add_test (tc, test_autocommit);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Batched results");
+    tcase_add_test (tc, test_step_batch);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Arrow export");
+    tcase_add_test (tc, test_arrow);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Hash joins");
+    tcase_add_test (tc, test_hashjoin);
+    tcase_add_test (tc, test_hashjoin_semi);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Sets");
+    tcase_add_test (tc, test_set);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Sorters");
+    tcase_add_test (tc, test_sorter);
+    tcase_add_test (tc, test_sorter_limit);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Aggregates");
+    tcase_add_test (tc, test_agg);
+    tcase_add_test (tc, test_agg_empty);
+    tcase_add_test (tc, test_agg_sides);
+    tcase_add_test (tc, test_agg_merge);
+    suite_add_tcase (s, tc);
+    srunner_add_suite(sr, s);
+
     srunner_run_all (sr, CK_NORMAL);
     number_failed = srunner_ntests_failed (sr);
     srunner_free (sr);
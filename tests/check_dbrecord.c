@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 #include "libchidb/record.h"
 
@@ -177,6 +178,200 @@ START_TEST (test_packunpack)
 END_TEST
 
 
+START_TEST (test_view)
+{
+    DBRecord *dbr;
+    DBRecordView view;
+    const char *s;
+    int8_t i8;
+    int16_t i16;
+    int32_t i32;
+    uint8_t *buf;
+    int len;
+
+    for(int i=0; i<NVALUES; i++)
+    {
+        chidb_DBRecord_create(&dbr, "|s|0|i1|i2|i4|", str_values[i], int8_values[i], int16_values[i], int32_values[i]);
+        chidb_DBRecord_pack(dbr, &buf);
+
+        /* Fields can be read in any order */
+        chidb_DBRecordView_init(&view, buf);
+        ck_assert_int_eq(chidb_DBRecordView_getType(&view, 4), SQL_INTEGER_4BYTE);
+        ck_assert(chidb_DBRecordView_getInt32(&view, 4, &i32) == CHIDB_OK);
+        ck_assert_int_eq(int32_values[i], i32);
+
+        ck_assert_int_eq(chidb_DBRecordView_getType(&view, 0), SQL_TEXT);
+        ck_assert(chidb_DBRecordView_getString(&view, 0, &s, &len) == CHIDB_OK);
+        ck_assert_int_eq(strlen(str_values[i]), len);
+        ck_assert(strncmp(str_values[i], s, len) == 0);
+        ck_assert(s == (const char *) buf + buf[0]);
+
+        ck_assert_int_eq(chidb_DBRecordView_getType(&view, 1), SQL_NULL);
+        ck_assert(chidb_DBRecordView_getInt8(&view, 2, &i8) == CHIDB_OK);
+        ck_assert_int_eq(int8_values[i], i8);
+        ck_assert(chidb_DBRecordView_getInt16(&view, 3, &i16) == CHIDB_OK);
+        ck_assert_int_eq(int16_values[i], i16);
+
+        ck_assert(chidb_DBRecordView_getInt16(&view, 2, &i16) == CHIDB_EMISMATCH);
+        ck_assert_int_eq(chidb_DBRecordView_getType(&view, 5), SQL_NOTVALID);
+        ck_assert_int_eq(chidb_DBRecordView_nfields(&view), 5);
+
+        /* Only the header up to the field asked for is parsed */
+        chidb_DBRecordView_init(&view, buf);
+        chidb_DBRecordView_getInt8(&view, 2, &i8);
+        ck_assert_int_eq(view.nparsed, 3);
+
+        chidb_DBRecord_destroy(dbr);
+        free(buf);
+    }
+}
+END_TEST
+
+
+/* Records built in an arena are the same as malloc'd ones, and resetting
+ * the arena between rows reuses its memory */
+START_TEST (test_arena)
+{
+    DBRecordArena arena;
+    DBRecordBuffer dbrb;
+    DBRecord *dbr, *dbr2;
+    uint8_t *buf, *buf2, *first;
+    char *s;
+    int32_t i32;
+
+    chidb_DBRecordArena_init(&arena);
+
+    for(int row=0; row<3; row++)
+        for(int i=0; i<NVALUES; i++)
+        {
+            chidb_DBRecordArena_reset(&arena);
+            ck_assert(chidb_DBRecord_create_empty2(&dbrb, 3, &arena) == CHIDB_OK);
+            if (row == 0 && i == 0)
+                first = (uint8_t *) dbrb.dbr;
+            else
+                ck_assert(first == (uint8_t *) dbrb.dbr);
+            chidb_DBRecord_appendString(&dbrb, str_values[i]);
+            chidb_DBRecord_appendNull(&dbrb);
+            chidb_DBRecord_appendInt32(&dbrb, int32_values[i]);
+            ck_assert(chidb_DBRecord_finalize(&dbrb, &dbr) == CHIDB_OK);
+            ck_assert(chidb_DBRecord_pack2(dbr, &buf, &arena) == CHIDB_OK);
+
+            chidb_DBRecord_getString(dbr, 0, &s);
+            ck_assert_str_eq(str_values[i], s);
+            free(s);
+            chidb_DBRecord_getInt32(dbr, 2, &i32);
+            ck_assert_int_eq(int32_values[i], i32);
+
+            chidb_DBRecord_create(&dbr2, "|s|0|i4|", str_values[i], int32_values[i]);
+            chidb_DBRecord_pack(dbr2, &buf2);
+            ck_assert_int_eq(dbr->packed_len, dbr2->packed_len);
+            ck_assert(memcmp(buf, buf2, dbr->packed_len) == 0);
+
+            ck_assert(chidb_DBRecord_destroy(dbr) == CHIDB_OK);
+            chidb_DBRecord_destroy(dbr2);
+            free(buf2);
+        }
+
+    /* Data larger than a block */
+    char big[3 * DBRECORDARENA_BLOCK_SIZE + 1];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    chidb_DBRecordArena_reset(&arena);
+    chidb_DBRecord_create_empty2(&dbrb, 2, &arena);
+    chidb_DBRecord_appendInt8(&dbrb, 42);
+    ck_assert(chidb_DBRecord_appendString(&dbrb, big) == CHIDB_OK);
+    ck_assert(chidb_DBRecord_finalize(&dbrb, &dbr) == CHIDB_OK);
+    chidb_DBRecord_getString(dbr, 1, &s);
+    ck_assert_str_eq(big, s);
+    free(s);
+
+    /* A header that doesn't fit in one byte */
+    chidb_DBRecordArena_reset(&arena);
+    chidb_DBRecord_create_empty2(&dbrb, 64, &arena);
+    for(int i=0; i<64; i++)
+        chidb_DBRecord_appendString(&dbrb, "foo");
+    ck_assert(chidb_DBRecord_finalize(&dbrb, &dbr) == CHIDB_OK);
+    ck_assert(chidb_DBRecord_pack2(dbr, &buf, &arena) == CHIDB_EMISUSE);
+
+    chidb_DBRecordArena_free(&arena);
+}
+END_TEST
+
+
+/* Records in format v2 have the same fields as in format v1, and a view
+ * reads any field without reading the ones before it */
+START_TEST (test_v2)
+{
+    DBRecord *dbr, *dbr2;
+    DBRecordView view;
+    const char *s;
+    char *s2;
+    int8_t i8;
+    int32_t i32;
+    uint8_t *buf;
+    uint32_t len;
+    int slen;
+
+    for(int i=0; i<NVALUES; i++)
+    {
+        chidb_DBRecord_create(&dbr, "|s|0|i1|i2|i4|", str_values[i], int8_values[i], int16_values[i], int32_values[i]);
+        ck_assert(chidb_DBRecord_packV2(dbr, &buf, &len, NULL) == CHIDB_OK);
+        ck_assert_int_eq(len, DBRECORDV2_TYPES_OFFSET + 5 + 2 * 6 + dbr->data_len);
+        ck_assert_int_eq(buf[0], 5);
+        ck_assert_int_eq(buf[1], 2);
+
+        ck_assert(chidb_DBRecordView_initV2(&view, buf) == CHIDB_OK);
+        ck_assert_int_eq(chidb_DBRecordView_nfields(&view), 5);
+        ck_assert(chidb_DBRecordView_getInt32(&view, 4, &i32) == CHIDB_OK);
+        ck_assert_int_eq(int32_values[i], i32);
+        ck_assert_int_eq(chidb_DBRecordView_getType(&view, 1), SQL_NULL);
+        ck_assert(chidb_DBRecordView_getString(&view, 0, &s, &slen) == CHIDB_OK);
+        ck_assert_int_eq(strlen(str_values[i]), slen);
+        ck_assert(strncmp(str_values[i], s, slen) == 0);
+        ck_assert(chidb_DBRecordView_getInt8(&view, 2, &i8) == CHIDB_OK);
+        ck_assert_int_eq(int8_values[i], i8);
+        ck_assert_int_eq(chidb_DBRecordView_getType(&view, 5), SQL_NOTVALID);
+
+        ck_assert(chidb_DBRecord_unpackV2(&dbr2, buf) == CHIDB_OK);
+        ck_assert_int_eq(dbr2->nfields, 5);
+        ck_assert_int_eq(dbr2->packed_len, dbr->packed_len);
+        chidb_DBRecord_getString(dbr2, 0, &s2);
+        ck_assert_str_eq(str_values[i], s2);
+        free(s2);
+        chidb_DBRecord_getInt32(dbr2, 4, &i32);
+        ck_assert_int_eq(int32_values[i], i32);
+
+        chidb_DBRecord_destroy(dbr);
+        chidb_DBRecord_destroy(dbr2);
+        free(buf);
+    }
+
+    /* Records too large for 2-byte offsets, and with more strings than
+     * the format v1 header can hold */
+    DBRecordBuffer dbrb;
+    char big[70000];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    chidb_DBRecord_create_empty(&dbrb, 100);
+    for(int i=0; i<99; i++)
+        chidb_DBRecord_appendString(&dbrb, str_values[i % NVALUES]);
+    chidb_DBRecord_appendString(&dbrb, big);
+    chidb_DBRecord_finalize(&dbrb, &dbr);
+    ck_assert(chidb_DBRecord_packV2(dbr, &buf, &len, NULL) == CHIDB_OK);
+    ck_assert_int_eq(buf[1], 4);
+
+    chidb_DBRecordView_initV2(&view, buf);
+    ck_assert(chidb_DBRecordView_getString(&view, 99, &s, &slen) == CHIDB_OK);
+    ck_assert_int_eq(slen, sizeof(big) - 1);
+    ck_assert(chidb_DBRecordView_getString(&view, 50, &s, &slen) == CHIDB_OK);
+    ck_assert(strncmp(str_values[50 % NVALUES], s, slen) == 0);
+
+    chidb_DBRecord_destroy(dbr);
+    free(buf);
+}
+END_TEST
+
+
 Suite* make_dbrecord_suite (void)
 {
     Suite *s = suite_create ("DB Record");
@@ -197,6 +392,18 @@ Suite* make_dbrecord_suite (void)
     tcase_add_test (tc_packunpack, test_packunpack);
     suite_add_tcase (s, tc_packunpack);
 
+    TCase *tc_view = tcase_create ("Record views");
+    tcase_add_test (tc_view, test_view);
+    suite_add_tcase (s, tc_view);
+
+    TCase *tc_arena = tcase_create ("Records in an arena");
+    tcase_add_test (tc_arena, test_arena);
+    suite_add_tcase (s, tc_arena);
+
+    TCase *tc_v2 = tcase_create ("Record format v2");
+    tcase_add_test (tc_v2, test_v2);
+    suite_add_tcase (s, tc_v2);
+
     return s;
 }
 
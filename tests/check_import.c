@@ -0,0 +1,335 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include <chidb/chidb.h>
+#include "libchidb/btree.h"
+#include "libchidb/record.h"
+#include "libchidb/catalog.h"
+#include "check_common.h"
+
+/* Runs a statement that returns no rows */
+static void exec_sql(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+/* Opens a new database with table t (id, name, n) and an index on n */
+static chidb *open_import_db(char **fname)
+{
+    chidb *db;
+
+    *fname = create_tmp_file();
+    ck_assert(chidb_open(*fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT, n INTEGER);");
+    exec_sql(db, "CREATE INDEX t_n ON t (n);");
+
+    return db;
+}
+
+/* Writes a file to import, whose extension tells its format */
+static char *write_import_file(const char *name, const char *text)
+{
+    char *f = generated_file_path(name);
+    FILE *fp = fopen(f, "w");
+
+    ck_assert(fp != NULL);
+    ck_assert_int_eq(fwrite(text, 1, strlen(text), fp), strlen(text));
+    fclose(fp);
+
+    return f;
+}
+
+/* Checks that row key of table t is (key, name, n), where a NULL name
+ * or a negative n is a NULL value */
+static void check_import_row(chidb *db, chidb_key_t key, const char *name, int32_t n)
+{
+    chidb_catalog_table_t *t = chidb_catalog_table(db, "t");
+    DBRecord *dbr;
+    uint8_t *data;
+    uint32_t size;
+    int32_t v;
+    char *s;
+
+    ck_assert(t != NULL);
+    ck_assert(chidb_Btree_find2(db->bt, t->nroot, key, &data, &size) == CHIDB_OK);
+    ck_assert(chidb_DBRecord_unpack(&dbr, data) == CHIDB_OK);
+    ck_assert_int_eq(dbr->nfields, 3);
+
+    ck_assert(chidb_DBRecord_getInt32(dbr, 0, &v) == CHIDB_OK);
+    ck_assert_int_eq(v, key);
+    if (name == NULL)
+        ck_assert_int_eq(chidb_DBRecord_getType(dbr, 1), SQL_NULL);
+    else
+    {
+        ck_assert(chidb_DBRecord_getString(dbr, 1, &s) == CHIDB_OK);
+        ck_assert_str_eq(s, name);
+        free(s);
+    }
+    if (n < 0)
+        ck_assert_int_eq(chidb_DBRecord_getType(dbr, 2), SQL_NULL);
+    else
+    {
+        ck_assert(chidb_DBRecord_getInt32(dbr, 2, &v) == CHIDB_OK);
+        ck_assert_int_eq(v, n);
+    }
+
+    chidb_DBRecord_destroy(dbr);
+    free(data);
+}
+
+/* Checks the number of rows of table t, and of entries of its index */
+static void check_import_count(chidb *db, uint64_t nrows, uint64_t nentries)
+{
+    chidb_catalog_table_t *t = chidb_catalog_table(db, "t");
+    uint64_t n;
+
+    ck_assert(t != NULL);
+    ck_assert(chidb_Btree_count(db->bt, t->nroot, &n) == CHIDB_OK);
+    ck_assert_int_eq(n, nrows);
+    ck_assert(chidb_Btree_count(db->bt, chidb_catalog_index(t, "n")->nroot, &n) == CHIDB_OK);
+    ck_assert_int_eq(n, nentries);
+}
+
+
+/* In a CSV file, a quoted field can have separators, newlines and
+ * doubled quotes, quotes elsewhere are text, and lines can end in
+ * "\r\n" */
+START_TEST (test_import_csv)
+{
+    chidb *db;
+    char *fname, *csv;
+    unsigned int nrows;
+
+    db = open_import_db(&fname);
+    csv = write_import_file("import.csv",
+                            "1,\"a, b\",10\r\n"
+                            "2,\"two\r\nlines\",20\r\n"
+                            "\r\n"
+                            "3,\"say \"\"hi\"\"\",\r\n"
+                            "4,it's 6\" long,40\n"
+                            "5,,50\r\n");
+
+    ck_assert(chidb_import_table(db, csv, "t", &nrows) == CHIDB_OK);
+    ck_assert_int_eq(nrows, 5);
+    check_import_count(db, 5, 4);
+    check_import_row(db, 1, "a, b", 10);
+    check_import_row(db, 2, "two\r\nlines", 20);
+    check_import_row(db, 3, "say \"hi\"", -1);
+    check_import_row(db, 4, "it's 6\" long", 40);
+    check_import_row(db, 5, NULL, 50);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+    delete_copy(csv);
+}
+END_TEST
+
+
+/* A quote that is never closed, or that has text after it, is an
+ * error, and nothing of the file is imported */
+START_TEST (test_import_unterminated)
+{
+    chidb *db;
+    char *fname, *csv;
+    unsigned int nrows;
+
+    db = open_import_db(&fname);
+
+    csv = write_import_file("import.csv", "1,one,10\n2,\"two,20\n3,three,30\n");
+    ck_assert(chidb_import_table(db, csv, "t", &nrows) == CHIDB_EMISMATCH);
+    ck_assert_int_eq(nrows, 1);
+    check_import_count(db, 0, 0);
+    delete_copy(csv);
+
+    csv = write_import_file("import.csv", "1,one,10\n2,\"two\"x,20\n");
+    ck_assert(chidb_import_table(db, csv, "t", &nrows) == CHIDB_EMISMATCH);
+    check_import_count(db, 0, 0);
+    delete_copy(csv);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Rows are scanned sixteen bytes at a time, and the bytes of the file
+ * after the last sixteen one at a time: the last row of a file whose
+ * size isn't a multiple of sixteen, with no newline after it, is still
+ * imported whole, and so are fields that span sixteen-byte chunks */
+START_TEST (test_import_tail)
+{
+    chidb *db;
+    char *fname, *tsv, *psv;
+    unsigned int nrows;
+    const char *text = "1\tthe first name, which is long\t10\n"
+                       "2\tsecond\t20\n"
+                       "3\tlast\t3";
+
+    ck_assert(strlen(text) % 16 != 0);
+    db = open_import_db(&fname);
+
+    tsv = write_import_file("import.tsv", text);
+    ck_assert(chidb_import_table(db, tsv, "t", &nrows) == CHIDB_OK);
+    ck_assert_int_eq(nrows, 3);
+    check_import_count(db, 3, 3);
+    check_import_row(db, 1, "the first name, which is long", 10);
+    check_import_row(db, 2, "second", 20);
+    check_import_row(db, 3, "last", 3);
+
+    /* A "\r" at the very end of the file is dropped too */
+    psv = write_import_file("import.txt", "4|fourth|40\r\n5|fifth|5\r");
+    ck_assert(chidb_import_table(db, psv, "t", &nrows) == CHIDB_OK);
+    ck_assert_int_eq(nrows, 2);
+    check_import_count(db, 5, 5);
+    check_import_row(db, 4, "fourth", 40);
+    check_import_row(db, 5, "fifth", 5);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+    delete_copy(tsv);
+    delete_copy(psv);
+}
+END_TEST
+
+
+/* Sorted rows are bulk-loaded into an empty table, and its index built
+ * from them; unsorted rows, or rows for a table that isn't empty, are
+ * inserted one at a time. Either way, every row and index entry is
+ * there. */
+START_TEST (test_import_paths)
+{
+    chidb *db;
+    char *fname, *f;
+    unsigned int nrows;
+    char *text = malloc(64 * 1024), *p;
+
+    /* Sorted, and enough rows for more than one leaf */
+    db = open_import_db(&fname);
+    p = text;
+    for (int i = 1; i <= 1000; i++)
+        p += sprintf(p, "%i|row %i|%i\n", i, i, 2000 - i);
+    f = write_import_file("import.txt", text);
+    ck_assert(chidb_import_table(db, f, "t", &nrows) == CHIDB_OK);
+    ck_assert_int_eq(nrows, 1000);
+    check_import_count(db, 1000, 1000);
+    check_import_row(db, 1, "row 1", 1999);
+    check_import_row(db, 500, "row 500", 1500);
+    check_import_row(db, 1000, "row 1000", 1000);
+    delete_copy(f);
+
+    /* Sorted, but the table isn't empty any more */
+    p = text;
+    for (int i = 1001; i <= 1100; i++)
+        p += sprintf(p, "%i|row %i|%i\n", i, i, 2000 + i);
+    f = write_import_file("import.txt", text);
+    ck_assert(chidb_import_table(db, f, "t", &nrows) == CHIDB_OK);
+    ck_assert_int_eq(nrows, 100);
+    check_import_count(db, 1100, 1100);
+    check_import_row(db, 1100, "row 1100", 3100);
+    delete_copy(f);
+    chidb_close(db);
+    delete_tmp_file(fname);
+
+    /* Unsorted, into an empty table */
+    db = open_import_db(&fname);
+    p = text;
+    for (int i = 0; i < 1000; i++)
+        p += sprintf(p, "%i|row %i|\n", (i * 7919) % 1000 + 1, i);
+    f = write_import_file("import.txt", text);
+    ck_assert(chidb_import_table(db, f, "t", &nrows) == CHIDB_OK);
+    ck_assert_int_eq(nrows, 1000);
+    check_import_count(db, 1000, 0);
+    check_import_row(db, 1, "row 0", -1);
+    check_import_row(db, 1000, "row 321", -1);
+    delete_copy(f);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+    free(text);
+}
+END_TEST
+
+
+/* A row that can't be imported rolls back the whole file, on either
+ * path, and nrows tells which row it was */
+START_TEST (test_import_rollback)
+{
+    chidb *db;
+    char *fname, *f;
+    unsigned int nrows;
+
+    db = open_import_db(&fname);
+
+    /* Bulk load, stopped by a value that isn't an integer */
+    f = write_import_file("import.txt", "1|one|10\n2|two|20\n3|three|x\n4|four|40\n");
+    ck_assert(chidb_import_table(db, f, "t", &nrows) == CHIDB_EMISMATCH);
+    ck_assert_int_eq(nrows, 3);
+    check_import_count(db, 0, 0);
+    delete_copy(f);
+
+    /* Inserts, stopped by a row with too few values */
+    f = write_import_file("import.txt", "2|two|20\n1|one|10\n3|three\n");
+    ck_assert(chidb_import_table(db, f, "t", &nrows) == CHIDB_EMISMATCH);
+    ck_assert_int_eq(nrows, 3);
+    check_import_count(db, 0, 0);
+    delete_copy(f);
+
+    /* Inserts, stopped by a key that is already in the table */
+    f = write_import_file("import.txt", "5|five|50\n");
+    ck_assert(chidb_import_table(db, f, "t", &nrows) == CHIDB_OK);
+    delete_copy(f);
+    f = write_import_file("import.txt", "6|six|60\n5|again|55\n");
+    ck_assert(chidb_import_table(db, f, "t", &nrows) == CHIDB_ECONSTRAINT);
+    ck_assert_int_eq(nrows, 2);
+    check_import_count(db, 1, 1);
+    check_import_row(db, 5, "five", 50);
+    ck_assert(chidb_get_autocommit(db));
+    delete_copy(f);
+
+    ck_assert(chidb_import_table(db, "no-such-file.txt", "t", &nrows) == CHIDB_ECANTOPEN);
+    f = write_import_file("import.txt", "7|seven|70\n");
+    ck_assert(chidb_import_table(db, f, "nosuchtable", &nrows) == CHIDB_EINVALIDSQL);
+    delete_copy(f);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+Suite* make_import_suite (void)
+{
+    Suite *s = suite_create ("Import");
+
+    TCase *tc_rows = tcase_create ("Rows");
+    tcase_add_test (tc_rows, test_import_csv);
+    tcase_add_test (tc_rows, test_import_unterminated);
+    tcase_add_test (tc_rows, test_import_tail);
+    suite_add_tcase (s, tc_rows);
+
+    TCase *tc_table = tcase_create ("Tables");
+    tcase_add_test (tc_table, test_import_paths);
+    tcase_add_test (tc_table, test_import_rollback);
+    suite_add_tcase (s, tc_table);
+
+    return s;
+}
+
+int main (void)
+{
+    SRunner *sr;
+    int number_failed;
+
+    sr = srunner_create (make_import_suite ());
+
+    srunner_run_all (sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
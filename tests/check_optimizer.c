@@ -0,0 +1,397 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <check.h>
+#include <chidb/chidb.h>
+#include <chisql/chisql.h>
+#include "libchidb/btree.h"
+#include "libchidb/record.h"
+#include "libchidb/stats.h"
+#include "libchidb/catalog.h"
+#include "libchidb/dbm.h"
+#include "check_common.h"
+
+/* Implemented in optimizer.c */
+int chidb_stmt_optimize(chidb *db, chisql_statement_t *sql_stmt, chisql_statement_t **sql_stmt_opt);
+
+#define OPT_NROWS (1000)
+
+/* Inserts row (key, a, b) into a table, with b NULL if it's negative */
+static void insert_opt_row(BTree *bt, npage_t nroot, chidb_key_t key, int32_t a, int32_t b)
+{
+    DBRecordBuffer dbrb;
+    DBRecord *dbr;
+    uint8_t *data;
+
+    chidb_DBRecord_create_empty(&dbrb, 3);
+    chidb_DBRecord_appendInt32(&dbrb, key);
+    chidb_DBRecord_appendInt32(&dbrb, a);
+    if (b < 0)
+        chidb_DBRecord_appendNull(&dbrb);
+    else
+        chidb_DBRecord_appendInt32(&dbrb, b);
+    chidb_DBRecord_finalize(&dbrb, &dbr);
+    ck_assert(chidb_DBRecord_pack(dbr, &data) == CHIDB_OK);
+    ck_assert(chidb_Btree_insertInTable(bt, nroot, key, data, dbr->packed_len) == CHIDB_OK);
+    chidb_DBRecord_destroy(dbr);
+    free(data);
+}
+
+/* Runs a statement that returns no rows */
+static void exec_sql(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+/* Creates table t (id, a, b) of OPT_NROWS rows, where a is the key and
+ * b its last digit (NULL every hundred rows), with an index on a */
+static void create_opt_table(chidb *db, npage_t *ntable, npage_t *nindex)
+{
+    chidb_catalog_table_t *t;
+
+    exec_sql(db, "CREATE TABLE t (id INTEGER PRIMARY KEY, a INTEGER, b INTEGER);");
+    exec_sql(db, "CREATE INDEX t_a ON t (a);");
+    t = chidb_catalog_table(db, "t");
+    ck_assert(t != NULL && chidb_catalog_index(t, "a") != NULL);
+    *ntable = t->nroot;
+    *nindex = chidb_catalog_index(t, "a")->nroot;
+
+    for (int32_t i = 1; i <= OPT_NROWS; i++)
+    {
+        insert_opt_row(db->bt, *ntable, i, i, i % 100 == 0 ? -1 : i % 10);
+        ck_assert(chidb_Btree_insertInIndex(db->bt, *nindex, i, i) == CHIDB_OK);
+    }
+}
+
+/* Counts the leaves of a B-Tree, and its levels */
+static void count_leaves(BTree *bt, npage_t npage, uint32_t level, uint32_t *nleaves, uint32_t *depth)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+    if (level > *depth)
+        *depth = level;
+    if (btn->type == PGTYPE_TABLE_LEAF)
+        (*nleaves)++;
+    else
+    {
+        for (ncell_t i = 0; i < btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &cell);
+            count_leaves(bt, cell.fields.tableInternal.child_page, level + 1, nleaves, depth);
+        }
+        count_leaves(bt, btn->right_page, level + 1, nleaves, depth);
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+}
+
+/* Returns the selection right above table t in an optimized tree */
+static SRA_t *find_select(SRA_t *sra)
+{
+    SRA_t *found;
+
+    switch (sra->t)
+    {
+    case SRA_SELECT:
+        if (sra->select.sra->t == SRA_TABLE)
+            return sra;
+        return find_select(sra->select.sra);
+    case SRA_PROJECT:
+        return find_select(sra->project.sra);
+    case SRA_JOIN:
+        if ((found = find_select(sra->join.sra1)) != NULL)
+            return found;
+        return find_select(sra->join.sra2);
+    default:
+        return NULL;
+    }
+}
+
+/* Optimizes a SELECT, and returns the selection on its table (in *sql_stmt,
+ * which must be freed with chisql_stmt_free) */
+static SRA_t *optimize_select(chidb *db, const char *sql, chisql_statement_t **sql_stmt)
+{
+    chisql_statement_t *sql_stmt_opt;
+
+    ck_assert(chisql_parser(sql, sql_stmt) == CHIDB_OK);
+    ck_assert(chidb_stmt_optimize(db, *sql_stmt, &sql_stmt_opt) == CHIDB_OK);
+    free(sql_stmt_opt);
+
+    return find_select((*sql_stmt)->stmt.select);
+}
+
+
+/* ANALYZE counts the rows, leaves and levels of a table, and for each
+ * column its NULLs and distinct values, and splits its integers into
+ * buckets of the same number of values */
+START_TEST (test_analyze)
+{
+    chidb *db;
+    npage_t ntable, nindex;
+    const char *columns[] = {"id", "a", "b"};
+    npage_t index_roots[3] = {0};
+    chidb_table_stats_t *ts;
+    chidb_column_stats_t *cs;
+    uint32_t nleaves = 0, depth = 0;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    create_opt_table(db, &ntable, &nindex);
+    index_roots[1] = nindex;
+
+    ck_assert(chidb_stats_table(db, "t") == NULL);
+    ck_assert(chidb_stats_analyze(db, "t", ntable, columns, index_roots, 3) == CHIDB_OK);
+    ts = chidb_stats_table(db, "T");
+    ck_assert(ts != NULL);
+    count_leaves(db->bt, ntable, 1, &nleaves, &depth);
+    ck_assert_int_eq(ts->nrows, OPT_NROWS);
+    ck_assert_int_eq(ts->nleaves, nleaves);
+    ck_assert_int_eq(ts->depth, depth);
+    ck_assert(depth > 1);
+
+    /* a: 1 to 1000, so each bucket has a sixteenth of them */
+    cs = chidb_stats_column(ts, "a");
+    ck_assert(cs != NULL);
+    ck_assert_int_eq(cs->index_root, nindex);
+    ck_assert_int_eq(cs->nnull, 0);
+    ck_assert_int_eq(cs->nint, OPT_NROWS);
+    ck_assert(cs->ndistinct > 0.8 * OPT_NROWS && cs->ndistinct < 1.2 * OPT_NROWS);
+    ck_assert_int_eq(cs->nbounds, STATS_NBUCKETS + 1);
+    for (int i = 0; i <= STATS_NBUCKETS; i++)
+        ck_assert_int_eq(cs->bounds[i], 1 + i * (OPT_NROWS - 1) / STATS_NBUCKETS);
+    ck_assert(fabs(chidb_stats_selectivity(ts, cs, STATS_LT, true, 251) - 0.25) < 0.01);
+    ck_assert(fabs(chidb_stats_selectivity(ts, cs, STATS_GE, true, 251) - 0.75) < 0.01);
+    ck_assert(fabs(chidb_stats_selectivity(ts, cs, STATS_EQ, true, 7) - 1.0 / OPT_NROWS) < 0.0005);
+
+    /* b: ten values, and ten NULLs that aren't in the histogram */
+    cs = chidb_stats_column(ts, "b");
+    ck_assert_int_eq(cs->index_root, 0);
+    ck_assert_int_eq(cs->nnull, OPT_NROWS / 100);
+    ck_assert_int_eq(cs->nint, OPT_NROWS - OPT_NROWS / 100);
+    ck_assert(cs->ndistinct == 10);
+    ck_assert_int_eq(cs->bounds[0], 0);
+    ck_assert_int_eq(cs->bounds[STATS_NBUCKETS], 9);
+    ck_assert(fabs(chidb_stats_selectivity(ts, cs, STATS_EQ, true, 3) - 0.099) < 0.0005);
+
+    /* Analyzing again replaces the statistics */
+    insert_opt_row(db->bt, ntable, OPT_NROWS + 1, OPT_NROWS + 1, -1);
+    ck_assert(chidb_stats_analyze(db, "t", ntable, columns, index_roots, 3) == CHIDB_OK);
+    ts = chidb_stats_table(db, "t");
+    ck_assert_int_eq(ts->nrows, OPT_NROWS + 1);
+    ck_assert(ts->next == NULL);
+    ck_assert_int_eq(chidb_stats_column(ts, "b")->nnull, OPT_NROWS / 100 + 1);
+    ck_assert_int_eq(chidb_stats_column(ts, "a")->bounds[STATS_NBUCKETS], OPT_NROWS + 1);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* A selective predicate on an indexed column seeks the index, and one
+ * that keeps most of the rows scans the table, which reads fewer pages
+ * than seeking the table for each of them */
+START_TEST (test_access_path)
+{
+    chidb *db;
+    npage_t ntable, nindex;
+    const char *columns[] = {"id", "a", "b"};
+    npage_t index_roots[3] = {0};
+    chisql_statement_t *sql_stmt;
+    SRA_t *select;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    create_opt_table(db, &ntable, &nindex);
+    index_roots[1] = nindex;
+
+    /* Without statistics, tables are scanned */
+    select = optimize_select(db, "SELECT t.b FROM t WHERE t.a = 500;", &sql_stmt);
+    ck_assert(select != NULL);
+    ck_assert(select->select.seek == NULL && select->select.seek_end == NULL);
+    chisql_stmt_free(sql_stmt);
+
+    ck_assert(chidb_stats_analyze(db, "t", ntable, columns, index_roots, 3) == CHIDB_OK);
+
+    select = optimize_select(db, "SELECT t.b FROM t WHERE t.a = 500;", &sql_stmt);
+    ck_assert(select->select.seek != NULL);
+    ck_assert(select->select.seek == select->select.seek_end);
+    ck_assert_int_eq(select->select.seek->t, RA_COND_EQ);
+    chisql_stmt_free(sql_stmt);
+
+    select = optimize_select(db, "SELECT t.b FROM t WHERE t.a > 100 AND t.a < 106 AND t.b = 1;", &sql_stmt);
+    ck_assert(select->select.seek != NULL && select->select.seek_end != NULL);
+    ck_assert_int_eq(select->select.seek->t, RA_COND_GT);
+    ck_assert_int_eq(select->select.seek_end->t, RA_COND_LT);
+    chisql_stmt_free(sql_stmt);
+
+    select = optimize_select(db, "SELECT t.b FROM t WHERE t.a > 10;", &sql_stmt);
+    ck_assert(select->select.seek == NULL && select->select.seek_end == NULL);
+    chisql_stmt_free(sql_stmt);
+
+    /* b has no index to seek */
+    select = optimize_select(db, "SELECT t.a FROM t WHERE t.b = 5;", &sql_stmt);
+    ck_assert(select->select.seek == NULL && select->select.seek_end == NULL);
+    chisql_stmt_free(sql_stmt);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Returns the first instruction of a program from from on with an
+ * opcode, or -1 if there is none */
+static int find_op(chidb_stmt *stmt, int from, opcode_t opcode)
+{
+    for (uint32_t i = from; i < stmt->endOp; i++)
+        if (stmt->ops[i].opcode == opcode)
+            return i;
+
+    return -1;
+}
+
+
+/* The conjuncts of a WHERE clause that refer to a single table of a join
+ * go right above that table, and the one that compares the tables to
+ * the join */
+START_TEST (test_pushdown)
+{
+    chidb *db;
+    chisql_statement_t *sql_stmt;
+    chisql_statement_t *sql_stmt_opt;
+    SRA_t *join, *select;
+    Condition_t *on;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    ck_assert(chisql_parser("SELECT t.b, u.y FROM t, u WHERE t.a = u.x AND t.b = 1 AND u.y > 5;",
+                            &sql_stmt) == CHIDB_OK);
+    ck_assert_int_eq(sql_stmt->stmt.select->project.sra->t, SRA_SELECT);
+    ck_assert(chidb_stmt_optimize(db, sql_stmt, &sql_stmt_opt) == CHIDB_OK);
+    free(sql_stmt_opt);
+
+    join = sql_stmt->stmt.select->project.sra;
+    ck_assert_int_eq(join->t, SRA_JOIN);
+    ck_assert(join->join.opt_cond != NULL);
+    ck_assert_int_eq(join->join.opt_cond->t, JOIN_COND_ON);
+    on = join->join.opt_cond->on;
+    ck_assert_int_eq(on->t, RA_COND_EQ);
+    ck_assert_str_eq(on->cond.comp.expr1->expr.term.ref->columnName, "a");
+    ck_assert_str_eq(on->cond.comp.expr2->expr.term.ref->columnName, "x");
+
+    for (int i = 0; i < 2; i++)
+    {
+        select = find_select(i == 0 ? join->join.sra1 : join->join.sra2);
+        ck_assert(select != NULL);
+        if (!strcmp(select->select.sra->table.ref->table_name, "t"))
+        {
+            ck_assert_int_eq(select->select.cond->t, RA_COND_EQ);
+            ck_assert_str_eq(select->select.cond->cond.comp.expr1->expr.term.ref->columnName, "b");
+        }
+        else
+        {
+            ck_assert_str_eq(select->select.sra->table.ref->table_name, "u");
+            ck_assert_int_eq(select->select.cond->t, RA_COND_GT);
+            ck_assert_str_eq(select->select.cond->cond.comp.expr1->expr.term.ref->columnName, "y");
+        }
+    }
+    chisql_stmt_free(sql_stmt);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* A range of an indexed column is read from the index, from a seek to
+ * its start to the entry past its end, instead of scanning the table and
+ * comparing every row */
+START_TEST (test_range_seek)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    npage_t ntable, nindex;
+    const char *columns[] = {"id", "a", "b"};
+    npage_t index_roots[3] = {0};
+    int seek, end;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    create_opt_table(db, &ntable, &nindex);
+    index_roots[1] = nindex;
+    ck_assert(chidb_stats_analyze(db, "t", ntable, columns, index_roots, 3) == CHIDB_OK);
+
+    /* Both bounds included */
+    ck_assert(chidb_prepare(db, "SELECT b FROM t WHERE a >= 101 AND a <= 105;", &stmt) == CHIDB_OK);
+    seek = find_op(stmt, 0, Op_SeekGe);
+    if (seek < 0)
+        seek = find_op(stmt, 0, Op_SeekGeIdxPKey);
+    ck_assert(seek >= 0);
+    end = find_op(stmt, seek, Op_IdxGt);
+    ck_assert(end > seek);
+    ck_assert_int_eq(stmt->ops[end].p1, stmt->ops[seek].p1);
+    ck_assert(find_op(stmt, seek, Op_IdxPKey) > seek);
+    ck_assert_int_eq(find_op(stmt, 0, Op_Rewind), -1);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Both bounds strict, and the other way round */
+    ck_assert(chidb_prepare(db, "SELECT b FROM t WHERE 106 > a AND a > 100;", &stmt) == CHIDB_OK);
+    seek = find_op(stmt, 0, Op_SeekGt);
+    ck_assert(seek >= 0);
+    end = find_op(stmt, seek, Op_IdxGe);
+    ck_assert(end > seek);
+    ck_assert_int_eq(stmt->ops[end].p1, stmt->ops[seek].p1);
+    ck_assert_int_eq(find_op(stmt, 0, Op_Rewind), -1);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Most of the table is cheaper to scan */
+    ck_assert(chidb_prepare(db, "SELECT b FROM t WHERE a > 10;", &stmt) == CHIDB_OK);
+    ck_assert(find_op(stmt, 0, Op_Rewind) >= 0);
+    ck_assert_int_eq(find_op(stmt, 0, Op_SeekGt), -1);
+    ck_assert_int_eq(find_op(stmt, 0, Op_IdxGe), -1);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+Suite* make_optimizer_suite (void)
+{
+    Suite *s = suite_create ("Optimizer");
+
+    TCase *tc_stats = tcase_create ("Statistics");
+    tcase_add_test (tc_stats, test_analyze);
+    tcase_add_test (tc_stats, test_access_path);
+    suite_add_tcase (s, tc_stats);
+
+    TCase *tc_plans = tcase_create ("Plans");
+    tcase_add_test (tc_plans, test_pushdown);
+    tcase_add_test (tc_plans, test_range_seek);
+    suite_add_tcase (s, tc_plans);
+
+    return s;
+}
+
+int main (void)
+{
+    SRunner *sr;
+    int number_failed;
+
+    sr = srunner_create (make_optimizer_suite ());
+
+    srunner_run_all (sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
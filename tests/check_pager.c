@@ -1,4 +1,9 @@
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <check.h>
 #include "check_common.h"
 #include "libchidb/pager.h"
@@ -9,8 +14,8 @@
 #define TESTFILE ("32k-of-zeroes.dat")
 #define MAXPAGES (8)
 
-#define NMULT (6)
-uint8_t pagemult[] = {1,2,4,8,16,32};
+#define NMULT (7)
+uint8_t pagemult[] = {1,2,4,8,16,32,64};
 
 uint16_t pagepos[] = {407, 685, 692, 847, 383, 813, 705, 113, 929, 576, 257, 602, 655, 17, 231, 787, 196,
                       765, 258, 123, 943, 481, 540, 117, 428, 580, 534, 541, 883, 255, 982, 488, 151, 766,
@@ -146,6 +151,1148 @@ START_TEST (test_readwrite)
 END_TEST
 
 
+START_TEST (test_cache)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page, *page2;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* Much smaller than the number of pages, to force evictions */
+    rc = chidb_Pager_setCacheSize(pg, 2);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        ck_assert(npage == j);
+    }
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            page->data[pagepos[k]] = values[k] ^ j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    /* A page that is read while pinned is the same in-memory copy */
+    rc = chidb_Pager_readPage(pg, 1, &page);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Pager_readPage(pg, 1, &page2);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(page == page2);
+    chidb_Pager_releaseMemPage(pg, page2);
+
+    /* With page 1 pinned, the remaining pages have to share one frame */
+    for(int j=2; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page2);
+        for(int k=0; k<NVALUES; k++)
+            if(page2->data[pagepos[k]] != (values[k] ^ j))
+            {
+                ck_abort_msg("Incorrect value read from page");
+                break;
+            }
+        chidb_Pager_releaseMemPage(pg, page2);
+    }
+    chidb_Pager_releaseMemPage(pg, page);
+
+    chidb_Pager_close(pg);
+
+    /* Dirty pages must have been written back when closing the pager */
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert_int_eq(pg->n_pages, MAXPAGES);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            if(page->data[pagepos[k]] != (values[k] ^ j))
+            {
+                ck_abort_msg("Incorrect value read from page");
+                break;
+            }
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_mmap)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page, *page2;
+    uint8_t *ro;
+    size_t size;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_setCacheSize(pg, 2);
+    rc = chidb_Pager_setMmap(pg, true);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        for(int k=0; k<NVALUES; k++)
+            page->data[pagepos[k]] = values[k] ^ j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        rc = chidb_Pager_readPageRO(pg, j, &page);
+        ck_assert(rc == CHIDB_OK);
+        for(int k=0; k<NVALUES; k++)
+            if(page->data[pagepos[k]] != (values[k] ^ j))
+            {
+                ck_abort_msg("Incorrect value read from mapped page");
+                break;
+            }
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    /* Mapped pages are copied before they can be modified */
+    rc = chidb_Pager_readPageRO(pg, 1, &page);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(chidb_Pager_writePage(pg, page) == CHIDB_EMISUSE);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    rc = chidb_Pager_readPage(pg, 1, &page);
+    ck_assert(rc == CHIDB_OK);
+    for(int k=0; k<NVALUES; k++)
+        page->data[pagepos[k]] = values[k];
+    chidb_Pager_writePage(pg, page);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    /* Force the modified page out of the buffer pool */
+    for(int j=2; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPageRO(pg, j, &page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    rc = chidb_Pager_readPageRO(pg, 1, &page);
+    ck_assert(rc == CHIDB_OK);
+    for(int k=0; k<NVALUES; k++)
+        ck_assert_int_eq(page->data[pagepos[k]], values[k]);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    /* A page read through the mapping stays there while the same page
+     * is modified, and the file grows */
+    rc = chidb_Pager_readPageRO(pg, 2, &page);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(page->mapped);
+    ro = page->data;
+    size = pg->map_size;
+    rc = chidb_Pager_readPage(pg, 2, &page2);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(page2->data != ro);
+    page2->data[PAGE_SIZE - 1] = 0xff;
+    chidb_Pager_writePage(pg, page2);
+    chidb_Pager_releaseMemPage(pg, page2);
+
+    chidb_Pager_allocatePage(pg, &npage);
+    chidb_Pager_readPage(pg, npage, &page2);
+    chidb_Pager_writePage(pg, page2);
+    chidb_Pager_releaseMemPage(pg, page2);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+    rc = chidb_Pager_readPageRO(pg, 3, &page2);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_releaseMemPage(pg, page2);
+    rc = chidb_Pager_readPageRO(pg, npage, &page2);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_releaseMemPage(pg, page2);
+    ck_assert(pg->map_size == size);
+    for(int k=0; k<NVALUES; k++)
+        ck_assert_int_eq(ro[pagepos[k]], values[k] ^ 2);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    /* Once it is released, the mapping can grow */
+    for(npage_t j=1; j<=npage; j++)
+    {
+        rc = chidb_Pager_readPageRO(pg, j, &page2);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_releaseMemPage(pg, page2);
+    }
+    ck_assert(pg->map_size > size);
+
+    rc = chidb_Pager_setMmap(pg, false);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_direct)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+
+    char *fname = create_tmp_file();
+
+    /* Falls back to buffered I/O if the file system doesn't support O_DIRECT */
+    rc = chidb_Pager_open2(&pg, fname, PAGER_DIRECT);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        ck_assert((uintptr_t) page->data % PAGE_SIZE == 0);
+        for(int k=0; k<NVALUES; k++)
+            page->data[pagepos[k]] = values[k] ^ j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    rc = chidb_Pager_close(pg);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Pager_open2(&pg, fname, PAGER_DIRECT);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert_int_eq(pg->n_pages, MAXPAGES);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            if(page->data[pagepos[k]] != (values[k] ^ j))
+            {
+                ck_abort_msg("Incorrect value read from page");
+                break;
+            }
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_wal)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg, *pg2;
+    MemPage *page;
+    struct stat st;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open2(&pg, fname, PAGER_WAL);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_setCacheSize(pg, 2);
+    chidb_Pager_setAutoCheckpoint(pg, 0);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        for(int k=0; k<NVALUES; k++)
+            page->data[pagepos[k]] = values[k] ^ j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    rc = chidb_Pager_flush(pg);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Committed pages are only in the log */
+    stat(fname, &st);
+    ck_assert_int_eq(st.st_size, 0);
+
+    /* Another pager recovers them from the log */
+    rc = chidb_Pager_open2(&pg2, fname, PAGER_WAL);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg2, PAGE_SIZE);
+    ck_assert_int_eq(pg2->n_pages, MAXPAGES);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg2, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            if(page->data[pagepos[k]] != (values[k] ^ j))
+            {
+                ck_abort_msg("Incorrect value read from log");
+                break;
+            }
+        chidb_Pager_releaseMemPage(pg2, page);
+    }
+    chidb_Pager_close(pg2);
+    chidb_Pager_close(pg);
+
+    /* Closing the pager checkpoints the log into the database file */
+    stat(fname, &st);
+    ck_assert_int_eq(st.st_size, MAXPAGES * PAGE_SIZE);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            if(page->data[pagepos[k]] != (values[k] ^ j))
+            {
+                ck_abort_msg("Incorrect value read from page");
+                break;
+            }
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+#define GROUP_NTHREADS (4)
+#define GROUP_NCOMMITS (20)
+
+typedef struct group_commit_arg
+{
+    Pager *pg;
+    int ncommits;           /* Commits that returned CHIDB_OK */
+    int nundurable;         /* Commits that returned before the log was synced */
+} group_commit_arg;
+
+/* Commits GROUP_NCOMMITS times, each time checking that the commit is
+ * durable when chidb_Pager_flush returns */
+static void *group_commit(void *a)
+{
+    group_commit_arg *arg = a;
+    ShmHeader *h = arg->pg->shm->header;
+    npage_t npage;
+    MemPage *page;
+    int rc;
+
+    while(arg->ncommits < GROUP_NCOMMITS)
+    {
+        rc = chidb_Pager_allocatePage(arg->pg, &npage);
+        if(rc == CHIDB_EBUSY)
+        {
+            sched_yield();
+            continue;
+        }
+        if(rc != CHIDB_OK || chidb_Pager_readPage(arg->pg, npage, &page) != CHIDB_OK)
+            break;
+        page->data[0] = npage;
+        chidb_Pager_writePage(arg->pg, page);
+        chidb_Pager_releaseMemPage(arg->pg, page);
+        if(chidb_Pager_flush(arg->pg) != CHIDB_OK)
+            break;
+
+        if(__atomic_load_n(&h->synced, __ATOMIC_ACQUIRE)
+           < ((uint64_t) arg->pg->wal->ckpt_seq << 32 | arg->pg->wal->max_frame))
+            arg->nundurable++;
+        arg->ncommits++;
+    }
+
+    return NULL;
+}
+
+START_TEST (test_group_commit)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    pthread_t threads[GROUP_NTHREADS];
+    group_commit_arg args[GROUP_NTHREADS];
+    uint64_t syncs = 0;
+
+    char *fname = create_tmp_file();
+
+    /* A commit does not return before the log is synced */
+    rc = chidb_Pager_open2(&pg, fname, PAGER_WAL);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_setAutoCheckpoint(pg, 0);
+    chidb_Pager_allocatePage(pg, &npage);
+    chidb_Pager_readPage(pg, npage, &page);
+    chidb_Pager_writePage(pg, page);
+    chidb_Pager_releaseMemPage(pg, page);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+    ck_assert_int_eq(pg->stats.syncs, 1);
+    ck_assert_int_eq(pg->wal->sync_frame, 0);
+    ck_assert(pg->shm->header->synced == ((uint64_t) pg->wal->ckpt_seq << 32 | pg->wal->max_frame));
+
+    /* Nor does a commit that is already durable sync again */
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+    ck_assert_int_eq(pg->stats.syncs, 1);
+
+    /* Pagers that commit at the same time share the syncs, and none of
+     * them returns before its own commit is durable */
+    for(int i=0; i<GROUP_NTHREADS; i++)
+    {
+        args[i].ncommits = args[i].nundurable = 0;
+        rc = chidb_Pager_open2(&args[i].pg, fname, PAGER_WAL);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(args[i].pg, PAGE_SIZE);
+        chidb_Pager_setAutoCheckpoint(args[i].pg, 0);
+    }
+    for(int i=0; i<GROUP_NTHREADS; i++)
+        ck_assert(pthread_create(&threads[i], NULL, group_commit, &args[i]) == 0);
+    for(int i=0; i<GROUP_NTHREADS; i++)
+        pthread_join(threads[i], NULL);
+    for(int i=0; i<GROUP_NTHREADS; i++)
+    {
+        ck_assert_int_eq(args[i].ncommits, GROUP_NCOMMITS);
+        ck_assert_int_eq(args[i].nundurable, 0);
+        syncs += args[i].pg->stats.syncs;
+        chidb_Pager_close(args[i].pg);
+    }
+    ck_assert(syncs <= GROUP_NTHREADS * GROUP_NCOMMITS);
+
+    ck_assert(chidb_Pager_beginRead(pg) == CHIDB_OK);
+    ck_assert_int_eq(pg->n_pages, 1 + GROUP_NTHREADS * GROUP_NCOMMITS);
+    for(npage_t j=2; j<=pg->n_pages; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        ck_assert_int_eq(page->data[0], (uint8_t) j);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    ck_assert(chidb_Pager_endRead(pg) == CHIDB_OK);
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_prefetch)
+{
+    int rc;
+    npage_t npage, npages[MAXPAGES + 1];
+    Pager *pg;
+    MemPage *page;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        for(int k=0; k<NVALUES; k++)
+            page->data[pagepos[k]] = values[k] ^ j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* Page 1 is already in the buffer pool, and the last page doesn't exist */
+    chidb_Pager_readPage(pg, 1, &page);
+    for(int j=1; j<=MAXPAGES+1; j++)
+        npages[j-1] = j;
+    rc = chidb_Pager_prefetch(pg, npages, MAXPAGES + 1);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            if(page->data[pagepos[k]] != (values[k] ^ j))
+            {
+                ck_abort_msg("Incorrect value read from page");
+                break;
+            }
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_stats)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        for(int k=0; k<NVALUES; k++)
+            page->data[pagepos[k]] = values[k] ^ j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    rc = chidb_Pager_flush(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->stats.pages_written == MAXPAGES);
+    ck_assert(pg->stats.bytes_written == MAXPAGES * PAGE_SIZE);
+    ck_assert(pg->stats.write_latency.count == MAXPAGES);
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_setCacheSize(pg, 2);
+
+    /* Every page is a miss the first time and a hit the second time */
+    for(int j=1; j<=MAXPAGES; j++)
+        for(int i=0; i<2; i++)
+        {
+            chidb_Pager_readPage(pg, j, &page);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+
+    ck_assert(pg->stats.cache_misses == MAXPAGES);
+    ck_assert(pg->stats.cache_hits == MAXPAGES);
+    ck_assert(pg->stats.pages_read == MAXPAGES);
+    ck_assert(pg->stats.bytes_read == MAXPAGES * PAGE_SIZE);
+    ck_assert(pg->stats.pages_written == 0);
+
+    uint64_t nbuckets = 0;
+    for(int i=0; i<CHIDB_HIST_NBUCKETS; i++)
+        nbuckets += pg->stats.read_latency.buckets[i];
+    ck_assert(pg->stats.read_latency.count == MAXPAGES);
+    ck_assert(nbuckets == MAXPAGES);
+    ck_assert(pg->stats.read_latency.max_ns <= pg->stats.read_latency.total_ns);
+
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_checksum)
+{
+    int rc, fd;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    uint8_t byte;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open2(&pg, fname, PAGER_CHECKSUM);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert(chidb_Pager_usableSize(pg) == PAGE_SIZE - PAGER_CHECKSUM_SIZE);
+
+    /* Page 1 is allocated but never written */
+    for(int j=1; j<=MAXPAGES; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+    for(int j=2; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            page->data[pagepos[k] % (PAGE_SIZE - PAGER_CHECKSUM_SIZE)] = values[k] ^ j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    /* Flip one bit in page 3 */
+    fd = open(fname, O_RDWR);
+    ck_assert(fd != -1);
+    ck_assert(pread(fd, &byte, 1, 2 * PAGE_SIZE + 100) == 1);
+    byte ^= 0x10;
+    ck_assert(pwrite(fd, &byte, 1, 2 * PAGE_SIZE + 100) == 1);
+    close(fd);
+
+    rc = chidb_Pager_open2(&pg, fname, PAGER_CHECKSUM);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        rc = chidb_Pager_readPage(pg, j, &page);
+        if(j == 3)
+        {
+            ck_assert(rc == CHIDB_ECORRUPT);
+            continue;
+        }
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    /* Same thing through the memory-mapped read path */
+    chidb_Pager_setCacheSize(pg, 2);
+    chidb_Pager_setMmap(pg, true);
+    rc = chidb_Pager_readPageRO(pg, 3, &page);
+    ck_assert(rc == CHIDB_ECORRUPT);
+    rc = chidb_Pager_readPageRO(pg, 4, &page);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_close(pg);
+
+    /* Without checksums, the page is read as is */
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    rc = chidb_Pager_readPage(pg, 3, &page);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Compressed pages take fewer blocks of the file, and read back as
+ * they were written, through the buffer pool and readPages. A page
+ * that doesn't compress is written as is. */
+#define ZPAGE_SIZE (16384)
+
+START_TEST (test_compress)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    struct stat st;
+    uint8_t *buf;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, ZPAGE_SIZE);
+    rc = chidb_Pager_setCompression(pg, true);
+#ifndef CHIDB_LZ4
+    ck_assert(rc == CHIDB_EMISUSE);
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+    return;
+#endif
+    ck_assert(rc == CHIDB_OK);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        for(int k=0; k<ZPAGE_SIZE; k++)
+            page->data[k] = j == MAXPAGES ? values[(k * 7 + k / NVALUES) % NVALUES] ^ k : values[k / 512] ^ j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+    chidb_Pager_close(pg);
+
+    ck_assert(stat(fname, &st) == 0);
+    ck_assert_int_eq(st.st_size, MAXPAGES * ZPAGE_SIZE);
+    ck_assert((off_t) st.st_blocks * 512 < st.st_size);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, ZPAGE_SIZE);
+    ck_assert(chidb_Pager_setCompression(pg, true) == CHIDB_OK);
+    buf = malloc(MAXPAGES * ZPAGE_SIZE);
+    ck_assert(chidb_Pager_readPages(pg, 1, MAXPAGES, buf) == CHIDB_OK);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        rc = chidb_Pager_readPage(pg, j, &page);
+        ck_assert(rc == CHIDB_OK);
+        for(int k=0; k<ZPAGE_SIZE; k++)
+        {
+            uint8_t v = j == MAXPAGES ? values[(k * 7 + k / NVALUES) % NVALUES] ^ k : values[k / 512] ^ j;
+            ck_assert_int_eq(page->data[k], v);
+            ck_assert_int_eq(buf[(j - 1) * ZPAGE_SIZE + k], v);
+        }
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    free(buf);
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* A scratch file has no name once it is open, and its pages go to the
+ * file (and back) when the buffer pool runs out of room for them */
+START_TEST (test_temp)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    struct stat st;
+
+    rc = chidb_Pager_open2(&pg, "chidb-temp-XXXXXX", PAGER_TEMP);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(strcmp(pg->filename, "chidb-temp-XXXXXX") != 0);
+    ck_assert(stat(pg->filename, &st) == -1);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_setCacheSize(pg, 2);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        for(int k=0; k<NVALUES; k++)
+            page->data[pagepos[k]] = values[k] ^ j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            if(page->data[pagepos[k]] != (values[k] ^ j))
+            {
+                ck_abort_msg("Incorrect value read from page");
+                break;
+            }
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    rc = chidb_Pager_close(pg);
+    ck_assert(rc == CHIDB_OK);
+}
+END_TEST
+
+
+/* Writes values ^ (j + delta) to pages 1 to n */
+static void write_pages(Pager *pg, npage_t n, int delta)
+{
+    MemPage *page;
+
+    for(int j=1; j<=n; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            page->data[pagepos[k]] = values[k] ^ (j + delta);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+}
+
+static void check_pages(Pager *pg, npage_t n, int delta)
+{
+    MemPage *page;
+
+    for(int j=1; j<=n; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            if(page->data[pagepos[k]] != (uint8_t) (values[k] ^ (j + delta)))
+            {
+                ck_abort_msg("Incorrect value read from page");
+                break;
+            }
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+}
+
+static void check_transaction(int flags)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    struct stat st;
+    char journal[256], crashed[256], crashed_journal[256];
+
+    char *fname = create_tmp_file();
+    snprintf(journal, sizeof(journal), "%s-journal", fname);
+    snprintf(crashed, sizeof(crashed), "%s-crashed", fname);
+    snprintf(crashed_journal, sizeof(crashed_journal), "%s-crashed-journal", fname);
+
+    rc = chidb_Pager_open2(&pg, fname, flags);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_setCacheSize(pg, 2);
+    for(int j=1; j<=MAXPAGES; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+    write_pages(pg, MAXPAGES, 0);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+
+    ck_assert(chidb_Pager_commit(pg) == CHIDB_EMISUSE);
+    ck_assert(chidb_Pager_begin(pg) == CHIDB_OK);
+    ck_assert(chidb_Pager_begin(pg) == CHIDB_EMISUSE);
+    ck_assert(chidb_Pager_inTransaction(pg));
+
+    /* The pool is too small for the transaction, so pages are written
+     * back (and journaled) before the rollback */
+    chidb_Pager_allocatePage(pg, &npage);
+    write_pages(pg, MAXPAGES + 1, 100);
+    check_pages(pg, MAXPAGES + 1, 100);
+    if(!(flags & PAGER_WAL))
+        ck_assert(stat(journal, &st) == 0);
+    ck_assert(chidb_Pager_rollback(pg) == CHIDB_OK);
+    ck_assert(!chidb_Pager_inTransaction(pg));
+    ck_assert(stat(journal, &st) == -1);
+    ck_assert_int_eq(pg->n_pages, MAXPAGES);
+    check_pages(pg, MAXPAGES, 0);
+
+    ck_assert(chidb_Pager_begin(pg) == CHIDB_OK);
+    write_pages(pg, MAXPAGES, 200);
+    ck_assert(chidb_Pager_commit(pg) == CHIDB_OK);
+    ck_assert(stat(journal, &st) == -1);
+    check_pages(pg, MAXPAGES, 200);
+
+    /* A copy of the files taken in the middle of a transaction is what
+     * a crash would leave behind */
+    ck_assert(chidb_Pager_begin(pg) == CHIDB_OK);
+    write_pages(pg, MAXPAGES, 300);
+    if(!(flags & PAGER_WAL))
+    {
+        copy(fname, crashed);
+        copy(journal, crashed_journal);
+    }
+    chidb_Pager_close(pg);
+
+    /* Closing the pager rolls back the transaction */
+    rc = chidb_Pager_open2(&pg, fname, flags);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    check_pages(pg, MAXPAGES, 200);
+    chidb_Pager_close(pg);
+
+    /* And so does opening the file after a crash */
+    if(!(flags & PAGER_WAL))
+    {
+        rc = chidb_Pager_open2(&pg, crashed, flags);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(stat(crashed_journal, &st) == -1);
+        chidb_Pager_setPageSize(pg, PAGE_SIZE);
+        ck_assert_int_eq(pg->n_pages, MAXPAGES);
+        check_pages(pg, MAXPAGES, 200);
+        chidb_Pager_close(pg);
+        remove(crashed);
+    }
+
+    delete_tmp_file(fname);
+}
+
+START_TEST (test_transaction)
+{
+    check_transaction(0);
+}
+END_TEST
+
+START_TEST (test_transaction_wal)
+{
+    check_transaction(PAGER_WAL);
+}
+END_TEST
+
+START_TEST (test_snapshot)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    PagerSnapshot *snap1, *snap2;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open2(&pg, fname, PAGER_WAL);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_setCacheSize(pg, 2);
+    for(int j=1; j<=MAXPAGES; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+    write_pages(pg, MAXPAGES, 0);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+
+    /* Commits after a snapshot began are not seen through it, even
+     * once they are checkpointed */
+    ck_assert(chidb_Pager_beginSnapshot(pg, &snap1) == CHIDB_OK);
+    chidb_Pager_allocatePage(pg, &npage);
+    write_pages(pg, MAXPAGES + 1, 100);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+    ck_assert(chidb_Pager_checkpoint(pg) == CHIDB_OK);
+
+    ck_assert(chidb_Pager_beginSnapshot(pg, &snap2) == CHIDB_OK);
+    write_pages(pg, MAXPAGES + 1, 200);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+
+    ck_assert(chidb_Pager_useSnapshot(snap1) == NULL);
+    check_pages(pg, MAXPAGES, 0);
+    ck_assert(chidb_Pager_readPage(pg, MAXPAGES + 1, &page) == CHIDB_EPAGENO);
+    chidb_Pager_readPage(pg, 1, &page);
+    ck_assert(chidb_Pager_writePage(pg, page) == CHIDB_EMISUSE);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    chidb_Pager_useSnapshot(snap2);
+    check_pages(pg, MAXPAGES + 1, 100);
+    ck_assert(chidb_Pager_useSnapshot(NULL) == snap2);
+    check_pages(pg, MAXPAGES + 1, 200);
+
+    /* Versions are dropped once no snapshot needs them, and the log can
+     * then be reset */
+    ck_assert(chidb_Pager_endSnapshot(pg, snap1) == CHIDB_OK);
+    ck_assert_int_eq(pg->nversions, MAXPAGES + 1);
+    ck_assert(chidb_Pager_endSnapshot(pg, snap2) == CHIDB_OK);
+    ck_assert_int_eq(pg->nversions, 0);
+    ck_assert(chidb_Pager_checkpoint(pg) == CHIDB_OK);
+    ck_assert_int_eq(pg->wal->n_frames, 0);
+    check_pages(pg, MAXPAGES + 1, 200);
+
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+static void check_shared(int flags)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg1, *pg2;
+    struct stat st;
+    char shm[256];
+
+    char *fname = create_tmp_file();
+    snprintf(shm, sizeof(shm), "%s-shm", fname);
+
+    /* Two pagers on the same file behave like two processes */
+    rc = chidb_Pager_open2(&pg1, fname, flags);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Pager_open2(&pg2, fname, flags);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg1, PAGE_SIZE);
+    chidb_Pager_setPageSize(pg2, PAGE_SIZE);
+    ck_assert(stat(shm, &st) == 0);
+
+    for(int j=1; j<=MAXPAGES; j++)
+        chidb_Pager_allocatePage(pg1, &npage);
+    write_pages(pg1, MAXPAGES, 0);
+    ck_assert(chidb_Pager_flush(pg1) == CHIDB_OK);
+
+    /* The other pager catches up when it begins reading */
+    ck_assert(chidb_Pager_beginRead(pg2) == CHIDB_OK);
+    ck_assert_int_eq(pg2->n_pages, MAXPAGES);
+    check_pages(pg2, MAXPAGES, 0);
+    ck_assert(chidb_Pager_endRead(pg2) == CHIDB_OK);
+
+    /* Only one of them writes at a time */
+    ck_assert(chidb_Pager_beginWrite(pg1) == CHIDB_OK);
+    write_pages(pg1, MAXPAGES, 100);
+    ck_assert(chidb_Pager_allocatePage(pg2, &npage) == CHIDB_EBUSY);
+
+    /* With a log, readers don't wait for the writer, and keep reading
+     * what was committed when they began */
+    if(flags & PAGER_WAL)
+    {
+        ck_assert(chidb_Pager_beginRead(pg2) == CHIDB_OK);
+        ck_assert(chidb_Pager_flush(pg1) == CHIDB_OK);
+        check_pages(pg2, MAXPAGES, 0);
+        ck_assert(chidb_Pager_checkpoint(pg1) == CHIDB_OK);
+        check_pages(pg2, MAXPAGES, 0);
+        ck_assert(chidb_Pager_endRead(pg2) == CHIDB_OK);
+    }
+    ck_assert(chidb_Pager_flush(pg1) == CHIDB_OK);
+    ck_assert(chidb_Pager_endWrite(pg1) == CHIDB_OK);
+    ck_assert(chidb_Pager_endWrite(pg1) == CHIDB_EMISUSE);
+
+    /* The pages changed by the other pager are read again */
+    ck_assert(chidb_Pager_beginRead(pg2) == CHIDB_OK);
+    check_pages(pg2, MAXPAGES, 100);
+    ck_assert(chidb_Pager_endRead(pg2) == CHIDB_OK);
+
+    ck_assert(chidb_Pager_beginWrite(pg2) == CHIDB_OK);
+    chidb_Pager_allocatePage(pg2, &npage);
+    write_pages(pg2, MAXPAGES + 1, 200);
+    ck_assert(chidb_Pager_flush(pg2) == CHIDB_OK);
+    ck_assert(chidb_Pager_endWrite(pg2) == CHIDB_OK);
+
+    ck_assert(chidb_Pager_beginRead(pg1) == CHIDB_OK);
+    ck_assert_int_eq(pg1->n_pages, MAXPAGES + 1);
+    check_pages(pg1, MAXPAGES + 1, 200);
+    ck_assert(chidb_Pager_endRead(pg1) == CHIDB_OK);
+
+    /* The last one to close the file removes the shared memory file */
+    chidb_Pager_close(pg1);
+    ck_assert(stat(shm, &st) == 0);
+    chidb_Pager_close(pg2);
+    ck_assert(stat(shm, &st) == -1);
+
+    delete_tmp_file(fname);
+}
+
+START_TEST (test_shared)
+{
+    check_shared(0);
+}
+END_TEST
+
+START_TEST (test_shared_wal)
+{
+    check_shared(PAGER_WAL);
+}
+END_TEST
+
+
+/* An in-memory database never touches a file, but still writes pages
+ * back when the buffer pool runs out of room for them, truncates and
+ * rolls back like one */
+START_TEST (test_memory)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    uint8_t header[100];
+    struct stat st;
+
+    rc = chidb_Pager_open2(&pg, ":memory:", PAGER_MEMORY | PAGER_WAL);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(!(pg->flags & PAGER_WAL));
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_setCacheSize(pg, 2);
+    ck_assert(chidb_Pager_readHeader(pg, header) == CHIDB_NOHEADER);
+
+    for(int j=1; j<=MAXPAGES; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+    write_pages(pg, MAXPAGES, 0);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+    ck_assert_int_eq(pg->mem_pages, MAXPAGES);
+    ck_assert(chidb_Pager_readHeader(pg, header) == CHIDB_OK);
+    ck_assert(stat(":memory:", &st) == -1);
+    check_pages(pg, MAXPAGES, 0);
+
+    ck_assert(chidb_Pager_begin(pg) == CHIDB_OK);
+    chidb_Pager_allocatePage(pg, &npage);
+    write_pages(pg, MAXPAGES + 1, 100);
+    check_pages(pg, MAXPAGES + 1, 100);
+    ck_assert(chidb_Pager_truncate(pg, 2) == CHIDB_OK);
+    ck_assert(chidb_Pager_rollback(pg) == CHIDB_OK);
+    ck_assert_int_eq(pg->n_pages, MAXPAGES);
+    check_pages(pg, MAXPAGES, 0);
+
+    ck_assert(chidb_Pager_begin(pg) == CHIDB_OK);
+    write_pages(pg, MAXPAGES, 200);
+    ck_assert(chidb_Pager_commit(pg) == CHIDB_OK);
+    check_pages(pg, MAXPAGES, 200);
+    ck_assert_int_eq(pg->stats.syncs, 0);
+
+    ck_assert(chidb_Pager_truncate(pg, 2) == CHIDB_OK);
+    ck_assert_int_eq(pg->mem_pages, 2);
+    check_pages(pg, 2, 200);
+
+    rc = chidb_Pager_close(pg);
+    ck_assert(rc == CHIDB_OK);
+}
+END_TEST
+
+
+/* Checks that pages first to first + n - 1 in buf hold values ^ (j + delta) */
+static void check_run(uint8_t *buf, npage_t first, npage_t n, int delta)
+{
+    for(int j=first; j<first+n; j++)
+        for(int k=0; k<NVALUES; k++)
+            if(buf[(j - first) * PAGE_SIZE + pagepos[k]] != (uint8_t) (values[k] ^ (j + delta)))
+            {
+                ck_abort_msg("Incorrect value read from page");
+                return;
+            }
+}
+
+/* Runs of pages are read as they were written back (or as of the
+ * snapshot in use), without going through the buffer pool */
+static void check_readpages(int flags)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    PagerSnapshot *snap = NULL;
+    uint8_t *buf;
+    uint32_t nchanges;
+
+    char *fname = (flags & PAGER_MEMORY) ? NULL : create_tmp_file();
+
+    ck_assert(posix_memalign((void **) &buf, PAGER_BUF_ALIGN, MAXPAGES * PAGE_SIZE) == 0);
+    rc = chidb_Pager_open2(&pg, fname ? fname : ":memory:", flags);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_setCacheSize(pg, 2);
+    for(int j=1; j<=MAXPAGES; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+    write_pages(pg, MAXPAGES, 0);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+
+    ck_assert(chidb_Pager_readPages(pg, 1, MAXPAGES, buf) == CHIDB_OK);
+    check_run(buf, 1, MAXPAGES, 0);
+    ck_assert(chidb_Pager_readPages(pg, 2, MAXPAGES, buf) == CHIDB_EPAGENO);
+    ck_assert(chidb_Pager_readPages(pg, 0, 1, buf) == CHIDB_EPAGENO);
+
+    if(flags & PAGER_WAL)
+        ck_assert(chidb_Pager_beginSnapshot(pg, &snap) == CHIDB_OK);
+    nchanges = chidb_Pager_changes(pg);
+    write_pages(pg, MAXPAGES, 100);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+    ck_assert(chidb_Pager_changes(pg) != nchanges);
+
+    ck_assert(chidb_Pager_readPages(pg, 2, MAXPAGES - 1, buf) == CHIDB_OK);
+    check_run(buf, 2, MAXPAGES - 1, 100);
+    if(snap != NULL)
+    {
+        chidb_Pager_useSnapshot(snap);
+        ck_assert(chidb_Pager_readPages(pg, 1, MAXPAGES, buf) == CHIDB_OK);
+        check_run(buf, 1, MAXPAGES, 0);
+        chidb_Pager_useSnapshot(NULL);
+        chidb_Pager_endSnapshot(pg, snap);
+    }
+
+    chidb_Pager_close(pg);
+    free(buf);
+    if(fname)
+        delete_tmp_file(fname);
+}
+
+START_TEST (test_readpages)
+{
+    check_readpages(0);
+}
+END_TEST
+
+START_TEST (test_readpages_wal)
+{
+    check_readpages(PAGER_WAL);
+}
+END_TEST
+
+START_TEST (test_readpages_memory)
+{
+    check_readpages(PAGER_MEMORY);
+}
+END_TEST
+
+
 Suite* make_pager_suite (void)
 {
     Suite *s = suite_create ("Pager");
@@ -162,6 +1309,67 @@ Suite* make_pager_suite (void)
     tcase_add_test (tc_readwrite, test_readwrite);
     suite_add_tcase (s, tc_readwrite);
 
+    TCase *tc_cache = tcase_create ("Buffer pool");
+    tcase_add_test (tc_cache, test_cache);
+    suite_add_tcase (s, tc_cache);
+
+    TCase *tc_mmap = tcase_create ("Memory-mapped reads");
+    tcase_add_test (tc_mmap, test_mmap);
+    suite_add_tcase (s, tc_mmap);
+
+    TCase *tc_direct = tcase_create ("Direct I/O");
+    tcase_add_test (tc_direct, test_direct);
+    suite_add_tcase (s, tc_direct);
+
+    TCase *tc_wal = tcase_create ("Write-ahead log");
+    tcase_add_test (tc_wal, test_wal);
+    tcase_add_test (tc_wal, test_group_commit);
+    suite_add_tcase (s, tc_wal);
+
+    TCase *tc_prefetch = tcase_create ("Read-ahead");
+    tcase_add_test (tc_prefetch, test_prefetch);
+    suite_add_tcase (s, tc_prefetch);
+
+    TCase *tc_readpages = tcase_create ("Reading runs of pages");
+    tcase_add_test (tc_readpages, test_readpages);
+    tcase_add_test (tc_readpages, test_readpages_wal);
+    tcase_add_test (tc_readpages, test_readpages_memory);
+    suite_add_tcase (s, tc_readpages);
+
+    TCase *tc_stats = tcase_create ("I/O statistics");
+    tcase_add_test (tc_stats, test_stats);
+    suite_add_tcase (s, tc_stats);
+
+    TCase *tc_checksum = tcase_create ("Page checksums");
+    tcase_add_test (tc_checksum, test_checksum);
+    suite_add_tcase (s, tc_checksum);
+
+    TCase *tc_compress = tcase_create ("Page compression");
+    tcase_add_test (tc_compress, test_compress);
+    suite_add_tcase (s, tc_compress);
+
+    TCase *tc_temp = tcase_create ("Scratch files");
+    tcase_add_test (tc_temp, test_temp);
+    suite_add_tcase (s, tc_temp);
+
+    TCase *tc_transaction = tcase_create ("Transactions");
+    tcase_add_test (tc_transaction, test_transaction);
+    tcase_add_test (tc_transaction, test_transaction_wal);
+    suite_add_tcase (s, tc_transaction);
+
+    TCase *tc_snapshot = tcase_create ("Snapshots");
+    tcase_add_test (tc_snapshot, test_snapshot);
+    suite_add_tcase (s, tc_snapshot);
+
+    TCase *tc_shared = tcase_create ("Pagers sharing a file");
+    tcase_add_test (tc_shared, test_shared);
+    tcase_add_test (tc_shared, test_shared_wal);
+    suite_add_tcase (s, tc_shared);
+
+    TCase *tc_memory = tcase_create ("In-memory databases");
+    tcase_add_test (tc_memory, test_memory);
+    suite_add_tcase (s, tc_memory);
+
     return s;
 }
 
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <check.h>
+#include <chidb/chidb.h>
+#include <chisql/chisql.h>
+
+START_TEST (test_context_keywords)
+{
+    chisql_statement_t *stmt;
+    Column_t *col;
+    Expression_t *expr;
+    SRA_t *sra;
+    const char *names[] = {"plan", "query", "include", "with", "limit", "offset", "analyze", "transaction"};
+    int i;
+
+    /* Keywords that can't be where a name is are names there */
+    ck_assert(chisql_parser("CREATE TABLE plan (plan INTEGER, query TEXT, include INTEGER, with INTEGER,"
+                            " limit INTEGER, offset INTEGER, analyze INTEGER, transaction INTEGER);",
+                            &stmt) == CHIDB_OK);
+    ck_assert_int_eq(stmt->type, STMT_CREATE);
+    ck_assert_str_eq(stmt->stmt.create->table->name, "plan");
+    for(col = stmt->stmt.create->table->columns, i = 0; col != NULL; col = col->next, i++)
+        ck_assert_str_eq(col->name, names[i]);
+    ck_assert_int_eq(i, 8);
+    chisql_stmt_free(stmt);
+
+    /* With the spelling they were written with */
+    ck_assert(chisql_parser("SELECT Plan, query FROM plan WHERE plan = 1 LIMIT 2;", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(stmt->type, STMT_SELECT);
+    sra = stmt->stmt.select;
+    ck_assert_int_eq(sra->t, SRA_PROJECT);
+    ck_assert(sra->project.limit != NULL);
+    expr = sra->project.expr_list;
+    ck_assert_str_eq(expr->expr.term.ref->columnName, "Plan");
+    ck_assert_str_eq(expr->next->expr.term.ref->columnName, "query");
+    ck_assert_int_eq(sra->project.sra->t, SRA_SELECT);
+    ck_assert_str_eq(sra->project.sra->select.sra->table.ref->table_name, "plan");
+    chisql_stmt_free(stmt);
+
+    ck_assert(chisql_parser("CREATE INDEX query ON plan (with) INCLUDE (include);", &stmt) == CHIDB_OK);
+    ck_assert_str_eq(stmt->stmt.create->index->name, "query");
+    ck_assert_str_eq(stmt->stmt.create->index->column_name, "with");
+    ck_assert_str_eq(StrList_get(stmt->stmt.create->index->include, 0), "include");
+    chisql_stmt_free(stmt);
+
+    ck_assert(chisql_parser("ANALYZE plan;", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(stmt->type, STMT_ANALYZE);
+    ck_assert_str_eq(stmt->stmt.analyze, "plan");
+    chisql_stmt_free(stmt);
+
+    /* And still keywords where they are keywords */
+    ck_assert(chisql_parser("EXPLAIN QUERY PLAN SELECT plan FROM query;", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(stmt->plan, PLAN_QUERY);
+    ck_assert_str_eq(stmt->stmt.select->project.expr_list->expr.term.ref->columnName, "plan");
+    chisql_stmt_free(stmt);
+
+    ck_assert(chisql_parser("BEGIN TRANSACTION;", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(stmt->type, STMT_BEGIN);
+    chisql_stmt_free(stmt);
+
+    /* A bare alias can't be one, or LIMIT would be taken for an alias */
+    ck_assert(chisql_parser("SELECT a limit FROM t;", &stmt) == CHIDB_EINVALIDSQL);
+}
+END_TEST
+
+#define PARSE_NTHREADS (4)
+#define PARSE_NSTMTS (200)
+
+/* Parses statements that differ in each thread and iteration, and
+ * returns how many of them didn't parse into what they say */
+static void *parse_thread(void *arg)
+{
+    intptr_t id = (intptr_t) arg, nerrors = 0;
+    chisql_statement_t *stmt;
+    char sql[128], table[16];
+    SRA_t *select;
+    Condition_t *cond;
+    Column_t *col;
+
+    sprintf(table, "t%d", (int) id);
+    for (int i = 0; i < PARSE_NSTMTS; i++)
+    {
+        sprintf(sql, "SELECT a, b -- line %d\nFROM t%d /* thread\n%d */ WHERE a = %d;", i, (int) id, (int) id, i);
+        if (chisql_parser(sql, &stmt) != CHIDB_OK)
+            nerrors++;
+        else
+        {
+            select = stmt->stmt.select->project.sra;
+            cond = select->select.cond;
+            if (strcmp(select->select.sra->table.ref->table_name, table) ||
+                cond->t != RA_COND_EQ || cond->cond.comp.expr2->expr.term.val->val.ival != i)
+                nerrors++;
+            chisql_stmt_free(stmt);
+        }
+
+        /* Column sizes are kept between two actions of the parser */
+        sprintf(sql, "CREATE TABLE t%d (a INTEGER, s VARCHAR(%d));", (int) id, (int) id + i + 1);
+        if (chisql_parser(sql, &stmt) != CHIDB_OK)
+            nerrors++;
+        else
+        {
+            col = stmt->stmt.create->table->columns->next;
+            if (strcmp(col->name, "s") || Column_getSize(col) != (size_t) (id + i + 1))
+                nerrors++;
+            chisql_stmt_free(stmt);
+        }
+
+        /* The semicolon ends up in the comment, which ends the input
+         * before the statement does */
+        sprintf(sql, "SELECT a\nFROM t%d\n/* never closed", (int) id);
+        if (chisql_parser(sql, &stmt) != CHIDB_EINVALIDSQL)
+            nerrors++;
+    }
+
+    return (void *) nerrors;
+}
+
+/* Statements can be parsed in several threads at once, each with its
+ * own scanner and arena, with no state shared between them */
+START_TEST (test_concurrent_parse)
+{
+    pthread_t threads[PARSE_NTHREADS];
+    void *nerrors;
+
+    for (intptr_t i = 0; i < PARSE_NTHREADS; i++)
+        ck_assert(pthread_create(&threads[i], NULL, parse_thread, (void *) i) == 0);
+    for (int i = 0; i < PARSE_NTHREADS; i++)
+    {
+        ck_assert(pthread_join(threads[i], &nerrors) == 0);
+        ck_assert_int_eq((intptr_t) nerrors, 0);
+    }
+}
+END_TEST
+
+
+Suite* make_parser_suite (void)
+{
+    Suite *s = suite_create ("Parser");
+
+    TCase *tc_keywords = tcase_create ("Keywords");
+    tcase_add_test (tc_keywords, test_context_keywords);
+    suite_add_tcase (s, tc_keywords);
+
+    TCase *tc_threads = tcase_create ("Threads");
+    tcase_add_test (tc_threads, test_concurrent_parse);
+    suite_add_tcase (s, tc_threads);
+
+    return s;
+}
+
+int main (void)
+{
+    SRunner *sr;
+    int number_failed;
+
+    sr = srunner_create (make_parser_suite ());
+
+    srunner_run_all (sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
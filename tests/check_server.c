@@ -0,0 +1,400 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <check.h>
+#include "check_common.h"
+#include "server/server.h"
+#include "server/protocol.h"
+
+/* Writes the payload of a SERVER_REQ_QUERY, up to its parameters, and
+ * returns its length */
+static size_t put_query(uint8_t *p, const char *sql, uint16_t nparams)
+{
+    size_t len = strlen(sql);
+
+    server_put4(p, len);
+    memcpy(p + 4, sql, len);
+    server_put2(p + 4 + len, nparams);
+
+    return 4 + len + 2;
+}
+
+/* Writes a frame of type SERVER_REQ_QUERY with a payload, and returns
+ * its length */
+static size_t put_frame(uint8_t *p, const uint8_t *payload, size_t n)
+{
+    server_put4(p, n + 1);
+    p[4] = SERVER_REQ_QUERY;
+    memcpy(p + SERVER_FRAME_HEADER, payload, n);
+
+    return SERVER_FRAME_HEADER + n;
+}
+
+/* Writes a frame with a query without parameters */
+static size_t put_query_frame(uint8_t *p, const char *sql)
+{
+    uint8_t payload[256];
+
+    return put_frame(p, payload, put_query(payload, sql, 0));
+}
+
+/* Reads a frame sent by the server, and returns its type (-1 if the
+ * connection ended first) */
+static int read_frame(int fd, uint8_t *payload, uint32_t *n)
+{
+    uint8_t header[SERVER_FRAME_HEADER];
+    size_t got = 0;
+    ssize_t r;
+
+    while (got < SERVER_FRAME_HEADER)
+    {
+        if ((r = recv(fd, header + got, SERVER_FRAME_HEADER - got, 0)) <= 0)
+            return -1;
+        got += r;
+    }
+
+    *n = server_get4(header) - 1;
+    for (got = 0; got < *n; got += r)
+        if ((r = recv(fd, payload + got, *n - got, 0)) <= 0)
+            return -1;
+
+    return header[4];
+}
+
+
+START_TEST (test_parse_query)
+{
+    uint8_t buf[256], *p;
+    server_request_t *req;
+    size_t n;
+
+    /* A NULL, an integer and a text */
+    n = put_query(buf, "SELECT ?, ?, ?;", 3);
+    p = buf + n;
+    *p++ = SERVER_VALUE_NULL;
+    *p++ = SERVER_VALUE_INT;
+    server_put4(p, (uint32_t) -5);
+    p += 4;
+    *p++ = SERVER_VALUE_TEXT;
+    server_put4(p, 3);
+    memcpy(p + 4, "abc", 3);
+    p += 7;
+    n = p - buf;
+
+    req = chidb_server_parse_query(buf, n);
+    ck_assert(req != NULL);
+    ck_assert_str_eq(req->sql, "SELECT ?, ?, ?;");
+    ck_assert_int_eq(req->nparams, 3);
+    ck_assert_int_eq(req->params[0].type, SERVER_VALUE_NULL);
+    ck_assert_int_eq(req->params[1].type, SERVER_VALUE_INT);
+    ck_assert_int_eq(req->params[1].i, -5);
+    ck_assert_int_eq(req->params[2].type, SERVER_VALUE_TEXT);
+    ck_assert_str_eq(req->params[2].s, "abc");
+    chidb_server_request_free(req);
+
+    /* Any shorter, and it is truncated */
+    for (size_t i = 0; i < n; i++)
+        ck_assert(chidb_server_parse_query(buf, i) == NULL);
+
+    /* Any longer, and there are bytes after the last parameter */
+    buf[n] = 0;
+    ck_assert(chidb_server_parse_query(buf, n + 1) == NULL);
+
+    /* The text of the last parameter runs past the end */
+    server_put4(buf + n - 7, 4);
+    ck_assert(chidb_server_parse_query(buf, n) == NULL);
+    server_put4(buf + n - 7, 0xFFFFFFFF);
+    ck_assert(chidb_server_parse_query(buf, n) == NULL);
+
+    /* The statement runs past the end */
+    n = put_query(buf, "SELECT 1;", 0);
+    server_put4(buf, n - 3);
+    ck_assert(chidb_server_parse_query(buf, n) == NULL);
+    server_put4(buf, 0xFFFFFFFF);
+    ck_assert(chidb_server_parse_query(buf, n) == NULL);
+
+    /* A parameter of an unknown type */
+    n = put_query(buf, "SELECT ?;", 1);
+    buf[n] = SERVER_VALUE_TEXT + 1;
+    ck_assert(chidb_server_parse_query(buf, n + 1) == NULL);
+}
+END_TEST
+
+
+/* A connection whose client end is *client, on a server without an event
+ * loop or executors: the requests it reads are only queued */
+static server_conn_t *make_conn(server_t *server, int *client)
+{
+    server_conn_t *conn = calloc(1, sizeof(server_conn_t));
+    int sv[2];
+
+    ck_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+
+    memset(server, 0, sizeof(server_t));
+    pthread_mutex_init(&server->sched_lock, NULL);
+    pthread_cond_init(&server->sched_cond, NULL);
+    server->epfd = -1;
+
+    conn->fd = sv[0];
+    conn->server = server;
+    conn->refs = 1;
+    pthread_mutex_init(&conn->lock, NULL);
+    pthread_cond_init(&conn->drained, NULL);
+    *client = sv[1];
+
+    return conn;
+}
+
+static void free_conn(server_conn_t *conn, int client)
+{
+    server_request_t *req, *next;
+
+    for (req = conn->head; req != NULL; req = next)
+    {
+        next = req->next;
+        chidb_server_request_free(req);
+    }
+    /* No executor takes the requests it queued */
+    conn->refs = 1;
+    chidb_server_conn_release(conn);
+    close(client);
+}
+
+START_TEST (test_read_pipelined)
+{
+    server_t server;
+    server_conn_t *conn;
+    uint8_t buf[256];
+    size_t n;
+    int client;
+
+    conn = make_conn(&server, &client);
+
+    /* Two requests in a single recv run in the order they were sent */
+    n = put_query_frame(buf, "SELECT 1;");
+    n += put_query_frame(buf + n, "SELECT 2;");
+    ck_assert(send(client, buf, n, 0) == (ssize_t) n);
+    ck_assert_int_eq(chidb_server_read(conn), 0);
+    ck_assert(conn->head != NULL && conn->head->next == conn->tail);
+    ck_assert_str_eq(conn->head->sql, "SELECT 1;");
+    ck_assert_str_eq(conn->tail->sql, "SELECT 2;");
+    ck_assert(conn->queued);
+    ck_assert(conn->in.start == conn->in.len);
+
+    free_conn(conn, client);
+}
+END_TEST
+
+START_TEST (test_read_truncated)
+{
+    server_t server;
+    server_conn_t *conn;
+    uint8_t buf[256];
+    size_t n;
+    int client;
+
+    conn = make_conn(&server, &client);
+
+    /* Nothing is submitted until the whole frame is in, whether the
+     * header or the payload is cut short */
+    n = put_query_frame(buf, "SELECT 1;");
+    ck_assert(send(client, buf, 3, 0) == 3);
+    ck_assert_int_eq(chidb_server_read(conn), 0);
+    ck_assert(conn->head == NULL);
+    ck_assert(send(client, buf + 3, 6, 0) == 6);
+    ck_assert_int_eq(chidb_server_read(conn), 0);
+    ck_assert(conn->head == NULL);
+    ck_assert(send(client, buf + 9, n - 9, 0) == (ssize_t) (n - 9));
+    ck_assert_int_eq(chidb_server_read(conn), 0);
+    ck_assert(conn->head != NULL);
+    ck_assert_str_eq(conn->head->sql, "SELECT 1;");
+
+    /* Nor if the length says there is more than was sent */
+    n = put_query_frame(buf, "SELECT 2;");
+    server_put4(buf, n + 100);
+    ck_assert(send(client, buf, n, 0) == (ssize_t) n);
+    ck_assert_int_eq(chidb_server_read(conn), 0);
+    ck_assert(conn->head == conn->tail);
+
+    /* And the connection ends with the frame still incomplete */
+    shutdown(client, SHUT_WR);
+    ck_assert_int_eq(chidb_server_read(conn), -1);
+    ck_assert(conn->head == conn->tail);
+
+    free_conn(conn, client);
+}
+END_TEST
+
+START_TEST (test_read_malformed)
+{
+    server_t server;
+    server_conn_t *conn;
+    uint8_t buf[256], payload[256];
+    size_t n;
+    int client;
+
+    /* A request with a malformed payload closes the connection... */
+    conn = make_conn(&server, &client);
+    n = put_query(payload, "SELECT ?;", 1);
+    payload[n++] = SERVER_VALUE_TEXT + 1;
+    n = put_frame(buf, payload, n);
+    ck_assert(send(client, buf, n, 0) == (ssize_t) n);
+    ck_assert_int_eq(chidb_server_read(conn), -1);
+    ck_assert(conn->head == NULL);
+    free_conn(conn, client);
+
+    /* ...and so does one with trailing bytes in its frame... */
+    conn = make_conn(&server, &client);
+    n = put_query(payload, "SELECT 1;", 0);
+    payload[n++] = 0;
+    n = put_frame(buf, payload, n);
+    ck_assert(send(client, buf, n, 0) == (ssize_t) n);
+    ck_assert_int_eq(chidb_server_read(conn), -1);
+    free_conn(conn, client);
+
+    /* ...an unknown request type... */
+    conn = make_conn(&server, &client);
+    n = put_query_frame(buf, "SELECT 1;");
+    buf[4] = SERVER_RESP_DONE;
+    ck_assert(send(client, buf, n, 0) == (ssize_t) n);
+    ck_assert_int_eq(chidb_server_read(conn), -1);
+    free_conn(conn, client);
+
+    /* ...an empty frame, or one that is too long */
+    conn = make_conn(&server, &client);
+    server_put4(buf, 0);
+    buf[4] = SERVER_REQ_QUERY;
+    ck_assert(send(client, buf, SERVER_FRAME_HEADER, 0) == SERVER_FRAME_HEADER);
+    ck_assert_int_eq(chidb_server_read(conn), -1);
+    free_conn(conn, client);
+
+    conn = make_conn(&server, &client);
+    server_put4(buf, SERVER_MAX_FRAME + 1);
+    ck_assert(send(client, buf, SERVER_FRAME_HEADER, 0) == SERVER_FRAME_HEADER);
+    ck_assert_int_eq(chidb_server_read(conn), -1);
+    free_conn(conn, client);
+}
+END_TEST
+
+
+START_TEST (test_roundtrip)
+{
+    server_t server;
+    server_conn_t *conn;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    struct timeval timeout = {5, 0};
+    struct pollfd pfd = {.events = POLLIN};
+    uint8_t buf[1024], payload[256], *p;
+    uint32_t n;
+    size_t len;
+    chidb *db;
+    int client, type;
+
+    char *fname = create_tmp_file();
+
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert(chidb_server_init(&server, db, 0, 2) == 0);
+    ck_assert(chidb_server_start_executors(&server) == 0);
+
+    /* A client connected over the loopback interface */
+    ck_assert(getsockname(server.listen_fd, (struct sockaddr *) &addr, &addrlen) == 0);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ck_assert(connect(client, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+
+    conn = calloc(1, sizeof(server_conn_t));
+    conn->fd = accept4(server.listen_fd, NULL, NULL, SOCK_NONBLOCK);
+    ck_assert(conn->fd != -1);
+    conn->server = &server;
+    conn->refs = 1;
+    pthread_mutex_init(&conn->lock, NULL);
+    pthread_cond_init(&conn->drained, NULL);
+
+    /* Three pipelined requests: their responses come back in order */
+    len = put_query_frame(buf, "CREATE TABLE t (a INTEGER, b TEXT);");
+    n = put_query(payload, "INSERT INTO t VALUES (?, ?);", 2);
+    p = payload + n;
+    *p++ = SERVER_VALUE_INT;
+    server_put4(p, 42);
+    p += 4;
+    *p++ = SERVER_VALUE_TEXT;
+    server_put4(p, 2);
+    memcpy(p + 4, "hi", 2);
+    p += 6;
+    len += put_frame(buf + len, payload, p - payload);
+    len += put_query_frame(buf + len, "SELEC a FROM t;");
+    ck_assert(send(client, buf, len, 0) == (ssize_t) len);
+
+    /* What the event loop does once the socket is readable */
+    pfd.fd = conn->fd;
+    ck_assert(poll(&pfd, 1, 5000) == 1);
+    ck_assert_int_eq(chidb_server_read(conn), 0);
+
+    for (int i = 0; i < 2; i++)
+    {
+        ck_assert_int_eq(read_frame(client, buf, &n), SERVER_RESP_COLUMNS);
+        ck_assert_int_eq(read_frame(client, buf, &n), SERVER_RESP_DONE);
+        ck_assert_int_eq(n, 0);
+    }
+    type = read_frame(client, buf, &n);
+    ck_assert_int_eq(type, SERVER_RESP_ERROR);
+    ck_assert_int_eq(server_get4(buf), CHIDB_EINVALIDSQL);
+
+    pthread_mutex_lock(&server.sched_lock);
+    server.stopping = true;
+    pthread_cond_broadcast(&server.sched_cond);
+    pthread_mutex_unlock(&server.sched_lock);
+    for (int i = 0; i < server.nthreads; i++)
+        pthread_join(server.threads[i], NULL);
+    free(server.threads);
+
+    chidb_server_conn_release(conn);
+    close(client);
+    close(server.epfd);
+    close(server.listen_fd);
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+Suite* make_server_suite (void)
+{
+    Suite *s = suite_create ("Server");
+
+    TCase *tc_protocol = tcase_create ("Protocol");
+    tcase_add_test (tc_protocol, test_parse_query);
+    tcase_add_test (tc_protocol, test_read_pipelined);
+    tcase_add_test (tc_protocol, test_read_truncated);
+    tcase_add_test (tc_protocol, test_read_malformed);
+    suite_add_tcase (s, tc_protocol);
+
+    TCase *tc_roundtrip = tcase_create ("Round trip");
+    tcase_add_test (tc_roundtrip, test_roundtrip);
+    suite_add_tcase (s, tc_roundtrip);
+
+    return s;
+}
+
+int main (void)
+{
+    SRunner *sr;
+    int number_failed;
+
+    sr = srunner_create (make_server_suite ());
+
+    srunner_run_all (sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <check.h>
 #include "libchidb/util.h"
+#include <chidb/log.h>
 
 #define NVALUES (8)
 
@@ -56,6 +57,96 @@ START_TEST (test_varint32)
 END_TEST
 
 
+START_TEST (test_uvarint32)
+{
+    uint8_t buf[UVARINT32_MAXSIZE];
+    int lens[] = {1,2,2,3,3,3,3,4};
+
+    for(int i=0; i<NVALUES; i++)
+    {
+        uint32_t val;
+        ck_assert_int_eq(putUvarint32(buf, varint32_values[i]), lens[i]);
+        ck_assert_int_eq(uvarint32Len(varint32_values[i]), lens[i]);
+        ck_assert_int_eq(getUvarint32(buf, &val), lens[i]);
+
+        ck_assert_int_eq(val, varint32_values[i]);
+    }
+
+    for(int i=0; i<NVALUES; i++)
+    {
+        uint32_t val;
+        putUvarint32(buf, uint32_values[i]);
+        getUvarint32(buf, &val);
+
+        ck_assert_int_eq(val, uint32_values[i]);
+    }
+    ck_assert_int_eq(uvarint32Len(4294967295), UVARINT32_MAXSIZE);
+}
+END_TEST
+
+
+START_TEST (test_recordtypes)
+{
+    uint8_t buf[4 * 40];
+    uint32_t types[40], out[40], used;
+    int len, n;
+
+    /* Long runs of one-byte types, broken up by strings */
+    for(int i=0; i<40; i++)
+        types[i] = (i % 17 == 16) ? SQL_TEXT + 2 * varint32_values[i % NVALUES] : (i % 4 == 3 ? 4 : i % 4);
+
+    len = putRecordTypes(buf, types, 40);
+    ck_assert_int_eq(len, 40 + 2 * 3);
+
+    ck_assert_int_eq(getRecordTypes(buf, len, out, 40, &used), 40);
+    ck_assert_int_eq(used, len);
+    for(int i=0; i<40; i++)
+        ck_assert_int_eq(out[i], types[i]);
+
+    /* Only max types are decoded */
+    ck_assert_int_eq(getRecordTypes(buf, len, out, 17, &used), 17);
+    ck_assert_int_eq(used, 16 + 4);
+    ck_assert_int_eq(out[16], types[16]);
+
+    /* A varint cut short isn't */
+    n = getRecordTypes(buf, 18, out, 40, &used);
+    ck_assert_int_eq(n, 16);
+    ck_assert_int_eq(used, 16);
+}
+END_TEST
+
+
+START_TEST (test_logring)
+{
+    int n;
+
+    chilog_setloglevel(TRACE);
+
+    /* Nothing to test if TRACE messages were compiled out */
+    if(!CHILOG_ENABLED(TRACE))
+        return;
+
+    chilog_setbackend(CHILOG_BACKEND_RING);
+
+    for(int i=0; i<CHILOG_RING_SIZE + 10; i++)
+        chilog(TRACE, "Message %i", i);
+
+    /* The last 10 messages didn't fit in the ring and were dropped */
+    n = chilog_flush();
+    ck_assert_int_eq(n, CHILOG_RING_SIZE);
+
+    /* Messages below the run-time level never reach the ring */
+    chilog_setloglevel(ERROR);
+    chilog(DEBUG, "Not logged");
+    chilog(ERROR, "Logged");
+    n = chilog_flush();
+    ck_assert_int_eq(n, 1);
+
+    chilog_setbackend(CHILOG_BACKEND_STDOUT);
+}
+END_TEST
+
+
 Suite* make_utils_suite (void)
 {
     Suite *s = suite_create ("Utils");
@@ -64,8 +155,14 @@ Suite* make_utils_suite (void)
     tcase_add_test (tc_integer, test_getput2byte);
     tcase_add_test (tc_integer, test_getput4byte);
     tcase_add_test (tc_integer, test_varint32);
+    tcase_add_test (tc_integer, test_uvarint32);
+    tcase_add_test (tc_integer, test_recordtypes);
     suite_add_tcase (s, tc_integer);
 
+    TCase *tc_log = tcase_create ("Logging");
+    tcase_add_test (tc_log, test_logring);
+    suite_add_tcase (s, tc_log);
+
     return s;
 }
 
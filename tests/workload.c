@@ -0,0 +1,1238 @@
+/*****************************************************************************
+ *
+ *																 chidb
+ *
+ * Workload driver.
+ *
+ * Runs a mix of transactions on a database, from several threads, for
+ * a given time, and reports the throughput and the latency percentiles
+ * of each kind of transaction. It only uses the public API (chidb.h),
+ * so it measures what an application would see. The workloads are:
+ *
+ * - ycsb-a to ycsb-f: the YCSB core workloads, on a usertable of
+ *   ROWS records with four 24-byte fields. Keys follow a (scrambled)
+ *   Zipfian distribution, except for ycsb-d, which favours the latest
+ *   records. chidb has no UPDATE, so an update deletes the record and
+ *   inserts it again, in a transaction.
+ *     a: 50% read, 50% update        d: 95% read latest, 5% insert
+ *     b: 95% read, 5% update         e: 95% scan, 5% insert
+ *     c: 100% read                   f: 50% read, 50% read-modify-write
+ * - tpcc: a small TPC-C-like schema (ROWS warehouses, 10 districts
+ *   each, 300 customers per district, 1000 items), with an index on each
+ *   of the columns the transactions search by, and the New-Order,
+ *   Payment, Order-Status and Stock-Level transactions (45/47/4/4%).
+ *   Composite keys are folded into a single integer primary key.
+ * - scan: analytic queries (aggregates, a join, a top-10) on the tpcc
+ *   schema, with 10% New-Order transactions running alongside them.
+ *
+ * Each thread opens its own connection to the database. The tables are
+ * created and loaded the first time a workload runs on a file, and
+ * reused by later runs (the dataset size is then that of the file). A
+ * transaction that finds the database busy is rolled back and retried;
+ * its latency includes the retries.
+ *
+ * Usage: workload [-w WORKLOAD] [-t THREADS] [-n ROWS] [-d SECONDS]
+ *                 [-s SEED] [-p PARALLEL] [-f FLAG]... DATABASE
+ *
+ * where FLAG is one of wal, mmap, direct, checksum, linkedleaves,
+ * packedindex or compress (see chidb_open2), and PARALLEL is the number of threads
+ * each query may use (see chidb_set_threads). The output is in the same
+ * format as that of tests/bench.c: lines starting with # are comments,
+ * and the others have tab-separated fields, one line per transaction
+ * type plus a total:
+ *
+ *   workload operation count errors retries ops/s p50_us p99_us p999_us max_us
+ *
+\*****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <chidb/chidb.h>
+
+#define WL_DEFAULT_THREADS (4)
+#define WL_DEFAULT_SECONDS (10)
+#define WL_DEFAULT_SEED (1)
+#define WL_DEFAULT_YCSB_ROWS (100000)
+#define WL_DEFAULT_WAREHOUSES (1)
+
+#define WL_LOAD_BATCH (1000)     /* Rows per transaction while loading */
+#define WL_MAX_BACKOFF_US (1000)
+#define WL_MAX_OPS (8)
+
+/* YCSB */
+#define YCSB_FIELDS (4)
+#define YCSB_FIELD_LEN (24)
+#define YCSB_ZIPF_THETA (0.99)
+#define YCSB_MAX_SCAN (100)
+
+/* TPC-C (scaled down) */
+#define TPCC_DISTRICTS (10)
+#define TPCC_CUSTOMERS (300)     /* Per district */
+#define TPCC_ITEMS (1000)
+#define TPCC_ORDERS (300)        /* Per district, when loading */
+#define TPCC_MAX_LINES (15)
+#define TPCC_LAST_NAMES (1000)
+
+
+/*
+ * Latency histograms
+ *
+ * Log-linear buckets: values under 16ns have a bucket each, and every
+ * power of two above is split in 16, so a percentile is off by at
+ * most 1/16th.
+ */
+#define WL_HIST_SUB (16)
+#define WL_HIST_BUCKETS ((64 - 3) * WL_HIST_SUB)
+
+typedef struct wl_hist
+{
+    uint64_t count;
+    uint64_t max_ns;
+    uint64_t buckets[WL_HIST_BUCKETS];
+} wl_hist_t;
+
+static int wl_hist_bucket(uint64_t ns)
+{
+    int e;
+
+    if (ns < WL_HIST_SUB)
+        return ns;
+
+    e = 63 - __builtin_clzll(ns);
+    return (e - 3) * WL_HIST_SUB + ((ns >> (e - 4)) & (WL_HIST_SUB - 1));
+}
+
+/* Smallest value of a bucket */
+static uint64_t wl_hist_value(int bucket)
+{
+    int e = bucket / WL_HIST_SUB + 3;
+
+    if (bucket < WL_HIST_SUB)
+        return bucket;
+
+    return (uint64_t) (WL_HIST_SUB + bucket % WL_HIST_SUB) << (e - 4);
+}
+
+static void wl_hist_add(wl_hist_t *hist, uint64_t ns)
+{
+    hist->count++;
+    hist->buckets[wl_hist_bucket(ns)]++;
+    if (ns > hist->max_ns)
+        hist->max_ns = ns;
+}
+
+static void wl_hist_merge(wl_hist_t *dst, const wl_hist_t *src)
+{
+    dst->count += src->count;
+    if (src->max_ns > dst->max_ns)
+        dst->max_ns = src->max_ns;
+    for (int i = 0; i < WL_HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+}
+
+static uint64_t wl_hist_percentile(const wl_hist_t *hist, double p)
+{
+    uint64_t rank = (uint64_t) ceil(hist->count * p);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < WL_HIST_BUCKETS; i++)
+    {
+        seen += hist->buckets[i];
+        if (seen >= rank && seen > 0)
+            return wl_hist_value(i);
+    }
+
+    return hist->max_ns;
+}
+
+
+/*
+ * Workloads
+ */
+
+typedef struct wl_thread wl_thread_t;
+typedef int (*wl_op_fn)(wl_thread_t *t);
+
+typedef struct wl_op
+{
+    const char *name;
+    int weight;                 /* Percentage of the transactions */
+    wl_op_fn run;
+} wl_op_t;
+
+typedef struct wl_workload
+{
+    const char *name;
+    bool tpcc;                  /* Runs on the tpcc schema (otherwise, on usertable) */
+    bool latest;                /* YCSB reads favour the latest records */
+    wl_op_t ops[WL_MAX_OPS];
+} wl_workload_t;
+
+/* Shared by all the threads */
+typedef struct wl_config
+{
+    const char *filename;
+    const wl_workload_t *workload;
+    int flags;
+    int nthreads;
+    int parallel;
+    int seconds;
+    uint32_t seed;
+
+    uint32_t nrows;             /* YCSB records, or TPC-C warehouses */
+    uint32_t next_key;          /* Next YCSB key, or TPC-C order key */
+    double zipf_zetan;
+    double zipf_eta;
+    bool stop;
+} wl_config_t;
+
+/* Prepared statements (see wl_sql) */
+enum
+{
+    S_YCSB_READ, S_YCSB_DELETE, S_YCSB_INSERT, S_YCSB_SCAN, S_YCSB_MAX,
+
+    S_WAREHOUSE_GET, S_WAREHOUSE_DELETE, S_WAREHOUSE_INSERT,
+    S_DISTRICT_GET, S_DISTRICT_DELETE, S_DISTRICT_INSERT,
+    S_CUSTOMER_GET, S_CUSTOMER_BYNAME, S_CUSTOMER_DELETE, S_CUSTOMER_INSERT,
+    S_ITEM_GET, S_ITEM_INSERT,
+    S_STOCK_GET, S_STOCK_DELETE, S_STOCK_INSERT, S_STOCK_LEVEL,
+    S_ORDER_INSERT, S_ORDER_LAST, S_ORDER_MAX,
+    S_ORDER_LINE_INSERT, S_ORDER_LINES,
+    S_WAREHOUSE_MAX,
+
+    S_REVENUE, S_LOW_STOCK, S_BALANCES, S_ORDER_JOIN, S_TOP_CUSTOMERS,
+
+    S_COUNT
+};
+
+static const char *wl_sql[S_COUNT] =
+{
+    [S_YCSB_READ] = "SELECT * FROM usertable WHERE ycsb_key = ?;",
+    [S_YCSB_DELETE] = "DELETE FROM usertable WHERE ycsb_key = ?;",
+    [S_YCSB_INSERT] = "INSERT INTO usertable VALUES (?, ?, ?, ?, ?);",
+    [S_YCSB_SCAN] = "SELECT * FROM usertable WHERE ycsb_key >= ? LIMIT ?;",
+    [S_YCSB_MAX] = "SELECT MAX(ycsb_key) FROM usertable;",
+
+    [S_WAREHOUSE_GET] = "SELECT w_name, w_tax, w_ytd FROM warehouse WHERE w_id = ?;",
+    [S_WAREHOUSE_DELETE] = "DELETE FROM warehouse WHERE w_id = ?;",
+    [S_WAREHOUSE_INSERT] = "INSERT INTO warehouse VALUES (?, ?, ?, ?);",
+    [S_DISTRICT_GET] = "SELECT d_w_id, d_name, d_tax, d_ytd, d_next_o_id FROM district WHERE d_key = ?;",
+    [S_DISTRICT_DELETE] = "DELETE FROM district WHERE d_key = ?;",
+    [S_DISTRICT_INSERT] = "INSERT INTO district VALUES (?, ?, ?, ?, ?, ?);",
+    [S_CUSTOMER_GET] = "SELECT c_d_key, c_last_id, c_last, c_balance, c_payment_cnt FROM customer WHERE c_key = ?;",
+    [S_CUSTOMER_BYNAME] = "SELECT c_key FROM customer WHERE c_last_id = ? AND c_d_key = ?;",
+    [S_CUSTOMER_DELETE] = "DELETE FROM customer WHERE c_key = ?;",
+    [S_CUSTOMER_INSERT] = "INSERT INTO customer VALUES (?, ?, ?, ?, ?, ?);",
+    [S_ITEM_GET] = "SELECT i_price FROM item WHERE i_id = ?;",
+    [S_ITEM_INSERT] = "INSERT INTO item VALUES (?, ?, ?);",
+    [S_STOCK_GET] = "SELECT s_w_id, s_i_id, s_quantity, s_ytd FROM stock WHERE s_key = ?;",
+    [S_STOCK_DELETE] = "DELETE FROM stock WHERE s_key = ?;",
+    [S_STOCK_INSERT] = "INSERT INTO stock VALUES (?, ?, ?, ?, ?);",
+    [S_STOCK_LEVEL] = "SELECT COUNT(*) FROM stock WHERE s_w_id = ? AND s_quantity < ?;",
+    [S_ORDER_INSERT] = "INSERT INTO orders VALUES (?, ?, ?, ?);",
+    [S_ORDER_LAST] = "SELECT MAX(o_key) FROM orders WHERE o_c_key = ?;",
+    [S_ORDER_MAX] = "SELECT MAX(o_key) FROM orders;",
+    [S_ORDER_LINE_INSERT] = "INSERT INTO order_line VALUES (?, ?, ?, ?, ?);",
+    [S_ORDER_LINES] = "SELECT ol_i_id, ol_quantity, ol_amount FROM order_line WHERE ol_o_key = ?;",
+    [S_WAREHOUSE_MAX] = "SELECT MAX(w_id) FROM warehouse;",
+
+    [S_REVENUE] = "SELECT ol_i_id, SUM(ol_amount) FROM order_line GROUP BY ol_i_id;",
+    [S_LOW_STOCK] = "SELECT COUNT(*) FROM stock WHERE s_quantity < ?;",
+    [S_BALANCES] = "SELECT c_d_key, SUM(c_balance), AVG(c_balance) FROM customer GROUP BY c_d_key;",
+    [S_ORDER_JOIN] = "SELECT COUNT(*), SUM(ol_amount) FROM orders JOIN order_line ON o_key = ol_o_key WHERE o_d_key = ?;",
+    [S_TOP_CUSTOMERS] = "SELECT c_key, c_balance FROM customer ORDER BY c_balance DESC LIMIT 10;",
+};
+
+static const char *ycsb_schema[] =
+{
+    "CREATE TABLE usertable (ycsb_key INTEGER PRIMARY KEY, field0 TEXT, field1 TEXT, field2 TEXT, field3 TEXT);",
+    NULL
+};
+
+static const char *tpcc_schema[] =
+{
+    "CREATE TABLE warehouse (w_id INTEGER PRIMARY KEY, w_name TEXT, w_tax INTEGER, w_ytd INTEGER);",
+    "CREATE TABLE district (d_key INTEGER PRIMARY KEY, d_w_id INTEGER, d_name TEXT, d_tax INTEGER, d_ytd INTEGER, d_next_o_id INTEGER);",
+    "CREATE TABLE customer (c_key INTEGER PRIMARY KEY, c_d_key INTEGER, c_last_id INTEGER, c_last TEXT, c_balance INTEGER, c_payment_cnt INTEGER);",
+    "CREATE TABLE item (i_id INTEGER PRIMARY KEY, i_name TEXT, i_price INTEGER);",
+    "CREATE TABLE stock (s_key INTEGER PRIMARY KEY, s_w_id INTEGER, s_i_id INTEGER, s_quantity INTEGER, s_ytd INTEGER);",
+    "CREATE TABLE orders (o_key INTEGER PRIMARY KEY, o_d_key INTEGER, o_c_key INTEGER, o_ol_cnt INTEGER);",
+    "CREATE TABLE order_line (ol_key INTEGER PRIMARY KEY, ol_o_key INTEGER, ol_i_id INTEGER, ol_quantity INTEGER, ol_amount INTEGER);",
+    NULL
+};
+
+/* Created once the tables are loaded */
+static const char *tpcc_indexes[] =
+{
+    "CREATE INDEX customer_last ON customer(c_last_id);",
+    "CREATE INDEX orders_customer ON orders(o_c_key);",
+    "CREATE INDEX order_line_order ON order_line(ol_o_key);",
+    "CREATE INDEX stock_warehouse ON stock(s_w_id);",
+    NULL
+};
+
+struct wl_thread
+{
+    int id;
+    wl_config_t *config;
+    chidb *db;
+    chidb_stmt *stmts[S_COUNT];  /* Prepared the first time they are used */
+    uint64_t rng;
+    int warehouse;               /* Home warehouse (tpcc) */
+
+    wl_hist_t hist[WL_MAX_OPS];
+    uint64_t errors[WL_MAX_OPS];
+    uint64_t retries[WL_MAX_OPS];
+    int last_error;
+};
+
+
+/*
+ * Random numbers
+ */
+
+/* xorshift64* */
+static uint64_t wl_random(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* Uniform in [lo, hi] */
+static int wl_uniform(wl_thread_t *t, int lo, int hi)
+{
+    return lo + (int) (wl_random(&t->rng) % (uint64_t) (hi - lo + 1));
+}
+
+static double wl_double(wl_thread_t *t)
+{
+    return (wl_random(&t->rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* TPC-C's non-uniform random numbers */
+static int wl_nurand(wl_thread_t *t, int a, int lo, int hi)
+{
+    return (((wl_uniform(t, 0, a) | wl_uniform(t, lo, hi)) + 42) % (hi - lo + 1)) + lo;
+}
+
+static void wl_string(wl_thread_t *t, char *s, int len)
+{
+    for (int i = 0; i < len; i++)
+        s[i] = 'a' + wl_random(&t->rng) % 26;
+    s[len] = '\0';
+}
+
+/* Zipfian ranks in [0, n), as in Gray et al., "Quickly generating
+ * billion-record synthetic databases" (the algorithm YCSB uses) */
+static void wl_zipf_init(wl_config_t *config, uint32_t n)
+{
+    double zeta2 = 1.0 + pow(0.5, YCSB_ZIPF_THETA);
+    double zetan = 0.0;
+
+    for (uint32_t i = 1; i <= n; i++)
+        zetan += 1.0 / pow(i, YCSB_ZIPF_THETA);
+
+    config->zipf_zetan = zetan;
+    config->zipf_eta = (1.0 - pow(2.0 / n, 1.0 - YCSB_ZIPF_THETA)) / (1.0 - zeta2 / zetan);
+}
+
+static uint32_t wl_zipf(wl_thread_t *t)
+{
+    wl_config_t *config = t->config;
+    double u = wl_double(t);
+    double uz = u * config->zipf_zetan;
+
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + pow(0.5, YCSB_ZIPF_THETA))
+        return 1;
+
+    return (uint32_t) (config->nrows * pow(config->zipf_eta * u - config->zipf_eta + 1.0,
+                                            1.0 / (1.0 - YCSB_ZIPF_THETA)));
+}
+
+/* FNV-1a, so that the popular keys are not all next to each other */
+static uint32_t wl_scramble(uint32_t v)
+{
+    uint32_t h = 2166136261u;
+
+    for (int i = 0; i < 4; i++)
+    {
+        h ^= (v >> (i * 8)) & 0xFF;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+
+/*
+ * Running statements
+ */
+
+static uint64_t wl_now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Prepares (if needed) a statement of a thread, and binds the
+ * parameters described by fmt: 'i' for an int, 's' for a string */
+static int wl_bind(wl_thread_t *t, int s, const char *fmt, va_list ap)
+{
+    int rc;
+
+    if (t->stmts[s] == NULL)
+    {
+        rc = chidb_prepare(t->db, wl_sql[s], &t->stmts[s]);
+        if (rc != CHIDB_OK)
+        {
+            t->stmts[s] = NULL;
+            return rc;
+        }
+    }
+
+    for (int i = 0; fmt[i]; i++)
+        if (fmt[i] == 'i')
+            chidb_bind_int(t->stmts[s], i + 1, va_arg(ap, int));
+        else
+            chidb_bind_text(t->stmts[s], i + 1, va_arg(ap, const char *));
+
+    return CHIDB_OK;
+}
+
+/* Runs a statement of a thread to completion (see wl_bind). If out is
+ * not NULL, the first column of the first row is stored in it (and left
+ * alone if there is no row). If rows is not NULL, it is set to the
+ * number of rows.
+ *
+ * Returns CHIDB_DONE or a chidb error code. */
+static int wl_run(wl_thread_t *t, int s, int *out, int *rows, const char *fmt, ...)
+{
+    va_list ap;
+    int rc, n = 0;
+
+    va_start(ap, fmt);
+    rc = wl_bind(t, s, fmt, ap);
+    va_end(ap);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    while ((rc = chidb_step(t->stmts[s])) == CHIDB_ROW)
+    {
+        if (n == 0 && out != NULL)
+            *out = chidb_column_int(t->stmts[s], 0);
+        n++;
+    }
+    chidb_reset(t->stmts[s]);
+
+    if (rows != NULL)
+        *rows = n;
+
+    return rc;
+}
+
+/* Runs a statement of a thread up to its first row, so that its columns
+ * can be read from t->stmts[s] (which must then be reset).
+ *
+ * Returns CHIDB_ROW, CHIDB_DONE if there are no rows (the statement is
+ * then reset), or a chidb error code. */
+static int wl_row(wl_thread_t *t, int s, const char *fmt, ...)
+{
+    va_list ap;
+    int rc;
+
+    va_start(ap, fmt);
+    rc = wl_bind(t, s, fmt, ap);
+    va_end(ap);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    rc = chidb_step(t->stmts[s]);
+    if (rc != CHIDB_ROW)
+        chidb_reset(t->stmts[s]);
+
+    return rc;
+}
+
+/* Runs a statement that isn't one of wl_sql */
+static int wl_exec(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+    int rc;
+
+    rc = chidb_prepare(db, sql, &stmt);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    while ((rc = chidb_step(stmt)) == CHIDB_ROW)
+        ;
+    chidb_finalize(stmt);
+
+    return rc;
+}
+
+#define WL_CHECK(call) do { int __rc = (call); if (__rc != CHIDB_DONE) return __rc; } while (0)
+
+
+/*
+ * YCSB
+ */
+
+static uint32_t ycsb_key(wl_thread_t *t)
+{
+    uint32_t nkeys = __atomic_load_n(&t->config->next_key, __ATOMIC_RELAXED);
+    uint32_t rank = wl_zipf(t);
+
+    if (t->config->workload->latest)
+        return rank < nkeys ? nkeys - 1 - rank : 0;
+
+    return wl_scramble(rank) % nkeys;
+}
+
+static int ycsb_write(wl_thread_t *t, uint32_t key)
+{
+    char fields[YCSB_FIELDS][YCSB_FIELD_LEN + 1];
+
+    for (int i = 0; i < YCSB_FIELDS; i++)
+        wl_string(t, fields[i], YCSB_FIELD_LEN);
+
+    return wl_run(t, S_YCSB_INSERT, NULL, NULL, "issss", key, fields[0], fields[1], fields[2], fields[3]);
+}
+
+static int ycsb_read(wl_thread_t *t)
+{
+    return wl_run(t, S_YCSB_READ, NULL, NULL, "i", ycsb_key(t));
+}
+
+static int ycsb_update(wl_thread_t *t)
+{
+    uint32_t key = ycsb_key(t);
+    int rc;
+
+    if ((rc = chidb_begin(t->db)) != CHIDB_OK)
+        return rc;
+    WL_CHECK(wl_run(t, S_YCSB_DELETE, NULL, NULL, "i", key));
+    WL_CHECK(ycsb_write(t, key));
+
+    return chidb_commit(t->db);
+}
+
+static int ycsb_rmw(wl_thread_t *t)
+{
+    uint32_t key = ycsb_key(t);
+    int rc;
+
+    if ((rc = chidb_begin(t->db)) != CHIDB_OK)
+        return rc;
+    WL_CHECK(wl_run(t, S_YCSB_READ, NULL, NULL, "i", key));
+    WL_CHECK(wl_run(t, S_YCSB_DELETE, NULL, NULL, "i", key));
+    WL_CHECK(ycsb_write(t, key));
+
+    return chidb_commit(t->db);
+}
+
+static int ycsb_insert(wl_thread_t *t)
+{
+    uint32_t key = __atomic_fetch_add(&t->config->next_key, 1, __ATOMIC_RELAXED);
+
+    return ycsb_write(t, key);
+}
+
+static int ycsb_scan(wl_thread_t *t)
+{
+    return wl_run(t, S_YCSB_SCAN, NULL, NULL, "ii", ycsb_key(t), wl_uniform(t, 1, YCSB_MAX_SCAN));
+}
+
+static int ycsb_load(wl_thread_t *t, uint32_t nrows)
+{
+    int rc;
+
+    for (uint32_t key = 0; key < nrows; key++)
+    {
+        if (key % WL_LOAD_BATCH == 0 && (rc = chidb_begin(t->db)) != CHIDB_OK)
+            return rc;
+
+        WL_CHECK(ycsb_write(t, key));
+
+        if ((key + 1) % WL_LOAD_BATCH == 0 || key + 1 == nrows)
+            if ((rc = chidb_commit(t->db)) != CHIDB_OK)
+                return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/*
+ * TPC-C
+ *
+ * Keys of the rows whose primary key is made of several columns
+ */
+#define TPCC_DKEY(w, d) (((w) - 1) * TPCC_DISTRICTS + (d))
+#define TPCC_CKEY(dkey, c) (((dkey) - 1) * TPCC_CUSTOMERS + (c))
+#define TPCC_SKEY(w, i) (((w) - 1) * TPCC_ITEMS + (i))
+#define TPCC_OLKEY(o, l) ((o) * 16 + (l))
+
+static const char *tpcc_syllables[] =
+{
+    "BAR", "OUGHT", "ABLE", "PRI", "PRES", "ESE", "ANTI", "CALLY", "ATION", "EING"
+};
+
+static void tpcc_last_name(int n, char *s)
+{
+    sprintf(s, "%s%s%s", tpcc_syllables[n / 100], tpcc_syllables[(n / 10) % 10], tpcc_syllables[n % 10]);
+}
+
+/* chidb has no UPDATE: a row is changed by deleting it and inserting it
+ * again. These run inside the transaction of their caller. */
+static int tpcc_set_district(wl_thread_t *t, int dkey, int delta_ytd, int delta_next)
+{
+    chidb_stmt *stmt;
+    int w, tax, ytd, next;
+    char name[16];
+    int rc;
+
+    if ((rc = wl_row(t, S_DISTRICT_GET, "i", dkey)) != CHIDB_ROW)
+        return rc;
+    stmt = t->stmts[S_DISTRICT_GET];
+    w = chidb_column_int(stmt, 0);
+    snprintf(name, sizeof(name), "%s", chidb_column_text(stmt, 1));
+    tax = chidb_column_int(stmt, 2);
+    ytd = chidb_column_int(stmt, 3);
+    next = chidb_column_int(stmt, 4);
+    chidb_reset(stmt);
+
+    WL_CHECK(wl_run(t, S_DISTRICT_DELETE, NULL, NULL, "i", dkey));
+
+    return wl_run(t, S_DISTRICT_INSERT, NULL, NULL, "iisiii", dkey, w, name, tax, ytd + delta_ytd, next + delta_next);
+}
+
+static int tpcc_new_order(wl_thread_t *t)
+{
+    int w = t->warehouse;
+    int dkey = TPCC_DKEY(w, wl_uniform(t, 1, TPCC_DISTRICTS));
+    int ckey = TPCC_CKEY(dkey, wl_nurand(t, 1023, 1, TPCC_CUSTOMERS));
+    int nlines = wl_uniform(t, 5, TPCC_MAX_LINES);
+    int okey = __atomic_fetch_add(&t->config->next_key, 1, __ATOMIC_RELAXED);
+    int rc;
+
+    if ((rc = chidb_begin(t->db)) != CHIDB_OK)
+        return rc;
+
+    WL_CHECK(wl_run(t, S_WAREHOUSE_GET, NULL, NULL, "i", w));
+    WL_CHECK(tpcc_set_district(t, dkey, 0, 1));
+    WL_CHECK(wl_run(t, S_CUSTOMER_GET, NULL, NULL, "i", ckey));
+    WL_CHECK(wl_run(t, S_ORDER_INSERT, NULL, NULL, "iiii", okey, dkey, ckey, nlines));
+
+    for (int l = 1; l <= nlines; l++)
+    {
+        int item = wl_nurand(t, 8191, 1, TPCC_ITEMS);
+        int skey = TPCC_SKEY(w, item);
+        int quantity = wl_uniform(t, 1, 10);
+        int price = 0, stock, ytd;
+
+        WL_CHECK(wl_run(t, S_ITEM_GET, &price, NULL, "i", item));
+
+        rc = wl_row(t, S_STOCK_GET, "i", skey);
+        if (rc == CHIDB_DONE)
+            continue;
+        if (rc != CHIDB_ROW)
+            return rc;
+        stock = chidb_column_int(t->stmts[S_STOCK_GET], 2);
+        ytd = chidb_column_int(t->stmts[S_STOCK_GET], 3);
+        chidb_reset(t->stmts[S_STOCK_GET]);
+
+        stock = stock >= quantity + 10 ? stock - quantity : stock - quantity + 91;
+
+        WL_CHECK(wl_run(t, S_STOCK_DELETE, NULL, NULL, "i", skey));
+        WL_CHECK(wl_run(t, S_STOCK_INSERT, NULL, NULL, "iiiii", skey, w, item, stock, ytd + quantity));
+        WL_CHECK(wl_run(t, S_ORDER_LINE_INSERT, NULL, NULL, "iiiii", TPCC_OLKEY(okey, l), okey, item, quantity, quantity * price));
+    }
+
+    return chidb_commit(t->db);
+}
+
+static int tpcc_payment(wl_thread_t *t)
+{
+    int w = t->warehouse;
+    int dkey = TPCC_DKEY(w, wl_uniform(t, 1, TPCC_DISTRICTS));
+    int amount = wl_uniform(t, 100, 500000);
+    int ckey, rc;
+    chidb_stmt *stmt;
+    char name[16], last[32];
+    int tax, ytd, clast, balance, cnt;
+
+    if ((rc = chidb_begin(t->db)) != CHIDB_OK)
+        return rc;
+
+    /* Warehouse */
+    rc = wl_row(t, S_WAREHOUSE_GET, "i", w);
+    if (rc != CHIDB_ROW && rc != CHIDB_DONE)
+        return rc;
+    if (rc == CHIDB_ROW)
+    {
+        stmt = t->stmts[S_WAREHOUSE_GET];
+        snprintf(name, sizeof(name), "%s", chidb_column_text(stmt, 0));
+        tax = chidb_column_int(stmt, 1);
+        ytd = chidb_column_int(stmt, 2);
+        chidb_reset(stmt);
+
+        WL_CHECK(wl_run(t, S_WAREHOUSE_DELETE, NULL, NULL, "i", w));
+        WL_CHECK(wl_run(t, S_WAREHOUSE_INSERT, NULL, NULL, "isii", w, name, tax, ytd + amount));
+    }
+
+    WL_CHECK(tpcc_set_district(t, dkey, amount, 0));
+
+    /* Customer, by last name 60% of the time */
+    ckey = TPCC_CKEY(dkey, wl_nurand(t, 1023, 1, TPCC_CUSTOMERS));
+    if (wl_uniform(t, 1, 100) <= 60)
+        WL_CHECK(wl_run(t, S_CUSTOMER_BYNAME, &ckey, NULL, "ii", wl_nurand(t, 255, 0, TPCC_LAST_NAMES - 1), dkey));
+
+    rc = wl_row(t, S_CUSTOMER_GET, "i", ckey);
+    if (rc != CHIDB_ROW && rc != CHIDB_DONE)
+        return rc;
+    if (rc == CHIDB_ROW)
+    {
+        stmt = t->stmts[S_CUSTOMER_GET];
+        clast = chidb_column_int(stmt, 1);
+        snprintf(last, sizeof(last), "%s", chidb_column_text(stmt, 2));
+        balance = chidb_column_int(stmt, 3);
+        cnt = chidb_column_int(stmt, 4);
+        chidb_reset(stmt);
+
+        WL_CHECK(wl_run(t, S_CUSTOMER_DELETE, NULL, NULL, "i", ckey));
+        WL_CHECK(wl_run(t, S_CUSTOMER_INSERT, NULL, NULL, "iiisii", ckey, dkey, clast, last, balance - amount, cnt + 1));
+    }
+
+    return chidb_commit(t->db);
+}
+
+static int tpcc_order_status(wl_thread_t *t)
+{
+    int dkey = TPCC_DKEY(t->warehouse, wl_uniform(t, 1, TPCC_DISTRICTS));
+    int ckey = TPCC_CKEY(dkey, wl_nurand(t, 1023, 1, TPCC_CUSTOMERS));
+    int okey = -1;
+
+    WL_CHECK(wl_run(t, S_CUSTOMER_GET, NULL, NULL, "i", ckey));
+    WL_CHECK(wl_run(t, S_ORDER_LAST, &okey, NULL, "i", ckey));
+    if (okey < 0)
+        return CHIDB_DONE;
+
+    return wl_run(t, S_ORDER_LINES, NULL, NULL, "i", okey);
+}
+
+static int tpcc_stock_level(wl_thread_t *t)
+{
+    return wl_run(t, S_STOCK_LEVEL, NULL, NULL, "ii", t->warehouse, wl_uniform(t, 10, 20));
+}
+
+static int tpcc_load(wl_thread_t *t, uint32_t nwarehouses)
+{
+    char s[32];
+    int rc, n = 0;
+
+    if ((rc = chidb_begin(t->db)) != CHIDB_OK)
+        return rc;
+
+/* Commits every WL_LOAD_BATCH rows */
+#define TPCC_LOAD_ROW(call) do {                                        \
+        WL_CHECK(call);                                                 \
+        if (++n % WL_LOAD_BATCH == 0 &&                                 \
+            ((rc = chidb_commit(t->db)) != CHIDB_OK ||                  \
+             (rc = chidb_begin(t->db)) != CHIDB_OK))                    \
+            return rc;                                                  \
+    } while (0)
+
+    for (int i = 1; i <= TPCC_ITEMS; i++)
+    {
+        wl_string(t, s, 14);
+        TPCC_LOAD_ROW(wl_run(t, S_ITEM_INSERT, NULL, NULL, "isi", i, s, wl_uniform(t, 100, 10000)));
+    }
+
+    for (int w = 1; w <= nwarehouses; w++)
+    {
+        wl_string(t, s, 10);
+        TPCC_LOAD_ROW(wl_run(t, S_WAREHOUSE_INSERT, NULL, NULL, "isii", w, s, wl_uniform(t, 0, 2000), 30000000));
+
+        for (int i = 1; i <= TPCC_ITEMS; i++)
+            TPCC_LOAD_ROW(wl_run(t, S_STOCK_INSERT, NULL, NULL, "iiiii", TPCC_SKEY(w, i), w, i, wl_uniform(t, 10, 100), 0));
+
+        for (int d = 1; d <= TPCC_DISTRICTS; d++)
+        {
+            int dkey = TPCC_DKEY(w, d);
+
+            wl_string(t, s, 10);
+            TPCC_LOAD_ROW(wl_run(t, S_DISTRICT_INSERT, NULL, NULL, "iisiii", dkey, w, s, wl_uniform(t, 0, 2000), 3000000, TPCC_ORDERS + 1));
+
+            for (int c = 1; c <= TPCC_CUSTOMERS; c++)
+            {
+                /* The first thousand customers of TPC-C get every last
+                 * name once; here, the first TPCC_CUSTOMERS of them */
+                int last = c <= TPCC_LAST_NAMES ? c - 1 : wl_nurand(t, 255, 0, TPCC_LAST_NAMES - 1);
+
+                tpcc_last_name(last, s);
+                TPCC_LOAD_ROW(wl_run(t, S_CUSTOMER_INSERT, NULL, NULL, "iiisii", TPCC_CKEY(dkey, c), dkey, last, s, -1000, 1));
+            }
+
+            for (int o = 1; o <= TPCC_ORDERS; o++)
+            {
+                int okey = (dkey - 1) * TPCC_ORDERS + o;
+                int nlines = wl_uniform(t, 5, TPCC_MAX_LINES);
+
+                TPCC_LOAD_ROW(wl_run(t, S_ORDER_INSERT, NULL, NULL, "iiii", okey, dkey,
+                                     TPCC_CKEY(dkey, wl_uniform(t, 1, TPCC_CUSTOMERS)), nlines));
+
+                for (int l = 1; l <= nlines; l++)
+                    TPCC_LOAD_ROW(wl_run(t, S_ORDER_LINE_INSERT, NULL, NULL, "iiiii", TPCC_OLKEY(okey, l), okey,
+                                         wl_uniform(t, 1, TPCC_ITEMS), 5, wl_uniform(t, 1, 999999)));
+            }
+        }
+    }
+
+#undef TPCC_LOAD_ROW
+
+    if ((rc = chidb_commit(t->db)) != CHIDB_OK)
+        return rc;
+
+    for (int i = 0; tpcc_indexes[i]; i++)
+        WL_CHECK(wl_exec(t->db, tpcc_indexes[i]));
+
+    return CHIDB_OK;
+}
+
+
+/*
+ * Analytic queries (on the tpcc schema)
+ */
+
+static int scan_revenue(wl_thread_t *t)
+{
+    return wl_run(t, S_REVENUE, NULL, NULL, "");
+}
+
+static int scan_low_stock(wl_thread_t *t)
+{
+    return wl_run(t, S_LOW_STOCK, NULL, NULL, "i", wl_uniform(t, 10, 50));
+}
+
+static int scan_balances(wl_thread_t *t)
+{
+    return wl_run(t, S_BALANCES, NULL, NULL, "");
+}
+
+static int scan_order_join(wl_thread_t *t)
+{
+    return wl_run(t, S_ORDER_JOIN, NULL, NULL, "i", TPCC_DKEY(t->warehouse, wl_uniform(t, 1, TPCC_DISTRICTS)));
+}
+
+static int scan_top_customers(wl_thread_t *t)
+{
+    return wl_run(t, S_TOP_CUSTOMERS, NULL, NULL, "");
+}
+
+
+static const wl_workload_t wl_workloads[] =
+{
+    { "ycsb-a", false, false, { {"read", 50, ycsb_read}, {"update", 50, ycsb_update} } },
+    { "ycsb-b", false, false, { {"read", 95, ycsb_read}, {"update", 5, ycsb_update} } },
+    { "ycsb-c", false, false, { {"read", 100, ycsb_read} } },
+    { "ycsb-d", false, true,  { {"read", 95, ycsb_read}, {"insert", 5, ycsb_insert} } },
+    { "ycsb-e", false, false, { {"scan", 95, ycsb_scan}, {"insert", 5, ycsb_insert} } },
+    { "ycsb-f", false, false, { {"read", 50, ycsb_read}, {"rmw", 50, ycsb_rmw} } },
+    { "tpcc",   true,  false, { {"new_order", 45, tpcc_new_order}, {"payment", 47, tpcc_payment},
+                                {"order_status", 4, tpcc_order_status}, {"stock_level", 4, tpcc_stock_level} } },
+    { "scan",   true,  false, { {"revenue", 20, scan_revenue}, {"low_stock", 25, scan_low_stock},
+                                {"balances", 20, scan_balances}, {"order_join", 20, scan_order_join},
+                                {"top_customers", 5, scan_top_customers}, {"new_order", 10, tpcc_new_order} } },
+};
+
+#define WL_NWORKLOADS (sizeof(wl_workloads) / sizeof(wl_workloads[0]))
+
+
+/*
+ * Threads
+ */
+
+static int wl_connect(wl_thread_t *t)
+{
+    int rc = chidb_open2(t->config->filename, &t->db, 0, t->config->flags);
+
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if (t->config->parallel > 0)
+        chidb_set_threads(t->db, t->config->parallel);
+
+    return CHIDB_OK;
+}
+
+static void wl_disconnect(wl_thread_t *t)
+{
+    for (int s = 0; s < S_COUNT; s++)
+        if (t->stmts[s] != NULL)
+        {
+            chidb_finalize(t->stmts[s]);
+            t->stmts[s] = NULL;
+        }
+
+    chidb_close(t->db);
+}
+
+/* Runs a transaction until it doesn't find the database busy, and
+ * records its latency. */
+static void wl_transaction(wl_thread_t *t, int op)
+{
+    const wl_op_t *wop = &t->config->workload->ops[op];
+    uint64_t start = wl_now_ns();
+    unsigned int backoff = 1;
+    int rc;
+
+    for (;;)
+    {
+        rc = wop->run(t);
+
+        if (rc != CHIDB_OK && rc != CHIDB_DONE && !chidb_get_autocommit(t->db))
+            chidb_rollback(t->db);
+
+        if (rc != CHIDB_EBUSY)
+            break;
+
+        /* Stopping: the transaction doesn't count */
+        if (__atomic_load_n(&t->config->stop, __ATOMIC_RELAXED))
+            return;
+
+        t->retries[op]++;
+        usleep(backoff);
+        if (backoff < WL_MAX_BACKOFF_US)
+            backoff *= 2;
+    }
+
+    if (rc != CHIDB_OK && rc != CHIDB_DONE)
+    {
+        t->errors[op]++;
+        t->last_error = rc;
+        return;
+    }
+
+    wl_hist_add(&t->hist[op], wl_now_ns() - start);
+}
+
+static int wl_pick(wl_thread_t *t)
+{
+    int r = wl_uniform(t, 1, 100);
+    int op;
+
+    for (op = 0; op < WL_MAX_OPS - 1 && t->config->workload->ops[op + 1].run != NULL; op++)
+    {
+        r -= t->config->workload->ops[op].weight;
+        if (r <= 0)
+            break;
+    }
+
+    return op;
+}
+
+static void *wl_thread_main(void *arg)
+{
+    wl_thread_t *t = arg;
+
+    while (!__atomic_load_n(&t->config->stop, __ATOMIC_RELAXED))
+        wl_transaction(t, wl_pick(t));
+
+    return NULL;
+}
+
+
+/*
+ * Setting up the database
+ */
+
+/* Creates and loads the tables of the workload, unless the file has
+ * them already, and sets config->nrows and config->next_key from what
+ * the file has. */
+static int wl_setup(wl_config_t *config)
+{
+    wl_thread_t t;
+    int max = -1;
+    int rc;
+    bool tpcc = config->workload->tpcc;
+
+    memset(&t, 0, sizeof(t));
+    t.config = config;
+    t.rng = config->seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    if ((rc = wl_connect(&t)) != CHIDB_OK)
+        return rc;
+
+    /* The query fails if the table doesn't exist */
+    rc = wl_run(&t, tpcc ? S_WAREHOUSE_MAX : S_YCSB_MAX, &max, NULL, "");
+    if (rc != CHIDB_DONE)
+    {
+        const char **schema = tpcc ? tpcc_schema : ycsb_schema;
+        uint64_t start = wl_now_ns();
+
+        rc = CHIDB_OK;
+        for (int i = 0; schema[i] && rc == CHIDB_OK; i++)
+            if ((rc = wl_exec(t.db, schema[i])) == CHIDB_DONE)
+                rc = CHIDB_OK;
+
+        if (rc == CHIDB_OK)
+            rc = tpcc ? tpcc_load(&t, config->nrows) : ycsb_load(&t, config->nrows);
+
+        if (rc == CHIDB_OK)
+            printf("# loaded %u %s in %.1f s\n", config->nrows, tpcc ? "warehouses" : "records",
+                   (wl_now_ns() - start) / 1e9);
+    }
+    else
+    {
+        config->nrows = max + (tpcc ? 0 : 1);
+        printf("# using the %u %s in the file\n", config->nrows, tpcc ? "warehouses" : "records");
+        rc = CHIDB_OK;
+    }
+
+    if (rc == CHIDB_OK && tpcc)
+    {
+        max = 0;
+        rc = wl_run(&t, S_ORDER_MAX, &max, NULL, "");
+        config->next_key = max + 1;
+        rc = rc == CHIDB_DONE ? CHIDB_OK : rc;
+    }
+    else if (rc == CHIDB_OK)
+        config->next_key = config->nrows;
+
+    wl_disconnect(&t);
+
+    return rc;
+}
+
+static void wl_report(wl_config_t *config, wl_thread_t *threads, double seconds)
+{
+    const wl_workload_t *w = config->workload;
+    wl_hist_t *total = calloc(1, sizeof(wl_hist_t));
+    uint64_t total_errors = 0, total_retries = 0;
+
+    printf("# workload\toperation\tcount\terrors\tretries\tops/s\tp50_us\tp99_us\tp999_us\tmax_us\n");
+
+    for (int op = 0; op <= WL_MAX_OPS; op++)
+    {
+        wl_hist_t *hist;
+        uint64_t errors = 0, retries = 0;
+        const char *name;
+
+        if (op < WL_MAX_OPS && w->ops[op].run == NULL)
+            continue;
+
+        if (op < WL_MAX_OPS)
+        {
+            hist = calloc(1, sizeof(wl_hist_t));
+            for (int i = 0; i < config->nthreads; i++)
+            {
+                wl_hist_merge(hist, &threads[i].hist[op]);
+                errors += threads[i].errors[op];
+                retries += threads[i].retries[op];
+            }
+            wl_hist_merge(total, hist);
+            total_errors += errors;
+            total_retries += retries;
+            name = w->ops[op].name;
+        }
+        else
+        {
+            hist = total;
+            errors = total_errors;
+            retries = total_retries;
+            name = "total";
+        }
+
+        printf("%s\t%s\t%lu\t%lu\t%lu\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\n", w->name, name,
+               (unsigned long) hist->count, (unsigned long) errors, (unsigned long) retries,
+               hist->count / seconds,
+               wl_hist_percentile(hist, 0.50) / 1e3,
+               wl_hist_percentile(hist, 0.99) / 1e3,
+               wl_hist_percentile(hist, 0.999) / 1e3,
+               hist->max_ns / 1e3);
+
+        if (hist != total)
+            free(hist);
+    }
+
+    free(total);
+}
+
+
+static const struct
+{
+    const char *name;
+    int flag;
+} wl_flags[] =
+{
+    { "wal", CHIDB_OPEN_WAL },
+    { "direct", CHIDB_OPEN_DIRECT },
+    { "mmap", CHIDB_OPEN_MMAP },
+    { "checksum", CHIDB_OPEN_CHECKSUM },
+    { "linkedleaves", CHIDB_OPEN_LINKEDLEAVES },
+    { "packedindex", CHIDB_OPEN_PACKEDINDEX },
+    { "compress", CHIDB_OPEN_COMPRESS },
+};
+
+static void wl_usage(FILE *f)
+{
+    fprintf(f, "Usage: workload [-w WORKLOAD] [-t THREADS] [-n ROWS] [-d SECONDS]\n"
+               "                [-s SEED] [-p PARALLEL] [-f FLAG]... DATABASE\n"
+               "Workloads:");
+    for (int i = 0; i < WL_NWORKLOADS; i++)
+        fprintf(f, " %s", wl_workloads[i].name);
+    fprintf(f, "\nFlags:");
+    for (int i = 0; i < sizeof(wl_flags) / sizeof(wl_flags[0]); i++)
+        fprintf(f, " %s", wl_flags[i].name);
+    fprintf(f, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    wl_config_t config;
+    wl_thread_t *threads;
+    pthread_t *tids;
+    const char *workload = "ycsb-a";
+    uint64_t start;
+    double seconds;
+    int rows = 0;
+    int opt, rc;
+
+    memset(&config, 0, sizeof(config));
+    config.nthreads = WL_DEFAULT_THREADS;
+    config.seconds = WL_DEFAULT_SECONDS;
+    config.seed = WL_DEFAULT_SEED;
+
+    while ((opt = getopt(argc, argv, "w:t:n:d:s:p:f:h")) != -1)
+        switch (opt)
+        {
+        case 'w':
+            workload = optarg;
+            break;
+        case 't':
+            config.nthreads = atoi(optarg);
+            break;
+        case 'n':
+            rows = atoi(optarg);
+            break;
+        case 'd':
+            config.seconds = atoi(optarg);
+            break;
+        case 's':
+            config.seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            config.parallel = atoi(optarg);
+            break;
+        case 'f':
+        {
+            int i, n = sizeof(wl_flags) / sizeof(wl_flags[0]);
+            for (i = 0; i < n && strcmp(optarg, wl_flags[i].name); i++)
+                ;
+            if (i == n)
+            {
+                fprintf(stderr, "ERROR: Unknown flag %s\n", optarg);
+                wl_usage(stderr);
+                exit(1);
+            }
+            config.flags |= wl_flags[i].flag;
+            break;
+        }
+        case 'h':
+            wl_usage(stdout);
+            exit(0);
+        default:
+            wl_usage(stderr);
+            exit(1);
+        }
+
+    for (int i = 0; i < WL_NWORKLOADS; i++)
+        if (!strcmp(workload, wl_workloads[i].name))
+            config.workload = &wl_workloads[i];
+
+    if (optind >= argc || config.workload == NULL || config.nthreads < 1 || config.seconds < 1 || rows < 0)
+    {
+        wl_usage(stderr);
+        exit(1);
+    }
+
+    config.filename = argv[optind];
+    config.nrows = rows > 0 ? rows : config.workload->tpcc ? WL_DEFAULT_WAREHOUSES : WL_DEFAULT_YCSB_ROWS;
+
+    printf("# workload=%s threads=%i seconds=%i seed=%u parallel=%i flags=", config.workload->name,
+           config.nthreads, config.seconds, config.seed, config.parallel);
+    for (int i = 0, n = 0; i < sizeof(wl_flags) / sizeof(wl_flags[0]); i++)
+        if (config.flags & wl_flags[i].flag)
+            printf("%s%s", n++ ? "," : "", wl_flags[i].name);
+    printf("\n");
+
+    rc = wl_setup(&config);
+    if (rc != CHIDB_OK)
+    {
+        fprintf(stderr, "ERROR: Could not set up %s (error %i)\n", config.filename, rc);
+        exit(1);
+    }
+
+    if (!config.workload->tpcc)
+        wl_zipf_init(&config, config.nrows);
+
+    threads = calloc(config.nthreads, sizeof(wl_thread_t));
+    tids = calloc(config.nthreads, sizeof(pthread_t));
+
+    for (int i = 0; i < config.nthreads; i++)
+    {
+        threads[i].id = i;
+        threads[i].config = &config;
+        threads[i].rng = (config.seed + i + 1) * 0x9E3779B97F4A7C15ULL;
+        threads[i].warehouse = i % config.nrows + 1;
+
+        if ((rc = wl_connect(&threads[i])) != CHIDB_OK)
+        {
+            fprintf(stderr, "ERROR: Could not open %s (error %i)\n", config.filename, rc);
+            exit(1);
+        }
+    }
+
+    start = wl_now_ns();
+    for (int i = 0; i < config.nthreads; i++)
+        pthread_create(&tids[i], NULL, wl_thread_main, &threads[i]);
+
+    sleep(config.seconds);
+    __atomic_store_n(&config.stop, true, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < config.nthreads; i++)
+        pthread_join(tids[i], NULL);
+    seconds = (wl_now_ns() - start) / 1e9;
+
+    wl_report(&config, threads, seconds);
+
+    for (int i = 0; i < config.nthreads; i++)
+    {
+        if (threads[i].last_error)
+            fprintf(stderr, "Thread %i: last error was %i\n", i, threads[i].last_error);
+        wl_disconnect(&threads[i]);
+    }
+
+    free(threads);
+    free(tids);
+
+    return 0;
+}